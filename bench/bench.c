@@ -0,0 +1,148 @@
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+
+/* MARK: Allocation counting *//**
+ * @name Allocation counting
+ * On glibc the allocator entry points are interposed so that every
+ * allocation made by the library during a sample can be counted.
+ * Elsewhere allocations are not counted and reported as -1.
+ * @{
+ */
+
+static long _allocs = 0;
+
+#ifdef __GLIBC__
+#define BENCH_COUNT_ALLOCS
+
+extern void * __libc_malloc( size_t size );
+extern void * __libc_calloc( size_t count, size_t size );
+extern void * __libc_realloc( void * ptr, size_t size );
+
+void * malloc( size_t size ) {
+  __sync_fetch_and_add( &_allocs, 1 );
+  return __libc_malloc( size );
+}
+
+void * calloc( size_t count, size_t size ) {
+  __sync_fetch_and_add( &_allocs, 1 );
+  return __libc_calloc( count, size );
+}
+
+void * realloc( void * ptr, size_t size ) {
+  __sync_fetch_and_add( &_allocs, 1 );
+  return __libc_realloc( ptr, size );
+}
+#endif
+
+/** @} */
+
+/* MARK: Sampling *//**
+ * @name Sampling
+ * @{
+ */
+
+static double _elapsed_ns( struct timespec * start, struct timespec * end ) {
+  return (double) ( end->tv_sec - start->tv_sec ) * 1000000000.0
+       + (double) ( end->tv_nsec - start->tv_nsec );
+}
+
+/**
+ * @brief Advance to the next sample.
+ * Stop timing the running sample (if any) and start timing the
+ * next one. The first sample is used to warm up caches and pools
+ * and is not recorded.
+ * @param bench The benchmark state.
+ * @retval 1 if another sample of @c bench->batch operations has to be run.
+ * @retval 0 if all samples were taken.
+ */
+int BenchSample( struct Bench * bench ) {
+  struct timespec now;
+  double ns;
+  clock_gettime( CLOCK_MONOTONIC, &now );
+  if( !bench->warm ) {
+    /* untimed warm-up round */
+    bench->warm = 1;
+    return 1;
+  }
+  if( bench->sample > 0 ) {
+    ns = _elapsed_ns( &(bench->start), &now );
+    bench->ns_per_op[bench->sample-1] = ns / bench->batch;
+    bench->ns_total += ns;
+    bench->allocs   += _allocs - bench->allocs_start;
+  }
+  if( bench->sample == bench->samples ) {
+    return 0;
+  }
+  bench->sample++;
+  bench->allocs_start = _allocs;
+  clock_gettime( CLOCK_MONOTONIC, &(bench->start) );
+  return 1;
+}
+
+/** @} */
+
+/* MARK: Reporting *//**
+ * @name Reporting
+ * @{
+ */
+
+static int _compare_double( const void * a, const void * b ) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return ( x > y ) - ( x < y );
+}
+
+static double _percentile( double * sorted, size_t n, int percent ) {
+  return sorted[ ( ( n - 1 ) * percent ) / 100 ];
+}
+
+/**
+ * @brief Run a benchmark and write its results.
+ * Results are written as one JSON object per line with the
+ * mean time per operation, the number of allocations per operation
+ * and the median and 99th percentile of the per-operation time
+ * of all samples.
+ * @param name    The name of the benchmark.
+ * @param func    The benchmark function.
+ * @param samples The number of samples to take.
+ * @param batch   The number of operations per sample.
+ * @param out     The stream to write the results to.
+ * @retval 0  on success.
+ * @retval >0 if the benchmark failed.
+ */
+int BenchRun( const char * name, BenchFn * func, size_t samples, size_t batch, FILE * out ) {
+  struct Bench bench;
+  double allocs_per_op = -1;
+  int result;
+
+  memset( &bench, 0, sizeof(bench) );
+  bench.name      = name;
+  bench.samples   = samples;
+  bench.batch     = batch;
+  bench.ns_per_op = malloc( sizeof(double) * samples );
+  if( bench.ns_per_op == NULL ) {
+    return 1;
+  }
+
+  result = (*func)( &bench );
+  if( result || bench.sample != bench.samples ) {
+    fprintf( out, "{\"bench\":\"%s\",\"error\":true}\n", name );
+    free( bench.ns_per_op );
+    return 1;
+  }
+
+  qsort( bench.ns_per_op, samples, sizeof(double), &_compare_double );
+#ifdef BENCH_COUNT_ALLOCS
+  allocs_per_op = (double) bench.allocs / ( samples * batch );
+#endif
+  fprintf( out, "{\"bench\":\"%s\",\"ops\":%lu,\"ns_per_op\":%.2f,\"allocs_per_op\":%.3f,"
+                "\"p50_ns\":%.2f,\"p99_ns\":%.2f}\n",
+           name, (unsigned long) ( samples * batch ), bench.ns_total / ( samples * batch ),
+           allocs_per_op, _percentile( bench.ns_per_op, samples, 50 ),
+           _percentile( bench.ns_per_op, samples, 99 ) );
+  fflush( out );
+  free( bench.ns_per_op );
+  return 0;
+}
+
+/** @} */
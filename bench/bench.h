@@ -0,0 +1,46 @@
+#ifndef MIDIKIT_BENCH_BENCH_H
+#define MIDIKIT_BENCH_BENCH_H
+#include <stdio.h>
+#include <time.h>
+
+#define BENCH_DEFAULT_SAMPLES 1000
+#define BENCH_DEFAULT_BATCH   100
+
+/**
+ * @brief State of a running benchmark.
+ * A benchmark function sets up its fixtures, then runs
+ * @c bench->batch operations for every iteration of
+ * @c while( BenchSample( bench ) ) and tears its fixtures
+ * down again. Only the loop body is timed.
+ */
+struct Bench {
+  const char * name;
+  size_t samples;
+  size_t batch;
+  size_t sample;
+  int warm;
+  double * ns_per_op;
+  struct timespec start;
+  long allocs_start;
+  long allocs;
+  double ns_total;
+};
+
+/**
+ * @brief A benchmark function.
+ * @param bench The benchmark state.
+ * @retval 0  on success.
+ * @retval >0 if the benchmark could not be run.
+ */
+typedef int BenchFn( struct Bench * bench );
+
+int BenchSample( struct Bench * bench );
+int BenchRun( const char * name, BenchFn * func, size_t samples, size_t batch, FILE * out );
+
+#define BENCH_ASSERT( expr ) \
+  if( !(expr) ) { \
+    fprintf( stderr, "%s:%d: " #expr " failed.\n", __FILE__, __LINE__ ); \
+    return 1; \
+  }
+
+#endif
@@ -0,0 +1,59 @@
+#include <sys/time.h>
+#include "bench.h"
+#include "midi/clock.h"
+
+/**
+ * Benchmark reading the current time from a clock.
+ */
+static int _get_now( struct Bench * bench, MIDISamplingRate rate ) {
+  struct MIDIClock * clock = MIDIClockCreate( rate );
+  MIDITimestamp now, last = 0;
+  size_t i;
+
+  BENCH_ASSERT( clock != NULL );
+  while( BenchSample( bench ) ) {
+    for( i=0; i<bench->batch; i++ ) {
+      MIDIClockGetNow( clock, &now );
+    }
+    BENCH_ASSERT( now >= last );
+    last = now;
+  }
+  MIDIClockRelease( clock );
+  return 0;
+}
+
+/**
+ * Benchmark reading the current time at the default sampling rate.
+ */
+int bench_clock_get_now( struct Bench * bench ) {
+  return _get_now( bench, MIDI_SAMPLING_RATE_DEFAULT );
+}
+
+/**
+ * Benchmark reading the current time at 44.1KHz, where the clock's
+ * fraction does not reduce to a plain division.
+ */
+int bench_clock_get_now_44k1( struct Bench * bench ) {
+  return _get_now( bench, MIDI_SAMPLING_RATE_44K1HZ );
+}
+
+/**
+ * Reference: read the time with gettimeofday() and convert it
+ * with an exact multiplication and division, like the exact path
+ * of the clock does.
+ */
+int bench_clock_exact_reference( struct Bench * bench ) {
+  volatile unsigned long long numer = 441, denom = 10000;
+  unsigned long long now = 0;
+  struct timeval tv;
+  size_t i;
+
+  while( BenchSample( bench ) ) {
+    for( i=0; i<bench->batch; i++ ) {
+      gettimeofday( &tv, NULL );
+      now = ( ( tv.tv_sec * 1000000ULL + tv.tv_usec ) * numer ) / denom;
+    }
+  }
+  BENCH_ASSERT( now > 0 );
+  return 0;
+}
@@ -0,0 +1,71 @@
+#include <stdlib.h>
+#include "bench.h"
+#include "midi/message.h"
+#include "midi/compact.h"
+
+/* a block of notes, controllers and clocks on all channels */
+static struct MIDICompactMessage * _block_create( size_t count ) {
+  static const unsigned char statuses[] = { 0x90, 0x80, 0xb0, 0x90, 0xe0, 0x90, 0x80, 0xf8 };
+  struct MIDICompactMessage * block = malloc( sizeof( struct MIDICompactMessage ) * count );
+  size_t i;
+  if( block == NULL ) return NULL;
+  for( i=0; i<count; i++ ) {
+    block[i].bytes[0]     = statuses[i%8] | ( ( statuses[i%8] < 0xf0 ) ? ( i % 16 ) : 0 );
+    block[i].bytes[1]     = ( i * 7 ) % 128;
+    block[i].bytes[2]     = ( i * 13 ) % 128;
+    block[i].flags        = 0;
+    block[i].timestamp    = i;
+    block[i].sysex_offset = 0;
+    block[i].sysex_size   = 0;
+  }
+  return block;
+}
+
+/**
+ * Benchmark filtering a block of compact messages by status, channel
+ * and key range. The batch size is the block size.
+ */
+int bench_compact_filter( struct Bench * bench ) {
+  struct MIDICompactMessage * block, * out;
+  struct MIDICompactFilter filter;
+  size_t written = 0;
+
+  block = _block_create( bench->batch );
+  out   = malloc( sizeof( struct MIDICompactMessage ) * bench->batch );
+  BENCH_ASSERT( block != NULL && out != NULL );
+  MIDICompactFilterInit( &filter );
+  MIDICompactFilterSetStatus( &filter, MIDI_STATUS_PITCH_WHEEL_CHANGE, MIDI_OFF );
+  MIDICompactFilterSetChannel( &filter, MIDI_CHANNEL_10, MIDI_OFF );
+  MIDICompactFilterSetKeyRange( &filter, 36, 96 );
+  while( BenchSample( bench ) ) {
+    MIDICompactFilterApply( &filter, bench->batch, block, out, &written );
+  }
+  BENCH_ASSERT( written > 0 && written < bench->batch );
+  free( out );
+  free( block );
+  return 0;
+}
+
+/**
+ * Benchmark remapping channels, transposing and scaling velocities of
+ * a block of compact messages in place.
+ */
+int bench_compact_transform( struct Bench * bench ) {
+  struct MIDICompactMessage * block;
+  unsigned char map[16];
+  int c, t = 1;
+
+  block = _block_create( bench->batch );
+  BENCH_ASSERT( block != NULL );
+  for( c=0; c<16; c++ ) map[c] = c;
+  map[MIDI_CHANNEL_1] = MIDI_CHANNEL_10;
+  map[MIDI_CHANNEL_2] = MIDI_CHANNEL_11;
+  while( BenchSample( bench ) ) {
+    MIDICompactRemapChannels( bench->batch, block, &(map[0]) );
+    MIDICompactTranspose( bench->batch, block, t );
+    MIDICompactScaleVelocity( bench->batch, block, 250 );
+    t = -t;
+  }
+  free( block );
+  return 0;
+}
@@ -0,0 +1,115 @@
+#include <stdlib.h>
+#include "bench.h"
+#include "midi/message.h"
+#include "midi/device.h"
+
+static size_t _received = 0;
+
+static int _receive_non( struct MIDIDevice * device, MIDIChannel channel, MIDIKey key, MIDIVelocity velocity ) {
+  _received++;
+  return 0;
+}
+
+static int _receive_batch( struct MIDIDevice * device, MIDIStatus status, MIDIChannel channel,
+                           size_t count, struct MIDICompactMessage * messages ) {
+  _received += count;
+  return 0;
+}
+
+static struct MIDIDeviceDelegate _bench_device = {
+  NULL, /* recv_nof  */
+  &_receive_non,
+  NULL, /* recv_pkp  */
+  NULL, /* recv_cc   */
+  NULL, /* recv_pc   */
+  NULL, /* recv_cp   */
+  NULL, /* recv_pwc  */
+  NULL, /* recv_sx   */
+  NULL, /* recv_tcqf */
+  NULL, /* recv_spp  */
+  NULL, /* recv_ss   */
+  NULL, /* recv_tr   */
+  NULL, /* recv_eox  */
+  NULL  /* recv_rt   */
+};
+
+/**
+ * Benchmark dispatching a received note on message to a device delegate.
+ */
+int bench_device_receive( struct Bench * bench ) {
+  static unsigned char note_on[] = { 0x90, 60, 100 };
+  struct MIDIDevice * device;
+  struct MIDIMessage * message;
+  size_t i, read;
+
+  device = MIDIDeviceCreate( &_bench_device );
+  BENCH_ASSERT( device != NULL );
+  message = MIDIMessageCreate( 0 );
+  BENCH_ASSERT( message != NULL );
+  BENCH_ASSERT( MIDIMessageDecode( message, 3, &(note_on[0]), &read ) == 0 );
+
+  while( BenchSample( bench ) ) {
+    for( i=0; i<bench->batch; i++ ) {
+      MIDIDeviceReceive( device, message );
+    }
+  }
+  BENCH_ASSERT( _received > 0 );
+
+  MIDIMessageRelease( message );
+  MIDIDeviceRelease( device );
+  return 0;
+}
+
+/**
+ * Benchmark dispatching a received compact note on message to a device delegate.
+ */
+int bench_device_receive_compact( struct Bench * bench ) {
+  struct MIDICompactMessage compact = { { 0x90, 60, 100 }, 0, 0, 0, 0 };
+  struct MIDIDevice * device;
+  size_t i;
+
+  device = MIDIDeviceCreate( &_bench_device );
+  BENCH_ASSERT( device != NULL );
+  _received = 0;
+
+  while( BenchSample( bench ) ) {
+    for( i=0; i<bench->batch; i++ ) {
+      MIDIDeviceReceiveCompact( device, 0, &compact, NULL );
+    }
+  }
+  BENCH_ASSERT( _received > 0 );
+
+  MIDIDeviceRelease( device );
+  return 0;
+}
+
+/**
+ * Benchmark dispatching a block of compact note on messages to a
+ * batch-aware device delegate.
+ */
+int bench_device_receive_batch( struct Bench * bench ) {
+  struct MIDICompactMessage compact = { { 0x90, 60, 100 }, 0, 0, 0, 0 };
+  struct MIDICompactMessage * block;
+  struct MIDIDeviceDelegate delegate = _bench_device;
+  struct MIDIDevice * device;
+  size_t i;
+
+  block = malloc( sizeof( struct MIDICompactMessage ) * bench->batch );
+  BENCH_ASSERT( block != NULL );
+  for( i=0; i<bench->batch; i++ ) {
+    block[i] = compact;
+  }
+  delegate.recv_batch = &_receive_batch;
+  device = MIDIDeviceCreate( &delegate );
+  BENCH_ASSERT( device != NULL );
+  _received = 0;
+
+  while( BenchSample( bench ) ) {
+    MIDIDeviceReceiveBatch( device, 0, bench->batch, block, NULL );
+  }
+  BENCH_ASSERT( _received > 0 );
+
+  MIDIDeviceRelease( device );
+  free( block );
+  return 0;
+}
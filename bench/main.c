@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdlib.h>
+#include "bench.h"
+#include "midi/midi.h"
+
+extern int bench_message_encode( struct Bench * bench );
+extern int bench_message_encode_running_status( struct Bench * bench );
+extern int bench_message_encode_stream( struct Bench * bench );
+extern int bench_message_decode( struct Bench * bench );
+extern int bench_message_decode_running_status( struct Bench * bench );
+extern int bench_message_format_detect( struct Bench * bench );
+extern int bench_message_decode_mixed( struct Bench * bench );
+extern int bench_message_decode_stream( struct Bench * bench );
+extern int bench_message_queue_push_pop( struct Bench * bench );
+extern int bench_message_queue_ring_push_pop( struct Bench * bench );
+extern int bench_port_send_fanout( struct Bench * bench );
+extern int bench_port_send_fanout_32( struct Bench * bench );
+extern int bench_device_receive( struct Bench * bench );
+extern int bench_device_receive_compact( struct Bench * bench );
+extern int bench_device_receive_batch( struct Bench * bench );
+extern int bench_rtpmidi_loopback( struct Bench * bench );
+extern int bench_clock_get_now( struct Bench * bench );
+extern int bench_clock_get_now_44k1( struct Bench * bench );
+extern int bench_clock_exact_reference( struct Bench * bench );
+extern int bench_compact_filter( struct Bench * bench );
+extern int bench_compact_transform( struct Bench * bench );
+extern int bench_timer_clock_jitter( struct Bench * bench );
+
+/* a multiple of the number of messages in the mixed stream */
+#define BENCH_MIXED_BATCH 104
+
+static struct {
+  char * name;
+  BenchFn * func;
+  size_t batch;
+} _benches[] = {
+  { "message_encode",                &bench_message_encode,                BENCH_DEFAULT_BATCH },
+  { "message_encode_running_status", &bench_message_encode_running_status, BENCH_DEFAULT_BATCH },
+  { "message_encode_stream",         &bench_message_encode_stream,         BENCH_DEFAULT_BATCH },
+  { "message_decode",                &bench_message_decode,                BENCH_DEFAULT_BATCH },
+  { "message_decode_running_status", &bench_message_decode_running_status, BENCH_DEFAULT_BATCH },
+  { "message_format_detect",         &bench_message_format_detect,         BENCH_DEFAULT_BATCH },
+  { "message_decode_mixed",          &bench_message_decode_mixed,          BENCH_DEFAULT_BATCH },
+  { "message_decode_stream",         &bench_message_decode_stream,         BENCH_MIXED_BATCH },
+  { "message_queue_push_pop",        &bench_message_queue_push_pop,        BENCH_DEFAULT_BATCH },
+  { "message_queue_ring_push_pop",   &bench_message_queue_ring_push_pop,   BENCH_DEFAULT_BATCH },
+  { "port_send_fanout",              &bench_port_send_fanout,              BENCH_DEFAULT_BATCH },
+  { "port_send_fanout_32",           &bench_port_send_fanout_32,           BENCH_DEFAULT_BATCH },
+  { "device_receive",                &bench_device_receive,                BENCH_DEFAULT_BATCH },
+  { "device_receive_compact",        &bench_device_receive_compact,        BENCH_DEFAULT_BATCH },
+  { "device_receive_batch",          &bench_device_receive_batch,          BENCH_DEFAULT_BATCH },
+  { "clock_get_now",                 &bench_clock_get_now,                 BENCH_DEFAULT_BATCH },
+  { "clock_get_now_44k1",            &bench_clock_get_now_44k1,            BENCH_DEFAULT_BATCH },
+  { "clock_exact_reference",         &bench_clock_exact_reference,         BENCH_DEFAULT_BATCH },
+  /* one block of compact messages per sample */
+  { "compact_filter_1k",             &bench_compact_filter,                1000 },
+  { "compact_filter_64k",            &bench_compact_filter,                65536 },
+  { "compact_filter_1m",             &bench_compact_filter,                1048576 },
+  { "compact_transform_1k",          &bench_compact_transform,             1000 },
+  { "compact_transform_64k",         &bench_compact_transform,             65536 },
+  { "compact_transform_1m",          &bench_compact_transform,             1048576 },
+  /* one round trip per sample to get a latency distribution */
+  { "rtpmidi_loopback",              &bench_rtpmidi_loopback,              1 },
+  /* one timing clock per sample, run with -n 72000 to measure ten minutes */
+  { "timer_clock_jitter",            &bench_timer_clock_jitter,            1 }
+};
+
+/**
+ * Only pass errors on, so that the verbose logging of debug builds
+ * does not end up in the measurements.
+ */
+static int _bench_log( int channel, const char * fmt, ... ) {
+  va_list ap;
+  int result;
+  if( ! ( channel & MIDI_LOG_ERROR ) ) return 0;
+  va_start( ap, fmt );
+  result = vfprintf( stderr, fmt, ap );
+  va_end( ap );
+  return result;
+}
+
+/**
+ * Usage: bench_main [-n samples] [name ...]
+ * Run all benchmarks, or only those whose name starts with one of
+ * the given names, and write their results as JSON lines to stdout.
+ */
+int main( int argc, char *argv[] ) {
+  size_t i, samples = BENCH_DEFAULT_SAMPLES;
+  int a, selected, filtered = 0, failures = 0;
+
+  MIDILogger = &_bench_log;
+  for( a=1; a<argc; a++ ) {
+    if( strcmp( argv[a], "-n" ) == 0 && a+1 < argc ) {
+      samples = strtoul( argv[++a], NULL, 10 );
+      argv[a-1] = argv[a] = NULL;
+    } else {
+      filtered = 1;
+    }
+  }
+  if( samples == 0 ) {
+    samples = 1;
+  }
+
+  for( i=0; i<(sizeof(_benches)/sizeof(_benches[0])); i++ ) {
+    selected = !filtered;
+    for( a=1; a<argc && !selected; a++ ) {
+      if( argv[a] != NULL && strncmp( _benches[i].name, argv[a], strlen( argv[a] ) ) == 0 ) {
+        selected = 1;
+      }
+    }
+    if( selected && BenchRun( _benches[i].name, _benches[i].func, samples, _benches[i].batch, stdout ) ) {
+      failures++;
+    }
+  }
+  return failures;
+}
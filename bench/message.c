@@ -0,0 +1,124 @@
+#include "bench.h"
+#include "midi/message.h"
+
+static unsigned char _notes[] = { 0x90, 60, 100, 0x90, 64, 100, 0x90, 67, 100, 0x80, 60, 64 };
+
+/**
+ * Benchmark encoding a note on message.
+ */
+int bench_message_encode( struct Bench * bench ) {
+  struct MIDIMessage * message;
+  unsigned char buffer[4];
+  size_t i, written, read;
+
+  message = MIDIMessageCreate( 0 );
+  BENCH_ASSERT( message != NULL );
+  BENCH_ASSERT( MIDIMessageDecode( message, 3, &(_notes[0]), &read ) == 0 );
+  while( BenchSample( bench ) ) {
+    for( i=0; i<bench->batch; i++ ) {
+      MIDIMessageEncode( message, sizeof(buffer), &(buffer[0]), &written );
+    }
+  }
+  MIDIMessageRelease( message );
+  return 0;
+}
+
+/**
+ * Benchmark encoding a stream of note messages with running status.
+ */
+int bench_message_encode_running_status( struct Bench * bench ) {
+  struct MIDIMessage * messages[4];
+  MIDIRunningStatus status = 0;
+  unsigned char buffer[4];
+  size_t i, written, read;
+
+  for( i=0; i<4; i++ ) {
+    messages[i] = MIDIMessageCreate( 0 );
+    BENCH_ASSERT( messages[i] != NULL );
+    BENCH_ASSERT( MIDIMessageDecode( messages[i], 3, &(_notes[i*3]), &read ) == 0 );
+  }
+  while( BenchSample( bench ) ) {
+    for( i=0; i<bench->batch; i++ ) {
+      MIDIMessageEncodeRunningStatus( messages[i%4], &status, sizeof(buffer), &(buffer[0]), &written );
+    }
+  }
+  for( i=0; i<4; i++ ) {
+    MIDIMessageRelease( messages[i] );
+  }
+  return 0;
+}
+
+/**
+ * Benchmark encoding a stream of note messages with delta times in
+ * batches of @c BENCH_DEFAULT_BATCH messages.
+ */
+int bench_message_encode_stream( struct Bench * bench ) {
+  struct MIDIMessage * notes[4];
+  struct MIDIMessage * messages[BENCH_DEFAULT_BATCH];
+  MIDIVarLen deltas[BENCH_DEFAULT_BATCH];
+  MIDIRunningStatus status;
+  unsigned char buffer[4*BENCH_DEFAULT_BATCH];
+  size_t i, count, written, read;
+
+  for( i=0; i<4; i++ ) {
+    notes[i] = MIDIMessageCreate( 0 );
+    BENCH_ASSERT( notes[i] != NULL );
+    BENCH_ASSERT( MIDIMessageDecode( notes[i], 3, &(_notes[i*3]), &read ) == 0 );
+  }
+  for( i=0; i<BENCH_DEFAULT_BATCH; i++ ) {
+    messages[i] = notes[i%4];
+    deltas[i]   = i % 3;
+  }
+  while( BenchSample( bench ) ) {
+    for( i=0; i<bench->batch; i+=BENCH_DEFAULT_BATCH ) {
+      status = 0;
+      MIDIMessageEncodeTimedStream( sizeof(buffer), &(buffer[0]), &status, BENCH_DEFAULT_BATCH,
+                                    &(messages[0]), &(deltas[0]), &count, &written );
+    }
+  }
+  BENCH_ASSERT( count == BENCH_DEFAULT_BATCH );
+  for( i=0; i<4; i++ ) {
+    MIDIMessageRelease( notes[i] );
+  }
+  return 0;
+}
+
+/**
+ * Benchmark decoding a note on message.
+ */
+int bench_message_decode( struct Bench * bench ) {
+  struct MIDIMessage * message;
+  size_t i, read;
+
+  message = MIDIMessageCreate( 0 );
+  BENCH_ASSERT( message != NULL );
+  while( BenchSample( bench ) ) {
+    for( i=0; i<bench->batch; i++ ) {
+      MIDIMessageDecode( message, 3, &(_notes[0]), &read );
+    }
+  }
+  MIDIMessageRelease( message );
+  return 0;
+}
+
+/**
+ * Benchmark decoding a stream of note messages with running status.
+ */
+int bench_message_decode_running_status( struct Bench * bench ) {
+  static unsigned char stream[] = { 0x90, 60, 100, 64, 100, 67, 100, 60, 0 };
+  static size_t offsets[] = { 0, 3, 5, 7 };
+  static size_t sizes[]   = { 3, 2, 2, 2 };
+  struct MIDIMessage * message;
+  MIDIRunningStatus status = 0;
+  size_t i, read;
+
+  message = MIDIMessageCreate( 0 );
+  BENCH_ASSERT( message != NULL );
+  while( BenchSample( bench ) ) {
+    for( i=0; i<bench->batch; i++ ) {
+      MIDIMessageDecodeRunningStatus( message, &status, sizes[i%4], &(stream[offsets[i%4]]), &read );
+    }
+  }
+  MIDIMessageRelease( message );
+  return 0;
+}
@@ -0,0 +1,66 @@
+#include "bench.h"
+#include "midi/message.h"
+#include "midi/message_format.h"
+
+/* one message of every format, in the order they appear on the wire most often */
+static unsigned char _mixed[] = {
+  0xf8, 0x90, 60, 100, 0xb0, 7, 90, 0xe0, 0, 64, 0xd0, 80, 0xc0, 5,
+  0xa0, 60, 70, 0x80, 60, 64, 0xf1, 0x12, 0xf2, 0, 16, 0xf3, 3, 0xf6, 0xfe
+};
+static size_t _mixed_offsets[] = { 0, 1, 4, 7, 10, 12, 14, 17, 20, 22, 25, 27, 28 };
+#define BENCH_MIXED_COUNT (sizeof(_mixed_offsets)/sizeof(_mixed_offsets[0]))
+
+/**
+ * Benchmark detecting the format of messages of every kind.
+ */
+int bench_message_format_detect( struct Bench * bench ) {
+  size_t i, found = 0;
+  while( BenchSample( bench ) ) {
+    for( i=0; i<bench->batch; i++ ) {
+      found += ( MIDIMessageFormatDetect( &(_mixed[_mixed_offsets[i%BENCH_MIXED_COUNT]]) ) != NULL );
+    }
+  }
+  BENCH_ASSERT( found > 0 );
+  return 0;
+}
+
+/**
+ * Benchmark decoding a stream that contains messages of every kind.
+ */
+int bench_message_decode_mixed( struct Bench * bench ) {
+  struct MIDIMessage * message;
+  MIDIRunningStatus status = 0;
+  size_t i, j, read;
+
+  message = MIDIMessageCreate( 0 );
+  BENCH_ASSERT( message != NULL );
+  while( BenchSample( bench ) ) {
+    for( i=0; i<bench->batch; i++ ) {
+      j = i % BENCH_MIXED_COUNT;
+      MIDIMessageDecodeRunningStatus( message, &status, sizeof(_mixed) - _mixed_offsets[j],
+                                      &(_mixed[_mixed_offsets[j]]), &read );
+    }
+  }
+  MIDIMessageRelease( message );
+  return 0;
+}
+
+/**
+ * Benchmark decoding the same stream in one pass into compact messages.
+ * One operation is one decoded message.
+ */
+int bench_message_decode_stream( struct Bench * bench ) {
+  struct MIDICompactMessage messages[BENCH_MIXED_COUNT];
+  MIDIRunningStatus status;
+  size_t i, count, read;
+
+  while( BenchSample( bench ) ) {
+    for( i=0; i<bench->batch; i+=BENCH_MIXED_COUNT ) {
+      status = 0;
+      MIDIMessageDecodeStream( sizeof(_mixed), &(_mixed[0]), &status, BENCH_MIXED_COUNT,
+                               &(messages[0]), &count, &read );
+    }
+  }
+  BENCH_ASSERT( count == BENCH_MIXED_COUNT );
+  return 0;
+}
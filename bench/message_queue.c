@@ -0,0 +1,36 @@
+#include "bench.h"
+#include "midi/message.h"
+#include "midi/message_queue.h"
+
+static int _push_pop( struct Bench * bench, struct MIDIMessageQueue * queue ) {
+  struct MIDIMessage * message, * popped;
+  size_t i;
+
+  BENCH_ASSERT( queue != NULL );
+  message = MIDIMessageCreate( MIDI_STATUS_TIMING_CLOCK );
+  BENCH_ASSERT( message != NULL );
+  while( BenchSample( bench ) ) {
+    for( i=0; i<bench->batch; i++ ) {
+      MIDIMessageQueuePush( queue, message );
+      MIDIMessageQueuePop( queue, &popped );
+      MIDIMessageRelease( popped );
+    }
+  }
+  MIDIMessageRelease( message );
+  MIDIMessageQueueRelease( queue );
+  return 0;
+}
+
+/**
+ * Benchmark pushing and popping a message on a list queue.
+ */
+int bench_message_queue_push_pop( struct Bench * bench ) {
+  return _push_pop( bench, MIDIMessageQueueCreate() );
+}
+
+/**
+ * Benchmark pushing and popping a message on a ring queue.
+ */
+int bench_message_queue_ring_push_pop( struct Bench * bench ) {
+  return _push_pop( bench, MIDIMessageQueueCreateRing( 64 ) );
+}
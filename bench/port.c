@@ -0,0 +1,59 @@
+#include "bench.h"
+#include "midi/port.h"
+#include "midi/message.h"
+
+#define BENCH_PORT_FANOUT_MAX 32
+
+static int _receive( void * target, void * source, struct MIDITypeSpec * type, void * object ) {
+  (*(size_t*)target)++;
+  return 0;
+}
+
+/**
+ * Benchmark sending a message from one port to @c n connected ports.
+ */
+static int _send_fanout( struct Bench * bench, size_t n ) {
+  struct MIDIPort * source, * targets[BENCH_PORT_FANOUT_MAX];
+  struct MIDIMessage * message;
+  size_t i, received = 0;
+
+  source = MIDIPortCreate( "bench source", MIDI_PORT_OUT, NULL, NULL );
+  BENCH_ASSERT( source != NULL );
+  for( i=0; i<n; i++ ) {
+    targets[i] = MIDIPortCreate( "bench target", MIDI_PORT_IN, &received, &_receive );
+    BENCH_ASSERT( targets[i] != NULL );
+    BENCH_ASSERT( MIDIPortConnect( source, targets[i] ) == 0 );
+  }
+  message = MIDIMessageCreate( MIDI_STATUS_TIMING_CLOCK );
+  BENCH_ASSERT( message != NULL );
+
+  while( BenchSample( bench ) ) {
+    for( i=0; i<bench->batch; i++ ) {
+      MIDIPortSend( source, MIDIMessageType, message );
+    }
+  }
+  BENCH_ASSERT( received > 0 );
+
+  MIDIMessageRelease( message );
+  MIDIPortInvalidate( source );
+  MIDIPortRelease( source );
+  for( i=0; i<n; i++ ) {
+    MIDIPortRelease( targets[i] );
+  }
+  return 0;
+}
+
+/**
+ * Benchmark sending a message from one port to 8 connected ports.
+ */
+int bench_port_send_fanout( struct Bench * bench ) {
+  return _send_fanout( bench, 8 );
+}
+
+/**
+ * Benchmark sending a message from one port to 32 connected ports,
+ * like a router with one input.
+ */
+int bench_port_send_fanout_32( struct Bench * bench ) {
+  return _send_fanout( bench, BENCH_PORT_FANOUT_MAX );
+}
@@ -0,0 +1,83 @@
+#include <unistd.h>
+#include <arpa/inet.h>
+#include "bench.h"
+#include "midi/message.h"
+#include "driver/common/rtp.h"
+#include "driver/common/rtpmidi.h"
+
+#define BENCH_RTPMIDI_ADDRESS "127.0.0.1"
+#define BENCH_RTPMIDI_SENDER_PORT   5604
+#define BENCH_RTPMIDI_RECEIVER_PORT 5704
+#define BENCH_RTPMIDI_RECEIVER_SSRC 0xbe7c4000
+
+static int _socket( struct sockaddr_in * address, unsigned short port ) {
+  int s;
+  address->sin_family = AF_INET;
+  address->sin_port   = htons( port );
+  if( inet_aton( BENCH_RTPMIDI_ADDRESS, &(address->sin_addr) ) == 0 ) {
+    return -1;
+  }
+  s = socket( AF_INET, SOCK_DGRAM, 0 );
+  if( s < 0 ) {
+    return -1;
+  }
+  if( bind( s, (void*)address, sizeof(struct sockaddr_in) ) ) {
+    close( s );
+    return -1;
+  }
+  return s;
+}
+
+/**
+ * Benchmark the round trip of a note on message from one RTP-MIDI
+ * session to another over the UDP loopback interface.
+ */
+int bench_rtpmidi_loopback( struct Bench * bench ) {
+  static unsigned char note_on[] = { 0x90, 60, 100 };
+  struct sockaddr_in sender_address, receiver_address;
+  struct RTPSession * sender_rtp, * receiver_rtp;
+  struct RTPMIDISession * sender, * receiver;
+  struct RTPPeer * peer;
+  struct MIDIMessageList out, in[8];
+  int sender_socket, receiver_socket;
+  size_t i, j, read;
+
+  sender_socket   = _socket( &sender_address, BENCH_RTPMIDI_SENDER_PORT );
+  receiver_socket = _socket( &receiver_address, BENCH_RTPMIDI_RECEIVER_PORT );
+  BENCH_ASSERT( sender_socket >= 0 && receiver_socket >= 0 );
+  sender_rtp   = RTPSessionCreate( sender_socket );
+  receiver_rtp = RTPSessionCreate( receiver_socket );
+  sender   = RTPMIDISessionCreate( sender_rtp );
+  receiver = RTPMIDISessionCreate( receiver_rtp );
+  BENCH_ASSERT( sender != NULL && receiver != NULL );
+  peer = RTPPeerCreate( BENCH_RTPMIDI_RECEIVER_SSRC, sizeof(receiver_address), (void*) &receiver_address );
+  BENCH_ASSERT( RTPSessionAddPeer( sender_rtp, peer ) == 0 );
+
+  out.message = MIDIMessageCreate( 0 );
+  out.next    = NULL;
+  BENCH_ASSERT( MIDIMessageDecode( out.message, 3, &(note_on[0]), &read ) == 0 );
+
+  while( BenchSample( bench ) ) {
+    for( i=0; i<bench->batch; i++ ) {
+      for( j=0; j<8; j++ ) {
+        in[j].message = NULL;
+        in[j].next    = ( j+1 < 8 ) ? &(in[j+1]) : NULL;
+      }
+      BENCH_ASSERT( RTPMIDISessionSend( sender, &out ) == 0 );
+      BENCH_ASSERT( RTPMIDISessionReceive( receiver, &(in[0]) ) == 0 );
+      for( j=0; j<8 && in[j].message != NULL; j++ ) {
+        MIDIMessageRelease( in[j].message );
+      }
+    }
+  }
+
+  MIDIMessageRelease( out.message );
+  RTPPeerRelease( peer );
+  RTPMIDISessionRelease( sender );
+  RTPMIDISessionRelease( receiver );
+  RTPSessionRelease( sender_rtp );
+  RTPSessionRelease( receiver_rtp );
+  close( sender_socket );
+  close( receiver_socket );
+  return 0;
+}
@@ -0,0 +1,843 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <sys/select.h>
+#include <sys/resource.h>
+#include "midi/midi.h"
+#include "midi/port.h"
+#include "midi/driver.h"
+#include "midi/message.h"
+#include "midi/runloop.h"
+#include "driver/common/rtp.h"
+#include "driver/common/rtpmidi.h"
+#include "driver/applemidi/applemidi.h"
+
+/*
+ * Soak test for the AppleMIDI driver.
+ * One process runs a hub, an AppleMIDI driver that accepts any peer, and
+ * a number of simulated peers on the same runloop. Every peer opens a
+ * session with the hub and then sends a configurable mix of note bursts,
+ * control change sweeps, system exclusive dumps and timing clocks. The
+ * RTP-MIDI packets of the peers pass a relay that drops, delays and
+ * reorders them before they are forwarded to the hub from the peer's own
+ * socket. Results are written as one JSON object per line and report
+ * interval, like the results of bench_main.
+ */
+
+#define SOAK_ADDRESS          "127.0.0.1"
+#define SOAK_DEFAULT_PORT     7004
+#define SOAK_DEFAULT_PEERS    100
+#define SOAK_DEFAULT_SECONDS  10
+#define SOAK_DEFAULT_INTERVAL 1
+#define SOAK_DEFAULT_RATE     100   /* messages per peer and second */
+#define SOAK_DEFAULT_SYSEX    128   /* bytes */
+
+#define SOAK_TICK_USEC        1000
+#define SOAK_INVITE_RETRY     1000000 /* usec */
+#define SOAK_REORDER_USEC     2000
+#define SOAK_BURST            4
+#define SOAK_MAX_MESSAGES     ( 2 * SOAK_BURST )
+#define SOAK_MAX_SYSEX        512
+#define SOAK_FIFO_SIZE        64
+#define SOAK_RELAY_SIZE       4096
+#define SOAK_PACKET_SIZE      1500
+#define SOAK_SAMPLES          65536
+
+#define SOAK_NOTES     0
+#define SOAK_CC        1
+#define SOAK_SYSEX     2
+#define SOAK_CLOCK     3
+#define SOAK_NUM_KINDS 4
+
+#define SOAK_PEER_INVITING_CONTROL 0
+#define SOAK_PEER_INVITING_RTP     1
+#define SOAK_PEER_CONNECTED        2
+#define SOAK_PEER_REJECTED         3
+
+struct SoakOptions {
+  size_t peers;
+  double seconds;
+  double interval;
+  double rate;
+  unsigned int mix[SOAK_NUM_KINDS];
+  size_t sysex;
+  double loss;
+  double reorder;
+  unsigned long jitter;
+  unsigned short port;
+  unsigned long seed;
+  unsigned long busy_poll;
+};
+
+/**
+ * @brief A simulated peer.
+ * The sizes of the packets that were sent but not yet seen by the relay
+ * are kept in a FIFO, so the relay knows how many messages a dropped
+ * packet carried.
+ */
+struct SoakPeer {
+  int control_socket;
+  int rtp_socket;
+  int state;
+  unsigned long ssrc;
+  unsigned long long invited;
+  struct RTPSession * rtp_session;
+  struct RTPMIDISession * rtpmidi_session;
+  MIDIChannel channel;
+  MIDIKey next_key;
+  MIDIValue cc_value;
+  MIDIKey held[SOAK_BURST];
+  size_t nheld;
+  double budget;
+  unsigned short fifo[SOAK_FIFO_SIZE];
+  size_t fifo_head;
+  size_t fifo_tail;
+};
+
+/**
+ * @brief A packet held back by the relay.
+ */
+struct SoakPacket {
+  unsigned long long due;
+  size_t peer;
+  size_t size;
+  unsigned char data[SOAK_PACKET_SIZE];
+};
+
+struct SoakCounters {
+  unsigned long sent;
+  unsigned long received;
+  unsigned long send_errors;
+  unsigned long packets;
+  unsigned long dropped;
+  unsigned long reordered;
+  unsigned long lost;
+  unsigned long recovered;
+  unsigned long packets_in;
+  unsigned long wakeups;
+  double wakeup_usec;
+};
+
+/**
+ * @brief A reservoir of latency samples.
+ * Once the reservoir is full, every new sample replaces a random one, so
+ * the percentiles stay unbiased however long the soak runs.
+ */
+struct SoakLatency {
+  unsigned long long seen;
+  size_t count;
+  unsigned long max;
+  unsigned long samples[SOAK_SAMPLES];
+};
+
+struct Soak {
+  struct SoakOptions options;
+  struct MIDIDriverAppleMIDI * hub;
+  struct MIDIPort * port;
+  struct MIDIRunloop * runloop;
+  struct MIDIRunloopSource * source;
+  struct SoakPeer * peers;
+  size_t connected;
+  int relay_socket;
+  struct sockaddr_in hub_control;
+  struct sockaddr_in hub_rtp;
+  struct sockaddr_in relay_addr;
+  struct SoakPacket * relay;
+  size_t relay_count;
+  unsigned long long start;
+  unsigned long long last_tick;
+  unsigned long long last_report;
+  unsigned long tick_timer;
+  unsigned long long random;
+  struct SoakCounters total;
+  struct SoakCounters interval;
+  struct SoakLatency latency_total;
+  struct SoakLatency latency_interval;
+  int done;
+};
+
+static unsigned char _sysex[SOAK_MAX_SYSEX];
+
+/* MARK: Utilities *//**
+ * @name Utilities
+ * @{
+ */
+
+static unsigned long long _now_usec( void ) {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return (unsigned long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* xorshift64*, seeded from the command line for reproducible runs */
+static unsigned long _random( struct Soak * soak ) {
+  soak->random ^= soak->random >> 12;
+  soak->random ^= soak->random << 25;
+  soak->random ^= soak->random >> 27;
+  return (unsigned long) ( ( soak->random * 2685821657736338717ULL ) >> 32 );
+}
+
+static double _uniform( struct Soak * soak ) {
+  return (double) _random( soak ) / 4294967296.0;
+}
+
+static long _rss_kb( void ) {
+  struct rusage usage;
+  long pages, resident;
+  FILE * statm = fopen( "/proc/self/statm", "r" );
+  if( statm != NULL ) {
+    if( fscanf( statm, "%ld %ld", &pages, &resident ) == 2 ) {
+      fclose( statm );
+      return resident * ( sysconf( _SC_PAGESIZE ) / 1024 );
+    }
+    fclose( statm );
+  }
+  /* the peak is better than nothing */
+  if( getrusage( RUSAGE_SELF, &usage ) == 0 ) {
+    return usage.ru_maxrss;
+  }
+  return -1;
+}
+
+static void _latency_add( struct Soak * soak, struct SoakLatency * latency, unsigned long usec ) {
+  unsigned long long i;
+  latency->seen++;
+  if( usec > latency->max ) latency->max = usec;
+  if( latency->count < SOAK_SAMPLES ) {
+    latency->samples[latency->count++] = usec;
+  } else {
+    i = ( ( (unsigned long long) _random( soak ) << 32 ) | _random( soak ) ) % latency->seen;
+    if( i < SOAK_SAMPLES ) latency->samples[i] = usec;
+  }
+}
+
+static int _compare_ulong( const void * a, const void * b ) {
+  unsigned long x = *(const unsigned long *)a, y = *(const unsigned long *)b;
+  return ( x > y ) - ( x < y );
+}
+
+static unsigned long _percentile( struct SoakLatency * latency, int permille ) {
+  if( latency->count == 0 ) return 0;
+  return latency->samples[ ( ( latency->count - 1 ) * permille ) / 1000 ];
+}
+
+/** @} */
+
+/* MARK: Simulated peers *//**
+ * @name Simulated peers
+ * The peers speak just enough of the AppleMIDI session protocol to be
+ * invited and to answer clock synchronizations. RTP-MIDI is sent with the
+ * library's own RTP-MIDI session, so the journal is exercised as well.
+ * @{
+ */
+
+static void _put32( unsigned char * buf, unsigned long value ) {
+  buf[0] = 0xff & ( value >> 24 );
+  buf[1] = 0xff & ( value >> 16 );
+  buf[2] = 0xff & ( value >> 8 );
+  buf[3] = 0xff &   value;
+}
+
+static unsigned long _get32( unsigned char * buf ) {
+  return ( (unsigned long) buf[0] << 24 ) | ( (unsigned long) buf[1] << 16 )
+       | ( (unsigned long) buf[2] << 8 ) | buf[3];
+}
+
+static int _peer_invite( struct Soak * soak, struct SoakPeer * peer ) {
+  unsigned char buf[24];
+  int fd = peer->control_socket;
+  struct sockaddr_in * addr = &(soak->hub_control);
+  memset( &(buf[0]), 0, sizeof(buf) );
+  buf[0] = 0xff;
+  buf[1] = 0xff;
+  buf[2] = 'I';
+  buf[3] = 'N';
+  _put32( &(buf[4]), 2 );
+  _put32( &(buf[8]), peer->ssrc );
+  _put32( &(buf[12]), peer->ssrc );
+  memcpy( &(buf[16]), "Soak", 5 );
+  if( peer->state == SOAK_PEER_INVITING_RTP ) {
+    fd   = peer->rtp_socket;
+    addr = &(soak->hub_rtp);
+  }
+  peer->invited = _now_usec();
+  return sendto( fd, &(buf[0]), 21, 0, (struct sockaddr *) addr, sizeof(struct sockaddr_in) ) != 21;
+}
+
+static int _peer_connect( struct Soak * soak, struct SoakPeer * peer, unsigned long hub_ssrc ) {
+  struct RTPPeer * hub;
+  peer->rtp_session = RTPSessionCreate( peer->rtp_socket );
+  if( peer->rtp_session == NULL ) return 1;
+  RTPSessionSetSSRC( peer->rtp_session, peer->ssrc );
+  /* send to the relay, it forwards the packets from the peer's socket */
+  hub = RTPPeerCreate( hub_ssrc, sizeof(struct sockaddr_in), (struct sockaddr *) &(soak->relay_addr) );
+  if( hub == NULL ) return 1;
+  RTPSessionAddPeer( peer->rtp_session, hub );
+  RTPPeerRelease( hub );
+  peer->rtpmidi_session = RTPMIDISessionCreate( peer->rtp_session );
+  if( peer->rtpmidi_session == NULL ) return 1;
+  peer->state = SOAK_PEER_CONNECTED;
+  soak->connected++;
+  return 0;
+}
+
+static int _peer_sync( struct Soak * soak, struct SoakPeer * peer, unsigned char * buf ) {
+  unsigned long long now = _now_usec() / 100; /* the hub counts in 100 usec */
+  _put32( &(buf[4]), peer->ssrc );
+  buf[8] = 1;
+  _put32( &(buf[20]), (unsigned long) ( now >> 32 ) );
+  _put32( &(buf[24]), (unsigned long) ( now & 0xffffffff ) );
+  return sendto( peer->rtp_socket, buf, 36, 0, (struct sockaddr *) &(soak->hub_rtp), sizeof(struct sockaddr_in) ) != 36;
+}
+
+static int _peer_read( struct Soak * soak, struct SoakPeer * peer, int fd ) {
+  unsigned char buf[SOAK_PACKET_SIZE];
+  ssize_t bytes;
+  int result = 0;
+
+  while( ( bytes = recv( fd, &(buf[0]), sizeof(buf), MSG_DONTWAIT ) ) > 0 ) {
+    if( bytes < 16 || buf[0] != 0xff || buf[1] != 0xff ) continue;
+    if( buf[2] == 'O' && buf[3] == 'K' ) {
+      if( fd == peer->control_socket && peer->state == SOAK_PEER_INVITING_CONTROL ) {
+        peer->state = SOAK_PEER_INVITING_RTP;
+        result += _peer_invite( soak, peer );
+      } else if( fd == peer->rtp_socket && peer->state == SOAK_PEER_INVITING_RTP ) {
+        result += _peer_connect( soak, peer, _get32( &(buf[12]) ) );
+      }
+    } else if( buf[2] == 'N' && buf[3] == 'O' ) {
+      peer->state = SOAK_PEER_REJECTED;
+    } else if( buf[2] == 'C' && buf[3] == 'K' && bytes >= 36 && buf[8] == 0 ) {
+      result += _peer_sync( soak, peer, &(buf[0]) );
+    }
+  }
+  return result;
+}
+
+static struct MIDIMessage * _message( MIDIStatus status, MIDIChannel channel, MIDIProperty property,
+                                      MIDIValue data1, MIDIValue data2, unsigned long long now ) {
+  struct MIDIMessage * message = MIDIMessageCreate( status );
+  if( message == NULL ) return NULL;
+  MIDIMessageSet( message, MIDI_CHANNEL, sizeof(MIDIChannel), &channel );
+  MIDIMessageSet( message, property, sizeof(MIDIValue), &data1 );
+  MIDIMessageSet( message, ( property == MIDI_KEY ) ? MIDI_VELOCITY : MIDI_VALUE, sizeof(MIDIValue), &data2 );
+  MIDIMessageSetTimestamp( message, now );
+  return message;
+}
+
+static struct MIDIMessage * _sysex_message( struct Soak * soak, unsigned long long now ) {
+  struct MIDIMessage * message = MIDIMessageCreate( MIDI_STATUS_SYSTEM_EXCLUSIVE );
+  MIDIManufacturerId manufacturer_id = 0x7d;
+  unsigned char * data = &(_sysex[0]);
+  size_t size = soak->options.sysex;
+  if( message == NULL ) return NULL;
+  MIDIMessageSet( message, MIDI_MANUFACTURER_ID, sizeof(MIDIManufacturerId), &manufacturer_id );
+  MIDIMessageSet( message, MIDI_SYSEX_DATA, sizeof(void *), &data );
+  MIDIMessageSet( message, MIDI_SYSEX_SIZE, sizeof(size_t), &size );
+  MIDIMessageSetTimestamp( message, now );
+  return message;
+}
+
+static int _pick( struct Soak * soak ) {
+  unsigned int i, sum = 0, r;
+  for( i=0; i<SOAK_NUM_KINDS; i++ ) sum += soak->options.mix[i];
+  r = _random( soak ) % sum;
+  for( i=0; i<SOAK_NUM_KINDS; i++ ) {
+    if( r < soak->options.mix[i] ) return i;
+    r -= soak->options.mix[i];
+  }
+  return SOAK_CLOCK;
+}
+
+/**
+ * @brief Send the traffic of one tick.
+ * All messages of a tick go into a single packet. A note burst releases
+ * the notes of the previous burst, a system exclusive dump is always sent
+ * in a packet of its own.
+ */
+static int _peer_send( struct Soak * soak, struct SoakPeer * peer, double seconds, unsigned long long now ) {
+  struct MIDIMessageList list[SOAK_MAX_MESSAGES];
+  size_t i, n = 0;
+  int kind, result = 0;
+
+  peer->budget += soak->options.rate * seconds;
+  while( peer->budget >= 1 && n < SOAK_MAX_MESSAGES ) {
+    kind = _pick( soak );
+    if( kind == SOAK_NOTES ) {
+      if( n + peer->nheld + SOAK_BURST > SOAK_MAX_MESSAGES ) break;
+      for( i=0; i<peer->nheld; i++ ) {
+        list[n++].message = _message( MIDI_STATUS_NOTE_OFF, peer->channel, MIDI_KEY, peer->held[i], 64, now );
+      }
+      for( i=0; i<SOAK_BURST; i++ ) {
+        peer->held[i]  = 36 + peer->next_key;
+        peer->next_key = ( peer->next_key + 7 ) % 60;
+        list[n++].message = _message( MIDI_STATUS_NOTE_ON, peer->channel, MIDI_KEY, peer->held[i], 100, now );
+      }
+      peer->budget -= peer->nheld + SOAK_BURST;
+      peer->nheld = SOAK_BURST;
+    } else if( kind == SOAK_CC ) {
+      peer->cc_value = ( peer->cc_value + 1 ) & 0x7f;
+      list[n++].message = _message( MIDI_STATUS_CONTROL_CHANGE, peer->channel, MIDI_CONTROL, 1, peer->cc_value, now );
+      peer->budget -= 1;
+    } else if( kind == SOAK_SYSEX ) {
+      if( n > 0 ) break;
+      list[n++].message = _sysex_message( soak, now );
+      peer->budget -= 1;
+      break;
+    } else {
+      list[n++].message = MIDIMessageCreate( MIDI_STATUS_TIMING_CLOCK );
+      if( list[n-1].message != NULL ) MIDIMessageSetTimestamp( list[n-1].message, now );
+      peer->budget -= 1;
+    }
+  }
+  if( n == 0 ) return 0;
+
+  for( i=0; i<n; i++ ) {
+    if( list[i].message == NULL ) {
+      result = 1;
+    }
+    list[i].next = ( i+1 < n ) ? &(list[i+1]) : NULL;
+  }
+  if( result == 0 && RTPMIDISessionSend( peer->rtpmidi_session, &(list[0]) ) == 0 ) {
+    if( ( peer->fifo_tail + 1 ) % SOAK_FIFO_SIZE != peer->fifo_head ) {
+      peer->fifo[peer->fifo_tail] = n;
+      peer->fifo_tail = ( peer->fifo_tail + 1 ) % SOAK_FIFO_SIZE;
+    }
+    soak->interval.sent += n;
+  } else {
+    soak->interval.send_errors++;
+  }
+  for( i=0; i<n; i++ ) {
+    if( list[i].message != NULL ) MIDIMessageRelease( list[i].message );
+  }
+  return 0;
+}
+
+/** @} */
+
+/* MARK: Relay *//**
+ * @name Relay
+ * The relay delays every packet by a random time of up to the configured
+ * jitter and holds reordered packets back a little longer. Held packets
+ * are released on the next tick, so delays are resolved to the tick.
+ * @{
+ */
+
+static void _relay_forward( struct Soak * soak, size_t peer, unsigned char * data, size_t size ) {
+  sendto( soak->peers[peer].rtp_socket, data, size, 0,
+          (struct sockaddr *) &(soak->hub_rtp), sizeof(struct sockaddr_in) );
+}
+
+static int _relay_read( struct Soak * soak ) {
+  struct SoakPacket * packet;
+  struct sockaddr_in from;
+  socklen_t size;
+  unsigned char buf[SOAK_PACKET_SIZE];
+  struct SoakPeer * peer;
+  unsigned long delay;
+  unsigned short messages;
+  ssize_t bytes;
+  size_t i;
+  int port;
+
+  for(;;) {
+    size  = sizeof(from);
+    bytes = recvfrom( soak->relay_socket, &(buf[0]), sizeof(buf), MSG_DONTWAIT, (struct sockaddr *) &from, &size );
+    if( bytes <= 0 ) break;
+    port = ntohs( from.sin_port ) - ( soak->options.port + 3 );
+    if( port < 0 || port % 2 != 0 || (size_t) ( port / 2 ) >= soak->options.peers ) continue;
+    i    = port / 2;
+    peer = &(soak->peers[i]);
+
+    messages = 0;
+    if( peer->fifo_head != peer->fifo_tail ) {
+      messages = peer->fifo[peer->fifo_head];
+      peer->fifo_head = ( peer->fifo_head + 1 ) % SOAK_FIFO_SIZE;
+    }
+    soak->interval.packets++;
+    if( _uniform( soak ) * 100 < soak->options.loss ) {
+      soak->interval.dropped++;
+      soak->interval.lost += messages;
+      continue;
+    }
+    delay = ( soak->options.jitter > 0 ) ? _random( soak ) % ( soak->options.jitter + 1 ) : 0;
+    if( _uniform( soak ) * 100 < soak->options.reorder ) {
+      delay += soak->options.jitter + SOAK_REORDER_USEC;
+      soak->interval.reordered++;
+    }
+    if( delay == 0 || soak->relay_count == SOAK_RELAY_SIZE ) {
+      _relay_forward( soak, i, &(buf[0]), bytes );
+      continue;
+    }
+    packet = &(soak->relay[soak->relay_count++]);
+    packet->due  = _now_usec() + delay;
+    packet->peer = i;
+    packet->size = bytes;
+    memcpy( &(packet->data[0]), &(buf[0]), bytes );
+  }
+  return 0;
+}
+
+static void _relay_release( struct Soak * soak, unsigned long long now ) {
+  struct SoakPacket * packet;
+  size_t i = 0;
+  while( i < soak->relay_count ) {
+    packet = &(soak->relay[i]);
+    if( packet->due > now ) {
+      i++;
+      continue;
+    }
+    _relay_forward( soak, packet->peer, &(packet->data[0]), packet->size );
+    /* order among held packets does not matter, they are reordered anyway */
+    soak->relay_count--;
+    if( i < soak->relay_count ) {
+      memcpy( packet, &(soak->relay[soak->relay_count]), sizeof(struct SoakPacket) );
+    }
+  }
+}
+
+/** @} */
+
+/* MARK: Reporting *//**
+ * @name Reporting
+ * @{
+ */
+
+static void _counters_add( struct SoakCounters * total, struct SoakCounters * interval ) {
+  total->sent        += interval->sent;
+  total->received    += interval->received;
+  total->send_errors += interval->send_errors;
+  total->packets     += interval->packets;
+  total->dropped     += interval->dropped;
+  total->reordered   += interval->reordered;
+  total->lost        += interval->lost;
+  total->recovered   += interval->recovered;
+  total->packets_in  += interval->packets_in;
+  total->wakeups     += interval->wakeups;
+  total->wakeup_usec += interval->wakeup_usec;
+}
+
+static void _report( struct Soak * soak, const char * kind, double t, double seconds,
+                     struct SoakCounters * counters, struct SoakLatency * latency ) {
+  qsort( &(latency->samples[0]), latency->count, sizeof(unsigned long), &_compare_ulong );
+  printf( "{\"soak\":\"%s\",\"t\":%.2f,\"peers\":%lu,\"connected\":%lu,\"sent\":%lu,\"received\":%lu,"
+          "\"msgs_per_s\":%.1f,\"packets\":%lu,\"packets_in\":%lu,\"send_errors\":%lu,\"dropped\":%lu,"
+          "\"reordered\":%lu,\"lost\":%lu,\"recovered\":%lu,\"recovery\":%.3f,"
+          "\"p50_us\":%lu,\"p99_us\":%lu,\"p999_us\":%lu,\"max_us\":%lu,\"wakeup_mean_us\":%.1f,\"rss_kb\":%ld}\n",
+          kind, t, (unsigned long) soak->options.peers, (unsigned long) soak->connected,
+          counters->sent, counters->received, ( seconds > 0 ) ? counters->received / seconds : 0,
+          counters->packets, counters->packets_in, counters->send_errors, counters->dropped,
+          counters->reordered, counters->lost, counters->recovered,
+          ( counters->lost > 0 ) ? (double) counters->recovered / counters->lost : -1.0,
+          _percentile( latency, 500 ), _percentile( latency, 990 ), _percentile( latency, 999 ),
+          latency->max, ( counters->wakeups > 0 ) ? counters->wakeup_usec / counters->wakeups : 0, _rss_kb() );
+  fflush( stdout );
+}
+
+static void _report_interval( struct Soak * soak, unsigned long long now ) {
+  struct MIDIDriverProfilingStats stats;
+  if( MIDIDriverGetProfilingStats( (struct MIDIDriver *) soak->hub, &stats ) == 0 ) {
+    soak->interval.recovered  = stats.recovered  - soak->total.recovered;
+    soak->interval.packets_in = stats.packets_in - soak->total.packets_in;
+    /* from the arrival of a packet at the hub's socket until it is decoded */
+    soak->interval.wakeups     = stats.stages[MIDI_DRIVER_STAGE_WAKEUP].count - soak->total.wakeups;
+    soak->interval.wakeup_usec = stats.stages[MIDI_DRIVER_STAGE_WAKEUP].total * 1e6 / stats.rate
+                               - soak->total.wakeup_usec;
+  }
+  _report( soak, "interval", ( now - soak->start ) / 1e6, ( now - soak->last_report ) / 1e6,
+           &(soak->interval), &(soak->latency_interval) );
+  _counters_add( &(soak->total), &(soak->interval) );
+  memset( &(soak->interval), 0, sizeof(struct SoakCounters) );
+  soak->latency_interval.seen  = 0;
+  soak->latency_interval.count = 0;
+  soak->latency_interval.max   = 0;
+  soak->last_report = now;
+}
+
+/** @} */
+
+/* MARK: Runloop callbacks *//**
+ * @name Runloop callbacks
+ * @{
+ */
+
+static int _soak_receive( void * target, void * source, struct MIDITypeSpec * type, void * data ) {
+  struct Soak * soak = target;
+  MIDITimestamp timestamp;
+  unsigned long latency;
+  if( type != MIDIMessageType ) return 0;
+  soak->interval.received++;
+  MIDIMessageGetTimestamp( data, &timestamp );
+  /* RTP only carries the low 32 bits of the sender's timestamp */
+  latency = ( (unsigned long) _now_usec() - (unsigned long) timestamp ) & 0xffffffff;
+  if( latency > 0x7fffffff ) latency = 0;
+  _latency_add( soak, &(soak->latency_interval), latency );
+  _latency_add( soak, &(soak->latency_total), latency );
+  return 0;
+}
+
+static int _soak_read( void * info, int nfds, fd_set * readfds ) {
+  struct Soak * soak = info;
+  struct SoakPeer * peer;
+  size_t i;
+  int result = 0;
+
+  if( FD_ISSET( soak->relay_socket, readfds ) ) {
+    result += _relay_read( soak );
+  }
+  for( i=0; i<soak->options.peers; i++ ) {
+    peer = &(soak->peers[i]);
+    if( FD_ISSET( peer->control_socket, readfds ) ) result += _peer_read( soak, peer, peer->control_socket );
+    if( FD_ISSET( peer->rtp_socket, readfds ) )     result += _peer_read( soak, peer, peer->rtp_socket );
+  }
+  return 0;
+}
+
+static int _soak_tick( void * info, struct timespec * ts ) {
+  struct timespec tick = { 0, SOAK_TICK_USEC * 1000 };
+  struct Soak * soak = info;
+  struct SoakPeer * peer;
+  unsigned long long now = _now_usec();
+  double seconds = ( now - soak->last_tick ) / 1e6;
+  size_t i;
+
+  soak->tick_timer = 0;
+  soak->last_tick  = now;
+  _relay_release( soak, now );
+  for( i=0; i<soak->options.peers; i++ ) {
+    peer = &(soak->peers[i]);
+    if( peer->state == SOAK_PEER_CONNECTED ) {
+      _peer_send( soak, peer, seconds, now );
+    } else if( peer->state != SOAK_PEER_REJECTED && now - peer->invited > SOAK_INVITE_RETRY ) {
+      _peer_invite( soak, peer );
+    }
+  }
+  if( now - soak->last_report >= soak->options.interval * 1e6 ) {
+    _report_interval( soak, now );
+  }
+  if( now - soak->start >= soak->options.seconds * 1e6 ) {
+    soak->done = 1;
+    return 0;
+  }
+  return MIDIRunloopSourceAddTimer( soak->source, &tick, &_soak_tick, soak, &(soak->tick_timer) );
+}
+
+/** @} */
+
+/* MARK: Setup and teardown *//**
+ * @name Setup and teardown
+ * @{
+ */
+
+static int _socket( struct sockaddr_in * addr, unsigned short port ) {
+  int s;
+  addr->sin_family = AF_INET;
+  addr->sin_port   = htons( port );
+  inet_aton( SOAK_ADDRESS, &(addr->sin_addr) );
+  s = socket( AF_INET, SOCK_DGRAM, 0 );
+  if( s < 0 ) return -1;
+  if( bind( s, (struct sockaddr *) addr, sizeof(struct sockaddr_in) ) ) {
+    close( s );
+    return -1;
+  }
+  return s;
+}
+
+static int _soak_setup( struct Soak * soak ) {
+  struct MIDIRunloopSourceDelegate delegate = { soak, &_soak_read, NULL, NULL };
+  struct MIDIRunloopSource * hub_source;
+  struct sockaddr_in addr;
+  struct MIDIPort * port;
+  socklen_t size = sizeof(soak->relay_addr);
+  size_t i;
+
+  for( i=0; i<SOAK_MAX_SYSEX; i++ ) _sysex[i] = i & 0x7f;
+  _sysex[soak->options.sysex-1] = 0xf7;
+
+  soak->hub = MIDIDriverAppleMIDICreate( "Soak hub", soak->options.port );
+  if( soak->hub == NULL ) return 1;
+  MIDIDriverAppleMIDIAcceptFromAny( soak->hub );
+  MIDIDriverStartProfiling( (struct MIDIDriver *) soak->hub );
+  soak->port = MIDIPortCreate( "Soak receiver", MIDI_PORT_IN, soak, &_soak_receive );
+  if( soak->port == NULL || MIDIDriverGetPort( (struct MIDIDriver *) soak->hub, &port ) || MIDIPortConnect( port, soak->port ) ) return 1;
+
+  _socket( &(soak->hub_control), soak->options.port );
+  _socket( &(soak->hub_rtp), soak->options.port + 1 );
+  soak->relay_socket = _socket( &(soak->relay_addr), 0 );
+  if( soak->relay_socket < 0 || getsockname( soak->relay_socket, (struct sockaddr *) &(soak->relay_addr), &size ) ) {
+    fprintf( stderr, "Could not create relay socket.\n" );
+    return 1;
+  }
+  soak->relay = malloc( sizeof(struct SoakPacket) * SOAK_RELAY_SIZE );
+  soak->peers = calloc( soak->options.peers, sizeof(struct SoakPeer) );
+  if( soak->relay == NULL || soak->peers == NULL ) return 1;
+
+  soak->runloop = MIDIRunloopCreate();
+  soak->source  = MIDIRunloopSourceCreate( &delegate );
+  if( soak->runloop == NULL || soak->source == NULL
+   || MIDIDriverAppleMIDIGetRunloopSource( soak->hub, &hub_source )
+   || MIDIRunloopAddSource( soak->runloop, hub_source )
+   || MIDIRunloopAddSource( soak->runloop, soak->source )
+   || MIDIRunloopSetBusyPoll( soak->runloop, soak->options.busy_poll ) ) return 1;
+  MIDIRunloopSourceScheduleRead( soak->source, soak->relay_socket );
+
+  soak->start = soak->last_tick = soak->last_report = _now_usec();
+  for( i=0; i<soak->options.peers; i++ ) {
+    struct SoakPeer * peer = &(soak->peers[i]);
+    peer->control_socket = _socket( &addr, soak->options.port + 2 + 2*i );
+    peer->rtp_socket     = _socket( &addr, soak->options.port + 3 + 2*i );
+    if( peer->control_socket < 0 || peer->rtp_socket < 0 ) {
+      fprintf( stderr, "Could not bind peer %lu: %s\n", (unsigned long) i, strerror( errno ) );
+      return 1;
+    }
+    peer->ssrc    = 0x50000000 + i;
+    peer->channel = MIDI_CHANNEL_1 + ( i % 16 );
+    peer->state   = SOAK_PEER_INVITING_CONTROL;
+    MIDIRunloopSourceScheduleRead( soak->source, peer->control_socket );
+    MIDIRunloopSourceScheduleRead( soak->source, peer->rtp_socket );
+    /* all peers connect at once, like after a network outage */
+    _peer_invite( soak, peer );
+  }
+  return _soak_tick( soak, NULL );
+}
+
+static void _soak_teardown( struct Soak * soak ) {
+  struct MIDIRunloopSource * hub_source;
+  size_t i;
+  if( soak->tick_timer != 0 ) MIDIRunloopSourceCancelTimer( soak->source, soak->tick_timer );
+  if( soak->runloop != NULL ) {
+    if( soak->source != NULL ) MIDIRunloopRemoveSource( soak->runloop, soak->source );
+    if( soak->hub != NULL && MIDIDriverAppleMIDIGetRunloopSource( soak->hub, &hub_source ) == 0 ) {
+      MIDIRunloopRemoveSource( soak->runloop, hub_source );
+    }
+    MIDIRunloopRelease( soak->runloop );
+  }
+  if( soak->source != NULL ) MIDIRunloopSourceRelease( soak->source );
+  if( soak->hub != NULL ) MIDIDriverRelease( (struct MIDIDriver *) soak->hub );
+  if( soak->port != NULL ) MIDIPortRelease( soak->port );
+  for( i=0; soak->peers != NULL && i<soak->options.peers; i++ ) {
+    if( soak->peers[i].rtpmidi_session != NULL ) RTPMIDISessionRelease( soak->peers[i].rtpmidi_session );
+    if( soak->peers[i].rtp_session != NULL ) RTPSessionRelease( soak->peers[i].rtp_session );
+    if( soak->peers[i].control_socket > 0 ) close( soak->peers[i].control_socket );
+    if( soak->peers[i].rtp_socket > 0 ) close( soak->peers[i].rtp_socket );
+  }
+  if( soak->relay_socket > 0 ) close( soak->relay_socket );
+  free( soak->peers );
+  free( soak->relay );
+}
+
+/** @} */
+
+static int _usage( char * name ) {
+  fprintf( stderr, "Usage: %s [-p peers] [-t seconds] [-i interval] [-r rate] [-m notes:cc:sysex:clock]\n"
+                   "          [-x sysex bytes] [-l loss %%] [-o reorder %%] [-j jitter usec] [-P port] [-s seed]\n"
+                   "          [-b busy poll usec]\n",
+           name );
+  return 2;
+}
+
+/**
+ * Only pass errors on, so that the verbose logging of debug builds
+ * does not end up in the measurements.
+ */
+static int _soak_log( int channel, const char * fmt, ... ) {
+  va_list ap;
+  int result;
+  if( ! ( channel & MIDI_LOG_ERROR ) ) return 0;
+  va_start( ap, fmt );
+  result = vfprintf( stderr, fmt, ap );
+  va_end( ap );
+  return result;
+}
+
+/**
+ * Usage: soak_main [-p peers] [-t seconds] [-i interval] [-r rate]
+ *                  [-m notes:cc:sysex:clock] [-x sysex bytes] [-l loss %]
+ *                  [-o reorder %] [-j jitter usec] [-P port] [-s seed]
+ *                  [-b busy poll usec]
+ * Run simulated peers against an AppleMIDI hub for the given time and
+ * write one JSON line per report interval and a final total.
+ */
+int main( int argc, char *argv[] ) {
+  struct Soak * soak;
+  unsigned long long now;
+  int a, result = 0;
+
+  MIDILogger = &_soak_log;
+  soak = calloc( 1, sizeof(struct Soak) );
+  if( soak == NULL ) return 1;
+  soak->options.peers    = SOAK_DEFAULT_PEERS;
+  soak->options.seconds  = SOAK_DEFAULT_SECONDS;
+  soak->options.interval = SOAK_DEFAULT_INTERVAL;
+  soak->options.rate     = SOAK_DEFAULT_RATE;
+  soak->options.sysex    = SOAK_DEFAULT_SYSEX;
+  soak->options.port     = SOAK_DEFAULT_PORT;
+  soak->options.seed     = 1;
+  soak->options.mix[SOAK_NOTES] = 4;
+  soak->options.mix[SOAK_CC]    = 4;
+  soak->options.mix[SOAK_SYSEX] = 1;
+  soak->options.mix[SOAK_CLOCK] = 1;
+
+  for( a=1; a<argc; a++ ) {
+    if( argv[a][0] != '-' || argv[a][1] == '\0' || argv[a][2] != '\0' || a+1 >= argc ) {
+      return _usage( argv[0] );
+    }
+    switch( argv[a++][1] ) {
+      case 'p': soak->options.peers    = strtoul( argv[a], NULL, 10 ); break;
+      case 't': soak->options.seconds  = strtod( argv[a], NULL ); break;
+      case 'i': soak->options.interval = strtod( argv[a], NULL ); break;
+      case 'r': soak->options.rate     = strtod( argv[a], NULL ); break;
+      case 'x': soak->options.sysex    = strtoul( argv[a], NULL, 10 ); break;
+      case 'l': soak->options.loss     = strtod( argv[a], NULL ); break;
+      case 'o': soak->options.reorder  = strtod( argv[a], NULL ); break;
+      case 'j': soak->options.jitter   = strtoul( argv[a], NULL, 10 ); break;
+      case 'P': soak->options.port     = strtoul( argv[a], NULL, 10 ); break;
+      case 's': soak->options.seed     = strtoul( argv[a], NULL, 10 ); break;
+      case 'b': soak->options.busy_poll = strtoul( argv[a], NULL, 10 ); break;
+      case 'm':
+        if( sscanf( argv[a], "%u:%u:%u:%u", &(soak->options.mix[SOAK_NOTES]), &(soak->options.mix[SOAK_CC]),
+                    &(soak->options.mix[SOAK_SYSEX]), &(soak->options.mix[SOAK_CLOCK]) ) != 4 ) {
+          return _usage( argv[0] );
+        }
+        break;
+      default:
+        return _usage( argv[0] );
+    }
+  }
+  if( soak->options.mix[SOAK_NOTES] + soak->options.mix[SOAK_CC]
+    + soak->options.mix[SOAK_SYSEX] + soak->options.mix[SOAK_CLOCK] == 0 ) {
+    return _usage( argv[0] );
+  }
+  /* every peer has two sockets in the runloop's descriptor sets */
+  if( soak->options.peers == 0 || soak->options.peers > ( FD_SETSIZE - 32 ) / 2 ) {
+    fprintf( stderr, "The number of peers must be between 1 and %d.\n", ( FD_SETSIZE - 32 ) / 2 );
+    return 2;
+  }
+  if( soak->options.sysex < 2 ) soak->options.sysex = 2;
+  if( soak->options.sysex > SOAK_MAX_SYSEX ) soak->options.sysex = SOAK_MAX_SYSEX;
+  if( soak->options.interval <= 0 ) soak->options.interval = SOAK_DEFAULT_INTERVAL;
+  soak->random = soak->options.seed * 0x9e3779b97f4a7c15ULL + 1;
+
+  if( _soak_setup( soak ) ) {
+    fprintf( stderr, "Could not set up the soak test.\n" );
+    result = 1;
+  } else {
+    while( ! soak->done ) {
+      MIDIRunloopStep( soak->runloop );
+    }
+    now = _now_usec();
+    if( soak->interval.sent > 0 || soak->interval.received > 0 ) {
+      _report_interval( soak, now );
+    }
+    _report( soak, "total", ( now - soak->start ) / 1e6, ( now - soak->start ) / 1e6,
+             &(soak->total), &(soak->latency_total) );
+    if( soak->connected < soak->options.peers ) result = 1;
+  }
+  _soak_teardown( soak );
+  free( soak );
+  return result;
+}
@@ -0,0 +1,78 @@
+#include "bench.h"
+#include "midi/port.h"
+#include "midi/clock.h"
+#include "midi/device.h"
+#include "midi/message.h"
+#include "midi/runloop.h"
+#include "midi/timer.h"
+
+/* 120 clocks per second, 72000 samples take ten minutes */
+#define BENCH_TIMER_TEMPO 300
+
+struct _jitter {
+  struct MIDIClock * clock;
+  size_t clocks;
+  MIDITimestamp deviation_max;
+  double deviation_sum;
+};
+
+/* measure how late every clock arrives compared to its deadline */
+static int _receive( void * target, void * source, struct MIDITypeSpec * type, void * object ) {
+  struct _jitter * jitter = target;
+  MIDITimestamp now, due;
+  MIDIClockGetNow( jitter->clock, &now );
+  MIDIMessageGetTimestamp( object, &due );
+  if( now - due > jitter->deviation_max ) jitter->deviation_max = now - due;
+  jitter->deviation_sum += now - due;
+  jitter->clocks++;
+  return 0;
+}
+
+/**
+ * Benchmark the interval between the timing clocks of the generator.
+ * Every operation waits for one clock, so the percentiles show the spread
+ * of the intervals. The deviation of the clocks from their deadlines is
+ * written to stderr.
+ */
+int bench_timer_clock_jitter( struct Bench * bench ) {
+  struct MIDIRunloop * runloop = MIDIRunloopCreate();
+  struct MIDIRunloopSource * source = MIDIRunloopSourceCreate( NULL );
+  struct MIDIDevice * device = MIDIDeviceCreate( NULL );
+  struct MIDITimer * timer = MIDITimerCreate( NULL );
+  struct MIDIPort * out, * port;
+  struct _jitter jitter = { NULL, 0, 0, 0 };
+  MIDISamplingRate rate;
+  size_t i, clocks;
+
+  BENCH_ASSERT( runloop != NULL && source != NULL && device != NULL && timer != NULL );
+  BENCH_ASSERT( MIDIRunloopAddSource( runloop, source ) == 0 );
+  MIDITimerGetClock( timer, &(jitter.clock) );
+  MIDIDeviceGetOutputPort( device, &out );
+  port = MIDIPortCreate( "bench port", MIDI_PORT_IN, &jitter, &_receive );
+  BENCH_ASSERT( port != NULL && MIDIPortConnect( out, port ) == 0 );
+  BENCH_ASSERT( MIDITimerSetTempo( timer, BENCH_TIMER_TEMPO ) == 0 );
+  BENCH_ASSERT( MIDITimerStartGenerator( timer, device, source ) == 0 );
+
+  while( BenchSample( bench ) ) {
+    for( i=0; i<bench->batch; i++ ) {
+      clocks = jitter.clocks;
+      while( jitter.clocks == clocks ) {
+        BENCH_ASSERT( MIDIRunloopStep( runloop ) == 0 );
+      }
+    }
+  }
+
+  MIDIClockGetSamplingRate( jitter.clock, &rate );
+  fprintf( stderr, "%s: %lu clocks, deviation mean %.0f ns, max %.0f ns\n", bench->name,
+           (unsigned long) jitter.clocks, jitter.deviation_sum * 1000000000.0 / ( (double) rate * jitter.clocks ),
+           (double) jitter.deviation_max * 1000000000.0 / rate );
+
+  MIDITimerStopGenerator( timer );
+  MIDITimerRelease( timer );
+  MIDIPortInvalidate( port );
+  MIDIPortRelease( port );
+  MIDIDeviceRelease( device );
+  MIDIRunloopSourceRelease( source );
+  MIDIRunloopRelease( runloop );
+  return 0;
+}
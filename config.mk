@@ -22,7 +22,7 @@ BINDIR = $(BUILDDIR)
 CC = clang
 CFLAGS_DEBUG = -O3 -Wall -DDEBUG -g
 CFLAGS_RELEASE = -O3 -Wall
-CFLAGS = $(CFLAGS_$(COMPILE_MODE)) -I$(PROJECTDIR) -DSUBDIR=\"$(SUBDIR)\" #-DNO_LOG -DNO_ASSERT -DNO_PRECOND -DNO_ERROR
+CFLAGS = $(CFLAGS_$(COMPILE_MODE)) -I$(PROJECTDIR) -DSUBDIR=\"$(SUBDIR)\" #-DNO_LOG -DNO_ASSERT -DNO_PRECOND -DNO_ERROR -DNO_PROFILING -DNO_SIMD -DNO_FAST_CLOCK -DUSE_TSC_CLOCK -DUSE_ATOMIC_REFS -DUSE_LOG_RING -DHAVE_DNS_SD -DHAVE_ALSA
 CFLAGS_OBJ_SHARED = $(CFLAGS) -c -fPIC
 CFLAGS_OBJ_DYNAMIC = $(CFLAGS) -c -fPIC
 CFLAGS_OBJ_STATIC = $(CFLAGS) -c
@@ -0,0 +1,412 @@
+#ifdef HAVE_ALSA
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <alsa/asoundlib.h>
+
+#define MIDI_DRIVER_INTERNALS
+#include "alsa.h"
+#include "midi/runloop.h"
+#include "midi/driver.h"
+#include "midi/clock.h"
+#include "midi/message.h"
+#include "midi/sysex.h"
+
+#define ALSA_CLOCK_RATE   1000
+#define ALSA_BUFFER_SIZE  4096
+#define ALSA_POOL_SIZE    64
+#define ALSA_MAX_MESSAGES 64
+#define ALSA_MAX_SYSEX_SIZE 1048576 /* bytes of a reassembled message */
+
+/**
+ * @ingroup MIDI-driver
+ * @brief MIDIDriver implementation for ALSA raw MIDI devices.
+ * The device is opened in non-blocking mode and its file descriptors are
+ * served by the runloop. Incoming bytes are read in large chunks and decoded
+ * in a single pass, outgoing messages are encoded with running status into
+ * one buffer that is written when the device can accept more data.
+ * System exclusive messages that span several reads are reassembled in
+ * buffers from the driver's message pool and delivered when complete.
+ */
+struct MIDIDriverALSA {
+  struct MIDIDriver base;
+  snd_rawmidi_t * in;
+  snd_rawmidi_t * out;
+  int in_fd;
+  int out_fd;
+  struct MIDIMessagePool * pool;
+  struct MIDISysExAssembler * sysex;
+  MIDIRunningStatus in_status;
+  MIDIRunningStatus out_status;
+  size_t in_length;
+  size_t out_length;
+  unsigned char in_buffer[ALSA_BUFFER_SIZE];
+  unsigned char out_buffer[ALSA_BUFFER_SIZE];
+};
+
+/**
+ * @internal
+ * @cond INTERNALS
+ * @name Internals
+ * @{
+ */
+
+static int _alsa_fd( snd_rawmidi_t * rawmidi ) {
+  struct pollfd pfd;
+  if( rawmidi == NULL ) return -1;
+  if( snd_rawmidi_poll_descriptors( rawmidi, &pfd, 1 ) != 1 ) return -1;
+  return pfd.fd;
+}
+
+/**
+ * @brief Decode the bytes in the input buffer.
+ * All complete messages are passed to the driver's port, an incomplete
+ * message at the end of the buffer is moved to the front so that the next
+ * read continues it. System exclusive segments go to the assembler, a
+ * channel or system common message in between aborts the message.
+ * @private @memberof MIDIDriverALSA
+ * @param driver The driver.
+ * @param size   The number of bytes in the input buffer.
+ * @retval 0 on success.
+ * @retval >0 if the buffer could not be decoded or a message could not be dispatched.
+ */
+static int _alsa_decode( struct MIDIDriverALSA * driver, size_t size ) {
+  struct MIDICompactMessage compact[ALSA_MAX_MESSAGES];
+  struct MIDIMessage * message;
+  MIDITimestamp now;
+  size_t offset = 0, count, read, i;
+  int result = 0;
+
+  MIDIClockGetNow( driver->base.clock, &now );
+  MIDIProfileBegin( driver->base.profile, MIDI_DRIVER_STAGE_DECODE );
+  while( offset < size ) {
+    count = 0;
+    read  = 0;
+    if( MIDIMessageDecodeStream( size - offset, &(driver->in_buffer[offset]), &(driver->in_status),
+                                 ALSA_MAX_MESSAGES, &(compact[0]), &count, &read ) ) {
+      /* skip the garbage and start over */
+      MIDILog( DEBUG, "could not decode ALSA raw MIDI data\n" );
+      driver->in_status = 0;
+      offset = size;
+      result = 1;
+      break;
+    }
+    for( i=0; i<count; i++ ) {
+      message = NULL;
+      if( compact[i].bytes[0] == MIDI_STATUS_SYSTEM_EXCLUSIVE && driver->sysex != NULL ) {
+        if( MIDISysExAssemblerAppendCompact( driver->sysex, &(compact[i]), &(driver->in_buffer[offset]), &message ) ) {
+          MIDIProfileAdd( driver->base.profile, drops, 1 );
+          result = 1;
+        }
+        if( message == NULL ) continue;
+      } else {
+        if( compact[i].bytes[0] < MIDI_STATUS_TIMING_CLOCK && driver->sysex != NULL ) {
+          MIDISysExAssemblerCancel( driver->sysex );
+        }
+        message = MIDIMessageCreateFromPool( driver->pool, MIDI_STATUS_RESET );
+        if( message == NULL ) {
+          MIDIProfileAdd( driver->base.profile, drops, count - i );
+          result = 1;
+          break;
+        }
+        if( MIDIMessageSetCompact( message, &(compact[i]), &(driver->in_buffer[offset]) ) ) {
+          MIDIMessageRelease( message );
+          continue;
+        }
+      }
+      MIDIMessageSetTimestamp( message, now );
+      result += MIDIDriverReceive( &(driver->base), message );
+      MIDIMessageRelease( message );
+    }
+    if( read == 0 ) break; /* incomplete message at the end of the buffer */
+    offset += read;
+  }
+  MIDIProfileEnd( driver->base.profile, MIDI_DRIVER_STAGE_DECODE );
+
+  driver->in_length = size - offset;
+  if( driver->in_length > 0 && offset > 0 ) {
+    memmove( &(driver->in_buffer[0]), &(driver->in_buffer[offset]), driver->in_length );
+  }
+  return result;
+}
+
+static int _alsa_read_fds( void * drv, int nfds, fd_set * fds ) {
+  struct MIDIDriverALSA * driver = drv;
+  if( nfds <= 0 || driver->in_fd < 0 || !FD_ISSET( driver->in_fd, fds ) ) return 0;
+  return MIDIDriverALSAReceive( driver );
+}
+
+static int _alsa_write_fds( void * drv, int nfds, fd_set * fds ) {
+  struct MIDIDriverALSA * driver = drv;
+  if( nfds <= 0 || driver->out_fd < 0 || !FD_ISSET( driver->out_fd, fds ) ) return 0;
+  return MIDIDriverALSASend( driver );
+}
+
+static int _alsa_idle_timeout( void * drv, struct timespec * ts ) {
+  return 0;
+}
+
+static int _driver_send( void * driverp, struct MIDIMessage * message ) {
+  return MIDIDriverALSASendMessage( driverp, message );
+}
+
+void MIDIDriverALSADestroy( struct MIDIDriverALSA * driver );
+static void _driver_destroy( void * driverp ) {
+  MIDIDriverALSADestroy( driverp );
+}
+
+/**
+ * @}
+ * @endcond
+ */
+
+/* MARK: Creation and destruction *//**
+ * @name Creation and destruction
+ * Creating, destroying and reference counting of MIDIDriverALSA objects.
+ * @{
+ */
+
+/**
+ * @brief Create a MIDIDriverALSA instance.
+ * Allocate space and initialize an MIDIDriverALSA instance that reads from
+ * and writes to the given raw MIDI device. Devices that only support one
+ * direction are opened for that direction only.
+ * @public @memberof MIDIDriverALSA
+ * @param name   The name of the driver.
+ * @param device The ALSA name of the raw MIDI device, for example "hw:1,0,0".
+ * @return a pointer to the created driver structure on success.
+ * @return a @c NULL pointer if the driver could not created.
+ */
+struct MIDIDriverALSA * MIDIDriverALSACreate( char * name, char * device ) {
+  struct MIDIDriverALSA * driver = malloc( sizeof( struct MIDIDriverALSA ) );
+  struct MIDIRunloopSourceDelegate delegate = { NULL, &_alsa_read_fds, &_alsa_write_fds, &_alsa_idle_timeout };
+  int err;
+  MIDIPrecondReturn( driver != NULL, ENOMEM, NULL );
+  MIDIDriverInit( &(driver->base), name, ALSA_CLOCK_RATE );
+
+  driver->in  = NULL;
+  driver->out = NULL;
+  driver->in_status  = 0;
+  driver->out_status = 0;
+  driver->in_length  = 0;
+  driver->out_length = 0;
+  driver->pool = MIDIMessagePoolCreate( ALSA_POOL_SIZE );
+  driver->sysex = MIDISysExAssemblerCreate( ALSA_MAX_SYSEX_SIZE );
+  if( driver->sysex != NULL ) {
+    MIDISysExAssemblerSetPool( driver->sysex, driver->pool );
+  }
+
+  driver->base.send    = &_driver_send;
+  driver->base.destroy = &_driver_destroy;
+
+  err = snd_rawmidi_open( &(driver->in), &(driver->out), device, SND_RAWMIDI_NONBLOCK );
+  if( err < 0 ) err = snd_rawmidi_open( &(driver->in), NULL, device, SND_RAWMIDI_NONBLOCK );
+  if( err < 0 ) err = snd_rawmidi_open( NULL, &(driver->out), device, SND_RAWMIDI_NONBLOCK );
+  if( err < 0 ) {
+    MIDIError( -err, "Could not open ALSA raw MIDI device." );
+  }
+  driver->in_fd  = _alsa_fd( driver->in );
+  driver->out_fd = _alsa_fd( driver->out );
+
+  delegate.info = driver;
+  driver->base.rls = MIDIRunloopSourceCreate( &delegate );
+  if( driver->in_fd >= 0 ) {
+    MIDIRunloopSourceScheduleRead( driver->base.rls, driver->in_fd );
+  }
+  return driver;
+}
+
+/**
+ * @brief Destroy a MIDIDriverALSA instance.
+ * Free all resources occupied by the driver.
+ * @public @memberof MIDIDriverALSA
+ * @param driver The driver.
+ */
+void MIDIDriverALSADestroy( struct MIDIDriverALSA * driver ) {
+  if( driver->in != NULL ) {
+    MIDIRunloopSourceClearRead( driver->base.rls, driver->in_fd );
+    snd_rawmidi_close( driver->in );
+  }
+  if( driver->out != NULL ) {
+    MIDIRunloopSourceClearWrite( driver->base.rls, driver->out_fd );
+    snd_rawmidi_close( driver->out );
+  }
+  if( driver->sysex != NULL ) {
+    MIDISysExAssemblerRelease( driver->sysex );
+  }
+  if( driver->pool != NULL ) {
+    MIDIMessagePoolRelease( driver->pool );
+  }
+}
+
+/**
+ * @brief Retain a MIDIDriverALSA instance.
+ * @public @memberof MIDIDriverALSA
+ * @param driver The driver.
+ */
+void MIDIDriverALSARetain( struct MIDIDriverALSA * driver ) {
+  MIDIDriverRetain( &(driver->base) );
+}
+
+/**
+ * @brief Release a MIDIDriverALSA instance.
+ * @public @memberof MIDIDriverALSA
+ * @param driver The driver.
+ */
+void MIDIDriverALSARelease( struct MIDIDriverALSA * driver ) {
+  MIDIDriverRelease( &(driver->base) );
+}
+
+/** @} */
+
+/* MARK: Configuration *//**
+ * @name Configuration
+ * @{
+ */
+
+/**
+ * @brief Get the file descriptors of the device.
+ * @public @memberof MIDIDriverALSA
+ * @param driver The driver.
+ * @param in     The input file descriptor, -1 if the device has no input.
+ * @param out    The output file descriptor, -1 if the device has no output.
+ * @retval 0 on success.
+ */
+int MIDIDriverALSAGetFileDescriptors( struct MIDIDriverALSA * driver, int * in, int * out ) {
+  MIDIPrecond( driver != NULL, EFAULT );
+  if( in != NULL )  *in  = driver->in_fd;
+  if( out != NULL ) *out = driver->out_fd;
+  return 0;
+}
+
+/** @} */
+
+/* MARK: Sending and receiving *//**
+ * @name Sending and receiving
+ * @{
+ */
+
+/**
+ * @brief Process outgoing MIDI messages.
+ * The message is appended to the output buffer using running status and
+ * the output is scheduled for writing, so all messages that are sent
+ * during one runloop iteration are written with a single call.
+ * @public @memberof MIDIDriverALSA
+ * @param driver  The driver.
+ * @param message The message that should be sent.
+ * @retval 0 on success.
+ * @retval >0 if the message could not be processed.
+ */
+int MIDIDriverALSASendMessage( struct MIDIDriverALSA * driver, struct MIDIMessage * message ) {
+  size_t count, written;
+  int attempt;
+  MIDIPrecond( driver != NULL, EFAULT );
+  MIDIPrecond( message != NULL, EINVAL );
+
+  if( driver->out == NULL ) {
+    MIDIProfileAdd( driver->base.profile, drops, 1 );
+    return 1;
+  }
+  for( attempt=0; attempt<2; attempt++ ) {
+    count   = 0;
+    written = 0;
+    MIDIProfileBegin( driver->base.profile, MIDI_DRIVER_STAGE_ENCODE );
+    if( MIDIMessageEncodeTimedStream( ALSA_BUFFER_SIZE - driver->out_length, &(driver->out_buffer[driver->out_length]),
+                                      &(driver->out_status), 1, &message, NULL, &count, &written ) ) {
+      MIDIProfileEnd( driver->base.profile, MIDI_DRIVER_STAGE_ENCODE );
+      break;
+    }
+    MIDIProfileEnd( driver->base.profile, MIDI_DRIVER_STAGE_ENCODE );
+    if( count == 1 ) {
+      driver->out_length += written;
+      MIDIProfileAdd( driver->base.profile, messages_out, 1 );
+      MIDIDriverSetQueueDepth( &(driver->base), driver->out_length );
+      MIDIRunloopSourceScheduleWrite( driver->base.rls, driver->out_fd );
+      return 0;
+    }
+    if( driver->out_length == 0 ) break;
+    MIDIDriverALSASend( driver );
+  }
+  MIDILog( DEBUG, "could not buffer ALSA message, dropping message\n" );
+  MIDIProfileAdd( driver->base.profile, drops, 1 );
+  return 1;
+}
+
+/**
+ * @brief Write the output buffer to the device.
+ * As much of the buffer as the device accepts is written with a single
+ * call, the rest is kept until the device becomes writable again.
+ * @public @memberof MIDIDriverALSA
+ * @param driver The driver.
+ * @retval 0 on success.
+ * @retval >0 if the device could not be written to.
+ */
+int MIDIDriverALSASend( struct MIDIDriverALSA * driver ) {
+  ssize_t bytes;
+  MIDIPrecond( driver != NULL, EFAULT );
+
+  if( driver->out_length == 0 ) {
+    MIDIRunloopSourceClearWrite( driver->base.rls, driver->out_fd );
+    return 0;
+  }
+  MIDIProfileBegin( driver->base.profile, MIDI_DRIVER_STAGE_SOCKET_WRITE );
+  bytes = snd_rawmidi_write( driver->out, &(driver->out_buffer[0]), driver->out_length );
+  MIDIProfileEnd( driver->base.profile, MIDI_DRIVER_STAGE_SOCKET_WRITE );
+  if( bytes == -EAGAIN ) return 0;
+  if( bytes < 0 ) {
+    /* discard the buffer, the next message starts with a status byte */
+    MIDIError( -bytes, "Could not write to ALSA raw MIDI device." );
+    MIDIProfileAdd( driver->base.profile, drops, 1 );
+    MIDIRunloopSourceClearWrite( driver->base.rls, driver->out_fd );
+    driver->out_length = 0;
+    driver->out_status = 0;
+    return 1;
+  }
+  MIDIProfileAdd( driver->base.profile, packets_out, 1 );
+  MIDIProfileAdd( driver->base.profile, bytes_out, bytes );
+  driver->out_length -= bytes;
+  if( driver->out_length > 0 ) {
+    memmove( &(driver->out_buffer[0]), &(driver->out_buffer[bytes]), driver->out_length );
+  } else {
+    MIDIRunloopSourceClearWrite( driver->base.rls, driver->out_fd );
+  }
+  MIDIDriverSetQueueDepth( &(driver->base), driver->out_length );
+  return 0;
+}
+
+/**
+ * @brief Read from the device.
+ * Read until the device has no more data or the input buffer is full and
+ * decode everything that was read.
+ * @public @memberof MIDIDriverALSA
+ * @param driver The driver.
+ * @retval 0 on success.
+ * @retval >0 if the device could not be read from or a message could not be processed.
+ */
+int MIDIDriverALSAReceive( struct MIDIDriverALSA * driver ) {
+  ssize_t bytes;
+  size_t space;
+  int result = 0;
+  MIDIPrecond( driver != NULL, EFAULT );
+
+  if( driver->in == NULL ) return 1;
+  do {
+    space = ALSA_BUFFER_SIZE - driver->in_length;
+    MIDIProfileBegin( driver->base.profile, MIDI_DRIVER_STAGE_SOCKET_READ );
+    bytes = snd_rawmidi_read( driver->in, &(driver->in_buffer[driver->in_length]), space );
+    MIDIProfileEnd( driver->base.profile, MIDI_DRIVER_STAGE_SOCKET_READ );
+    if( bytes == -EAGAIN || bytes == 0 ) break;
+    if( bytes < 0 ) {
+      MIDIError( -bytes, "Could not read from ALSA raw MIDI device." );
+      return 1;
+    }
+    MIDIProfileAdd( driver->base.profile, packets_in, 1 );
+    MIDIProfileAdd( driver->base.profile, bytes_in, bytes );
+    result += _alsa_decode( driver, driver->in_length + bytes );
+  } while( (size_t) bytes == space );
+  return result;
+}
+
+/** @} */
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef MIDI_DRIVER_ALSA_H
+#define MIDI_DRIVER_ALSA_H
+#include <stdlib.h>
+
+#ifndef MIDI_DRIVER_INTERNALS
+/**
+ * When used as an opaque pointer type, an instance of
+ * MIDIDriverALSA can be used as a MIDIDriver.
+ */
+#define MIDIDriverALSA MIDIDriver
+#endif
+
+struct MIDIMessage;
+struct MIDIDriverALSA;
+
+struct MIDIDriverALSA * MIDIDriverALSACreate( char * name, char * device );
+void MIDIDriverALSARetain( struct MIDIDriverALSA * driver );
+void MIDIDriverALSARelease( struct MIDIDriverALSA * driver );
+
+int MIDIDriverALSAGetFileDescriptors( struct MIDIDriverALSA * driver, int * in, int * out );
+
+int MIDIDriverALSASendMessage( struct MIDIDriverALSA * driver, struct MIDIMessage * message );
+
+int MIDIDriverALSASend( struct MIDIDriverALSA * driver );
+int MIDIDriverALSAReceive( struct MIDIDriverALSA * driver );
+
+#endif
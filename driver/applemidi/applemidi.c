@@ -1,10 +1,19 @@
 #include <string.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <sys/select.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#ifdef __linux__
+#include <linux/filter.h>
+#endif
+#ifdef HAVE_DNS_SD
+#include <dns_sd.h>
+#endif
 
 #define MIDI_DRIVER_INTERNALS
 #include "applemidi.h"
@@ -18,6 +27,10 @@
 #include "midi/message.h"
 #include "midi/message_queue.h"
 #include "midi/event.h"
+#include "midi/port.h"
+#include "midi/router.h"
+#include "midi/scheduler.h"
+#include "midi/metrics.h"
 
 #define APPLEMIDI_CLOCK_RATE 10000
 
@@ -26,6 +39,32 @@
 
 #define APPLEMIDI_MAX_MESSAGES_PER_PACKET 16
 #define APPLEMIDI_MSG_BUFFER_SIZE 16
+#define APPLEMIDI_DEFERRED_COMMANDS 8
+#define APPLEMIDI_QUEUE_SIZE 256
+#define APPLEMIDI_REALTIME_QUEUE_SIZE 64
+#define APPLEMIDI_MAX_SYSEX_SIZE 1048576 /* bytes of a reassembled message */
+
+#define APPLEMIDI_JITTER_WINDOW     64
+#define APPLEMIDI_JITTER_PERCENTILE 95
+
+#define APPLEMIDI_SYNC_WINDOW           16
+#define APPLEMIDI_SYNC_BURST             6
+#define APPLEMIDI_SYNC_BURST_INTERVAL  500 /* msec */
+#define APPLEMIDI_SYNC_INTERVAL      10000 /* msec */
+#define APPLEMIDI_SYNC_TIMEOUT        1000 /* msec */
+#define APPLEMIDI_SYNC_MAX_SKEW       1e-3
+
+#define APPLEMIDI_SYNC_IDLE      0
+#define APPLEMIDI_SYNC_INITIATOR 1 /* sent CK0, waits for CK1 */
+#define APPLEMIDI_SYNC_RESPONDER 2 /* sent CK1, waits for CK2 */
+
+#define APPLEMIDI_INVITE_RETRY    1000 /* msec */
+#define APPLEMIDI_INVITE_ATTEMPTS   12
+
+#define APPLEMIDI_MSEC_TO_TICKS( ms ) ( (MIDITimestamp) (ms) * APPLEMIDI_CLOCK_RATE / 1000 )
+
+#define APPLEMIDI_HOSTNAME_LEN 256
+#define APPLEMIDI_SERVICE_TYPE "_apple-midi._udp"
 
 struct AppleMIDICommand {
   struct RTPPeer * peer; /* use peers sockaddr instead .. we get initialization problems otherwise */
@@ -59,11 +98,100 @@ struct AppleMIDIPeer {
   unsigned short port;
   unsigned long token;
   unsigned long ssrc;
-  unsigned long long timestamp_delay;
-  unsigned long long timestamp_diff;
+  MIDITimestamp timestamp_delay;
+  MIDITimestamp timestamp_diff;
   struct RTPMIDIPeer * rtp_peer;
+  unsigned char synced;
+  unsigned char sync_state;
+  MIDITimestamp sync_started;
+  unsigned long sync_count;
+  size_t        sync_samples;
+  MIDITimestamp sync_time;
+  MIDITimestamp next_sync;
+  double        skew;
+  struct MIDIClock * clock;
+  MIDITimestamp sync_local[APPLEMIDI_SYNC_WINDOW];
+  MIDITimestamp sync_diff[APPLEMIDI_SYNC_WINDOW];
+  MIDITimestamp latency;
+  size_t        transit_count;
+  MIDITimestamp transit[APPLEMIDI_JITTER_WINDOW];
+  unsigned long transit_packets;
+  MIDITimestamp last_transit;
+  double        jitter;
+  unsigned long feedback_count;
+};
+
+/**
+ * @brief An invitation that waits for an answer.
+ * The invitation is sent to the peer's control port first and to its RTP
+ * port once it was accepted there. Every stage is resent on a timer of its
+ * own until the peer answers, so any number of invitations can be pending
+ * at the same time.
+ */
+struct AppleMIDIInvitation {
+  struct AppleMIDIInvitation * next;
+  struct MIDIDriverAppleMIDI * driver;
+  struct sockaddr_storage addr; /* control address */
+  socklen_t     size;
+  unsigned char stage;
+  unsigned char attempts;
+  unsigned long timer;
+};
+
+/**
+ * @brief A host name that waits to be resolved.
+ */
+struct AppleMIDIResolveRequest {
+  struct AppleMIDIResolveRequest * next;
+  unsigned char  remove;
+  unsigned short port;
+  char host[APPLEMIDI_HOSTNAME_LEN];
 };
 
+/**
+ * @brief The result of a name resolution.
+ * Sent as a single datagram from the resolver thread to the driver.
+ */
+struct AppleMIDIResolution {
+  unsigned char  remove;
+  int            error;
+  socklen_t      size;
+  struct sockaddr_storage addr;
+  char host[APPLEMIDI_HOSTNAME_LEN];
+};
+
+/**
+ * @brief Resolve host names off the runloop.
+ * A thread works through the requests in order and sends the results
+ * to a datagram socket that is part of the driver's runloop source.
+ * The resolver is shared by the thread and the driver and outlives the
+ * driver if a lookup is still running when the driver is destroyed.
+ */
+struct AppleMIDIResolver {
+  int refs;
+  int fds[2];
+  int quit;
+  pthread_t       thread;
+  pthread_mutex_t lock;
+  pthread_cond_t  cond;
+  struct AppleMIDIResolveRequest * first;
+  struct AppleMIDIResolveRequest * last;
+};
+
+#ifdef HAVE_DNS_SD
+/**
+ * @brief An AppleMIDI service that was found on the network.
+ */
+struct AppleMIDIService {
+  struct AppleMIDIService * next;
+  struct MIDIDriverAppleMIDI * driver;
+  DNSServiceRef resolve;
+  unsigned short port;
+  char name[64];
+  char host[APPLEMIDI_HOSTNAME_LEN];
+};
+#endif
+
 /**
  * @ingroup MIDI-driver
  * @brief MIDIDriver implementation using Apple's network MIDI protocol.
@@ -74,23 +202,62 @@ struct MIDIDriverAppleMIDI {
   int rtp_socket;
   unsigned short port;
   unsigned char  accept;
-  unsigned char  sync;
+  unsigned char  reuse;
   unsigned long  token;
   char name[32];
-  
-  struct AppleMIDICommand  command;
 
-  struct RTPPeer * peer;
+  struct AppleMIDIInvitation * invitations;
+  struct AppleMIDICommand deferred[APPLEMIDI_DEFERRED_COMMANDS];
+  size_t ndeferred;
+
   struct RTPSession * rtp_session;
   struct RTPMIDISession * rtpmidi_session;
 
   struct MIDIMessageQueue * in_queue;
   struct MIDIMessageQueue * out_queue;
+  struct MIDIMessageQueue * rt_queue;
+
+  struct timespec batch_window;
+  size_t          batch_size;
+  unsigned long   batch_timer;
+  int             queue_policy;
+
+  unsigned long   sync_timer;
+
+  size_t          nstreams;
+  unsigned long   stream_timer;
+  unsigned long   sysex_timer;
+
+  struct MIDIScheduler * jitter_buffer;
+  struct MIDIPort      * jitter_port;
+  MIDITimestamp          jitter_min;
+  MIDITimestamp          jitter_max;
+
+  struct MIDIDriverAppleMIDI * forward;
+  struct MIDIRouterFilter      forward_filter;
+  int                          forward_filtered;
+
+  struct AppleMIDIResolver * resolver;
+#ifdef HAVE_DNS_SD
+  DNSServiceRef             browser;
+  struct AppleMIDIService * services;
+#endif
 };
 
 static int _applemidi_read_fds( void * drv, int nfds, fd_set * fds );
 static int _applemidi_write_fds( void * drv, int nfsd, fd_set * fds );
 static int _applemidi_idle_timeout( void * drv, struct timespec * ts );
+static int _applemidi_arm_sync_timer( struct MIDIDriverAppleMIDI * driver );
+static int _applemidi_arm_stream_timer( struct MIDIDriverAppleMIDI * driver );
+static int _applemidi_arm_sysex_timer( struct MIDIDriverAppleMIDI * driver );
+static int _applemidi_defer_command( void * drv, size_t size, void * data, socklen_t addrlen, struct sockaddr * addr );
+static void _applemidi_resolver_release( struct AppleMIDIResolver * resolver );
+static void _applemidi_resolver_stop( struct AppleMIDIResolver * resolver );
+static int _applemidi_resolver_read( struct MIDIDriverAppleMIDI * driver );
+#ifdef HAVE_DNS_SD
+static int _applemidi_browser_read( struct MIDIDriverAppleMIDI * driver, fd_set * readfds );
+static int _applemidi_browser_init_fds( struct MIDIDriverAppleMIDI * driver, fd_set * fds, int nfds );
+#endif
 
 static int _applemidi_init_runloop_source( struct MIDIDriverAppleMIDI * driver ) {
   struct MIDIRunloopSourceDelegate delegate = {
@@ -144,14 +311,18 @@ static int _applemidi_update_runloop_source( struct MIDIDriverAppleMIDI * driver
   size_t in = 0, out = 0;
   struct timespec ts = { 1, 500000000 };
 
+  size_t rt = 0;
+
   MIDIMessageQueueGetLength( driver->in_queue,  &in );
   MIDIMessageQueueGetLength( driver->out_queue, &out );
+  MIDIMessageQueueGetLength( driver->rt_queue,  &rt );
+  out += rt;
   if( in == 0 ) {
     MIDIRunloopSourceScheduleRead( driver->base.rls, driver->rtp_socket );
   } else {
     MIDIRunloopSourceClearRead( driver->base.rls, driver->rtp_socket );
   }
-  if( driver->accept || (driver->sync>0) ) {
+  if( driver->accept || driver->invitations != NULL ) {
     MIDIRunloopSourceScheduleRead( driver->base.rls, driver->control_socket );
   }
   if( out == 0 ) {
@@ -167,6 +338,23 @@ static int _applemidi_update_runloop_source( struct MIDIDriverAppleMIDI * driver
   return 0;
 }
 
+/**
+ * @brief Let the workers of a server bind the same port.
+ * @private @memberof MIDIDriverAppleMIDI
+ * @param driver The driver.
+ * @param fd     The socket, before it is bound.
+ * @retval 0 on success.
+ * @retval >0 if the option could not be set.
+ */
+static int _applemidi_reuse_port( struct MIDIDriverAppleMIDI * driver, int fd ) {
+#ifdef SO_REUSEPORT
+  int on = 1;
+  if( ! driver->reuse || fd < 0 ) return 0;
+  return setsockopt( fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on) ) ? 1 : 0;
+#else
+  return driver->reuse ? 1 : 0;
+#endif
+}
 
 static int _applemidi_connect( struct MIDIDriverAppleMIDI * driver ) {
   struct sockaddr_in addr;
@@ -178,6 +366,7 @@ static int _applemidi_connect( struct MIDIDriverAppleMIDI * driver ) {
     addr.sin_port = htons( driver->port );
 
     driver->control_socket = socket( PF_INET, SOCK_DGRAM, 0 );
+    _applemidi_reuse_port( driver, driver->control_socket );
     result = bind( driver->control_socket, (struct sockaddr *) &addr, sizeof(addr) );
   }
 
@@ -187,6 +376,7 @@ static int _applemidi_connect( struct MIDIDriverAppleMIDI * driver ) {
     addr.sin_port = htons( driver->port + 1 );
 
     driver->rtp_socket = socket( PF_INET, SOCK_DGRAM, 0 );
+    _applemidi_reuse_port( driver, driver->rtp_socket );
     result = bind( driver->rtp_socket, (struct sockaddr *) &addr, sizeof(addr) );
   }
 
@@ -194,8 +384,69 @@ static int _applemidi_connect( struct MIDIDriverAppleMIDI * driver ) {
 }
 
 static int _applemidi_endsession( struct MIDIDriverAppleMIDI *, int, socklen_t, struct sockaddr * );
+static void _applemidi_invitation_remove( struct MIDIDriverAppleMIDI *, struct AppleMIDIInvitation * );
 static int _applemidi_control_addr( socklen_t, struct sockaddr *, struct sockaddr * );
 
+/**
+ * @brief Get the AppleMIDI state of an RTP peer.
+ * The state is created when it is requested for the first time.
+ * @private @memberof MIDIDriverAppleMIDI
+ * @param peer The RTP peer.
+ * @return a pointer to the peer state on success.
+ * @return a @c NULL pointer if the state could not be created.
+ */
+static struct AppleMIDIPeer * _applemidi_peer( struct RTPPeer * peer ) {
+  struct AppleMIDIPeer * info = NULL;
+  RTPMIDIPeerGetInfo( peer, (void **) &info );
+  if( info == NULL ) {
+    info = malloc( sizeof( struct AppleMIDIPeer ) );
+    if( info == NULL ) return NULL;
+    memset( info, 0, sizeof( struct AppleMIDIPeer ) );
+    RTPPeerGetSSRC( peer, &(info->ssrc) );
+    RTPMIDIPeerSetInfo( peer, info );
+  }
+  return info;
+}
+
+/**
+ * @brief Get the difference between a peer's clock and the driver's clock.
+ * Extrapolate the fitted offset to the given time.
+ * @private @memberof MIDIDriverAppleMIDI
+ * @param peer The peer.
+ * @param now  The time of the driver's clock.
+ * @return the offset in ticks of the driver's clock.
+ */
+static MIDITimestamp _applemidi_peer_diff( struct AppleMIDIPeer * peer, MIDITimestamp now ) {
+  return peer->timestamp_diff + (MIDITimestamp) ( peer->skew * ( now - peer->sync_time ) );
+}
+
+/**
+ * @brief Remove a peer from the RTP session and free its AppleMIDI and RTP-MIDI state.
+ * @private @memberof MIDIDriverAppleMIDI
+ * @param driver The driver.
+ * @param peer   The RTP peer.
+ * @retval 0 on success.
+ * @retval >0 if the peer could not be removed.
+ */
+static int _applemidi_remove_peer( struct MIDIDriverAppleMIDI * driver, struct RTPPeer * peer ) {
+  struct AppleMIDIPeer * info = NULL;
+  int fd = -1;
+  RTPPeerGetStream( peer, &fd );
+  if( fd >= 0 ) {
+    MIDIRunloopSourceClearRead( driver->base.rls, fd );
+    MIDIRunloopSourceClearWrite( driver->base.rls, fd );
+    RTPPeerSetStream( peer, -1 );
+    driver->nstreams--;
+  }
+  RTPMIDIPeerGetInfo( peer, (void **) &info );
+  if( info != NULL ) {
+    RTPMIDIPeerSetInfo( peer, NULL );
+    if( info->clock != NULL ) MIDIClockRelease( info->clock );
+    free( info );
+  }
+  return RTPMIDISessionRemovePeer( driver->rtpmidi_session, peer );
+}
+
 static int _applemidi_disconnect_peer( struct MIDIDriverAppleMIDI * driver, struct RTPPeer * peer ) {
   int result = 0;
   struct sockaddr * rtp_addr = NULL;
@@ -206,7 +457,7 @@ static int _applemidi_disconnect_peer( struct MIDIDriverAppleMIDI * driver, stru
   }
   _applemidi_control_addr( size, rtp_addr, (struct sockaddr *) &addr );
   result = _applemidi_endsession( driver, driver->control_socket, size, (struct sockaddr *) &addr );
-  RTPSessionRemovePeer( driver->rtp_session, peer );
+  _applemidi_remove_peer( driver, peer );
   return result;
 }
 
@@ -260,14 +511,7 @@ static void _driver_destroy( void * driverp ) {
  * @{
  */
 
-/**
- * @brief Create a MIDIDriverAppleMIDI instance.
- * Allocate space and initialize an MIDIDriverAppleMIDI instance.
- * @public @memberof MIDIDriverAppleMIDI
- * @return a pointer to the created driver structure on success.
- * @return a @c NULL pointer if the driver could not created.
- */
-struct MIDIDriverAppleMIDI * MIDIDriverAppleMIDICreate( char * name, unsigned short port ) {
+static struct MIDIDriverAppleMIDI * _applemidi_create( char * name, unsigned short port, unsigned char reuse ) {
   struct MIDIDriverAppleMIDI * driver;
   MIDITimestamp timestamp;
 
@@ -279,33 +523,73 @@ struct MIDIDriverAppleMIDI * MIDIDriverAppleMIDICreate( char * name, unsigned sh
   driver->rtp_socket     = 0;
   driver->port           = port;
   driver->accept         = 0;
-  driver->sync           = 0;
+  driver->reuse          = reuse;
   strncpy( &(driver->name[0]), name, sizeof(driver->name) );
 
-  driver->in_queue  = MIDIMessageQueueCreate();
-  driver->out_queue = MIDIMessageQueueCreate();
+  driver->in_queue  = MIDIMessageQueueCreateRing( APPLEMIDI_QUEUE_SIZE );
+  driver->out_queue = MIDIMessageQueueCreateRing( APPLEMIDI_QUEUE_SIZE );
+  driver->rt_queue  = MIDIMessageQueueCreateRing( APPLEMIDI_REALTIME_QUEUE_SIZE );
+
+  driver->batch_window.tv_sec  = 0;
+  driver->batch_window.tv_nsec = 0;
+  driver->batch_size  = APPLEMIDI_MAX_MESSAGES_PER_PACKET;
+  driver->batch_timer = 0;
+  driver->queue_policy = MIDI_QUEUE_POLICY_DROP_NEWEST;
+  MIDIMessageQueueSetLimit( driver->out_queue, 0, driver->queue_policy );
+
+  driver->sync_timer  = 0;
+  driver->invitations = NULL;
+
+  driver->nstreams     = 0;
+  driver->stream_timer = 0;
+  driver->sysex_timer  = 0;
+
+  driver->jitter_buffer = NULL;
+  driver->jitter_port   = NULL;
+  driver->jitter_min    = 0;
+  driver->jitter_max    = 0;
+
+  driver->forward          = NULL;
+  driver->forward_filtered = 0;
+
+  driver->resolver = NULL;
+#ifdef HAVE_DNS_SD
+  driver->browser  = NULL;
+  driver->services = NULL;
+#endif
   
   driver->base.send    = &_driver_send;
   driver->base.destroy = &_driver_destroy;
   
   _applemidi_connect( driver );
 
-  driver->peer = NULL;
   driver->rtp_session     = RTPSessionCreate( driver->rtp_socket );  
   driver->rtpmidi_session = RTPMIDISessionCreate( driver->rtp_session );
+  driver->ndeferred       = 0;
+  RTPMIDISessionSetSysExAssembly( driver->rtpmidi_session, 1, APPLEMIDI_MAX_SYSEX_SIZE );
+  RTPSessionSetForeignHandler( driver->rtp_session, &_applemidi_defer_command, driver );
 
   MIDIClockGetNow( driver->base.clock, &timestamp );
   MIDILog( DEBUG, "initial timestamp: %lli\n", timestamp );
   driver->token = timestamp;
 
-  memset( &(driver->command), 0, sizeof(driver->command) );
-  driver->command.peer = NULL;
-
   _applemidi_init_runloop_source( driver );
+  _applemidi_arm_sync_timer( driver );
 
   return driver;
 }
 
+/**
+ * @brief Create a MIDIDriverAppleMIDI instance.
+ * Allocate space and initialize an MIDIDriverAppleMIDI instance.
+ * @public @memberof MIDIDriverAppleMIDI
+ * @return a pointer to the created driver structure on success.
+ * @return a @c NULL pointer if the driver could not created.
+ */
+struct MIDIDriverAppleMIDI * MIDIDriverAppleMIDICreate( char * name, unsigned short port ) {
+  return _applemidi_create( name, port, 0 );
+}
+
 /**
  * @brief Destroy a MIDIDriverAppleMIDI instance.
  * Free all resources occupied by the driver.
@@ -313,11 +597,42 @@ struct MIDIDriverAppleMIDI * MIDIDriverAppleMIDICreate( char * name, unsigned sh
  * @param driver The driver.
  */
 void MIDIDriverAppleMIDIDestroy( struct MIDIDriverAppleMIDI * driver ) {
+  if( driver->batch_timer != 0 ) {
+    MIDIRunloopSourceCancelTimer( driver->base.rls, driver->batch_timer );
+  }
+  if( driver->sync_timer != 0 ) {
+    MIDIRunloopSourceCancelTimer( driver->base.rls, driver->sync_timer );
+  }
+  if( driver->stream_timer != 0 ) {
+    MIDIRunloopSourceCancelTimer( driver->base.rls, driver->stream_timer );
+  }
+  if( driver->sysex_timer != 0 ) {
+    MIDIRunloopSourceCancelTimer( driver->base.rls, driver->sysex_timer );
+  }
+  while( driver->invitations != NULL ) {
+    _applemidi_invitation_remove( driver, driver->invitations );
+  }
+  if( driver->jitter_buffer != NULL ) {
+    MIDISchedulerRelease( driver->jitter_buffer );
+  }
+  if( driver->jitter_port != NULL ) {
+    MIDIPortInvalidate( driver->jitter_port );
+    MIDIPortRelease( driver->jitter_port );
+  }
+  if( driver->forward != NULL ) {
+    MIDIDriverRelease( &(driver->forward->base) );
+  }
+  MIDIDriverAppleMIDIStopBrowsing( driver );
+  if( driver->resolver != NULL ) {
+    MIDIRunloopSourceClearRead( driver->base.rls, driver->resolver->fds[0] );
+    _applemidi_resolver_stop( driver->resolver );
+  }
   _applemidi_disconnect( driver, 0 );
   RTPMIDISessionRelease( driver->rtpmidi_session );
   RTPSessionRelease( driver->rtp_session );
   MIDIMessageQueueRelease( driver->in_queue );
   MIDIMessageQueueRelease( driver->out_queue );
+  MIDIMessageQueueRelease( driver->rt_queue );
 }
 
 /** @} */
@@ -401,6 +716,86 @@ int MIDIDriverAppleMIDIGetControlSocket( struct MIDIDriverAppleMIDI * driver, in
   return 0;
 }
 
+/**
+ * @brief Get the number of connected peers.
+ * @public @memberof MIDIDriverAppleMIDI
+ * @param driver The driver.
+ * @param count  The number of peers.
+ * @retval 0 on success.
+ */
+int MIDIDriverAppleMIDIGetPeerCount( struct MIDIDriverAppleMIDI * driver, size_t * count ) {
+  struct RTPPeer * peer = NULL;
+  MIDIPrecond( driver != NULL, EFAULT );
+  MIDIPrecond( count != NULL, EINVAL );
+  *count = 0;
+  RTPSessionNextPeer( driver->rtp_session, &peer );
+  while( peer != NULL ) {
+    (*count)++;
+    RTPSessionNextPeer( driver->rtp_session, &peer );
+  }
+  return 0;
+}
+
+/**
+ * @brief Set the time window in which outgoing messages are collected.
+ * Messages that are sent within the window are coalesced into a single packet.
+ * The window starts with the first message that is queued and is measured using
+ * a timer on the driver's runloop source, so the source must be part of a
+ * running runloop. A window of zero sends every message immediately.
+ * @public @memberof MIDIDriverAppleMIDI
+ * @param driver The driver.
+ * @param usec   The length of the window in microseconds.
+ * @retval 0 on success.
+ */
+int MIDIDriverAppleMIDISetBatchWindow( struct MIDIDriverAppleMIDI * driver, unsigned long usec ) {
+  MIDIPrecond( driver != NULL, EFAULT );
+  driver->batch_window.tv_sec  = usec / 1000000;
+  driver->batch_window.tv_nsec = ( usec % 1000000 ) * 1000;
+  return 0;
+}
+
+/**
+ * @brief Set the maximum number of messages per packet.
+ * When this many messages are queued, they are sent without waiting for the
+ * batch window to close.
+ * @public @memberof MIDIDriverAppleMIDI
+ * @param driver The driver.
+ * @param count  The number of messages, between 1 and
+ *               @c APPLEMIDI_MAX_MESSAGES_PER_PACKET.
+ * @retval 0 on success.
+ */
+int MIDIDriverAppleMIDISetMaxMessagesPerPacket( struct MIDIDriverAppleMIDI * driver, size_t count ) {
+  MIDIPrecond( driver != NULL, EFAULT );
+  MIDIPrecond( count > 0 && count <= APPLEMIDI_MAX_MESSAGES_PER_PACKET, EINVAL );
+  driver->batch_size = count;
+  return 0;
+}
+
+/**
+ * @brief Limit the number of outgoing messages that are queued.
+ * When a peer or the network can not keep up, the policy decides which
+ * messages are given up, see @ref MIDIMessageQueueSetLimit. With
+ * @c MIDI_QUEUE_POLICY_BLOCK the queue is sent right away to make room
+ * for the new message, ignoring the batch window. Dropped and coalesced
+ * messages are counted in the driver's profiling stats.
+ * By default the queue holds @c APPLEMIDI_QUEUE_SIZE messages and new
+ * messages are dropped when it is full.
+ * @public @memberof MIDIDriverAppleMIDI
+ * @param driver   The driver.
+ * @param capacity The maximum number of queued messages, at most @c APPLEMIDI_QUEUE_SIZE.
+ *                 Zero uses the full queue size.
+ * @param policy   The policy for a full queue.
+ * @retval 0 on success.
+ * @retval >0 if the limit could not be set.
+ */
+int MIDIDriverAppleMIDISetQueueLimit( struct MIDIDriverAppleMIDI * driver, size_t capacity, int policy ) {
+  MIDIPrecond( driver != NULL, EFAULT );
+  MIDIPrecond( capacity <= APPLEMIDI_QUEUE_SIZE, EINVAL );
+  if( MIDIMessageQueueSetLimit( driver->out_queue, capacity, policy ) ) return 1;
+  driver->queue_policy = policy;
+  return 0;
+}
+
 /**
  * @brief Handle incoming MIDI messages.
  * This is called by the RTP-MIDI payload parser whenever it encounters a new MIDI message.
@@ -417,92 +812,497 @@ int MIDIDriverAppleMIDIReceiveMessage( struct MIDIDriverAppleMIDI * driver, stru
 }
 
 /**
- * @todo: remove the forward declaration as soon as MIDIDriverAppleMIDISendMessage does
- * start queueing messages instead of sending immediately.
+ * @brief Deliver messages that leave the jitter buffer.
+ * @private @memberof MIDIDriverAppleMIDI
+ * @param target The driver.
+ * @param source The jitter buffer's port.
+ * @param type   The type of the object.
+ * @param object The object.
+ * @retval 0 on success.
  */
-int MIDIDriverAppleMIDISend( struct MIDIDriverAppleMIDI * driver );
+static int _applemidi_jitter_deliver( void * target, void * source, struct MIDITypeSpec * type, void * object ) {
+  if( type == MIDIMessageType ) {
+    return MIDIDriverAppleMIDIReceiveMessage( target, object );
+  }
+  return 0;
+}
 
 /**
- * @brief Process outgoing MIDI messages.
- * This is called by the generic driver interface to pass messages to this driver implementation.
- * The driver may queue outgoing messages to reduce package overhead, trading of latency for throughput.
+ * @brief Enable or disable the receive jitter buffer.
+ * With the jitter buffer, messages from synchronized peers are not delivered
+ * on arrival. Their RTP timestamps are converted to the driver's clock using
+ * the offset that was measured during clock synchronization, and each message
+ * is delivered a target latency after it was sent. The target latency follows
+ * the @c APPLEMIDI_JITTER_PERCENTILE percentile of the recently observed
+ * transit times and stays within the given range. Delivered messages carry
+ * their local delivery time as timestamp.
+ * Messages from peers that have not finished clock synchronization are
+ * delivered at once. Messages that are already buffered are still delivered
+ * on time after the jitter buffer was disabled.
+ * @public @memberof MIDIDriverAppleMIDI
+ * @param driver   The driver.
+ * @param min_usec The minimum latency in microseconds.
+ * @param max_usec The maximum latency in microseconds, 0 disables the jitter buffer.
+ * @retval 0 on success.
+ * @retval >0 if the jitter buffer could not be created.
+ */
+int MIDIDriverAppleMIDISetJitterBuffer( struct MIDIDriverAppleMIDI * driver, unsigned long min_usec, unsigned long max_usec ) {
+  struct MIDIPort * port;
+  MIDIPrecond( driver != NULL, EFAULT );
+  MIDIPrecond( min_usec <= max_usec, EINVAL );
+
+  if( max_usec > 0 && driver->jitter_buffer == NULL ) {
+    /* use the driver's runloop source so the buffer is served
+     * whenever the driver is part of a runloop */
+    driver->jitter_buffer = MIDISchedulerCreateWithSource( driver->base.clock, driver->base.rls );
+    if( driver->jitter_buffer == NULL ) return 1;
+    driver->jitter_port = MIDIPortCreate( "AppleMIDI jitter buffer", MIDI_PORT_IN, driver, &_applemidi_jitter_deliver );
+    if( driver->jitter_port == NULL ) {
+      MIDISchedulerRelease( driver->jitter_buffer );
+      driver->jitter_buffer = NULL;
+      return 1;
+    }
+    MIDISchedulerGetPort( driver->jitter_buffer, &port );
+    MIDIPortConnect( port, driver->jitter_port );
+  }
+  driver->jitter_min = (MIDITimestamp) min_usec * APPLEMIDI_CLOCK_RATE / 1000000;
+  driver->jitter_max = (MIDITimestamp) max_usec * APPLEMIDI_CLOCK_RATE / 1000000;
+  return 0;
+}
+
+/**
+ * @brief Get the current receive latency for a peer.
+ * This is the delay between the time a message was sent by the peer and the
+ * time it is delivered by the jitter buffer.
  * @public @memberof MIDIDriverAppleMIDI
  * @param driver The driver.
- * @param message The message that should be sent.
+ * @param ssrc   The synchronization source identifier of the peer.
+ * @param usec   The latency in microseconds.
  * @retval 0 on success.
- * @retval >0 if the message could not be processed.
+ * @retval >0 if the peer is unknown or its clock was not synchronized.
  */
-int MIDIDriverAppleMIDISendMessage( struct MIDIDriverAppleMIDI * driver, struct MIDIMessage * message ) {
+int MIDIDriverAppleMIDIGetPeerLatency( struct MIDIDriverAppleMIDI * driver, unsigned long ssrc, unsigned long * usec ) {
+  struct RTPPeer * peer = NULL;
+  struct AppleMIDIPeer * info = NULL;
+  MIDIPrecond( driver != NULL, EFAULT );
+  MIDIPrecond( usec != NULL, EINVAL );
+
+  RTPSessionFindPeerBySSRC( driver->rtp_session, &peer, ssrc );
+  if( peer == NULL ) return 1;
+  RTPMIDIPeerGetInfo( peer, (void **) &info );
+  if( info == NULL || ! info->synced ) return 1;
+  *usec = ( info->latency > 0 ) ? info->latency * 1000000 / APPLEMIDI_CLOCK_RATE : 0;
+  return 0;
+}
+
 /**
- * @todo: when midi messages get timestamped by global clock, do something different:
- * - if we use the global clock (driver->clock == global_clock) do nothing
- * - otherwise: convert timestamp between clocks
+ * @brief Get the clock synchronization state of a peer.
+ * The offset and skew are a least-squares fit over the last
+ * @c APPLEMIDI_SYNC_WINDOW synchronizations, the offset is extrapolated to
+ * the current time.
+ * @public @memberof MIDIDriverAppleMIDI
+ * @param driver The driver.
+ * @param ssrc   The synchronization source identifier of the peer.
+ * @param sync   The synchronization state.
+ * @retval 0 on success.
+ * @retval >0 if the peer is unknown or its clock was not synchronized.
  */
-  MIDITimestamp timestamp;
-  MIDIClockGetNow( driver->base.clock, &timestamp );
-  MIDIMessageSetTimestamp( message, timestamp );
-  MIDIMessageQueuePush( driver->out_queue, message );
+int MIDIDriverAppleMIDIGetPeerSync( struct MIDIDriverAppleMIDI * driver, unsigned long ssrc, struct AppleMIDIPeerSync * sync ) {
+  struct RTPPeer * peer = NULL;
+  struct AppleMIDIPeer * info = NULL;
+  MIDITimestamp now;
+  MIDIPrecond( driver != NULL, EFAULT );
+  MIDIPrecond( sync != NULL, EINVAL );
+
+  RTPSessionFindPeerBySSRC( driver->rtp_session, &peer, ssrc );
+  if( peer == NULL ) return 1;
+  RTPMIDIPeerGetInfo( peer, (void **) &info );
+  if( info == NULL || ! info->synced ) return 1;
+  MIDIClockGetNow( driver->base.clock, &now );
+  sync->count  = info->sync_count;
+  sync->offset = _applemidi_peer_diff( info, now );
+  sync->delay  = info->timestamp_delay;
+  sync->skew   = info->skew;
+  return 0;
+}
+
 /**
- * @todo: instead of sending directly, set a minimal timeout, just long enough so that
- * multiple messages that are queued together will be sent together.
+ * @brief Get a clock that follows the clock of a peer.
+ * The clock is adjusted after every synchronization. Use it with
+ * @ref MIDIClockConvertTimestamp to convert timestamps between the driver
+ * and the peer, or between two peers. The clock is owned by the driver and
+ * stays valid as long as the peer is connected, retain it to keep it longer.
+ * @public @memberof MIDIDriverAppleMIDI
+ * @param driver The driver.
+ * @param ssrc   The synchronization source identifier of the peer.
+ * @param clock  The clock.
+ * @retval 0 on success.
+ * @retval >0 if the peer is unknown or its clock was not synchronized.
  */
-  return MIDIDriverAppleMIDISend( driver );
+int MIDIDriverAppleMIDIGetPeerClock( struct MIDIDriverAppleMIDI * driver, unsigned long ssrc, struct MIDIClock ** clock ) {
+  struct RTPPeer * peer = NULL;
+  struct AppleMIDIPeer * info = NULL;
+  MIDIPrecond( driver != NULL, EFAULT );
+  MIDIPrecond( clock != NULL, EINVAL );
+
+  RTPSessionFindPeerBySSRC( driver->rtp_session, &peer, ssrc );
+  if( peer == NULL ) return 1;
+  RTPMIDIPeerGetInfo( peer, (void **) &info );
+  if( info == NULL || info->clock == NULL ) return 1;
+  *clock = info->clock;
+  return 0;
 }
 
-/*
-static int _applemidi_init_addr_with_peer( struct AppleMIDICommand * command, struct RTPPeer * peer ) {
-  struct sockaddr * addr;
-  socklen_t size;
+/**
+ * @brief Pace the segments of long system exclusive messages.
+ * System exclusive messages that are too long for a packet are sent in
+ * segments. The segments are sent on a timer at the given rate while the
+ * other messages go out in between, so notes are not held up by a dump.
+ * @public @memberof MIDIDriverAppleMIDI
+ * @param driver The driver.
+ * @param rate   The number of system exclusive bytes per second or 0 to
+ *               send all segments at once.
+ * @retval 0 on success.
+ * @retval >0 if the rate could not be set.
+ */
+int MIDIDriverAppleMIDISetSysExRate( struct MIDIDriverAppleMIDI * driver, unsigned long rate ) {
+  MIDIPrecond( driver != NULL, EFAULT );
+  RTPMIDISessionSetSysExRate( driver->rtpmidi_session, rate );
+  if( driver->sysex_timer != 0 ) {
+    MIDIRunloopSourceCancelTimer( driver->base.rls, driver->sysex_timer );
+    driver->sysex_timer = 0;
+  }
+  return _applemidi_arm_sysex_timer( driver );
+}
 
-  RTPPeerGetAddress( peer, &size, &addr );
-  memcpy( &(command->addr), addr, size );
-  command->size = size;
+/**
+ * @brief Forward received messages to another driver without decoding them.
+ * Instead of decoding every received command into a MIDIMessage and
+ * encoding it again on the way out, the commands are received as compact
+ * messages that refer to the received packet and their bytes are copied
+ * straight into the packets of @c target. The messages are only decoded
+ * when the driver's port is connected or the messages are observed,
+ * so devices and observers still see everything that is received.
+ * Both drivers have to run on the same runloop.
+ * @public @memberof MIDIDriverAppleMIDI
+ * @param driver The driver.
+ * @param target The driver to forward to or @c NULL to stop forwarding.
+ * @param filter The filter to apply to the forwarded messages or @c NULL.
+ *               The filter is copied.
+ * @retval 0 on success.
+ * @retval >0 if the driver could not forward.
+ */
+int MIDIDriverAppleMIDISetForward( struct MIDIDriverAppleMIDI * driver, struct MIDIDriverAppleMIDI * target,
+                                   struct MIDIRouterFilter * filter ) {
+  MIDIPrecond( driver != NULL, EFAULT );
+  MIDIPrecond( target != driver, EINVAL );
+  if( target != NULL ) MIDIDriverRetain( &(target->base) );
+  if( driver->forward != NULL ) MIDIDriverRelease( &(driver->forward->base) );
+  driver->forward          = target;
+  driver->forward_filtered = ( filter != NULL );
+  if( filter != NULL ) driver->forward_filter = *filter;
   return 0;
 }
-*/
 
 /**
- * @brief Test incoming packets for the AppleMIDI signature.
- * Check if the data that is waiting on a socket begins with the special AppleMIDI signature (0xffff).
- * @private @memberof MIDIDriverAppleMIDI
- * @param fd The file descriptor to use for communication.
- * @retval 0 if the packet is AppleMIDI
- * @retval 1 if the packet is not AppleMIDI
- * @retval -1 if no signature data could be received
+ * @brief Exchange the RTP packets of a peer over a stream socket.
+ * Send and receive the RTP-MIDI packets of the peer framed as described in
+ * RFC 4571 over the connected socket @c fd, for example a TCP connection
+ * that was established out of band. Session management and clock
+ * synchronization stay on the datagram sockets. Packets that are sent
+ * within one runloop turn are coalesced and written together when the
+ * turn is over. The driver takes ownership of the socket on success and
+ * closes it
+ * when the peer is removed. If the connection fails the peer falls back
+ * to datagrams.
+ * @public @memberof MIDIDriverAppleMIDI
+ * @param driver The driver.
+ * @param ssrc   The synchronization source identifier of the peer.
+ * @param fd     The connected socket or -1 to go back to datagrams.
+ * @retval 0 on success.
+ * @retval >0 if the peer is unknown or the stream could not be set.
  */
-static int _test_applemidi( int fd ) {
-  ssize_t bytes;
-  unsigned short buf[2];
-  bytes = recv( fd, &buf, 4, MSG_PEEK );
-  if( bytes != 4 ) return -1;
-  if( ntohs(buf[0]) == APPLEMIDI_PROTOCOL_SIGNATURE ) {
-    switch( ntohs(buf[1]) ) {
-      case APPLEMIDI_COMMAND_INVITATION:
-      case APPLEMIDI_COMMAND_INVITATION_ACCEPTED:
-      case APPLEMIDI_COMMAND_INVITATION_REJECTED:
-      case APPLEMIDI_COMMAND_RECEIVER_FEEDBACK:
-      case APPLEMIDI_COMMAND_SYNCHRONIZATION:
-      case APPLEMIDI_COMMAND_ENDSESSION:
-        return 0;
+int MIDIDriverAppleMIDISetPeerStream( struct MIDIDriverAppleMIDI * driver, unsigned long ssrc, int fd ) {
+  struct RTPPeer * peer = NULL;
+  int current = -1, result;
+  MIDIPrecond( driver != NULL, EFAULT );
+
+  RTPSessionFindPeerBySSRC( driver->rtp_session, &peer, ssrc );
+  if( peer == NULL ) return 1;
+  RTPPeerGetStream( peer, &current );
+  if( current == fd ) return 0;
+  if( current >= 0 ) {
+    /* write what was coalesced for the old connection before it is closed */
+    RTPPeerFlushStream( peer );
+    MIDIRunloopSourceClearRead( driver->base.rls, current );
+    MIDIRunloopSourceClearWrite( driver->base.rls, current );
+    driver->nstreams--;
+  }
+  result = RTPPeerSetStream( peer, fd );
+  if( result != 0 || fd < 0 ) return result;
+  driver->nstreams++;
+  MIDIRunloopSourceScheduleRead( driver->base.rls, fd );
+  return 0;
+}
+
+/**
+ * @brief Add the statistics of the driver's peers to metrics.
+ * Use this as a collector with @ref MIDIMetricsAddCollector on the
+ * runloop that runs the driver. Every peer is labeled with its name and
+ * SSRC and exports the round trip time and the clock skew measured by the
+ * clock synchronization, the interarrival jitter of its RTP packets, the
+ * received and lost packets, and the number of synchronizations and
+ * receiver feedback commands.
+ * @public @memberof MIDIDriverAppleMIDI
+ * @param drv    The driver.
+ * @param writer The metrics writer.
+ * @retval 0 on success.
+ */
+int MIDIDriverAppleMIDICollectMetrics( void * drv, struct MIDIMetricsWriter * writer ) {
+  struct MIDIDriverAppleMIDI * driver = drv;
+  struct RTPPeer * peer = NULL;
+  struct AppleMIDIPeer * info;
+  unsigned long received, lost;
+  char ssrc[12];
+  char * labels[] = { "peer", "", "ssrc", &(ssrc[0]), NULL };
+  size_t count = 0;
+  MIDIPrecond( driver != NULL, EFAULT );
+
+  RTPSessionNextPeer( driver->rtp_session, &peer );
+  while( peer != NULL ) {
+    count++;
+    info = NULL;
+    RTPMIDIPeerGetInfo( peer, (void **) &info );
+    if( info != NULL ) {
+      sprintf( &(ssrc[0]), "%08lx", info->ssrc & 0xffffffff );
+      labels[1] = ( info->name != NULL ) ? info->name : "";
+      if( info->synced ) {
+        MIDIMetricsWriterFamily( writer, "midikit_applemidi_peer_rtt_seconds", MIDI_METRICS_GAUGE,
+                                 "Round trip time measured by the clock synchronization." );
+        MIDIMetricsWriterSample( writer, "midikit_applemidi_peer_rtt_seconds", &(labels[0]),
+                                 2.0 * info->timestamp_delay / APPLEMIDI_CLOCK_RATE );
+        MIDIMetricsWriterFamily( writer, "midikit_applemidi_peer_skew", MIDI_METRICS_GAUGE,
+                                 "Rate deviation of the peer's clock." );
+        MIDIMetricsWriterSample( writer, "midikit_applemidi_peer_skew", &(labels[0]), info->skew );
+        MIDIMetricsWriterFamily( writer, "midikit_applemidi_peer_jitter_seconds", MIDI_METRICS_GAUGE,
+                                 "Interarrival jitter of the peer's packets." );
+        MIDIMetricsWriterSample( writer, "midikit_applemidi_peer_jitter_seconds", &(labels[0]),
+                                 info->jitter / APPLEMIDI_CLOCK_RATE );
+      }
+      if( RTPPeerGetReceptionStats( peer, &received, &lost ) == 0 ) {
+        MIDIMetricsWriterFamily( writer, "midikit_applemidi_peer_packets", MIDI_METRICS_COUNTER,
+                                 "RTP packets received from the peer." );
+        MIDIMetricsWriterSample( writer, "midikit_applemidi_peer_packets_total", &(labels[0]), received );
+        MIDIMetricsWriterFamily( writer, "midikit_applemidi_peer_lost", MIDI_METRICS_COUNTER,
+                                 "RTP packets of the peer that did not arrive." );
+        MIDIMetricsWriterSample( writer, "midikit_applemidi_peer_lost_total", &(labels[0]), lost );
+      }
+      MIDIMetricsWriterFamily( writer, "midikit_applemidi_peer_syncs", MIDI_METRICS_COUNTER,
+                               "Clock synchronizations with the peer." );
+      MIDIMetricsWriterSample( writer, "midikit_applemidi_peer_syncs_total", &(labels[0]), info->sync_count );
+      MIDIMetricsWriterFamily( writer, "midikit_applemidi_peer_feedback", MIDI_METRICS_COUNTER,
+                               "Receiver feedback commands from the peer." );
+      MIDIMetricsWriterSample( writer, "midikit_applemidi_peer_feedback_total", &(labels[0]), info->feedback_count );
     }
+    RTPSessionNextPeer( driver->rtp_session, &peer );
   }
-  return 1;
+  MIDIMetricsWriterFamily( writer, "midikit_applemidi_peers", MIDI_METRICS_GAUGE, "Peers of the session." );
+  labels[0] = NULL;
+  MIDIMetricsWriterSample( writer, "midikit_applemidi_peers", &(labels[0]), count );
+  return 0;
 }
 
 /**
- * @brief Send the given AppleMIDI command.
- * Compose a message buffer and send the datagram to the given peer.
- * @private @memberof MIDIDriverAppleMIDI
- * @param driver The driver.
- * @param fd The file descriptor to use for communication.
- * @param command The command.
- * @retval 0 On success.
- * @retval >0 If the packet could not be sent.
+ * @todo: remove the forward declaration as soon as MIDIDriverAppleMIDISendMessage does
+ * start queueing messages instead of sending immediately.
  */
-static int _applemidi_send_command( struct MIDIDriverAppleMIDI * driver, int fd, struct AppleMIDICommand * command ) {
-  unsigned int ssrc;
-  unsigned int msg[16];
-  int len;
+int MIDIDriverAppleMIDISend( struct MIDIDriverAppleMIDI * driver );
+
+/**
+ * @brief Flush the out queue when the batch window closes.
+ * @private @memberof MIDIDriverAppleMIDI
+ * @param drv The driver.
+ * @param now The current time.
+ */
+static int _applemidi_batch_timeout( void * drv, struct timespec * now ) {
+  struct MIDIDriverAppleMIDI * driver = drv;
+  driver->batch_timer = 0;
+  return MIDIDriverAppleMIDISend( driver );
+}
+
+/**
+ * @brief Send a real-time message in a packet of its own.
+ * @private @memberof MIDIDriverAppleMIDI
+ * @param driver  The driver.
+ * @param message The message.
+ * @retval 0 on success.
+ * @retval >0 if the message could not be sent.
+ */
+static int _applemidi_send_realtime( struct MIDIDriverAppleMIDI * driver, struct MIDIMessage * message ) {
+  struct MIDIMessageList list = { message, NULL };
+  MIDITimestamp timestamp;
+  int result;
+  MIDIMessageGetTimestamp( message, &timestamp );
+  MIDIProfileLane( driver->base.profile, MIDI_DRIVER_LANE_REALTIME, driver->base.clock, timestamp );
+  RTPMIDISessionSetProfile( driver->rtpmidi_session, driver->base.profile );
+  result = RTPMIDISessionSend( driver->rtpmidi_session, &list );
+  _applemidi_arm_stream_timer( driver );
+  _applemidi_arm_sysex_timer( driver );
+  return result;
+}
+
+/**
+ * @brief Queue a real-time message for the head of the next packet.
+ * The message is sent ahead of all queued messages when the batch window
+ * closes, it never waits for a full packet and is never coalesced.
+ * @private @memberof MIDIDriverAppleMIDI
+ * @param driver  The driver.
+ * @param message The message.
+ * @retval 0 on success.
+ * @retval >0 if the message could not be queued.
+ */
+static int _applemidi_queue_realtime( struct MIDIDriverAppleMIDI * driver, struct MIDIMessage * message ) {
+  if( MIDIMessageQueuePush( driver->rt_queue, message )
+   && ( MIDIDriverAppleMIDISend( driver ) || MIDIMessageQueuePush( driver->rt_queue, message ) ) ) {
+    MIDILog( DEBUG, "real-time queue is full, dropping message\n" );
+    MIDIProfileAdd( driver->base.profile, drops, 1 );
+    return 1;
+  }
+  if( driver->batch_window.tv_sec == 0 && driver->batch_window.tv_nsec == 0 ) {
+    return MIDIDriverAppleMIDISend( driver );
+  } else if( driver->batch_timer == 0 ) {
+    return MIDIRunloopSourceAddTimer( driver->base.rls, &(driver->batch_window),
+                                      &_applemidi_batch_timeout, driver, &(driver->batch_timer) );
+  }
+  return 0;
+}
+
+/**
+ * @brief Process outgoing MIDI messages.
+ * This is called by the generic driver interface to pass messages to this driver implementation.
+ * The driver may queue outgoing messages to reduce package overhead, trading of latency for throughput.
+ * System real-time messages are handled according to the driver's real-time policy, see
+ * @ref MIDIDriverSetRealTimePolicy.
+ * @public @memberof MIDIDriverAppleMIDI
+ * @param driver The driver.
+ * @param message The message that should be sent.
+ * @retval 0 on success.
+ * @retval >0 if the message could not be processed.
+ */
+int MIDIDriverAppleMIDISendMessage( struct MIDIDriverAppleMIDI * driver, struct MIDIMessage * message ) {
+/**
+ * @todo: when midi messages get timestamped by global clock, do something different:
+ * - if we use the global clock (driver->clock == global_clock) do nothing
+ * - otherwise: convert timestamp between clocks
+ */
+  struct MIDIMessageQueueStats stats;
+  unsigned long dropped, coalesced;
+  MIDITimestamp timestamp;
+  size_t length;
+  int lane;
+  MIDIClockGetNow( driver->base.clock, &timestamp );
+  MIDIMessageSetTimestamp( message, timestamp );
+  MIDIDriverGetLane( &(driver->base), message, &lane );
+  if( lane == MIDI_DRIVER_LANE_REALTIME ) {
+    if( driver->base.realtime_policy == MIDI_DRIVER_REALTIME_IMMEDIATE ) {
+      return _applemidi_send_realtime( driver, message );
+    }
+    return _applemidi_queue_realtime( driver, message );
+  }
+  MIDIMessageQueueGetStats( driver->out_queue, &stats );
+  dropped   = stats.dropped;
+  coalesced = stats.coalesced;
+  if( MIDIMessageQueuePush( driver->out_queue, message ) ) {
+    /* with backpressure, make room by sending what is queued */
+    if( driver->queue_policy != MIDI_QUEUE_POLICY_BLOCK
+     || MIDIDriverAppleMIDISend( driver )
+     || MIDIMessageQueuePush( driver->out_queue, message ) ) {
+      MIDILog( DEBUG, "out queue is full, dropping message\n" );
+      MIDIProfileAdd( driver->base.profile, drops, 1 );
+      return 1;
+    }
+  }
+  MIDIMessageQueueGetStats( driver->out_queue, &stats );
+  MIDIProfileAdd( driver->base.profile, drops, stats.dropped - dropped );
+  MIDIProfileAdd( driver->base.profile, coalesced, stats.coalesced - coalesced );
+  MIDIMessageQueueGetLength( driver->out_queue, &length );
+  MIDIDriverSetQueueDepth( &(driver->base), length );
+  if( length == 1 ) {
+    /* measure how long the oldest message of a batch waits */
+    MIDIProfileBegin( driver->base.profile, MIDI_DRIVER_STAGE_QUEUE );
+  }
+  if( driver->batch_window.tv_sec == 0 && driver->batch_window.tv_nsec == 0 ) {
+    return MIDIDriverAppleMIDISend( driver );
+  }
+
+  if( length >= driver->batch_size ) {
+    /* the packet is full, don't wait for the window to close */
+    if( driver->batch_timer != 0 ) {
+      MIDIRunloopSourceCancelTimer( driver->base.rls, driver->batch_timer );
+      driver->batch_timer = 0;
+    }
+    return MIDIDriverAppleMIDISend( driver );
+  } else if( driver->batch_timer == 0 ) {
+    return MIDIRunloopSourceAddTimer( driver->base.rls, &(driver->batch_window),
+                                      &_applemidi_batch_timeout, driver, &(driver->batch_timer) );
+  }
+  return 0;
+}
+
+/*
+static int _applemidi_init_addr_with_peer( struct AppleMIDICommand * command, struct RTPPeer * peer ) {
+  struct sockaddr * addr;
+  socklen_t size;
+
+  RTPPeerGetAddress( peer, &size, &addr );
+  memcpy( &(command->addr), addr, size );
+  command->size = size;
+  return 0;
+}
+*/
+
+/**
+ * @brief Test incoming packets for the AppleMIDI signature.
+ * Check if the data that is waiting on a socket begins with the special AppleMIDI signature (0xffff).
+ * @private @memberof MIDIDriverAppleMIDI
+ * @param fd The file descriptor to use for communication.
+ * @retval 0 if the packet is AppleMIDI
+ * @retval 1 if the packet is not AppleMIDI
+ * @retval -1 if no signature data could be received
+ */
+static int _test_applemidi( int fd ) {
+  ssize_t bytes;
+  unsigned short buf[2];
+  bytes = recv( fd, &buf, 4, MSG_PEEK );
+  if( bytes != 4 ) return -1;
+  if( ntohs(buf[0]) == APPLEMIDI_PROTOCOL_SIGNATURE ) {
+    switch( ntohs(buf[1]) ) {
+      case APPLEMIDI_COMMAND_INVITATION:
+      case APPLEMIDI_COMMAND_INVITATION_ACCEPTED:
+      case APPLEMIDI_COMMAND_INVITATION_REJECTED:
+      case APPLEMIDI_COMMAND_RECEIVER_FEEDBACK:
+      case APPLEMIDI_COMMAND_SYNCHRONIZATION:
+      case APPLEMIDI_COMMAND_ENDSESSION:
+        return 0;
+    }
+  }
+  return 1;
+}
+
+/**
+ * @brief Send the given AppleMIDI command.
+ * Compose a message buffer and send the datagram to the given peer.
+ * @private @memberof MIDIDriverAppleMIDI
+ * @param driver The driver.
+ * @param fd The file descriptor to use for communication.
+ * @param command The command.
+ * @retval 0 On success.
+ * @retval >0 If the packet could not be sent.
+ */
+static int _applemidi_send_command( struct MIDIDriverAppleMIDI * driver, int fd, struct AppleMIDICommand * command ) {
+  unsigned int ssrc;
+  unsigned int msg[16];
+  int len;
 
   msg[0] = htonl( ( APPLEMIDI_PROTOCOL_SIGNATURE << 16 ) | command->type );
   switch( command->type ) {
@@ -559,30 +1359,18 @@ static int _applemidi_send_command( struct MIDIDriverAppleMIDI * driver, int fd,
 }
 
 /**
- * @brief Receive an AppleMIDI command.
- * Receive a datagram and decompose the message into the message structure.
+ * @brief Decompose an AppleMIDI command.
  * @private @memberof MIDIDriverAppleMIDI
- * @param driver The driver.
- * @param fd The file descriptor to use for communication.
  * @param command The command.
+ * @param len     The size of the datagram.
+ * @param msg     The datagram.
  * @retval 0 On success.
- * @retval >0 If the packet could not be sent.
+ * @retval >0 If the datagram is not a valid command.
  */
-static int _applemidi_recv_command( struct MIDIDriverAppleMIDI * driver, int fd, struct AppleMIDICommand * command ) {
+static int _applemidi_parse_command( struct AppleMIDICommand * command, int len, unsigned int * msg ) {
   unsigned int ssrc;
-  unsigned int msg[16];
-  int len;
-  
-  command->size = sizeof(command->addr);
-  len = recvfrom( fd, &msg[0], sizeof(msg), 0,
-                  (struct sockaddr *) &(command->addr), &(command->size) );
-  if( command->addr.ss_family == AF_INET ) {
-    struct sockaddr_in * a = (struct sockaddr_in *) &(command->addr);
-    MIDILog( DEBUG, "recv %i bytes from %s:%i on s(%i)\n", len, inet_ntoa( a->sin_addr ), ntohs( a->sin_port ), fd );
-  } else {
-    MIDILog( DEBUG, "recv %i bytes from <unknown addr family> on s(%i)\n", len, fd );
-  }
 
+  if( len < 4 ) return 1;
   command->type = ntohl( msg[0] ) & 0xffff;
   
   switch( command->type ) {
@@ -629,110 +1417,275 @@ static int _applemidi_recv_command( struct MIDIDriverAppleMIDI * driver, int fd,
 }
 
 /**
- * @brief Start or continue a synchronization session.
- * Continue a synchronization session identified by a given command.
- * The command must contain a pointer to a valid peer.
+ * @brief Receive an AppleMIDI command.
+ * Receive a datagram and decompose the message into the message structure.
+ * @private @memberof MIDIDriverAppleMIDI
+ * @param driver The driver.
+ * @param fd The file descriptor to use for communication.
+ * @param command The command.
+ * @retval 0 On success.
+ * @retval >0 If the packet could not be received.
+ */
+static int _applemidi_recv_command( struct MIDIDriverAppleMIDI * driver, int fd, struct AppleMIDICommand * command ) {
+  unsigned int msg[16];
+  int len;
+  
+  command->size = sizeof(command->addr);
+  len = recvfrom( fd, &msg[0], sizeof(msg), 0,
+                  (struct sockaddr *) &(command->addr), &(command->size) );
+  if( command->addr.ss_family == AF_INET ) {
+    struct sockaddr_in * a = (struct sockaddr_in *) &(command->addr);
+    MIDILog( DEBUG, "recv %i bytes from %s:%i on s(%i)\n", len, inet_ntoa( a->sin_addr ), ntohs( a->sin_port ), fd );
+  } else {
+    MIDILog( DEBUG, "recv %i bytes from <unknown addr family> on s(%i)\n", len, fd );
+  }
+  return _applemidi_parse_command( command, len, &msg[0] );
+}
+
+/**
+ * @brief Keep a command that was received with a batch of RTP packets.
+ * The RTP port carries session commands and RTP-MIDI packets. When
+ * several datagrams are received at once, commands are handed over by the
+ * RTP session and answered once the batch has been decoded, so that the
+ * peers of pending packets are not changed while they are in use.
+ * @private @memberof MIDIDriverAppleMIDI
+ * @param drv     The driver.
+ * @param size    The size of the datagram.
+ * @param data    The datagram.
+ * @param addrlen The size of the sender's address.
+ * @param addr    The sender's address.
+ * @retval 0 If the command was kept.
+ * @retval >0 If the datagram was dropped.
+ */
+static int _applemidi_defer_command( void * drv, size_t size, void * data, socklen_t addrlen, struct sockaddr * addr ) {
+  struct MIDIDriverAppleMIDI * driver = drv;
+  struct AppleMIDICommand * command;
+  unsigned int msg[16];
+
+  if( driver->ndeferred == APPLEMIDI_DEFERRED_COMMANDS || addrlen > sizeof(command->addr) ) {
+    MIDILog( DEBUG, "dropped AppleMIDI command received with RTP packets\n" );
+    return 1;
+  }
+  if( size > sizeof(msg) ) size = sizeof(msg);
+  memcpy( &msg[0], data, size );
+  command = &(driver->deferred[driver->ndeferred]);
+  memcpy( &(command->addr), addr, addrlen );
+  command->size = addrlen;
+  if( _applemidi_parse_command( command, size, &msg[0] ) ) return 1;
+  driver->ndeferred++;
+  return 0;
+}
+
+/**
+ * @brief Fit offset and skew of a peer's clock.
+ * Compute the least-squares line through the offsets measured by the recent
+ * synchronizations and evaluate it at @c now.
+ * @private @memberof MIDIDriverAppleMIDI
+ * @param peer The peer.
+ * @param now  The time of the driver's clock.
+ */
+static void _applemidi_peer_fit( struct AppleMIDIPeer * peer, MIDITimestamp now ) {
+  size_t i, n = ( peer->sync_samples < APPLEMIDI_SYNC_WINDOW ) ? peer->sync_samples : APPLEMIDI_SYNC_WINDOW;
+  double mt = 0, md = 0, stt = 0, std = 0, t, d;
+
+  for( i=0; i<n; i++ ) {
+    mt += peer->sync_local[i] - now;
+    md += peer->sync_diff[i];
+  }
+  mt /= n;
+  md /= n;
+  for( i=0; i<n; i++ ) {
+    t = ( peer->sync_local[i] - now ) - mt;
+    d = peer->sync_diff[i] - md;
+    stt += t * t;
+    std += t * d;
+  }
+  peer->skew = ( n > 1 && stt > 0 ) ? std / stt : 0;
+  if( peer->skew >  APPLEMIDI_SYNC_MAX_SKEW ) peer->skew =  APPLEMIDI_SYNC_MAX_SKEW;
+  if( peer->skew < -APPLEMIDI_SYNC_MAX_SKEW ) peer->skew = -APPLEMIDI_SYNC_MAX_SKEW;
+  peer->sync_time      = now;
+  peer->timestamp_diff = (MIDITimestamp) ( md - peer->skew * mt );
+}
+
+/**
+ * @brief Store the result of a clock synchronization.
+ * Add the measured offset to the peer's window and refit offset and skew,
+ * then update the peer's clock. Buffered transit times and the target
+ * latency of the jitter buffer are moved by the change of the offset, so
+ * messages are delivered without a jump in timing. If the offset is off
+ * the prediction by more than a second, the peer's clock was reset and
+ * the fit starts over. Implausible results are ignored.
+ * @private @memberof MIDIDriverAppleMIDI
+ * @param peer  The peer.
+ * @param now   The time of the driver's clock when the offset was measured.
+ * @param diff  The difference between the peer's and the driver's clock.
+ * @param delay The media delay.
+ */
+static void _applemidi_peer_synchronize( struct RTPPeer * peer, MIDITimestamp now, MIDITimestamp diff, MIDITimestamp delay ) {
+  struct AppleMIDIPeer * info;
+  MIDITimestamp shift, predicted = 0;
+  size_t i;
+  if( peer == NULL || delay < 0 || delay >= APPLEMIDI_CLOCK_RATE ) return;
+  info = _applemidi_peer( peer );
+  if( info == NULL ) return;
+
+  if( info->synced ) {
+    predicted = _applemidi_peer_diff( info, now );
+    if( predicted - diff > APPLEMIDI_CLOCK_RATE || diff - predicted > APPLEMIDI_CLOCK_RATE ) {
+      info->synced        = 0;
+      info->sync_samples  = 0;
+      info->transit_count = 0;
+      info->latency       = 0;
+      info->transit_packets = 0;
+    }
+  }
+  i = info->sync_samples++ % APPLEMIDI_SYNC_WINDOW;
+  info->sync_local[i] = now;
+  info->sync_diff[i]  = diff;
+  _applemidi_peer_fit( info, now );
+
+  if( info->synced ) {
+    shift = _applemidi_peer_diff( info, now ) - predicted;
+    for( i=0; i<APPLEMIDI_JITTER_WINDOW; i++ ) {
+      info->transit[i] += shift;
+    }
+    info->latency += shift;
+    info->last_transit += shift;
+  }
+  info->timestamp_delay = delay;
+  info->synced = 1;
+  info->sync_count++;
+
+  if( info->clock == NULL ) {
+    info->clock = MIDIClockCreate( APPLEMIDI_CLOCK_RATE );
+  }
+  if( info->clock != NULL ) {
+    MIDIClockAdjust( info->clock, now + info->timestamp_diff, info->skew );
+  }
+}
+
+/**
+ * @brief Continue a synchronization session.
+ * Answer a received clock synchronization and update the state of the
+ * peer that sent it. Every peer has its own exchange, so the exchanges
+ * with different peers do not wait for each other.
+ * @private @memberof MIDIDriverAppleMIDI
  * @param driver The driver.
  * @param fd The file descriptor to be used for communication.
- * @param command The previous sync command.
+ * @param command The received sync command.
  * @retval 0 On success.
  * @retval >0 If the synchronization failed.
  */
 static int _applemidi_sync( struct MIDIDriverAppleMIDI * driver, int fd, struct AppleMIDICommand * command ) {
+  struct RTPPeer * peer = NULL;
+  struct AppleMIDIPeer * info = NULL;
   unsigned long ssrc;
-  MIDITimestamp timestamp, diff;
+  MIDITimestamp timestamp, diff, delay;
   RTPSessionGetSSRC( driver->rtp_session, &ssrc );
   MIDIClockGetNow( driver->base.clock, &timestamp );
 
-  if( command->type != APPLEMIDI_COMMAND_SYNCHRONIZATION || 
-      command->data.sync.ssrc == ssrc ||
-      command->data.sync.count > 2 ) {
-    command->type = APPLEMIDI_COMMAND_SYNCHRONIZATION;
+  if( command->data.sync.ssrc == ssrc || command->data.sync.count > 2 ) {
+    return 0;
+  }
+  RTPSessionFindPeerBySSRC( driver->rtp_session, &peer, command->data.sync.ssrc );
+  if( peer != NULL ) {
+    info = _applemidi_peer( peer );
+  }
+
+  /* received packet from other peer */
+  if( command->data.sync.count == 2 ) {
+    /* compute media delay */
+    delay = (MIDITimestamp) ( command->data.sync.timestamp3 - command->data.sync.timestamp1 ) / 2;
+    /* approximate time difference between peer and self */
+    diff = command->data.sync.timestamp3 + delay - timestamp;
+
+    _applemidi_peer_synchronize( peer, timestamp, diff, delay );
+    /* finished sync */
+    if( info != NULL ) info->sync_state = APPLEMIDI_SYNC_IDLE;
+    return 0;
+  }
+  if( command->data.sync.count == 1 ) {
+    /* compute media delay, timestamp1 was taken by our clock */
+    delay = ( timestamp - (MIDITimestamp) command->data.sync.timestamp1 ) / 2;
+    /* approximate time difference between peer and self */
+    diff = command->data.sync.timestamp2 + delay - timestamp;
+
+    _applemidi_peer_synchronize( peer, timestamp, diff, delay );
+
     command->data.sync.ssrc       = ssrc;
-    command->data.sync.count      = 0;
-    command->data.sync.timestamp1 = timestamp;
-    
-    driver->sync = 1;
+    command->data.sync.count      = 2;
+    command->data.sync.timestamp3 = timestamp;
+
+    if( info != NULL ) info->sync_state = APPLEMIDI_SYNC_IDLE;
     return _applemidi_send_command( driver, fd, command );
-  } else {
-    RTPSessionFindPeerBySSRC( driver->rtp_session, &(driver->peer), command->data.sync.ssrc );
-
-    /* received packet from other peer */
-    if( command->data.sync.count == 2 ) {
-      /* compute media delay */
-      diff = ( command->data.sync.timestamp3 - command->data.sync.timestamp1 ) / 2;
-      /* approximate time difference between peer and self */
-      diff = command->data.sync.timestamp3 + diff - timestamp;
-
-      /* RTPPeerSetTimestampDiff( command->peer, diff ) */
-      /* finished sync */
-      command->data.sync.ssrc  = ssrc;
-      command->data.sync.count = 3;
-
-      driver->sync = 0;
-      return 0;
-    }
-    if( command->data.sync.count == 1 ) {
-      /* compute media delay */
-      diff = ( command->data.sync.timestamp3 - command->data.sync.timestamp1 ) / 2;
-      /* approximate time difference between peer and self */
-      diff = command->data.sync.timestamp2 + diff - timestamp;
-
-      /* RTPPeerSetTimestampDiff( command->peer, diff ) */
-
-      command->data.sync.ssrc       = ssrc;
-      command->data.sync.count      = 2;
-      command->data.sync.timestamp3 = timestamp;
-      
-      driver->sync = 0;
-      return _applemidi_send_command( driver, fd, command );
-    }
-    if( command->data.sync.count == 0 ) {
-      command->data.sync.ssrc       = ssrc;
-      command->data.sync.count      = 1;
-      command->data.sync.timestamp2 = timestamp;
-      
-      driver->sync = 2;
-      return _applemidi_send_command( driver, fd, command );
-    }
   }
-  return 1;
+  command->data.sync.ssrc       = ssrc;
+  command->data.sync.count      = 1;
+  command->data.sync.timestamp2 = timestamp;
+
+  if( info != NULL ) {
+    info->sync_state   = APPLEMIDI_SYNC_RESPONDER;
+    info->sync_started = timestamp;
+  }
+  return _applemidi_send_command( driver, fd, command );
 }
 
-static int _applemidi_start_sync( struct MIDIDriverAppleMIDI * driver, int fd, socklen_t size, struct sockaddr * addr ) {
-  if( addr != (struct sockaddr *) &(driver->command.addr) ) memcpy( &(driver->command.addr), addr, size );
-  driver->command.size = size;
-  driver->command.type = APPLEMIDI_COMMAND_SYNCHRONIZATION;
-  driver->command.data.sync.count = 3;
-  RTPSessionGetSSRC( driver->rtp_session, &(driver->command.data.sync.ssrc) );
+/**
+ * @brief Start a synchronization session with a peer.
+ * Send the first clock synchronization to the peer's RTP port.
+ * @private @memberof MIDIDriverAppleMIDI
+ * @param driver The driver.
+ * @param peer The peer.
+ * @retval 0 On success.
+ * @retval >0 If the synchronization could not be started.
+ */
+static int _applemidi_start_sync( struct MIDIDriverAppleMIDI * driver, struct RTPPeer * peer ) {
+  struct AppleMIDICommand command;
+  struct AppleMIDIPeer * info;
+  struct sockaddr * addr = NULL;
+  MIDITimestamp timestamp;
+
+  info = _applemidi_peer( peer );
+  if( info == NULL || RTPPeerGetAddress( peer, &(command.size), &addr ) || addr == NULL ) {
+    return 1;
+  }
+  MIDIClockGetNow( driver->base.clock, &timestamp );
+  memcpy( &(command.addr), addr, command.size );
+  command.peer = peer;
+  command.type = APPLEMIDI_COMMAND_SYNCHRONIZATION;
+  RTPSessionGetSSRC( driver->rtp_session, &(command.data.sync.ssrc) );
+  command.data.sync.count      = 0;
+  command.data.sync.timestamp1 = timestamp;
+  command.data.sync.timestamp2 = 0;
+  command.data.sync.timestamp3 = 0;
+
+  info->sync_state   = APPLEMIDI_SYNC_INITIATOR;
+  info->sync_started = timestamp;
+  return _applemidi_send_command( driver, driver->rtp_socket, &command );
+}
 
-  return _applemidi_sync( driver, fd, &(driver->command) );
+static int _applemidi_session_command( struct MIDIDriverAppleMIDI * driver, int fd, unsigned short type,
+                                       socklen_t size, struct sockaddr * addr ) {
+  struct AppleMIDICommand command;
+  memcpy( &(command.addr), addr, size );
+  command.peer = NULL;
+  command.size = size;
+  command.type = type;
+  command.data.session.version = 2;
+  command.data.session.token   = driver->token;
+  RTPSessionGetSSRC( driver->rtp_session, &(command.data.session.ssrc) );
+  strncpy( &(command.data.session.name[0]), driver->name,
+           sizeof(command.data.session.name) );
+
+  return _applemidi_send_command( driver, fd, &command );
 }
 
 static int _applemidi_invite( struct MIDIDriverAppleMIDI * driver, int fd, socklen_t size, struct sockaddr * addr ) {
-  if( addr != (struct sockaddr *) &(driver->command.addr) ) memcpy( &(driver->command.addr), addr, size );
-  driver->command.size = size;
-  driver->command.type = APPLEMIDI_COMMAND_INVITATION;
-  driver->command.data.session.version = 2;
-  driver->command.data.session.token   = driver->token;
-  RTPSessionGetSSRC( driver->rtp_session, &(driver->command.data.session.ssrc) );
-  strncpy( &(driver->command.data.session.name[0]), driver->name,
-           sizeof(driver->command.data.session.name) );
-
-  return _applemidi_send_command( driver, fd, &(driver->command) );
+  return _applemidi_session_command( driver, fd, APPLEMIDI_COMMAND_INVITATION, size, addr );
 }
 
 static int _applemidi_endsession( struct MIDIDriverAppleMIDI * driver, int fd, socklen_t size, struct sockaddr * addr ) {
-  if( addr != (struct sockaddr *) &(driver->command.addr) ) memcpy( &(driver->command.addr), addr, size );
-  driver->command.size = size;
-  driver->command.type = APPLEMIDI_COMMAND_ENDSESSION;
-  driver->command.data.session.version = 2;
-  driver->command.data.session.token   = driver->token;
-  RTPSessionGetSSRC( driver->rtp_session, &(driver->command.data.session.ssrc) );
-  strncpy( &(driver->command.data.session.name[0]), driver->name,
-           sizeof(driver->command.data.session.name) );
-  
-  return _applemidi_send_command( driver, fd, &(driver->command) );
+  return _applemidi_session_command( driver, fd, APPLEMIDI_COMMAND_ENDSESSION, size, addr );
 }
 
 /**
@@ -779,67 +1732,228 @@ static int _applemidi_control_addr( socklen_t size, struct sockaddr * rtp_addr,
   }
 }
 
+/* MARK: Invitations *//**
+ * @name Invitations
+ * Pending invitations are kept in a list and resent on runloop timers
+ * until they are answered.
+ * @{
+ */
+
+static int _applemidi_addr_equal( socklen_t size, struct sockaddr * a, struct sockaddr * b ) {
+  if( a->sa_family != b->sa_family ) return 0;
+  if( a->sa_family == AF_INET ) {
+    return ((struct sockaddr_in *) a)->sin_port == ((struct sockaddr_in *) b)->sin_port
+        && ((struct sockaddr_in *) a)->sin_addr.s_addr == ((struct sockaddr_in *) b)->sin_addr.s_addr;
+  }
+  return memcmp( a, b, size ) == 0;
+}
+
 /**
- * @brief Respond to a given AppleMIDI command.
- * Use the command as response and - if neccessary - send it back to the peer.
+ * @brief Find the pending invitation of a peer.
  * @private @memberof MIDIDriverAppleMIDI
  * @param driver The driver.
- * @param fd The file descriptor to be used for communication.
- * @param command The command.
- * @retval 0 On success.
- * @retval >0 If the packet could not be sent.
+ * @param size   The size of the address.
+ * @param addr   The control address of the peer.
+ * @return a pointer to the invitation or @c NULL if there is none.
  */
-static int _applemidi_respond( struct MIDIDriverAppleMIDI * driver, int fd, struct AppleMIDICommand * command ) {
-  struct RTPPeer * peer = NULL;
-  struct MIDIEvent * event = NULL;
+static struct AppleMIDIInvitation * _applemidi_invitation_find( struct MIDIDriverAppleMIDI * driver,
+                                                                socklen_t size, struct sockaddr * addr ) {
+  struct AppleMIDIInvitation * invitation;
+  for( invitation = driver->invitations; invitation != NULL; invitation = invitation->next ) {
+    if( invitation->size == size && _applemidi_addr_equal( size, (struct sockaddr *) &(invitation->addr), addr ) ) {
+      return invitation;
+    }
+  }
+  return NULL;
+}
 
-  switch( command->type ) {
-    case APPLEMIDI_COMMAND_INVITATION:
-      if( fd == driver->control_socket ) {
-        event = MIDIEventCreate( MIDI_APPLEMIDI_PEER_DID_SEND_INVITATION, NULL, "%s", &(command->data.session.name[0]) );
-        MIDIDriverTriggerEvent( &(driver->base), event );
-        MIDIEventRelease( event );
-      }
-      if( driver->accept ) {
-        command->type = APPLEMIDI_COMMAND_INVITATION_ACCEPTED;
-        if( fd == driver->rtp_socket ) {
-          peer = RTPPeerCreate( command->data.session.ssrc, command->size, (struct sockaddr *) &(command->addr) );
-          RTPSessionAddPeer( driver->rtp_session, peer );
-          RTPPeerRelease( peer );
-        }
-      } else {
-        command->type = APPLEMIDI_COMMAND_INVITATION_REJECTED;
-      }
-      RTPSessionGetSSRC( driver->rtp_session, &(command->data.session.ssrc) );
-      return _applemidi_send_command( driver, fd, command );
-    case APPLEMIDI_COMMAND_INVITATION_ACCEPTED:
-      if( command->data.session.token == driver->token ) {
+/**
+ * @brief Stop resending an invitation and free it.
+ * @private @memberof MIDIDriverAppleMIDI
+ * @param driver     The driver.
+ * @param invitation The invitation.
+ */
+static void _applemidi_invitation_remove( struct MIDIDriverAppleMIDI * driver, struct AppleMIDIInvitation * invitation ) {
+  struct AppleMIDIInvitation ** link = &(driver->invitations);
+  while( *link != NULL && *link != invitation ) link = &((*link)->next);
+  if( *link == NULL ) return;
+  *link = invitation->next;
+  if( invitation->timer != 0 ) {
+    MIDIRunloopSourceCancelTimer( driver->base.rls, invitation->timer );
+  }
+  free( invitation );
+}
+
+static int _applemidi_invitation_timeout( void * info, struct timespec * ts );
+
+/**
+ * @brief Send an invitation for its current stage.
+ * Arm the timer that resends it if no answer arrives within
+ * @c APPLEMIDI_INVITE_RETRY milliseconds.
+ * @private @memberof MIDIDriverAppleMIDI
+ * @param invitation The invitation.
+ * @retval 0 on success.
+ * @retval >0 if the invitation could not be sent.
+ */
+static int _applemidi_invitation_send( struct AppleMIDIInvitation * invitation ) {
+  struct MIDIDriverAppleMIDI * driver = invitation->driver;
+  struct timespec ts = { APPLEMIDI_INVITE_RETRY / 1000, ( APPLEMIDI_INVITE_RETRY % 1000 ) * 1000000 };
+  struct sockaddr_storage addr;
+  int fd = driver->control_socket;
+
+  memcpy( &addr, &(invitation->addr), invitation->size );
+  if( invitation->stage == APPLEMIDI_RTP_SOCKET ) {
+    fd = driver->rtp_socket;
+    _applemidi_rtp_addr( invitation->size, (struct sockaddr *) &addr, (struct sockaddr *) &addr );
+  }
+  if( invitation->timer != 0 ) {
+    MIDIRunloopSourceCancelTimer( driver->base.rls, invitation->timer );
+    invitation->timer = 0;
+  }
+  invitation->attempts++;
+  MIDIRunloopSourceAddTimer( driver->base.rls, &ts, &_applemidi_invitation_timeout, invitation, &(invitation->timer) );
+  return _applemidi_invite( driver, fd, invitation->size, (struct sockaddr *) &addr );
+}
+
+/**
+ * @brief Resend an unanswered invitation.
+ * Give up after @c APPLEMIDI_INVITE_ATTEMPTS attempts.
+ * @private @memberof MIDIDriverAppleMIDI
+ * @param info The invitation.
+ * @param ts   The current time.
+ * @retval 0 always, a lost invitation does not stop the runloop.
+ */
+static int _applemidi_invitation_timeout( void * info, struct timespec * ts ) {
+  struct AppleMIDIInvitation * invitation = info;
+  invitation->timer = 0;
+  if( invitation->attempts >= APPLEMIDI_INVITE_ATTEMPTS ) {
+    MIDILog( INFO, "invitation was not answered after %i attempts\n", invitation->attempts );
+    _applemidi_invitation_remove( invitation->driver, invitation );
+  } else {
+    _applemidi_invitation_send( invitation );
+  }
+  return 0;
+}
+
+/**
+ * @brief Invite a peer on the control or the RTP port.
+ * Start a new invitation or move a pending one to the given stage.
+ * @private @memberof MIDIDriverAppleMIDI
+ * @param driver The driver.
+ * @param stage  @c APPLEMIDI_CONTROL_SOCKET or @c APPLEMIDI_RTP_SOCKET.
+ * @param size   The size of the address.
+ * @param addr   The control address of the peer.
+ * @retval 0 on success.
+ * @retval >0 if the invitation could not be sent.
+ */
+static int _applemidi_invitation_start( struct MIDIDriverAppleMIDI * driver, unsigned char stage,
+                                        socklen_t size, struct sockaddr * addr ) {
+  struct AppleMIDIInvitation * invitation;
+  MIDIPrecond( size <= sizeof(struct sockaddr_storage), EINVAL );
+
+  invitation = _applemidi_invitation_find( driver, size, addr );
+  if( invitation == NULL ) {
+    invitation = malloc( sizeof( struct AppleMIDIInvitation ) );
+    MIDIPrecond( invitation != NULL, ENOMEM );
+    invitation->driver = driver;
+    invitation->size   = size;
+    invitation->timer  = 0;
+    memcpy( &(invitation->addr), addr, size );
+    invitation->next    = driver->invitations;
+    driver->invitations = invitation;
+  }
+  invitation->stage    = stage;
+  invitation->attempts = 0;
+  _applemidi_update_runloop_source( driver );
+  return _applemidi_invitation_send( invitation );
+}
+
+/**
+ * @brief Stop resending the invitation that a command answered.
+ * @private @memberof MIDIDriverAppleMIDI
+ * @param driver  The driver.
+ * @param fd      The socket on which the answer arrived.
+ * @param command The answer.
+ */
+static void _applemidi_invitation_answered( struct MIDIDriverAppleMIDI * driver, int fd, struct AppleMIDICommand * command ) {
+  struct AppleMIDIInvitation * invitation;
+  struct sockaddr_storage addr;
+
+  memcpy( &addr, &(command->addr), command->size );
+  if( fd == driver->rtp_socket ) {
+    _applemidi_control_addr( command->size, (struct sockaddr *) &addr, (struct sockaddr *) &addr );
+  }
+  invitation = _applemidi_invitation_find( driver, command->size, (struct sockaddr *) &addr );
+  if( invitation != NULL ) {
+    _applemidi_invitation_remove( driver, invitation );
+  }
+}
+
+/** @} */
+
+/**
+ * @brief Respond to a given AppleMIDI command.
+ * Use the command as response and - if neccessary - send it back to the peer.
+ * @private @memberof MIDIDriverAppleMIDI
+ * @param driver The driver.
+ * @param fd The file descriptor to be used for communication.
+ * @param command The command.
+ * @retval 0 On success.
+ * @retval >0 If the packet could not be sent.
+ */
+static int _applemidi_respond( struct MIDIDriverAppleMIDI * driver, int fd, struct AppleMIDICommand * command ) {
+  struct RTPPeer * peer = NULL;
+  struct AppleMIDIPeer * info;
+  int result;
+
+  switch( command->type ) {
+    case APPLEMIDI_COMMAND_INVITATION:
+      if( fd == driver->control_socket ) {
+        MIDIDriverTriggerEventFormat( &(driver->base), MIDI_APPLEMIDI_PEER_DID_SEND_INVITATION, NULL, "%s", &(command->data.session.name[0]) );
+      }
+      if( driver->accept ) {
+        command->type = APPLEMIDI_COMMAND_INVITATION_ACCEPTED;
+        /* a resent invitation of a known peer is only answered */
+        if( fd == driver->rtp_socket
+         && RTPSessionFindPeerBySSRC( driver->rtp_session, &peer, command->data.session.ssrc ) ) {
+          peer = RTPPeerCreate( command->data.session.ssrc, command->size, (struct sockaddr *) &(command->addr) );
+          RTPSessionAddPeer( driver->rtp_session, peer );
+          RTPPeerRelease( peer );
+        }
+      } else {
+        command->type = APPLEMIDI_COMMAND_INVITATION_REJECTED;
+      }
+      RTPSessionGetSSRC( driver->rtp_session, &(command->data.session.ssrc) );
+      return _applemidi_send_command( driver, fd, command );
+    case APPLEMIDI_COMMAND_INVITATION_ACCEPTED:
+      if( command->data.session.token == driver->token ) {
+        if( RTPSessionFindPeerBySSRC( driver->rtp_session, &peer, command->data.session.ssrc ) == 0 ) {
+          /* answer to a resent invitation */
+          _applemidi_invitation_answered( driver, fd, command );
+          break;
+        }
         if( fd == driver->control_socket ) {
-          _applemidi_rtp_addr( command->size, (struct sockaddr *) &command->addr, (struct sockaddr *) &command->addr );
-          return _applemidi_invite( driver, driver->rtp_socket, command->size, (struct sockaddr *) &(command->addr) );
+          return _applemidi_invitation_start( driver, APPLEMIDI_RTP_SOCKET, command->size, (struct sockaddr *) &(command->addr) );
         } else {
+          _applemidi_invitation_answered( driver, fd, command );
           peer = RTPPeerCreate( command->data.session.ssrc, command->size, (struct sockaddr *) &(command->addr) );
           RTPSessionAddPeer( driver->rtp_session, peer );
-          event = MIDIEventCreate( MIDI_APPLEMIDI_PEER_DID_ACCEPT_INVITATION, NULL, "%s", &(command->data.session.name[0]) );
-          MIDIDriverTriggerEvent( &(driver->base), event );
-          MIDIEventRelease( event );
+          MIDIDriverTriggerEventFormat( &(driver->base), MIDI_APPLEMIDI_PEER_DID_ACCEPT_INVITATION, NULL, "%s", &(command->data.session.name[0]) );
+          result = _applemidi_start_sync( driver, peer );
           RTPPeerRelease( peer );
-          return _applemidi_start_sync( driver, driver->rtp_socket, command->size, (struct sockaddr *) &(command->addr) );
+          return result;
         }
       }
       break;
     case APPLEMIDI_COMMAND_INVITATION_REJECTED:
-      event = MIDIEventCreate( MIDI_APPLEMIDI_PEER_DID_REJECT_INVITATION, NULL, "%s", &(command->data.session.name[0]) );
-      MIDIDriverTriggerEvent( &(driver->base), event );
-      MIDIEventRelease( event );
+      _applemidi_invitation_answered( driver, fd, command );
+      MIDIDriverTriggerEventFormat( &(driver->base), MIDI_APPLEMIDI_PEER_DID_REJECT_INVITATION, NULL, "%s", &(command->data.session.name[0]) );
       break;
     case APPLEMIDI_COMMAND_ENDSESSION:
       RTPSessionFindPeerBySSRC( driver->rtp_session, &peer, command->data.session.ssrc );
-      event = MIDIEventCreate( MIDI_APPLEMIDI_PEER_DID_END_SESSION, NULL, "%s", &(command->data.session.name[0]) );
-      MIDIDriverTriggerEvent( &(driver->base), event );
-      MIDIEventRelease( event );
+      MIDIDriverTriggerEventFormat( &(driver->base), MIDI_APPLEMIDI_PEER_DID_END_SESSION, NULL, "%s", &(command->data.session.name[0]) );
       if( peer != NULL ) {
-        RTPSessionRemovePeer( driver->rtp_session, peer );
+        _applemidi_remove_peer( driver, peer );
       }
       break;
     case APPLEMIDI_COMMAND_SYNCHRONIZATION:
@@ -847,6 +1961,9 @@ static int _applemidi_respond( struct MIDIDriverAppleMIDI * driver, int fd, stru
     case APPLEMIDI_COMMAND_RECEIVER_FEEDBACK:
       RTPSessionFindPeerBySSRC( driver->rtp_session, &peer, command->data.feedback.ssrc );
       RTPMIDISessionJournalTrunkate( driver->rtpmidi_session, peer, command->data.feedback.seqnum );
+      if( peer != NULL && ( info = _applemidi_peer( peer ) ) != NULL ) {
+        info->feedback_count++;
+      }
       break;
     default:
       return 1;
@@ -854,10 +1971,396 @@ static int _applemidi_respond( struct MIDIDriverAppleMIDI * driver, int fd, stru
   return 0;
 }
 
+/* MARK: Name resolution *//**
+ * @name Name resolution
+ * Host names are resolved on a separate thread so that a slow name server
+ * never blocks the runloop. Numeric addresses are used right away.
+ * @{
+ */
+
+/**
+ * @brief Look up a numeric address.
+ * @private @memberof MIDIDriverAppleMIDI
+ * @param address The numeric address.
+ * @param port    The port.
+ * @param res     The address info.
+ * @retval 0 on success.
+ * @retval EAI_NONAME if the address is not numeric.
+ * @retval >0 if the address could not be used.
+ */
+static int _applemidi_lookup_numeric( char * address, unsigned short port, struct addrinfo ** res ) {
+  struct addrinfo hints;
+  char portname[8];
+
+  memset( &hints, 0, sizeof(hints) );
+  hints.ai_family   = AF_INET;
+  hints.ai_socktype = SOCK_DGRAM;
+  hints.ai_flags    = AI_NUMERICHOST | AI_NUMERICSERV;
+  sprintf( &(portname[0]), "%hu", port );
+  return getaddrinfo( address, portname, &hints, res );
+}
+
+static void * _applemidi_resolver_thread( void * arg ) {
+  struct AppleMIDIResolver * resolver = arg;
+  struct AppleMIDIResolveRequest * request;
+  struct AppleMIDIResolution resolution;
+  struct addrinfo hints, * res;
+  char portname[8];
+
+  memset( &hints, 0, sizeof(hints) );
+  hints.ai_family   = AF_INET;
+  hints.ai_socktype = SOCK_DGRAM;
+  hints.ai_flags    = AI_NUMERICSERV;
+
+  pthread_mutex_lock( &(resolver->lock) );
+  while( !resolver->quit ) {
+    request = resolver->first;
+    if( request == NULL ) {
+      pthread_cond_wait( &(resolver->cond), &(resolver->lock) );
+      continue;
+    }
+    resolver->first = request->next;
+    if( resolver->first == NULL ) resolver->last = NULL;
+    pthread_mutex_unlock( &(resolver->lock) );
+
+    memset( &resolution, 0, sizeof(resolution) );
+    resolution.remove = request->remove;
+    memcpy( &(resolution.host[0]), &(request->host[0]), sizeof(resolution.host) );
+    sprintf( &(portname[0]), "%hu", request->port );
+    resolution.error = getaddrinfo( request->host, portname, &hints, &res );
+    if( resolution.error == 0 ) {
+      resolution.size = res->ai_addrlen;
+      memcpy( &(resolution.addr), res->ai_addr, res->ai_addrlen );
+      freeaddrinfo( res );
+    }
+    free( request );
+    send( resolver->fds[1], &resolution, sizeof(resolution), MSG_NOSIGNAL );
+
+    pthread_mutex_lock( &(resolver->lock) );
+  }
+  pthread_mutex_unlock( &(resolver->lock) );
+  _applemidi_resolver_release( resolver );
+  return NULL;
+}
+
+/**
+ * @brief Create a resolver and start its thread.
+ * The resolver is retained by the caller and by the thread.
+ * @private @memberof MIDIDriverAppleMIDI
+ * @return a pointer to the resolver on success.
+ * @return a @c NULL pointer if the resolver could not be started.
+ */
+static struct AppleMIDIResolver * _applemidi_resolver_create( void ) {
+  struct AppleMIDIResolver * resolver = malloc( sizeof( struct AppleMIDIResolver ) );
+  MIDIPrecondReturn( resolver != NULL, ENOMEM, NULL );
+
+  resolver->refs  = 2;
+  resolver->quit  = 0;
+  resolver->first = NULL;
+  resolver->last  = NULL;
+  if( socketpair( AF_UNIX, SOCK_DGRAM, 0, &(resolver->fds[0]) ) ) {
+    MIDIError( errno, "Could not create resolver sockets." );
+    free( resolver );
+    return NULL;
+  }
+  pthread_mutex_init( &(resolver->lock), NULL );
+  pthread_cond_init( &(resolver->cond), NULL );
+  if( pthread_create( &(resolver->thread), NULL, &_applemidi_resolver_thread, resolver ) ) {
+    MIDIError( EAGAIN, "Could not start resolver thread." );
+    pthread_cond_destroy( &(resolver->cond) );
+    pthread_mutex_destroy( &(resolver->lock) );
+    close( resolver->fds[0] );
+    close( resolver->fds[1] );
+    free( resolver );
+    return NULL;
+  }
+  pthread_detach( resolver->thread );
+  return resolver;
+}
+
+/**
+ * @brief Release a resolver.
+ * The last release frees the pending requests and the resolver.
+ * @private @memberof MIDIDriverAppleMIDI
+ * @param resolver The resolver.
+ */
+static void _applemidi_resolver_release( struct AppleMIDIResolver * resolver ) {
+  struct AppleMIDIResolveRequest * request;
+  if( __sync_sub_and_fetch( &(resolver->refs), 1 ) > 0 ) return;
+  while( resolver->first != NULL ) {
+    request = resolver->first;
+    resolver->first = request->next;
+    free( request );
+  }
+  close( resolver->fds[1] );
+  pthread_cond_destroy( &(resolver->cond) );
+  pthread_mutex_destroy( &(resolver->lock) );
+  free( resolver );
+}
+
+/**
+ * @brief Stop a resolver.
+ * The driver stops listening for results, a lookup that is still running
+ * finishes on the resolver thread and is discarded.
+ * @private @memberof MIDIDriverAppleMIDI
+ * @param resolver The resolver.
+ */
+static void _applemidi_resolver_stop( struct AppleMIDIResolver * resolver ) {
+  pthread_mutex_lock( &(resolver->lock) );
+  resolver->quit = 1;
+  pthread_cond_signal( &(resolver->cond) );
+  pthread_mutex_unlock( &(resolver->lock) );
+  close( resolver->fds[0] );
+  _applemidi_resolver_release( resolver );
+}
+
+/**
+ * @brief Resolve a host name in the background.
+ * Once the name is resolved the peer is added or removed on the runloop.
+ * @private @memberof MIDIDriverAppleMIDI
+ * @param driver  The driver.
+ * @param remove  Whether the peer should be removed instead of added.
+ * @param address The host name of the peer.
+ * @param port    The AppleMIDI control port.
+ * @retval 0 if the name is being resolved.
+ * @retval >0 if the name could not be queued.
+ */
+static int _applemidi_resolve( struct MIDIDriverAppleMIDI * driver, unsigned char remove, char * address, unsigned short port ) {
+  struct AppleMIDIResolveRequest * request;
+
+  MIDIPrecond( strlen( address ) < APPLEMIDI_HOSTNAME_LEN, EINVAL );
+  if( driver->resolver == NULL ) {
+    driver->resolver = _applemidi_resolver_create();
+    if( driver->resolver == NULL ) return 1;
+    MIDIRunloopSourceScheduleRead( driver->base.rls, driver->resolver->fds[0] );
+  }
+
+  request = malloc( sizeof( struct AppleMIDIResolveRequest ) );
+  MIDIPrecond( request != NULL, ENOMEM );
+  request->next   = NULL;
+  request->remove = remove;
+  request->port   = port;
+  strcpy( &(request->host[0]), address );
+
+  pthread_mutex_lock( &(driver->resolver->lock) );
+  if( driver->resolver->last == NULL ) {
+    driver->resolver->first = request;
+  } else {
+    driver->resolver->last->next = request;
+  }
+  driver->resolver->last = request;
+  pthread_cond_signal( &(driver->resolver->cond) );
+  pthread_mutex_unlock( &(driver->resolver->lock) );
+  return 0;
+}
+
+/**
+ * @brief Handle the results of the resolver thread.
+ * @private @memberof MIDIDriverAppleMIDI
+ * @param driver The driver.
+ * @retval 0 on success.
+ * @retval >0 if a name could not be resolved or a peer could not be added or removed.
+ */
+static int _applemidi_resolver_read( struct MIDIDriverAppleMIDI * driver ) {
+  struct AppleMIDIResolution resolution;
+  int result = 0;
+
+  while( recv( driver->resolver->fds[0], &resolution, sizeof(resolution), MSG_DONTWAIT ) == sizeof(resolution) ) {
+    if( resolution.error ) {
+      MIDILog( ERROR, "could not resolve %s: %s\n", resolution.host, gai_strerror( resolution.error ) );
+      result++;
+    } else if( resolution.remove ) {
+      result += MIDIDriverAppleMIDIRemovePeerWithSockaddr( driver, resolution.size, (struct sockaddr *) &(resolution.addr) );
+    } else {
+      result += MIDIDriverAppleMIDIAddPeerWithSockaddr( driver, resolution.size, (struct sockaddr *) &(resolution.addr) );
+    }
+  }
+  return result;
+}
+
+/** @} */
+
+/* MARK: Service discovery *//**
+ * @name Service discovery
+ * Browse for AppleMIDI sessions that are announced with DNS-SD and connect
+ * to them. The DNS-SD sockets are part of the driver's runloop source, so
+ * replies are handled without blocking. Only available when the driver is
+ * built with @c HAVE_DNS_SD.
+ * @{
+ */
+
+#ifdef HAVE_DNS_SD
+static void _applemidi_service_free( struct MIDIDriverAppleMIDI * driver, struct AppleMIDIService * service ) {
+  if( service->resolve != NULL ) {
+    MIDIRunloopSourceClearRead( driver->base.rls, DNSServiceRefSockFD( service->resolve ) );
+    DNSServiceRefDeallocate( service->resolve );
+  }
+  free( service );
+}
+
+static void DNSSD_API _applemidi_resolve_reply( DNSServiceRef ref, DNSServiceFlags flags, uint32_t interface,
+                                                DNSServiceErrorType error, const char * fullname, const char * host,
+                                                uint16_t port, uint16_t txtlen, const unsigned char * txt, void * context ) {
+  struct AppleMIDIService * service = context;
+  struct MIDIDriverAppleMIDI * driver = service->driver;
+
+  MIDIRunloopSourceClearRead( driver->base.rls, DNSServiceRefSockFD( service->resolve ) );
+  DNSServiceRefDeallocate( service->resolve );
+  service->resolve = NULL;
+  if( error != kDNSServiceErr_NoError ) {
+    MIDILog( ERROR, "could not resolve service %s: %i\n", service->name, error );
+    return;
+  }
+  strncpy( &(service->host[0]), host, sizeof(service->host) - 1 );
+  service->port = ntohs( port );
+  MIDILog( INFO, "found service %s at %s:%hu\n", service->name, service->host, service->port );
+  MIDIDriverAppleMIDIAddPeer( driver, service->host, service->port );
+}
+
+static void DNSSD_API _applemidi_browse_reply( DNSServiceRef ref, DNSServiceFlags flags, uint32_t interface,
+                                               DNSServiceErrorType error, const char * name,
+                                               const char * type, const char * domain, void * context ) {
+  struct MIDIDriverAppleMIDI * driver = context;
+  struct AppleMIDIService ** link, * service;
+
+  if( error != kDNSServiceErr_NoError ) {
+    MIDILog( ERROR, "could not browse for services: %i\n", error );
+    return;
+  }
+  if( strncmp( name, driver->name, sizeof(driver->name) ) == 0 ) return;
+
+  for( link = &(driver->services); *link != NULL; link = &((*link)->next) ) {
+    if( strncmp( (*link)->name, name, sizeof((*link)->name) ) == 0 ) break;
+  }
+
+  if( flags & kDNSServiceFlagsAdd ) {
+    if( *link != NULL ) return;
+    service = malloc( sizeof( struct AppleMIDIService ) );
+    if( service == NULL ) {
+      MIDIError( ENOMEM, "Could not allocate space for service." );
+      return;
+    }
+    memset( service, 0, sizeof( struct AppleMIDIService ) );
+    service->driver = driver;
+    strncpy( &(service->name[0]), name, sizeof(service->name) - 1 );
+    if( DNSServiceResolve( &(service->resolve), 0, interface, name, type, domain,
+                           &_applemidi_resolve_reply, service ) != kDNSServiceErr_NoError ) {
+      MIDILog( ERROR, "could not resolve service %s\n", name );
+      free( service );
+      return;
+    }
+    MIDIRunloopSourceScheduleRead( driver->base.rls, DNSServiceRefSockFD( service->resolve ) );
+    service->next = driver->services;
+    driver->services = service;
+  } else if( *link != NULL ) {
+    service = *link;
+    *link = service->next;
+    if( service->resolve == NULL ) {
+      MIDIDriverAppleMIDIRemovePeer( driver, service->host, service->port );
+    }
+    _applemidi_service_free( driver, service );
+  }
+}
+
+static int _applemidi_browser_read( struct MIDIDriverAppleMIDI * driver, fd_set * readfds ) {
+  struct AppleMIDIService * service, * next;
+  int result = 0;
+
+  for( service = driver->services; service != NULL; service = next ) {
+    next = service->next;
+    if( service->resolve != NULL && FD_ISSET( DNSServiceRefSockFD( service->resolve ), readfds ) ) {
+      result += ( DNSServiceProcessResult( service->resolve ) != kDNSServiceErr_NoError );
+    }
+  }
+  if( driver->browser != NULL && FD_ISSET( DNSServiceRefSockFD( driver->browser ), readfds ) ) {
+    result += ( DNSServiceProcessResult( driver->browser ) != kDNSServiceErr_NoError );
+  }
+  return result;
+}
+
+static int _applemidi_browser_init_fds( struct MIDIDriverAppleMIDI * driver, fd_set * fds, int nfds ) {
+  struct AppleMIDIService * service;
+  int fd;
+
+  if( driver->browser != NULL ) {
+    fd = DNSServiceRefSockFD( driver->browser );
+    FD_SET( fd, fds );
+    if( fd >= nfds ) nfds = fd + 1;
+  }
+  for( service = driver->services; service != NULL; service = service->next ) {
+    if( service->resolve == NULL ) continue;
+    fd = DNSServiceRefSockFD( service->resolve );
+    FD_SET( fd, fds );
+    if( fd >= nfds ) nfds = fd + 1;
+  }
+  return nfds;
+}
+#endif
+
+/**
+ * @brief Browse for AppleMIDI sessions.
+ * Connect to every AppleMIDI session that is announced on the network,
+ * except sessions with the driver's own name. Sessions that disappear
+ * are disconnected.
+ * @public @memberof MIDIDriverAppleMIDI
+ * @param driver The driver.
+ * @retval 0 on success.
+ * @retval >0 if browsing could not be started or is not available.
+ */
+int MIDIDriverAppleMIDIStartBrowsing( struct MIDIDriverAppleMIDI * driver ) {
+  MIDIPrecond( driver != NULL, EFAULT );
+#ifdef HAVE_DNS_SD
+  if( driver->browser != NULL ) return 0;
+  if( DNSServiceBrowse( &(driver->browser), 0, 0, APPLEMIDI_SERVICE_TYPE, NULL,
+                        &_applemidi_browse_reply, driver ) != kDNSServiceErr_NoError ) {
+    MIDILog( ERROR, "could not browse for %s\n", APPLEMIDI_SERVICE_TYPE );
+    driver->browser = NULL;
+    return 1;
+  }
+  MIDIRunloopSourceScheduleRead( driver->base.rls, DNSServiceRefSockFD( driver->browser ) );
+  return 0;
+#else
+  MIDILog( ERROR, "service discovery is not available\n" );
+  return 1;
+#endif
+}
+
+/**
+ * @brief Stop browsing for AppleMIDI sessions.
+ * Sessions that were already connected stay connected.
+ * @public @memberof MIDIDriverAppleMIDI
+ * @param driver The driver.
+ * @retval 0 on success.
+ * @retval >0 if the operation failed.
+ */
+int MIDIDriverAppleMIDIStopBrowsing( struct MIDIDriverAppleMIDI * driver ) {
+#ifdef HAVE_DNS_SD
+  struct AppleMIDIService * service;
+#endif
+  MIDIPrecond( driver != NULL, EFAULT );
+#ifdef HAVE_DNS_SD
+  while( driver->services != NULL ) {
+    service = driver->services;
+    driver->services = service->next;
+    _applemidi_service_free( driver, service );
+  }
+  if( driver->browser != NULL ) {
+    MIDIRunloopSourceClearRead( driver->base.rls, DNSServiceRefSockFD( driver->browser ) );
+    DNSServiceRefDeallocate( driver->browser );
+    driver->browser = NULL;
+  }
+#endif
+  return 0;
+}
+
+/** @} */
+
 /**
  * @brief Connect to a peer with a socket address.
  * Use the AppleMIDI protocol to establish an RTP-session, including a SSRC that was received
  * from the peer. Send the session packets to the given socket address.
+ * The invitation is resent on the runloop until the peer answers it, other
+ * invitations do not wait for it.
  * @public @memberof MIDIDriverAppleMIDI
  * @param driver The driver.
  * @param size The size of the address pointed to by @c addr.
@@ -866,7 +2369,7 @@ static int _applemidi_respond( struct MIDIDriverAppleMIDI * driver, int fd, stru
  * @retval >0 if the connection could not be established.
  */
 int MIDIDriverAppleMIDIAddPeerWithSockaddr( struct MIDIDriverAppleMIDI * driver, socklen_t size, struct sockaddr * addr ) {
-  return _applemidi_invite( driver, driver->control_socket, size, addr );
+  return _applemidi_invitation_start( driver, APPLEMIDI_CONTROL_SOCKET, size, addr );
 }
 
 /**
@@ -875,21 +2378,23 @@ int MIDIDriverAppleMIDIAddPeerWithSockaddr( struct MIDIDriverAppleMIDI * driver,
  * from the peer.
  * @public @memberof MIDIDriverAppleMIDI
  * @param driver The driver.
- * @param address The internet address of the peer.
+ * A numeric address is invited right away, a host name is resolved in the
+ * background and invited from the runloop once it is known.
+ * @param address The internet address or host name of the peer.
  * @param port The AppleMIDI control port (usually 5004), the RTP-port is the next port.
- * @retval 0 on success.
+ * @retval 0 on success or if the host name is being resolved.
  * @retval >0 if the connection could not be established.
  */
 int MIDIDriverAppleMIDIAddPeer( struct MIDIDriverAppleMIDI * driver, char * address, unsigned short port ) {
   struct addrinfo * res;
   int result;
-  char portname[8];
 
-  sprintf( &(portname[0]), "%hu", port );
-  result = getaddrinfo( address, portname, NULL, &res );
-  if( result ) {
+  result = _applemidi_lookup_numeric( address, port, &res );
+  if( result == EAI_NONAME ) {
+    return _applemidi_resolve( driver, 0, address, port );
+  } else if( result ) {
     return 1;
-  }  
+  }
 
   result = MIDIDriverAppleMIDIAddPeerWithSockaddr( driver, res->ai_addrlen, res->ai_addr );
   freeaddrinfo( res );
@@ -908,14 +2413,20 @@ int MIDIDriverAppleMIDIAddPeer( struct MIDIDriverAppleMIDI * driver, char * addr
  * @retval >0 if the session could not be ended.
  */
 int MIDIDriverAppleMIDIRemovePeerWithSockaddr( struct MIDIDriverAppleMIDI * driver, socklen_t size, struct sockaddr * addr ) {
-  int result;
+  int result, pending = 0;
   struct RTPPeer * peer;
+  struct AppleMIDIInvitation * invitation;
+  invitation = _applemidi_invitation_find( driver, size, addr );
+  if( invitation != NULL ) {
+    _applemidi_invitation_remove( driver, invitation );
+    pending = 1;
+  }
   result = RTPSessionFindPeerByAddress( driver->rtp_session, &peer, size, addr );
   if( result ) {
-    return result;
+    return pending ? _applemidi_endsession( driver, driver->control_socket, size, addr ) : result;
   }
 
-  result  = RTPSessionRemovePeer( driver->rtp_session, peer );
+  result  = _applemidi_remove_peer( driver, peer );
   result += _applemidi_endsession( driver, driver->control_socket, size, addr );
   return result;
 }
@@ -926,19 +2437,20 @@ int MIDIDriverAppleMIDIRemovePeerWithSockaddr( struct MIDIDriverAppleMIDI * driv
  * Remove the peer from the RTPSession.
  * @public @memberof MIDIDriverAppleMIDI
  * @param driver The driver.
- * @param address The internet address of the peer.
+ * Like @ref MIDIDriverAppleMIDIAddPeer a host name is resolved in the background.
+ * @param address The internet address or host name of the peer.
  * @param port The AppleMIDI control port (usually 5004), the RTP-port is the next port.
- * @retval 0 on success.
+ * @retval 0 on success or if the host name is being resolved.
  * @retval >0 if the session could not be ended.
  */
 int MIDIDriverAppleMIDIRemovePeer( struct MIDIDriverAppleMIDI * driver, char * address, unsigned short port ) {
   struct addrinfo * res = NULL;
   int result;
-  char portname[8];
 
-  sprintf( &(portname[0]), "%hu", port );
-  result = getaddrinfo( address, portname, NULL, &res );
-  if( result ) {
+  result = _applemidi_lookup_numeric( address, port, &res );
+  if( result == EAI_NONAME ) {
+    return _applemidi_resolve( driver, 1, address, port );
+  } else if( result ) {
     return 1;
   }
   
@@ -947,54 +2459,419 @@ int MIDIDriverAppleMIDIRemovePeer( struct MIDIDriverAppleMIDI * driver, char * a
   return result;
 }
 
-static int _applemidi_receive_rtpmidi( struct MIDIDriverAppleMIDI * driver ) {
-  struct MIDIMessageList messages[APPLEMIDI_MAX_MESSAGES_PER_PACKET];
-  int i, result;
+/**
+ * @brief Convert an RTP timestamp of a peer to the driver's clock.
+ * RTP timestamps only hold the low 32 bits of the peer's clock, they are
+ * unwrapped around the peer time that corresponds to @c now.
+ * @private @memberof MIDIDriverAppleMIDI
+ * @param peer      The peer.
+ * @param now       The current time of the driver's clock.
+ * @param timestamp The RTP timestamp.
+ * @return the time of the driver's clock.
+ */
+static MIDITimestamp _applemidi_peer_time( struct AppleMIDIPeer * peer, MIDITimestamp now, MIDITimestamp timestamp ) {
+  return now + (int32_t) ( (uint32_t) timestamp - (uint32_t) ( now + _applemidi_peer_diff( peer, now ) ) );
+}
+
+/**
+ * @brief Update the interarrival jitter of a peer.
+ * The jitter is estimated as in RFC 3550, the running mean deviation of
+ * the difference between the transit times of consecutive packets.
+ * @private @memberof MIDIDriverAppleMIDI
+ * @param peer    The peer that sent the packet.
+ * @param now     The arrival time of the packet.
+ * @param message The first message of the packet.
+ */
+static void _applemidi_transit_sample( struct AppleMIDIPeer * peer, MIDITimestamp now, struct MIDIMessage * message ) {
+  MIDITimestamp timestamp, transit, d;
+  MIDIMessageGetTimestamp( message, &timestamp );
+  transit = now - _applemidi_peer_time( peer, now, timestamp );
+  if( peer->transit_packets++ > 0 ) {
+    d = transit - peer->last_transit;
+    if( d < 0 ) d = -d;
+    peer->jitter += ( (double) d - peer->jitter ) / 16;
+  }
+  peer->last_transit = transit;
+}
+
+/**
+ * @brief Record the transit time of a packet and adapt the target latency.
+ * The latency rises at once to avoid late messages and decays slowly when
+ * the network calms down.
+ * @private @memberof MIDIDriverAppleMIDI
+ * @param driver  The driver.
+ * @param peer    The peer that sent the packet.
+ * @param now     The arrival time of the packet.
+ * @param message The first message of the packet.
+ */
+static void _applemidi_jitter_sample( struct MIDIDriverAppleMIDI * driver, struct AppleMIDIPeer * peer,
+                                      MIDITimestamp now, struct MIDIMessage * message ) {
+  MIDITimestamp sorted[APPLEMIDI_JITTER_WINDOW];
+  MIDITimestamp timestamp, target;
+  size_t i, j, n;
+
+  MIDIMessageGetTimestamp( message, &timestamp );
+  peer->transit[peer->transit_count++ % APPLEMIDI_JITTER_WINDOW] = now - _applemidi_peer_time( peer, now, timestamp );
+
+  n = ( peer->transit_count < APPLEMIDI_JITTER_WINDOW ) ? peer->transit_count : APPLEMIDI_JITTER_WINDOW;
+  memcpy( &(sorted[0]), &(peer->transit[0]), n * sizeof(MIDITimestamp) );
+  for( i=1; i<n; i++ ) {
+    timestamp = sorted[i];
+    for( j=i; j>0 && sorted[j-1] > timestamp; j-- ) {
+      sorted[j] = sorted[j-1];
+    }
+    sorted[j] = timestamp;
+  }
+  target = sorted[( n - 1 ) * APPLEMIDI_JITTER_PERCENTILE / 100];
+  if( target < driver->jitter_min ) target = driver->jitter_min;
+  if( target > driver->jitter_max ) target = driver->jitter_max;
 
-  for( i=0; i<APPLEMIDI_MAX_MESSAGES_PER_PACKET; i++ ) {
-    messages[i].message = NULL;
-    messages[i].next = &(messages[i+1]);
+  if( n == 1 || target > peer->latency ) {
+    peer->latency = target;
+  } else {
+    peer->latency -= ( peer->latency - target + 7 ) / 8;
   }
-  messages[i-1].next = NULL;
+}
 
-  result = RTPMIDISessionReceive( driver->rtpmidi_session, &(messages[0]) );
-  if( result != 0 ) return result;
+/**
+ * @brief Hold a received message in the jitter buffer.
+ * @private @memberof MIDIDriverAppleMIDI
+ * @param driver  The driver.
+ * @param peer    The peer that sent the message.
+ * @param now     The arrival time of the message.
+ * @param message The message.
+ * @retval 0 on success.
+ * @retval >0 if the message could not be buffered.
+ */
+static int _applemidi_jitter_schedule( struct MIDIDriverAppleMIDI * driver, struct AppleMIDIPeer * peer,
+                                       MIDITimestamp now, struct MIDIMessage * message ) {
+  MIDITimestamp timestamp;
+  MIDIMessageGetTimestamp( message, &timestamp );
+  MIDIMessageSetTimestamp( message, _applemidi_peer_time( peer, now, timestamp ) + peer->latency );
+  return MIDISchedulerSchedule( driver->jitter_buffer, message );
+}
+
+/**
+ * @brief Deliver the messages of a received packet.
+ * Sample the peer's transit time and pass the messages through the jitter
+ * buffer if there is one. The messages are released.
+ * @private @memberof MIDIDriverAppleMIDI
+ * @param driver   The driver.
+ * @param peer     The peer that sent the packet or @c NULL.
+ * @param messages The list of messages, ending at the first empty entry.
+ */
+static void _applemidi_deliver_rtpmidi( struct MIDIDriverAppleMIDI * driver, struct RTPPeer * peer,
+                                        struct MIDIMessageList * messages ) {
+  struct AppleMIDIPeer * info = NULL;
+  MIDITimestamp now = 0;
+  int i;
+
+  if( peer != NULL ) {
+    RTPMIDIPeerGetInfo( peer, (void **) &info );
+    if( info != NULL && ! info->synced ) info = NULL;
+  }
+  if( info != NULL && messages[0].message != NULL ) {
+    MIDIClockGetNow( driver->base.clock, &now );
+    _applemidi_transit_sample( info, now, messages[0].message );
+    if( driver->jitter_max > 0 ) _applemidi_jitter_sample( driver, info, now, messages[0].message );
+  }
+  if( driver->jitter_max == 0 ) info = NULL;
 
   for( i=0; i<APPLEMIDI_MAX_MESSAGES_PER_PACKET && messages[i].message != NULL; i++ ) {
-  /*MIDIMessageQueuePush( driver->in_queue, messages[i].message );
-    MIDIMessageRelease( messages[i].message );*/
-    MIDIDriverAppleMIDIReceiveMessage( driver, messages[i].message ); /* fixme: add scheduling! */
+    if( info != NULL ) {
+      _applemidi_jitter_schedule( driver, info, now, messages[i].message );
+    } else {
+      MIDIDriverAppleMIDIReceiveMessage( driver, messages[i].message );
+    }
+    /* hand the message back to the session's pool unless someone retained it */
+    MIDIMessageRelease( messages[i].message );
   }
+}
+
+/**
+ * @brief Check if anyone looks at the received messages.
+ * @private @memberof MIDIDriverAppleMIDI
+ * @param driver The driver.
+ * @return 1 if the driver's port is connected or received messages are
+ *         observed, 0 otherwise.
+ */
+static int _applemidi_inspected( struct MIDIDriverAppleMIDI * driver ) {
+  struct MIDIPort * port = NULL;
+  size_t count = 0;
+  if( MIDIDriverObservesEvent( &(driver->base), MIDI_DRIVER_WILL_RECEIVE_MESSAGE ) ) return 1;
+  MIDIDriverGetPort( &(driver->base), &port );
+  if( port != NULL ) MIDIPortGetConnectionCount( port, &count );
+  return count > 0;
+}
+
+/**
+ * @brief Forward the received packets to the forwarding target.
+ * The commands are received as compact messages and copied to the
+ * target's packets. Only if someone inspects the received messages they
+ * are decoded and delivered, before the filter is applied.
+ * @private @memberof MIDIDriverAppleMIDI
+ * @param driver The driver.
+ * @retval 0 on success.
+ * @retval >0 if no packet could be received.
+ */
+static int _applemidi_forward_rtpmidi( struct MIDIDriverAppleMIDI * driver ) {
+  struct MIDICompactMessage compact[APPLEMIDI_MAX_MESSAGES_PER_PACKET];
+  struct MIDIMessageList messages[APPLEMIDI_MAX_MESSAGES_PER_PACKET];
+  struct MIDIDriverAppleMIDI * target = driver->forward;
+  struct RTPPeer * peer;
+  unsigned char * payload;
+  MIDITimestamp timestamp;
+  size_t i, n, count, pending;
+  int result;
+
+  RTPMIDISessionSetProfile( target->rtpmidi_session, target->base.profile );
+  do {
+    peer = NULL;
+    result = RTPMIDISessionReceiveCompact( driver->rtpmidi_session, &peer, APPLEMIDI_MAX_MESSAGES_PER_PACKET,
+                                           &(compact[0]), &count, &payload, &timestamp );
+    if( result != 0 ) return result;
+
+    if( count > 0 && _applemidi_inspected( driver ) ) {
+      for( i=0, n=0; i<count; i++ ) {
+        messages[n].message = MIDIMessageCreate( MIDI_STATUS_RESET );
+        if( messages[n].message == NULL ) break;
+        if( MIDIMessageSetCompact( messages[n].message, &(compact[i]), payload ) ) {
+          MIDIMessageRelease( messages[n].message );
+          continue;
+        }
+        MIDIMessageSetTimestamp( messages[n].message, timestamp + compact[i].timestamp );
+        messages[n].next = &(messages[n+1]);
+        n++;
+      }
+      if( n < APPLEMIDI_MAX_MESSAGES_PER_PACKET ) messages[n].message = NULL;
+      if( n > 0 ) _applemidi_deliver_rtpmidi( driver, peer, &(messages[0]) );
+    }
+
+    if( driver->forward_filtered ) {
+      MIDIRouterFilterApplyBatch( &(driver->forward_filter), count, &(compact[0]), &(compact[0]), &count );
+    }
+    if( count > 0 ) {
+      /* the packets are stamped with the target's clock */
+      MIDIClockGetNow( target->base.clock, &timestamp );
+      RTPMIDISessionSendCompact( target->rtpmidi_session, timestamp, count, &(compact[0]), payload );
+    }
+    RTPMIDISessionGetPendingPackets( driver->rtpmidi_session, &pending );
+  } while( pending > 0 );
+  _applemidi_arm_stream_timer( target );
+  return 0;
+}
+
+static int _applemidi_receive_rtpmidi( struct MIDIDriverAppleMIDI * driver ) {
+  struct MIDIMessageList messages[APPLEMIDI_MAX_MESSAGES_PER_PACKET];
+  struct RTPPeer * peer;
+  int i, result;
+  size_t pending;
+
+  RTPMIDISessionSetProfile( driver->rtpmidi_session, driver->base.profile );
+  if( driver->forward != NULL ) return _applemidi_forward_rtpmidi( driver );
+  /* one wakeup drains every packet that is pending on the socket */
+  do {
+    for( i=0; i<APPLEMIDI_MAX_MESSAGES_PER_PACKET; i++ ) {
+      messages[i].message = NULL;
+      messages[i].next = &(messages[i+1]);
+    }
+    messages[i-1].next = NULL;
+
+    peer = NULL;
+    result = RTPMIDISessionReceiveFrom( driver->rtpmidi_session, &peer, &(messages[0]) );
+    if( result != 0 ) return result;
+    _applemidi_deliver_rtpmidi( driver, peer, &(messages[0]) );
+    RTPMIDISessionGetPendingPackets( driver->rtpmidi_session, &pending );
+  } while( pending > 0 );
   
   return 0;
 }
 
 static int _applemidi_send_rtpmidi( struct MIDIDriverAppleMIDI * driver ) {
   struct MIDIMessageList messages[APPLEMIDI_MAX_MESSAGES_PER_PACKET];
-  int i, result;
-  size_t length;
+  MIDITimestamp timestamp;
+  int i, n, r, result = 0;
+  size_t length, rt;
   MIDIMessageQueueGetLength( driver->out_queue, &length );
-
+  MIDIMessageQueueGetLength( driver->rt_queue, &rt );
   if( length > 0 ) {
-    for( i=0; i<length && i<APPLEMIDI_MAX_MESSAGES_PER_PACKET; i++ ) {
-      MIDIMessageQueuePop( driver->out_queue, &(messages[i].message) );
+    MIDIProfileEnd( driver->base.profile, MIDI_DRIVER_STAGE_QUEUE );
+    MIDIDriverSetQueueDepth( &(driver->base), 0 );
+  }
+  RTPMIDISessionSetProfile( driver->rtpmidi_session, driver->base.profile );
+
+  /* send everything that is queued, using as few packets as possible,
+   * real-time messages go first */
+  while( rt + length > 0 && result == 0 ) {
+    r = ( rt < driver->batch_size ) ? rt : driver->batch_size;
+    n = ( rt + length < driver->batch_size ) ? rt + length : driver->batch_size;
+    for( i=0; i<n; i++ ) {
+      MIDIMessageQueuePop( ( i < r ) ? driver->rt_queue : driver->out_queue, &(messages[i].message) );
+      MIDIMessageGetTimestamp( messages[i].message, &timestamp );
+      MIDIProfileLane( driver->base.profile, ( i < r ) ? MIDI_DRIVER_LANE_REALTIME : MIDI_DRIVER_LANE_BULK,
+                       driver->base.clock, timestamp );
       messages[i].next = &(messages[i+1]);
     }
-    messages[i-1].next = NULL;
+    messages[n-1].next = NULL;
 
     result = RTPMIDISessionSend( driver->rtpmidi_session, &(messages[0]) );
 
-    for( i=0; i<length && i<APPLEMIDI_MAX_MESSAGES_PER_PACKET; i++ ) {
+    for( i=0; i<n; i++ ) {
       if( messages[i].message != NULL ) MIDIMessageRelease( messages[i].message );
     }
-    return result;
-  } else {
-    return 0;
+    rt     -= r;
+    length -= n - r;
+  }
+  _applemidi_arm_stream_timer( driver );
+  _applemidi_arm_sysex_timer( driver );
+  return result;
+}
+
+static int _applemidi_respond_deferred( struct MIDIDriverAppleMIDI * driver ) {
+  size_t i;
+  int result = 0;
+  for( i=0; i<driver->ndeferred; i++ ) {
+    result += _applemidi_respond( driver, driver->rtp_socket, &(driver->deferred[i]) );
   }
+  driver->ndeferred = 0;
+  return result;
+}
+
+/**
+ * @brief Write the coalesced packets of all streams.
+ * Streams the kernel did not take all bytes from are written again as soon
+ * as their socket becomes writable.
+ * @private @memberof MIDIDriverAppleMIDI
+ * @param driver The driver.
+ * @retval 0 on success.
+ * @retval >0 if a connection failed.
+ */
+static int _applemidi_flush_streams( struct MIDIDriverAppleMIDI * driver ) {
+  struct RTPPeer * peer = NULL;
+  size_t bytes;
+  int fd, result;
+
+  if( driver->nstreams == 0 ) return 0;
+  result = RTPSessionFlushStreams( driver->rtp_session, NULL );
+  RTPSessionNextPeer( driver->rtp_session, &peer );
+  while( peer != NULL ) {
+    RTPPeerGetStream( peer, &fd );
+    if( fd >= 0 ) {
+      RTPPeerGetStreamPending( peer, &bytes );
+      if( bytes > 0 ) {
+        MIDIRunloopSourceScheduleWrite( driver->base.rls, fd );
+      } else {
+        MIDIRunloopSourceClearWrite( driver->base.rls, fd );
+      }
+    }
+    RTPSessionNextPeer( driver->rtp_session, &peer );
+  }
+  return result;
+}
+
+/**
+ * @brief Flush the streams once the runloop turn that sent packets is over.
+ * @private @memberof MIDIDriverAppleMIDI
+ * @param drv The driver.
+ * @param now The current time.
+ */
+static int _applemidi_stream_timeout( void * drv, struct timespec * now ) {
+  struct MIDIDriverAppleMIDI * driver = drv;
+  driver->stream_timer = 0;
+  return _applemidi_flush_streams( driver );
+}
+
+/**
+ * @brief Arm the timer that flushes the streams at the end of the runloop turn.
+ * Packets that are sent within one turn are coalesced and written together.
+ * @private @memberof MIDIDriverAppleMIDI
+ * @param driver The driver.
+ * @retval 0 on success.
+ * @retval >0 if the timer could not be added.
+ */
+static int _applemidi_arm_stream_timer( struct MIDIDriverAppleMIDI * driver ) {
+  struct timespec now = { 0, 0 };
+  if( driver->nstreams == 0 || driver->stream_timer != 0 ) return 0;
+  return MIDIRunloopSourceAddTimer( driver->base.rls, &now, &_applemidi_stream_timeout,
+                                    driver, &(driver->stream_timer) );
+}
+
+/**
+ * @brief Send the system exclusive segments that are due.
+ * @private @memberof MIDIDriverAppleMIDI
+ * @param drv The driver.
+ * @param now The current time.
+ */
+static int _applemidi_sysex_timeout( void * drv, struct timespec * now ) {
+  struct MIDIDriverAppleMIDI * driver = drv;
+  int result;
+  driver->sysex_timer = 0;
+  RTPMIDISessionSetProfile( driver->rtpmidi_session, driver->base.profile );
+  result = RTPMIDISessionSendSysEx( driver->rtpmidi_session );
+  _applemidi_arm_stream_timer( driver );
+  _applemidi_arm_sysex_timer( driver );
+  return result;
+}
+
+/**
+ * @brief Arm the timer that sends the next system exclusive segment.
+ * @private @memberof MIDIDriverAppleMIDI
+ * @param driver The driver.
+ * @retval 0 on success.
+ * @retval >0 if the timer could not be added.
+ */
+static int _applemidi_arm_sysex_timer( struct MIDIDriverAppleMIDI * driver ) {
+  struct timespec delay;
+  if( driver->sysex_timer != 0 ) return 0;
+  if( RTPMIDISessionGetSysExDelay( driver->rtpmidi_session, &delay ) ) return 0;
+  return MIDIRunloopSourceAddTimer( driver->base.rls, &delay, &_applemidi_sysex_timeout,
+                                    driver, &(driver->sysex_timer) );
+}
+
+/**
+ * @brief Receive the packets of all peers whose stream is readable.
+ * A stream that was closed or failed is dropped and the peer falls back to
+ * datagrams.
+ * @private @memberof MIDIDriverAppleMIDI
+ * @param driver  The driver.
+ * @param readfds The readable file descriptors.
+ * @retval 0 on success.
+ * @retval >0 if packets could not be received.
+ */
+static int _applemidi_read_streams( struct MIDIDriverAppleMIDI * driver, fd_set * readfds ) {
+  struct RTPPeer * peer = NULL;
+  size_t pending;
+  int fd, result = 0;
+
+  RTPMIDISessionSetProfile( driver->rtpmidi_session, driver->base.profile );
+  RTPSessionNextPeer( driver->rtp_session, &peer );
+  while( peer != NULL ) {
+    RTPPeerGetStream( peer, &fd );
+    if( fd >= 0 && FD_ISSET( fd, readfds ) ) {
+      /* the stream may hold more frames than fit into one read */
+      for( ;; ) {
+        if( RTPMIDISessionReadStream( driver->rtpmidi_session, peer ) ) {
+          MIDILog( INFO, "stream of peer closed, falling back to datagrams\n" );
+          MIDIRunloopSourceClearRead( driver->base.rls, fd );
+          MIDIRunloopSourceClearWrite( driver->base.rls, fd );
+          RTPPeerSetStream( peer, -1 );
+          driver->nstreams--;
+          break;
+        }
+        RTPMIDISessionGetPendingPackets( driver->rtpmidi_session, &pending );
+        if( pending == 0 ) break;
+        result += _applemidi_receive_rtpmidi( driver );
+      }
+    }
+    RTPSessionNextPeer( driver->rtp_session, &peer );
+  }
+  /* commands that came over the streams may remove peers */
+  return result + _applemidi_respond_deferred( driver );
 }
 
 static int _applemidi_read_fds( void * drv, int nfds, fd_set * readfds ) {
   struct MIDIDriverAppleMIDI * driver = drv;
+  struct AppleMIDICommand command;
   int fd, result = 0;
 
   if( nfds <= 0 ) return 0;
@@ -1002,8 +2879,8 @@ static int _applemidi_read_fds( void * drv, int nfds, fd_set * readfds ) {
   if( FD_ISSET( driver->control_socket, readfds ) ) {
     fd = driver->control_socket;
     if( _test_applemidi( fd ) == 0 ) {
-      if( _applemidi_recv_command( driver, fd, &(driver->command) ) == 0 ) {
-        result += _applemidi_respond( driver, fd, &(driver->command) );
+      if( _applemidi_recv_command( driver, fd, &command ) == 0 ) {
+        result += _applemidi_respond( driver, fd, &command );
       }
     }
   }
@@ -1011,13 +2888,25 @@ static int _applemidi_read_fds( void * drv, int nfds, fd_set * readfds ) {
   if( FD_ISSET( driver->rtp_socket, readfds ) ) {
     fd = driver->rtp_socket;
     if( _test_applemidi( fd ) == 0 ) {
-      if( _applemidi_recv_command( driver, fd, &(driver->command) ) == 0 ) {
-        result += _applemidi_respond( driver, fd, &(driver->command) );
+      if( _applemidi_recv_command( driver, fd, &command ) == 0 ) {
+        result += _applemidi_respond( driver, fd, &command );
       }
     } else {
       result += _applemidi_receive_rtpmidi( driver );
+      result += _applemidi_respond_deferred( driver );
     }
   }
+
+  if( driver->nstreams > 0 ) {
+    result += _applemidi_read_streams( driver, readfds );
+  }
+
+  if( driver->resolver != NULL && FD_ISSET( driver->resolver->fds[0], readfds ) ) {
+    result += _applemidi_resolver_read( driver );
+  }
+#ifdef HAVE_DNS_SD
+  result += _applemidi_browser_read( driver, readfds );
+#endif
   
   _applemidi_update_runloop_source( driver );
 
@@ -1039,6 +2928,9 @@ static int _applemidi_write_fds( void * drv, int nfds, fd_set * writefds ) {
     fd = driver->control_socket;
   }
 
+  /* everything this turn had to send is written, hand it to the streams */
+  result += _applemidi_flush_streams( driver );
+
   _applemidi_update_runloop_source( driver );
 
   return result;
@@ -1046,30 +2938,75 @@ static int _applemidi_write_fds( void * drv, int nfds, fd_set * writefds ) {
 
 static int _applemidi_idle_timeout( void * drv, struct timespec * ts ) {
   struct MIDIDriverAppleMIDI * driver = drv;
-  struct sockaddr * addr;
-  socklen_t size;
 
   _applemidi_update_runloop_source( driver );
 
-  RTPSessionNextPeer( driver->rtp_session, &(driver->peer) );
-  if( driver->peer != NULL ) {
-    /* check if receiver feedback needs to be sent */
-    if( driver->sync == 0 ) {
-      /* no sync packets active. start new sync */
-      RTPPeerGetAddress( driver->peer, &size, &addr );
-      return _applemidi_start_sync( driver, driver->rtp_socket, size, addr );
-    }
-  }
-
-  /* check for messages in dispatch (incoming) queue:
+  /* clock synchronization runs on its own timer, see _applemidi_sync_timeout.
+   * check for messages in dispatch (incoming) queue:
    *   if message needs to be dispatched (timestamp >= now+latency)
    *   call MIDIDriverAppleMIDIReceiveMessage
-   * send receiver feedback
-   * if the last synchronization happened a certain time ago, synchronize again */
+   * send receiver feedback */
 
   return 0;
 }
 
+/**
+ * @brief Start the due clock synchronizations.
+ * Start a sync with every peer whose synchronization is due. New peers are
+ * synchronized in a fast burst of @c APPLEMIDI_SYNC_BURST exchanges, after
+ * that every @c APPLEMIDI_SYNC_INTERVAL milliseconds. Every peer has its
+ * own exchange, an exchange that did not complete within
+ * @c APPLEMIDI_SYNC_TIMEOUT milliseconds is considered lost and restarted.
+ * @private @memberof MIDIDriverAppleMIDI
+ * @param drv The driver.
+ * @param ts  The current time.
+ * @retval 0 on success.
+ * @retval >0 if a sync could not be started.
+ */
+static int _applemidi_sync_timeout( void * drv, struct timespec * ts ) {
+  struct MIDIDriverAppleMIDI * driver = drv;
+  struct RTPPeer * peer = NULL;
+  struct AppleMIDIPeer * info;
+  MIDITimestamp now;
+  int result = 0;
+
+  driver->sync_timer = 0;
+  MIDIClockGetNow( driver->base.clock, &now );
+  RTPSessionNextPeer( driver->rtp_session, &peer );
+  while( peer != NULL ) {
+    info = _applemidi_peer( peer );
+    if( info != NULL ) {
+      if( info->sync_state != APPLEMIDI_SYNC_IDLE
+       && now - info->sync_started > APPLEMIDI_MSEC_TO_TICKS( APPLEMIDI_SYNC_TIMEOUT ) ) {
+        info->sync_state = APPLEMIDI_SYNC_IDLE;
+        info->next_sync  = now;
+      }
+      if( info->sync_state == APPLEMIDI_SYNC_IDLE && info->next_sync <= now ) {
+        info->next_sync = now + APPLEMIDI_MSEC_TO_TICKS( ( info->sync_count < APPLEMIDI_SYNC_BURST )
+                                                         ? APPLEMIDI_SYNC_BURST_INTERVAL : APPLEMIDI_SYNC_INTERVAL );
+        result += _applemidi_start_sync( driver, peer );
+      }
+    }
+    RTPSessionNextPeer( driver->rtp_session, &peer );
+  }
+  return result + _applemidi_arm_sync_timer( driver );
+}
+
+/**
+ * @brief Arm the runloop timer for clock synchronization.
+ * The timer fires every @c APPLEMIDI_SYNC_BURST_INTERVAL milliseconds and
+ * is only effective while the driver is part of a runloop.
+ * @private @memberof MIDIDriverAppleMIDI
+ * @param driver The driver.
+ * @retval 0 on success.
+ * @retval >0 if the timer could not be added.
+ */
+static int _applemidi_arm_sync_timer( struct MIDIDriverAppleMIDI * driver ) {
+  struct timespec ts = { APPLEMIDI_SYNC_BURST_INTERVAL / 1000, ( APPLEMIDI_SYNC_BURST_INTERVAL % 1000 ) * 1000000 };
+  if( driver->sync_timer != 0 ) return 0;
+  return MIDIRunloopSourceAddTimer( driver->base.rls, &ts, &_applemidi_sync_timeout, driver, &(driver->sync_timer) );
+}
+
 /**
  * @brief Initialize an @c fd_set with the driver's sockets and return the number
  * of descriptors in the set.
@@ -1078,15 +3015,24 @@ static int _applemidi_idle_timeout( void * drv, struct timespec * ts ) {
  * @return The number of descriptors (max ID + 1) in @ fds.
  */
 static int _applemidi_init_fds( struct MIDIDriverAppleMIDI * driver, fd_set * fds ) {
+  int nfds;
   FD_ZERO( fds );
   FD_SET( driver->control_socket, fds );
   FD_SET( driver->rtp_socket, fds );
   
   if( driver->control_socket > driver->rtp_socket ) {
-    return driver->control_socket + 1;
+    nfds = driver->control_socket + 1;
   } else {
-    return driver->rtp_socket + 1;
+    nfds = driver->rtp_socket + 1;
   }
+  if( driver->resolver != NULL ) {
+    FD_SET( driver->resolver->fds[0], fds );
+    if( driver->resolver->fds[0] >= nfds ) nfds = driver->resolver->fds[0] + 1;
+  }
+#ifdef HAVE_DNS_SD
+  nfds = _applemidi_browser_init_fds( driver, fds, nfds );
+#endif
+  return nfds;
 }
 
 /**
@@ -1154,3 +3100,306 @@ int MIDIDriverAppleMIDIGetRunloopSource( struct MIDIDriverAppleMIDI * driver, st
 }
 
 /** @} */
+
+/* MARK: Server mode *//**
+ * @name Server mode
+ * A server runs several drivers, the workers, on one port pair. Each
+ * worker has its own sockets, bound with @c SO_REUSEPORT, its own peer
+ * table and its own runloop on a thread of its own. The kernel steers
+ * every datagram to a worker by the sender's SSRC, so all invitations,
+ * clock synchronizations, receiver feedback and RTP-MIDI packets of a
+ * peer reach the same worker and are answered there. The workers share
+ * the SSRC and the invitation token, to their peers they look like a
+ * single session.
+ * @{
+ */
+
+/**
+ * @brief A driver that runs on a thread of its own.
+ */
+struct AppleMIDIWorker {
+  struct MIDIDriverAppleMIDI * driver;
+  struct MIDIRunloop * runloop;
+  pthread_t thread;
+  int running;
+};
+
+/**
+ * @ingroup MIDI-driver
+ * @brief A set of AppleMIDI drivers that share a port.
+ */
+struct MIDIDriverAppleMIDIServer {
+  int refs;
+  size_t nworkers;
+  struct AppleMIDIWorker * workers;
+};
+
+/**
+ * @cond INTERNALS
+ */
+
+/**
+ * @brief Steer datagrams to the worker that owns the sender's SSRC.
+ * The classic BPF program picks the socket with the index SSRC modulo the
+ * number of workers. The SSRC is at byte 4 of clock synchronizations and
+ * receiver feedback, at byte 12 of the other session commands and at
+ * byte 8 of RTP packets. Datagrams that are too short go to the first
+ * worker.
+ * @private @memberof MIDIDriverAppleMIDIServer
+ * @param fd       A socket of the reuse group.
+ * @param nworkers The number of sockets in the group.
+ * @retval 0 on success.
+ * @retval >0 if the program could not be attached.
+ */
+static int _applemidi_server_steer( int fd, size_t nworkers ) {
+#if defined( __linux__ ) && defined( SO_ATTACH_REUSEPORT_CBPF )
+  struct sock_filter code[] = {
+    BPF_STMT( BPF_LD  | BPF_H   | BPF_ABS, 0 ),
+    BPF_JUMP( BPF_JMP | BPF_JEQ | BPF_K, APPLEMIDI_PROTOCOL_SIGNATURE, 0, 7 ),
+    BPF_STMT( BPF_LD  | BPF_H   | BPF_ABS, 2 ),
+    BPF_JUMP( BPF_JMP | BPF_JEQ | BPF_K, APPLEMIDI_COMMAND_SYNCHRONIZATION, 3, 0 ),
+    BPF_JUMP( BPF_JMP | BPF_JEQ | BPF_K, APPLEMIDI_COMMAND_RECEIVER_FEEDBACK, 2, 0 ),
+    BPF_STMT( BPF_LD  | BPF_W   | BPF_ABS, 12 ),
+    BPF_JUMP( BPF_JMP | BPF_JA, 3, 0, 0 ),
+    BPF_STMT( BPF_LD  | BPF_W   | BPF_ABS, 4 ),
+    BPF_JUMP( BPF_JMP | BPF_JA, 1, 0, 0 ),
+    BPF_STMT( BPF_LD  | BPF_W   | BPF_ABS, 8 ),
+    BPF_STMT( BPF_ALU | BPF_MOD | BPF_K, nworkers ),
+    BPF_STMT( BPF_RET | BPF_A, 0 )
+  };
+  struct sock_fprog program = { sizeof(code) / sizeof(code[0]), &(code[0]) };
+  return setsockopt( fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program) ) ? 1 : 0;
+#else
+  return ( nworkers > 1 ) ? 1 : 0;
+#endif
+}
+
+/* stopping from a posted callback also works if the thread did not
+ * start the runloop yet */
+static int _applemidi_server_halt( void * info ) {
+  return MIDIRunloopStop( info );
+}
+
+static void * _applemidi_server_thread( void * info ) {
+  struct AppleMIDIWorker * worker = info;
+  MIDIRunloopStart( worker->runloop );
+  return NULL;
+}
+
+/**
+ * @endcond
+ */
+
+/**
+ * @brief Create a MIDIDriverAppleMIDIServer instance.
+ * Create the workers and bind their sockets to the given port pair.
+ * Where the kernel can not steer datagrams by SSRC, only a single worker
+ * is created.
+ * @public @memberof MIDIDriverAppleMIDIServer
+ * @param name    The name of the session.
+ * @param port    The control port, the RTP port is the next one.
+ * @param workers The number of workers, usually the number of cores.
+ * @return a pointer to the created server structure on success.
+ * @return a @c NULL pointer if the server could not created.
+ */
+struct MIDIDriverAppleMIDIServer * MIDIDriverAppleMIDIServerCreate( char * name, unsigned short port, size_t workers ) {
+  struct MIDIDriverAppleMIDIServer * server;
+  struct MIDIDriverAppleMIDI * driver;
+  unsigned long ssrc = 0;
+  size_t i;
+  MIDIPrecondReturn( workers > 0, EINVAL, NULL );
+
+#if !defined( __linux__ ) || !defined( SO_ATTACH_REUSEPORT_CBPF )
+  if( workers > 1 ) {
+    MIDILog( INFO, "datagrams can not be steered by SSRC, using a single worker\n" );
+    workers = 1;
+  }
+#endif
+  server = malloc( sizeof( struct MIDIDriverAppleMIDIServer ) );
+  MIDIPrecondReturn( server != NULL, ENOMEM, NULL );
+  server->refs     = 1;
+  server->nworkers = 0;
+  server->workers  = malloc( sizeof( struct AppleMIDIWorker ) * workers );
+  if( server->workers == NULL ) {
+    MIDIError( ENOMEM, "Could not allocate AppleMIDI workers." );
+    free( server );
+    return NULL;
+  }
+
+  for( i=0; i<workers; i++ ) {
+    driver = _applemidi_create( name, port, ( workers > 1 ) ? 1 : 0 );
+    if( driver == NULL ) break;
+    server->workers[i].driver  = driver;
+    server->workers[i].runloop = NULL;
+    server->workers[i].running = 0;
+    server->nworkers++;
+    if( i == 0 ) {
+      RTPSessionGetSSRC( driver->rtp_session, &ssrc );
+    } else {
+      RTPSessionSetSSRC( driver->rtp_session, ssrc );
+      driver->token = server->workers[0].driver->token;
+    }
+    if( driver->control_socket <= 0 || driver->rtp_socket <= 0 ) break;
+  }
+  if( server->nworkers < workers
+   || _applemidi_server_steer( server->workers[0].driver->control_socket, workers )
+   || _applemidi_server_steer( server->workers[0].driver->rtp_socket, workers ) ) {
+    MIDIError( errno, "Could not create AppleMIDI workers." );
+    MIDIDriverAppleMIDIServerRelease( server );
+    return NULL;
+  }
+  return server;
+}
+
+/**
+ * @brief Destroy a MIDIDriverAppleMIDIServer instance.
+ * Stop the workers and release them.
+ * @public @memberof MIDIDriverAppleMIDIServer
+ * @param server The server.
+ */
+void MIDIDriverAppleMIDIServerDestroy( struct MIDIDriverAppleMIDIServer * server ) {
+  size_t i;
+  MIDIDriverAppleMIDIServerStop( server );
+  for( i=0; i<server->nworkers; i++ ) {
+    MIDIDriverRelease( &(server->workers[i].driver->base) );
+  }
+  free( server->workers );
+  free( server );
+}
+
+/**
+ * @brief Retain a MIDIDriverAppleMIDIServer instance.
+ * @public @memberof MIDIDriverAppleMIDIServer
+ * @param server The server.
+ */
+void MIDIDriverAppleMIDIServerRetain( struct MIDIDriverAppleMIDIServer * server ) {
+  MIDIPrecondReturn( server != NULL, EFAULT, (void)0 );
+  MIDIRefRetain( server->refs );
+}
+
+/**
+ * @brief Release a MIDIDriverAppleMIDIServer instance.
+ * @public @memberof MIDIDriverAppleMIDIServer
+ * @param server The server.
+ */
+void MIDIDriverAppleMIDIServerRelease( struct MIDIDriverAppleMIDIServer * server ) {
+  MIDIPrecondReturn( server != NULL, EFAULT, (void)0 );
+  if( ! MIDIRefRelease( server->refs ) ) {
+    MIDIDriverAppleMIDIServerDestroy( server );
+  }
+}
+
+/**
+ * @brief Get the number of workers.
+ * @public @memberof MIDIDriverAppleMIDIServer
+ * @param server The server.
+ * @param count  The number of workers.
+ * @retval 0 on success.
+ */
+int MIDIDriverAppleMIDIServerGetWorkerCount( struct MIDIDriverAppleMIDIServer * server, size_t * count ) {
+  MIDIPrecond( server != NULL, EFAULT );
+  MIDIPrecond( count != NULL, EINVAL );
+  *count = server->nworkers;
+  return 0;
+}
+
+/**
+ * @brief Get a worker.
+ * Workers are configured like any other AppleMIDI driver, as long as the
+ * server is stopped. While it runs, a worker must only be touched on its
+ * own thread, for example with @ref MIDIRunloopPost. Messages that arrive
+ * at a worker are passed to the worker's port on the worker's thread.
+ * @public @memberof MIDIDriverAppleMIDIServer
+ * @param server The server.
+ * @param index  The index of the worker.
+ * @param driver The worker's driver, owned by the server.
+ * @retval 0 on success.
+ * @retval >0 if there is no such worker.
+ */
+int MIDIDriverAppleMIDIServerGetWorker( struct MIDIDriverAppleMIDIServer * server, size_t index,
+                                        struct MIDIDriverAppleMIDI ** driver ) {
+  MIDIPrecond( server != NULL, EFAULT );
+  MIDIPrecond( driver != NULL && index < server->nworkers, EINVAL );
+  *driver = server->workers[index].driver;
+  return 0;
+}
+
+/**
+ * @brief Get the worker that owns a peer.
+ * @public @memberof MIDIDriverAppleMIDIServer
+ * @param server The server.
+ * @param ssrc   The synchronization source identifier of the peer.
+ * @param index  The index of the worker.
+ * @retval 0 on success.
+ */
+int MIDIDriverAppleMIDIServerGetShard( struct MIDIDriverAppleMIDIServer * server, unsigned long ssrc, size_t * index ) {
+  MIDIPrecond( server != NULL, EFAULT );
+  MIDIPrecond( index != NULL, EINVAL );
+  *index = ( ssrc & 0xffffffff ) % server->nworkers;
+  return 0;
+}
+
+/**
+ * @brief Start the workers.
+ * Every worker gets a runloop and a thread that runs it.
+ * @public @memberof MIDIDriverAppleMIDIServer
+ * @param server The server.
+ * @retval 0 on success.
+ * @retval >0 if a worker could not be started.
+ */
+int MIDIDriverAppleMIDIServerStart( struct MIDIDriverAppleMIDIServer * server ) {
+  struct AppleMIDIWorker * worker;
+  size_t i;
+  MIDIPrecond( server != NULL, EFAULT );
+
+  for( i=0; i<server->nworkers; i++ ) {
+    worker = &(server->workers[i]);
+    if( worker->running ) continue;
+    worker->runloop = MIDIRunloopCreate();
+    if( worker->runloop == NULL ) break;
+    MIDIRunloopAddSource( worker->runloop, worker->driver->base.rls );
+    if( pthread_create( &(worker->thread), NULL, &_applemidi_server_thread, worker ) ) {
+      MIDIRunloopRemoveSource( worker->runloop, worker->driver->base.rls );
+      MIDIRunloopRelease( worker->runloop );
+      worker->runloop = NULL;
+      break;
+    }
+    worker->running = 1;
+  }
+  if( i < server->nworkers ) {
+    MIDIError( errno, "Could not start AppleMIDI worker." );
+    MIDIDriverAppleMIDIServerStop( server );
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Stop the workers.
+ * Wait until every worker's runloop has stopped. The workers keep their
+ * peers and can be started again.
+ * @public @memberof MIDIDriverAppleMIDIServer
+ * @param server The server.
+ * @retval 0 on success.
+ */
+int MIDIDriverAppleMIDIServerStop( struct MIDIDriverAppleMIDIServer * server ) {
+  struct AppleMIDIWorker * worker;
+  size_t i;
+  MIDIPrecond( server != NULL, EFAULT );
+
+  for( i=0; i<server->nworkers; i++ ) {
+    worker = &(server->workers[i]);
+    if( ! worker->running ) continue;
+    if( MIDIRunloopPost( worker->runloop, &_applemidi_server_halt, worker->runloop ) ) {
+      MIDIRunloopStop( worker->runloop );
+    }
+    pthread_join( worker->thread, NULL );
+    MIDIRunloopRemoveSource( worker->runloop, worker->driver->base.rls );
+    MIDIRunloopRelease( worker->runloop );
+    worker->runloop = NULL;
+    worker->running = 0;
+  }
+  return 0;
+}
+
+/** @} */
@@ -1,6 +1,7 @@
 #ifndef MIDIKIT_DRIVER_APPLEMIDI_H
 #define MIDIKIT_DRIVER_APPLEMIDI_H
 #include <sys/socket.h>
+#include "midi/midi.h"
 
 #ifndef MIDI_DRIVER_INTERNALS
 /**
@@ -10,8 +11,25 @@
 #define MIDIDriverAppleMIDI MIDIDriver
 #endif
 
+struct MIDIClock;
 struct MIDIMessage;
 struct MIDIDriverAppleMIDI;
+struct MIDIDriverAppleMIDIServer;
+struct MIDIMetricsWriter;
+struct MIDIRouterFilter;
+
+/**
+ * @brief Clock synchronization state of an AppleMIDI peer.
+ * The offset is the difference between the peer's clock and the driver's
+ * clock in ticks of the driver's clock, the skew is the deviation of the
+ * peer's clock rate.
+ */
+struct AppleMIDIPeerSync {
+  unsigned long count;
+  MIDITimestamp offset;
+  MIDITimestamp delay;
+  double        skew;
+};
 
 #define APPLEMIDI_PROTOCOL_SIGNATURE          0xffff
 
@@ -29,6 +47,17 @@ struct MIDIDriverAppleMIDI;
 
 struct MIDIDriverAppleMIDI * MIDIDriverAppleMIDICreate( char * name, unsigned short port );
 
+struct MIDIDriverAppleMIDIServer * MIDIDriverAppleMIDIServerCreate( char * name, unsigned short port, size_t workers );
+void MIDIDriverAppleMIDIServerRetain( struct MIDIDriverAppleMIDIServer * server );
+void MIDIDriverAppleMIDIServerRelease( struct MIDIDriverAppleMIDIServer * server );
+
+int MIDIDriverAppleMIDIServerGetWorkerCount( struct MIDIDriverAppleMIDIServer * server, size_t * count );
+int MIDIDriverAppleMIDIServerGetWorker( struct MIDIDriverAppleMIDIServer * server, size_t index,
+                                        struct MIDIDriverAppleMIDI ** driver );
+int MIDIDriverAppleMIDIServerGetShard( struct MIDIDriverAppleMIDIServer * server, unsigned long ssrc, size_t * index );
+int MIDIDriverAppleMIDIServerStart( struct MIDIDriverAppleMIDIServer * server );
+int MIDIDriverAppleMIDIServerStop( struct MIDIDriverAppleMIDIServer * server );
+
 int MIDIDriverAppleMIDISetPort( struct MIDIDriverAppleMIDI * driver, unsigned short port ); 
 int MIDIDriverAppleMIDIGetPort( struct MIDIDriverAppleMIDI * driver, unsigned short * port ); 
 
@@ -40,12 +69,30 @@ int MIDIDriverAppleMIDIAddPeerWithSockaddr( struct MIDIDriverAppleMIDI * driver,
 int MIDIDriverAppleMIDIRemovePeerWithSockaddr( struct MIDIDriverAppleMIDI * driver, socklen_t size, struct sockaddr * addr );
 int MIDIDriverAppleMIDIAddPeer( struct MIDIDriverAppleMIDI * driver, char * address, unsigned short port );
 int MIDIDriverAppleMIDIRemovePeer( struct MIDIDriverAppleMIDI * driver, char * address, unsigned short port );
+int MIDIDriverAppleMIDIGetPeerCount( struct MIDIDriverAppleMIDI * driver, size_t * count );
+
+int MIDIDriverAppleMIDIStartBrowsing( struct MIDIDriverAppleMIDI * driver );
+int MIDIDriverAppleMIDIStopBrowsing( struct MIDIDriverAppleMIDI * driver );
 
 int MIDIDriverAppleMIDISetRTPSocket( struct MIDIDriverAppleMIDI * driver, int socket );
 int MIDIDriverAppleMIDIGetRTPSocket( struct MIDIDriverAppleMIDI * driver, int * socket );
 int MIDIDriverAppleMIDISetControlSocket( struct MIDIDriverAppleMIDI * driver, int socket );
 int MIDIDriverAppleMIDIGetControlSocket( struct MIDIDriverAppleMIDI * driver, int * socket );
 
+int MIDIDriverAppleMIDISetBatchWindow( struct MIDIDriverAppleMIDI * driver, unsigned long usec );
+int MIDIDriverAppleMIDISetMaxMessagesPerPacket( struct MIDIDriverAppleMIDI * driver, size_t count );
+int MIDIDriverAppleMIDISetQueueLimit( struct MIDIDriverAppleMIDI * driver, size_t capacity, int policy );
+
+int MIDIDriverAppleMIDISetSysExRate( struct MIDIDriverAppleMIDI * driver, unsigned long rate );
+int MIDIDriverAppleMIDISetForward( struct MIDIDriverAppleMIDI * driver, struct MIDIDriverAppleMIDI * target,
+                                   struct MIDIRouterFilter * filter );
+int MIDIDriverAppleMIDISetJitterBuffer( struct MIDIDriverAppleMIDI * driver, unsigned long min_usec, unsigned long max_usec );
+int MIDIDriverAppleMIDIGetPeerLatency( struct MIDIDriverAppleMIDI * driver, unsigned long ssrc, unsigned long * usec );
+int MIDIDriverAppleMIDIGetPeerSync( struct MIDIDriverAppleMIDI * driver, unsigned long ssrc, struct AppleMIDIPeerSync * sync );
+int MIDIDriverAppleMIDIGetPeerClock( struct MIDIDriverAppleMIDI * driver, unsigned long ssrc, struct MIDIClock ** clock );
+int MIDIDriverAppleMIDISetPeerStream( struct MIDIDriverAppleMIDI * driver, unsigned long ssrc, int fd );
+int MIDIDriverAppleMIDICollectMetrics( void * driver, struct MIDIMetricsWriter * writer );
+
 /*
 int MIDIDriverAppleMIDIReceiveMessage( struct MIDIDriverAppleMIDI * driver, struct MIDIMessage * message );
 int MIDIDriverAppleMIDISendMessage( struct MIDIDriverAppleMIDI * driver, struct MIDIMessage * message );
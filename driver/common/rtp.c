@@ -1,17 +1,85 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE /* recvmmsg, sendmmsg */
+#endif
 #include "rtp.h"
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <sys/time.h>
 #include <arpa/inet.h>
-
-#ifndef NO_LOG
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include "midi/midi.h"
-#endif
 
+/**
+ * @brief Initial number of peer slots in a session.
+ * The peer list grows as needed, define this at compile time to
+ * reserve space for more peers up front.
+ */
+#ifndef RTP_MAX_PEERS
 #define RTP_MAX_PEERS 16
-#define RTP_BUF_LEN   512
+#endif
+
+/**
+ * @brief Number of packets RTPSessionSendPackets submits at once.
+ */
+#define RTP_SEND_CHUNK 16
+
+/**
+ * @brief Size of a receive buffer.
+ * The largest UDP payload that fits an ethernet frame, packets that fill
+ * the MTU must not be truncated.
+ */
+#define RTP_BUF_LEN   1472
 #define RTP_IOV_LEN   16
 
+/**
+ * @brief Number of packet buffers in the receive ring.
+ * This is the maximum number of packets RTPSessionReceivePackets can
+ * drain from the socket in one call.
+ */
+#define RTP_RECV_RING_LEN 32
+
+/**
+ * @brief Number of bytes reserved per packet for headers when sending
+ * to many peers at once.
+ * Enough for the fixed header, 15 CSRCs, a small extension and padding.
+ */
+#define RTP_HEADER_ARENA_SLOT 128
+
+#if defined(__linux__) && defined(MSG_WAITFORONE)
+#define RTP_HAVE_RECVMMSG
+#define RTP_HAVE_SENDMMSG
+#endif
+
+/**
+ * @brief Number of bytes reserved per packet for the receive timestamp.
+ */
+#define RTP_CONTROL_LEN 64
+
+/**
+ * @brief Number of bytes a stream keeps back before they have to be written.
+ * Framed packets are collected up to this size and written once per runloop
+ * turn with @c RTPSessionFlushStreams.
+ */
+#define RTP_STREAM_COALESCE 4096
+
+/**
+ * @brief Maximum number of bytes a stream may hold while the connection is
+ * congested. Packets that do not fit are dropped.
+ */
+#define RTP_STREAM_MAX_PENDING 65536
+
+/**
+ * @brief Maximum size of an RFC 4571 frame, including the length prefix.
+ */
+#define RTP_STREAM_FRAME_LEN ( 2 + 65535 )
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
 #define USEC_PER_SEC 1000000
 
 struct RTPAddress {
@@ -27,21 +95,75 @@ struct RTPPeer {
   unsigned long out_timestamp;
   unsigned long in_seqnum;
   unsigned long out_seqnum;
+  unsigned long in_packets;
+  unsigned long in_lost;
+  unsigned long in_highest;
+  struct RTPStream * stream;
   void * info;
 };
 
+/**
+ * Connection oriented transport of a peer.
+ * Packets are framed as described in RFC 4571, every packet is preceded
+ * by its length as a 16 bit unsigned integer in network byte order.
+ */
+struct RTPStream {
+  int fd;
+  unsigned char * out;
+  size_t out_length;
+  size_t out_size;
+  size_t in_length;
+  size_t in_offset;
+  struct iovec in_iov[RTP_RECV_RING_LEN][2];
+  unsigned char in[RTP_STREAM_FRAME_LEN];
+};
+
+/**
+ * Buffer for the control messages of a received packet.
+ */
+union RTPControlBuffer {
+  struct cmsghdr header;
+  unsigned char bytes[RTP_CONTROL_LEN];
+};
+
+/**
+ * Buffer for one packet received by RTPSessionReceivePackets.
+ */
+struct RTPPacketBuffer {
+  struct sockaddr_storage name;
+  struct iovec iov[2];
+  unsigned char data[RTP_BUF_LEN];
+  union RTPControlBuffer control;
+};
+
 struct RTPSession {
   size_t refs;
   
   int socket;
   
   struct RTPAddress self;
-  struct RTPPeer *  peers[RTP_MAX_PEERS];
+  size_t npeers;
+  size_t peers_size;
+  struct RTPPeer ** peers;
+  size_t index_mask;
+  size_t * by_ssrc;
+  size_t * by_address;
   struct RTPPacketInfo info;
+  struct RTPPeer * group;
   
   struct iovec iov[RTP_IOV_LEN];
   size_t buflen;
   void * buffer;
+
+  size_t recv_next;
+  struct RTPPacketBuffer * recv_ring;
+
+  unsigned char * header_arena;
+
+  RTPForeignHandlerFn * foreign;
+  void * foreign_info;
+
+  int timestamping;
 };
 
 /**
@@ -292,6 +414,10 @@ struct RTPPeer * RTPPeerCreate( unsigned long ssrc, socklen_t size, struct socka
   peer->in_timestamp   = 0;
   peer->out_seqnum     = 0;
   peer->out_timestamp  = 0;
+  peer->in_packets     = 0;
+  peer->in_lost        = 0;
+  peer->in_highest     = 0;
+  peer->stream = NULL;
   peer->info = NULL;
   return peer;
 }
@@ -303,6 +429,7 @@ struct RTPPeer * RTPPeerCreate( unsigned long ssrc, socklen_t size, struct socka
  * @param peer The peer.
  */
 void RTPPeerDestroy( struct RTPPeer * peer ) {
+  RTPPeerSetStream( peer, -1 );
   free( peer );
 }
 
@@ -313,7 +440,7 @@ void RTPPeerDestroy( struct RTPPeer * peer ) {
  * @param peer The peer.
  */
 void RTPPeerRetain( struct RTPPeer * peer ) {
-  peer->refs++;
+  MIDIRefRetain( peer->refs );
 }
 
 /**
@@ -324,7 +451,7 @@ void RTPPeerRetain( struct RTPPeer * peer ) {
  * @param peer The peer.
  */
 void RTPPeerRelease( struct RTPPeer * peer ) {
-  if( ! --peer->refs ) {
+  if( ! MIDIRefRelease( peer->refs ) ) {
     RTPPeerDestroy( peer );
   }
 }
@@ -386,6 +513,133 @@ int RTPPeerGetInfo( struct RTPPeer * peer, void ** info ) {
   return 0;
 }
 
+/**
+ * @brief Get the reception statistics of a peer.
+ * A gap in the sequence numbers counts the missing packets as lost, a
+ * packet that arrives late takes its count back.
+ * @public @memberof RTPPeer
+ * @param peer     The peer.
+ * @param received The number of packets received from the peer.
+ * @param lost     The number of packets that did not arrive.
+ * @retval 0 on success.
+ */
+int RTPPeerGetReceptionStats( struct RTPPeer * peer, unsigned long * received, unsigned long * lost ) {
+  MIDIPrecond( peer != NULL, EFAULT );
+  MIDIPrecond( received != NULL && lost != NULL, EINVAL );
+  *received = peer->in_packets;
+  *lost     = peer->in_lost;
+  return 0;
+}
+
+/**
+ * @brief Send and receive the packets of a peer over a stream socket.
+ * Packets to and from the peer are framed as described in RFC 4571 and
+ * exchanged over the connected socket @c fd instead of the session's
+ * datagram socket. The peer takes ownership of the socket on success and closes it
+ * when the stream is replaced or the peer is destroyed. The socket is made
+ * non-blocking and Nagle's algorithm is disabled, small packets are
+ * coalesced by the session instead, see @ref RTPSessionFlushStreams.
+ * @public @memberof RTPPeer
+ * @param peer The peer.
+ * @param fd   The connected socket or -1 to go back to datagrams.
+ * @retval 0 on success.
+ * @retval >0 if the stream could not be set.
+ */
+int RTPPeerSetStream( struct RTPPeer * peer, int fd ) {
+  struct RTPStream * stream;
+  int flags, error, on = 1;
+  MIDIPrecond( peer != NULL, EFAULT );
+
+  if( peer->stream != NULL ) {
+    if( peer->stream->fd == fd ) return 0;
+    close( peer->stream->fd );
+    free( peer->stream->out );
+    free( peer->stream );
+    peer->stream = NULL;
+  }
+  if( fd < 0 ) return 0;
+
+  flags = fcntl( fd, F_GETFL, 0 );
+  if( flags == -1 || fcntl( fd, F_SETFL, flags | O_NONBLOCK ) == -1 ) {
+    error = errno;
+    MIDIError( error, "Could not make stream socket non-blocking." );
+    return error;
+  }
+  /* fails for anything but TCP, where it does not matter */
+  setsockopt( fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on) );
+#if defined( SO_NOSIGPIPE )
+  setsockopt( fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on) );
+#endif
+
+  stream = malloc( sizeof( struct RTPStream ) );
+  if( stream != NULL ) stream->out = malloc( RTP_STREAM_COALESCE );
+  if( stream == NULL || stream->out == NULL ) {
+    free( stream );
+    MIDIError( ENOMEM, "Could not allocate stream buffer." );
+    return ENOMEM;
+  }
+  stream->fd         = fd;
+  stream->out_length = 0;
+  stream->out_size   = RTP_STREAM_COALESCE;
+  stream->in_length  = 0;
+  stream->in_offset  = 0;
+  peer->stream = stream;
+  return 0;
+}
+
+/**
+ * @brief Get the stream socket of a peer.
+ * @public @memberof RTPPeer
+ * @param peer The peer.
+ * @param fd   The socket or -1 if the peer uses datagrams.
+ * @retval 0 on success.
+ */
+int RTPPeerGetStream( struct RTPPeer * peer, int * fd ) {
+  MIDIPrecond( peer != NULL, EFAULT );
+  MIDIPrecond( fd != NULL, EINVAL );
+  *fd = ( peer->stream != NULL ) ? peer->stream->fd : -1;
+  return 0;
+}
+
+/**
+ * @brief Get the number of bytes that wait to be written to a peer's stream.
+ * @public @memberof RTPPeer
+ * @param peer  The peer.
+ * @param bytes The number of bytes.
+ * @retval 0 on success.
+ */
+int RTPPeerGetStreamPending( struct RTPPeer * peer, size_t * bytes ) {
+  MIDIPrecond( peer != NULL, EFAULT );
+  MIDIPrecond( bytes != NULL, EINVAL );
+  *bytes = ( peer->stream != NULL ) ? peer->stream->out_length : 0;
+  return 0;
+}
+
+/**
+ * @brief Write as much of the coalesced bytes of a peer's stream as the
+ * socket takes without blocking.
+ * @public @memberof RTPPeer
+ * @param peer The peer.
+ * @retval 0 on success, even if bytes are left.
+ * @retval >0 if the connection failed.
+ */
+int RTPPeerFlushStream( struct RTPPeer * peer ) {
+  struct RTPStream * stream;
+  ssize_t bytes_sent;
+  MIDIPrecond( peer != NULL, EFAULT );
+  stream = peer->stream;
+  if( stream == NULL || stream->out_length == 0 ) return 0;
+
+  bytes_sent = send( stream->fd, stream->out, stream->out_length, MSG_NOSIGNAL );
+  if( bytes_sent < 0 ) {
+    if( errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ) return 0;
+    return errno;
+  }
+  stream->out_length -= bytes_sent;
+  memmove( stream->out, stream->out + bytes_sent, stream->out_length );
+  return 0;
+}
+
 /* MARK: Creation and destruction *//**
  * @name Creation and destruction
  * Creating, destroying and reference counting of RTPSession objects.
@@ -423,6 +677,130 @@ static void _session_randomize_ssrc( struct RTPSession * session ) {
   session->self.ssrc = random();
 }
 
+/**
+ * @brief Hash a socket address.
+ * Use FNV-1a over the bytes of the address, like the comparison in
+ * RTPSessionFindPeerByAddress does.
+ * @private @memberof RTPSession
+ * @param size The length of the address.
+ * @param addr The address.
+ * @return the hash value.
+ */
+static size_t _session_hash_address( socklen_t size, struct sockaddr * addr ) {
+  const unsigned char * bytes = (const unsigned char *) addr;
+  unsigned long hash = 2166136261UL;
+  socklen_t i;
+  for( i=0; i<size; i++ ) {
+    hash = ( hash ^ bytes[i] ) * 16777619UL;
+  }
+  return hash;
+}
+
+/**
+ * @brief Hash a synchronization source identifier.
+ * SSRCs are random, but mix the bits anyway so that peers with
+ * sequential SSRCs do not cluster.
+ * @private @memberof RTPSession
+ * @param ssrc The SSRC.
+ * @return the hash value.
+ */
+static size_t _session_hash_ssrc( unsigned long ssrc ) {
+  return ( ssrc & 0xffffffffUL ) * 2654435761UL;
+}
+
+/**
+ * @brief Insert a peer into one of the session's indices.
+ * The indices are open addressing hash tables with linear probing. Every
+ * slot holds the position of a peer in the peer list plus one, zero marks
+ * an empty slot.
+ * @private @memberof RTPSession
+ * @param session The session.
+ * @param index   The index to insert into.
+ * @param hash    The hash value of the peer's key.
+ * @param i       The position of the peer in the peer list.
+ */
+static void _session_index_insert( struct RTPSession * session, size_t * index, size_t hash, size_t i ) {
+  size_t slot = hash & session->index_mask;
+  while( index[slot] != 0 ) {
+    slot = ( slot + 1 ) & session->index_mask;
+  }
+  index[slot] = i + 1;
+}
+
+/**
+ * @brief Rebuild the session's indices.
+ * Called when the peer list grows and after a peer was removed. The
+ * indices are kept at most half full.
+ * @private @memberof RTPSession
+ * @param session The session.
+ * @param size    The number of slots, a power of two.
+ * @retval 0 on success.
+ * @retval >0 if the indices could not be allocated.
+ */
+static int _session_index_rebuild( struct RTPSession * session, size_t size ) {
+  size_t i, * by_ssrc, * by_address;
+  struct RTPPeer * peer;
+
+  if( size - 1 != session->index_mask ) {
+    by_ssrc    = calloc( size, sizeof(size_t) );
+    by_address = calloc( size, sizeof(size_t) );
+    if( by_ssrc == NULL || by_address == NULL ) {
+      free( by_ssrc );
+      free( by_address );
+      return 1;
+    }
+    free( session->by_ssrc );
+    free( session->by_address );
+    session->by_ssrc    = by_ssrc;
+    session->by_address = by_address;
+    session->index_mask = size - 1;
+  } else {
+    memset( session->by_ssrc, 0, size * sizeof(size_t) );
+    memset( session->by_address, 0, size * sizeof(size_t) );
+  }
+  for( i=0; i<session->npeers; i++ ) {
+    peer = session->peers[i];
+    _session_index_insert( session, session->by_ssrc, _session_hash_ssrc( peer->address.ssrc ), i );
+    _session_index_insert( session, session->by_address,
+      _session_hash_address( peer->address.size, (struct sockaddr *) &(peer->address.addr) ), i );
+  }
+  return 0;
+}
+
+/**
+ * @brief Get the number of index slots for a number of peers.
+ * @private @memberof RTPSession
+ * @param n The number of peers.
+ * @return the smallest power of two that is at least twice @c n.
+ */
+static size_t _session_index_size( size_t n ) {
+  size_t size = 1;
+  while( size < 2*n ) size *= 2;
+  return size;
+}
+
+/**
+ * @brief Find the position of a peer in the peer list.
+ * @private @memberof RTPSession
+ * @param session The session.
+ * @param peer    The peer.
+ * @param i       The position of the peer.
+ * @retval 0 on success.
+ * @retval >0 if the peer is not part of the session.
+ */
+static int _session_peer_position( struct RTPSession * session, struct RTPPeer * peer, size_t * i ) {
+  size_t slot = _session_hash_ssrc( peer->address.ssrc ) & session->index_mask;
+  if( session->by_ssrc == NULL ) return 1;
+  while( session->by_ssrc[slot] != 0 ) {
+    if( session->peers[session->by_ssrc[slot]-1] == peer ) {
+      *i = session->by_ssrc[slot] - 1;
+      return 0;
+    }
+    slot = ( slot + 1 ) & session->index_mask;
+  }
+  return 1;
+}
+
 /**
  * @brief Create an RTPSession instance.
  * Allocate space and initialize an RTPSession instance.
@@ -438,11 +816,19 @@ struct RTPSession * RTPSessionCreate( int socket ) {
   session->socket = socket;
 
   _init_addr_with_socket( &(session->self), socket );
-  for( i=0; i<RTP_MAX_PEERS; i++ ) {
-    session->peers[i] = NULL;
+  session->npeers     = 0;
+  session->peers_size = RTP_MAX_PEERS;
+  session->peers      = malloc( session->peers_size * sizeof(struct RTPPeer *) );
+  session->index_mask = 0;
+  session->by_ssrc    = NULL;
+  session->by_address = NULL;
+  session->group      = NULL;
+  if( session->peers == NULL || _session_index_rebuild( session, _session_index_size( RTP_MAX_PEERS ) ) ) {
+    free( session->peers );
+    free( session );
+    return NULL;
   }
   
-  
   session->buflen = RTP_BUF_LEN;
   session->buffer = malloc( session->buflen );
   if( session->buffer == NULL ) {
@@ -455,6 +841,17 @@ struct RTPSession * RTPSessionCreate( int socket ) {
     session->iov[i].iov_len  = 0;
   }
 
+  /* allocated on the first call to RTPSessionReceivePackets */
+  session->recv_next = 0;
+  session->recv_ring = NULL;
+
+  /* allocated on the first call to RTPSessionSendPackets */
+  session->header_arena = NULL;
+
+  session->foreign      = NULL;
+  session->foreign_info = NULL;
+  session->timestamping = 0;
+
   _session_randomize_ssrc( session );
   
   session->info.peer         = NULL;
@@ -477,11 +874,21 @@ struct RTPSession * RTPSessionCreate( int socket ) {
  * @param session The session.
  */
 void RTPSessionDestroy( struct RTPSession * session ) {
-  int i;
-  for( i=0; i<RTP_MAX_PEERS; i++ ) {
-    if( session->peers[i] != NULL ) {
-      RTPPeerRelease( session->peers[i] );
-    }
+  size_t i;
+  for( i=0; i<session->npeers; i++ ) {
+    RTPPeerRelease( session->peers[i] );
+  }
+  free( session->peers );
+  free( session->by_ssrc );
+  free( session->by_address );
+  if( session->group != NULL ) {
+    RTPPeerRelease( session->group );
+  }
+  if( session->recv_ring != NULL ) {
+    free( session->recv_ring );
+  }
+  if( session->header_arena != NULL ) {
+    free( session->header_arena );
   }
   free( session->buffer );
   free( session );
@@ -494,7 +901,7 @@ void RTPSessionDestroy( struct RTPSession * session ) {
  * @param session The session.
  */
 void RTPSessionRetain( struct RTPSession * session ) {
-  session->refs++;
+  MIDIRefRetain( session->refs );
 }
 
 /**
@@ -505,7 +912,7 @@ void RTPSessionRetain( struct RTPSession * session ) {
  * @param session The session.
  */
 void RTPSessionRelease( struct RTPSession * session ) {
-  if( ! --session->refs ) {
+  if( ! MIDIRefRelease( session->refs ) ) {
     RTPSessionDestroy( session );
   }
 }
@@ -547,6 +954,10 @@ int RTPSessionGetSSRC( struct RTPSession * session, unsigned long * ssrc ) {
 int RTPSessionSetSocket( struct RTPSession * session, int socket ) {
   if( socket == session->socket ) return 0;
   session->socket = socket;
+  if( session->timestamping ) {
+    session->timestamping = 0;
+    return RTPSessionSetTimestamping( session, 1 );
+  }
   return 0;
 }
 
@@ -563,9 +974,54 @@ int RTPSessionGetSocket( struct RTPSession * session, int * socket ) {
   return 0;
 }
 
+/**
+ * @brief Let the kernel timestamp received packets.
+ * When enabled, the @c arrival member of received packet infos is set to
+ * the time the packet arrived at the socket, measured with the system's
+ * real time clock. Otherwise, or where the platform does not timestamp
+ * packets, it is zero.
+ * @public @memberof RTPSession
+ * @param session The session.
+ * @param enabled Whether packets should be timestamped.
+ * @retval 0 on success.
+ * @retval >0 if the socket option could not be set.
+ */
+int RTPSessionSetTimestamping( struct RTPSession * session, int enabled ) {
+  int on = enabled ? 1 : 0;
+  if( session->timestamping == on ) return 0;
+#if defined( SO_TIMESTAMPNS )
+  if( setsockopt( session->socket, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on) ) ) return 1;
+#elif defined( SO_TIMESTAMP )
+  if( setsockopt( session->socket, SOL_SOCKET, SO_TIMESTAMP, &on, sizeof(on) ) ) return 1;
+#else
+  if( on ) return 1;
+#endif
+  session->timestamping = on;
+  return 0;
+}
+
+/**
+ * @brief Set the handler for datagrams that are not RTP packets.
+ * When other protocols share the session's socket, a batch of received
+ * packets may contain their datagrams as well. Those are passed to the
+ * handler while the batch is decoded, instead of being dropped like
+ * corrupted packets. The data is only valid during the call.
+ * @public @memberof RTPSession
+ * @param session The session.
+ * @param handler The handler or @c NULL to drop foreign datagrams.
+ * @param info    A pointer that is passed to the handler.
+ * @retval 0 on success.
+ */
+int RTPSessionSetForeignHandler( struct RTPSession * session, RTPForeignHandlerFn * handler, void * info ) {
+  session->foreign      = handler;
+  session->foreign_info = info;
+  return 0;
+}
+
 /**
  * @brief Add an RTPPeer to the session.
- * Lookup the peer using the (pseudo) hash-table, add it to the list and retain it.
+ * Append the peer to the list, index it by SSRC and by address and retain it.
+ * The list grows as needed.
  * The peer will be included when data is sent via RTPSessionSendPayload.
  * @public @memberof RTPSession
  * @param session The session.
@@ -574,22 +1030,34 @@ int RTPSessionGetSocket( struct RTPSession * session, int * socket ) {
  * @retval >0 if the peer could not be added.
  */
 int RTPSessionAddPeer( struct RTPSession * session, struct RTPPeer * peer ) {
-  int i, off, p;
-  off = peer->address.ssrc % RTP_MAX_PEERS;
-  for( i=0; i < RTP_MAX_PEERS; i++ ) {
-    p = (i+off)%RTP_MAX_PEERS;
-    if( session->peers[p] == NULL ) {
-      session->peers[p] = peer;
-      RTPPeerRetain( peer );
-      return 0;
+  struct RTPPeer ** peers;
+  size_t i = session->npeers;
+  if( i == session->peers_size ) {
+    peers = realloc( session->peers, 2 * session->peers_size * sizeof(struct RTPPeer *) );
+    if( peers == NULL ) return 1;
+    session->peers       = peers;
+    session->peers_size *= 2;
+  }
+  session->peers[i] = peer;
+  session->npeers++;
+  if( 2 * session->npeers > session->index_mask + 1 ) {
+    if( _session_index_rebuild( session, 2 * ( session->index_mask + 1 ) ) ) {
+      session->npeers--;
+      return 1;
     }
+  } else {
+    _session_index_insert( session, session->by_ssrc, _session_hash_ssrc( peer->address.ssrc ), i );
+    _session_index_insert( session, session->by_address,
+      _session_hash_address( peer->address.size, (struct sockaddr *) &(peer->address.addr) ), i );
   }
-  return 1;
+  RTPPeerRetain( peer );
+  return 0;
 }
 
 /**
  * @brief Remove an RTPPeer from the session.
- * Lookup the peer using the (pseudo) hash-table, remove it from the list and release it.
+ * Lookup the peer using the SSRC index, remove it from the list and release it.
+ * The last peer of the list takes its place.
  * @public @memberof RTPSession
  * @param session The session.
  * @param peer The peer to remove.
@@ -597,17 +1065,12 @@ int RTPSessionAddPeer( struct RTPSession * session, struct RTPPeer * peer ) {
  * @retval >0 if the peer could not be removed.
  */
 int RTPSessionRemovePeer( struct RTPSession * session, struct RTPPeer * peer ) {
-  int i, off, p;
-  off = peer->address.ssrc % RTP_MAX_PEERS;
-  for( i=0; i < RTP_MAX_PEERS; i++ ) {
-    p = (i+off)%RTP_MAX_PEERS;
-    if( session->peers[p] == peer ) {
-      session->peers[p] = NULL;
-      RTPPeerRelease( peer );
-      return 0;
-    }
-  }
-  return 1;
+  size_t i;
+  if( _session_peer_position( session, peer, &i ) ) return 1;
+  session->peers[i] = session->peers[--session->npeers];
+  _session_index_rebuild( session, session->index_mask + 1 );
+  RTPPeerRelease( peer );
+  return 0;
 }
 
 /**
@@ -621,27 +1084,15 @@ int RTPSessionRemovePeer( struct RTPSession * session, struct RTPPeer * peer ) {
  * @retval >0 if the given peer does not exist.
  */
 int RTPSessionNextPeer( struct RTPSession * session, struct RTPPeer ** peer ) {
-  int i;
+  size_t i;
   if( peer == NULL ) return 1;
   if( *peer == NULL ) {
-    i=-1;
+    i = 0;
   } else {
-    for( i=0; i < RTP_MAX_PEERS; i++ ) {
-      if( session->peers[i] == *peer ) {
-        break;
-      }
-    }
-    if( i == RTP_MAX_PEERS ) return 1;
-  }
-
-  do {
-     i++;
-  } while( i < RTP_MAX_PEERS && session->peers[i] == NULL );
-  if( i == RTP_MAX_PEERS ) {
-    *peer = NULL;
-  } else {
-    *peer = session->peers[i];
+    if( _session_peer_position( session, *peer, &i ) ) return 1;
+    i++;
   }
+  *peer = ( i < session->npeers ) ? session->peers[i] : NULL;
   return 0;
 }
 
@@ -656,16 +1107,15 @@ int RTPSessionNextPeer( struct RTPSession * session, struct RTPPeer ** peer ) {
  */
 int RTPSessionFindPeerBySSRC( struct RTPSession * session, struct RTPPeer ** peer,
                               unsigned long ssrc ) {
-  int i, off, p;
-  off = ssrc % RTP_MAX_PEERS;
-  for( i=0; i < RTP_MAX_PEERS; i++ ) {
-    p = (i+off)%RTP_MAX_PEERS;
-    if( session->peers[p] != NULL ) {
-      if( session->peers[p]->address.ssrc == ssrc ) {
-        *peer = session->peers[p];
-        return 0;
-      }
+  size_t slot = _session_hash_ssrc( ssrc ) & session->index_mask;
+  struct RTPPeer * p;
+  while( session->by_ssrc[slot] != 0 ) {
+    p = session->peers[session->by_ssrc[slot]-1];
+    if( p->address.ssrc == ssrc ) {
+      *peer = p;
+      return 0;
     }
+    slot = ( slot + 1 ) & session->index_mask;
   }
   return 1;
 }
@@ -682,21 +1132,100 @@ int RTPSessionFindPeerBySSRC( struct RTPSession * session, struct RTPPeer ** pee
  */
 int RTPSessionFindPeerByAddress( struct RTPSession * session, struct RTPPeer ** peer,
                                  socklen_t size, struct sockaddr * addr ) {
-  int i;
-  socklen_t s;
-  struct sockaddr * a;
-  for( i=0; i < RTP_MAX_PEERS; i++ ) {
-    if( session->peers[i] != NULL ) {
-      RTPPeerGetAddress( session->peers[i], &s, &a );
-      if( s == size && memcmp( a, addr, s ) == 0 ) {
-        *peer = session->peers[i];
-        return 0;
-      }
+  size_t slot = _session_hash_address( size, addr ) & session->index_mask;
+  struct RTPPeer * p;
+  while( session->by_address[slot] != 0 ) {
+    p = session->peers[session->by_address[slot]-1];
+    if( p->address.size == size && memcmp( &(p->address.addr), addr, size ) == 0 ) {
+      *peer = p;
+      return 0;
     }
+    slot = ( slot + 1 ) & session->index_mask;
+  }
+  return 1;
+}
+
+/**
+ * @brief Send to a multicast group instead of the single peers.
+ * The group is a peer with the address of the group that is not part
+ * of the session's peer list. Payload layers that support multicast
+ * send one packet to the group instead of one packet per peer, the
+ * peers of the session are the group's receivers.
+ * While a group is set, packets to the group advance the group's
+ * sequence numbers and packets to single peers repeat the sequence
+ * number of the last packet sent to the group, so that every receiver
+ * sees a single sequence of packets from this session.
+ * @public @memberof RTPSession
+ * @param session The session.
+ * @param group   The group or @c NULL to send to the single peers.
+ * @retval 0 on success.
+ */
+int RTPSessionSetMulticastGroup( struct RTPSession * session, struct RTPPeer * group ) {
+  if( group != NULL ) RTPPeerRetain( group );
+  if( session->group != NULL ) RTPPeerRelease( session->group );
+  session->group = group;
+  return 0;
+}
+
+/**
+ * @brief Get the multicast group the session sends to.
+ * @public @memberof RTPSession
+ * @param session The session.
+ * @param group   The group or @c NULL if the session sends to the single peers.
+ * @retval 0 on success.
+ * @retval >0 if the group could not be stored.
+ */
+int RTPSessionGetMulticastGroup( struct RTPSession * session, struct RTPPeer ** group ) {
+  if( group == NULL ) return 1;
+  *group = session->group;
+  return 0;
+}
+
+static int _rtp_membership( struct RTPSession * session, socklen_t size, struct sockaddr * addr, int join ) {
+  struct ip_mreq mreq;
+  struct ipv6_mreq mreq6;
+  if( addr == NULL ) return 1;
+  if( addr->sa_family == AF_INET && size >= sizeof(struct sockaddr_in) ) {
+    mreq.imr_multiaddr        = ((struct sockaddr_in *) addr)->sin_addr;
+    mreq.imr_interface.s_addr = htonl( INADDR_ANY );
+    return setsockopt( session->socket, IPPROTO_IP, join ? IP_ADD_MEMBERSHIP : IP_DROP_MEMBERSHIP,
+                       &mreq, sizeof(mreq) ) ? 1 : 0;
+  } else if( addr->sa_family == AF_INET6 && size >= sizeof(struct sockaddr_in6) ) {
+    mreq6.ipv6mr_multiaddr = ((struct sockaddr_in6 *) addr)->sin6_addr;
+    mreq6.ipv6mr_interface = 0;
+    return setsockopt( session->socket, IPPROTO_IPV6, join ? IPV6_JOIN_GROUP : IPV6_LEAVE_GROUP,
+                       &mreq6, sizeof(mreq6) ) ? 1 : 0;
   }
   return 1;
 }
 
+/**
+ * @brief Receive the packets sent to a multicast group.
+ * Join the group on the session's socket, on the default interface.
+ * @public @memberof RTPSession
+ * @param session The session.
+ * @param size    The length of the structure pointed to by @c addr.
+ * @param addr    The address of the group.
+ * @retval 0 on success.
+ * @retval >0 if the group could not be joined.
+ */
+int RTPSessionJoinMulticastGroup( struct RTPSession * session, socklen_t size, struct sockaddr * addr ) {
+  return _rtp_membership( session, size, addr, 1 );
+}
+
+/**
+ * @brief Stop receiving the packets sent to a multicast group.
+ * @public @memberof RTPSession
+ * @param session The session.
+ * @param size    The length of the structure pointed to by @c addr.
+ * @param addr    The address of the group.
+ * @retval 0 on success.
+ * @retval >0 if the group could not be left.
+ */
+int RTPSessionLeaveMulticastGroup( struct RTPSession * session, socklen_t size, struct sockaddr * addr ) {
+  return _rtp_membership( session, size, addr, 0 );
+}
+
 static int _rtp_encode_header( struct RTPPacketInfo * info, size_t size, void * data, size_t * written ) {
   int i, j;
   unsigned char * buffer = data;
@@ -791,6 +1320,7 @@ static int _rtp_encode_extension( struct RTPPacketInfo * info, size_t size, void
       /* fill up to whole 4 bytes words */
       ext_header_size += 4 - (info->iov[0].iov_len % 4);
     }
+    if( size < ext_header_size ) return 1;
 
     memcpy( buffer, info->iov[0].iov_base, info->iov[0].iov_len );
     i = ext_header_size / 4;
@@ -845,77 +1375,232 @@ static void _append_iov( size_t * iovlen, struct iovec * iov, size_t size, void
   *iovlen += 1;
 }
 
+#ifndef NO_LOG
 /**
- * @brief Send an RTP packet.
- * @public @memberof RTPSession
- * @param session The session.
- * @param info The packet info.
- * @retval 0 On success.
- * @retval >0 If the message could not be sent.
+ * Log the iovecs of a packet with a hex dump of up to 16 bytes per line
+ * instead of one log call per byte.
  */
-int RTPSessionSendPacket( struct RTPSession * session, struct RTPPacketInfo * info ) {
-  size_t size, written = 0, iovlen = 0;
-  void * buffer;
-  struct msghdr msg;
-  struct iovec  iov[RTP_IOV_LEN+3];
-  ssize_t bytes_sent;
-  
+static void _log_iov( size_t iovlen, struct iovec * iov ) {
+  static const char hex[] = "0123456789abcdef";
+  char line[16*5];
+  unsigned char * c;
+  size_t i, j, n;
+  for( i=0; i<iovlen; i++ ) {
+    MIDILog( DEBUG, "[%i] iov_len: %i, iov_base: %p\n", (int) i, (int) iov[i].iov_len, iov[i].iov_base );
+    c = iov[i].iov_base;
+    for( j=0, n=0; j<iov[i].iov_len; j++ ) {
+      line[n++] = '0';
+      line[n++] = 'x';
+      line[n++] = hex[c[j] >> 4];
+      line[n++] = hex[c[j] & 0xf];
+      line[n++] = ' ';
+      if( (j+1) % 16 == 0 || j+1 == iov[i].iov_len ) {
+        line[n-1] = '\0';
+        MIDILog( DEBUG, "%s\n", line );
+        n = 0;
+      }
+    }
+  }
+}
+#endif
+
+/**
+ * Encode the header, extension and padding of a packet into @c buffer and
+ * collect them together with the payload in @c iov. Stores the number of
+ * used iovecs in @c iovlen and the number of used bytes in @c used.
+ */
+static int _rtp_encode_packet( struct RTPSession * session, struct RTPPacketInfo * info,
+                               size_t size, void * buffer, size_t * iovlen, struct iovec * iov,
+                               size_t * used ) {
+  size_t written = 0;
+  void * start = buffer;
+
   if( info == NULL || info->peer == NULL ) return 1;
   if( info->iovlen > RTP_IOV_LEN ) return 1;
-  
-  size   = session->buflen;
-  buffer = session->buffer;
 
   info->ssrc            = session->self.ssrc;
-  info->sequence_number = info->peer->out_seqnum + 1;
+  if( session->group != NULL && info->peer != session->group ) {
+    info->sequence_number = session->group->out_seqnum;
+  } else {
+    info->sequence_number = info->peer->out_seqnum + 1;
+  }
 
+  *iovlen = 0;
   info->total_size = 0;
-  _rtp_encode_header( info, size, buffer, &written );
-  _append_iov( &iovlen, &(iov[0]), written, buffer );
+  if( _rtp_encode_header( info, size, buffer, &written ) ) return 1;
+  _append_iov( iovlen, iov, written, buffer );
   _advance_buffer( &size, &buffer, written );
   info->total_size += written;
   if( info->extension ) {
-    _rtp_encode_extension( info, size, &buffer, &written );
-    _append_iov( &iovlen, &(iov[0]), written, buffer );
+    if( _rtp_encode_extension( info, size, buffer, &written ) ) return 1;
+    _append_iov( iovlen, iov, written, buffer );
     _advance_buffer( &size, &buffer, written );
     info->total_size += written;
   }
   info->payload_size = 0;
-  while( (iovlen-1)<info->iovlen ) {
-    info->payload_size += info->iov[iovlen-1].iov_len;
-    _append_iov( &iovlen, &(iov[0]), info->iov[iovlen-1].iov_len, info->iov[iovlen-1].iov_base );
+  while( (*iovlen-1)<info->iovlen ) {
+    info->payload_size += info->iov[*iovlen-1].iov_len;
+    _append_iov( iovlen, iov, info->iov[*iovlen-1].iov_len, info->iov[*iovlen-1].iov_base );
   }
   info->total_size += info->payload_size;
   if( info->padding ) {
-    _rtp_encode_padding( info, size, &buffer, &written );
-    _append_iov( &iovlen, &(iov[0]), written, buffer );
+    if( _rtp_encode_padding( info, size, buffer, &written ) ) return 1;
+    _append_iov( iovlen, iov, written, buffer );
     _advance_buffer( &size, &buffer, written );
     info->total_size += written;
   }
 
 #ifndef NO_LOG
-  MIDILogLocation( DEBUG, "Sending RTP message consisting of %i iovecs.\n", (int) iovlen );
-  int i, j;
+  MIDILogLocation( DEBUG, "Sending RTP message consisting of %i iovecs.\n", (int) *iovlen );
+  _log_iov( *iovlen, iov );
+#endif
+
+  *used = buffer - start;
+  return 0;
+}
+
+static void _rtp_init_send_msg( struct msghdr * msg, struct RTPPacketInfo * info,
+                                size_t iovlen, struct iovec * iov ) {
+  msg->msg_name       = &(info->peer->address.addr);
+  msg->msg_namelen    = info->peer->address.size;
+  msg->msg_iov        = iov;
+  msg->msg_iovlen     = iovlen;
+  msg->msg_control    = NULL;
+  msg->msg_controllen = 0;
+  msg->msg_flags      = 0;
+}
+
+static void _rtp_packet_sent( struct RTPPacketInfo * info ) {
+  info->peer->out_seqnum    = info->sequence_number;
+  info->peer->out_timestamp = info->timestamp;
+}
+
+/**
+ * @brief Append bytes to the coalesced bytes of a stream.
+ * @private @memberof RTPPeer
+ * @param stream The stream.
+ * @param offset The number of leading bytes of the iovecs to skip.
+ * @param iovlen The number of iovecs.
+ * @param iov    The iovecs.
+ * @retval 0 on success.
+ * @retval >0 if the buffer could not be grown.
+ */
+static int _rtp_stream_buffer( struct RTPStream * stream, size_t offset, size_t iovlen, struct iovec * iov ) {
+  size_t i, length, size = stream->out_length;
+  unsigned char * out;
+  for( i=0; i<iovlen; i++ ) size += iov[i].iov_len;
+  size -= offset;
+  if( size > stream->out_size ) {
+    out = realloc( stream->out, size );
+    if( out == NULL ) return 1;
+    stream->out      = out;
+    stream->out_size = size;
+  }
   for( i=0; i<iovlen; i++ ) {
-    MIDILog( DEBUG, "[%i] iov_len: %i, iov_base: %p\n", i, (int) iov[i].iov_len, iov[i].iov_base );
-    for( j=0; j<iov[i].iov_len; j++ ) {
-      unsigned char c = *((unsigned char*)iov[i].iov_base+j);
-      if( (j+1) % 8 == 0 || j+1 == iov[i].iov_len ) {
-        MIDILog( DEBUG, "0x%02x\n", c );
-      } else {
-        MIDILog( DEBUG, "0x%02x ", c );
-      }
+    length = iov[i].iov_len;
+    if( offset >= length ) {
+      offset -= length;
+      continue;
     }
+    memcpy( stream->out + stream->out_length, iov[i].iov_base + offset, length - offset );
+    stream->out_length += length - offset;
+    offset = 0;
   }
-#endif
+  return 0;
+}
 
-  msg.msg_name       = &(info->peer->address.addr);
-  msg.msg_namelen    = info->peer->address.size;
-  msg.msg_iov        = &(iov[0]);
+/**
+ * @brief Send an encoded packet as an RFC 4571 frame over a stream.
+ * Small frames are coalesced and written by the next flush. When a frame
+ * does not fit, the coalesced bytes, the length prefix and the packet are
+ * handed to the kernel by a single @c sendmsg and whatever the socket did
+ * not take is kept for the next flush.
+ * @private @memberof RTPSession
+ * @param stream The stream of the packet's peer.
+ * @param info   The packet info.
+ * @param iovlen The number of iovecs used by the packet.
+ * @param iov    The iovecs, the packet starts at the third element.
+ * @retval 0 on success.
+ * @retval >0 if the packet could not be sent.
+ */
+static int _rtp_stream_send( struct RTPStream * stream, struct RTPPacketInfo * info,
+                             size_t iovlen, struct iovec * iov ) {
+  unsigned char prefix[2];
+  size_t offset, frame_size = 2 + info->total_size;
+  struct msghdr msg;
+  ssize_t bytes_sent;
+
+  if( info->total_size > 0xffff ) return 1;
+  prefix[0] = ( info->total_size >> 8 ) & 0xff;
+  prefix[1] =   info->total_size        & 0xff;
+  iov[0].iov_base = stream->out;
+  iov[0].iov_len  = stream->out_length;
+  iov[1].iov_base = &(prefix[0]);
+  iov[1].iov_len  = 2;
+  iovlen += 2;
+
+  if( stream->out_length + frame_size <= RTP_STREAM_COALESCE ) {
+    if( _rtp_stream_buffer( stream, 0, iovlen-1, &(iov[1]) ) ) return 1;
+    _rtp_packet_sent( info );
+    return 0;
+  }
+  if( stream->out_length + frame_size > RTP_STREAM_MAX_PENDING ) {
+    /* the peer does not keep up, drop the packet rather than a part of it */
+    return 1;
+  }
+
+  msg.msg_name       = NULL;
+  msg.msg_namelen    = 0;
+  msg.msg_iov        = iov;
   msg.msg_iovlen     = iovlen;
   msg.msg_control    = NULL;
   msg.msg_controllen = 0;
   msg.msg_flags      = 0;
+  bytes_sent = sendmsg( stream->fd, &msg, MSG_NOSIGNAL );
+  if( bytes_sent < 0 ) {
+    if( errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR ) return 1;
+    bytes_sent = 0;
+  }
+
+  if( bytes_sent < stream->out_length ) {
+    /* keep the unsent part of the coalesced bytes and append the frame */
+    stream->out_length -= bytes_sent;
+    memmove( stream->out, stream->out + bytes_sent, stream->out_length );
+    offset = 0;
+  } else {
+    offset = bytes_sent - stream->out_length;
+    stream->out_length = 0;
+  }
+  if( _rtp_stream_buffer( stream, offset, iovlen-1, &(iov[1]) ) ) return 1;
+  _rtp_packet_sent( info );
+  return 0;
+}
+
+/**
+ * @brief Send an RTP packet.
+ * If the peer has a stream, see @ref RTPPeerSetStream, the packet is framed
+ * and written to the stream instead of the session's socket.
+ * @public @memberof RTPSession
+ * @param session The session.
+ * @param info The packet info.
+ * @retval 0 On success.
+ * @retval >0 If the message could not be sent.
+ */
+int RTPSessionSendPacket( struct RTPSession * session, struct RTPPacketInfo * info ) {
+  size_t iovlen = 0, used = 0;
+  struct msghdr msg;
+  /* room in front for the coalesced bytes and the frame's length prefix */
+  struct iovec  iov[RTP_IOV_LEN+5];
+  ssize_t bytes_sent;
+
+  if( _rtp_encode_packet( session, info, session->buflen, session->buffer,
+                          &iovlen, &(iov[2]), &used ) ) {
+    return 1;
+  }
+  if( info->peer->stream != NULL ) {
+    return _rtp_stream_send( info->peer->stream, info, iovlen, &(iov[0]) );
+  }
+  _rtp_init_send_msg( &msg, info, iovlen, &(iov[2]) );
 
   bytes_sent = sendmsg( session->socket, &msg, 0 );
 
@@ -924,49 +1609,160 @@ int RTPSessionSendPacket( struct RTPSession * session, struct RTPPacketInfo * in
   } else if( msg.msg_flags != 0 ) {
     return 1;
   } else {
-    info->peer->out_seqnum    = info->sequence_number;
-    info->peer->out_timestamp = info->timestamp;
+    _rtp_packet_sent( info );
     return 0;
   }
 }
 
 /**
- * @brief Receive an RTP packet.
+ * @brief Send several RTP packets at once.
+ * The headers of all packets are encoded into a contiguous arena owned by the
+ * session while the payload iovecs are referenced as they are, so packets that
+ * go to different peers may share the same payload buffers. Where available
+ * all packets are submitted with a single @c sendmmsg, otherwise they are sent
+ * one after another. Packets to peers that have a stream are framed and
+ * written to the stream, see @ref RTPSessionSendPacket.
+ * Sending stops at the first packet that could not be sent.
  * @public @memberof RTPSession
  * @param session The session.
- * @param info The packet info.
+ * @param n       The number of entries in the @c infos array.
+ * @param infos   An array of packet infos, each with its peer set.
+ * @param sent    The number of leading packets that were sent.
  * @retval 0 On success.
- * @retval >0 If the message could not be received.
+ * @retval >0 If any of the packets could not be sent.
  */
-int RTPSessionReceivePacket( struct RTPSession * session, struct RTPPacketInfo * info ) {
-  size_t size, read = 0;
-  void * buffer;
-  struct sockaddr_storage name;
-  struct msghdr msg;
-  struct iovec  iov;
-  ssize_t bytes_received;
+int RTPSessionSendPackets( struct RTPSession * session, size_t n, struct RTPPacketInfo * infos, size_t * sent ) {
+  struct msghdr msg[RTP_SEND_CHUNK];
+  struct iovec  iov[RTP_SEND_CHUNK][RTP_IOV_LEN+3];
+  size_t i, iovlen, used, chunk, done = 0;
+  ssize_t bytes_sent;
+  unsigned char * buffer;
+#ifdef RTP_HAVE_SENDMMSG
+  struct mmsghdr mmsg[RTP_SEND_CHUNK];
+  int result;
+#endif
 
-  iov.iov_base = session->buffer;
-  iov.iov_len  = session->buflen;
+  if( infos == NULL || sent == NULL ) return 1;
+  *sent = 0;
+  if( session->header_arena == NULL ) {
+    session->header_arena = malloc( RTP_SEND_CHUNK * RTP_HEADER_ARENA_SLOT );
+    if( session->header_arena == NULL ) return 1;
+  }
 
-  msg.msg_name       = &name;
-  msg.msg_namelen    = sizeof(name);
-  msg.msg_iov        = &iov;
-  msg.msg_iovlen     = 1;
-  msg.msg_control    = NULL;
-  msg.msg_controllen = 0;
-  msg.msg_flags      = 0;
+  while( done < n ) {
+    if( infos[done].peer != NULL && infos[done].peer->stream != NULL ) {
+      if( RTPSessionSendPacket( session, &(infos[done]) ) ) return 1;
+      *sent = ++done;
+      continue;
+    }
+    /* encode as many headers as fit into the arena, up to the next peer
+     * that has a stream */
+    chunk  = ( n-done < RTP_SEND_CHUNK ) ? n-done : RTP_SEND_CHUNK;
+    buffer = session->header_arena;
+    for( i=0; i<chunk; i++ ) {
+      if( infos[done+i].peer != NULL && infos[done+i].peer->stream != NULL ) break;
+      if( _rtp_encode_packet( session, &(infos[done+i]), RTP_HEADER_ARENA_SLOT, buffer,
+                              &iovlen, &(iov[i][0]), &used ) ) {
+        break;
+      }
+      _rtp_init_send_msg( &(msg[i]), &(infos[done+i]), iovlen, &(iov[i][0]) );
+      buffer += RTP_HEADER_ARENA_SLOT;
+    }
+    chunk = i;
+    if( chunk == 0 ) return 1;
 
-  bytes_received = recvmsg( session->socket, &msg, 0 );
+#ifdef RTP_HAVE_SENDMMSG
+    for( i=0; i<chunk; i++ ) {
+      mmsg[i].msg_hdr = msg[i];
+      mmsg[i].msg_len = 0;
+    }
+    result = sendmmsg( session->socket, &(mmsg[0]), chunk, 0 );
+    if( result <= 0 ) return 1;
+    for( i=0; i<result; i++ ) {
+      bytes_sent = mmsg[i].msg_len;
+      if( bytes_sent != infos[done+i].total_size ) return 1;
+      _rtp_packet_sent( &(infos[done+i]) );
+      *sent = done + i + 1;
+    }
+    if( result < chunk ) return 1;
+#else
+    for( i=0; i<chunk; i++ ) {
+      bytes_sent = sendmsg( session->socket, &(msg[i]), 0 );
+      if( bytes_sent != infos[done+i].total_size ) return 1;
+      _rtp_packet_sent( &(infos[done+i]) );
+      *sent = done + i + 1;
+    }
+#endif
+    done += chunk;
+  }
+  return 0;
+}
 
-  if( bytes_received == -1 ) return -1;
-  if( msg.msg_flags != 0  )  return 1;
+/**
+ * @brief Update the reception statistics of a peer.
+ * @private @memberof RTPPeer
+ * @param peer   The peer that sent the packet.
+ * @param seqnum The sequence number of the packet.
+ */
+static void _rtp_count_packet( struct RTPPeer * peer, unsigned short seqnum ) {
+  unsigned long delta = ( seqnum - peer->in_highest ) & 0xffff;
+  if( peer->in_packets == 0 ) {
+    peer->in_highest = seqnum;
+  } else if( delta > 0 && delta < 0x8000 ) {
+    peer->in_lost   += delta - 1;
+    peer->in_highest = seqnum;
+  } else if( delta != 0 && peer->in_lost > 0 ) {
+    peer->in_lost--;
+  }
+  peer->in_packets++;
+}
+
+/**
+ * @brief Get the receive timestamp of a packet from its control messages.
+ * @private @memberof RTPSession
+ * @param msg     The message header of the received packet.
+ * @param arrival Will be set to the receive time or to zero.
+ */
+static void _rtp_decode_arrival( struct msghdr * msg, struct timespec * arrival ) {
+  struct cmsghdr * cmsg;
+  arrival->tv_sec  = 0;
+  arrival->tv_nsec = 0;
+  if( msg->msg_controllen == 0 ) return;
+  for( cmsg = CMSG_FIRSTHDR( msg ); cmsg != NULL; cmsg = CMSG_NXTHDR( msg, cmsg ) ) {
+    if( cmsg->cmsg_level != SOL_SOCKET ) continue;
+#if defined( SCM_TIMESTAMPNS )
+    if( cmsg->cmsg_type == SCM_TIMESTAMPNS ) {
+      memcpy( arrival, CMSG_DATA( cmsg ), sizeof(struct timespec) );
+    }
+#elif defined( SCM_TIMESTAMP )
+    if( cmsg->cmsg_type == SCM_TIMESTAMP ) {
+      struct timeval tv;
+      memcpy( &tv, CMSG_DATA( cmsg ), sizeof(struct timeval) );
+      arrival->tv_sec  = tv.tv_sec;
+      arrival->tv_nsec = tv.tv_usec * 1000;
+    }
+#endif
+  }
+}
+
+static int _rtp_decode_packet( struct RTPSession * session, struct RTPPacketInfo * info,
+                               struct msghdr * msg, ssize_t bytes_received ) {
+  size_t size, read = 0;
+  void * buffer;
+
+  if( msg->msg_flags != 0  ) return 1;
   if( bytes_received < 12 )  return 1;
 
   size   = bytes_received;
-  buffer = session->buffer;
+  buffer = msg->msg_iov[0].iov_base;
   info->total_size = bytes_received;
-  _rtp_decode_header( info, size, buffer, &read );
+  _rtp_decode_arrival( msg, &(info->arrival) );
+  if( _rtp_decode_header( info, size, buffer, &read ) ) {
+    if( session->foreign != NULL ) {
+      session->foreign( session->foreign_info, size, buffer, msg->msg_namelen, msg->msg_name );
+    }
+    return 1;
+  }
   _advance_buffer( &size, &buffer, read );
   if( info->extension ) {
     _rtp_decode_extension( info, size, buffer, &read );
@@ -984,25 +1780,14 @@ int RTPSessionReceivePacket( struct RTPSession * session, struct RTPPacketInfo *
   }
   
 #ifndef NO_LOG
-  int i, j;
   MIDILogLocation( DEBUG, "Received RTP message consisting of %i iovecs.\n", (int) info->iovlen );
-  for( i=0; i<info->iovlen; i++ ) {
-    MIDILog( DEBUG, "[%i] iov_len: %i, iov_base: %p\n", i, (int) info->iov[i].iov_len, info->iov[i].iov_base );
-    for( j=0; j<info->iov[i].iov_len; j++ ) {
-      unsigned char c = *((unsigned char*)info->iov[i].iov_base+j);
-      if( (j+1) % 8 == 0 || j+1 == info->iov[i].iov_len ) {
-        MIDILog( DEBUG, "0x%02x\n", c );
-      } else {
-        MIDILog( DEBUG, "0x%02x ", c );
-      }
-    }
-  }
+  _log_iov( info->iovlen, &(info->iov[0]) );
 #endif
 
   info->peer = NULL;
   RTPSessionFindPeerBySSRC( session, &(info->peer), info->ssrc );
   if( info->peer == NULL ) {
-    info->peer = RTPPeerCreate( info->ssrc, msg.msg_namelen, msg.msg_name );
+    info->peer = RTPPeerCreate( info->ssrc, msg->msg_namelen, msg->msg_name );
     RTPSessionAddPeer( session, info->peer );
     RTPPeerRelease( info->peer );
   }
@@ -1010,6 +1795,217 @@ int RTPSessionReceivePacket( struct RTPSession * session, struct RTPPacketInfo *
     info->peer->in_seqnum    = info->sequence_number;
     info->peer->in_timestamp = info->timestamp;
   }
+  _rtp_count_packet( info->peer, info->sequence_number );
+  return 0;
+}
+
+static void _rtp_init_recv_msg( struct msghdr * msg, struct RTPPacketBuffer * packet ) {
+  packet->iov[0].iov_base = &(packet->data[0]);
+  packet->iov[0].iov_len  = sizeof(packet->data);
+
+  msg->msg_name       = &(packet->name);
+  msg->msg_namelen    = sizeof(packet->name);
+  msg->msg_iov        = &(packet->iov[0]);
+  msg->msg_iovlen     = 1;
+  msg->msg_control    = &(packet->control.bytes[0]);
+  msg->msg_controllen = sizeof(packet->control.bytes);
+  msg->msg_flags      = 0;
+}
+
+/**
+ * @brief Receive an RTP packet.
+ * @public @memberof RTPSession
+ * @param session The session.
+ * @param info The packet info.
+ * @retval 0 On success.
+ * @retval >0 If the message could not be received.
+ */
+int RTPSessionReceivePacket( struct RTPSession * session, struct RTPPacketInfo * info ) {
+  struct sockaddr_storage name;
+  union RTPControlBuffer control;
+  struct msghdr msg;
+  struct iovec  iov;
+  ssize_t bytes_received;
+
+  iov.iov_base = session->buffer;
+  iov.iov_len  = session->buflen;
+
+  msg.msg_name       = &name;
+  msg.msg_namelen    = sizeof(name);
+  msg.msg_iov        = &iov;
+  msg.msg_iovlen     = 1;
+  msg.msg_control    = &(control.bytes[0]);
+  msg.msg_controllen = sizeof(control.bytes);
+  msg.msg_flags      = 0;
+
+  bytes_received = recvmsg( session->socket, &msg, 0 );
+
+  if( bytes_received == -1 ) return -1;
+  return _rtp_decode_packet( session, info, &msg, bytes_received );
+}
+
+/**
+ * @brief Receive all pending RTP packets.
+ * Drain up to @c n packets from the session's socket with as few system
+ * calls as possible (a single @c recvmmsg where available). The call blocks
+ * until at least one packet arrived, but never waits for more.
+ * The packets are received into buffers from a ring owned by the session
+ * and decoded in place. The payload iovecs of each returned info point
+ * into that ring and stay valid until @c RTP_RECV_RING_LEN further packets
+ * were received. Corrupted packets are dropped.
+ * @public @memberof RTPSession
+ * @param session The session.
+ * @param n       The number of entries in the @c infos array.
+ * @param infos   An array of packet infos to populate.
+ * @param count   The number of received packets.
+ * @retval 0 On success.
+ * @retval >0 If no packet could be received.
+ */
+int RTPSessionReceivePackets( struct RTPSession * session, size_t n, struct RTPPacketInfo * infos, size_t * count ) {
+  struct msghdr msg[RTP_RECV_RING_LEN];
+  struct RTPPacketBuffer * packets[RTP_RECV_RING_LEN];
+  ssize_t bytes[RTP_RECV_RING_LEN];
+  size_t i, received = 0, valid = 0;
+#ifdef RTP_HAVE_RECVMMSG
+  struct mmsghdr mmsg[RTP_RECV_RING_LEN];
+  int result;
+#endif
+
+  if( infos == NULL || count == NULL ) return 1;
+  if( session->recv_ring == NULL ) {
+    session->recv_ring = malloc( sizeof(struct RTPPacketBuffer) * RTP_RECV_RING_LEN );
+    if( session->recv_ring == NULL ) return 1;
+  }
+  if( n > RTP_RECV_RING_LEN ) n = RTP_RECV_RING_LEN;
+
+  for( i=0; i<n; i++ ) {
+    packets[i] = &(session->recv_ring[(session->recv_next+i) % RTP_RECV_RING_LEN]);
+    _rtp_init_recv_msg( &(msg[i]), packets[i] );
+  }
+
+#ifdef RTP_HAVE_RECVMMSG
+  for( i=0; i<n; i++ ) {
+    mmsg[i].msg_hdr = msg[i];
+    mmsg[i].msg_len = 0;
+  }
+  result = recvmmsg( session->socket, &(mmsg[0]), n, MSG_WAITFORONE, NULL );
+  if( result <= 0 ) return -1;
+  for( received=0; received<result; received++ ) {
+    msg[received]   = mmsg[received].msg_hdr;
+    bytes[received] = mmsg[received].msg_len;
+  }
+#else
+  for( received=0; received<n; received++ ) {
+    /* only the first call may block */
+    bytes[received] = recvmsg( session->socket, &(msg[received]), ( received == 0 ) ? 0 : MSG_DONTWAIT );
+    if( bytes[received] == -1 ) break;
+  }
+  if( received == 0 ) return -1;
+#endif
+
+  session->recv_next = ( session->recv_next + received ) % RTP_RECV_RING_LEN;
+  for( i=0; i<received; i++ ) {
+    infos[valid].iov = &(packets[i]->iov[0]);
+    if( _rtp_decode_packet( session, &(infos[valid]), &(msg[i]), bytes[i] ) == 0 ) {
+      valid++;
+    }
+  }
+  *count = valid;
+  return 0;
+}
+
+/**
+ * @brief Write the coalesced packets of all streams.
+ * Hand the bytes that were collected since the last flush to the kernel,
+ * call this once per runloop turn after the packets of the turn were sent.
+ * @public @memberof RTPSession
+ * @param session The session.
+ * @param pending The number of peers whose stream still holds bytes because
+ *                the socket did not take them. May be @c NULL.
+ * @retval 0 on success.
+ * @retval >0 if any of the connections failed.
+ */
+int RTPSessionFlushStreams( struct RTPSession * session, size_t * pending ) {
+  size_t i, waiting = 0;
+  int result = 0;
+  struct RTPStream * stream;
+  for( i=0; i<session->npeers; i++ ) {
+    stream = session->peers[i]->stream;
+    if( stream == NULL ) continue;
+    if( RTPPeerFlushStream( session->peers[i] ) ) result = 1;
+    if( stream->out_length > 0 ) waiting++;
+  }
+  if( pending != NULL ) *pending = waiting;
+  return result;
+}
+
+/**
+ * @brief Receive the RTP packets a peer sent over its stream.
+ * Read what the peer's stream socket holds without blocking and decode all
+ * complete frames, up to @c n packets. The payload iovecs of the returned
+ * infos point into the stream's buffer and stay valid until the next call.
+ * Frames that are not RTP packets are passed to the foreign handler,
+ * corrupted packets are dropped.
+ * @public @memberof RTPSession
+ * @param session The session.
+ * @param peer    The peer, see @ref RTPPeerSetStream.
+ * @param n       The number of entries in the @c infos array.
+ * @param infos   An array of packet infos to populate.
+ * @param count   The number of received packets.
+ * @retval 0 On success, even if no packet was complete.
+ * @retval -1 If the connection was closed or failed.
+ * @retval >0 If the peer has no stream.
+ */
+int RTPSessionReceiveStream( struct RTPSession * session, struct RTPPeer * peer,
+                             size_t n, struct RTPPacketInfo * infos, size_t * count ) {
+  struct RTPStream * stream;
+  struct msghdr msg;
+  struct iovec  iov;
+  ssize_t bytes_received;
+  size_t length, valid = 0;
+  unsigned char * frame;
+
+  if( peer == NULL || infos == NULL || count == NULL ) return 1;
+  stream = peer->stream;
+  if( stream == NULL ) return 1;
+  if( n > RTP_RECV_RING_LEN ) n = RTP_RECV_RING_LEN;
+  *count = 0;
+
+  /* drop the frames that were decoded by the previous call */
+  stream->in_length -= stream->in_offset;
+  memmove( &(stream->in[0]), &(stream->in[stream->in_offset]), stream->in_length );
+  stream->in_offset = 0;
+
+  bytes_received = recv( stream->fd, &(stream->in[stream->in_length]),
+                         sizeof(stream->in) - stream->in_length, 0 );
+  if( bytes_received == 0 ) return -1;
+  if( bytes_received < 0 ) {
+    if( errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR ) return -1;
+    bytes_received = 0;
+  }
+  stream->in_length += bytes_received;
+
+  msg.msg_name       = &(peer->address.addr);
+  msg.msg_namelen    = peer->address.size;
+  msg.msg_iov        = &iov;
+  msg.msg_iovlen     = 1;
+  msg.msg_control    = NULL;
+  msg.msg_controllen = 0;
+  while( valid < n && stream->in_length - stream->in_offset >= 2 ) {
+    frame  = &(stream->in[stream->in_offset]);
+    length = ( frame[0] << 8 ) | frame[1];
+    if( stream->in_length - stream->in_offset < 2 + length ) break;
+    stream->in_offset += 2 + length;
+
+    iov.iov_base  = frame + 2;
+    iov.iov_len   = length;
+    msg.msg_flags = 0;
+    infos[valid].iov = &(stream->in_iov[valid][0]);
+    if( _rtp_decode_packet( session, &(infos[valid]), &msg, length ) == 0 ) {
+      valid++;
+    }
+  }
+  *count = valid;
   return 0;
 }
 
@@ -1025,7 +2021,8 @@ int RTPSessionReceivePacket( struct RTPSession * session, struct RTPPacketInfo *
  */
 int RTPSessionSend( struct RTPSession * session, size_t size, void * payload,
                     struct RTPPacketInfo * info ) {
-  int i, result = 0;
+  size_t i;
+  int result = 0;
   struct iovec iov;
   
   if( info == NULL ) {
@@ -1039,11 +2036,9 @@ int RTPSessionSend( struct RTPSession * session, size_t size, void * payload,
   info->iov       = &iov;
   
   if( info->peer == NULL ) {
-    for( i=0; i<RTP_MAX_PEERS; i++ ) {
-      if( session->peers[i] != NULL ) {
-        info->peer = session->peers[i];
-        result += RTPSessionSendPacket( session, info );
-      }
+    for( i=0; i<session->npeers; i++ ) {
+      info->peer = session->peers[i];
+      result += RTPSessionSendPacket( session, info );
     }
   } else {
     result = RTPSessionSendPacket( session, info );
@@ -1,6 +1,7 @@
 #ifndef MIDIKIT_DRIVER_RTP_H
 #define MIDIKIT_DRIVER_RTP_H
 #include <stdlib.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 
@@ -18,12 +19,15 @@ struct RTPPacketInfo {
   unsigned long  timestamp;
   unsigned long  ssrc;
   unsigned long  csrc[16];
+  struct timespec arrival;
   size_t total_size;
   size_t payload_size;
   size_t iovlen;
   struct iovec * iov;
 };
 
+typedef int RTPForeignHandlerFn( void * info, size_t size, void * data, socklen_t addrlen, struct sockaddr * addr );
+
 struct RTPPeer * RTPPeerCreate( unsigned long ssrc, socklen_t size, struct sockaddr * addr );
 void RTPPeerDestroy( struct RTPPeer * peer );
 void RTPPeerRetain( struct RTPPeer * peer );
@@ -33,6 +37,11 @@ int RTPPeerGetSSRC( struct RTPPeer * peer, unsigned long * ssrc );
 int RTPPeerGetAddress( struct RTPPeer * peer, socklen_t * size, struct sockaddr ** addr );
 int RTPPeerSetInfo( struct RTPPeer * peer, void * info );
 int RTPPeerGetInfo( struct RTPPeer * peer, void ** info );
+int RTPPeerGetReceptionStats( struct RTPPeer * peer, unsigned long * received, unsigned long * lost );
+int RTPPeerSetStream( struct RTPPeer * peer, int fd );
+int RTPPeerGetStream( struct RTPPeer * peer, int * fd );
+int RTPPeerGetStreamPending( struct RTPPeer * peer, size_t * bytes );
+int RTPPeerFlushStream( struct RTPPeer * peer );
 
 struct RTPSession * RTPSessionCreate( int socket );
 void RTPSessionDestroy( struct RTPSession * session );
@@ -43,6 +52,8 @@ int RTPSessionSetSSRC( struct RTPSession * session, unsigned long ssrc );
 int RTPSessionGetSSRC( struct RTPSession * session, unsigned long * ssrc );
 int RTPSessionSetSocket( struct RTPSession * session, int socket );
 int RTPSessionGetSocket( struct RTPSession * session, int * socket );
+int RTPSessionSetTimestamping( struct RTPSession * session, int enabled );
+int RTPSessionSetForeignHandler( struct RTPSession * session, RTPForeignHandlerFn * handler, void * info );
 
 int RTPSessionAddPeer( struct RTPSession * session, struct RTPPeer * peer );
 int RTPSessionRemovePeer( struct RTPSession * session, struct RTPPeer * peer );
@@ -52,8 +63,18 @@ int RTPSessionFindPeerBySSRC( struct RTPSession * session, struct RTPPeer ** pee
 int RTPSessionFindPeerByAddress( struct RTPSession * session, struct RTPPeer ** peer,
                                  socklen_t size, struct sockaddr * addr );
 
+int RTPSessionSetMulticastGroup( struct RTPSession * session, struct RTPPeer * group );
+int RTPSessionGetMulticastGroup( struct RTPSession * session, struct RTPPeer ** group );
+int RTPSessionJoinMulticastGroup( struct RTPSession * session, socklen_t size, struct sockaddr * addr );
+int RTPSessionLeaveMulticastGroup( struct RTPSession * session, socklen_t size, struct sockaddr * addr );
+
 int RTPSessionSendPacket( struct RTPSession * session, struct RTPPacketInfo * info );
+int RTPSessionSendPackets( struct RTPSession * session, size_t n, struct RTPPacketInfo * infos, size_t * sent );
 int RTPSessionReceivePacket( struct RTPSession * session, struct RTPPacketInfo * info );
+int RTPSessionReceivePackets( struct RTPSession * session, size_t n, struct RTPPacketInfo * infos, size_t * count );
+int RTPSessionReceiveStream( struct RTPSession * session, struct RTPPeer * peer,
+                             size_t n, struct RTPPacketInfo * infos, size_t * count );
+int RTPSessionFlushStreams( struct RTPSession * session, size_t * pending );
 int RTPSessionSend( struct RTPSession * session, size_t size, void * payload, struct RTPPacketInfo * info );
 int RTPSessionReceive( struct RTPSession * session, size_t size, void * payload, struct RTPPacketInfo * info );
 
@@ -1,6 +1,109 @@
 #include "rtpmidi.h"
 #include "rtp.h"
 #include "midi/util.h"
+#include "midi/ump.h"
+#include "midi/message_queue.h"
+#include "midi/sysex.h"
+#define MIDI_DRIVER_INTERNALS
+#include "midi/driver.h"
+#include "midi/trace.h"
+#include <string.h>
+#include <time.h>
+
+/**
+ * @brief Number of messages in the pool of received messages.
+ */
+#define RTPMIDI_MESSAGE_POOL_SIZE 64
+
+/**
+ * @brief Maximum number of packets drained from the socket at once.
+ */
+#define RTPMIDI_RECV_PACKETS 16
+
+/**
+ * @brief Maximum number of commands decoded from a packet at once.
+ */
+#define RTPMIDI_DECODE_MESSAGES 32
+
+/**
+ * @brief Maximum number of peers a packet is sent to at once.
+ */
+#define RTPMIDI_SEND_PEERS 16
+
+/**
+ * @brief Maximum number of journal bytes appended to a packet.
+ * If a peer's journal grows larger it is left out until receiver
+ * feedback truncates it.
+ */
+#define RTPMIDI_JOURNAL_SIZE 512
+
+/**
+ * @brief Maximum size of an outgoing packet.
+ * The UDP payload of an unfragmented packet on ethernet.
+ */
+#define RTPMIDI_MTU 1472
+
+/**
+ * @brief Maximum number of command section bytes in a packet.
+ * What is left of the MTU after the RTP header (12 bytes), the longest
+ * RTP-MIDI header (2 bytes) and the journal. Messages that do not fit
+ * are sent in the following packets.
+ */
+#define RTPMIDI_COMMAND_SIZE ( RTPMIDI_MTU - 12 - 2 - RTPMIDI_JOURNAL_SIZE )
+
+/**
+ * @brief Maximum number of system exclusive bytes in a segment.
+ * What is left of the command section after the delta time and the
+ * @c 0xf0 / @c 0xf7 markers that start and end a segment.
+ */
+#define RTPMIDI_SYSEX_SEGMENT ( RTPMIDI_COMMAND_SIZE - 3 )
+
+/**
+ * @brief Number of system exclusive messages that may wait to be segmented.
+ */
+#define RTPMIDI_SYSEX_QUEUE 16
+
+/**
+ * @brief Maximum number of messages encoded into a packet at once.
+ */
+#define RTPMIDI_ENCODE_MESSAGES 32
+
+/**
+ * @brief Number of sent packets a peer's cursor remembers.
+ * Receiver feedback for older packets can not be mapped to the shared
+ * history and is ignored. Must be a power of two.
+ */
+#define RTPMIDI_CURSOR_PACKETS 128
+
+/**
+ * @brief Maximum number of packets a peer's cursor may lag behind.
+ * Serials are compared modulo 2^16, so the cursors of peers that do
+ * not send feedback are moved along and lose the older history.
+ */
+#define RTPMIDI_CURSOR_LAG 0x4000
+
+/**
+ * @brief Number of packets a multicast receiver may lag behind.
+ * The journal of multicast packets covers the receivers that are at most
+ * this many packets behind, receivers that lag further have to be
+ * repaired with @ref RTPMIDISessionSendRepair.
+ */
+#define RTPMIDI_MULTICAST_LAG 64
+
+/**
+ * @brief Marker for state the journal has not seen yet.
+ */
+#define RTPMIDI_JOURNAL_UNSET 0xff
+
+/* chapter flags in the table of contents of a channel journal */
+#define RTPMIDI_CHAPTER_P 0x80
+#define RTPMIDI_CHAPTER_C 0x40
+#define RTPMIDI_CHAPTER_M 0x20
+#define RTPMIDI_CHAPTER_W 0x10
+#define RTPMIDI_CHAPTER_N 0x08
+#define RTPMIDI_CHAPTER_E 0x04
+#define RTPMIDI_CHAPTER_T 0x02
+#define RTPMIDI_CHAPTER_A 0x01
 
 /**
  * @defgroup RTP-MIDI RTP-MIDI
@@ -42,17 +145,42 @@ struct RTPMIDISystemJournal {
 
 /**
  * Hold information for the channel history.
+ * The storage is fixed per channel: it holds the current state of every note,
+ * controller, the program and the pitch wheel together with the sequence
+ * number of the packet that last changed it. The logs list the entries that
+ * changed after the checkpoint, so encoding and truncating the journal costs
+ * O(changed state) rather than O(history).
  */
 struct RTPMIDIChannelJournal {
   unsigned short checkpoint_pkt_seqnum;         /**< The latest RTP sequence number encoded in the journal */
   unsigned char  enhanced_chapter_c;            /**< Use enhanced chapter C coding */
   unsigned char  channel;                       /**< The channel number */
-  struct RTPMIDIJournalChapterPart * chapter_p; /**< Chapter P: MIDI Program Change (0xc) */
-  struct RTPMIDIJournalChapterPart * chapter_c; /**< Chapter C: MIDI Control Change (0xb) */
-  struct RTPMIDIJournalChapterPart * chapter_m; /**< Chapter M: MIDI Parameter System (part of 0xb) */
-  struct RTPMIDIJournalChapterPart * chapter_w; /**< Chapter W: MIDI Pitch Wheel (0xe) */
-  struct RTPMIDIJournalChapterPart * chapter_n; /**< Chapter N: MIDI NoteOff (0x8), NoteOn (0x9) */
-  struct RTPMIDIJournalChapterPart * chapter_e; /**< Chapter E: MIDI Note Command Extras (0x8, 0x9) */
+  unsigned char  toc;                           /**< The chapters that hold entries newer than the checkpoint */
+
+  /* Chapter P: MIDI Program Change (0xc) */
+  unsigned short program_seqnum;                /**< The sequence number of the last program change */
+  unsigned char  program;                       /**< The current program or RTPMIDI_JOURNAL_UNSET */
+  unsigned char  program_bank_msb;              /**< Bank select MSB active at the program change */
+  unsigned char  program_bank_lsb;              /**< Bank select LSB active at the program change */
+
+  /* Chapter W: MIDI Pitch Wheel (0xe) */
+  unsigned short wheel_seqnum;                  /**< The sequence number of the last pitch wheel change */
+  unsigned char  wheel_lsb;                     /**< The current pitch wheel LSB or RTPMIDI_JOURNAL_UNSET */
+  unsigned char  wheel_msb;                     /**< The current pitch wheel MSB */
+
+  /* Chapter C: MIDI Control Change (0xb) */
+  unsigned char  controllers;                   /**< The number of entries in the controller log */
+  unsigned char  controller_log[128];           /**< The controllers changed after the checkpoint */
+  unsigned char  controller_index[128];         /**< Position of a controller in the log or RTPMIDI_JOURNAL_UNSET */
+  unsigned char  controller_value[128];         /**< The current values or RTPMIDI_JOURNAL_UNSET */
+  unsigned short controller_seqnum[128];        /**< The sequence numbers of the last changes */
+
+  /* Chapter N: MIDI NoteOff (0x8), NoteOn (0x9) */
+  unsigned char  notes;                         /**< The number of entries in the note log */
+  unsigned char  note_log[128];                 /**< The notes changed after the checkpoint */
+  unsigned char  note_index[128];               /**< Position of a note in the log or RTPMIDI_JOURNAL_UNSET */
+  unsigned char  note_velocity[128];            /**< The current velocity, zero if the note is off */
+  unsigned short note_seqnum[128];              /**< The sequence numbers of the last changes */
 };
 
 /**
@@ -63,6 +191,8 @@ struct RTPMIDIJournal {
   unsigned char  enhanced_chapter_c;    /**< Use enhanced chapter C coding in at least one channel journal */
   unsigned char  total_channels;        /**< The number of valid entries in the channel journals list */
   unsigned short checkpoint_pkt_seqnum; /**< The latest RTP sequence number encoded in the journal */
+  unsigned char  received;              /**< Whether @c last_pkt_seqnum holds a valid sequence number */
+  unsigned short last_pkt_seqnum;       /**< The sequence number of the last packet stored in the journal */
   struct RTPMIDISystemJournal  * system_journal;
   struct RTPMIDIChannelJournal * channel_journals[16];
 
@@ -70,9 +200,26 @@ struct RTPMIDIJournal {
   void * buffer;
 };
 
+/**
+ * Hold a peer's position in the session's shared send history.
+ * The shared history is stamped with session serials, one per sent
+ * packet, while feedback refers to the peer's own sequence numbers.
+ * The cursor remembers which serial recent sequence numbers were sent
+ * with and the serial of the last packet the peer acknowledged.
+ */
+struct RTPMIDIPeerCursor {
+  unsigned char  joined;                /**< Whether the cursor has been placed in the history */
+  unsigned char  sent;                  /**< Whether a packet has been sent since the cursor was placed */
+  unsigned short checkpoint;            /**< The serial of the last packet the peer acknowledged */
+  unsigned short checkpoint_pkt_seqnum; /**< The peer's sequence number of the first unacknowledged packet */
+  unsigned short seqnums[RTPMIDI_CURSOR_PACKETS]; /**< The sequence numbers of recent packets */
+  unsigned short serials[RTPMIDI_CURSOR_PACKETS]; /**< The serials the recent packets were sent with */
+};
+
 struct RTPMIDIPeerInfo {
   struct RTPMIDIJournal * receive_journal;
-  struct RTPMIDIJournal * send_journal;
+  struct MIDISysExAssembler * receive_sysex;
+  struct RTPMIDIPeerCursor send_cursor;
   void * info;
 };
 
@@ -92,6 +239,38 @@ struct RTPMIDISession {
   struct RTPMIDIInfo   midi_info;
   struct RTPPacketInfo rtp_info;
   struct RTPSession  * rtp_session;
+  struct MIDIMessagePool * message_pool;
+  struct MIDIDriverProfile * profile;
+  MIDIBoolean ump;
+
+  unsigned short send_serial;
+  unsigned short send_checkpoint;
+  struct RTPMIDIJournal * send_journal;
+  unsigned char  repair_pending;
+  unsigned short repair_checkpoint;
+
+  size_t pending_next;
+  size_t pending_count;
+  struct RTPPacketInfo pending[RTPMIDI_RECV_PACKETS];
+
+  struct MIDIMessageQueue * sysex_queue;
+  struct MIDIMessage      * sysex_message;
+  struct MIDISysExBuffer  * sysex_buffer;
+  unsigned char * sysex;
+  unsigned char   sysex_header[4];
+  size_t          sysex_header_size;
+  size_t          sysex_size;
+  size_t          sysex_offset;
+  MIDITimestamp   sysex_timestamp;
+  unsigned long   sysex_rate;
+  struct timespec sysex_due;
+  MIDIBoolean     sysex_assemble;
+  size_t          sysex_max_size;
+
+  struct MIDICompactMessage * forward;
+  size_t          forward_count;
+  unsigned char * forward_payload;
+  MIDITimestamp   forward_timestamp;
 
   size_t size;
   void * buffer;
@@ -100,6 +279,9 @@ struct RTPMIDISession {
 
 /** @} */
 
+static struct RTPMIDIJournal * _rtpmidi_journal_create();
+static void _rtpmidi_journal_destroy( struct RTPMIDIJournal * journal );
+
 /* MARK: Creation and destruction *//**
  * @name Creation and destruction
  * Creating, destroying and reference counting of RTPMIDISession objects.
@@ -127,7 +309,46 @@ struct RTPMIDISession * RTPMIDISessionCreate( struct RTPSession * rtp_session )
   session->midi_info.phantom = 0;
   session->midi_info.len     = 0;
 
-  session->size   = 512;
+  session->message_pool = MIDIMessagePoolCreate( RTPMIDI_MESSAGE_POOL_SIZE );
+  session->profile      = NULL;
+  session->ump          = 0;
+
+  session->send_serial     = 0;
+  session->send_checkpoint = 0;
+  session->repair_pending    = 0;
+  session->repair_checkpoint = 0;
+  session->send_journal = _rtpmidi_journal_create();
+  if( session->send_journal == NULL ) {
+    if( session->message_pool != NULL ) MIDIMessagePoolRelease( session->message_pool );
+    RTPSessionRelease( rtp_session );
+    free( session );
+    return NULL;
+  }
+
+  session->pending_next  = 0;
+  session->pending_count = 0;
+
+  session->sysex_queue  = NULL;
+  session->sysex_message = NULL;
+  session->sysex_buffer  = NULL;
+  session->sysex        = NULL;
+  session->sysex_header_size = 0;
+  session->sysex_size   = 0;
+  session->sysex_offset = 0;
+  session->sysex_timestamp = 0;
+  session->sysex_rate   = 0;
+  session->sysex_due.tv_sec  = 0;
+  session->sysex_due.tv_nsec = 0;
+  session->sysex_assemble = 0;
+  session->sysex_max_size = 0;
+
+  session->forward         = NULL;
+  session->forward_count   = 0;
+  session->forward_payload = NULL;
+  session->forward_timestamp = 0;
+
+  /* commands and headers plus one journal for each peer of a batch */
+  session->size   = RTPMIDI_COMMAND_SIZE + 4 + RTPMIDI_SEND_PEERS * RTPMIDI_JOURNAL_SIZE;
   session->buffer = malloc( session->size );
   if( session->buffer == NULL ) {
     session->size = 0;
@@ -135,6 +356,17 @@ struct RTPMIDISession * RTPMIDISessionCreate( struct RTPSession * rtp_session )
   return session;
 }
 
+static void _rtpmidi_peer_info_destroy( struct RTPPeer * peer ) {
+  struct RTPMIDIPeerInfo * info = NULL;
+  RTPPeerGetInfo( peer, (void **) &info );
+  if( info != NULL ) {
+    if( info->receive_journal != NULL ) _rtpmidi_journal_destroy( info->receive_journal );
+    if( info->receive_sysex != NULL ) MIDISysExAssemblerRelease( info->receive_sysex );
+    free( info );
+    RTPPeerSetInfo( peer, NULL );
+  }
+}
+
 /**
  * @brief Destroy an RTPMIDISession instance.
  * Free all resources occupied by the session and release the
@@ -143,10 +375,28 @@ struct RTPMIDISession * RTPMIDISessionCreate( struct RTPSession * rtp_session )
  * @param session The session.
  */
 void RTPMIDISessionDestroy( struct RTPMIDISession * session ) {
+  struct RTPPeer * peer = NULL;
+
+  /* drop the journals of the remaining peers and the group */
+  RTPSessionNextPeer( session->rtp_session, &peer );
+  while( peer != NULL ) {
+    _rtpmidi_peer_info_destroy( peer );
+    RTPSessionNextPeer( session->rtp_session, &peer );
+  }
+  RTPSessionGetMulticastGroup( session->rtp_session, &peer );
+  if( peer != NULL ) _rtpmidi_peer_info_destroy( peer );
   RTPSessionRelease( session->rtp_session );
+  _rtpmidi_journal_destroy( session->send_journal );
+  if( session->message_pool != NULL ) {
+    MIDIMessagePoolRelease( session->message_pool );
+  }
   if( session->size > 0 && session->buffer != NULL ) {
     free( session->buffer );
   }
+  RTPMIDISessionCancelSysEx( session );
+  if( session->sysex_queue != NULL ) {
+    MIDIMessageQueueRelease( session->sysex_queue );
+  }
   free( session );
 }
 
@@ -157,7 +407,7 @@ void RTPMIDISessionDestroy( struct RTPMIDISession * session ) {
  * @param session The session.
  */
 void RTPMIDISessionRetain( struct RTPMIDISession * session ) {
-  session->refs++;
+  MIDIRefRetain( session->refs );
 }
 
 /**
@@ -168,13 +418,243 @@ void RTPMIDISessionRetain( struct RTPMIDISession * session ) {
  * @param session The session.
  */
 void RTPMIDISessionRelease( struct RTPMIDISession * session ) {
-  if( ! --session->refs ) {
+  if( ! MIDIRefRelease( session->refs ) ) {
     RTPMIDISessionDestroy( session );
   }
 }
 
 /** @} */
 
+/* MARK: RTP-MIDI journal state *//**
+ * @name RTP-MIDI journal state
+ * Functions for keeping track of the session state that the journals
+ * describe.
+ * @{
+ */
+
+static int _rtpmidi_seqnum_newer( unsigned short seqnum, unsigned short other ) {
+  return (short) (seqnum - other) > 0;
+}
+
+static struct RTPMIDIJournal * _rtpmidi_journal_create() {
+  struct RTPMIDIJournal * journal = malloc( sizeof( struct RTPMIDIJournal ) );
+  int i;
+  if( journal == NULL ) return NULL;
+  journal->enhanced_chapter_c    = 0;
+  journal->total_channels        = 0;
+  journal->checkpoint_pkt_seqnum = 0;
+  journal->received              = 0;
+  journal->last_pkt_seqnum       = 0;
+  journal->system_journal        = NULL;
+  for( i=0; i<16; i++ ) {
+    journal->channel_journals[i] = NULL;
+  }
+  journal->size   = 0;
+  journal->buffer = NULL;
+  return journal;
+}
+
+/**
+ * @brief Get the journal of a channel, create it if it is not used yet.
+ * @memberof RTPMIDIJournal
+ * @param journal The journal.
+ * @param channel The channel number.
+ * @return the channel journal or @c NULL if it could not be created.
+ */
+static struct RTPMIDIChannelJournal * _rtpmidi_channel_journal( struct RTPMIDIJournal * journal, unsigned char channel ) {
+  struct RTPMIDIChannelJournal * cj = journal->channel_journals[channel & 0xf];
+  if( cj != NULL ) return cj;
+
+  cj = malloc( sizeof( struct RTPMIDIChannelJournal ) );
+  if( cj == NULL ) return NULL;
+  cj->checkpoint_pkt_seqnum = 0;
+  cj->enhanced_chapter_c    = 0;
+  cj->channel               = channel & 0xf;
+  cj->toc                   = 0;
+  cj->program_seqnum        = 0;
+  cj->program               = RTPMIDI_JOURNAL_UNSET;
+  cj->program_bank_msb      = RTPMIDI_JOURNAL_UNSET;
+  cj->program_bank_lsb      = RTPMIDI_JOURNAL_UNSET;
+  cj->wheel_seqnum          = 0;
+  cj->wheel_lsb             = RTPMIDI_JOURNAL_UNSET;
+  cj->wheel_msb             = RTPMIDI_JOURNAL_UNSET;
+  cj->controllers           = 0;
+  cj->notes                 = 0;
+  memset( &(cj->controller_index[0]), RTPMIDI_JOURNAL_UNSET, sizeof(cj->controller_index) );
+  memset( &(cj->controller_value[0]), RTPMIDI_JOURNAL_UNSET, sizeof(cj->controller_value) );
+  memset( &(cj->note_index[0]), RTPMIDI_JOURNAL_UNSET, sizeof(cj->note_index) );
+  memset( &(cj->note_velocity[0]), 0, sizeof(cj->note_velocity) );
+
+  journal->channel_journals[channel & 0xf] = cj;
+  journal->total_channels++;
+  return cj;
+}
+
+static void _rtpmidi_journal_destroy( struct RTPMIDIJournal * journal ) {
+  int i;
+  for( i=0; i<16; i++ ) {
+    if( journal->channel_journals[i] != NULL ) {
+      free( journal->channel_journals[i] );
+    }
+  }
+  free( journal );
+}
+
+static int _rtpmidi_journal_empty( struct RTPMIDIJournal * journal ) {
+  int i;
+  for( i=0; i<16; i++ ) {
+    if( journal->channel_journals[i] != NULL && journal->channel_journals[i]->toc != 0 ) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static void _rtpmidi_channel_journal_log_note( struct RTPMIDIChannelJournal * cj, unsigned short seqnum,
+                                               unsigned char note, unsigned char velocity ) {
+  cj->note_velocity[note] = velocity;
+  cj->note_seqnum[note]   = seqnum;
+  if( cj->note_index[note] == RTPMIDI_JOURNAL_UNSET ) {
+    cj->note_index[note] = cj->notes;
+    cj->note_log[cj->notes++] = note;
+  }
+  cj->toc |= RTPMIDI_CHAPTER_N;
+}
+
+static void _rtpmidi_channel_journal_log_controller( struct RTPMIDIChannelJournal * cj, unsigned short seqnum,
+                                                     unsigned char controller, unsigned char value ) {
+  cj->controller_value[controller]  = value;
+  cj->controller_seqnum[controller] = seqnum;
+  if( cj->controller_index[controller] == RTPMIDI_JOURNAL_UNSET ) {
+    cj->controller_index[controller] = cj->controllers;
+    cj->controller_log[cj->controllers++] = controller;
+  }
+  cj->toc |= RTPMIDI_CHAPTER_C;
+}
+
+/**
+ * @brief Update the channel state with a single channel voice message.
+ * @memberof RTPMIDIChannelJournal
+ * @param cj     The channel journal.
+ * @param seqnum The sequence number of the packet containing the message.
+ * @param m      The status byte and data bytes of the message.
+ */
+static void _rtpmidi_channel_journal_store( struct RTPMIDIChannelJournal * cj, unsigned short seqnum, unsigned char * m ) {
+  int i;
+  switch( m[0] >> 4 ) {
+    case MIDI_STATUS_NOTE_OFF:
+      _rtpmidi_channel_journal_log_note( cj, seqnum, m[1] & 0x7f, 0 );
+      break;
+    case MIDI_STATUS_NOTE_ON:
+      _rtpmidi_channel_journal_log_note( cj, seqnum, m[1] & 0x7f, m[2] & 0x7f );
+      break;
+    case MIDI_STATUS_CONTROL_CHANGE:
+      _rtpmidi_channel_journal_log_controller( cj, seqnum, m[1] & 0x7f, m[2] & 0x7f );
+      if( m[1] == 120 || m[1] >= 123 ) {
+        /* all sound off, all notes off and mode changes end all notes */
+        for( i=0; i<128; i++ ) {
+          if( cj->note_velocity[i] != 0 ) {
+            _rtpmidi_channel_journal_log_note( cj, seqnum, i, 0 );
+          }
+        }
+      }
+      break;
+    case MIDI_STATUS_PROGRAM_CHANGE:
+      cj->program          = m[1] & 0x7f;
+      cj->program_bank_msb = cj->controller_value[0];
+      cj->program_bank_lsb = cj->controller_value[32];
+      cj->program_seqnum   = seqnum;
+      cj->toc |= RTPMIDI_CHAPTER_P;
+      break;
+    case MIDI_STATUS_PITCH_WHEEL_CHANGE:
+      cj->wheel_lsb    = m[1] & 0x7f;
+      cj->wheel_msb    = m[2] & 0x7f;
+      cj->wheel_seqnum = seqnum;
+      cj->toc |= RTPMIDI_CHAPTER_W;
+      break;
+  }
+}
+
+/**
+ * @brief Trunkate a channel journal.
+ * Remove all log entries that are not newer than @c seqnum.
+ * @memberof RTPMIDIChannelJournal
+ * @param cj     The channel journal.
+ * @param seqnum The sequence number.
+ */
+static void _rtpmidi_channel_journal_trunkate( struct RTPMIDIChannelJournal * cj, unsigned short seqnum ) {
+  unsigned char i, n, x;
+
+  for( i=0, n=0; i<cj->controllers; i++ ) {
+    x = cj->controller_log[i];
+    if( _rtpmidi_seqnum_newer( cj->controller_seqnum[x], seqnum ) ) {
+      cj->controller_index[x] = n;
+      cj->controller_log[n++] = x;
+    } else {
+      cj->controller_index[x] = RTPMIDI_JOURNAL_UNSET;
+    }
+  }
+  cj->controllers = n;
+
+  for( i=0, n=0; i<cj->notes; i++ ) {
+    x = cj->note_log[i];
+    if( _rtpmidi_seqnum_newer( cj->note_seqnum[x], seqnum ) ) {
+      cj->note_index[x] = n;
+      cj->note_log[n++] = x;
+    } else {
+      cj->note_index[x] = RTPMIDI_JOURNAL_UNSET;
+    }
+  }
+  cj->notes = n;
+
+  if( cj->controllers == 0 ) cj->toc &= ~RTPMIDI_CHAPTER_C;
+  if( cj->notes == 0 )       cj->toc &= ~RTPMIDI_CHAPTER_N;
+  if( ! _rtpmidi_seqnum_newer( cj->program_seqnum, seqnum ) ) cj->toc &= ~RTPMIDI_CHAPTER_P;
+  if( ! _rtpmidi_seqnum_newer( cj->wheel_seqnum, seqnum ) )   cj->toc &= ~RTPMIDI_CHAPTER_W;
+  cj->checkpoint_pkt_seqnum = seqnum + 1;
+}
+
+/**
+ * @brief Put a message into the next entry of a message list.
+ * @param pool      The pool to take the message from if the entry is empty.
+ * @param messages  A pointer to the list entry, advanced to the next entry.
+ * @param timestamp The timestamp of the message.
+ * @param m         The status byte and data bytes of the message.
+ * @retval 0 on success.
+ * @retval >0 if the list is full or the message could not be created.
+ */
+static int _rtpmidi_journal_emit( struct MIDIMessagePool * pool, struct MIDIMessageList ** messages,
+                                  MIDITimestamp timestamp, unsigned char * m ) {
+  size_t read;
+  if( *messages == NULL ) return 1;
+  if( (*messages)->message == NULL ) {
+    (*messages)->message = MIDIMessageCreateFromPool( pool, 0 );
+    if( (*messages)->message == NULL ) return 1;
+  }
+  if( MIDIMessageDecode( (*messages)->message, 3, m, &read ) ) return 1;
+  MIDIMessageSetTimestamp( (*messages)->message, timestamp );
+  *messages = (*messages)->next;
+  return 0;
+}
+
+/**
+ * @brief Emit a recovery message and apply it to the receiver's state.
+ */
+static int _rtpmidi_journal_recover( struct RTPMIDISession * session, struct RTPMIDIChannelJournal * cj,
+                                     unsigned short seqnum, struct MIDIMessageList ** messages, MIDITimestamp timestamp,
+                                     unsigned char status, unsigned char data1, unsigned char data2 ) {
+  unsigned char m[3];
+  m[0] = ( status << 4 ) | cj->channel;
+  m[1] = data1;
+  m[2] = data2;
+  if( _rtpmidi_journal_emit( session->message_pool, messages, timestamp, &(m[0]) ) ) return 1;
+  _rtpmidi_channel_journal_store( cj, seqnum, &(m[0]) );
+  MIDIProfileAdd( session->profile, recovered, 1 );
+  return 0;
+}
+
+/** @} */
+
 /* MARK: RTP-MIDI journal coding *//**
  * @name RTP-MIDI journal coding
  * Functions for encoding the various journals and their chapters to a
@@ -182,59 +662,419 @@ void RTPMIDISessionRelease( struct RTPMIDISession * session ) {
  * @{
  */
 
+/**
+ * @brief Encode one channel journal to a stream.
+ * Only chapters P, C, W and N are coded. Only the changes made after
+ * @c checkpoint are written, if there are none nothing is written.
+ * @memberof RTPMIDIChannelJournal
+ * @param cj         The channel journal.
+ * @param checkpoint The serial of the last packet the receiver acknowledged.
+ * @param size       The number of available bytes in the buffer.
+ * @param buffer     The buffer to write the channel journal to.
+ * @param written    The number of bytes written to the stream.
+ * @retval 0 on success.
+ * @retval >0 if the channel journal does not fit into the buffer.
+ */
+static int _rtpmidi_channel_journal_encode( struct RTPMIDIChannelJournal * cj, unsigned short checkpoint,
+                                            size_t size, unsigned char * buffer, size_t * written ) {
+  size_t p = 3, length;
+  unsigned char i, x, n, controllers = 0, low = 15, high = 0, offbits[16] = { 0 };
+  unsigned char toc = 0;
+
+  *written = 0;
+  if( ( cj->toc & RTPMIDI_CHAPTER_P ) && _rtpmidi_seqnum_newer( cj->program_seqnum, checkpoint ) ) {
+    toc |= RTPMIDI_CHAPTER_P;
+  }
+  if( cj->toc & RTPMIDI_CHAPTER_C ) {
+    for( i=0; i<cj->controllers; i++ ) {
+      if( _rtpmidi_seqnum_newer( cj->controller_seqnum[cj->controller_log[i]], checkpoint ) ) controllers++;
+    }
+    if( controllers > 0 ) toc |= RTPMIDI_CHAPTER_C;
+  }
+  if( ( cj->toc & RTPMIDI_CHAPTER_W ) && _rtpmidi_seqnum_newer( cj->wheel_seqnum, checkpoint ) ) {
+    toc |= RTPMIDI_CHAPTER_W;
+  }
+  if( cj->toc & RTPMIDI_CHAPTER_N ) {
+    for( i=0; i<cj->notes; i++ ) {
+      if( _rtpmidi_seqnum_newer( cj->note_seqnum[cj->note_log[i]], checkpoint ) ) {
+        toc |= RTPMIDI_CHAPTER_N;
+        break;
+      }
+    }
+  }
+  if( toc == 0 ) return 0;
+
+  if( size < 3 ) return 1;
+  if( toc & RTPMIDI_CHAPTER_P ) {
+    if( size < p+3 ) return 1;
+    buffer[p++] = cj->program;
+    if( cj->program_bank_msb != RTPMIDI_JOURNAL_UNSET || cj->program_bank_lsb != RTPMIDI_JOURNAL_UNSET ) {
+      buffer[p++] = 0x80 | ( ( cj->program_bank_msb == RTPMIDI_JOURNAL_UNSET ) ? 0 : cj->program_bank_msb );
+      buffer[p++] = ( cj->program_bank_lsb == RTPMIDI_JOURNAL_UNSET ) ? 0 : cj->program_bank_lsb;
+    } else {
+      buffer[p++] = 0;
+      buffer[p++] = 0;
+    }
+  }
+  if( toc & RTPMIDI_CHAPTER_C ) {
+    if( size < p+1+controllers*2 ) return 1;
+    buffer[p++] = controllers - 1;
+    for( i=0; i<cj->controllers; i++ ) {
+      x = cj->controller_log[i];
+      if( ! _rtpmidi_seqnum_newer( cj->controller_seqnum[x], checkpoint ) ) continue;
+      buffer[p++] = x;
+      buffer[p++] = cj->controller_value[x];
+    }
+  }
+  if( toc & RTPMIDI_CHAPTER_W ) {
+    if( size < p+2 ) return 1;
+    buffer[p++] = cj->wheel_lsb;
+    buffer[p++] = cj->wheel_msb;
+  }
+  if( toc & RTPMIDI_CHAPTER_N ) {
+    /* sounding notes go to the note logs, released ones to the offbits */
+    for( i=0, n=0; i<cj->notes; i++ ) {
+      x = cj->note_log[i];
+      if( ! _rtpmidi_seqnum_newer( cj->note_seqnum[x], checkpoint ) ) continue;
+      if( cj->note_velocity[x] == 0 ) {
+        offbits[x >> 3] |= 0x80 >> (x & 7);
+        if( (x >> 3) < low )  low  = x >> 3;
+        if( (x >> 3) > high ) high = x >> 3;
+      } else if( n < 127 ) {
+        n++;
+      }
+    }
+    if( low > high ) {
+      low  = 15;
+      high = 0;
+    }
+    length = 2 + n*2 + ( ( low <= high ) ? high-low+1 : 0 );
+    if( size < p+length ) return 1;
+    buffer[p++] = n;
+    buffer[p++] = ( low << 4 ) | high;
+    for( i=0; n>0 && i<cj->notes; i++ ) {
+      x = cj->note_log[i];
+      if( cj->note_velocity[x] != 0 && _rtpmidi_seqnum_newer( cj->note_seqnum[x], checkpoint ) ) {
+        buffer[p++] = x;
+        buffer[p++] = 0x80 | cj->note_velocity[x];
+        n--;
+      }
+    }
+    for( x=low; x<=high && high>=low; x++ ) {
+      buffer[p++] = offbits[x];
+    }
+  }
+
+  if( p > 0x3ff ) return 1;
+  buffer[0] = ( cj->channel << 3 ) | ( ( p >> 8 ) & 0x03 );
+  buffer[1] = p & 0xff;
+  buffer[2] = toc;
+  *written = p;
+  return 0;
+}
+
 /**
  * @brief Encode the RTP-MIDI history to a stream.
+ * Write the channel journals of the changes made after @c checkpoint. The
+ * result does not depend on the receiver otherwise, so it can be shared by
+ * all peers that acknowledged the same packet. The journal header holds
+ * the receiver's sequence number and is written by
+ * @ref _rtpmidi_journal_encode_header. If there are no changes nothing is
+ * written and the packet should be sent without a journal.
  * @memberof RTPMIDIJournal
- * @param session The session.
- * @param journal The journal.
- * @param size    The number of available bytes in the buffer.
- * @param buffer  The buffer to write the journal to.
- * @param written The number of bytes written to the stream.
+ * @param journal    The journal.
+ * @param checkpoint The serial of the last packet the receiver acknowledged.
+ * @param size       The number of available bytes in the buffer.
+ * @param buffer     The buffer to write the channel journals to.
+ * @param written    The number of bytes written to the stream.
+ * @param channels   The number of channel journals that were written.
+ * @retval 0 on success.
+ * @retval >0 if the journal does not fit into the buffer.
  */
-static int _rtpmidi_journal_encode( struct RTPMIDISession * session, struct RTPMIDIJournal * journal,
-                                    size_t size, void * buffer, size_t * written ) {
-  *written = 0;
+static int _rtpmidi_journal_encode( struct RTPMIDIJournal * journal, unsigned short checkpoint,
+                                    size_t size, void * buffer, size_t * written, int * channels ) {
+  unsigned char * bytes = buffer;
+  size_t p = 0, w;
+  int i;
+
+  *written  = 0;
+  *channels = 0;
+  if( journal == NULL || _rtpmidi_journal_empty( journal ) ) return 0;
+
+  for( i=0; i<16; i++ ) {
+    if( journal->channel_journals[i] != NULL && journal->channel_journals[i]->toc != 0 ) {
+      if( _rtpmidi_channel_journal_encode( journal->channel_journals[i], checkpoint, size-p, bytes+p, &w ) ) return 1;
+      if( w > 0 ) {
+        p += w;
+        (*channels)++;
+      }
+    }
+  }
+  *written = p;
+  return 0;
+}
+
+/**
+ * @brief Encode the header of a journal.
+ * @memberof RTPMIDIJournal
+ * @param channels The number of channel journals that follow.
+ * @param seqnum   The receiver's sequence number of the checkpoint packet.
+ * @param buffer   The buffer to write the three header bytes to.
+ */
+static void _rtpmidi_journal_encode_header( int channels, unsigned short seqnum, unsigned char * buffer ) {
+  buffer[0] = 0x20 | ( ( channels - 1 ) & 0x0f ); /* S=0, Y=0, A=1, H=0 */
+  buffer[1] = ( seqnum >> 8 ) & 0xff;
+  buffer[2] =   seqnum        & 0xff;
+}
+
+/**
+ * @brief Decode one channel journal and recover the state it describes.
+ * Chapters that come after an unsupported chapter are skipped.
+ */
+static int _rtpmidi_channel_journal_decode( struct RTPMIDISession * session, struct RTPMIDIChannelJournal * cj,
+                                            unsigned short seqnum, MIDITimestamp timestamp, struct MIDIMessageList ** messages,
+                                            size_t size, unsigned char * buffer ) {
+  size_t p = 3;
+  unsigned char toc = buffer[2];
+  unsigned char i, n, x, value, low, high;
+
+  if( toc & RTPMIDI_CHAPTER_P ) {
+    if( size < p+3 ) return 1;
+    x = buffer[p] & 0x7f;
+    if( cj->program != x ) {
+      if( buffer[p+1] & 0x80 ) {
+        if( cj->controller_value[0] != ( buffer[p+1] & 0x7f ) ) {
+          _rtpmidi_journal_recover( session, cj, seqnum, messages, timestamp, MIDI_STATUS_CONTROL_CHANGE, 0, buffer[p+1] & 0x7f );
+        }
+        if( cj->controller_value[32] != ( buffer[p+2] & 0x7f ) ) {
+          _rtpmidi_journal_recover( session, cj, seqnum, messages, timestamp, MIDI_STATUS_CONTROL_CHANGE, 32, buffer[p+2] & 0x7f );
+        }
+      }
+      _rtpmidi_journal_recover( session, cj, seqnum, messages, timestamp, MIDI_STATUS_PROGRAM_CHANGE, x, 0 );
+    }
+    p += 3;
+  }
+  if( toc & RTPMIDI_CHAPTER_C ) {
+    if( size < p+1 ) return 1;
+    n = ( buffer[p++] & 0x7f ) + 1;
+    if( size < p+n*2 ) return 1;
+    for( i=0; i<n; i++, p+=2 ) {
+      x     = buffer[p] & 0x7f;
+      value = buffer[p+1] & 0x7f;
+      if( ( buffer[p+1] & 0x80 ) == 0 && cj->controller_value[x] != value ) {
+        _rtpmidi_journal_recover( session, cj, seqnum, messages, timestamp, MIDI_STATUS_CONTROL_CHANGE, x, value );
+      }
+    }
+  }
+  if( toc & RTPMIDI_CHAPTER_M ) return 0;
+  if( toc & RTPMIDI_CHAPTER_W ) {
+    if( size < p+2 ) return 1;
+    if( cj->wheel_lsb != ( buffer[p] & 0x7f ) || cj->wheel_msb != ( buffer[p+1] & 0x7f ) ) {
+      _rtpmidi_journal_recover( session, cj, seqnum, messages, timestamp, MIDI_STATUS_PITCH_WHEEL_CHANGE,
+                                buffer[p] & 0x7f, buffer[p+1] & 0x7f );
+    }
+    p += 2;
+  }
+  if( toc & RTPMIDI_CHAPTER_N ) {
+    if( size < p+2 ) return 1;
+    n    = buffer[p] & 0x7f;
+    low  = buffer[p+1] >> 4;
+    high = buffer[p+1] & 0x0f;
+    p += 2;
+    if( size < p+n*2 ) return 1;
+    for( i=0; i<n; i++, p+=2 ) {
+      x     = buffer[p] & 0x7f;
+      value = buffer[p+1] & 0x7f;
+      if( cj->note_velocity[x] == 0 && value != 0 ) {
+        _rtpmidi_journal_recover( session, cj, seqnum, messages, timestamp, MIDI_STATUS_NOTE_ON, x, value );
+      }
+    }
+    for( ; low<=high; low++, p++ ) {
+      if( size < p+1 ) return 1;
+      for( i=0; i<8; i++ ) {
+        x = ( low << 3 ) + i;
+        if( ( buffer[p] & ( 0x80 >> i ) ) && cj->note_velocity[x] != 0 ) {
+          _rtpmidi_journal_recover( session, cj, seqnum, messages, timestamp, MIDI_STATUS_NOTE_OFF, x, 64 );
+        }
+      }
+    }
+  }
   return 0;
 }
 
 /**
  * @brief Decode the RTP-MIDI history from a stream.
+ * Compare the state coded in the journal with the state the receiver has
+ * seen and write messages that repair the difference to the list.
+ * The system journal is skipped.
  * @memberof RTPMIDIJournal
- * @param session The session.
- * @param journal The journal.
- * @param size    The number of available bytes in the buffer.
- * @param buffer  The buffer to read the journal from.
- * @param read    The number of bytes read from the stream.
+ * @param session   The session.
+ * @param journal   The receive journal holding the receiver's state.
+ * @param seqnum    The sequence number of the packet containing the journal.
+ * @param timestamp The timestamp to use for recovered messages.
+ * @param messages  A pointer to the list to store the recovered messages in,
+ *                  advanced past the used entries.
+ * @param size      The number of available bytes in the buffer.
+ * @param buffer    The buffer to read the journal from.
+ * @param read      The number of bytes read from the stream.
+ * @retval 0 on success.
+ * @retval >0 if the journal is corrupted.
  */
 static int _rtpmidi_journal_decode( struct RTPMIDISession * session, struct RTPMIDIJournal * journal,
+                                    unsigned short seqnum, MIDITimestamp timestamp, struct MIDIMessageList ** messages,
                                     size_t size, void * buffer, size_t * read ) {
+  unsigned char * bytes = buffer;
+  struct RTPMIDIChannelJournal * cj;
+  size_t p = 3, length;
+  int i, channels;
+
   *read = 0;
+  if( size < 3 ) return 1;
+  channels = ( bytes[0] & 0x0f ) + 1;
+  if( bytes[0] & 0x40 ) {
+    /* system journal */
+    if( size < p+2 ) return 1;
+    length = ( ( bytes[p] & 0x03 ) << 8 ) | bytes[p+1];
+    if( length < 2 || size < p+length ) return 1;
+    p += length;
+  }
+  if( bytes[0] & 0x20 ) {
+    for( i=0; i<channels; i++ ) {
+      if( size < p+3 ) return 1;
+      length = ( ( bytes[p] & 0x03 ) << 8 ) | bytes[p+1];
+      if( length < 3 || size < p+length ) return 1;
+      cj = _rtpmidi_channel_journal( journal, ( bytes[p] >> 3 ) & 0x0f );
+      if( cj != NULL ) {
+        _rtpmidi_channel_journal_decode( session, cj, seqnum, timestamp, messages, length, bytes+p );
+      }
+      p += length;
+    }
+  }
+  *read = p;
   return 0;
 }
 
 /**
  * @brief Store a list of messages in the journal.
+ * Update the state of the channels the messages address. The list ends at
+ * the first entry without a message or at @c end.
  * @memberof RTPMIDIJournal
  * @param journal    The journal.
  * @param checkpoint The sequence number of the packet that contains the messages.
  * @param messages   The list of messages to store.
+ * @param end        The first list entry not to store or @c NULL.
  */
 static int _rtpmidi_journal_encode_messages( struct RTPMIDIJournal * journal, unsigned short checkpoint,
-                                             struct MIDIMessageList * messages ) {
-/*struct MIDIMessage * message;*/
+                                             struct MIDIMessageList * messages, struct MIDIMessageList * end ) {
+  struct RTPMIDIChannelJournal * cj;
+  unsigned char m[4];
+  MIDIStatus status;
+  size_t written;
+
+  if( journal == NULL ) return 0;
+  if( _rtpmidi_journal_empty( journal ) ) {
+    journal->checkpoint_pkt_seqnum = checkpoint;
+  }
+  for( ; messages != end && messages != NULL && messages->message != NULL; messages = messages->next ) {
+    MIDIMessageGetStatus( messages->message, &status );
+    if( status < MIDI_STATUS_NOTE_OFF || status > MIDI_STATUS_PITCH_WHEEL_CHANGE ) continue;
+    if( MIDIMessageEncode( messages->message, sizeof(m), &(m[0]), &written ) ) continue;
+    cj = _rtpmidi_channel_journal( journal, m[0] & 0x0f );
+    if( cj != NULL ) {
+      _rtpmidi_channel_journal_store( cj, checkpoint, &(m[0]) );
+    }
+  }
+  if( ! journal->received || _rtpmidi_seqnum_newer( checkpoint, journal->last_pkt_seqnum ) ) {
+    journal->last_pkt_seqnum = checkpoint;
+    journal->received = 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Store an array of compact messages in the journal.
+ * Like @ref _rtpmidi_journal_encode_messages but for messages that were
+ * forwarded without being decoded.
+ * @memberof RTPMIDIJournal
+ * @param journal    The journal.
+ * @param checkpoint The sequence number of the packet that contains the messages.
+ * @param count      The number of messages to store.
+ * @param messages   The messages.
+ */
+static int _rtpmidi_journal_encode_compact( struct RTPMIDIJournal * journal, unsigned short checkpoint,
+                                            size_t count, struct MIDICompactMessage * messages ) {
+  struct RTPMIDIChannelJournal * cj;
+  unsigned char m[4];
+  size_t i;
+
+  if( journal == NULL ) return 0;
+  if( _rtpmidi_journal_empty( journal ) ) {
+    journal->checkpoint_pkt_seqnum = checkpoint;
+  }
+  for( i=0; i<count; i++ ) {
+    if( messages[i].bytes[0] < 0x80 || messages[i].bytes[0] >= 0xf0 ) continue;
+    m[0] = messages[i].bytes[0];
+    m[1] = messages[i].bytes[1];
+    m[2] = messages[i].bytes[2];
+    m[3] = 0;
+    cj = _rtpmidi_channel_journal( journal, m[0] & 0x0f );
+    if( cj != NULL ) {
+      _rtpmidi_channel_journal_store( cj, checkpoint, &(m[0]) );
+    }
+  }
+  if( ! journal->received || _rtpmidi_seqnum_newer( checkpoint, journal->last_pkt_seqnum ) ) {
+    journal->last_pkt_seqnum = checkpoint;
+    journal->received = 1;
+  }
   return 0;
 }
 
 /**
  * @brief Restore a list of messages from the journal.
+ * Write messages that reproduce every change made after @c checkpoint.
  * @memberof RTPMIDIJournal
  * @param journal    The journal.
+ * @param pool       The pool to take messages for empty list entries from.
  * @param checkpoint The sequence number of the packet that contains the messages.
  * @param messages   The list to store the recovered messages in.
  */
-static int _rtpmidi_journal_decode_messages( struct RTPMIDIJournal * journal, unsigned short checkpoint,
-                                             struct MIDIMessageList * messages ) {
-/*struct MIDIMessage * message;*/
+static int _rtpmidi_journal_decode_messages( struct RTPMIDIJournal * journal, struct MIDIMessagePool * pool,
+                                             unsigned short checkpoint, struct MIDIMessageList * messages ) {
+  struct RTPMIDIChannelJournal * cj;
+  unsigned char m[3], i, x;
+  int c;
+
+  for( c=0; c<16; c++ ) {
+    cj = journal->channel_journals[c];
+    if( cj == NULL ) continue;
+    if( cj->program != RTPMIDI_JOURNAL_UNSET && _rtpmidi_seqnum_newer( cj->program_seqnum, checkpoint ) ) {
+      m[0] = ( MIDI_STATUS_PROGRAM_CHANGE << 4 ) | c;
+      m[1] = cj->program;
+      if( _rtpmidi_journal_emit( pool, &messages, 0, &(m[0]) ) ) return 1;
+    }
+    for( i=0; i<cj->controllers; i++ ) {
+      x = cj->controller_log[i];
+      if( ! _rtpmidi_seqnum_newer( cj->controller_seqnum[x], checkpoint ) ) continue;
+      m[0] = ( MIDI_STATUS_CONTROL_CHANGE << 4 ) | c;
+      m[1] = x;
+      m[2] = cj->controller_value[x];
+      if( _rtpmidi_journal_emit( pool, &messages, 0, &(m[0]) ) ) return 1;
+    }
+    if( cj->wheel_lsb != RTPMIDI_JOURNAL_UNSET && _rtpmidi_seqnum_newer( cj->wheel_seqnum, checkpoint ) ) {
+      m[0] = ( MIDI_STATUS_PITCH_WHEEL_CHANGE << 4 ) | c;
+      m[1] = cj->wheel_lsb;
+      m[2] = cj->wheel_msb;
+      if( _rtpmidi_journal_emit( pool, &messages, 0, &(m[0]) ) ) return 1;
+    }
+    for( i=0; i<cj->notes; i++ ) {
+      x = cj->note_log[i];
+      if( ! _rtpmidi_seqnum_newer( cj->note_seqnum[x], checkpoint ) ) continue;
+      m[0] = ( ( cj->note_velocity[x] ? MIDI_STATUS_NOTE_ON : MIDI_STATUS_NOTE_OFF ) << 4 ) | c;
+      m[1] = x;
+      m[2] = cj->note_velocity[x] ? cj->note_velocity[x] : 64;
+      if( _rtpmidi_journal_emit( pool, &messages, 0, &(m[0]) ) ) return 1;
+    }
+  }
   return 0;
 }
 
@@ -248,12 +1088,116 @@ static int _rtpmidi_journal_decode_messages( struct RTPMIDIJournal * journal, un
 
 static void * _rtpmidi_peer_info_create() {
   struct RTPMIDIPeerInfo * info = malloc( sizeof( struct RTPMIDIPeerInfo ) );
-  info->send_journal = NULL;
+  if( info == NULL ) return NULL;
+  info->send_cursor.joined = 0;
   info->receive_journal = NULL;
+  info->receive_sysex   = NULL;
   info->info = NULL;
   return info;
 }
 
+static struct RTPMIDIPeerInfo * _rtpmidi_peer_info( struct RTPPeer * peer ) {
+  struct RTPMIDIPeerInfo * info = NULL;
+  RTPPeerGetInfo( peer, (void **) &info );
+  if( info == NULL ) {
+    info = _rtpmidi_peer_info_create();
+    RTPPeerSetInfo( peer, info );
+  }
+  return info;
+}
+
+/**
+ * @brief Get a peer's cursor into the shared send history.
+ * A peer that is seen for the first time needs none of the history
+ * that was sent before, it's cursor is placed at the latest packet.
+ * @param session The session.
+ * @param peer    The peer.
+ * @return the cursor or @c NULL if the peer info could not be created.
+ */
+static struct RTPMIDIPeerCursor * _rtpmidi_peer_send_cursor( struct RTPMIDISession * session, struct RTPPeer * peer ) {
+  struct RTPMIDIPeerInfo * info = _rtpmidi_peer_info( peer );
+  struct RTPMIDIPeerCursor * cursor;
+  int i;
+  if( info == NULL ) return NULL;
+  cursor = &(info->send_cursor);
+  if( ! cursor->joined ) {
+    cursor->joined     = 1;
+    cursor->sent       = 0;
+    cursor->checkpoint = session->send_serial;
+    cursor->checkpoint_pkt_seqnum = 0;
+    /* slot i only ever holds sequence numbers that are i modulo the
+     * size, so i+1 marks it as unused */
+    for( i=0; i<RTPMIDI_CURSOR_PACKETS; i++ ) {
+      cursor->seqnums[i] = i+1;
+    }
+  }
+  return cursor;
+}
+
+/**
+ * @brief Remember the serial a packet was sent to a peer with.
+ * @param cursor The peer's cursor.
+ * @param seqnum The peer's sequence number of the packet.
+ * @param serial The serial of the packet.
+ */
+static void _rtpmidi_cursor_sent( struct RTPMIDIPeerCursor * cursor, unsigned short seqnum, unsigned short serial ) {
+  int slot = seqnum & ( RTPMIDI_CURSOR_PACKETS - 1 );
+  if( ! cursor->sent ) {
+    cursor->sent = 1;
+    cursor->checkpoint_pkt_seqnum = seqnum;
+  }
+  cursor->seqnums[slot] = seqnum;
+  cursor->serials[slot] = serial;
+}
+
+/**
+ * @brief Trunkate the shared send history.
+ * Remove all entries that are not newer than @c checkpoint, no peer
+ * needs them anymore.
+ * @param session    The session.
+ * @param checkpoint The serial of the oldest packet any peer still needs.
+ */
+static void _rtpmidi_send_journal_trunkate( struct RTPMIDISession * session, unsigned short checkpoint ) {
+  int i;
+  if( ! _rtpmidi_seqnum_newer( checkpoint, session->send_checkpoint ) ) return;
+  for( i=0; i<16; i++ ) {
+    if( session->send_journal->channel_journals[i] != NULL ) {
+      _rtpmidi_channel_journal_trunkate( session->send_journal->channel_journals[i], checkpoint );
+    }
+  }
+  session->send_journal->checkpoint_pkt_seqnum = checkpoint + 1;
+  session->send_checkpoint = checkpoint;
+}
+
+static struct RTPMIDIJournal * _rtpmidi_peer_receive_journal( struct RTPPeer * peer ) {
+  struct RTPMIDIPeerInfo * info = _rtpmidi_peer_info( peer );
+  if( info == NULL ) return NULL;
+  if( info->receive_journal == NULL ) {
+    info->receive_journal = _rtpmidi_journal_create();
+  }
+  return info->receive_journal;
+}
+
+/**
+ * @brief Get the assembler for the system exclusive messages a peer sends.
+ * @param session The session.
+ * @param peer    The peer.
+ * @return the assembler or @c NULL if the session delivers segments or
+ *         the assembler could not be created.
+ */
+static struct MIDISysExAssembler * _rtpmidi_peer_receive_sysex( struct RTPMIDISession * session, struct RTPPeer * peer ) {
+  struct RTPMIDIPeerInfo * info;
+  if( ! session->sysex_assemble ) return NULL;
+  info = _rtpmidi_peer_info( peer );
+  if( info == NULL ) return NULL;
+  if( info->receive_sysex == NULL ) {
+    info->receive_sysex = MIDISysExAssemblerCreate( session->sysex_max_size );
+    if( info->receive_sysex == NULL ) return NULL;
+    MIDISysExAssemblerSetPool( info->receive_sysex, session->message_pool );
+  }
+  return info->receive_sysex;
+}
+
 /**
  * @brief Set the pointer of the internal info-structure.
  * @relates RTPMIDISession
@@ -273,6 +1217,24 @@ int RTPMIDIPeerSetInfo( struct RTPPeer * peer, void * info ) {
   return 0;
 }
 
+/**
+ * @brief Remove a peer from the session.
+ * Free the receive journal and the system exclusive assembler of the peer
+ * and remove it from the RTP session. The info pointer set with
+ * @ref RTPMIDIPeerSetInfo is not freed.
+ * @public @memberof RTPMIDISession
+ * @param session The session.
+ * @param peer    The peer to remove.
+ * @retval 0 on success.
+ * @retval >0 if the peer could not be removed.
+ */
+int RTPMIDISessionRemovePeer( struct RTPMIDISession * session, struct RTPPeer * peer ) {
+  MIDIPrecond( session != NULL, EFAULT );
+  MIDIPrecond( peer != NULL, EINVAL );
+  _rtpmidi_peer_info_destroy( peer );
+  return RTPSessionRemovePeer( session->rtp_session, peer );
+}
+
 /**
  * @brief Get a pointer to the info sub-structure.
  * @relates RTPMIDISession
@@ -295,8 +1257,71 @@ int RTPMIDIPeerGetInfo( struct RTPPeer * peer, void ** info ) {
 }
 
 /**
- * @brief Trunkate a peers send journal.
- * Remove all message entries that have a sequence number less or equal to @c seqnum.
+ * @brief Move a receiver's cursor with feedback to multicast packets.
+ * Feedback refers to the sequence numbers of the group, the serial is
+ * looked up in the group's cursor. The group's checkpoint then follows
+ * the receiver that lags the most, unless it lags more than
+ * @c RTPMIDI_MULTICAST_LAG packets. The history is kept for those
+ * receivers until they are repaired or catch up.
+ * @param session The session.
+ * @param group   The multicast group.
+ * @param peer    The receiver.
+ * @param seqnum  The group's sequence number.
+ * @retval 0 on success.
+ * @retval >0 if the receiver's cursor could not be created.
+ */
+static int _rtpmidi_group_trunkate( struct RTPMIDISession * session, struct RTPPeer * group,
+                                    struct RTPPeer * peer, unsigned long seqnum ) {
+  struct RTPMIDIPeerInfo * info = NULL;
+  struct RTPMIDIPeerCursor * group_cursor, * cursor, * oldest = NULL, * lagging = NULL;
+  struct RTPPeer * p = NULL;
+  int slot = seqnum & ( RTPMIDI_CURSOR_PACKETS - 1 );
+
+  RTPPeerGetInfo( group, (void**) &info );
+  if( info == NULL || ! info->send_cursor.joined ) return 0;
+  group_cursor = &(info->send_cursor);
+  if( group_cursor->seqnums[slot] != ( seqnum & 0xffff ) ) return 0;
+
+  cursor = _rtpmidi_peer_send_cursor( session, peer );
+  if( cursor == NULL ) return 1;
+  if( _rtpmidi_seqnum_newer( group_cursor->serials[slot], cursor->checkpoint ) ) {
+    cursor->checkpoint            = group_cursor->serials[slot];
+    cursor->checkpoint_pkt_seqnum = seqnum + 1;
+  }
+
+  RTPSessionNextPeer( session->rtp_session, &p );
+  while( p != NULL ) {
+    info = NULL;
+    RTPPeerGetInfo( p, (void**) &info );
+    if( info != NULL && info->send_cursor.joined ) {
+      cursor = &(info->send_cursor);
+      if( (unsigned short) ( session->send_serial - cursor->checkpoint ) > RTPMIDI_MULTICAST_LAG ) {
+        if( lagging == NULL || _rtpmidi_seqnum_newer( lagging->checkpoint, cursor->checkpoint ) ) lagging = cursor;
+      } else if( oldest == NULL || _rtpmidi_seqnum_newer( oldest->checkpoint, cursor->checkpoint ) ) {
+        oldest = cursor;
+      }
+    }
+    RTPSessionNextPeer( session->rtp_session, &p );
+  }
+  if( oldest != NULL && _rtpmidi_seqnum_newer( oldest->checkpoint, group_cursor->checkpoint ) ) {
+    group_cursor->checkpoint            = oldest->checkpoint;
+    group_cursor->checkpoint_pkt_seqnum = oldest->checkpoint_pkt_seqnum;
+  }
+  session->repair_pending = ( lagging != NULL ) ? 1 : 0;
+  if( lagging != NULL ) session->repair_checkpoint = lagging->checkpoint;
+  return 0;
+}
+
+/**
+ * @brief Trunkate a peers send journal.
+ * Move the peer's cursor in the shared send history to the packet with
+ * the sequence number @c seqnum. The journals sent to the peer only
+ * describe the changes made after that packet. The shared history
+ * itself is trunkated on the next send once no peer needs the older
+ * entries. Feedback for packets that are older than the cursor or were
+ * sent too long ago is ignored.
+ * While the session sends to a multicast group @c seqnum is the group's
+ * sequence number of the packet the peer acknowledged.
  * @public @memberof RTPMIDISession
  * @param session The session.
  * @param peer    The peer.
@@ -304,12 +1329,32 @@ int RTPMIDIPeerGetInfo( struct RTPPeer * peer, void ** info ) {
  * @retval 0 on success.
  */
 int RTPMIDISessionJournalTrunkate( struct RTPMIDISession * session, struct RTPPeer * peer, unsigned long seqnum ) {
+  struct RTPMIDIPeerInfo * info = NULL;
+  struct RTPMIDIPeerCursor * cursor;
+  struct RTPPeer * group = NULL;
+  int slot = seqnum & ( RTPMIDI_CURSOR_PACKETS - 1 );
+
+  if( peer == NULL ) return 0;
+  RTPSessionGetMulticastGroup( session->rtp_session, &group );
+  if( group != NULL && peer != group ) {
+    return _rtpmidi_group_trunkate( session, group, peer, seqnum );
+  }
+  RTPPeerGetInfo( peer, (void**) &info );
+  if( info == NULL || ! info->send_cursor.joined ) return 0;
+
+  cursor = &(info->send_cursor);
+  if( cursor->seqnums[slot] != ( seqnum & 0xffff ) ) return 0;
+  if( ! _rtpmidi_seqnum_newer( cursor->serials[slot], cursor->checkpoint ) ) return 0;
+  cursor->checkpoint            = cursor->serials[slot];
+  cursor->checkpoint_pkt_seqnum = seqnum + 1;
   return 0;
 }
 
 /**
  * @brief Store a list of messages in a peer's send journal and
  * associate them with the given sequence number.
+ * The messages are stored in the shared send history as a new packet
+ * that was sent to the peer with the given sequence number.
  * @public @memberof RTPMIDISession
  * @param session  The session.
  * @param peer     The peer.
@@ -319,19 +1364,12 @@ int RTPMIDISessionJournalTrunkate( struct RTPMIDISession * session, struct RTPPe
  */
 int RTPMIDISessionJournalStoreMessages( struct RTPMIDISession * session, struct RTPPeer * peer,
                                         unsigned long seqnum, struct MIDIMessageList * messages ) {
-  struct RTPMIDIPeerInfo * info = NULL;
-
-  RTPPeerGetInfo( peer, (void**) &info );
-  if( info == NULL ) {
-    info = _rtpmidi_peer_info_create();
-    RTPPeerSetInfo( peer, info );
-  }
+  struct RTPMIDIPeerCursor * cursor = _rtpmidi_peer_send_cursor( session, peer );
 
-  if( info->send_journal == NULL ) {
-    /* create journal */
-  }
-
-  return _rtpmidi_journal_encode_messages( info->send_journal, seqnum, messages );
+  if( cursor == NULL ) return 1;
+  session->send_serial++;
+  _rtpmidi_cursor_sent( cursor, seqnum, session->send_serial );
+  return _rtpmidi_journal_encode_messages( session->send_journal, session->send_serial, messages, NULL );
 }
 
 /**
@@ -352,7 +1390,7 @@ int RTPMIDISessionJournalRecoverMessages( struct RTPMIDISession * session, struc
   if( info == NULL ) return 0;
   if( info->receive_journal == NULL ) return 0;
 
-  return _rtpmidi_journal_decode_messages( info->receive_journal, seqnum, messages );
+  return _rtpmidi_journal_decode_messages( info->receive_journal, session->message_pool, seqnum, messages );
 }
 
 static void _advance_buffer( size_t * size, void ** buffer, size_t bytes ) {
@@ -403,97 +1441,597 @@ static int _rtpmidi_decode_header( struct RTPMIDIInfo * info, size_t size, void
   return 0;
 }
 
-static int _rtpmidi_encode_messages( struct RTPMIDIInfo * info, MIDITimestamp timestamp, struct MIDIMessageList * messages, size_t size, void * data, size_t * written ) {
-  int m, result = 0;
-  void * buffer = data;
-  size_t w;
+/**
+ * @brief Encode the command section of a packet.
+ * Encode as many messages of the list as fit into @c size bytes, prefixing
+ * all but the first with it's delta time. The first one gets a delta time
+ * too if it is later than @c timestamp. Messages are collected in batches
+ * and encoded in a single pass each, the list entry of the first message
+ * that did not fit is stored in @c end.
+ * @param info      The payload header to set the Z flag and length in.
+ * @param timestamp The timestamp of the packet.
+ * @param messages  The list of messages.
+ * @param size      The size of the command section.
+ * @param data      The buffer to encode the command section into.
+ * @param written   The number of bytes that were written.
+ * @param end       The first list entry that was not encoded.
+ * @retval 0  on success.
+ * @retval >0 if a message could not be encoded.
+ */
+static int _rtpmidi_encode_messages( struct RTPMIDIInfo * info, MIDITimestamp timestamp, struct MIDIMessageList * messages,
+                                     size_t size, void * data, size_t * written, struct MIDIMessageList ** end ) {
+  struct MIDIMessage * batch[RTPMIDI_ENCODE_MESSAGES];
+  struct MIDIMessageList * lists[RTPMIDI_ENCODE_MESSAGES];
+  MIDIVarLen deltas[RTPMIDI_ENCODE_MESSAGES];
   MIDIRunningStatus status = 0;
-  MIDITimestamp     timestamp2;
-  MIDIVarLen        time_diff;
+  MIDITimestamp timestamp2;
+  size_t n, k, count, w, p = 0;
+  int result = 0;
 
-  for( m=0; (size>0) && (messages!=NULL) && (messages->message!=NULL); m++ ) {
-    MIDIMessageGetTimestamp( messages->message, &timestamp2 );
-    time_diff = ( timestamp2 > timestamp ) ? ( timestamp2 - timestamp ) : 0;
-    timestamp = timestamp2;
-    if( m == 0 ) {
-      info->zero = time_diff ? 1 : 0;
+  if( size > RTPMIDI_COMMAND_SIZE ) size = RTPMIDI_COMMAND_SIZE;
+  info->zero = 0;
+  while( messages != NULL && messages->message != NULL ) {
+    for( n=0; n < RTPMIDI_ENCODE_MESSAGES && messages != NULL && messages->message != NULL; n++ ) {
+      MIDIMessageGetTimestamp( messages->message, &timestamp2 );
+      deltas[n] = ( timestamp2 > timestamp ) ? ( timestamp2 - timestamp ) : 0;
+      timestamp = timestamp2;
+      batch[n]  = messages->message;
+      lists[n]  = messages;
+      messages  = messages->next;
+    }
+    k = 0;
+    if( p == 0 ) {
+      info->zero = deltas[0] ? 1 : 0;
+      if( info->zero == 0 ) {
+        /* the first command has no delta time */
+        result = MIDIMessageEncodeTimedStream( size, data, &status, 1, &(batch[0]), NULL, &k, &w );
+        p += w;
+        if( result != 0 || k == 0 ) {
+          messages = lists[0];
+          break;
+        }
+      }
     }
-    if( m > 0 || info->zero == 1 ) {
-      MIDIUtilWriteVarLen( &time_diff, size, buffer, &w );
-      _advance_buffer( &size, &buffer, w );
+    result = MIDIMessageEncodeTimedStream( size-p, data+p, &status, n-k, &(batch[k]), &(deltas[k]), &count, &w );
+    p += w;
+    if( result != 0 || k+count < n ) {
+      messages = lists[k+count];
+      break;
     }
-    MIDIMessageEncodeRunningStatus( messages->message, &status, size, buffer, &w );
-    _advance_buffer( &size, &buffer, w );
-    messages = messages->next;
   }
 
-  info->len = buffer - data;
-  
-  *written = buffer - data;
+  info->len = p;
+  *written  = p;
+  if( end != NULL ) *end = messages;
   return result;
 }
 
-static int _rtpmidi_decode_messages( struct RTPMIDIInfo * info, MIDITimestamp timestamp, struct MIDIMessageList * messages, size_t size, void * data, size_t * read ) {
-  int m, result = 0;
-  void * buffer = data;
-  size_t r;
+/**
+ * @brief Decode the command section of a packet into messages.
+ * Commands that do not fit into the list, or for which no message could
+ * be allocated, are decoded nonetheless so that they can be counted.
+ * If an assembler is given, system exclusive segments are fed to it and
+ * only completed messages take up list entries; messages that grew too
+ * large are counted as dropped.
+ * @param info      The payload header.
+ * @param pool      The pool to take the messages from.
+ * @param sysex     The assembler of the sender or @c NULL to deliver segments.
+ * @param timestamp The timestamp of the packet.
+ * @param messages  The list to store the messages in.
+ * @param size      The size of the command section.
+ * @param data      The command section.
+ * @param read      The number of bytes that were read.
+ * @param dropped   The number of commands that were not delivered.
+ * @retval 0      on success.
+ * @retval ENOMEM if commands were dropped.
+ * @retval >0     if the command section could not be decoded.
+ */
+static int _rtpmidi_decode_messages( struct RTPMIDIInfo * info, struct MIDIMessagePool * pool,
+                                     struct MIDISysExAssembler * sysex, MIDITimestamp timestamp,
+                                     struct MIDIMessageList * messages, size_t size, void * data, size_t * read,
+                                     size_t * dropped ) {
+  struct MIDICompactMessage compact[RTPMIDI_DECODE_MESSAGES];
+  struct MIDIMessageList * list;
+  struct MIDIMessage * message;
+  int result = 0;
+  size_t i, n, max, r, p = 0;
   MIDIRunningStatus status = 0;
-  MIDIVarLen        time_diff;
 
   if( info->phantom ) {
     /* we don't really care about the source coding for now .. */
   }
-  for( m=0; (size>0) && (messages!=NULL) && (buffer-data) < info->len; m++ ) {
-    if( messages->message == NULL ) {
-      messages->message = MIDIMessageCreate( 0 );
-    }
-    if( m > 0 || info->zero == 1 ) {
-      MIDIUtilReadVarLen( &time_diff, size, buffer, &r );
-      _advance_buffer( &size, &buffer, r );
+  *dropped = 0;
+  if( size > info->len ) size = info->len;
+  while( p < size ) {
+    for( max=0, list=messages; list != NULL && max < RTPMIDI_DECODE_MESSAGES; list=list->next ) max++;
+    /* out of list entries, only count the remaining commands */
+    if( max == 0 ) max = RTPMIDI_DECODE_MESSAGES;
+    if( p == 0 && info->zero == 0 ) {
+      /* the first command has no delta time */
+      result = MIDIMessageDecodeCommandStream( size, data, &status, max, &(compact[0]), &n, &r );
     } else {
-      time_diff = 0;
+      result = MIDIMessageDecodeTimedStream( size-p, data+p, &status, max, &(compact[0]), &n, &r );
+    }
+    if( result != 0 || r == 0 ) break;
+
+    for( i=0; i<n; i++ ) {
+      message = NULL;
+      if( sysex != NULL && compact[i].bytes[0] == MIDI_STATUS_SYSTEM_EXCLUSIVE ) {
+        /* segments are collected until the message is complete */
+        if( MIDISysExAssemblerAppendCompact( sysex, &(compact[i]), data+p, &message ) ) (*dropped)++;
+        if( message == NULL ) continue;
+      }
+      if( messages == NULL ) {
+        if( message != NULL ) MIDIMessageRelease( message );
+        (*dropped)++;
+        continue;
+      }
+      if( message != NULL ) {
+        if( messages->message != NULL ) MIDIMessageRelease( messages->message );
+        messages->message = message;
+      } else {
+        if( messages->message == NULL ) {
+          messages->message = MIDIMessageCreateFromPool( pool, 0 );
+          if( messages->message == NULL ) {
+            (*dropped)++;
+            messages = NULL;
+            continue;
+          }
+        }
+        MIDIMessageSetCompact( messages->message, &(compact[i]), data+p );
+      }
+      MIDIMessageSetTimestamp( messages->message, timestamp + compact[i].timestamp );
+      MIDITraceHop( messages->message, MIDI_TRACE_INGRESS );
+      messages = messages->next;
     }
+    /* the offsets of the next call start at the last command */
+    if( n > 0 ) timestamp += compact[n-1].timestamp;
+    p += r;
+  }
 
-    MIDIMessageDecodeRunningStatus( messages->message, &status, size, buffer, &r );
-    _advance_buffer( &size, &buffer, r );
+  *read = p;
+  if( result == 0 && *dropped > 0 ) result = ENOMEM;
+  return result;
+}
 
-    timestamp += time_diff;
-    MIDIMessageSetTimestamp( messages->message, timestamp );
-    messages = messages->next;
+/**
+ * @brief Encode the command section of a packet as universal MIDI packets.
+ * Like @ref _rtpmidi_encode_messages but every message is coded as a
+ * universal packet and delta times are coded as jitter reduction
+ * timestamps in front of the message, in units of the session clock.
+ * Longer deltas are clamped. Messages that have no packet form, like
+ * system exclusive messages, end the command section.
+ * @param info      The payload header to set the Z flag and length in.
+ * @param timestamp The timestamp of the packet.
+ * @param messages  The list of messages.
+ * @param size      The size of the command section.
+ * @param data      The buffer to encode the command section into.
+ * @param written   The number of bytes that were written.
+ * @param end       The first list entry that was not encoded.
+ * @retval 0  on success.
+ * @retval >0 if a message could not be encoded.
+ */
+static int _rtpmidi_encode_packets( struct RTPMIDIInfo * info, MIDITimestamp timestamp, struct MIDIMessageList * messages,
+                                    size_t size, void * data, size_t * written, struct MIDIMessageList ** end ) {
+  struct MIDIUniversalPacket packets[2];
+  MIDITimestamp timestamp2, delta;
+  size_t n, w, p = 0;
+  int result = 0;
+
+  if( size > RTPMIDI_COMMAND_SIZE ) size = RTPMIDI_COMMAND_SIZE;
+  info->zero = 0;
+  while( messages != NULL && messages->message != NULL ) {
+    MIDIMessageGetTimestamp( messages->message, &timestamp2 );
+    delta = ( timestamp2 > timestamp ) ? ( timestamp2 - timestamp ) : 0;
+    n = 0;
+    if( delta > 0 ) {
+      MIDIUniversalPacketSetTimestamp( &(packets[n++]), 0, ( delta > 0xffff ) ? 0xffff : delta );
+    }
+    result = MIDIUniversalPacketFromMessage( &(packets[n++]), 0, messages->message, 1 );
+    if( result != 0 ) break;
+    result = MIDIUniversalPacketEncode( size-p, data+p, n, &(packets[0]), NULL, &w );
+    if( result != 0 ) break;
+    p += w;
+    timestamp = timestamp2;
+    messages  = messages->next;
   }
 
-  *read = buffer - data;
+  info->len = p;
+  *written  = p;
+  if( end != NULL ) *end = messages;
   return result;
 }
 
 /**
- * @brief Send MIDI messages over an RTPSession.
- * Broadcast the messages to all connected peers. Store the number of sent messages
- * in @c count, if the @c info argument was specified it will be populated with the
- * packet info of the last sent packet.
- * The peer's control structures will be updated with the required journalling
- * information.
- * @public @memberof RTPMIDISession
- * @param session  The session.
- * @param messages A pointer to a list of @c size message pointers.
+ * @brief Decode the universal packets of a command section into messages.
+ * Like @ref _rtpmidi_decode_messages, packets that do not fit into the
+ * list or for which no message could be allocated are counted.
+ * @param info      The payload header.
+ * @param pool      The pool to take the messages from.
+ * @param timestamp The timestamp of the packet.
+ * @param messages  The list to store the messages in.
+ * @param size      The size of the command section.
+ * @param data      The command section.
+ * @param read      The number of bytes that were read.
+ * @param dropped   The number of packets that were not delivered.
+ * @retval 0      on success.
+ * @retval ENOMEM if packets were dropped.
+ * @retval >0     if the command section could not be decoded.
+ */
+static int _rtpmidi_decode_packets( struct RTPMIDIInfo * info, struct MIDIMessagePool * pool, MIDITimestamp timestamp,
+                                    struct MIDIMessageList * messages, size_t size, void * data, size_t * read,
+                                    size_t * dropped ) {
+  struct MIDIUniversalPacket packets[RTPMIDI_DECODE_MESSAGES];
+  struct MIDICompactMessage compact;
+  int result = 0;
+  size_t i, n, r, p = 0;
+
+  *dropped = 0;
+  if( size > info->len ) size = info->len;
+  while( p < size ) {
+    result = MIDIUniversalPacketDecode( size-p, data+p, RTPMIDI_DECODE_MESSAGES, &(packets[0]), &n, &r );
+    if( result != 0 || r == 0 ) break;
+
+    for( i=0; i<n; i++ ) {
+      if( MIDI_UMP_TYPE( &(packets[i]) ) == MIDI_UMP_TYPE_UTILITY ) {
+        if( ( ( packets[i].words[0] >> 20 ) & 0xf ) == MIDI_UMP_UTILITY_JR_TIMESTAMP ) {
+          timestamp += packets[i].words[0] & 0xffff;
+        }
+        continue;
+      }
+      /* skip packets that have no MIDI 1.0 form */
+      if( MIDIUniversalPacketToCompact( &(packets[i]), &compact ) ) continue;
+      if( messages != NULL && messages->message == NULL ) {
+        messages->message = MIDIMessageCreateFromPool( pool, 0 );
+        if( messages->message == NULL ) messages = NULL;
+      }
+      if( messages == NULL ) {
+        (*dropped)++;
+        continue;
+      }
+      MIDIMessageSetCompact( messages->message, &compact, NULL );
+      MIDIMessageSetTimestamp( messages->message, timestamp );
+      messages = messages->next;
+    }
+    p += r;
+  }
+
+  *read = p;
+  if( result == 0 && *dropped > 0 ) result = ENOMEM;
+  return result;
+}
+
+/**
+ * @brief Keep a system exclusive message that is too long for a packet.
+ * The message is sent in segments by @ref RTPMIDISessionSendSysEx.
+ * @private @memberof RTPMIDISession
+ * @param session The session.
+ * @param message The message.
+ * @retval 0 on success.
+ * @retval >0 if too many messages wait already.
+ */
+static int _rtpmidi_sysex_push( struct RTPMIDISession * session, struct MIDIMessage * message ) {
+  if( session->sysex_queue == NULL ) {
+    session->sysex_queue = MIDIMessageQueueCreateRing( RTPMIDI_SYSEX_QUEUE );
+    if( session->sysex_queue == NULL ) return 1;
+  }
+  return MIDIMessageQueuePush( session->sysex_queue, message );
+}
+
+/**
+ * @brief Make sure there are system exclusive bytes left to segment.
+ * If the current message is sent completely, encode the next waiting one.
+ * @private @memberof RTPMIDISession
+ * @param session The session.
+ * @retval 0 if a segment can be sent.
+ * @retval >0 if no message is left.
+ */
+static int _rtpmidi_sysex_next( struct RTPMIDISession * session ) {
+  struct MIDIMessage * message;
+  MIDIManufacturerId id = 0;
+  unsigned char * header = &(session->sysex_header[0]);
+  char fragment = 0;
+  size_t size = 0;
+
+  while( session->sysex_offset >= session->sysex_size ) {
+    if( session->sysex_buffer != NULL ) MIDISysExBufferRelease( session->sysex_buffer );
+    if( session->sysex_message != NULL ) MIDIMessageRelease( session->sysex_message );
+    session->sysex_message = NULL;
+    session->sysex_buffer  = NULL;
+    session->sysex        = NULL;
+    session->sysex_header_size = 0;
+    session->sysex_size   = 0;
+    session->sysex_offset = 0;
+    message = NULL;
+    if( session->sysex_queue != NULL ) MIDIMessageQueuePop( session->sysex_queue, &message );
+    if( message == NULL ) return 1;
+
+    /* only the status and manufacturer id are coded here, the payload is
+     * segmented where it is */
+    MIDIMessageGet( message, MIDI_SYSEX_FRAGMENT, sizeof(char), &fragment );
+    MIDIMessageGet( message, MIDI_MANUFACTURER_ID, sizeof(MIDIManufacturerId), &id );
+    MIDIMessageGet( message, MIDI_SYSEX_SIZE, sizeof(size_t), &size );
+    MIDIMessageGet( message, MIDI_SYSEX_DATA, sizeof(void*), &(session->sysex) );
+    if( fragment == 0 ) {
+      header[0] = MIDI_STATUS_SYSTEM_EXCLUSIVE;
+      if( (unsigned short) id & 0xff80 ) {
+        /* extended manufacturer id */
+        header[1] = 0;
+        header[2] = ( id >> 8 ) & 0x7f;
+        header[3] = id & 0x7f;
+        session->sysex_header_size = 4;
+      } else {
+        header[1] = id & 0x7f;
+        session->sysex_header_size = 2;
+      }
+    }
+    if( session->sysex == NULL ) size = 0;
+    session->sysex_size = session->sysex_header_size + size;
+    MIDIMessageGetTimestamp( message, &(session->sysex_timestamp) );
+
+    /* keep the buffer the payload is a slice of, or the message that owns it */
+    MIDIMessageGetSysExBuffer( message, &(session->sysex_buffer), NULL );
+    if( session->sysex_buffer != NULL ) {
+      MIDISysExBufferRetain( session->sysex_buffer );
+      MIDIMessageRelease( message );
+    } else {
+      session->sysex_message = message;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief Get a byte of the current system exclusive message.
+ * @private @memberof RTPMIDISession
+ * @param session The session.
+ * @param offset  The offset of the byte, counting the status and
+ *                manufacturer id.
+ * @return the byte.
+ */
+static unsigned char _rtpmidi_sysex_byte( struct RTPMIDISession * session, size_t offset ) {
+  if( offset < session->sysex_header_size ) return session->sysex_header[offset];
+  return session->sysex[offset - session->sysex_header_size];
+}
+
+/**
+ * @brief Encode the next segment of the current system exclusive message.
+ * The first segment ends with @c 0xf0, the following segments start with
+ * @c 0xf7 and all but the last end with @c 0xf0, as described in RFC 6295.
+ * The segment is the only command of the packet and has a zero delta time.
+ * @private @memberof RTPMIDISession
+ * @param session The session.
+ * @param info    The payload header to set the Z flag and length in.
+ * @param size    The size of the buffer.
+ * @param data    The buffer to encode the command section into.
+ * @param written The number of bytes that were written.
+ * @retval 0  on success.
+ * @retval >0 if the segment does not fit.
+ */
+static int _rtpmidi_encode_segment( struct RTPMIDISession * session, struct RTPMIDIInfo * info,
+                                    size_t size, unsigned char * data, size_t * written ) {
+  size_t n, h, p = 0, offset = session->sysex_offset, remain = session->sysex_size - offset;
+
+  n = ( remain < RTPMIDI_SYSEX_SEGMENT ) ? remain : RTPMIDI_SYSEX_SEGMENT;
+  if( size < n + 3 ) return 1;
+  data[p++] = 0;
+  if( offset > 0 || _rtpmidi_sysex_byte( session, 0 ) != MIDI_STATUS_SYSTEM_EXCLUSIVE ) {
+    data[p++] = MIDI_STATUS_END_OF_EXCLUSIVE;
+  }
+  /* copy the rest of the header and the slice of the payload */
+  h = ( offset < session->sysex_header_size ) ? session->sysex_header_size - offset : 0;
+  if( h > n ) h = n;
+  if( h > 0 ) memcpy( data+p, &(session->sysex_header[offset]), h );
+  if( n > h ) memcpy( data+p+h, session->sysex + offset + h - session->sysex_header_size, n - h );
+  p += n;
+  if( n < remain || _rtpmidi_sysex_byte( session, offset + n - 1 ) != MIDI_STATUS_END_OF_EXCLUSIVE ) {
+    data[p++] = MIDI_STATUS_SYSTEM_EXCLUSIVE;
+  }
+  session->sysex_offset += n;
+
+  info->zero = 1;
+  info->len  = p;
+  *written   = p;
+  return 0;
+}
+
+/**
+ * @brief Get the number of data bytes of a compact message.
+ * @param status The status byte including the channel.
+ * @return the number of data bytes that follow the status byte.
+ */
+static size_t _rtpmidi_compact_data_bytes( unsigned char status ) {
+  switch( status & 0xf0 ) {
+    case 0xc0:
+    case 0xd0:
+      return 1;
+    case 0xf0:
+      break;
+    default:
+      return 2;
+  }
+  switch( status ) {
+    case MIDI_STATUS_TIME_CODE_QUARTER_FRAME:
+    case MIDI_STATUS_SONG_SELECT:
+      return 1;
+    case MIDI_STATUS_SONG_POSITION_POINTER:
+      return 2;
+    default:
+      return 0;
+  }
+}
+
+/**
+ * @brief Encode the command section from the compact messages to forward.
+ * Copy the bytes of as many of the session's forwarded messages as fit
+ * into @c size bytes, using running status for channel messages. System
+ * exclusive payloads are copied from the buffer they were received in and
+ * framed like the segments they were received as. The messages that were
+ * encoded are consumed. A message that does not fit into an empty packet
+ * is dropped.
+ * @private @memberof RTPMIDISession
+ * @param session The session.
+ * @param info    The payload header to set the Z flag and length in.
+ * @param size    The size of the buffer.
+ * @param data    The buffer to encode the command section into.
+ * @param written The number of bytes that were written.
+ * @retval 0  on success.
+ * @retval >0 if the first message does not fit.
+ */
+static int _rtpmidi_encode_compact( struct RTPMIDISession * session, struct RTPMIDIInfo * info,
+                                    size_t size, unsigned char * data, size_t * written ) {
+  struct MIDICompactMessage * m;
+  unsigned char status = 0, byte;
+  uint32_t offset = 0;
+  MIDIVarLen delta;
+  size_t need, w, p = 0, q;
+
+  if( size > RTPMIDI_COMMAND_SIZE ) size = RTPMIDI_COMMAND_SIZE;
+  info->zero = 0;
+  for( ; session->forward_count > 0; session->forward++, session->forward_count-- ) {
+    m     = session->forward;
+    byte  = m->bytes[0];
+    delta = ( m->timestamp > offset ) ? ( m->timestamp - offset ) : 0;
+    q     = p;
+    if( p == 0 ) info->zero = delta ? 1 : 0;
+    if( p > 0 || info->zero ) {
+      if( q >= size || MIDIUtilWriteVarLen( &delta, size-q, data+q, &w ) ) break;
+      q += w;
+    }
+    if( byte == MIDI_STATUS_SYSTEM_EXCLUSIVE ) {
+      need = m->sysex_size;
+      if( q + need + 2 > size || ( need > 0 && session->forward_payload == NULL ) ) break;
+      data[q++] = ( m->flags & MIDI_COMPACT_SYSEX_START ) ? MIDI_STATUS_SYSTEM_EXCLUSIVE : MIDI_STATUS_END_OF_EXCLUSIVE;
+      memcpy( data+q, session->forward_payload + m->sysex_offset, need );
+      q += need;
+      if( m->flags & MIDI_COMPACT_SYSEX_END ) {
+        data[q++] = MIDI_STATUS_END_OF_EXCLUSIVE;
+      } else if( m->flags & MIDI_COMPACT_SYSEX_CANCEL ) {
+        data[q++] = MIDI_STATUS_UNDEFINED0;
+      } else {
+        /* the message goes on in a later command */
+        data[q++] = MIDI_STATUS_SYSTEM_EXCLUSIVE;
+      }
+      status = 0;
+    } else {
+      need = _rtpmidi_compact_data_bytes( byte );
+      if( q + need + 1 > size ) break;
+      if( byte != status ) data[q++] = byte;
+      if( need > 0 ) data[q++] = m->bytes[1];
+      if( need > 1 ) data[q++] = m->bytes[2];
+      /* real time messages don't touch the running status */
+      if( byte < MIDI_STATUS_SYSTEM_EXCLUSIVE ) {
+        status = byte;
+      } else if( byte < MIDI_STATUS_TIMING_CLOCK ) {
+        status = 0;
+      }
+    }
+    if( m->timestamp > offset ) offset = m->timestamp;
+    p = q;
+  }
+
+  if( p == 0 && session->forward_count > 0 ) {
+    session->forward++;
+    session->forward_count--;
+    return 1;
+  }
+  info->len = p;
+  *written  = p;
+  return 0;
+}
+
+/**
+ * @brief Send a batch of prepared packets over an RTPSession.
+ * The cursors of the peers that received their packet remember the
+ * sequence number it was sent with.
+ * @param session The session.
+ * @param cursors The cursors of the peers, one for each packet.
+ * @param serial  The serial of the packet in the shared send history.
+ * @param n       The number of packets.
+ * @param infos   The packets.
  * @retval 0 On success.
- * @retval >0 If the message could not be sent.
+ * @retval >0 If any of the packets could not be sent.
  */
-int RTPMIDISessionSend( struct RTPMIDISession * session, struct MIDIMessageList * messages ) {
+static int _rtpmidi_send_packets( struct RTPMIDISession * session, struct RTPMIDIPeerCursor ** cursors,
+                                  unsigned short serial, size_t n, struct RTPPacketInfo * infos ) {
   int result = 0;
-  struct iovec iov[3];
+  size_t i, sent, done = 0;
+
+  while( done < n ) {
+    MIDIProfileBegin( session->profile, MIDI_DRIVER_STAGE_SOCKET_WRITE );
+    result = RTPSessionSendPackets( session->rtp_session, n-done, &(infos[done]), &sent );
+    MIDIProfileEnd( session->profile, MIDI_DRIVER_STAGE_SOCKET_WRITE );
+    for( i=done; i<done+sent; i++ ) {
+      if( cursors[i] != NULL ) {
+        _rtpmidi_cursor_sent( cursors[i], infos[i].sequence_number, serial );
+      }
+      MIDIProfileAdd( session->profile, bytes_out, infos[i].payload_size );
+    }
+    MIDIProfileAdd( session->profile, packets_out, sent );
+    /* skip the peer that failed and go on with the rest */
+    if( result != 0 ) {
+      MIDIProfileAdd( session->profile, drops, 1 );
+    }
+    done += ( result == 0 ) ? sent : sent+1;
+  }
+  return result;
+}
+
+/**
+ * @brief Send one packet with as many messages as fit to all peers.
+ * A system exclusive message that is too long for any packet is kept and
+ * segmented instead.
+ * @param session  The session.
+ * @param messages The list of messages or @c NULL to send the forwarded
+ *                 compact messages or the next segment of the current
+ *                 system exclusive message.
+ * @param end      The first list entry that was not sent.
+ * @retval 0  on success.
+ * @retval >0 if the packet could not be sent to all peers.
+ */
+static int _rtpmidi_send_packet( struct RTPMIDISession * session, struct MIDIMessageList * messages,
+                                 struct MIDIMessageList ** end ) {
+  int result = 0, r;
+  struct iovec header[2];
+  struct iovec iov[RTPMIDI_SEND_PEERS][4];
+  struct RTPPacketInfo   infos[RTPMIDI_SEND_PEERS];
+  struct RTPMIDIPeerCursor * cursors[RTPMIDI_SEND_PEERS];
+  unsigned char journal_headers[RTPMIDI_SEND_PEERS][3];
+  /* the channel journals encoded for the distinct checkpoints of a batch */
+  unsigned short checkpoints[RTPMIDI_SEND_PEERS];
+  struct iovec   journals[RTPMIDI_SEND_PEERS];
+  int            channels[RTPMIDI_SEND_PEERS];
+  size_t n = 0, k, distinct = 0;
   size_t written = 0;
   size_t size    = session->size;
   void * buffer  = session->buffer;
+  size_t journal_size;
+  void * journal_buffer;
+  unsigned short serial = session->send_serial + 1;
+  unsigned short oldest = session->send_serial;
 
   struct RTPPeer        * peer    = NULL;
-  struct RTPMIDIJournal * journal = NULL;
+  struct RTPPeer        * group   = NULL;
+  struct RTPMIDIPeerCursor * cursor;
   struct RTPMIDIInfo    * minfo   = &(session->midi_info);
   struct RTPPacketInfo  * info    = &(session->rtp_info);
 
-  MIDITimestamp timestamp;
+  struct MIDICompactMessage * forward = NULL;
 
-  MIDIMessageGetTimestamp( messages->message, &timestamp );
+  MIDITimestamp timestamp;
+  MIDIStatus status = 0;
+
+  MIDIProfileBegin( session->profile, MIDI_DRIVER_STAGE_ENCODE );
+  if( messages != NULL ) {
+    MIDIMessageGetTimestamp( messages->message, &timestamp );
+  } else if( session->forward != NULL ) {
+    timestamp = session->forward_timestamp;
+    forward   = session->forward;
+    *end      = NULL;
+  } else {
+    timestamp = session->sysex_timestamp;
+    *end      = NULL;
+  }
 
   info->peer            = 0;
   info->padding         = 0;
@@ -508,48 +2046,384 @@ int RTPMIDISessionSend( struct RTPMIDISession * session, struct MIDIMessageList
   minfo->phantom = 0;
   minfo->zero    = 0;
 
-  _rtpmidi_encode_messages( minfo, timestamp, messages, size, buffer, &written );
-  iov[1].iov_base = buffer;
-  iov[1].iov_len  = written;
+  if( forward != NULL ) {
+    if( _rtpmidi_encode_compact( session, minfo, size, buffer, &written ) ) {
+      MIDIProfileEnd( session->profile, MIDI_DRIVER_STAGE_ENCODE );
+      MIDIProfileAdd( session->profile, drops, 1 );
+      return 1;
+    }
+  } else if( messages == NULL ) {
+    if( _rtpmidi_encode_segment( session, minfo, size, buffer, &written ) ) {
+      MIDIProfileEnd( session->profile, MIDI_DRIVER_STAGE_ENCODE );
+      return 1;
+    }
+  } else if( ( session->ump ? _rtpmidi_encode_packets( minfo, timestamp, messages, size, buffer, &written, end )
+                            : _rtpmidi_encode_messages( minfo, timestamp, messages, size, buffer, &written, end ) )
+          || *end == messages ) {
+    /* the first message can not be encoded or does not fit, segment
+     * system exclusive messages and drop the rest */
+    MIDIProfileEnd( session->profile, MIDI_DRIVER_STAGE_ENCODE );
+    if( *end == messages ) {
+      *end = messages->next;
+      MIDIMessageGetStatus( messages->message, &status );
+      if( status == MIDI_STATUS_SYSTEM_EXCLUSIVE && ! session->ump
+       && _rtpmidi_sysex_push( session, messages->message ) == 0 ) return 0;
+    }
+    MIDIProfileAdd( session->profile, drops, 1 );
+    return 1;
+  }
+  iov[0][1].iov_base = buffer;
+  iov[0][1].iov_len  = written;
   _advance_buffer( &size, &buffer, written );
 
+  /* the J flag depends on the peer's journal, so prepare both headers */
   _rtpmidi_encode_header( minfo, size, buffer, &written );
-  iov[0].iov_base = buffer;
-  iov[0].iov_len  = written;
+  header[0].iov_base = buffer;
+  header[0].iov_len  = written;
   _advance_buffer( &size, &buffer, written );
 
-  /* send encoded messages to each peer
-   * each peer has its own journal */
+  minfo->journal = 1;
+  _rtpmidi_encode_header( minfo, size, buffer, &written );
+  header[1].iov_base = buffer;
+  header[1].iov_len  = written;
+  _advance_buffer( &size, &buffer, written );
+
+  journal_size   = size;
+  journal_buffer = buffer;
+
+  /* the MIDI command section is shared by all peers, only the RTP
+   * header and the journal differ. the journal only depends on the
+   * last packet a peer acknowledged, so it is encoded once for all
+   * peers that are at the same checkpoint. collect the packets for
+   * all peers and hand them to rtp at once. a multicast group stands
+   * in for all peers, it gets the only packet. */
+  RTPSessionGetMulticastGroup( session->rtp_session, &group );
   result = RTPSessionNextPeer( session->rtp_session, &peer );
+  if( group != NULL ) peer = group;
   while( peer != NULL ) {
-    if( minfo->journal ) {
-      journal = NULL; /* peer out journal */
-      _rtpmidi_journal_encode( session, journal, size, buffer, &written );
-      iov[2].iov_base = buffer;
-      iov[2].iov_len  = written;
-      _advance_buffer( &size, &buffer, written );
+    cursor = _rtpmidi_peer_send_cursor( session, peer );
+    cursors[n] = cursor;
+    k = distinct;
+    if( cursor != NULL ) {
+      if( (unsigned short) ( serial - cursor->checkpoint ) > RTPMIDI_CURSOR_LAG ) {
+        cursor->checkpoint = serial - RTPMIDI_CURSOR_LAG;
+      }
+      if( _rtpmidi_seqnum_newer( oldest, cursor->checkpoint ) ) {
+        oldest = cursor->checkpoint;
+      }
+      for( k=0; k<distinct && checkpoints[k] != cursor->checkpoint; k++ );
+      if( k == distinct ) {
+        if( _rtpmidi_journal_encode( session->send_journal, cursor->checkpoint,
+                                     ( size < RTPMIDI_JOURNAL_SIZE - 3 ) ? size : RTPMIDI_JOURNAL_SIZE - 3,
+                                     buffer, &written, &(channels[k]) ) ) {
+          /* too much history, wait for receiver feedback to trunkate it */
+          written     = 0;
+          channels[k] = 0;
+        }
+        checkpoints[k]       = cursor->checkpoint;
+        journals[k].iov_base = buffer;
+        journals[k].iov_len  = written;
+        _advance_buffer( &size, &buffer, written );
+        distinct++;
+      }
+    }
+
+    infos[n]      = *info;
+    infos[n].peer = peer;
+    infos[n].iov  = &(iov[n][0]);
+    iov[n][1] = iov[0][1];
+    if( k < distinct && channels[k] > 0 ) {
+      _rtpmidi_journal_encode_header( channels[k], cursor->checkpoint_pkt_seqnum, &(journal_headers[n][0]) );
+      iov[n][0] = header[1];
+      iov[n][2].iov_base = &(journal_headers[n][0]);
+      iov[n][2].iov_len  = 3;
+      iov[n][3] = journals[k];
+      infos[n].iovlen = 4;
+      infos[n].payload_size = iov[n][0].iov_len + iov[n][1].iov_len + iov[n][2].iov_len + iov[n][3].iov_len;
     } else {
-      iov[2].iov_base = NULL;
-      iov[2].iov_len  = 0;
+      iov[n][0] = header[0];
+      infos[n].iovlen = 2;
+      infos[n].payload_size = iov[n][0].iov_len + iov[n][1].iov_len;
+    }
+    n++;
+
+    if( n == RTPMIDI_SEND_PEERS ) {
+      MIDIProfileEnd( session->profile, MIDI_DRIVER_STAGE_ENCODE );
+      r = _rtpmidi_send_packets( session, &(cursors[0]), serial, n, &(infos[0]) );
+      MIDIProfileBegin( session->profile, MIDI_DRIVER_STAGE_ENCODE );
+      if( r != 0 ) result = r;
+      *info    = infos[n-1];
+      n        = 0;
+      distinct = 0;
+      size     = journal_size;
+      buffer   = journal_buffer;
+    }
+    if( peer == group ) break;
+    RTPSessionNextPeer( session->rtp_session, &peer );
+  }
+  MIDIProfileEnd( session->profile, MIDI_DRIVER_STAGE_ENCODE );
+  if( n > 0 ) {
+    r = _rtpmidi_send_packets( session, &(cursors[0]), serial, n, &(infos[0]) );
+    if( r != 0 ) result = r;
+    *info = infos[n-1];
+  }
+
+  /* the history is shared by all peers, store the packet once and
+   * drop what the peer that lags the most has acknowledged */
+  if( group != NULL && session->repair_pending ) {
+    if( (unsigned short) ( serial - session->repair_checkpoint ) > RTPMIDI_CURSOR_LAG ) {
+      session->repair_checkpoint = serial - RTPMIDI_CURSOR_LAG;
+    }
+    if( _rtpmidi_seqnum_newer( oldest, session->repair_checkpoint ) ) {
+      oldest = session->repair_checkpoint;
     }
+  }
+  session->send_serial = serial;
+  if( forward != NULL ) {
+    _rtpmidi_journal_encode_compact( session->send_journal, serial, session->forward - forward, forward );
+  } else {
+    _rtpmidi_journal_encode_messages( session->send_journal, serial, messages, *end );
+  }
+  _rtpmidi_send_journal_trunkate( session, oldest );
+  return result;
+}
 
-    info->peer   = peer;
-    info->iovlen = ( minfo->journal ) ? 3 : 2;
-    info->iov    = &(iov[0]);
-    info->payload_size = iov[0].iov_len + iov[1].iov_len + iov[2].iov_len;
+/**
+ * @brief Send the journal to a single peer.
+ * Send a packet without commands whose journal describes all changes
+ * the peer did not acknowledge yet. While the session sends to a
+ * multicast group this repairs a receiver that reported loss or lags
+ * too far behind to be covered by the journal of the group's packets.
+ * The packet repeats the group's last sequence number, so receivers that
+ * did not miss anything ignore it.
+ * @public @memberof RTPMIDISession
+ * @param session The session.
+ * @param peer    The peer to repair.
+ * @retval 0 on success or if the peer has nothing to recover.
+ * @retval >0 if the packet could not be sent.
+ */
+int RTPMIDISessionSendRepair( struct RTPMIDISession * session, struct RTPPeer * peer ) {
+  struct RTPMIDIInfo minfo = { 1, 0, 0, 0 };
+  struct RTPPacketInfo info;
+  struct RTPMIDIPeerCursor * cursor;
+  struct iovec iov[3];
+  unsigned char header[2], journal_header[3];
+  size_t written = 0, header_size = 0;
+  int channels = 0;
+
+  if( peer == NULL ) return 1;
+  cursor = _rtpmidi_peer_send_cursor( session, peer );
+  if( cursor == NULL ) return 1;
+  if( (unsigned short) ( session->send_serial - cursor->checkpoint ) > RTPMIDI_CURSOR_LAG ) {
+    cursor->checkpoint = session->send_serial - RTPMIDI_CURSOR_LAG;
+  }
+  if( _rtpmidi_journal_encode( session->send_journal, cursor->checkpoint, RTPMIDI_JOURNAL_SIZE - 3,
+                               session->buffer, &written, &channels ) ) return 1;
+  if( channels == 0 ) return 0;
+
+  _rtpmidi_encode_header( &minfo, sizeof(header), &(header[0]), &header_size );
+  _rtpmidi_journal_encode_header( channels, cursor->checkpoint_pkt_seqnum, &(journal_header[0]) );
+  iov[0].iov_base = &(header[0]);
+  iov[0].iov_len  = header_size;
+  iov[1].iov_base = &(journal_header[0]);
+  iov[1].iov_len  = 3;
+  iov[2].iov_base = session->buffer;
+  iov[2].iov_len  = written;
+
+  info = session->rtp_info;
+  info.peer         = peer;
+  info.payload_type = 97;
+  info.iov          = &(iov[0]);
+  info.iovlen       = 3;
+  info.payload_size = header_size + 3 + written;
+  return _rtpmidi_send_packets( session, &cursor, session->send_serial, 1, &info );
+}
 
-    result = RTPSessionSendPacket( session->rtp_session, info );
+/**
+ * @brief Send MIDI messages over an RTPSession.
+ * Broadcast the messages to all connected peers. The messages are split
+ * into as many packets as needed to keep every packet within the MTU.
+ * System exclusive messages that are too long for any packet are split
+ * into segments that are sent in packets of their own, while the messages
+ * that follow them go out right away, see @ref RTPMIDISessionSendSysEx.
+ * Other messages that are too long for any packet are dropped.
+ * If the RTP session has a multicast group, every packet is sent once to
+ * the group instead, with a journal that covers all peers that are not
+ * lagging too far behind.
+ * @public @memberof RTPMIDISession
+ * @param session  The session.
+ * @param messages The list of messages to send.
+ * @retval 0 On success.
+ * @retval >0 If a message could not be sent.
+ */
+int RTPMIDISessionSend( struct RTPMIDISession * session, struct MIDIMessageList * messages ) {
+  struct MIDIMessageList * end = NULL;
+  int result = 0, r;
 
-    if( result == 0 && minfo->journal ) {
-      _rtpmidi_journal_encode_messages( journal, info->sequence_number, messages );
-    }
+  while( messages != NULL && messages->message != NULL ) {
+    r = _rtpmidi_send_packet( session, messages, &end );
+    if( r != 0 ) result = r;
+    messages = end;
+  }
+  r = RTPMIDISessionSendSysEx( session );
+  return ( result != 0 ) ? result : r;
+}
 
-    RTPSessionNextPeer( session->rtp_session, &peer );
+/**
+ * @brief Forward compact MIDI messages over an RTPSession.
+ * Send messages that were received with @ref RTPMIDISessionReceiveCompact
+ * without decoding them. The status and data bytes are copied and system
+ * exclusive payloads are copied straight from the received command
+ * section, so a pure MIDI thru path never builds MIDIMessage objects.
+ * The messages are split into as many packets as needed and are stored in
+ * the send journal like the messages sent with @ref RTPMIDISessionSend.
+ * Messages that are too long for any packet are dropped. Sessions that
+ * code universal packets can not forward compact messages.
+ * @public @memberof RTPMIDISession
+ * @param session   The session.
+ * @param timestamp The timestamp of the packets.
+ * @param count     The number of messages.
+ * @param messages  The messages, their timestamps are offsets from @c timestamp.
+ * @param payload   The buffer the system exclusive payloads refer to.
+ * @retval 0 On success.
+ * @retval >0 If a message could not be sent.
+ */
+int RTPMIDISessionSendCompact( struct RTPMIDISession * session, MIDITimestamp timestamp, size_t count,
+                               struct MIDICompactMessage * messages, unsigned char * payload ) {
+  struct MIDIMessageList * end = NULL;
+  int result = 0, r;
+
+  MIDIPrecond( session != NULL, EFAULT );
+  MIDIPrecond( messages != NULL || count == 0, EINVAL );
+  if( session->ump ) return 1;
+  if( count == 0 ) return 0;
+
+  session->forward           = messages;
+  session->forward_count     = count;
+  session->forward_payload   = payload;
+  session->forward_timestamp = timestamp;
+  while( session->forward_count > 0 ) {
+    r = _rtpmidi_send_packet( session, NULL, &end );
+    if( r != 0 ) result = r;
   }
+  session->forward         = NULL;
+  session->forward_payload = NULL;
+  return result;
+}
 
+/**
+ * @brief Compare two points in time.
+ * @return a negative value if @c a is before @c b, zero if they are equal
+ * and a positive value otherwise.
+ */
+static long _rtpmidi_timespec_cmp( struct timespec * a, struct timespec * b ) {
+  return ( a->tv_sec != b->tv_sec ) ? (long) ( a->tv_sec - b->tv_sec ) : ( a->tv_nsec - b->tv_nsec );
+}
+
+/**
+ * @brief Send the system exclusive segments that are due.
+ * Segments of system exclusive messages that were too long for a packet
+ * are sent one packet at a time. Without a rate all segments are sent at
+ * once, otherwise only as many as the rate allows, use
+ * @ref RTPMIDISessionGetSysExDelay to find out when to call this again.
+ * @public @memberof RTPMIDISession
+ * @param session The session.
+ * @retval 0 on success.
+ * @retval >0 if a segment could not be sent to all peers.
+ */
+int RTPMIDISessionSendSysEx( struct RTPMIDISession * session ) {
+  struct MIDIMessageList * end = NULL;
+  struct timespec now;
+  unsigned long long ns;
+  size_t offset;
+  int result = 0, r;
+
+  MIDIPrecond( session != NULL, EFAULT );
+  clock_gettime( CLOCK_MONOTONIC, &now );
+  while( _rtpmidi_sysex_next( session ) == 0 ) {
+    if( session->sysex_rate > 0 && _rtpmidi_timespec_cmp( &now, &(session->sysex_due) ) < 0 ) break;
+    offset = session->sysex_offset;
+    r = _rtpmidi_send_packet( session, NULL, &end );
+    if( r != 0 ) result = r;
+    if( session->sysex_offset == offset ) {
+      /* the segment can not be encoded, drop the message */
+      session->sysex_offset = session->sysex_size;
+      MIDIProfileAdd( session->profile, drops, 1 );
+      continue;
+    }
+    if( session->sysex_rate > 0 ) {
+      /* the next segment is due when the rate allows the bytes of this one */
+      if( _rtpmidi_timespec_cmp( &(session->sysex_due), &now ) < 0 ) session->sysex_due = now;
+      ns = (unsigned long long) ( session->sysex_offset - offset ) * 1000000000ULL / session->sysex_rate;
+      ns += session->sysex_due.tv_nsec;
+      session->sysex_due.tv_sec += ns / 1000000000ULL;
+      session->sysex_due.tv_nsec = ns % 1000000000ULL;
+    }
+  }
   return result;
 }
 
+/**
+ * @brief Get the time until the next system exclusive segment is due.
+ * @public @memberof RTPMIDISession
+ * @param session The session.
+ * @param delay   The time to wait before calling @ref RTPMIDISessionSendSysEx.
+ * @retval 0 on success.
+ * @retval >0 if no segments wait to be sent.
+ */
+int RTPMIDISessionGetSysExDelay( struct RTPMIDISession * session, struct timespec * delay ) {
+  struct timespec now;
+  MIDIPrecond( session != NULL, EFAULT );
+  MIDIPrecond( delay != NULL, EINVAL );
+  if( _rtpmidi_sysex_next( session ) ) return 1;
+  delay->tv_sec  = 0;
+  delay->tv_nsec = 0;
+  clock_gettime( CLOCK_MONOTONIC, &now );
+  if( session->sysex_rate == 0 || _rtpmidi_timespec_cmp( &now, &(session->sysex_due) ) >= 0 ) return 0;
+  delay->tv_sec  = session->sysex_due.tv_sec  - now.tv_sec;
+  delay->tv_nsec = session->sysex_due.tv_nsec - now.tv_nsec;
+  if( delay->tv_nsec < 0 ) {
+    delay->tv_sec  -= 1;
+    delay->tv_nsec += 1000000000;
+  }
+  return 0;
+}
+
+/**
+ * @brief Get the number of system exclusive bytes that wait to be sent.
+ * @public @memberof RTPMIDISession
+ * @param session The session.
+ * @param bytes   The bytes left of the current message.
+ * @param count   The number of messages that wait behind it. May be @c NULL.
+ * @retval 0 on success.
+ */
+int RTPMIDISessionGetPendingSysEx( struct RTPMIDISession * session, size_t * bytes, size_t * count ) {
+  MIDIPrecond( session != NULL, EFAULT );
+  MIDIPrecond( bytes != NULL, EINVAL );
+  *bytes = session->sysex_size - session->sysex_offset;
+  if( count != NULL ) {
+    *count = 0;
+    if( session->sysex_queue != NULL ) MIDIMessageQueueGetLength( session->sysex_queue, count );
+  }
+  return 0;
+}
+
+/**
+ * @brief Drop all system exclusive segments that were not sent yet.
+ * The receivers are not told, the last segment they got announces more.
+ * @public @memberof RTPMIDISession
+ * @param session The session.
+ * @retval 0 on success.
+ */
+int RTPMIDISessionCancelSysEx( struct RTPMIDISession * session ) {
+  MIDIPrecond( session != NULL, EFAULT );
+  session->sysex_offset = session->sysex_size;
+  while( _rtpmidi_sysex_next( session ) == 0 ) {
+    session->sysex_offset = session->sysex_size;
+  }
+  return 0;
+}
+
 
 /**
  * @brief Receive MIDI messages over an RTPSession.
@@ -558,6 +2432,12 @@ int RTPMIDISessionSend( struct RTPMIDISession * session, struct MIDIMessageList
  * packet info of the last received packet.
  * If lost packets are detected the required information is recovered from the
  * journal.
+ * Each call decodes a single packet. All packets that are pending on the socket
+ * are received at once and decoded in place on subsequent calls, use
+ * @ref RTPMIDISessionGetPendingPackets to check if there are more.
+ * List entries without a message are filled with messages from the session's
+ * message pool; the caller owns them and has to release them. Commands that
+ * do not fit into the list are dropped and counted in the session's profile.
  * @public @memberof RTPMIDISession
  * @param session  The session.
  * @param messages A pointer to a list of midi messages.
@@ -565,48 +2445,116 @@ int RTPMIDISessionSend( struct RTPMIDISession * session, struct MIDIMessageList
  * @retval >0 If the message was corrupted or could not be received.
  */
 int RTPMIDISessionReceive( struct RTPMIDISession * session, struct MIDIMessageList * messages ) {
+  return RTPMIDISessionReceiveFrom( session, NULL, messages );
+}
+
+/**
+ * @brief Record the time from the arrival of a packet until it is decoded.
+ * This includes the time it took to wake up the thread that runs the
+ * session and to get through the runloop to the session.
+ * @private @memberof RTPMIDISession
+ * @param profile The profile.
+ * @param arrival The time the packet arrived at the socket.
+ */
+static void _rtpmidi_record_wakeup( struct MIDIDriverProfile * profile, struct timespec * arrival ) {
+  struct timespec now;
+  long long ns;
+  clock_gettime( CLOCK_REALTIME, &now );
+  ns = (long long) ( now.tv_sec - arrival->tv_sec ) * 1000000000LL + ( now.tv_nsec - arrival->tv_nsec );
+  MIDIDriverProfileRecordLatency( profile, MIDI_DRIVER_STAGE_WAKEUP,
+                                  (MIDITimestamp) ( (double) ns * profile->stats.rate / 1e9 ) );
+}
+
+/**
+ * @brief Get the next received packet.
+ * Read a batch of packets from the socket if none are pending.
+ * @private @memberof RTPMIDISession
+ * @param session The session.
+ * @param info    The packet.
+ * @retval 0 on success.
+ * @retval >0 if no packet was received.
+ */
+static int _rtpmidi_next_packet( struct RTPMIDISession * session, struct RTPPacketInfo ** info ) {
+  int result;
+  if( session->pending_next >= session->pending_count ) {
+    session->pending_next  = 0;
+    session->pending_count = 0;
+    MIDIProfileBegin( session->profile, MIDI_DRIVER_STAGE_SOCKET_READ );
+    result = RTPSessionReceivePackets( session->rtp_session, RTPMIDI_RECV_PACKETS,
+                                       &(session->pending[0]), &(session->pending_count) );
+    MIDIProfileEnd( session->profile, MIDI_DRIVER_STAGE_SOCKET_READ );
+    if( result != 0 ) return result;
+    if( session->pending_count == 0 ) return 1;
+    MIDIProfileAdd( session->profile, packets_in, session->pending_count );
+  }
+  *info = &(session->pending[session->pending_next++]);
+  if( session->profile != NULL && (*info)->arrival.tv_sec != 0 ) {
+    _rtpmidi_record_wakeup( session->profile, &((*info)->arrival) );
+  }
+  MIDIProfileAdd( session->profile, bytes_in, (*info)->iov[(*info)->iovlen-1].iov_len );
+  return 0;
+}
+
+/**
+ * @brief Receive MIDI messages over an RTPSession and identify the sender.
+ * Works like @ref RTPMIDISessionReceive and additionally stores the peer that
+ * sent the decoded packet in @c peer.
+ * @public @memberof RTPMIDISession
+ * @param session  The session.
+ * @param peer     The peer that sent the packet. May be @c NULL.
+ * @param messages A pointer to a list of midi messages.
+ * @retval 0 on success.
+ * @retval >0 If the message was corrupted or could not be received.
+ */
+int RTPMIDISessionReceiveFrom( struct RTPMIDISession * session, struct RTPPeer ** peer,
+                               struct MIDIMessageList * messages ) {
   int result = 0;
-  struct iovec iov[3];
-  size_t read = 0;
+  size_t read = 0, dropped;
   size_t size;
   void * buffer;
   MIDITimestamp timestamp;
 
-/*struct RTPPeer        * peer    = NULL;*/
   struct RTPMIDIJournal * journal = NULL;
   struct RTPMIDIInfo    * minfo   = &(session->midi_info);
-  struct RTPPacketInfo  * info    = &(session->rtp_info);
+  struct RTPPacketInfo  * info;
+  struct MIDIMessageList * list;
 
-  info->iovlen = 3;
-  info->iov    = &(iov[0]);
-  
   if( messages == NULL ) return 1;
-  result = RTPSessionReceivePacket( session->rtp_session, info );
+  result = _rtpmidi_next_packet( session, &info );
   if( result != 0 ) return result;
-  
+  if( peer != NULL ) *peer = info->peer;
+
   timestamp = info->timestamp;
-  size      = info->iov[0].iov_len;
-  buffer    = info->iov[0].iov_base;
+  size      = info->iov[info->iovlen-1].iov_len;
+  buffer    = info->iov[info->iovlen-1].iov_base;
+
+  MIDIProfileBegin( session->profile, MIDI_DRIVER_STAGE_DECODE );
 
   _rtpmidi_decode_header( minfo, size, buffer, &read );
   _advance_buffer( &size, &buffer, read );
 
-  _rtpmidi_decode_messages( minfo, timestamp, messages, size, buffer, &read );
-  _advance_buffer( &size, &buffer, read );
-  
-  if( minfo->journal ) {
-    if( 0 /* check for out of order package */ ) {
-      if( 0 /* any more packets pending? */ ) {
-        /* move messages to buffer */
-        /* receive pending packets, try again */
-      } else {
-        journal = NULL; /* peer in journal */
-        _rtpmidi_journal_decode( session, journal, size, buffer, &read );
-        _advance_buffer( &size, &buffer, read );
-        /* recover from journal */
-      }
-    }
+  /* if packets were lost, repair the state from the journal before
+   * delivering the commands of this packet */
+  list    = messages;
+  journal = _rtpmidi_peer_receive_journal( info->peer );
+  if( minfo->journal && journal != NULL && journal->received && minfo->len <= size
+   && _rtpmidi_seqnum_newer( info->sequence_number, journal->last_pkt_seqnum + 1 ) ) {
+    _rtpmidi_journal_decode( session, journal, info->sequence_number, timestamp, &list,
+                             size - minfo->len, buffer + minfo->len, &read );
   }
+
+  if( session->ump ) {
+    _rtpmidi_decode_packets( minfo, session->message_pool, timestamp, list, size, buffer, &read, &dropped );
+    MIDIProfileAdd( session->profile, drops, dropped );
+  } else {
+    _rtpmidi_decode_messages( minfo, session->message_pool, _rtpmidi_peer_receive_sysex( session, info->peer ),
+                              timestamp, list, size, buffer, &read, &dropped );
+    MIDIProfileAdd( session->profile, drops, dropped );
+  }
+  _advance_buffer( &size, &buffer, read );
+  _rtpmidi_journal_encode_messages( journal, info->sequence_number, list, NULL );
+  MIDIProfileEnd( session->profile, MIDI_DRIVER_STAGE_DECODE );
+
   /* - clear the internal packet buffer
    * - repeat as long as the socket holds packets:
    *   - if the packet is not currupted sort it into the internal packet buffer
@@ -620,4 +2568,217 @@ int RTPMIDISessionReceive( struct RTPMIDISession * session, struct MIDIMessageLi
   return result;
 }
 
+/**
+ * @brief Receive MIDI messages over an RTPSession as compact messages.
+ * Works like @ref RTPMIDISessionReceiveFrom but decodes the command section
+ * into compact messages that refer to the received packet instead of
+ * creating MIDIMessage objects. The timestamps of the messages are offsets
+ * from the timestamp of the packet and the system exclusive payloads are
+ * located in @c payload, which stays valid until the next packet is
+ * received. Messages recovered from the journal come first. Use this with
+ * @ref RTPMIDISessionSendCompact to forward messages and
+ * @ref MIDIMessageSetCompact to decode the ones that have to be inspected.
+ * Sessions that code universal packets can not receive compact messages.
+ * @public @memberof RTPMIDISession
+ * @param session   The session.
+ * @param peer      The peer that sent the packet. May be @c NULL.
+ * @param size      The number of messages that fit into @c messages.
+ * @param messages  The array to store the messages in.
+ * @param count     The number of messages that were stored.
+ * @param payload   The command section of the packet.
+ * @param timestamp The timestamp of the packet.
+ * @retval 0 on success.
+ * @retval >0 If the message was corrupted or could not be received.
+ */
+int RTPMIDISessionReceiveCompact( struct RTPMIDISession * session, struct RTPPeer ** peer, size_t size,
+                                  struct MIDICompactMessage * messages, size_t * count,
+                                  unsigned char ** payload, MIDITimestamp * timestamp ) {
+  struct MIDIMessageList recovered[RTPMIDI_DECODE_MESSAGES];
+  struct MIDIMessageList * list;
+  struct RTPMIDIJournal  * journal;
+  struct RTPMIDIInfo     * minfo = &(session->midi_info);
+  struct RTPPacketInfo   * info;
+  MIDIRunningStatus status = 0;
+  uint32_t offset = 0;
+  size_t i, n = 0, k, r, read = 0, p = 0, length;
+  unsigned char * buffer;
+  int result;
+
+  MIDIPrecond( session != NULL, EFAULT );
+  MIDIPrecond( messages != NULL && count != NULL, EINVAL );
+  MIDIPrecond( payload != NULL && timestamp != NULL, EINVAL );
+  if( session->ump ) return 1;
+  result = _rtpmidi_next_packet( session, &info );
+  if( result != 0 ) return result;
+  if( peer != NULL ) *peer = info->peer;
+
+  *timestamp = info->timestamp;
+  length     = info->iov[info->iovlen-1].iov_len;
+  buffer     = info->iov[info->iovlen-1].iov_base;
+
+  MIDIProfileBegin( session->profile, MIDI_DRIVER_STAGE_DECODE );
+  _rtpmidi_decode_header( minfo, length, buffer, &read );
+  buffer  += read;
+  length  -= read;
+  *payload = buffer;
+
+  /* recovery messages are rare, so they are built as messages first */
+  journal = _rtpmidi_peer_receive_journal( info->peer );
+  if( minfo->journal && journal != NULL && journal->received && minfo->len <= length
+   && _rtpmidi_seqnum_newer( info->sequence_number, journal->last_pkt_seqnum + 1 ) ) {
+    for( i=0; i<RTPMIDI_DECODE_MESSAGES; i++ ) {
+      recovered[i].message = NULL;
+      recovered[i].next    = ( i+1 < RTPMIDI_DECODE_MESSAGES ) ? &(recovered[i+1]) : NULL;
+    }
+    list = &(recovered[0]);
+    _rtpmidi_journal_decode( session, journal, info->sequence_number, *timestamp, &list,
+                             length - minfo->len, buffer + minfo->len, &read );
+    for( i=0; i<RTPMIDI_DECODE_MESSAGES && recovered[i].message != NULL; i++ ) {
+      if( n < size && MIDIMessageGetCompact( recovered[i].message, &(messages[n]) ) == 0 ) {
+        messages[n++].timestamp = 0;
+      }
+      MIDIMessageRelease( recovered[i].message );
+    }
+  }
+
+  k = n;
+  if( length > minfo->len ) length = minfo->len;
+  while( p < length && n < size ) {
+    if( p == 0 && minfo->zero == 0 ) {
+      /* the first command has no delta time */
+      result = MIDIMessageDecodeCommandStream( length, buffer, &status, size-n, &(messages[n]), &r, &read );
+    } else {
+      result = MIDIMessageDecodeTimedStream( length-p, buffer+p, &status, size-n, &(messages[n]), &r, &read );
+    }
+    if( result != 0 || read == 0 ) break;
+    for( i=n; i<n+r; i++ ) {
+      messages[i].sysex_offset += p;
+      messages[i].timestamp    += offset;
+    }
+    n += r;
+    if( r > 0 ) offset = messages[n-1].timestamp;
+    p += read;
+  }
+  _rtpmidi_journal_encode_compact( journal, info->sequence_number, n-k, &(messages[k]) );
+  MIDIProfileEnd( session->profile, MIDI_DRIVER_STAGE_DECODE );
+  *count = n;
+  return result;
+}
+
+/**
+ * @brief Read the packets a peer sent over its stream.
+ * Receive all complete packets from the peer's stream, see
+ * @ref RTPPeerSetStream, and keep them for decoding. Packets that are still
+ * pending are decoded first, the stream is only read once they are gone.
+ * Use @ref RTPMIDISessionReceiveFrom to decode the packets.
+ * @public @memberof RTPMIDISession
+ * @param session The session.
+ * @param peer    The peer.
+ * @retval 0 on success, even if no packet was complete.
+ * @retval -1 if the connection was closed or failed.
+ * @retval >0 if the stream could not be read.
+ */
+int RTPMIDISessionReadStream( struct RTPMIDISession * session, struct RTPPeer * peer ) {
+  int result;
+  if( session->pending_next < session->pending_count ) return 0;
+  session->pending_next  = 0;
+  session->pending_count = 0;
+  MIDIProfileBegin( session->profile, MIDI_DRIVER_STAGE_SOCKET_READ );
+  result = RTPSessionReceiveStream( session->rtp_session, peer, RTPMIDI_RECV_PACKETS,
+                                    &(session->pending[0]), &(session->pending_count) );
+  MIDIProfileEnd( session->profile, MIDI_DRIVER_STAGE_SOCKET_READ );
+  if( result != 0 ) return result;
+  MIDIProfileAdd( session->profile, packets_in, session->pending_count );
+  return 0;
+}
+
+/**
+ * @brief Get the number of received but not yet decoded packets.
+ * @public @memberof RTPMIDISession
+ * @param session The session.
+ * @param count   The number of pending packets.
+ * @retval 0 on success.
+ * @retval >0 If the count could not be stored.
+ */
+int RTPMIDISessionGetPendingPackets( struct RTPMIDISession * session, size_t * count ) {
+  if( count == NULL ) return 1;
+  *count = session->pending_count - session->pending_next;
+  return 0;
+}
+
+/**
+ * @brief Record profiling information.
+ * Record the socket read and write, encode and decode stages and the
+ * packet and byte counters of the session in a driver's profile.
+ * @public @memberof RTPMIDISession
+ * @param session The session.
+ * @param profile The profile to record to or @c NULL to stop recording.
+ * @retval 0 on success.
+ */
+int RTPMIDISessionSetProfile( struct RTPMIDISession * session, struct MIDIDriverProfile * profile ) {
+  if( ( profile == NULL ) != ( session->profile == NULL ) ) {
+    /* the wakeup stage is measured from the kernel's receive timestamps */
+    RTPSessionSetTimestamping( session->rtp_session, profile != NULL );
+  }
+  session->profile = profile;
+  return 0;
+}
+
+/**
+ * @brief Pace the segments of long system exclusive messages.
+ * Limit the rate at which the segments of system exclusive messages that
+ * are too long for a packet are sent, so that bulk dumps do not overflow
+ * the receive buffers of the peers. Other messages are not paced.
+ * @public @memberof RTPMIDISession
+ * @param session The session.
+ * @param rate    The number of system exclusive bytes per second or 0 to
+ *                send all segments at once.
+ * @retval 0 on success.
+ */
+int RTPMIDISessionSetSysExRate( struct RTPMIDISession * session, unsigned long rate ) {
+  MIDIPrecond( session != NULL, EFAULT );
+  session->sysex_rate = rate;
+  return 0;
+}
+
+/**
+ * @brief Code the command section as universal MIDI packets.
+ * Instead of the MIDI 1.0 command list of RFC 6295 the command section
+ * holds a sequence of big endian universal MIDI packets. Channel voice
+ * messages are sent as MIDI 2.0 packets and delta times as jitter
+ * reduction timestamps. The recovery journal is not affected. Both ends
+ * of the session have to agree on the payload format.
+ * @public @memberof RTPMIDISession
+ * @param session The session.
+ * @param ump     Whether to send and receive universal packets.
+ * @retval 0 on success.
+ */
+int RTPMIDISessionSetUniversalPackets( struct RTPMIDISession * session, MIDIBoolean ump ) {
+  session->ump = ump ? 1 : 0;
+  return 0;
+}
+
+/**
+ * @brief Reassemble received system exclusive messages.
+ * By default the segments of system exclusive messages that are too long
+ * for a packet are received as separate messages. With reassembly every
+ * peer gets a MIDISysExAssembler that collects the segments in buffers
+ * from the session's message pool, and the complete message is received
+ * with the packet of the last segment. Messages that grow past the
+ * maximum size are cancelled and counted as drops. Peers that already
+ * sent system exclusive data keep their maximum size. Universal packets
+ * are not reassembled.
+ * @public @memberof RTPMIDISession
+ * @param session  The session.
+ * @param assemble Whether to reassemble system exclusive messages.
+ * @param max_size The maximum size of a message in bytes or 0 for no limit.
+ * @retval 0 on success.
+ */
+int RTPMIDISessionSetSysExAssembly( struct RTPMIDISession * session, MIDIBoolean assemble, size_t max_size ) {
+  MIDIPrecond( session != NULL, EFAULT );
+  session->sysex_assemble = assemble ? 1 : 0;
+  session->sysex_max_size = max_size;
+  return 0;
+}
+
 /** @} */
@@ -1,10 +1,12 @@
 #ifndef MIDIKIT_DRIVER_RTPMIDI_H
 #define MIDIKIT_DRIVER_RTPMIDI_H
 #include <stdlib.h>
+#include <time.h>
 #include "midi/message.h"
 
 struct RTPPeer;
 struct RTPSession;
+struct MIDIDriverProfile;
 
 struct RTPMIDISession;
 
@@ -21,8 +23,27 @@ int RTPMIDISessionJournalRecoverMessages( struct RTPMIDISession * session, struc
 
 int RTPMIDIPeerSetInfo( struct RTPPeer * peer, void * info );
 int RTPMIDIPeerGetInfo( struct RTPPeer * peer, void ** info );
+int RTPMIDISessionRemovePeer( struct RTPMIDISession * session, struct RTPPeer * peer );
 
 int RTPMIDISessionSend( struct RTPMIDISession * session, struct MIDIMessageList * messages );
+int RTPMIDISessionSendRepair( struct RTPMIDISession * session, struct RTPPeer * peer );
+int RTPMIDISessionSendSysEx( struct RTPMIDISession * session );
+int RTPMIDISessionGetSysExDelay( struct RTPMIDISession * session, struct timespec * delay );
+int RTPMIDISessionGetPendingSysEx( struct RTPMIDISession * session, size_t * bytes, size_t * count );
+int RTPMIDISessionCancelSysEx( struct RTPMIDISession * session );
+int RTPMIDISessionSendCompact( struct RTPMIDISession * session, MIDITimestamp timestamp, size_t count,
+                               struct MIDICompactMessage * messages, unsigned char * payload );
 int RTPMIDISessionReceive( struct RTPMIDISession * session, struct MIDIMessageList * messages );
+int RTPMIDISessionReceiveFrom( struct RTPMIDISession * session, struct RTPPeer ** peer,
+                               struct MIDIMessageList * messages );
+int RTPMIDISessionReceiveCompact( struct RTPMIDISession * session, struct RTPPeer ** peer, size_t size,
+                                  struct MIDICompactMessage * messages, size_t * count,
+                                  unsigned char ** payload, MIDITimestamp * timestamp );
+int RTPMIDISessionReadStream( struct RTPMIDISession * session, struct RTPPeer * peer );
+int RTPMIDISessionGetPendingPackets( struct RTPMIDISession * session, size_t * count );
+int RTPMIDISessionSetProfile( struct RTPMIDISession * session, struct MIDIDriverProfile * profile );
+int RTPMIDISessionSetSysExRate( struct RTPMIDISession * session, unsigned long rate );
+int RTPMIDISessionSetUniversalPackets( struct RTPMIDISession * session, MIDIBoolean ump );
+int RTPMIDISessionSetSysExAssembly( struct RTPMIDISession * session, MIDIBoolean assemble, size_t max_size );
 
 #endif
@@ -1,39 +1,114 @@
 #ifdef __APPLE__
 
 #define MIDI_DRIVER_INTERNALS
+#include <mach/mach_time.h>
 #include "coremidi.h"
 #include "midi/driver.h"
+#include "midi/clock.h"
+#include "midi/runloop.h"
 #include "midi/message.h"
 #include "midi/message_queue.h"
+#include "midi/trace.h"
 
 #define COREMIDI_CLOCK_RATE 10000
+#define COREMIDI_PACKET_LIST_SIZE 1024
+#define COREMIDI_MAX_MESSAGES_PER_PACKET 64
 
 struct MIDIDriverCoreMIDI {
   struct MIDIDriver base;
   MIDIClientRef client;
   MIDIPortRef   cm_in_port;
   MIDIPortRef   cm_out_port;
+  MIDIEndpointRef cm_destination;
   struct MIDIDriverDelegate * delegate;
+  struct MIDIClock * host_clock;
+  MIDIRunningStatus in_status;
+  MIDIPacketList * packet_list;
+  MIDIPacket     * packet;
+  size_t           packet_bytes;
+  Byte packet_buffer[COREMIDI_PACKET_LIST_SIZE];
+  struct timespec flush_window;
+  unsigned long   flush_timer;
 };
 
+/**
+ * @brief Create a clock that runs on host time.
+ * CoreMIDI timestamps packets with the value of @c mach_absolute_time.
+ * A clock with the host's time base is used to convert these timestamps
+ * to and from the driver's clock.
+ * @private @memberof MIDIDriverCoreMIDI
+ * @return a pointer to the created clock on success.
+ * @return a @c NULL pointer if the clock could not be created.
+ */
+static struct MIDIClock * _coremidi_host_clock_create( void ) {
+  struct MIDIClock * clock;
+  mach_timebase_info_data_t info;
+  mach_timebase_info( &info );
+  clock = MIDIClockCreate( (MIDISamplingRate) ( 1000000000ULL * info.denom / info.numer ) );
+  if( clock != NULL ) {
+    MIDIClockSetNow( clock, mach_absolute_time() );
+  }
+  return clock;
+}
+
+/**
+ * @brief Decode a packet list received from CoreMIDI.
+ * The data of every packet is decoded in a single pass, running status
+ * is kept across packets so that system exclusive messages that are
+ * split over several packets are continued. The host timestamp of the
+ * packet is converted to the driver's clock.
+ * @private @memberof MIDIDriverCoreMIDI
+ * @param pktlist        The received packet list.
+ * @param readProcRefCon The driver.
+ * @param srcRefCon      The source endpoint's reference, unused.
+ */
 static void _coremidi_readproc( const MIDIPacketList *pktlist, void * readProcRefCon, void * srcRefCon ) {
   struct MIDIDriverCoreMIDI * driver = readProcRefCon;
-  struct MIDIMessage * message       = NULL;
-  int i;
-  size_t size, read = 0;
-  const void * buffer;
-  
+  struct MIDICompactMessage compact[COREMIDI_MAX_MESSAGES_PER_PACKET];
+  struct MIDIMessage * message;
+  const MIDIPacket * packet = &(pktlist->packet[0]);
+  MIDITimestamp timestamp;
+  unsigned char * buffer;
+  size_t size, count, read, j;
+  UInt32 i;
+
+  MIDIProfileAdd( driver->base.profile, packets_in, pktlist->numPackets );
   for( i=0; i<pktlist->numPackets; i++ ) {
-    size   =   pktlist->packet[i].length;
-    buffer = &(pktlist->packet[i].data[0]);
-    do {
-      message = MIDIMessageCreate( MIDI_STATUS_RESET );
-      MIDIMessageDecode( message, size, buffer, &read );
-      MIDIDriverCoreMIDIReceiveMessage( driver, message );
-      MIDIMessageRelease( message );
+    size   = packet->length;
+    buffer = (unsigned char *) &(packet->data[0]);
+    MIDIProfileAdd( driver->base.profile, bytes_in, size );
+    if( packet->timeStamp == 0 ) {
+      MIDIClockGetNow( driver->base.clock, &timestamp );
+    } else {
+      timestamp = packet->timeStamp;
+      MIDIClockConvertTimestamp( driver->base.clock, driver->host_clock, &timestamp );
+    }
+
+    MIDIProfileBegin( driver->base.profile, MIDI_DRIVER_STAGE_DECODE );
+    while( size > 0 ) {
+      count = 0;
+      read  = 0;
+      if( MIDIMessageDecodeStream( size, buffer, &(driver->in_status),
+                                   COREMIDI_MAX_MESSAGES_PER_PACKET, &(compact[0]), &count, &read ) ) {
+        MIDILog( DEBUG, "could not decode CoreMIDI packet\n" );
+        break;
+      }
+      for( j=0; j<count; j++ ) {
+        message = MIDIMessageCreate( MIDI_STATUS_RESET );
+        if( message == NULL ) break;
+        if( MIDIMessageSetCompact( message, &(compact[j]), buffer ) == 0 ) {
+          MIDIMessageSetTimestamp( message, timestamp );
+          MIDITraceHop( message, MIDI_TRACE_INGRESS );
+          MIDIDriverCoreMIDIReceiveMessage( driver, message );
+        }
+        MIDIMessageRelease( message );
+      }
+      if( read == 0 ) break; /* incomplete message at the end of the packet */
       size   -= read;
       buffer += read;
-    } while( size > 0 );
+    }
+    MIDIProfileEnd( driver->base.profile, MIDI_DRIVER_STAGE_DECODE );
+    packet = MIDIPacketNext( packet );
   }
 }
 
@@ -56,6 +131,7 @@ static void _driver_destroy( void * driverp ) {
  */
 struct MIDIDriverCoreMIDI * MIDIDriverCoreMIDICreate( char * name, MIDIClientRef client ) {
   struct MIDIDriverCoreMIDI * driver;
+  struct MIDIRunloopSourceDelegate delegate = { NULL, NULL, NULL, NULL };
   CFStringRef in_name, out_name;
   
   driver = malloc( sizeof( struct MIDIDriverCoreMIDI ) );
@@ -63,11 +139,29 @@ struct MIDIDriverCoreMIDI * MIDIDriverCoreMIDICreate( char * name, MIDIClientRef
   MIDIDriverInit( &(driver->base), name, COREMIDI_CLOCK_RATE );
 
   driver->client = client; 
+  driver->cm_destination = 0;
+  driver->host_clock  = _coremidi_host_clock_create();
+  driver->in_status   = 0;
+  driver->packet_list = (MIDIPacketList *) &(driver->packet_buffer[0]);
+  driver->packet      = MIDIPacketListInit( driver->packet_list );
+  driver->packet_bytes = 0;
+  driver->flush_window.tv_sec  = 0;
+  driver->flush_window.tv_nsec = 0;
+  driver->flush_timer = 0;
+
+  driver->base.send    = &_driver_send;
+  driver->base.destroy = &_driver_destroy;
+
+  delegate.info = driver;
+  driver->base.rls = MIDIRunloopSourceCreate( &delegate );
+
   in_name  = CFStringCreateWithFormat( NULL, NULL, CFSTR("MIDIKit %s input"), name );
-  out_name = CFStringCreateWithFormat( NULL, NULL, CFSTR("MIDIKit %s input"), name );
+  out_name = CFStringCreateWithFormat( NULL, NULL, CFSTR("MIDIKit %s output"), name );
   
   MIDIInputPortCreate( client, in_name, &_coremidi_readproc, driver, &(driver->cm_in_port) );
   MIDIOutputPortCreate( client, out_name, &(driver->cm_out_port) );
+  CFRelease( in_name );
+  CFRelease( out_name );
 
   return driver;
 }
@@ -79,15 +173,54 @@ struct MIDIDriverCoreMIDI * MIDIDriverCoreMIDICreate( char * name, MIDIClientRef
  * @param driver The driver.
  */
 void MIDIDriverCoreMIDIDestroy( struct MIDIDriverCoreMIDI * driver ) {
+  if( driver->flush_timer != 0 ) {
+    MIDIRunloopSourceCancelTimer( driver->base.rls, driver->flush_timer );
+    driver->flush_timer = 0;
+  }
   MIDIPortDispose( driver->cm_in_port );
   MIDIPortDispose( driver->cm_out_port );
+  if( driver->host_clock != NULL ) {
+    MIDIClockRelease( driver->host_clock );
+  }
+}
+
+/**
+ * @brief Set the destination endpoint.
+ * Outgoing packet lists are sent to this endpoint.
+ * @public @memberof MIDIDriverCoreMIDI
+ * @param driver      The driver.
+ * @param destination The destination endpoint.
+ * @retval 0 on success.
+ */
+int MIDIDriverCoreMIDISetDestination( struct MIDIDriverCoreMIDI * driver, MIDIEndpointRef destination ) {
+  MIDIPrecond( driver != NULL, EFAULT );
+  driver->cm_destination = destination;
+  return 0;
+}
+
+/**
+ * @brief Set the time to wait for more outgoing messages.
+ * Outgoing messages are accumulated in a single packet list that is
+ * sent when the window closes or the list is full. With a window of
+ * zero microseconds, the default, the list is sent on the next
+ * iteration of the runloop.
+ * @public @memberof MIDIDriverCoreMIDI
+ * @param driver The driver.
+ * @param usec   The length of the window in microseconds.
+ * @retval 0 on success.
+ */
+int MIDIDriverCoreMIDISetFlushWindow( struct MIDIDriverCoreMIDI * driver, unsigned long usec ) {
+  MIDIPrecond( driver != NULL, EFAULT );
+  driver->flush_window.tv_sec  = usec / 1000000;
+  driver->flush_window.tv_nsec = ( usec % 1000000 ) * 1000;
+  return 0;
 }
 
 /**
  * @brief Handle incoming MIDI messages.
- * This is called by the RTP-MIDI payload parser whenever it encounters a new MIDI message.
- * There may be multiple messages in a single packet so a single call of MIDIDriverCoreMIDI
- * may trigger multiple calls of this function.
+ * This is called by the CoreMIDI read procedure whenever it decodes a new MIDI message.
+ * There may be multiple messages in a single packet list so a single call of the
+ * read procedure may trigger multiple calls of this function.
  * @public @memberof MIDIDriverCoreMIDI
  * @param driver The driver.
  * @param message The message that was just received.
@@ -95,13 +228,27 @@ void MIDIDriverCoreMIDIDestroy( struct MIDIDriverCoreMIDI * driver ) {
  * @retval >0 if the message could not be processed.
  */
 int MIDIDriverCoreMIDIReceiveMessage( struct MIDIDriverCoreMIDI * driver, struct MIDIMessage * message ) {
-  return 0;
+  return MIDIDriverReceive( &(driver->base), message );
+}
+
+/**
+ * @brief Flush the packet list when the flush window closes.
+ * @private @memberof MIDIDriverCoreMIDI
+ * @param drv The driver.
+ * @param now The current time.
+ */
+static int _coremidi_flush_timeout( void * drv, struct timespec * now ) {
+  struct MIDIDriverCoreMIDI * driver = drv;
+  driver->flush_timer = 0;
+  return MIDIDriverCoreMIDISend( driver );
 }
 
 /**
  * @brief Process outgoing MIDI messages.
  * This is called by the generic driver interface to pass messages to this driver implementation.
- * The driver may queue outgoing messages to reduce package overhead, trading of latency for throughput.
+ * The message is added to the pending packet list, the list is sent when the flush window
+ * closes or when it can not take any more messages. The timestamp of the message is
+ * converted to host time, a message without a timestamp is sent immediately.
  * @public @memberof MIDIDriverCoreMIDI
  * @param driver The driver.
  * @param message The message that should be sent.
@@ -109,12 +256,54 @@ int MIDIDriverCoreMIDIReceiveMessage( struct MIDIDriverCoreMIDI * driver, struct
  * @retval >0 if the message could not be processed.
  */
 int MIDIDriverCoreMIDISendMessage( struct MIDIDriverCoreMIDI * driver, struct MIDIMessage * message ) {
+  unsigned char buffer[COREMIDI_PACKET_LIST_SIZE - sizeof( MIDIPacketList )];
+  MIDITimestamp timestamp;
+  MIDIPacket * packet;
+  size_t written = 0;
+  MIDIPrecond( driver != NULL, EFAULT );
+  MIDIPrecond( message != NULL, EINVAL );
+
+  MIDIProfileBegin( driver->base.profile, MIDI_DRIVER_STAGE_ENCODE );
+  if( MIDIMessageEncode( message, sizeof( buffer ), &(buffer[0]), &written ) ) {
+    MIDIProfileEnd( driver->base.profile, MIDI_DRIVER_STAGE_ENCODE );
+    MIDILog( DEBUG, "could not encode CoreMIDI message, dropping message\n" );
+    MIDIProfileAdd( driver->base.profile, drops, 1 );
+    return 1;
+  }
+  MIDIMessageGetTimestamp( message, &timestamp );
+  if( timestamp != 0 ) {
+    MIDIClockConvertTimestamp( driver->host_clock, driver->base.clock, &timestamp );
+  }
+
+  packet = MIDIPacketListAdd( driver->packet_list, COREMIDI_PACKET_LIST_SIZE, driver->packet,
+                              (MIDITimeStamp) timestamp, written, &(buffer[0]) );
+  if( packet == NULL && driver->packet_list->numPackets > 0 ) {
+    /* the list is full, send it and start over */
+    MIDIDriverCoreMIDISend( driver );
+    packet = MIDIPacketListAdd( driver->packet_list, COREMIDI_PACKET_LIST_SIZE, driver->packet,
+                                (MIDITimeStamp) timestamp, written, &(buffer[0]) );
+  }
+  MIDIProfileEnd( driver->base.profile, MIDI_DRIVER_STAGE_ENCODE );
+  if( packet == NULL ) {
+    MIDILog( DEBUG, "CoreMIDI packet list is full, dropping message\n" );
+    MIDIProfileAdd( driver->base.profile, drops, 1 );
+    return 1;
+  }
+  driver->packet = packet;
+  driver->packet_bytes += written;
+  MIDIProfileAdd( driver->base.profile, messages_out, 1 );
+
+  if( driver->flush_timer == 0 ) {
+    return MIDIRunloopSourceAddTimer( driver->base.rls, &(driver->flush_window),
+                                      &_coremidi_flush_timeout, driver, &(driver->flush_timer) );
+  }
   return 0;
 }
 
 /**
  * @brief Receive from any peer.
- * This should be called whenever there is new data to be received on a socket.
+ * CoreMIDI delivers incoming packet lists to the read procedure on it's own
+ * thread, so there is nothing to do here.
  * @public @memberof MIDIDriverCoreMIDI
  * @param driver The driver.
  * @retval 0 on success.
@@ -125,15 +314,44 @@ int MIDIDriverCoreMIDIReceive( struct MIDIDriverCoreMIDI * driver ) {
 }
 
 /**
- * @brief Send queued messages to all connected peers.
- * This should be called whenever new messages are added to the queue and whenever the
- * socket can accept new data.
+ * @brief Send the pending packet list.
+ * All messages that were added since the last call are sent to the
+ * destination with a single call of @c MIDISend.
  * @public @memberof MIDIDriverCoreMIDI
  * @param driver The driver.
  * @retval 0 on success.
  * @retval >0 if packets could not be sent, or any other operation failed.
  */
 int MIDIDriverCoreMIDISend( struct MIDIDriverCoreMIDI * driver ) {
+  UInt32 npackets;
+  size_t bytes;
+  OSStatus status;
+  MIDIPrecond( driver != NULL, EFAULT );
+
+  if( driver->flush_timer != 0 ) {
+    MIDIRunloopSourceCancelTimer( driver->base.rls, driver->flush_timer );
+    driver->flush_timer = 0;
+  }
+  npackets = driver->packet_list->numPackets;
+  if( npackets == 0 ) return 0;
+  bytes    = driver->packet_bytes;
+
+  if( driver->cm_destination == 0 ) {
+    status = 1;
+    MIDILog( DEBUG, "CoreMIDI driver has no destination, dropping packet list\n" );
+  } else {
+    MIDIProfileBegin( driver->base.profile, MIDI_DRIVER_STAGE_SOCKET_WRITE );
+    status = MIDISend( driver->cm_out_port, driver->cm_destination, driver->packet_list );
+    MIDIProfileEnd( driver->base.profile, MIDI_DRIVER_STAGE_SOCKET_WRITE );
+  }
+  driver->packet = MIDIPacketListInit( driver->packet_list );
+  driver->packet_bytes = 0;
+  if( status != noErr ) {
+    MIDIProfileAdd( driver->base.profile, drops, npackets );
+    return 1;
+  }
+  MIDIProfileAdd( driver->base.profile, packets_out, npackets );
+  MIDIProfileAdd( driver->base.profile, bytes_out, bytes );
   return 0;
 }
 
@@ -147,7 +365,7 @@ int MIDIDriverCoreMIDISend( struct MIDIDriverCoreMIDI * driver ) {
  * @retval >0 if packets could not be sent, or any other operation failed.
  */
 int MIDIDriverCoreMIDIIdle( struct MIDIDriverCoreMIDI * driver ) {
-  return 0;
+  return MIDIDriverCoreMIDISend( driver );
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -17,6 +17,9 @@ struct MIDIDriverCoreMIDI;
 
 struct MIDIDriverCoreMIDI * MIDIDriverCoreMIDICreate( char * name, MIDIClientRef client );
 
+int MIDIDriverCoreMIDISetDestination( struct MIDIDriverCoreMIDI * driver, MIDIEndpointRef destination );
+int MIDIDriverCoreMIDISetFlushWindow( struct MIDIDriverCoreMIDI * driver, unsigned long usec );
+
 int MIDIDriverCoreMIDIReceiveMessage( struct MIDIDriverCoreMIDI * driver, struct MIDIMessage * message );
 int MIDIDriverCoreMIDISendMessage( struct MIDIDriverCoreMIDI * driver, struct MIDIMessage * message );
 
@@ -1,110 +1,928 @@
-#include "osc.h"
-#define MIDI_DRIVER_INTERNALS
-#include "midi/runloop.h"
-#include "midi/driver.h"
-#include "midi/message_queue.h"
-#include "midi/controller.h"
+#include <stdio.h>
 #include <unistd.h>
 #include <string.h>
+#include <stdint.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <arpa/inet.h>
+#include <netdb.h>
+#include <errno.h>
+
+#define MIDI_DRIVER_INTERNALS
+#include "osc.h"
+#include "midi/runloop.h"
+#include "midi/driver.h"
+#include "midi/clock.h"
+#include "midi/controller.h"
+#include "midi/ump.h"
+
+#define OSC_CLOCK_RATE   1000
+#define OSC_PACKET_SIZE  1472
+#define OSC_POOL_SIZE    64
+#define OSC_PATTERN_SIZE 64
+#define OSC_BUNDLE_DEPTH 4
+
+/* an OSC 1.0 bundle starts with "#bundle" and a 64 bit time tag */
+#define OSC_BUNDLE_HEADER_SIZE 16
+#define OSC_BUNDLE_IMMEDIATELY 1
+
+#define OSC_PATTERN_NOTE_OFF      0
+#define OSC_PATTERN_NOTE_ON       1
+#define OSC_PATTERN_POLY_TOUCH    2
+#define OSC_PATTERN_CONTROL       3
+#define OSC_PATTERN_PROGRAM       4
+#define OSC_PATTERN_TOUCH         5
+#define OSC_PATTERN_BEND          6
+#define OSC_PATTERN_ALL_NOTES_OFF 7
+#define OSC_PATTERN_RAW           8
+#define OSC_PATTERN_UMP           9
+#define OSC_NUM_PATTERNS          10
+
+#define OSC_PAD( n ) ( ( (n) + 3 ) & ~3 )
+
+/**
+ * @brief A precomputed OSC message head.
+ * Holds the zero padded address pattern followed by the zero padded type
+ * tag string, so that encoding a message starts with a single copy and
+ * incoming addresses are matched with a single compare.
+ */
+struct OSCPattern {
+  size_t address_length;
+  size_t size;
+  size_t nargs;
+  unsigned char data[OSC_PATTERN_SIZE];
+};
+
+/**
+ * @brief Cursor over the arguments of an OSC message.
+ */
+struct OSCArguments {
+  const char * tags;
+  const unsigned char * data;
+  size_t size;
+  size_t offset;
+};
 
 /**
  * @ingroup MIDI-driver
  * @brief MIDIDriver implementation using the opensoundcontrol protocol.
+ * Outgoing messages are collected in a single OSC bundle until the socket
+ * can be written, the packet is full or @ref MIDIDriverOSCSend is called.
+ * Incoming packets are parsed in place, messages are taken from a pool.
  */
 struct MIDIDriverOSC {
-  struct MIDIDriver super;
-  size_t refs;
-  int    socket;
-  struct MIDIMessageQueue * in_queue;
-  struct MIDIMessageQueue * out_queue;
+  struct MIDIDriver base;
+  int socket;
+  unsigned short port;
+  MIDIBoolean raw;
+  MIDIBoolean ump;
+
+  struct sockaddr_storage destination;
+  socklen_t destination_size;
+
+  struct MIDIMessagePool * pool;
+  struct OSCPattern out[OSC_NUM_PATTERNS];
+  struct OSCPattern in[OSC_NUM_PATTERNS];
+
+  size_t packet_length;
+  size_t packet_count;
+  unsigned char packet[OSC_PACKET_SIZE];
+  unsigned char buffer[OSC_PACKET_SIZE];
+};
+
+static char * _osc_pattern_names[OSC_NUM_PATTERNS] = {
+  MIDI_DRIVER_OSC_DEFAULT_ADDRESS_NOTE_OFF,
+  MIDI_DRIVER_OSC_DEFAULT_ADDRESS_NOTE_ON,
+  MIDI_DRIVER_OSC_DEFAULT_ADDRESS_POLYPHONIC_KEY_PRESSURE,
+  MIDI_DRIVER_OSC_DEFAULT_ADDRESS_CONTROL_CHANGE,
+  MIDI_DRIVER_OSC_DEFAULT_ADDRESS_PROGRAM_CHANGE,
+  MIDI_DRIVER_OSC_DEFAULT_ADDRESS_CHANNEL_PRESSURE,
+  MIDI_DRIVER_OSC_DEFAULT_ADDRESS_PITCH_WHEEL_CHANGE,
+  MIDI_DRIVER_OSC_DEFAULT_ADDRESS_ALL_NOTES_OFF,
+  MIDI_DRIVER_OSC_DEFAULT_ADDRESS_RAW,
+  MIDI_DRIVER_OSC_DEFAULT_ADDRESS_UMP
+};
+
+static char * _osc_pattern_tags[OSC_NUM_PATTERNS] = {
+  ",iii", ",iii", ",iii", ",iii", ",ii", ",ii", ",ii", ",i", ",b", ",b"
 };
 
-struct MIDIDriverOSC * MIDIDriverOSCCreate( ) {
+/* MARK: Internals *//**
+ * @name Internals
+ * @cond INTERNALS
+ * Encoding and decoding of OSC data.
+ * @{
+ */
+
+static void _osc_write_int( unsigned char * buffer, uint32_t value ) {
+  buffer[0] = ( value >> 24 ) & 0xff;
+  buffer[1] = ( value >> 16 ) & 0xff;
+  buffer[2] = ( value >>  8 ) & 0xff;
+  buffer[3] =   value         & 0xff;
+}
+
+static uint32_t _osc_read_int( const unsigned char * buffer ) {
+  return ( (uint32_t) buffer[0] << 24 ) | ( (uint32_t) buffer[1] << 16 )
+       | ( (uint32_t) buffer[2] <<  8 ) |   (uint32_t) buffer[3];
+}
+
+/**
+ * @brief Build the message head for an address.
+ * @private @memberof MIDIDriverOSC
+ * @param pattern The pattern.
+ * @param space   The address space.
+ * @param name    The method name.
+ * @param tags    The type tag string.
+ * @retval 0 on success.
+ * @retval 1 if the address is too long.
+ */
+static int _osc_pattern_init( struct OSCPattern * pattern, char * space, char * name, char * tags ) {
+  size_t space_length = strlen( space ), name_length = strlen( name ), tags_length = strlen( tags );
+  size_t address_size = OSC_PAD( space_length + name_length + 2 );
+
+  if( address_size + OSC_PAD( tags_length + 1 ) > OSC_PATTERN_SIZE ) return 1;
+  memset( &(pattern->data[0]), 0, OSC_PATTERN_SIZE );
+  memcpy( &(pattern->data[0]), space, space_length );
+  pattern->data[space_length] = '/';
+  memcpy( &(pattern->data[space_length + 1]), name, name_length );
+  memcpy( &(pattern->data[address_size]), tags, tags_length );
+  pattern->address_length = space_length + name_length + 2;
+  pattern->size  = address_size + OSC_PAD( tags_length + 1 );
+  pattern->nargs = tags_length - 1;
+  return 0;
+}
+
+static int _osc_patterns_init( struct OSCPattern * patterns, char * space ) {
+  int i;
+  for( i=0; i<OSC_NUM_PATTERNS; i++ ) {
+    if( _osc_pattern_init( &(patterns[i]), space, _osc_pattern_names[i], _osc_pattern_tags[i] ) ) return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Find the end of a zero terminated, zero padded OSC string.
+ * @private @memberof MIDIDriverOSC
+ * @param size   The size of the buffer.
+ * @param buffer The buffer.
+ * @return the padded size of the string.
+ * @return 0 if the string is not terminated within the buffer.
+ */
+static size_t _osc_string_size( size_t size, const unsigned char * buffer ) {
+  const unsigned char * end = memchr( buffer, 0, size );
+  size_t length;
+  if( end == NULL ) return 0;
+  length = OSC_PAD( end - buffer + 1 );
+  return ( length <= size ) ? length : 0;
+}
+
+/**
+ * @brief Match the address of an incoming OSC message.
+ * @private @memberof MIDIDriverOSC
+ * @param driver  The driver.
+ * @param size    The size of the message.
+ * @param buffer  The message.
+ * @param args    The argument cursor that is set up for the message.
+ * @return the index of the matching pattern.
+ * @return -1 if the message is malformed or the address is unknown.
+ */
+static int _osc_match( struct MIDIDriverOSC * driver, size_t size, const unsigned char * buffer, struct OSCArguments * args ) {
+  size_t address_size, tags_size;
+  int i;
+
+  if( size < 8 || buffer[0] != '/' ) return -1;
+  address_size = _osc_string_size( size, buffer );
+  if( address_size == 0 || address_size >= size || buffer[address_size] != ',' ) return -1;
+  tags_size = _osc_string_size( size - address_size, buffer + address_size );
+  if( tags_size == 0 ) return -1;
+
+  args->tags   = (const char *) buffer + address_size + 1;
+  args->data   = buffer + address_size + tags_size;
+  args->size   = size - address_size - tags_size;
+  args->offset = 0;
+  for( i=0; i<OSC_NUM_PATTERNS; i++ ) {
+    if( driver->in[i].address_length <= address_size
+     && memcmp( buffer, &(driver->in[i].data[0]), driver->in[i].address_length ) == 0 ) return i;
+  }
+  return -1;
+}
+
+/**
+ * @brief Read the next numeric argument.
+ * Integers are used as they are, floats are truncated.
+ * @private @memberof MIDIDriverOSC
+ * @param args  The argument cursor.
+ * @param value The value.
+ * @retval 0 on success.
+ * @retval 1 if there is no numeric argument.
+ */
+static int _osc_next_int( struct OSCArguments * args, int * value ) {
+  union { uint32_t i; float f; } number;
+  if( args->offset + 4 > args->size ) return 1;
+  number.i = _osc_read_int( args->data + args->offset );
+  switch( *(args->tags) ) {
+    case 'i':
+      *value = (int32_t) number.i;
+      break;
+    case 'f':
+      *value = (int) number.f;
+      break;
+    default:
+      return 1;
+  }
+  args->tags++;
+  args->offset += 4;
+  return 0;
+}
+
+/**
+ * @brief Read the next blob argument.
+ * @private @memberof MIDIDriverOSC
+ * @param args The argument cursor.
+ * @param size The size of the blob.
+ * @param data The blob data, pointing into the message.
+ * @retval 0 on success.
+ * @retval 1 if there is no blob argument.
+ */
+static int _osc_next_blob( struct OSCArguments * args, size_t * size, const unsigned char ** data ) {
+  uint32_t length;
+  if( *(args->tags) != 'b' || args->offset + 4 > args->size ) return 1;
+  length = _osc_read_int( args->data + args->offset );
+  if( length > args->size - args->offset - 4 ) return 1;
+  *size = length;
+  *data = args->data + args->offset + 4;
+  args->tags++;
+  args->offset += 4 + OSC_PAD( length );
+  return 0;
+}
+
+/**
+ * @brief Decode a single OSC message.
+ * @private @memberof MIDIDriverOSC
+ * @param driver     The driver.
+ * @param message    The message.
+ * @param size       The size of the OSC message.
+ * @param buffer     The OSC message.
+ * @param bytes_read The number of bytes that were used.
+ * @param raw        -1 to accept any address, 0 to accept the default
+ *                   addresses, 1 to accept the raw address only and
+ *                   2 to accept the universal packet address only.
+ * @retval 0 on success.
+ * @retval >0 if the message could not be decoded.
+ */
+static int _osc_decode( struct MIDIDriverOSC * driver, struct MIDIMessage * message,
+                        size_t size, const unsigned char * buffer, size_t * bytes_read, int raw ) {
+  struct OSCArguments args;
+  const unsigned char * blob;
+  unsigned char bytes[3];
+  struct MIDIUniversalPacket packet;
+  int i, values[3] = { 0, 0, 0 };
+  size_t n, read;
+
+  i = _osc_match( driver, size, buffer, &args );
+  if( i < 0 ) return 1;
+  if( raw >= 0 && raw != ( ( i == OSC_PATTERN_RAW ) ? 1 : ( i == OSC_PATTERN_UMP ) ? 2 : 0 ) ) return 1;
+
+  if( i == OSC_PATTERN_RAW ) {
+    if( _osc_next_blob( &args, &n, &blob ) || n == 0 ) return 1;
+    if( MIDIMessageDecode( message, n, (unsigned char *) blob, &read ) ) return 1;
+  } else if( i == OSC_PATTERN_UMP ) {
+    if( _osc_next_blob( &args, &n, &blob ) ) return 1;
+    if( MIDIUniversalPacketDecode( n, (void *) blob, 1, &packet, &read, NULL ) || read != 1 ) return 1;
+    if( MIDIUniversalPacketToMessage( &packet, message ) ) return 1;
+  } else {
+    for( n=0; n<driver->in[i].nargs; n++ ) {
+      if( _osc_next_int( &args, &(values[n]) ) ) return 1;
+    }
+    if( values[0] < 1 || values[0] > 16 ) return 1;
+    if( i == OSC_PATTERN_ALL_NOTES_OFF ) {
+      bytes[0] = ( MIDI_STATUS_CONTROL_CHANGE << 4 ) | ( values[0] - 1 );
+      bytes[1] = MIDI_CONTROL_ALL_NOTES_OFF;
+      bytes[2] = 0;
+    } else {
+      if( i == OSC_PATTERN_BEND ) {
+        values[2] = ( values[1] >> 7 ) & 0x7f;
+      }
+      bytes[0] = ( ( MIDI_STATUS_NOTE_OFF + i ) << 4 ) | ( values[0] - 1 );
+      bytes[1] = values[1] & 0x7f;
+      bytes[2] = values[2] & 0x7f;
+    }
+    n = ( driver->in[i].nargs == 3 || i == OSC_PATTERN_BEND || i == OSC_PATTERN_ALL_NOTES_OFF ) ? 3 : 2;
+    if( MIDIMessageDecode( message, n, &(bytes[0]), &read ) ) return 1;
+  }
+  if( bytes_read != NULL ) {
+    *bytes_read = ( args.data - buffer ) + args.offset;
+  }
+  return 0;
+}
+
+/**
+ * @brief Write the blob of a raw OSC message.
+ * @private @memberof MIDIDriverOSC
+ * @param driver  The driver.
+ * @param message The message.
+ * @param size    The size of the buffer.
+ * @param buffer  The buffer.
+ * @param written The number of bytes that were written.
+ * @retval 0 on success.
+ * @retval >0 if the message does not fit into the buffer.
+ */
+static int _osc_encode_raw( struct MIDIDriverOSC * driver, struct MIDIMessage * message,
+                            size_t size, unsigned char * buffer, size_t * written ) {
+  struct OSCPattern * pattern = &(driver->out[OSC_PATTERN_RAW]);
+  size_t length = 0;
+
+  if( size < pattern->size + 8 ) return 1;
+  memcpy( buffer, &(pattern->data[0]), pattern->size );
+  if( MIDIMessageEncode( message, size - pattern->size - 4, buffer + pattern->size + 4, &length ) ) return 1;
+  if( pattern->size + 4 + OSC_PAD( length ) > size ) return 1;
+  _osc_write_int( buffer + pattern->size, length );
+  memset( buffer + pattern->size + 4 + length, 0, OSC_PAD( length ) - length );
+  *written = pattern->size + 4 + OSC_PAD( length );
+  return 0;
+}
+
+/**
+ * @brief Write the blob of a universal packet OSC message.
+ * The blob holds the words of a single universal MIDI packet in network
+ * byte order, its size is always a multiple of four.
+ * @private @memberof MIDIDriverOSC
+ * @param driver  The driver.
+ * @param message The message.
+ * @param size    The size of the buffer.
+ * @param buffer  The buffer.
+ * @param written The number of bytes that were written.
+ * @retval 0 on success.
+ * @retval >0 if the message has no packet form or does not fit into the buffer.
+ */
+static int _osc_encode_ump( struct MIDIDriverOSC * driver, struct MIDIMessage * message,
+                            size_t size, unsigned char * buffer, size_t * written ) {
+  struct OSCPattern * pattern = &(driver->out[OSC_PATTERN_UMP]);
+  struct MIDIUniversalPacket packet;
+  size_t length = 0;
+
+  if( size < pattern->size + 8 ) return 1;
+  if( MIDIUniversalPacketFromMessage( &packet, 0, message, 1 ) ) return 1;
+  if( MIDIUniversalPacketEncode( size - pattern->size - 4, buffer + pattern->size + 4, 1, &packet, NULL, &length ) ) return 1;
+  memcpy( buffer, &(pattern->data[0]), pattern->size );
+  _osc_write_int( buffer + pattern->size, length );
+  *written = pattern->size + 4 + length;
+  return 0;
+}
+
+/**
+ * @brief Encode a message with the default namespace.
+ * @private @memberof MIDIDriverOSC
+ * @param driver  The driver.
+ * @param message The message.
+ * @param size    The size of the buffer.
+ * @param buffer  The buffer.
+ * @param written The number of bytes that were written.
+ * @retval 0 on success.
+ * @retval >0 if the message has no default address or does not fit into the buffer.
+ */
+static int _osc_encode_default( struct MIDIDriverOSC * driver, struct MIDIMessage * message,
+                                size_t size, unsigned char * buffer, size_t * written ) {
+  struct MIDICompactMessage compact;
+  struct OSCPattern * pattern;
+  int i, status;
+
+  if( MIDIMessageGetCompact( message, &compact ) ) return 1;
+  status = compact.bytes[0] >> 4;
+  if( status < MIDI_STATUS_NOTE_OFF || status > MIDI_STATUS_PITCH_WHEEL_CHANGE ) return 1;
+  i = status - MIDI_STATUS_NOTE_OFF;
+  if( status == MIDI_STATUS_CONTROL_CHANGE && compact.bytes[1] == MIDI_CONTROL_ALL_NOTES_OFF ) {
+    i = OSC_PATTERN_ALL_NOTES_OFF;
+  }
+  pattern = &(driver->out[i]);
+  if( size < pattern->size + 4 * pattern->nargs ) return 1;
+
+  memcpy( buffer, &(pattern->data[0]), pattern->size );
+  buffer += pattern->size;
+  _osc_write_int( buffer, ( compact.bytes[0] & 0x0f ) + 1 );
+  if( i == OSC_PATTERN_BEND ) {
+    _osc_write_int( buffer + 4, compact.bytes[1] | ( compact.bytes[2] << 7 ) );
+  } else if( pattern->nargs > 1 ) {
+    _osc_write_int( buffer + 4, compact.bytes[1] );
+    if( pattern->nargs > 2 ) {
+      _osc_write_int( buffer + 8, compact.bytes[2] );
+    }
+  }
+  *written = pattern->size + 4 * pattern->nargs;
+  return 0;
+}
+
+/**
+ * @brief Decode an OSC packet and pass the messages to the driver's port.
+ * Bundles are unpacked recursively, up to @c OSC_BUNDLE_DEPTH levels.
+ * @private @memberof MIDIDriverOSC
+ * @param driver The driver.
+ * @param size   The size of the packet.
+ * @param buffer The packet.
+ * @param depth  The bundle nesting level.
+ * @retval 0 on success.
+ * @retval >0 if the packet is malformed or a message could not be decoded.
+ */
+static int _osc_receive_packet( struct MIDIDriverOSC * driver, size_t size, const unsigned char * buffer, int depth ) {
+  struct MIDIMessage * message;
+  MIDITimestamp now;
+  size_t offset, length;
+  int result = 0;
+
+  if( size >= OSC_BUNDLE_HEADER_SIZE && memcmp( buffer, "#bundle", 8 ) == 0 ) {
+    if( depth >= OSC_BUNDLE_DEPTH ) return 1;
+    for( offset = OSC_BUNDLE_HEADER_SIZE; offset + 4 <= size; offset += 4 + length ) {
+      length = _osc_read_int( buffer + offset );
+      if( length > size - offset - 4 || ( length & 3 ) ) return result + 1;
+      result += _osc_receive_packet( driver, length, buffer + offset + 4, depth + 1 );
+    }
+    return result;
+  }
+
+  message = MIDIMessageCreateFromPool( driver->pool, MIDI_STATUS_NOTE_OFF );
+  if( message == NULL ) return 1;
+  if( _osc_decode( driver, message, size, buffer, NULL, -1 ) == 0 ) {
+    MIDIClockGetNow( driver->base.clock, &now );
+    MIDIMessageSetTimestamp( message, now );
+    result = MIDIDriverReceive( &(driver->base), message );
+  } else {
+    MIDIProfileAdd( driver->base.profile, drops, 1 );
+    result = 1;
+  }
+  MIDIMessageRelease( message );
+  return result;
+}
+
+/**
+ * @}
+ * @endcond
+ */
+
+static int _osc_read_fds( void * drv, int nfds, fd_set * fds ) {
+  struct MIDIDriverOSC * driver = drv;
+  if( nfds <= 0 || !FD_ISSET( driver->socket, fds ) ) return 0;
+  return MIDIDriverOSCReceive( driver );
+}
+
+static int _osc_write_fds( void * drv, int nfds, fd_set * fds ) {
+  struct MIDIDriverOSC * driver = drv;
+  if( nfds <= 0 || !FD_ISSET( driver->socket, fds ) ) return 0;
+  return MIDIDriverOSCSend( driver );
+}
+
+static int _osc_idle_timeout( void * drv, struct timespec * ts ) {
+  return 0;
+}
+
+static int _driver_send( void * driverp, struct MIDIMessage * message ) {
+  return MIDIDriverOSCSendMessage( driverp, message );
+}
+
+void MIDIDriverOSCDestroy( struct MIDIDriverOSC * driver );
+static void _driver_destroy( void * driverp ) {
+  MIDIDriverOSCDestroy( driverp );
+}
+
+/* MARK: Creation and destruction *//**
+ * @name Creation and destruction
+ * Creating, destroying and reference counting of MIDIDriverOSC objects.
+ * @{
+ */
+
+/**
+ * @brief Create a MIDIDriverOSC instance.
+ * Allocate space and initialize an MIDIDriverOSC instance that listens
+ * for OSC packets on the given UDP port.
+ * @public @memberof MIDIDriverOSC
+ * @param name The name of the driver.
+ * @param port The UDP port to listen on.
+ * @return a pointer to the created driver structure on success.
+ * @return a @c NULL pointer if the driver could not created.
+ */
+struct MIDIDriverOSC * MIDIDriverOSCCreate( char * name, unsigned short port ) {
   struct MIDIDriverOSC * driver = malloc( sizeof( struct MIDIDriverOSC ) );
+  struct MIDIRunloopSourceDelegate delegate = { NULL, &_osc_read_fds, &_osc_write_fds, &_osc_idle_timeout };
   struct sockaddr_in addr;
-  
-  driver->refs   = 1;
+  MIDIPrecondReturn( driver != NULL, ENOMEM, NULL );
+  MIDIDriverInit( &(driver->base), name, OSC_CLOCK_RATE );
+
+  driver->port = port;
+  driver->raw  = 0;
+  driver->ump  = 0;
+  driver->destination_size = 0;
+  driver->packet_length = OSC_BUNDLE_HEADER_SIZE;
+  driver->packet_count  = 0;
+  memcpy( &(driver->packet[0]), "#bundle", 8 );
+  _osc_write_int( &(driver->packet[8]), 0 );
+  _osc_write_int( &(driver->packet[12]), OSC_BUNDLE_IMMEDIATELY );
+  _osc_patterns_init( &(driver->out[0]), MIDI_DRIVER_OSC_DEFAULT_ADDRESS_SPACE_OUT );
+  _osc_patterns_init( &(driver->in[0]), MIDI_DRIVER_OSC_DEFAULT_ADDRESS_SPACE_IN );
+  driver->pool = MIDIMessagePoolCreate( OSC_POOL_SIZE );
+
+  driver->base.send    = &_driver_send;
+  driver->base.destroy = &_driver_destroy;
+
   driver->socket = socket( PF_INET, SOCK_DGRAM, 0 );
-  
-  addr.sin_family = AF_INET;
-  addr.sin_port = 5006;
+  addr.sin_family      = AF_INET;
+  addr.sin_port        = htons( port );
   addr.sin_addr.s_addr = INADDR_ANY;
-  
-  bind( driver->socket, (struct sockaddr *) &addr, sizeof(addr) );
-  
-  driver->in_queue  = MIDIMessageQueueCreate();
-  driver->out_queue = MIDIMessageQueueCreate();
+  if( driver->socket < 0 || bind( driver->socket, (struct sockaddr *) &addr, sizeof(addr) ) ) {
+    MIDIError( errno, "Could not bind OSC socket." );
+  }
+
+  delegate.info = driver;
+  driver->base.rls = MIDIRunloopSourceCreate( &delegate );
+  MIDIRunloopSourceScheduleRead( driver->base.rls, driver->socket );
   return driver;
 }
 
+/**
+ * @brief Destroy a MIDIDriverOSC instance.
+ * Free all resources occupied by the driver.
+ * @public @memberof MIDIDriverOSC
+ * @param driver The driver.
+ */
 void MIDIDriverOSCDestroy( struct MIDIDriverOSC * driver ) {
-  MIDIMessageQueueRelease( driver->in_queue );
-  MIDIMessageQueueRelease( driver->out_queue );
-  if( driver->socket > 0 ) {
+  if( driver->socket >= 0 ) {
+    MIDIRunloopSourceClearRead( driver->base.rls, driver->socket );
+    MIDIRunloopSourceClearWrite( driver->base.rls, driver->socket );
     close( driver->socket );
   }
-  free( driver );
+  if( driver->pool != NULL ) {
+    MIDIMessagePoolRelease( driver->pool );
+  }
 }
 
+/**
+ * @brief Retain a MIDIDriverOSC instance.
+ * @public @memberof MIDIDriverOSC
+ * @param driver The driver.
+ */
 void MIDIDriverOSCRetain( struct MIDIDriverOSC * driver ) {
-  driver->refs++;
+  MIDIDriverRetain( &(driver->base) );
 }
 
+/**
+ * @brief Release a MIDIDriverOSC instance.
+ * @public @memberof MIDIDriverOSC
+ * @param driver The driver.
+ */
 void MIDIDriverOSCRelease( struct MIDIDriverOSC * driver ) {
-  if( ! --driver->refs ) {
-    MIDIDriverOSCDestroy( driver );
+  MIDIDriverRelease( &(driver->base) );
+}
+
+/** @} */
+
+/* MARK: Configuration *//**
+ * @name Configuration
+ * @{
+ */
+
+/**
+ * @brief Set the address spaces of the default namespace.
+ * The message heads for all addresses are computed once, so encoding and
+ * matching does not depend on the length of the address space.
+ * @public @memberof MIDIDriverOSC
+ * @param driver The driver.
+ * @param out    The address space for outgoing messages.
+ * @param in     The address space for incoming messages.
+ * @retval 0 on success.
+ * @retval >0 if an address space is too long.
+ */
+int MIDIDriverOSCSetAddressSpace( struct MIDIDriverOSC * driver, char * out, char * in ) {
+  struct OSCPattern patterns[OSC_NUM_PATTERNS * 2];
+  MIDIPrecond( driver != NULL, EFAULT );
+  MIDIPrecond( out != NULL && in != NULL, EINVAL );
+  if( _osc_patterns_init( &(patterns[0]), out ) || _osc_patterns_init( &(patterns[OSC_NUM_PATTERNS]), in ) ) {
+    MIDIError( EINVAL, "OSC address space is too long." );
+    return 1;
   }
+  memcpy( &(driver->out[0]), &(patterns[0]), sizeof(driver->out) );
+  memcpy( &(driver->in[0]), &(patterns[OSC_NUM_PATTERNS]), sizeof(driver->in) );
+  return 0;
+}
+
+/**
+ * @brief Send all messages as raw MIDI blobs.
+ * Messages that have no address in the default namespace, like system
+ * exclusive messages, are always sent raw.
+ * @public @memberof MIDIDriverOSC
+ * @param driver The driver.
+ * @param raw    Whether to send raw messages.
+ * @retval 0 on success.
+ */
+int MIDIDriverOSCSetRawMode( struct MIDIDriverOSC * driver, MIDIBoolean raw ) {
+  MIDIPrecond( driver != NULL, EFAULT );
+  driver->raw = raw ? 1 : 0;
+  return 0;
+}
+
+/**
+ * @brief Send messages as universal MIDI packets.
+ * Channel voice messages are sent as MIDI 2.0 packets, system common and
+ * real time messages as system packets. System exclusive messages have no
+ * packet form and are sent raw. Incoming packets are accepted in any mode.
+ * @public @memberof MIDIDriverOSC
+ * @param driver The driver.
+ * @param ump    Whether to send universal packets.
+ * @retval 0 on success.
+ */
+int MIDIDriverOSCSetUniversalPacketMode( struct MIDIDriverOSC * driver, MIDIBoolean ump ) {
+  MIDIPrecond( driver != NULL, EFAULT );
+  driver->ump = ump ? 1 : 0;
+  return 0;
+}
+
+/**
+ * @brief Set the destination of outgoing packets.
+ * @public @memberof MIDIDriverOSC
+ * @param driver The driver.
+ * @param size   The size of the address pointed to by @c addr.
+ * @param addr   The address.
+ * @retval 0 on success.
+ * @retval >0 if the address could not be used.
+ */
+int MIDIDriverOSCSetDestinationWithSockaddr( struct MIDIDriverOSC * driver, socklen_t size, struct sockaddr * addr ) {
+  MIDIPrecond( driver != NULL, EFAULT );
+  MIDIPrecond( addr != NULL && size <= sizeof(driver->destination), EINVAL );
+  memcpy( &(driver->destination), addr, size );
+  driver->destination_size = size;
+  return 0;
+}
+
+/**
+ * @brief Set the destination of outgoing packets.
+ * The address has to be numeric, so that the runloop never waits for
+ * a name server.
+ * @public @memberof MIDIDriverOSC
+ * @param driver  The driver.
+ * @param address The numeric internet address.
+ * @param port    The UDP port.
+ * @retval 0 on success.
+ * @retval >0 if the address could not be used.
+ */
+int MIDIDriverOSCSetDestination( struct MIDIDriverOSC * driver, char * address, unsigned short port ) {
+  struct addrinfo hints, * res;
+  char portname[8];
+  int result;
+
+  memset( &hints, 0, sizeof(hints) );
+  hints.ai_family   = AF_INET;
+  hints.ai_socktype = SOCK_DGRAM;
+  hints.ai_flags    = AI_NUMERICHOST | AI_NUMERICSERV;
+  sprintf( &(portname[0]), "%hu", port );
+  if( getaddrinfo( address, portname, &hints, &res ) ) return 1;
+  result = MIDIDriverOSCSetDestinationWithSockaddr( driver, res->ai_addrlen, res->ai_addr );
+  freeaddrinfo( res );
+  return result;
+}
+
+/**
+ * @brief Get the socket the driver uses.
+ * @public @memberof MIDIDriverOSC
+ * @param driver The driver.
+ * @param socket The socket.
+ * @retval 0 on success.
+ */
+int MIDIDriverOSCGetSocket( struct MIDIDriverOSC * driver, int * socket ) {
+  MIDIPrecond( driver != NULL, EFAULT );
+  MIDIPrecond( socket != NULL, EINVAL );
+  *socket = driver->socket;
+  return 0;
 }
 
+/** @} */
+
+/* MARK: Encoding and decoding *//**
+ * @name Encoding and decoding
+ * Convert between MIDI messages and OSC messages in caller supplied
+ * buffers, without allocating memory.
+ * @{
+ */
+
+/**
+ * @brief Encode a channel voice message with the default namespace.
+ * @public @memberof MIDIDriverOSC
+ * @param driver        The driver.
+ * @param message       The message.
+ * @param size          The size of the buffer.
+ * @param buffer        The buffer.
+ * @param bytes_written The number of bytes that were written.
+ * @retval 0 on success.
+ * @retval >0 if the message has no default address or does not fit into the buffer.
+ */
 int MIDIDriverOSCEncodeMessageDefault( struct MIDIDriverOSC * driver, struct MIDIMessage * message,
                                        size_t size, void * buffer, size_t * bytes_written ) {
-  MIDIStatus  status;
-  MIDIControl control;
-  MIDIMessageGetStatus( message, &status );
-  switch( status ) {
-    case MIDI_STATUS_NOTE_OFF:
-      break;
-    case MIDI_STATUS_NOTE_ON:
-      break;
-    case MIDI_STATUS_POLYPHONIC_KEY_PRESSURE:
-      break;
-    case MIDI_STATUS_CONTROL_CHANGE:
-      MIDIMessageGet( message, MIDI_CONTROL, sizeof(MIDIControl), &control );
-      if( control == MIDI_CONTROL_ALL_NOTES_OFF ) {
-      } else {
-      }
-      break;
-    case MIDI_STATUS_PROGRAM_CHANGE:
-      break;
-    case MIDI_STATUS_CHANNEL_PRESSURE:
-      break;
-    case MIDI_STATUS_PITCH_WHEEL_CHANGE:
-      break;
-  }
-  return 0;
+  MIDIPrecond( driver != NULL, EFAULT );
+  MIDIPrecond( message != NULL && buffer != NULL && bytes_written != NULL, EINVAL );
+  return _osc_encode_default( driver, message, size, buffer, bytes_written );
 }
 
+/**
+ * @brief Decode an OSC message of the default namespace.
+ * @public @memberof MIDIDriverOSC
+ * @param driver     The driver.
+ * @param message    The message.
+ * @param size       The size of the OSC message.
+ * @param buffer     The OSC message.
+ * @param bytes_read The number of bytes that were used.
+ * @retval 0 on success.
+ * @retval >0 if the OSC message could not be decoded.
+ */
 int MIDIDriverOSCDecodeMessageDefault( struct MIDIDriverOSC * driver, struct MIDIMessage * message,
                                        size_t size, void * buffer, size_t * bytes_read ) {
-  return 0;
+  MIDIPrecond( driver != NULL, EFAULT );
+  MIDIPrecond( message != NULL && buffer != NULL, EINVAL );
+  return _osc_decode( driver, message, size, buffer, bytes_read, 0 );
 }
 
+/**
+ * @brief Encode a message as a raw MIDI blob.
+ * @public @memberof MIDIDriverOSC
+ * @param driver        The driver.
+ * @param message       The message.
+ * @param size          The size of the buffer.
+ * @param buffer        The buffer.
+ * @param bytes_written The number of bytes that were written.
+ * @retval 0 on success.
+ * @retval >0 if the message does not fit into the buffer.
+ */
 int MIDIDriverOSCEncodeMessageRaw( struct MIDIDriverOSC * driver, struct MIDIMessage * message,
                                    size_t size, void * buffer, size_t * bytes_written ) {
-  return 0;
+  MIDIPrecond( driver != NULL, EFAULT );
+  MIDIPrecond( message != NULL && buffer != NULL && bytes_written != NULL, EINVAL );
+  return _osc_encode_raw( driver, message, size, buffer, bytes_written );
 }
 
+/**
+ * @brief Decode a raw MIDI blob OSC message.
+ * @public @memberof MIDIDriverOSC
+ * @param driver     The driver.
+ * @param message    The message.
+ * @param size       The size of the OSC message.
+ * @param buffer     The OSC message.
+ * @param bytes_read The number of bytes that were used.
+ * @retval 0 on success.
+ * @retval >0 if the OSC message could not be decoded.
+ */
 int MIDIDriverOSCDecodeMessageRaw( struct MIDIDriverOSC * driver, struct MIDIMessage * message,
                                    size_t size, void * buffer, size_t * bytes_read ) {
+  MIDIPrecond( driver != NULL, EFAULT );
+  MIDIPrecond( message != NULL && buffer != NULL, EINVAL );
+  return _osc_decode( driver, message, size, buffer, bytes_read, 1 );
+}
+
+/**
+ * @brief Encode a message as a universal MIDI packet blob.
+ * @public @memberof MIDIDriverOSC
+ * @param driver        The driver.
+ * @param message       The message.
+ * @param size          The size of the buffer.
+ * @param buffer        The buffer.
+ * @param bytes_written The number of bytes that were written.
+ * @retval 0 on success.
+ * @retval >0 if the message has no packet form or does not fit into the buffer.
+ */
+int MIDIDriverOSCEncodeMessageUniversal( struct MIDIDriverOSC * driver, struct MIDIMessage * message,
+                                         size_t size, void * buffer, size_t * bytes_written ) {
+  MIDIPrecond( driver != NULL, EFAULT );
+  MIDIPrecond( message != NULL && buffer != NULL && bytes_written != NULL, EINVAL );
+  return _osc_encode_ump( driver, message, size, buffer, bytes_written );
+}
+
+/**
+ * @brief Decode a universal MIDI packet blob OSC message.
+ * MIDI 2.0 channel voice packets are scaled down to MIDI 1.0 messages.
+ * @public @memberof MIDIDriverOSC
+ * @param driver     The driver.
+ * @param message    The message.
+ * @param size       The size of the OSC message.
+ * @param buffer     The OSC message.
+ * @param bytes_read The number of bytes that were used.
+ * @retval 0 on success.
+ * @retval >0 if the OSC message could not be decoded.
+ */
+int MIDIDriverOSCDecodeMessageUniversal( struct MIDIDriverOSC * driver, struct MIDIMessage * message,
+                                         size_t size, void * buffer, size_t * bytes_read ) {
+  MIDIPrecond( driver != NULL, EFAULT );
+  MIDIPrecond( message != NULL && buffer != NULL, EINVAL );
+  return _osc_decode( driver, message, size, buffer, bytes_read, 2 );
+}
+
+/** @} */
+
+/* MARK: Sending and receiving *//**
+ * @name Sending and receiving
+ * @{
+ */
+
+/**
+ * @brief Queue a message for sending.
+ * The message is added to the bundle that is sent with the next packet.
+ * If the bundle is full, it is sent first.
+ * @public @memberof MIDIDriverOSC
+ * @param driver  The driver.
+ * @param message The message.
+ * @retval 0 on success.
+ * @retval >0 if the message could not be encoded.
+ */
+int MIDIDriverOSCSendMessage( struct MIDIDriverOSC * driver, struct MIDIMessage * message ) {
+  size_t written = 0, size;
+  unsigned char * buffer;
+  int attempt;
+  MIDIPrecond( driver != NULL, EFAULT );
+  MIDIPrecond( message != NULL, EINVAL );
+
+  for( attempt=0; attempt<2; attempt++ ) {
+    buffer = &(driver->packet[driver->packet_length + 4]);
+    size   = OSC_PACKET_SIZE - driver->packet_length - 4;
+    if( ( driver->ump && _osc_encode_ump( driver, message, size, buffer, &written ) == 0 )
+     || ( !driver->raw && !driver->ump && _osc_encode_default( driver, message, size, buffer, &written ) == 0 )
+     || _osc_encode_raw( driver, message, size, buffer, &written ) == 0 ) {
+      _osc_write_int( buffer - 4, written );
+      driver->packet_length += 4 + written;
+      driver->packet_count++;
+      MIDIRunloopSourceScheduleWrite( driver->base.rls, driver->socket );
+      return 0;
+    }
+    if( driver->packet_count == 0 ) break;
+    MIDIDriverOSCSend( driver );
+  }
+  MIDILog( DEBUG, "could not encode OSC message, dropping message\n" );
+  MIDIProfileAdd( driver->base.profile, drops, 1 );
+  return 1;
+}
+
+/**
+ * @brief Send the queued messages.
+ * A single message is sent as it is, multiple messages are sent as one
+ * OSC bundle.
+ * @public @memberof MIDIDriverOSC
+ * @param driver The driver.
+ * @retval 0 on success.
+ * @retval >0 if the packet could not be sent.
+ */
+int MIDIDriverOSCSend( struct MIDIDriverOSC * driver ) {
+  unsigned char * buffer = &(driver->packet[0]);
+  size_t length = driver->packet_length;
+  ssize_t bytes;
+  MIDIPrecond( driver != NULL, EFAULT );
+
+  MIDIRunloopSourceClearWrite( driver->base.rls, driver->socket );
+  if( driver->packet_count == 0 ) return 0;
+  if( driver->packet_count == 1 ) {
+    buffer += OSC_BUNDLE_HEADER_SIZE + 4;
+    length -= OSC_BUNDLE_HEADER_SIZE + 4;
+  }
+  driver->packet_length = OSC_BUNDLE_HEADER_SIZE;
+  driver->packet_count  = 0;
+  if( driver->destination_size == 0 ) {
+    MIDILog( DEBUG, "OSC driver has no destination, dropping packet\n" );
+    return 1;
+  }
+
+  bytes = sendto( driver->socket, buffer, length, 0, (struct sockaddr *) &(driver->destination), driver->destination_size );
+  if( bytes != (ssize_t) length ) {
+    MIDIProfileAdd( driver->base.profile, drops, 1 );
+    return 1;
+  }
+  MIDIProfileAdd( driver->base.profile, packets_out, 1 );
+  MIDIProfileAdd( driver->base.profile, bytes_out, length );
   return 0;
 }
 
-int MIDIDriverOSCSendMessage( struct MIDIDriverOSC * driver, struct MIDIMessage * message );
-int MIDIDriverOSCReceiveMessage( struct MIDIDriverOSC * driver, struct MIDIMessage * message );
+/**
+ * @brief Decode an OSC packet and pass the messages to the driver's port.
+ * The packet is parsed in place, messages are taken from the driver's pool.
+ * @public @memberof MIDIDriverOSC
+ * @param driver The driver.
+ * @param size   The size of the packet.
+ * @param buffer The packet.
+ * @retval 0 on success.
+ * @retval >0 if the packet is malformed or a message could not be decoded.
+ */
+int MIDIDriverOSCReceivePacket( struct MIDIDriverOSC * driver, size_t size, void * buffer ) {
+  MIDIPrecond( driver != NULL, EFAULT );
+  MIDIPrecond( buffer != NULL, EINVAL );
+  return _osc_receive_packet( driver, size, buffer, 0 );
+}
+
+/**
+ * @brief Receive a pending packet.
+ * @public @memberof MIDIDriverOSC
+ * @param driver The driver.
+ * @retval 0 on success.
+ * @retval >0 if no packet could be received or the packet could not be decoded.
+ */
+int MIDIDriverOSCReceive( struct MIDIDriverOSC * driver ) {
+  ssize_t bytes;
+  MIDIPrecond( driver != NULL, EFAULT );
+
+  bytes = recv( driver->socket, &(driver->buffer[0]), sizeof(driver->buffer), MSG_DONTWAIT );
+  if( bytes <= 0 ) return 1;
+  MIDIProfileAdd( driver->base.profile, packets_in, 1 );
+  MIDIProfileAdd( driver->base.profile, bytes_in, bytes );
+  return _osc_receive_packet( driver, bytes, &(driver->buffer[0]), 0 );
+}
 
-int MIDIDriverOSCSend( struct MIDIDriverOSC * driver );
-int MIDIDriverOSCReceive( struct MIDIDriverOSC * driver );
-int MIDIDriverOSCIdle( struct MIDIDriverOSC * driver );
+/** @} */
@@ -1,8 +1,17 @@
 #ifndef MIDI_DRIVER_OSC_H
 #define MIDI_DRIVER_OSC_H
 #include <stdlib.h>
+#include <sys/socket.h>
 #include "midi/message.h"
 
+#ifndef MIDI_DRIVER_INTERNALS
+/**
+ * When used as an opaque pointer type, an instance of
+ * MIDIDriverOSC can be used as a MIDIDriver.
+ */
+#define MIDIDriverOSC MIDIDriver
+#endif
+
 /*
  * Default OSC namespace
  * See also: http://www.illposed.com/software/occam.html
@@ -14,11 +23,16 @@
  * /osc/midi/out/touch       channel (int)   pressure (int)
  * /osc/midi/out/bend        channel (int)   value (int)
  * /osc/midi/out/allNotesOff channel (int)
+ * /osc/midi/out/raw         data (blob)
+ * /osc/midi/out/ump         packet (blob)
+ * Channels are numbered from 1 to 16, the bend value ranges from 0 to 16383.
+ * The ump blob holds the big endian words of one universal MIDI packet.
  */
 
 #define MIDI_DRIVER_OSC_DEFAULT_ADDRESS_SPACE_OUT     "/osc/midi/out"
 #define MIDI_DRIVER_OSC_DEFAULT_ADDRESS_SPACE_IN      "/osc/midi/in"
 #define MIDI_DRIVER_OSC_DEFAULT_ADDRESS_RAW                     "raw"
+#define MIDI_DRIVER_OSC_DEFAULT_ADDRESS_UMP                     "ump"
 #define MIDI_DRIVER_OSC_DEFAULT_ADDRESS_NOTE_ON                 "noteOn"
 #define MIDI_DRIVER_OSC_DEFAULT_ADDRESS_NOTE_OFF                "noteOff"
 #define MIDI_DRIVER_OSC_DEFAULT_ADDRESS_POLYPHONIC_KEY_PRESSURE "polyTouch"
@@ -30,17 +44,17 @@
 
 struct MIDIDriverOSC;
 
-/*
-struct MIDIDriverOSCDelegate {
-  int (*encode)( struct MIDIDriverOSC * driver, struct MIDIMessage * message, size_t size, void * buffer );
-  int (*decode)( struct MIDIDriverOSC * driver, struct MIDIMessage * message, size_t size, void * buffer );
-};*/
-
-struct MIDIDriverOSC * MIDIDriverOSCCreate( /*struct MIDIDriverDelegate * delegate*/ );
-void MIDIDriverOSCDestroy( struct MIDIDriverOSC * driver );
+struct MIDIDriverOSC * MIDIDriverOSCCreate( char * name, unsigned short port );
 void MIDIDriverOSCRetain( struct MIDIDriverOSC * driver );
 void MIDIDriverOSCRelease( struct MIDIDriverOSC * driver );
 
+int MIDIDriverOSCSetAddressSpace( struct MIDIDriverOSC * driver, char * out, char * in );
+int MIDIDriverOSCSetRawMode( struct MIDIDriverOSC * driver, MIDIBoolean raw );
+int MIDIDriverOSCSetUniversalPacketMode( struct MIDIDriverOSC * driver, MIDIBoolean ump );
+int MIDIDriverOSCSetDestination( struct MIDIDriverOSC * driver, char * address, unsigned short port );
+int MIDIDriverOSCSetDestinationWithSockaddr( struct MIDIDriverOSC * driver, socklen_t size, struct sockaddr * addr );
+int MIDIDriverOSCGetSocket( struct MIDIDriverOSC * driver, int * socket );
+
 int MIDIDriverOSCEncodeMessageDefault( struct MIDIDriverOSC * driver, struct MIDIMessage * message,
                                        size_t size, void * buffer, size_t * bytes_written );
 int MIDIDriverOSCDecodeMessageDefault( struct MIDIDriverOSC * driver, struct MIDIMessage * message,
@@ -51,12 +65,15 @@ int MIDIDriverOSCEncodeMessageRaw( struct MIDIDriverOSC * driver, struct MIDIMes
 int MIDIDriverOSCDecodeMessageRaw( struct MIDIDriverOSC * driver, struct MIDIMessage * message,
                                    size_t size, void * buffer, size_t * bytes_read );
 
-/*
+int MIDIDriverOSCEncodeMessageUniversal( struct MIDIDriverOSC * driver, struct MIDIMessage * message,
+                                         size_t size, void * buffer, size_t * bytes_written );
+int MIDIDriverOSCDecodeMessageUniversal( struct MIDIDriverOSC * driver, struct MIDIMessage * message,
+                                         size_t size, void * buffer, size_t * bytes_read );
+
 int MIDIDriverOSCSendMessage( struct MIDIDriverOSC * driver, struct MIDIMessage * message );
-int MIDIDriverOSCReceiveMessage( struct MIDIDriverOSC * driver, struct MIDIMessage * message );
+int MIDIDriverOSCReceivePacket( struct MIDIDriverOSC * driver, size_t size, void * buffer );
 
 int MIDIDriverOSCSend( struct MIDIDriverOSC * driver );
 int MIDIDriverOSCReceive( struct MIDIDriverOSC * driver );
-int MIDIDriverOSCIdle( struct MIDIDriverOSC * driver );
-*/
+
 #endif
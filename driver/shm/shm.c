@@ -0,0 +1,494 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <errno.h>
+
+#define MIDI_DRIVER_INTERNALS
+#include "shm.h"
+#include "midi/runloop.h"
+#include "midi/driver.h"
+#include "midi/clock.h"
+
+#define SHM_CLOCK_RATE 1000000
+#define SHM_POOL_SIZE  64
+#define SHM_CACHE_LINE 64
+#define SHM_MAGIC      0x4d4b5348
+#define SHM_VERSION    2
+#define SHM_RING_MASK  ( MIDI_DRIVER_SHM_RING_SIZE - 1 )
+#define SHM_OFFSET_TOLERANCE 2
+
+/**
+ * @brief A compact timestamped event in a ring.
+ * The timestamp is given in microseconds since the segment was created,
+ * so that both processes agree on it regardless of their clock offsets.
+ */
+struct SHMEvent {
+  int64_t timestamp;
+  unsigned char bytes[4];
+  uint32_t reserved;
+};
+
+/**
+ * @brief A single producer, single consumer event ring.
+ * The producer only writes @c head, the consumer only writes @c tail,
+ * both live on cache lines of their own. The consumer clears the
+ * @c doorbell flag before it drains the ring, the producer rings the
+ * doorbell only if it could set the flag, so a busy consumer is never
+ * woken up.
+ */
+struct SHMRing {
+  volatile uint32_t head;
+  unsigned char pad0[SHM_CACHE_LINE - 4];
+  volatile uint32_t tail;
+  volatile int doorbell;
+  unsigned char pad1[SHM_CACHE_LINE - 8];
+  struct SHMEvent events[MIDI_DRIVER_SHM_RING_SIZE];
+};
+
+/**
+ * @brief The layout of the shared memory segment.
+ */
+struct SHMSegment {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t ring_size;
+  uint32_t reserved;
+  int64_t  epoch;
+  int64_t  offset;
+  unsigned char pad[SHM_CACHE_LINE - 32];
+  struct SHMRing rings[2];
+};
+
+/**
+ * @ingroup MIDI-driver
+ * @brief MIDIDriver implementation using shared memory.
+ * Messages are exchanged with another process on the same host through
+ * lock-free rings in a shared memory segment. Sending a message does not
+ * need a system call unless the other process waits for its doorbell.
+ * System exclusive messages can not be sent.
+ */
+struct MIDIDriverSHM {
+  struct MIDIDriver base;
+  MIDIBoolean owner;
+  char * path;
+  struct SHMSegment * segment;
+  struct SHMRing * in;
+  struct SHMRing * out;
+  int doorbell_in;
+  int doorbell_out;
+  MIDITimestamp offset;
+  struct MIDIMessagePool * pool;
+};
+
+/* MARK: Internals *//**
+ * @name Internals
+ * @cond INTERNALS
+ * Mapping of the segment and access to the rings.
+ * @{
+ */
+
+static int64_t _shm_get_time( void ) {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief Get the path of a doorbell.
+ * @private @memberof MIDIDriverSHM
+ * @param driver The driver.
+ * @param ring   The index of the ring.
+ * @param size   The size of the buffer.
+ * @param buffer The buffer.
+ * @retval 0 on success.
+ * @retval 1 if the path does not fit into the buffer.
+ */
+static int _shm_doorbell_path( struct MIDIDriverSHM * driver, int ring, size_t size, char * buffer ) {
+  return ( snprintf( buffer, size, "%s.%i", driver->path, ring ) >= (int) size ) ? 1 : 0;
+}
+
+/**
+ * @brief Open the doorbell of a ring.
+ * The named pipe is opened for reading and writing, so that opening it
+ * does not block and it stays usable while the other process is gone.
+ * @private @memberof MIDIDriverSHM
+ * @param driver The driver.
+ * @param ring   The index of the ring.
+ * @return the file descriptor on success.
+ * @return -1 if the doorbell could not be opened.
+ */
+static int _shm_doorbell_open( struct MIDIDriverSHM * driver, int ring ) {
+  char path[256];
+  if( _shm_doorbell_path( driver, ring, sizeof(path), &(path[0]) ) ) return -1;
+  if( driver->owner ) {
+    unlink( &(path[0]) );
+    if( mkfifo( &(path[0]), 0600 ) ) return -1;
+  }
+  return open( &(path[0]), O_RDWR | O_NONBLOCK );
+}
+
+/**
+ * @brief Create or attach to the shared memory segment.
+ * @private @memberof MIDIDriverSHM
+ * @param driver The driver.
+ * @retval 0 on success.
+ * @retval >0 if the segment could not be mapped.
+ */
+static int _shm_map( struct MIDIDriverSHM * driver ) {
+  struct SHMSegment * segment;
+  struct stat st;
+  int fd;
+
+  fd = open( driver->path, driver->owner ? ( O_RDWR | O_CREAT | O_TRUNC ) : O_RDWR, 0600 );
+  if( fd < 0 ) return 1;
+  if( driver->owner ) {
+    if( ftruncate( fd, sizeof(struct SHMSegment) ) ) {
+      close( fd );
+      return 1;
+    }
+  } else if( fstat( fd, &st ) || st.st_size < (off_t) sizeof(struct SHMSegment) ) {
+    close( fd );
+    errno = EINVAL;
+    return 1;
+  }
+  segment = mmap( NULL, sizeof(struct SHMSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+  close( fd );
+  if( segment == MAP_FAILED ) return 1;
+  driver->segment = segment;
+
+  if( driver->owner ) {
+    memset( segment, 0, sizeof(struct SHMSegment) );
+    segment->version   = SHM_VERSION;
+    segment->ring_size = MIDI_DRIVER_SHM_RING_SIZE;
+    segment->epoch     = _shm_get_time();
+    __sync_synchronize();
+    segment->magic     = SHM_MAGIC;
+  } else if( segment->magic != SHM_MAGIC || segment->version != SHM_VERSION
+          || segment->ring_size != MIDI_DRIVER_SHM_RING_SIZE ) {
+    errno = EINVAL;
+    return 1;
+  }
+  driver->out = &(segment->rings[driver->owner ? 0 : 1]);
+  driver->in  = &(segment->rings[driver->owner ? 1 : 0]);
+  return 0;
+}
+
+/**
+ * @brief Pass all events of the incoming ring to the driver's port.
+ * Every event is copied out of its slot before the slot is returned to
+ * the producer and the message is delivered.
+ * @private @memberof MIDIDriverSHM
+ * @param driver The driver.
+ * @retval 0 on success.
+ * @retval >0 if an event could not be delivered.
+ */
+static int _shm_drain( struct MIDIDriverSHM * driver ) {
+  struct SHMRing * ring = driver->in;
+  struct MIDICompactMessage compact;
+  struct MIDIMessage * message;
+  MIDITimestamp timestamp;
+  uint32_t tail = ring->tail;
+  int result = 0;
+
+  memset( &compact, 0, sizeof(compact) );
+  while( tail != ring->head ) {
+    __sync_synchronize();
+    memcpy( &(compact.bytes[0]), &(ring->events[tail & SHM_RING_MASK].bytes[0]), 3 );
+    timestamp = ring->events[tail & SHM_RING_MASK].timestamp - driver->offset;
+    __sync_synchronize();
+    ring->tail = ++tail;
+
+    message = MIDIMessageCreateFromPool( driver->pool, MIDI_STATUS_NOTE_OFF );
+    if( message == NULL ) return result + 1;
+    if( MIDIMessageSetCompact( message, &compact, NULL ) == 0 ) {
+      MIDIMessageSetTimestamp( message, timestamp );
+      result += MIDIDriverReceive( &(driver->base), message );
+    } else {
+      MIDIProfileAdd( driver->base.profile, drops, 1 );
+      result++;
+    }
+    MIDIMessageRelease( message );
+  }
+  return result;
+}
+
+/**
+ * @}
+ * @endcond
+ */
+
+static int _shm_read_fds( void * drv, int nfds, fd_set * fds ) {
+  struct MIDIDriverSHM * driver = drv;
+  if( nfds <= 0 || !FD_ISSET( driver->doorbell_in, fds ) ) return 0;
+  return MIDIDriverSHMReceive( driver );
+}
+
+static int _shm_write_fds( void * drv, int nfds, fd_set * fds ) {
+  return 0;
+}
+
+static int _shm_idle_timeout( void * drv, struct timespec * ts ) {
+  return 0;
+}
+
+static int _driver_send( void * driverp, struct MIDIMessage * message ) {
+  return MIDIDriverSHMSendMessage( driverp, message );
+}
+
+void MIDIDriverSHMDestroy( struct MIDIDriverSHM * driver );
+static void _driver_destroy( void * driverp ) {
+  MIDIDriverSHMDestroy( driverp );
+}
+
+/* MARK: Creation and destruction *//**
+ * @name Creation and destruction
+ * Creating, destroying and reference counting of MIDIDriverSHM objects.
+ * @{
+ */
+
+/**
+ * @brief Create a MIDIDriverSHM instance.
+ * Allocate space and initialize an MIDIDriverSHM instance that either
+ * creates the shared memory segment at the given path or attaches to a
+ * segment that was created by another process.
+ * @public @memberof MIDIDriverSHM
+ * @param name   The name of the driver.
+ * @param path   The path of the segment file.
+ * @param create Whether to create the segment.
+ * @return a pointer to the created driver structure on success.
+ * @return a @c NULL pointer if the driver could not created.
+ */
+struct MIDIDriverSHM * MIDIDriverSHMCreate( char * name, char * path, MIDIBoolean create ) {
+  struct MIDIDriverSHM * driver;
+  struct MIDIRunloopSourceDelegate delegate = { NULL, &_shm_read_fds, &_shm_write_fds, &_shm_idle_timeout };
+  MIDITimestamp now;
+  MIDIPrecondReturn( path != NULL, EINVAL, NULL );
+
+  driver = malloc( sizeof( struct MIDIDriverSHM ) );
+  MIDIPrecondReturn( driver != NULL, ENOMEM, NULL );
+  MIDIDriverInit( &(driver->base), name, SHM_CLOCK_RATE );
+
+  driver->owner   = create ? 1 : 0;
+  driver->path    = malloc( strlen( path ) + 1 );
+  driver->segment = NULL;
+  driver->in      = NULL;
+  driver->out     = NULL;
+  driver->doorbell_in  = -1;
+  driver->doorbell_out = -1;
+  driver->offset  = 0;
+  driver->pool    = MIDIMessagePoolCreate( SHM_POOL_SIZE );
+
+  driver->base.send    = &_driver_send;
+  driver->base.destroy = &_driver_destroy;
+
+  if( driver->path == NULL ) {
+    MIDIError( ENOMEM, "Could not allocate shared memory path." );
+    MIDIDriverRelease( &(driver->base) );
+    return NULL;
+  }
+  strcpy( driver->path, path );
+  if( _shm_map( driver ) ) {
+    MIDIError( errno, "Could not map shared memory segment." );
+    MIDIDriverRelease( &(driver->base) );
+    return NULL;
+  }
+  driver->doorbell_out = _shm_doorbell_open( driver, driver->owner ? 0 : 1 );
+  driver->doorbell_in  = _shm_doorbell_open( driver, driver->owner ? 1 : 0 );
+  if( driver->doorbell_out < 0 || driver->doorbell_in < 0 ) {
+    MIDIError( errno, "Could not open shared memory doorbell." );
+    MIDIDriverRelease( &(driver->base) );
+    return NULL;
+  }
+
+  /* The clock and the segment time are read one after the other, the
+   * measured offset may be off by a tick. An attacher that shares the
+   * owner's clock adopts the owner's offset, so both agree exactly. */
+  MIDIClockGetNow( driver->base.clock, &now );
+  driver->offset = ( _shm_get_time() - driver->segment->epoch ) - now;
+  if( driver->owner ) {
+    driver->segment->offset = driver->offset;
+  } else if( llabs( driver->offset - driver->segment->offset ) <= SHM_OFFSET_TOLERANCE ) {
+    driver->offset = driver->segment->offset;
+  }
+
+  delegate.info = driver;
+  driver->base.rls = MIDIRunloopSourceCreate( &delegate );
+  MIDIRunloopSourceScheduleRead( driver->base.rls, driver->doorbell_in );
+  return driver;
+}
+
+/**
+ * @brief Destroy a MIDIDriverSHM instance.
+ * Free all resources occupied by the driver. The process that created
+ * the segment also removes the segment file and the doorbells.
+ * @public @memberof MIDIDriverSHM
+ * @param driver The driver.
+ */
+void MIDIDriverSHMDestroy( struct MIDIDriverSHM * driver ) {
+  char path[256];
+  int i;
+  if( driver->doorbell_in >= 0 ) {
+    if( driver->base.rls != NULL ) {
+      MIDIRunloopSourceClearRead( driver->base.rls, driver->doorbell_in );
+    }
+    close( driver->doorbell_in );
+  }
+  if( driver->doorbell_out >= 0 ) {
+    close( driver->doorbell_out );
+  }
+  if( driver->segment != NULL ) {
+    munmap( driver->segment, sizeof(struct SHMSegment) );
+  }
+  if( driver->path != NULL ) {
+    if( driver->owner ) {
+      for( i=0; i<2; i++ ) {
+        if( _shm_doorbell_path( driver, i, sizeof(path), &(path[0]) ) == 0 ) {
+          unlink( &(path[0]) );
+        }
+      }
+      unlink( driver->path );
+    }
+    free( driver->path );
+  }
+  if( driver->pool != NULL ) {
+    MIDIMessagePoolRelease( driver->pool );
+  }
+}
+
+/**
+ * @brief Retain a MIDIDriverSHM instance.
+ * @public @memberof MIDIDriverSHM
+ * @param driver The driver.
+ */
+void MIDIDriverSHMRetain( struct MIDIDriverSHM * driver ) {
+  MIDIDriverRetain( &(driver->base) );
+}
+
+/**
+ * @brief Release a MIDIDriverSHM instance.
+ * @public @memberof MIDIDriverSHM
+ * @param driver The driver.
+ */
+void MIDIDriverSHMRelease( struct MIDIDriverSHM * driver ) {
+  MIDIDriverRelease( &(driver->base) );
+}
+
+/** @} */
+
+/* MARK: Properties *//**
+ * @name Properties
+ * @{
+ */
+
+/**
+ * @brief Get the doorbell of the incoming ring.
+ * The descriptor becomes readable when the other process added events
+ * to the ring while this driver was idle.
+ * @public @memberof MIDIDriverSHM
+ * @param driver The driver.
+ * @param fd     The file descriptor.
+ * @retval 0 on success.
+ */
+int MIDIDriverSHMGetDoorbell( struct MIDIDriverSHM * driver, int * fd ) {
+  MIDIPrecond( driver != NULL, EFAULT );
+  MIDIPrecond( fd != NULL, EINVAL );
+  *fd = driver->doorbell_in;
+  return 0;
+}
+
+/**
+ * @brief Get the number of events waiting in the incoming ring.
+ * @public @memberof MIDIDriverSHM
+ * @param driver  The driver.
+ * @param pending The number of events.
+ * @retval 0 on success.
+ */
+int MIDIDriverSHMGetPending( struct MIDIDriverSHM * driver, size_t * pending ) {
+  MIDIPrecond( driver != NULL, EFAULT );
+  MIDIPrecond( pending != NULL, EINVAL );
+  *pending = driver->in->head - driver->in->tail;
+  return 0;
+}
+
+/** @} */
+
+/* MARK: Sending and receiving *//**
+ * @name Sending and receiving
+ * @{
+ */
+
+/**
+ * @brief Add a message to the outgoing ring.
+ * The doorbell is only rung if the other process has drained the ring
+ * since it was rung last.
+ * @public @memberof MIDIDriverSHM
+ * @param driver  The driver.
+ * @param message The message.
+ * @retval 0 on success.
+ * @retval >0 if the message is a system exclusive message or the ring is full.
+ */
+int MIDIDriverSHMSendMessage( struct MIDIDriverSHM * driver, struct MIDIMessage * message ) {
+  struct MIDICompactMessage compact;
+  struct SHMRing * ring;
+  struct SHMEvent * event;
+  MIDITimestamp timestamp = 0;
+  unsigned char bell = 0;
+  uint32_t head;
+  MIDIPrecond( driver != NULL, EFAULT );
+  MIDIPrecond( message != NULL, EINVAL );
+
+  ring = driver->out;
+  head = ring->head;
+  if( MIDIMessageGetCompact( message, &compact ) || head - ring->tail >= MIDI_DRIVER_SHM_RING_SIZE ) {
+    MIDILog( DEBUG, "could not add message to shared memory ring, dropping message\n" );
+    MIDIProfileAdd( driver->base.profile, drops, 1 );
+    return 1;
+  }
+  MIDIMessageGetTimestamp( message, &timestamp );
+  event = &(ring->events[head & SHM_RING_MASK]);
+  event->timestamp = timestamp + driver->offset;
+  memcpy( &(event->bytes[0]), &(compact.bytes[0]), 3 );
+  event->bytes[3] = 0;
+  __sync_synchronize();
+  ring->head = head + 1;
+  __sync_synchronize();
+  MIDIProfileAdd( driver->base.profile, messages_out, 1 );
+
+  if( ring->doorbell == 0 && __sync_lock_test_and_set( &(ring->doorbell), 1 ) == 0 ) {
+    if( write( driver->doorbell_out, &bell, 1 ) == 1 ) {
+      MIDIProfileAdd( driver->base.profile, packets_out, 1 );
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief Receive all events of the incoming ring.
+ * Pending doorbell rings are consumed and the doorbell is rearmed before
+ * the ring is drained, so no event is left behind.
+ * @public @memberof MIDIDriverSHM
+ * @param driver The driver.
+ * @retval 0 on success.
+ * @retval >0 if an event could not be delivered.
+ */
+int MIDIDriverSHMReceive( struct MIDIDriverSHM * driver ) {
+  unsigned char buffer[64];
+  ssize_t bytes;
+  MIDIPrecond( driver != NULL, EFAULT );
+
+  while( ( bytes = read( driver->doorbell_in, &(buffer[0]), sizeof(buffer) ) ) > 0 ) {
+    MIDIProfileAdd( driver->base.profile, packets_in, 1 );
+  }
+  __sync_lock_release( &(driver->in->doorbell) );
+  __sync_synchronize();
+  return _shm_drain( driver );
+}
+
+/** @} */
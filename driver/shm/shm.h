@@ -0,0 +1,37 @@
+#ifndef MIDI_DRIVER_SHM_H
+#define MIDI_DRIVER_SHM_H
+#include <stdlib.h>
+#include "midi/message.h"
+
+#ifndef MIDI_DRIVER_INTERNALS
+/**
+ * When used as an opaque pointer type, an instance of
+ * MIDIDriverSHM can be used as a MIDIDriver.
+ */
+#define MIDIDriverSHM MIDIDriver
+#endif
+
+/*
+ * A shared memory segment connects two processes on the same host.
+ * The segment is a file, preferably on a memory backed file system like
+ * /dev/shm, and holds one event ring per direction. Each ring has a
+ * doorbell, a named pipe next to the segment file with the suffix ".0"
+ * or ".1". The process that creates the segment writes ring 0 and reads
+ * ring 1, the process that attaches to it does the opposite.
+ */
+
+#define MIDI_DRIVER_SHM_RING_SIZE 1024
+
+struct MIDIDriverSHM;
+
+struct MIDIDriverSHM * MIDIDriverSHMCreate( char * name, char * path, MIDIBoolean create );
+void MIDIDriverSHMRetain( struct MIDIDriverSHM * driver );
+void MIDIDriverSHMRelease( struct MIDIDriverSHM * driver );
+
+int MIDIDriverSHMGetDoorbell( struct MIDIDriverSHM * driver, int * fd );
+int MIDIDriverSHMGetPending( struct MIDIDriverSHM * driver, size_t * pending );
+
+int MIDIDriverSHMSendMessage( struct MIDIDriverSHM * driver, struct MIDIMessage * message );
+int MIDIDriverSHMReceive( struct MIDIDriverSHM * driver );
+
+#endif
@@ -0,0 +1,475 @@
+#include <stdlib.h>
+#include <string.h>
+#include "midi.h"
+#include "array.h"
+
+#define MIDI_ARRAY_MIN_CAPACITY 4
+
+/**
+ * @ingroup MIDI
+ * @brief A contiguous array of MIDI objects of a common type.
+ * The array is the counterpart of the MIDIList for hot paths. Items
+ * are stored in one block of memory that grows by doubling, so that
+ * walking the array is a tight loop. Unsorted arrays keep the order
+ * of insertion until items are removed and remove items by moving the
+ * last item into the gap. Sorted arrays keep their items ordered by a
+ * comparator function and look items up using binary search.
+ */
+struct MIDIArray {
+/**
+ * @privatesections
+ * @cond INTERNALS
+ */
+  int    refs;
+  struct MIDITypeSpec * type;
+  MIDIArrayCompareFn  * compare;
+  size_t length;
+  size_t capacity;
+  void ** items;
+/** @endcond */
+};
+
+/* MARK: Internals *//**
+ * @name Internals
+ * @cond INTERNALS
+ * @{
+ */
+
+/**
+ * @brief Use the callback to retain an array item.
+ * @private @memberof MIDIArray
+ * @param array The array.
+ * @param item  The item to retain.
+ */
+static void _array_item_retain( struct MIDIArray * array, void * item ) {
+  MIDIAssert( array != NULL );
+  if( item != NULL && array->type != NULL && array->type->retain != NULL ) {
+    (*array->type->retain)( item );
+  }
+}
+
+/**
+ * @brief Use the callback to release an array item.
+ * @private @memberof MIDIArray
+ * @param array The array.
+ * @param item  The item to release.
+ */
+static void _array_item_release( struct MIDIArray * array, void * item ) {
+  MIDIAssert( array != NULL );
+  if( item != NULL && array->type != NULL && array->type->release != NULL ) {
+    (*array->type->release)( item );
+  }
+}
+
+/**
+ * @brief Compare two items by their address.
+ * This is the comparator of sorted arrays that were created without one.
+ * @private @memberof MIDIArray
+ * @param a The first item.
+ * @param b The second item.
+ * @return a value less than, equal to or greater than zero if @c a is
+ *         located before, at or after @c b.
+ */
+static int _array_compare_address( void * a, void * b ) {
+  return ( (char *) a > (char *) b ) - ( (char *) a < (char *) b );
+}
+
+/**
+ * @brief Make room for at least one more item.
+ * @private @memberof MIDIArray
+ * @param array The array.
+ * @retval 0 on success.
+ * @retval >0 if the storage could not be grown.
+ */
+static int _array_reserve( struct MIDIArray * array ) {
+  size_t capacity;
+  void ** items;
+  if( array->length < array->capacity ) return 0;
+  capacity = ( array->capacity < MIDI_ARRAY_MIN_CAPACITY ) ? MIDI_ARRAY_MIN_CAPACITY : array->capacity * 2;
+  items = realloc( array->items, sizeof( void * ) * capacity );
+  if( items == NULL ) {
+    MIDIError( ENOMEM, "Failed to grow array storage." );
+    return ENOMEM;
+  }
+  array->items    = items;
+  array->capacity = capacity;
+  return 0;
+}
+
+/**
+ * @brief Find the first position of an item in a sorted array.
+ * @private @memberof MIDIArray
+ * @param array The array.
+ * @param item  The item to search for.
+ * @return the index of the first item that does not compare less
+ *         than the given item.
+ */
+static size_t _array_lower_bound( struct MIDIArray * array, void * item ) {
+  size_t lo = 0, hi = array->length, mid;
+  while( lo < hi ) {
+    mid = lo + ( hi - lo ) / 2;
+    if( (*array->compare)( array->items[mid], item ) < 0 ) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+/**
+ * @brief Take an item out of the array without releasing it.
+ * @private @memberof MIDIArray
+ * @param array The array.
+ * @param index The index of the item.
+ * @return the item that was removed.
+ */
+static void * _array_take( struct MIDIArray * array, size_t index ) {
+  void * item = array->items[index];
+  array->length--;
+  if( array->compare != NULL ) {
+    memmove( &(array->items[index]), &(array->items[index+1]),
+             sizeof( void * ) * ( array->length - index ) );
+  } else {
+    array->items[index] = array->items[array->length];
+  }
+  return item;
+}
+
+/**
+ * @}
+ * @endcond
+ */
+
+/* MARK: -
+ * MARK: Creation and destruction *//**
+ * @name Creation and destruction
+ * Creating, destroying and reference counting of MIDIArray objects.
+ * @{
+ */
+
+/**
+ * @brief Create a MIDIArray instance.
+ * Allocate space and initialize an unsorted MIDIArray instance.
+ * @public @memberof MIDIArray
+ * @param type     The type of the elements to be stored.
+ * @param capacity The number of items to reserve space for. May be 0.
+ * @return a pointer to the created array structure on success.
+ * @return a @c NULL pointer if the array could not created.
+ */
+struct MIDIArray * MIDIArrayCreate( struct MIDITypeSpec * type, size_t capacity ) {
+  struct MIDIArray * array = malloc( sizeof( struct MIDIArray ) );
+  MIDIPrecondReturn( array != NULL, ENOMEM, NULL );
+
+  array->refs     = 1;
+  array->type     = type;
+  array->compare  = NULL;
+  array->length   = 0;
+  array->capacity = 0;
+  array->items    = NULL;
+
+  if( capacity > 0 ) {
+    array->items = malloc( sizeof( void * ) * capacity );
+    if( array->items == NULL ) {
+      free( array );
+      MIDIPrecondReturn( 0, ENOMEM, NULL );
+    }
+    array->capacity = capacity;
+  }
+  return array;
+}
+
+/**
+ * @brief Create a sorted MIDIArray instance.
+ * Allocate space and initialize a MIDIArray instance that keeps its
+ * items ordered. Items that compare equal are considered to be the same
+ * item by MIDIArrayIndexOf, MIDIArrayContains and MIDIArrayRemove.
+ * @public @memberof MIDIArray
+ * @param type     The type of the elements to be stored.
+ * @param capacity The number of items to reserve space for. May be 0.
+ * @param compare  The comparator to order the items by. If @c NULL
+ *                 items are ordered by address.
+ * @return a pointer to the created array structure on success.
+ * @return a @c NULL pointer if the array could not created.
+ */
+struct MIDIArray * MIDIArrayCreateSorted( struct MIDITypeSpec * type, size_t capacity, MIDIArrayCompareFn * compare ) {
+  struct MIDIArray * array = MIDIArrayCreate( type, capacity );
+  if( array == NULL ) return NULL;
+  array->compare = ( compare == NULL ) ? &_array_compare_address : compare;
+  return array;
+}
+
+/**
+ * @brief Destroy a MIDIArray instance.
+ * Free all resources occupied by the array and release all
+ * array items.
+ * @public @memberof MIDIArray
+ * @param array The array.
+ */
+void MIDIArrayDestroy( struct MIDIArray * array ) {
+  size_t i, length;
+  void ** items;
+  MIDIPrecondReturn( array != NULL, EFAULT, (void)0 );
+  items  = array->items;
+  length = array->length;
+  array->items    = NULL;
+  array->length   = 0;
+  array->capacity = 0;
+  for( i=0; i<length; i++ ) {
+    _array_item_release( array, items[i] );
+  }
+  free( items );
+  free( array );
+}
+
+/**
+ * @brief Retain a MIDIArray instance.
+ * Increment the reference counter of an array so that it won't be destroyed.
+ * @public @memberof MIDIArray
+ * @param array The array.
+ */
+void MIDIArrayRetain( struct MIDIArray * array ) {
+  MIDIPrecondReturn( array != NULL, EFAULT, (void)0 );
+  MIDIRefRetain( array->refs );
+}
+
+/**
+ * @brief Release a MIDIArray instance.
+ * Decrement the reference counter of an array. If the reference count
+ * reached zero, destroy the array.
+ * @public @memberof MIDIArray
+ * @param array The array.
+ */
+void MIDIArrayRelease( struct MIDIArray * array ) {
+  MIDIPrecondReturn( array != NULL, EFAULT, (void)0 );
+  if( ! MIDIRefRelease( array->refs ) ) {
+    MIDIArrayDestroy( array );
+  }
+}
+
+/** @} */
+
+/* MARK: Array management *//**
+ * @name Array management
+ * Functions for working with arrays.
+ * @{
+ */
+
+/**
+ * @brief Get the number of items in the array.
+ * @public @memberof MIDIArray
+ * @param array  The array.
+ * @param length The number of items.
+ * @retval 0 on success.
+ * @retval >0 otherwise.
+ */
+int MIDIArrayGetLength( struct MIDIArray * array, size_t * length ) {
+  MIDIPrecond( array != NULL, EFAULT );
+  MIDIPrecond( length != NULL, EINVAL );
+  *length = array->length;
+  return 0;
+}
+
+/**
+ * @brief Get the item at an index.
+ * The item is not retained.
+ * @public @memberof MIDIArray
+ * @param array The array.
+ * @param index The index of the item.
+ * @param item  The item.
+ * @retval 0 on success.
+ * @retval >0 otherwise.
+ */
+int MIDIArrayGet( struct MIDIArray * array, size_t index, void ** item ) {
+  MIDIPrecond( array != NULL, EFAULT );
+  MIDIPrecond( item != NULL, EINVAL );
+  MIDIPrecond( index < array->length, ERANGE );
+  *item = array->items[index];
+  return 0;
+}
+
+/**
+ * @brief Add an item to the array.
+ * Add one item to the array and retain it. Unsorted arrays append the
+ * item, sorted arrays insert it before the first item that does not
+ * compare less.
+ * @public @memberof MIDIArray
+ * @param array The array.
+ * @param item  The item to add.
+ * @retval 0 on success.
+ * @retval >0 otherwise.
+ */
+int MIDIArrayAdd( struct MIDIArray * array, void * item ) {
+  size_t index;
+  MIDIPrecond( array != NULL, EFAULT );
+  MIDIPrecond( item != NULL, EINVAL );
+
+  if( _array_reserve( array ) ) return ENOMEM;
+  _array_item_retain( array, item );
+  if( array->compare != NULL ) {
+    index = _array_lower_bound( array, item );
+    memmove( &(array->items[index+1]), &(array->items[index]),
+             sizeof( void * ) * ( array->length - index ) );
+  } else {
+    index = array->length;
+  }
+  array->items[index] = item;
+  array->length++;
+  return 0;
+}
+
+/**
+ * @brief Remove an item from the array.
+ * Remove all occurrences of an item from the array and release them.
+ * Sorted arrays remove all items that compare equal to the given item.
+ * @public @memberof MIDIArray
+ * @param array The array.
+ * @param item  The item to remove.
+ * @retval 0 on success.
+ * @retval >0 otherwise.
+ */
+int MIDIArrayRemove( struct MIDIArray * array, void * item ) {
+  size_t i;
+  MIDIPrecond( array != NULL, EFAULT );
+  MIDIPrecond( item != NULL, EINVAL );
+
+  if( array->compare != NULL ) {
+    i = _array_lower_bound( array, item );
+    while( i < array->length && (*array->compare)( array->items[i], item ) == 0 ) {
+      _array_item_release( array, _array_take( array, i ) );
+    }
+  } else {
+    i = array->length;
+    while( i > 0 ) {
+      i--;
+      if( i < array->length && array->items[i] == item ) {
+        _array_item_release( array, _array_take( array, i ) );
+      }
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief Remove the item at an index.
+ * Remove one item from the array and release it. In unsorted arrays
+ * the last item takes the place of the removed one.
+ * @public @memberof MIDIArray
+ * @param array The array.
+ * @param index The index of the item to remove.
+ * @retval 0 on success.
+ * @retval >0 otherwise.
+ */
+int MIDIArrayRemoveAt( struct MIDIArray * array, size_t index ) {
+  MIDIPrecond( array != NULL, EFAULT );
+  MIDIPrecond( index < array->length, ERANGE );
+  _array_item_release( array, _array_take( array, index ) );
+  return 0;
+}
+
+/**
+ * @brief Get the index of an item.
+ * Sorted arrays use binary search to find the first item that compares
+ * equal to the given item, unsorted arrays look for the item's address.
+ * @public @memberof MIDIArray
+ * @param array The array.
+ * @param item  The item to search for.
+ * @param index The index of the item if it is present. For sorted arrays
+ *              the index where the item would be inserted otherwise.
+ *              May be @c NULL.
+ * @retval 0 if the item is present in the array.
+ * @retval -1 if the item is not present in the array.
+ * @retval >0 if an error occurred.
+ */
+int MIDIArrayIndexOf( struct MIDIArray * array, void * item, size_t * index ) {
+  size_t i;
+  MIDIPrecond( array != NULL, EFAULT );
+  MIDIPrecond( item != NULL, EINVAL );
+
+  if( array->compare != NULL ) {
+    i = _array_lower_bound( array, item );
+    if( index != NULL ) *index = i;
+    return ( i < array->length && (*array->compare)( array->items[i], item ) == 0 ) ? 0 : -1;
+  }
+  for( i=0; i<array->length; i++ ) {
+    if( array->items[i] == item ) {
+      if( index != NULL ) *index = i;
+      return 0;
+    }
+  }
+  if( index != NULL ) *index = array->length;
+  return -1;
+}
+
+/**
+ * @brief Check if an item is contained inside the array.
+ * @see MIDIArrayIndexOf
+ * @public @memberof MIDIArray
+ * @param array The array.
+ * @param item  The item to search for.
+ * @retval 0 if the item is present in the array.
+ * @retval -1 if the item is not present in the array.
+ * @retval >0 if an error occurred.
+ */
+int MIDIArrayContains( struct MIDIArray * array, void * item ) {
+  return MIDIArrayIndexOf( array, item, NULL );
+}
+
+/**
+ * @brief Find a given item using a comparator function.
+ * Step through all items and check if the given comparator returns 0.
+ * Use MIDIArrayIndexOf to search sorted arrays by key.
+ * @public @memberof MIDIArray
+ * @param array The array.
+ * @param item  The result-item.
+ * @param info  The pointer to pass as the second parameter.
+ * @param func  The comparator function.
+ * @retval 0 if the item is present in the array.
+ * @retval -1 if the item is not present in the array.
+ * @retval >0 if an error occurred.
+ */
+int MIDIArrayFind( struct MIDIArray * array, void ** item, void * info, int (*func)( void *, void * ) ) {
+  size_t i;
+  MIDIPrecond( array != NULL, EFAULT );
+  MIDIPrecond( item != NULL, EINVAL );
+  MIDIPrecond( func != NULL, EINVAL );
+
+  for( i=0; i<array->length; i++ ) {
+    if( (*func)( array->items[i], info ) == 0 ) {
+      *item = array->items[i];
+      return 0;
+    }
+  }
+  return -1;
+}
+
+/**
+ * @brief Apply a function to all items in the array.
+ * Call the given function once for every item in the array, starting
+ * with the last one. Use the item as the first parameter and the given
+ * @c info pointer as the second parameter. The function may remove the
+ * item it was called with from the array.
+ * @public @memberof MIDIArray
+ * @param array The array.
+ * @param info  The pointer to pass as the second parameter.
+ * @param func  The function to apply.
+ * @retval 0 on success.
+ * @retval >0 otherwise.
+ */
+int MIDIArrayApply( struct MIDIArray * array, void * info, int (*func)( void *, void * ) ) {
+  size_t i;
+  int result = 0;
+  MIDIPrecond( array != NULL, EFAULT );
+  MIDIPrecond( func != NULL, EINVAL );
+
+  i = array->length;
+  while( i > 0 ) {
+    i--;
+    if( i < array->length ) {
+      result += (*func)( array->items[i], info );
+    }
+  }
+  return result;
+}
+
+/** @} */
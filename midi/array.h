@@ -0,0 +1,27 @@
+#ifndef MIDIKIT_MIDI_ARRAY_H
+#define MIDIKIT_MIDI_ARRAY_H
+#include <stddef.h>
+#include "type.h"
+
+struct MIDIArray;
+
+typedef int MIDIArrayCompareFn( void * a, void * b );
+
+struct MIDIArray * MIDIArrayCreate( struct MIDITypeSpec * type, size_t capacity );
+struct MIDIArray * MIDIArrayCreateSorted( struct MIDITypeSpec * type, size_t capacity, MIDIArrayCompareFn * compare );
+void MIDIArrayDestroy( struct MIDIArray * array );
+void MIDIArrayRetain( struct MIDIArray * array );
+void MIDIArrayRelease( struct MIDIArray * array );
+
+int MIDIArrayGetLength( struct MIDIArray * array, size_t * length );
+int MIDIArrayGet( struct MIDIArray * array, size_t index, void ** item );
+int MIDIArrayAdd( struct MIDIArray * array, void * item );
+int MIDIArrayRemove( struct MIDIArray * array, void * item );
+int MIDIArrayRemoveAt( struct MIDIArray * array, size_t index );
+
+int MIDIArrayIndexOf( struct MIDIArray * array, void * item, size_t * index );
+int MIDIArrayContains( struct MIDIArray * array, void * item );
+int MIDIArrayFind( struct MIDIArray * array, void ** item, void * info, int (*func)( void *, void * ) );
+int MIDIArrayApply( struct MIDIArray * array, void * info, int (*func)( void * item, void * info ) );
+
+#endif
@@ -0,0 +1,285 @@
+#include <stdlib.h>
+#define MIDI_DRIVER_INTERNALS
+#include "audio_bridge.h"
+
+#include "type.h"
+#include "port.h"
+#include "clock.h"
+#include "message.h"
+#include "message_queue.h"
+
+/**
+ * @ingroup MIDI
+ * @brief Handoff of incoming messages to a real-time audio thread.
+ * The bridge receives messages on its port, usually on the thread that
+ * runs a driver, and pushes them as compact messages onto a ring queue
+ * with one producer and one consumer. The audio callback drains the ring
+ * once per block. Draining never blocks, allocates memory or calls into
+ * the system, so it is safe to do inside an audio callback. Timestamps are
+ * converted to frame offsets within the block. Events that are not yet
+ * due stay in the bridge until a later block.
+ * Messages that have no compact form, like system exclusive messages,
+ * are not passed on.
+ */
+struct MIDIAudioThreadBridge {
+/**
+ * @privatesection
+ * @cond INTERNALS
+ */
+  int refs;
+  struct MIDIClock * clock;
+  struct MIDIPort * port;
+  struct MIDIMessageQueue * queue;
+  MIDISamplingRate rate;
+  int held;
+  struct MIDICompactMessage next;
+  struct MIDIAudioThreadBridgeStats stats;
+/** @endcond */
+};
+
+/* MARK: Internals *//**
+ * @name Internals
+ * @cond INTERNALS
+ * @{
+ */
+
+/**
+ * @brief Port callback.
+ * Push every received message onto the ring queue. Messages that do not
+ * fit or have no compact form are counted and dropped.
+ * @private @memberof MIDIAudioThreadBridge
+ * @param target The bridge.
+ * @param source The port that sent the object.
+ * @param type   The type of the object.
+ * @param object The object.
+ * @retval 0 on success.
+ */
+static int _port_receive( void * target, void * source, struct MIDITypeSpec * type, void * object ) {
+  struct MIDIAudioThreadBridge * bridge = target;
+  struct MIDICompactMessage compact;
+  if( type != MIDIMessageType ) return 0;
+  bridge->stats.received++;
+  if( MIDIMessageGetCompact( object, &compact ) ) {
+    bridge->stats.unsupported++;
+  } else if( MIDIMessageQueuePushCompact( bridge->queue, &compact ) ) {
+    bridge->stats.dropped++;
+  }
+  return 0;
+}
+
+/**
+ * @}
+ * @endcond
+ */
+
+/* MARK: -
+ * MARK: Creation and destruction *//**
+ * @name Creation and destruction
+ * Creating, destroying and reference counting of MIDIAudioThreadBridge objects.
+ * @{
+ */
+
+/**
+ * @brief Create a MIDIAudioThreadBridge instance.
+ * Allocate space and initialize a MIDIAudioThreadBridge instance.
+ * @public @memberof MIDIAudioThreadBridge
+ * @param driver   The driver to receive messages from. May be @c NULL, in
+ *                 that case the bridge uses the global clock and only
+ *                 receives from the ports that are connected to its port.
+ * @param capacity The number of messages the bridge can hold. Rounded up
+ *                 to a power of two.
+ * @return a pointer to the created bridge structure on success.
+ * @return a @c NULL pointer if the bridge could not created.
+ */
+struct MIDIAudioThreadBridge * MIDIAudioThreadBridgeCreate( struct MIDIDriver * driver, size_t capacity ) {
+  struct MIDIAudioThreadBridge * bridge = malloc( sizeof( struct MIDIAudioThreadBridge ) );
+  MIDIPrecondReturn( bridge != NULL, ENOMEM, NULL );
+
+  bridge->refs  = 1;
+  bridge->held  = 0;
+  if( driver != NULL ) {
+    bridge->clock = driver->clock;
+    MIDIClockRetain( bridge->clock );
+  } else {
+    bridge->clock = MIDIClockProvide( MIDI_SAMPLING_RATE_DEFAULT );
+  }
+  bridge->port  = MIDIPortCreate( "Audio thread bridge", MIDI_PORT_IN, bridge, &_port_receive );
+  bridge->queue = MIDIMessageQueueCreateCompactRing( capacity );
+  if( bridge->clock == NULL || bridge->port == NULL || bridge->queue == NULL ) {
+    if( bridge->clock != NULL ) MIDIClockRelease( bridge->clock );
+    if( bridge->port  != NULL ) MIDIPortRelease( bridge->port );
+    if( bridge->queue != NULL ) MIDIMessageQueueRelease( bridge->queue );
+    free( bridge );
+    return NULL;
+  }
+  MIDIClockGetSamplingRate( bridge->clock, &(bridge->rate) );
+  bridge->stats.received    = 0;
+  bridge->stats.dropped     = 0;
+  bridge->stats.unsupported = 0;
+  bridge->stats.late        = 0;
+  if( driver != NULL ) {
+    MIDIPortConnect( driver->port, bridge->port );
+  }
+  return bridge;
+}
+
+/**
+ * @brief Destroy a MIDIAudioThreadBridge instance.
+ * Free all resources occupied by the bridge and drop all pending events.
+ * The audio thread must not drain the bridge anymore.
+ * @public @memberof MIDIAudioThreadBridge
+ * @param bridge The bridge.
+ */
+void MIDIAudioThreadBridgeDestroy( struct MIDIAudioThreadBridge * bridge ) {
+  MIDIPrecondReturn( bridge != NULL, EFAULT, (void)0 );
+  MIDIPortInvalidate( bridge->port );
+  MIDIPortRelease( bridge->port );
+  MIDIMessageQueueRelease( bridge->queue );
+  MIDIClockRelease( bridge->clock );
+  free( bridge );
+}
+
+/**
+ * @brief Retain a MIDIAudioThreadBridge instance.
+ * Increment the reference counter of a bridge so that it won't be destroyed.
+ * @public @memberof MIDIAudioThreadBridge
+ * @param bridge The bridge.
+ */
+void MIDIAudioThreadBridgeRetain( struct MIDIAudioThreadBridge * bridge ) {
+  MIDIPrecondReturn( bridge != NULL, EFAULT, (void)0 );
+  MIDIRefRetain( bridge->refs );
+}
+
+/**
+ * @brief Release a MIDIAudioThreadBridge instance.
+ * Decrement the reference counter of a bridge. If the reference count
+ * reached zero, destroy the bridge.
+ * @public @memberof MIDIAudioThreadBridge
+ * @param bridge The bridge.
+ */
+void MIDIAudioThreadBridgeRelease( struct MIDIAudioThreadBridge * bridge ) {
+  MIDIPrecondReturn( bridge != NULL, EFAULT, (void)0 );
+  if( ! MIDIRefRelease( bridge->refs ) ) {
+    MIDIAudioThreadBridgeDestroy( bridge );
+  }
+}
+
+/** @} */
+
+/* MARK: Properties *//**
+ * @name Properties
+ * @{
+ */
+
+/**
+ * @brief Get the bridge port.
+ * Connect the port of a driver (or any other port that sends messages)
+ * to this port to pass messages to the audio thread.
+ * @public @memberof MIDIAudioThreadBridge
+ * @param bridge The bridge.
+ * @param port   The port.
+ * @retval 0 on success.
+ */
+int MIDIAudioThreadBridgeGetPort( struct MIDIAudioThreadBridge * bridge, struct MIDIPort ** port ) {
+  MIDIPrecond( bridge != NULL, EFAULT );
+  MIDIPrecond( port != NULL, EINVAL );
+  *port = bridge->port;
+  return 0;
+}
+
+/**
+ * @brief Get the bridge clock.
+ * Message timestamps and the block start passed to
+ * @ref MIDIAudioThreadBridgeDrain refer to this clock.
+ * @public @memberof MIDIAudioThreadBridge
+ * @param bridge The bridge.
+ * @param clock  The clock.
+ * @retval 0 on success.
+ */
+int MIDIAudioThreadBridgeGetClock( struct MIDIAudioThreadBridge * bridge, struct MIDIClock ** clock ) {
+  MIDIPrecond( bridge != NULL, EFAULT );
+  MIDIPrecond( clock != NULL, EINVAL );
+  *clock = bridge->clock;
+  return 0;
+}
+
+/**
+ * @brief Get the bridge statistics.
+ * The @c received, @c dropped and @c unsupported counters are updated by
+ * the receiving thread, @c late is updated by the audio thread.
+ * @public @memberof MIDIAudioThreadBridge
+ * @param bridge The bridge.
+ * @param stats  The stats to copy the counters to.
+ * @retval 0 on success.
+ */
+int MIDIAudioThreadBridgeGetStats( struct MIDIAudioThreadBridge * bridge, struct MIDIAudioThreadBridgeStats * stats ) {
+  MIDIPrecond( bridge != NULL, EFAULT );
+  MIDIPrecond( stats != NULL, EINVAL );
+  *stats = bridge->stats;
+  return 0;
+}
+
+/** @} */
+
+/* MARK: Draining *//**
+ * @name Draining
+ * @{
+ */
+
+/**
+ * @brief Get the events of an audio block.
+ * Take all events that are due before the end of the block and convert
+ * their timestamps to frame offsets from the start of the block. Events
+ * are returned in the order they were received with non-decreasing
+ * frames. Events that are older than the block start are placed at
+ * frame 0 and counted as @c late. Only the lower 32 bits of the
+ * timestamps are compared, so events must be due within 2^31 ticks of
+ * the block start. Must only be called from one thread at a time.
+ * @public @memberof MIDIAudioThreadBridge
+ * @param bridge       The bridge.
+ * @param block_start  The time of the first frame of the block on the bridge clock.
+ * @param block_frames The number of frames in the block.
+ * @param sample_rate  The audio sampling rate in frames per second.
+ * @param max          The number of events that fit into @c events.
+ * @param events       The events of the block.
+ * @param count        The number of events that were stored.
+ * @retval 0 on success.
+ */
+int MIDIAudioThreadBridgeDrain( struct MIDIAudioThreadBridge * bridge, MIDITimestamp block_start,
+                                size_t block_frames, MIDISamplingRate sample_rate,
+                                size_t max, struct MIDIAudioEvent * events, size_t * count ) {
+  long long ticks, frame;
+  unsigned int last = 0;
+  size_t n = 0;
+
+  MIDIPrecond( bridge != NULL, EFAULT );
+  MIDIPrecond( events != NULL || max == 0, EINVAL );
+  MIDIPrecond( count != NULL, EINVAL );
+
+  while( n < max ) {
+    if( ! bridge->held ) {
+      if( MIDIMessageQueuePopCompact( bridge->queue, &(bridge->next) ) ) break;
+      bridge->held = 1;
+    }
+    ticks = (int32_t) ( bridge->next.timestamp - (uint32_t) block_start );
+    if( ticks < 0 ) {
+      bridge->stats.late++;
+      frame = 0;
+    } else {
+      frame = ( ticks * sample_rate ) / bridge->rate;
+      if( frame >= (long long) block_frames ) break;
+    }
+    if( frame < last ) frame = last;
+    last = frame;
+    events[n].frame    = frame;
+    events[n].bytes[0] = bridge->next.bytes[0];
+    events[n].bytes[1] = bridge->next.bytes[1];
+    events[n].bytes[2] = bridge->next.bytes[2];
+    bridge->held = 0;
+    n++;
+  }
+  *count = n;
+  return 0;
+}
+
+/** @} */
@@ -0,0 +1,36 @@
+#ifndef MIDIKIT_MIDI_AUDIO_BRIDGE_H
+#define MIDIKIT_MIDI_AUDIO_BRIDGE_H
+#include "midi.h"
+#include "driver.h"
+
+struct MIDIPort;
+struct MIDIClock;
+
+struct MIDIAudioThreadBridge;
+
+struct MIDIAudioEvent {
+  unsigned int  frame;
+  unsigned char bytes[3];
+};
+
+struct MIDIAudioThreadBridgeStats {
+  unsigned long received;
+  unsigned long dropped;
+  unsigned long unsupported;
+  unsigned long late;
+};
+
+struct MIDIAudioThreadBridge * MIDIAudioThreadBridgeCreate( struct MIDIDriver * driver, size_t capacity );
+void MIDIAudioThreadBridgeDestroy( struct MIDIAudioThreadBridge * bridge );
+void MIDIAudioThreadBridgeRetain( struct MIDIAudioThreadBridge * bridge );
+void MIDIAudioThreadBridgeRelease( struct MIDIAudioThreadBridge * bridge );
+
+int MIDIAudioThreadBridgeGetPort( struct MIDIAudioThreadBridge * bridge, struct MIDIPort ** port );
+int MIDIAudioThreadBridgeGetClock( struct MIDIAudioThreadBridge * bridge, struct MIDIClock ** clock );
+int MIDIAudioThreadBridgeGetStats( struct MIDIAudioThreadBridge * bridge, struct MIDIAudioThreadBridgeStats * stats );
+
+int MIDIAudioThreadBridgeDrain( struct MIDIAudioThreadBridge * bridge, MIDITimestamp block_start,
+                                size_t block_frames, MIDISamplingRate sample_rate,
+                                size_t max, struct MIDIAudioEvent * events, size_t * count );
+
+#endif
@@ -41,16 +41,26 @@ int MIDIDriverAppleMIDIRemovePeerWithCFNetService( struct MIDIDriverAppleMIDI *
 /* MARK: -
  * MARK: CFMIDIRunloop */
 
+#define CF_INTEGRATION_TIMER_IDLE 1.0e10
+
 struct CFMIDIRunloop {
   struct MIDIRunloop    base; 
   CFRunLoopRef          runloop;
   CFRunLoopTimerContext timer_context;
   CFSocketContext       socket_context;
-  CFMutableSetRef cf_timers;
-  CFMutableSetRef cf_sockets;
-  CFMutableSetRef cf_sources;
+  CFRunLoopTimerRef     cf_timer;
+  CFAbsoluteTime        cf_deadline;
+  CFMutableDictionaryRef cf_sockets;
+  CFMutableDictionaryRef cf_sources;
 };
 
+/**
+ * Sockets are keyed by their native socket number. The number is
+ * offset by one, because a key of @c NULL can not be told apart from
+ * a missing key.
+ */
+#define CF_SOCKET_KEY( fd ) ((const void *) (intptr_t) ( (fd) + 1 ))
+
 /* MARK: Core Foundation callbacks *//**
  * @name Core Foundation callbacks
  * @cond INTERNAL
@@ -94,56 +104,27 @@ static void _cf_socket_callback( CFSocketRef s, CFSocketCallBackType callbackTyp
 static void _cf_timer_callback( CFRunLoopTimerRef timer, void *info ) {
   struct CFMIDIRunloop * cf_runloop = info;
   struct MIDIRunloopSource * source = &(cf_runloop->base.master);
+  struct timespec * timeout = &(source->timeout_time);
+  cf_runloop->cf_deadline = 0;
   if( source->delegate.timeout != NULL ) {
-    (*source->delegate.timeout)( source->delegate.info, &(source->timeout_time) );
-  }
-}
-
-struct CFRunLoopTimerTimespec {
-  double timeout;
-  CFRunLoopTimerRef timer;
-};
-
-#define CF_INTEGRATION_TIMEOUT_DELTA 0.001
-static void _cf_runloop_timer_timeout_applier( const void * value, void * context ) {
-  CFRunLoopTimerRef timer = value;
-  struct CFRunLoopTimerTimespec * t = context;
-  double timeout = CFRunLoopTimerGetInterval( timer );
-  if( timeout + CF_INTEGRATION_TIMEOUT_DELTA > t->timeout
-   && timeout - CF_INTEGRATION_TIMEOUT_DELTA < t->timeout ) {
-    t->timer = timer;
-  }
-}
-#undef CF_INTEGRATION_TIMEOUT_DELTA
-
-struct CFSocketNative {
-  int fd;
-  CFSocketRef socket;
-};
-
-static void _cf_socket_native_applier( const void * value, void * context ) {
-  CFSocketRef socket = value;
-  struct CFSocketNative * s = context;
-  int native = CFSocketGetNative( socket );
-  if( s->fd == native ) {
-    s->socket = socket;
+    (*source->delegate.timeout)( source->delegate.info, timeout );
   }
-}
-
-static void _cf_invalidate_timer_applier( const void * value, void * context ) {
-  struct CFMIDIRunloop * cf_runloop = context;
-  CFRunLoopTimerRef timer = value;
-  CFRunLoopTimerInvalidate( timer );
-  if( CFRunLoopContainsTimer( cf_runloop->runloop, timer, kCFRunLoopCommonModes ) ) {
-    CFRunLoopRemoveTimer( cf_runloop->runloop, timer, kCFRunLoopCommonModes );
+  /* the master timeout is the shortest timeout of all sources,
+   * check again after it has passed */
+  if( cf_runloop->cf_deadline == 0 && source->delegate.timeout != NULL
+   && ( timeout->tv_sec != 0 || timeout->tv_nsec != 0 ) ) {
+    cf_runloop->cf_deadline = CFAbsoluteTimeGetCurrent()
+                            + (double) timeout->tv_sec + 0.000000001 * (double) timeout->tv_nsec;
   }
+  CFRunLoopTimerSetNextFireDate( timer, ( cf_runloop->cf_deadline != 0 ) ? cf_runloop->cf_deadline
+                                        : CFAbsoluteTimeGetCurrent() + CF_INTEGRATION_TIMER_IDLE );
 }
 
-static void _cf_disable_socket_callbacks_applier( const void * value, void * context ) {
+static void _cf_disable_socket_callbacks_applier( const void * key, const void * value, void * context ) {
   CFSocketDisableCallBacks( value, kCFSocketReadCallBack | kCFSocketWriteCallBack );
 }
 
-static void _cf_invalidate_source_applier( const void * value, void * context ) {
+static void _cf_invalidate_source_applier( const void * key, const void * value, void * context ) {
   struct CFMIDIRunloop * cf_runloop = context;
   CFRunLoopSourceRef source = value;
   CFRunLoopSourceInvalidate( source );
@@ -163,45 +144,6 @@ static void _cf_invalidate_source_applier( const void * value, void * context )
  * @{
  */
 
-/**
- * Given the runloop and a timeout find the CFRunLoopTimerRef
- * with the interval close to timeout.
- * @private @memberof CFMIDIRunloop
- * @param cf_runloop the runloop.
- * @param timeout    the timeout.
- * @return a CFRunLoopTimerRef that is close to @c timeout or @c NULL if no
- *         interval close to the given timeout was created.
- */
-static CFRunLoopTimerRef _cf_runloop_find_cf_runloop_timer( struct CFMIDIRunloop * cf_runloop, struct timespec * timeout ) {
-  struct CFRunLoopTimerTimespec t;
-  t.timeout = (double) timeout->tv_sec + 0.000000001 * (double) timeout->tv_nsec;
-  t.timer   = NULL;
-  CFSetApplyFunction( cf_runloop->cf_timers, &_cf_runloop_timer_timeout_applier, &t );
-  if( t.timer != NULL ) CFRetain( t.timer );
-  return t.timer;
-}
-
-/**
- * Provide a runloop timer with closely the given timeout.
- * @private @memberof CFMIDIRunloop
- * @param cf_runloop the runloop.
- * @param fd         the filedescriptor.
- * @return a CFRunLoopTimerRef that is close to @c timeout.
- */
-static CFRunLoopTimerRef _cf_runloop_provide_cf_runloop_timer( struct CFMIDIRunloop * cf_runloop, struct timespec * timeout ) {
-  CFRunLoopTimerRef timer;
-  
-  timer = _cf_runloop_find_cf_runloop_timer( cf_runloop, timeout );
-  if( timer == NULL ) {
-    timer = CFRunLoopTimerCreate( NULL, CFAbsoluteTimeGetCurrent(),
-      (double) timeout->tv_sec + 0.000000001 * (double) timeout->tv_nsec,
-      0, 1, &_cf_timer_callback, &(cf_runloop->timer_context) );
-    CFRunLoopAddTimer( cf_runloop->runloop, timer, kCFRunLoopCommonModes );
-    CFSetAddValue( cf_runloop->cf_timers, timer );
-  }
-  return timer;
-}
-
 /**
  * Given the runloop and a socket number find the CFSocketRef
  * with the native socket number @c fd.
@@ -212,12 +154,7 @@ static CFRunLoopTimerRef _cf_runloop_provide_cf_runloop_timer( struct CFMIDIRunl
  *         socket with the given number was created.
  */
 static CFSocketRef _cf_runloop_find_cf_socket( struct CFMIDIRunloop * cf_runloop, int fd ) {
-  struct CFSocketNative s;
-  s.fd     = fd;
-  s.socket = NULL;
-  CFSetApplyFunction( cf_runloop->cf_sockets, &_cf_socket_native_applier, &s );
-  if( s.socket != NULL ) CFRetain( s.socket );
-  return s.socket;
+  return (CFSocketRef) CFDictionaryGetValue( cf_runloop->cf_sockets, CF_SOCKET_KEY( fd ) );
 }
 
 /**
@@ -227,7 +164,7 @@ static CFSocketRef _cf_runloop_find_cf_socket( struct CFMIDIRunloop * cf_runloop
  * @private @memberof CFMIDIRunloop
  * @param cf_runloop the runloop.
  * @param fd         the filedescriptor.
- * @return a CFSocketRef thet matches @c fd.
+ * @return a CFSocketRef thet matches @c fd, owned by the runloop.
  */
 static CFSocketRef _cf_runloop_provide_cf_socket( struct CFMIDIRunloop * cf_runloop, int fd ) {
   CFSocketRef        socket;
@@ -237,13 +174,13 @@ static CFSocketRef _cf_runloop_provide_cf_socket( struct CFMIDIRunloop * cf_runl
   if( socket == NULL ) {
     socket = CFSocketCreateWithNative( NULL, fd, kCFSocketReadCallBack | kCFSocketWriteCallBack,
                                        &_cf_socket_callback, &(cf_runloop->socket_context) );
+    if( socket == NULL ) return NULL;
     source = CFSocketCreateRunLoopSource( NULL, socket, 1 );
-    if( !CFSetContainsValue( cf_runloop->cf_sources, source ) ) {
-      CFSetAddValue( cf_runloop->cf_sources, source );
-      CFRunLoopAddSource( cf_runloop->runloop, source, kCFRunLoopCommonModes );
-    }
+    CFDictionarySetValue( cf_runloop->cf_sources, CF_SOCKET_KEY( fd ), source );
+    CFRunLoopAddSource( cf_runloop->runloop, source, kCFRunLoopCommonModes );
     CFRelease( source );
-    CFSetAddValue( cf_runloop->cf_sockets, socket );
+    CFDictionarySetValue( cf_runloop->cf_sockets, CF_SOCKET_KEY( fd ), socket );
+    CFRelease( socket );
   }
 
   return socket;
@@ -260,8 +197,8 @@ static int _cf_runloop_socket_enable_callback( struct CFMIDIRunloop * cf_runloop
   MIDIAssert( cf_runloop != NULL );
 
   socket = _cf_runloop_provide_cf_socket( cf_runloop, fd );
+  if( socket == NULL ) return 1;
   CFSocketEnableCallBacks( socket, type );  
-  CFRelease( socket );
   return 0;
 }  
 
@@ -278,7 +215,6 @@ static int _cf_runloop_socket_disable_callback( struct CFMIDIRunloop * cf_runloo
   socket = _cf_runloop_find_cf_socket( cf_runloop, fd );
   if( socket ) {
     CFSocketDisableCallBacks( socket, type );  
-    CFRelease( socket );
   }
   return 0;
 }  
@@ -316,13 +252,22 @@ static int _cf_runloop_clear_write( void * info, int fd ) {
   return _cf_runloop_socket_disable_callback( info, fd, kCFSocketWriteCallBack );
 }
 
+/**
+ * Move the fire date of the runloop's timer forward if the timeout
+ * expires before the current deadline. All timeouts share a single
+ * timer, which is re-armed from the master timeout after it fired.
+ */
 static int _cf_runloop_schedule_timeout( void * info, struct timespec * timeout ) {
   struct CFMIDIRunloop * cf_runloop = info;
-  CFRunLoopTimerRef timer;
+  CFAbsoluteTime deadline;
   MIDIAssert( cf_runloop != NULL );
   MIDILog( DEBUG, "CoreFoundation integration: Schedule timeout\n" );
-  timer = _cf_runloop_provide_cf_runloop_timer( cf_runloop, timeout );
-  return (timer != NULL);
+  deadline = CFAbsoluteTimeGetCurrent() + (double) timeout->tv_sec + 0.000000001 * (double) timeout->tv_nsec;
+  if( cf_runloop->cf_deadline == 0 || deadline < cf_runloop->cf_deadline ) {
+    cf_runloop->cf_deadline = deadline;
+    CFRunLoopTimerSetNextFireDate( cf_runloop->cf_timer, deadline );
+  }
+  return 0;
 }
 
 static int _cf_runloop_clear_timeout( void * info ) {
@@ -365,9 +310,15 @@ struct CFMIDIRunloop * CFMIDIRunloopCreate( CFRunLoopRef runloop ) {
   cf_runloop->socket_context.retain  = &_cf_retain_callback;
   cf_runloop->socket_context.copyDescription = NULL;
   
-  cf_runloop->cf_timers  = CFSetCreateMutable( NULL, 0, &kCFTypeSetCallBacks );
-  cf_runloop->cf_sockets = CFSetCreateMutable( NULL, 0, &kCFTypeSetCallBacks );
-  cf_runloop->cf_sources = CFSetCreateMutable( NULL, 0, &kCFTypeSetCallBacks );
+  cf_runloop->cf_sockets = CFDictionaryCreateMutable( NULL, 0, NULL, &kCFTypeDictionaryValueCallBacks );
+  cf_runloop->cf_sources = CFDictionaryCreateMutable( NULL, 0, NULL, &kCFTypeDictionaryValueCallBacks );
+
+  /* a repeating timer stays valid after firing, so it can be re-armed */
+  cf_runloop->cf_deadline = 0;
+  cf_runloop->cf_timer = CFRunLoopTimerCreate( NULL, CFAbsoluteTimeGetCurrent() + CF_INTEGRATION_TIMER_IDLE,
+                                               CF_INTEGRATION_TIMER_IDLE, 0, 1,
+                                               &_cf_timer_callback, &(cf_runloop->timer_context) );
+  CFRunLoopAddTimer( cf_runloop->runloop, cf_runloop->cf_timer, kCFRunLoopCommonModes );
 
   cf_runloop->base.schedule_read    = &_cf_runloop_schedule_read;
   cf_runloop->base.schedule_write   = &_cf_runloop_schedule_write;
@@ -382,11 +333,11 @@ struct CFMIDIRunloop * CFMIDIRunloopCreate( CFRunLoopRef runloop ) {
 void CFMIDIRunloopDestroy( struct CFMIDIRunloop * cf_runloop ) {
   MIDIPrecondReturn( cf_runloop, EFAULT, (void)0 );
   
-  CFSetApplyFunction( cf_runloop->cf_timers, &_cf_invalidate_timer_applier, NULL );
-  CFSetApplyFunction( cf_runloop->cf_sockets, &_cf_disable_socket_callbacks_applier, NULL );
-  CFSetApplyFunction( cf_runloop->cf_sources, &_cf_invalidate_source_applier, NULL );
+  CFRunLoopTimerInvalidate( cf_runloop->cf_timer );
+  CFRelease( cf_runloop->cf_timer );
+  CFDictionaryApplyFunction( cf_runloop->cf_sockets, &_cf_disable_socket_callbacks_applier, NULL );
+  CFDictionaryApplyFunction( cf_runloop->cf_sources, &_cf_invalidate_source_applier, cf_runloop );
 
-  CFRelease( cf_runloop->cf_timers );
   CFRelease( cf_runloop->cf_sockets );
   CFRelease( cf_runloop->cf_sources );
   free( cf_runloop );
@@ -30,6 +30,21 @@
 #define _MIDI_CLOCK_SYS { &_init_clock_sys, &_timestamp_sys }
 #endif
 
+/* The time stamp counter is opt-in, it is only usable on CPUs with an
+ * invariant TSC and is checked and calibrated when the first clock is created. */
+#if defined(USE_TSC_CLOCK) && defined(__GNUC__) && ( defined(__x86_64__) || defined(__i386__) )
+#include <cpuid.h>
+#include <x86intrin.h>
+#define _MIDI_CLOCK_TSC { &_init_clock_tsc, &_timestamp_tsc }
+#define TSC_CALIBRATION_USEC 20000
+#endif
+
+/* Convert timestamps with a precomputed 64.64 fixed-point multiplier instead
+ * of a multiplication and a division by the clock's fraction. */
+#if defined(__SIZEOF_INT128__) && !defined(NO_FAST_CLOCK)
+#define _MIDI_CLOCK_FIXED_POINT
+#endif
+
 #define MSEC_PER_SEC 1000
 #define USEC_PER_SEC 1000000
 #define NSEC_PER_SEC 1000000000
@@ -52,6 +67,12 @@ struct MIDIClock {
   MIDISamplingRate rate;
   unsigned long long numer;
   unsigned long long denom;
+  MIDITimestamp    epoch;
+  double           skew;
+#ifdef _MIDI_CLOCK_FIXED_POINT
+  unsigned long long mult_int;
+  unsigned long long mult_frac;
+#endif
 /** @endcond */
 };
 
@@ -121,6 +142,23 @@ static void _multiply_frac( unsigned long long * numer, unsigned long long * den
   _divide_frac( denom, numer, fac );
 }
 
+/**
+ * @brief Precompute the fixed-point form of the clock's fraction.
+ * Split the fraction into an integral part and a fractional part that is
+ * scaled by 2^64, so that @ref _get_real_time only needs multiplications
+ * and a shift. The result is the exact quotient or at most one tick less.
+ * Must be called whenever the fraction changes.
+ * @private @memberof MIDIClock
+ * @param clock The clock.
+ */
+static void _update_fixed_point( struct MIDIClock * clock ) {
+#ifdef _MIDI_CLOCK_FIXED_POINT
+  clock->mult_int  = clock->numer / clock->denom;
+  clock->mult_frac = (unsigned long long)
+    ( ( (unsigned __int128) ( clock->numer % clock->denom ) << 64 ) / clock->denom );
+#endif
+}
+
 #ifdef _MIDI_CLOCK_MACH
 /**
  * Initialize a clock to be used with @c mach_absolute_time().
@@ -165,7 +203,7 @@ static void _init_clock_posix( struct MIDIClock * clock ) {
  * @return a timestamp in nanoseconds.
  */
 static unsigned long long _timestamp_posix( void ) {
-  static struct timespec ts;
+  struct timespec ts;
   clock_gettime( POSIX_CLOCK_TYPE, &ts );
   return (ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec);
 }
@@ -188,16 +226,24 @@ static void _init_clock_sys( struct MIDIClock * clock ) {
  * @return a timestamp in microseconds.
  */
 static unsigned long long _timestamp_sys( void ) {
-  static struct timeval tv;
+  struct timeval tv;
   gettimeofday( &tv, NULL );
   return (tv.tv_sec * USEC_PER_SEC + tv.tv_usec);
 }
 #endif
 
+#ifdef _MIDI_CLOCK_TSC
+static void _init_clock_tsc( struct MIDIClock * clock );
+static unsigned long long _timestamp_tsc( void );
+#endif
+
 static struct {
   void (*init)( struct MIDIClock * );
   unsigned long long (*timestamp)( void );
 } _midi_clock[] = {
+#ifdef _MIDI_CLOCK_TSC
+  _MIDI_CLOCK_TSC,
+#endif
 #ifdef _MIDI_CLOCK_MACH
   _MIDI_CLOCK_MACH,
 #endif
@@ -209,6 +255,59 @@ static struct {
 #endif
 };
 
+/**
+ * @brief The index of the timestamp source in use.
+ * @private @memberof MIDIClock
+ */
+static int _midi_clock_source = 0;
+
+#ifdef _MIDI_CLOCK_TSC
+/**
+ * Initialize a clock to be used with the CPU's time stamp counter.
+ * On first use, check that the counter runs at a constant rate and measure
+ * its frequency against the next timestamp source. If the counter is not
+ * invariant, switch to the next source for good.
+ * @private @memberof MIDIClock
+ * @param clock The clock.
+ */
+static void _init_clock_tsc( struct MIDIClock * clock ) {
+  static unsigned long long frequency = 0;
+  unsigned int eax, ebx, ecx, edx;
+  unsigned long long tsc, ref, elapsed;
+  struct MIDIClock reference;
+
+  if( frequency == 0 ) {
+    (*_midi_clock[1].init)( &reference );
+    if( __get_cpuid( 0x80000007, &eax, &ebx, &ecx, &edx ) == 0 || ( edx & (1<<8) ) == 0 ) {
+      MIDILog( INFO, "TSC is not invariant, using fallback clock.\n" );
+      _midi_clock_source = 1;
+      clock->numer = reference.numer;
+      clock->denom = reference.denom;
+      return;
+    }
+    ref = (*_midi_clock[1].timestamp)();
+    tsc = _timestamp_tsc();
+    do {
+      elapsed = (*_midi_clock[1].timestamp)() - ref;
+    } while( ( elapsed * reference.numer * USEC_PER_SEC ) / reference.denom < TSC_CALIBRATION_USEC );
+    tsc = _timestamp_tsc() - tsc;
+    frequency = ( tsc * reference.denom ) / ( elapsed * reference.numer );
+    MIDILog( DEBUG, "TSC frequency: %llu Hz\n", frequency );
+  }
+  clock->numer = 1;
+  clock->denom = frequency;
+}
+
+/**
+ * Get a timestamp by reading the time stamp counter.
+ * @private @memberof MIDIClock
+ * @return a timestamp in CPU cycles.
+ */
+static unsigned long long _timestamp_tsc( void ) {
+  return __rdtsc();
+}
+#endif
+
 /**
  * @brief The global clock.
  * @private @memberof MIDIClock
@@ -218,12 +317,46 @@ static struct MIDIClock * _midi_global_clock = NULL;
 /**
  * @brief Get the real time.
  * Use the clock's timestamp function to get an implementation-specific
- * timestamp. Then convert it to the desired rate using the internal fraction.
+ * timestamp. Then convert it to the desired rate using the fixed-point
+ * multiplier or, where that is not available, the internal fraction.
  * @private @memberof MIDIClock
  * @param clock The clock.
  */
 static MIDITimestamp _get_real_time( struct MIDIClock * clock ) {
-  return ((*_midi_clock[0].timestamp)() * clock->numer) / clock->denom;
+  unsigned long long timestamp = (*_midi_clock[_midi_clock_source].timestamp)();
+#ifdef _MIDI_CLOCK_FIXED_POINT
+  return timestamp * clock->mult_int
+       + (unsigned long long) ( ( (unsigned __int128) timestamp * clock->mult_frac ) >> 64 );
+#else
+  return (timestamp * clock->numer) / clock->denom;
+#endif
+}
+
+/**
+ * @brief Convert the real time to the clock's time.
+ * Apply the clock's offset and, if the clock is skewed, the rate deviation
+ * accumulated since the skew was set.
+ * @private @memberof MIDIClock
+ * @param clock The clock.
+ * @param real  The real time.
+ * @return the time of the clock.
+ */
+static MIDITimestamp _clock_time( struct MIDIClock * clock, MIDITimestamp real ) {
+  if( clock->skew == 0 ) return real + clock->offset;
+  return real + clock->offset + (MIDITimestamp) ( (double) ( real - clock->epoch ) * clock->skew );
+}
+
+/**
+ * @brief Convert the clock's time to the real time.
+ * @see _clock_time
+ * @private @memberof MIDIClock
+ * @param clock     The clock.
+ * @param timestamp The time of the clock.
+ * @return the real time.
+ */
+static MIDITimestamp _clock_real_time( struct MIDIClock * clock, MIDITimestamp timestamp ) {
+  if( clock->skew == 0 ) return timestamp - clock->offset;
+  return clock->epoch + (MIDITimestamp) ( (double) ( timestamp - clock->offset - clock->epoch ) / ( 1.0 + clock->skew ) );
 }
 
 /**
@@ -322,12 +455,15 @@ struct MIDIClock * MIDIClockCreate( MIDISamplingRate rate ) {
   MIDIPrecondReturn( clock != NULL, ENOMEM, NULL );
 
   clock->refs = 1;
-  (*_midi_clock[0].init)( clock );
+  (*_midi_clock[_midi_clock_source].init)( clock );
   if( rate == 0 ) rate = ( clock->denom / clock->numer );
   _multiply_frac( &(clock->numer), &(clock->denom), rate );
   _normalize_frac( &(clock->numer), &(clock->denom) );
+  _update_fixed_point( clock );
   clock->rate   = rate;
   clock->offset = -1 * _get_real_time( clock );
+  clock->epoch  = 0;
+  clock->skew   = 0;
   MIDILogLocation( DEVELOP, "Initialized clock:\n  rate: %u, offset: %lli\n  numer: %llu / denom: %llu\n",
     clock->rate, clock->offset, clock->numer, clock->denom );
   return clock;
@@ -352,7 +488,7 @@ void MIDIClockDestroy( struct MIDIClock * clock ) {
  */
 void MIDIClockRetain( struct MIDIClock * clock ) {
   MIDIPrecondReturn( clock != NULL, EFAULT, (void)0 );
-  clock->refs++;
+  MIDIRefRetain( clock->refs );
 }
 
 /**
@@ -364,7 +500,7 @@ void MIDIClockRetain( struct MIDIClock * clock ) {
  */
 void MIDIClockRelease( struct MIDIClock * clock ) {
   MIDIPrecondReturn( clock != NULL, EFAULT, (void)0 );
-  if( ! --clock->refs ) {
+  if( ! MIDIRefRelease( clock->refs ) ) {
     MIDIClockDestroy( clock );
   }
 }
@@ -389,7 +525,8 @@ void MIDIClockRelease( struct MIDIClock * clock ) {
 int MIDIClockSetNow( struct MIDIClock * clock, MIDITimestamp now ) {
   if( clock == NULL ) clock = _get_global_clock();
   MIDIPrecond( clock->refs == 1, EFAULT );
-  clock->offset = now - _get_real_time( clock );
+  clock->offset = 0;
+  clock->offset = now - _clock_time( clock, _get_real_time( clock ) );
   return 0;
 }
 
@@ -404,7 +541,47 @@ int MIDIClockSetNow( struct MIDIClock * clock, MIDITimestamp now ) {
 int MIDIClockGetNow( struct MIDIClock * clock, MIDITimestamp * now ) {
   MIDIPrecond( now != NULL, EINVAL );
   if( clock == NULL ) clock = _get_global_clock();
-  *now = _get_real_time( clock ) + clock->offset;
+  *now = _clock_time( clock, _get_real_time( clock ) );
+  return 0;
+}
+
+/**
+ * @brief Make a clock follow another time base.
+ * Set the current time and the deviation of the clock's rate from its
+ * nominal sampling rate. From now on the clock gains @c skew ticks per tick,
+ * a @c skew of @c 1e-6 makes it run one part per million fast. This is used
+ * to model the clock of a remote host, so it may be called while the clock
+ * is referenced elsewhere. @ref MIDIClockConvertTimestamp honours the skew.
+ * @public @memberof MIDIClock
+ * @param clock The clock to modify (pass @c NULL for global clock)
+ * @param now   The new current time.
+ * @param skew  The rate deviation.
+ * @retval 0 on success.
+ * @retval >0 if the clock could not be adjusted.
+ */
+int MIDIClockAdjust( struct MIDIClock * clock, MIDITimestamp now, double skew ) {
+  MIDITimestamp real;
+  if( clock == NULL ) clock = _get_global_clock();
+  MIDIPrecond( skew > -1.0, EINVAL );
+  real = _get_real_time( clock );
+  clock->epoch  = real;
+  clock->skew   = skew;
+  clock->offset = now - real;
+  return 0;
+}
+
+/**
+ * @brief Get the rate deviation of a clock.
+ * @see MIDIClockAdjust
+ * @public @memberof MIDIClock
+ * @param clock The clock (pass @c NULL for global clock)
+ * @param skew  The rate deviation.
+ * @retval 0 on success.
+ */
+int MIDIClockGetSkew( struct MIDIClock * clock, double * skew ) {
+  MIDIPrecond( skew != NULL, EINVAL );
+  if( clock == NULL ) clock = _get_global_clock();
+  *skew = clock->skew;
   return 0;
 }
 
@@ -422,6 +599,7 @@ int MIDIClockSetSamplingRate( struct MIDIClock * clock, MIDISamplingRate rate )
   MIDIPrecond( clock->refs == 1, EFAULT );
   clock->numer = ( clock->numer / clock->rate ) * rate;
   clock->rate  = rate;
+  _update_fixed_point( clock );
   return 0;
 }
 
@@ -452,7 +630,7 @@ int MIDIClockGetSamplingRate( struct MIDIClock * clock, MIDISamplingRate * rate
 int MIDIClockTimestampToSeconds( struct MIDIClock * clock, MIDITimestamp timestamp, double * seconds ) {
   MIDIPrecond( seconds != NULL, EINVAL );
   if( clock == NULL ) clock = _get_global_clock();
-  *seconds = timestamp / clock->rate;
+  *seconds = (double) timestamp / clock->rate;
   return 0;
 }
 
@@ -495,11 +673,11 @@ int MIDIClockConvertTimestamp( struct MIDIClock * clock, struct MIDIClock * sour
   _normalize_frac( &numer, &denom );
 
   /* printf( "Rate: %u->%u, *%llu/%llu\n", source->rate, clock->rate, numer, denom ); */
-  tmp = ( *timestamp - source->offset );
+  tmp = _clock_real_time( source, *timestamp );
   /* printf( "tmp:%lli\n", tmp ); */
   tmp = ( tmp * numer ) / denom;
   /* printf( "tmp:%lli\n", tmp ); */
-  *timestamp = ( tmp + clock->offset );
+  *timestamp = _clock_time( clock, tmp );
   return 0;
 }
 
@@ -26,6 +26,9 @@ void MIDIClockRelease( struct MIDIClock * clock );
 int MIDIClockSetNow( struct MIDIClock * clock, MIDITimestamp now );
 int MIDIClockGetNow( struct MIDIClock * clock, MIDITimestamp * now );
 
+int MIDIClockAdjust( struct MIDIClock * clock, MIDITimestamp now, double skew );
+int MIDIClockGetSkew( struct MIDIClock * clock, double * skew );
+
 int MIDIClockSetSamplingRate( struct MIDIClock * clock, MIDISamplingRate rate );
 int MIDIClockGetSamplingRate( struct MIDIClock * clock, MIDISamplingRate * rate );
 
@@ -0,0 +1,28 @@
+#ifndef MIDIKIT_MIDI_COMPACT_H
+#define MIDIKIT_MIDI_COMPACT_H
+#include "midi.h"
+#include "message.h"
+
+struct MIDICompactFilter {
+  unsigned short statuses;
+  unsigned short channels;
+  short key_min;
+  short key_max;
+  unsigned char table[256];
+};
+
+int MIDICompactFilterInit( struct MIDICompactFilter * filter );
+int MIDICompactFilterSetStatus( struct MIDICompactFilter * filter, MIDIStatus status, MIDIBoolean pass );
+int MIDICompactFilterSetChannel( struct MIDICompactFilter * filter, MIDIChannel channel, MIDIBoolean pass );
+int MIDICompactFilterSetMasks( struct MIDICompactFilter * filter, unsigned short statuses, unsigned short channels );
+int MIDICompactFilterSetKeyRange( struct MIDICompactFilter * filter, int min, int max );
+
+int MIDICompactFilterApply( struct MIDICompactFilter * filter, size_t count, struct MIDICompactMessage * messages,
+                            struct MIDICompactMessage * out, size_t * written );
+
+int MIDICompactRemapChannels( size_t count, struct MIDICompactMessage * messages, const unsigned char * map );
+int MIDICompactTranspose( size_t count, struct MIDICompactMessage * messages, int transpose );
+int MIDICompactScaleVelocity( size_t count, struct MIDICompactMessage * messages, unsigned int scale );
+int MIDICompactApplyVelocityCurve( size_t count, struct MIDICompactMessage * messages, const unsigned char * curve );
+
+#endif
@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <string.h>
 #include "device.h"
 #include "controller.h"
 
@@ -44,8 +45,18 @@ static char * _control_names[] = {
 };
 */
 
-/** @internal */
-struct MIDINRPList;
+/**
+ * @ingroup MIDI
+ * @struct MIDIControllerState controller.h
+ * @brief Flat copy of the complete state of a controller.
+ * The state block contains no pointers, so it can be stored, recalled
+ * and kept in arrays with a single bounded memcpy. The version and size
+ * fields are checked when a block is recalled.
+ * Non-registered parameters are kept on up to
+ * @c MIDI_CONTROLLER_NRP_PAGES pages of 128 parameters that share the
+ * same MSB. @c page_index maps an MSB to its page, zero means that no
+ * parameter of that range was stored.
+ */
 
 /**
  * @ingroup MIDI
@@ -53,16 +64,17 @@ struct MIDINRPList;
  * The MIDIController implements the full set of controls
  * specified by the MIDI standard and can be attached to
  * any MIDIDevice channel to monitor control change messages.
+ * The controller owns two state blocks. Messages always modify the
+ * current one, the other one receives snapshots that are staged with
+ * MIDIControllerStage and become current with MIDIControllerCommit.
  */
 struct MIDIController {
   size_t refs;
   struct MIDIControllerDelegate * delegate;
 
-  MIDILongValue current_parameter;
-  MIDIBoolean   current_parameter_registered;
-  MIDIValue controls[N_CONTROLS];
-  MIDIValue registered_parameters[6];
-  struct MIDINRPList * list;
+  struct MIDIControllerState * state;
+  volatile int staged;
+  struct MIDIControllerState buffers[2];
 };
 
 /* MARK: Internals *//**
@@ -72,91 +84,138 @@ struct MIDIController {
  * @{
  */
 
-struct MIDINonRegisteredParameter {
-  MIDILongValue number;
-  MIDILongValue value;
-};
+/**
+ * @brief Look up a non-registered parameter.
+ * @param controller The controller.
+ * @param number     The 14-bit parameter number.
+ * @param value      The stored value.
+ * @retval 0 if the parameter was stored before.
+ * @retval 1 otherwise.
+ */
+static int _find_non_registered_parameter( struct MIDIController * controller, MIDILongValue number,
+                                           MIDILongValue * value ) {
+  struct MIDIControllerState * state = controller->state;
+  struct MIDINonRegisteredParameterPage * page;
+  int index = state->page_index[MIDI_MSB(number)];
+  int entry = MIDI_LSB(number);
+  if( index == 0 || index > state->pages_length ) return 1;
+  page = &(state->pages[index-1]);
+  if( !( page->stored[entry>>3] & ( 1 << ( entry & 7 ) ) ) ) return 1;
+  *value = page->values[entry];
+  return 0;
+}
 
-struct MIDINRPList {
-  struct MIDINonRegisteredParameter * parameter;
-  struct MIDINRPList * next;
-};
+/**
+ * @brief Store the value of a non-registered parameter.
+ * Assign the next free page to the parameter's MSB if necessary.
+ * @param controller The controller.
+ * @param number     The 14-bit parameter number.
+ * @param value      The value to store.
+ * @retval 0 on success.
+ * @retval 1 if all pages are in use.
+ */
+static int _put_non_registered_parameter( struct MIDIController * controller, MIDILongValue number,
+                                          MIDILongValue value ) {
+  struct MIDIControllerState * state = controller->state;
+  struct MIDINonRegisteredParameterPage * page;
+  unsigned char * index = &(state->page_index[MIDI_MSB(number)]);
+  int entry = MIDI_LSB(number);
+  if( *index == 0 || *index > state->pages_length ) {
+    if( state->pages_length >= MIDI_CONTROLLER_NRP_PAGES ) return 1;
+    page = &(state->pages[state->pages_length]);
+    memset( page, 0, sizeof( struct MIDINonRegisteredParameterPage ) );
+    *index = ++(state->pages_length);
+  }
+  page = &(state->pages[*index-1]);
+  page->stored[entry>>3] |= ( 1 << ( entry & 7 ) );
+  page->values[entry] = value;
+  return 0;
+}
+
+/**
+ * @brief Check that a buffer holds a state block of this version.
+ * @param size   The size of the buffer.
+ * @param buffer The buffer.
+ * @retval 0 if the state block can be recalled.
+ * @retval 1 otherwise.
+ */
+static int _check_state( size_t size, void * buffer ) {
+  struct MIDIControllerState * state = buffer;
+  if( size < sizeof( struct MIDIControllerState ) ) return 1;
+  if( state->version != MIDI_CONTROLLER_STATE_VERSION ) return 1;
+  if( state->size != sizeof( struct MIDIControllerState ) ) return 1;
+  if( state->pages_length > MIDI_CONTROLLER_NRP_PAGES ) return 1;
+  return 0;
+}
 
 static int _load_non_registered_parameter( struct MIDIController * controller ) {
-  MIDILongValue parameter = MIDI_LONG_VALUE( controller->controls[MIDI_CONTROL_NON_REGISTERED_PARAMETER_NUMBER_MSB],
-                                             controller->controls[MIDI_CONTROL_NON_REGISTERED_PARAMETER_NUMBER_LSB] );
-  struct MIDINRPList * list = controller->list;
-  if( controller->current_parameter_registered == MIDI_ON ) return 1;
-  if( parameter == controller->current_parameter )          return 0;
+  MIDILongValue parameter = MIDI_LONG_VALUE( controller->state->controls[MIDI_CONTROL_NON_REGISTERED_PARAMETER_NUMBER_MSB],
+                                             controller->state->controls[MIDI_CONTROL_NON_REGISTERED_PARAMETER_NUMBER_LSB] );
+  MIDILongValue value;
+  if( controller->state->current_parameter_registered == MIDI_ON ) return 1;
+  if( parameter == controller->state->current_parameter )          return 0;
   if( parameter == MIDI_CONTROL_RPN_RESET ) {
-    controller->controls[MIDI_CONTROL_DATA_ENTRY]    = 0x7f;
-    controller->controls[MIDI_CONTROL_DATA_ENTRY+32] = 0x7f;
-    controller->current_parameter = MIDI_CONTROL_RPN_RESET;
-    controller->current_parameter_registered = MIDI_OFF;
+    controller->state->controls[MIDI_CONTROL_DATA_ENTRY]    = 0x7f;
+    controller->state->controls[MIDI_CONTROL_DATA_ENTRY+32] = 0x7f;
+    controller->state->current_parameter = MIDI_CONTROL_RPN_RESET;
+    controller->state->current_parameter_registered = MIDI_OFF;
     return 0;
   }
-  while( list != NULL ) {
-    if( list->parameter != NULL && list->parameter->number == parameter ) {
-       controller->controls[MIDI_CONTROL_DATA_ENTRY]    = MIDI_MSB( list->parameter->value );
-       controller->controls[MIDI_CONTROL_DATA_ENTRY+32] = MIDI_LSB( list->parameter->value );
-       controller->current_parameter = parameter;
-       controller->current_parameter_registered = MIDI_OFF;
-       return 0;
-    }
+  if( _find_non_registered_parameter( controller, parameter, &value ) ) {
+    value = 0;
   }
-  return 1;
+  controller->state->controls[MIDI_CONTROL_DATA_ENTRY]    = MIDI_MSB( value );
+  controller->state->controls[MIDI_CONTROL_DATA_ENTRY+32] = MIDI_LSB( value );
+  controller->state->current_parameter = parameter;
+  controller->state->current_parameter_registered = MIDI_OFF;
+  return 0;
 }
 
 static int _store_non_registered_parameter( struct MIDIController * controller ) {
-  MIDILongValue parameter = controller->current_parameter;
-  struct MIDINRPList * list = controller->list;
-  if( controller->current_parameter_registered == MIDI_ON ) return 1;
-  while( list != NULL ) {
-    if( list->parameter != NULL && list->parameter->number == parameter ) {
-       list->parameter->value = MIDI_LONG_VALUE( controller->controls[MIDI_CONTROL_DATA_ENTRY],
-                                                 controller->controls[MIDI_CONTROL_DATA_ENTRY+32] );
-       return 0;
-    }
-  }
-  return 1;
+  MIDILongValue parameter = controller->state->current_parameter;
+  if( controller->state->current_parameter_registered == MIDI_ON ) return 1;
+  if( parameter == MIDI_CONTROL_RPN_RESET ) return 0;
+  return _put_non_registered_parameter( controller, parameter,
+                                        MIDI_LONG_VALUE( controller->state->controls[MIDI_CONTROL_DATA_ENTRY],
+                                                         controller->state->controls[MIDI_CONTROL_DATA_ENTRY+32] ) );
 }
 
 static int _load_registered_parameter( struct MIDIController * controller ) {
-  MIDILongValue parameter = MIDI_LONG_VALUE( controller->controls[MIDI_CONTROL_REGISTERED_PARAMETER_NUMBER_MSB],
-                                             controller->controls[MIDI_CONTROL_REGISTERED_PARAMETER_NUMBER_LSB] );
-  if( controller->current_parameter_registered == MIDI_OFF ) return 1;
-  if( parameter == controller->current_parameter )           return 0;
+  MIDILongValue parameter = MIDI_LONG_VALUE( controller->state->controls[MIDI_CONTROL_REGISTERED_PARAMETER_NUMBER_MSB],
+                                             controller->state->controls[MIDI_CONTROL_REGISTERED_PARAMETER_NUMBER_LSB] );
+  if( controller->state->current_parameter_registered == MIDI_OFF ) return 1;
+  if( parameter == controller->state->current_parameter )           return 0;
   if( parameter == MIDI_CONTROL_RPN_RESET ) {
-    controller->controls[MIDI_CONTROL_DATA_ENTRY]    = 0x7f;
-    controller->controls[MIDI_CONTROL_DATA_ENTRY+32] = 0x7f;
-    controller->current_parameter = MIDI_CONTROL_RPN_RESET;
-    controller->current_parameter_registered = MIDI_ON;
+    controller->state->controls[MIDI_CONTROL_DATA_ENTRY]    = 0x7f;
+    controller->state->controls[MIDI_CONTROL_DATA_ENTRY+32] = 0x7f;
+    controller->state->current_parameter = MIDI_CONTROL_RPN_RESET;
+    controller->state->current_parameter_registered = MIDI_ON;
     return 0;
   }
   if( parameter >= MIDI_CONTROL_RPN_PITCH_BEND_RANGE && parameter <= MIDI_CONTROL_RPN_COARSE_TUNING ) {
-    controller->controls[MIDI_CONTROL_DATA_ENTRY]    = controller->registered_parameters[parameter*2];
-    controller->controls[MIDI_CONTROL_DATA_ENTRY+32] = controller->registered_parameters[parameter*2+1];
-    controller->current_parameter = parameter;
-    controller->current_parameter_registered = MIDI_ON;
+    controller->state->controls[MIDI_CONTROL_DATA_ENTRY]    = controller->state->registered_parameters[parameter*2];
+    controller->state->controls[MIDI_CONTROL_DATA_ENTRY+32] = controller->state->registered_parameters[parameter*2+1];
+    controller->state->current_parameter = parameter;
+    controller->state->current_parameter_registered = MIDI_ON;
     return 0;
   }
   return 1;
 }
 
 static int _store_registered_parameter( struct MIDIController * controller ) {
-  MIDILongValue parameter = controller->current_parameter;
-  if( controller->current_parameter_registered == MIDI_OFF ) return 1;
+  MIDILongValue parameter = controller->state->current_parameter;
+  if( controller->state->current_parameter_registered == MIDI_OFF ) return 1;
   if( parameter == MIDI_CONTROL_RPN_RESET ) return 0;
   if( parameter >= MIDI_CONTROL_RPN_PITCH_BEND_RANGE && parameter <= MIDI_CONTROL_RPN_COARSE_TUNING ) {
-    controller->registered_parameters[parameter*2]   = controller->controls[MIDI_CONTROL_DATA_ENTRY];
-    controller->registered_parameters[parameter*2+1] = controller->controls[MIDI_CONTROL_DATA_ENTRY+32];
+    controller->state->registered_parameters[parameter*2]   = controller->state->controls[MIDI_CONTROL_DATA_ENTRY];
+    controller->state->registered_parameters[parameter*2+1] = controller->state->controls[MIDI_CONTROL_DATA_ENTRY+32];
     return 0;
   }
   return 1;
 }
 
 static int _load_current_parameter( struct MIDIController * controller ) {
-  if( controller->current_parameter_registered == MIDI_OFF ) {
+  if( controller->state->current_parameter_registered == MIDI_OFF ) {
     return _load_non_registered_parameter( controller );
   } else {
     return _load_registered_parameter( controller );
@@ -164,52 +223,71 @@ static int _load_current_parameter( struct MIDIController * controller ) {
 }
 
 static int _store_current_parameter( struct MIDIController * controller ) {
-  if( controller->current_parameter_registered == MIDI_OFF ) {
+  if( controller->state->current_parameter_registered == MIDI_OFF ) {
     return _store_non_registered_parameter( controller );
   } else {
     return _store_registered_parameter( controller );
   }
 }
 
+/**
+ * @brief Make the parameter addressed by the parameter number controls current.
+ * Load its value into the data entry controls so that following data entry,
+ * increment and decrement messages modify it. Unknown registered parameters
+ * deselect the current parameter.
+ * @param controller The controller.
+ * @param registered Whether to select the registered or non-registered parameter.
+ * @retval 0 on success.
+ */
+static int _select_parameter( struct MIDIController * controller, MIDIBoolean registered ) {
+  if( controller->state->current_parameter_registered != registered ) {
+    controller->state->current_parameter_registered = registered;
+    controller->state->current_parameter = MIDI_CONTROL_RPN_RESET;
+  }
+  if( _load_current_parameter( controller ) ) {
+    controller->state->current_parameter = MIDI_CONTROL_RPN_RESET;
+  }
+  return 0;
+}
+
 static int _initialize_controls_for_gm( struct MIDIController * controller ) {
-  controller->controls[MIDI_CONTROL_CHANNEL_VOLUME]        = 100;
-  controller->controls[MIDI_CONTROL_EXPRESSION_CONTROLLER] = 127;
-  controller->controls[MIDI_CONTROL_PAN]                   =  64;
+  controller->state->controls[MIDI_CONTROL_CHANNEL_VOLUME]        = 100;
+  controller->state->controls[MIDI_CONTROL_EXPRESSION_CONTROLLER] = 127;
+  controller->state->controls[MIDI_CONTROL_PAN]                   =  64;
   return 0;
 }
 
 static int _reset_controls( struct MIDIController * controller ) {
-  controller->controls[MIDI_CONTROL_MODULATION_WHEEL]      = 0;
-  controller->controls[MIDI_CONTROL_EXPRESSION_CONTROLLER] = 127;
-  controller->controls[MIDI_CONTROL_DAMPER_PEDAL]          = 0;
-  controller->controls[MIDI_CONTROL_PORTAMENTO]            = 0;
-  controller->controls[MIDI_CONTROL_SOSTENUTO]             = 0;
-  controller->controls[MIDI_CONTROL_SOFT_PEDAL]            = 0;
-
-  controller->controls[MIDI_CONTROL_DATA_ENTRY]    = 0x7f;
-  controller->controls[MIDI_CONTROL_DATA_ENTRY+32] = 0x7f;
-  controller->controls[MIDI_CONTROL_NON_REGISTERED_PARAMETER_NUMBER_MSB] = 0x7f;
-  controller->controls[MIDI_CONTROL_NON_REGISTERED_PARAMETER_NUMBER_LSB] = 0x7f;
-  controller->controls[MIDI_CONTROL_REGISTERED_PARAMETER_NUMBER_MSB]     = 0x7f;
-  controller->controls[MIDI_CONTROL_REGISTERED_PARAMETER_NUMBER_LSB]     = 0x7f;
-
-  controller->current_parameter            = MIDI_CONTROL_RPN_RESET;
-  controller->current_parameter_registered = MIDI_OFF;
-
-  controller->registered_parameters[MIDI_CONTROL_RPN_PITCH_BEND_RANGE_SEMITONES] = 2;
-  controller->registered_parameters[MIDI_CONTROL_RPN_PITCH_BEND_RANGE_CENTS]     = 0;
-  controller->registered_parameters[MIDI_CONTROL_RPN_FINE_TUNING_MSB]            = 0x40;
-  controller->registered_parameters[MIDI_CONTROL_RPN_FINE_TUNING_LSB]            = 0;
-  controller->registered_parameters[MIDI_CONTROL_RPN_COARSE_TUNING_MSB]          = 0x40;
-  controller->registered_parameters[MIDI_CONTROL_RPN_COARSE_TUNING_LSB]          = 0;
+  controller->state->controls[MIDI_CONTROL_MODULATION_WHEEL]      = 0;
+  controller->state->controls[MIDI_CONTROL_EXPRESSION_CONTROLLER] = 127;
+  controller->state->controls[MIDI_CONTROL_DAMPER_PEDAL]          = 0;
+  controller->state->controls[MIDI_CONTROL_PORTAMENTO]            = 0;
+  controller->state->controls[MIDI_CONTROL_SOSTENUTO]             = 0;
+  controller->state->controls[MIDI_CONTROL_SOFT_PEDAL]            = 0;
+
+  controller->state->controls[MIDI_CONTROL_DATA_ENTRY]    = 0x7f;
+  controller->state->controls[MIDI_CONTROL_DATA_ENTRY+32] = 0x7f;
+  controller->state->controls[MIDI_CONTROL_NON_REGISTERED_PARAMETER_NUMBER_MSB] = 0x7f;
+  controller->state->controls[MIDI_CONTROL_NON_REGISTERED_PARAMETER_NUMBER_LSB] = 0x7f;
+  controller->state->controls[MIDI_CONTROL_REGISTERED_PARAMETER_NUMBER_MSB]     = 0x7f;
+  controller->state->controls[MIDI_CONTROL_REGISTERED_PARAMETER_NUMBER_LSB]     = 0x7f;
+
+  controller->state->current_parameter            = MIDI_CONTROL_RPN_RESET;
+  controller->state->current_parameter_registered = MIDI_OFF;
+
+  controller->state->registered_parameters[MIDI_CONTROL_RPN_PITCH_BEND_RANGE_SEMITONES] = 2;
+  controller->state->registered_parameters[MIDI_CONTROL_RPN_PITCH_BEND_RANGE_CENTS]     = 0;
+  controller->state->registered_parameters[MIDI_CONTROL_RPN_FINE_TUNING_MSB]            = 0x40;
+  controller->state->registered_parameters[MIDI_CONTROL_RPN_FINE_TUNING_LSB]            = 0;
+  controller->state->registered_parameters[MIDI_CONTROL_RPN_COARSE_TUNING_MSB]          = 0x40;
+  controller->state->registered_parameters[MIDI_CONTROL_RPN_COARSE_TUNING_LSB]          = 0;
   return 0;
 }
 
 static int _initialize_controls( struct MIDIController * controller ) {
-  int i;
-  for( i=0; i<N_CONTROLS; i++ ) {
-    controller->controls[i] = 0;
-  }
+  memset( controller->state, 0, sizeof( struct MIDIControllerState ) );
+  controller->state->version = MIDI_CONTROLLER_STATE_VERSION;
+  controller->state->size    = sizeof( struct MIDIControllerState );
   return _reset_controls( controller ) + _initialize_controls_for_gm( controller );
 }
 
@@ -258,6 +336,8 @@ struct MIDIController * MIDIControllerCreate( struct MIDIControllerDelegate * de
   MIDIPrecondReturn( controller != NULL, ENOMEM, NULL );
   controller->refs = 1;
   controller->delegate = delegate;
+  controller->state    = &(controller->buffers[0]);
+  controller->staged   = 0;
   _initialize_controls( controller );
   return controller;
 }
@@ -281,7 +361,7 @@ void MIDIControllerDestroy( struct MIDIController * controller ) {
  */
 void MIDIControllerRetain( struct MIDIController * controller ) {
   MIDIPrecondReturn( controller != NULL, EFAULT, (void)0 );
-  controller->refs++;
+  MIDIRefRetain( controller->refs );
 }
 
 /**
@@ -293,7 +373,7 @@ void MIDIControllerRetain( struct MIDIController * controller ) {
  */
 void MIDIControllerRelease( struct MIDIController * controller ) {
   MIDIPrecondReturn( controller != NULL, EFAULT, (void)0 );
-  if( ! --controller->refs ) {
+  if( ! MIDIRefRelease( controller->refs ) ) {
     MIDIControllerDestroy( controller );
   }
 }
@@ -325,8 +405,8 @@ int MIDIControllerSetControl( struct MIDIController * controller, MIDIControl co
 
   if( size == sizeof(MIDIValue) ) {
     v1 = *((MIDIValue*)value);
-    if( controller->controls[(int)control] != v1 ) {
-      controller->controls[(int)control] = v1;
+    if( controller->state->controls[(int)control] != v1 ) {
+      controller->state->controls[(int)control] = v1;
       /* send control change */
     }
   } else if( size == sizeof(MIDILongValue) ) {
@@ -365,7 +445,7 @@ int MIDIControllerGetControl( struct MIDIController * controller, MIDIControl co
   int result;
 
   if( size == sizeof(MIDIValue) ) {
-    *((MIDIValue*)value) = controller->controls[(int)control];
+    *((MIDIValue*)value) = controller->state->controls[(int)control];
   } else if( size == sizeof(MIDILongValue) ) {
     if( control >= MIDI_CONTROL_BANK_SELECT && control <= MIDI_CONTROL_UNDEFINED15 ) {
       result = MIDIControllerGetControl( controller, control,    sizeof(MIDIValue), &v1 )
@@ -439,8 +519,16 @@ int MIDIControllerSetNonRegisteredParameter( struct MIDIController * controller,
   MIDIPrecond( controller != NULL, EFAULT );
   MIDIPrecond( size > 0 && value != NULL, EINVAL );
 
+  MIDIPrecond( size == sizeof(MIDIValue) || size == sizeof(MIDILongValue), EINVAL );
+  MIDILongValue v = ( size == sizeof(MIDIValue) ) ? MIDI_LONG_VALUE( *((MIDIValue*)value), 0 ) : *((MIDILongValue*)value);
+
   MIDIControllerSetControl( controller, MIDI_CONTROL_NON_REGISTERED_PARAMETER_NUMBER, sizeof(MIDILongValue), &parameter );
-  /* set non-registered parameter */
+  if( _put_non_registered_parameter( controller, parameter, v ) ) return 1;
+  controller->state->current_parameter_registered = MIDI_OFF;
+  controller->state->current_parameter = parameter;
+  controller->state->controls[MIDI_CONTROL_DATA_ENTRY]    = MIDI_MSB( v );
+  controller->state->controls[MIDI_CONTROL_DATA_ENTRY+32] = MIDI_LSB( v );
+  /* send control change */
   return 0;
 }
 
@@ -457,35 +545,116 @@ int MIDIControllerSetNonRegisteredParameter( struct MIDIController * controller,
 int MIDIControllerGetNonRegisteredParameter( struct MIDIController * controller, MIDIControlParameter parameter, size_t size,  void * value ) {
   MIDIPrecond( controller != NULL, EFAULT );
   MIDIPrecond( size > 0 && value != NULL, EINVAL );
+  MIDIPrecond( size == sizeof(MIDIValue) || size == sizeof(MIDILongValue), EINVAL );
+  MIDILongValue v;
 
+  if( _find_non_registered_parameter( controller, parameter, &v ) ) return 1;
+  if( size == sizeof(MIDIValue) ) {
+    *((MIDIValue*)value) = MIDI_MSB( v );
+  } else {
+    *((MIDILongValue*)value) = v;
+  }
   return 0;
 }
 
 /**
  * @brief Store control values.
+ * Copy the current state block of the controller to the buffer.
  * @public @memberof MIDIController
  * @param controller The controller.
- * @param size       The size of the buffer pointed to by @c buffer.
+ * @param size       The size of the buffer pointed to by @c buffer. It must
+ *                   fit at least one struct MIDIControllerState.
  * @param buffer     The buffer to store the controller values in.
- * @param written    The number of bytes written to the buffer.
+ * @param written    The number of bytes written to the buffer. May be @c NULL.
+ * @retval 0 on success.
+ * @retval >0 if the values could not be stored.
  */
 int MIDIControllerStore( struct MIDIController * controller, size_t size, void * buffer, size_t * written ) {
   MIDIPrecond( controller != NULL, EFAULT );
-  MIDIPrecond( size > 0 && buffer != NULL, EINVAL );
+  MIDIPrecond( size >= sizeof( struct MIDIControllerState ) && buffer != NULL, EINVAL );
+  memcpy( buffer, controller->state, sizeof( struct MIDIControllerState ) );
+  if( written != NULL ) *written = sizeof( struct MIDIControllerState );
   return 0;
 }
 
 /**
  * @brief Recall the values of previously stored controls.
+ * Replace the current state block of the controller with a block
+ * that was written by MIDIControllerStore.
  * @public @memberof MIDIController
  * @param controller The controller.
  * @param size       The size of the buffer pointed to by @c buffer.
- * @param buffer     The buffer to store the controller values in.
- * @param read       The number of bytes read from the buffer.
+ * @param buffer     The buffer to read the controller values from.
+ * @param read       The number of bytes read from the buffer. May be @c NULL.
+ * @retval 0 on success.
+ * @retval >0 if the buffer does not contain a state block of this version.
  */
 int MIDIControllerRecall( struct MIDIController * controller, size_t size, void * buffer, size_t * read ) {
   MIDIPrecond( controller != NULL, EFAULT );
-  MIDIPrecond( size > 0 && buffer != NULL, EINVAL );
+  MIDIPrecond( buffer != NULL, EINVAL );
+  if( _check_state( size, buffer ) ) {
+    MIDIError( EINVAL, "Buffer does not hold a state block of this version." );
+    return EINVAL;
+  }
+  memcpy( controller->state, buffer, sizeof( struct MIDIControllerState ) );
+  if( read != NULL ) *read = sizeof( struct MIDIControllerState );
+  return 0;
+}
+
+/**
+ * @brief Prepare a state block to become current.
+ * Copy a block that was written by MIDIControllerStore to the spare
+ * state block of the controller. The copy may be made on any thread
+ * while the thread that passes messages to the controller keeps using
+ * the current block. Only one snapshot can be staged at a time.
+ * @see MIDIControllerCommit
+ * @public @memberof MIDIController
+ * @param controller The controller.
+ * @param size       The size of the buffer pointed to by @c buffer.
+ * @param buffer     The buffer to read the controller values from.
+ * @retval 0 on success.
+ * @retval >0 if the buffer does not contain a state block of this version
+ *            or the previously staged snapshot was not committed yet.
+ */
+int MIDIControllerStage( struct MIDIController * controller, size_t size, void * buffer ) {
+  struct MIDIControllerState * spare;
+  MIDIPrecond( controller != NULL, EFAULT );
+  MIDIPrecond( buffer != NULL, EINVAL );
+  if( _check_state( size, buffer ) ) {
+    MIDIError( EINVAL, "Buffer does not hold a state block of this version." );
+    return EINVAL;
+  }
+  __sync_synchronize();
+  if( controller->staged ) {
+    MIDIError( EBUSY, "Staged snapshot was not committed yet." );
+    return EBUSY;
+  }
+  spare = ( controller->state == &(controller->buffers[0]) ) ? &(controller->buffers[1]) : &(controller->buffers[0]);
+  memcpy( spare, buffer, sizeof( struct MIDIControllerState ) );
+  __sync_synchronize();
+  controller->staged = 1;
+  return 0;
+}
+
+/**
+ * @brief Make the staged state block current.
+ * Swap the current and the spare state block if a snapshot was staged.
+ * This only exchanges a pointer, so it can be called from the thread
+ * that passes messages to the controller, for example at the start of
+ * every audio buffer.
+ * @see MIDIControllerStage
+ * @public @memberof MIDIController
+ * @param controller The controller.
+ * @retval 0 if the staged snapshot became current.
+ * @retval 1 if no snapshot was staged.
+ */
+int MIDIControllerCommit( struct MIDIController * controller ) {
+  MIDIPrecond( controller != NULL, EFAULT );
+  if( controller->staged == 0 ) return 1;
+  __sync_synchronize();
+  controller->state = ( controller->state == &(controller->buffers[0]) ) ? &(controller->buffers[1]) : &(controller->buffers[0]);
+  __sync_synchronize();
+  controller->staged = 0;
   return 0;
 }
 
@@ -516,32 +685,37 @@ int MIDIControllerReceiveControlChange( struct MIDIController * controller, stru
   if( control < MIDI_CONTROL_ALL_SOUND_OFF ) {
     switch( control ) {
       case MIDI_CONTROL_DATA_INCREMENT:
-        controller->controls[MIDI_CONTROL_DATA_ENTRY+32]++;
-        if( controller->controls[MIDI_CONTROL_DATA_ENTRY+32] & 0x80 ) {
-          controller->controls[MIDI_CONTROL_DATA_ENTRY+32] &= 0x7f;
-          controller->controls[MIDI_CONTROL_DATA_ENTRY]++;
+        controller->state->controls[MIDI_CONTROL_DATA_ENTRY+32]++;
+        if( controller->state->controls[MIDI_CONTROL_DATA_ENTRY+32] & 0x80 ) {
+          controller->state->controls[MIDI_CONTROL_DATA_ENTRY+32] &= 0x7f;
+          controller->state->controls[MIDI_CONTROL_DATA_ENTRY]++;
         }
-        break;
+        controller->state->controls[(int)control] = value;
+        return _store_current_parameter( controller );
       case MIDI_CONTROL_DATA_DECREMENT:
-        controller->controls[MIDI_CONTROL_DATA_ENTRY+32]--;
-        if( controller->controls[MIDI_CONTROL_DATA_ENTRY+32] & 0x80 ) {
-          controller->controls[MIDI_CONTROL_DATA_ENTRY+32] &= 0x7f;
-          controller->controls[MIDI_CONTROL_DATA_ENTRY]--;
+        controller->state->controls[MIDI_CONTROL_DATA_ENTRY+32]--;
+        if( controller->state->controls[MIDI_CONTROL_DATA_ENTRY+32] & 0x80 ) {
+          controller->state->controls[MIDI_CONTROL_DATA_ENTRY+32] &= 0x7f;
+          controller->state->controls[MIDI_CONTROL_DATA_ENTRY]--;
         }
-        break;
+        controller->state->controls[(int)control] = value;
+        return _store_current_parameter( controller );
       case MIDI_CONTROL_DATA_ENTRY:
       case MIDI_CONTROL_DATA_ENTRY+32:
-        break;
+        controller->state->controls[(int)control] = value;
+        return _store_current_parameter( controller );
       case MIDI_CONTROL_NON_REGISTERED_PARAMETER_NUMBER_MSB:
       case MIDI_CONTROL_NON_REGISTERED_PARAMETER_NUMBER_LSB:
-        break;
+        controller->state->controls[(int)control] = value;
+        return _select_parameter( controller, MIDI_OFF );
       case MIDI_CONTROL_REGISTERED_PARAMETER_NUMBER_MSB:
       case MIDI_CONTROL_REGISTERED_PARAMETER_NUMBER_LSB:
-        break;
+        controller->state->controls[(int)control] = value;
+        return _select_parameter( controller, MIDI_ON );
       default:
         break;
     }
-    controller->controls[(int)control] = value;
+    controller->state->controls[(int)control] = value;
   } else {
     switch( control ) {
       case  MIDI_CONTROL_ALL_SOUND_OFF:
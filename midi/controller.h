@@ -125,8 +125,35 @@
 
 /** @} */
 
+/**
+ * @name Controller state
+ * @{
+ */
+
+#define MIDI_CONTROLLER_STATE_VERSION 1
+#define MIDI_CONTROLLER_NRP_PAGES     8
+
+/** @} */
+
 struct MIDIDevice;
 
+struct MIDINonRegisteredParameterPage {
+  unsigned char stored[16];
+  MIDILongValue values[128];
+};
+
+struct MIDIControllerState {
+  unsigned short version;
+  unsigned short size;
+  MIDILongValue  current_parameter;
+  MIDIBoolean    current_parameter_registered;
+  unsigned char  pages_length;
+  MIDIValue      controls[128];
+  MIDIValue      registered_parameters[6];
+  unsigned char  page_index[128];
+  struct MIDINonRegisteredParameterPage pages[MIDI_CONTROLLER_NRP_PAGES];
+};
+
 struct MIDIController;
 struct MIDIControllerDelegate {
   int (*recv_cc)( struct MIDIController * controller, struct MIDIDevice * device,
@@ -147,6 +174,8 @@ int MIDIControllerGetNonRegisteredParameter( struct MIDIController * controller,
 
 int MIDIControllerStore( struct MIDIController * controller, size_t size, void * buffer, size_t * written );
 int MIDIControllerRecall( struct MIDIController * controller, size_t size, void * buffer, size_t * read );
+int MIDIControllerStage( struct MIDIController * controller, size_t size, void * buffer );
+int MIDIControllerCommit( struct MIDIController * controller );
 
 int MIDIControllerReceiveControlChange( struct MIDIController * controller, struct MIDIDevice * device,
                                         MIDIChannel channel, MIDIControl control, MIDIValue value );
@@ -1,6 +1,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "device.h"
 
@@ -9,8 +10,10 @@
 #include "message.h"
 #include "controller.h"
 #include "timer.h"
+#include "state_tracker.h"
 
 #define N_CHANNEL 16
+#define MESSAGE_POOL_SIZE 32
 
 
 /**
@@ -92,6 +95,15 @@
  *        MIDI_STATUS_CONTINUE, MIDI_STATUS_STOP,
  *        MIDI_STATUS_ACTIVE_SENSING, MIDI_STATUS_RESET
  */
+/**
+ * @public @property MIDIDeviceDelegate::recv_batch
+ * @brief Batch callback.
+ * Receives runs of channel messages with the same status and channel
+ * from MIDIDeviceReceiveBatch instead of the per-message callbacks.
+ * The timestamps of the messages are offsets from the base time that was
+ * passed to MIDIDeviceReceiveBatch.
+ * @see   MIDIDeviceReceiveBatch
+ */
 
 /**
  * @ingroup MIDI
@@ -116,8 +128,13 @@ struct MIDIDevice {
   MIDIBoolean omni_mode;
   MIDIBoolean poly_mode;
   struct MIDITimer      * timer;
+  struct MIDIMessagePool * pool;
+  struct MIDIStateTracker * in_state;
+  struct MIDIStateTracker * out_state;
 /*struct MIDIInstrument * instrument[N_CHANNEL]; */
   struct MIDIController * controller[N_CHANNEL];
+  struct MIDIController * omni_controllers[N_CHANNEL];
+  size_t omni_controllers_length;
 /** @endcond */
 };
 
@@ -128,12 +145,51 @@ struct MIDIDevice {
  * @{
  */
  
+/**
+ * @brief Rebuild the set of distinct channel controllers.
+ * In Omni mode every controller receives each control change once, even
+ * if it is connected to multiple channels. The controllers are collected
+ * whenever a channel controller changes, so that receiving a control change
+ * does not have to find duplicates.
+ * @private @memberof MIDIDevice
+ * @param device The device.
+ */
+static void _update_omni_controllers( struct MIDIDevice * device ) {
+  struct MIDIController * ctl;
+  MIDIChannel c;
+  size_t i;
+  device->omni_controllers_length = 0;
+  for( c=MIDI_CHANNEL_1; c<=MIDI_CHANNEL_16; c++ ) {
+    ctl = device->controller[(int)c];
+    if( ctl == NULL ) continue;
+    for( i=0; i<device->omni_controllers_length && device->omni_controllers[i] != ctl; i++ );
+    if( i == device->omni_controllers_length ) {
+      device->omni_controllers[device->omni_controllers_length++] = ctl;
+    }
+  }
+}
+
+/**
+ * @brief Check whether a channel shares its controller with a lower channel.
+ * @private @memberof MIDIDevice
+ * @param device  The device.
+ * @param channel The channel.
+ * @retval 1 if the controller was seen on a lower channel.
+ * @retval 0 otherwise.
+ */
+static int _shared_controller( struct MIDIDevice * device, MIDIChannel channel ) {
+  MIDIChannel c;
+  for( c=MIDI_CHANNEL_1; c<channel; c++ ) {
+    if( device->controller[(int)c] == device->controller[(int)channel] ) return 1;
+  }
+  return 0;
+}
+
 /**
  * @brief Receive a control change in Omni mode.
  * Receive a control change and pass it to all connected controllers.
  * We ensure that even if one controller is connected to multiple
- * channels, it will receive the control change only once, by keeping
- * a list of controllers that received the given message.
+ * channels, it will receive the control change only once.
  * @private @memberof MIDIDevice
  * @param device  The device.
  * @param channel The channel.
@@ -143,30 +199,13 @@ struct MIDIDevice {
  */
 static int _recv_cc_omni( struct MIDIDevice * device, MIDIChannel channel,
                           MIDIControl control, MIDIValue value ) {
-  int result = 0, i;
-  struct MIDIController * ctl;
-  struct MIDIController * recv[N_CHANNEL] = { NULL };
-  MIDIChannel c;
+  int result = 0;
+  size_t i;
   MIDIPrecond( device != NULL, EFAULT );
-  
-  for( c=MIDI_CHANNEL_1; c<=MIDI_CHANNEL_16; c++ ) {
-    if( device->controller[(int)c] != NULL ) {
-      i   = 0;
-      ctl = device->controller[(int)c];
-      /* if we have already sent the CC to the controller,
-       * it will be contained in the recv list. */
-      while( i<N_CHANNEL
-          && recv[i]!=NULL
-          && recv[i]!=ctl ) i++;
-      if( recv[i] != ctl ) {
-        /* we reached the end of (the filled part of) the list
-         * without finding the controller. */
-        recv[i]   = ctl;
-        recv[i+1] = NULL;
-        result   += MIDIControllerReceiveControlChange( ctl, device, channel,
-                                                        control, value );
-      }
-    }
+
+  for( i=0; i<device->omni_controllers_length; i++ ) {
+    result += MIDIControllerReceiveControlChange( device->omni_controllers[i], device, channel,
+                                                  control, value );
   }
   return result;
 }
@@ -368,10 +407,14 @@ struct MIDIDevice * MIDIDeviceCreate( struct MIDIDeviceDelegate * delegate ) {
   device->omni_mode    = MIDI_OFF;
   device->poly_mode    = MIDI_ON;
   device->timer        = NULL;
+  device->pool         = MIDIMessagePoolCreate( MESSAGE_POOL_SIZE );
+  device->in_state     = NULL;
+  device->out_state    = NULL;
   for( channel=MIDI_CHANNEL_1; channel<=MIDI_CHANNEL_16; channel++ ) {
   /*device->instrument[(int)channel] = NULL;*/
     device->controller[(int)channel] = NULL;
   }
+  device->omni_controllers_length = 0;
   return device;
 }
 
@@ -394,6 +437,9 @@ void MIDIDeviceDestroy( struct MIDIDevice * device ) {
   MIDIPortRelease( device->out );
 
   if( device->timer != NULL ) MIDITimerRelease( device->timer );
+  if( device->pool != NULL ) MIDIMessagePoolRelease( device->pool );
+  if( device->in_state != NULL ) MIDIStateTrackerRelease( device->in_state );
+  if( device->out_state != NULL ) MIDIStateTrackerRelease( device->out_state );
   for( channel=MIDI_CHANNEL_1; channel<=MIDI_CHANNEL_16; channel++ ) {
   /*if( device->instrument[(int)channel] != NULL ) MIDIInstrumentRelease( device->instrument[(int)channel] );;*/
     if( device->controller[(int)channel] != NULL ) MIDIControllerRelease( device->controller[(int)channel] );;
@@ -408,7 +454,7 @@ void MIDIDeviceDestroy( struct MIDIDevice * device ) {
  * @param device The device.
  */
 void MIDIDeviceRetain( struct MIDIDevice * device ) {
-  device->refs++;
+  MIDIRefRetain( device->refs );
 }
 
 /**
@@ -419,7 +465,7 @@ void MIDIDeviceRetain( struct MIDIDevice * device ) {
  * @param device The device.
  */
 void MIDIDeviceRelease( struct MIDIDevice * device ) {
-  if( ! --device->refs ) {
+  if( ! MIDIRefRelease( device->refs ) ) {
     MIDIDeviceDestroy( device );
   }
 }
@@ -706,6 +752,7 @@ int MIDIDeviceSetChannelController( struct MIDIDevice * device, MIDIChannel chan
   if( device->controller[(int)channel] != NULL ) MIDIControllerRelease( device->controller[(int)channel] );
   device->controller[(int)channel] = controller;
   MIDIControllerRetain( controller );
+  _update_omni_controllers( device );
   return 0;
 }
 
@@ -730,6 +777,153 @@ int MIDIDeviceGetChannelController( struct MIDIDevice * device, MIDIChannel chan
   return 0;
 }
 
+/**
+ * @brief Store the state of all channel controllers.
+ * Copy the state block of the controller of every channel to the
+ * corresponding entry of @c states. The entries of channels without
+ * a controller are cleared.
+ * @public @memberof MIDIDevice
+ * @param device The midi device.
+ * @param states An array of 16 state blocks, one for each channel.
+ * @retval 0  on success.
+ * @retval >0 if the states could not be stored.
+ */
+int MIDIDeviceStoreAll( struct MIDIDevice * device, struct MIDIControllerState * states ) {
+  MIDIChannel c;
+  int result = 0;
+  MIDIPrecond( device != NULL, EFAULT );
+  MIDIPrecond( states != NULL, EINVAL );
+  for( c=MIDI_CHANNEL_1; c<=MIDI_CHANNEL_16; c++ ) {
+    if( device->controller[(int)c] == NULL ) {
+      memset( &(states[(int)c]), 0, sizeof( struct MIDIControllerState ) );
+    } else {
+      result += MIDIControllerStore( device->controller[(int)c], sizeof( struct MIDIControllerState ),
+                                     &(states[(int)c]), NULL );
+    }
+  }
+  return result;
+}
+
+/**
+ * @brief Recall the state of all channel controllers.
+ * Replace the state of the controller of every channel with the
+ * corresponding entry of @c states. A controller that is attached to
+ * multiple channels recalls the entry of the lowest channel. Cleared
+ * entries are skipped.
+ * @see MIDIDeviceStoreAll
+ * @public @memberof MIDIDevice
+ * @param device The midi device.
+ * @param states An array of 16 state blocks, one for each channel.
+ * @retval 0  on success.
+ * @retval >0 if the states could not be recalled.
+ */
+int MIDIDeviceRecallAll( struct MIDIDevice * device, struct MIDIControllerState * states ) {
+  MIDIChannel c;
+  int result = 0;
+  MIDIPrecond( device != NULL, EFAULT );
+  MIDIPrecond( states != NULL, EINVAL );
+  for( c=MIDI_CHANNEL_1; c<=MIDI_CHANNEL_16; c++ ) {
+    if( device->controller[(int)c] == NULL || states[(int)c].version == 0 ) continue;
+    if( _shared_controller( device, c ) ) continue;
+    result += MIDIControllerRecall( device->controller[(int)c], sizeof( struct MIDIControllerState ),
+                                    &(states[(int)c]), NULL );
+  }
+  return result;
+}
+
+/**
+ * @brief Stage the state of all channel controllers.
+ * Like MIDIDeviceRecallAll, but the states are copied to the spare
+ * state blocks of the controllers and become current with
+ * MIDIDeviceCommitAll.
+ * @see MIDIControllerStage
+ * @public @memberof MIDIDevice
+ * @param device The midi device.
+ * @param states An array of 16 state blocks, one for each channel.
+ * @retval 0  on success.
+ * @retval >0 if the states could not be staged.
+ */
+int MIDIDeviceStageAll( struct MIDIDevice * device, struct MIDIControllerState * states ) {
+  MIDIChannel c;
+  int result = 0;
+  MIDIPrecond( device != NULL, EFAULT );
+  MIDIPrecond( states != NULL, EINVAL );
+  for( c=MIDI_CHANNEL_1; c<=MIDI_CHANNEL_16; c++ ) {
+    if( device->controller[(int)c] == NULL || states[(int)c].version == 0 ) continue;
+    if( _shared_controller( device, c ) ) continue;
+    result += MIDIControllerStage( device->controller[(int)c], sizeof( struct MIDIControllerState ),
+                                   &(states[(int)c]) );
+  }
+  return result;
+}
+
+/**
+ * @brief Make the staged states of all channel controllers current.
+ * This swaps one pointer per controller and can be called from the
+ * thread that passes messages to the device.
+ * @see MIDIControllerCommit
+ * @public @memberof MIDIDevice
+ * @param device The midi device.
+ * @retval 0 on success.
+ */
+int MIDIDeviceCommitAll( struct MIDIDevice * device ) {
+  size_t i;
+  MIDIPrecond( device != NULL, EFAULT );
+  for( i=0; i<device->omni_controllers_length; i++ ) {
+    MIDIControllerCommit( device->omni_controllers[i] );
+  }
+  return 0;
+}
+
+/**
+ * @brief Set the state tracker for received or sent messages.
+ * The input state tracker records the channel messages the device
+ * receives, the output state tracker records the messages the device
+ * sends. The same tracker may be used for both directions.
+ * The tracker is retained by the device.
+ * @public @memberof MIDIDevice
+ * @param device    The midi device.
+ * @param direction @c MIDI_PORT_IN, @c MIDI_PORT_OUT or both.
+ * @param tracker   The state tracker or @c NULL to stop tracking.
+ * @retval 0  on success.
+ * @retval >0 if the state tracker could not be set.
+ */
+int MIDIDeviceSetStateTracker( struct MIDIDevice * device, int direction, struct MIDIStateTracker * tracker ) {
+  MIDIPrecond( device != NULL, EFAULT );
+  MIDIPrecond( direction != 0 && ( direction & ~( MIDI_PORT_IN | MIDI_PORT_OUT ) ) == 0, EINVAL );
+  if( tracker != NULL ) {
+    if( direction & MIDI_PORT_IN ) MIDIStateTrackerRetain( tracker );
+    if( direction & MIDI_PORT_OUT ) MIDIStateTrackerRetain( tracker );
+  }
+  if( direction & MIDI_PORT_IN ) {
+    if( device->in_state != NULL ) MIDIStateTrackerRelease( device->in_state );
+    device->in_state = tracker;
+  }
+  if( direction & MIDI_PORT_OUT ) {
+    if( device->out_state != NULL ) MIDIStateTrackerRelease( device->out_state );
+    device->out_state = tracker;
+  }
+  return 0;
+}
+
+/**
+ * @brief Get the state tracker for received or sent messages.
+ * @see MIDIDeviceSetStateTracker
+ * @public @memberof MIDIDevice
+ * @param device    The midi device.
+ * @param direction @c MIDI_PORT_IN or @c MIDI_PORT_OUT.
+ * @param tracker   The state tracker, @c NULL if there is none.
+ * @retval 0  on success.
+ * @retval >0 if the state tracker was not stored.
+ */
+int MIDIDeviceGetStateTracker( struct MIDIDevice * device, int direction, struct MIDIStateTracker ** tracker ) {
+  MIDIPrecond( device != NULL, EFAULT );
+  MIDIPrecond( direction == MIDI_PORT_IN || direction == MIDI_PORT_OUT, EINVAL );
+  MIDIPrecond( tracker != NULL, EINVAL );
+  *tracker = ( direction == MIDI_PORT_IN ) ? device->in_state : device->out_state;
+  return 0;
+}
+
 /** @} */
 
 /* MARK: Message passing *//**
@@ -757,6 +951,7 @@ int MIDIDeviceReceive( struct MIDIDevice * device, struct MIDIMessage * message
 /**
  * @brief Send a generic MIDI message.
  * This calls the the relay method of the @c OUT connector.
+ * Channel messages are recorded by the output state tracker, if any.
  * @public @memberof MIDIDevice
  * @param device  The device.
  * @param message The message.
@@ -764,11 +959,167 @@ int MIDIDeviceReceive( struct MIDIDevice * device, struct MIDIMessage * message
  * @retval 1 if the message could not be sent.
  */
 int MIDIDeviceSend( struct MIDIDevice * device, struct MIDIMessage * message ) {
+  struct MIDICompactMessage compact;
   MIDIPrecond( device != NULL, EFAULT );
   MIDIPrecond( message != NULL, EINVAL );
+  if( device->out_state != NULL && MIDIMessageGetCompact( message, &compact ) == 0 ) {
+    MIDIStateTrackerUpdate( device->out_state, 1, &compact );
+  }
   return MIDIPortSend( device->out, MIDIMessageType, message );
 }
 
+/**
+ * @brief Receive a compact MIDI message.
+ * Call the appropiate member function for the message without creating
+ * a MIDIMessage. Only system exclusive messages are converted, their
+ * payload is read from the buffer the compact message was decoded from.
+ * The port connections of the device are not involved. Real time
+ * messages are stamped with @c timestamp plus the offset of the message.
+ * @public @memberof MIDIDevice
+ * @param device    The device.
+ * @param timestamp The base time of the compact message.
+ * @param compact   The message.
+ * @param buffer    The buffer the compact message was decoded from or @c NULL.
+ * @retval 0 on success.
+ * @retval 1 if the message could not be processed.
+ */
+int MIDIDeviceReceiveCompact( struct MIDIDevice * device, MIDITimestamp timestamp, struct MIDICompactMessage * compact,
+                              unsigned char * buffer ) {
+  struct MIDIMessage * message;
+  unsigned char * m;
+  MIDIChannel channel;
+  int result;
+  MIDIPrecond( device != NULL, EFAULT );
+  MIDIPrecond( compact != NULL, EINVAL );
+
+  m = &(compact->bytes[0]);
+  channel = MIDI_LOW_NIBBLE(m[0]);
+  switch( MIDI_HIGH_NIBBLE(m[0]) ) {
+    case MIDI_STATUS_NOTE_OFF:
+      return MIDIDeviceReceiveNoteOff( device, channel, m[1], m[2] );
+    case MIDI_STATUS_NOTE_ON:
+      return MIDIDeviceReceiveNoteOn( device, channel, m[1], m[2] );
+    case MIDI_STATUS_POLYPHONIC_KEY_PRESSURE:
+      return MIDIDeviceReceivePolyphonicKeyPressure( device, channel, m[1], m[2] );
+    case MIDI_STATUS_CONTROL_CHANGE:
+      return MIDIDeviceReceiveControlChange( device, channel, m[1], m[2] );
+    case MIDI_STATUS_PROGRAM_CHANGE:
+      return MIDIDeviceReceiveProgramChange( device, channel, m[1] );
+    case MIDI_STATUS_CHANNEL_PRESSURE:
+      return MIDIDeviceReceiveChannelPressure( device, channel, m[1] );
+    case MIDI_STATUS_PITCH_WHEEL_CHANGE:
+      return MIDIDeviceReceivePitchWheelChange( device, channel, MIDI_LONG_VALUE( m[2], m[1] ) );
+    default:
+      break;
+  }
+  switch( m[0] ) {
+    case MIDI_STATUS_SYSTEM_EXCLUSIVE:
+      message = MIDIMessageCreateFromPool( device->pool, 0 );
+      if( message == NULL ) return 1;
+      result = MIDIMessageSetCompact( message, compact, buffer );
+      if( result == 0 ) result = _recv_msg( device, message );
+      MIDIMessageRelease( message );
+      return result;
+    case MIDI_STATUS_TIME_CODE_QUARTER_FRAME:
+      return MIDIDeviceReceiveTimeCodeQuarterFrame( device, MIDI_HIGH_NIBBLE(m[1]), MIDI_LOW_NIBBLE(m[1]) );
+    case MIDI_STATUS_SONG_POSITION_POINTER:
+      return MIDIDeviceReceiveSongPositionPointer( device, MIDI_LONG_VALUE( m[2], m[1] ) );
+    case MIDI_STATUS_SONG_SELECT:
+      return MIDIDeviceReceiveSongSelect( device, m[1] );
+    case MIDI_STATUS_TUNE_REQUEST:
+      return MIDIDeviceReceiveTuneRequest( device );
+    case MIDI_STATUS_END_OF_EXCLUSIVE:
+      return MIDIDeviceReceiveEndOfExclusive( device );
+    case MIDI_STATUS_TIMING_CLOCK:
+    case MIDI_STATUS_START:
+    case MIDI_STATUS_CONTINUE:
+    case MIDI_STATUS_STOP:
+    case MIDI_STATUS_ACTIVE_SENSING:
+    case MIDI_STATUS_RESET:
+      return MIDIDeviceReceiveRealTime( device, m[0], timestamp + compact->timestamp );
+    default:
+      break;
+  }
+  return 0;
+}
+
+/**
+ * @brief Receive a block of compact MIDI messages.
+ * Dispatch all messages of a block, for example the events of one audio
+ * buffer, in the order they were received. Consecutive channel messages
+ * with the same status and channel form a run. If the delegate implements
+ * @c recv_batch, it is called once per run instead of calling the per-message
+ * callbacks. Control changes are passed to the channel controllers one by
+ * one before the run is handed to the delegate. All other messages are
+ * dispatched like MIDIDeviceReceiveCompact does.
+ * @public @memberof MIDIDevice
+ * @param device    The device.
+ * @param timestamp The base time of the compact messages.
+ * @param count     The number of messages.
+ * @param messages  The messages.
+ * @param buffer    The buffer the compact messages were decoded from or @c NULL.
+ * @retval 0 on success.
+ * @retval >0 if messages could not be processed.
+ */
+int MIDIDeviceReceiveBatch( struct MIDIDevice * device, MIDITimestamp timestamp, size_t count,
+                            struct MIDICompactMessage * messages, unsigned char * buffer ) {
+  struct MIDIDeviceDelegate * delegate;
+  struct MIDIController ** ctls;
+  size_t i, j, k, n, length;
+  unsigned char s, * m;
+  MIDIChannel channel;
+  MIDIStatus status;
+  int result = 0;
+  MIDIPrecond( device != NULL, EFAULT );
+  MIDIPrecond( count == 0 || messages != NULL, EINVAL );
+
+  delegate = device->delegate;
+  for( i=0; i<count; i=j ) {
+    s = messages[i].bytes[0];
+    if( s >= 0xf0 ) {
+      result += MIDIDeviceReceiveCompact( device, timestamp, &(messages[i]), buffer );
+      j = i + 1;
+      continue;
+    }
+    for( j=i+1; j<count && messages[j].bytes[0] == s; j++ );
+    status  = MIDI_HIGH_NIBBLE(s);
+    channel = MIDI_LOW_NIBBLE(s);
+    if( status == MIDI_STATUS_CONTROL_CHANGE ) {
+      if( device->omni_mode == MIDI_OFF ) {
+        ctls   = &(device->controller[(int)channel]);
+        length = ( channel == device->base_channel && *ctls != NULL ) ? 1 : 0;
+      } else {
+        ctls   = &(device->omni_controllers[0]);
+        length = device->omni_controllers_length;
+      }
+      for( n=0; n<length; n++ ) {
+        for( k=i; k<j; k++ ) {
+          m = &(messages[k].bytes[0]);
+          result += MIDIControllerReceiveControlChange( ctls[n], device, channel, m[1], m[2] );
+        }
+      }
+    }
+    if( device->in_state != NULL && ( status == MIDI_STATUS_CONTROL_CHANGE ||
+                                      ( delegate != NULL && delegate->recv_batch != NULL ) ) ) {
+      MIDIStateTrackerUpdate( device->in_state, j - i, &(messages[i]) );
+    }
+    if( delegate != NULL && delegate->recv_batch != NULL ) {
+      result += (*delegate->recv_batch)( device, status, channel, j - i, &(messages[i]) );
+    } else if( status == MIDI_STATUS_CONTROL_CHANGE ) {
+      if( delegate == NULL || delegate->recv_cc == NULL ) continue;
+      for( k=i; k<j; k++ ) {
+        m = &(messages[k].bytes[0]);
+        result += (*delegate->recv_cc)( device, channel, m[1], m[2] );
+      }
+    } else {
+      for( k=i; k<j; k++ ) {
+        result += MIDIDeviceReceiveCompact( device, timestamp, &(messages[k]), buffer );
+      }
+    }
+  }
+  return result;
+}
+
 /**
  * @brief Receive a "Note Off" message.
  * This is called whenever the device receives a "Note Off" message.
@@ -783,6 +1134,7 @@ int MIDIDeviceSend( struct MIDIDevice * device, struct MIDIMessage * message ) {
  */
 int MIDIDeviceReceiveNoteOff( struct MIDIDevice * device, MIDIChannel channel, MIDIKey key, MIDIVelocity velocity ) {
   MIDIPrecond( device != NULL, EFAULT );
+  if( device->in_state != NULL ) MIDIStateTrackerNoteOff( device->in_state, channel, key );
   if( device->delegate == NULL || device->delegate->recv_nof == NULL ) {
     return 0;
   }
@@ -805,7 +1157,7 @@ int MIDIDeviceSendNoteOff( struct MIDIDevice * device, MIDIChannel channel, MIDI
   struct MIDIMessage * message;
   int result;
   MIDIPrecond( device != NULL, EFAULT );
-  message = MIDIMessageCreate( MIDI_STATUS_NOTE_OFF );
+  message = MIDIMessageCreateFromPool( device->pool, MIDI_STATUS_NOTE_OFF );
   result  = MIDIMessageSet( message, MIDI_CHANNEL,  sizeof(MIDIChannel),  &channel );
   result += MIDIMessageSet( message, MIDI_KEY,      sizeof(MIDIKey),      &key );
   result += MIDIMessageSet( message, MIDI_VELOCITY, sizeof(MIDIVelocity), &velocity );
@@ -829,6 +1181,7 @@ int MIDIDeviceSendNoteOff( struct MIDIDevice * device, MIDIChannel channel, MIDI
  */
 int MIDIDeviceReceiveNoteOn( struct MIDIDevice * device, MIDIChannel channel, MIDIKey key, MIDIVelocity velocity ) {
   MIDIPrecond( device != NULL, EFAULT );
+  if( device->in_state != NULL ) MIDIStateTrackerNoteOn( device->in_state, channel, key, velocity );
   if( device->delegate == NULL || device->delegate->recv_non == NULL ) {
     return 0;
   }
@@ -851,7 +1204,7 @@ int MIDIDeviceSendNoteOn( struct MIDIDevice * device, MIDIChannel channel, MIDIK
   struct MIDIMessage * message;
   int result;
   MIDIPrecond( device != NULL, EFAULT );
-  message = MIDIMessageCreate( MIDI_STATUS_NOTE_ON );
+  message = MIDIMessageCreateFromPool( device->pool, MIDI_STATUS_NOTE_ON );
   result  = MIDIMessageSet( message, MIDI_CHANNEL,  sizeof(MIDIChannel),  &channel );
   result += MIDIMessageSet( message, MIDI_KEY,      sizeof(MIDIKey),      &key );
   result += MIDIMessageSet( message, MIDI_VELOCITY, sizeof(MIDIVelocity), &velocity );
@@ -897,7 +1250,7 @@ int MIDIDeviceSendPolyphonicKeyPressure( struct MIDIDevice * device, MIDIChannel
   struct MIDIMessage * message;
   int result;
   MIDIPrecond( device != NULL, EFAULT );
-  message = MIDIMessageCreate( MIDI_STATUS_POLYPHONIC_KEY_PRESSURE );
+  message = MIDIMessageCreateFromPool( device->pool, MIDI_STATUS_POLYPHONIC_KEY_PRESSURE );
   result  = MIDIMessageSet( message, MIDI_CHANNEL,  sizeof(MIDIChannel),  &channel );
   result += MIDIMessageSet( message, MIDI_KEY,      sizeof(MIDIKey),      &key );
   result += MIDIMessageSet( message, MIDI_PRESSURE, sizeof(MIDIPressure), &pressure );
@@ -921,6 +1274,7 @@ int MIDIDeviceSendPolyphonicKeyPressure( struct MIDIDevice * device, MIDIChannel
  */
 int MIDIDeviceReceiveControlChange( struct MIDIDevice * device, MIDIChannel channel, MIDIControl control, MIDIValue value ) {
   MIDIPrecond( device != NULL, EFAULT );
+  if( device->in_state != NULL ) MIDIStateTrackerControlChange( device->in_state, channel, control, value );
   int result = _recv_cc( device, channel, control, value );
   if( device->delegate == NULL || device->delegate->recv_cc == NULL ) {
     return result;
@@ -944,7 +1298,7 @@ int MIDIDeviceSendControlChange( struct MIDIDevice * device, MIDIChannel channel
   struct MIDIMessage * message;
   int result;
   MIDIPrecond( device != NULL, EFAULT );
-  message = MIDIMessageCreate( MIDI_STATUS_CONTROL_CHANGE );
+  message = MIDIMessageCreateFromPool( device->pool, MIDI_STATUS_CONTROL_CHANGE );
   result  = MIDIMessageSet( message, MIDI_CHANNEL, sizeof(MIDIChannel), &channel );
   result += MIDIMessageSet( message, MIDI_CONTROL, sizeof(MIDIControl), &control );
   result += MIDIMessageSet( message, MIDI_VALUE,   sizeof(MIDIValue),   &value );
@@ -967,6 +1321,7 @@ int MIDIDeviceSendControlChange( struct MIDIDevice * device, MIDIChannel channel
  */
 int MIDIDeviceReceiveProgramChange( struct MIDIDevice * device, MIDIChannel channel, MIDIProgram program ) {
   MIDIPrecond( device != NULL, EFAULT );
+  if( device->in_state != NULL ) MIDIStateTrackerProgramChange( device->in_state, channel, program );
   if( device->delegate == NULL || device->delegate->recv_pc == NULL ) {
     return 0;
   }
@@ -988,7 +1343,7 @@ int MIDIDeviceSendProgramChange( struct MIDIDevice * device, MIDIChannel channel
   struct MIDIMessage * message;
   int result;
   MIDIPrecond( device != NULL, EFAULT );
-  message = MIDIMessageCreate( MIDI_STATUS_PROGRAM_CHANGE );
+  message = MIDIMessageCreateFromPool( device->pool, MIDI_STATUS_PROGRAM_CHANGE );
   result  = MIDIMessageSet( message, MIDI_CHANNEL, sizeof(MIDIChannel), &channel );
   result += MIDIMessageSet( message, MIDI_PROGRAM, sizeof(MIDIProgram), &program );
   if( result != 0 ) return result;
@@ -1031,7 +1386,7 @@ int MIDIDeviceSendChannelPressure( struct MIDIDevice * device, MIDIChannel chann
   struct MIDIMessage * message;
   int result;
   MIDIPrecond( device != NULL, EFAULT );
-  message = MIDIMessageCreate( MIDI_STATUS_CHANNEL_PRESSURE );
+  message = MIDIMessageCreateFromPool( device->pool, MIDI_STATUS_CHANNEL_PRESSURE );
   result  = MIDIMessageSet( message, MIDI_CHANNEL,  sizeof(MIDIChannel),  &channel );
   result += MIDIMessageSet( message, MIDI_PRESSURE, sizeof(MIDIPressure), &pressure );
   if( result != 0 ) return result;
@@ -1054,6 +1409,7 @@ int MIDIDeviceSendChannelPressure( struct MIDIDevice * device, MIDIChannel chann
  */
 int MIDIDeviceReceivePitchWheelChange( struct MIDIDevice * device, MIDIChannel channel, MIDILongValue value ) {
   MIDIPrecond( device != NULL, EFAULT );
+  if( device->in_state != NULL ) MIDIStateTrackerPitchWheelChange( device->in_state, channel, value );
   if( device->delegate == NULL || device->delegate->recv_pwc == NULL ) {
     return 0;
   }
@@ -1076,7 +1432,7 @@ int MIDIDeviceSendPitchWheelChange( struct MIDIDevice * device, MIDIChannel chan
   struct MIDIMessage * message;
   int result;
   MIDIPrecond( device != NULL, EFAULT );
-  message = MIDIMessageCreate( MIDI_STATUS_PITCH_WHEEL_CHANGE );
+  message = MIDIMessageCreateFromPool( device->pool, MIDI_STATUS_PITCH_WHEEL_CHANGE );
   result  = MIDIMessageSet( message, MIDI_CHANNEL, sizeof(MIDIChannel),   &channel );
   result += MIDIMessageSet( message, MIDI_VALUE,   sizeof(MIDILongValue), &value );
   if( result != 0 ) return result;
@@ -1135,7 +1491,7 @@ int MIDIDeviceSendSystemExclusive( struct MIDIDevice * device, MIDIManufacturerI
   struct MIDIMessage * message;
   int result;
   MIDIPrecond( device != NULL, EFAULT );
-  message = MIDIMessageCreate( MIDI_STATUS_SYSTEM_EXCLUSIVE );
+  message = MIDIMessageCreateFromPool( device->pool, MIDI_STATUS_SYSTEM_EXCLUSIVE );
   result  = MIDIMessageSet( message, MIDI_MANUFACTURER_ID, sizeof(MIDIManufacturerId), &manufacturer_id );
   result += MIDIMessageSet( message, MIDI_SYSEX_SIZE,      sizeof(size_t), &size );
   result += MIDIMessageSet( message, MIDI_SYSEX_DATA,      sizeof(void *), &data );
@@ -1180,7 +1536,7 @@ int MIDIDeviceSendTimeCodeQuarterFrame( struct MIDIDevice * device, MIDIValue ti
   struct MIDIMessage * message;
   int result;
   MIDIPrecond( device != NULL, EFAULT );
-  message = MIDIMessageCreate( MIDI_STATUS_TIME_CODE_QUARTER_FRAME );
+  message = MIDIMessageCreateFromPool( device->pool, MIDI_STATUS_TIME_CODE_QUARTER_FRAME );
   result  = MIDIMessageSet( message, MIDI_TIME_CODE_TYPE, sizeof(MIDIValue), &time_code_type );
   result += MIDIMessageSet( message, MIDI_VALUE,          sizeof(MIDIValue), &value );
   if( result != 0 ) return result;
@@ -1223,7 +1579,7 @@ int MIDIDeviceSendSongPositionPointer( struct MIDIDevice * device, MIDILongValue
   struct MIDIMessage * message;
   int result;
   MIDIPrecond( device != NULL, EFAULT );
-  message = MIDIMessageCreate( MIDI_STATUS_SONG_POSITION_POINTER );
+  message = MIDIMessageCreateFromPool( device->pool, MIDI_STATUS_SONG_POSITION_POINTER );
   result  = MIDIMessageSet( message, MIDI_VALUE, sizeof(MIDILongValue), &value );
   if( result != 0 ) return result;
   result  = MIDIDeviceSend( device, message );
@@ -1263,7 +1619,7 @@ int MIDIDeviceSendSongSelect( struct MIDIDevice * device, MIDIValue value ) {
   struct MIDIMessage * message;
   int result;
   MIDIPrecond( device != NULL, EFAULT );
-  message = MIDIMessageCreate( MIDI_STATUS_SONG_SELECT );
+  message = MIDIMessageCreateFromPool( device->pool, MIDI_STATUS_SONG_SELECT );
   result  = MIDIMessageSet( message, MIDI_VALUE, sizeof(MIDIValue), &value );
   if( result != 0 ) return result;
   result  = MIDIDeviceSend( device, message );
@@ -1301,7 +1657,7 @@ int MIDIDeviceSendTuneRequest( struct MIDIDevice * device ) {
   struct MIDIMessage * message;
   int result;
   MIDIPrecond( device != NULL, EFAULT );
-  message = MIDIMessageCreate( MIDI_STATUS_TUNE_REQUEST );
+  message = MIDIMessageCreateFromPool( device->pool, MIDI_STATUS_TUNE_REQUEST );
   result  = MIDIDeviceSend( device, message );
   MIDIMessageRelease( message );
   return result;
@@ -1339,7 +1695,7 @@ int MIDIDeviceSendEndOfExclusive( struct MIDIDevice * device ) {
   struct MIDIMessage * message;
   int result;
   MIDIPrecond( device != NULL, EFAULT );
-  message = MIDIMessageCreate( MIDI_STATUS_END_OF_EXCLUSIVE );
+  message = MIDIMessageCreateFromPool( device->pool, MIDI_STATUS_END_OF_EXCLUSIVE );
   result  = MIDIDeviceSend( device, message );
   MIDIMessageRelease( message );
   return result;
@@ -1387,7 +1743,7 @@ int MIDIDeviceSendRealTime( struct MIDIDevice * device, MIDIStatus status, MIDIT
   MIDIPrecond( status >= MIDI_STATUS_TIMING_CLOCK, EINVAL );
   MIDIPrecond( status <= MIDI_STATUS_RESET, EINVAL );
   
-  message = MIDIMessageCreate( status );
+  message = MIDIMessageCreateFromPool( device->pool, status );
   result  = MIDIMessageSetTimestamp( message, timestamp );
   result += MIDIDeviceSend( device, message );
   MIDIMessageRelease( message );
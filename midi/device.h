@@ -4,9 +4,12 @@
 #include "midi.h"
 
 struct MIDIMessage;
+struct MIDICompactMessage;
 struct MIDIPort;
 struct MIDIController;
+struct MIDIControllerState;
 struct MIDITimer;
+struct MIDIStateTracker;
 
 struct MIDIDevice;
 
@@ -26,6 +29,8 @@ struct MIDIDeviceDelegate {
   int (*recv_tr)( struct MIDIDevice * device );
   int (*recv_eox)( struct MIDIDevice * device );
   int (*recv_rt)( struct MIDIDevice * device, MIDIStatus status, MIDITimestamp );
+  int (*recv_batch)( struct MIDIDevice * device, MIDIStatus status, MIDIChannel channel,
+                     size_t count, struct MIDICompactMessage * messages );
 };
 
 struct MIDIDevice * MIDIDeviceCreate( struct MIDIDeviceDelegate * delegate );
@@ -57,8 +62,20 @@ int MIDIDeviceGetTimer( struct MIDIDevice * device, struct MIDITimer ** timer );
 int MIDIDeviceSetChannelController( struct MIDIDevice * device, MIDIChannel channel, struct MIDIController * controller );
 int MIDIDeviceGetChannelController( struct MIDIDevice * device, MIDIChannel channel, struct MIDIController ** controller );
 
+int MIDIDeviceStoreAll( struct MIDIDevice * device, struct MIDIControllerState * states );
+int MIDIDeviceRecallAll( struct MIDIDevice * device, struct MIDIControllerState * states );
+int MIDIDeviceStageAll( struct MIDIDevice * device, struct MIDIControllerState * states );
+int MIDIDeviceCommitAll( struct MIDIDevice * device );
+
+int MIDIDeviceSetStateTracker( struct MIDIDevice * device, int direction, struct MIDIStateTracker * tracker );
+int MIDIDeviceGetStateTracker( struct MIDIDevice * device, int direction, struct MIDIStateTracker ** tracker );
+
 int MIDIDeviceReceive( struct MIDIDevice * device, struct MIDIMessage * message );
 int MIDIDeviceSend( struct MIDIDevice * device, struct MIDIMessage * message );
+int MIDIDeviceReceiveCompact( struct MIDIDevice * device, MIDITimestamp timestamp, struct MIDICompactMessage * compact,
+                              unsigned char * buffer );
+int MIDIDeviceReceiveBatch( struct MIDIDevice * device, MIDITimestamp timestamp, size_t count,
+                            struct MIDICompactMessage * messages, unsigned char * buffer );
 
 int MIDIDeviceReceiveNoteOff( struct MIDIDevice * device, MIDIChannel channel, MIDIKey key, MIDIVelocity velocity );
 int MIDIDeviceSendNoteOff( struct MIDIDevice * device, MIDIChannel channel, MIDIKey key, MIDIVelocity velocity );
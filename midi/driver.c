@@ -1,4 +1,6 @@
 #include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
 #define MIDI_DRIVER_INTERNALS
 #include "driver.h"
 
@@ -6,6 +8,7 @@
 #include "port.h"
 #include "event.h"
 #include "message.h"
+#include "trace.h"
 
 #include "runloop.h"
 #include "clock.h"
@@ -54,6 +57,323 @@
  * @{
  */
 
+/**
+ * @brief Trigger an event without message.
+ * @private @memberof MIDIDriver
+ * @param driver The driver.
+ * @param id     The event id.
+ * @param info   The event info.
+ * @return the sum of the values returned by the observers.
+ */
+static int _trigger( struct MIDIDriver * driver, size_t id, void * info ) {
+  struct MIDIEvent * event = MIDIEventCreate( id, info, NULL );
+  int result;
+  if( event == NULL ) return 0;
+  result = MIDIEventBusPost( &(driver->events), event );
+  MIDIEventRelease( event );
+  return result;
+}
+
+/**
+ * @brief Pass a message to the implementation.
+ * @private @memberof MIDIDriver
+ * @param driver  The driver.
+ * @param message The message.
+ * @retval 0  on success.
+ * @retval >0 if the message could not be sent.
+ */
+static int _send( struct MIDIDriver * driver, struct MIDIMessage * message ) {
+  MIDIProfileAdd( driver->profile, messages_out, 1 );
+  MIDITraceHop( message, MIDI_TRACE_SEND );
+  return (*driver->send)( driver, message );
+}
+
+#define THINNING_SLOTS_PER_CHANNEL 130
+#define THINNING_SLOTS             ( 16 * THINNING_SLOTS_PER_CHANNEL )
+#define THINNING_MAX_SCALE         8
+#define THINNING_BURST             10
+
+struct MIDIDriverThinningSlot {
+  MIDITimestamp next;
+  struct MIDIMessage * message;
+};
+
+struct MIDIDriverThinning {
+  unsigned long rate;
+  unsigned long budget;
+  size_t depth;
+  MIDITimestamp refilled;
+  long long tokens;
+  unsigned long timer;
+  size_t npending;
+  unsigned short pending[THINNING_SLOTS];
+  struct MIDIMessage * ready[THINNING_SLOTS];
+  struct MIDIDriverThinningSlot slots[THINNING_SLOTS];
+};
+
+/**
+ * @brief Get the slot under which a message is thinned.
+ * Every continuous controller of a channel has a slot of its own, pitch
+ * wheel changes and channel pressure have one slot per channel. Bank
+ * selects, data entry, (N)RPN selection, switches and channel mode
+ * messages have to arrive in order and are never thinned, neither are
+ * notes, SysEx and real-time messages.
+ * @private @memberof MIDIDriver
+ * @param message The message.
+ * @param slot    The slot.
+ * @retval 0 on success.
+ * @retval 1 if the message is never thinned.
+ */
+static int _thin_slot( struct MIDIMessage * message, unsigned int * slot ) {
+  struct MIDICompactMessage compact;
+  unsigned int channel, controller;
+  if( MIDIMessageGetCompact( message, &compact ) ) return 1;
+  channel = compact.bytes[0] & 0x0f;
+  switch( compact.bytes[0] >> 4 ) {
+    case MIDI_STATUS_CONTROL_CHANGE:
+      controller = compact.bytes[1];
+      if( controller == 0 || controller == 6 || controller == 32 || controller == 38
+       || ( controller >= 64 && controller <= 69 ) || controller >= 96 ) {
+        return 1;
+      }
+      *slot = channel * THINNING_SLOTS_PER_CHANNEL + controller;
+      return 0;
+    case MIDI_STATUS_PITCH_WHEEL_CHANGE:
+      *slot = channel * THINNING_SLOTS_PER_CHANNEL + 128;
+      return 0;
+    case MIDI_STATUS_CHANNEL_PRESSURE:
+      *slot = channel * THINNING_SLOTS_PER_CHANNEL + 129;
+      return 0;
+    default:
+      return 1;
+  }
+}
+
+/**
+ * @brief Get the factor by which the rate and budget are reduced.
+ * The factor grows by one for every @c MIDI_DRIVER_THINNING_DEPTH
+ * messages waiting in the driver's send queue.
+ * @private @memberof MIDIDriver
+ * @param thinning The thinning stage.
+ * @return the factor.
+ */
+static long long _thin_scale( struct MIDIDriverThinning * thinning ) {
+  size_t scale = 1 + thinning->depth / MIDI_DRIVER_THINNING_DEPTH;
+  return ( scale < THINNING_MAX_SCALE ) ? scale : THINNING_MAX_SCALE;
+}
+
+/**
+ * @brief Get the number of tokens that can be saved up.
+ * A tenth of a second of the budget, but at least one message.
+ * @private @memberof MIDIDriver
+ * @param thinning The thinning stage.
+ * @param rate     The sampling rate of the driver's clock.
+ * @return the capacity in bytes times clock ticks.
+ */
+static long long _thin_capacity( struct MIDIDriverThinning * thinning, MIDISamplingRate rate ) {
+  long long capacity = (long long) thinning->budget * rate / THINNING_BURST;
+  return ( capacity < 3LL * rate ) ? 3LL * rate : capacity;
+}
+
+/**
+ * @brief Refill the byte budget.
+ * Tokens are counted in bytes times clock ticks, so that the budget
+ * can be refilled by whole ticks.
+ * @private @memberof MIDIDriver
+ * @param thinning The thinning stage.
+ * @param now      The current time.
+ * @param rate     The sampling rate of the driver's clock.
+ */
+static void _thin_refill( struct MIDIDriverThinning * thinning, MIDITimestamp now, MIDISamplingRate rate ) {
+  MIDITimestamp delta = now - thinning->refilled;
+  thinning->refilled = now;
+  if( thinning->budget == 0 || delta <= 0 ) return;
+  if( delta > rate ) delta = rate;
+  thinning->tokens += delta * (long long) thinning->budget / _thin_scale( thinning );
+  if( thinning->tokens > _thin_capacity( thinning, rate ) ) thinning->tokens = _thin_capacity( thinning, rate );
+}
+
+/**
+ * @brief Take the size of a message from the byte budget.
+ * Messages that are never thinned may overdraw the budget by up to a
+ * tenth of a second, so that continuous controllers back off while
+ * notes and SysEx fill the link.
+ * @private @memberof MIDIDriver
+ * @param thinning The thinning stage.
+ * @param size     The size of the message.
+ * @param rate     The sampling rate of the driver's clock.
+ */
+static void _thin_charge( struct MIDIDriverThinning * thinning, size_t size, MIDISamplingRate rate ) {
+  long long floor = -(long long) thinning->budget * rate / THINNING_BURST;
+  if( thinning->budget == 0 ) return;
+  thinning->tokens -= (long long) size * rate;
+  if( thinning->tokens < floor ) thinning->tokens = floor;
+}
+
+/**
+ * @brief Get the time until a slot may send its next value.
+ * @private @memberof MIDIDriver
+ * @param thinning The thinning stage.
+ * @param slot     The slot.
+ * @param size     The size of the message to send.
+ * @param now      The current time.
+ * @param rate     The sampling rate of the driver's clock.
+ * @return the number of ticks to wait, 0 if the value can be sent now.
+ */
+static MIDITimestamp _thin_wait( struct MIDIDriverThinning * thinning, struct MIDIDriverThinningSlot * slot,
+                                 size_t size, MIDITimestamp now, MIDISamplingRate rate ) {
+  MIDITimestamp wait = slot->next - now, deficit;
+  if( wait < 0 ) wait = 0;
+  if( thinning->budget > 0 ) {
+    deficit = (long long) size * rate - thinning->tokens;
+    if( deficit > 0 ) {
+      deficit = ( deficit * _thin_scale( thinning ) + thinning->budget - 1 ) / thinning->budget;
+      if( deficit > wait ) wait = deficit;
+    }
+  }
+  return wait;
+}
+
+/**
+ * @brief Mark a slot as sent.
+ * @private @memberof MIDIDriver
+ * @param thinning The thinning stage.
+ * @param slot     The slot.
+ * @param size     The size of the sent message.
+ * @param now      The current time.
+ * @param rate     The sampling rate of the driver's clock.
+ */
+static void _thin_sent( struct MIDIDriverThinning * thinning, struct MIDIDriverThinningSlot * slot,
+                        size_t size, MIDITimestamp now, MIDISamplingRate rate ) {
+  slot->next = now;
+  if( thinning->rate > 0 ) {
+    slot->next += ( rate / thinning->rate + ( rate < thinning->rate ) ) * _thin_scale( thinning );
+  }
+  _thin_charge( thinning, size, rate );
+}
+
+static int _thin_flush( void * info, struct timespec * ts );
+
+/**
+ * @brief Schedule the timer for the earliest held value.
+ * @private @memberof MIDIDriver
+ * @param driver The driver.
+ * @param now    The current time.
+ * @param rate   The sampling rate of the driver's clock.
+ * @retval 0  on success.
+ * @retval >0 if the timer could not be added.
+ */
+static int _thin_schedule( struct MIDIDriver * driver, MIDITimestamp now, MIDISamplingRate rate ) {
+  struct MIDIDriverThinning * thinning = driver->thinning;
+  struct MIDIDriverThinningSlot * slot;
+  MIDITimestamp wait, earliest = -1;
+  struct timespec delay;
+  size_t i, size;
+
+  if( thinning->npending == 0 || thinning->timer != 0 ) return 0;
+  for( i=0; i<thinning->npending; i++ ) {
+    slot = &(thinning->slots[thinning->pending[i]]);
+    size = 0;
+    MIDIMessageGetSize( slot->message, &size );
+    wait = _thin_wait( thinning, slot, size, now, rate );
+    if( earliest < 0 || wait < earliest ) earliest = wait;
+  }
+  if( earliest < 1 ) earliest = 1;
+  delay.tv_sec  = earliest / rate;
+  delay.tv_nsec = ( earliest % rate ) * 1000000000LL / rate;
+  return MIDIRunloopSourceAddTimer( driver->rls, &delay, &_thin_flush, driver, &(thinning->timer) );
+}
+
+/**
+ * @brief Send the held values that are due.
+ * Messages are collected before they are sent, so that the
+ * implementation can send new messages through the thinning stage.
+ * @private @memberof MIDIDriver
+ * @param info The driver.
+ * @param ts   The current time of the runloop.
+ * @retval 0 on success.
+ */
+static int _thin_flush( void * info, struct timespec * ts ) {
+  struct MIDIDriver * driver = info;
+  struct MIDIDriverThinning * thinning = driver->thinning;
+  struct MIDIDriverThinningSlot * slot;
+  MIDISamplingRate rate;
+  MIDITimestamp now;
+  size_t i, n = 0, npending = 0, size;
+  int result = 0;
+
+  thinning->timer = 0;
+  MIDIClockGetNow( driver->clock, &now );
+  MIDIClockGetSamplingRate( driver->clock, &rate );
+  _thin_refill( thinning, now, rate );
+  for( i=0; i<thinning->npending; i++ ) {
+    slot = &(thinning->slots[thinning->pending[i]]);
+    size = 0;
+    MIDIMessageGetSize( slot->message, &size );
+    if( _thin_wait( thinning, slot, size, now, rate ) == 0 ) {
+      _thin_sent( thinning, slot, size, now, rate );
+      thinning->ready[n++] = slot->message;
+      slot->message = NULL;
+    } else {
+      thinning->pending[npending++] = thinning->pending[i];
+    }
+  }
+  thinning->npending = npending;
+  for( i=0; i<n; i++ ) {
+    result += _send( driver, thinning->ready[i] );
+    MIDIMessageRelease( thinning->ready[i] );
+  }
+  if( driver->thinning == thinning ) {
+    _thin_schedule( driver, now, rate );
+  }
+  return result;
+}
+
+/**
+ * @brief Pass an outgoing message through the thinning stage.
+ * Values of continuous controllers that arrive before their slot may
+ * send again are held, a newer value replaces the held one. Every other
+ * message is sent immediately.
+ * @private @memberof MIDIDriver
+ * @param driver  The driver.
+ * @param message The message.
+ * @retval 0  on success.
+ * @retval >0 if the message could not be sent.
+ */
+static int _thin( struct MIDIDriver * driver, struct MIDIMessage * message ) {
+  struct MIDIDriverThinning * thinning = driver->thinning;
+  struct MIDIDriverThinningSlot * slot;
+  MIDISamplingRate rate;
+  MIDITimestamp now;
+  unsigned int index;
+  size_t size = 0;
+
+  MIDIClockGetNow( driver->clock, &now );
+  MIDIClockGetSamplingRate( driver->clock, &rate );
+  MIDIMessageGetSize( message, &size );
+  _thin_refill( thinning, now, rate );
+  if( _thin_slot( message, &index ) ) {
+    _thin_charge( thinning, size, rate );
+    return _send( driver, message );
+  }
+  slot = &(thinning->slots[index]);
+  if( slot->message != NULL ) {
+    MIDIMessageRetain( message );
+    MIDIMessageRelease( slot->message );
+    slot->message = message;
+    MIDIProfileAdd( driver->profile, thinned, 1 );
+    return 0;
+  }
+  if( _thin_wait( thinning, slot, size, now, rate ) == 0 ) {
+    _thin_sent( thinning, slot, size, now, rate );
+    return _send( driver, message );
+  }
+  MIDIMessageRetain( message );
+  slot->message = message;
+  thinning->pending[thinning->npending++] = index;
+  return _thin_schedule( driver, now, rate );
+}
+
 /**
  * @brief Port callback.
  * This may be confusing at first but when the driver <b>receives</b>
@@ -73,7 +393,14 @@ static int _port_receive( void * target, void * source, struct MIDITypeSpec * ty
   struct MIDIDriver * driver = target;
 
   if( type == MIDIMessageType && driver->send != NULL ) {
-    return (*driver->send)( driver, object );
+    if( MIDIDriverObservesEvent( driver, MIDI_DRIVER_WILL_SEND_MESSAGE ) &&
+        _trigger( driver, MIDI_DRIVER_WILL_SEND_MESSAGE, object ) ) {
+      return 0;
+    }
+    if( driver->thinning != NULL ) {
+      return _thin( driver, object );
+    }
+    return _send( driver, object );
   } else {
     return 0;
   }
@@ -120,6 +447,10 @@ void MIDIDriverInit( struct MIDIDriver * driver, char * name, MIDISamplingRate r
   driver->rls   = NULL;
   driver->port  = MIDIPortCreate( name, MIDI_PORT_IN | MIDI_PORT_OUT, driver, &_port_receive );
   driver->clock = MIDIClockProvide( rate );
+  driver->profile = NULL;
+  driver->thinning = NULL;
+  driver->realtime_policy = MIDI_DRIVER_REALTIME_HEAD;
+  MIDIEventBusInit( &(driver->events) );
 
   driver->send    = NULL;
   driver->destroy = NULL;
@@ -136,6 +467,12 @@ void MIDIDriverDestroy( struct MIDIDriver * driver ) {
   if( driver->destroy != NULL ) {
     (*driver->destroy)( driver );
   }
+  if( driver->thinning != NULL ) {
+    MIDIDriverSetThinning( driver, 0, 0 );
+  }
+  if( driver->profile != NULL ) {
+    MIDIDriverStopProfiling( driver );
+  }
   if( driver->clock != NULL ) {
     MIDIClockRelease( driver->clock );
   }
@@ -145,6 +482,7 @@ void MIDIDriverDestroy( struct MIDIDriver * driver ) {
   }
   MIDIPortInvalidate( driver->port );
   MIDIPortRelease( driver->port );
+  MIDIEventBusClear( &(driver->events) );
   free( driver );
 }
 
@@ -156,7 +494,7 @@ void MIDIDriverDestroy( struct MIDIDriver * driver ) {
  */
 void MIDIDriverRetain( struct MIDIDriver * driver ) {
   MIDIPrecondReturn( driver != NULL, EFAULT, (void)0 );
-  driver->refs++;
+  MIDIRefRetain( driver->refs );
 }
 
 /**
@@ -168,7 +506,7 @@ void MIDIDriverRetain( struct MIDIDriver * driver ) {
  */
 void MIDIDriverRelease( struct MIDIDriver * driver ) {
   MIDIPrecondReturn( driver != NULL, EFAULT, (void)0 );
-  if( ! --driver->refs ) {
+  if( ! MIDIRefRelease( driver->refs ) ) {
     MIDIDriverDestroy( driver );
   }
 }
@@ -201,6 +539,78 @@ int MIDIDriverGetPort( struct MIDIDriver * driver, struct MIDIPort ** port ) {
 
 /** @} */
 
+/* MARK: Output lanes *//**
+ * @name Output lanes
+ * Drivers that queue outgoing messages keep system real-time messages in
+ * a lane of their own, so that timing clocks, start and stop messages
+ * do not wait behind long SysEx dumps or floods of control changes. The
+ * policy decides how the real-time lane is sent:
+ * - @c MIDI_DRIVER_REALTIME_IN_ORDER: queue real-time messages with all
+ *   other messages, in the order they were sent.
+ * - @c MIDI_DRIVER_REALTIME_HEAD: put real-time messages at the head of
+ *   the next packet, ahead of all queued messages.
+ * - @c MIDI_DRIVER_REALTIME_IMMEDIATE: send every real-time message in a
+ *   packet of its own as soon as it is sent to the driver.
+ * The time messages spend in each lane is recorded in the @c lanes
+ * histograms of the profiling stats.
+ * @{
+ */
+
+/**
+ * @brief Set the policy for system real-time messages.
+ * By default real-time messages are put at the head of the next packet.
+ * @public @memberof MIDIDriver
+ * @param driver The driver.
+ * @param policy The policy.
+ * @retval 0 on success.
+ */
+int MIDIDriverSetRealTimePolicy( struct MIDIDriver * driver, int policy ) {
+  MIDIPrecond( driver != NULL, EFAULT );
+  MIDIPrecond( policy >= MIDI_DRIVER_REALTIME_IN_ORDER && policy <= MIDI_DRIVER_REALTIME_IMMEDIATE, EINVAL );
+  driver->realtime_policy = policy;
+  return 0;
+}
+
+/**
+ * @brief Get the policy for system real-time messages.
+ * @public @memberof MIDIDriver
+ * @param driver The driver.
+ * @param policy The policy.
+ * @retval 0 on success.
+ */
+int MIDIDriverGetRealTimePolicy( struct MIDIDriver * driver, int * policy ) {
+  MIDIPrecond( driver != NULL, EFAULT );
+  MIDIPrecond( policy != NULL, EINVAL );
+  *policy = driver->realtime_policy;
+  return 0;
+}
+
+/**
+ * @brief Get the output lane of a message.
+ * System real-time messages go to the real-time lane, unless the driver
+ * keeps them in order. All other messages go to the bulk lane.
+ * @public @memberof MIDIDriver
+ * @param driver  The driver.
+ * @param message The message.
+ * @param lane    The lane.
+ * @retval 0 on success.
+ */
+int MIDIDriverGetLane( struct MIDIDriver * driver, struct MIDIMessage * message, int * lane ) {
+  MIDIStatus status = 0;
+  MIDIPrecond( driver != NULL, EFAULT );
+  MIDIPrecond( message != NULL, EINVAL );
+  MIDIPrecond( lane != NULL, EINVAL );
+  MIDIMessageGetStatus( message, &status );
+  if( status >= MIDI_STATUS_TIMING_CLOCK && driver->realtime_policy != MIDI_DRIVER_REALTIME_IN_ORDER ) {
+    *lane = MIDI_DRIVER_LANE_REALTIME;
+  } else {
+    *lane = MIDI_DRIVER_LANE_BULK;
+  }
+  return 0;
+}
+
+/** @} */
+
 /* MARK: Message passing *//**
  * @name Message passing
  * Receiving and sending MIDIMessage objects.
@@ -235,9 +645,18 @@ int MIDIDriverMakeLoopback( struct MIDIDriver * driver ) {
  * @retval >0 if the message could not be relayed.
  */
 int MIDIDriverReceive( struct MIDIDriver * driver, struct MIDIMessage * message ) {
+  int result;
   MIDIPrecond( driver != NULL, EFAULT );
   MIDIPrecond( message != NULL, EINVAL );
-  return MIDIPortSend( driver->port, MIDIMessageType, message );
+  MIDIProfileAdd( driver->profile, messages_in, 1 );
+  if( MIDIDriverObservesEvent( driver, MIDI_DRIVER_WILL_RECEIVE_MESSAGE ) &&
+      _trigger( driver, MIDI_DRIVER_WILL_RECEIVE_MESSAGE, message ) ) {
+    return 0;
+  }
+  MIDIProfileBegin( driver->profile, MIDI_DRIVER_STAGE_DISPATCH );
+  result = MIDIPortSend( driver->port, MIDIMessageType, message );
+  MIDIProfileEnd( driver->profile, MIDI_DRIVER_STAGE_DISPATCH );
+  return result;
 }
 
 /**
@@ -257,19 +676,374 @@ int MIDIDriverSend( struct MIDIDriver * driver, struct MIDIMessage * message ) {
   return MIDIPortReceive( driver->port, MIDIMessageType, message );
 }
 
+/** @} */
+
+/* MARK: Events *//**
+ * @name Events
+ * Notifying observers about events that occured in the driver.
+ * Observers register for an event id. Events that nobody observes are
+ * neither created nor formatted, so triggering them costs one branch.
+ * @{
+ */
+
+/**
+ * @brief Register an event observer.
+ * @public @memberof MIDIDriver
+ * @param driver   The driver.
+ * @param id       The event id or @c MIDI_EVENT_ANY to observe all events.
+ * @param observer The callback.
+ * @param target   The first argument of the callback.
+ * @retval 0  on success.
+ * @retval >0 if the observer could not be registered.
+ */
+int MIDIDriverAddEventObserver( struct MIDIDriver * driver, size_t id, MIDIEventObserverFn * observer, void * target ) {
+  MIDIPrecond( driver != NULL, EFAULT );
+  return MIDIEventBusSubscribe( &(driver->events), id, observer, target );
+}
+
+/**
+ * @brief Remove an event observer.
+ * @public @memberof MIDIDriver
+ * @param driver   The driver.
+ * @param id       The event id the observer was registered for.
+ * @param observer The callback.
+ * @param target   The first argument of the callback.
+ * @retval 0 on success.
+ * @retval 1 if the observer was not registered.
+ */
+int MIDIDriverRemoveEventObserver( struct MIDIDriver * driver, size_t id, MIDIEventObserverFn * observer, void * target ) {
+  MIDIPrecond( driver != NULL, EFAULT );
+  return MIDIEventBusUnsubscribe( &(driver->events), id, observer, target );
+}
+
 /**
  * @brief Trigger an event that occured in the driver implementation.
+ * Deliver the event to all observers of its id.
  * @public @memberof MIDIDriver
  * @param driver The driver.
  * @param event  The event.
- * @retval 0  on success.
+ * @return the sum of the values returned by the observers.
  */
 int MIDIDriverTriggerEvent( struct MIDIDriver * driver, struct MIDIEvent * event ) {
   MIDIPrecond( driver != NULL, EFAULT );
   MIDIPrecond( event != NULL, EINVAL );
-  return MIDIPortSend( driver->port, MIDIEventType, event );
+  return MIDIEventBusPost( &(driver->events), event );
+}
+
+/**
+ * @brief Create and trigger an event if it is observed.
+ * The event is only created if an observer registered for its id. The
+ * message is formatted when an observer asks for it.
+ * @public @memberof MIDIDriver
+ * @param driver  The driver.
+ * @param id      The event id.
+ * @param info    Any optional data to be associated with the event.
+ * @param message A message format that may contain placeholders.
+ * @param ...     The data to be filled into the message format placeholders.
+ * @return the sum of the values returned by the observers.
+ */
+int MIDIDriverTriggerEventFormat( struct MIDIDriver * driver, size_t id, void * info, char * message, ... ) {
+  struct MIDIEvent * event;
+  va_list vargs;
+  int result;
+  MIDIPrecond( driver != NULL, EFAULT );
+  if( ! MIDIDriverObservesEvent( driver, id ) ) return 0;
+  va_start( vargs, message );
+  event = MIDIEventCreateV( id, info, message, vargs );
+  va_end( vargs );
+  if( event == NULL ) return 0;
+  result = MIDIEventBusPost( &(driver->events), event );
+  MIDIEventRelease( event );
+  return result;
+}
+
+/** @} */
+
+/* MARK: Output thinning *//**
+ * @name Output thinning
+ * High resolution controllers send control changes and pitch wheel
+ * changes faster than slow links can carry them, delaying the notes
+ * behind them. The thinning stage limits every continuous controller of
+ * every channel to a maximum rate and all of them together to a byte
+ * budget. Values that arrive too early are held back and replaced by
+ * newer ones, so the latest value is always sent. Notes, SysEx and
+ * real-time messages are never held.
+ * Drivers that queue outgoing messages report the depth of their queue
+ * with MIDIDriverSetQueueDepth. Rate and budget are divided by one more
+ * for every @c MIDI_DRIVER_THINNING_DEPTH queued messages, up to a
+ * factor of eight.
+ * Held values are sent by a timer of the driver's runloop source, so
+ * messages have to be sent on the thread of the driver's runloop.
+ * Drivers without a runloop source are given one that has to be added
+ * to a runloop with MIDIRunloopAddDriver.
+ * @{
+ */
+
+/**
+ * @brief Limit the rate of continuous controllers.
+ * Set both @c rate and @c budget to 0 to remove the thinning stage.
+ * Held values are sent when the stage is removed.
+ * @public @memberof MIDIDriver
+ * @param driver The driver.
+ * @param rate   The maximum number of values per second and controller,
+ *               0 if unlimited.
+ * @param budget The maximum number of bytes per second of all
+ *               controllers, 0 if unlimited.
+ * @retval 0  on success.
+ * @retval >0 if the thinning stage could not be set.
+ */
+int MIDIDriverSetThinning( struct MIDIDriver * driver, unsigned long rate, unsigned long budget ) {
+  struct MIDIDriverThinning * thinning;
+  MIDISamplingRate clock_rate;
+  MIDITimestamp now;
+  size_t i;
+  MIDIPrecond( driver != NULL, EFAULT );
+
+  thinning = driver->thinning;
+  if( rate == 0 && budget == 0 ) {
+    if( thinning == NULL ) return 0;
+    if( thinning->timer != 0 ) {
+      MIDIRunloopSourceCancelTimer( driver->rls, thinning->timer );
+    }
+    driver->thinning = NULL;
+    for( i=0; i<thinning->npending; i++ ) {
+      _send( driver, thinning->slots[thinning->pending[i]].message );
+      MIDIMessageRelease( thinning->slots[thinning->pending[i]].message );
+    }
+    free( thinning );
+    return 0;
+  }
+  if( driver->rls == NULL ) {
+    driver->rls = MIDIRunloopSourceCreate( NULL );
+    MIDIPrecond( driver->rls != NULL, ENOMEM );
+  }
+  MIDIClockGetNow( driver->clock, &now );
+  MIDIClockGetSamplingRate( driver->clock, &clock_rate );
+  if( thinning == NULL ) {
+    thinning = malloc( sizeof( struct MIDIDriverThinning ) );
+    MIDIPrecond( thinning != NULL, ENOMEM );
+    thinning->depth    = 0;
+    thinning->timer    = 0;
+    thinning->npending = 0;
+    for( i=0; i<THINNING_SLOTS; i++ ) {
+      thinning->slots[i].next    = now;
+      thinning->slots[i].message = NULL;
+    }
+    driver->thinning = thinning;
+  }
+  thinning->rate     = rate;
+  thinning->budget   = budget;
+  thinning->refilled = now;
+  thinning->tokens   = _thin_capacity( thinning, clock_rate );
+  return 0;
+}
+
+/**
+ * @brief Get the limits of continuous controllers.
+ * @public @memberof MIDIDriver
+ * @param driver The driver.
+ * @param rate   The maximum number of values per second and controller.
+ * @param budget The maximum number of bytes per second.
+ * @retval 0 on success.
+ */
+int MIDIDriverGetThinning( struct MIDIDriver * driver, unsigned long * rate, unsigned long * budget ) {
+  MIDIPrecond( driver != NULL, EFAULT );
+  if( rate != NULL ) {
+    *rate = ( driver->thinning != NULL ) ? driver->thinning->rate : 0;
+  }
+  if( budget != NULL ) {
+    *budget = ( driver->thinning != NULL ) ? driver->thinning->budget : 0;
+  }
+  return 0;
 }
 
+/**
+ * @brief Report the depth of the driver's send queue.
+ * Driver implementations call this whenever the number of queued
+ * messages changes. The depth adapts the thinning stage and is recorded
+ * in the profiling stats.
+ * @private @memberof MIDIDriver
+ * @param driver The driver.
+ * @param depth  The number of queued messages.
+ */
+void MIDIDriverSetQueueDepth( struct MIDIDriver * driver, size_t depth ) {
+  MIDIPrecondReturn( driver != NULL, EFAULT, (void)0 );
+  if( driver->thinning != NULL ) {
+    driver->thinning->depth = depth;
+  }
+  MIDIProfileQueueDepth( driver->profile, depth );
+}
+
+/** @} */
+
+/* MARK: Profiling *//**
+ * @name Profiling
+ * Collect message counters and per-stage latency histograms.
+ * Driver implementations record their stages with the
+ * @c MIDIProfileBegin and @c MIDIProfileEnd macros. All recording
+ * is compiled out if @c NO_PROFILING is defined.
+ * @{
+ */
+
+/**
+ * @brief Start collecting profiling information.
+ * Reset all counters and histograms and start recording. Latencies
+ * are measured in ticks of a clock running at the system's native
+ * rate, which is stored in the @c rate member of the stats.
+ * @public @memberof MIDIDriver
+ * @param driver The driver.
+ * @retval 0      on success.
+ * @retval ENOSYS if profiling was compiled out.
+ * @retval >0     if profiling could not be started.
+ */
+int MIDIDriverStartProfiling( struct MIDIDriver * driver ) {
+#ifdef NO_PROFILING
+  return ENOSYS;
+#else
+  struct MIDIDriverProfile * profile;
+  MIDIPrecond( driver != NULL, EFAULT );
+  if( driver->profile != NULL ) {
+    profile = driver->profile;
+  } else {
+    profile = malloc( sizeof( struct MIDIDriverProfile ) );
+    MIDIPrecond( profile != NULL, ENOMEM );
+    profile->clock = MIDIClockCreate( 0 );
+    if( profile->clock == NULL ) {
+      free( profile );
+      return ENOMEM;
+    }
+  }
+  memset( &(profile->start[0]), 0, sizeof(profile->start) );
+  memset( &(profile->stats), 0, sizeof(profile->stats) );
+  MIDIClockGetSamplingRate( profile->clock, &(profile->stats.rate) );
+  driver->profile = profile;
+  return 0;
+#endif
+}
+
+/**
+ * @brief Get the collected profiling information.
+ * @public @memberof MIDIDriver
+ * @param driver The driver.
+ * @param stats  The stats to copy the counters and histograms to.
+ * @retval 0  on success.
+ * @retval >0 if the driver is not profiling.
+ */
+int MIDIDriverGetProfilingStats( struct MIDIDriver * driver, struct MIDIDriverProfilingStats * stats ) {
+  MIDIPrecond( driver != NULL, EFAULT );
+  MIDIPrecond( stats != NULL, EINVAL );
+  if( driver->profile == NULL ) {
+    MIDIError( EINVAL, "Driver is not profiling." );
+    return EINVAL;
+  }
+  *stats = driver->profile->stats;
+  return 0;
+}
+
+/**
+ * @brief Stop collecting profiling information.
+ * Free all resources used for profiling, collected stats are lost.
+ * @public @memberof MIDIDriver
+ * @param driver The driver.
+ * @retval 0  on success.
+ * @retval >0 if the driver is not profiling.
+ */
+int MIDIDriverStopProfiling( struct MIDIDriver * driver ) {
+  MIDIPrecond( driver != NULL, EFAULT );
+  if( driver->profile == NULL ) {
+    MIDIError( EINVAL, "Driver is not profiling." );
+    return EINVAL;
+  }
+  MIDIClockRelease( driver->profile->clock );
+  free( driver->profile );
+  driver->profile = NULL;
+  return 0;
+}
+
+/**
+ * @brief Add a latency to a histogram.
+ * Bucket @c i counts latencies of @c 2^(i-1) up to @c 2^i-1 ticks,
+ * the last bucket counts everything above. Negative latencies are
+ * counted as 0.
+ * @public @memberof MIDIDriverLatencyHistogram
+ * @param histogram The histogram.
+ * @param latency   The latency.
+ */
+void MIDIDriverLatencyHistogramAdd( struct MIDIDriverLatencyHistogram * histogram, MIDITimestamp latency ) {
+  int bucket;
+  MIDIPrecondReturn( histogram != NULL, EFAULT, (void)0 );
+  if( latency < 0 ) latency = 0;
+
+  bucket = ( latency == 0 ) ? 0 : 64 - __builtin_clzll( (unsigned long long) latency );
+  if( bucket >= MIDI_DRIVER_HISTOGRAM_BUCKETS ) bucket = MIDI_DRIVER_HISTOGRAM_BUCKETS - 1;
+
+  histogram->count++;
+  histogram->total += latency;
+  if( latency > histogram->max ) histogram->max = latency;
+  histogram->buckets[bucket]++;
+}
+
+/**
+ * @brief Record the latency of a stage.
+ * Add the time since the stage was started with @c MIDIProfileBegin
+ * to the stage's histogram.
+ * @public @memberof MIDIDriverProfile
+ * @param profile The profile.
+ * @param stage   The stage.
+ */
+void MIDIDriverProfileRecord( struct MIDIDriverProfile * profile, int stage ) {
+  MIDITimestamp now;
+  MIDIPrecondReturn( profile != NULL, EFAULT, (void)0 );
+  MIDIPrecondReturn( stage >= 0 && stage < MIDI_DRIVER_NUM_STAGES, EINVAL, (void)0 );
+  MIDIClockGetNow( profile->clock, &now );
+  MIDIDriverLatencyHistogramAdd( &(profile->stats.stages[stage]), now - profile->start[stage] );
+}
+
+/**
+ * @brief Record a latency that was measured elsewhere.
+ * This is used for stages that do not start and end in the same
+ * call, like the delay between the due time and the actual send time
+ * of a scheduled message.
+ * @public @memberof MIDIDriverProfile
+ * @param profile The profile.
+ * @param stage   The stage.
+ * @param latency The latency in ticks of the profile's clock.
+ */
+void MIDIDriverProfileRecordLatency( struct MIDIDriverProfile * profile, int stage, MIDITimestamp latency ) {
+  MIDIPrecondReturn( profile != NULL, EFAULT, (void)0 );
+  MIDIPrecondReturn( stage >= 0 && stage < MIDI_DRIVER_NUM_STAGES, EINVAL, (void)0 );
+  MIDIDriverLatencyHistogramAdd( &(profile->stats.stages[stage]), latency );
+}
+
+/**
+ * @brief Record the time a message spent in an output lane.
+ * The latency is measured with the clock that timestamped the message
+ * when it was queued and converted to the rate of the profile's clock.
+ * @public @memberof MIDIDriverProfile
+ * @param profile The profile.
+ * @param lane    The lane.
+ * @param clock   The clock that was used to timestamp the message.
+ * @param queued  The time the message was queued.
+ */
+void MIDIDriverProfileRecordLane( struct MIDIDriverProfile * profile, int lane,
+                                  struct MIDIClock * clock, MIDITimestamp queued ) {
+  MIDISamplingRate rate;
+  MIDITimestamp now;
+  MIDIPrecondReturn( profile != NULL, EFAULT, (void)0 );
+  MIDIPrecondReturn( lane >= 0 && lane < MIDI_DRIVER_NUM_LANES, EINVAL, (void)0 );
+  MIDIClockGetNow( clock, &now );
+  MIDIClockGetSamplingRate( clock, &rate );
+  MIDIDriverLatencyHistogramAdd( &(profile->stats.lanes[lane]),
+                                 ( now - queued ) * profile->stats.rate / rate );
+}
+
+/** @} */
+
+/* MARK: Runloop integration *//**
+ * @name Runloop integration
+ * @{
+ */
+
 int MIDIRunloopAddDriver( struct MIDIRunloop * runloop, struct MIDIDriver * driver ) {
   MIDIPrecond( runloop != NULL, EFAULT );
   MIDIPrecond( driver != NULL, EINVAL );
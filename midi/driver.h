@@ -1,6 +1,7 @@
 #ifndef MIDIKIT_MIDI_DRIVER_H
 #define MIDIKIT_MIDI_DRIVER_H
 #include "midi.h"
+#include "event.h"
 
 struct MIDIPort;
 struct MIDIEvent;
@@ -13,18 +14,111 @@ struct MIDIDriver;
 #define MIDI_DRIVER_WILL_RECEIVE_MESSAGE 1
 #define MIDI_DRIVER_NUM_EVENT_TYPES 2
 
+#define MIDI_DRIVER_STAGE_SOCKET_READ  0
+#define MIDI_DRIVER_STAGE_DECODE       1
+#define MIDI_DRIVER_STAGE_DISPATCH     2
+#define MIDI_DRIVER_STAGE_QUEUE        3
+#define MIDI_DRIVER_STAGE_ENCODE       4
+#define MIDI_DRIVER_STAGE_SOCKET_WRITE 5
+#define MIDI_DRIVER_STAGE_SCHEDULE     6
+#define MIDI_DRIVER_STAGE_WAKEUP       7
+#define MIDI_DRIVER_NUM_STAGES         8
+
+#define MIDI_DRIVER_HISTOGRAM_BUCKETS  32
+
+#define MIDI_DRIVER_LANE_REALTIME 0
+#define MIDI_DRIVER_LANE_BULK     1
+#define MIDI_DRIVER_NUM_LANES     2
+
+#define MIDI_DRIVER_REALTIME_IN_ORDER  0
+#define MIDI_DRIVER_REALTIME_HEAD      1
+#define MIDI_DRIVER_REALTIME_IMMEDIATE 2
+
+#define MIDI_DRIVER_THINNING_DEPTH     16
+
+struct MIDIDriverLatencyHistogram {
+  unsigned long count;
+  MIDITimestamp total;
+  MIDITimestamp max;
+  unsigned long buckets[MIDI_DRIVER_HISTOGRAM_BUCKETS];
+};
+
+struct MIDIDriverProfilingStats {
+  MIDISamplingRate rate;
+  unsigned long messages_in;
+  unsigned long messages_out;
+  unsigned long bytes_in;
+  unsigned long bytes_out;
+  unsigned long packets_in;
+  unsigned long packets_out;
+  unsigned long drops;
+  unsigned long coalesced;
+  unsigned long thinned;
+  unsigned long recovered;
+  size_t queue_depth;
+  size_t queue_depth_max;
+  struct MIDIDriverLatencyHistogram stages[MIDI_DRIVER_NUM_STAGES];
+  struct MIDIDriverLatencyHistogram lanes[MIDI_DRIVER_NUM_LANES];
+};
+
+struct MIDIDriverProfile;
+struct MIDIDriverThinning;
+
 #ifdef MIDI_DRIVER_INTERNALS
+#include "clock.h"
 struct MIDIRunloopSource;
-struct MIDIClock;
+
+struct MIDIDriverProfile {
+  struct MIDIClock * clock;
+  MIDITimestamp start[MIDI_DRIVER_NUM_STAGES];
+  struct MIDIDriverProfilingStats stats;
+};
+
+void MIDIDriverProfileRecord( struct MIDIDriverProfile * profile, int stage );
+void MIDIDriverProfileRecordLatency( struct MIDIDriverProfile * profile, int stage, MIDITimestamp latency );
+void MIDIDriverProfileRecordLane( struct MIDIDriverProfile * profile, int lane,
+                                  struct MIDIClock * clock, MIDITimestamp queued );
+
+#ifndef NO_PROFILING
+#define MIDIProfileBegin( profile, stage ) \
+do { if( (profile) != NULL ) { \
+  MIDIClockGetNow( (profile)->clock, &((profile)->start[stage]) ); \
+} } while( 0 )
+#define MIDIProfileEnd( profile, stage ) \
+do { if( (profile) != NULL ) { MIDIDriverProfileRecord( (profile), (stage) ); } } while( 0 )
+#define MIDIProfileAdd( profile, counter, n ) \
+do { if( (profile) != NULL ) { (profile)->stats.counter += (n); } } while( 0 )
+#define MIDIProfileQueueDepth( profile, depth ) \
+do { if( (profile) != NULL ) { \
+  (profile)->stats.queue_depth = (depth); \
+  if( (depth) > (profile)->stats.queue_depth_max ) (profile)->stats.queue_depth_max = (depth); \
+} } while( 0 )
+#define MIDIProfileLane( profile, lane, clock, queued ) \
+do { if( (profile) != NULL ) { MIDIDriverProfileRecordLane( (profile), (lane), (clock), (queued) ); } } while( 0 )
+#else
+#define MIDIProfileBegin( profile, stage )
+#define MIDIProfileEnd( profile, stage )
+#define MIDIProfileAdd( profile, counter, n )
+#define MIDIProfileQueueDepth( profile, depth )
+#define MIDIProfileLane( profile, lane, clock, queued )
+#endif
+
+#define MIDIDriverObservesEvent( driver, id ) MIDIEventBusObserves( &((driver)->events), (id) )
 
 struct MIDIDriver {
   size_t refs;
   struct MIDIRunloopSource * rls;
   struct MIDIPort * port;
   struct MIDIClock * clock;
+  struct MIDIDriverProfile * profile;
+  struct MIDIDriverThinning * thinning;
+  int realtime_policy;
+  struct MIDIEventBus events;
   int (*send)( void * driver, struct MIDIMessage * message );
   void (*destroy)( void * driver );
 };
+
+void MIDIDriverSetQueueDepth( struct MIDIDriver * driver, size_t depth );
 #endif
 
 struct MIDIDriver * MIDIDriverCreate( char * name, MIDISamplingRate rate );
@@ -36,15 +130,25 @@ void MIDIDriverRelease( struct MIDIDriver * driver );
 int MIDIDriverMakeLoopback( struct MIDIDriver * driver );
 
 int MIDIDriverGetPort( struct MIDIDriver * driver, struct MIDIPort ** port );
+int MIDIDriverSetRealTimePolicy( struct MIDIDriver * driver, int policy );
+int MIDIDriverGetRealTimePolicy( struct MIDIDriver * driver, int * policy );
+int MIDIDriverGetLane( struct MIDIDriver * driver, struct MIDIMessage * message, int * lane );
+int MIDIDriverSetThinning( struct MIDIDriver * driver, unsigned long rate, unsigned long budget );
+int MIDIDriverGetThinning( struct MIDIDriver * driver, unsigned long * rate, unsigned long * budget );
 
 int MIDIDriverSend( struct MIDIDriver * driver, struct MIDIMessage * message );
 int MIDIDriverReceive( struct MIDIDriver * driver, struct MIDIMessage * message );
 int MIDIDriverTriggerEvent( struct MIDIDriver * driver, struct MIDIEvent * event );
+int MIDIDriverTriggerEventFormat( struct MIDIDriver * driver, size_t id, void * info, char * message, ... );
+int MIDIDriverAddEventObserver( struct MIDIDriver * driver, size_t id, MIDIEventObserverFn * observer, void * target );
+int MIDIDriverRemoveEventObserver( struct MIDIDriver * driver, size_t id, MIDIEventObserverFn * observer, void * target );
 
 int MIDIDriverStartProfiling( struct MIDIDriver * driver );
-int MIDIDriverGetProfilingStats( struct MIDIDriver * driver, void * stats );
+int MIDIDriverGetProfilingStats( struct MIDIDriver * driver, struct MIDIDriverProfilingStats * stats );
 int MIDIDriverStopProfiling( struct MIDIDriver * driver );
 
+void MIDIDriverLatencyHistogramAdd( struct MIDIDriverLatencyHistogram * histogram, MIDITimestamp latency );
+
 int MIDIRunloopAddDriver( struct MIDIRunloop * runloop, struct MIDIDriver * driver );
 int MIDIRunloopRemoveDriver( struct MIDIRunloop * runloop, struct MIDIDriver * driver );
 
@@ -1,7 +1,9 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <string.h>
 #include "event.h"
+#include "log.h"
 #include "type.h"
 #include "midi.h"
 
@@ -9,6 +11,11 @@
  * @ingroup MIDI
  * A basic event consisting of an id, a message and arbitary optional
  * data.
+ * The message is not formatted when the event is created. The event
+ * keeps the format and a copy of the arguments (strings are copied to
+ * a small buffer inside the event) and formats the message when it is
+ * requested for the first time. Formats with conversions that can not
+ * be stored this way are formatted immediately.
  */
 struct MIDIEvent {
 /**
@@ -17,17 +24,78 @@ struct MIDIEvent {
  */
   int refs;
   size_t id;
+  void * info;
+  char * format;
+  struct MIDIFormatArguments arguments;
   size_t length;
   char * message;
-  void * info;
 /** @endcond */
 };
 
+/**
+ * @ingroup MIDI
+ * @struct MIDIEventBus event.h
+ * @brief A list of event observers filtered by event id.
+ * The mask has one bit for every event id modulo 64 that has at least
+ * one observer, so posting an event that nobody observes only tests one
+ * bit. Use the @c MIDIEventBusObserves macro to skip creating events
+ * that would not be delivered.
+ */
+
+/** @internal */
+struct MIDIEventObserver {
+  size_t id;
+  MIDIEventObserverFn * observer;
+  void * target;
+  struct MIDIEventObserver * next;
+};
+
 /**
  * @brief Declare the MIDIEventType type specification.
  */
 MIDI_TYPE_SPEC_CODING( MIDIEvent, 0x3010 );
 
+/* MARK: Internals *//**
+ * @name Internals
+ * @cond INTERNALS
+ * Eager message formatting.
+ * @{
+ */
+
+/**
+ * @brief Format the message immediately.
+ * @private @memberof MIDIEvent
+ * @param event  The event.
+ * @param format The message format.
+ * @param vargs  The arguments.
+ * @retval 0 on success.
+ * @retval 1 if the message could not be formatted.
+ */
+static int _print( struct MIDIEvent * event, const char * format, va_list vargs ) {
+  va_list copy;
+  int length;
+  va_copy( copy, vargs );
+  length = vsnprintf( NULL, 0, format, copy );
+  va_end( copy );
+  if( length < 0 ) return 1;
+  event->message = malloc( length + 1 );
+  if( event->message == NULL ) return 1;
+  vsnprintf( event->message, length + 1, format, vargs );
+  event->length = length;
+  return 0;
+}
+
+/**
+ * @brief Get the observer mask bit of an event id.
+ * @param id The event id.
+ * @return the mask bit, all bits for @c MIDI_EVENT_ANY.
+ */
+static unsigned long long _mask( size_t id ) {
+  return ( id == MIDI_EVENT_ANY ) ? ~0ULL : ( 1ULL << ( id & 63 ) );
+}
+
+/** @} @endcond */
+
 /* MARK: -
  * MARK: Creation and destruction *//**
  * @name Creation and destruction
@@ -38,6 +106,8 @@ MIDI_TYPE_SPEC_CODING( MIDIEvent, 0x3010 );
 /**
  * @brief Create a MIDIEvent instance.
  * Allocate space and initialize a MIDIEvent instance.
+ * The message is formatted when it is requested. The format is not
+ * copied, so it should be a string literal.
  * @public @memberof MIDIEvent
  * @param id      A (hopefully) unique ID.
  * @param info    Any optional data to be associated with the event.
@@ -48,41 +118,51 @@ MIDI_TYPE_SPEC_CODING( MIDIEvent, 0x3010 );
  * @return a @c NULL pointer if the event could not created.
  */
 struct MIDIEvent * MIDIEventCreate( size_t id, void * info, char * message, ... ) {
-  void * buffer;
-  size_t length, required;
+  struct MIDIEvent * event;
   va_list vargs;
+  va_start( vargs, message );
+  event = MIDIEventCreateV( id, info, message, vargs );
+  va_end( vargs );
+  return event;
+}
+
+/**
+ * @brief Create a MIDIEvent instance with a list of arguments.
+ * @see MIDIEventCreate
+ * @public @memberof MIDIEvent
+ * @param id      A (hopefully) unique ID.
+ * @param info    Any optional data to be associated with the event.
+ * @param message A message format that may contain placeholders.
+ * @param vargs   The data to be filled into the message format placeholders.
+ * @return a pointer to the created event structure on success.
+ * @return a @c NULL pointer if the event could not created.
+ */
+struct MIDIEvent * MIDIEventCreateV( size_t id, void * info, char * message, va_list vargs ) {
   struct MIDIEvent * event = malloc( sizeof( struct MIDIEvent ) );
+  va_list copy;
+  int result;
   MIDIPrecondReturn( event != NULL, ENOMEM, NULL );
 
-  event->refs = 1;
-  event->id   = id;
-  event->info = info;
-
-  if( message != NULL ) {
-    length = 64;
-    buffer = malloc( length );
-
-    va_start( vargs, message );
-    do {
-      if( buffer == NULL ) {
-        MIDIError( ENOMEM, "Could not allocate space for static buffer." );
-        return NULL;
-      }
-      required = vsnprintf( buffer, length-1, message, vargs );
-      if( required > length ) {
-        buffer = realloc( buffer, required );
-        length = required;
-      }
-    } while( required > length );
-    va_end( vargs );
-
-    event->message = buffer;
-    event->length  = length;
-  } else {
-    event->message = NULL;
-    event->length  = 0;
-  }
+  event->refs    = 1;
+  event->id      = id;
+  event->info    = info;
+  event->format  = NULL;
+  event->length  = 0;
+  event->message = NULL;
+  event->arguments.nargs = 0;
+  event->arguments.strings_length = 0;
+  if( message == NULL ) return event;
 
+  va_copy( copy, vargs );
+  result = MIDIFormatArgumentsCapture( &(event->arguments), message, copy );
+  va_end( copy );
+  if( result == 0 ) {
+    event->format = message;
+  } else if( _print( event, message, vargs ) ) {
+    free( event );
+    MIDIError( ENOMEM, "Could not allocate space for event message." );
+    return NULL;
+  }
   return event;
 }
 
@@ -108,7 +188,7 @@ void MIDIEventDestroy( struct MIDIEvent * event ) {
  */
 void MIDIEventRetain( struct MIDIEvent * event ) {
   MIDIPrecondReturn( event != NULL, EFAULT, (void)0 );
-  event->refs++;
+  MIDIRefRetain( event->refs );
 }
 
 /**
@@ -120,7 +200,7 @@ void MIDIEventRetain( struct MIDIEvent * event ) {
  */
 void MIDIEventRelease( struct MIDIEvent * event ) {
   MIDIPrecondReturn( event != NULL, EFAULT, (void)0 );
-  if( ! --event->refs ) {
+  if( ! MIDIRefRelease( event->refs ) ) {
     MIDIEventDestroy( event );
   }
 }
@@ -161,11 +241,39 @@ int MIDIEventGetInfo( struct MIDIEvent * event, void ** info ) {
   return 0;
 }
 
+/**
+ * @brief Get the event message.
+ * Format the message if this was not done before. The message
+ * is owned by the event.
+ * @public @memberof MIDIEvent
+ * @param event   The event.
+ * @param message The message, @c NULL if the event has none.
+ * @retval 0 on success.
+ * @retval >0 if the message could not be formatted.
+ */
+int MIDIEventGetMessage( struct MIDIEvent * event, char ** message ) {
+  size_t length;
+  MIDIPrecond( event != NULL, EFAULT );
+  MIDIPrecond( message != NULL, EINVAL );
+  if( event->message == NULL && event->format != NULL ) {
+    length = MIDIFormatArgumentsPrint( &(event->arguments), event->format, NULL, 0 );
+    event->message = malloc( length + 1 );
+    MIDIPrecond( event->message != NULL, ENOMEM );
+    MIDIFormatArgumentsPrint( &(event->arguments), event->format, event->message, length + 1 );
+    event->length = length;
+  }
+  *message = event->message;
+  return 0;
+}
+
 /** @} */
 
 /* MARK: Coding *//**
  * @name Coding
  * Encoding and decoding of MIDIEvent objects.
+ * An encoded event consists of the 32-bit id and the 32-bit length of
+ * the message, both in network byte order, followed by the formatted
+ * message without terminating zero. The info object is not encoded.
  * @{
  */
 
@@ -181,17 +289,34 @@ int MIDIEventGetInfo( struct MIDIEvent * event, void ** info ) {
  * @retval 1 if the event could not be encoded.
  */
 int MIDIEventEncode( struct MIDIEvent * event, size_t size, void * buffer, size_t * written ) {
+  unsigned char * b = buffer;
+  char * message;
+  size_t required;
   MIDIPrecond( event != NULL, EFAULT );
   MIDIPrecond( buffer != NULL, EINVAL );
-  size_t required = 8 + event->length;
-  MIDIPrecond( size >= required, ENOMEM );
-  /** @todo implement me */
-  return 1;
+  if( MIDIEventGetMessage( event, &message ) ) return 1;
+  required = 8 + event->length;
+  if( size < required ) {
+    MIDIError( ENOMEM, "Buffer is too small for the event." );
+    return ENOMEM;
+  }
+  b[0] = ( event->id >> 24 ) & 0xff;
+  b[1] = ( event->id >> 16 ) & 0xff;
+  b[2] = ( event->id >> 8 ) & 0xff;
+  b[3] = event->id & 0xff;
+  b[4] = ( event->length >> 24 ) & 0xff;
+  b[5] = ( event->length >> 16 ) & 0xff;
+  b[6] = ( event->length >> 8 ) & 0xff;
+  b[7] = event->length & 0xff;
+  if( event->length > 0 ) memcpy( b + 8, message, event->length );
+  if( written != NULL ) *written = required;
+  return 0;
 }
 
 /**
  * @brief Decode events.
- * Decode event objects from a buffer.
+ * Decode event objects from a buffer. The id and the message of the
+ * event are replaced, the info object is kept.
  * @public @memberof MIDIEvent
  * @param event  The event.
  * @param size   The size of the memory pointed to by @c buffer.
@@ -201,12 +326,156 @@ int MIDIEventEncode( struct MIDIEvent * event, size_t size, void * buffer, size_
  * @retval 1 if the event could not be encoded.
  */
 int MIDIEventDecode( struct MIDIEvent * event, size_t size, void * buffer, size_t * read ) {
+  unsigned char * b = buffer;
+  size_t length;
+  char * message;
   MIDIPrecond( event != NULL, EFAULT );
   MIDIPrecond( buffer != NULL, EINVAL );
-  size_t required = 5;
-  MIDIPrecond( size >= required, EINVAL );
-  /** @todo implement me */
-  return 1;
+  if( size < 8 ) {
+    MIDIError( EINVAL, "Buffer is too small for an event header." );
+    return EINVAL;
+  }
+  length = ( (size_t) b[4] << 24 ) | ( (size_t) b[5] << 16 ) | ( (size_t) b[6] << 8 ) | b[7];
+  if( size - 8 < length ) {
+    MIDIError( EINVAL, "Event reaches past the end of the buffer." );
+    return EINVAL;
+  }
+  message = malloc( length + 1 );
+  if( message == NULL ) {
+    MIDIError( ENOMEM, "Could not allocate space for event message." );
+    return ENOMEM;
+  }
+  memcpy( message, b + 8, length );
+  message[length] = '\0';
+
+  if( event->message != NULL ) free( event->message );
+  event->id      = ( (size_t) b[0] << 24 ) | ( (size_t) b[1] << 16 ) | ( (size_t) b[2] << 8 ) | b[3];
+  event->format  = NULL;
+  event->arguments.nargs = 0;
+  event->arguments.strings_length = 0;
+  event->message = message;
+  event->length  = length;
+  if( read != NULL ) *read = 8 + length;
+  return 0;
+}
+
+/** @} */
+
+/* MARK: -
+ * MARK: Event bus *//**
+ * @name Event bus
+ * Delivering events to observers that registered for their id.
+ * @{
+ */
+
+/**
+ * @brief Initialize an event bus without observers.
+ * @public @memberof MIDIEventBus
+ * @param bus The event bus.
+ * @retval 0 on success.
+ */
+int MIDIEventBusInit( struct MIDIEventBus * bus ) {
+  MIDIPrecond( bus != NULL, EFAULT );
+  bus->mask      = 0;
+  bus->observers = NULL;
+  return 0;
+}
+
+/**
+ * @brief Remove all observers of an event bus.
+ * @public @memberof MIDIEventBus
+ * @param bus The event bus.
+ * @retval 0 on success.
+ */
+int MIDIEventBusClear( struct MIDIEventBus * bus ) {
+  struct MIDIEventObserver * observer;
+  MIDIPrecond( bus != NULL, EFAULT );
+  while( bus->observers != NULL ) {
+    observer = bus->observers;
+    bus->observers = observer->next;
+    free( observer );
+  }
+  bus->mask = 0;
+  return 0;
+}
+
+/**
+ * @brief Register an observer for events with an id.
+ * Observers are called in the order they were registered.
+ * @public @memberof MIDIEventBus
+ * @param bus      The event bus.
+ * @param id       The event id or @c MIDI_EVENT_ANY to observe all events.
+ * @param observer The callback.
+ * @param target   The first argument of the callback.
+ * @retval 0 on success.
+ * @retval >0 if the observer could not be registered.
+ */
+int MIDIEventBusSubscribe( struct MIDIEventBus * bus, size_t id, MIDIEventObserverFn * observer, void * target ) {
+  struct MIDIEventObserver ** tail;
+  struct MIDIEventObserver * entry;
+  MIDIPrecond( bus != NULL, EFAULT );
+  MIDIPrecond( observer != NULL, EINVAL );
+  entry = malloc( sizeof( struct MIDIEventObserver ) );
+  MIDIPrecond( entry != NULL, ENOMEM );
+  entry->id       = id;
+  entry->observer = observer;
+  entry->target   = target;
+  entry->next     = NULL;
+  for( tail = &(bus->observers); *tail != NULL; tail = &((*tail)->next) );
+  *tail = entry;
+  bus->mask |= _mask( id );
+  return 0;
+}
+
+/**
+ * @brief Remove an observer.
+ * @public @memberof MIDIEventBus
+ * @param bus      The event bus.
+ * @param id       The event id the observer was registered for.
+ * @param observer The callback.
+ * @param target   The first argument of the callback.
+ * @retval 0 on success.
+ * @retval 1 if the observer was not registered.
+ */
+int MIDIEventBusUnsubscribe( struct MIDIEventBus * bus, size_t id, MIDIEventObserverFn * observer, void * target ) {
+  struct MIDIEventObserver ** entry, * found;
+  MIDIPrecond( bus != NULL, EFAULT );
+  for( entry = &(bus->observers); *entry != NULL; entry = &((*entry)->next) ) {
+    if( (*entry)->id == id && (*entry)->observer == observer && (*entry)->target == target ) break;
+  }
+  if( *entry == NULL ) return 1;
+  found  = *entry;
+  *entry = found->next;
+  free( found );
+  bus->mask = 0;
+  for( found = bus->observers; found != NULL; found = found->next ) {
+    bus->mask |= _mask( found->id );
+  }
+  return 0;
+}
+
+/**
+ * @brief Deliver an event to its observers.
+ * Call every observer that registered for the id of the event or for
+ * @c MIDI_EVENT_ANY. An observer may remove itself while it is called.
+ * @public @memberof MIDIEventBus
+ * @param bus   The event bus.
+ * @param event The event.
+ * @return the sum of the return values of all observers.
+ */
+int MIDIEventBusPost( struct MIDIEventBus * bus, struct MIDIEvent * event ) {
+  struct MIDIEventObserver * observer, * next;
+  int result = 0;
+  MIDIPrecond( bus != NULL, EFAULT );
+  MIDIPrecond( event != NULL, EINVAL );
+  if( ! MIDIEventBusObserves( bus, event->id ) ) return 0;
+  for( observer = bus->observers; observer != NULL; observer = next ) {
+    next = observer->next;
+    if( observer->id == event->id || observer->id == MIDI_EVENT_ANY ) {
+      result += (*observer->observer)( observer->target, event );
+    }
+  }
+  return result;
 }
 
 /** @} */
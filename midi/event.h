@@ -1,16 +1,41 @@
 #ifndef MIDIKIT_EVENT_H
 #define MIDIKIT_EVENT_H
+#include <stdarg.h>
 #include "type.h"
 
+#define MIDI_EVENT_ANY ((size_t) -1)
+
 struct MIDIEvent;
 extern struct MIDITypeSpec * MIDIEventType;
 
 struct MIDIEvent * MIDIEventCreate( size_t id, void * info, char * message, ... );
+struct MIDIEvent * MIDIEventCreateV( size_t id, void * info, char * message, va_list vargs );
 void MIDIEventDestroy( struct MIDIEvent * event );
 void MIDIEventRetain( struct MIDIEvent * event );
 void MIDIEventRelease( struct MIDIEvent * event );
 
+int MIDIEventGetId( struct MIDIEvent * event, size_t * id );
+int MIDIEventGetInfo( struct MIDIEvent * event, void ** info );
+int MIDIEventGetMessage( struct MIDIEvent * event, char ** message );
+
 int MIDIEventEncode( struct MIDIEvent * event, size_t size, void * buffer, size_t * written );
 int MIDIEventDecode( struct MIDIEvent * event, size_t size, void * buffer, size_t * read );
 
+typedef int MIDIEventObserverFn( void * target, struct MIDIEvent * event );
+
+struct MIDIEventObserver;
+
+struct MIDIEventBus {
+  unsigned long long mask;
+  struct MIDIEventObserver * observers;
+};
+
+#define MIDIEventBusObserves( bus, id ) ( (bus)->mask & ( 1ULL << ( (id) & 63 ) ) )
+
+int MIDIEventBusInit( struct MIDIEventBus * bus );
+int MIDIEventBusClear( struct MIDIEventBus * bus );
+int MIDIEventBusSubscribe( struct MIDIEventBus * bus, size_t id, MIDIEventObserverFn * observer, void * target );
+int MIDIEventBusUnsubscribe( struct MIDIEventBus * bus, size_t id, MIDIEventObserverFn * observer, void * target );
+int MIDIEventBusPost( struct MIDIEventBus * bus, struct MIDIEvent * event );
+
 #endif
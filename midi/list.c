@@ -124,7 +124,7 @@ void MIDIListDestroy( struct MIDIList * list ) {
  */
 void MIDIListRetain( struct MIDIList * list ) {
   MIDIPrecondReturn( list != NULL, EFAULT, (void)0 );
-  list->refs++;
+  MIDIRefRetain( list->refs );
 }
 
 /**
@@ -136,7 +136,7 @@ void MIDIListRetain( struct MIDIList * list ) {
  */
 void MIDIListRelease( struct MIDIList * list ) {
   MIDIPrecondReturn( list != NULL, EFAULT, (void)0 );
-  if( ! --list->refs ) {
+  if( ! MIDIRefRelease( list->refs ) ) {
     MIDIListDestroy( list );
   }
 }
@@ -0,0 +1,473 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "log.h"
+#include "midi.h"
+
+#define MIDI_FORMAT_SPEC_SIZE 32
+#define MIDI_LOG_TEXT_SIZE    512
+
+#define MIDI_FORMAT_ARG_INT       1
+#define MIDI_FORMAT_ARG_LONG      2
+#define MIDI_FORMAT_ARG_LONG_LONG 3
+#define MIDI_FORMAT_ARG_SIZE      4
+#define MIDI_FORMAT_ARG_DOUBLE    5
+#define MIDI_FORMAT_ARG_POINTER   6
+#define MIDI_FORMAT_ARG_STRING    7
+
+/**
+ * @ingroup MIDI
+ * @struct MIDIFormatArguments log.h
+ * @brief The arguments of a printf-style format, stored for later.
+ * Capturing the arguments is much cheaper than formatting them. Strings
+ * are copied to a small buffer, so the format can be printed after the
+ * strings went out of scope. Only int, long, long long, size_t, double,
+ * pointer and string arguments without variable field width or
+ * precision can be captured.
+ */
+
+/**
+ * @ingroup MIDI
+ * @struct MIDILogSite log.h
+ * @brief A call site of the logging macros.
+ * Every @c MIDILog and @c MIDILogLocation call has a static site that
+ * serves as location id of its records and counts the records of the
+ * current second to limit the rate of noisy call sites.
+ */
+
+/** @internal */
+struct MIDILogRecord {
+  struct MIDILogSite * site;
+  const char * format;
+  unsigned long suppressed;
+  struct MIDIFormatArguments arguments;
+};
+
+/**
+ * @internal
+ * A single producer, single consumer ring of log records. Each thread
+ * that logs owns one ring. Rings of finished threads are handed to the
+ * next thread that starts logging.
+ */
+struct MIDILogRing {
+  volatile size_t head;
+  volatile size_t tail;
+  volatile int owned;
+  unsigned long written;
+  unsigned long dropped;
+  struct MIDILogRing * next;
+  struct MIDILogRecord records[MIDI_LOG_RING_SIZE];
+};
+
+static struct MIDILogRing * volatile _rings = NULL;
+static MIDI_THREAD_LOCAL struct MIDILogRing * _ring = NULL;
+static unsigned long _suppressed = 0;
+
+static pthread_once_t _ring_once = PTHREAD_ONCE_INIT;
+static pthread_key_t _ring_key;
+static pthread_mutex_t _drain_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_t _thread;
+static volatile int _thread_running = 0;
+static volatile int _thread_stop = 0;
+static unsigned long _thread_interval = 0;
+
+/* MARK: Internals *//**
+ * @name Internals
+ * @cond INTERNALS
+ * Argument capture and the per-thread rings.
+ * @{
+ */
+
+/**
+ * @brief Find the conversion character of a conversion specification.
+ * @param f The character behind the '%'.
+ * @return a pointer to the conversion character.
+ */
+static const char * _conversion( const char * f ) {
+  f += strspn( f, "-+ #0" );
+  f += strspn( f, "0123456789." );
+  f += strspn( f, "hlz" );
+  return f;
+}
+
+/**
+ * @brief Release the ring of a finished thread.
+ * @param ring The ring.
+ */
+static void _ring_release( void * ring ) {
+  __sync_lock_release( &(((struct MIDILogRing *) ring)->owned) );
+}
+
+/**
+ * @brief Drain pending records when the program exits.
+ */
+static void _ring_exit( void ) {
+  MIDILogRingDrain( NULL );
+}
+
+/**
+ * @brief Create the ring key.
+ */
+static void _ring_init( void ) {
+  pthread_key_create( &_ring_key, &_ring_release );
+  atexit( &_ring_exit );
+}
+
+/**
+ * @brief Get the ring of the current thread.
+ * Reuse the ring of a finished thread or add a new ring.
+ * @return the ring, @c NULL if no ring could be allocated.
+ */
+static struct MIDILogRing * _ring_acquire( void ) {
+  struct MIDILogRing * ring;
+  if( _ring != NULL ) return _ring;
+  pthread_once( &_ring_once, &_ring_init );
+  for( ring = _rings; ring != NULL; ring = ring->next ) {
+    if( ring->owned == 0 && __sync_bool_compare_and_swap( &(ring->owned), 0, 1 ) ) break;
+  }
+  if( ring == NULL ) {
+    ring = malloc( sizeof( struct MIDILogRing ) );
+    if( ring == NULL ) return NULL;
+    ring->head    = 0;
+    ring->tail    = 0;
+    ring->owned   = 1;
+    ring->written = 0;
+    ring->dropped = 0;
+    do {
+      ring->next = _rings;
+    } while( ! __sync_bool_compare_and_swap( &_rings, ring->next, ring ) );
+  }
+  pthread_setspecific( _ring_key, ring );
+  _ring = ring;
+  return ring;
+}
+
+/**
+ * @brief Check the rate limit of a call site.
+ * @param site The call site.
+ * @retval 0 if the record may be written.
+ * @retval 1 if the site exceeded its rate.
+ */
+static int _site_limit( struct MIDILogSite * site ) {
+  unsigned long now = (unsigned long) time( NULL );
+  if( site->window != now ) {
+    site->window = now;
+    site->count  = 0;
+  }
+  if( __sync_add_and_fetch( &(site->count), 1 ) > MIDI_LOG_RATE_LIMIT ) {
+    __sync_fetch_and_add( &(site->suppressed), 1 );
+    __sync_fetch_and_add( &_suppressed, 1 );
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Format a record and pass it to the logger.
+ * @param record The record.
+ */
+static void _record_print( struct MIDILogRecord * record ) {
+  char text[MIDI_LOG_TEXT_SIZE];
+  struct MIDILogSite * site = record->site;
+  size_t length = 0;
+  if( MIDILogger == NULL ) return;
+  if( record->suppressed > 0 ) {
+    (*MIDILogger)( site->channel, "%s:%i: %lu messages suppressed\n", site->file, site->line, record->suppressed );
+  }
+  if( site->location ) {
+    length = snprintf( &(text[0]), sizeof(text), "%s:%i: ", site->file, site->line );
+    if( length >= sizeof(text) ) length = sizeof(text) - 1;
+  }
+  if( record->format != NULL ) {
+    MIDIFormatArgumentsPrint( &(record->arguments), record->format, &(text[length]), sizeof(text) - length );
+  } else {
+    snprintf( &(text[length]), sizeof(text) - length, "%s", &(record->arguments.strings[0]) );
+  }
+  (*MIDILogger)( site->channel, "%s", &(text[0]) );
+}
+
+/**
+ * @brief Background drain.
+ * @param info Unused.
+ */
+static void * _log_thread( void * info ) {
+  struct timespec ts;
+  ts.tv_sec  = _thread_interval / 1000000;
+  ts.tv_nsec = ( _thread_interval % 1000000 ) * 1000;
+  while( ! _thread_stop ) {
+    MIDILogRingDrain( NULL );
+    nanosleep( &ts, NULL );
+  }
+  MIDILogRingDrain( NULL );
+  return NULL;
+}
+
+/** @} @endcond */
+
+/* MARK: -
+ * MARK: Deferred formatting *//**
+ * @name Deferred formatting
+ * Capturing printf-style arguments and formatting them later.
+ * @{
+ */
+
+/**
+ * @brief Capture the arguments of a format.
+ * @public @memberof MIDIFormatArguments
+ * @param arguments The arguments to fill.
+ * @param format    The format.
+ * @param vargs     The arguments of the format.
+ * @retval 0 on success.
+ * @retval 1 if the arguments can not be captured.
+ */
+int MIDIFormatArgumentsCapture( struct MIDIFormatArguments * arguments, const char * format, va_list vargs ) {
+  struct MIDIFormatArgument * arg;
+  const char * f, * c, * s;
+  size_t n;
+  int longs;
+  arguments->nargs = 0;
+  arguments->strings_length = 0;
+  for( f = strchr( format, '%' ); f != NULL; f = strchr( f, '%' ) ) {
+    if( f[1] == '%' ) {
+      f += 2;
+      continue;
+    }
+    c = _conversion( f + 1 );
+    if( c - f + 1 >= MIDI_FORMAT_SPEC_SIZE || arguments->nargs >= MIDI_FORMAT_MAX_ARGS ) return 1;
+    for( longs = 0, s = f; s < c; s++ ) {
+      if( *s == 'l' ) longs++;
+      if( *s == 'z' ) longs = -1;
+    }
+    arg = &(arguments->args[arguments->nargs++]);
+    switch( *c ) {
+      case 'd': case 'i': case 'o': case 'u': case 'x': case 'X': case 'c':
+        if( longs < 0 ) {
+          arg->type    = MIDI_FORMAT_ARG_SIZE;
+          arg->value.z = va_arg( vargs, size_t );
+        } else if( longs == 0 ) {
+          arg->type    = MIDI_FORMAT_ARG_INT;
+          arg->value.i = va_arg( vargs, int );
+        } else if( longs == 1 ) {
+          arg->type    = MIDI_FORMAT_ARG_LONG;
+          arg->value.l = va_arg( vargs, long );
+        } else {
+          arg->type     = MIDI_FORMAT_ARG_LONG_LONG;
+          arg->value.ll = va_arg( vargs, long long );
+        }
+        break;
+      case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+        arg->type    = MIDI_FORMAT_ARG_DOUBLE;
+        arg->value.d = va_arg( vargs, double );
+        break;
+      case 'p':
+        arg->type    = MIDI_FORMAT_ARG_POINTER;
+        arg->value.p = va_arg( vargs, void * );
+        break;
+      case 's':
+        if( longs != 0 ) return 1;
+        s = va_arg( vargs, char * );
+        if( s == NULL ) s = "(null)";
+        n = strlen( s ) + 1;
+        if( arguments->strings_length + n > MIDI_FORMAT_STRING_SIZE ) return 1;
+        arg->type    = MIDI_FORMAT_ARG_STRING;
+        arg->value.s = arguments->strings_length;
+        memcpy( &(arguments->strings[arguments->strings_length]), s, n );
+        arguments->strings_length += n;
+        break;
+      default:
+        return 1;
+    }
+    f = c + 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Format captured arguments.
+ * Behaves like snprintf: at most @c size bytes including the terminating
+ * zero are written.
+ * @public @memberof MIDIFormatArguments
+ * @param arguments The captured arguments.
+ * @param format    The format the arguments were captured with.
+ * @param buffer    The buffer to write to. May be @c NULL if @c size is zero.
+ * @param size      The size of the buffer.
+ * @return the length of the complete text.
+ */
+size_t MIDIFormatArgumentsPrint( struct MIDIFormatArguments * arguments, const char * format, char * buffer, size_t size ) {
+  struct MIDIFormatArgument * arg = &(arguments->args[0]);
+  char spec[MIDI_FORMAT_SPEC_SIZE];
+  const char * f = format, * c;
+  size_t length = 0, remaining;
+  char * out;
+  int r = 0;
+  while( *f != '\0' ) {
+    if( *f != '%' || f[1] == '%' ) {
+      if( length + 1 < size ) buffer[length] = *f;
+      length++;
+      f += ( *f == '%' ) ? 2 : 1;
+      continue;
+    }
+    c = _conversion( f + 1 );
+    memcpy( &(spec[0]), f, c - f + 1 );
+    spec[c - f + 1] = '\0';
+    out       = ( length < size ) ? buffer + length : NULL;
+    remaining = ( length < size ) ? size - length : 0;
+    switch( arg->type ) {
+      case MIDI_FORMAT_ARG_INT:       r = snprintf( out, remaining, spec, arg->value.i ); break;
+      case MIDI_FORMAT_ARG_LONG:      r = snprintf( out, remaining, spec, arg->value.l ); break;
+      case MIDI_FORMAT_ARG_LONG_LONG: r = snprintf( out, remaining, spec, arg->value.ll ); break;
+      case MIDI_FORMAT_ARG_SIZE:      r = snprintf( out, remaining, spec, arg->value.z ); break;
+      case MIDI_FORMAT_ARG_DOUBLE:    r = snprintf( out, remaining, spec, arg->value.d ); break;
+      case MIDI_FORMAT_ARG_POINTER:   r = snprintf( out, remaining, spec, arg->value.p ); break;
+      case MIDI_FORMAT_ARG_STRING:    r = snprintf( out, remaining, spec, &(arguments->strings[arg->value.s]) ); break;
+    }
+    if( r > 0 ) length += r;
+    arg++;
+    f = c + 1;
+  }
+  if( size > 0 ) buffer[ ( length < size ) ? length : size - 1 ] = '\0';
+  return length;
+}
+
+/** @} */
+
+/* MARK: -
+ * MARK: Log rings *//**
+ * @name Log rings
+ * A logging backend that keeps formatting and I/O off the hot path.
+ * Define @c USE_LOG_RING to let @c MIDILog and @c MIDILogLocation write
+ * binary records (call site, format and captured arguments) to a ring
+ * of the calling thread instead of calling the logger. The records are
+ * formatted and passed to @c MIDILogger when the rings are drained,
+ * either on demand with @c MIDILogRingDrain or periodically by a
+ * background thread. Records are dropped when a ring is full and call
+ * sites that log more than @c MIDI_LOG_RATE_LIMIT records per second
+ * are throttled; the number of suppressed records is logged with the
+ * next record of the site. Pending records are drained when the
+ * program exits.
+ * @{
+ */
+
+/**
+ * @brief Write a log record.
+ * Capture the arguments and append a record to the ring of the calling
+ * thread. The format has to stay valid until the record was drained,
+ * so it should be a string literal. Formats with arguments that can not
+ * be captured are formatted immediately.
+ * @param site   The call site.
+ * @param format The message format.
+ * @param ...    The data to be filled into the message format placeholders.
+ * @retval 0 on success.
+ * @retval 1 if the record was suppressed or dropped.
+ */
+int MIDILogRingWrite( struct MIDILogSite * site, const char * format, ... ) {
+  struct MIDILogRing * ring;
+  struct MIDILogRecord * record;
+  va_list vargs;
+  int result;
+  MIDIPrecond( site != NULL, EFAULT );
+  MIDIPrecond( format != NULL, EINVAL );
+  if( _site_limit( site ) ) return 1;
+  ring = _ring_acquire();
+  if( ring == NULL ) return 1;
+  if( ring->head - ring->tail >= MIDI_LOG_RING_SIZE ) {
+    ring->dropped++;
+    return 1;
+  }
+  record = &(ring->records[ring->head % MIDI_LOG_RING_SIZE]);
+  record->site       = site;
+  record->format     = format;
+  record->suppressed = ( site->suppressed > 0 ) ? __sync_lock_test_and_set( &(site->suppressed), 0 ) : 0;
+  va_start( vargs, format );
+  result = MIDIFormatArgumentsCapture( &(record->arguments), format, vargs );
+  va_end( vargs );
+  if( result ) {
+    va_start( vargs, format );
+    vsnprintf( &(record->arguments.strings[0]), MIDI_FORMAT_STRING_SIZE, format, vargs );
+    va_end( vargs );
+    record->format = NULL;
+  }
+  ring->written++;
+  __sync_synchronize();
+  ring->head++;
+  return 0;
+}
+
+/**
+ * @brief Format and log all pending records.
+ * Rings are drained one after another, so records of different threads
+ * may be logged out of order.
+ * @param count The number of records that were drained. May be @c NULL.
+ * @retval 0 on success.
+ */
+int MIDILogRingDrain( size_t * count ) {
+  struct MIDILogRing * ring;
+  size_t n = 0, head;
+  pthread_mutex_lock( &_drain_mutex );
+  for( ring = _rings; ring != NULL; ring = ring->next ) {
+    head = ring->head;
+    __sync_synchronize();
+    while( ring->tail != head ) {
+      _record_print( &(ring->records[ring->tail % MIDI_LOG_RING_SIZE]) );
+      __sync_synchronize();
+      ring->tail++;
+      n++;
+    }
+  }
+  pthread_mutex_unlock( &_drain_mutex );
+  if( count != NULL ) *count = n;
+  return 0;
+}
+
+/**
+ * @brief Get the number of written, dropped and suppressed records.
+ * @param stats The stats.
+ * @retval 0 on success.
+ */
+int MIDILogRingGetStats( struct MIDILogRingStats * stats ) {
+  struct MIDILogRing * ring;
+  MIDIPrecond( stats != NULL, EINVAL );
+  stats->written    = 0;
+  stats->dropped    = 0;
+  stats->suppressed = _suppressed;
+  for( ring = _rings; ring != NULL; ring = ring->next ) {
+    stats->written += ring->written;
+    stats->dropped += ring->dropped;
+  }
+  return 0;
+}
+
+/**
+ * @brief Start a thread that drains the rings periodically.
+ * @param interval The time between two drains in microseconds.
+ * @retval 0 on success.
+ * @retval >0 if the thread could not be started.
+ */
+int MIDILogRingStartThread( unsigned long interval ) {
+  MIDIPrecond( interval > 0, EINVAL );
+  MIDIPrecond( _thread_running == 0, EBUSY );
+  _thread_interval = interval;
+  _thread_stop     = 0;
+  if( pthread_create( &_thread, NULL, &_log_thread, NULL ) ) return 1;
+  _thread_running  = 1;
+  return 0;
+}
+
+/**
+ * @brief Stop the drain thread.
+ * The rings are drained once more before the thread exits.
+ * @retval 0 on success.
+ * @retval 1 if no thread was running.
+ */
+int MIDILogRingStopThread( void ) {
+  if( ! _thread_running ) return 1;
+  _thread_stop = 1;
+  pthread_join( _thread, NULL );
+  _thread_running = 0;
+  return 0;
+}
+
+/** @} */
@@ -0,0 +1,77 @@
+#ifndef MIDIKIT_MIDI_LOG_H
+#define MIDIKIT_MIDI_LOG_H
+#include <stddef.h>
+#include <stdarg.h>
+
+#define MIDI_FORMAT_MAX_ARGS    8
+#define MIDI_FORMAT_STRING_SIZE 128
+
+/**
+ * @brief Number of records in the log ring of each thread.
+ */
+#ifndef MIDI_LOG_RING_SIZE
+#define MIDI_LOG_RING_SIZE 256
+#endif
+
+/**
+ * @brief Maximum number of records per call site and second.
+ */
+#ifndef MIDI_LOG_RATE_LIMIT
+#define MIDI_LOG_RATE_LIMIT 64
+#endif
+
+struct MIDIFormatArgument {
+  int type;
+  union {
+    int i;
+    long l;
+    long long ll;
+    size_t z;
+    double d;
+    void * p;
+    size_t s;
+  } value;
+};
+
+struct MIDIFormatArguments {
+  size_t nargs;
+  struct MIDIFormatArgument args[MIDI_FORMAT_MAX_ARGS];
+  size_t strings_length;
+  char strings[MIDI_FORMAT_STRING_SIZE];
+};
+
+int MIDIFormatArgumentsCapture( struct MIDIFormatArguments * arguments, const char * format, va_list vargs );
+size_t MIDIFormatArgumentsPrint( struct MIDIFormatArguments * arguments, const char * format, char * buffer, size_t size );
+
+struct MIDILogSite {
+  int channel;
+  const char * file;
+  int line;
+  int location;
+  volatile unsigned long window;
+  volatile unsigned int count;
+  volatile unsigned long suppressed;
+};
+
+#ifdef SUBDIR
+#define MIDI_LOG_SITE_INIT( channel, location ) \
+{ (channel), SUBDIR "/" __FILE__, __LINE__, (location), 0, 0, 0 }
+#else
+#define MIDI_LOG_SITE_INIT( channel, location ) \
+{ (channel), __FILE__, __LINE__, (location), 0, 0, 0 }
+#endif
+
+struct MIDILogRingStats {
+  unsigned long written;
+  unsigned long dropped;
+  unsigned long suppressed;
+};
+
+int MIDILogRingWrite( struct MIDILogSite * site, const char * format, ... );
+int MIDILogRingDrain( size_t * count );
+int MIDILogRingGetStats( struct MIDILogRingStats * stats );
+
+int MIDILogRingStartThread( unsigned long interval );
+int MIDILogRingStopThread( void );
+
+#endif
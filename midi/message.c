@@ -1,6 +1,16 @@
 #include <stdlib.h>
+#include <string.h>
 #include "message.h"
 #include "message_format.h"
+#include "trace.h"
+#include "util.h"
+
+/**
+ * @brief Capacity of the largest SysEx buffer a message pool keeps.
+ * Larger buffers are freed when they are released, so that a single
+ * bulk dump does not pin its memory in the pool.
+ */
+#define MIDI_MESSAGE_POOL_SYSEX_SIZE 65536
 
 /**
  * @ingroup MIDI
@@ -13,9 +23,71 @@ struct MIDIMessage {
  * @cond INTERNALS
  */
   int    refs;
+  int    local;
   struct MIDIMessageFormat * format;
   struct MIDIMessageData data;
   MIDITimestamp timestamp;
+  struct MIDIMessagePool * pool;
+  struct MIDIMessage     * next;
+  struct MIDISysExBuffer * sysex;
+/** @endcond */
+};
+
+/**
+ * @ingroup MIDI
+ * @struct MIDIMessagePool message.h
+ * @brief Preallocated storage for MIDIMessage objects.
+ * A message pool holds a fixed number of message structures in a single
+ * slab. Messages created from the pool are handed back to the pool when
+ * their reference count drops to zero, so a busy receive path does not
+ * have to go through the system allocator for every message.
+ * Messages may be created by one thread only, but they may be released
+ * from any thread. Released messages are pushed onto a lock-free list
+ * that is taken over as a whole by the creating thread once its own
+ * list runs dry.
+ */
+struct MIDIMessagePool {
+/**
+ * @privatesection
+ * @cond INTERNALS
+ */
+  int    refs;
+  size_t capacity;
+  struct MIDIMessage * slab;
+  struct MIDIMessage * local;
+  struct MIDIMessage * volatile shared;
+  size_t volatile in_use;
+  size_t hits;
+  size_t misses;
+  size_t high_water;
+  struct MIDISysExBuffer * sysex_local;
+  struct MIDISysExBuffer * volatile sysex_shared;
+/** @endcond */
+};
+
+/**
+ * @ingroup MIDI
+ * @struct MIDISysExBuffer message.h
+ * @brief Shared storage for system exclusive payloads.
+ * A SysEx buffer holds the payload of a (possibly very large) system
+ * exclusive message. Any number of messages can reference slices of
+ * the same buffer, so a dump can be split into segments and sent to
+ * several ports without copying the payload. The buffer is freed when
+ * the last reference is released, which may happen on any thread.
+ * Buffers created from a MIDIMessagePool go back to the pool instead
+ * and keep the capacity they grew to.
+ */
+struct MIDISysExBuffer {
+/**
+ * @privatesection
+ * @cond INTERNALS
+ */
+  int volatile refs;
+  size_t size;
+  size_t capacity;
+  struct MIDIMessagePool * pool;
+  struct MIDISysExBuffer * next;
+  unsigned char data[1];
 /** @endcond */
 };
 
@@ -42,6 +114,141 @@ static void _check_release_data( struct MIDIMessage * message ) {
     free( message->data.data );
     message->data.data = NULL;
   }
+  if( message->sysex != NULL ) {
+    MIDISysExBufferRelease( message->sysex );
+    message->sysex     = NULL;
+    message->data.data = NULL;
+  }
+}
+
+/**
+ * @brief Initialize a message structure.
+ * Reset the contents of a freshly allocated or recycled message.
+ * @private @memberof MIDIMessage
+ * @param message The message.
+ * @param format  The message format or @c NULL.
+ * @param status  The message status to be used for initialization.
+ */
+static void _message_init( struct MIDIMessage * message, struct MIDIMessageFormat * format, MIDIStatus status ) {
+  int i;
+  message->refs   = 1;
+  message->local  = 0;
+  message->format = format;
+  /* clear the status byte too, setting the status keeps the channel */
+  for( i=0; i<MIDI_MESSAGE_DATA_BYTES; i++ ) {
+    message->data.bytes[i] = 0;
+  }
+  message->data.size = 0;
+  message->data.data = NULL;
+  message->next      = NULL;
+  message->sysex     = NULL;
+  if( status != 0 ) {
+    MIDIMessageSetStatus( message, status );
+  }
+  MIDIMessageSetTimestamp( message, 0 );
+}
+
+/**
+ * @brief Take a message from a pool.
+ * Pop a message off the pool's local free list. If the local list is
+ * empty, take over all messages that were released in the meantime.
+ * @private @memberof MIDIMessagePool
+ * @param pool The pool.
+ * @return a pointer to an unused message structure.
+ * @return a @c NULL pointer if the pool is exhausted.
+ */
+static struct MIDIMessage * _pool_take( struct MIDIMessagePool * pool ) {
+  struct MIDIMessage * message;
+  size_t in_use;
+  if( pool->local == NULL ) {
+    pool->local = __sync_lock_test_and_set( &(pool->shared), NULL );
+    if( pool->local == NULL ) return NULL;
+  }
+  message     = pool->local;
+  pool->local = message->next;
+  in_use = __sync_add_and_fetch( &(pool->in_use), 1 );
+  if( in_use > pool->high_water ) pool->high_water = in_use;
+  return message;
+}
+
+/**
+ * @brief Return a message to its pool.
+ * Push the message onto the pool's shared free list. This may be
+ * called from any thread.
+ * @private @memberof MIDIMessagePool
+ * @param pool    The pool.
+ * @param message The message.
+ */
+static void _pool_give( struct MIDIMessagePool * pool, struct MIDIMessage * message ) {
+  struct MIDIMessage * head;
+  do {
+    head = pool->shared;
+    message->next = head;
+  } while( ! __sync_bool_compare_and_swap( &(pool->shared), head, message ) );
+  __sync_sub_and_fetch( &(pool->in_use), 1 );
+}
+
+/**
+ * @brief Return a thread-local message to its pool.
+ * Push the message onto the pool's local free list. This may only be
+ * called from the thread that creates messages from the pool.
+ * @private @memberof MIDIMessagePool
+ * @param pool    The pool.
+ * @param message The message.
+ */
+static void _pool_give_local( struct MIDIMessagePool * pool, struct MIDIMessage * message ) {
+  message->next = pool->local;
+  pool->local   = message;
+  __sync_sub_and_fetch( &(pool->in_use), 1 );
+}
+
+/**
+ * @brief Take a SysEx buffer from a pool.
+ * Like _pool_take, but for the buffers that were released to the pool.
+ * @private @memberof MIDIMessagePool
+ * @param pool The pool.
+ * @return a pointer to an unused buffer structure.
+ * @return a @c NULL pointer if no buffer was released to the pool.
+ */
+static struct MIDISysExBuffer * _pool_take_sysex( struct MIDIMessagePool * pool ) {
+  struct MIDISysExBuffer * buffer;
+  if( pool->sysex_local == NULL ) {
+    pool->sysex_local = __sync_lock_test_and_set( &(pool->sysex_shared), NULL );
+    if( pool->sysex_local == NULL ) return NULL;
+  }
+  buffer = pool->sysex_local;
+  pool->sysex_local = buffer->next;
+  return buffer;
+}
+
+/**
+ * @brief Return a SysEx buffer to its pool.
+ * Push the buffer onto the pool's shared list of buffers. This may be
+ * called from any thread.
+ * @private @memberof MIDIMessagePool
+ * @param pool   The pool.
+ * @param buffer The buffer.
+ */
+static void _pool_give_sysex( struct MIDIMessagePool * pool, struct MIDISysExBuffer * buffer ) {
+  struct MIDISysExBuffer * head;
+  do {
+    head = pool->sysex_shared;
+    buffer->next = head;
+  } while( ! __sync_bool_compare_and_swap( &(pool->sysex_shared), head, buffer ) );
+}
+
+/**
+ * @brief Free a list of SysEx buffers.
+ * @private @memberof MIDIMessagePool
+ * @param buffer The first buffer of the list.
+ */
+static void _pool_free_sysex( struct MIDISysExBuffer * buffer ) {
+  struct MIDISysExBuffer * next;
+  while( buffer != NULL ) {
+    next = buffer->next;
+    free( buffer );
+    buffer = next;
+  }
 }
 
 /**
@@ -67,8 +274,6 @@ static void _check_release_data( struct MIDIMessage * message ) {
 struct MIDIMessage * MIDIMessageCreate( MIDIStatus status ) {
   struct MIDIMessage * message;
   struct MIDIMessageFormat * format = NULL;
-  MIDITimestamp timestamp = 0;
-  int i;
 
   if( status != 0 ) {
     format = MIDIMessageFormatForStatus( status );
@@ -79,17 +284,63 @@ struct MIDIMessage * MIDIMessageCreate( MIDIStatus status ) {
   message = malloc( sizeof( struct MIDIMessage ) );
   MIDIPrecondReturn( message != NULL, ENOMEM, NULL );
 
-  message->refs   = 1;
-  message->format = format;
-  for( i=1; i<MIDI_MESSAGE_DATA_BYTES; i++ ) {
-    message->data.bytes[i] = 0;
-  }
-  message->data.size = 0;
-  message->data.data = NULL;
+  message->pool = NULL;
+  _message_init( message, format, status );
+  return message;
+}
+
+/**
+ * @brief Create a MIDIMessage instance from a pool.
+ * Take a message from the given pool and initialize it. If the pool is
+ * exhausted, fall back to allocating the message on the heap.
+ * The message is returned to the pool when it is destroyed.
+ * @public @memberof MIDIMessage
+ * @param pool   The pool to take the message from. May be @c NULL.
+ * @param status The message status to be used for initialization.
+ * @return a pointer to the created message structure on success.
+ * @return a @c NULL pointer if the message could not created.
+ */
+struct MIDIMessage * MIDIMessageCreateFromPool( struct MIDIMessagePool * pool, MIDIStatus status ) {
+  struct MIDIMessage * message;
+  struct MIDIMessageFormat * format = NULL;
+
+  if( pool == NULL ) return MIDIMessageCreate( status );
   if( status != 0 ) {
-    MIDIMessageSetStatus( message, status );
+    format = MIDIMessageFormatForStatus( status );
+    if( format == NULL ) {
+      return NULL;
+    }
+  }
+  message = _pool_take( pool );
+  if( message == NULL ) {
+    pool->misses++;
+    return MIDIMessageCreate( status );
   }
-  MIDIMessageSetTimestamp( message, timestamp );
+  pool->hits++;
+
+  MIDIMessagePoolRetain( pool );
+  message->pool = pool;
+  _message_init( message, format, status );
+  return message;
+}
+
+/**
+ * @brief Create a single-owner MIDIMessage instance from a pool.
+ * Like MIDIMessageCreateFromPool, but the message must never be
+ * passed to another thread. Its reference count is not updated
+ * atomically, even in builds with @c USE_ATOMIC_REFS, and it goes
+ * straight back to the pool's local free list when it is destroyed.
+ * Use this for messages that are created, dispatched and released
+ * within one receive callback.
+ * @public @memberof MIDIMessage
+ * @param pool   The pool to take the message from. May be @c NULL.
+ * @param status The message status to be used for initialization.
+ * @return a pointer to the created message structure on success.
+ * @return a @c NULL pointer if the message could not created.
+ */
+struct MIDIMessage * MIDIMessageCreateLocal( struct MIDIMessagePool * pool, MIDIStatus status ) {
+  struct MIDIMessage * message = MIDIMessageCreateFromPool( pool, status );
+  if( message != NULL ) message->local = 1;
   return message;
 }
 
@@ -100,9 +351,22 @@ struct MIDIMessage * MIDIMessageCreate( MIDIStatus status ) {
  * @param message The message.
  */
 void MIDIMessageDestroy( struct MIDIMessage * message ) {
+  struct MIDIMessagePool * pool;
   MIDIPrecondReturn( message != NULL, EFAULT, (void)0 );
-  if( message->data.data != NULL && ( message->data.bytes[3] & 1 ) ) free( message->data.data );
-  free( message );
+  MIDITraceFinish( message );
+  _check_release_data( message );
+  pool = message->pool;
+  if( pool != NULL ) {
+    message->pool = NULL;
+    if( message->local ) {
+      _pool_give_local( pool, message );
+    } else {
+      _pool_give( pool, message );
+    }
+    MIDIMessagePoolRelease( pool );
+  } else {
+    free( message );
+  }
 }
 
 /**
@@ -113,7 +377,11 @@ void MIDIMessageDestroy( struct MIDIMessage * message ) {
  */
 void MIDIMessageRetain( struct MIDIMessage * message ) {
   MIDIPrecondReturn( message != NULL, EFAULT, (void)0 );
-  message->refs++;
+  if( message->local ) {
+    message->refs++;
+  } else {
+    MIDIRefRetain( message->refs );
+  }
 }
 
 /**
@@ -125,13 +393,358 @@ void MIDIMessageRetain( struct MIDIMessage * message ) {
  */
 void MIDIMessageRelease( struct MIDIMessage * message ) {
   MIDIPrecondReturn( message != NULL, EFAULT, (void)0 );
-  if( ! --message->refs ) {
+  if( message->local ? ! --message->refs : ! MIDIRefRelease( message->refs ) ) {
     MIDIMessageDestroy( message );
   }
 }
 
 /** @} */
 
+/* MARK: SysEx buffers *//**
+ * @name SysEx buffers
+ * Creating and reference counting of MIDISysExBuffer objects and
+ * referencing them from messages.
+ * @{
+ */
+
+/**
+ * @brief Create a MIDISysExBuffer instance.
+ * Allocate a buffer of @c size bytes. If @c data is given it is copied
+ * into the buffer, otherwise the buffer can be filled in place.
+ * @public @memberof MIDISysExBuffer
+ * @param size The size of the payload.
+ * @param data The payload or @c NULL.
+ * @return a pointer to the created buffer structure on success.
+ * @return a @c NULL pointer if the buffer could not created.
+ */
+struct MIDISysExBuffer * MIDISysExBufferCreate( size_t size, void * data ) {
+  struct MIDISysExBuffer * buffer = malloc( sizeof( struct MIDISysExBuffer ) + size );
+  MIDIPrecondReturn( buffer != NULL, ENOMEM, NULL );
+  buffer->refs     = 1;
+  buffer->size     = size;
+  buffer->capacity = size;
+  buffer->pool     = NULL;
+  buffer->next     = NULL;
+  if( data != NULL && size > 0 ) {
+    memcpy( &(buffer->data[0]), data, size );
+  }
+  return buffer;
+}
+
+/**
+ * @brief Create a MIDISysExBuffer instance from a pool.
+ * Reuse a buffer that was released to the given pool and grow it to
+ * @c size bytes if necessary. If the pool holds no buffer, allocate a
+ * new one that goes back to the pool when it is destroyed. The payload
+ * is not initialized. Like messages, buffers may be created from a pool
+ * by one thread only.
+ * @public @memberof MIDISysExBuffer
+ * @param pool The pool to take the buffer from. May be @c NULL.
+ * @param size The size of the payload.
+ * @return a pointer to the created buffer structure on success.
+ * @return a @c NULL pointer if the buffer could not created.
+ */
+struct MIDISysExBuffer * MIDISysExBufferCreateFromPool( struct MIDIMessagePool * pool, size_t size ) {
+  struct MIDISysExBuffer * buffer, * grown;
+
+  if( pool == NULL ) return MIDISysExBufferCreate( size, NULL );
+  buffer = _pool_take_sysex( pool );
+  if( buffer == NULL ) {
+    buffer = MIDISysExBufferCreate( size, NULL );
+    if( buffer == NULL ) return NULL;
+  } else if( buffer->capacity < size ) {
+    grown = realloc( buffer, sizeof( struct MIDISysExBuffer ) + size );
+    if( grown == NULL ) {
+      free( buffer );
+      MIDIError( ENOMEM, "Could not grow pooled SysEx buffer." );
+      return NULL;
+    }
+    buffer = grown;
+    buffer->capacity = size;
+  }
+
+  MIDIMessagePoolRetain( pool );
+  buffer->refs = 1;
+  buffer->size = size;
+  buffer->pool = pool;
+  buffer->next = NULL;
+  return buffer;
+}
+
+/**
+ * @brief Destroy a MIDISysExBuffer instance.
+ * Buffers that were created from a pool are handed back to it.
+ * @public @memberof MIDISysExBuffer
+ * @param buffer The buffer.
+ */
+void MIDISysExBufferDestroy( struct MIDISysExBuffer * buffer ) {
+  struct MIDIMessagePool * pool;
+  MIDIPrecondReturn( buffer != NULL, EFAULT, (void)0 );
+  pool = buffer->pool;
+  if( pool != NULL && buffer->capacity <= MIDI_MESSAGE_POOL_SYSEX_SIZE ) {
+    buffer->pool = NULL;
+    _pool_give_sysex( pool, buffer );
+  } else {
+    free( buffer );
+  }
+  if( pool != NULL ) MIDIMessagePoolRelease( pool );
+}
+
+/**
+ * @brief Retain a MIDISysExBuffer instance.
+ * @public @memberof MIDISysExBuffer
+ * @param buffer The buffer.
+ */
+void MIDISysExBufferRetain( struct MIDISysExBuffer * buffer ) {
+  MIDIPrecondReturn( buffer != NULL, EFAULT, (void)0 );
+  __sync_add_and_fetch( &(buffer->refs), 1 );
+}
+
+/**
+ * @brief Release a MIDISysExBuffer instance.
+ * Destroy the buffer when the last reference is released. This may be
+ * called from any thread.
+ * @public @memberof MIDISysExBuffer
+ * @param buffer The buffer.
+ */
+void MIDISysExBufferRelease( struct MIDISysExBuffer * buffer ) {
+  MIDIPrecondReturn( buffer != NULL, EFAULT, (void)0 );
+  if( ! __sync_sub_and_fetch( &(buffer->refs), 1 ) ) {
+    MIDISysExBufferDestroy( buffer );
+  }
+}
+
+/**
+ * @brief Get the payload of a buffer.
+ * @public @memberof MIDISysExBuffer
+ * @param buffer The buffer.
+ * @param size   The size of the payload.
+ * @param data   The payload.
+ * @retval 0 on success.
+ */
+int MIDISysExBufferGetData( struct MIDISysExBuffer * buffer, size_t * size, void ** data ) {
+  MIDIPrecond( buffer != NULL, EFAULT );
+  if( size != NULL ) *size = buffer->size;
+  if( data != NULL ) *data = &(buffer->data[0]);
+  return 0;
+}
+
+/**
+ * @brief Set the size of a buffer's payload.
+ * Shrink the payload or grow it within the allocated capacity, e.g. to
+ * reuse a buffer. The payload must not be referenced by anyone else.
+ * @public @memberof MIDISysExBuffer
+ * @param buffer The buffer.
+ * @param size   The new size.
+ * @retval 0  on success.
+ * @retval >0 if the size could not be set.
+ */
+int MIDISysExBufferSetSize( struct MIDISysExBuffer * buffer, size_t size ) {
+  MIDIPrecond( buffer != NULL, EFAULT );
+  MIDIPrecond( buffer->refs == 1, EINVAL );
+  MIDIPrecond( size <= buffer->capacity, EINVAL );
+  buffer->size = size;
+  return 0;
+}
+
+/**
+ * @brief Append data to a buffer.
+ * Grow the buffer if necessary. Growing doubles the capacity, so the
+ * buffer may move and @c buffer is updated. The payload must not be
+ * referenced by anyone else.
+ * @public @memberof MIDISysExBuffer
+ * @param buffer A pointer to the buffer.
+ * @param size   The number of bytes to append.
+ * @param data   The bytes to append.
+ * @retval 0  on success.
+ * @retval >0 if the data could not be appended.
+ */
+int MIDISysExBufferAppend( struct MIDISysExBuffer ** buffer, size_t size, void * data ) {
+  struct MIDISysExBuffer * b;
+  size_t capacity;
+  MIDIPrecond( buffer != NULL && *buffer != NULL, EFAULT );
+  MIDIPrecond( data != NULL || size == 0, EINVAL );
+  b = *buffer;
+  MIDIPrecond( b->refs == 1, EINVAL );
+
+  if( b->size + size > b->capacity ) {
+    capacity = ( b->capacity > 0 ) ? b->capacity * 2 : 64;
+    while( capacity < b->size + size ) capacity *= 2;
+    b = realloc( b, sizeof( struct MIDISysExBuffer ) + capacity );
+    MIDIPrecond( b != NULL, ENOMEM );
+    b->capacity = capacity;
+    *buffer = b;
+  }
+  if( size > 0 ) {
+    memcpy( &(b->data[b->size]), data, size );
+    b->size += size;
+  }
+  return 0;
+}
+
+/**
+ * @brief Reference a slice of a buffer as system exclusive data.
+ * Let the data of a system exclusive message point to @c size bytes of
+ * the buffer starting at @c offset. The payload is not copied, the
+ * message keeps a reference to the buffer instead. The manufacturer id
+ * and fragment number are not changed.
+ * @public @memberof MIDIMessage
+ * @param message The message.
+ * @param buffer  The buffer.
+ * @param offset  The offset of the slice.
+ * @param size    The size of the slice.
+ * @retval 0  on success.
+ * @retval >0 if the slice could not be set.
+ */
+int MIDIMessageSetSysExBuffer( struct MIDIMessage * message, struct MIDISysExBuffer * buffer,
+                               size_t offset, size_t size ) {
+  MIDIPrecond( message != NULL, EFAULT );
+  MIDIPrecond( buffer != NULL, EINVAL );
+  MIDIPrecond( message->format != NULL && message->data.bytes[0] == MIDI_STATUS_SYSTEM_EXCLUSIVE, EINVAL );
+  if( offset > buffer->size || size > buffer->size - offset ) {
+    MIDIError( EINVAL, "Slice reaches past the end of the buffer." );
+    return EINVAL;
+  }
+
+  MIDISysExBufferRetain( buffer );
+  _check_release_data( message );
+  message->sysex = buffer;
+  message->data.bytes[3] &= ~1;
+  message->data.data = &(buffer->data[offset]);
+  message->data.size = size;
+  return 0;
+}
+
+/**
+ * @brief Get the buffer the system exclusive data of a message references.
+ * @public @memberof MIDIMessage
+ * @param message The message.
+ * @param buffer  The buffer or @c NULL if the message does not reference one.
+ * @param offset  The offset of the slice or @c NULL.
+ * @retval 0 on success.
+ */
+int MIDIMessageGetSysExBuffer( struct MIDIMessage * message, struct MIDISysExBuffer ** buffer, size_t * offset ) {
+  MIDIPrecond( message != NULL, EFAULT );
+  MIDIPrecond( buffer != NULL, EINVAL );
+  *buffer = message->sysex;
+  if( offset != NULL ) {
+    *offset = ( message->sysex != NULL ) ? (unsigned char *) message->data.data - &(message->sysex->data[0]) : 0;
+  }
+  return 0;
+}
+
+/** @} */
+
+/* MARK: Message pools *//**
+ * @name Message pools
+ * Creating, destroying and inspecting MIDIMessagePool objects.
+ * @{
+ */
+
+/**
+ * @brief Create a MIDIMessagePool instance.
+ * Allocate a slab for @c capacity messages and put all of them onto the
+ * pool's free list.
+ * @public @memberof MIDIMessagePool
+ * @param capacity The number of messages the pool can hold.
+ * @return a pointer to the created pool structure on success.
+ * @return a @c NULL pointer if the pool could not created.
+ */
+struct MIDIMessagePool * MIDIMessagePoolCreate( size_t capacity ) {
+  struct MIDIMessagePool * pool;
+  size_t i;
+  MIDIPrecondReturn( capacity > 0, EINVAL, NULL );
+
+  pool = malloc( sizeof( struct MIDIMessagePool ) );
+  MIDIPrecondReturn( pool != NULL, ENOMEM, NULL );
+  pool->slab = malloc( sizeof( struct MIDIMessage ) * capacity );
+  if( pool->slab == NULL ) {
+    free( pool );
+    return NULL;
+  }
+
+  pool->refs     = 1;
+  pool->capacity = capacity;
+  for( i=0; i<capacity; i++ ) {
+    pool->slab[i].pool = NULL;
+    pool->slab[i].next = ( i+1 < capacity ) ? &(pool->slab[i+1]) : NULL;
+  }
+  pool->local      = &(pool->slab[0]);
+  pool->shared     = NULL;
+  pool->in_use     = 0;
+  pool->hits       = 0;
+  pool->misses     = 0;
+  pool->high_water = 0;
+  pool->sysex_local  = NULL;
+  pool->sysex_shared = NULL;
+  return pool;
+}
+
+/**
+ * @brief Destroy a MIDIMessagePool instance.
+ * Free the slab, the released SysEx buffers and the pool itself. Every
+ * message and buffer that was created from the pool holds a reference
+ * to it, so this will not happen before all of them have been returned.
+ * @public @memberof MIDIMessagePool
+ * @param pool The pool.
+ */
+void MIDIMessagePoolDestroy( struct MIDIMessagePool * pool ) {
+  MIDIPrecondReturn( pool != NULL, EFAULT, (void)0 );
+  MIDIAssert( pool->in_use == 0 );
+  _pool_free_sysex( pool->sysex_local );
+  _pool_free_sysex( pool->sysex_shared );
+  free( pool->slab );
+  free( pool );
+}
+
+/**
+ * @brief Retain a MIDIMessagePool instance.
+ * Increment the reference counter of a pool so that it won't be destroyed.
+ * @public @memberof MIDIMessagePool
+ * @param pool The pool.
+ */
+void MIDIMessagePoolRetain( struct MIDIMessagePool * pool ) {
+  MIDIPrecondReturn( pool != NULL, EFAULT, (void)0 );
+  __sync_add_and_fetch( &(pool->refs), 1 );
+}
+
+/**
+ * @brief Release a MIDIMessagePool instance.
+ * Decrement the reference counter of a pool. If the reference count
+ * reached zero, destroy the pool.
+ * @public @memberof MIDIMessagePool
+ * @param pool The pool.
+ */
+void MIDIMessagePoolRelease( struct MIDIMessagePool * pool ) {
+  MIDIPrecondReturn( pool != NULL, EFAULT, (void)0 );
+  if( ! __sync_sub_and_fetch( &(pool->refs), 1 ) ) {
+    MIDIMessagePoolDestroy( pool );
+  }
+}
+
+/**
+ * @brief Get pool statistics.
+ * Report how often the pool could serve a request (hits), how often it
+ * had to fall back to the heap (misses) and the maximum number of pooled
+ * messages that were in use at the same time (high water mark).
+ * @public @memberof MIDIMessagePool
+ * @param pool  The pool.
+ * @param stats The statistics structure to fill.
+ * @retval 0 on success.
+ */
+int MIDIMessagePoolGetStats( struct MIDIMessagePool * pool, struct MIDIMessagePoolStats * stats ) {
+  MIDIPrecond( pool != NULL, EFAULT );
+  MIDIPrecond( stats != NULL, EINVAL );
+  stats->capacity   = pool->capacity;
+  stats->in_use     = pool->in_use;
+  stats->hits       = pool->hits;
+  stats->misses     = pool->misses;
+  stats->high_water = pool->high_water;
+  return 0;
+}
+
+/** @} */
+
 /* MARK: Property access *//**
  * @name Property access
  * Get and set message properties.
@@ -209,8 +822,15 @@ int MIDIMessageGetSize( struct MIDIMessage * message, size_t * size ) {
  * @retval 1 if the property was not set.
  */
 int MIDIMessageSet( struct MIDIMessage * message, MIDIProperty property, size_t size, void * value ) {
+  int result;
   MIDIPrecond( message != NULL, EFAULT );
-  return MIDIMessageFormatSet( message->format, &(message->data), property, size, value );
+  result = MIDIMessageFormatSet( message->format, &(message->data), property, size, value );
+  if( result == 0 && property == MIDI_SYSEX_DATA && message->sysex != NULL ) {
+    /* the data no longer points into the buffer */
+    MIDISysExBufferRelease( message->sysex );
+    message->sysex = NULL;
+  }
+  return result;
 }
 
 /**
@@ -390,3 +1010,456 @@ int MIDIMessageListDecode( struct MIDIMessageList * messages, size_t size, unsig
 }
 
 /** @} */
+
+/* MARK: Stream coding *//**
+ * @name Stream coding
+ * Decode whole byte streams into arrays of compact messages and
+ * encode arrays of messages into byte streams.
+ * @{
+ */
+
+/**
+ * @ingroup MIDI
+ * @struct MIDICompactMessage message.h
+ * @brief Plain value representation of a decoded MIDI message.
+ * Compact messages are decoded in bulk into caller-provided arrays and
+ * need no heap allocation. @c bytes holds the status byte (including
+ * the channel) and up to two data bytes. System exclusive messages
+ * have the status @c MIDI_STATUS_SYSTEM_EXCLUSIVE and refer to their
+ * payload by @c sysex_offset and @c sysex_size within the decoded
+ * buffer, excluding the leading @c 0xf0 and the terminator. The
+ * @c MIDI_COMPACT_SYSEX_* @c flags tell if the payload starts and
+ * ends the system exclusive message so that segments can be
+ * reassembled. @c timestamp is the time of the message in ticks after
+ * a base time that is passed along with the compact messages, like the
+ * timestamp of the packet or the start of the decoded buffer. Compact
+ * messages taken from a MIDIMessage have a base time of zero and hold
+ * the lower 32 bits of its timestamp.
+ */
+
+/**
+ * @brief Number of data bytes following a status byte.
+ * Indexed by the status byte minus @c 0x80. Undefined status bytes
+ * have @c 0xff data bytes.
+ */
+static const unsigned char _stream_data_bytes[0x80] = {
+  2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, /* note off */
+  2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, /* note on */
+  2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, /* polyphonic key pressure */
+  2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, /* control change */
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, /* program change */
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, /* channel pressure */
+  2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, /* pitch wheel change */
+  0xff, 1, 2, 1, 0xff, 0xff, 0, 0xff,             /* system common */
+  0, 0xff, 0, 0, 0, 0xff, 0, 0                    /* system real time */
+};
+
+/**
+ * @brief Decode a stream with or without delta times.
+ * If @c timed is 0 the stream has no delta times, if it is 1 every command
+ * has a delta time and if it is 2 every command but the first has one.
+ * Only timed streams know segment and cancel terminators.
+ * @private @memberof MIDIMessage
+ * @see MIDIMessageDecodeStream
+ * @see MIDIMessageDecodeTimedStream
+ * @see MIDIMessageDecodeCommandStream
+ */
+static int _decode_stream( size_t size, unsigned char * buffer, MIDIRunningStatus * status, int timed,
+                              size_t max, struct MIDICompactMessage * messages, size_t * count, size_t * read ) {
+  struct MIDICompactMessage * m;
+  MIDIRunningStatus rs, rs_start;
+  size_t p = 0, q, start, n = 0, mark;
+  MIDIVarLen delta;
+  uint32_t offset = 0;
+  unsigned char byte, need, got, data[2];
+  int continued = 0;
+
+  MIDIPrecond( buffer != NULL || size == 0, EINVAL );
+  MIDIPrecond( messages != NULL || max == 0, EINVAL );
+  rs = ( status != NULL ) ? *status : 0;
+
+  while( p < size && n < max ) {
+    start    = p;
+    mark     = n;
+    rs_start = rs;
+    delta    = 0;
+
+    if( timed && !continued && ( timed == 1 || p > 0 ) ) {
+      do {
+        if( p >= size ) goto incomplete;
+        delta = ( delta << 7 ) | ( buffer[p] & 0x7f );
+      } while( buffer[p++] & 0x80 );
+      if( p >= size ) goto incomplete;
+    }
+    offset += delta;
+    continued = 0;
+
+    byte = buffer[p];
+    if( byte >= MIDI_STATUS_TIMING_CLOCK ) {
+      /* real time messages may appear anywhere and don't touch the running status */
+      p++;
+      if( _stream_data_bytes[byte-0x80] == 0 ) {
+        m = &(messages[n++]);
+        m->bytes[0] = byte;
+        m->bytes[1] = m->bytes[2] = 0;
+        m->flags = 0;
+        m->timestamp = offset;
+        m->sysex_offset = m->sysex_size = 0;
+      }
+      /* a real time message in the middle of a system exclusive
+       * message does not end the command */
+      continued = ( rs == MIDI_STATUS_SYSTEM_EXCLUSIVE );
+      continue;
+    }
+
+    if( rs == MIDI_STATUS_SYSTEM_EXCLUSIVE || byte == MIDI_STATUS_SYSTEM_EXCLUSIVE
+     || byte == MIDI_STATUS_END_OF_EXCLUSIVE ) {
+      m = &(messages[n++]);
+      m->flags = 0;
+      if( rs != MIDI_STATUS_SYSTEM_EXCLUSIVE ) {
+        /* system exclusive message or continued segment */
+        if( byte == MIDI_STATUS_SYSTEM_EXCLUSIVE ) m->flags = MIDI_COMPACT_SYSEX_START;
+        p++;
+      }
+      for( q=p; q<size && buffer[q] < 0x80; q++ );
+      m->bytes[0] = MIDI_STATUS_SYSTEM_EXCLUSIVE;
+      m->bytes[1] = m->bytes[2] = 0;
+      m->timestamp = offset;
+      m->sysex_offset = p;
+      m->sysex_size   = q - p;
+      p  = q;
+      rs = 0;
+      if( q == size ) {
+        /* the message goes on in the next buffer */
+        rs = MIDI_STATUS_SYSTEM_EXCLUSIVE;
+      } else if( buffer[q] == MIDI_STATUS_END_OF_EXCLUSIVE ) {
+        m->flags |= MIDI_COMPACT_SYSEX_END;
+        p++;
+      } else if( buffer[q] >= MIDI_STATUS_TIMING_CLOCK ) {
+        rs = MIDI_STATUS_SYSTEM_EXCLUSIVE;
+        continued = 1;
+      } else if( timed && buffer[q] == MIDI_STATUS_SYSTEM_EXCLUSIVE ) {
+        /* segment of a message that goes on in a later command */
+        p++;
+      } else if( timed && buffer[q] == MIDI_STATUS_UNDEFINED0 ) {
+        m->flags |= MIDI_COMPACT_SYSEX_CANCEL;
+        p++;
+      } /* otherwise the message was aborted by the next status byte */
+      continue;
+    }
+
+    if( byte & 0x80 ) {
+      p++;
+      need = _stream_data_bytes[byte-0x80];
+      if( need == 0xff ) {
+        /* undefined status, skip it */
+        rs = 0;
+        continue;
+      }
+      rs = ( byte < MIDI_STATUS_SYSTEM_EXCLUSIVE ) ? byte : 0;
+    } else if( rs != 0 ) {
+      need = _stream_data_bytes[rs-0x80];
+      byte = rs;
+    } else {
+      /* data byte without status */
+      p++;
+      continue;
+    }
+
+    for( got=0; got<need && p<size; p++ ) {
+      if( buffer[p] >= MIDI_STATUS_TIMING_CLOCK ) {
+        if( n == max ) goto incomplete;
+        if( _stream_data_bytes[buffer[p]-0x80] == 0 ) {
+          m = &(messages[n++]);
+          m->bytes[0] = buffer[p];
+          m->bytes[1] = m->bytes[2] = 0;
+          m->flags = 0;
+          m->timestamp = offset;
+          m->sysex_offset = m->sysex_size = 0;
+        }
+      } else if( buffer[p] & 0x80 ) {
+        break;
+      } else {
+        data[got++] = buffer[p];
+      }
+    }
+    if( got < need ) {
+      if( p == size ) goto incomplete;
+      /* the message was cut short by the next status byte, drop it */
+      continue;
+    }
+    if( n == max ) goto incomplete;
+    m = &(messages[n++]);
+    m->bytes[0] = byte;
+    m->bytes[1] = ( need > 0 ) ? data[0] : 0;
+    m->bytes[2] = ( need > 1 ) ? data[1] : 0;
+    m->flags = 0;
+    m->timestamp = offset;
+    m->sysex_offset = m->sysex_size = 0;
+  }
+  goto done;
+
+incomplete:
+  /* leave the incomplete message in the buffer for the next call */
+  p  = start;
+  n  = mark;
+  rs = rs_start;
+
+done:
+  if( status != NULL ) *status = rs;
+  if( count != NULL ) *count = n;
+  if( read != NULL ) *read = p;
+  return 0;
+}
+
+/**
+ * @brief Decode a byte stream into compact messages.
+ * Decode all messages in a stream of bytes as it would appear on a
+ * MIDI cable in a single pass. Running status is used and updated,
+ * real time messages may appear anywhere, even between the data bytes
+ * of other messages. System exclusive messages are not copied, the
+ * compact messages refer to their payload within @c buffer. If a
+ * system exclusive message goes on past the end of the buffer the
+ * running status is set to @c MIDI_STATUS_SYSTEM_EXCLUSIVE so that the
+ * next call continues it.
+ * Decoding stops if @c max messages were decoded or if the last
+ * message is incomplete. In both cases @c read tells where to go on.
+ * @public @memberof MIDIMessage
+ * @param size     The number of bytes in @c buffer.
+ * @param buffer   The buffer to decode.
+ * @param status   The running status, may be @c NULL.
+ * @param max      The number of entries in @c messages.
+ * @param messages The array to decode the messages to.
+ * @param count    The number of decoded messages.
+ * @param read     The number of bytes that were consumed.
+ * @retval 0  on success.
+ * @retval >0 if the stream could not be decoded.
+ */
+int MIDIMessageDecodeStream( size_t size, unsigned char * buffer, MIDIRunningStatus * status,
+                             size_t max, struct MIDICompactMessage * messages, size_t * count, size_t * read ) {
+  return _decode_stream( size, buffer, status, 0, max, messages, count, read );
+}
+
+/**
+ * @brief Decode a byte stream with delta times into compact messages.
+ * Like @ref MIDIMessageDecodeStream but every command is preceded by a
+ * variable length delta time, as in the command section of RTP-MIDI
+ * packets. The delta times add up, the @c timestamp of every message is
+ * its offset from the start of @c buffer.
+ * System exclusive segments ending with @c 0xf0 and cancelled messages
+ * ending with @c 0xf4 are recognized as well.
+ * @public @memberof MIDIMessage
+ * @param size     The number of bytes in @c buffer.
+ * @param buffer   The buffer to decode.
+ * @param status   The running status, may be @c NULL.
+ * @param max      The number of entries in @c messages.
+ * @param messages The array to decode the messages to.
+ * @param count    The number of decoded messages.
+ * @param read     The number of bytes that were consumed.
+ * @retval 0  on success.
+ * @retval >0 if the stream could not be decoded.
+ */
+int MIDIMessageDecodeTimedStream( size_t size, unsigned char * buffer, MIDIRunningStatus * status,
+                                  size_t max, struct MIDICompactMessage * messages, size_t * count, size_t * read ) {
+  return _decode_stream( size, buffer, status, 1, max, messages, count, read );
+}
+
+/**
+ * @brief Decode a command list whose first command has no delta time.
+ * Like @ref MIDIMessageDecodeTimedStream but the first command in
+ * @c buffer is not preceded by a delta time, as in the command section of
+ * RTP-MIDI packets with the Z flag cleared. Segment and cancel terminators
+ * are recognized for the first command too.
+ * @public @memberof MIDIMessage
+ * @param size     The number of bytes in @c buffer.
+ * @param buffer   The buffer to decode.
+ * @param status   The running status, may be @c NULL.
+ * @param max      The number of entries in @c messages.
+ * @param messages The array to decode the messages to.
+ * @param count    The number of decoded messages.
+ * @param read     The number of bytes that were consumed.
+ * @retval 0  on success.
+ * @retval >0 if the stream could not be decoded.
+ */
+int MIDIMessageDecodeCommandStream( size_t size, unsigned char * buffer, MIDIRunningStatus * status,
+                                    size_t max, struct MIDICompactMessage * messages, size_t * count, size_t * read ) {
+  return _decode_stream( size, buffer, status, 2, max, messages, count, read );
+}
+
+/**
+ * @brief Encode an array of messages into a byte stream.
+ * Encode as many of the messages as fit into the buffer in a single
+ * pass. The running status is used and updated so that repeated
+ * channel status bytes are left out. If @c deltas is given every
+ * message is preceded by it's variable length delta time, as in the
+ * command section of RTP-MIDI packets. A message is only written if
+ * it fits into the buffer together with it's delta time, @c count
+ * tells how many messages were written.
+ * @public @memberof MIDIMessage
+ * @param size     The size of the memory pointed to by @c buffer.
+ * @param buffer   The buffer to encode the messages into.
+ * @param status   The running status, may be @c NULL.
+ * @param n        The number of messages.
+ * @param messages The messages.
+ * @param deltas   The delta times of the messages or @c NULL.
+ * @param count    The number of messages that were written.
+ * @param written  The number of bytes that were written.
+ * @retval 0  on success, even if not all messages fit.
+ * @retval >0 if a message could not be encoded.
+ */
+int MIDIMessageEncodeTimedStream( size_t size, unsigned char * buffer, MIDIRunningStatus * status,
+                                  size_t n, struct MIDIMessage ** messages, MIDIVarLen * deltas,
+                                  size_t * count, size_t * written ) {
+  struct MIDIMessageData * data;
+  MIDIRunningStatus rs, rs_next;
+  MIDIVarLen v;
+  size_t i, p = 0, q, w;
+  unsigned char byte, need;
+  int k, j, result = 0;
+
+  MIDIPrecond( buffer != NULL || size == 0, EINVAL );
+  MIDIPrecond( messages != NULL || n == 0, EINVAL );
+  rs = ( status != NULL ) ? *status : 0;
+
+  for( i=0; i<n; i++ ) {
+    data = &(messages[i]->data);
+    byte = data->bytes[0];
+    if( byte < 0x80 || messages[i]->format == NULL ) {
+      result = 1;
+      break;
+    }
+    q = p;
+    if( deltas != NULL ) {
+      v = deltas[i] & 0x0fffffff;
+      k = 1 + ( v >= (1<<7) ) + ( v >= (1<<14) ) + ( v >= (1<<21) );
+      if( q + k > size ) break;
+      for( j=k-1; j>=0; j-- ) {
+        buffer[q+j] = ( v & 0x7f ) | ( ( j == k-1 ) ? 0 : 0x80 );
+        v >>= 7;
+      }
+      q += k;
+    }
+    rs_next = rs;
+    if( byte == MIDI_STATUS_SYSTEM_EXCLUSIVE ) {
+      if( q >= size ) break;
+      if( MIDIMessageFormatEncodeRunningStatus( messages[i]->format, data, &rs_next, size-q, buffer+q, &w ) ) break;
+      q += w;
+    } else {
+      need = _stream_data_bytes[byte-0x80];
+      if( need == 0xff ) {
+        result = 1;
+        break;
+      }
+      if( byte < MIDI_STATUS_SYSTEM_EXCLUSIVE ) {
+        if( q + need + ( byte != rs ) > size ) break;
+        if( byte != rs ) buffer[q++] = byte;
+        rs_next = byte;
+      } else {
+        if( q + need + 1 > size ) break;
+        buffer[q++] = byte;
+        if( byte < MIDI_STATUS_TIMING_CLOCK ) rs_next = 0;
+      }
+      if( need > 0 ) buffer[q++] = data->bytes[1];
+      if( need > 1 ) buffer[q++] = data->bytes[2];
+    }
+    rs = rs_next;
+    p  = q;
+  }
+
+  if( status != NULL ) *status = rs;
+  if( count != NULL ) *count = i;
+  if( written != NULL ) *written = p;
+  return result;
+}
+
+/**
+ * @brief Set a message from a compact message.
+ * Replace the contents of a message with a decoded compact message.
+ * The payload of system exclusive messages is copied from the buffer
+ * the compact message was decoded from. The timestamp is not changed.
+ * @public @memberof MIDIMessage
+ * @param message The message.
+ * @param compact The compact message.
+ * @param buffer  The buffer the compact message was decoded from.
+ * @retval 0  on success.
+ * @retval >0 if the message could not be set.
+ */
+int MIDIMessageSetCompact( struct MIDIMessage * message, struct MIDICompactMessage * compact, unsigned char * buffer ) {
+  unsigned char * payload;
+  size_t size;
+  MIDIPrecond( message != NULL, EFAULT );
+  MIDIPrecond( compact != NULL, EINVAL );
+
+  _check_release_data( message );
+  message->format = MIDIMessageFormatDetect( &(compact->bytes[0]) );
+  if( message->format == NULL ) return 1;
+  message->data.bytes[0] = compact->bytes[0];
+  message->data.bytes[1] = compact->bytes[1];
+  message->data.bytes[2] = compact->bytes[2];
+  message->data.bytes[3] = 0;
+  message->data.size = 0;
+  message->data.data = NULL;
+  if( compact->bytes[0] != MIDI_STATUS_SYSTEM_EXCLUSIVE ) {
+    return 0;
+  }
+
+  MIDIPrecond( buffer != NULL, EINVAL );
+  payload = buffer + compact->sysex_offset;
+  size    = compact->sysex_size;
+  if( compact->flags & MIDI_COMPACT_SYSEX_START ) {
+    if( size >= 3 && payload[0] == 0 ) {
+      /* extended manufacturer id */
+      message->data.bytes[1] = payload[1];
+      message->data.bytes[2] = payload[2] | 0x80;
+      payload += 3;
+      size    -= 3;
+    } else if( size >= 1 ) {
+      message->data.bytes[2] = payload[0];
+      payload += 1;
+      size    -= 1;
+    }
+    message->data.bytes[3] = 1;
+  } else {
+    /* continued segment */
+    message->data.bytes[3] = ( 1 << 1 ) | 1;
+  }
+  /* keep the terminator like MIDIMessageDecode does */
+  if( compact->flags & MIDI_COMPACT_SYSEX_END ) size++;
+  if( size > 0 ) {
+    message->data.data = malloc( size );
+    if( message->data.data == NULL ) {
+      message->data.bytes[3] &= ~1;
+      return ENOMEM;
+    }
+    memcpy( message->data.data, payload, size );
+    message->data.size = size;
+  }
+  return 0;
+}
+
+/**
+ * @brief Get a compact message from a message.
+ * Copy the status and data bytes and the lower 32 bits of the timestamp
+ * into a compact message. System exclusive messages have no compact
+ * form without a payload buffer and are not converted.
+ * @public @memberof MIDIMessage
+ * @param message The message.
+ * @param compact The compact message.
+ * @retval 0  on success.
+ * @retval >0 if the message has no compact form.
+ */
+int MIDIMessageGetCompact( struct MIDIMessage * message, struct MIDICompactMessage * compact ) {
+  MIDIPrecond( message != NULL, EFAULT );
+  MIDIPrecond( compact != NULL, EINVAL );
+  if( message->format == NULL || message->data.bytes[0] == MIDI_STATUS_SYSTEM_EXCLUSIVE ) return 1;
+  compact->bytes[0]     = message->data.bytes[0];
+  compact->bytes[1]     = message->data.bytes[1];
+  compact->bytes[2]     = message->data.bytes[2];
+  compact->flags        = 0;
+  compact->timestamp    = (uint32_t) message->timestamp;
+  compact->sysex_offset = 0;
+  compact->sysex_size   = 0;
+  return 0;
+}
+
+/** @} */
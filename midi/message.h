@@ -1,13 +1,37 @@
 #ifndef MIDIKIT_MIDI_MESSAGE_H
 #define MIDIKIT_MIDI_MESSAGE_H
 #include <stdlib.h>
+#include <stdint.h>
 #include "midi.h"
+#include "util.h"
 #include "clock.h"
 #include "type.h"
 
 struct MIDIMessage;
+struct MIDIMessagePool;
+struct MIDISysExBuffer;
 extern struct MIDITypeSpec * MIDIMessageType;
 
+struct MIDIMessagePoolStats {
+  size_t capacity;
+  size_t in_use;
+  size_t hits;
+  size_t misses;
+  size_t high_water;
+};
+
+#define MIDI_COMPACT_SYSEX_START  0x01
+#define MIDI_COMPACT_SYSEX_END    0x02
+#define MIDI_COMPACT_SYSEX_CANCEL 0x04
+
+struct MIDICompactMessage {
+  unsigned char bytes[3];
+  unsigned char flags;
+  uint32_t timestamp;
+  uint32_t sysex_offset;
+  uint32_t sysex_size;
+};
+
 struct MIDIMessageList {
 /*size_t refs;
   size_t length;*/
@@ -16,10 +40,31 @@ struct MIDIMessageList {
 };
 
 struct MIDIMessage * MIDIMessageCreate( MIDIStatus status );
+struct MIDIMessage * MIDIMessageCreateFromPool( struct MIDIMessagePool * pool, MIDIStatus status );
+struct MIDIMessage * MIDIMessageCreateLocal( struct MIDIMessagePool * pool, MIDIStatus status );
 void MIDIMessageDestroy( struct MIDIMessage * message );
 void MIDIMessageRetain( struct MIDIMessage * message );
 void MIDIMessageRelease( struct MIDIMessage * message );
 
+struct MIDISysExBuffer * MIDISysExBufferCreate( size_t size, void * data );
+struct MIDISysExBuffer * MIDISysExBufferCreateFromPool( struct MIDIMessagePool * pool, size_t size );
+void MIDISysExBufferDestroy( struct MIDISysExBuffer * buffer );
+void MIDISysExBufferRetain( struct MIDISysExBuffer * buffer );
+void MIDISysExBufferRelease( struct MIDISysExBuffer * buffer );
+int MIDISysExBufferGetData( struct MIDISysExBuffer * buffer, size_t * size, void ** data );
+int MIDISysExBufferSetSize( struct MIDISysExBuffer * buffer, size_t size );
+int MIDISysExBufferAppend( struct MIDISysExBuffer ** buffer, size_t size, void * data );
+
+int MIDIMessageSetSysExBuffer( struct MIDIMessage * message, struct MIDISysExBuffer * buffer,
+                               size_t offset, size_t size );
+int MIDIMessageGetSysExBuffer( struct MIDIMessage * message, struct MIDISysExBuffer ** buffer, size_t * offset );
+
+struct MIDIMessagePool * MIDIMessagePoolCreate( size_t capacity );
+void MIDIMessagePoolDestroy( struct MIDIMessagePool * pool );
+void MIDIMessagePoolRetain( struct MIDIMessagePool * pool );
+void MIDIMessagePoolRelease( struct MIDIMessagePool * pool );
+int MIDIMessagePoolGetStats( struct MIDIMessagePool * pool, struct MIDIMessagePoolStats * stats );
+
 int MIDIMessageSetStatus( struct MIDIMessage * message, MIDIStatus status );
 int MIDIMessageGetStatus( struct MIDIMessage * message, MIDIStatus * status );
 int MIDIMessageSetTimestamp( struct MIDIMessage * message, MIDITimestamp timestamp );
@@ -50,4 +95,16 @@ int MIDIMessageListGetLength( struct MIDIMessageList * messages, size_t * length
 int MIDIMessageListEncode( struct MIDIMessageList * messages, size_t size, unsigned char * buffer, size_t * written );
 int MIDIMessageListDecode( struct MIDIMessageList * messages, size_t size, unsigned char * buffer, size_t * read );
 
+int MIDIMessageDecodeStream( size_t size, unsigned char * buffer, MIDIRunningStatus * status,
+                             size_t max, struct MIDICompactMessage * messages, size_t * count, size_t * read );
+int MIDIMessageDecodeTimedStream( size_t size, unsigned char * buffer, MIDIRunningStatus * status,
+                                  size_t max, struct MIDICompactMessage * messages, size_t * count, size_t * read );
+int MIDIMessageDecodeCommandStream( size_t size, unsigned char * buffer, MIDIRunningStatus * status,
+                                    size_t max, struct MIDICompactMessage * messages, size_t * count, size_t * read );
+int MIDIMessageEncodeTimedStream( size_t size, unsigned char * buffer, MIDIRunningStatus * status,
+                                  size_t n, struct MIDIMessage ** messages, MIDIVarLen * deltas,
+                                  size_t * count, size_t * written );
+int MIDIMessageSetCompact( struct MIDIMessage * message, struct MIDICompactMessage * compact, unsigned char * buffer );
+int MIDIMessageGetCompact( struct MIDIMessage * message, struct MIDICompactMessage * compact );
+
 #endif
@@ -669,7 +669,10 @@ static int _set_system_exclusive( struct MIDIMessageData * data, MIDIProperty pr
   if( size == 0 || value == NULL ) return 1;
   switch( property ) {
     PROPERTY_CASE_SET(MIDI_STATUS,MIDIStatus,data->bytes[0]);
-    PROPERTY_CASE_SET(MIDI_SYSEX_SIZE,size_t,data->size);
+    PROPERTY_CASE_BASE(MIDI_SYSEX_SIZE,size_t);
+      /* the size is no data byte, it is not limited to seven bits */
+      data->size = *((size_t*)value);
+      return 0;
     PROPERTY_CASE_BASE(MIDI_MANUFACTURER_ID,MIDIManufacturerId);
       data->bytes[1] = *((MIDIManufacturerId*)value) >> 8;
       data->bytes[2] = *((MIDIManufacturerId*)value) & 0xff;
@@ -1050,6 +1053,59 @@ static struct MIDIMessageFormat _real_time = {
   &_decode_one_byte
 };
 
+/**
+ * @}
+ * @endcond
+ */
+
+/* MARK: Format table *//**
+ * @name Format table
+ * @cond INTERNALS
+ * Map every possible first byte of a message to it's format so that
+ * formats can be detected with a single lookup. Data bytes and undefined
+ * status bytes map to @c NULL.
+ * @{
+ */
+
+#define FORMAT_X4( format )  format, format, format, format
+#define FORMAT_X16( format ) FORMAT_X4( format ), FORMAT_X4( format ), \
+                             FORMAT_X4( format ), FORMAT_X4( format )
+
+static struct MIDIMessageFormat * _formats[256] = {
+  /* 0x00 - 0x7f: data bytes */
+  FORMAT_X16( NULL ), FORMAT_X16( NULL ), FORMAT_X16( NULL ), FORMAT_X16( NULL ),
+  FORMAT_X16( NULL ), FORMAT_X16( NULL ), FORMAT_X16( NULL ), FORMAT_X16( NULL ),
+  /* 0x80 - 0xef: channel messages */
+  FORMAT_X16( &_note_off_on ),
+  FORMAT_X16( &_note_off_on ),
+  FORMAT_X16( &_polyphonic_key_pressure ),
+  FORMAT_X16( &_control_change ),
+  FORMAT_X16( &_program_change ),
+  FORMAT_X16( &_channel_pressure ),
+  FORMAT_X16( &_pitch_wheel_change ),
+  /* 0xf0 - 0xf7: system common messages */
+  &_system_exclusive,
+  &_time_code_quarter_frame,
+  &_song_position_pointer,
+  &_song_select,
+  NULL, /* undefined */
+  NULL, /* undefined */
+  &_tune_request,
+  NULL, /* end of exclusive */
+  /* 0xf8 - 0xff: system real time messages */
+  &_real_time,
+  NULL, /* undefined */
+  &_real_time,
+  &_real_time,
+  &_real_time,
+  NULL, /* undefined */
+  &_real_time,
+  &_real_time
+};
+
+#undef FORMAT_X16
+#undef FORMAT_X4
+
 /**
  * @}
  * @endcond
@@ -1058,8 +1114,6 @@ static struct MIDIMessageFormat _real_time = {
 /* MARK: -
  * MARK: Public functions */
 
-#define N_ELEM(a) (sizeof(a) / sizeof(a[0]))
-
 /**
  * @brief Detect the format of message stored in a buffer.
  * Determine the message format used in a stream of bytes.
@@ -1069,29 +1123,8 @@ static struct MIDIMessageFormat _real_time = {
  * @return a NULL pointer if the format could not be detected.
  */
 struct MIDIMessageFormat * MIDIMessageFormatDetect( void * buffer ) {
-  static struct MIDIMessageFormat * formats[] = {
-    &_note_off_on,
-    &_polyphonic_key_pressure,
-    &_control_change,
-    &_program_change,
-    &_channel_pressure,
-    &_pitch_wheel_change,
-    &_system_exclusive,
-    &_time_code_quarter_frame,
-    &_song_position_pointer,
-    &_song_select,
-    &_tune_request,
-    &_real_time
-  };
-  int i;
   MIDIPrecondReturn( buffer != NULL, EFAULT, NULL );
-  for( i=0; i<N_ELEM(formats); i++ ) {
-    MIDIAssert( formats[i] != NULL && formats[i]->test != NULL );
-    if( (formats[i]->test)( buffer ) ) {
-      return formats[i];
-    }
-  }
-  return NULL;
+  return _formats[VOID_BYTE(buffer,0)];
 }
 
 /**
@@ -1104,10 +1137,12 @@ struct MIDIMessageFormat * MIDIMessageFormatDetect( void * buffer ) {
  * @return a NULL pointer if the format could not be detected.
  */
 struct MIDIMessageFormat * MIDIMessageFormatDetectRunningStatus( void * buffer, MIDIRunningStatus * status ) {
+  MIDIPrecondReturn( buffer != NULL, EFAULT, NULL );
   if( VOID_BYTE(buffer, 0) & 0x80 ) {
-    return MIDIMessageFormatDetect( buffer );
-  } else if( status != NULL && *status != 0 ) {
-    return MIDIMessageFormatDetect( status );
+    return _formats[VOID_BYTE(buffer,0)];
+  } else if( status != NULL ) {
+    /* a running status of 0 maps to NULL as well */
+    return _formats[*status];
   } else {
     return NULL;
   }
@@ -1135,7 +1170,7 @@ struct MIDIMessageFormat * MIDIMessageFormatForStatus( MIDIStatus status ) {
     byte = status << 4;
     if( byte < 0x80 ) return NULL; /* no status bit? */
   }
-  return MIDIMessageFormatDetect( &byte );
+  return _formats[byte];
 }
 
 /**
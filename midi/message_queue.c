@@ -1,9 +1,18 @@
 #include <stdlib.h>
+#include <string.h>
 #include "message_queue.h"
+#include "trace.h"
 
 /**
  * @ingroup MIDI
  * @brief Queue for MIDI message objects.
+ * A queue is either backed by a linked list that grows as needed, or by
+ * a fixed size ring buffer. The ring buffer variant never allocates after
+ * creation and is safe to use with exactly one thread pushing and one
+ * other thread popping messages at the same time. A compact ring buffer
+ * stores MIDICompactMessage values instead of message references.
+ * Message queues can be limited to a capacity. A policy decides what
+ * happens when a message is pushed to a full queue.
  * @todo  Implement this using a MIDIList
  */
 struct MIDIMessageQueue {
@@ -15,9 +24,196 @@ struct MIDIMessageQueue {
   size_t length;
   struct MIDIMessageList * first;
   struct MIDIMessageList * last;
+
+  size_t mask;
+  struct MIDIMessage ** ring;
+  struct MIDICompactMessage * compact;
+  size_t volatile head;
+  size_t volatile tail;
+
+  size_t limit;
+  int    policy;
+  struct MIDIMessageQueueStats stats;
 /** @endcond */
 };
 
+/* MARK: Internals *//**
+ * @name Internals
+ * @cond INTERNALS
+ * Ring buffer operations.
+ * @{
+ */
+
+/**
+ * @brief Add a message to the ring buffer.
+ * Only the producer thread modifies the tail. The message pointer is
+ * stored before the new tail is published, so the consumer never sees
+ * an empty slot.
+ * @private @memberof MIDIMessageQueue
+ * @param queue   The message queue.
+ * @param message The message.
+ * @retval 0 on success.
+ * @retval 1 if the ring buffer is full.
+ */
+static int _ring_push( struct MIDIMessageQueue * queue, struct MIDIMessage * message ) {
+  size_t tail = queue->tail;
+  if( tail - queue->head > queue->mask ) return 1;
+  MIDIMessageRetain( message );
+  queue->ring[tail & queue->mask] = message;
+  __sync_synchronize();
+  queue->tail = tail + 1;
+  return 0;
+}
+
+/**
+ * @brief Get the first message in the ring buffer.
+ * @private @memberof MIDIMessageQueue
+ * @param queue The message queue.
+ * @return the first message or @c NULL if the ring buffer is empty.
+ */
+static struct MIDIMessage * _ring_peek( struct MIDIMessageQueue * queue ) {
+  size_t head = queue->head;
+  if( head == queue->tail ) return NULL;
+  __sync_synchronize();
+  return queue->ring[head & queue->mask];
+}
+
+/**
+ * @brief Remove the first message from the ring buffer.
+ * Only the consumer thread modifies the head. The slot is read before
+ * the new head is published, so the producer never overwrites a message
+ * that was not yet taken.
+ * @private @memberof MIDIMessageQueue
+ * @param queue The message queue.
+ * @return the removed message or @c NULL if the ring buffer is empty.
+ */
+static struct MIDIMessage * _ring_pop( struct MIDIMessageQueue * queue ) {
+  struct MIDIMessage * message = _ring_peek( queue );
+  if( message != NULL ) {
+    __sync_synchronize();
+    queue->head = queue->head + 1;
+  }
+  return message;
+}
+
+/**
+ * @brief Add a compact message to the ring buffer.
+ * @private @memberof MIDIMessageQueue
+ * @param queue   The message queue.
+ * @param compact The compact message.
+ * @retval 0 on success.
+ * @retval 1 if the ring buffer is full.
+ */
+static int _compact_push( struct MIDIMessageQueue * queue, struct MIDICompactMessage * compact ) {
+  size_t tail = queue->tail;
+  if( tail - queue->head > queue->mask ) return 1;
+  queue->compact[tail & queue->mask] = *compact;
+  __sync_synchronize();
+  queue->tail = tail + 1;
+  return 0;
+}
+
+/**
+ * @brief Remove the first compact message from the ring buffer.
+ * @private @memberof MIDIMessageQueue
+ * @param queue   The message queue.
+ * @param compact The compact message.
+ * @retval 0 on success.
+ * @retval 1 if the ring buffer is empty.
+ */
+static int _compact_pop( struct MIDIMessageQueue * queue, struct MIDICompactMessage * compact ) {
+  size_t head = queue->head;
+  if( head == queue->tail ) return 1;
+  __sync_synchronize();
+  *compact = queue->compact[head & queue->mask];
+  __sync_synchronize();
+  queue->head = head + 1;
+  return 0;
+}
+
+/**
+ * @brief Get the key under which a message is coalesced.
+ * Control changes and polyphonic key pressure are coalesced per channel
+ * and controller or key, channel pressure and pitch wheel changes per
+ * channel.
+ * @private @memberof MIDIMessageQueue
+ * @param message The message.
+ * @param key     The key.
+ * @retval 0 on success.
+ * @retval 1 if the message is never coalesced.
+ */
+static int _coalesce_key( struct MIDIMessage * message, unsigned int * key ) {
+  struct MIDICompactMessage compact;
+  if( MIDIMessageGetCompact( message, &compact ) ) return 1;
+  switch( compact.bytes[0] >> 4 ) {
+    case MIDI_STATUS_POLYPHONIC_KEY_PRESSURE:
+    case MIDI_STATUS_CONTROL_CHANGE:
+      *key = ( compact.bytes[0] << 8 ) | compact.bytes[1];
+      return 0;
+    case MIDI_STATUS_CHANNEL_PRESSURE:
+    case MIDI_STATUS_PITCH_WHEEL_CHANGE:
+      *key = compact.bytes[0] << 8;
+      return 0;
+    default:
+      return 1;
+  }
+}
+
+/**
+ * @brief Replace a queued message with the same coalescing key.
+ * The new message takes the place of the old one, so it is sent where the
+ * old value would have been sent.
+ * @private @memberof MIDIMessageQueue
+ * @param queue   The message queue.
+ * @param message The message.
+ * @retval 0 if a queued message was replaced.
+ * @retval 1 if there is no message to replace.
+ */
+static int _coalesce( struct MIDIMessageQueue * queue, struct MIDIMessage * message ) {
+  struct MIDIMessage ** slot = NULL;
+  struct MIDIMessageList * item;
+  unsigned int key, other;
+  size_t i;
+
+  if( _coalesce_key( message, &key ) ) return 1;
+  if( queue->ring != NULL ) {
+    for( i = queue->head; i != queue->tail; i++ ) {
+      if( _coalesce_key( queue->ring[i & queue->mask], &other ) == 0 && other == key ) {
+        slot = &(queue->ring[i & queue->mask]);
+      }
+    }
+  } else {
+    for( item = queue->first; item != NULL; item = item->next ) {
+      if( _coalesce_key( item->message, &other ) == 0 && other == key ) {
+        slot = &(item->message);
+      }
+    }
+  }
+  if( slot == NULL ) return 1;
+  MIDIMessageRetain( message );
+  MIDIMessageRelease( *slot );
+  *slot = message;
+  return 0;
+}
+
+/**
+ * @brief Check if a queue reached its capacity.
+ * @private @memberof MIDIMessageQueue
+ * @param queue The message queue.
+ * @retval 0 if another message fits into the queue.
+ * @retval 1 if the queue is full.
+ */
+static int _is_full( struct MIDIMessageQueue * queue ) {
+  size_t length = ( queue->ring != NULL ) ? queue->tail - queue->head : queue->length;
+  if( queue->ring != NULL && length > queue->mask ) return 1;
+  return ( queue->limit > 0 && length >= queue->limit );
+}
+
+/**
+ * @}
+ * @endcond
+ */
+
 /* MARK: Creation and destruction *//**
  * @name Creation and destruction
  * Creating, destroying and reference counting of MIDIMessageQueue objects.
@@ -39,9 +235,73 @@ struct MIDIMessageQueue * MIDIMessageQueueCreate() {
   queue->length = 0;
   queue->first  = NULL;
   queue->last   = NULL;
+  queue->mask   = 0;
+  queue->ring   = NULL;
+  queue->compact = NULL;
+  queue->head   = 0;
+  queue->tail   = 0;
+  queue->limit  = 0;
+  queue->policy = MIDI_QUEUE_POLICY_BLOCK;
+  memset( &(queue->stats), 0, sizeof(queue->stats) );
   return queue;
 };
 
+/**
+ * @brief Create a MIDIMessageQueue instance backed by a ring buffer.
+ * Allocate space and initialize a MIDIMessageQueue instance that can
+ * hold at least @c capacity messages. The capacity is rounded up to the
+ * next power of two. Pushing to a full queue fails instead of allocating.
+ * One thread may push while another thread peeks and pops without any
+ * further locking.
+ * @public @memberof MIDIMessageQueue
+ * @param capacity The minimum number of messages the queue can hold.
+ * @return a pointer to the created queue structure on success.
+ * @return a @c NULL pointer if the queue could not created.
+ */
+struct MIDIMessageQueue * MIDIMessageQueueCreateRing( size_t capacity ) {
+  struct MIDIMessageQueue * queue;
+  size_t size = 1;
+  MIDIPrecondReturn( capacity > 0, EINVAL, NULL );
+
+  while( size < capacity ) size <<= 1;
+  queue = MIDIMessageQueueCreate();
+  if( queue == NULL ) return NULL;
+  queue->ring = malloc( sizeof( struct MIDIMessage * ) * size );
+  if( queue->ring == NULL ) {
+    free( queue );
+    return NULL;
+  }
+  queue->mask = size - 1;
+  return queue;
+}
+
+/**
+ * @brief Create a MIDIMessageQueue instance backed by a compact ring buffer.
+ * Like @ref MIDIMessageQueueCreateRing, but the queue stores copies of
+ * compact messages and is used with @ref MIDIMessageQueuePushCompact and
+ * @ref MIDIMessageQueuePopCompact. It holds no message references.
+ * @public @memberof MIDIMessageQueue
+ * @param capacity The minimum number of messages the queue can hold.
+ * @return a pointer to the created queue structure on success.
+ * @return a @c NULL pointer if the queue could not created.
+ */
+struct MIDIMessageQueue * MIDIMessageQueueCreateCompactRing( size_t capacity ) {
+  struct MIDIMessageQueue * queue;
+  size_t size = 1;
+  MIDIPrecondReturn( capacity > 0, EINVAL, NULL );
+
+  while( size < capacity ) size <<= 1;
+  queue = MIDIMessageQueueCreate();
+  if( queue == NULL ) return NULL;
+  queue->compact = malloc( sizeof( struct MIDICompactMessage ) * size );
+  if( queue->compact == NULL ) {
+    free( queue );
+    return NULL;
+  }
+  queue->mask = size - 1;
+  return queue;
+}
+
 /**
  * @brief Destroy a MIDIMessageQueue instance.
  * Free all resources occupied by the queue and release all referenced messages.
@@ -61,6 +321,16 @@ void MIDIMessageQueueDestroy( struct MIDIMessageQueue * queue ) {
     free( item );
     item = next;
   }
+  if( queue->ring != NULL ) {
+    while( queue->head != queue->tail ) {
+      MIDIMessageRelease( queue->ring[queue->head & queue->mask] );
+      queue->head++;
+    }
+    free( queue->ring );
+  }
+  if( queue->compact != NULL ) {
+    free( queue->compact );
+  }
   free( queue );
 }
 
@@ -73,7 +343,7 @@ void MIDIMessageQueueDestroy( struct MIDIMessageQueue * queue ) {
  */
 void MIDIMessageQueueRetain( struct MIDIMessageQueue * queue ) {
   MIDIPrecondReturn( queue != NULL, EFAULT, (void)0 );
-  queue->refs++;
+  MIDIRefRetain( queue->refs );
 }
 
 /**
@@ -85,7 +355,7 @@ void MIDIMessageQueueRetain( struct MIDIMessageQueue * queue ) {
  */
 void MIDIMessageQueueRelease( struct MIDIMessageQueue * queue ) {
   MIDIPrecondReturn( queue != NULL, EFAULT, (void)0 );
-  if( ! --queue->refs ) {
+  if( ! MIDIRefRelease( queue->refs ) ) {
     MIDIMessageQueueDestroy( queue );
   }
 }
@@ -109,22 +379,117 @@ void MIDIMessageQueueRelease( struct MIDIMessageQueue * queue ) {
 int MIDIMessageQueueGetLength( struct MIDIMessageQueue * queue, size_t * length ) {
   MIDIPrecond( queue != NULL, EFAULT );
   MIDIPrecond( length != NULL, EINVAL );
-  *length = queue->length;
+  if( queue->ring != NULL || queue->compact != NULL ) {
+    *length = queue->tail - queue->head;
+  } else {
+    *length = queue->length;
+  }
+  return 0;
+}
+
+/**
+ * Limit the number of messages in a queue.
+ * The policy decides what happens when a message is pushed to a full queue:
+ * - @c MIDI_QUEUE_POLICY_BLOCK rejects the message, the caller has to make
+ *   room by popping messages and try again.
+ * - @c MIDI_QUEUE_POLICY_DROP_NEWEST discards the message.
+ * - @c MIDI_QUEUE_POLICY_DROP_OLDEST discards the first message in the queue.
+ * - @c MIDI_QUEUE_POLICY_COALESCE replaces a queued control change, pitch
+ *   wheel change or aftertouch message for the same channel and controller
+ *   with the new value, even if the queue is not full. Other messages are
+ *   handled like @c MIDI_QUEUE_POLICY_DROP_OLDEST.
+ *
+ * Dropping the oldest message and coalescing modify the beginning of the
+ * queue, a ring buffer queue with such a policy must be popped on the
+ * thread that pushes.
+ * @public @memberof MIDIMessageQueue
+ * @param queue    The message queue.
+ * @param capacity The maximum number of messages, or zero for no limit
+ *                 other than the size of the ring buffer.
+ * @param policy   The policy.
+ * @retval 0 on success.
+ * @retval >0 if the limit could not be set.
+ */
+int MIDIMessageQueueSetLimit( struct MIDIMessageQueue * queue, size_t capacity, int policy ) {
+  MIDIPrecond( queue != NULL, EFAULT );
+  MIDIPrecond( queue->compact == NULL, EINVAL );
+  MIDIPrecond( policy >= MIDI_QUEUE_POLICY_BLOCK && policy <= MIDI_QUEUE_POLICY_COALESCE, EINVAL );
+  queue->limit  = capacity;
+  queue->policy = policy;
   return 0;
 }
 
+/**
+ * Get the statistics of a message queue.
+ * Count the messages that were rejected, dropped or coalesced because the
+ * queue was full.
+ * @public @memberof MIDIMessageQueue
+ * @param queue The message queue.
+ * @param stats The statistics.
+ * @retval 0 on success.
+ * @retval >0 if the statistics could not be determined.
+ */
+int MIDIMessageQueueGetStats( struct MIDIMessageQueue * queue, struct MIDIMessageQueueStats * stats ) {
+  MIDIPrecond( queue != NULL, EFAULT );
+  MIDIPrecond( stats != NULL, EINVAL );
+  *stats = queue->stats;
+  if( queue->ring != NULL || queue->compact != NULL ) {
+    stats->capacity = queue->mask + 1;
+    if( queue->limit > 0 && queue->limit < stats->capacity ) stats->capacity = queue->limit;
+  } else {
+    stats->capacity = queue->limit;
+  }
+  return MIDIMessageQueueGetLength( queue, &(stats->length) );
+}
+
 /**
  * Add a message to the end queue.
+ * If the queue is full, the queue's policy decides what happens, see
+ * @ref MIDIMessageQueueSetLimit.
  * @public @memberof MIDIMessageQueue
  * @param queue The message queue.
  * @param message The message.
  * @retval 0 on success.
- * @retval >0 if the item could not be added.
+ * @retval >0 if the message was not added, i.e. the queue is full and
+ *            the message was rejected or dropped.
  */
 int MIDIMessageQueuePush( struct MIDIMessageQueue * queue, struct MIDIMessage * message ) {
   struct MIDIMessageList * item;
+  struct MIDIMessage * oldest;
+  int result;
   MIDIPrecond( queue != NULL, EFAULT );
   MIDIPrecond( message != NULL, EINVAL );
+  MIDIPrecond( queue->compact == NULL, EINVAL );
+
+  if( queue->policy == MIDI_QUEUE_POLICY_COALESCE && _coalesce( queue, message ) == 0 ) {
+    queue->stats.coalesced++;
+    return 0;
+  }
+  if( _is_full( queue ) ) {
+    switch( queue->policy ) {
+      case MIDI_QUEUE_POLICY_DROP_OLDEST:
+      case MIDI_QUEUE_POLICY_COALESCE:
+        MIDIMessageQueuePop( queue, &oldest );
+        if( oldest != NULL ) MIDIMessageRelease( oldest );
+        queue->stats.dropped++;
+        break;
+      case MIDI_QUEUE_POLICY_DROP_NEWEST:
+        queue->stats.dropped++;
+        return 1;
+      default:
+        queue->stats.rejected++;
+        return 1;
+    }
+  }
+
+  if( queue->ring != NULL ) {
+    result = _ring_push( queue, message );
+    if( result == 0 && queue->tail - queue->head > queue->stats.length_max ) {
+      queue->stats.length_max = queue->tail - queue->head;
+    }
+    if( result == 0 ) MIDITraceHop( message, MIDI_TRACE_QUEUE_PUSH );
+    return result;
+  }
   item = malloc( sizeof( struct MIDIMessageList ) );
   MIDIPrecond( item != NULL, ENOMEM );
   
@@ -139,6 +504,8 @@ int MIDIMessageQueuePush( struct MIDIMessageQueue * queue, struct MIDIMessage *
     queue->last = item;
   }
   queue->length++;
+  if( queue->length > queue->stats.length_max ) queue->stats.length_max = queue->length;
+  MIDITraceHop( message, MIDI_TRACE_QUEUE_PUSH );
   return 0;
 }
 
@@ -153,8 +520,11 @@ int MIDIMessageQueuePush( struct MIDIMessageQueue * queue, struct MIDIMessage *
 int MIDIMessageQueuePeek( struct MIDIMessageQueue * queue, struct MIDIMessage ** message ) {
   MIDIPrecond( queue != NULL, EFAULT );
   MIDIPrecond( message != NULL, EINVAL );
+  MIDIPrecond( queue->compact == NULL, EINVAL );
 
-  if( queue->first != NULL ) {
+  if( queue->ring != NULL ) {
+    *message = _ring_peek( queue );
+  } else if( queue->first != NULL ) {
     *message = queue->first->message;
   } else {
     *message = NULL;
@@ -174,7 +544,13 @@ int MIDIMessageQueuePop( struct MIDIMessageQueue * queue, struct MIDIMessage **
   struct MIDIMessageList * item;
   MIDIPrecond( queue != NULL, EFAULT );
   MIDIPrecond( message != NULL, EINVAL );
+  MIDIPrecond( queue->compact == NULL, EINVAL );
 
+  if( queue->ring != NULL ) {
+    *message = _ring_pop( queue );
+    if( *message != NULL ) MIDITraceHop( *message, MIDI_TRACE_QUEUE_POP );
+    return 0;
+  }
   item = queue->first;
   if( item != NULL ) {
     *message     = item->message;
@@ -184,6 +560,7 @@ int MIDIMessageQueuePop( struct MIDIMessageQueue * queue, struct MIDIMessage **
     }
     queue->length--;
     free( item );
+    MIDITraceHop( *message, MIDI_TRACE_QUEUE_POP );
   } else {
     *message = NULL;
   }
@@ -191,3 +568,42 @@ int MIDIMessageQueuePop( struct MIDIMessageQueue * queue, struct MIDIMessage **
 }
 
 /** @} */
+
+/* MARK: Compact queueing operations *//**
+ * @name Compact queueing operations
+ * Store and retrieve compact messages in queues created with
+ * @ref MIDIMessageQueueCreateCompactRing.
+ * @{
+ */
+
+/**
+ * Add a copy of a compact message to the end of the queue.
+ * @public @memberof MIDIMessageQueue
+ * @param queue   The message queue.
+ * @param compact The compact message.
+ * @retval 0 on success.
+ * @retval >0 if the item could not be added, i.e. the ring buffer is full.
+ */
+int MIDIMessageQueuePushCompact( struct MIDIMessageQueue * queue, struct MIDICompactMessage * compact ) {
+  MIDIPrecond( queue != NULL, EFAULT );
+  MIDIPrecond( compact != NULL, EINVAL );
+  MIDIPrecond( queue->compact != NULL, EINVAL );
+  return _compact_push( queue, compact );
+}
+
+/**
+ * Remove the first compact message in the queue and store it.
+ * @public @memberof MIDIMessageQueue
+ * @param queue   The message queue.
+ * @param compact The compact message.
+ * @retval 0 on success.
+ * @retval >0 if the queue is empty.
+ */
+int MIDIMessageQueuePopCompact( struct MIDIMessageQueue * queue, struct MIDICompactMessage * compact ) {
+  MIDIPrecond( queue != NULL, EFAULT );
+  MIDIPrecond( compact != NULL, EINVAL );
+  MIDIPrecond( queue->compact != NULL, EINVAL );
+  return _compact_pop( queue, compact );
+}
+
+/** @} */
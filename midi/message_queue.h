@@ -6,15 +6,36 @@
 struct MIDIMessage;
 struct MIDIMessageQueue;
 
+#define MIDI_QUEUE_POLICY_BLOCK       0
+#define MIDI_QUEUE_POLICY_DROP_OLDEST 1
+#define MIDI_QUEUE_POLICY_DROP_NEWEST 2
+#define MIDI_QUEUE_POLICY_COALESCE    3
+
+struct MIDIMessageQueueStats {
+  size_t capacity;
+  size_t length;
+  size_t length_max;
+  unsigned long rejected;
+  unsigned long dropped;
+  unsigned long coalesced;
+};
+
 struct MIDIMessageQueue * MIDIMessageQueueCreate();
+struct MIDIMessageQueue * MIDIMessageQueueCreateRing( size_t capacity );
+struct MIDIMessageQueue * MIDIMessageQueueCreateCompactRing( size_t capacity );
 void MIDIMessageQueueDestroy( struct MIDIMessageQueue * queue );
 void MIDIMessageQueueRetain( struct MIDIMessageQueue * queue );
 void MIDIMessageQueueRelease( struct MIDIMessageQueue * queue );
 
 int MIDIMessageQueueGetLength( struct MIDIMessageQueue * queue, size_t * length );
+int MIDIMessageQueueSetLimit( struct MIDIMessageQueue * queue, size_t capacity, int policy );
+int MIDIMessageQueueGetStats( struct MIDIMessageQueue * queue, struct MIDIMessageQueueStats * stats );
 
 int MIDIMessageQueuePush( struct MIDIMessageQueue * queue, struct MIDIMessage * message );
 int MIDIMessageQueuePeek( struct MIDIMessageQueue * queue, struct MIDIMessage ** message );
 int MIDIMessageQueuePop( struct MIDIMessageQueue * queue, struct MIDIMessage ** message );
 
+int MIDIMessageQueuePushCompact( struct MIDIMessageQueue * queue, struct MIDICompactMessage * compact );
+int MIDIMessageQueuePopCompact( struct MIDIMessageQueue * queue, struct MIDICompactMessage * compact );
+
 #endif
@@ -0,0 +1,1198 @@
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#define MIDI_DRIVER_INTERNALS
+#include "metrics.h"
+
+#include "driver.h"
+#include "runloop.h"
+#include "message.h"
+#include "message_queue.h"
+
+#define MIDI_METRICS_CACHE_LINE   64
+#define MIDI_METRICS_REQUEST_SIZE 1024
+#define MIDI_METRICS_MAX_LABELS   8
+
+#define MIDI_METRICS_CONTENT_TYPE "application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+static const char * _metrics_types[] = { "counter", "gauge", "histogram" };
+
+static const char * _metrics_stages[MIDI_DRIVER_NUM_STAGES] = {
+  "socket_read", "decode", "dispatch", "queue", "encode", "socket_write", "schedule", "wakeup"
+};
+
+static const char * _metrics_lanes[MIDI_DRIVER_NUM_LANES] = { "realtime", "bulk" };
+
+/** @internal */
+struct MIDIMetricsEntry;
+
+/**
+ * @internal
+ * The counters of the threads that share a slot. Every slot spans whole
+ * cache lines, so threads that count in different slots never write to
+ * the same line.
+ */
+struct MIDIMetricsSlot {
+  unsigned long values[MIDI_METRICS_COUNTERS];
+} __attribute__(( aligned( MIDI_METRICS_CACHE_LINE ) ));
+
+/** @internal */
+struct MIDIMetricsCounter {
+  char * name;
+  char * help;
+};
+
+/** @internal */
+struct MIDIMetricsClient {
+  int fd;
+  size_t received;
+  size_t sent;
+  size_t length;
+  char * response;
+  char request[MIDI_METRICS_REQUEST_SIZE];
+};
+
+/**
+ * @ingroup MIDI
+ * @brief Export of counters and statistics in the OpenMetrics text format.
+ * The metrics object collects the profiling stats of drivers, the
+ * iteration timing of runloops, queue depths, pool usage and anything a
+ * custom collector adds, for example the per-peer statistics of the
+ * AppleMIDI driver. The text can be written to a file periodically, in
+ * the format of a node exporter's text file collector, or served over
+ * HTTP for a Prometheus scraper.
+ * Collection happens on the thread that runs the metrics' runloop source.
+ * Objects that must only be touched by their own runloop's thread, like
+ * AppleMIDI drivers, should be collected by a source on that runloop.
+ * The statistics of drivers, queues and pools are read without locks and
+ * may be slightly outdated.
+ * Counters added with @ref MIDIMetricsAddCounter may be counted from any
+ * thread. Every thread counts in a slot of its own, so the hot path does
+ * not contend with other threads or with the collection.
+ */
+struct MIDIMetrics {
+/**
+ * @privatesection
+ * @cond INTERNALS
+ */
+  int refs;
+  struct MIDIRunloopSource * rls;
+  size_t nentries;
+  size_t entries_size;
+  struct MIDIMetricsEntry * entries;
+  size_t ncounters;
+  struct MIDIMetricsCounter counters[MIDI_METRICS_COUNTERS];
+  struct MIDIMetricsSlot * slots;
+  char * path;
+  struct timespec interval;
+  unsigned long timer;
+  int listen_fd;
+  unsigned short port;
+  struct MIDIMetricsClient clients[MIDI_METRICS_CLIENTS];
+/** @endcond */
+};
+
+/* MARK: Internals *//**
+ * @name Internals
+ * @cond INTERNALS
+ * Formatting of metric families and the built-in collectors.
+ * @{
+ */
+
+struct MIDIMetricsFamily {
+  char * name;
+  char * help;
+  int type;
+  char * text;
+  size_t length;
+  size_t capacity;
+};
+
+struct MIDIMetricsWriter {
+  size_t nfamilies;
+  size_t families_size;
+  struct MIDIMetricsFamily * families;
+  struct MIDIMetricsFamily * current;
+  int error;
+};
+
+struct MIDIMetricsEntry {
+  int (*collect)( struct MIDIMetricsEntry * entry, struct MIDIMetricsWriter * writer );
+  MIDIMetricsCollectorFn * collector;
+  void * object;
+  char * name;
+  void (*release)( void * object );
+};
+
+static MIDI_THREAD_LOCAL int _metrics_slot = -1;
+static int _metrics_threads = 0;
+
+static char * _strdup( const char * string ) {
+  char * copy = malloc( strlen( string ) + 1 );
+  if( copy != NULL ) strcpy( copy, string );
+  return copy;
+}
+
+static void _writer_init( struct MIDIMetricsWriter * writer ) {
+  writer->nfamilies     = 0;
+  writer->families_size = 0;
+  writer->families      = NULL;
+  writer->current       = NULL;
+  writer->error         = 0;
+}
+
+static void _writer_cleanup( struct MIDIMetricsWriter * writer ) {
+  size_t i;
+  for( i=0; i<writer->nfamilies; i++ ) {
+    free( writer->families[i].name );
+    free( writer->families[i].help );
+    free( writer->families[i].text );
+  }
+  free( writer->families );
+}
+
+/**
+ * @brief Append formatted text to a family.
+ * @param writer The writer.
+ * @param family The family.
+ * @param format The printf-style format.
+ */
+static void _writer_append( struct MIDIMetricsWriter * writer, struct MIDIMetricsFamily * family, const char * format, ... ) {
+  va_list args;
+  size_t capacity;
+  char * text;
+  int n;
+
+  for(;;) {
+    va_start( args, format );
+    n = vsnprintf( family->text + family->length, family->capacity - family->length, format, args );
+    va_end( args );
+    if( n < 0 ) {
+      writer->error = 1;
+      return;
+    }
+    if( family->length + n < family->capacity ) {
+      family->length += n;
+      return;
+    }
+    capacity = ( family->capacity ) ? family->capacity * 2 : 256;
+    while( capacity <= family->length + n ) capacity *= 2;
+    text = realloc( family->text, capacity );
+    if( text == NULL ) {
+      writer->error = 1;
+      return;
+    }
+    family->text     = text;
+    family->capacity = capacity;
+  }
+}
+
+/**
+ * @brief Append a label value with backslashes, quotes and line feeds escaped.
+ * @param writer The writer.
+ * @param family The family.
+ * @param value  The value.
+ */
+static void _writer_append_value( struct MIDIMetricsWriter * writer, struct MIDIMetricsFamily * family, const char * value ) {
+  size_t n;
+  while( *value != '\0' ) {
+    n = strcspn( value, "\\\"\n" );
+    if( n > 0 ) _writer_append( writer, family, "%.*s", (int) n, value );
+    value += n;
+    if( *value == '\n' ) {
+      _writer_append( writer, family, "\\n" );
+      value++;
+    } else if( *value != '\0' ) {
+      _writer_append( writer, family, "\\%c", *value );
+      value++;
+    }
+  }
+}
+
+/**
+ * @brief Write a histogram of the driver's profile.
+ * Bucket @c i holds latencies up to @c 2^i-1 ticks, so the upper bounds
+ * are converted to seconds with the histogram's rate.
+ * @param writer    The writer.
+ * @param name      The name of the family.
+ * @param labels    The labels of the histogram.
+ * @param histogram The histogram.
+ * @param rate      The sampling rate of the histogram.
+ */
+static void _write_histogram( struct MIDIMetricsWriter * writer, char * name, char ** labels,
+                              struct MIDIDriverLatencyHistogram * histogram, MIDISamplingRate rate ) {
+  char * bucket_labels[2 * MIDI_METRICS_MAX_LABELS + 3];
+  char sample[128], le[32];
+  unsigned long count = 0;
+  size_t n;
+  int i;
+
+  for( n=0; labels[n] != NULL && n < 2 * MIDI_METRICS_MAX_LABELS; n++ ) {
+    bucket_labels[n] = labels[n];
+  }
+  bucket_labels[n]   = "le";
+  bucket_labels[n+1] = &(le[0]);
+  bucket_labels[n+2] = NULL;
+
+  snprintf( &(sample[0]), sizeof(sample), "%s_bucket", name );
+  for( i=0; i<MIDI_DRIVER_HISTOGRAM_BUCKETS; i++ ) {
+    count += histogram->buckets[i];
+    if( i + 1 < MIDI_DRIVER_HISTOGRAM_BUCKETS ) {
+      snprintf( &(le[0]), sizeof(le), "%.9g", (double) ( ( 1ULL << i ) - 1 ) / rate );
+    } else {
+      strcpy( &(le[0]), "+Inf" );
+    }
+    MIDIMetricsWriterSample( writer, &(sample[0]), &(bucket_labels[0]), count );
+  }
+  snprintf( &(sample[0]), sizeof(sample), "%s_count", name );
+  MIDIMetricsWriterSample( writer, &(sample[0]), labels, histogram->count );
+  snprintf( &(sample[0]), sizeof(sample), "%s_sum", name );
+  MIDIMetricsWriterSample( writer, &(sample[0]), labels, (double) histogram->total / rate );
+}
+
+static int _collect_driver( struct MIDIMetricsEntry * entry, struct MIDIMetricsWriter * writer ) {
+  struct MIDIDriver * driver = entry->object;
+  struct MIDIDriverProfilingStats stats;
+  char * labels[]     = { "driver", entry->name, NULL, NULL, NULL };
+  char * in_labels[]  = { "driver", entry->name, "direction", "in", NULL };
+  char * out_labels[] = { "driver", entry->name, "direction", "out", NULL };
+  int i;
+
+  /* the driver only has statistics while it is profiled */
+  if( driver->profile == NULL ) return 0;
+  stats = driver->profile->stats;
+
+  MIDIMetricsWriterFamily( writer, "midikit_driver_messages", MIDI_METRICS_COUNTER, "Messages passed by the driver." );
+  MIDIMetricsWriterSample( writer, "midikit_driver_messages_total", &(in_labels[0]), stats.messages_in );
+  MIDIMetricsWriterSample( writer, "midikit_driver_messages_total", &(out_labels[0]), stats.messages_out );
+  MIDIMetricsWriterFamily( writer, "midikit_driver_bytes", MIDI_METRICS_COUNTER, "Bytes passed by the driver." );
+  MIDIMetricsWriterSample( writer, "midikit_driver_bytes_total", &(in_labels[0]), stats.bytes_in );
+  MIDIMetricsWriterSample( writer, "midikit_driver_bytes_total", &(out_labels[0]), stats.bytes_out );
+  MIDIMetricsWriterFamily( writer, "midikit_driver_packets", MIDI_METRICS_COUNTER, "Packets passed by the driver." );
+  MIDIMetricsWriterSample( writer, "midikit_driver_packets_total", &(in_labels[0]), stats.packets_in );
+  MIDIMetricsWriterSample( writer, "midikit_driver_packets_total", &(out_labels[0]), stats.packets_out );
+  MIDIMetricsWriterFamily( writer, "midikit_driver_drops", MIDI_METRICS_COUNTER, "Messages dropped by the driver." );
+  MIDIMetricsWriterSample( writer, "midikit_driver_drops_total", &(labels[0]), stats.drops );
+  MIDIMetricsWriterFamily( writer, "midikit_driver_coalesced", MIDI_METRICS_COUNTER, "Messages replaced by newer ones." );
+  MIDIMetricsWriterSample( writer, "midikit_driver_coalesced_total", &(labels[0]), stats.coalesced );
+  MIDIMetricsWriterFamily( writer, "midikit_driver_thinned", MIDI_METRICS_COUNTER, "Controller values replaced by newer ones." );
+  MIDIMetricsWriterSample( writer, "midikit_driver_thinned_total", &(labels[0]), stats.thinned );
+  MIDIMetricsWriterFamily( writer, "midikit_driver_recovered", MIDI_METRICS_COUNTER, "Messages recovered from the journal." );
+  MIDIMetricsWriterSample( writer, "midikit_driver_recovered_total", &(labels[0]), stats.recovered );
+  MIDIMetricsWriterFamily( writer, "midikit_driver_queue_depth", MIDI_METRICS_GAUGE, "Messages waiting to be sent." );
+  MIDIMetricsWriterSample( writer, "midikit_driver_queue_depth", &(labels[0]), stats.queue_depth );
+  MIDIMetricsWriterFamily( writer, "midikit_driver_queue_depth_max", MIDI_METRICS_GAUGE, "Most messages that waited to be sent." );
+  MIDIMetricsWriterSample( writer, "midikit_driver_queue_depth_max", &(labels[0]), stats.queue_depth_max );
+
+  MIDIMetricsWriterFamily( writer, "midikit_driver_stage_seconds", MIDI_METRICS_HISTOGRAM, "Time spent in a stage of the driver." );
+  labels[2] = "stage";
+  for( i=0; i<MIDI_DRIVER_NUM_STAGES; i++ ) {
+    if( stats.stages[i].count == 0 ) continue;
+    labels[3] = (char *) _metrics_stages[i];
+    _write_histogram( writer, "midikit_driver_stage_seconds", &(labels[0]), &(stats.stages[i]), stats.rate );
+  }
+  MIDIMetricsWriterFamily( writer, "midikit_driver_lane_seconds", MIDI_METRICS_HISTOGRAM, "Time messages waited in an output lane." );
+  labels[2] = "lane";
+  for( i=0; i<MIDI_DRIVER_NUM_LANES; i++ ) {
+    if( stats.lanes[i].count == 0 ) continue;
+    labels[3] = (char *) _metrics_lanes[i];
+    _write_histogram( writer, "midikit_driver_lane_seconds", &(labels[0]), &(stats.lanes[i]), stats.rate );
+  }
+  return 0;
+}
+
+static int _collect_runloop( struct MIDIMetricsEntry * entry, struct MIDIMetricsWriter * writer ) {
+  struct MIDIRunloopStats stats;
+  char * labels[] = { "runloop", entry->name, NULL };
+  if( MIDIRunloopGetStats( entry->object, &stats ) ) return 1;
+
+  MIDIMetricsWriterFamily( writer, "midikit_runloop_iterations", MIDI_METRICS_COUNTER, "Iterations of the runloop." );
+  MIDIMetricsWriterSample( writer, "midikit_runloop_iterations_total", &(labels[0]), stats.iterations );
+  MIDIMetricsWriterFamily( writer, "midikit_runloop_wait_seconds", MIDI_METRICS_COUNTER, "Time the runloop waited for events." );
+  MIDIMetricsWriterSample( writer, "midikit_runloop_wait_seconds_total", &(labels[0]), stats.wait_usec / 1e6 );
+  MIDIMetricsWriterFamily( writer, "midikit_runloop_busy_seconds", MIDI_METRICS_COUNTER, "Time the runloop spent in callbacks." );
+  MIDIMetricsWriterSample( writer, "midikit_runloop_busy_seconds_total", &(labels[0]), stats.busy_usec / 1e6 );
+  MIDIMetricsWriterFamily( writer, "midikit_runloop_busy_max_seconds", MIDI_METRICS_GAUGE, "Longest time spent in the callbacks of one iteration." );
+  MIDIMetricsWriterSample( writer, "midikit_runloop_busy_max_seconds", &(labels[0]), stats.busy_max_usec / 1e6 );
+  return 0;
+}
+
+static int _collect_queue( struct MIDIMetricsEntry * entry, struct MIDIMetricsWriter * writer ) {
+  struct MIDIMessageQueueStats stats;
+  char * labels[] = { "queue", entry->name, NULL };
+  if( MIDIMessageQueueGetStats( entry->object, &stats ) ) return 1;
+
+  MIDIMetricsWriterFamily( writer, "midikit_queue_length", MIDI_METRICS_GAUGE, "Messages in the queue." );
+  MIDIMetricsWriterSample( writer, "midikit_queue_length", &(labels[0]), stats.length );
+  MIDIMetricsWriterFamily( writer, "midikit_queue_length_max", MIDI_METRICS_GAUGE, "Most messages that were in the queue." );
+  MIDIMetricsWriterSample( writer, "midikit_queue_length_max", &(labels[0]), stats.length_max );
+  MIDIMetricsWriterFamily( writer, "midikit_queue_capacity", MIDI_METRICS_GAUGE, "Capacity of the queue, 0 if unlimited." );
+  MIDIMetricsWriterSample( writer, "midikit_queue_capacity", &(labels[0]), stats.capacity );
+  MIDIMetricsWriterFamily( writer, "midikit_queue_rejected", MIDI_METRICS_COUNTER, "Messages rejected by the full queue." );
+  MIDIMetricsWriterSample( writer, "midikit_queue_rejected_total", &(labels[0]), stats.rejected );
+  MIDIMetricsWriterFamily( writer, "midikit_queue_dropped", MIDI_METRICS_COUNTER, "Messages dropped by the full queue." );
+  MIDIMetricsWriterSample( writer, "midikit_queue_dropped_total", &(labels[0]), stats.dropped );
+  MIDIMetricsWriterFamily( writer, "midikit_queue_coalesced", MIDI_METRICS_COUNTER, "Messages replaced by newer ones." );
+  MIDIMetricsWriterSample( writer, "midikit_queue_coalesced_total", &(labels[0]), stats.coalesced );
+  return 0;
+}
+
+static int _collect_pool( struct MIDIMetricsEntry * entry, struct MIDIMetricsWriter * writer ) {
+  struct MIDIMessagePoolStats stats;
+  char * labels[] = { "pool", entry->name, NULL };
+  if( MIDIMessagePoolGetStats( entry->object, &stats ) ) return 1;
+
+  MIDIMetricsWriterFamily( writer, "midikit_pool_capacity", MIDI_METRICS_GAUGE, "Messages the pool can hold." );
+  MIDIMetricsWriterSample( writer, "midikit_pool_capacity", &(labels[0]), stats.capacity );
+  MIDIMetricsWriterFamily( writer, "midikit_pool_in_use", MIDI_METRICS_GAUGE, "Messages of the pool in use." );
+  MIDIMetricsWriterSample( writer, "midikit_pool_in_use", &(labels[0]), stats.in_use );
+  MIDIMetricsWriterFamily( writer, "midikit_pool_high_water", MIDI_METRICS_GAUGE, "Most messages of the pool in use." );
+  MIDIMetricsWriterSample( writer, "midikit_pool_high_water", &(labels[0]), stats.high_water );
+  MIDIMetricsWriterFamily( writer, "midikit_pool_hits", MIDI_METRICS_COUNTER, "Messages taken from the pool." );
+  MIDIMetricsWriterSample( writer, "midikit_pool_hits_total", &(labels[0]), stats.hits );
+  MIDIMetricsWriterFamily( writer, "midikit_pool_misses", MIDI_METRICS_COUNTER, "Messages allocated because the pool was empty." );
+  MIDIMetricsWriterSample( writer, "midikit_pool_misses_total", &(labels[0]), stats.misses );
+  return 0;
+}
+
+static int _collect_custom( struct MIDIMetricsEntry * entry, struct MIDIMetricsWriter * writer ) {
+  return (*entry->collector)( entry->object, writer );
+}
+
+/**
+ * @brief Sum up the counters of all slots.
+ * @private @memberof MIDIMetrics
+ * @param metrics The metrics.
+ * @param writer  The writer.
+ */
+static void _collect_counters( struct MIDIMetrics * metrics, struct MIDIMetricsWriter * writer ) {
+  char * labels[] = { NULL };
+  char sample[128];
+  unsigned long value;
+  size_t i, j;
+  for( i=0; i<metrics->ncounters; i++ ) {
+    value = 0;
+    for( j=0; j<MIDI_METRICS_SLOTS; j++ ) {
+      value += __atomic_load_n( &(metrics->slots[j].values[i]), __ATOMIC_RELAXED );
+    }
+    snprintf( &(sample[0]), sizeof(sample), "%s_total", metrics->counters[i].name );
+    MIDIMetricsWriterFamily( writer, metrics->counters[i].name, MIDI_METRICS_COUNTER, metrics->counters[i].help );
+    MIDIMetricsWriterSample( writer, &(sample[0]), &(labels[0]), value );
+  }
+}
+
+/**
+ * @brief Collect all metrics and render them as OpenMetrics text.
+ * @private @memberof MIDIMetrics
+ * @param metrics The metrics.
+ * @param text    Will be set to the allocated text, free it.
+ * @param length  Will be set to the length of the text.
+ * @retval 0 on success.
+ * @retval >0 if the text could not be rendered.
+ */
+static int _metrics_render( struct MIDIMetrics * metrics, char ** text, size_t * length ) {
+  struct MIDIMetricsWriter writer;
+  struct MIDIMetricsFamily output = { NULL, NULL, 0, NULL, 0, 0 };
+  struct MIDIMetricsFamily * family;
+  size_t i;
+
+  _writer_init( &writer );
+  for( i=0; i<metrics->nentries; i++ ) {
+    writer.current = NULL;
+    if( (*metrics->entries[i].collect)( &(metrics->entries[i]), &writer ) ) {
+      MIDILog( INFO, "Could not collect metrics of %s.\n",
+               ( metrics->entries[i].name != NULL ) ? metrics->entries[i].name : "collector" );
+    }
+  }
+  writer.current = NULL;
+  _collect_counters( metrics, &writer );
+
+  for( i=0; i<writer.nfamilies; i++ ) {
+    family = &(writer.families[i]);
+    if( family->length == 0 ) continue;
+    _writer_append( &writer, &output, "# TYPE %s %s\n# HELP %s %s\n%.*s",
+                    family->name, _metrics_types[family->type], family->name, family->help,
+                    (int) family->length, family->text );
+  }
+  _writer_append( &writer, &output, "# EOF\n" );
+  _writer_cleanup( &writer );
+  if( writer.error ) {
+    free( output.text );
+    MIDIError( ENOMEM, "Could not render metrics." );
+    return 1;
+  }
+  *text   = output.text;
+  *length = output.length;
+  return 0;
+}
+
+/**
+ * @brief Add a collector.
+ * @private @memberof MIDIMetrics
+ * @param metrics The metrics.
+ * @param entry   The collector, copied.
+ * @retval 0 on success.
+ * @retval >0 if the collector could not be added.
+ */
+static int _metrics_add( struct MIDIMetrics * metrics, struct MIDIMetricsEntry * entry ) {
+  struct MIDIMetricsEntry * entries;
+  size_t size;
+  if( metrics->nentries == metrics->entries_size ) {
+    size = ( metrics->entries_size ) ? metrics->entries_size * 2 : 8;
+    entries = realloc( metrics->entries, size * sizeof(struct MIDIMetricsEntry) );
+    MIDIPrecond( entries != NULL, ENOMEM );
+    metrics->entries      = entries;
+    metrics->entries_size = size;
+  }
+  metrics->entries[metrics->nentries++] = *entry;
+  return 0;
+}
+
+/**
+ * @brief Add a built-in collector for a named object.
+ * @private @memberof MIDIMetrics
+ * @param metrics The metrics.
+ * @param collect The collect function.
+ * @param name    The value of the object's label.
+ * @param object  The object, retained by the caller for the collector.
+ * @param release The function to release the object with.
+ * @retval 0 on success.
+ * @retval >0 if the collector could not be added.
+ */
+static int _metrics_add_object( struct MIDIMetrics * metrics,
+                                int (*collect)( struct MIDIMetricsEntry *, struct MIDIMetricsWriter * ),
+                                char * name, void * object, void (*release)( void * ) ) {
+  struct MIDIMetricsEntry entry;
+  entry.collect   = collect;
+  entry.collector = NULL;
+  entry.object    = object;
+  entry.release   = release;
+  entry.name      = _strdup( name );
+  if( entry.name == NULL || _metrics_add( metrics, &entry ) ) {
+    free( entry.name );
+    (*release)( object );
+    return 1;
+  }
+  return 0;
+}
+
+static void _metrics_release_driver( void * object ) { MIDIDriverRelease( object ); }
+static void _metrics_release_runloop( void * object ) { MIDIRunloopRelease( object ); }
+static void _metrics_release_queue( void * object ) { MIDIMessageQueueRelease( object ); }
+static void _metrics_release_pool( void * object ) { MIDIMessagePoolRelease( object ); }
+
+/** @} */
+
+/* MARK: Endpoint *//**
+ * @name Endpoint
+ * The HTTP endpoint and the periodic stats file.
+ * @{
+ */
+
+static void _client_close( struct MIDIMetrics * metrics, struct MIDIMetricsClient * client ) {
+  MIDIRunloopSourceClearRead( metrics->rls, client->fd );
+  MIDIRunloopSourceClearWrite( metrics->rls, client->fd );
+  close( client->fd );
+  free( client->response );
+  client->fd       = -1;
+  client->response = NULL;
+}
+
+/**
+ * @brief Prepare the response to a complete request.
+ * GET requests are answered with the metrics regardless of the path,
+ * anything else is rejected.
+ * @private @memberof MIDIMetrics
+ * @param metrics The metrics.
+ * @param client  The client.
+ */
+static void _client_respond( struct MIDIMetrics * metrics, struct MIDIMetricsClient * client ) {
+  static const char rejected[] = "HTTP/1.0 405 Method Not Allowed\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+  char header[192];
+  char * text = NULL;
+  size_t length = 0;
+  int n;
+
+  if( client->received >= 4 && memcmp( &(client->request[0]), "GET ", 4 ) == 0
+   && _metrics_render( metrics, &text, &length ) == 0 ) {
+    n = snprintf( &(header[0]), sizeof(header),
+                  "HTTP/1.0 200 OK\r\nContent-Type: " MIDI_METRICS_CONTENT_TYPE "\r\n"
+                  "Content-Length: %lu\r\nConnection: close\r\n\r\n", (unsigned long) length );
+    client->response = malloc( n + length );
+    if( client->response != NULL ) {
+      memcpy( client->response, &(header[0]), n );
+      memcpy( client->response + n, text, length );
+      client->length = n + length;
+    }
+    free( text );
+  } else {
+    client->response = _strdup( rejected );
+    client->length   = sizeof(rejected) - 1;
+  }
+  if( client->response == NULL ) {
+    _client_close( metrics, client );
+    return;
+  }
+  client->sent = 0;
+  MIDIRunloopSourceClearRead( metrics->rls, client->fd );
+  MIDIRunloopSourceScheduleWrite( metrics->rls, client->fd );
+}
+
+static void _client_read( struct MIDIMetrics * metrics, struct MIDIMetricsClient * client ) {
+  ssize_t n = recv( client->fd, &(client->request[client->received]),
+                    sizeof(client->request) - 1 - client->received, 0 );
+  if( n < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ) ) return;
+  if( n <= 0 ) {
+    _client_close( metrics, client );
+    return;
+  }
+  client->received += n;
+  client->request[client->received] = '\0';
+  if( strstr( &(client->request[0]), "\r\n\r\n" ) != NULL || strstr( &(client->request[0]), "\n\n" ) != NULL
+   || client->received == sizeof(client->request) - 1 ) {
+    _client_respond( metrics, client );
+  }
+}
+
+static void _client_write( struct MIDIMetrics * metrics, struct MIDIMetricsClient * client ) {
+  int flags = 0;
+  ssize_t n;
+#ifdef MSG_NOSIGNAL
+  flags = MSG_NOSIGNAL;
+#endif
+  n = send( client->fd, client->response + client->sent, client->length - client->sent, flags );
+  if( n < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ) ) return;
+  if( n > 0 ) client->sent += n;
+  if( n <= 0 || client->sent == client->length ) {
+    _client_close( metrics, client );
+  }
+}
+
+/**
+ * @brief Accept a scraper's connection.
+ * Connections beyond @c MIDI_METRICS_CLIENTS are closed right away.
+ * @private @memberof MIDIMetrics
+ * @param metrics The metrics.
+ */
+static void _metrics_accept( struct MIDIMetrics * metrics ) {
+  struct MIDIMetricsClient * client = NULL;
+  int fd, i;
+
+  fd = accept( metrics->listen_fd, NULL, NULL );
+  if( fd < 0 ) return;
+  for( i=0; i<MIDI_METRICS_CLIENTS; i++ ) {
+    if( metrics->clients[i].fd < 0 ) {
+      client = &(metrics->clients[i]);
+      break;
+    }
+  }
+  if( client == NULL || fcntl( fd, F_SETFL, fcntl( fd, F_GETFL, 0 ) | O_NONBLOCK ) ) {
+    MIDILog( INFO, "Rejected metrics connection.\n" );
+    close( fd );
+    return;
+  }
+  client->fd       = fd;
+  client->received = 0;
+  client->response = NULL;
+  MIDIRunloopSourceScheduleRead( metrics->rls, fd );
+}
+
+static int _metrics_read_fds( void * info, int nfds, fd_set * fds ) {
+  struct MIDIMetrics * metrics = info;
+  int i;
+  if( nfds <= 0 ) return 0;
+  for( i=0; i<MIDI_METRICS_CLIENTS; i++ ) {
+    if( metrics->clients[i].fd >= 0 && metrics->clients[i].response == NULL
+     && FD_ISSET( metrics->clients[i].fd, fds ) ) {
+      _client_read( metrics, &(metrics->clients[i]) );
+    }
+  }
+  if( metrics->listen_fd >= 0 && FD_ISSET( metrics->listen_fd, fds ) ) {
+    _metrics_accept( metrics );
+  }
+  return 0;
+}
+
+static int _metrics_write_fds( void * info, int nfds, fd_set * fds ) {
+  struct MIDIMetrics * metrics = info;
+  int i;
+  if( nfds <= 0 ) return 0;
+  for( i=0; i<MIDI_METRICS_CLIENTS; i++ ) {
+    if( metrics->clients[i].fd >= 0 && metrics->clients[i].response != NULL
+     && FD_ISSET( metrics->clients[i].fd, fds ) ) {
+      _client_write( metrics, &(metrics->clients[i]) );
+    }
+  }
+  return 0;
+}
+
+static int _metrics_idle_timeout( void * info, struct timespec * ts ) {
+  return 0;
+}
+
+/**
+ * @brief Write the stats file and schedule the next write.
+ * @private @memberof MIDIMetrics
+ * @param info The metrics.
+ * @param now  The current time.
+ * @retval 0 always, a failed write does not stop the runloop.
+ */
+static int _metrics_file_timer( void * info, struct timespec * now ) {
+  struct MIDIMetrics * metrics = info;
+  metrics->timer = 0;
+  if( metrics->path == NULL ) return 0;
+  if( MIDIMetricsWriteFile( metrics, metrics->path ) ) {
+    MIDILog( ERROR, "Could not write metrics to %s.\n", metrics->path );
+  }
+  MIDIRunloopSourceAddTimer( metrics->rls, &(metrics->interval), &_metrics_file_timer, metrics, &(metrics->timer) );
+  return 0;
+}
+
+/** @} */
+
+/* MARK: Creation and destruction *//**
+ * @name Creation and destruction
+ * Creating, destroying and reference counting of MIDIMetrics objects.
+ * @{
+ */
+
+/**
+ * @brief Create a MIDIMetrics instance.
+ * Allocate space and initialize a MIDIMetrics instance. Add its runloop
+ * source to a runloop to write the stats file and serve the endpoint.
+ * @public @memberof MIDIMetrics
+ * @return a pointer to the created metrics structure on success.
+ * @return a @c NULL pointer if the metrics could not created.
+ */
+struct MIDIMetrics * MIDIMetricsCreate() {
+  struct MIDIMetrics * metrics;
+  struct MIDIRunloopSourceDelegate delegate = { NULL, &_metrics_read_fds, &_metrics_write_fds, &_metrics_idle_timeout };
+  void * slots = NULL;
+  int i;
+
+  metrics = malloc( sizeof( struct MIDIMetrics ) );
+  MIDIPrecondReturn( metrics != NULL, ENOMEM, NULL );
+  memset( metrics, 0, sizeof( struct MIDIMetrics ) );
+  metrics->refs      = 1;
+  metrics->listen_fd = -1;
+  for( i=0; i<MIDI_METRICS_CLIENTS; i++ ) {
+    metrics->clients[i].fd = -1;
+  }
+  if( posix_memalign( &slots, MIDI_METRICS_CACHE_LINE, sizeof(struct MIDIMetricsSlot) * MIDI_METRICS_SLOTS ) ) {
+    MIDIError( ENOMEM, "Could not allocate metrics counters." );
+    free( metrics );
+    return NULL;
+  }
+  memset( slots, 0, sizeof(struct MIDIMetricsSlot) * MIDI_METRICS_SLOTS );
+  metrics->slots = slots;
+
+  delegate.info = metrics;
+  metrics->rls = MIDIRunloopSourceCreate( &delegate );
+  if( metrics->rls == NULL ) {
+    free( metrics->slots );
+    free( metrics );
+    return NULL;
+  }
+  return metrics;
+}
+
+/**
+ * @brief Destroy a MIDIMetrics instance.
+ * Close the endpoint, stop writing the stats file and release all
+ * collected objects.
+ * @public @memberof MIDIMetrics
+ * @param metrics The metrics.
+ */
+void MIDIMetricsDestroy( struct MIDIMetrics * metrics ) {
+  size_t i;
+  MIDIMetricsSetFile( metrics, NULL, 0 );
+  MIDIMetricsListen( metrics, 0 );
+  for( i=0; i<metrics->nentries; i++ ) {
+    if( metrics->entries[i].release != NULL ) {
+      (*metrics->entries[i].release)( metrics->entries[i].object );
+    }
+    free( metrics->entries[i].name );
+  }
+  for( i=0; i<metrics->ncounters; i++ ) {
+    free( metrics->counters[i].name );
+    free( metrics->counters[i].help );
+  }
+  MIDIRunloopSourceInvalidate( metrics->rls );
+  MIDIRunloopSourceRelease( metrics->rls );
+  free( metrics->entries );
+  free( metrics->slots );
+  free( metrics );
+}
+
+/**
+ * @brief Retain a MIDIMetrics instance.
+ * Increment the reference counter of a metrics object so that it won't be destroyed.
+ * @public @memberof MIDIMetrics
+ * @param metrics The metrics.
+ */
+void MIDIMetricsRetain( struct MIDIMetrics * metrics ) {
+  MIDIPrecondReturn( metrics != NULL, EFAULT, (void)0 );
+  MIDIRefRetain( metrics->refs );
+}
+
+/**
+ * @brief Release a MIDIMetrics instance.
+ * Decrement the reference counter of a metrics object. If the reference
+ * count reached zero, destroy the metrics.
+ * @public @memberof MIDIMetrics
+ * @param metrics The metrics.
+ */
+void MIDIMetricsRelease( struct MIDIMetrics * metrics ) {
+  MIDIPrecondReturn( metrics != NULL, EFAULT, (void)0 );
+  if( ! MIDIRefRelease( metrics->refs ) ) {
+    MIDIMetricsDestroy( metrics );
+  }
+}
+
+/** @} */
+
+/* MARK: Collection *//**
+ * @name Collection
+ * Adding objects and collectors to the metrics.
+ * @{
+ */
+
+/**
+ * @brief Export the profiling stats of a driver.
+ * The counters, queue depths and latency histograms are exported while
+ * the driver is profiled, see @ref MIDIDriverStartProfiling.
+ * @public @memberof MIDIMetrics
+ * @param metrics The metrics.
+ * @param name    The value of the @c driver label.
+ * @param driver  The driver, retained by the metrics.
+ * @retval 0 on success.
+ * @retval >0 if the driver could not be added.
+ */
+int MIDIMetricsAddDriver( struct MIDIMetrics * metrics, char * name, struct MIDIDriver * driver ) {
+  MIDIPrecond( metrics != NULL, EFAULT );
+  MIDIPrecond( name != NULL && driver != NULL, EINVAL );
+  MIDIDriverRetain( driver );
+  return _metrics_add_object( metrics, &_collect_driver, name, driver, &_metrics_release_driver );
+}
+
+/**
+ * @brief Export the iteration timing of a runloop.
+ * @public @memberof MIDIMetrics
+ * @param metrics The metrics.
+ * @param name    The value of the @c runloop label.
+ * @param runloop The runloop, retained by the metrics.
+ * @retval 0 on success.
+ * @retval >0 if the runloop could not be added.
+ */
+int MIDIMetricsAddRunloop( struct MIDIMetrics * metrics, char * name, struct MIDIRunloop * runloop ) {
+  MIDIPrecond( metrics != NULL, EFAULT );
+  MIDIPrecond( name != NULL && runloop != NULL, EINVAL );
+  MIDIRunloopRetain( runloop );
+  return _metrics_add_object( metrics, &_collect_runloop, name, runloop, &_metrics_release_runloop );
+}
+
+/**
+ * @brief Export the depth and the limit counters of a message queue.
+ * @public @memberof MIDIMetrics
+ * @param metrics The metrics.
+ * @param name    The value of the @c queue label.
+ * @param queue   The queue, retained by the metrics.
+ * @retval 0 on success.
+ * @retval >0 if the queue could not be added.
+ */
+int MIDIMetricsAddQueue( struct MIDIMetrics * metrics, char * name, struct MIDIMessageQueue * queue ) {
+  MIDIPrecond( metrics != NULL, EFAULT );
+  MIDIPrecond( name != NULL && queue != NULL, EINVAL );
+  MIDIMessageQueueRetain( queue );
+  return _metrics_add_object( metrics, &_collect_queue, name, queue, &_metrics_release_queue );
+}
+
+/**
+ * @brief Export the usage of a message pool.
+ * @public @memberof MIDIMetrics
+ * @param metrics The metrics.
+ * @param name    The value of the @c pool label.
+ * @param pool    The pool, retained by the metrics.
+ * @retval 0 on success.
+ * @retval >0 if the pool could not be added.
+ */
+int MIDIMetricsAddPool( struct MIDIMetrics * metrics, char * name, struct MIDIMessagePool * pool ) {
+  MIDIPrecond( metrics != NULL, EFAULT );
+  MIDIPrecond( name != NULL && pool != NULL, EINVAL );
+  MIDIMessagePoolRetain( pool );
+  return _metrics_add_object( metrics, &_collect_pool, name, pool, &_metrics_release_pool );
+}
+
+/**
+ * @brief Add a custom collector.
+ * The collector is called on every collection and adds its families and
+ * samples with @ref MIDIMetricsWriterFamily and @ref MIDIMetricsWriterSample.
+ * @public @memberof MIDIMetrics
+ * @param metrics   The metrics.
+ * @param collector The collector.
+ * @param info      The info passed to the collector, not retained.
+ * @retval 0 on success.
+ * @retval >0 if the collector could not be added.
+ */
+int MIDIMetricsAddCollector( struct MIDIMetrics * metrics, MIDIMetricsCollectorFn * collector, void * info ) {
+  struct MIDIMetricsEntry entry;
+  MIDIPrecond( metrics != NULL, EFAULT );
+  MIDIPrecond( collector != NULL, EINVAL );
+  entry.collect   = &_collect_custom;
+  entry.collector = collector;
+  entry.object    = info;
+  entry.name      = NULL;
+  entry.release   = NULL;
+  return _metrics_add( metrics, &entry );
+}
+
+/**
+ * @brief Stop exporting an object.
+ * Remove every collector of the given object or collector info and
+ * release the object.
+ * @public @memberof MIDIMetrics
+ * @param metrics The metrics.
+ * @param object  The object.
+ * @retval 0 on success.
+ * @retval >0 if the object was not exported.
+ */
+int MIDIMetricsRemove( struct MIDIMetrics * metrics, void * object ) {
+  struct MIDIMetricsEntry entry;
+  size_t i = 0, removed = 0;
+  MIDIPrecond( metrics != NULL, EFAULT );
+  while( i < metrics->nentries ) {
+    if( metrics->entries[i].object != object ) {
+      i++;
+      continue;
+    }
+    entry = metrics->entries[i];
+    memmove( &(metrics->entries[i]), &(metrics->entries[i+1]),
+             ( metrics->nentries - i - 1 ) * sizeof(struct MIDIMetricsEntry) );
+    metrics->nentries--;
+    if( entry.release != NULL ) (*entry.release)( entry.object );
+    free( entry.name );
+    removed++;
+  }
+  return ( removed > 0 ) ? 0 : 1;
+}
+
+/**
+ * @brief Add a counter.
+ * The counter is exported as a family of its own with a @c _total sample.
+ * Add all counters before they are counted from other threads.
+ * @public @memberof MIDIMetrics
+ * @param metrics The metrics.
+ * @param name    The name of the counter family.
+ * @param help    The description of the counter.
+ * @param counter Will be set to the index of the counter.
+ * @retval 0 on success.
+ * @retval >0 if no more counters can be added.
+ */
+int MIDIMetricsAddCounter( struct MIDIMetrics * metrics, char * name, char * help, size_t * counter ) {
+  struct MIDIMetricsCounter * c;
+  MIDIPrecond( metrics != NULL, EFAULT );
+  MIDIPrecond( name != NULL && help != NULL && counter != NULL, EINVAL );
+  MIDIPrecond( metrics->ncounters < MIDI_METRICS_COUNTERS, ENOMEM );
+  c = &(metrics->counters[metrics->ncounters]);
+  c->name = _strdup( name );
+  c->help = _strdup( help );
+  if( c->name == NULL || c->help == NULL ) {
+    free( c->name );
+    free( c->help );
+    MIDIError( ENOMEM, "Could not allocate metrics counter." );
+    return 1;
+  }
+  *counter = metrics->ncounters++;
+  return 0;
+}
+
+/**
+ * @brief Count events.
+ * This may be called from any thread. The calling thread adds to a slot
+ * of its own, threads only share a slot when there are more than
+ * @c MIDI_METRICS_SLOTS of them.
+ * @public @memberof MIDIMetrics
+ * @param metrics The metrics.
+ * @param counter The index of the counter.
+ * @param n       The number of events.
+ */
+void MIDIMetricsCount( struct MIDIMetrics * metrics, size_t counter, unsigned long n ) {
+  MIDIPrecondReturn( metrics != NULL, EFAULT, (void)0 );
+  MIDIPrecondReturn( counter < metrics->ncounters, EINVAL, (void)0 );
+  if( _metrics_slot < 0 ) {
+    _metrics_slot = __sync_fetch_and_add( &_metrics_threads, 1 ) % MIDI_METRICS_SLOTS;
+  }
+  __atomic_fetch_add( &(metrics->slots[_metrics_slot].values[counter]), n, __ATOMIC_RELAXED );
+}
+
+/** @} */
+
+/* MARK: Export *//**
+ * @name Export
+ * Writing the metrics to files and serving them over HTTP.
+ * @{
+ */
+
+/**
+ * @brief Collect the metrics and write them to a file.
+ * @public @memberof MIDIMetrics
+ * @param metrics The metrics.
+ * @param file    The file.
+ * @retval 0 on success.
+ * @retval >0 if the metrics could not be written.
+ */
+int MIDIMetricsWrite( struct MIDIMetrics * metrics, FILE * file ) {
+  char * text = NULL;
+  size_t length = 0;
+  int result;
+  MIDIPrecond( metrics != NULL, EFAULT );
+  MIDIPrecond( file != NULL, EINVAL );
+  if( _metrics_render( metrics, &text, &length ) ) return 1;
+  result = ( fwrite( text, 1, length, file ) == length ) ? 0 : 1;
+  free( text );
+  return result;
+}
+
+/**
+ * @brief Collect the metrics and replace a stats file.
+ * The metrics are written to a temporary file next to the stats file
+ * which is then renamed, so readers never see a partial file.
+ * @public @memberof MIDIMetrics
+ * @param metrics The metrics.
+ * @param path    The path of the stats file.
+ * @retval 0 on success.
+ * @retval >0 if the file could not be written.
+ */
+int MIDIMetricsWriteFile( struct MIDIMetrics * metrics, char * path ) {
+  char * tmp;
+  FILE * file;
+  int result;
+  MIDIPrecond( metrics != NULL, EFAULT );
+  MIDIPrecond( path != NULL, EINVAL );
+
+  tmp = malloc( strlen( path ) + 5 );
+  MIDIPrecond( tmp != NULL, ENOMEM );
+  sprintf( tmp, "%s.tmp", path );
+  file = fopen( tmp, "w" );
+  if( file == NULL ) {
+    free( tmp );
+    return 1;
+  }
+  result  = MIDIMetricsWrite( metrics, file );
+  result |= ( fclose( file ) != 0 );
+  if( result == 0 && rename( tmp, path ) ) result = 1;
+  if( result ) unlink( tmp );
+  free( tmp );
+  return result;
+}
+
+/**
+ * @brief Write a stats file periodically.
+ * The file is written by the metrics' runloop source.
+ * @public @memberof MIDIMetrics
+ * @param metrics The metrics.
+ * @param path    The path of the stats file, @c NULL to stop writing it.
+ * @param usec    The interval in microseconds.
+ * @retval 0 on success.
+ * @retval >0 if the file could not be scheduled.
+ */
+int MIDIMetricsSetFile( struct MIDIMetrics * metrics, char * path, unsigned long usec ) {
+  MIDIPrecond( metrics != NULL, EFAULT );
+  MIDIPrecond( path == NULL || usec > 0, EINVAL );
+  if( metrics->timer != 0 ) {
+    MIDIRunloopSourceCancelTimer( metrics->rls, metrics->timer );
+    metrics->timer = 0;
+  }
+  free( metrics->path );
+  metrics->path = NULL;
+  if( path == NULL ) return 0;
+
+  metrics->path = _strdup( path );
+  MIDIPrecond( metrics->path != NULL, ENOMEM );
+  metrics->interval.tv_sec  = usec / 1000000;
+  metrics->interval.tv_nsec = ( usec % 1000000 ) * 1000;
+  return MIDIRunloopSourceAddTimer( metrics->rls, &(metrics->interval), &_metrics_file_timer, metrics, &(metrics->timer) );
+}
+
+/**
+ * @brief Serve the metrics over HTTP.
+ * Every GET request on the port is answered with the metrics in the
+ * OpenMetrics text format, so a Prometheus scraper can be pointed at it.
+ * @public @memberof MIDIMetrics
+ * @param metrics The metrics.
+ * @param port    The TCP port, 0 to close the endpoint.
+ * @retval 0 on success.
+ * @retval >0 if the port could not be opened.
+ */
+int MIDIMetricsListen( struct MIDIMetrics * metrics, unsigned short port ) {
+  struct sockaddr_in addr;
+  socklen_t size = sizeof(addr);
+  int fd, yes = 1, i;
+  MIDIPrecond( metrics != NULL, EFAULT );
+
+  for( i=0; i<MIDI_METRICS_CLIENTS; i++ ) {
+    if( metrics->clients[i].fd >= 0 ) _client_close( metrics, &(metrics->clients[i]) );
+  }
+  if( metrics->listen_fd >= 0 ) {
+    MIDIRunloopSourceClearRead( metrics->rls, metrics->listen_fd );
+    close( metrics->listen_fd );
+    metrics->listen_fd = -1;
+    metrics->port      = 0;
+  }
+  if( port == 0 ) return 0;
+
+  fd = socket( AF_INET, SOCK_STREAM, 0 );
+  MIDIPrecond( fd >= 0, errno );
+  memset( &addr, 0, sizeof(addr) );
+  addr.sin_family      = AF_INET;
+  addr.sin_port        = htons( port );
+  addr.sin_addr.s_addr = htonl( INADDR_ANY );
+  setsockopt( fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes) );
+  if( bind( fd, (struct sockaddr *) &addr, sizeof(addr) ) || listen( fd, MIDI_METRICS_CLIENTS )
+   || fcntl( fd, F_SETFL, fcntl( fd, F_GETFL, 0 ) | O_NONBLOCK )
+   || getsockname( fd, (struct sockaddr *) &addr, &size ) ) {
+    MIDIError( errno, "Could not open metrics endpoint." );
+    close( fd );
+    return 1;
+  }
+  metrics->listen_fd = fd;
+  metrics->port      = ntohs( addr.sin_port );
+  return MIDIRunloopSourceScheduleRead( metrics->rls, fd );
+}
+
+/**
+ * @brief Get the port of the HTTP endpoint.
+ * @public @memberof MIDIMetrics
+ * @param metrics The metrics.
+ * @param port    The TCP port, 0 if the endpoint is closed.
+ * @retval 0 on success.
+ */
+int MIDIMetricsGetPort( struct MIDIMetrics * metrics, unsigned short * port ) {
+  MIDIPrecond( metrics != NULL, EFAULT );
+  MIDIPrecond( port != NULL, EINVAL );
+  *port = metrics->port;
+  return 0;
+}
+
+/**
+ * @brief Get the runloop source of the metrics.
+ * @public @memberof MIDIMetrics
+ * @param metrics The metrics.
+ * @param source  The runloop source.
+ * @retval 0 on success.
+ */
+int MIDIMetricsGetRunloopSource( struct MIDIMetrics * metrics, struct MIDIRunloopSource ** source ) {
+  MIDIPrecond( metrics != NULL, EFAULT );
+  MIDIPrecond( source != NULL, EINVAL );
+  *source = metrics->rls;
+  return 0;
+}
+
+/** @} */
+
+/* MARK: Writer *//**
+ * @name Writer
+ * Adding families and samples from collectors.
+ * @{
+ */
+
+/**
+ * @brief Start or continue a metric family.
+ * Samples that follow are added to the family. Families of the same name
+ * that are added by several collectors are merged, so every family
+ * appears once in the output.
+ * @public @memberof MIDIMetricsWriter
+ * @param writer The writer.
+ * @param name   The name of the family, without the @c _total suffix of counters.
+ * @param type   The type, one of @c MIDI_METRICS_COUNTER, @c MIDI_METRICS_GAUGE
+ *               or @c MIDI_METRICS_HISTOGRAM.
+ * @param help   The description of the family.
+ * @retval 0 on success.
+ * @retval >0 if the family could not be added.
+ */
+int MIDIMetricsWriterFamily( struct MIDIMetricsWriter * writer, char * name, int type, char * help ) {
+  struct MIDIMetricsFamily * families, * family;
+  size_t i, size;
+  MIDIPrecond( writer != NULL, EFAULT );
+  MIDIPrecond( name != NULL && help != NULL, EINVAL );
+  MIDIPrecond( type >= MIDI_METRICS_COUNTER && type <= MIDI_METRICS_HISTOGRAM, EINVAL );
+
+  for( i=0; i<writer->nfamilies; i++ ) {
+    if( strcmp( writer->families[i].name, name ) == 0 ) {
+      writer->current = &(writer->families[i]);
+      return 0;
+    }
+  }
+  if( writer->nfamilies == writer->families_size ) {
+    size = ( writer->families_size ) ? writer->families_size * 2 : 32;
+    families = realloc( writer->families, size * sizeof(struct MIDIMetricsFamily) );
+    if( families == NULL ) {
+      writer->error = 1;
+      writer->current = NULL;
+      return 1;
+    }
+    writer->families      = families;
+    writer->families_size = size;
+  }
+  family = &(writer->families[writer->nfamilies]);
+  family->name     = _strdup( name );
+  family->help     = _strdup( help );
+  family->type     = type;
+  family->text     = NULL;
+  family->length   = 0;
+  family->capacity = 0;
+  if( family->name == NULL || family->help == NULL ) {
+    free( family->name );
+    free( family->help );
+    writer->error = 1;
+    writer->current = NULL;
+    return 1;
+  }
+  writer->nfamilies++;
+  writer->current = family;
+  return 0;
+}
+
+/**
+ * @brief Add a sample to the current family.
+ * @public @memberof MIDIMetricsWriter
+ * @param writer The writer.
+ * @param name   The name of the sample, the family's name with a suffix
+ *               like @c _total or @c _bucket where the type requires it.
+ * @param labels A @c NULL terminated list of label names and values,
+ *               the values are escaped.
+ * @param value  The value.
+ * @retval 0 on success.
+ * @retval >0 if no family was started.
+ */
+int MIDIMetricsWriterSample( struct MIDIMetricsWriter * writer, char * name, char ** labels, double value ) {
+  struct MIDIMetricsFamily * family;
+  size_t i;
+  MIDIPrecond( writer != NULL, EFAULT );
+  MIDIPrecond( name != NULL, EINVAL );
+  family = writer->current;
+  if( family == NULL ) return 1;
+
+  _writer_append( writer, family, "%s", name );
+  if( labels != NULL && labels[0] != NULL ) {
+    for( i=0; labels[i] != NULL && labels[i+1] != NULL; i+=2 ) {
+      _writer_append( writer, family, "%s%s=\"", ( i == 0 ) ? "{" : ",", labels[i] );
+      _writer_append_value( writer, family, labels[i+1] );
+      _writer_append( writer, family, "\"" );
+    }
+    _writer_append( writer, family, "}" );
+  }
+  if( value == (double) (long long) value && value < 1e15 && value > -1e15 ) {
+    _writer_append( writer, family, " %lld\n", (long long) value );
+  } else {
+    _writer_append( writer, family, " %.9g\n", value );
+  }
+  return 0;
+}
+
+/** @} */
@@ -0,0 +1,50 @@
+#ifndef MIDIKIT_MIDI_METRICS_H
+#define MIDIKIT_MIDI_METRICS_H
+#include <stdio.h>
+#include "midi.h"
+
+struct MIDIDriver;
+struct MIDIRunloop;
+struct MIDIRunloopSource;
+struct MIDIMessagePool;
+struct MIDIMessageQueue;
+
+struct MIDIMetrics;
+struct MIDIMetricsWriter;
+
+#define MIDI_METRICS_COUNTER   0
+#define MIDI_METRICS_GAUGE     1
+#define MIDI_METRICS_HISTOGRAM 2
+
+#define MIDI_METRICS_SLOTS     16
+#define MIDI_METRICS_COUNTERS  64
+#define MIDI_METRICS_CLIENTS   4
+
+typedef int MIDIMetricsCollectorFn( void * info, struct MIDIMetricsWriter * writer );
+
+struct MIDIMetrics * MIDIMetricsCreate();
+void MIDIMetricsDestroy( struct MIDIMetrics * metrics );
+void MIDIMetricsRetain( struct MIDIMetrics * metrics );
+void MIDIMetricsRelease( struct MIDIMetrics * metrics );
+
+int MIDIMetricsAddDriver( struct MIDIMetrics * metrics, char * name, struct MIDIDriver * driver );
+int MIDIMetricsAddRunloop( struct MIDIMetrics * metrics, char * name, struct MIDIRunloop * runloop );
+int MIDIMetricsAddQueue( struct MIDIMetrics * metrics, char * name, struct MIDIMessageQueue * queue );
+int MIDIMetricsAddPool( struct MIDIMetrics * metrics, char * name, struct MIDIMessagePool * pool );
+int MIDIMetricsAddCollector( struct MIDIMetrics * metrics, MIDIMetricsCollectorFn * collector, void * info );
+int MIDIMetricsRemove( struct MIDIMetrics * metrics, void * object );
+
+int MIDIMetricsAddCounter( struct MIDIMetrics * metrics, char * name, char * help, size_t * counter );
+void MIDIMetricsCount( struct MIDIMetrics * metrics, size_t counter, unsigned long n );
+
+int MIDIMetricsWrite( struct MIDIMetrics * metrics, FILE * file );
+int MIDIMetricsWriteFile( struct MIDIMetrics * metrics, char * path );
+int MIDIMetricsSetFile( struct MIDIMetrics * metrics, char * path, unsigned long usec );
+int MIDIMetricsListen( struct MIDIMetrics * metrics, unsigned short port );
+int MIDIMetricsGetPort( struct MIDIMetrics * metrics, unsigned short * port );
+int MIDIMetricsGetRunloopSource( struct MIDIMetrics * metrics, struct MIDIRunloopSource ** source );
+
+int MIDIMetricsWriterFamily( struct MIDIMetricsWriter * writer, char * name, int type, char * help );
+int MIDIMetricsWriterSample( struct MIDIMetricsWriter * writer, char * name, char ** labels, double value );
+
+#endif
@@ -312,7 +312,27 @@ extern int MIDIErrorNumber;
 #endif
 #endif
 
+/* every thread may keep its own state */
+#if defined( __GNUC__ )
+#define MIDI_THREAD_LOCAL __thread
+#else
+#define MIDI_THREAD_LOCAL
+#endif
+
 #ifndef NO_LOG
+#ifdef USE_LOG_RING
+#include "log.h"
+#define MIDILog( channel, ... ) \
+do { if( MIDI_LOG_ ## channel & MIDI_LOG_CHANNELS ) { \
+  static struct MIDILogSite _midi_log_site = MIDI_LOG_SITE_INIT( MIDI_LOG_ ## channel, 0 ); \
+  MIDILogRingWrite( &_midi_log_site, __VA_ARGS__ ); \
+} } while( 0 )
+#define MIDILogLocation( channel, fmt, ... ) \
+do { if( MIDI_LOG_ ## channel & MIDI_LOG_CHANNELS ) { \
+  static struct MIDILogSite _midi_log_site = MIDI_LOG_SITE_INIT( MIDI_LOG_ ## channel, 1 ); \
+  MIDILogRingWrite( &_midi_log_site, fmt, __VA_ARGS__ ); \
+} } while( 0 );
+#else
 #define MIDILog( channel, ... ) \
 do { if( MIDILogger != NULL ) { (*MIDILogger)( MIDI_LOG_ ## channel, __VA_ARGS__ ); } } while( 0 )
 #ifdef SUBDIR
@@ -322,6 +342,7 @@ MIDILog( channel, "%s/%s:%i: " fmt, SUBDIR, __FILE__, __LINE__, __VA_ARGS__ );
 #define MIDILogLocation( channel, fmt, ... ) \
 MIDILog( channel, "%s:%i: " fmt, __FILE__, __LINE__, __VA_ARGS__ );
 #endif
+#endif
 #else
 #define MIDILog( channel, fmt, ... )
 #define MIDILogLocation( channel, fmt, ... )
@@ -366,6 +387,18 @@ do { if( !(expr) ) { \
 #define MIDIPrecond( expr, kind )
 #endif
 
+/* Reference counting for the Retain and Release functions. Define
+ * USE_ATOMIC_REFS to make objects safe to share between threads: the
+ * increment is relaxed, the decrement that may destroy the object is
+ * acquire-release so that all writes of other owners are visible. */
+#ifdef USE_ATOMIC_REFS
+#define MIDIRefRetain( refs )  ((void) __atomic_fetch_add( &(refs), 1, __ATOMIC_RELAXED ))
+#define MIDIRefRelease( refs ) __atomic_sub_fetch( &(refs), 1, __ATOMIC_ACQ_REL )
+#else
+#define MIDIRefRetain( refs )  ((void) (refs)++)
+#define MIDIRefRelease( refs ) (--(refs))
+#endif
+
 /**
  * @addtogroup MIDI
  * @{
@@ -1,8 +1,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include "midi.h"
-#include "list.h"
+#include "array.h"
 #include "port.h"
+#include "message.h"
+#include "trace.h"
 
 /**
  * @ingroup MIDI
@@ -22,7 +24,26 @@ struct MIDIPort {
   void * observer;
   MIDIPortReceiveFn * receive;
   MIDIPortInterceptFn * intercept;
-  struct MIDIList * ports;
+  struct MIDIArray * ports;
+  struct MIDIPortSnapshot * snapshot;
+/** @endcond */
+};
+
+/**
+ * @brief Array of connected ports.
+ * A copy of the port array that is used for sending so that messages
+ * are dispatched in a tight loop. It is rebuilt on the first send after
+ * the connections changed. Senders hold a reference while dispatching,
+ * so connections may change from within a receive callback.
+ */
+struct MIDIPortSnapshot {
+/**
+ * @privatesection
+ * @cond INTERNALS
+ */
+  int refs;
+  size_t length;
+  struct MIDIPort * ports[1];
 /** @endcond */
 };
 
@@ -69,39 +90,90 @@ MIDI_TYPE_SPEC_OBJECT( MIDIPort, 0x3000 );
  */
 
 /**
- * Parameter struct for apply function used for sending.
+ * @brief Release a snapshot of connected ports.
+ * @private @memberof MIDIPort
+ * @param snapshot The snapshot.
  */
-struct MIDIPortApplyParams {
-  struct MIDIPort * port;     /**< source port */
-  struct MIDITypeSpec * type; /**< message type */
-  void * object;              /**< message data */
-};
+static void _port_snapshot_release( struct MIDIPortSnapshot * snapshot ) {
+  size_t i;
+  if( MIDIRefRelease( snapshot->refs ) ) return;
+  for( i=0; i<snapshot->length; i++ ) {
+    MIDIPortRelease( snapshot->ports[i] );
+  }
+  free( snapshot );
+}
 
 /**
- * @brief Applier function to send to a port.
- * This is used when a port sends data to all connected ports.
- * If the port to send to was invalidated before, remove it from the
+ * @brief Drop the snapshot of connected ports.
+ * This has to be called whenever the port list changes.
+ * @private @memberof MIDIPort
+ * @param port The port.
+ */
+static void _port_snapshot_invalidate( struct MIDIPort * port ) {
+  struct MIDIPortSnapshot * snapshot = port->snapshot;
+  if( snapshot != NULL ) {
+    port->snapshot = NULL;
+    _port_snapshot_release( snapshot );
+  }
+}
+
+/**
+ * @brief Get the snapshot of connected ports.
+ * Build the snapshot if the port list changed since the last call.
+ * @private @memberof MIDIPort
+ * @param port The port.
+ * @return a retained snapshot on success.
+ * @return a @c NULL pointer if the snapshot could not be created.
+ */
+static struct MIDIPortSnapshot * _port_snapshot( struct MIDIPort * port ) {
+  struct MIDIPortSnapshot * snapshot = port->snapshot;
+  size_t i, length = 0;
+  if( snapshot == NULL ) {
+    MIDIArrayGetLength( port->ports, &length );
+    snapshot = malloc( sizeof( struct MIDIPortSnapshot ) + sizeof( struct MIDIPort * ) * length );
+    MIDIPrecondReturn( snapshot != NULL, ENOMEM, NULL );
+    snapshot->refs   = 1;
+    snapshot->length = length;
+    for( i=0; i<length; i++ ) {
+      MIDIArrayGet( port->ports, i, (void **) &(snapshot->ports[i]) );
+      MIDIPortRetain( snapshot->ports[i] );
+    }
+    port->snapshot = snapshot;
+  }
+  MIDIRefRetain( snapshot->refs );
+  return snapshot;
+}
+
+/**
+ * @brief Send to all connected ports.
+ * If a port to send to was invalidated before, remove it from the
  * list of connected ports. Send the message to the port otherwise.
  * @private @memberof MIDIPort
- * @param item A pointer to the MIDIPort to send to.
- * @param info A pointer to the MIDIPortApplyParams structure
- *             that was passed to MIDIListApply.
+ * @param port   The port with the connections.
+ * @param source The source port of the message.
+ * @param type   The type of the message.
+ * @param object The message.
  * @retval 0 on success.
  */
-static int _port_apply_send( void * item, void * info ) {
-  struct MIDIPort            * port   = item;
-  struct MIDIPortApplyParams * params = info;
-  if( port->mode & MIDI_PORT_INVALID ) {
-    MIDIPortRetain( port );
-    MIDIListRemove( params->port->ports, port );
-    MIDIPortRelease( port );
-    return 0;
-  } else if( port != params->port ) {
-    return MIDIPortReceiveFrom( port, params->port, params->type, params->object );
-  } else {
+static int _port_send_connected( struct MIDIPort * port, struct MIDIPort * source, struct MIDITypeSpec * type, void * object ) {
+  struct MIDIPortSnapshot * snapshot;
+  struct MIDIPort * target;
+  size_t i;
+  int result = 0;
+
+  snapshot = _port_snapshot( port );
+  if( snapshot == NULL ) return 1;
+  for( i=0; i<snapshot->length; i++ ) {
+    target = snapshot->ports[i];
+    if( target->mode & MIDI_PORT_INVALID ) {
+      MIDIPortDisconnect( port, target );
+    } else if( target != source ) {
+      result += MIDIPortReceiveFrom( target, source, type, object );
+    }
     /* avoid sending messages to self */
-    return 0;
   }
+  _port_snapshot_release( snapshot );
+  return result;
 }
 
 /**
@@ -118,9 +190,10 @@ static int _port_apply_check( void * item, void * info ) {
   struct MIDIPort * source = info;
   if( port->mode & MIDI_PORT_INVALID ) {
     /* retain the port, before removing to avoid recursion
-     * release the port *after* it was removed from the list */
+     * release the port *after* it was removed from the array */
     MIDIPortRetain( port );
-    MIDIListRemove( source->ports, port );
+    MIDIArrayRemove( source->ports, port );
+    _port_snapshot_invalidate( source );
     MIDIPortRelease( port );
   }
   return 0;
@@ -171,14 +244,10 @@ static int _port_intercept( struct MIDIPort * port, int mode, struct MIDITypeSpe
  * @retval 0 on success.
  */
 static int _port_passthrough( struct MIDIPort * port, struct MIDIPort * source, struct MIDITypeSpec * type, void * object ) {
-  struct MIDIPortApplyParams params;
   MIDIAssert( port != NULL );
   MIDIAssert( port->mode & MIDI_PORT_THRU );
   _port_intercept( port, MIDI_PORT_THRU, type, object );
-  params.port   = source;
-  params.type   = type;
-  params.object = object;
-  return MIDIListApply( port->ports, &params, &_port_apply_send );
+  return _port_send_connected( port, source, type, object );
 }
 
 /**
@@ -223,14 +292,15 @@ struct MIDIPort * MIDIPortCreate( char * name, int mode, void * target,
   port->name    = malloc( namelen );
   port->target  = target;
   port->receive = receive;
-  port->ports   = MIDIListCreate( MIDIPortType );
+  port->ports   = MIDIArrayCreate( MIDIPortType, 0 );
+  port->snapshot = NULL;
 
   if( port->name == NULL ) {
     free( port );
     return NULL;
   }
   if( port->ports == NULL ) {
-    /* probably ENOMEM, in that case, error code is already set by MIDIList */
+    /* probably ENOMEM, in that case, error code is already set by MIDIArray */
     free( port );
     return NULL;
   }
@@ -251,7 +321,8 @@ struct MIDIPort * MIDIPortCreate( char * name, int mode, void * target,
  */
 void MIDIPortDestroy( struct MIDIPort * port ) {
   MIDIPrecondReturn( port != NULL, EFAULT, (void)0 );
-  MIDIListRelease( port->ports );
+  _port_snapshot_invalidate( port );
+  MIDIArrayRelease( port->ports );
   /* If we get problems with with access to freed ports we could
    * enable this temporarily ..
    * port->ports = NULL;
@@ -269,7 +340,7 @@ void MIDIPortDestroy( struct MIDIPort * port ) {
  */
 void MIDIPortRetain( struct MIDIPort * port ) {
   MIDIPrecondReturn( port != NULL, EFAULT, (void)0 );
-  port->refs++;
+  MIDIRefRetain( port->refs );
 }
 
 /**
@@ -284,10 +355,10 @@ void MIDIPortRetain( struct MIDIPort * port ) {
 void MIDIPortRelease( struct MIDIPort * port ) {
   MIDIPrecondReturn( port != NULL, EFAULT, (void)0 );
   if( port->refs > 1 ) {
-    MIDIListApply( port->ports, port, &_port_apply_check );
+    MIDIArrayApply( port->ports, port, &_port_apply_check );
   }
   MIDILogLocation( DEVELOP, "Release port %s [%p] (%i -> %i)\n", port->name, port, port->refs, port->refs -1 );
-  if( ! --port->refs ) {
+  if( ! MIDIRefRelease( port->refs ) ) {
     MIDIPortDestroy( port );
   }
 }
@@ -311,7 +382,8 @@ void MIDIPortRelease( struct MIDIPort * port ) {
 int MIDIPortConnect( struct MIDIPort * port, struct MIDIPort * target ) {
   MIDIPrecond( port != NULL, EFAULT );
   MIDIPrecond( target != NULL , EINVAL );
-  return MIDIListAdd( port->ports, target );
+  _port_snapshot_invalidate( port );
+  return MIDIArrayAdd( port->ports, target );
 }
 
 /**
@@ -324,7 +396,8 @@ int MIDIPortConnect( struct MIDIPort * port, struct MIDIPort * target ) {
 int MIDIPortDisconnect( struct MIDIPort * port, struct MIDIPort * target ) {
   MIDIPrecond( port != NULL, EFAULT );
   MIDIPrecond( target != NULL , EINVAL );
-  return MIDIListRemove( port->ports, target );
+  _port_snapshot_invalidate( port );
+  return MIDIArrayRemove( port->ports, target );
 }
 
 /**
@@ -335,7 +408,7 @@ int MIDIPortDisconnect( struct MIDIPort * port, struct MIDIPort * target ) {
  */
 int MIDIPortDisconnectAll( struct MIDIPort * port ) {
   MIDIPrecond( port != NULL, EFAULT );
-  return MIDIListApply( port->ports, port, &_port_apply_disconnect );
+  return MIDIArrayApply( port->ports, port, &_port_apply_disconnect );
 }
 
 /**
@@ -386,6 +459,20 @@ int MIDIPortGetObserver( struct MIDIPort * port, void ** target, MIDIPortInterce
   return 0;
 }
 
+/**
+ * @brief Get the number of connected ports.
+ * Senders can use this to skip building messages nobody would receive.
+ * @public @memberof MIDIPort
+ * @param port  The port.
+ * @param count The number of ports the port is connected to.
+ */
+int MIDIPortGetConnectionCount( struct MIDIPort * port, size_t * count ) {
+  MIDIPrecond( port != NULL, EFAULT );
+  MIDIPrecond( count != NULL, EINVAL );
+  MIDIArrayGetLength( port->ports, count );
+  return 0;
+}
+
 /**
  * @brief Simulate an incoming message that was sent by another port.
  * @public @memberof MIDIPort
@@ -407,6 +494,7 @@ int MIDIPortReceiveFrom( struct MIDIPort * port, struct MIDIPort * source, struc
     MIDIAssert( port->target  != NULL );
     MIDIAssert( port->receive != NULL );
 
+    if( type == MIDIMessageType ) MIDITraceHop( object, MIDI_TRACE_PORT );
     _port_intercept( port, MIDI_PORT_IN, type, object );
     if( source != NULL ) {
       result = (*port->receive)( port->target, source->target, type, object );
@@ -460,8 +548,8 @@ int MIDIPortSendTo( struct MIDIPort * port, struct MIDIPort * target, struct MID
 
 /**
  * @brief Send the given message to all connected ports.
- * Use the apply mechanism of the list to send the given message
- * to all connected ports.
+ * Send the given message to all connected ports using an array
+ * snapshot of the connections.
  * @public @memberof MIDIPort
  * @param port   The source port.
  * @param type   The message type to send.
@@ -469,7 +557,6 @@ int MIDIPortSendTo( struct MIDIPort * port, struct MIDIPort * target, struct MID
  * @retval 0 on success.
  */
 int MIDIPortSend( struct MIDIPort * port, struct MIDITypeSpec * type, void * object ) {
-  struct MIDIPortApplyParams params;
   MIDIPrecond( port != NULL, EFAULT );
   MIDIPrecond( port->mode & MIDI_PORT_OUT, EPERM );
   
@@ -477,10 +564,7 @@ int MIDIPortSend( struct MIDIPort * port, struct MIDITypeSpec * type, void * obj
     return 0;
   } else {
     _port_intercept( port, MIDI_PORT_OUT, type, object );
-    params.port   = port;
-    params.type   = type;
-    params.object = object;
-    return MIDIListApply( port->ports, &params, &_port_apply_send );
+    return _port_send_connected( port, port, type, object );
   }
 }
 
@@ -27,6 +27,7 @@ int MIDIPortInvalidate( struct MIDIPort * port );
 
 int MIDIPortSetObserver( struct MIDIPort * port, void * target, MIDIPortInterceptFn * intercept );
 int MIDIPortGetObserver( struct MIDIPort * port, void ** target, MIDIPortInterceptFn ** intercept );
+int MIDIPortGetConnectionCount( struct MIDIPort * port, size_t * count );
 
 int MIDIPortReceiveFrom( struct MIDIPort * port, struct MIDIPort * source, struct MIDITypeSpec * type, void * object );
 int MIDIPortReceive( struct MIDIPort * port, struct MIDITypeSpec * type, void * object );
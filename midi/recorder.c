@@ -0,0 +1,637 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#define MIDI_DRIVER_INTERNALS
+#include "recorder.h"
+
+#include "type.h"
+#include "port.h"
+#include "util.h"
+#include "clock.h"
+#include "driver.h"
+#include "message.h"
+
+#define MIDI_RECORDER_BUFFER_SIZE 65536
+#define MIDI_RECORDER_POOL_SIZE   64
+
+/* delta time and a channel or system message with running status */
+#define MIDI_RECORDER_RECORD_MAX  13
+/* delta time, blob marker and blob length */
+#define MIDI_RECORDER_BLOB_HEADER 15
+
+static const unsigned char _recorder_magic[4] = { 'M', 'K', 'R', 'L' };
+
+/** @internal */
+struct MIDIRecorderBuffer;
+
+/**
+ * @ingroup MIDI
+ * @brief Lossless recorder for the messages a driver receives.
+ * The recorder observes the port of a driver and appends every message
+ * the driver relays to a compact binary log. The log starts with the
+ * magic bytes @c MKRL and the sampling rate of the driver's clock as a
+ * 32 bit big endian number. Every record is the timestamp difference to
+ * the previous record as a variable length number followed by the
+ * message. Channel messages use running status, system exclusive
+ * messages are written as @c 0xf0, the variable length size of the
+ * encoded message and the encoded message itself.
+ * Records are collected in one of two buffers while a background thread
+ * writes the other one. When both buffers are full the recording thread
+ * waits instead of dropping messages.
+ */
+struct MIDIRecorder {
+/**
+ * @privatesection
+ * @cond INTERNALS
+ */
+  int refs;
+  int fd;
+  struct MIDIDriver * driver;
+  MIDIRunningStatus status;
+  MIDIBoolean started;
+  MIDITimestamp last;
+  struct MIDIRecorderBuffer * front;
+  struct MIDIRecorderBuffer * back;
+  struct MIDIRecorderStats stats;
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  int running;
+  int stop;
+  int error;
+/** @endcond */
+};
+
+/* MARK: Internals *//**
+ * @name Internals
+ * @cond INTERNALS
+ * Log encoding and the background writer.
+ * @{
+ */
+
+struct MIDIRecorderBuffer {
+  unsigned char * data;
+  size_t length;
+  size_t capacity;
+};
+
+static struct MIDIRecorderBuffer * _buffer_create( size_t capacity ) {
+  struct MIDIRecorderBuffer * buffer = malloc( sizeof( struct MIDIRecorderBuffer ) );
+  MIDIPrecondReturn( buffer != NULL, ENOMEM, NULL );
+  buffer->data = malloc( capacity );
+  if( buffer->data == NULL ) {
+    free( buffer );
+    return NULL;
+  }
+  buffer->length   = 0;
+  buffer->capacity = capacity;
+  return buffer;
+}
+
+static void _buffer_destroy( struct MIDIRecorderBuffer * buffer ) {
+  if( buffer == NULL ) return;
+  free( buffer->data );
+  free( buffer );
+}
+
+/**
+ * @brief Write a 64 bit variable length number.
+ * This uses the same encoding as MIDIUtilWriteVarLen but is not limited
+ * to 28 bits, so long pauses can be recorded with fast clocks.
+ * @param buffer The buffer, must have room for 10 bytes.
+ * @param value  The number.
+ * @return the number of bytes written.
+ */
+static size_t _put_varint( unsigned char * buffer, unsigned long long value ) {
+  unsigned char tmp[10];
+  size_t n = 0, i;
+  do {
+    tmp[n++] = value & 0x7f;
+    value >>= 7;
+  } while( value > 0 );
+  for( i=0; i<n; i++ ) {
+    buffer[i] = tmp[n-1-i] | ( ( i+1 < n ) ? 0x80 : 0 );
+  }
+  return n;
+}
+
+static int _get_varint( size_t size, unsigned char * buffer, unsigned long long * value, size_t * read ) {
+  unsigned long long v = 0;
+  size_t p = 0;
+  do {
+    if( p >= size || p >= 10 ) return 1;
+    v = ( v << 7 ) | ( buffer[p] & 0x7f );
+  } while( buffer[p++] & 0x80 );
+  *value = v;
+  *read  = p;
+  return 0;
+}
+
+/**
+ * @brief Background writer.
+ * Wait for the back buffer to be filled, write it and mark it empty.
+ * @private @memberof MIDIRecorder
+ * @param info The recorder.
+ */
+static void * _recorder_thread( void * info ) {
+  struct MIDIRecorder * recorder = info;
+  struct MIDIRecorderBuffer * buffer;
+  size_t p;
+  ssize_t w;
+  int error;
+
+  pthread_mutex_lock( &(recorder->mutex) );
+  for(;;) {
+    while( recorder->back->length == 0 && ! recorder->stop ) {
+      pthread_cond_wait( &(recorder->cond), &(recorder->mutex) );
+    }
+    if( recorder->back->length == 0 ) break;
+    /* the back buffer is not swapped while it is not empty */
+    buffer = recorder->back;
+    pthread_mutex_unlock( &(recorder->mutex) );
+
+    error = 0;
+    for( p=0; p<buffer->length; p+=w ) {
+      w = write( recorder->fd, buffer->data+p, buffer->length-p );
+      if( w < 0 ) {
+        if( errno == EINTR ) {
+          w = 0;
+          continue;
+        }
+        error = errno;
+        break;
+      }
+    }
+
+    pthread_mutex_lock( &(recorder->mutex) );
+    if( error != 0 && recorder->error == 0 ) recorder->error = error;
+    buffer->length = 0;
+    pthread_cond_broadcast( &(recorder->cond) );
+  }
+  pthread_mutex_unlock( &(recorder->mutex) );
+  return NULL;
+}
+
+/**
+ * @brief Hand the front buffer to the background writer.
+ * Wait until the writer is done with the back buffer, then swap them.
+ * @private @memberof MIDIRecorder
+ * @param recorder The recorder.
+ * @retval 0 on success.
+ * @retval >0 if the writer failed.
+ */
+static int _recorder_swap( struct MIDIRecorder * recorder ) {
+  struct MIDIRecorderBuffer * buffer;
+  int error;
+  pthread_mutex_lock( &(recorder->mutex) );
+  if( recorder->back->length > 0 ) {
+    recorder->stats.stalls++;
+    while( recorder->back->length > 0 ) {
+      pthread_cond_wait( &(recorder->cond), &(recorder->mutex) );
+    }
+  }
+  error = recorder->error;
+  if( error == 0 ) {
+    buffer = recorder->back;
+    recorder->back  = recorder->front;
+    recorder->front = buffer;
+    recorder->stats.swaps++;
+    pthread_cond_broadcast( &(recorder->cond) );
+  }
+  pthread_mutex_unlock( &(recorder->mutex) );
+  if( error != 0 ) MIDIError( error, "Could not write recording." );
+  return error;
+}
+
+/**
+ * @brief Port observer.
+ * Record every message the driver relays to its clients.
+ * @private @memberof MIDIRecorder
+ */
+static int _recorder_intercept( void * observer, struct MIDIPort * port, int mode, struct MIDITypeSpec * type, void * object ) {
+  if( mode == MIDI_PORT_OUT && type == MIDIMessageType ) {
+    return MIDIRecorderRecord( observer, object );
+  }
+  return 0;
+}
+
+/** @} */
+
+/* MARK: Creation and destruction *//**
+ * @name Creation and destruction
+ * Creating, destroying and reference counting of MIDIRecorder objects.
+ * @{
+ */
+
+/**
+ * @brief Create a MIDIRecorder instance.
+ * Allocate space and initialize a MIDIRecorder instance, start the
+ * background writer and observe the driver's port. The log header is
+ * written with the first buffer.
+ * @public @memberof MIDIRecorder
+ * @param fd     The file descriptor to append the log to.
+ * @param driver The driver to record. May be @c NULL to only record
+ *               messages passed to @ref MIDIRecorderRecord, the log is
+ *               then stamped with the default sampling rate.
+ * @return a pointer to the created recorder structure on success.
+ * @return a @c NULL pointer if the recorder could not created.
+ */
+struct MIDIRecorder * MIDIRecorderCreate( int fd, struct MIDIDriver * driver ) {
+  struct MIDIRecorder * recorder;
+  MIDISamplingRate rate = 0;
+  unsigned char * header;
+  MIDIPrecondReturn( fd >= 0, EINVAL, NULL );
+
+  recorder = malloc( sizeof( struct MIDIRecorder ) );
+  MIDIPrecondReturn( recorder != NULL, ENOMEM, NULL );
+  memset( recorder, 0, sizeof( struct MIDIRecorder ) );
+  recorder->refs  = 1;
+  recorder->fd    = fd;
+  recorder->front = _buffer_create( MIDI_RECORDER_BUFFER_SIZE );
+  recorder->back  = _buffer_create( MIDI_RECORDER_BUFFER_SIZE );
+  if( recorder->front == NULL || recorder->back == NULL ) {
+    _buffer_destroy( recorder->front );
+    _buffer_destroy( recorder->back );
+    free( recorder );
+    return NULL;
+  }
+  pthread_mutex_init( &(recorder->mutex), NULL );
+  pthread_cond_init( &(recorder->cond), NULL );
+  if( pthread_create( &(recorder->thread), NULL, &_recorder_thread, recorder ) ) {
+    MIDIError( errno, "Could not start recorder thread." );
+    MIDIRecorderDestroy( recorder );
+    return NULL;
+  }
+  recorder->running = 1;
+
+  if( driver != NULL ) {
+    MIDIClockGetSamplingRate( driver->clock, &rate );
+    MIDIDriverRetain( driver );
+    recorder->driver = driver;
+    MIDIPortSetObserver( driver->port, recorder, &_recorder_intercept );
+  } else {
+    MIDIClockGetSamplingRate( NULL, &rate );
+  }
+  header = recorder->front->data;
+  memcpy( header, &(_recorder_magic[0]), sizeof(_recorder_magic) );
+  header[4] = ( rate >> 24 ) & 0xff;
+  header[5] = ( rate >> 16 ) & 0xff;
+  header[6] = ( rate >> 8 ) & 0xff;
+  header[7] = rate & 0xff;
+  recorder->front->length = MIDI_RECORDER_HEADER_SIZE;
+  recorder->stats.bytes   = MIDI_RECORDER_HEADER_SIZE;
+  return recorder;
+}
+
+/**
+ * @brief Destroy a MIDIRecorder instance.
+ * Stop observing the driver, write all pending records, stop the
+ * background writer and free all resources occupied by the recorder.
+ * The file descriptor is not closed.
+ * @public @memberof MIDIRecorder
+ * @param recorder The recorder.
+ */
+void MIDIRecorderDestroy( struct MIDIRecorder * recorder ) {
+  void * observer;
+  MIDIPortInterceptFn * intercept;
+  MIDIPrecondReturn( recorder != NULL, EFAULT, (void)0 );
+  if( recorder->driver != NULL ) {
+    MIDIPortGetObserver( recorder->driver->port, &observer, &intercept );
+    if( observer == recorder ) {
+      MIDIPortSetObserver( recorder->driver->port, NULL, NULL );
+    }
+    MIDIDriverRelease( recorder->driver );
+  }
+  if( recorder->running ) {
+    MIDIRecorderFlush( recorder );
+    pthread_mutex_lock( &(recorder->mutex) );
+    recorder->stop = 1;
+    pthread_cond_broadcast( &(recorder->cond) );
+    pthread_mutex_unlock( &(recorder->mutex) );
+    pthread_join( recorder->thread, NULL );
+  }
+  pthread_cond_destroy( &(recorder->cond) );
+  pthread_mutex_destroy( &(recorder->mutex) );
+  _buffer_destroy( recorder->front );
+  _buffer_destroy( recorder->back );
+  free( recorder );
+}
+
+/**
+ * @brief Retain a MIDIRecorder instance.
+ * Increment the reference counter of a recorder so that it won't be destroyed.
+ * @public @memberof MIDIRecorder
+ * @param recorder The recorder.
+ */
+void MIDIRecorderRetain( struct MIDIRecorder * recorder ) {
+  MIDIPrecondReturn( recorder != NULL, EFAULT, (void)0 );
+  MIDIRefRetain( recorder->refs );
+}
+
+/**
+ * @brief Release a MIDIRecorder instance.
+ * Decrement the reference counter of a recorder. If the reference count
+ * reached zero, destroy the recorder.
+ * @public @memberof MIDIRecorder
+ * @param recorder The recorder.
+ */
+void MIDIRecorderRelease( struct MIDIRecorder * recorder ) {
+  MIDIPrecondReturn( recorder != NULL, EFAULT, (void)0 );
+  if( ! MIDIRefRelease( recorder->refs ) ) {
+    MIDIRecorderDestroy( recorder );
+  }
+}
+
+/** @} */
+
+/* MARK: Recording *//**
+ * @name Recording
+ * Appending messages to the log.
+ * @{
+ */
+
+/**
+ * @brief Get recorder statistics.
+ * Report how many messages and bytes were recorded, how often the
+ * buffers were swapped and how often recording had to wait for the
+ * background writer.
+ * @public @memberof MIDIRecorder
+ * @param recorder The recorder.
+ * @param stats    The statistics.
+ * @retval 0 on success.
+ */
+int MIDIRecorderGetStats( struct MIDIRecorder * recorder, struct MIDIRecorderStats * stats ) {
+  MIDIPrecond( recorder != NULL, EFAULT );
+  MIDIPrecond( stats != NULL, EINVAL );
+  pthread_mutex_lock( &(recorder->mutex) );
+  *stats = recorder->stats;
+  pthread_mutex_unlock( &(recorder->mutex) );
+  return 0;
+}
+
+/**
+ * @brief Append a message to the log.
+ * This is called by the port observer for every message the driver
+ * receives. Timestamps that go back in time are recorded with a delta
+ * of zero.
+ * @public @memberof MIDIRecorder
+ * @param recorder The recorder.
+ * @param message  The message.
+ * @retval 0 on success.
+ * @retval >0 if the message could not be encoded or written.
+ */
+int MIDIRecorderRecord( struct MIDIRecorder * recorder, struct MIDIMessage * message ) {
+  struct MIDIRecorderBuffer * front;
+  MIDIRunningStatus status;
+  MIDITimestamp timestamp;
+  MIDIVarLen length;
+  unsigned long long delta = 0;
+  unsigned char * p, * data;
+  size_t space, n, w, v, count, capacity;
+  int result, sysex;
+  MIDIPrecond( recorder != NULL, EFAULT );
+  MIDIPrecond( message != NULL, EINVAL );
+
+  MIDIMessageGetTimestamp( message, &timestamp );
+  if( recorder->started && timestamp > recorder->last ) {
+    delta = timestamp - recorder->last;
+  }
+  if( ! recorder->started || timestamp > recorder->last ) {
+    recorder->last = timestamp;
+  }
+  recorder->started = 1;
+  MIDIMessageGetStatus( message, &status );
+  sysex = ( status == MIDI_STATUS_SYSTEM_EXCLUSIVE );
+
+  for(;;) {
+    front = recorder->front;
+    space = front->capacity - front->length;
+    p     = front->data + front->length;
+    count = 0;
+    if( ! sysex && space >= MIDI_RECORDER_RECORD_MAX ) {
+      n = _put_varint( p, delta );
+      result = MIDIMessageEncodeTimedStream( space-n, p+n, &(recorder->status), 1, &message, NULL, &count, &w );
+      if( result ) return result;
+      w += n;
+    } else if( sysex && space > MIDI_RECORDER_BLOB_HEADER ) {
+      /* encode behind the largest possible header, then close the gap */
+      data   = p + MIDI_RECORDER_BLOB_HEADER;
+      status = 0;
+      result = MIDIMessageEncodeTimedStream( space-MIDI_RECORDER_BLOB_HEADER, data, &status, 1, &message, NULL, &count, &w );
+      if( result ) return result;
+      if( count == 1 ) {
+        n = _put_varint( p, delta );
+        p[n++] = MIDI_STATUS_SYSTEM_EXCLUSIVE;
+        length = w;
+        MIDIUtilWriteVarLen( &length, 4, p+n, &v );
+        n += v;
+        memmove( p+n, data, w );
+        w += n;
+        recorder->status = 0;
+      }
+    }
+    if( count == 1 ) break;
+    if( front->length == 0 ) {
+      /* the message does not even fit into an empty buffer */
+      capacity = front->capacity * 2;
+      data = realloc( front->data, capacity );
+      MIDIPrecond( data != NULL, ENOMEM );
+      front->data     = data;
+      front->capacity = capacity;
+      continue;
+    }
+    result = _recorder_swap( recorder );
+    if( result ) return result;
+  }
+
+  front->length += w;
+  recorder->stats.messages++;
+  recorder->stats.bytes += w;
+  return 0;
+}
+
+/**
+ * @brief Write all pending records.
+ * Hand the current buffer to the background writer and wait until
+ * everything was written.
+ * @public @memberof MIDIRecorder
+ * @param recorder The recorder.
+ * @retval 0 on success.
+ * @retval >0 if the log could not be written.
+ */
+int MIDIRecorderFlush( struct MIDIRecorder * recorder ) {
+  int result = 0;
+  MIDIPrecond( recorder != NULL, EFAULT );
+  if( recorder->front->length > 0 ) {
+    result = _recorder_swap( recorder );
+  }
+  pthread_mutex_lock( &(recorder->mutex) );
+  while( recorder->back->length > 0 ) {
+    pthread_cond_wait( &(recorder->cond), &(recorder->mutex) );
+  }
+  if( result == 0 ) result = recorder->error;
+  pthread_mutex_unlock( &(recorder->mutex) );
+  return result;
+}
+
+/** @} */
+
+/* MARK: Replay *//**
+ * @name Replay
+ * Feeding a log back into a driver.
+ * @{
+ */
+
+static int _replay_read( int fd, unsigned char ** buffer, size_t * size ) {
+  unsigned char * data = NULL, * grown;
+  size_t length = 0, capacity = 0;
+  ssize_t r;
+  for(;;) {
+    if( length == capacity ) {
+      capacity = ( capacity == 0 ) ? MIDI_RECORDER_BUFFER_SIZE : capacity * 2;
+      grown = realloc( data, capacity );
+      if( grown == NULL ) {
+        free( data );
+        MIDIError( ENOMEM, "Could not read recording." );
+        return ENOMEM;
+      }
+      data = grown;
+    }
+    r = read( fd, data+length, capacity-length );
+    if( r < 0 && errno == EINTR ) continue;
+    if( r < 0 ) {
+      free( data );
+      MIDIError( errno, "Could not read recording." );
+      return errno;
+    }
+    if( r == 0 ) break;
+    length += r;
+  }
+  *buffer = data;
+  *size   = length;
+  return 0;
+}
+
+static void _replay_wait( struct MIDIClock * clock, MIDISamplingRate rate, MIDITimestamp due ) {
+  struct timespec delay;
+  MIDITimestamp now, ticks;
+  for(;;) {
+    MIDIClockGetNow( clock, &now );
+    if( now >= due ) return;
+    ticks = due - now;
+    delay.tv_sec  = ticks / rate;
+    delay.tv_nsec = ( ( ticks % rate ) * 1000000000LL ) / rate;
+    nanosleep( &delay, NULL );
+  }
+}
+
+/**
+ * @brief Replay a log through a driver.
+ * Read a log that was written by a MIDIRecorder and pass every message
+ * to @ref MIDIDriverReceive as if the driver had received it. With a
+ * @c speed of @c 1 the original timing is reproduced, larger values
+ * replay faster and @c 0 replays as fast as possible. The replayed
+ * messages are stamped with the driver's clock.
+ * This blocks until the whole log was replayed.
+ * @public @memberof MIDIRecorder
+ * @param fd     The file descriptor to read the log from.
+ * @param driver The driver.
+ * @param speed  The speed factor.
+ * @param count  The number of replayed messages. May be @c NULL.
+ * @retval 0 on success.
+ * @retval >0 if the log could not be read or is malformed.
+ */
+int MIDIRecorderReplay( int fd, struct MIDIDriver * driver, double speed, size_t * count ) {
+  struct MIDICompactMessage compact;
+  struct MIDIMessagePool * pool;
+  struct MIDIMessage * message;
+  MIDIRunningStatus status = 0, blob_status;
+  MIDISamplingRate rate, log_rate;
+  MIDITimestamp start, due;
+  MIDIVarLen length;
+  unsigned long long delta, time = 0;
+  unsigned char * buffer = NULL, * base;
+  size_t size = 0, p, r, n = 0, decoded;
+  int result;
+  MIDIPrecond( fd >= 0, EINVAL );
+  MIDIPrecond( driver != NULL, EFAULT );
+  MIDIPrecond( speed >= 0, EINVAL );
+
+  result = _replay_read( fd, &buffer, &size );
+  if( result ) return result;
+  if( size < MIDI_RECORDER_HEADER_SIZE || memcmp( buffer, &(_recorder_magic[0]), sizeof(_recorder_magic) ) ) {
+    free( buffer );
+    MIDIError( EINVAL, "Not a recording." );
+    return EINVAL;
+  }
+  log_rate = ( buffer[4] << 24 ) | ( buffer[5] << 16 ) | ( buffer[6] << 8 ) | buffer[7];
+  pool = MIDIMessagePoolCreate( MIDI_RECORDER_POOL_SIZE );
+  if( log_rate == 0 || pool == NULL ) {
+    if( pool != NULL ) MIDIMessagePoolRelease( pool );
+    free( buffer );
+    MIDIError( EINVAL, "Could not replay recording." );
+    return EINVAL;
+  }
+  MIDIClockGetSamplingRate( driver->clock, &rate );
+  MIDIClockGetNow( driver->clock, &start );
+
+  p = MIDI_RECORDER_HEADER_SIZE;
+  while( result == 0 && p < size ) {
+    if( _get_varint( size-p, buffer+p, &delta, &r ) || p+r >= size ) {
+      result = EINVAL;
+      break;
+    }
+    p    += r;
+    time += delta;
+    if( buffer[p] == MIDI_STATUS_SYSTEM_EXCLUSIVE ) {
+      p++;
+      if( p >= size || MIDIUtilReadVarLen( &length, size-p, buffer+p, &r ) || p+r+length > size ) {
+        result = EINVAL;
+        break;
+      }
+      p += r;
+      base = buffer+p;
+      /* segments that do not start with a status byte continue a message */
+      blob_status = ( length > 0 && base[0] == MIDI_STATUS_SYSTEM_EXCLUSIVE ) ? 0 : MIDI_STATUS_SYSTEM_EXCLUSIVE;
+      result = MIDIMessageDecodeStream( length, base, &blob_status, 1, &compact, &decoded, &r );
+      p += length;
+      status = 0;
+    } else {
+      base = buffer+p;
+      result = MIDIMessageDecodeStream( size-p, base, &status, 1, &compact, &decoded, &r );
+      p += r;
+    }
+    if( result == 0 && decoded != 1 ) result = EINVAL;
+    if( result ) break;
+
+    if( speed > 0 ) {
+      due = start + (MIDITimestamp) ( (double) time * rate / log_rate / speed );
+      _replay_wait( driver->clock, rate, due );
+    } else {
+      MIDIClockGetNow( driver->clock, &due );
+    }
+    message = MIDIMessageCreateFromPool( pool, 0 );
+    if( message == NULL ) {
+      result = ENOMEM;
+      break;
+    }
+    result = MIDIMessageSetCompact( message, &compact, base );
+    if( result == 0 ) {
+      MIDIMessageSetTimestamp( message, due );
+      result = MIDIDriverReceive( driver, message );
+      n++;
+    }
+    MIDIMessageRelease( message );
+  }
+
+  if( result == EINVAL ) MIDIError( EINVAL, "Malformed recording." );
+  MIDIMessagePoolRelease( pool );
+  free( buffer );
+  if( count != NULL ) *count = n;
+  return result;
+}
+
+/** @} */
@@ -0,0 +1,31 @@
+#ifndef MIDIKIT_MIDI_RECORDER_H
+#define MIDIKIT_MIDI_RECORDER_H
+#include "midi.h"
+
+struct MIDIDriver;
+struct MIDIMessage;
+
+#define MIDI_RECORDER_HEADER_SIZE 8
+
+struct MIDIRecorder;
+
+struct MIDIRecorderStats {
+  unsigned long messages;
+  unsigned long long bytes;
+  unsigned long swaps;
+  unsigned long stalls;
+};
+
+struct MIDIRecorder * MIDIRecorderCreate( int fd, struct MIDIDriver * driver );
+void MIDIRecorderDestroy( struct MIDIRecorder * recorder );
+void MIDIRecorderRetain( struct MIDIRecorder * recorder );
+void MIDIRecorderRelease( struct MIDIRecorder * recorder );
+
+int MIDIRecorderGetStats( struct MIDIRecorder * recorder, struct MIDIRecorderStats * stats );
+
+int MIDIRecorderRecord( struct MIDIRecorder * recorder, struct MIDIMessage * message );
+int MIDIRecorderFlush( struct MIDIRecorder * recorder );
+
+int MIDIRecorderReplay( int fd, struct MIDIDriver * driver, double speed, size_t * count );
+
+#endif
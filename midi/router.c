@@ -0,0 +1,803 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "router.h"
+
+#include "type.h"
+#include "port.h"
+#include "message.h"
+#include "compact.h"
+
+#define MIDI_ROUTER_POOL_SIZE 64
+
+#define MIDI_ROUTER_NODE_SOURCE 1
+#define MIDI_ROUTER_NODE_SINK   2
+
+/** @internal */
+struct MIDIRouterNode;
+/** @internal */
+struct MIDIRouterEdge;
+/** @internal */
+struct MIDIRouterPlan;
+
+/**
+ * @ingroup MIDI
+ * @brief Routing matrix with a compiled dispatch plan.
+ * Sources are input ports owned by the router, sinks are arbitrary
+ * ports. Sources are connected to sinks or to other sources (busses)
+ * through filters that can remap channels, restrict the key range,
+ * transpose notes and drop control changes or whole message types.
+ * Whenever the graph changes it is compiled into a flat table with
+ * one slice of pre-composed filters and sink ports per source, so a
+ * message is routed with a single lookup instead of walking through
+ * chains of passthrough ports. The new table replaces the old one
+ * with an atomic exchange, messages that are being routed while the
+ * graph changes finish with the table they started with.
+ */
+struct MIDIRouter {
+/**
+ * @privatesection
+ * @cond INTERNALS
+ */
+  int refs;
+  struct MIDIPort * port;
+  struct MIDIMessagePool * pool;
+  struct MIDIRouterNode ** nodes;
+  size_t nnodes;
+  size_t nodes_capacity;
+  struct MIDIRouterEdge * edges;
+  size_t nedges;
+  size_t edges_capacity;
+  struct MIDIRouterPlan * plan;
+  struct MIDIRouterPlan * retired;
+  int readers;
+/** @endcond */
+};
+
+/* MARK: Internals *//**
+ * @name Internals
+ * @cond INTERNALS
+ * Graph storage, filter composition and plan compilation.
+ * @{
+ */
+
+struct MIDIRouterNode {
+  struct MIDIRouter * router;
+  size_t id;
+  int kind;
+  struct MIDIPort * port;
+};
+
+struct MIDIRouterEdge {
+  size_t from;
+  size_t to;
+  int active;
+  struct MIDIRouterFilter filter;
+};
+
+struct MIDIRouterEntry {
+  struct MIDIPort * sink;
+  int identity;
+  struct MIDIRouterFilter filter;
+};
+
+/**
+ * @brief Compiled dispatch plan.
+ * The entries for source @c i are @c entries[offsets[i]] up to
+ * @c entries[offsets[i+1]]. Nodes that are not sources have an
+ * empty slice.
+ */
+struct MIDIRouterPlan {
+  struct MIDIRouterPlan * next;
+  size_t nnodes;
+  size_t * offsets;
+  struct MIDIRouterEntry * entries;
+};
+
+/**
+ * @brief Growable list of entries used while compiling.
+ */
+struct MIDIRouterWork {
+  struct MIDIRouterEntry * entries;
+  size_t length;
+  size_t capacity;
+  char * visiting;
+};
+
+/**
+ * @brief Compose two filters.
+ * The result passes exactly the messages that pass @c a and then
+ * @c b, with the modifications of both applied.
+ * @param a      The first filter.
+ * @param b      The second filter.
+ * @param result The composed filter, may be the same as @c a.
+ */
+static void _filter_compose( struct MIDIRouterFilter * a, struct MIDIRouterFilter * b, struct MIDIRouterFilter * result ) {
+  struct MIDIRouterFilter c;
+  int i, lo, hi;
+  for( i=0; i<16; i++ ) {
+    c.channels[i] = ( a->channels[i] < 0 ) ? -1 : b->channels[(int) a->channels[i]];
+    c.controls[i] = a->controls[i] & b->controls[i];
+  }
+  c.statuses = a->statuses & b->statuses;
+  /* keys leaving a have to be in range after transposition */
+  lo = a->key_min;
+  hi = a->key_max;
+  if( lo < -a->transpose ) lo = -a->transpose;
+  if( hi > 127 - a->transpose ) hi = 127 - a->transpose;
+  if( lo < b->key_min - a->transpose ) lo = b->key_min - a->transpose;
+  if( hi > b->key_max - a->transpose ) hi = b->key_max - a->transpose;
+  c.key_min   = lo;
+  c.key_max   = hi;
+  c.transpose = a->transpose + b->transpose;
+  *result = c;
+}
+
+static int _filter_is_identity( struct MIDIRouterFilter * filter ) {
+  struct MIDIRouterFilter identity;
+  MIDIRouterFilterInit( &identity );
+  return memcmp( filter, &identity, sizeof( struct MIDIRouterFilter ) ) == 0;
+}
+
+/**
+ * @brief Apply a filter to a compact message.
+ * @param filter  The filter.
+ * @param compact The message, modified in place.
+ * @retval 0 if the message passes.
+ * @retval 1 if the message is dropped.
+ */
+static int _filter_apply( struct MIDIRouterFilter * filter, struct MIDICompactMessage * compact ) {
+  unsigned char status = compact->bytes[0];
+  int channel, key;
+  if( status >= 0xf0 ) {
+    return ( filter->statuses & ( 1 << 0xf ) ) ? 0 : 1;
+  }
+  if( ! ( filter->statuses & ( 1 << ( status >> 4 ) ) ) ) return 1;
+  channel = filter->channels[status & 0x0f];
+  if( channel < 0 ) return 1;
+  compact->bytes[0] = ( status & 0xf0 ) | channel;
+  switch( status >> 4 ) {
+    case MIDI_STATUS_NOTE_OFF:
+    case MIDI_STATUS_NOTE_ON:
+    case MIDI_STATUS_POLYPHONIC_KEY_PRESSURE:
+      key = compact->bytes[1];
+      if( key < filter->key_min || key > filter->key_max ) return 1;
+      key += filter->transpose;
+      if( key < 0 || key > 127 ) return 1;
+      compact->bytes[1] = key;
+      break;
+    case MIDI_STATUS_CONTROL_CHANGE:
+      key = compact->bytes[1] & 0x7f;
+      if( ! ( filter->controls[key >> 3] & ( 1 << ( key & 7 ) ) ) ) return 1;
+      break;
+  }
+  return 0;
+}
+
+static int _work_push( struct MIDIRouterWork * work, struct MIDIPort * sink, struct MIDIRouterFilter * filter ) {
+  struct MIDIRouterEntry * entries;
+  size_t capacity;
+  if( work->length == work->capacity ) {
+    capacity = work->capacity ? work->capacity * 2 : 16;
+    entries  = realloc( work->entries, sizeof( struct MIDIRouterEntry ) * capacity );
+    MIDIPrecond( entries != NULL, ENOMEM );
+    work->entries  = entries;
+    work->capacity = capacity;
+  }
+  entries = &(work->entries[work->length++]);
+  entries->sink     = sink;
+  entries->filter   = *filter;
+  entries->identity = _filter_is_identity( filter );
+  return 0;
+}
+
+/**
+ * @brief Collect the sinks that are reachable from a node.
+ * Follow all active edges, composing filters on the way. Nodes that
+ * are already on the current path are skipped so cycles between
+ * busses terminate, paths are limited to @ref MIDI_ROUTER_MAX_HOPS.
+ * @private @memberof MIDIRouter
+ */
+static int _router_walk( struct MIDIRouter * router, struct MIDIRouterWork * work, size_t id,
+                         struct MIDIRouterFilter * filter, int depth ) {
+  struct MIDIRouterFilter composed;
+  struct MIDIRouterNode * node;
+  struct MIDIRouterEdge * edge;
+  size_t i;
+  int result = 0;
+  if( depth >= MIDI_ROUTER_MAX_HOPS ) return 0;
+  work->visiting[id] = 1;
+  for( i=0; i<router->nedges && result == 0; i++ ) {
+    edge = &(router->edges[i]);
+    if( ! edge->active || edge->from != id || work->visiting[edge->to] ) continue;
+    _filter_compose( filter, &(edge->filter), &composed );
+    /* an empty key range still passes other message types */
+    if( composed.statuses == 0 ) continue;
+    node = router->nodes[edge->to];
+    if( node->kind == MIDI_ROUTER_NODE_SINK ) {
+      result = _work_push( work, node->port, &composed );
+    } else {
+      result = _router_walk( router, work, edge->to, &composed, depth+1 );
+    }
+  }
+  work->visiting[id] = 0;
+  return result;
+}
+
+/**
+ * @brief Retire a plan.
+ * Free all retired plans if no message is being routed.
+ * @private @memberof MIDIRouter
+ */
+static void _router_reclaim( struct MIDIRouter * router ) {
+  struct MIDIRouterPlan * plan;
+  __sync_synchronize();
+  if( router->readers != 0 ) return;
+  while( router->retired != NULL ) {
+    plan = router->retired;
+    router->retired = plan->next;
+    free( plan );
+  }
+}
+
+/**
+ * @brief Compile the routing graph.
+ * Build a new dispatch plan and publish it.
+ * @private @memberof MIDIRouter
+ * @param router The router.
+ * @retval 0 on success.
+ * @retval >0 if the plan could not be built.
+ */
+static int _router_compile( struct MIDIRouter * router ) {
+  struct MIDIRouterWork work;
+  struct MIDIRouterFilter identity;
+  struct MIDIRouterPlan * plan, * old;
+  size_t * offsets;
+  size_t i;
+  int result = 0;
+
+  memset( &work, 0, sizeof(work) );
+  work.visiting = calloc( router->nnodes + 1, 1 );
+  MIDIPrecond( work.visiting != NULL, ENOMEM );
+  offsets = malloc( sizeof(size_t) * ( router->nnodes + 1 ) );
+  if( offsets == NULL ) {
+    free( work.visiting );
+    MIDIError( ENOMEM, "Could not compile routing graph." );
+    return ENOMEM;
+  }
+  MIDIRouterFilterInit( &identity );
+  for( i=0; i<router->nnodes && result == 0; i++ ) {
+    offsets[i] = work.length;
+    if( router->nodes[i]->kind == MIDI_ROUTER_NODE_SOURCE ) {
+      result = _router_walk( router, &work, i, &identity, 0 );
+    }
+  }
+  offsets[router->nnodes] = work.length;
+
+  plan = NULL;
+  if( result == 0 ) {
+    /* one allocation so retired plans are freed with a single call */
+    plan = malloc( sizeof( struct MIDIRouterPlan )
+                 + sizeof(size_t) * ( router->nnodes + 1 )
+                 + sizeof( struct MIDIRouterEntry ) * work.length );
+    if( plan == NULL ) {
+      MIDIError( ENOMEM, "Could not compile routing graph." );
+      result = ENOMEM;
+    }
+  }
+  if( plan != NULL ) {
+    plan->next    = NULL;
+    plan->nnodes  = router->nnodes;
+    plan->entries = (struct MIDIRouterEntry *) ( plan + 1 );
+    plan->offsets = (size_t *) ( plan->entries + work.length );
+    memcpy( plan->offsets, offsets, sizeof(size_t) * ( router->nnodes + 1 ) );
+    if( work.length > 0 ) {
+      memcpy( plan->entries, work.entries, sizeof( struct MIDIRouterEntry ) * work.length );
+    }
+    old = __sync_lock_test_and_set( &(router->plan), plan );
+    if( old != NULL ) {
+      old->next = router->retired;
+      router->retired = old;
+    }
+    _router_reclaim( router );
+  }
+  free( offsets );
+  free( work.entries );
+  free( work.visiting );
+  return result;
+}
+
+/**
+ * @brief Source port callback.
+ * @private @memberof MIDIRouter
+ */
+static int _router_receive( void * target, void * source, struct MIDITypeSpec * type, void * object ) {
+  struct MIDIRouterNode * node = target;
+  if( type != MIDIMessageType ) return 0;
+  return MIDIRouterRoute( node->router, node->id, object );
+}
+
+static int _router_add_node( struct MIDIRouter * router, int kind, struct MIDIPort * port, size_t * id ) {
+  struct MIDIRouterNode ** nodes, * node;
+  size_t capacity;
+  if( router->nnodes == router->nodes_capacity ) {
+    capacity = router->nodes_capacity ? router->nodes_capacity * 2 : 8;
+    nodes    = realloc( router->nodes, sizeof( struct MIDIRouterNode * ) * capacity );
+    MIDIPrecond( nodes != NULL, ENOMEM );
+    router->nodes = nodes;
+    router->nodes_capacity = capacity;
+  }
+  node = malloc( sizeof( struct MIDIRouterNode ) );
+  MIDIPrecond( node != NULL, ENOMEM );
+  node->router = router;
+  node->id     = router->nnodes;
+  node->kind   = kind;
+  node->port   = port;
+  router->nodes[router->nnodes++] = node;
+  *id = node->id;
+  return 0;
+}
+
+/** @} */
+
+/* MARK: Filters *//**
+ * @name Filters
+ * Describing which messages pass a route and how they are changed.
+ * @{
+ */
+
+/**
+ * @brief Initialize a filter that passes everything unchanged.
+ * @public @memberof MIDIRouterFilter
+ * @param filter The filter.
+ * @retval 0 on success.
+ */
+int MIDIRouterFilterInit( struct MIDIRouterFilter * filter ) {
+  int i;
+  MIDIPrecond( filter != NULL, EFAULT );
+  for( i=0; i<16; i++ ) {
+    filter->channels[i] = i;
+    filter->controls[i] = 0xff;
+  }
+  filter->statuses  = 0xffff;
+  filter->key_min   = 0;
+  filter->key_max   = 127;
+  filter->transpose = 0;
+  return 0;
+}
+
+/**
+ * @brief Remap or drop a channel.
+ * @public @memberof MIDIRouterFilter
+ * @param filter The filter.
+ * @param from   The channel of incoming messages.
+ * @param to     The channel to send them on or -1 to drop them.
+ * @retval 0 on success.
+ */
+int MIDIRouterFilterSetChannelMap( struct MIDIRouterFilter * filter, MIDIChannel from, int to ) {
+  MIDIPrecond( filter != NULL, EFAULT );
+  MIDIPrecond( from >= MIDI_CHANNEL_1 && from <= MIDI_CHANNEL_16, EINVAL );
+  MIDIPrecond( to >= -1 && to <= MIDI_CHANNEL_16, EINVAL );
+  filter->channels[(int) from] = to;
+  return 0;
+}
+
+/**
+ * @brief Restrict note messages to a key range.
+ * The range applies to the keys before transposition.
+ * @public @memberof MIDIRouterFilter
+ * @param filter The filter.
+ * @param min    The lowest key that passes.
+ * @param max    The highest key that passes.
+ * @retval 0 on success.
+ */
+int MIDIRouterFilterSetKeyRange( struct MIDIRouterFilter * filter, MIDIKey min, MIDIKey max ) {
+  MIDIPrecond( filter != NULL, EFAULT );
+  MIDIPrecond( min >= 0 && max >= min, EINVAL );
+  filter->key_min = min;
+  filter->key_max = max;
+  return 0;
+}
+
+/**
+ * @brief Transpose note messages.
+ * Notes that would be transposed out of the key range are dropped.
+ * @public @memberof MIDIRouterFilter
+ * @param filter    The filter.
+ * @param transpose The number of semitones.
+ * @retval 0 on success.
+ */
+int MIDIRouterFilterSetTranspose( struct MIDIRouterFilter * filter, int transpose ) {
+  MIDIPrecond( filter != NULL, EFAULT );
+  MIDIPrecond( transpose >= -127 && transpose <= 127, EINVAL );
+  filter->transpose = transpose;
+  return 0;
+}
+
+/**
+ * @brief Pass or drop a controller.
+ * @public @memberof MIDIRouterFilter
+ * @param filter  The filter.
+ * @param control The controller number.
+ * @param pass    @c MIDI_ON to pass control changes, @c MIDI_OFF to drop them.
+ * @retval 0 on success.
+ */
+int MIDIRouterFilterSetControl( struct MIDIRouterFilter * filter, MIDIControl control, MIDIBoolean pass ) {
+  MIDIPrecond( filter != NULL, EFAULT );
+  MIDIPrecond( control >= 0, EINVAL );
+  if( pass ) {
+    filter->controls[control >> 3] |= ( 1 << ( control & 7 ) );
+  } else {
+    filter->controls[control >> 3] &= ~( 1 << ( control & 7 ) );
+  }
+  return 0;
+}
+
+/**
+ * @brief Pass or drop a message type.
+ * @public @memberof MIDIRouterFilter
+ * @param filter The filter.
+ * @param status A channel status like @c MIDI_STATUS_NOTE_ON or any
+ *               system status to pass or drop all system messages.
+ * @param pass   @c MIDI_ON to pass messages, @c MIDI_OFF to drop them.
+ * @retval 0 on success.
+ */
+int MIDIRouterFilterSetStatus( struct MIDIRouterFilter * filter, MIDIStatus status, MIDIBoolean pass ) {
+  int bit;
+  MIDIPrecond( filter != NULL, EFAULT );
+  bit = ( status >= 0xf0 ) ? 0xf : ( status & 0x0f );
+  MIDIPrecond( bit >= MIDI_STATUS_NOTE_OFF, EINVAL );
+  if( pass ) {
+    filter->statuses |= ( 1 << bit );
+  } else {
+    filter->statuses &= ~( 1 << bit );
+  }
+  return 0;
+}
+
+/**
+ * @brief Apply a filter to an array of compact messages.
+ * This has the same effect as routing the messages one by one through
+ * a route with the filter but uses the vectorized compact message
+ * kernels, for example to filter a block before it is passed to
+ * MIDIDeviceReceiveBatch.
+ * @public @memberof MIDIRouterFilter
+ * @param filter   The filter.
+ * @param count    The number of messages.
+ * @param messages The messages.
+ * @param out      The array for the passing messages, with room for
+ *                 @c count messages. May be the same as @c messages.
+ * @param written  The number of messages that passed.
+ * @retval 0 on success.
+ */
+int MIDIRouterFilterApplyBatch( struct MIDIRouterFilter * filter, size_t count, struct MIDICompactMessage * messages,
+                                struct MIDICompactMessage * out, size_t * written ) {
+  struct MIDICompactFilter compact;
+  unsigned short channels = 0;
+  unsigned char map[16];
+  size_t i, w;
+  int c, controls = 0, result;
+  MIDIPrecond( filter != NULL, EFAULT );
+  MIDIPrecond( written != NULL, EINVAL );
+
+  for( c=0; c<16; c++ ) {
+    if( filter->channels[c] >= 0 ) channels |= ( 1 << c );
+    map[c] = ( filter->channels[c] >= 0 ) ? filter->channels[c] : c;
+    if( filter->controls[c] != 0xff ) controls = 1;
+  }
+  MIDICompactFilterInit( &compact );
+  MIDICompactFilterSetMasks( &compact, filter->statuses, channels );
+  /* drop notes that would be transposed out of range */
+  MIDICompactFilterSetKeyRange( &compact, ( filter->key_min > -filter->transpose ) ? filter->key_min : -filter->transpose,
+                                ( filter->key_max < 127 - filter->transpose ) ? filter->key_max : 127 - filter->transpose );
+  result = MIDICompactFilterApply( &compact, count, messages, out, written );
+  if( result ) return result;
+  if( controls ) {
+    for( i=0, w=0; i<*written; i++ ) {
+      c = out[i].bytes[1] & 0x7f;
+      if( ( out[i].bytes[0] & 0xf0 ) == 0xb0 && ! ( filter->controls[c >> 3] & ( 1 << ( c & 7 ) ) ) ) continue;
+      out[w++] = out[i];
+    }
+    *written = w;
+  }
+  return MIDICompactRemapChannels( *written, out, &(map[0]) )
+       + MIDICompactTranspose( *written, out, filter->transpose );
+}
+
+/** @} */
+
+/* MARK: Creation and destruction *//**
+ * @name Creation and destruction
+ * Creating, destroying and reference counting of MIDIRouter objects.
+ * @{
+ */
+
+/**
+ * @brief Create a MIDIRouter instance.
+ * Allocate space and initialize a MIDIRouter instance with an empty
+ * routing graph.
+ * @public @memberof MIDIRouter
+ * @return a pointer to the created router structure on success.
+ * @return a @c NULL pointer if the router could not created.
+ */
+struct MIDIRouter * MIDIRouterCreate( void ) {
+  struct MIDIRouter * router = malloc( sizeof( struct MIDIRouter ) );
+  MIDIPrecondReturn( router != NULL, ENOMEM, NULL );
+  memset( router, 0, sizeof( struct MIDIRouter ) );
+  router->refs = 1;
+  router->port = MIDIPortCreate( "Router", MIDI_PORT_OUT, router, NULL );
+  router->pool = MIDIMessagePoolCreate( MIDI_ROUTER_POOL_SIZE );
+  if( router->port == NULL || router->pool == NULL || _router_compile( router ) ) {
+    MIDIRouterDestroy( router );
+    return NULL;
+  }
+  return router;
+}
+
+/**
+ * @brief Destroy a MIDIRouter instance.
+ * Invalidate all source ports, release all sinks and free all
+ * resources occupied by the router.
+ * @public @memberof MIDIRouter
+ * @param router The router.
+ */
+void MIDIRouterDestroy( struct MIDIRouter * router ) {
+  struct MIDIRouterNode * node;
+  size_t i;
+  MIDIPrecondReturn( router != NULL, EFAULT, (void)0 );
+  for( i=0; i<router->nnodes; i++ ) {
+    node = router->nodes[i];
+    if( node->kind == MIDI_ROUTER_NODE_SOURCE ) {
+      MIDIPortInvalidate( node->port );
+    }
+    MIDIPortRelease( node->port );
+    free( node );
+  }
+  if( router->plan != NULL ) {
+    router->plan->next = router->retired;
+    router->retired    = router->plan;
+    router->plan       = NULL;
+  }
+  _router_reclaim( router );
+  if( router->port != NULL ) {
+    MIDIPortInvalidate( router->port );
+    MIDIPortRelease( router->port );
+  }
+  if( router->pool != NULL ) MIDIMessagePoolRelease( router->pool );
+  free( router->nodes );
+  free( router->edges );
+  free( router );
+}
+
+/**
+ * @brief Retain a MIDIRouter instance.
+ * Increment the reference counter of a router so that it won't be destroyed.
+ * @public @memberof MIDIRouter
+ * @param router The router.
+ */
+void MIDIRouterRetain( struct MIDIRouter * router ) {
+  MIDIPrecondReturn( router != NULL, EFAULT, (void)0 );
+  MIDIRefRetain( router->refs );
+}
+
+/**
+ * @brief Release a MIDIRouter instance.
+ * Decrement the reference counter of a router. If the reference count
+ * reached zero, destroy the router.
+ * @public @memberof MIDIRouter
+ * @param router The router.
+ */
+void MIDIRouterRelease( struct MIDIRouter * router ) {
+  MIDIPrecondReturn( router != NULL, EFAULT, (void)0 );
+  if( ! MIDIRefRelease( router->refs ) ) {
+    MIDIRouterDestroy( router );
+  }
+}
+
+/** @} */
+
+/* MARK: Graph *//**
+ * @name Graph
+ * Declaring sources, sinks and the routes between them.
+ * @{
+ */
+
+/**
+ * @brief Add a source.
+ * Create an input port that feeds messages into the router. Connect
+ * drivers or devices to the port to route their messages.
+ * @public @memberof MIDIRouter
+ * @param router The router.
+ * @param name   The name of the input port.
+ * @param node   The node id of the source.
+ * @retval 0 on success.
+ */
+int MIDIRouterAddSource( struct MIDIRouter * router, char * name, size_t * node ) {
+  struct MIDIPort * port;
+  size_t id;
+  int result;
+  MIDIPrecond( router != NULL, EFAULT );
+  MIDIPrecond( node != NULL, EINVAL );
+  result = _router_add_node( router, MIDI_ROUTER_NODE_SOURCE, NULL, &id );
+  if( result ) return result;
+  port = MIDIPortCreate( name, MIDI_PORT_IN, router->nodes[id], &_router_receive );
+  if( port == NULL ) {
+    free( router->nodes[--router->nnodes] );
+    return 1;
+  }
+  router->nodes[id]->port = port;
+  *node = id;
+  return _router_compile( router );
+}
+
+/**
+ * @brief Get the input port of a source.
+ * @public @memberof MIDIRouter
+ * @param router The router.
+ * @param node   The node id of the source.
+ * @param port   The input port.
+ * @retval 0 on success.
+ */
+int MIDIRouterGetSourcePort( struct MIDIRouter * router, size_t node, struct MIDIPort ** port ) {
+  MIDIPrecond( router != NULL, EFAULT );
+  MIDIPrecond( node < router->nnodes, EINVAL );
+  MIDIPrecond( router->nodes[node]->kind == MIDI_ROUTER_NODE_SOURCE, EINVAL );
+  MIDIPrecond( port != NULL, EINVAL );
+  *port = router->nodes[node]->port;
+  return 0;
+}
+
+/**
+ * @brief Add a sink.
+ * The router retains the port and sends routed messages to it.
+ * @public @memberof MIDIRouter
+ * @param router The router.
+ * @param port   A port that can receive messages.
+ * @param node   The node id of the sink.
+ * @retval 0 on success.
+ */
+int MIDIRouterAddSink( struct MIDIRouter * router, struct MIDIPort * port, size_t * node ) {
+  int result;
+  MIDIPrecond( router != NULL, EFAULT );
+  MIDIPrecond( port != NULL, EINVAL );
+  MIDIPrecond( node != NULL, EINVAL );
+  result = _router_add_node( router, MIDI_ROUTER_NODE_SINK, port, node );
+  if( result ) return result;
+  MIDIPortRetain( port );
+  return _router_compile( router );
+}
+
+/**
+ * @brief Route messages from a source to a sink or another source.
+ * Routes into another source let sources act as busses, messages
+ * are filtered by every route on their way to a sink.
+ * @public @memberof MIDIRouter
+ * @param router The router.
+ * @param from   The node id of the source.
+ * @param to     The node id of the sink or source to route to.
+ * @param filter The filter for the route or @c NULL to pass everything.
+ * @param route  The route id, may be @c NULL.
+ * @retval 0 on success.
+ */
+int MIDIRouterConnect( struct MIDIRouter * router, size_t from, size_t to,
+                       struct MIDIRouterFilter * filter, size_t * route ) {
+  struct MIDIRouterEdge * edges, * edge;
+  size_t capacity;
+  MIDIPrecond( router != NULL, EFAULT );
+  MIDIPrecond( from < router->nnodes && to < router->nnodes, EINVAL );
+  MIDIPrecond( from != to, EINVAL );
+  MIDIPrecond( router->nodes[from]->kind == MIDI_ROUTER_NODE_SOURCE, EINVAL );
+  if( router->nedges == router->edges_capacity ) {
+    capacity = router->edges_capacity ? router->edges_capacity * 2 : 16;
+    edges    = realloc( router->edges, sizeof( struct MIDIRouterEdge ) * capacity );
+    MIDIPrecond( edges != NULL, ENOMEM );
+    router->edges = edges;
+    router->edges_capacity = capacity;
+  }
+  edge = &(router->edges[router->nedges]);
+  edge->from   = from;
+  edge->to     = to;
+  edge->active = 1;
+  if( filter != NULL ) {
+    edge->filter = *filter;
+  } else {
+    MIDIRouterFilterInit( &(edge->filter) );
+  }
+  if( route != NULL ) *route = router->nedges;
+  router->nedges++;
+  return _router_compile( router );
+}
+
+/**
+ * @brief Remove a route.
+ * @public @memberof MIDIRouter
+ * @param router The router.
+ * @param route  The route id.
+ * @retval 0 on success.
+ */
+int MIDIRouterDisconnect( struct MIDIRouter * router, size_t route ) {
+  MIDIPrecond( router != NULL, EFAULT );
+  if( route >= router->nedges || ! router->edges[route].active ) {
+    MIDIError( EINVAL, "Route is not connected." );
+    return EINVAL;
+  }
+  router->edges[route].active = 0;
+  return _router_compile( router );
+}
+
+/** @} */
+
+/* MARK: Routing *//**
+ * @name Routing
+ * Dispatching messages through the compiled plan.
+ * @{
+ */
+
+/**
+ * @brief Route a message.
+ * Look up the slice of the plan for the source and send the message
+ * to every sink in it. Messages that a filter modifies are copied to
+ * a pooled message with the original timestamp, unmodified messages
+ * are sent as they are. The source ports call this for every message
+ * they receive.
+ * @public @memberof MIDIRouter
+ * @param router  The router.
+ * @param source  The node id of the source.
+ * @param message The message.
+ * @retval 0 on success.
+ * @retval >0 if the message could not be sent to all sinks.
+ */
+int MIDIRouterRoute( struct MIDIRouter * router, size_t source, struct MIDIMessage * message ) {
+  struct MIDIRouterPlan * plan;
+  struct MIDIRouterEntry * entry, * end;
+  struct MIDICompactMessage original, compact;
+  struct MIDIMessage * copy;
+  MIDITimestamp timestamp;
+  MIDIStatus status;
+  int result = 0, simple;
+  MIDIPrecond( router != NULL, EFAULT );
+  MIDIPrecond( message != NULL, EINVAL );
+
+  simple = ( MIDIMessageGetCompact( message, &original ) == 0 );
+  if( ! simple ) {
+    MIDIMessageGetStatus( message, &status );
+    if( status != MIDI_STATUS_SYSTEM_EXCLUSIVE ) return 0;
+    original.bytes[0] = MIDI_STATUS_SYSTEM_EXCLUSIVE;
+  }
+
+  __sync_add_and_fetch( &(router->readers), 1 );
+  plan = router->plan;
+  if( source >= plan->nnodes ) {
+    __sync_sub_and_fetch( &(router->readers), 1 );
+    MIDIError( EINVAL, "Unknown router source." );
+    return EINVAL;
+  }
+  entry = &(plan->entries[plan->offsets[source]]);
+  end   = &(plan->entries[plan->offsets[source+1]]);
+  for( ; entry<end; entry++ ) {
+    if( entry->identity ) {
+      result += MIDIPortSendTo( router->port, entry->sink, MIDIMessageType, message );
+      continue;
+    }
+    compact = original;
+    if( _filter_apply( &(entry->filter), &compact ) ) continue;
+    if( ! simple || memcmp( &(compact.bytes[0]), &(original.bytes[0]), 3 ) == 0 ) {
+      result += MIDIPortSendTo( router->port, entry->sink, MIDIMessageType, message );
+      continue;
+    }
+    copy = MIDIMessageCreateFromPool( router->pool, 0 );
+    if( copy == NULL ) {
+      result++;
+      continue;
+    }
+    MIDIMessageGetTimestamp( message, &timestamp );
+    MIDIMessageSetCompact( copy, &compact, NULL );
+    MIDIMessageSetTimestamp( copy, timestamp );
+    result += MIDIPortSendTo( router->port, entry->sink, MIDIMessageType, copy );
+    MIDIMessageRelease( copy );
+  }
+  __sync_sub_and_fetch( &(router->readers), 1 );
+  return result;
+}
+
+/** @} */
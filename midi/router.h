@@ -0,0 +1,46 @@
+#ifndef MIDIKIT_MIDI_ROUTER_H
+#define MIDIKIT_MIDI_ROUTER_H
+#include "midi.h"
+
+struct MIDIPort;
+struct MIDIMessage;
+struct MIDICompactMessage;
+
+#define MIDI_ROUTER_MAX_HOPS 8
+
+struct MIDIRouter;
+
+struct MIDIRouterFilter {
+  signed char channels[16];
+  unsigned short statuses;
+  short key_min;
+  short key_max;
+  short transpose;
+  unsigned char controls[16];
+};
+
+int MIDIRouterFilterInit( struct MIDIRouterFilter * filter );
+int MIDIRouterFilterSetChannelMap( struct MIDIRouterFilter * filter, MIDIChannel from, int to );
+int MIDIRouterFilterSetKeyRange( struct MIDIRouterFilter * filter, MIDIKey min, MIDIKey max );
+int MIDIRouterFilterSetTranspose( struct MIDIRouterFilter * filter, int transpose );
+int MIDIRouterFilterSetControl( struct MIDIRouterFilter * filter, MIDIControl control, MIDIBoolean pass );
+int MIDIRouterFilterSetStatus( struct MIDIRouterFilter * filter, MIDIStatus status, MIDIBoolean pass );
+int MIDIRouterFilterApplyBatch( struct MIDIRouterFilter * filter, size_t count, struct MIDICompactMessage * messages,
+                                struct MIDICompactMessage * out, size_t * written );
+
+struct MIDIRouter * MIDIRouterCreate( void );
+void MIDIRouterDestroy( struct MIDIRouter * router );
+void MIDIRouterRetain( struct MIDIRouter * router );
+void MIDIRouterRelease( struct MIDIRouter * router );
+
+int MIDIRouterAddSource( struct MIDIRouter * router, char * name, size_t * node );
+int MIDIRouterGetSourcePort( struct MIDIRouter * router, size_t node, struct MIDIPort ** port );
+int MIDIRouterAddSink( struct MIDIRouter * router, struct MIDIPort * port, size_t * node );
+
+int MIDIRouterConnect( struct MIDIRouter * router, size_t from, size_t to,
+                       struct MIDIRouterFilter * filter, size_t * route );
+int MIDIRouterDisconnect( struct MIDIRouter * router, size_t route );
+
+int MIDIRouterRoute( struct MIDIRouter * router, size_t source, struct MIDIMessage * message );
+
+#endif
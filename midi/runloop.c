@@ -1,14 +1,34 @@
+#if defined( __linux__ ) && ! defined( _GNU_SOURCE )
+#define _GNU_SOURCE /* pthread_setaffinity_np */
+#endif
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
 #include <sys/select.h>
+#include <sys/socket.h>
 #include <sys/time.h>
 #include <time.h>
+#if defined( __linux__ ) && ! defined( MIDI_RUNLOOP_SELECT )
+#define MIDI_RUNLOOP_EPOLL
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#elif ( defined( __APPLE__ ) || defined( __FreeBSD__ ) || \
+        defined( __NetBSD__ ) || defined( __OpenBSD__ ) ) && ! defined( MIDI_RUNLOOP_SELECT )
+#define MIDI_RUNLOOP_KQUEUE
+#include <sys/types.h>
+#include <sys/event.h>
+#endif
 #define MIDI_RUNLOOP_INTERNALS
 #include "runloop.h"
 #include "midi.h"
 
 #define CURRENT_RUNLOOP( rl ) do { _midi_current_runloop = (rl); } while(0)
 
-static struct MIDIRunloop * _midi_current_runloop = NULL;
+/* every thread may run its own runloop */
+static MIDI_THREAD_LOCAL struct MIDIRunloop * _midi_current_runloop = NULL;
 static struct MIDIRunloop * _midi_global_runloop = NULL;
 
 static int _runloop_schedule_read( struct MIDIRunloop * runloop, int fd );
@@ -16,6 +36,7 @@ static int _runloop_schedule_write( struct MIDIRunloop * runloop, int fd );
 static int _runloop_schedule_timeout( struct MIDIRunloop * runloop, struct timespec * ts );
 static int _runloop_clear_read( struct MIDIRunloop * runloop, int fd );
 static int _runloop_clear_write( struct MIDIRunloop * runloop, int fd );
+static void _runloop_busy_poll_socket( struct MIDIRunloop * runloop, int fd );
 
 /* MARK: fd_set helper functions *//**
  * @name fd_set helper functions
@@ -156,6 +177,183 @@ static void _timeval_from_timespec( struct timeval * tv, struct timespec * ts )
 
 /** @} */
 
+/* MARK: Timer helper functions *//**
+ * @name Timer helper functions
+ * @cond INTERNALS
+ * Every runloop source keeps its timers in a binary min-heap ordered by
+ * deadline. The timer structures themselves live in a slot array so that
+ * handles stay valid while the heap is reordered.
+ * @{
+ */
+
+#define NO_TIMER ((size_t)-1)
+
+static int _timers_less( struct MIDIRunloopSource * source, size_t a, size_t b ) {
+  return _timespec_cmp( &(source->timers[source->timers_heap[a]].deadline),
+                        &(source->timers[source->timers_heap[b]].deadline) ) < 0;
+}
+
+static void _timers_swap( struct MIDIRunloopSource * source, size_t a, size_t b ) {
+  size_t slot = source->timers_heap[a];
+  source->timers_heap[a] = source->timers_heap[b];
+  source->timers_heap[b] = slot;
+  source->timers[source->timers_heap[a]].position = a;
+  source->timers[source->timers_heap[b]].position = b;
+}
+
+static void _timers_up( struct MIDIRunloopSource * source, size_t i ) {
+  while( i > 0 && _timers_less( source, i, (i-1)/2 ) ) {
+    _timers_swap( source, i, (i-1)/2 );
+    i = (i-1)/2;
+  }
+}
+
+static void _timers_down( struct MIDIRunloopSource * source, size_t i ) {
+  size_t l, r, m;
+  for(;;) {
+    l = 2*i + 1;
+    r = l + 1;
+    m = i;
+    if( l < source->ntimers && _timers_less( source, l, m ) ) m = l;
+    if( r < source->ntimers && _timers_less( source, r, m ) ) m = r;
+    if( m == i ) break;
+    _timers_swap( source, i, m );
+    i = m;
+  }
+}
+
+static int _timers_grow( struct MIDIRunloopSource * source ) {
+  struct MIDIRunloopTimer * timers;
+  size_t * heap;
+  size_t i, size = ( source->timers_size == 0 ) ? 8 : source->timers_size * 2;
+  if( size > MAX_RUNLOOP_TIMERS ) size = MAX_RUNLOOP_TIMERS;
+  if( size <= source->timers_size ) return 1;
+
+  timers = realloc( source->timers, sizeof( struct MIDIRunloopTimer ) * size );
+  if( timers == NULL ) return 1;
+  source->timers = timers;
+  heap = realloc( source->timers_heap, sizeof( size_t ) * size );
+  if( heap == NULL ) return 1;
+  source->timers_heap = heap;
+
+  for( i=source->timers_size; i<size; i++ ) {
+    source->timers[i].handle   = 0;
+    source->timers[i].position = ( i+1 < size ) ? i+1 : source->timers_free;
+  }
+  source->timers_free = source->timers_size;
+  source->timers_size = size;
+  return 0;
+}
+
+static void _timers_remove( struct MIDIRunloopSource * source, struct MIDIRunloopTimer * timer ) {
+  size_t i = timer->position;
+  size_t slot = source->timers_heap[i];
+
+  source->ntimers--;
+  if( i != source->ntimers ) {
+    source->timers_heap[i] = source->timers_heap[source->ntimers];
+    source->timers[source->timers_heap[i]].position = i;
+    _timers_down( source, i );
+    _timers_up( source, i );
+  }
+  timer->handle   = 0;
+  timer->position = source->timers_free;
+  source->timers_free = slot;
+}
+
+/**
+ * @brief Get the deadline of the next timer of a single source.
+ * @private @memberof MIDIRunloopSource
+ * @param source   The runloop source.
+ * @param deadline Will be set to the deadline, if it is earlier.
+ * @param found    Whether @c deadline was already set by another source.
+ * @return 1 if @c deadline is set, 0 otherwise.
+ */
+static int _timers_next( struct MIDIRunloopSource * source, struct timespec * deadline, int found ) {
+  struct MIDIRunloopTimer * timer;
+  if( source->ntimers == 0 ) return found;
+  timer = &(source->timers[source->timers_heap[0]]);
+  if( ! found || _timespec_cmp( &(timer->deadline), deadline ) < 0 ) {
+    _timespec_cpy( deadline, &(timer->deadline) );
+  }
+  return 1;
+}
+
+/**
+ * @brief Call all expired timers of a single source.
+ * Every timer is removed before its callback is invoked, so callbacks may
+ * add or cancel timers freely.
+ * @private @memberof MIDIRunloopSource
+ * @param source The runloop source.
+ * @param now    Must be set to the current time.
+ */
+static int _timers_fire( struct MIDIRunloopSource * source, struct timespec * now ) {
+  struct MIDIRunloopTimer * timer;
+  int (*callback)( void * info, struct timespec * now );
+  void * info;
+  int result = 0;
+
+  while( source->ntimers > 0 ) {
+    timer = &(source->timers[source->timers_heap[0]]);
+    if( _timespec_cmp( now, &(timer->deadline) ) < 0 ) break;
+    callback = timer->callback;
+    info     = timer->info;
+    _timers_remove( source, timer );
+    result += (callback)( info, now );
+  }
+  return result;
+}
+
+/**
+ * @brief Check if a source is the master source of its runloop.
+ * The master source collects the timers of all sources in the runloop.
+ * @private @memberof MIDIRunloopSource
+ * @param source The runloop source.
+ */
+static int _runloop_source_is_master( struct MIDIRunloopSource * source ) {
+  return source->runloop != NULL && source == &(source->runloop->master);
+}
+
+/**
+ * @brief Get the deadline of the next timer that is handled by a source.
+ * @private @memberof MIDIRunloopSource
+ * @param source   The runloop source.
+ * @param deadline Will be set to the earliest deadline.
+ * @return 1 if there is any timer, 0 otherwise.
+ */
+static int _runloop_timers_next( struct MIDIRunloopSource * source, struct timespec * deadline ) {
+  int i, found = 0;
+  if( _runloop_source_is_master( source ) ) {
+    for( i=0; i<source->runloop->sources_size; i++ ) {
+      if( source->runloop->sources[i] != NULL ) {
+        found = _timers_next( source->runloop->sources[i], deadline, found );
+      }
+    }
+  }
+  return _timers_next( source, deadline, found );
+}
+
+/**
+ * @brief Call all expired timers that are handled by a source.
+ * @private @memberof MIDIRunloopSource
+ * @param source The runloop source.
+ * @param now    Must be set to the current time.
+ */
+static int _runloop_timers_fire( struct MIDIRunloopSource * source, struct timespec * now ) {
+  int i, result = 0;
+  if( _runloop_source_is_master( source ) ) {
+    CURRENT_RUNLOOP( source->runloop );
+    for( i=0; i<source->runloop->sources_size; i++ ) {
+      if( source->runloop->sources[i] != NULL ) {
+        result += _timers_fire( source->runloop->sources[i], now );
+      }
+    }
+  }
+  return result + _timers_fire( source, now );
+}
+
+/** @} */
+
 /* MARK: -
  * MARK: Runloop Source *//**
  * @name Runloop Source
@@ -187,21 +385,30 @@ struct MIDIRunloopSource * MIDIRunloopSourceCreate( struct MIDIRunloopSourceDele
   }
   source->runloop = NULL;
 
+  source->ntimers       = 0;
+  source->timers_size   = 0;
+  source->timers_free   = NO_TIMER;
+  source->timers_serial = 0;
+  source->timers        = NULL;
+  source->timers_heap   = NULL;
+
   return source;
 }
 
 void MIDIRunloopSourceDestroy( struct MIDIRunloopSource * source ) {
+  if( source->timers != NULL ) free( source->timers );
+  if( source->timers_heap != NULL ) free( source->timers_heap );
   free( source );
 }
 
 void MIDIRunloopSourceRetain( struct MIDIRunloopSource * source ) {
   MIDIPrecondReturn( source != NULL, EFAULT, (void)0 );
-  source->refs++;
+  MIDIRefRetain( source->refs );
 }
 
 void MIDIRunloopSourceRelease( struct MIDIRunloopSource * source ) {
   MIDIPrecondReturn( source != NULL, EFAULT, (void)0 );
-  if( ! --source->refs ) {
+  if( ! MIDIRefRelease( source->refs ) ) {
     MIDIRunloopSourceDestroy( source );
   }
 }
@@ -334,55 +541,135 @@ static int _runloop_source_reschedule( struct MIDIRunloopSource * source ) {
   return 0;
 }
 
+/**
+ * @brief Limit a remaining time to the time until the next timer.
+ * @private @memberof MIDIRunloopSource
+ * @param remain The remaining time, zero if unlimited.
+ * @param limit  The time until the next timer or @c NULL.
+ * @return 1 if the remaining time was limited, 0 otherwise.
+ */
+static int _runloop_limit_remain( struct timespec * remain, struct timespec * limit ) {
+  if( limit == NULL ) return 0;
+  if( _timespec_empty( remain ) || _timespec_cmp( limit, remain ) < 0 ) {
+    _timespec_cpy( remain, limit );
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Add the time spent waiting to the current iteration.
+ * @private @memberof MIDIRunloop
+ * @param runloop The runloop, @c NULL if the wait is not accounted.
+ * @param before  The time the wait started.
+ * @param after   The time the wait ended.
+ */
+static void _runloop_waited( struct MIDIRunloop * runloop, struct timespec * before, struct timespec * after ) {
+  struct timespec waited;
+  if( runloop == NULL ) return;
+  _timespec_cpy( &waited, after );
+  _timespec_sub( &waited, before );
+  if( waited.tv_sec >= 0 ) _timespec_add( &(runloop->step_wait), &waited );
+}
+
 /**
  * @brief Wait until any callback of the runloop source is triggered.
- * If no callbacks are scheduled return immediately.
- * @public @memberof MIDIRunloopSource
+ * Wait for at most @c limit, if given.
+ * @private @memberof MIDIRunloopSource
  * @param source The runloop source.
+ * @param now    Must be set to the current time.
+ * @param limit  The time until the next timer expires or @c NULL.
  */
-int MIDIRunloopSourceWait( struct MIDIRunloopSource * source ) {
-  int result = 0;
-  struct timespec now, remain;
+static int _runloop_source_wait( struct MIDIRunloopSource * source, struct timespec * now, struct timespec * limit ) {
+  int result = 0, limited;
+  struct timespec remain, before;
   struct timeval  remain_tv = { 0, 0 };
+  struct MIDIRunloop * runloop = _runloop_source_is_master( source ) ? source->runloop : NULL;
   fd_set readfds;
   fd_set writefds;
 
   /*printf( "RunloopSourceWait\n" );*/
-  _timespec_now( &now );
-  if( _runloop_source_timeout_check( source, &now ) ) {
+  if( _runloop_source_timeout_check( source, now ) ) {
     /* timed out before check */
     /*printf( "- timeout(sec:%li,nsec:%li)\n", source->timeout_time.tv_sec, source->timeout_time.tv_nsec );*/
-    return _runloop_source_timeout( source, &now );
+    return _runloop_source_timeout( source, now );
   } else if( source->nfds > 0 ) {
     /* select */
-    _runloop_source_timeout_remain( source, &remain, &now );
+    _runloop_source_timeout_remain( source, &remain, now );
+    limited = _runloop_limit_remain( &remain, limit );
     _timeval_from_timespec( &remain_tv, &remain );
     _fds_cpy( &readfds, &(source->readfds), source->nfds );
     _fds_cpy( &writefds, &(source->writefds), source->nfds );
 
     /*printf( "- select(nfds:%i)\n", source->nfds );*/
+    _timespec_cpy( &before, now );
     result = select( source->nfds, &readfds, &writefds, NULL, &remain_tv );
-    _timespec_now( &now );
+    _timespec_now( now );
+    _runloop_waited( runloop, &before, now );
     if( result > 0 ) {
       /*printf( "- read/write\n" );*/
-      return _runloop_source_read( source, &now, &readfds )
-           + _runloop_source_write( source, &now, &writefds );
-    } else {
+      return _runloop_source_read( source, now, &readfds )
+           + _runloop_source_write( source, now, &writefds );
+    } else if( ! limited || _runloop_source_timeout_check( source, now ) ) {
       /*printf( "- timeout\n" );*/
-      return _runloop_source_timeout( source, &now );
+      return _runloop_source_timeout( source, now );
     }
   } else if( ! _timespec_empty( &(source->timeout_time) ) ) {
     /* nanosleep */
     /*printf( "- sleep\n" );*/
-    _runloop_source_timeout_remain( source, &remain, &now );
+    _runloop_source_timeout_remain( source, &remain, now );
+    limited = _runloop_limit_remain( &remain, limit );
+    _timespec_cpy( &before, now );
     result = nanosleep( &remain, NULL );
-    _timespec_now( &now );
+    _timespec_now( now );
+    _runloop_waited( runloop, &before, now );
     /*printf( "- timeout\n" );*/
-    return _runloop_source_timeout( source, &now );
+    if( ! limited || _runloop_source_timeout_check( source, now ) ) {
+      return _runloop_source_timeout( source, now );
+    }
+  } else if( limit != NULL ) {
+    /* sleep until the next timer */
+    _timespec_cpy( &before, now );
+    nanosleep( limit, NULL );
+    _timespec_now( now );
+    _runloop_waited( runloop, &before, now );
   }
   return 0;
 }
 
+static int _runloop_wait( struct MIDIRunloop * runloop, struct timespec * now, struct timespec * limit );
+
+/**
+ * @brief Wait until any callback of the runloop source is triggered.
+ * If no callbacks are scheduled return immediately. Expired timers are
+ * called before and after waiting.
+ * @public @memberof MIDIRunloopSource
+ * @param source The runloop source.
+ */
+int MIDIRunloopSourceWait( struct MIDIRunloopSource * source ) {
+  int result = 0;
+  struct timespec now, next;
+  struct timespec * limit = NULL;
+
+  _timespec_now( &now );
+  if( _runloop_timers_next( source, &next ) ) {
+    if( _timespec_cmp( &now, &next ) >= 0 ) {
+      return _runloop_timers_fire( source, &now );
+    }
+    _timespec_sub( &next, &now );
+    limit = &next;
+  }
+  if( _runloop_source_is_master( source ) && source->runloop->delegate.wait != NULL ) {
+    result = _runloop_wait( source->runloop, &now, limit );
+  } else {
+    result = _runloop_source_wait( source, &now, limit );
+  }
+  if( limit != NULL ) {
+    result += _runloop_timers_fire( source, &now );
+  }
+  return result;
+}
+
 /**
  * @brief Schedule the read callback of a runloop source.
  * Enable the read callback of a runloop source. The callback will be invoked the
@@ -497,6 +784,74 @@ int MIDIRunloopSourceClearTimeout( struct MIDIRunloopSource * source ) {
   return 0;
 }
 
+/**
+ * @brief Add a timer to a runloop source.
+ * Call @c callback with @c info once after @c delay has passed. A source may
+ * have any number of timers at the same time. The runloop only waits until
+ * the earliest deadline of all timers, so adding and cancelling timers
+ * does not require scanning the other timers.
+ * @public @memberof MIDIRunloopSource
+ * @param source   The runloop source.
+ * @param delay    The time after which the timer expires.
+ * @param callback The function to call when the timer expires.
+ * @param info     The info pointer to pass to the callback.
+ * @param handle   If not @c NULL, will be set to a handle that can be
+ *                 used to cancel the timer.
+ * @retval 0 on success.
+ * @retval >0 if the timer could not be added.
+ */
+int MIDIRunloopSourceAddTimer( struct MIDIRunloopSource * source, struct timespec * delay,
+                               int (*callback)( void * info, struct timespec * now ), void * info,
+                               unsigned long * handle ) {
+  struct MIDIRunloopTimer * timer;
+  size_t slot;
+  MIDIPrecond( source != NULL, EFAULT );
+  MIDIPrecond( delay != NULL, EINVAL );
+  MIDIPrecond( callback != NULL, EINVAL );
+
+  if( source->timers_free == NO_TIMER && _timers_grow( source ) ) {
+    return ENOMEM;
+  }
+  slot  = source->timers_free;
+  timer = &(source->timers[slot]);
+  source->timers_free = timer->position;
+
+  source->timers_serial = ( source->timers_serial + 1 ) & 0xffff;
+  if( source->timers_serial == 0 ) source->timers_serial = 1;
+  timer->handle   = ( source->timers_serial << 16 ) | slot;
+  timer->callback = callback;
+  timer->info     = info;
+  _timespec_now( &(timer->deadline) );
+  _timespec_add( &(timer->deadline), delay );
+
+  timer->position = source->ntimers;
+  source->timers_heap[source->ntimers++] = slot;
+  _timers_up( source, timer->position );
+
+  if( handle != NULL ) *handle = timer->handle;
+  return 0;
+}
+
+/**
+ * @brief Cancel a timer of a runloop source.
+ * Remove a timer that was added using MIDIRunloopSourceAddTimer before it
+ * expires.
+ * @public @memberof MIDIRunloopSource
+ * @param source The runloop source.
+ * @param handle The handle of the timer.
+ * @retval 0 on success.
+ * @retval 1 if there is no such timer, e.g. because it already expired.
+ */
+int MIDIRunloopSourceCancelTimer( struct MIDIRunloopSource * source, unsigned long handle ) {
+  size_t slot = handle & 0xffff;
+  MIDIPrecond( source != NULL, EFAULT );
+  if( handle == 0 || slot >= source->timers_size || source->timers[slot].handle != handle ) {
+    return 1;
+  }
+  _timers_remove( source, &(source->timers[slot]) );
+  return 0;
+}
+
 /** @} */
 
 /* MARK: -
@@ -532,7 +887,7 @@ static int _runloop_master_read( void * rl, int nfds, fd_set * readfds ) {
   /* _timespec_now( &now ); */
   _timespec_cpy( &now, &(runloop->master.timeout_start) );
   
-  for( i=0; i<MAX_RUNLOOP_SOURCES; i++ ) {
+  for( i=0; i<runloop->sources_size; i++ ) {
     source = runloop->sources[i];
     if( source == NULL ) continue;
 
@@ -566,7 +921,7 @@ static int _runloop_master_write( void * rl, int nfds, fd_set * writefds ) {
   /* _timespec_now( &now ); */
   _timespec_cpy( &now, &(runloop->master.timeout_start) );
   
-  for( i=0; i<MAX_RUNLOOP_SOURCES; i++ ) {
+  for( i=0; i<runloop->sources_size; i++ ) {
     source = runloop->sources[i];
     if( source == NULL ) continue;
 
@@ -600,7 +955,7 @@ static int _runloop_master_timeout( void * rl, struct timespec * ts ) {
   /* _timespec_now( &now ); */
   _timespec_cpy( &now, &(runloop->master.timeout_start) );
 
-  for( i=0; i<MAX_RUNLOOP_SOURCES; i++ ) {
+  for( i=0; i<runloop->sources_size; i++ ) {
     source = runloop->sources[i];
     if( source == NULL ) continue;
 
@@ -620,6 +975,494 @@ static int _runloop_master_timeout( void * rl, struct timespec * ts ) {
 
 /** @} */
 
+/* MARK: -
+ * MARK: Poller *//**
+ * @name Poller
+ * @cond INTERNALS
+ * Wait for ready file descriptors using the delegate instead of @c select.
+ * Only the sources that own a ready file descriptor are dispatched.
+ * @{
+ */
+
+/**
+ * @brief Dispatch ready file descriptors.
+ * Call the read and write callbacks of all sources that own one of the
+ * ready file descriptors. Like with @c select, write callbacks have to be
+ * scheduled again after they were triggered. Sources that did not receive
+ * any event are checked for timeouts.
+ * @private @memberof MIDIRunloop
+ * @param runloop The runloop.
+ * @param now     Must be set to the current time.
+ * @param n       The number of ready file descriptors.
+ * @param fds     The ready file descriptors.
+ * @param events  The @c MIDI_RUNLOOP_READ / @c MIDI_RUNLOOP_WRITE flags for every descriptor.
+ */
+static int _runloop_dispatch( struct MIDIRunloop * runloop, struct timespec * now, int n, int * fds, int * events ) {
+  int i, k, r, w, result = 0;
+  struct MIDIRunloopSource * source;
+  fd_set readfds;
+  fd_set writefds;
+
+  CURRENT_RUNLOOP( runloop );
+
+  FD_ZERO( &readfds );
+  FD_ZERO( &writefds );
+  for( k=0; k<n; k++ ) {
+    if( events[k] & MIDI_RUNLOOP_READ )  FD_SET( fds[k], &readfds );
+    if( events[k] & MIDI_RUNLOOP_WRITE ) FD_SET( fds[k], &writefds );
+  }
+
+  for( i=0; i<runloop->sources_size; i++ ) {
+    source = runloop->sources[i];
+    if( source == NULL ) continue;
+
+    r = 0;
+    w = 0;
+    for( k=0; k<n; k++ ) {
+      if( fds[k] >= source->nfds ) continue;
+      if( FD_ISSET( fds[k], &readfds ) && FD_ISSET( fds[k], &(source->readfds) ) ) {
+        r = 1;
+      }
+      if( FD_ISSET( fds[k], &writefds ) && FD_ISSET( fds[k], &(source->writefds) ) ) {
+        FD_CLR( fds[k], &(source->writefds) );
+        _runloop_clear_write( runloop, fds[k] );
+        w = 1;
+      }
+    }
+
+    if( source->delegate.info == NULL ) continue;
+    if( r && source->delegate.read != NULL ) {
+      _runloop_source_timeout_start( source, now );
+      result += (source->delegate.read)( source->delegate.info, source->nfds, &readfds );
+    }
+    if( w && source->delegate.write != NULL ) {
+      _runloop_source_timeout_start( source, now );
+      result += (source->delegate.write)( source->delegate.info, source->nfds, &writefds );
+    }
+    if( ! r && ! w && _runloop_source_timeout_check( source, now ) ) {
+      result += _runloop_source_timeout( source, now );
+    }
+  }
+  return result;
+}
+
+/**
+ * @brief Wait until any callback of the runloop is triggered.
+ * This does the same as _runloop_source_wait on the master source, but
+ * uses the @c wait callback of the runloop delegate.
+ * @private @memberof MIDIRunloop
+ * @param runloop The runloop.
+ * @param now     Must be set to the current time.
+ * @param limit   The time until the next timer expires or @c NULL.
+ */
+/**
+ * @brief Poll without blocking for the busy poll budget.
+ * Spin for at most the budget or the remaining time, whichever is
+ * shorter. If nothing got ready, the remaining time is reduced by the
+ * time that was spent spinning.
+ * @private @memberof MIDIRunloop
+ * @param runloop The runloop.
+ * @param now     Must be set to the current time, is updated.
+ * @param remain  The time to wait, zero if the wait does not block.
+ * @param fds     Will be set to the ready file descriptors.
+ * @param events  Will be set to the events of the ready file descriptors.
+ * @return the number of ready file descriptors, zero if none got ready.
+ */
+static int _runloop_spin( struct MIDIRunloop * runloop, struct timespec * now, struct timespec * remain,
+                          int * fds, int * events ) {
+  struct timespec poll = { 0, 0 };
+  struct timespec budget, deadline;
+  int n;
+
+  if( _timespec_empty( &(runloop->busy_poll) ) || _timespec_empty( remain ) ) return 0;
+  _timespec_cpy( &budget, &(runloop->busy_poll) );
+  if( _timespec_cmp( remain, &budget ) < 0 ) _timespec_cpy( &budget, remain );
+  _timespec_cpy( &deadline, now );
+  _timespec_add( &deadline, &budget );
+  do {
+    n = (runloop->delegate.wait)( runloop->delegate.info, &poll, MAX_RUNLOOP_EVENTS, fds, events );
+    _timespec_now( now );
+    if( n != 0 ) return n;
+  } while( _timespec_cmp( now, &deadline ) < 0 );
+
+  _timespec_sub( remain, &budget );
+  if( remain->tv_sec < 0 ) _timespec_zero( remain );
+  return 0;
+}
+
+static int _runloop_wait( struct MIDIRunloop * runloop, struct timespec * now, struct timespec * limit ) {
+  struct MIDIRunloopSource * master = &(runloop->master);
+  struct timespec remain, before;
+  int n, limited, fds[MAX_RUNLOOP_EVENTS], events[MAX_RUNLOOP_EVENTS];
+
+  if( _runloop_source_timeout_check( master, now ) ) {
+    return _runloop_source_timeout( master, now );
+  } else if( master->nfds > 0 ) {
+    _runloop_source_timeout_remain( master, &remain, now );
+    limited = _runloop_limit_remain( &remain, limit );
+    _timespec_cpy( &before, now );
+    n = _runloop_spin( runloop, now, &remain, &(fds[0]), &(events[0]) );
+    if( n == 0 ) {
+      n = (runloop->delegate.wait)( runloop->delegate.info, &remain, MAX_RUNLOOP_EVENTS, &(fds[0]), &(events[0]) );
+      _timespec_now( now );
+    }
+    _runloop_waited( runloop, &before, now );
+    if( n > 0 ) {
+      _runloop_source_timeout_start( master, now );
+      return _runloop_dispatch( runloop, now, n, &(fds[0]), &(events[0]) );
+    } else if( ! limited || _runloop_source_timeout_check( master, now ) ) {
+      return _runloop_source_timeout( master, now );
+    }
+    return 0;
+  }
+  return _runloop_source_wait( master, now, limit );
+}
+
+#if defined( MIDI_RUNLOOP_EPOLL ) || defined( MIDI_RUNLOOP_KQUEUE )
+
+/**
+ * @brief State of the native poller.
+ * The poller keeps track of the interest it registered with the kernel
+ * so that it only has to issue changes.
+ */
+struct MIDIRunloopPoller {
+  int    fd;
+  fd_set readfds;
+  fd_set writefds;
+  struct MIDIRunloop * runloop;
+};
+
+static struct MIDIRunloopPoller * _poller_create( struct MIDIRunloop * runloop ) {
+  struct MIDIRunloopPoller * poller = malloc( sizeof( struct MIDIRunloopPoller ) );
+  MIDIPrecondReturn( poller != NULL, ENOMEM, NULL );
+#if defined( MIDI_RUNLOOP_EPOLL )
+  poller->fd = epoll_create( MAX_RUNLOOP_EVENTS );
+#else
+  poller->fd = kqueue();
+#endif
+  if( poller->fd < 0 ) {
+    free( poller );
+    return NULL;
+  }
+  FD_ZERO( &(poller->readfds) );
+  FD_ZERO( &(poller->writefds) );
+  poller->runloop = runloop;
+  return poller;
+}
+
+static void _poller_destroy( void * info ) {
+  struct MIDIRunloopPoller * poller = info;
+  close( poller->fd );
+  free( poller );
+}
+
+#endif
+
+#if defined( MIDI_RUNLOOP_EPOLL )
+
+/**
+ * @brief Register the runloop's interest in a file descriptor with epoll.
+ * @private @memberof MIDIRunloop
+ * @param info The poller.
+ * @param fd   The file descriptor that was scheduled or cleared.
+ */
+static int _poller_update( void * info, int fd ) {
+  struct MIDIRunloopPoller * poller = info;
+  struct MIDIRunloopSource * master = &(poller->runloop->master);
+  struct epoll_event ev;
+  int registered;
+
+  ev.events  = 0;
+  ev.data.u64 = 0;
+  ev.data.fd = fd;
+  if( FD_ISSET( fd, &(master->readfds) ) )  ev.events |= EPOLLIN;
+  if( FD_ISSET( fd, &(master->writefds) ) ) ev.events |= EPOLLOUT;
+  registered = FD_ISSET( fd, &(poller->readfds) ) || FD_ISSET( fd, &(poller->writefds) );
+
+  FD_CLR( fd, &(poller->readfds) );
+  FD_CLR( fd, &(poller->writefds) );
+  if( ev.events == 0 ) {
+    if( registered ) epoll_ctl( poller->fd, EPOLL_CTL_DEL, fd, &ev );
+    return 0;
+  }
+  if( ev.events & EPOLLIN )  FD_SET( fd, &(poller->readfds) );
+  if( ev.events & EPOLLOUT ) FD_SET( fd, &(poller->writefds) );
+
+  /* the descriptor may have been closed and reopened in the meantime */
+  if( registered ) {
+    if( epoll_ctl( poller->fd, EPOLL_CTL_MOD, fd, &ev ) == 0 ) return 0;
+    if( errno != ENOENT ) return 1;
+    return epoll_ctl( poller->fd, EPOLL_CTL_ADD, fd, &ev ) != 0;
+  } else {
+    if( epoll_ctl( poller->fd, EPOLL_CTL_ADD, fd, &ev ) == 0 ) return 0;
+    if( errno != EEXIST ) return 1;
+    return epoll_ctl( poller->fd, EPOLL_CTL_MOD, fd, &ev ) != 0;
+  }
+}
+
+/**
+ * @brief Wait for ready file descriptors using epoll.
+ * @private @memberof MIDIRunloop
+ * @param info    The poller.
+ * @param timeout The maximum time to wait.
+ * @param size    The number of available entries in @c fds and @c events.
+ * @param fds     Will be set to the ready file descriptors.
+ * @param events  Will be set to the events of the ready file descriptors.
+ * @return the number of ready file descriptors, zero on timeout.
+ */
+static int _poller_wait( void * info, struct timespec * timeout, int size, int * fds, int * events ) {
+  struct MIDIRunloopPoller * poller = info;
+  struct epoll_event ev[MAX_RUNLOOP_EVENTS];
+  int i, n, ms = 0;
+
+  if( size > MAX_RUNLOOP_EVENTS ) size = MAX_RUNLOOP_EVENTS;
+  if( timeout->tv_sec >= 0 ) {
+    /* round up, so we do not spin while waiting for a sub-millisecond timeout */
+    ms = timeout->tv_sec * 1000 + ( timeout->tv_nsec + 999999 ) / 1000000;
+  }
+  n = epoll_wait( poller->fd, &(ev[0]), size, ms );
+  if( n < 0 ) return ( errno == EINTR ) ? 0 : -1;
+
+  for( i=0; i<n; i++ ) {
+    fds[i]    = ev[i].data.fd;
+    events[i] = 0;
+    if( ev[i].events & ( EPOLLIN | EPOLLHUP | EPOLLERR ) )  events[i] |= MIDI_RUNLOOP_READ;
+    if( ev[i].events & ( EPOLLOUT | EPOLLHUP | EPOLLERR ) ) events[i] |= MIDI_RUNLOOP_WRITE;
+  }
+  return n;
+}
+
+#elif defined( MIDI_RUNLOOP_KQUEUE )
+
+/**
+ * @brief Register the runloop's interest in a file descriptor with kqueue.
+ * @private @memberof MIDIRunloop
+ * @param info The poller.
+ * @param fd   The file descriptor that was scheduled or cleared.
+ */
+static int _poller_update( void * info, int fd ) {
+  struct MIDIRunloopPoller * poller = info;
+  struct MIDIRunloopSource * master = &(poller->runloop->master);
+  struct kevent ev[2];
+  int n = 0;
+
+  if( FD_ISSET( fd, &(master->readfds) ) && ! FD_ISSET( fd, &(poller->readfds) ) ) {
+    EV_SET( &(ev[n++]), fd, EVFILT_READ, EV_ADD, 0, 0, NULL );
+    FD_SET( fd, &(poller->readfds) );
+  } else if( ! FD_ISSET( fd, &(master->readfds) ) && FD_ISSET( fd, &(poller->readfds) ) ) {
+    EV_SET( &(ev[n++]), fd, EVFILT_READ, EV_DELETE, 0, 0, NULL );
+    FD_CLR( fd, &(poller->readfds) );
+  }
+  if( FD_ISSET( fd, &(master->writefds) ) && ! FD_ISSET( fd, &(poller->writefds) ) ) {
+    EV_SET( &(ev[n++]), fd, EVFILT_WRITE, EV_ADD, 0, 0, NULL );
+    FD_SET( fd, &(poller->writefds) );
+  } else if( ! FD_ISSET( fd, &(master->writefds) ) && FD_ISSET( fd, &(poller->writefds) ) ) {
+    EV_SET( &(ev[n++]), fd, EVFILT_WRITE, EV_DELETE, 0, 0, NULL );
+    FD_CLR( fd, &(poller->writefds) );
+  }
+  if( n == 0 ) return 0;
+  /* deleting a filter of a closed descriptor fails, which is fine */
+  kevent( poller->fd, &(ev[0]), n, NULL, 0, NULL );
+  return 0;
+}
+
+/**
+ * @brief Wait for ready file descriptors using kqueue.
+ * @private @memberof MIDIRunloop
+ * @param info    The poller.
+ * @param timeout The maximum time to wait.
+ * @param size    The number of available entries in @c fds and @c events.
+ * @param fds     Will be set to the ready file descriptors.
+ * @param events  Will be set to the events of the ready file descriptors.
+ * @return the number of ready file descriptors, zero on timeout.
+ */
+static int _poller_wait( void * info, struct timespec * timeout, int size, int * fds, int * events ) {
+  struct MIDIRunloopPoller * poller = info;
+  struct kevent ev[MAX_RUNLOOP_EVENTS];
+  struct timespec ts = { 0, 0 };
+  int i, n;
+
+  if( size > MAX_RUNLOOP_EVENTS ) size = MAX_RUNLOOP_EVENTS;
+  if( timeout->tv_sec >= 0 ) _timespec_cpy( &ts, timeout );
+  n = kevent( poller->fd, NULL, 0, &(ev[0]), size, &ts );
+  if( n < 0 ) return ( errno == EINTR ) ? 0 : -1;
+
+  for( i=0; i<n; i++ ) {
+    fds[i]    = (int) ev[i].ident;
+    events[i] = ( ev[i].filter == EVFILT_WRITE ) ? MIDI_RUNLOOP_WRITE : MIDI_RUNLOOP_READ;
+  }
+  return n;
+}
+
+#endif
+
+/** @} */
+
+/* MARK: -
+ * MARK: Posting *//**
+ * @name Posting
+ * @cond INTERNALS
+ * Hand over callbacks from other threads. Posted callbacks are pushed
+ * onto a lock-free list that is taken over as a whole by the thread that
+ * runs the runloop. A file descriptor wakes the runloop up while it is
+ * blocked in @ref MIDIRunloopStart.
+ * @{
+ */
+
+/**
+ * @brief Open the wakeup file descriptors.
+ * Use an @c eventfd on Linux and a non-blocking pipe elsewhere.
+ * @private @memberof MIDIRunloop
+ * @param runloop The runloop.
+ */
+static void _runloop_wakeup_open( struct MIDIRunloop * runloop ) {
+#if defined( MIDI_RUNLOOP_EPOLL )
+  runloop->wakeup_read  = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+  runloop->wakeup_write = runloop->wakeup_read;
+#else
+  int fds[2];
+  runloop->wakeup_read  = -1;
+  runloop->wakeup_write = -1;
+  if( pipe( fds ) == 0 ) {
+    fcntl( fds[0], F_SETFL, O_NONBLOCK );
+    fcntl( fds[1], F_SETFL, O_NONBLOCK );
+    fcntl( fds[0], F_SETFD, FD_CLOEXEC );
+    fcntl( fds[1], F_SETFD, FD_CLOEXEC );
+    runloop->wakeup_read  = fds[0];
+    runloop->wakeup_write = fds[1];
+  }
+#endif
+  if( runloop->wakeup_read < 0 ) {
+    MIDILog( ERROR, "Could not open runloop wakeup descriptor.\n" );
+  }
+}
+
+/**
+ * @brief Close the wakeup file descriptors.
+ * @private @memberof MIDIRunloop
+ * @param runloop The runloop.
+ */
+static void _runloop_wakeup_close( struct MIDIRunloop * runloop ) {
+  if( runloop->wakeup_write >= 0 && runloop->wakeup_write != runloop->wakeup_read ) {
+    close( runloop->wakeup_write );
+  }
+  if( runloop->wakeup_read >= 0 ) {
+    close( runloop->wakeup_read );
+  }
+  runloop->wakeup_read  = -1;
+  runloop->wakeup_write = -1;
+}
+
+/**
+ * @brief Wake up the runloop.
+ * May be called from any thread.
+ * @private @memberof MIDIRunloop
+ * @param runloop The runloop.
+ */
+static void _runloop_wakeup_signal( struct MIDIRunloop * runloop ) {
+#if defined( MIDI_RUNLOOP_EPOLL )
+  unsigned long long one = 1;
+#else
+  unsigned char one = 1;
+#endif
+  if( runloop->wakeup_write < 0 ) return;
+  /* a full pipe or counter already wakes the runloop */
+  if( write( runloop->wakeup_write, &one, sizeof(one) ) < 0 ) return;
+}
+
+/**
+ * @brief Consume all pending wakeups.
+ * @private @memberof MIDIRunloop
+ * @param runloop The runloop.
+ */
+static void _runloop_wakeup_drain( struct MIDIRunloop * runloop ) {
+  unsigned char buffer[64];
+  if( runloop->wakeup_read < 0 ) return;
+  while( read( runloop->wakeup_read, &(buffer[0]), sizeof(buffer) ) > 0 ) {
+  }
+}
+
+/**
+ * @brief Call all posted callbacks.
+ * Take over the list of posted callbacks and call them in the order in
+ * which they were posted.
+ * @private @memberof MIDIRunloop
+ * @param runloop The runloop.
+ * @return the sum of the callback results.
+ */
+static int _runloop_run_posted( struct MIDIRunloop * runloop ) {
+  struct MIDIRunloopPost * post, * next, * fifo = NULL;
+  int result = 0;
+
+  post = __sync_lock_test_and_set( &(runloop->posted), NULL );
+  while( post != NULL ) {
+    next = post->next;
+    post->next = fifo;
+    fifo = post;
+    post = next;
+  }
+  CURRENT_RUNLOOP( runloop );
+  while( fifo != NULL ) {
+    post = fifo;
+    fifo = post->next;
+    result += (post->callback)( post->info );
+    free( post );
+  }
+  return result;
+}
+
+/**
+ * @brief Read callback of the wakeup source.
+ * Drain the wakeup descriptor before taking over the posted callbacks,
+ * so that a callback posted in between signals the runloop again.
+ * @private @memberof MIDIRunloop
+ * @param info    The runloop.
+ * @param nfds    The number of file descriptors.
+ * @param readfds The set of readable file descriptors.
+ */
+static int _runloop_wakeup_read( void * info, int nfds, fd_set * readfds ) {
+  struct MIDIRunloop * runloop = info;
+  if( ! FD_ISSET( runloop->wakeup_read, readfds ) ) return 0;
+  _runloop_wakeup_drain( runloop );
+  return _runloop_run_posted( runloop );
+}
+
+/**
+ * @brief Start listening for wakeups.
+ * Add the wakeup source to the runloop. This is only done while the runloop
+ * runs in @ref MIDIRunloopStart, so that @ref MIDIRunloopStep still returns
+ * immediately if nothing else is scheduled.
+ * @private @memberof MIDIRunloop
+ * @param runloop The runloop.
+ */
+static int _runloop_wakeup_attach( struct MIDIRunloop * runloop ) {
+  struct MIDIRunloopSourceDelegate delegate = { NULL, NULL, NULL, NULL };
+  if( runloop->wakeup_read < 0 ) return 0;
+  if( runloop->wakeup == NULL ) {
+    delegate.info = runloop;
+    delegate.read = &_runloop_wakeup_read;
+    runloop->wakeup = MIDIRunloopSourceCreate( &delegate );
+    if( runloop->wakeup == NULL ) return 1;
+    MIDIRunloopSourceScheduleRead( runloop->wakeup, runloop->wakeup_read );
+  }
+  if( runloop->wakeup->runloop == runloop ) return 0;
+  return MIDIRunloopAddSource( runloop, runloop->wakeup );
+}
+
+/**
+ * @brief Stop listening for wakeups.
+ * @private @memberof MIDIRunloop
+ * @param runloop The runloop.
+ */
+static void _runloop_wakeup_detach( struct MIDIRunloop * runloop ) {
+  if( runloop->wakeup != NULL && runloop->wakeup->runloop == runloop ) {
+    MIDIRunloopRemoveSource( runloop, runloop->wakeup );
+    _runloop_clear_read( runloop, runloop->wakeup_read );
+  }
+}
+
+/** @} */
+
 /* MARK: -
  * MARK: Global runloop *//**
  * @name Global runloop
@@ -650,6 +1493,20 @@ int MIDIRunloopGetGlobalRunloop( struct MIDIRunloop ** runloop ) {
   return 0;
 }
 
+/**
+ * @brief Get the runloop of the calling thread.
+ * Every thread can run its own runloop. While a runloop dispatches
+ * callbacks, it is the current runloop of the thread that runs it.
+ * @public @memberof MIDIRunloop
+ * @param runloop The current runloop or @c NULL if the thread does not run one.
+ * @retval 0 on success.
+ */
+int MIDIRunloopGetCurrentRunloop( struct MIDIRunloop ** runloop ) {
+  MIDIPrecond( runloop != NULL, EINVAL );
+  *runloop = _midi_current_runloop;
+  return 0;
+}
+
 /** @} */
 
 /* MARK: -
@@ -663,6 +1520,8 @@ struct MIDIRunloop * MIDIRunloopCreate() {
   MIDIPrecondReturn( runloop != NULL, ENOMEM, NULL );
 
   MIDIRunloopInit( runloop );
+  /* fall back to select if the native poller is not available */
+  MIDIRunloopSetNativeDelegate( runloop );
   return runloop;
 }
 
@@ -672,6 +1531,9 @@ void MIDIRunloopInit( struct MIDIRunloop * runloop ) {
 
   runloop->refs   = 1;
   runloop->active = 0;
+  runloop->wakeup = NULL;
+  runloop->posted = NULL;
+  _runloop_wakeup_open( runloop );
   runloop->master.nfds = 0;
   FD_ZERO( &(runloop->master.readfds) );
   FD_ZERO( &(runloop->master.writefds) );
@@ -682,8 +1544,16 @@ void MIDIRunloopInit( struct MIDIRunloop * runloop ) {
   runloop->master.delegate.timeout = NULL;
   runloop->master.delegate.info    = runloop;
   runloop->master.runloop = runloop;
-
-  for( i=0; i<MAX_RUNLOOP_SOURCES; i++ ) {
+  runloop->master.ntimers       = 0;
+  runloop->master.timers_size   = 0;
+  runloop->master.timers_free   = NO_TIMER;
+  runloop->master.timers_serial = 0;
+  runloop->master.timers        = NULL;
+  runloop->master.timers_heap   = NULL;
+
+  runloop->sources = malloc( MAX_RUNLOOP_SOURCES * sizeof( struct MIDIRunloopSource * ) );
+  runloop->sources_size = ( runloop->sources != NULL ) ? MAX_RUNLOOP_SOURCES : 0;
+  for( i=0; i<runloop->sources_size; i++ ) {
     runloop->sources[i] = NULL;
   }
   
@@ -694,35 +1564,68 @@ void MIDIRunloopInit( struct MIDIRunloop * runloop ) {
   runloop->clear_write      = NULL;
   runloop->clear_timeout    = NULL;
   runloop->destroy = NULL;
+
+  runloop->delegate.info             = NULL;
+  runloop->delegate.schedule_read    = NULL;
+  runloop->delegate.schedule_write   = NULL;
+  runloop->delegate.schedule_timeout = NULL;
+  runloop->delegate.clear_read       = NULL;
+  runloop->delegate.clear_write      = NULL;
+  runloop->delegate.clear_timeout    = NULL;
+  runloop->delegate.wait             = NULL;
+  runloop->delegate.destroy          = NULL;
+
+  _timespec_zero( &(runloop->busy_poll) );
+  FD_ZERO( &(runloop->busy_fds) );
+  runloop->cpu      = -1;
+  runloop->priority = 0;
+  _timespec_zero( &(runloop->step_wait) );
+  memset( &(runloop->stats), 0, sizeof(struct MIDIRunloopStats) );
 }
 
 void MIDIRunloopDestroy( struct MIDIRunloop * runloop ) {
+  struct MIDIRunloopPost * post;
   int i;
   MIDIPrecondReturn( runloop != NULL, EFAULT, (void)0 );
 
+  while( runloop->posted != NULL ) {
+    post = runloop->posted;
+    runloop->posted = post->next;
+    free( post );
+  }
+
+  if( runloop->delegate.destroy != NULL ) {
+    (runloop->delegate.destroy)( runloop->delegate.info );
+  }
   if( runloop->destroy != NULL ) {
     (*runloop->destroy)( runloop );
   }
-  for( i=0; i<MAX_RUNLOOP_SOURCES; i++ ) {
+  for( i=0; i<runloop->sources_size; i++ ) {
     if( runloop->sources[i] != NULL ) {
       runloop->sources[i]->runloop = NULL;
       MIDIRunloopSourceRelease( runloop->sources[i] );
     }
   }
+  free( runloop->sources );
+  if( runloop->wakeup != NULL ) MIDIRunloopSourceRelease( runloop->wakeup );
+  _runloop_wakeup_close( runloop );
+  if( runloop->master.timers != NULL ) free( runloop->master.timers );
+  if( runloop->master.timers_heap != NULL ) free( runloop->master.timers_heap );
   free( runloop );
 }
 
 void MIDIRunloopRetain( struct MIDIRunloop * runloop ) {
-  runloop->refs++;
+  MIDIRefRetain( runloop->refs );
 }
 
 void MIDIRunloopRelease( struct MIDIRunloop * runloop ) {
-  if( ! --runloop->refs ) {
+  if( ! MIDIRefRelease( runloop->refs ) ) {
     MIDIRunloopDestroy( runloop );
   }
 }
 
 static int _runloop_schedule_read( struct MIDIRunloop * runloop, int fd ) {
+  int result = 0;
   MIDIAssert( runloop != NULL );
   
   if( fd >= runloop->master.nfds ) {
@@ -730,19 +1633,24 @@ static int _runloop_schedule_read( struct MIDIRunloop * runloop, int fd ) {
   }
   FD_SET( fd, &(runloop->master.readfds) );
   runloop->master.delegate.read = &_runloop_master_read;
+  if( ! _timespec_empty( &(runloop->busy_poll) ) && ! FD_ISSET( fd, &(runloop->busy_fds) ) ) {
+    _runloop_busy_poll_socket( runloop, fd );
+  }
 
+  if( runloop->delegate.schedule_read != NULL ) {
+    result = (runloop->delegate.schedule_read)( runloop->delegate.info, fd );
+  }
   if( runloop->schedule_read != NULL ) {
-    return (runloop->schedule_read)( runloop, fd );
-  } else {
-    return 0;
+    result += (runloop->schedule_read)( runloop, fd );
   }
+  return result;
 }
 
 static int _runloop_clear_read( struct MIDIRunloop * runloop, int fd ) {
-  int i;
+  int i, result = 0;
   MIDIAssert( runloop != NULL );
 
-  for( i=0; i<MAX_RUNLOOP_SOURCES; i++ ) {
+  for( i=0; i<runloop->sources_size; i++ ) {
     if( runloop->sources[i] != NULL ) {
       if( FD_ISSET( fd, &(runloop->sources[i]->readfds) ) ) {
         return 0;
@@ -754,15 +1662,19 @@ static int _runloop_clear_read( struct MIDIRunloop * runloop, int fd ) {
     runloop->master.nfds = fd;
   }
   FD_CLR( fd, &(runloop->master.readfds) );
+  FD_CLR( fd, &(runloop->busy_fds) );
 
+  if( runloop->delegate.clear_read != NULL ) {
+    result = (runloop->delegate.clear_read)( runloop->delegate.info, fd );
+  }
   if( runloop->clear_read != NULL ) {
-    return (runloop->clear_read)( runloop, fd );
-  } else {
-    return 0;
+    result += (runloop->clear_read)( runloop, fd );
   }
+  return result;
 }
 
 static int _runloop_schedule_write( struct MIDIRunloop * runloop, int fd ) {
+  int result = 0;
   MIDIAssert( runloop != NULL );
   
   if( fd >= runloop->master.nfds ) {
@@ -771,18 +1683,20 @@ static int _runloop_schedule_write( struct MIDIRunloop * runloop, int fd ) {
   FD_SET( fd, &(runloop->master.writefds) );
   runloop->master.delegate.write = &_runloop_master_write;
 
+  if( runloop->delegate.schedule_write != NULL ) {
+    result = (runloop->delegate.schedule_write)( runloop->delegate.info, fd );
+  }
   if( runloop->schedule_write != NULL ) {
-    return (runloop->schedule_write)( runloop, fd );
-  } else {
-    return 0;
+    result += (runloop->schedule_write)( runloop, fd );
   }
+  return result;
 }
 
 static int _runloop_clear_write( struct MIDIRunloop * runloop, int fd ) {
-  int i;
+  int i, result = 0;
   MIDIAssert( runloop != NULL );
 
-  for( i=0; i<MAX_RUNLOOP_SOURCES; i++ ) {
+  for( i=0; i<runloop->sources_size; i++ ) {
     if( runloop->sources[i] != NULL ) {
       if( FD_ISSET( fd, &(runloop->sources[i]->writefds) ) ) {
         return 0;
@@ -795,11 +1709,13 @@ static int _runloop_clear_write( struct MIDIRunloop * runloop, int fd ) {
   }
   FD_CLR( fd, &(runloop->master.writefds) );
 
+  if( runloop->delegate.clear_write != NULL ) {
+    result = (runloop->delegate.clear_write)( runloop->delegate.info, fd );
+  }
   if( runloop->clear_write != NULL ) {
-    return (runloop->clear_write)( runloop, fd );
-  } else {
-    return 0;
+    result += (runloop->clear_write)( runloop, fd );
   }
+  return result;
 }
 
 
@@ -859,19 +1775,50 @@ static int _runloop_update_from_source( struct MIDIRunloop * runloop, struct MID
   return 0;
 }
 
+/**
+ * @brief Double the number of source slots.
+ * @private @memberof MIDIRunloop
+ * @param runloop The runloop.
+ * @retval 0 on success.
+ * @retval >0 if the slots could not be allocated.
+ */
+static int _runloop_sources_grow( struct MIDIRunloop * runloop ) {
+  struct MIDIRunloopSource ** sources;
+  int i, size = ( runloop->sources_size > 0 ) ? 2 * runloop->sources_size : MAX_RUNLOOP_SOURCES;
+  sources = realloc( runloop->sources, size * sizeof( struct MIDIRunloopSource * ) );
+  if( sources == NULL ) {
+    MIDIError( ENOMEM, "Failed to grow runloop sources." );
+    return ENOMEM;
+  }
+  for( i=runloop->sources_size; i<size; i++ ) {
+    sources[i] = NULL;
+  }
+  runloop->sources      = sources;
+  runloop->sources_size = size;
+  return 0;
+}
+
+/**
+ * @brief Add a source to the runloop.
+ * Retain the source and schedule its file descriptors and timeouts.
+ * The runloop makes room for any number of sources.
+ * @public @memberof MIDIRunloop
+ * @param runloop The runloop.
+ * @param source  The source.
+ * @retval 0 on success.
+ * @retval >0 if the source could not be added.
+ */
 int MIDIRunloopAddSource( struct MIDIRunloop * runloop, struct MIDIRunloopSource * source ) {
   int i;
-  for( i=0; i<MAX_RUNLOOP_SOURCES; i++ ) {
-    if( runloop->sources[i] == NULL ) {
-      runloop->sources[i] = source;
-      source->runloop = runloop;
-      MIDIRunloopSourceRetain( source );
-      break;
-    }
+  for( i=0; i<runloop->sources_size; i++ ) {
+    if( runloop->sources[i] == NULL ) break;
   }
-  if( i == MAX_RUNLOOP_SOURCES ) {
+  if( i == runloop->sources_size && _runloop_sources_grow( runloop ) ) {
     return 1;
   }
+  runloop->sources[i] = source;
+  source->runloop = runloop;
+  MIDIRunloopSourceRetain( source );
   _runloop_update_from_source( runloop, source );
   _runloop_source_reschedule( &(runloop->master) );
   MIDILog( DEVELOP, "master timeout %lu sec + %lu nsec\nnfds: %i\n",
@@ -881,7 +1828,7 @@ int MIDIRunloopAddSource( struct MIDIRunloop * runloop, struct MIDIRunloopSource
 
 int MIDIRunloopRemoveSource( struct MIDIRunloop * runloop, struct MIDIRunloopSource * source ) {
   int i;
-  for( i=0; i<MAX_RUNLOOP_SOURCES; i++ ) {
+  for( i=0; i<runloop->sources_size; i++ ) {
     if( runloop->sources[i] == source ) {
       runloop->sources[i] = NULL;
       source->runloop = NULL;
@@ -892,24 +1839,396 @@ int MIDIRunloopRemoveSource( struct MIDIRunloop * runloop, struct MIDIRunloopSou
   return 1;
 }
 
+/**
+ * @brief Set the runloop delegate.
+ * The delegate is notified whenever a file descriptor is scheduled or cleared.
+ * If the delegate provides a @c wait callback, it replaces @c select to wait
+ * for ready file descriptors. All currently scheduled file descriptors are
+ * passed to the new delegate.
+ * The previous delegate is destroyed if it has a @c destroy callback.
+ * @public @memberof MIDIRunloop
+ * @param runloop  The runloop.
+ * @param delegate The delegate to use. Pass @c NULL to fall back to @c select.
+ * @retval 0 on success.
+ */
+int MIDIRunloopSetDelegate( struct MIDIRunloop * runloop, struct MIDIRunloopDelegate * delegate ) {
+  MIDIPrecond( runloop != NULL, EFAULT );
+
+  if( runloop->delegate.destroy != NULL ) {
+    (runloop->delegate.destroy)( runloop->delegate.info );
+  }
+  if( delegate != NULL ) {
+    runloop->delegate = *delegate;
+  } else {
+    runloop->delegate.info             = NULL;
+    runloop->delegate.schedule_read    = NULL;
+    runloop->delegate.schedule_write   = NULL;
+    runloop->delegate.schedule_timeout = NULL;
+    runloop->delegate.clear_read       = NULL;
+    runloop->delegate.clear_write      = NULL;
+    runloop->delegate.clear_timeout    = NULL;
+    runloop->delegate.wait             = NULL;
+    runloop->delegate.destroy          = NULL;
+  }
+  return _runloop_source_reschedule( &(runloop->master) );
+}
+
+/**
+ * @brief Use the native poller of the operating system.
+ * Install a delegate that waits using @c epoll on Linux and @c kqueue on
+ * BSD and Mac OS X. Define @c MIDI_RUNLOOP_SELECT at compile time or on other
+ * systems the runloop is reset to @c select.
+ * @public @memberof MIDIRunloop
+ * @param runloop The runloop.
+ * @retval 0 on success.
+ * @retval >0 if the poller could not be created.
+ */
+int MIDIRunloopSetNativeDelegate( struct MIDIRunloop * runloop ) {
+#if defined( MIDI_RUNLOOP_EPOLL ) || defined( MIDI_RUNLOOP_KQUEUE )
+  struct MIDIRunloopDelegate delegate;
+  MIDIPrecond( runloop != NULL, EFAULT );
+
+  delegate.info = _poller_create( runloop );
+  if( delegate.info == NULL ) return 1;
+  delegate.schedule_read    = &_poller_update;
+  delegate.schedule_write   = &_poller_update;
+  delegate.schedule_timeout = NULL;
+  delegate.clear_read       = &_poller_update;
+  delegate.clear_write      = &_poller_update;
+  delegate.clear_timeout    = NULL;
+  delegate.wait             = &_poller_wait;
+  delegate.destroy          = &_poller_destroy;
+  return MIDIRunloopSetDelegate( runloop, &delegate );
+#else
+  return MIDIRunloopSetDelegate( runloop, NULL );
+#endif
+}
+
+/**
+ * @brief Set the busy poll option of a socket.
+ * Let the kernel poll the device queue of a socket for a while before a
+ * blocking receive sleeps. The option is ignored for descriptors that
+ * are not sockets and where it is not supported.
+ * @private @memberof MIDIRunloop
+ * @param runloop The runloop.
+ * @param fd      The file descriptor.
+ */
+static void _runloop_busy_poll_socket( struct MIDIRunloop * runloop, int fd ) {
+#if defined( SO_BUSY_POLL )
+  int usec = runloop->busy_poll.tv_sec * 1000000 + runloop->busy_poll.tv_nsec / 1000;
+  setsockopt( fd, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec) );
+#endif
+  if( _timespec_empty( &(runloop->busy_poll) ) ) {
+    FD_CLR( fd, &(runloop->busy_fds) );
+  } else {
+    FD_SET( fd, &(runloop->busy_fds) );
+  }
+}
+
+/**
+ * @brief Spin before the runloop goes to sleep.
+ * Instead of blocking right away, poll the scheduled file descriptors
+ * without blocking for up to @c usec microseconds. Data that arrives
+ * during that time is dispatched without the latency of waking up a
+ * sleeping thread, at the cost of a busy core. Where supported, sockets
+ * that are scheduled for reading are busy polled by the kernel as well.
+ * Busy polling works with the native poller and with delegates that have
+ * a @c wait callback. Timers and timeouts are not delayed by spinning.
+ * @public @memberof MIDIRunloop
+ * @param runloop The runloop.
+ * @param usec    The spin budget in microseconds, 0 to always block.
+ * @retval 0 on success.
+ */
+int MIDIRunloopSetBusyPoll( struct MIDIRunloop * runloop, unsigned long usec ) {
+  int fd;
+  MIDIPrecond( runloop != NULL, EFAULT );
+  runloop->busy_poll.tv_sec  = usec / 1000000;
+  runloop->busy_poll.tv_nsec = ( usec % 1000000 ) * 1000;
+  for( fd=0; fd<runloop->master.nfds; fd++ ) {
+    if( FD_ISSET( fd, &(runloop->master.readfds) ) || FD_ISSET( fd, &(runloop->busy_fds) ) ) {
+      _runloop_busy_poll_socket( runloop, fd );
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief Get the busy poll budget.
+ * @public @memberof MIDIRunloop
+ * @param runloop The runloop.
+ * @param usec    The spin budget in microseconds.
+ * @retval 0 on success.
+ */
+int MIDIRunloopGetBusyPoll( struct MIDIRunloop * runloop, unsigned long * usec ) {
+  MIDIPrecond( runloop != NULL, EFAULT );
+  MIDIPrecond( usec != NULL, EINVAL );
+  *usec = runloop->busy_poll.tv_sec * 1000000 + runloop->busy_poll.tv_nsec / 1000;
+  return 0;
+}
+
+/**
+ * @brief Pin the thread that runs the runloop to a CPU.
+ * The thread is pinned when @ref MIDIRunloopStart is called and its
+ * previous affinity is restored when the runloop stops. This is only
+ * supported on Linux.
+ * @public @memberof MIDIRunloop
+ * @param runloop The runloop.
+ * @param cpu     The CPU, -1 to not pin the thread.
+ * @retval 0 on success.
+ * @retval >0 if threads can not be pinned.
+ */
+int MIDIRunloopSetThreadAffinity( struct MIDIRunloop * runloop, int cpu ) {
+  MIDIPrecond( runloop != NULL, EFAULT );
+  if( cpu < -1 ) {
+    MIDIError( EINVAL, "Invalid CPU." );
+    return EINVAL;
+  }
+#if !defined( __linux__ )
+  if( cpu != -1 ) {
+    MIDIError( ENOSYS, "Threads can not be pinned on this system." );
+    return ENOSYS;
+  }
+#endif
+  runloop->cpu = cpu;
+  return 0;
+}
+
+/**
+ * @brief Run the runloop's thread with real time priority.
+ * The thread is scheduled with @c SCHED_FIFO and the given priority when
+ * @ref MIDIRunloopStart is called. Its previous scheduling policy is
+ * restored when the runloop stops. The process usually needs the
+ * privilege to do so, like @c CAP_SYS_NICE or an @c RLIMIT_RTPRIO.
+ * @public @memberof MIDIRunloop
+ * @param runloop  The runloop.
+ * @param priority The priority, 0 to keep the thread's policy.
+ * @retval 0 on success.
+ * @retval >0 if the priority is out of range.
+ */
+int MIDIRunloopSetThreadPriority( struct MIDIRunloop * runloop, int priority ) {
+  MIDIPrecond( runloop != NULL, EFAULT );
+  if( priority != 0 && ( priority < sched_get_priority_min( SCHED_FIFO )
+                       || priority > sched_get_priority_max( SCHED_FIFO ) ) ) {
+    MIDIError( EINVAL, "Priority is out of range." );
+    return EINVAL;
+  }
+  runloop->priority = priority;
+  return 0;
+}
+
+/**
+ * @brief The scheduling of a thread before a runloop was started on it.
+ */
+struct MIDIRunloopThreadState {
+  int policy;
+  struct sched_param param;
+#if defined( __linux__ )
+  cpu_set_t cpus;
+#endif
+};
+
+/**
+ * @brief Apply the affinity and priority of the runloop to the calling thread.
+ * Failures are logged, the runloop runs anyway.
+ * @private @memberof MIDIRunloop
+ * @param runloop The runloop.
+ * @param state   Will be set to the previous state of the thread.
+ */
+static void _runloop_thread_enter( struct MIDIRunloop * runloop, struct MIDIRunloopThreadState * state ) {
+  struct sched_param param;
+  int error;
+#if defined( __linux__ )
+  cpu_set_t cpus;
+  if( runloop->cpu >= 0 ) {
+    pthread_getaffinity_np( pthread_self(), sizeof(cpu_set_t), &(state->cpus) );
+    CPU_ZERO( &cpus );
+    CPU_SET( runloop->cpu, &cpus );
+    error = pthread_setaffinity_np( pthread_self(), sizeof(cpu_set_t), &cpus );
+    if( error ) {
+      MIDIError( error, "Could not pin runloop thread." );
+    }
+  }
+#endif
+  if( runloop->priority > 0 ) {
+    pthread_getschedparam( pthread_self(), &(state->policy), &(state->param) );
+    param.sched_priority = runloop->priority;
+    error = pthread_setschedparam( pthread_self(), SCHED_FIFO, &param );
+    if( error ) {
+      MIDIError( error, "Could not run runloop thread with real time priority." );
+    }
+  }
+}
+
+/**
+ * @brief Restore the affinity and priority of the calling thread.
+ * @private @memberof MIDIRunloop
+ * @param runloop The runloop.
+ * @param state   The previous state of the thread.
+ */
+static void _runloop_thread_leave( struct MIDIRunloop * runloop, struct MIDIRunloopThreadState * state ) {
+  if( runloop->priority > 0 ) {
+    pthread_setschedparam( pthread_self(), state->policy, &(state->param) );
+  }
+#if defined( __linux__ )
+  if( runloop->cpu >= 0 ) {
+    pthread_setaffinity_np( pthread_self(), sizeof(cpu_set_t), &(state->cpus) );
+  }
+#endif
+}
+
+/**
+ * @brief Account an iteration of the runloop.
+ * The time of the iteration that was not spent waiting was spent in
+ * callbacks.
+ * @private @memberof MIDIRunloop
+ * @param runloop The runloop.
+ * @param start   The time the iteration started.
+ */
+static void _runloop_account_step( struct MIDIRunloop * runloop, struct timespec * start ) {
+  struct timespec busy;
+  unsigned long long usec;
+  _timespec_now( &busy );
+  _timespec_sub( &busy, start );
+  _timespec_sub( &busy, &(runloop->step_wait) );
+  usec = ( busy.tv_sec < 0 ) ? 0 : busy.tv_sec * 1000000ULL + busy.tv_nsec / 1000;
+  runloop->stats.iterations++;
+  runloop->stats.busy_usec += usec;
+  runloop->stats.wait_usec += runloop->step_wait.tv_sec * 1000000ULL + runloop->step_wait.tv_nsec / 1000;
+  if( usec > runloop->stats.busy_max_usec ) runloop->stats.busy_max_usec = usec;
+}
+
+/**
+ * @brief Run one iteration of the runloop.
+ * Call callbacks that were posted since the last iteration, if any.
+ * Otherwise wait until any callback of the runloop is triggered.
+ * @public @memberof MIDIRunloop
+ * @param runloop The runloop.
+ * @retval 0 on success.
+ * @retval >0 if any callback failed.
+ */
 int MIDIRunloopStep( struct MIDIRunloop * runloop ) {
-  return MIDIRunloopSourceWait( &(runloop->master) );
+  struct MIDIRunloop * previous = _midi_current_runloop;
+  struct timespec start;
+  int result;
+  _timespec_now( &start );
+  _timespec_zero( &(runloop->step_wait) );
+  if( runloop->posted != NULL ) {
+    result = _runloop_run_posted( runloop );
+  } else {
+    result = MIDIRunloopSourceWait( &(runloop->master) );
+  }
+  _runloop_account_step( runloop, &start );
+  CURRENT_RUNLOOP( previous );
+  return result;
 }
 
+/**
+ * @brief Get the iteration statistics of the runloop.
+ * The statistics are updated by the thread that runs the runloop, other
+ * threads may read slightly outdated numbers.
+ * @public @memberof MIDIRunloop
+ * @param runloop The runloop.
+ * @param stats   The statistics.
+ * @retval 0 on success.
+ */
+int MIDIRunloopGetStats( struct MIDIRunloop * runloop, struct MIDIRunloopStats * stats ) {
+  MIDIPrecond( runloop != NULL, EFAULT );
+  MIDIPrecond( stats != NULL, EINVAL );
+  memcpy( stats, &(runloop->stats), sizeof(struct MIDIRunloopStats) );
+  return 0;
+}
+
+/**
+ * @brief Run the runloop until it is stopped.
+ * Step through the runloop on the calling thread until any callback fails
+ * or @ref MIDIRunloopStop is called. While running, the runloop is woken up
+ * when callbacks are posted from other threads. A program may run several
+ * runloops on separate threads, but all sources, timers and schedulers of
+ * a runloop must only be touched by the thread that runs it. Use
+ * @ref MIDIRunloopPost to get there from another thread. The thread's
+ * affinity and priority are set as configured for the runloop while it
+ * runs.
+ * @public @memberof MIDIRunloop
+ * @param runloop The runloop.
+ * @retval 0 if the runloop was stopped.
+ * @retval >0 if any callback failed.
+ */
 int MIDIRunloopStart( struct MIDIRunloop * runloop ) {
+  struct MIDIRunloopThreadState state;
   int result = 0;
+  CURRENT_RUNLOOP( runloop );
   runloop->active = 1;
+  if( _runloop_wakeup_attach( runloop ) ) {
+    MIDILog( ERROR, "Runloop will not wake up for posted callbacks.\n" );
+  }
+  _runloop_thread_enter( runloop, &state );
   do {
     result = MIDIRunloopStep( runloop );
     if( result != 0 ) {
       runloop->active = 0;
     }
   } while( runloop->active );
+  _runloop_thread_leave( runloop, &state );
+  _runloop_wakeup_detach( runloop );
   CURRENT_RUNLOOP(NULL);
   return result;
 }
 
+/**
+ * @brief Stop the runloop.
+ * Make @ref MIDIRunloopStart return after the current iteration.
+ * May be called from any thread.
+ * @public @memberof MIDIRunloop
+ * @param runloop The runloop.
+ * @retval 0 on success.
+ */
 int MIDIRunloopStop( struct MIDIRunloop * runloop ) {
   runloop->active = 0;
+  __sync_synchronize();
+  _runloop_wakeup_signal( runloop );
+  return 0;
+}
+
+/**
+ * @brief Call a function on the thread that runs a runloop.
+ * Queue a callback that is called by the runloop's thread during its next
+ * iteration. Callbacks are called in the order in which they were posted.
+ * Like other runloop callbacks, a non-zero result stops
+ * @ref MIDIRunloopStart. This may be called from any thread and does not
+ * take any locks. Callbacks that are still pending when the runloop is
+ * destroyed are dropped.
+ *
+ * Drivers that receive on their own thread should not post every message.
+ * Instead, push the messages onto a ring queue
+ * (@ref MIDIMessageQueueCreateRing), which is safe for one producer and one
+ * consumer thread, and post a callback that pops and delivers all queued
+ * messages. Guard the callback with a flag: after a push, the producer only
+ * posts if it could set the flag with @c __sync_lock_test_and_set. The
+ * callback clears the flag with @c __sync_lock_release before draining the
+ * queue until it is empty, so no message is left behind.
+ * @public @memberof MIDIRunloop
+ * @param runloop  The runloop.
+ * @param callback The function to call.
+ * @param info     The argument to pass to the function.
+ * @retval 0 on success.
+ * @retval >0 if the callback could not be posted.
+ */
+int MIDIRunloopPost( struct MIDIRunloop * runloop, int (*callback)( void * info ), void * info ) {
+  struct MIDIRunloopPost * post, * head;
+  MIDIPrecond( runloop != NULL, EFAULT );
+  MIDIPrecond( callback != NULL, EINVAL );
+
+  post = malloc( sizeof( struct MIDIRunloopPost ) );
+  MIDIPrecond( post != NULL, ENOMEM );
+  post->callback = callback;
+  post->info     = info;
+  do {
+    head = runloop->posted;
+    post->next = head;
+  } while( ! __sync_bool_compare_and_swap( &(runloop->posted), head, post ) );
+  /* the runloop takes over the whole list, it only needs one wakeup */
+  if( head == NULL ) {
+    _runloop_wakeup_signal( runloop );
+  }
   return 0;
 }
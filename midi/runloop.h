@@ -10,6 +10,13 @@
 struct MIDIRunloopSource;
 struct MIDIRunloop;
 
+struct MIDIRunloopStats {
+  unsigned long iterations;
+  unsigned long long wait_usec;
+  unsigned long long busy_usec;
+  unsigned long busy_max_usec;
+};
+
 struct MIDIRunloopSourceDelegate {
   void *info;
   int (*read)( void * info, int nfds, fd_set * readfds );
@@ -25,10 +32,26 @@ struct MIDIRunloopDelegate {
   int (*clear_read)( void * info, int fd );
   int (*clear_write)( void * info, int fd );
   int (*clear_timeout)( void * info );
+  int (*wait)( void * info, struct timespec * timeout, int size, int * fds, int * events );
+  void (*destroy)( void * info );
 };
 
 #ifdef MIDI_RUNLOOP_INTERNALS
+/* initial number of source slots, the runloop grows as needed */
+#ifndef MAX_RUNLOOP_SOURCES
 #define MAX_RUNLOOP_SOURCES 16
+#endif
+#define MAX_RUNLOOP_EVENTS  64
+
+#define MAX_RUNLOOP_TIMERS  65536
+
+struct MIDIRunloopTimer {
+  unsigned long handle;
+  size_t position;
+  struct timespec deadline;
+  int (*callback)( void * info, struct timespec * now );
+  void * info;
+};
 
 struct MIDIRunloopSource {
   int    refs;
@@ -39,14 +62,31 @@ struct MIDIRunloopSource {
   struct timespec timeout_time;
   struct MIDIRunloopSourceDelegate delegate;
   struct MIDIRunloop * runloop;
+  size_t ntimers;
+  size_t timers_size;
+  size_t timers_free;
+  unsigned long timers_serial;
+  struct MIDIRunloopTimer * timers;
+  size_t * timers_heap;
+};
+
+struct MIDIRunloopPost {
+  int (*callback)( void * info );
+  void * info;
+  struct MIDIRunloopPost * next;
 };
 
 struct MIDIRunloop {
   int    refs;
-  int    active;
+  int volatile active;
+  int    wakeup_read;
+  int    wakeup_write;
+  struct MIDIRunloopSource * wakeup;
+  struct MIDIRunloopPost * volatile posted;
   struct MIDIRunloopDelegate delegate;
   struct MIDIRunloopSource   master;
-  struct MIDIRunloopSource * sources[MAX_RUNLOOP_SOURCES];
+  int    sources_size;
+  struct MIDIRunloopSource ** sources;
   int (*schedule_read)( void * runloop, int fd );
   int (*schedule_write)( void * runloop, int fd );
   int (*schedule_timeout)( void * runloop, struct timespec * );
@@ -54,6 +94,12 @@ struct MIDIRunloop {
   int (*clear_write)( void * runloop, int fd );
   int (*clear_timeout)( void * runloop );
   void (*destroy)( void * runloop );
+  struct timespec busy_poll;
+  fd_set busy_fds;
+  int    cpu;
+  int    priority;
+  struct timespec step_wait;
+  struct MIDIRunloopStats stats;
 };
 #endif
 
@@ -71,9 +117,14 @@ int MIDIRunloopSourceScheduleWrite( struct MIDIRunloopSource * source, int fd );
 int MIDIRunloopSourceClearWrite( struct MIDIRunloopSource * source, int fd );
 int MIDIRunloopSourceScheduleTimeout( struct MIDIRunloopSource * source, struct timespec * timeout );
 int MIDIRunloopSourceClearTimeout( struct MIDIRunloopSource * source );
+int MIDIRunloopSourceAddTimer( struct MIDIRunloopSource * source, struct timespec * delay,
+                               int (*callback)( void * info, struct timespec * now ), void * info,
+                               unsigned long * handle );
+int MIDIRunloopSourceCancelTimer( struct MIDIRunloopSource * source, unsigned long handle );
 
 int MIDIRunloopSetGlobalRunloop( struct MIDIRunloop * runloop );
 int MIDIRunloopGetGlobalRunloop( struct MIDIRunloop ** runloop );
+int MIDIRunloopGetCurrentRunloop( struct MIDIRunloop ** runloop );
 
 struct MIDIRunloop * MIDIRunloopCreate();
 void MIDIRunloopInit( struct MIDIRunloop * runloop );
@@ -81,12 +132,22 @@ void MIDIRunloopDestroy( struct MIDIRunloop * runloop );
 void MIDIRunloopRetain( struct MIDIRunloop * runloop );
 void MIDIRunloopRelease( struct MIDIRunloop * runloop );
 
+int MIDIRunloopSetDelegate( struct MIDIRunloop * runloop, struct MIDIRunloopDelegate * delegate );
+int MIDIRunloopSetNativeDelegate( struct MIDIRunloop * runloop );
+
+int MIDIRunloopSetBusyPoll( struct MIDIRunloop * runloop, unsigned long usec );
+int MIDIRunloopGetBusyPoll( struct MIDIRunloop * runloop, unsigned long * usec );
+int MIDIRunloopSetThreadAffinity( struct MIDIRunloop * runloop, int cpu );
+int MIDIRunloopSetThreadPriority( struct MIDIRunloop * runloop, int priority );
+
 int MIDIRunloopAddSource( struct MIDIRunloop * runloop, struct MIDIRunloopSource * source );
 int MIDIRunloopRemoveSource( struct MIDIRunloop * runloop, struct MIDIRunloopSource * source );
 
 int MIDIRunloopStart( struct MIDIRunloop * runloop );
 int MIDIRunloopStop( struct MIDIRunloop * runloop );
 int MIDIRunloopStep( struct MIDIRunloop * runloop );
+int MIDIRunloopPost( struct MIDIRunloop * runloop, int (*callback)( void * info ), void * info );
+int MIDIRunloopGetStats( struct MIDIRunloop * runloop, struct MIDIRunloopStats * stats );
 
 
 #endif
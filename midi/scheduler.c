@@ -0,0 +1,519 @@
+#include <stdlib.h>
+#include <string.h>
+#define MIDI_DRIVER_INTERNALS
+#include "scheduler.h"
+
+#include "type.h"
+#include "port.h"
+#include "clock.h"
+#include "message.h"
+#include "runloop.h"
+
+#define MIDI_SCHEDULER_MIN_CAPACITY 16
+
+/** @internal */
+struct MIDISchedulerEntry;
+
+/**
+ * @ingroup MIDI
+ * @brief Output scheduler for future-dated messages.
+ * The scheduler holds messages until the clock reaches their timestamp
+ * and sends them through its port in timestamp order. Pending messages
+ * are kept in a binary min-heap, messages with equal timestamps are sent
+ * in the order they were scheduled. When its runloop source is added to
+ * a runloop, the scheduler arms a runloop timer for the earliest pending
+ * message, so the runloop wakes up exactly when the next message is due.
+ * If the scheduler was created for a driver, it uses the driver's clock,
+ * sends to the driver's port and records the difference between the due
+ * time and the actual send time in the driver's profile.
+ */
+struct MIDIScheduler {
+/**
+ * @privatesection
+ * @cond INTERNALS
+ */
+  int refs;
+  struct MIDIDriver * driver;
+  struct MIDIClock * clock;
+  struct MIDIPort * port;
+  struct MIDIRunloopSource * rls;
+  unsigned char shared_rls;
+  unsigned long timer;
+  MIDITimestamp timer_timestamp;
+  unsigned long serial;
+  size_t length;
+  size_t capacity;
+  struct MIDISchedulerEntry * heap;
+  struct MIDISchedulerStats stats;
+/** @endcond */
+};
+
+/* MARK: Internals *//**
+ * @name Internals
+ * @cond INTERNALS
+ * Heap operations and runloop timer handling.
+ * @{
+ */
+
+struct MIDISchedulerEntry {
+  MIDITimestamp timestamp;
+  unsigned long serial;
+  struct MIDIMessage * message;
+};
+
+static int _entry_less( struct MIDISchedulerEntry * a, struct MIDISchedulerEntry * b ) {
+  if( a->timestamp != b->timestamp ) return a->timestamp < b->timestamp;
+  return (long) ( a->serial - b->serial ) < 0;
+}
+
+static void _heap_up( struct MIDIScheduler * scheduler, size_t i ) {
+  struct MIDISchedulerEntry * heap = scheduler->heap;
+  struct MIDISchedulerEntry entry = heap[i];
+  while( i > 0 && _entry_less( &entry, &(heap[(i-1)/2]) ) ) {
+    heap[i] = heap[(i-1)/2];
+    i = (i-1)/2;
+  }
+  heap[i] = entry;
+}
+
+static void _heap_down( struct MIDIScheduler * scheduler, size_t i ) {
+  struct MIDISchedulerEntry * heap = scheduler->heap;
+  struct MIDISchedulerEntry entry = heap[i];
+  size_t c;
+  while( ( c = 2*i+1 ) < scheduler->length ) {
+    if( c+1 < scheduler->length && _entry_less( &(heap[c+1]), &(heap[c]) ) ) c++;
+    if( ! _entry_less( &(heap[c]), &entry ) ) break;
+    heap[i] = heap[c];
+    i = c;
+  }
+  heap[i] = entry;
+}
+
+static int _heap_push( struct MIDIScheduler * scheduler, MIDITimestamp timestamp, struct MIDIMessage * message ) {
+  struct MIDISchedulerEntry * heap;
+  size_t capacity;
+  if( scheduler->length == scheduler->capacity ) {
+    capacity = ( scheduler->capacity == 0 ) ? MIDI_SCHEDULER_MIN_CAPACITY : scheduler->capacity * 2;
+    heap = realloc( scheduler->heap, sizeof( struct MIDISchedulerEntry ) * capacity );
+    if( heap == NULL ) {
+      MIDIError( ENOMEM, "Failed to grow scheduler queue." );
+      return ENOMEM;
+    }
+    scheduler->heap     = heap;
+    scheduler->capacity = capacity;
+  }
+  MIDIMessageRetain( message );
+  scheduler->heap[scheduler->length].timestamp = timestamp;
+  scheduler->heap[scheduler->length].serial    = scheduler->serial++;
+  scheduler->heap[scheduler->length].message   = message;
+  _heap_up( scheduler, scheduler->length++ );
+  return 0;
+}
+
+static struct MIDIMessage * _heap_pop( struct MIDIScheduler * scheduler ) {
+  struct MIDIMessage * message = scheduler->heap[0].message;
+  if( --scheduler->length > 0 ) {
+    scheduler->heap[0] = scheduler->heap[scheduler->length];
+    _heap_down( scheduler, 0 );
+  }
+  return message;
+}
+
+/**
+ * @brief Convert a number of clock ticks to a timespec.
+ * @private @memberof MIDIScheduler
+ * @param scheduler The scheduler.
+ * @param ticks     The number of ticks, must not be negative.
+ * @param ts        The timespec.
+ */
+static void _ticks_to_timespec( struct MIDIScheduler * scheduler, MIDITimestamp ticks, struct timespec * ts ) {
+  MIDITimestamp rate = scheduler->stats.rate;
+  ts->tv_sec  = ticks / rate;
+  ts->tv_nsec = ( ( ticks % rate ) * 1000000000LL ) / rate;
+}
+
+/**
+ * @brief Runloop timer callback.
+ * @private @memberof MIDIScheduler
+ * @param info The scheduler.
+ * @param now  The current time.
+ * @retval 0 on success.
+ */
+static int _scheduler_timer( void * info, struct timespec * now ) {
+  struct MIDIScheduler * scheduler = info;
+  scheduler->timer = 0;
+  return MIDISchedulerPoll( scheduler );
+}
+
+/**
+ * @brief Arm the runloop timer for the earliest pending message.
+ * The timer is only replaced if the earliest timestamp changed.
+ * @private @memberof MIDIScheduler
+ * @param scheduler The scheduler.
+ * @param now       The current time of the scheduler's clock.
+ * @retval 0 on success.
+ * @retval >0 if the timer could not be added.
+ */
+static int _scheduler_arm( struct MIDIScheduler * scheduler, MIDITimestamp now ) {
+  struct timespec delay;
+  MIDITimestamp due;
+  if( scheduler->length == 0 ) {
+    if( scheduler->timer != 0 ) {
+      MIDIRunloopSourceCancelTimer( scheduler->rls, scheduler->timer );
+      scheduler->timer = 0;
+    }
+    return 0;
+  }
+  due = scheduler->heap[0].timestamp;
+  if( scheduler->timer != 0 ) {
+    if( scheduler->timer_timestamp == due ) return 0;
+    MIDIRunloopSourceCancelTimer( scheduler->rls, scheduler->timer );
+    scheduler->timer = 0;
+  }
+  _ticks_to_timespec( scheduler, ( due > now ) ? due - now : 0, &delay );
+  scheduler->timer_timestamp = due;
+  return MIDIRunloopSourceAddTimer( scheduler->rls, &delay, &_scheduler_timer, scheduler, &(scheduler->timer) );
+}
+
+/**
+ * @brief Port callback.
+ * Schedule every message that is received on the scheduler's port.
+ * Other objects are passed on at once.
+ * @private @memberof MIDIScheduler
+ * @param target The scheduler.
+ * @param source The port that sent the object.
+ * @param type   The type of the object.
+ * @param object The object.
+ * @retval 0 on success.
+ */
+static int _port_receive( void * target, void * source, struct MIDITypeSpec * type, void * object ) {
+  struct MIDIScheduler * scheduler = target;
+  if( type == MIDIMessageType ) {
+    return MIDISchedulerSchedule( scheduler, object );
+  }
+  return MIDIPortSend( scheduler->port, type, object );
+}
+
+/**
+ * @}
+ * @endcond
+ */
+
+/* MARK: -
+ * MARK: Creation and destruction *//**
+ * @name Creation and destruction
+ * Creating, destroying and reference counting of MIDIScheduler objects.
+ * @{
+ */
+
+/**
+ * @brief Create a MIDIScheduler instance.
+ * Allocate space and initialize a MIDIScheduler instance.
+ * @public @memberof MIDIScheduler
+ * @param driver The driver to send due messages to. May be @c NULL, in that
+ *               case the scheduler uses the global clock and due messages
+ *               are only sent to the ports that are connected to the
+ *               scheduler's port.
+ * @return a pointer to the created scheduler structure on success.
+ * @return a @c NULL pointer if the scheduler could not created.
+ */
+struct MIDIScheduler * MIDISchedulerCreate( struct MIDIDriver * driver ) {
+  struct MIDIScheduler * scheduler;
+  struct MIDIClock * clock;
+  if( driver != NULL ) {
+    scheduler = MIDISchedulerCreateWithSource( driver->clock, NULL );
+    if( scheduler == NULL ) return NULL;
+    scheduler->driver = driver;
+    MIDIDriverRetain( driver );
+    MIDIPortConnect( scheduler->port, driver->port );
+  } else {
+    clock = MIDIClockProvide( MIDI_SAMPLING_RATE_DEFAULT );
+    MIDIPrecondReturn( clock != NULL, ENOMEM, NULL );
+    scheduler = MIDISchedulerCreateWithSource( clock, NULL );
+    MIDIClockRelease( clock );
+  }
+  return scheduler;
+}
+
+/**
+ * @brief Create a MIDIScheduler instance that uses a given clock and source.
+ * Allocate space and initialize a MIDIScheduler instance. Due messages are
+ * only sent to the ports that are connected to the scheduler's port.
+ * This allows a driver to delay the messages it receives without creating
+ * a reference cycle: with the driver's runloop source the scheduler's timers
+ * fire whenever the driver is part of a runloop.
+ * @public @memberof MIDIScheduler
+ * @param clock  The clock to compare message timestamps against.
+ * @param source The runloop source to add timers to. May be @c NULL, in that
+ *               case the scheduler creates its own source.
+ * @return a pointer to the created scheduler structure on success.
+ * @return a @c NULL pointer if the scheduler could not created.
+ */
+struct MIDIScheduler * MIDISchedulerCreateWithSource( struct MIDIClock * clock, struct MIDIRunloopSource * source ) {
+  struct MIDIScheduler * scheduler;
+  MIDIPrecondReturn( clock != NULL, EINVAL, NULL );
+  scheduler = malloc( sizeof( struct MIDIScheduler ) );
+  MIDIPrecondReturn( scheduler != NULL, ENOMEM, NULL );
+
+  scheduler->refs   = 1;
+  scheduler->driver = NULL;
+  scheduler->clock  = clock;
+  scheduler->port   = MIDIPortCreate( "Scheduler", MIDI_PORT_IN | MIDI_PORT_OUT, scheduler, &_port_receive );
+  scheduler->shared_rls = ( source != NULL );
+  if( source != NULL ) {
+    scheduler->rls = source;
+    MIDIRunloopSourceRetain( source );
+  } else {
+    scheduler->rls = MIDIRunloopSourceCreate( NULL );
+  }
+  if( scheduler->port == NULL || scheduler->rls == NULL ) {
+    if( scheduler->port != NULL ) MIDIPortRelease( scheduler->port );
+    if( scheduler->rls  != NULL ) MIDIRunloopSourceRelease( scheduler->rls );
+    free( scheduler );
+    return NULL;
+  }
+  MIDIClockRetain( clock );
+
+  scheduler->timer     = 0;
+  scheduler->timer_timestamp = 0;
+  scheduler->serial    = 0;
+  scheduler->length    = 0;
+  scheduler->capacity  = 0;
+  scheduler->heap      = NULL;
+  memset( &(scheduler->stats), 0, sizeof(scheduler->stats) );
+  MIDIClockGetSamplingRate( scheduler->clock, &(scheduler->stats.rate) );
+  return scheduler;
+}
+
+/**
+ * @brief Destroy a MIDIScheduler instance.
+ * Free all resources occupied by the scheduler and release all pending
+ * messages without sending them.
+ * @public @memberof MIDIScheduler
+ * @param scheduler The scheduler.
+ */
+void MIDISchedulerDestroy( struct MIDIScheduler * scheduler ) {
+  MIDIPrecondReturn( scheduler != NULL, EFAULT, (void)0 );
+  MIDISchedulerClear( scheduler );
+  free( scheduler->heap );
+  if( ! scheduler->shared_rls ) {
+    MIDIRunloopSourceInvalidate( scheduler->rls );
+  }
+  MIDIRunloopSourceRelease( scheduler->rls );
+  MIDIPortInvalidate( scheduler->port );
+  MIDIPortRelease( scheduler->port );
+  if( scheduler->driver != NULL ) {
+    MIDIDriverRelease( scheduler->driver );
+  }
+  MIDIClockRelease( scheduler->clock );
+  free( scheduler );
+}
+
+/**
+ * @brief Retain a MIDIScheduler instance.
+ * Increment the reference counter of a scheduler so that it won't be destroyed.
+ * @public @memberof MIDIScheduler
+ * @param scheduler The scheduler.
+ */
+void MIDISchedulerRetain( struct MIDIScheduler * scheduler ) {
+  MIDIPrecondReturn( scheduler != NULL, EFAULT, (void)0 );
+  MIDIRefRetain( scheduler->refs );
+}
+
+/**
+ * @brief Release a MIDIScheduler instance.
+ * Decrement the reference counter of a scheduler. If the reference count
+ * reached zero, destroy the scheduler.
+ * @public @memberof MIDIScheduler
+ * @param scheduler The scheduler.
+ */
+void MIDISchedulerRelease( struct MIDIScheduler * scheduler ) {
+  MIDIPrecondReturn( scheduler != NULL, EFAULT, (void)0 );
+  if( ! MIDIRefRelease( scheduler->refs ) ) {
+    MIDISchedulerDestroy( scheduler );
+  }
+}
+
+/** @} */
+
+/* MARK: Properties *//**
+ * @name Properties
+ * @{
+ */
+
+/**
+ * @brief Get the scheduler port.
+ * Messages received on the port are scheduled, due messages are sent
+ * through it.
+ * @public @memberof MIDIScheduler
+ * @param scheduler The scheduler.
+ * @param port      The port.
+ * @retval 0 on success.
+ */
+int MIDISchedulerGetPort( struct MIDIScheduler * scheduler, struct MIDIPort ** port ) {
+  MIDIPrecond( scheduler != NULL, EFAULT );
+  MIDIPrecond( port != NULL, EINVAL );
+  *port = scheduler->port;
+  return 0;
+}
+
+/**
+ * @brief Get the scheduler clock.
+ * Message timestamps are compared against this clock.
+ * @public @memberof MIDIScheduler
+ * @param scheduler The scheduler.
+ * @param clock     The clock.
+ * @retval 0 on success.
+ */
+int MIDISchedulerGetClock( struct MIDIScheduler * scheduler, struct MIDIClock ** clock ) {
+  MIDIPrecond( scheduler != NULL, EFAULT );
+  MIDIPrecond( clock != NULL, EINVAL );
+  *clock = scheduler->clock;
+  return 0;
+}
+
+/**
+ * @brief Get the number of pending messages.
+ * @public @memberof MIDIScheduler
+ * @param scheduler The scheduler.
+ * @param length    The number of messages.
+ * @retval 0 on success.
+ */
+int MIDISchedulerGetLength( struct MIDIScheduler * scheduler, size_t * length ) {
+  MIDIPrecond( scheduler != NULL, EFAULT );
+  MIDIPrecond( length != NULL, EINVAL );
+  *length = scheduler->length;
+  return 0;
+}
+
+/**
+ * @brief Get the scheduling statistics.
+ * The jitter histogram counts the ticks of the scheduler's clock between
+ * the timestamp of a message and the time it was actually sent. Messages
+ * that were already due when they were scheduled are counted as @c late
+ * and measured from the time they were scheduled.
+ * @public @memberof MIDIScheduler
+ * @param scheduler The scheduler.
+ * @param stats     The stats to copy the counters and the histogram to.
+ * @retval 0 on success.
+ */
+int MIDISchedulerGetStats( struct MIDIScheduler * scheduler, struct MIDISchedulerStats * stats ) {
+  MIDIPrecond( scheduler != NULL, EFAULT );
+  MIDIPrecond( stats != NULL, EINVAL );
+  *stats = scheduler->stats;
+  return 0;
+}
+
+/** @} */
+
+/* MARK: Scheduling *//**
+ * @name Scheduling
+ * @{
+ */
+
+/**
+ * @brief Schedule a message.
+ * Retain the message and send it when the scheduler's clock reaches its
+ * timestamp. Messages that are already due are sent at once, after all
+ * other due messages.
+ * @public @memberof MIDIScheduler
+ * @param scheduler The scheduler.
+ * @param message   The message.
+ * @retval 0 on success.
+ * @retval >0 if the message could not be scheduled.
+ */
+int MIDISchedulerSchedule( struct MIDIScheduler * scheduler, struct MIDIMessage * message ) {
+  MIDITimestamp timestamp, now;
+  int result;
+  MIDIPrecond( scheduler != NULL, EFAULT );
+  MIDIPrecond( message != NULL, EINVAL );
+
+  MIDIMessageGetTimestamp( message, &timestamp );
+  MIDIClockGetNow( scheduler->clock, &now );
+  scheduler->stats.scheduled++;
+  if( timestamp <= now ) {
+    if( timestamp < now ) scheduler->stats.late++;
+    timestamp = now;
+  }
+  result = _heap_push( scheduler, timestamp, message );
+  if( result ) return result;
+  if( scheduler->length > scheduler->stats.queue_depth_max ) {
+    scheduler->stats.queue_depth_max = scheduler->length;
+  }
+  if( timestamp == now ) {
+    return MIDISchedulerPoll( scheduler );
+  }
+  scheduler->stats.queue_depth = scheduler->length;
+  return _scheduler_arm( scheduler, now );
+}
+
+/**
+ * @brief Send all due messages.
+ * This is called by the runloop timer of the scheduler. It can be called
+ * manually if the scheduler is not attached to a runloop.
+ * @public @memberof MIDIScheduler
+ * @param scheduler The scheduler.
+ * @retval 0 on success.
+ * @retval >0 if messages could not be sent.
+ */
+int MIDISchedulerPoll( struct MIDIScheduler * scheduler ) {
+  struct MIDIDriverProfile * profile;
+  struct MIDIMessage * message;
+  MIDITimestamp now, jitter;
+  int result = 0;
+  MIDIPrecond( scheduler != NULL, EFAULT );
+
+  MIDIClockGetNow( scheduler->clock, &now );
+  while( scheduler->length > 0 && scheduler->heap[0].timestamp <= now ) {
+    jitter  = now - scheduler->heap[0].timestamp;
+    message = _heap_pop( scheduler );
+    MIDIDriverLatencyHistogramAdd( &(scheduler->stats.jitter), jitter );
+    profile = ( scheduler->driver != NULL ) ? scheduler->driver->profile : NULL;
+    if( profile != NULL ) {
+      MIDIDriverProfileRecordLatency( profile, MIDI_DRIVER_STAGE_SCHEDULE,
+                                      jitter * profile->stats.rate / scheduler->stats.rate );
+    }
+    scheduler->stats.sent++;
+    result += MIDIPortSend( scheduler->port, MIDIMessageType, message );
+    MIDIMessageRelease( message );
+  }
+  scheduler->stats.queue_depth = scheduler->length;
+  return result + _scheduler_arm( scheduler, now );
+}
+
+/**
+ * @brief Drop all pending messages.
+ * Release all pending messages without sending them.
+ * @public @memberof MIDIScheduler
+ * @param scheduler The scheduler.
+ * @retval 0 on success.
+ */
+int MIDISchedulerClear( struct MIDIScheduler * scheduler ) {
+  MIDIPrecond( scheduler != NULL, EFAULT );
+  while( scheduler->length > 0 ) {
+    MIDIMessageRelease( scheduler->heap[--scheduler->length].message );
+  }
+  scheduler->stats.queue_depth = 0;
+  return _scheduler_arm( scheduler, 0 );
+}
+
+/** @} */
+
+/* MARK: Runloop integration *//**
+ * @name Runloop integration
+ * @{
+ */
+
+int MIDIRunloopAddScheduler( struct MIDIRunloop * runloop, struct MIDIScheduler * scheduler ) {
+  MIDIPrecond( runloop != NULL, EFAULT );
+  MIDIPrecond( scheduler != NULL, EINVAL );
+  return MIDIRunloopAddSource( runloop, scheduler->rls );
+}
+
+int MIDIRunloopRemoveScheduler( struct MIDIRunloop * runloop, struct MIDIScheduler * scheduler ) {
+  MIDIPrecond( runloop != NULL, EFAULT );
+  MIDIPrecond( scheduler != NULL, EINVAL );
+  return MIDIRunloopRemoveSource( runloop, scheduler->rls );
+}
+
+/** @} */
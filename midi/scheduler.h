@@ -0,0 +1,42 @@
+#ifndef MIDIKIT_MIDI_SCHEDULER_H
+#define MIDIKIT_MIDI_SCHEDULER_H
+#include "midi.h"
+#include "driver.h"
+
+struct MIDIPort;
+struct MIDIClock;
+struct MIDIMessage;
+struct MIDIRunloop;
+struct MIDIRunloopSource;
+
+struct MIDIScheduler;
+
+struct MIDISchedulerStats {
+  MIDISamplingRate rate;
+  unsigned long scheduled;
+  unsigned long sent;
+  unsigned long late;
+  size_t queue_depth;
+  size_t queue_depth_max;
+  struct MIDIDriverLatencyHistogram jitter;
+};
+
+struct MIDIScheduler * MIDISchedulerCreate( struct MIDIDriver * driver );
+struct MIDIScheduler * MIDISchedulerCreateWithSource( struct MIDIClock * clock, struct MIDIRunloopSource * source );
+void MIDISchedulerDestroy( struct MIDIScheduler * scheduler );
+void MIDISchedulerRetain( struct MIDIScheduler * scheduler );
+void MIDISchedulerRelease( struct MIDIScheduler * scheduler );
+
+int MIDISchedulerGetPort( struct MIDIScheduler * scheduler, struct MIDIPort ** port );
+int MIDISchedulerGetClock( struct MIDIScheduler * scheduler, struct MIDIClock ** clock );
+int MIDISchedulerGetLength( struct MIDIScheduler * scheduler, size_t * length );
+int MIDISchedulerGetStats( struct MIDIScheduler * scheduler, struct MIDISchedulerStats * stats );
+
+int MIDISchedulerSchedule( struct MIDIScheduler * scheduler, struct MIDIMessage * message );
+int MIDISchedulerPoll( struct MIDIScheduler * scheduler );
+int MIDISchedulerClear( struct MIDIScheduler * scheduler );
+
+int MIDIRunloopAddScheduler( struct MIDIRunloop * runloop, struct MIDIScheduler * scheduler );
+int MIDIRunloopRemoveScheduler( struct MIDIRunloop * runloop, struct MIDIScheduler * scheduler );
+
+#endif
@@ -0,0 +1,839 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "sequence_player.h"
+
+#include "type.h"
+#include "port.h"
+#include "clock.h"
+#include "device.h"
+#include "message.h"
+#include "runloop.h"
+#include "scheduler.h"
+#include "controller.h"
+#include "smf.h"
+
+#define MIDI_SEQUENCE_PLAYER_MIN_CAPACITY 64
+#define MIDI_SEQUENCE_PLAYER_POOL_SIZE    256
+#define MIDI_SEQUENCE_PLAYER_CHANNELS     16
+
+/** @internal */
+struct MIDISequenceTempo;
+
+/**
+ * @ingroup MIDI
+ * @brief Seekable player for standard MIDI files.
+ * The player merges all tracks of a file once when it is created and
+ * converts every event tick to a timestamp of the player's clock using a
+ * precomputed tempo map. Seeking is a binary search over the converted
+ * timestamps. Controller, program and pitch wheel values that were set
+ * before the seek position are chased through one MIDIController per
+ * channel and sent to the device before playback resumes.
+ * While playing, events within the lookahead window are turned into
+ * messages taken from a preallocated pool and handed to a MIDIScheduler
+ * which sends them through the device's output port when they are due.
+ * A loop region repeats the events between two ticks until the loop is
+ * cleared.
+ */
+struct MIDISequencePlayer {
+/**
+ * @privatesection
+ * @cond INTERNALS
+ */
+  int refs;
+  struct MIDISMFReader * reader;
+  struct MIDIDevice * device;
+  struct MIDIClock * clock;
+  struct MIDIPort * port;
+  struct MIDIScheduler * scheduler;
+  struct MIDIRunloopSource * rls;
+  struct MIDIMessagePool * pool;
+  struct MIDIController * controllers[MIDI_SEQUENCE_PLAYER_CHANNELS];
+  MIDISamplingRate rate;
+  unsigned short channels;
+
+  size_t ntempos;
+  struct MIDISequenceTempo * tempos;
+  size_t length;
+  struct MIDISMFEvent * events;
+  MIDITimestamp * times;
+  MIDITimestamp duration;
+
+  MIDIBoolean playing;
+  size_t next;
+  MIDITimestamp origin;
+  MIDITimestamp position;
+  MIDITimestamp lookahead;
+  unsigned long timer;
+
+  MIDITimestamp loop_start;
+  MIDITimestamp loop_end;
+  size_t loop_start_index;
+  size_t loop_end_index;
+  unsigned long laps;
+/** @endcond */
+};
+
+/* MARK: Internals *//**
+ * @name Internals
+ * @cond INTERNALS
+ * Tempo map construction, binary searches and state chasing.
+ * @{
+ */
+
+/**
+ * @brief A segment of constant tempo.
+ * Starting at @c tick, every tick of the sequence lasts @c scale ticks
+ * of the player's clock.
+ */
+struct MIDISequenceTempo {
+  unsigned long tick;
+  MIDITimestamp time;
+  double scale;
+};
+
+/**
+ * @brief Get the clock ticks per sequence tick for a tempo.
+ * @private @memberof MIDISequencePlayer
+ * @param player   The player.
+ * @param division The division of the file.
+ * @param tempo    The tempo in microseconds per quarter note.
+ * @return the number of clock ticks that one sequence tick lasts.
+ */
+static double _tempo_scale( struct MIDISequencePlayer * player, unsigned short division, unsigned long tempo ) {
+  int fps;
+  if( division & 0x8000 ) {
+    /* SMPTE time code, frames per second and ticks per frame */
+    fps = -(signed char) ( division >> 8 );
+    return (double) player->rate / ( fps * ( division & 0xff ) );
+  }
+  return (double) player->rate * tempo / ( 1000000.0 * division );
+}
+
+static int _tempo_push( struct MIDISequencePlayer * player, size_t * capacity, unsigned long tick, double scale ) {
+  struct MIDISequenceTempo * tempos, * last;
+  if( player->ntempos > 0 ) {
+    last = &(player->tempos[player->ntempos-1]);
+    if( last->tick == tick ) {
+      last->scale = scale;
+      return 0;
+    }
+  }
+  if( player->ntempos == *capacity ) {
+    *capacity = ( *capacity == 0 ) ? MIDI_SEQUENCE_PLAYER_MIN_CAPACITY : *capacity * 2;
+    tempos = realloc( player->tempos, sizeof( struct MIDISequenceTempo ) * *capacity );
+    MIDIPrecond( tempos != NULL, ENOMEM );
+    player->tempos = tempos;
+  }
+  player->tempos[player->ntempos].tick  = tick;
+  player->tempos[player->ntempos].time  = 0;
+  player->tempos[player->ntempos].scale = scale;
+  player->ntempos++;
+  return 0;
+}
+
+static int _event_push( struct MIDISequencePlayer * player, size_t * capacity, struct MIDISMFEvent * event ) {
+  struct MIDISMFEvent * events;
+  if( player->length == *capacity ) {
+    *capacity = ( *capacity == 0 ) ? MIDI_SEQUENCE_PLAYER_MIN_CAPACITY : *capacity * 2;
+    events = realloc( player->events, sizeof( struct MIDISMFEvent ) * *capacity );
+    MIDIPrecond( events != NULL, ENOMEM );
+    player->events = events;
+  }
+  player->events[player->length++] = *event;
+  return 0;
+}
+
+/**
+ * @brief Find the tempo segment that contains a tick.
+ * @private @memberof MIDISequencePlayer
+ * @param player The player.
+ * @param tick   The tick.
+ * @return the last segment that starts at or before the tick.
+ */
+static struct MIDISequenceTempo * _tempo_for_tick( struct MIDISequencePlayer * player, unsigned long tick ) {
+  size_t lo = 0, hi = player->ntempos, mid;
+  while( hi - lo > 1 ) {
+    mid = lo + ( hi - lo ) / 2;
+    if( player->tempos[mid].tick <= tick ) lo = mid;
+    else hi = mid;
+  }
+  return &(player->tempos[lo]);
+}
+
+static struct MIDISequenceTempo * _tempo_for_time( struct MIDISequencePlayer * player, MIDITimestamp time ) {
+  size_t lo = 0, hi = player->ntempos, mid;
+  while( hi - lo > 1 ) {
+    mid = lo + ( hi - lo ) / 2;
+    if( player->tempos[mid].time <= time ) lo = mid;
+    else hi = mid;
+  }
+  return &(player->tempos[lo]);
+}
+
+static MIDITimestamp _tick_to_time( struct MIDISequencePlayer * player, unsigned long tick ) {
+  struct MIDISequenceTempo * tempo = _tempo_for_tick( player, tick );
+  return tempo->time + (MIDITimestamp) ( ( tick - tempo->tick ) * tempo->scale + 0.5 );
+}
+
+/**
+ * @brief Find the first event at or after a time.
+ * @private @memberof MIDISequencePlayer
+ * @param player The player.
+ * @param time   The time relative to the start of the sequence.
+ * @return the index of the event or the number of events.
+ */
+static size_t _event_for_time( struct MIDISequencePlayer * player, MIDITimestamp time ) {
+  size_t lo = 0, hi = player->length, mid;
+  while( lo < hi ) {
+    mid = lo + ( hi - lo ) / 2;
+    if( player->times[mid] < time ) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+/**
+ * @brief Merge all tracks and build the tempo map.
+ * Meta events are not kept, tempo changes become segments of the tempo
+ * map and the end of the last track determines the duration.
+ * @private @memberof MIDISequencePlayer
+ * @param player The player.
+ * @retval 0 on success.
+ * @retval >0 if the sequence could not be loaded.
+ */
+static int _player_load( struct MIDISequencePlayer * player ) {
+  struct MIDISMFIterator * iterator;
+  struct MIDISMFEvent event;
+  struct MIDISequenceTempo * tempo;
+  size_t i, event_capacity = 0, tempo_capacity = 0;
+  unsigned long tempo_value, last_tick = 0;
+  unsigned short division;
+  int result;
+
+  result  = MIDISMFReaderGetDivision( player->reader, &division );
+  MIDIPrecond( result == 0 && division != 0, EINVAL );
+  iterator = MIDISMFIteratorCreate( player->reader );
+  MIDIPrecond( iterator != NULL, ENOMEM );
+
+  /* 120 beats per minute until the first tempo change */
+  result = _tempo_push( player, &tempo_capacity, 0, _tempo_scale( player, division, 500000 ) );
+  while( result == 0 && MIDISMFIteratorNext( iterator, &event ) == 0 ) {
+    if( event.tick > last_tick ) last_tick = event.tick;
+    if( event.status != MIDI_SMF_STATUS_META ) {
+      if( event.status < MIDI_STATUS_SYSTEM_EXCLUSIVE ) {
+        player->channels |= 1 << ( event.bytes[0] & 0x0f );
+      }
+      result = _event_push( player, &event_capacity, &event );
+    } else if( event.type == MIDI_SMF_META_SET_TEMPO && event.size == 3 && !( division & 0x8000 ) ) {
+      tempo_value = ( event.data[0] << 16 ) | ( event.data[1] << 8 ) | event.data[2];
+      if( tempo_value > 0 ) {
+        result = _tempo_push( player, &tempo_capacity, event.tick, _tempo_scale( player, division, tempo_value ) );
+      }
+    }
+  }
+  MIDISMFIteratorRelease( iterator );
+  if( result ) return result;
+
+  for( i=1; i<player->ntempos; i++ ) {
+    tempo = &(player->tempos[i-1]);
+    player->tempos[i].time = tempo->time
+      + (MIDITimestamp) ( ( player->tempos[i].tick - tempo->tick ) * tempo->scale + 0.5 );
+  }
+  if( player->length > 0 ) {
+    player->times = malloc( sizeof( MIDITimestamp ) * player->length );
+    MIDIPrecond( player->times != NULL, ENOMEM );
+  }
+  for( i=0; i<player->length; i++ ) {
+    player->times[i] = _tick_to_time( player, player->events[i].tick );
+  }
+  player->duration = _tick_to_time( player, last_tick );
+  return 0;
+}
+
+static MIDIBoolean _chased_control( MIDIControl control ) {
+  switch( control ) {
+    /* parameter access only makes sense in the order it was recorded */
+    case MIDI_CONTROL_DATA_ENTRY:
+    case MIDI_CONTROL_DATA_ENTRY+32:
+    case MIDI_CONTROL_DATA_INCREMENT:
+    case MIDI_CONTROL_DATA_DECREMENT:
+    case MIDI_CONTROL_NON_REGISTERED_PARAMETER_NUMBER_MSB:
+    case MIDI_CONTROL_NON_REGISTERED_PARAMETER_NUMBER_LSB:
+    case MIDI_CONTROL_REGISTERED_PARAMETER_NUMBER_MSB:
+    case MIDI_CONTROL_REGISTERED_PARAMETER_NUMBER_LSB:
+      return MIDI_OFF;
+    default:
+      return ( control >= 0 && control < MIDI_CONTROL_ALL_SOUND_OFF ) ? MIDI_ON : MIDI_OFF;
+  }
+}
+
+/**
+ * @brief Send the channel state at an event index to the device.
+ * Feed all control changes before the index into the channel
+ * controllers and remember the last program and pitch wheel value of
+ * every channel. Then send every control that was touched, followed by
+ * the program and pitch wheel changes.
+ * @private @memberof MIDISequencePlayer
+ * @param player The player.
+ * @param index  The index of the next event that will be played.
+ * @retval 0 on success.
+ * @retval >0 if the state could not be sent.
+ */
+static int _player_chase( struct MIDISequencePlayer * player, size_t index ) {
+  unsigned char touched[MIDI_SEQUENCE_PLAYER_CHANNELS][128];
+  short programs[MIDI_SEQUENCE_PLAYER_CHANNELS];
+  int pitch[MIDI_SEQUENCE_PLAYER_CHANNELS];
+  struct MIDISMFEvent * event;
+  MIDIChannel channel;
+  MIDIControl control;
+  MIDIValue value;
+  size_t i;
+  int c, result = 0;
+
+  memset( &(touched[0][0]), 0, sizeof(touched) );
+  for( c=0; c<MIDI_SEQUENCE_PLAYER_CHANNELS; c++ ) {
+    programs[c] = -1;
+    pitch[c]    = -1;
+  }
+  for( i=0; i<index; i++ ) {
+    event = &(player->events[i]);
+    if( event->status >= MIDI_STATUS_SYSTEM_EXCLUSIVE ) continue;
+    channel = event->bytes[0] & 0x0f;
+    switch( event->bytes[0] >> 4 ) {
+      case MIDI_STATUS_CONTROL_CHANGE:
+        control = event->bytes[1];
+        MIDIControllerReceiveControlChange( player->controllers[(int)channel], NULL, channel, control, event->bytes[2] );
+        if( _chased_control( control ) ) touched[(int)channel][(int)control] = 1;
+        break;
+      case MIDI_STATUS_PROGRAM_CHANGE:
+        programs[(int)channel] = event->bytes[1];
+        break;
+      case MIDI_STATUS_PITCH_WHEEL_CHANGE:
+        pitch[(int)channel] = MIDI_LONG_VALUE( event->bytes[2], event->bytes[1] );
+        break;
+    }
+  }
+  for( c=0; c<MIDI_SEQUENCE_PLAYER_CHANNELS; c++ ) {
+    for( i=0; i<128; i++ ) {
+      if( ! touched[c][i] ) continue;
+      MIDIControllerGetControl( player->controllers[c], i, sizeof(MIDIValue), &value );
+      result += MIDIDeviceSendControlChange( player->device, c, i, value );
+    }
+    if( programs[c] >= 0 ) {
+      result += MIDIDeviceSendProgramChange( player->device, c, programs[c] );
+    }
+    if( pitch[c] >= 0 ) {
+      result += MIDIDeviceSendPitchWheelChange( player->device, c, pitch[c] );
+    }
+  }
+  return result;
+}
+
+/**
+ * @brief Silence every channel the sequence uses.
+ * @private @memberof MIDISequencePlayer
+ * @param player The player.
+ * @retval 0 on success.
+ */
+static int _player_silence( struct MIDISequencePlayer * player ) {
+  int c, result = 0;
+  for( c=0; c<MIDI_SEQUENCE_PLAYER_CHANNELS; c++ ) {
+    if( player->channels & ( 1 << c ) ) {
+      result += MIDIDeviceSendControlChange( player->device, c, MIDI_CONTROL_ALL_NOTES_OFF, 0 );
+    }
+  }
+  return result;
+}
+
+/**
+ * @brief Get the position for a time since the player's origin.
+ * Times past the end of an active loop region are wrapped into it.
+ * @private @memberof MIDISequencePlayer
+ * @param player The player.
+ * @param time   The time.
+ * @return the position within the sequence.
+ */
+static MIDITimestamp _player_wrap( struct MIDISequencePlayer * player, MIDITimestamp time ) {
+  if( player->loop_end > player->loop_start && time >= player->loop_end ) {
+    time = player->loop_start + ( time - player->loop_start ) % ( player->loop_end - player->loop_start );
+  }
+  return time;
+}
+
+static int _player_timer( void * info, struct timespec * now ) {
+  struct MIDISequencePlayer * player = info;
+  player->timer = 0;
+  return MIDISequencePlayerPoll( player );
+}
+
+/**
+ * @brief Arm the runloop timer that refills the scheduler.
+ * The timer fires after half of the lookahead window has passed.
+ * @private @memberof MIDISequencePlayer
+ * @param player The player.
+ * @retval 0 on success.
+ */
+static int _player_arm( struct MIDISequencePlayer * player ) {
+  struct timespec delay;
+  MIDITimestamp ticks = player->lookahead / 2;
+  if( player->timer != 0 ) return 0;
+  delay.tv_sec  = ticks / player->rate;
+  delay.tv_nsec = ( ( ticks % player->rate ) * 1000000000LL ) / player->rate;
+  return MIDIRunloopSourceAddTimer( player->rls, &delay, &_player_timer, player, &(player->timer) );
+}
+
+static void _player_disarm( struct MIDISequencePlayer * player ) {
+  if( player->timer != 0 ) {
+    MIDIRunloopSourceCancelTimer( player->rls, player->timer );
+    player->timer = 0;
+  }
+}
+
+/**
+ * @brief Port callback.
+ * Pass due messages from the scheduler on to the device.
+ * @private @memberof MIDISequencePlayer
+ */
+static int _port_receive( void * target, void * source, struct MIDITypeSpec * type, void * object ) {
+  struct MIDISequencePlayer * player = target;
+  if( type == MIDIMessageType ) {
+    return MIDIDeviceSend( player->device, object );
+  }
+  return 0;
+}
+
+/** @} */
+
+/* MARK: Creation and destruction *//**
+ * @name Creation and destruction
+ * Creating, destroying and reference counting of MIDISequencePlayer objects.
+ * @{
+ */
+
+/**
+ * @brief Create a MIDISequencePlayer instance.
+ * Allocate space and initialize a MIDISequencePlayer instance. All events
+ * of the file are merged and converted to timestamps at once, playback does
+ * not allocate per event.
+ * @public @memberof MIDISequencePlayer
+ * @param reader The file to play.
+ * @param device The device whose output port is used.
+ * @param clock  The clock to schedule on. May be @c NULL to use the
+ *               default clock.
+ * @return a pointer to the created player structure on success.
+ * @return a @c NULL pointer if the player could not created.
+ */
+struct MIDISequencePlayer * MIDISequencePlayerCreate( struct MIDISMFReader * reader, struct MIDIDevice * device,
+                                                      struct MIDIClock * clock ) {
+  struct MIDISequencePlayer * player;
+  struct MIDIPort * port;
+  int c;
+  MIDIPrecondReturn( reader != NULL, EFAULT, NULL );
+  MIDIPrecondReturn( device != NULL, EINVAL, NULL );
+
+  player = malloc( sizeof( struct MIDISequencePlayer ) );
+  MIDIPrecondReturn( player != NULL, ENOMEM, NULL );
+  memset( player, 0, sizeof( struct MIDISequencePlayer ) );
+
+  if( clock == NULL ) {
+    clock = MIDIClockProvide( MIDI_SAMPLING_RATE_DEFAULT );
+  } else {
+    MIDIClockRetain( clock );
+  }
+  player->refs   = 1;
+  player->reader = reader;
+  player->device = device;
+  player->clock  = clock;
+  MIDISMFReaderRetain( reader );
+  MIDIDeviceRetain( device );
+  if( clock == NULL ) goto error;
+  MIDIClockGetSamplingRate( clock, &(player->rate) );
+
+  player->port  = MIDIPortCreate( "Sequence Player", MIDI_PORT_IN, player, &_port_receive );
+  player->rls   = MIDIRunloopSourceCreate( NULL );
+  player->pool  = MIDIMessagePoolCreate( MIDI_SEQUENCE_PLAYER_POOL_SIZE );
+  if( player->port == NULL || player->rls == NULL || player->pool == NULL ) goto error;
+  player->scheduler = MIDISchedulerCreateWithSource( clock, player->rls );
+  if( player->scheduler == NULL ) goto error;
+  MIDISchedulerGetPort( player->scheduler, &port );
+  MIDIPortConnect( port, player->port );
+  for( c=0; c<MIDI_SEQUENCE_PLAYER_CHANNELS; c++ ) {
+    player->controllers[c] = MIDIControllerCreate( NULL );
+    if( player->controllers[c] == NULL ) goto error;
+  }
+
+  player->lookahead = player->rate / 10;
+  if( player->lookahead < 2 ) player->lookahead = 2;
+  if( _player_load( player ) ) goto error;
+  return player;
+
+error:
+  MIDISequencePlayerDestroy( player );
+  return NULL;
+}
+
+/**
+ * @brief Destroy a MIDISequencePlayer instance.
+ * Drop all scheduled messages and free all resources occupied by the player.
+ * @public @memberof MIDISequencePlayer
+ * @param player The player.
+ */
+void MIDISequencePlayerDestroy( struct MIDISequencePlayer * player ) {
+  int c;
+  MIDIPrecondReturn( player != NULL, EFAULT, (void)0 );
+  _player_disarm( player );
+  if( player->scheduler != NULL ) {
+    MIDISchedulerClear( player->scheduler );
+    MIDISchedulerRelease( player->scheduler );
+  }
+  if( player->port != NULL ) {
+    MIDIPortInvalidate( player->port );
+    MIDIPortRelease( player->port );
+  }
+  for( c=0; c<MIDI_SEQUENCE_PLAYER_CHANNELS; c++ ) {
+    if( player->controllers[c] != NULL ) MIDIControllerRelease( player->controllers[c] );
+  }
+  if( player->pool  != NULL ) MIDIMessagePoolRelease( player->pool );
+  if( player->rls   != NULL ) MIDIRunloopSourceRelease( player->rls );
+  if( player->clock != NULL ) MIDIClockRelease( player->clock );
+  MIDIDeviceRelease( player->device );
+  MIDISMFReaderRelease( player->reader );
+  free( player->tempos );
+  free( player->events );
+  free( player->times );
+  free( player );
+}
+
+/**
+ * @brief Retain a MIDISequencePlayer instance.
+ * Increment the reference counter of a player so that it won't be destroyed.
+ * @public @memberof MIDISequencePlayer
+ * @param player The player.
+ */
+void MIDISequencePlayerRetain( struct MIDISequencePlayer * player ) {
+  MIDIPrecondReturn( player != NULL, EFAULT, (void)0 );
+  MIDIRefRetain( player->refs );
+}
+
+/**
+ * @brief Release a MIDISequencePlayer instance.
+ * Decrement the reference counter of a player. If the reference count
+ * reached zero, destroy the player.
+ * @public @memberof MIDISequencePlayer
+ * @param player The player.
+ */
+void MIDISequencePlayerRelease( struct MIDISequencePlayer * player ) {
+  MIDIPrecondReturn( player != NULL, EFAULT, (void)0 );
+  if( ! MIDIRefRelease( player->refs ) ) {
+    MIDISequencePlayerDestroy( player );
+  }
+}
+
+/** @} */
+
+/* MARK: Properties *//**
+ * @name Properties
+ * Tempo map queries and playback parameters.
+ * @{
+ */
+
+/**
+ * @brief Get the scheduler of the player.
+ * @public @memberof MIDISequencePlayer
+ * @param player    The player.
+ * @param scheduler The scheduler.
+ * @retval 0 on success.
+ */
+int MIDISequencePlayerGetScheduler( struct MIDISequencePlayer * player, struct MIDIScheduler ** scheduler ) {
+  MIDIPrecond( player != NULL, EFAULT );
+  MIDIPrecond( scheduler != NULL, EINVAL );
+  *scheduler = player->scheduler;
+  return 0;
+}
+
+/**
+ * @brief Get the duration of the sequence.
+ * The duration is the time of the last event of all tracks, including
+ * the end of track events.
+ * @public @memberof MIDISequencePlayer
+ * @param player   The player.
+ * @param duration The duration in ticks of the player's clock.
+ * @retval 0 on success.
+ */
+int MIDISequencePlayerGetDuration( struct MIDISequencePlayer * player, MIDITimestamp * duration ) {
+  MIDIPrecond( player != NULL, EFAULT );
+  MIDIPrecond( duration != NULL, EINVAL );
+  *duration = player->duration;
+  return 0;
+}
+
+/**
+ * @brief Convert a sequence tick to a time.
+ * @public @memberof MIDISequencePlayer
+ * @param player    The player.
+ * @param tick      The tick of the sequence.
+ * @param timestamp The time since the start of the sequence in ticks
+ *                  of the player's clock.
+ * @retval 0 on success.
+ */
+int MIDISequencePlayerGetTimestampForTick( struct MIDISequencePlayer * player, unsigned long tick,
+                                           MIDITimestamp * timestamp ) {
+  MIDIPrecond( player != NULL, EFAULT );
+  MIDIPrecond( timestamp != NULL, EINVAL );
+  *timestamp = _tick_to_time( player, tick );
+  return 0;
+}
+
+/**
+ * @brief Convert a time to a sequence tick.
+ * @public @memberof MIDISequencePlayer
+ * @param player    The player.
+ * @param timestamp The time since the start of the sequence in ticks
+ *                  of the player's clock.
+ * @param tick      The last tick of the sequence that starts at or
+ *                  before the time.
+ * @retval 0 on success.
+ */
+int MIDISequencePlayerGetTickForTimestamp( struct MIDISequencePlayer * player, MIDITimestamp timestamp,
+                                           unsigned long * tick ) {
+  struct MIDISequenceTempo * tempo;
+  MIDIPrecond( player != NULL, EFAULT );
+  MIDIPrecond( tick != NULL, EINVAL );
+  if( timestamp < 0 ) timestamp = 0;
+  tempo = _tempo_for_time( player, timestamp );
+  *tick = tempo->tick + (unsigned long) ( ( timestamp - tempo->time ) / tempo->scale + 1e-9 );
+  return 0;
+}
+
+/**
+ * @brief Set the lookahead window.
+ * Events are handed to the scheduler when they are due within the
+ * window. Larger windows survive longer runloop stalls, but delay the
+ * effect of seeking and stopping on messages that were already scheduled.
+ * @public @memberof MIDISequencePlayer
+ * @param player    The player.
+ * @param lookahead The window in ticks of the player's clock.
+ * @retval 0 on success.
+ */
+int MIDISequencePlayerSetLookahead( struct MIDISequencePlayer * player, MIDITimestamp lookahead ) {
+  MIDIPrecond( player != NULL, EFAULT );
+  MIDIPrecond( lookahead >= 2, EINVAL );
+  player->lookahead = lookahead;
+  return 0;
+}
+
+/**
+ * @brief Set the loop region.
+ * Events from @c start up to, but not including, @c end are repeated
+ * until the loop is cleared by setting an empty region. The current
+ * position is wrapped into the region if it is past the end.
+ * @public @memberof MIDISequencePlayer
+ * @param player The player.
+ * @param start  The first tick of the region.
+ * @param end    The tick after the region or @c start to clear the loop.
+ * @retval 0 on success.
+ */
+int MIDISequencePlayerSetLoop( struct MIDISequencePlayer * player, unsigned long start, unsigned long end ) {
+  MIDITimestamp position;
+  MIDIPrecond( player != NULL, EFAULT );
+  MIDIPrecond( end >= start, EINVAL );
+  MIDISequencePlayerGetPosition( player, &position );
+  player->loop_start       = _tick_to_time( player, start );
+  player->loop_end         = _tick_to_time( player, end );
+  player->loop_start_index = _event_for_time( player, player->loop_start );
+  player->loop_end_index   = _event_for_time( player, player->loop_end );
+  if( player->loop_end > player->loop_start && position >= player->loop_end ) {
+    return MIDISequencePlayerSeek( player, position );
+  }
+  return 0;
+}
+
+/** @} */
+
+/* MARK: Transport *//**
+ * @name Transport
+ * Starting, stopping and seeking.
+ * @{
+ */
+
+/**
+ * @brief Move the playback position.
+ * Find the next event with a binary search and chase the channel state
+ * up to the new position. If the player is playing, pending messages are
+ * dropped and all notes are turned off first.
+ * @public @memberof MIDISequencePlayer
+ * @param player   The player.
+ * @param position The time since the start of the sequence in ticks of
+ *                 the player's clock.
+ * @retval 0 on success.
+ * @retval >0 if the state could not be chased.
+ */
+int MIDISequencePlayerSeek( struct MIDISequencePlayer * player, MIDITimestamp position ) {
+  MIDITimestamp now;
+  int result = 0;
+  MIDIPrecond( player != NULL, EFAULT );
+  MIDIPrecond( position >= 0, EINVAL );
+
+  position = _player_wrap( player, position );
+  if( player->playing ) {
+    MIDISchedulerClear( player->scheduler );
+    result += _player_silence( player );
+  }
+  player->next     = _event_for_time( player, position );
+  player->position = position;
+  player->laps     = 0;
+  result += _player_chase( player, player->next );
+  if( player->playing ) {
+    MIDIClockGetNow( player->clock, &now );
+    player->origin = now - position;
+    result += MIDISequencePlayerPoll( player );
+  }
+  return result;
+}
+
+/**
+ * @brief Get the playback position.
+ * @public @memberof MIDISequencePlayer
+ * @param player   The player.
+ * @param position The time since the start of the sequence in ticks of
+ *                 the player's clock.
+ * @retval 0 on success.
+ */
+int MIDISequencePlayerGetPosition( struct MIDISequencePlayer * player, MIDITimestamp * position ) {
+  MIDITimestamp now;
+  MIDIPrecond( player != NULL, EFAULT );
+  MIDIPrecond( position != NULL, EINVAL );
+  if( player->playing ) {
+    MIDIClockGetNow( player->clock, &now );
+    *position = _player_wrap( player, ( now > player->origin ) ? now - player->origin : 0 );
+  } else {
+    *position = player->position;
+  }
+  return 0;
+}
+
+/**
+ * @brief Check if the player is playing.
+ * @public @memberof MIDISequencePlayer
+ * @param player  The player.
+ * @param playing @c MIDI_ON if the player is playing, @c MIDI_OFF otherwise.
+ * @retval 0 on success.
+ */
+int MIDISequencePlayerIsPlaying( struct MIDISequencePlayer * player, MIDIBoolean * playing ) {
+  MIDIPrecond( player != NULL, EFAULT );
+  MIDIPrecond( playing != NULL, EINVAL );
+  *playing = player->playing ? MIDI_ON : MIDI_OFF;
+  return 0;
+}
+
+/**
+ * @brief Start playback at the current position.
+ * @public @memberof MIDISequencePlayer
+ * @param player The player.
+ * @retval 0 on success.
+ */
+int MIDISequencePlayerStart( struct MIDISequencePlayer * player ) {
+  MIDITimestamp now;
+  MIDIPrecond( player != NULL, EFAULT );
+  if( player->playing ) return 0;
+  MIDIClockGetNow( player->clock, &now );
+  player->origin  = now - player->position;
+  player->laps    = 0;
+  player->playing = MIDI_ON;
+  return MIDISequencePlayerPoll( player );
+}
+
+/**
+ * @brief Stop playback.
+ * Remember the current position, drop all pending messages and turn
+ * off all notes on the channels used by the sequence.
+ * @public @memberof MIDISequencePlayer
+ * @param player The player.
+ * @retval 0 on success.
+ */
+int MIDISequencePlayerStop( struct MIDISequencePlayer * player ) {
+  MIDITimestamp position;
+  MIDIPrecond( player != NULL, EFAULT );
+  if( ! player->playing ) return 0;
+  MIDISequencePlayerGetPosition( player, &position );
+  _player_disarm( player );
+  MIDISchedulerClear( player->scheduler );
+  player->playing  = MIDI_OFF;
+  player->position = position;
+  /* events within the lookahead window were dropped with the scheduler */
+  player->next     = _event_for_time( player, position );
+  player->laps     = 0;
+  return _player_silence( player );
+}
+
+/**
+ * @brief Schedule the events within the lookahead window.
+ * This is called by the runloop timer of the player. It can be called
+ * manually if the player is not attached to a runloop.
+ * @public @memberof MIDISequencePlayer
+ * @param player The player.
+ * @retval 0 on success.
+ * @retval >0 if a message could not be scheduled.
+ */
+int MIDISequencePlayerPoll( struct MIDISequencePlayer * player ) {
+  struct MIDIMessage * message;
+  MIDITimestamp now, horizon, lap;
+  int result = 0;
+  MIDIPrecond( player != NULL, EFAULT );
+  if( ! player->playing ) return 0;
+
+  MIDIClockGetNow( player->clock, &now );
+  horizon = now + player->lookahead;
+  for(;;) {
+    lap = player->laps * ( player->loop_end - player->loop_start );
+    if( player->loop_end > player->loop_start && player->next >= player->loop_end_index ) {
+      if( player->origin + lap + player->loop_end > horizon ) break;
+      player->laps++;
+      player->next = player->loop_start_index;
+      continue;
+    }
+    if( player->next >= player->length ) break;
+    if( player->origin + lap + player->times[player->next] > horizon ) break;
+
+    message = MIDIMessageCreateFromPool( player->pool, 0 );
+    if( message == NULL ) {
+      result++;
+      break;
+    }
+    if( MIDISMFEventGetMessage( &(player->events[player->next]), message ) == 0 ) {
+      MIDIMessageSetTimestamp( message, player->origin + lap + player->times[player->next] );
+      result += MIDISchedulerSchedule( player->scheduler, message );
+    }
+    MIDIMessageRelease( message );
+    player->next++;
+  }
+
+  if( player->next < player->length || player->loop_end > player->loop_start ) {
+    result += _player_arm( player );
+  } else {
+    _player_disarm( player );
+  }
+  return result;
+}
+
+/** @} */
+
+/* MARK: Runloop integration *//**
+ * @name Runloop integration
+ * @{
+ */
+
+int MIDIRunloopAddSequencePlayer( struct MIDIRunloop * runloop, struct MIDISequencePlayer * player ) {
+  MIDIPrecond( runloop != NULL, EFAULT );
+  MIDIPrecond( player != NULL, EINVAL );
+  return MIDIRunloopAddSource( runloop, player->rls );
+}
+
+int MIDIRunloopRemoveSequencePlayer( struct MIDIRunloop * runloop, struct MIDISequencePlayer * player ) {
+  MIDIPrecond( runloop != NULL, EFAULT );
+  MIDIPrecond( player != NULL, EINVAL );
+  return MIDIRunloopRemoveSource( runloop, player->rls );
+}
+
+/** @} */
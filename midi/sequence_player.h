@@ -0,0 +1,40 @@
+#ifndef MIDIKIT_MIDI_SEQUENCE_PLAYER_H
+#define MIDIKIT_MIDI_SEQUENCE_PLAYER_H
+#include "midi.h"
+
+struct MIDIClock;
+struct MIDIDevice;
+struct MIDIRunloop;
+struct MIDIScheduler;
+struct MIDISMFReader;
+
+struct MIDISequencePlayer;
+
+struct MIDISequencePlayer * MIDISequencePlayerCreate( struct MIDISMFReader * reader, struct MIDIDevice * device,
+                                                      struct MIDIClock * clock );
+void MIDISequencePlayerDestroy( struct MIDISequencePlayer * player );
+void MIDISequencePlayerRetain( struct MIDISequencePlayer * player );
+void MIDISequencePlayerRelease( struct MIDISequencePlayer * player );
+
+int MIDISequencePlayerGetScheduler( struct MIDISequencePlayer * player, struct MIDIScheduler ** scheduler );
+int MIDISequencePlayerGetDuration( struct MIDISequencePlayer * player, MIDITimestamp * duration );
+int MIDISequencePlayerGetTimestampForTick( struct MIDISequencePlayer * player, unsigned long tick,
+                                           MIDITimestamp * timestamp );
+int MIDISequencePlayerGetTickForTimestamp( struct MIDISequencePlayer * player, MIDITimestamp timestamp,
+                                           unsigned long * tick );
+
+int MIDISequencePlayerSetLookahead( struct MIDISequencePlayer * player, MIDITimestamp lookahead );
+int MIDISequencePlayerSetLoop( struct MIDISequencePlayer * player, unsigned long start, unsigned long end );
+
+int MIDISequencePlayerSeek( struct MIDISequencePlayer * player, MIDITimestamp position );
+int MIDISequencePlayerGetPosition( struct MIDISequencePlayer * player, MIDITimestamp * position );
+int MIDISequencePlayerIsPlaying( struct MIDISequencePlayer * player, MIDIBoolean * playing );
+
+int MIDISequencePlayerStart( struct MIDISequencePlayer * player );
+int MIDISequencePlayerStop( struct MIDISequencePlayer * player );
+int MIDISequencePlayerPoll( struct MIDISequencePlayer * player );
+
+int MIDIRunloopAddSequencePlayer( struct MIDIRunloop * runloop, struct MIDISequencePlayer * player );
+int MIDIRunloopRemoveSequencePlayer( struct MIDIRunloop * runloop, struct MIDISequencePlayer * player );
+
+#endif
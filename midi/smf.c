@@ -0,0 +1,1350 @@
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "smf.h"
+#include "type.h"
+#include "port.h"
+#include "clock.h"
+#include "message.h"
+
+/**
+ * @brief Size of a chunk header, the type and the length.
+ */
+#define MIDI_SMF_CHUNK_HEADER_SIZE 8
+
+/**
+ * @brief Size of the header chunk including it's chunk header.
+ */
+#define MIDI_SMF_HEADER_SIZE 14
+
+/**
+ * @brief Initial capacity of a track buffer.
+ * In streaming mode the buffer is written to the file descriptor whenever
+ * it is full, so this is the size of a single write.
+ */
+#define MIDI_SMF_WRITER_BUFFER_SIZE 65536
+
+/**
+ * @brief The tempo that is assumed if a file has no tempo event.
+ */
+#define MIDI_SMF_DEFAULT_TEMPO 500000
+
+/**
+ * @brief Location of a track chunk within the file.
+ */
+struct MIDISMFTrack {
+  size_t offset;
+  size_t size;
+};
+
+/**
+ * @ingroup MIDI
+ * @brief Reader for standard MIDI files.
+ * The file is mapped into memory and only the chunk headers are read when
+ * the reader is created, so opening a file takes the same time regardless
+ * of the number of events. The events of a track are decoded on demand by
+ * a MIDISMFCursor, directly from the mapping and without copying. A
+ * MIDISMFIterator merges the events of all tracks in time order.
+ */
+struct MIDISMFReader {
+/**
+ * @privatesection
+ * @cond INTERNALS
+ */
+  int    refs;
+  int    mapped;
+  size_t size;
+  const unsigned char * data;
+  int    format;
+  unsigned short division;
+  size_t ntracks;
+  struct MIDISMFTrack * tracks;
+/** @endcond */
+};
+
+/**
+ * @ingroup MIDI
+ * @brief Merges the tracks of a standard MIDI file.
+ * The iterator keeps the next event of every track in a binary min-heap
+ * ordered by tick. Events with the same tick are returned in the order of
+ * their tracks, so the tempo track of a type 1 file comes first.
+ */
+struct MIDISMFIterator {
+/**
+ * @privatesection
+ * @cond INTERNALS
+ */
+  int    refs;
+  struct MIDISMFReader * reader;
+  size_t ntracks;
+  size_t length;
+  struct MIDISMFCursor * cursors;
+  struct MIDISMFEvent  * events;
+  size_t * heap;
+/** @endcond */
+};
+
+/**
+ * @brief A track that is being written.
+ */
+struct MIDISMFTrackBuffer {
+  unsigned char * data;
+  size_t size;
+  size_t capacity;
+  size_t flushed;
+  unsigned long tick;
+  MIDIRunningStatus status;
+  int ended;
+};
+
+/**
+ * @ingroup MIDI
+ * @brief Writer for standard MIDI files.
+ * Events are appended to a growable buffer per track, channel messages
+ * use running status. Every buffer starts with it's chunk header, the
+ * chunk lengths and the number of tracks are filled in when the writer is
+ * finalized, so every track is written with a single call.
+ *
+ * In streaming mode a type 0 file is written to a file descriptor while
+ * it is recorded. The track buffer is written out whenever it is full, so
+ * the memory used stays the same no matter how long the recording gets.
+ * The chunk length is patched when the writer is finalized, if the file
+ * descriptor is seekable.
+ *
+ * Messages that are sent to the writer's port are appended to the record
+ * track, their timestamps are converted to ticks at the default tempo of
+ * 120 beats per minute.
+ */
+struct MIDISMFWriter {
+/**
+ * @privatesection
+ * @cond INTERNALS
+ */
+  int    refs;
+  int    format;
+  unsigned short division;
+  int    finalized;
+  int    fd;
+  off_t  fd_offset;
+  unsigned char header[MIDI_SMF_HEADER_SIZE];
+  size_t ntracks;
+  size_t tracks_size;
+  struct MIDISMFTrackBuffer * tracks;
+  struct MIDIPort  * port;
+  struct MIDIClock * clock;
+  size_t record_track;
+  int    recording;
+  MIDITimestamp record_start;
+/** @endcond */
+};
+
+/* MARK: Internals *//**
+ * @name Internals
+ * @cond INTERNALS
+ * @{
+ */
+
+static unsigned long _read_uint32( const unsigned char * p ) {
+  return ( (unsigned long) p[0] << 24 ) | ( (unsigned long) p[1] << 16 ) | ( p[2] << 8 ) | p[3];
+}
+
+static unsigned short _read_uint16( const unsigned char * p ) {
+  return ( p[0] << 8 ) | p[1];
+}
+
+/**
+ * @brief Read the header chunk and index the track chunks.
+ * Unknown chunks are skipped, a truncated last chunk is cut at the end
+ * of the file.
+ * @private @memberof MIDISMFReader
+ * @param reader The reader.
+ * @retval 0  on success.
+ * @retval >0 if the file is not a standard MIDI file.
+ */
+static int _index( struct MIDISMFReader * reader ) {
+  const unsigned char * data = reader->data;
+  size_t offset, length, expected, n = 0;
+
+  if( reader->size < MIDI_SMF_CHUNK_HEADER_SIZE + 6 || memcmp( data, "MThd", 4 ) != 0 ) return 1;
+  length = _read_uint32( data + 4 );
+  if( length < 6 || length > reader->size - MIDI_SMF_CHUNK_HEADER_SIZE ) return 1;
+  reader->format   = _read_uint16( data + 8 );
+  expected         = _read_uint16( data + 10 );
+  reader->division = _read_uint16( data + 12 );
+  if( reader->format > MIDI_SMF_FORMAT_MULTIPLE_SONGS ) return 1;
+
+  if( expected > 0 ) {
+    reader->tracks = malloc( sizeof( struct MIDISMFTrack ) * expected );
+    if( reader->tracks == NULL ) return 1;
+  }
+  offset = MIDI_SMF_CHUNK_HEADER_SIZE + length;
+  while( n < expected && offset + MIDI_SMF_CHUNK_HEADER_SIZE <= reader->size ) {
+    length  = _read_uint32( data + offset + 4 );
+    if( length > reader->size - offset - MIDI_SMF_CHUNK_HEADER_SIZE ) {
+      length = reader->size - offset - MIDI_SMF_CHUNK_HEADER_SIZE;
+    }
+    if( memcmp( data + offset, "MTrk", 4 ) == 0 ) {
+      reader->tracks[n].offset = offset + MIDI_SMF_CHUNK_HEADER_SIZE;
+      reader->tracks[n].size   = length;
+      n++;
+    }
+    offset += MIDI_SMF_CHUNK_HEADER_SIZE + length;
+  }
+  if( n < expected ) {
+    MIDILog( DEBUG, "standard MIDI file announces %lu tracks but contains %lu\n",
+             (unsigned long) expected, (unsigned long) n );
+  }
+  reader->ntracks = n;
+  return 0;
+}
+
+static int _heap_less( struct MIDISMFIterator * iterator, size_t a, size_t b ) {
+  struct MIDISMFEvent * ea = &(iterator->events[iterator->heap[a]]);
+  struct MIDISMFEvent * eb = &(iterator->events[iterator->heap[b]]);
+  if( ea->tick != eb->tick ) return ea->tick < eb->tick;
+  return ea->track < eb->track;
+}
+
+static void _heap_swap( struct MIDISMFIterator * iterator, size_t a, size_t b ) {
+  size_t track = iterator->heap[a];
+  iterator->heap[a] = iterator->heap[b];
+  iterator->heap[b] = track;
+}
+
+static void _heap_up( struct MIDISMFIterator * iterator, size_t i ) {
+  while( i > 0 && _heap_less( iterator, i, (i-1)/2 ) ) {
+    _heap_swap( iterator, i, (i-1)/2 );
+    i = (i-1)/2;
+  }
+}
+
+static void _heap_down( struct MIDISMFIterator * iterator, size_t i ) {
+  size_t l, r, m;
+  for(;;) {
+    l = 2*i+1;
+    r = 2*i+2;
+    m = i;
+    if( l < iterator->length && _heap_less( iterator, l, m ) ) m = l;
+    if( r < iterator->length && _heap_less( iterator, r, m ) ) m = r;
+    if( m == i ) break;
+    _heap_swap( iterator, i, m );
+    i = m;
+  }
+}
+
+static void _write_uint32( unsigned char * p, unsigned long v ) {
+  p[0] = ( v >> 24 ) & 0xff;
+  p[1] = ( v >> 16 ) & 0xff;
+  p[2] = ( v >> 8 ) & 0xff;
+  p[3] = v & 0xff;
+}
+
+static void _write_uint16( unsigned char * p, unsigned short v ) {
+  p[0] = ( v >> 8 ) & 0xff;
+  p[1] = v & 0xff;
+}
+
+/**
+ * @brief Write the buffered part of the streamed track.
+ * @private @memberof MIDISMFWriter
+ * @param writer The writer.
+ * @param track  The track buffer.
+ * @retval 0  on success.
+ * @retval >0 if the buffer could not be written.
+ */
+static int _flush( struct MIDISMFWriter * writer, struct MIDISMFTrackBuffer * track ) {
+  size_t offset = 0;
+  ssize_t bytes;
+  while( offset < track->size ) {
+    bytes = write( writer->fd, track->data + offset, track->size - offset );
+    if( bytes < 0 ) {
+      if( errno == EINTR ) continue;
+      MIDIError( errno, "Could not write standard MIDI file." );
+      return 1;
+    }
+    offset += bytes;
+  }
+  track->flushed += track->size;
+  track->size = 0;
+  return 0;
+}
+
+/**
+ * @brief Make room for more bytes in a track buffer.
+ * In streaming mode the buffer is flushed first, it only grows if a
+ * single event does not fit.
+ * @private @memberof MIDISMFWriter
+ * @param writer The writer.
+ * @param track  The track buffer.
+ * @param n      The number of bytes to make room for.
+ * @retval 0  on success.
+ * @retval >0 if the buffer could not be flushed or grown.
+ */
+static int _reserve( struct MIDISMFWriter * writer, struct MIDISMFTrackBuffer * track, size_t n ) {
+  unsigned char * data;
+  size_t capacity;
+  if( track->size + n <= track->capacity ) return 0;
+  if( writer->fd >= 0 && track->size > 0 ) {
+    if( _flush( writer, track ) ) return 1;
+    if( n <= track->capacity ) return 0;
+  }
+  capacity = ( track->capacity > 0 ) ? track->capacity : MIDI_SMF_WRITER_BUFFER_SIZE;
+  while( capacity < track->size + n ) capacity *= 2;
+  data = realloc( track->data, capacity );
+  if( data == NULL ) {
+    MIDIError( ENOMEM, "Could not grow track buffer." );
+    return 1;
+  }
+  track->data     = data;
+  track->capacity = capacity;
+  return 0;
+}
+
+/**
+ * @brief Append the delta time of an event.
+ * Events must be appended in time order, an event that is earlier than
+ * the last event of the track gets a delta time of zero.
+ * @private @memberof MIDISMFWriter
+ * @param track The track buffer, room for four bytes must be reserved.
+ * @param tick  The absolute tick of the event.
+ */
+static void _append_delta( struct MIDISMFTrackBuffer * track, unsigned long tick ) {
+  MIDIVarLen delta = 0;
+  size_t written = 0;
+  if( tick > track->tick ) {
+    delta = tick - track->tick;
+    track->tick = tick;
+  }
+  MIDIUtilWriteVarLen( &delta, 4, track->data + track->size, &written );
+  track->size += written;
+}
+
+/**
+ * @brief Append a system exclusive, escaped or meta event.
+ * @private @memberof MIDISMFWriter
+ * @param writer The writer.
+ * @param track  The track buffer.
+ * @param tick   The absolute tick of the event.
+ * @param status The status byte, @c 0xf0, @c 0xf7 or @c 0xff.
+ * @param type   The type of a meta event.
+ * @param size   The size of the payload.
+ * @param data   The payload.
+ * @retval 0  on success.
+ * @retval >0 if the event could not be appended.
+ */
+static int _append_blob( struct MIDISMFWriter * writer, struct MIDISMFTrackBuffer * track, unsigned long tick,
+                         unsigned char status, unsigned char type, size_t size, const unsigned char * data ) {
+  MIDIVarLen length = size;
+  size_t written = 0;
+  if( _reserve( writer, track, 4 + 2 + 4 + size ) ) return 1;
+  _append_delta( track, tick );
+  track->data[track->size++] = status;
+  if( status == MIDI_SMF_STATUS_META ) {
+    track->data[track->size++] = type;
+  }
+  MIDIUtilWriteVarLen( &length, 4, track->data + track->size, &written );
+  track->size += written;
+  if( size > 0 ) {
+    memcpy( track->data + track->size, data, size );
+    track->size += size;
+  }
+  track->status = 0;
+  return 0;
+}
+
+/**
+ * @brief Append a channel message.
+ * The status byte is left out if it is equal to the running status.
+ * @private @memberof MIDISMFWriter
+ * @param writer The writer.
+ * @param track  The track buffer.
+ * @param tick   The absolute tick of the message.
+ * @param bytes  The status and data bytes.
+ * @retval 0  on success.
+ * @retval >0 if the message could not be appended.
+ */
+static int _append_channel( struct MIDISMFWriter * writer, struct MIDISMFTrackBuffer * track, unsigned long tick,
+                            unsigned char * bytes ) {
+  size_t n = ( ( bytes[0] >> 4 ) == MIDI_STATUS_PROGRAM_CHANGE || ( bytes[0] >> 4 ) == MIDI_STATUS_CHANNEL_PRESSURE ) ? 1 : 2;
+  if( _reserve( writer, track, 4 + 3 ) ) return 1;
+  _append_delta( track, tick );
+  if( bytes[0] != track->status ) {
+    track->data[track->size++] = bytes[0];
+    track->status = bytes[0];
+  }
+  track->data[track->size++] = bytes[1] & 0x7f;
+  if( n == 2 ) {
+    track->data[track->size++] = bytes[2] & 0x7f;
+  }
+  return 0;
+}
+
+/**
+ * @brief Get a track buffer that accepts events.
+ * @private @memberof MIDISMFWriter
+ * @param writer The writer.
+ * @param track  The index of the track.
+ * @return a pointer to the track buffer.
+ * @return a @c NULL pointer if there is no such track or the track has ended.
+ */
+static struct MIDISMFTrackBuffer * _track( struct MIDISMFWriter * writer, size_t track ) {
+  if( writer->finalized || track >= writer->ntracks ) return NULL;
+  if( writer->tracks[track].ended ) return NULL;
+  return &(writer->tracks[track]);
+}
+
+/**
+ * @brief Append messages that are sent to the writer's port.
+ * @private @memberof MIDISMFWriter
+ */
+static int _port_receive( void * target, void * source, struct MIDITypeSpec * type, void * object ) {
+  struct MIDISMFWriter * writer = target;
+  MIDITimestamp timestamp;
+  double seconds, ticks;
+  int fps;
+  if( type != MIDIMessageType ) return 0;
+
+  MIDIMessageGetTimestamp( object, &timestamp );
+  if( ! writer->recording ) {
+    writer->recording    = 1;
+    writer->record_start = timestamp;
+  }
+  timestamp = ( timestamp > writer->record_start ) ? timestamp - writer->record_start : 0;
+  MIDIClockTimestampToSeconds( writer->clock, timestamp, &seconds );
+  if( writer->division & 0x8000 ) {
+    /* SMPTE time, the high byte is the negative number of frames per second */
+    fps   = -(signed char) ( writer->division >> 8 );
+    ticks = seconds * fps * ( writer->division & 0xff );
+  } else {
+    ticks = seconds * writer->division * 1000000.0 / MIDI_SMF_DEFAULT_TEMPO;
+  }
+  return MIDISMFWriterAppendMessage( writer, writer->record_track, (unsigned long) ticks, object );
+}
+
+/**
+ * @}
+ * @endcond
+ */
+
+/* MARK: -
+ * MARK: Creation and destruction *//**
+ * @name Creation and destruction
+ * Creating, destroying and reference counting of MIDISMFReader objects.
+ * @{
+ */
+
+/**
+ * @brief Create a MIDISMFReader instance for a file.
+ * Map the file into memory and index it's track chunks.
+ * @public @memberof MIDISMFReader
+ * @param path The path of the file.
+ * @return a pointer to the created reader structure on success.
+ * @return a @c NULL pointer if the file could not be mapped or is not a standard MIDI file.
+ */
+struct MIDISMFReader * MIDISMFReaderCreate( const char * path ) {
+  struct MIDISMFReader * reader;
+  struct stat st;
+  void * data;
+  int fd;
+  MIDIPrecondReturn( path != NULL, EINVAL, NULL );
+
+  fd = open( path, O_RDONLY );
+  if( fd < 0 ) {
+    MIDIError( errno, "Could not open standard MIDI file." );
+    return NULL;
+  }
+  if( fstat( fd, &st ) || st.st_size == 0 ) {
+    close( fd );
+    return NULL;
+  }
+  data = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+  close( fd );
+  if( data == MAP_FAILED ) {
+    MIDIError( errno, "Could not map standard MIDI file." );
+    return NULL;
+  }
+  reader = MIDISMFReaderCreateWithBuffer( st.st_size, data );
+  if( reader == NULL ) {
+    munmap( data, st.st_size );
+    return NULL;
+  }
+  reader->mapped = 1;
+  return reader;
+}
+
+/**
+ * @brief Create a MIDISMFReader instance for a file in memory.
+ * The buffer is not copied and must stay valid as long as the reader and
+ * all events that were read from it are used.
+ * @public @memberof MIDISMFReader
+ * @param size   The size of the buffer.
+ * @param buffer The contents of the file.
+ * @return a pointer to the created reader structure on success.
+ * @return a @c NULL pointer if the buffer does not contain a standard MIDI file.
+ */
+struct MIDISMFReader * MIDISMFReaderCreateWithBuffer( size_t size, const unsigned char * buffer ) {
+  struct MIDISMFReader * reader;
+  MIDIPrecondReturn( buffer != NULL, EINVAL, NULL );
+  reader = malloc( sizeof( struct MIDISMFReader ) );
+  MIDIPrecondReturn( reader != NULL, ENOMEM, NULL );
+  reader->refs     = 1;
+  reader->mapped   = 0;
+  reader->size     = size;
+  reader->data     = buffer;
+  reader->format   = 0;
+  reader->division = 0;
+  reader->ntracks  = 0;
+  reader->tracks   = NULL;
+  if( _index( reader ) ) {
+    MIDILog( DEBUG, "not a standard MIDI file\n" );
+    if( reader->tracks != NULL ) free( reader->tracks );
+    free( reader );
+    return NULL;
+  }
+  return reader;
+}
+
+/**
+ * @brief Destroy a MIDISMFReader instance.
+ * Unmap the file and free all resources.
+ * @public @memberof MIDISMFReader
+ * @param reader The reader.
+ */
+void MIDISMFReaderDestroy( struct MIDISMFReader * reader ) {
+  MIDIPrecondReturn( reader != NULL, EFAULT, (void)0 );
+  if( reader->mapped ) {
+    munmap( (void *) reader->data, reader->size );
+  }
+  if( reader->tracks != NULL ) {
+    free( reader->tracks );
+  }
+  free( reader );
+}
+
+/**
+ * @brief Retain a MIDISMFReader instance.
+ * @public @memberof MIDISMFReader
+ * @param reader The reader.
+ */
+void MIDISMFReaderRetain( struct MIDISMFReader * reader ) {
+  MIDIPrecondReturn( reader != NULL, EFAULT, (void)0 );
+  MIDIRefRetain( reader->refs );
+}
+
+/**
+ * @brief Release a MIDISMFReader instance.
+ * @public @memberof MIDISMFReader
+ * @param reader The reader.
+ */
+void MIDISMFReaderRelease( struct MIDISMFReader * reader ) {
+  MIDIPrecondReturn( reader != NULL, EFAULT, (void)0 );
+  if( ! MIDIRefRelease( reader->refs ) ) {
+    MIDISMFReaderDestroy( reader );
+  }
+}
+
+/** @} */
+
+/* MARK: Properties *//**
+ * @name Properties
+ * @{
+ */
+
+/**
+ * @brief Get the format of the file.
+ * @public @memberof MIDISMFReader
+ * @param reader The reader.
+ * @param format The format, one of @c MIDI_SMF_FORMAT_SINGLE_TRACK,
+ *               @c MIDI_SMF_FORMAT_MULTIPLE_TRACKS or @c MIDI_SMF_FORMAT_MULTIPLE_SONGS.
+ * @retval 0 on success.
+ */
+int MIDISMFReaderGetFormat( struct MIDISMFReader * reader, int * format ) {
+  MIDIPrecond( reader != NULL, EFAULT );
+  MIDIPrecond( format != NULL, EINVAL );
+  *format = reader->format;
+  return 0;
+}
+
+/**
+ * @brief Get the time division of the file.
+ * If bit 15 is clear the division is the number of ticks per quarter
+ * note, otherwise the high byte is the negative SMPTE format and the low
+ * byte the number of ticks per frame.
+ * @public @memberof MIDISMFReader
+ * @param reader   The reader.
+ * @param division The division word of the header chunk.
+ * @retval 0 on success.
+ */
+int MIDISMFReaderGetDivision( struct MIDISMFReader * reader, unsigned short * division ) {
+  MIDIPrecond( reader != NULL, EFAULT );
+  MIDIPrecond( division != NULL, EINVAL );
+  *division = reader->division;
+  return 0;
+}
+
+/**
+ * @brief Get the number of tracks.
+ * @public @memberof MIDISMFReader
+ * @param reader The reader.
+ * @param count  The number of track chunks that were found.
+ * @retval 0 on success.
+ */
+int MIDISMFReaderGetTrackCount( struct MIDISMFReader * reader, size_t * count ) {
+  MIDIPrecond( reader != NULL, EFAULT );
+  MIDIPrecond( count != NULL, EINVAL );
+  *count = reader->ntracks;
+  return 0;
+}
+
+/**
+ * @brief Get a cursor at the start of a track.
+ * @public @memberof MIDISMFReader
+ * @param reader The reader.
+ * @param track  The index of the track.
+ * @param cursor The cursor to initialize.
+ * @retval 0 on success.
+ * @retval >0 if there is no such track.
+ */
+int MIDISMFReaderGetCursor( struct MIDISMFReader * reader, size_t track, struct MIDISMFCursor * cursor ) {
+  MIDIPrecond( reader != NULL, EFAULT );
+  MIDIPrecond( cursor != NULL, EINVAL );
+  MIDIPrecond( track < reader->ntracks, EINVAL );
+  cursor->data   = reader->data + reader->tracks[track].offset;
+  cursor->size   = reader->tracks[track].size;
+  cursor->offset = 0;
+  cursor->track  = track;
+  cursor->tick   = 0;
+  cursor->status = 0;
+  return 0;
+}
+
+/** @} */
+
+/* MARK: Cursors *//**
+ * @name Cursors
+ * Decoding the events of a single track.
+ * @{
+ */
+
+/**
+ * @brief Decode the next event of a track.
+ * Running status is applied to channel messages, system exclusive and
+ * meta events cancel it. The end of track meta event is returned and
+ * moves the cursor to the end.
+ * @public @memberof MIDISMFCursor
+ * @param cursor The cursor.
+ * @param event  The decoded event.
+ * @retval 0 on success.
+ * @retval 1 if the cursor is at the end of the track.
+ * @retval >1 if the event is malformed.
+ */
+int MIDISMFCursorNext( struct MIDISMFCursor * cursor, struct MIDISMFEvent * event ) {
+  const unsigned char * p;
+  size_t left, read, n;
+  unsigned char status;
+  MIDIVarLen delta;
+  MIDIPrecond( cursor != NULL, EFAULT );
+  MIDIPrecond( event != NULL, EINVAL );
+
+  if( cursor->offset >= cursor->size ) return 1;
+  p    = cursor->data + cursor->offset;
+  left = cursor->size - cursor->offset;
+  if( MIDIUtilReadVarLen( &delta, left, (unsigned char *) p, &read ) || read >= left ) {
+    cursor->offset = cursor->size;
+    return EINVAL;
+  }
+  p    += read;
+  left -= read;
+
+  if( p[0] & 0x80 ) {
+    status = p[0];
+    p++;
+    left--;
+  } else if( cursor->status != 0 ) {
+    status = cursor->status;
+  } else {
+    cursor->offset = cursor->size;
+    return EINVAL;
+  }
+
+  event->delta  = delta;
+  event->track  = cursor->track;
+  event->status = status;
+  event->type   = 0;
+  event->size   = 0;
+  event->data   = NULL;
+  if( status < MIDI_STATUS_SYSTEM_EXCLUSIVE ) {
+    n = ( ( status >> 4 ) == MIDI_STATUS_PROGRAM_CHANGE || ( status >> 4 ) == MIDI_STATUS_CHANNEL_PRESSURE ) ? 1 : 2;
+    if( left < n ) {
+      cursor->offset = cursor->size;
+      return EINVAL;
+    }
+    event->bytes[0] = status;
+    event->bytes[1] = p[0];
+    event->bytes[2] = ( n == 2 ) ? p[1] : 0;
+    cursor->status  = status;
+  } else {
+    if( status == MIDI_SMF_STATUS_META ) {
+      if( left < 1 ) {
+        cursor->offset = cursor->size;
+        return EINVAL;
+      }
+      event->type = p[0];
+      p++;
+      left--;
+    } else if( status != MIDI_STATUS_SYSTEM_EXCLUSIVE && status != MIDI_STATUS_END_OF_EXCLUSIVE ) {
+      cursor->offset = cursor->size;
+      return EINVAL;
+    }
+    if( left == 0 || MIDIUtilReadVarLen( &(event->size), left, (unsigned char *) p, &read )
+     || event->size > left - read ) {
+      cursor->offset = cursor->size;
+      return EINVAL;
+    }
+    event->bytes[0] = status;
+    event->bytes[1] = 0;
+    event->bytes[2] = 0;
+    event->data     = p + read;
+    n = read + event->size;
+    cursor->status  = 0;
+  }
+  cursor->tick  += delta;
+  cursor->offset = ( p + n ) - cursor->data;
+  event->tick    = cursor->tick;
+  if( status == MIDI_SMF_STATUS_META && event->type == MIDI_SMF_META_END_OF_TRACK ) {
+    cursor->offset = cursor->size;
+  }
+  return 0;
+}
+
+/** @} */
+
+/* MARK: Events *//**
+ * @name Events
+ * @{
+ */
+
+/**
+ * @brief Set a message from an event.
+ * Channel messages and system exclusive events are converted, the payload
+ * of system exclusive events is copied into the message. A system
+ * exclusive event that does not end with @c 0xf7 is converted to the first
+ * segment of a message, an escaped @c 0xf7 event to a continued segment.
+ * The message's timestamp is set to the event's tick.
+ * @public @memberof MIDISMFEvent
+ * @param event   The event.
+ * @param message The message.
+ * @retval 0 on success.
+ * @retval >0 if the event is a meta event or could not be converted.
+ */
+int MIDISMFEventGetMessage( struct MIDISMFEvent * event, struct MIDIMessage * message ) {
+  struct MIDICompactMessage compact;
+  int result;
+  MIDIPrecond( event != NULL, EFAULT );
+  MIDIPrecond( message != NULL, EINVAL );
+
+  if( event->status == MIDI_SMF_STATUS_META ) return 1;
+  compact.bytes[0]     = event->bytes[0];
+  compact.bytes[1]     = event->bytes[1];
+  compact.bytes[2]     = event->bytes[2];
+  compact.flags        = 0;
+  compact.timestamp    = 0;
+  compact.sysex_offset = 0;
+  compact.sysex_size   = event->size;
+  if( event->status >= MIDI_STATUS_SYSTEM_EXCLUSIVE ) {
+    compact.bytes[0] = MIDI_STATUS_SYSTEM_EXCLUSIVE;
+    if( event->status == MIDI_STATUS_SYSTEM_EXCLUSIVE ) {
+      compact.flags |= MIDI_COMPACT_SYSEX_START;
+    }
+    if( event->size > 0 && event->data[event->size-1] == MIDI_STATUS_END_OF_EXCLUSIVE ) {
+      compact.flags |= MIDI_COMPACT_SYSEX_END;
+      compact.sysex_size--;
+    }
+  }
+  result = MIDIMessageSetCompact( message, &compact, (unsigned char *) event->data );
+  if( result == 0 ) {
+    MIDIMessageSetTimestamp( message, event->tick );
+  }
+  return result;
+}
+
+/** @} */
+
+/* MARK: -
+ * MARK: Iterators *//**
+ * @name Iterators
+ * Merging the events of all tracks in time order.
+ * @{
+ */
+
+/**
+ * @brief Create a MIDISMFIterator instance.
+ * The iterator starts at the beginning of the file and retains the reader.
+ * @public @memberof MIDISMFIterator
+ * @param reader The reader.
+ * @return a pointer to the created iterator structure on success.
+ * @return a @c NULL pointer if the iterator could not created.
+ */
+struct MIDISMFIterator * MIDISMFIteratorCreate( struct MIDISMFReader * reader ) {
+  struct MIDISMFIterator * iterator;
+  size_t n;
+  MIDIPrecondReturn( reader != NULL, EFAULT, NULL );
+  iterator = malloc( sizeof( struct MIDISMFIterator ) );
+  MIDIPrecondReturn( iterator != NULL, ENOMEM, NULL );
+
+  n = ( reader->ntracks > 0 ) ? reader->ntracks : 1;
+  iterator->refs    = 1;
+  iterator->reader  = reader;
+  iterator->ntracks = reader->ntracks;
+  iterator->length  = 0;
+  iterator->cursors = malloc( sizeof( struct MIDISMFCursor ) * n );
+  iterator->events  = malloc( sizeof( struct MIDISMFEvent ) * n );
+  iterator->heap    = malloc( sizeof( size_t ) * n );
+  if( iterator->cursors == NULL || iterator->events == NULL || iterator->heap == NULL ) {
+    if( iterator->cursors != NULL ) free( iterator->cursors );
+    if( iterator->events != NULL ) free( iterator->events );
+    if( iterator->heap != NULL ) free( iterator->heap );
+    free( iterator );
+    MIDIError( ENOMEM, "Could not allocate iterator." );
+    return NULL;
+  }
+  MIDISMFReaderRetain( reader );
+  MIDISMFIteratorRewind( iterator );
+  return iterator;
+}
+
+/**
+ * @brief Destroy a MIDISMFIterator instance.
+ * @public @memberof MIDISMFIterator
+ * @param iterator The iterator.
+ */
+void MIDISMFIteratorDestroy( struct MIDISMFIterator * iterator ) {
+  MIDIPrecondReturn( iterator != NULL, EFAULT, (void)0 );
+  MIDISMFReaderRelease( iterator->reader );
+  free( iterator->cursors );
+  free( iterator->events );
+  free( iterator->heap );
+  free( iterator );
+}
+
+/**
+ * @brief Retain a MIDISMFIterator instance.
+ * @public @memberof MIDISMFIterator
+ * @param iterator The iterator.
+ */
+void MIDISMFIteratorRetain( struct MIDISMFIterator * iterator ) {
+  MIDIPrecondReturn( iterator != NULL, EFAULT, (void)0 );
+  MIDIRefRetain( iterator->refs );
+}
+
+/**
+ * @brief Release a MIDISMFIterator instance.
+ * @public @memberof MIDISMFIterator
+ * @param iterator The iterator.
+ */
+void MIDISMFIteratorRelease( struct MIDISMFIterator * iterator ) {
+  MIDIPrecondReturn( iterator != NULL, EFAULT, (void)0 );
+  if( ! MIDIRefRelease( iterator->refs ) ) {
+    MIDISMFIteratorDestroy( iterator );
+  }
+}
+
+/**
+ * @brief Go back to the beginning of the file.
+ * Only the first event of every track is decoded.
+ * @public @memberof MIDISMFIterator
+ * @param iterator The iterator.
+ * @retval 0 on success.
+ */
+int MIDISMFIteratorRewind( struct MIDISMFIterator * iterator ) {
+  size_t i;
+  MIDIPrecond( iterator != NULL, EFAULT );
+  iterator->length = 0;
+  for( i=0; i<iterator->ntracks; i++ ) {
+    MIDISMFReaderGetCursor( iterator->reader, i, &(iterator->cursors[i]) );
+    if( MIDISMFCursorNext( &(iterator->cursors[i]), &(iterator->events[i]) ) == 0 ) {
+      iterator->heap[iterator->length] = i;
+      _heap_up( iterator, iterator->length );
+      iterator->length++;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief Get the next event of the file.
+ * Return the earliest pending event of all tracks and decode the next
+ * event of it's track.
+ * @public @memberof MIDISMFIterator
+ * @param iterator The iterator.
+ * @param event    The event.
+ * @retval 0 on success.
+ * @retval >0 if there are no more events.
+ */
+int MIDISMFIteratorNext( struct MIDISMFIterator * iterator, struct MIDISMFEvent * event ) {
+  size_t track;
+  MIDIPrecond( iterator != NULL, EFAULT );
+  MIDIPrecond( event != NULL, EINVAL );
+
+  if( iterator->length == 0 ) return 1;
+  track = iterator->heap[0];
+  *event = iterator->events[track];
+  if( MIDISMFCursorNext( &(iterator->cursors[track]), &(iterator->events[track]) ) != 0 ) {
+    /* the track has ended, replace it with the last entry of the heap */
+    iterator->length--;
+    iterator->heap[0] = iterator->heap[iterator->length];
+  }
+  _heap_down( iterator, 0 );
+  return 0;
+}
+
+/** @} */
+
+/* MARK: -
+ * MARK: Writers *//**
+ * @name Writers
+ * Creating, destroying and reference counting of MIDISMFWriter objects.
+ * @{
+ */
+
+/**
+ * @brief Create a MIDISMFWriter instance.
+ * The file is built in memory, use @ref MIDISMFWriterAddTrack to add
+ * tracks and @ref MIDISMFWriterWrite to write the file.
+ * @public @memberof MIDISMFWriter
+ * @param format   The format of the file.
+ * @param division The time division, see @ref MIDISMFReaderGetDivision.
+ * @return a pointer to the created writer structure on success.
+ * @return a @c NULL pointer if the writer could not created.
+ */
+struct MIDISMFWriter * MIDISMFWriterCreate( int format, unsigned short division ) {
+  struct MIDISMFWriter * writer;
+  MIDIPrecondReturn( format >= MIDI_SMF_FORMAT_SINGLE_TRACK && format <= MIDI_SMF_FORMAT_MULTIPLE_SONGS, EINVAL, NULL );
+  writer = malloc( sizeof( struct MIDISMFWriter ) );
+  MIDIPrecondReturn( writer != NULL, ENOMEM, NULL );
+  writer->refs         = 1;
+  writer->format       = format;
+  writer->division     = division;
+  writer->finalized    = 0;
+  writer->fd           = -1;
+  writer->fd_offset    = -1;
+  writer->ntracks      = 0;
+  writer->tracks_size  = 0;
+  writer->tracks       = NULL;
+  writer->clock        = NULL;
+  writer->record_track = 0;
+  writer->recording    = 0;
+  writer->record_start = 0;
+  memcpy( &(writer->header[0]), "MThd", 4 );
+  _write_uint32( &(writer->header[4]), 6 );
+  _write_uint16( &(writer->header[8]), format );
+  _write_uint16( &(writer->header[10]), 0 );
+  _write_uint16( &(writer->header[12]), division );
+  writer->port = MIDIPortCreate( "SMF writer", MIDI_PORT_IN, writer, &_port_receive );
+  if( writer->port == NULL ) {
+    free( writer );
+    return NULL;
+  }
+  return writer;
+}
+
+/**
+ * @brief Create a MIDISMFWriter instance that streams to a file descriptor.
+ * A type 0 file with a single track is written while events are appended.
+ * The header is buffered like any other event, nothing is written before
+ * the buffer is full or the writer is finalized.
+ * @public @memberof MIDISMFWriter
+ * @param fd       The file descriptor, it is not closed by the writer.
+ * @param division The time division, see @ref MIDISMFReaderGetDivision.
+ * @return a pointer to the created writer structure on success.
+ * @return a @c NULL pointer if the writer could not created.
+ */
+struct MIDISMFWriter * MIDISMFWriterCreateStreaming( int fd, unsigned short division ) {
+  struct MIDISMFWriter * writer;
+  struct MIDISMFTrackBuffer * track;
+  size_t index;
+  MIDIPrecondReturn( fd >= 0, EINVAL, NULL );
+  writer = MIDISMFWriterCreate( MIDI_SMF_FORMAT_SINGLE_TRACK, division );
+  if( writer == NULL ) return NULL;
+  if( MIDISMFWriterAddTrack( writer, &index ) ) {
+    MIDISMFWriterRelease( writer );
+    return NULL;
+  }
+  /* the header chunk goes in front of the track chunk */
+  track = &(writer->tracks[0]);
+  memmove( track->data + MIDI_SMF_HEADER_SIZE, track->data, track->size );
+  memcpy( track->data, &(writer->header[0]), MIDI_SMF_HEADER_SIZE );
+  _write_uint16( track->data + 10, 1 );
+  track->size += MIDI_SMF_HEADER_SIZE;
+  writer->fd        = fd;
+  writer->fd_offset = lseek( fd, 0, SEEK_CUR );
+  return writer;
+}
+
+/**
+ * @brief Destroy a MIDISMFWriter instance.
+ * Free all resources, a streaming writer that was not finalized leaves
+ * an incomplete file.
+ * @public @memberof MIDISMFWriter
+ * @param writer The writer.
+ */
+void MIDISMFWriterDestroy( struct MIDISMFWriter * writer ) {
+  size_t i;
+  MIDIPrecondReturn( writer != NULL, EFAULT, (void)0 );
+  MIDIPortInvalidate( writer->port );
+  MIDIPortRelease( writer->port );
+  for( i=0; i<writer->ntracks; i++ ) {
+    free( writer->tracks[i].data );
+  }
+  if( writer->tracks != NULL ) free( writer->tracks );
+  if( writer->clock != NULL ) MIDIClockRelease( writer->clock );
+  free( writer );
+}
+
+/**
+ * @brief Retain a MIDISMFWriter instance.
+ * @public @memberof MIDISMFWriter
+ * @param writer The writer.
+ */
+void MIDISMFWriterRetain( struct MIDISMFWriter * writer ) {
+  MIDIPrecondReturn( writer != NULL, EFAULT, (void)0 );
+  MIDIRefRetain( writer->refs );
+}
+
+/**
+ * @brief Release a MIDISMFWriter instance.
+ * @public @memberof MIDISMFWriter
+ * @param writer The writer.
+ */
+void MIDISMFWriterRelease( struct MIDISMFWriter * writer ) {
+  MIDIPrecondReturn( writer != NULL, EFAULT, (void)0 );
+  if( ! MIDIRefRelease( writer->refs ) ) {
+    MIDISMFWriterDestroy( writer );
+  }
+}
+
+/**
+ * @brief Add a track.
+ * A type 0 file has a single track, streaming writers can not add tracks.
+ * @public @memberof MIDISMFWriter
+ * @param writer The writer.
+ * @param track  The index of the new track, may be @c NULL.
+ * @retval 0 on success.
+ * @retval >0 if the track could not be added.
+ */
+int MIDISMFWriterAddTrack( struct MIDISMFWriter * writer, size_t * track ) {
+  struct MIDISMFTrackBuffer * tracks, * t;
+  size_t size;
+  MIDIPrecond( writer != NULL, EFAULT );
+  if( writer->finalized || writer->fd >= 0 ) return 1;
+  if( writer->format == MIDI_SMF_FORMAT_SINGLE_TRACK && writer->ntracks > 0 ) return 1;
+
+  if( writer->ntracks == writer->tracks_size ) {
+    size = ( writer->tracks_size == 0 ) ? 4 : writer->tracks_size * 2;
+    tracks = realloc( writer->tracks, sizeof( struct MIDISMFTrackBuffer ) * size );
+    if( tracks == NULL ) {
+      MIDIError( ENOMEM, "Could not add track." );
+      return 1;
+    }
+    writer->tracks      = tracks;
+    writer->tracks_size = size;
+  }
+  t = &(writer->tracks[writer->ntracks]);
+  t->data     = NULL;
+  t->size     = 0;
+  t->capacity = 0;
+  t->flushed  = 0;
+  t->tick     = 0;
+  t->status   = 0;
+  t->ended    = 0;
+  if( _reserve( writer, t, MIDI_SMF_HEADER_SIZE + MIDI_SMF_CHUNK_HEADER_SIZE ) ) return 1;
+  memcpy( t->data, "MTrk", 4 );
+  _write_uint32( t->data + 4, 0 );
+  t->size = MIDI_SMF_CHUNK_HEADER_SIZE;
+  if( track != NULL ) *track = writer->ntracks;
+  writer->ntracks++;
+  return 0;
+}
+
+/**
+ * @brief Get the number of tracks.
+ * @public @memberof MIDISMFWriter
+ * @param writer The writer.
+ * @param count  The number of tracks.
+ * @retval 0 on success.
+ */
+int MIDISMFWriterGetTrackCount( struct MIDISMFWriter * writer, size_t * count ) {
+  MIDIPrecond( writer != NULL, EFAULT );
+  MIDIPrecond( count != NULL, EINVAL );
+  *count = writer->ntracks;
+  return 0;
+}
+
+/**
+ * @brief Get the writer's port.
+ * Connect the port to a device's through port to record it. The first
+ * message that is received is the start of the recording.
+ * @public @memberof MIDISMFWriter
+ * @param writer The writer.
+ * @param port   The port.
+ * @retval 0 on success.
+ */
+int MIDISMFWriterGetPort( struct MIDISMFWriter * writer, struct MIDIPort ** port ) {
+  MIDIPrecond( writer != NULL, EFAULT );
+  MIDIPrecond( port != NULL, EINVAL );
+  *port = writer->port;
+  return 0;
+}
+
+/**
+ * @brief Set the clock of recorded messages.
+ * @public @memberof MIDISMFWriter
+ * @param writer The writer.
+ * @param clock  The clock that the timestamps of recorded messages refer
+ *               to, or @c NULL for the global clock.
+ * @retval 0 on success.
+ */
+int MIDISMFWriterSetClock( struct MIDISMFWriter * writer, struct MIDIClock * clock ) {
+  MIDIPrecond( writer != NULL, EFAULT );
+  if( clock != NULL ) MIDIClockRetain( clock );
+  if( writer->clock != NULL ) MIDIClockRelease( writer->clock );
+  writer->clock = clock;
+  return 0;
+}
+
+/**
+ * @brief Set the track that recorded messages are appended to.
+ * @public @memberof MIDISMFWriter
+ * @param writer The writer.
+ * @param track  The index of the track.
+ * @retval 0 on success.
+ * @retval >0 if there is no such track.
+ */
+int MIDISMFWriterSetRecordTrack( struct MIDISMFWriter * writer, size_t track ) {
+  MIDIPrecond( writer != NULL, EFAULT );
+  MIDIPrecond( track < writer->ntracks, EINVAL );
+  writer->record_track = track;
+  return 0;
+}
+
+/** @} */
+
+/* MARK: Appending events *//**
+ * @name Appending events
+ * @{
+ */
+
+/**
+ * @brief Append a message to a track.
+ * Channel messages use running status. System exclusive messages are
+ * written as @c 0xf0 events, continued segments and other system messages
+ * as escaped @c 0xf7 events.
+ * @public @memberof MIDISMFWriter
+ * @param writer  The writer.
+ * @param track   The index of the track.
+ * @param tick    The absolute tick of the message.
+ * @param message The message.
+ * @retval 0 on success.
+ * @retval >0 if the message could not be appended.
+ */
+int MIDISMFWriterAppendMessage( struct MIDISMFWriter * writer, size_t track, unsigned long tick,
+                                struct MIDIMessage * message ) {
+  struct MIDICompactMessage compact;
+  struct MIDISMFTrackBuffer * t;
+  unsigned char * p, * payload;
+  unsigned char status;
+  MIDIVarLen length;
+  size_t size = 0, written = 0, n;
+  MIDIPrecond( writer != NULL, EFAULT );
+  MIDIPrecond( message != NULL, EINVAL );
+
+  t = _track( writer, track );
+  if( t == NULL ) return 1;
+  if( MIDIMessageGetCompact( message, &compact ) == 0 && compact.bytes[0] < MIDI_STATUS_SYSTEM_EXCLUSIVE ) {
+    return _append_channel( writer, t, tick, &(compact.bytes[0]) );
+  }
+
+  /* encode behind the room for the longest event head, then move it in place */
+  if( MIDIMessageGetSize( message, &size ) ) return 1;
+  if( _reserve( writer, t, 4 + 1 + 4 + size + 2 ) ) return 1;
+  p = t->data + t->size + 4 + 1 + 4;
+  if( MIDIMessageEncode( message, size + 2, p, &written ) || written == 0 ) return 1;
+  if( p[0] == MIDI_STATUS_SYSTEM_EXCLUSIVE ) {
+    status  = MIDI_STATUS_SYSTEM_EXCLUSIVE;
+    payload = p + 1;
+    length  = written - 1;
+  } else {
+    status  = MIDI_STATUS_END_OF_EXCLUSIVE;
+    payload = p;
+    length  = written;
+  }
+  _append_delta( t, tick );
+  t->data[t->size++] = status;
+  MIDIUtilWriteVarLen( &length, 4, t->data + t->size, &n );
+  t->size += n;
+  memmove( t->data + t->size, payload, length );
+  t->size  += length;
+  t->status = 0;
+  return 0;
+}
+
+/**
+ * @brief Append a meta event to a track.
+ * Appending an end of track event ends the track.
+ * @public @memberof MIDISMFWriter
+ * @param writer The writer.
+ * @param track  The index of the track.
+ * @param tick   The absolute tick of the event.
+ * @param type   The type of the meta event.
+ * @param size   The size of the payload.
+ * @param data   The payload.
+ * @retval 0 on success.
+ * @retval >0 if the event could not be appended.
+ */
+int MIDISMFWriterAppendMeta( struct MIDISMFWriter * writer, size_t track, unsigned long tick,
+                             unsigned char type, size_t size, const unsigned char * data ) {
+  struct MIDISMFTrackBuffer * t;
+  MIDIPrecond( writer != NULL, EFAULT );
+  MIDIPrecond( data != NULL || size == 0, EINVAL );
+
+  t = _track( writer, track );
+  if( t == NULL ) return 1;
+  if( _append_blob( writer, t, tick, MIDI_SMF_STATUS_META, type, size, data ) ) return 1;
+  if( type == MIDI_SMF_META_END_OF_TRACK ) t->ended = 1;
+  return 0;
+}
+
+/**
+ * @brief Append an event that was read from a file.
+ * The event is appended as it is, at it's absolute tick.
+ * @public @memberof MIDISMFWriter
+ * @param writer The writer.
+ * @param track  The index of the track.
+ * @param event  The event.
+ * @retval 0 on success.
+ * @retval >0 if the event could not be appended.
+ */
+int MIDISMFWriterAppendEvent( struct MIDISMFWriter * writer, size_t track, struct MIDISMFEvent * event ) {
+  struct MIDISMFTrackBuffer * t;
+  MIDIPrecond( writer != NULL, EFAULT );
+  MIDIPrecond( event != NULL, EINVAL );
+
+  if( event->status == MIDI_SMF_STATUS_META ) {
+    return MIDISMFWriterAppendMeta( writer, track, event->tick, event->type, event->size, event->data );
+  }
+  t = _track( writer, track );
+  if( t == NULL ) return 1;
+  if( event->status < MIDI_STATUS_SYSTEM_EXCLUSIVE ) {
+    return _append_channel( writer, t, event->tick, &(event->bytes[0]) );
+  }
+  return _append_blob( writer, t, event->tick, event->status, 0, event->size, event->data );
+}
+
+/** @} */
+
+/* MARK: Finalizing *//**
+ * @name Finalizing
+ * @{
+ */
+
+/**
+ * @brief Finish the file.
+ * End all tracks that were not ended and fill in the chunk lengths and
+ * the number of tracks. A streaming writer writes the rest of the track
+ * and patches the chunk length in place, this is skipped if the file
+ * descriptor is not seekable. No events can be appended afterwards.
+ * @public @memberof MIDISMFWriter
+ * @param writer The writer.
+ * @retval 0 on success.
+ * @retval >0 if the file could not be written.
+ */
+int MIDISMFWriterFinalize( struct MIDISMFWriter * writer ) {
+  struct MIDISMFTrackBuffer * t;
+  unsigned char length[4];
+  size_t i, size;
+  MIDIPrecond( writer != NULL, EFAULT );
+  if( writer->finalized ) return 0;
+
+  for( i=0; i<writer->ntracks; i++ ) {
+    t = &(writer->tracks[i]);
+    if( ! t->ended && MIDISMFWriterAppendMeta( writer, i, t->tick, MIDI_SMF_META_END_OF_TRACK, 0, NULL ) ) {
+      return 1;
+    }
+  }
+  writer->finalized = 1;
+  _write_uint16( &(writer->header[10]), writer->ntracks );
+
+  if( writer->fd < 0 ) {
+    for( i=0; i<writer->ntracks; i++ ) {
+      t = &(writer->tracks[i]);
+      _write_uint32( t->data + 4, t->size - MIDI_SMF_CHUNK_HEADER_SIZE );
+    }
+    return 0;
+  }
+
+  t    = &(writer->tracks[0]);
+  size = t->flushed + t->size - MIDI_SMF_HEADER_SIZE - MIDI_SMF_CHUNK_HEADER_SIZE;
+  _write_uint32( &(length[0]), size );
+  if( t->flushed == 0 ) {
+    memcpy( t->data + MIDI_SMF_HEADER_SIZE + 4, &(length[0]), 4 );
+    return _flush( writer, t );
+  }
+  if( _flush( writer, t ) ) return 1;
+  if( writer->fd_offset < 0 ) {
+    MIDILog( DEBUG, "file descriptor is not seekable, could not patch track length\n" );
+    return 1;
+  }
+  if( pwrite( writer->fd, &(length[0]), 4, writer->fd_offset + MIDI_SMF_HEADER_SIZE + 4 ) != 4 ) {
+    MIDIError( errno, "Could not patch track length." );
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Write the file to a file descriptor.
+ * Finalize the writer and write the header and every track with a single
+ * call each. Only for writers that are not streaming.
+ * @public @memberof MIDISMFWriter
+ * @param writer The writer.
+ * @param fd     The file descriptor.
+ * @retval 0 on success.
+ * @retval >0 if the file could not be written.
+ */
+int MIDISMFWriterWrite( struct MIDISMFWriter * writer, int fd ) {
+  struct MIDISMFTrackBuffer header;
+  size_t i;
+  int stream_fd;
+  MIDIPrecond( writer != NULL, EFAULT );
+  MIDIPrecond( fd >= 0, EINVAL );
+  if( writer->fd >= 0 ) return 1;
+  if( MIDISMFWriterFinalize( writer ) ) return 1;
+
+  /* reuse the flushing code of streaming writers */
+  stream_fd  = writer->fd;
+  writer->fd = fd;
+  header.data    = &(writer->header[0]);
+  header.size    = MIDI_SMF_HEADER_SIZE;
+  header.flushed = 0;
+  if( _flush( writer, &header ) ) {
+    writer->fd = stream_fd;
+    return 1;
+  }
+  for( i=0; i<writer->ntracks; i++ ) {
+    size_t size = writer->tracks[i].size;
+    if( _flush( writer, &(writer->tracks[i]) ) ) {
+      writer->fd = stream_fd;
+      return 1;
+    }
+    /* keep the data, the file may be written again */
+    writer->tracks[i].size    = size;
+    writer->tracks[i].flushed = 0;
+  }
+  writer->fd = stream_fd;
+  return 0;
+}
+
+/** @} */
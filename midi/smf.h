@@ -0,0 +1,103 @@
+#ifndef MIDIKIT_MIDI_SMF_H
+#define MIDIKIT_MIDI_SMF_H
+#include "midi.h"
+#include "util.h"
+
+struct MIDIPort;
+struct MIDIClock;
+struct MIDIMessage;
+
+#define MIDI_SMF_FORMAT_SINGLE_TRACK     0
+#define MIDI_SMF_FORMAT_MULTIPLE_TRACKS  1
+#define MIDI_SMF_FORMAT_MULTIPLE_SONGS   2
+
+#define MIDI_SMF_META_SEQUENCE_NUMBER    0x00
+#define MIDI_SMF_META_TEXT               0x01
+#define MIDI_SMF_META_TRACK_NAME         0x03
+#define MIDI_SMF_META_END_OF_TRACK       0x2f
+#define MIDI_SMF_META_SET_TEMPO          0x51
+#define MIDI_SMF_META_TIME_SIGNATURE     0x58
+#define MIDI_SMF_META_KEY_SIGNATURE      0x59
+
+#define MIDI_SMF_STATUS_META             0xff
+
+/**
+ * @brief An event of a standard MIDI file.
+ * Channel messages are stored in @c bytes, the payload of system
+ * exclusive and meta events is not copied, @c data points into the
+ * file's memory.
+ */
+struct MIDISMFEvent {
+  unsigned long  tick;
+  MIDIVarLen     delta;
+  size_t         track;
+  unsigned char  status;
+  unsigned char  type;
+  unsigned char  bytes[3];
+  MIDIVarLen     size;
+  const unsigned char * data;
+};
+
+/**
+ * @brief A cursor over the events of a single track.
+ * Cursors do not own any resources, they are only valid as long as the
+ * reader they were obtained from.
+ */
+struct MIDISMFCursor {
+  const unsigned char * data;
+  size_t size;
+  size_t offset;
+  size_t track;
+  unsigned long tick;
+  MIDIRunningStatus status;
+};
+
+struct MIDISMFReader;
+struct MIDISMFIterator;
+struct MIDISMFWriter;
+
+struct MIDISMFReader * MIDISMFReaderCreate( const char * path );
+struct MIDISMFReader * MIDISMFReaderCreateWithBuffer( size_t size, const unsigned char * buffer );
+void MIDISMFReaderDestroy( struct MIDISMFReader * reader );
+void MIDISMFReaderRetain( struct MIDISMFReader * reader );
+void MIDISMFReaderRelease( struct MIDISMFReader * reader );
+
+int MIDISMFReaderGetFormat( struct MIDISMFReader * reader, int * format );
+int MIDISMFReaderGetDivision( struct MIDISMFReader * reader, unsigned short * division );
+int MIDISMFReaderGetTrackCount( struct MIDISMFReader * reader, size_t * count );
+int MIDISMFReaderGetCursor( struct MIDISMFReader * reader, size_t track, struct MIDISMFCursor * cursor );
+
+int MIDISMFCursorNext( struct MIDISMFCursor * cursor, struct MIDISMFEvent * event );
+
+int MIDISMFEventGetMessage( struct MIDISMFEvent * event, struct MIDIMessage * message );
+
+struct MIDISMFIterator * MIDISMFIteratorCreate( struct MIDISMFReader * reader );
+void MIDISMFIteratorDestroy( struct MIDISMFIterator * iterator );
+void MIDISMFIteratorRetain( struct MIDISMFIterator * iterator );
+void MIDISMFIteratorRelease( struct MIDISMFIterator * iterator );
+
+int MIDISMFIteratorRewind( struct MIDISMFIterator * iterator );
+int MIDISMFIteratorNext( struct MIDISMFIterator * iterator, struct MIDISMFEvent * event );
+
+struct MIDISMFWriter * MIDISMFWriterCreate( int format, unsigned short division );
+struct MIDISMFWriter * MIDISMFWriterCreateStreaming( int fd, unsigned short division );
+void MIDISMFWriterDestroy( struct MIDISMFWriter * writer );
+void MIDISMFWriterRetain( struct MIDISMFWriter * writer );
+void MIDISMFWriterRelease( struct MIDISMFWriter * writer );
+
+int MIDISMFWriterAddTrack( struct MIDISMFWriter * writer, size_t * track );
+int MIDISMFWriterGetTrackCount( struct MIDISMFWriter * writer, size_t * count );
+int MIDISMFWriterGetPort( struct MIDISMFWriter * writer, struct MIDIPort ** port );
+int MIDISMFWriterSetClock( struct MIDISMFWriter * writer, struct MIDIClock * clock );
+int MIDISMFWriterSetRecordTrack( struct MIDISMFWriter * writer, size_t track );
+
+int MIDISMFWriterAppendMessage( struct MIDISMFWriter * writer, size_t track, unsigned long tick,
+                                struct MIDIMessage * message );
+int MIDISMFWriterAppendMeta( struct MIDISMFWriter * writer, size_t track, unsigned long tick,
+                             unsigned char type, size_t size, const unsigned char * data );
+int MIDISMFWriterAppendEvent( struct MIDISMFWriter * writer, size_t track, struct MIDISMFEvent * event );
+
+int MIDISMFWriterFinalize( struct MIDISMFWriter * writer );
+int MIDISMFWriterWrite( struct MIDISMFWriter * writer, int fd );
+
+#endif
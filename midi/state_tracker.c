@@ -0,0 +1,622 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include "state_tracker.h"
+
+#include "message.h"
+#include "controller.h"
+
+#define N_CHANNEL 16
+#define N_KEY 128
+#define PITCH_WHEEL_CENTER 0x2000
+
+#if defined(__GNUC__)
+#define _ctz( x ) __builtin_ctzll( x )
+#else
+static int _ctz( unsigned long long x ) {
+  int n = 0;
+  while( !( x & 1 ) ) { x >>= 1; n++; }
+  return n;
+}
+#endif
+
+/**
+ * @ingroup MIDI
+ * @brief Channel state of a MIDI stream.
+ * The state tracker follows the channel messages that pass through a
+ * device and records which notes are held (and with which velocity) as
+ * well as the last value of every control, the program and the pitch
+ * wheel position of each channel. Held notes and changed controls are
+ * kept in bitsets, one 128 bit set per channel, together with a mask of
+ * the channels that have any bit set. Emitting the note offs for all held
+ * notes or a snapshot of the state therefore only visits the slots that
+ * are in use instead of all 2048 keys or controls.
+ *
+ * Channel mode messages are not recorded as controls. "All Sound Off",
+ * "All Notes Off" and the mode changes end all notes of their channel,
+ * "Reset All Controllers" forgets all controls and centers the pitch wheel.
+ */
+struct MIDIStateTracker {
+/**
+ * @privatesection
+ * @cond INTERNALS
+ */
+  int refs;
+  unsigned short note_channels;
+  unsigned short control_channels;
+  unsigned short program_channels;
+  unsigned short pitch_wheel_channels;
+  size_t active;
+  unsigned long long notes[N_CHANNEL][2];
+  unsigned long long controls[N_CHANNEL][2];
+  unsigned char velocity[N_CHANNEL][N_KEY];
+  unsigned char control[N_CHANNEL][N_KEY];
+  unsigned char program[N_CHANNEL];
+  MIDILongValue pitch_wheel[N_CHANNEL];
+/** @endcond */
+};
+
+/* MARK: Internals *//**
+ * @name Internals
+ * @cond INTERNALS
+ * Bitset manipulation and message output.
+ * @{
+ */
+
+/**
+ * @brief Return the number of set bits of a 64 bit word.
+ * @private @memberof MIDIStateTracker
+ * @param x The word.
+ * @return the number of set bits.
+ */
+static size_t _popcount( unsigned long long x ) {
+#if defined(__GNUC__)
+  return __builtin_popcountll( x );
+#else
+  size_t n = 0;
+  for( ; x; x &= x - 1 ) n++;
+  return n;
+#endif
+}
+
+/**
+ * @brief End all notes of a channel.
+ * @private @memberof MIDIStateTracker
+ * @param tracker The state tracker.
+ * @param c       The channel index.
+ */
+static void _clear_channel_notes( struct MIDIStateTracker * tracker, int c ) {
+  tracker->active -= _popcount( tracker->notes[c][0] ) + _popcount( tracker->notes[c][1] );
+  tracker->notes[c][0] = 0;
+  tracker->notes[c][1] = 0;
+  tracker->note_channels &= ~( 1 << c );
+}
+
+/**
+ * @brief Record a note on or note off.
+ * @private @memberof MIDIStateTracker
+ * @param tracker  The state tracker.
+ * @param c        The channel index.
+ * @param k        The key index.
+ * @param velocity The velocity, 0 for a note off.
+ */
+static void _note( struct MIDIStateTracker * tracker, int c, int k, unsigned char velocity ) {
+  unsigned long long bit = 1ULL << ( k & 63 );
+  unsigned long long * word = &(tracker->notes[c][k >> 6]);
+  if( velocity ) {
+    if( !( *word & bit ) ) tracker->active++;
+    *word |= bit;
+    tracker->velocity[c][k] = velocity;
+    tracker->note_channels |= 1 << c;
+  } else if( *word & bit ) {
+    *word &= ~bit;
+    tracker->active--;
+    if( ( tracker->notes[c][0] | tracker->notes[c][1] ) == 0 ) {
+      tracker->note_channels &= ~( 1 << c );
+    }
+  }
+}
+
+/**
+ * @brief Record a control change.
+ * Channel mode messages change the note and control state of the channel
+ * instead of being recorded.
+ * @private @memberof MIDIStateTracker
+ * @param tracker The state tracker.
+ * @param c       The channel index.
+ * @param control The control index.
+ * @param value   The value.
+ */
+static void _control( struct MIDIStateTracker * tracker, int c, int control, unsigned char value ) {
+  switch( control ) {
+    case MIDI_CONTROL_RESET_ALL_CONTROLLERS:
+      tracker->controls[c][0] = 0;
+      tracker->controls[c][1] = 0;
+      tracker->control_channels     &= ~( 1 << c );
+      tracker->pitch_wheel[c]        = PITCH_WHEEL_CENTER;
+      tracker->pitch_wheel_channels &= ~( 1 << c );
+      return;
+    case MIDI_CONTROL_ALL_SOUND_OFF:
+    case MIDI_CONTROL_ALL_NOTES_OFF:
+    case MIDI_CONTROL_OMNI_MODE_OFF:
+    case MIDI_CONTROL_OMNI_MODE_ON:
+    case MIDI_CONTROL_MONO_MODE_ON:
+    case MIDI_CONTROL_POLY_MODE_ON:
+      _clear_channel_notes( tracker, c );
+      return;
+    case MIDI_CONTROL_LOCAL_CONTROL:
+      return;
+    default:
+      break;
+  }
+  tracker->controls[c][control >> 6] |= 1ULL << ( control & 63 );
+  tracker->control[c][control] = value;
+  tracker->control_channels |= 1 << c;
+}
+
+/**
+ * @brief Append a message to an output array.
+ * @private @memberof MIDIStateTracker
+ * @param messages The output array.
+ * @param size     The size of the output array.
+ * @param n        The number of messages in the output array.
+ * @param status   The status byte.
+ * @param data1    The first data byte.
+ * @param data2    The second data byte.
+ * @retval 0 on success.
+ * @retval 1 if the output array is full.
+ */
+static int _put( struct MIDICompactMessage * messages, size_t size, size_t * n,
+                 unsigned char status, unsigned char data1, unsigned char data2 ) {
+  struct MIDICompactMessage * m;
+  if( *n >= size ) return 1;
+  m = &(messages[(*n)++]);
+  m->bytes[0]     = status;
+  m->bytes[1]     = data1;
+  m->bytes[2]     = data2;
+  m->flags        = 0;
+  m->timestamp    = 0;
+  m->sysex_offset = 0;
+  m->sysex_size   = 0;
+  return 0;
+}
+
+/**
+ * @brief Append one message for each bit of a channel bitset.
+ * The status and the bit index are used as first two bytes, the third
+ * byte is taken from the channel's value table.
+ * @private @memberof MIDIStateTracker
+ * @param bits     The bitset of the channel.
+ * @param values   The value table of the channel.
+ * @param status   The status byte.
+ * @param messages The output array.
+ * @param size     The size of the output array.
+ * @param n        The number of messages in the output array.
+ * @retval 0 on success.
+ * @retval 1 if the output array is full.
+ */
+static int _put_bits( unsigned long long * bits, unsigned char * values, unsigned char status,
+                      struct MIDICompactMessage * messages, size_t size, size_t * n ) {
+  unsigned long long word;
+  int w, i;
+  for( w=0; w<2; w++ ) {
+    for( word = bits[w]; word; word &= word - 1 ) {
+      i = ( w << 6 ) + _ctz( word );
+      if( _put( messages, size, n, status, i, ( values == NULL ) ? 0 : values[i] ) ) return 1;
+    }
+  }
+  return 0;
+}
+
+/** @} @endcond */
+
+/* MARK: Creation and destruction *//**
+ * @name Creation and destruction
+ * Creating, destroying and reference counting of MIDIStateTracker objects.
+ * @{
+ */
+
+/**
+ * @brief Create a MIDIStateTracker instance.
+ * Allocate space and initialize a state tracker without held notes
+ * or changed controls.
+ * @public @memberof MIDIStateTracker
+ * @return a pointer to the created state tracker on success.
+ * @return a @c NULL pointer if the state tracker could not be created.
+ */
+struct MIDIStateTracker * MIDIStateTrackerCreate( void ) {
+  struct MIDIStateTracker * tracker = malloc( sizeof( struct MIDIStateTracker ) );
+  MIDIPrecondReturn( tracker != NULL, ENOMEM, NULL );
+  tracker->refs = 1;
+  MIDIStateTrackerReset( tracker );
+  return tracker;
+}
+
+/**
+ * @brief Destroy a MIDIStateTracker instance.
+ * Free all resources occupied by the state tracker.
+ * @public @memberof MIDIStateTracker
+ * @param tracker The state tracker.
+ */
+void MIDIStateTrackerDestroy( struct MIDIStateTracker * tracker ) {
+  MIDIPrecondReturn( tracker != NULL, EFAULT, (void)0 );
+  free( tracker );
+}
+
+/**
+ * @brief Retain a MIDIStateTracker instance.
+ * Increment the reference counter of a state tracker so that it won't be destroyed.
+ * @public @memberof MIDIStateTracker
+ * @param tracker The state tracker.
+ */
+void MIDIStateTrackerRetain( struct MIDIStateTracker * tracker ) {
+  MIDIPrecondReturn( tracker != NULL, EFAULT, (void)0 );
+  MIDIRefRetain( tracker->refs );
+}
+
+/**
+ * @brief Release a MIDIStateTracker instance.
+ * Decrement the reference counter of a state tracker. If the reference
+ * count reached zero, destroy the state tracker.
+ * @public @memberof MIDIStateTracker
+ * @param tracker The state tracker.
+ */
+void MIDIStateTrackerRelease( struct MIDIStateTracker * tracker ) {
+  MIDIPrecondReturn( tracker != NULL, EFAULT, (void)0 );
+  if( ! MIDIRefRelease( tracker->refs ) ) {
+    MIDIStateTrackerDestroy( tracker );
+  }
+}
+
+/** @} */
+
+/* MARK: State updates *//**
+ * @name State updates
+ * Record channel messages.
+ * @{
+ */
+
+/**
+ * @brief Forget the complete state.
+ * Forget all held notes, controls and programs and center the pitch wheels.
+ * @public @memberof MIDIStateTracker
+ * @param tracker The state tracker.
+ * @retval 0 on success.
+ */
+int MIDIStateTrackerReset( struct MIDIStateTracker * tracker ) {
+  int c, refs;
+  MIDIPrecond( tracker != NULL, EFAULT );
+  refs = tracker->refs;
+  memset( tracker, 0, sizeof( struct MIDIStateTracker ) );
+  tracker->refs = refs;
+  for( c=0; c<N_CHANNEL; c++ ) {
+    tracker->pitch_wheel[c] = PITCH_WHEEL_CENTER;
+  }
+  return 0;
+}
+
+/**
+ * @brief Forget all held notes.
+ * Call this after the note offs returned by MIDIStateTrackerEmitNotesOff
+ * were sent somewhere the tracker does not see them.
+ * @public @memberof MIDIStateTracker
+ * @param tracker The state tracker.
+ * @retval 0 on success.
+ */
+int MIDIStateTrackerClearNotes( struct MIDIStateTracker * tracker ) {
+  MIDIPrecond( tracker != NULL, EFAULT );
+  memset( &(tracker->notes[0][0]), 0, sizeof(tracker->notes) );
+  tracker->note_channels = 0;
+  tracker->active = 0;
+  return 0;
+}
+
+/**
+ * @brief Record a "Note Off" message.
+ * @public @memberof MIDIStateTracker
+ * @param tracker The state tracker.
+ * @param channel The channel.
+ * @param key     The key that ended.
+ * @retval 0 on success.
+ */
+int MIDIStateTrackerNoteOff( struct MIDIStateTracker * tracker, MIDIChannel channel, MIDIKey key ) {
+  MIDIPrecond( tracker != NULL, EFAULT );
+  MIDIPrecond( channel >= MIDI_CHANNEL_1 && channel <= MIDI_CHANNEL_16, EINVAL );
+  MIDIPrecond( key >= 0, EINVAL );
+  _note( tracker, channel & 0xf, key & 0x7f, 0 );
+  return 0;
+}
+
+/**
+ * @brief Record a "Note On" message.
+ * A velocity of zero ends the note.
+ * @public @memberof MIDIStateTracker
+ * @param tracker  The state tracker.
+ * @param channel  The channel.
+ * @param key      The key that was played.
+ * @param velocity The velocity.
+ * @retval 0 on success.
+ */
+int MIDIStateTrackerNoteOn( struct MIDIStateTracker * tracker, MIDIChannel channel, MIDIKey key, MIDIVelocity velocity ) {
+  MIDIPrecond( tracker != NULL, EFAULT );
+  MIDIPrecond( channel >= MIDI_CHANNEL_1 && channel <= MIDI_CHANNEL_16, EINVAL );
+  MIDIPrecond( key >= 0 && velocity >= 0, EINVAL );
+  _note( tracker, channel & 0xf, key & 0x7f, velocity & 0x7f );
+  return 0;
+}
+
+/**
+ * @brief Record a "Control Change" message.
+ * @public @memberof MIDIStateTracker
+ * @param tracker The state tracker.
+ * @param channel The channel.
+ * @param control The control that was changed.
+ * @param value   The new value of the control.
+ * @retval 0 on success.
+ */
+int MIDIStateTrackerControlChange( struct MIDIStateTracker * tracker, MIDIChannel channel, MIDIControl control, MIDIValue value ) {
+  MIDIPrecond( tracker != NULL, EFAULT );
+  MIDIPrecond( channel >= MIDI_CHANNEL_1 && channel <= MIDI_CHANNEL_16, EINVAL );
+  MIDIPrecond( control >= 0 && value >= 0, EINVAL );
+  _control( tracker, channel & 0xf, control & 0x7f, value & 0x7f );
+  return 0;
+}
+
+/**
+ * @brief Record a "Program Change" message.
+ * @public @memberof MIDIStateTracker
+ * @param tracker The state tracker.
+ * @param channel The channel.
+ * @param program The new program.
+ * @retval 0 on success.
+ */
+int MIDIStateTrackerProgramChange( struct MIDIStateTracker * tracker, MIDIChannel channel, MIDIProgram program ) {
+  MIDIPrecond( tracker != NULL, EFAULT );
+  MIDIPrecond( channel >= MIDI_CHANNEL_1 && channel <= MIDI_CHANNEL_16, EINVAL );
+  MIDIPrecond( program >= 0, EINVAL );
+  tracker->program[channel & 0xf] = program & 0x7f;
+  tracker->program_channels |= 1 << ( channel & 0xf );
+  return 0;
+}
+
+/**
+ * @brief Record a "Pitch Wheel Change" message.
+ * @public @memberof MIDIStateTracker
+ * @param tracker The state tracker.
+ * @param channel The channel.
+ * @param value   The new pitch wheel position.
+ * @retval 0 on success.
+ */
+int MIDIStateTrackerPitchWheelChange( struct MIDIStateTracker * tracker, MIDIChannel channel, MIDILongValue value ) {
+  MIDIPrecond( tracker != NULL, EFAULT );
+  MIDIPrecond( channel >= MIDI_CHANNEL_1 && channel <= MIDI_CHANNEL_16, EINVAL );
+  MIDIPrecond( value >= 0 && value <= 0x3fff, EINVAL );
+  tracker->pitch_wheel[channel & 0xf] = value;
+  tracker->pitch_wheel_channels |= 1 << ( channel & 0xf );
+  return 0;
+}
+
+/**
+ * @brief Record a block of compact messages.
+ * Messages that do not change the tracked state, including all system
+ * messages, are skipped.
+ * @public @memberof MIDIStateTracker
+ * @param tracker  The state tracker.
+ * @param count    The number of messages.
+ * @param messages The messages.
+ * @retval 0 on success.
+ */
+int MIDIStateTrackerUpdate( struct MIDIStateTracker * tracker, size_t count, struct MIDICompactMessage * messages ) {
+  unsigned char * m;
+  size_t i;
+  int c;
+  MIDIPrecond( tracker != NULL, EFAULT );
+  MIDIPrecond( count == 0 || messages != NULL, EINVAL );
+  for( i=0; i<count; i++ ) {
+    m = &(messages[i].bytes[0]);
+    c = MIDI_LOW_NIBBLE(m[0]);
+    switch( MIDI_HIGH_NIBBLE(m[0]) ) {
+      case MIDI_STATUS_NOTE_OFF:
+        _note( tracker, c, m[1] & 0x7f, 0 );
+        break;
+      case MIDI_STATUS_NOTE_ON:
+        _note( tracker, c, m[1] & 0x7f, m[2] & 0x7f );
+        break;
+      case MIDI_STATUS_CONTROL_CHANGE:
+        _control( tracker, c, m[1] & 0x7f, m[2] & 0x7f );
+        break;
+      case MIDI_STATUS_PROGRAM_CHANGE:
+        tracker->program[c] = m[1] & 0x7f;
+        tracker->program_channels |= 1 << c;
+        break;
+      case MIDI_STATUS_PITCH_WHEEL_CHANGE:
+        tracker->pitch_wheel[c] = MIDI_LONG_VALUE( m[2], m[1] );
+        tracker->pitch_wheel_channels |= 1 << c;
+        break;
+      default:
+        break;
+    }
+  }
+  return 0;
+}
+
+/** @} */
+
+/* MARK: State access *//**
+ * @name State access
+ * Query the tracked state.
+ * @{
+ */
+
+/**
+ * @brief Get the number of held notes.
+ * @public @memberof MIDIStateTracker
+ * @param tracker The state tracker.
+ * @param count   The number of held notes on all channels.
+ * @retval 0 on success.
+ */
+int MIDIStateTrackerGetActiveNotes( struct MIDIStateTracker * tracker, size_t * count ) {
+  MIDIPrecond( tracker != NULL, EFAULT );
+  MIDIPrecond( count != NULL, EINVAL );
+  *count = tracker->active;
+  return 0;
+}
+
+/**
+ * @brief Get the velocity of a note.
+ * @public @memberof MIDIStateTracker
+ * @param tracker  The state tracker.
+ * @param channel  The channel.
+ * @param key      The key.
+ * @param velocity The velocity the note was played with, zero if the
+ *                 note is not held.
+ * @retval 0 on success.
+ */
+int MIDIStateTrackerGetNote( struct MIDIStateTracker * tracker, MIDIChannel channel, MIDIKey key, MIDIVelocity * velocity ) {
+  int c = channel & 0xf, k = key & 0x7f;
+  MIDIPrecond( tracker != NULL, EFAULT );
+  MIDIPrecond( channel >= MIDI_CHANNEL_1 && channel <= MIDI_CHANNEL_16, EINVAL );
+  MIDIPrecond( key >= 0 && velocity != NULL, EINVAL );
+  *velocity = ( tracker->notes[c][k >> 6] & ( 1ULL << ( k & 63 ) ) ) ? tracker->velocity[c][k] : 0;
+  return 0;
+}
+
+/**
+ * @brief Get the last value of a control.
+ * @public @memberof MIDIStateTracker
+ * @param tracker The state tracker.
+ * @param channel The channel.
+ * @param control The control.
+ * @param value   The last value of the control.
+ * @retval 0 on success.
+ * @retval 1 if the control was not changed since it was last reset.
+ */
+int MIDIStateTrackerGetControl( struct MIDIStateTracker * tracker, MIDIChannel channel, MIDIControl control, MIDIValue * value ) {
+  int c = channel & 0xf, i = control & 0x7f;
+  MIDIPrecond( tracker != NULL, EFAULT );
+  MIDIPrecond( channel >= MIDI_CHANNEL_1 && channel <= MIDI_CHANNEL_16, EINVAL );
+  MIDIPrecond( control >= 0 && value != NULL, EINVAL );
+  if( !( tracker->controls[c][i >> 6] & ( 1ULL << ( i & 63 ) ) ) ) return 1;
+  *value = tracker->control[c][i];
+  return 0;
+}
+
+/**
+ * @brief Get the current program of a channel.
+ * @public @memberof MIDIStateTracker
+ * @param tracker The state tracker.
+ * @param channel The channel.
+ * @param program The program.
+ * @retval 0 on success.
+ * @retval 1 if no program change was recorded for the channel.
+ */
+int MIDIStateTrackerGetProgram( struct MIDIStateTracker * tracker, MIDIChannel channel, MIDIProgram * program ) {
+  MIDIPrecond( tracker != NULL, EFAULT );
+  MIDIPrecond( channel >= MIDI_CHANNEL_1 && channel <= MIDI_CHANNEL_16, EINVAL );
+  MIDIPrecond( program != NULL, EINVAL );
+  if( !( tracker->program_channels & ( 1 << ( channel & 0xf ) ) ) ) return 1;
+  *program = tracker->program[channel & 0xf];
+  return 0;
+}
+
+/**
+ * @brief Get the pitch wheel position of a channel.
+ * @public @memberof MIDIStateTracker
+ * @param tracker The state tracker.
+ * @param channel The channel.
+ * @param value   The pitch wheel position, centered (@c 0x2000) if the
+ *                wheel was not moved.
+ * @retval 0 on success.
+ */
+int MIDIStateTrackerGetPitchWheel( struct MIDIStateTracker * tracker, MIDIChannel channel, MIDILongValue * value ) {
+  MIDIPrecond( tracker != NULL, EFAULT );
+  MIDIPrecond( channel >= MIDI_CHANNEL_1 && channel <= MIDI_CHANNEL_16, EINVAL );
+  MIDIPrecond( value != NULL, EINVAL );
+  *value = tracker->pitch_wheel[channel & 0xf];
+  return 0;
+}
+
+/** @} */
+
+/* MARK: Message output *//**
+ * @name Message output
+ * Turn the tracked state into compact messages.
+ * @{
+ */
+
+/**
+ * @brief Emit note offs for all held notes.
+ * Write one "Note Off" message with zero velocity for every held note,
+ * grouped by channel so that they can be sent with running status. Only
+ * channels with held notes and the set bits of their key sets are visited.
+ * The state is not changed, see MIDIStateTrackerClearNotes.
+ * @public @memberof MIDIStateTracker
+ * @param tracker  The state tracker.
+ * @param size     The size of the message array. At most
+ *                 @c MIDI_STATE_TRACKER_MAX_NOTES messages are written.
+ * @param messages The message array.
+ * @param count    The number of messages that were written.
+ * @retval 0 on success.
+ * @retval 1 if the message array was too small for all notes.
+ */
+int MIDIStateTrackerEmitNotesOff( struct MIDIStateTracker * tracker, size_t size,
+                                  struct MIDICompactMessage * messages, size_t * count ) {
+  unsigned int channels;
+  int c;
+  MIDIPrecond( tracker != NULL, EFAULT );
+  MIDIPrecond( size == 0 || messages != NULL, EINVAL );
+  MIDIPrecond( count != NULL, EINVAL );
+  *count = 0;
+  for( channels = tracker->note_channels; channels; channels &= channels - 1 ) {
+    c = _ctz( channels );
+    if( _put_bits( tracker->notes[c], NULL, ( MIDI_STATUS_NOTE_OFF << 4 ) | c, messages, size, count ) ) return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Emit a snapshot of the tracked state.
+ * Write the messages that bring a receiver that just joined into the
+ * tracked state. For each channel the changed controls are written first,
+ * so that a bank select precedes the program change, followed by the
+ * program change, the pitch wheel position and a "Note On" message for
+ * every held note.
+ * @public @memberof MIDIStateTracker
+ * @param tracker  The state tracker.
+ * @param size     The size of the message array. At most
+ *                 @c MIDI_STATE_TRACKER_MAX_SNAPSHOT messages are written.
+ * @param messages The message array.
+ * @param count    The number of messages that were written.
+ * @retval 0 on success.
+ * @retval 1 if the message array was too small for the snapshot.
+ */
+int MIDIStateTrackerEmitSnapshot( struct MIDIStateTracker * tracker, size_t size,
+                                  struct MIDICompactMessage * messages, size_t * count ) {
+  unsigned int channels;
+  MIDILongValue v;
+  int c;
+  MIDIPrecond( tracker != NULL, EFAULT );
+  MIDIPrecond( size == 0 || messages != NULL, EINVAL );
+  MIDIPrecond( count != NULL, EINVAL );
+  *count = 0;
+  channels = tracker->note_channels | tracker->control_channels
+           | tracker->program_channels | tracker->pitch_wheel_channels;
+  for( ; channels; channels &= channels - 1 ) {
+    c = _ctz( channels );
+    if( _put_bits( tracker->controls[c], tracker->control[c], ( MIDI_STATUS_CONTROL_CHANGE << 4 ) | c,
+                   messages, size, count ) ) return 1;
+    if( tracker->program_channels & ( 1 << c ) ) {
+      if( _put( messages, size, count, ( MIDI_STATUS_PROGRAM_CHANGE << 4 ) | c, tracker->program[c], 0 ) ) return 1;
+    }
+    if( tracker->pitch_wheel_channels & ( 1 << c ) ) {
+      v = tracker->pitch_wheel[c];
+      if( _put( messages, size, count, ( MIDI_STATUS_PITCH_WHEEL_CHANGE << 4 ) | c, MIDI_LSB(v), MIDI_MSB(v) ) ) return 1;
+    }
+    if( _put_bits( tracker->notes[c], tracker->velocity[c], ( MIDI_STATUS_NOTE_ON << 4 ) | c,
+                   messages, size, count ) ) return 1;
+  }
+  return 0;
+}
+
+/** @} */
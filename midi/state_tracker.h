@@ -0,0 +1,43 @@
+#ifndef MIDIKIT_MIDI_STATE_TRACKER_H
+#define MIDIKIT_MIDI_STATE_TRACKER_H
+#include "midi.h"
+
+struct MIDICompactMessage;
+
+/**
+ * @brief Maximum number of messages of a state snapshot.
+ * 120 control changes (without channel mode messages), one program
+ * change, one pitch wheel change and 128 notes for each of 16 channels.
+ */
+#define MIDI_STATE_TRACKER_MAX_SNAPSHOT ( 16 * ( 120 + 1 + 1 + 128 ) )
+#define MIDI_STATE_TRACKER_MAX_NOTES    ( 16 * 128 )
+
+struct MIDIStateTracker;
+
+struct MIDIStateTracker * MIDIStateTrackerCreate( void );
+void MIDIStateTrackerDestroy( struct MIDIStateTracker * tracker );
+void MIDIStateTrackerRetain( struct MIDIStateTracker * tracker );
+void MIDIStateTrackerRelease( struct MIDIStateTracker * tracker );
+
+int MIDIStateTrackerReset( struct MIDIStateTracker * tracker );
+int MIDIStateTrackerClearNotes( struct MIDIStateTracker * tracker );
+
+int MIDIStateTrackerNoteOff( struct MIDIStateTracker * tracker, MIDIChannel channel, MIDIKey key );
+int MIDIStateTrackerNoteOn( struct MIDIStateTracker * tracker, MIDIChannel channel, MIDIKey key, MIDIVelocity velocity );
+int MIDIStateTrackerControlChange( struct MIDIStateTracker * tracker, MIDIChannel channel, MIDIControl control, MIDIValue value );
+int MIDIStateTrackerProgramChange( struct MIDIStateTracker * tracker, MIDIChannel channel, MIDIProgram program );
+int MIDIStateTrackerPitchWheelChange( struct MIDIStateTracker * tracker, MIDIChannel channel, MIDILongValue value );
+int MIDIStateTrackerUpdate( struct MIDIStateTracker * tracker, size_t count, struct MIDICompactMessage * messages );
+
+int MIDIStateTrackerGetActiveNotes( struct MIDIStateTracker * tracker, size_t * count );
+int MIDIStateTrackerGetNote( struct MIDIStateTracker * tracker, MIDIChannel channel, MIDIKey key, MIDIVelocity * velocity );
+int MIDIStateTrackerGetControl( struct MIDIStateTracker * tracker, MIDIChannel channel, MIDIControl control, MIDIValue * value );
+int MIDIStateTrackerGetProgram( struct MIDIStateTracker * tracker, MIDIChannel channel, MIDIProgram * program );
+int MIDIStateTrackerGetPitchWheel( struct MIDIStateTracker * tracker, MIDIChannel channel, MIDILongValue * value );
+
+int MIDIStateTrackerEmitNotesOff( struct MIDIStateTracker * tracker, size_t size,
+                                  struct MIDICompactMessage * messages, size_t * count );
+int MIDIStateTrackerEmitSnapshot( struct MIDIStateTracker * tracker, size_t size,
+                                  struct MIDICompactMessage * messages, size_t * count );
+
+#endif
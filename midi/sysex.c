@@ -0,0 +1,363 @@
+#include <stdlib.h>
+#include "sysex.h"
+
+/**
+ * @brief Initial capacity of the assembly buffer.
+ */
+#define MIDI_SYSEX_BUFFER_SIZE 256
+
+/**
+ * @ingroup MIDI
+ * @brief Incremental reassembly of system exclusive messages.
+ * An assembler collects the segments of one system exclusive message
+ * at a time, as they are delivered by RTP-MIDI packets or by decoding
+ * a raw byte stream in pieces. Use one assembler per input source.
+ *
+ * By default the segments are appended to a growable MIDISysExBuffer,
+ * which is handed over to a MIDIMessage without copying once the
+ * message is complete. If a MIDIMessagePool is set, the buffers and
+ * messages are taken from the pool, so a receive path that reassembles
+ * dumps all the time reuses the buffers of the messages it delivered. If a chunk callback is set the segments are
+ * passed on as they arrive instead and nothing is buffered, so very
+ * large dumps can be written out while they are still coming in.
+ *
+ * Messages that grow past the maximum size are cancelled.
+ */
+struct MIDISysExAssembler {
+/**
+ * @privatesection
+ * @cond INTERNALS
+ */
+  int    refs;
+  size_t max_size;
+  size_t size;
+  int    active;
+  struct MIDISysExBuffer * buffer;
+  struct MIDIMessagePool * pool;
+  void * info;
+  MIDISysExChunkFn * callback;
+/** @endcond */
+};
+
+/* MARK: Internals *//**
+ * @name Internals
+ * @cond INTERNALS
+ * @{
+ */
+
+/**
+ * @brief Drop the message that is being assembled.
+ * Tell the chunk callback (if any) that the message was cancelled and
+ * keep the buffer for the next message.
+ * @private @memberof MIDISysExAssembler
+ * @param assembler The assembler.
+ */
+static void _cancel( struct MIDISysExAssembler * assembler ) {
+  if( ! assembler->active ) return;
+  assembler->active = 0;
+  assembler->size   = 0;
+  if( assembler->callback != NULL ) {
+    (*assembler->callback)( assembler->info, MIDI_COMPACT_SYSEX_CANCEL, 0, NULL );
+  }
+  if( assembler->buffer != NULL ) {
+    MIDISysExBufferSetSize( assembler->buffer, 0 );
+  }
+}
+
+/**
+ * @brief Create a message from the complete buffer.
+ * The message references the buffer, the assembler starts the next
+ * message with a new buffer.
+ * @private @memberof MIDISysExAssembler
+ * @param assembler The assembler.
+ * @param message   The created message.
+ * @retval 0  on success.
+ * @retval >0 if the message could not be created.
+ */
+static int _complete( struct MIDISysExAssembler * assembler, struct MIDIMessage ** message ) {
+  static unsigned char eox = MIDI_STATUS_END_OF_EXCLUSIVE;
+  MIDIManufacturerId manufacturer_id = 0;
+  unsigned char * payload;
+  void * data;
+  size_t size, offset = 0;
+  int result;
+
+  /* keep the terminator like MIDIMessageDecode does */
+  if( MIDISysExBufferAppend( &(assembler->buffer), 1, &eox ) ) return 1;
+  MIDISysExBufferGetData( assembler->buffer, &size, &data );
+  payload = data;
+  if( size >= 4 && payload[0] == 0 ) {
+    /* extended manufacturer id */
+    manufacturer_id = ( payload[1] << 8 ) | payload[2] | 0x80;
+    offset = 3;
+  } else if( size >= 2 ) {
+    manufacturer_id = payload[0];
+    offset = 1;
+  }
+
+  *message = MIDIMessageCreateFromPool( assembler->pool, MIDI_STATUS_SYSTEM_EXCLUSIVE );
+  if( *message == NULL ) return 1;
+  result  = MIDIMessageSet( *message, MIDI_MANUFACTURER_ID, sizeof(MIDIManufacturerId), &manufacturer_id );
+  result += MIDIMessageSetSysExBuffer( *message, assembler->buffer, offset, size - offset );
+  MIDISysExBufferRelease( assembler->buffer );
+  assembler->buffer = NULL;
+  if( result != 0 ) {
+    MIDIMessageRelease( *message );
+    *message = NULL;
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @}
+ * @endcond
+ */
+
+/* MARK: -
+ * MARK: Creation and destruction *//**
+ * @name Creation and destruction
+ * Creating, destroying and reference counting of MIDISysExAssembler objects.
+ * @{
+ */
+
+/**
+ * @brief Create a MIDISysExAssembler instance.
+ * @public @memberof MIDISysExAssembler
+ * @param max_size The maximum size of a message in bytes or 0 for no limit.
+ * @return a pointer to the created assembler structure on success.
+ * @return a @c NULL pointer if the assembler could not created.
+ */
+struct MIDISysExAssembler * MIDISysExAssemblerCreate( size_t max_size ) {
+  struct MIDISysExAssembler * assembler = malloc( sizeof( struct MIDISysExAssembler ) );
+  MIDIPrecondReturn( assembler != NULL, ENOMEM, NULL );
+  assembler->refs     = 1;
+  assembler->max_size = max_size;
+  assembler->size     = 0;
+  assembler->active   = 0;
+  assembler->buffer   = NULL;
+  assembler->pool     = NULL;
+  assembler->info     = NULL;
+  assembler->callback = NULL;
+  return assembler;
+}
+
+/**
+ * @brief Destroy a MIDISysExAssembler instance.
+ * Drop the message that is being assembled and free all resources.
+ * @public @memberof MIDISysExAssembler
+ * @param assembler The assembler.
+ */
+void MIDISysExAssemblerDestroy( struct MIDISysExAssembler * assembler ) {
+  MIDIPrecondReturn( assembler != NULL, EFAULT, (void)0 );
+  _cancel( assembler );
+  if( assembler->buffer != NULL ) {
+    MIDISysExBufferRelease( assembler->buffer );
+  }
+  if( assembler->pool != NULL ) {
+    MIDIMessagePoolRelease( assembler->pool );
+  }
+  free( assembler );
+}
+
+/**
+ * @brief Retain a MIDISysExAssembler instance.
+ * @public @memberof MIDISysExAssembler
+ * @param assembler The assembler.
+ */
+void MIDISysExAssemblerRetain( struct MIDISysExAssembler * assembler ) {
+  MIDIPrecondReturn( assembler != NULL, EFAULT, (void)0 );
+  MIDIRefRetain( assembler->refs );
+}
+
+/**
+ * @brief Release a MIDISysExAssembler instance.
+ * @public @memberof MIDISysExAssembler
+ * @param assembler The assembler.
+ */
+void MIDISysExAssemblerRelease( struct MIDISysExAssembler * assembler ) {
+  MIDIPrecondReturn( assembler != NULL, EFAULT, (void)0 );
+  if( ! MIDIRefRelease( assembler->refs ) ) {
+    MIDISysExAssemblerDestroy( assembler );
+  }
+}
+
+/** @} */
+
+/* MARK: Properties *//**
+ * @name Properties
+ * @{
+ */
+
+/**
+ * @brief Stream segments to a callback instead of buffering them.
+ * The callback is called for every segment with the flags
+ * @c MIDI_COMPACT_SYSEX_START and @c MIDI_COMPACT_SYSEX_END for the
+ * first and the last segment and with @c MIDI_COMPACT_SYSEX_CANCEL if
+ * the message was cancelled. The data of the first segment starts with
+ * the manufacturer id, the status bytes are not passed on.
+ * Pass a @c NULL callback to go back to buffering.
+ * @public @memberof MIDISysExAssembler
+ * @param assembler The assembler.
+ * @param info      The first argument of the callback.
+ * @param callback  The callback or @c NULL.
+ * @retval 0 on success.
+ */
+int MIDISysExAssemblerSetChunkCallback( struct MIDISysExAssembler * assembler, void * info, MIDISysExChunkFn * callback ) {
+  MIDIPrecond( assembler != NULL, EFAULT );
+  _cancel( assembler );
+  assembler->info     = info;
+  assembler->callback = callback;
+  return 0;
+}
+
+/**
+ * @brief Take buffers and messages from a pool.
+ * The buffer of the message that is being assembled is kept, the next
+ * message is assembled in a buffer from the pool. The assembler must be
+ * used by the thread that creates the pool's messages.
+ * @public @memberof MIDISysExAssembler
+ * @param assembler The assembler.
+ * @param pool      The pool or @c NULL to allocate on the heap.
+ * @retval 0 on success.
+ */
+int MIDISysExAssemblerSetPool( struct MIDISysExAssembler * assembler, struct MIDIMessagePool * pool ) {
+  MIDIPrecond( assembler != NULL, EFAULT );
+  if( pool != NULL ) MIDIMessagePoolRetain( pool );
+  if( assembler->pool != NULL ) MIDIMessagePoolRelease( assembler->pool );
+  assembler->pool = pool;
+  return 0;
+}
+
+/**
+ * @brief Get the number of bytes of the message that is being assembled.
+ * @public @memberof MIDISysExAssembler
+ * @param assembler The assembler.
+ * @param size      The size.
+ * @retval 0 on success.
+ */
+int MIDISysExAssemblerGetSize( struct MIDISysExAssembler * assembler, size_t * size ) {
+  MIDIPrecond( assembler != NULL, EFAULT );
+  MIDIPrecond( size != NULL, EINVAL );
+  *size = assembler->size;
+  return 0;
+}
+
+/** @} */
+
+/* MARK: Assembly *//**
+ * @name Assembly
+ * @{
+ */
+
+/**
+ * @brief Append a segment of a system exclusive message.
+ * A segment with the @c MIDI_COMPACT_SYSEX_START flag starts a new
+ * message and cancels an unfinished one. Segments without a started
+ * message are ignored. When a segment with the @c MIDI_COMPACT_SYSEX_END
+ * flag completes the message and no chunk callback is set, the message
+ * is stored in @c message and has to be released by the caller.
+ * @public @memberof MIDISysExAssembler
+ * @param assembler The assembler.
+ * @param flags     The @c MIDI_COMPACT_SYSEX_* flags of the segment.
+ * @param size      The size of the segment.
+ * @param data      The segment without status bytes.
+ * @param message   The completed message or @c NULL. May be @c NULL.
+ * @retval 0  on success.
+ * @retval >0 if the message grew too large or could not be stored and
+ *            was cancelled.
+ */
+int MIDISysExAssemblerAppend( struct MIDISysExAssembler * assembler, int flags, size_t size, unsigned char * data,
+                              struct MIDIMessage ** message ) {
+  struct MIDIMessage * complete = NULL;
+  int result = 0;
+  MIDIPrecond( assembler != NULL, EFAULT );
+  MIDIPrecond( data != NULL || size == 0, EINVAL );
+  if( message != NULL ) *message = NULL;
+
+  if( flags & MIDI_COMPACT_SYSEX_START ) {
+    _cancel( assembler );
+    assembler->active = 1;
+  }
+  if( ! assembler->active ) return 0;
+  if( flags & MIDI_COMPACT_SYSEX_CANCEL ) {
+    _cancel( assembler );
+    return 0;
+  }
+  if( assembler->max_size > 0 && assembler->size + size > assembler->max_size ) {
+    _cancel( assembler );
+    return 1;
+  }
+  assembler->size += size;
+
+  if( assembler->callback != NULL ) {
+    result = (*assembler->callback)( assembler->info, flags & ( MIDI_COMPACT_SYSEX_START | MIDI_COMPACT_SYSEX_END ),
+                                     size, data );
+  } else {
+    if( assembler->buffer == NULL ) {
+      assembler->buffer = MIDISysExBufferCreateFromPool( assembler->pool, MIDI_SYSEX_BUFFER_SIZE );
+      if( assembler->buffer == NULL ) {
+        _cancel( assembler );
+        return 1;
+      }
+      MIDISysExBufferSetSize( assembler->buffer, 0 );
+    }
+    if( MIDISysExBufferAppend( &(assembler->buffer), size, data ) ) {
+      _cancel( assembler );
+      return 1;
+    }
+  }
+
+  if( flags & MIDI_COMPACT_SYSEX_END ) {
+    assembler->active = 0;
+    assembler->size   = 0;
+    if( assembler->callback == NULL ) {
+      result = _complete( assembler, &complete );
+      if( message != NULL ) {
+        *message = complete;
+      } else if( complete != NULL ) {
+        MIDIMessageRelease( complete );
+      }
+    }
+  }
+  return result;
+}
+
+/**
+ * @brief Append a segment decoded from a byte stream.
+ * Compact messages that are not system exclusive segments, like
+ * real-time messages that interrupt a segment, are ignored.
+ * @public @memberof MIDISysExAssembler
+ * @param assembler The assembler.
+ * @param compact   The segment.
+ * @param buffer    The buffer the segment was decoded from.
+ * @param message   The completed message or @c NULL. May be @c NULL.
+ * @retval 0  on success.
+ * @retval >0 if the message grew too large or could not be stored and
+ *            was cancelled.
+ * @see MIDIMessageDecodeStream
+ */
+int MIDISysExAssemblerAppendCompact( struct MIDISysExAssembler * assembler, struct MIDICompactMessage * compact,
+                                     unsigned char * buffer, struct MIDIMessage ** message ) {
+  MIDIPrecond( assembler != NULL, EFAULT );
+  MIDIPrecond( compact != NULL, EINVAL );
+  if( message != NULL ) *message = NULL;
+  if( compact->bytes[0] != MIDI_STATUS_SYSTEM_EXCLUSIVE ) return 0;
+  MIDIPrecond( buffer != NULL || compact->sysex_size == 0, EINVAL );
+  return MIDISysExAssemblerAppend( assembler, compact->flags, compact->sysex_size,
+                                   ( buffer != NULL ) ? buffer + compact->sysex_offset : NULL, message );
+}
+
+/**
+ * @brief Cancel the message that is being assembled.
+ * @public @memberof MIDISysExAssembler
+ * @param assembler The assembler.
+ * @retval 0 on success.
+ */
+int MIDISysExAssemblerCancel( struct MIDISysExAssembler * assembler ) {
+  MIDIPrecond( assembler != NULL, EFAULT );
+  _cancel( assembler );
+  return 0;
+}
+
+/** @} */
@@ -0,0 +1,25 @@
+#ifndef MIDIKIT_MIDI_SYSEX_H
+#define MIDIKIT_MIDI_SYSEX_H
+#include "midi.h"
+#include "message.h"
+
+struct MIDISysExAssembler;
+
+typedef int MIDISysExChunkFn( void * info, int flags, size_t size, unsigned char * data );
+
+struct MIDISysExAssembler * MIDISysExAssemblerCreate( size_t max_size );
+void MIDISysExAssemblerDestroy( struct MIDISysExAssembler * assembler );
+void MIDISysExAssemblerRetain( struct MIDISysExAssembler * assembler );
+void MIDISysExAssemblerRelease( struct MIDISysExAssembler * assembler );
+
+int MIDISysExAssemblerSetChunkCallback( struct MIDISysExAssembler * assembler, void * info, MIDISysExChunkFn * callback );
+int MIDISysExAssemblerSetPool( struct MIDISysExAssembler * assembler, struct MIDIMessagePool * pool );
+int MIDISysExAssemblerGetSize( struct MIDISysExAssembler * assembler, size_t * size );
+
+int MIDISysExAssemblerAppend( struct MIDISysExAssembler * assembler, int flags, size_t size, unsigned char * data,
+                              struct MIDIMessage ** message );
+int MIDISysExAssemblerAppendCompact( struct MIDISysExAssembler * assembler, struct MIDICompactMessage * compact,
+                                     unsigned char * buffer, struct MIDIMessage ** message );
+int MIDISysExAssemblerCancel( struct MIDISysExAssembler * assembler );
+
+#endif
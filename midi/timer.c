@@ -3,54 +3,513 @@
 #include "timer.h"
 #include "clock.h"
 #include "message.h"
+#include "runloop.h"
 
+/* bandwidth of the tempo follower in radians per clock, lower values track
+ * tempo changes slower but let less of the incoming jitter through */
+#define MIDI_TIMER_FOLLOW_OMEGA 0.1
+#define MIDI_TIMER_SQRT2        1.41421356237309504880
+/* clocks that deviate from the prediction by more than this many periods
+ * restart the follower, e.g. after the clock source was paused */
+#define MIDI_TIMER_FOLLOW_RESET 2.0
+/* the generator skips ahead instead of catching up when it falls behind
+ * by more than this many clocks */
+#define MIDI_TIMER_MAX_LATE_CLOCKS 6
+
+/**
+ * @ingroup MIDI
+ * @brief MIDI clock generator and follower.
+ * The MIDITimer keeps track of the MIDI beat clock of a MIDIDevice. As a
+ * follower it estimates tempo and phase from incoming timing clock
+ * messages. The clock timestamps are smoothed with a second order delay
+ * locked loop, so that jitter in the arrival times does not show up in the
+ * estimated tempo.
+ * As a generator it sends 24 timing clocks per quarter note through the
+ * device, driven by a timer of a runloop source. Every clock is scheduled
+ * for an absolute deadline computed from the start of the generator and
+ * the clock count, so late wakeups do not accumulate into drift. The clocks
+ * carry their nominal deadline as timestamp.
+ */
 struct MIDITimer {
+/**
+ * @privatesection
+ * @cond INTERNALS
+ */
   int refs;
   struct MIDITimerDelegate * delegate;
+  struct MIDIClock * clock;
+  MIDIBoolean running;
+  unsigned long clocks;
   MIDILongValue song_position;
-  MIDILongValue beats_per_minute;
-  MIDITimestamp last_timestamp;
-  MIDITimestamp clocks[4];
+  double beats_per_minute;
+  unsigned long followed;
+  double period;
+  double last;
+  double next;
+  struct MIDIDevice * device;
+  struct MIDIRunloopSource * rls;
+  unsigned long handle;
+  double interval;
+  MIDITimestamp origin;
+  unsigned long ticks;
+/** @endcond */
 };
 
+/* MARK: Internals *//**
+ * @name Internals
+ * @cond INTERNALS
+ * Clock counting, tempo following and clock generation.
+ * @{
+ */
+
+/**
+ * @brief Get the number of clock ticks per MIDI clock at a given tempo.
+ * @private @memberof MIDITimer
+ * @param timer            The timer.
+ * @param beats_per_minute The tempo in quarter notes per minute.
+ * @return the number of ticks of the timer's clock.
+ */
+static double _interval( struct MIDITimer * timer, double beats_per_minute ) {
+  MIDISamplingRate rate;
+  MIDIClockGetSamplingRate( timer->clock, &rate );
+  return ( (double) rate * 60.0 ) / ( beats_per_minute * MIDI_CLOCKS_PER_QUARTER_NOTE );
+}
+
+/**
+ * @brief Count a timing clock.
+ * The song position is only advanced while the song is running.
+ * @private @memberof MIDITimer
+ * @param timer The timer.
+ */
+static void _advance( struct MIDITimer * timer ) {
+  if( timer->running == MIDI_OFF ) return;
+  timer->clocks++;
+  timer->song_position = ( timer->clocks / MIDI_CLOCKS_PER_BEAT ) & 0x3fff;
+}
+
+/**
+ * @brief Follow an incoming timing clock.
+ * Update the filtered time of the last clock, the prediction of the next
+ * clock and the period between clocks. The first two clocks after a reset
+ * initialize the loop, every further clock corrects the prediction by a
+ * fraction of the error.
+ * @private @memberof MIDITimer
+ * @param timer     The timer.
+ * @param timestamp The timestamp of the clock.
+ */
+static void _follow( struct MIDITimer * timer, MIDITimestamp timestamp ) {
+  double t = timestamp, error;
+  if( timer->followed >= 2 ) {
+    error = t - timer->next;
+    if( error <= timer->period * MIDI_TIMER_FOLLOW_RESET && -error <= timer->period * MIDI_TIMER_FOLLOW_RESET ) {
+      timer->last    = timer->next;
+      timer->next   += MIDI_TIMER_SQRT2 * MIDI_TIMER_FOLLOW_OMEGA * error + timer->period;
+      timer->period += MIDI_TIMER_FOLLOW_OMEGA * MIDI_TIMER_FOLLOW_OMEGA * error;
+      timer->followed++;
+      return;
+    }
+    timer->followed = 0;
+  }
+  if( timer->followed == 1 && t > timer->last ) {
+    timer->period   = t - timer->last;
+    timer->next     = t + timer->period;
+    timer->followed = 2;
+  } else {
+    timer->followed = 1;
+  }
+  timer->last = t;
+}
+
+/**
+ * @brief Get the offset of the next clock from the start of the generator.
+ * The offset is computed from the clock count, instead of adding up the
+ * rounded intervals, so that rounding errors do not accumulate.
+ * @private @memberof MIDITimer
+ * @param timer The timer.
+ * @return the offset in ticks of the timer's clock.
+ */
+static MIDITimestamp _offset( struct MIDITimer * timer ) {
+  return (MIDITimestamp) ( timer->ticks * timer->interval + 0.5 );
+}
+
+static int _generator_tick( void * info, struct timespec * now );
+
+/**
+ * @brief Arm the runloop timer for the next clock.
+ * @private @memberof MIDITimer
+ * @param timer The timer.
+ * @param now   The current time of the timer's clock.
+ * @retval 0 on success.
+ * @retval >0 if the timer could not be added.
+ */
+static int _generator_arm( struct MIDITimer * timer, MIDITimestamp now ) {
+  struct timespec delay;
+  MIDISamplingRate rate;
+  MIDITimestamp due = timer->origin + _offset( timer );
+  MIDITimestamp ticks = ( due > now ) ? due - now : 0;
+  MIDIClockGetSamplingRate( timer->clock, &rate );
+  delay.tv_sec  = ticks / rate;
+  delay.tv_nsec = ( ( ticks % rate ) * 1000000000LL ) / rate;
+  return MIDIRunloopSourceAddTimer( timer->rls, &delay, &_generator_tick, timer, &(timer->handle) );
+}
+
+/**
+ * @brief Runloop timer callback of the generator.
+ * Send the clock that is due with its nominal timestamp and arm the timer
+ * for the next one. If the runloop was blocked for a long time the
+ * generator restarts its schedule at the current time, instead of sending
+ * a burst of clocks.
+ * @private @memberof MIDITimer
+ * @param info The timer.
+ * @param now  The current time.
+ * @retval 0 on success.
+ */
+static int _generator_tick( void * info, struct timespec * now ) {
+  struct MIDITimer * timer = info;
+  MIDITimestamp t, due;
+  int result;
+  timer->handle = 0;
+  MIDIClockGetNow( timer->clock, &t );
+  due = timer->origin + _offset( timer );
+  if( t - due > MIDI_TIMER_MAX_LATE_CLOCKS * timer->interval ) {
+    timer->origin = due = t;
+    timer->ticks  = 0;
+  }
+  timer->ticks++;
+  result = MIDITimerSendRealTime( timer, timer->device, MIDI_STATUS_TIMING_CLOCK, due );
+  if( timer->rls == NULL ) return result;
+  return result + _generator_arm( timer, t );
+}
+
+/**
+ * @}
+ * @endcond
+ */
+
+/* MARK: Creation and destruction *//**
+ * @name Creation and destruction
+ * Creating, destroying and reference counting of MIDITimer objects.
+ * @{
+ */
+
+/**
+ * @brief Create a MIDITimer instance.
+ * Allocate space and initialize a MIDITimer instance. The timer uses the
+ * global clock and a tempo of 120 beats per minute.
+ * @public @memberof MIDITimer
+ * @param delegate The delegate to use for the timer. May be @c NULL.
+ * @return a pointer to the created timer structure on success.
+ * @return a @c NULL pointer if the timer could not created.
+ */
 struct MIDITimer * MIDITimerCreate( struct MIDITimerDelegate * delegate ) {
   struct MIDITimer * timer = malloc( sizeof( struct MIDITimer ) );
+  MIDIPrecondReturn( timer != NULL, ENOMEM, NULL );
   timer->refs = 1;
   timer->delegate         = delegate;
+  MIDIClockGetGlobalClock( &(timer->clock) );
+  MIDIClockRetain( timer->clock );
+  timer->running          = MIDI_OFF;
+  timer->clocks           = 0;
   timer->song_position    = 0;
   timer->beats_per_minute = 120;
-  timer->last_timestamp   = -1;
-  timer->clocks[0]        = -1;
-  timer->clocks[1]        = -1;
-  timer->clocks[2]        = -1;
-  timer->clocks[3]        = -1;
+  timer->followed         = 0;
+  timer->period           = _interval( timer, timer->beats_per_minute );
+  timer->last             = 0;
+  timer->next             = 0;
+  timer->device           = NULL;
+  timer->rls              = NULL;
+  timer->handle           = 0;
+  timer->interval         = timer->period;
+  timer->origin           = 0;
+  timer->ticks            = 0;
   return timer;
 }
 
+/**
+ * @brief Destroy a MIDITimer instance.
+ * Stop the generator and free all resources occupied by the timer.
+ * @public @memberof MIDITimer
+ * @param timer The timer.
+ */
 void MIDITimerDestroy( struct MIDITimer * timer ) {
+  MIDIPrecondReturn( timer != NULL, EFAULT, (void)0 );
+  MIDITimerStopGenerator( timer );
+  MIDIClockRelease( timer->clock );
   free( timer );
 }
 
+/**
+ * @brief Retain a MIDITimer instance.
+ * Increment the reference counter of a timer so that it won't be destroyed.
+ * @public @memberof MIDITimer
+ * @param timer The timer.
+ */
 void MIDITimerRetain( struct MIDITimer * timer ) {
-  timer->refs++;
+  MIDIPrecondReturn( timer != NULL, EFAULT, (void)0 );
+  MIDIRefRetain( timer->refs );
 }
 
+/**
+ * @brief Release a MIDITimer instance.
+ * Decrement the reference counter of a timer. If the reference count
+ * reached zero, destroy the timer.
+ * @public @memberof MIDITimer
+ * @param timer The timer.
+ */
 void MIDITimerRelease( struct MIDITimer * timer ) {
-  if( ! --timer->refs ) {
+  MIDIPrecondReturn( timer != NULL, EFAULT, (void)0 );
+  if( ! MIDIRefRelease( timer->refs ) ) {
     MIDITimerDestroy( timer );
   }
 }
 
+/** @} */
+
+/* MARK: Properties *//**
+ * @name Properties
+ * @{
+ */
+
+/**
+ * @brief Set the clock of the timer.
+ * Timestamps of received clocks and the generator's deadlines are
+ * measured with this clock. The follower restarts.
+ * @public @memberof MIDITimer
+ * @param timer The timer.
+ * @param clock The clock.
+ * @retval 0 on success.
+ * @retval >0 if the generator is running.
+ */
+int MIDITimerSetClock( struct MIDITimer * timer, struct MIDIClock * clock ) {
+  MIDIPrecond( timer != NULL, EFAULT );
+  MIDIPrecond( clock != NULL, EINVAL );
+  MIDIPrecond( timer->rls == NULL, EINVAL );
+  MIDIClockRetain( clock );
+  MIDIClockRelease( timer->clock );
+  timer->clock    = clock;
+  timer->followed = 0;
+  timer->interval = _interval( timer, timer->beats_per_minute );
+  timer->period   = timer->interval;
+  return 0;
+}
+
+/**
+ * @brief Get the clock of the timer.
+ * @public @memberof MIDITimer
+ * @param timer The timer.
+ * @param clock The clock.
+ * @retval 0 on success.
+ */
+int MIDITimerGetClock( struct MIDITimer * timer, struct MIDIClock ** clock ) {
+  MIDIPrecond( timer != NULL, EFAULT );
+  MIDIPrecond( clock != NULL, EINVAL );
+  *clock = timer->clock;
+  return 0;
+}
+
+/**
+ * @brief Set the tempo of the generator.
+ * If the generator is running, the clock that is due next keeps its
+ * deadline and all following clocks are scheduled at the new tempo.
+ * @public @memberof MIDITimer
+ * @param timer            The timer.
+ * @param beats_per_minute The tempo in quarter notes per minute.
+ * @retval 0 on success.
+ */
+int MIDITimerSetTempo( struct MIDITimer * timer, double beats_per_minute ) {
+  MIDIPrecond( timer != NULL, EFAULT );
+  MIDIPrecond( beats_per_minute > 0, EINVAL );
+  if( timer->rls != NULL ) {
+    timer->origin += _offset( timer );
+    timer->ticks   = 0;
+  }
+  timer->beats_per_minute = beats_per_minute;
+  timer->interval = _interval( timer, beats_per_minute );
+  return 0;
+}
+
+/**
+ * @brief Get the tempo.
+ * While the generator is running, this is the generator's tempo. Otherwise
+ * it is the tempo that was estimated from the received clocks, or the
+ * generator's tempo if no clocks were received yet.
+ * @public @memberof MIDITimer
+ * @param timer            The timer.
+ * @param beats_per_minute The tempo in quarter notes per minute.
+ * @retval 0 on success.
+ */
+int MIDITimerGetTempo( struct MIDITimer * timer, double * beats_per_minute ) {
+  MIDIPrecond( timer != NULL, EFAULT );
+  MIDIPrecond( beats_per_minute != NULL, EINVAL );
+  if( timer->rls != NULL || timer->followed < 2 ) {
+    *beats_per_minute = timer->beats_per_minute;
+  } else {
+    *beats_per_minute = timer->beats_per_minute * timer->interval / timer->period;
+  }
+  return 0;
+}
+
+/**
+ * @brief Get the phase within the current quarter note.
+ * The phase is interpolated between the last clock and the next one, so it
+ * advances smoothly between clocks. It only advances while the song is
+ * running.
+ * @public @memberof MIDITimer
+ * @param timer The timer.
+ * @param now   The current time of the timer's clock.
+ * @param phase The phase, between 0 (inclusive) and 1 (exclusive).
+ * @retval 0 on success.
+ */
+int MIDITimerGetPhase( struct MIDITimer * timer, MIDITimestamp now, double * phase ) {
+  double fraction = 0, period;
+  MIDIPrecond( timer != NULL, EFAULT );
+  MIDIPrecond( phase != NULL, EINVAL );
+  if( timer->clocks == 0 ) {
+    *phase = 0;
+    return 0;
+  }
+  /* the first clock after a start is the downbeat */
+  period = ( timer->rls != NULL ) ? timer->interval : timer->period;
+  if( timer->running == MIDI_ON ) {
+    fraction = ( now - timer->last ) / period;
+    if( fraction < 0 ) fraction = 0;
+    if( fraction > 1 ) fraction = 1;
+  }
+  *phase = ( ( ( timer->clocks - 1 ) % MIDI_CLOCKS_PER_QUARTER_NOTE ) + fraction ) / MIDI_CLOCKS_PER_QUARTER_NOTE;
+  if( *phase >= 1 ) *phase -= 1;
+  return 0;
+}
+
+/**
+ * @brief Get the song position.
+ * The song position counts sixteenth notes since the last start.
+ * @public @memberof MIDITimer
+ * @param timer         The timer.
+ * @param song_position The song position.
+ * @retval 0 on success.
+ */
+int MIDITimerGetSongPosition( struct MIDITimer * timer, MIDILongValue * song_position ) {
+  MIDIPrecond( timer != NULL, EFAULT );
+  MIDIPrecond( song_position != NULL, EINVAL );
+  *song_position = timer->song_position;
+  return 0;
+}
+
+/**
+ * @brief Check if the song is running.
+ * @public @memberof MIDITimer
+ * @param timer   The timer.
+ * @param running @c MIDI_ON after a start or continue message,
+ *                @c MIDI_OFF after a stop message.
+ * @retval 0 on success.
+ */
+int MIDITimerIsRunning( struct MIDITimer * timer, MIDIBoolean * running ) {
+  MIDIPrecond( timer != NULL, EFAULT );
+  MIDIPrecond( running != NULL, EINVAL );
+  *running = timer->running;
+  return 0;
+}
+
+/** @} */
+
+/* MARK: Clock generation *//**
+ * @name Clock generation
+ * @{
+ */
+
+/**
+ * @brief Start generating timing clocks.
+ * Send timing clocks through a device at the timer's tempo. The first
+ * clock is sent as soon as the runloop source is served. The timer does
+ * not retain the device, the generator has to be stopped before the device
+ * is destroyed. Start, stop and continue messages are sent using
+ * MIDITimerSendRealTime.
+ * @public @memberof MIDITimer
+ * @param timer  The timer.
+ * @param device The device to send the clocks through.
+ * @param source The runloop source to add the generator's timers to.
+ * @retval 0 on success.
+ * @retval >0 if the generator could not be started.
+ */
+int MIDITimerStartGenerator( struct MIDITimer * timer, struct MIDIDevice * device,
+                             struct MIDIRunloopSource * source ) {
+  MIDITimestamp now;
+  MIDIPrecond( timer != NULL, EFAULT );
+  MIDIPrecond( device != NULL, EINVAL );
+  MIDIPrecond( source != NULL, EINVAL );
+  if( timer->rls != NULL ) {
+    MIDIError( EINVAL, "Generator is already running." );
+    return EINVAL;
+  }
+  MIDIRunloopSourceRetain( source );
+  timer->device = device;
+  timer->rls    = source;
+  MIDIClockGetNow( timer->clock, &now );
+  timer->origin = now;
+  timer->ticks  = 0;
+  if( _generator_arm( timer, now ) ) {
+    MIDITimerStopGenerator( timer );
+    return ENOMEM;
+  }
+  return 0;
+}
+
+/**
+ * @brief Stop generating timing clocks.
+ * @public @memberof MIDITimer
+ * @param timer The timer.
+ * @retval 0 on success.
+ */
+int MIDITimerStopGenerator( struct MIDITimer * timer ) {
+  MIDIPrecond( timer != NULL, EFAULT );
+  if( timer->rls == NULL ) return 0;
+  if( timer->handle != 0 ) {
+    MIDIRunloopSourceCancelTimer( timer->rls, timer->handle );
+    timer->handle = 0;
+  }
+  MIDIRunloopSourceRelease( timer->rls );
+  timer->rls    = NULL;
+  timer->device = NULL;
+  return 0;
+}
+
+/** @} */
+
+/* MARK: Real-time messages *//**
+ * @name Real-time messages
+ * @{
+ */
+
+/**
+ * @brief Receive a real-time message.
+ * Follow the tempo of received timing clocks and keep track of the
+ * song position. This is called by the device the timer is attached to.
+ * @public @memberof MIDITimer
+ * @param timer     The timer.
+ * @param device    The device that received the message.
+ * @param status    The status of the message.
+ * @param timestamp The timestamp of the message.
+ * @retval 0 on success.
+ * @retval 1 if the message is not handled by the timer.
+ */
 int MIDITimerReceiveRealTime( struct MIDITimer * timer, struct MIDIDevice * device,
                               MIDIStatus status, MIDITimestamp timestamp ) {
+  MIDIPrecond( timer != NULL, EFAULT );
   switch( status ) {
     case MIDI_STATUS_TIMING_CLOCK:
+      _follow( timer, timestamp );
+      _advance( timer );
       break;
     case MIDI_STATUS_START:
+      timer->clocks        = 0;
+      timer->song_position = 0;
+      timer->running       = MIDI_ON;
       break;
     case MIDI_STATUS_CONTINUE:
+      timer->running = MIDI_ON;
       break;
     case MIDI_STATUS_STOP:
+      timer->running = MIDI_OFF;
       break;
     default:
       return 1;
@@ -58,19 +517,43 @@ int MIDITimerReceiveRealTime( struct MIDITimer * timer, struct MIDIDevice * devi
   return 0;
 }
 
+/**
+ * @brief Send a real-time message.
+ * Keep track of the song position and send the message through the
+ * device. The generator uses this to send its timing clocks.
+ * @public @memberof MIDITimer
+ * @param timer     The timer.
+ * @param device    The device to send the message through. May be @c NULL
+ *                  to only update the song position.
+ * @param status    The status of the message.
+ * @param timestamp The timestamp of the message.
+ * @retval 0 on success.
+ * @retval 1 if the message is not handled by the timer.
+ */
 int MIDITimerSendRealTime( struct MIDITimer * timer, struct MIDIDevice * device,
                            MIDIStatus status, MIDITimestamp timestamp ) {
+  MIDIPrecond( timer != NULL, EFAULT );
   switch( status ) {
     case MIDI_STATUS_TIMING_CLOCK:
+      timer->last = timestamp;
+      _advance( timer );
       break;
     case MIDI_STATUS_START:
+      timer->clocks        = 0;
+      timer->song_position = 0;
+      timer->running       = MIDI_ON;
       break;
     case MIDI_STATUS_CONTINUE:
+      timer->running = MIDI_ON;
       break;
     case MIDI_STATUS_STOP:
+      timer->running = MIDI_OFF;
       break;
     default:
       return 1;
   }
-  return 0;
+  if( device == NULL ) return 0;
+  return MIDIDeviceSendRealTime( device, status, timestamp );
 }
+
+/** @} */
@@ -7,6 +7,9 @@
 #define MIDI_CLOCKS_PER_QUARTER_NOTE 24
 #define MIDI_BEATS_PER_QUARTER_NOTE   4
 
+struct MIDIClock;
+struct MIDIRunloopSource;
+
 struct MIDITimer;
 struct MIDITimerDelegate {
 };
@@ -16,6 +19,18 @@ void MIDITimerDestroy( struct MIDITimer * timer );
 void MIDITimerRetain( struct MIDITimer * timer );
 void MIDITimerRelease( struct MIDITimer * timer );
 
+int MIDITimerSetClock( struct MIDITimer * timer, struct MIDIClock * clock );
+int MIDITimerGetClock( struct MIDITimer * timer, struct MIDIClock ** clock );
+int MIDITimerSetTempo( struct MIDITimer * timer, double beats_per_minute );
+int MIDITimerGetTempo( struct MIDITimer * timer, double * beats_per_minute );
+int MIDITimerGetPhase( struct MIDITimer * timer, MIDITimestamp now, double * phase );
+int MIDITimerGetSongPosition( struct MIDITimer * timer, MIDILongValue * song_position );
+int MIDITimerIsRunning( struct MIDITimer * timer, MIDIBoolean * running );
+
+int MIDITimerStartGenerator( struct MIDITimer * timer, struct MIDIDevice * device,
+                             struct MIDIRunloopSource * source );
+int MIDITimerStopGenerator( struct MIDITimer * timer );
+
 int MIDITimerReceiveRealTime( struct MIDITimer * timer, struct MIDIDevice * device,
                               MIDIStatus status, MIDITimestamp timestamp );
 int MIDITimerSendRealTime( struct MIDITimer * timer, struct MIDIDevice * device,
@@ -0,0 +1,517 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include "trace.h"
+#include "message.h"
+
+static const char * _trace_hops[MIDI_TRACE_NUM_HOPS] = {
+  "ingress", "port", "queue_push", "queue_pop", "send"
+};
+
+/** @internal */
+struct MIDITraceEntry {
+  struct MIDIMessage * volatile message;
+  struct MIDITraceRecord record;
+};
+
+/**
+ * @ingroup MIDI
+ * @brief Latency tracing of sampled messages along the message path.
+ * One in @c interval received messages is sampled. A sampled message
+ * gets a time stamp at every hop it passes: when a driver decodes it,
+ * when the first port receives it, when it is pushed to and popped from
+ * a queue and when a driver sends it. The stamps are kept in a side table
+ * that is keyed by the message, so messages don't grow. When the message
+ * is destroyed, the time between each hop and the one before it is
+ * added to a histogram and the record is kept for a Chrome trace.
+ * Stamps are taken with the monotonic clock, latencies are in
+ * nanoseconds.
+ * Hops of messages that are not sampled cost one branch while no message
+ * is traced and a lookup without locks otherwise.
+ */
+struct MIDITrace {
+/**
+ * @privatesection
+ * @cond INTERNALS
+ */
+  int refs;
+  pthread_mutex_t lock;
+  unsigned long interval;
+  volatile unsigned long counter;
+  volatile size_t active;
+  unsigned long next_id;
+  struct MIDITraceEntry table[MIDI_TRACE_TABLE_SIZE];
+  size_t capacity;
+  size_t written;
+  struct MIDITraceRecord * records;
+  struct MIDITraceStats stats;
+/** @endcond */
+};
+
+struct MIDITrace * volatile MIDITraceCurrent = NULL;
+
+/* MARK: Internals *//**
+ * @name Internals
+ * @cond INTERNALS
+ * @{
+ */
+
+/* marks table entries whose message was finished */
+static char _removed;
+#define TRACE_REMOVED ((struct MIDIMessage *) &_removed)
+
+static long long _trace_now( void ) {
+  struct timespec now;
+  clock_gettime( CLOCK_MONOTONIC, &now );
+  return (long long) now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static size_t _trace_hash( struct MIDIMessage * message ) {
+  return ( ( (uintptr_t) message >> 4 ) * 2654435761u ) % MIDI_TRACE_TABLE_SIZE;
+}
+
+/**
+ * @brief Find the table entry of a message.
+ * The table is probed without the lock, the caller has to check the
+ * entry again once it holds the lock.
+ * @private @memberof MIDITrace
+ * @param trace   The trace.
+ * @param message The message.
+ * @return the entry or @c NULL if the message is not traced.
+ */
+static struct MIDITraceEntry * _trace_find( struct MIDITrace * trace, struct MIDIMessage * message ) {
+  struct MIDITraceEntry * entry;
+  size_t i, h = _trace_hash( message );
+  for( i=0; i<MIDI_TRACE_TABLE_SIZE; i++ ) {
+    entry = &(trace->table[(h+i) % MIDI_TRACE_TABLE_SIZE]);
+    if( entry->message == message ) return entry;
+    if( entry->message == NULL ) break;
+  }
+  return NULL;
+}
+
+/**
+ * @brief Find a free table entry for a message.
+ * @private @memberof MIDITrace
+ * @param trace   The trace.
+ * @param message The message.
+ * @return the entry or @c NULL if the table is full.
+ */
+static struct MIDITraceEntry * _trace_insert( struct MIDITrace * trace, struct MIDIMessage * message ) {
+  struct MIDITraceEntry * entry;
+  size_t i, h = _trace_hash( message );
+  for( i=0; i<MIDI_TRACE_TABLE_SIZE; i++ ) {
+    entry = &(trace->table[(h+i) % MIDI_TRACE_TABLE_SIZE]);
+    if( entry->message == NULL || entry->message == TRACE_REMOVED ) return entry;
+  }
+  return NULL;
+}
+
+/**
+ * @brief Add the latencies of a finished record to the histograms.
+ * The latency of a hop is the time since the latest hop before it, so
+ * hops that a message skipped or passed in a different order are
+ * accounted for.
+ * @private @memberof MIDITrace
+ * @param trace  The trace.
+ * @param record The record.
+ */
+static void _trace_complete( struct MIDITrace * trace, struct MIDITraceRecord * record ) {
+  long long * stamps = &(record->stamps[0]);
+  long long prev, last = stamps[MIDI_TRACE_INGRESS];
+  int h, j;
+
+  for( h=MIDI_TRACE_INGRESS+1; h<MIDI_TRACE_NUM_HOPS; h++ ) {
+    if( stamps[h] == 0 ) continue;
+    prev = stamps[MIDI_TRACE_INGRESS];
+    for( j=MIDI_TRACE_INGRESS+1; j<MIDI_TRACE_NUM_HOPS; j++ ) {
+      if( j == h || stamps[j] == 0 ) continue;
+      if( ( stamps[j] < stamps[h] || ( stamps[j] == stamps[h] && j < h ) ) && stamps[j] > prev ) {
+        prev = stamps[j];
+      }
+    }
+    MIDIDriverLatencyHistogramAdd( &(trace->stats.hops[h]), stamps[h] - prev );
+    if( stamps[h] > last ) last = stamps[h];
+  }
+  MIDIDriverLatencyHistogramAdd( &(trace->stats.total), last - stamps[MIDI_TRACE_INGRESS] );
+  trace->stats.completed++;
+
+  if( trace->capacity > 0 ) {
+    trace->records[trace->written % trace->capacity] = *record;
+    trace->written++;
+  }
+}
+
+/**
+ * @brief Copy the kept records, oldest first.
+ * @private @memberof MIDITrace
+ * @param trace   The trace.
+ * @param size    The number of records that fit into @c records.
+ * @param records The records.
+ * @return the number of records that were copied.
+ */
+static size_t _trace_copy_records( struct MIDITrace * trace, size_t size, struct MIDITraceRecord * records ) {
+  size_t i, n, first;
+  n     = ( trace->written < trace->capacity ) ? trace->written : trace->capacity;
+  first = trace->written - n;
+  if( n > size ) n = size;
+  for( i=0; i<n; i++ ) {
+    records[i] = trace->records[(first+i) % trace->capacity];
+  }
+  return n;
+}
+
+/** @} @endcond */
+
+/* MARK: Creation and destruction *//**
+ * @name Creation and destruction
+ * Creating, destroying and reference counting of MIDITrace objects.
+ * @{
+ */
+
+/**
+ * @brief Create a MIDITrace instance.
+ * @public @memberof MIDITrace
+ * @param capacity The number of finished records to keep for a Chrome trace.
+ * @param interval Sample one in @c interval received messages, 0 to
+ *                 sample none.
+ * @return a pointer to the created trace structure on success.
+ * @return a @c NULL pointer if the trace could not be created.
+ */
+struct MIDITrace * MIDITraceCreate( size_t capacity, unsigned long interval ) {
+  struct MIDITrace * trace;
+
+  trace = malloc( sizeof( struct MIDITrace ) );
+  MIDIPrecondReturn( trace != NULL, ENOMEM, NULL );
+  memset( trace, 0, sizeof( struct MIDITrace ) );
+  trace->refs     = 1;
+  trace->interval = interval;
+  trace->capacity = capacity;
+  if( capacity > 0 ) {
+    trace->records = malloc( sizeof( struct MIDITraceRecord ) * capacity );
+    if( trace->records == NULL ) {
+      MIDIError( ENOMEM, "Could not allocate trace records." );
+      free( trace );
+      return NULL;
+    }
+  }
+  pthread_mutex_init( &(trace->lock), NULL );
+  return trace;
+}
+
+/**
+ * @brief Destroy a MIDITrace instance.
+ * @public @memberof MIDITrace
+ * @param trace The trace.
+ */
+void MIDITraceDestroy( struct MIDITrace * trace ) {
+  MIDIPrecondReturn( trace != NULL, EFAULT, (void)0 );
+  pthread_mutex_destroy( &(trace->lock) );
+  free( trace->records );
+  free( trace );
+}
+
+/**
+ * @brief Retain a MIDITrace instance.
+ * Increment the reference counter of a trace so that it won't be destroyed.
+ * @public @memberof MIDITrace
+ * @param trace The trace.
+ */
+void MIDITraceRetain( struct MIDITrace * trace ) {
+  MIDIPrecondReturn( trace != NULL, EFAULT, (void)0 );
+  MIDIRefRetain( trace->refs );
+}
+
+/**
+ * @brief Release a MIDITrace instance.
+ * Decrement the reference counter of a trace. If the reference count
+ * reached zero, destroy the trace.
+ * @public @memberof MIDITrace
+ * @param trace The trace.
+ */
+void MIDITraceRelease( struct MIDITrace * trace ) {
+  MIDIPrecondReturn( trace != NULL, EFAULT, (void)0 );
+  if( ! MIDIRefRelease( trace->refs ) ) {
+    MIDITraceDestroy( trace );
+  }
+}
+
+/** @} */
+
+/* MARK: Configuration *//**
+ * @name Configuration
+ * @{
+ */
+
+/**
+ * @brief Set the sampling interval.
+ * @public @memberof MIDITrace
+ * @param trace    The trace.
+ * @param interval Sample one in @c interval received messages, 0 to
+ *                 stop sampling.
+ * @retval 0 on success.
+ */
+int MIDITraceSetInterval( struct MIDITrace * trace, unsigned long interval ) {
+  MIDIPrecond( trace != NULL, EFAULT );
+  trace->interval = interval;
+  return 0;
+}
+
+/**
+ * @brief Make a trace the one that the message path stamps into.
+ * The current trace is retained until another one replaces it. Drivers,
+ * ports and queues may still be stamping into the previous trace on
+ * other threads, so keep a reference to it until they are idle.
+ * @public
+ * @param trace The trace or @c NULL to stop tracing.
+ * @retval 0 on success.
+ */
+int MIDITraceSetCurrent( struct MIDITrace * trace ) {
+  struct MIDITrace * previous;
+  if( trace != NULL ) MIDITraceRetain( trace );
+  previous = __sync_lock_test_and_set( &MIDITraceCurrent, trace );
+  if( previous != NULL ) MIDITraceRelease( previous );
+  return 0;
+}
+
+/**
+ * @brief Clear the histograms and the kept records.
+ * Messages that are being traced are not affected.
+ * @public @memberof MIDITrace
+ * @param trace The trace.
+ * @retval 0 on success.
+ */
+int MIDITraceReset( struct MIDITrace * trace ) {
+  MIDIPrecond( trace != NULL, EFAULT );
+  pthread_mutex_lock( &(trace->lock) );
+  memset( &(trace->stats), 0, sizeof( struct MIDITraceStats ) );
+  trace->written = 0;
+  pthread_mutex_unlock( &(trace->lock) );
+  return 0;
+}
+
+/** @} */
+
+/* MARK: Stamping *//**
+ * @name Stamping
+ * Recording the hops of messages. These are usually called through the
+ * @c MIDITraceHop and @c MIDITraceFinish macros, which do nothing if no
+ * trace is current or if the library was built with @c NO_TRACING.
+ * @{
+ */
+
+/**
+ * @brief Stamp a message at a hop.
+ * At @c MIDI_TRACE_INGRESS the message is sampled, at every other hop
+ * only messages that were sampled are stamped. Only the first time a
+ * message passes a hop is recorded.
+ * @public @memberof MIDITrace
+ * @param trace   The trace.
+ * @param message The message.
+ * @param hop     The hop.
+ */
+void MIDITraceStampMessage( struct MIDITrace * trace, struct MIDIMessage * message, int hop ) {
+  struct MIDITraceEntry * entry;
+  unsigned long interval;
+  MIDIPrecondReturn( trace != NULL, EFAULT, (void)0 );
+  MIDIPrecondReturn( hop >= 0 && hop < MIDI_TRACE_NUM_HOPS, EINVAL, (void)0 );
+
+  if( hop == MIDI_TRACE_INGRESS ) {
+    interval = trace->interval;
+    if( interval == 0 || __sync_fetch_and_add( &(trace->counter), 1 ) % interval ) return;
+    pthread_mutex_lock( &(trace->lock) );
+    if( _trace_find( trace, message ) == NULL ) {
+      entry = _trace_insert( trace, message );
+      if( entry != NULL ) {
+        memset( &(entry->record), 0, sizeof( struct MIDITraceRecord ) );
+        entry->record.id = trace->next_id++;
+        MIDIMessageGetStatus( message, &(entry->record.status) );
+        entry->record.stamps[MIDI_TRACE_INGRESS] = _trace_now();
+        entry->message = message;
+        trace->active++;
+        trace->stats.sampled++;
+      } else {
+        trace->stats.skipped++;
+      }
+    }
+    pthread_mutex_unlock( &(trace->lock) );
+    return;
+  }
+
+  if( trace->active == 0 ) return;
+  entry = _trace_find( trace, message );
+  if( entry == NULL ) return;
+  pthread_mutex_lock( &(trace->lock) );
+  if( entry->message == message && entry->record.stamps[hop] == 0 ) {
+    entry->record.stamps[hop] = _trace_now();
+  }
+  pthread_mutex_unlock( &(trace->lock) );
+}
+
+/**
+ * @brief Finish the trace of a message.
+ * This is called when the message is destroyed. The latencies of its
+ * hops are added to the histograms and its record is kept.
+ * @public @memberof MIDITrace
+ * @param trace   The trace.
+ * @param message The message.
+ */
+void MIDITraceFinishMessage( struct MIDITrace * trace, struct MIDIMessage * message ) {
+  struct MIDITraceEntry * entry;
+  MIDIPrecondReturn( trace != NULL, EFAULT, (void)0 );
+  if( trace->active == 0 ) return;
+  entry = _trace_find( trace, message );
+  if( entry == NULL ) return;
+  pthread_mutex_lock( &(trace->lock) );
+  if( entry->message == message ) {
+    _trace_complete( trace, &(entry->record) );
+    entry->message = TRACE_REMOVED;
+    trace->active--;
+  }
+  pthread_mutex_unlock( &(trace->lock) );
+}
+
+/** @} */
+
+/* MARK: Output *//**
+ * @name Output
+ * Reading the histograms and records for offline analysis.
+ * @{
+ */
+
+/**
+ * @brief Get the counters and histograms.
+ * The histogram of @c MIDI_TRACE_INGRESS stays empty, the time from
+ * ingress to the last hop is in @c total.
+ * @public @memberof MIDITrace
+ * @param trace The trace.
+ * @param stats The stats.
+ * @retval 0 on success.
+ */
+int MIDITraceGetStats( struct MIDITrace * trace, struct MIDITraceStats * stats ) {
+  MIDIPrecond( trace != NULL, EFAULT );
+  MIDIPrecond( stats != NULL, EINVAL );
+  pthread_mutex_lock( &(trace->lock) );
+  *stats = trace->stats;
+  pthread_mutex_unlock( &(trace->lock) );
+  return 0;
+}
+
+/**
+ * @brief Get the kept records of finished messages, oldest first.
+ * @public @memberof MIDITrace
+ * @param trace   The trace.
+ * @param size    The number of records that fit into @c records.
+ * @param records The records.
+ * @param count   The number of records that were stored.
+ * @retval 0 on success.
+ */
+int MIDITraceGetRecords( struct MIDITrace * trace, size_t size, struct MIDITraceRecord * records, size_t * count ) {
+  MIDIPrecond( trace != NULL, EFAULT );
+  MIDIPrecond( records != NULL || size == 0, EINVAL );
+  MIDIPrecond( count != NULL, EINVAL );
+  pthread_mutex_lock( &(trace->lock) );
+  *count = _trace_copy_records( trace, size, records );
+  pthread_mutex_unlock( &(trace->lock) );
+  return 0;
+}
+
+/**
+ * @brief Write the per-hop histograms as text.
+ * Every hop gets a summary line with the count, mean and maximum and a
+ * line for every bucket that is not empty, with the upper bound of the
+ * bucket in nanoseconds.
+ * @public @memberof MIDITrace
+ * @param trace The trace.
+ * @param file  The file.
+ * @retval 0 on success.
+ * @retval >0 if the histograms could not be written.
+ */
+int MIDITraceWriteHistograms( struct MIDITrace * trace, FILE * file ) {
+  struct MIDITraceStats stats;
+  struct MIDIDriverLatencyHistogram * histogram;
+  const char * name;
+  int h, i, result = 0;
+
+  MIDIPrecond( file != NULL, EINVAL );
+  if( MIDITraceGetStats( trace, &stats ) ) return 1;
+  result |= fprintf( file, "# sampled %lu completed %lu skipped %lu\n",
+                     stats.sampled, stats.completed, stats.skipped ) < 0;
+  for( h=MIDI_TRACE_INGRESS+1; h<=MIDI_TRACE_NUM_HOPS; h++ ) {
+    histogram = ( h < MIDI_TRACE_NUM_HOPS ) ? &(stats.hops[h]) : &(stats.total);
+    name      = ( h < MIDI_TRACE_NUM_HOPS ) ? _trace_hops[h] : "total";
+    if( histogram->count == 0 ) continue;
+    result |= fprintf( file, "%s count %lu mean %lld max %lld\n", name, histogram->count,
+                       (long long) ( histogram->total / histogram->count ), (long long) histogram->max ) < 0;
+    for( i=0; i<MIDI_DRIVER_HISTOGRAM_BUCKETS; i++ ) {
+      if( histogram->buckets[i] == 0 ) continue;
+      if( i == MIDI_DRIVER_HISTOGRAM_BUCKETS - 1 ) {
+        result |= fprintf( file, "%s le +Inf %lu\n", name, histogram->buckets[i] ) < 0;
+      } else {
+        result |= fprintf( file, "%s le %llu %lu\n", name, ( 1ULL << i ) - 1, histogram->buckets[i] ) < 0;
+      }
+    }
+  }
+  return result;
+}
+
+/**
+ * @brief Write the kept records in the Chrome trace event format.
+ * Every message is a complete event on a thread of its own with one
+ * nested event for every hop, spanning the time since the hop before.
+ * The file can be loaded into chrome://tracing or Perfetto.
+ * @public @memberof MIDITrace
+ * @param trace The trace.
+ * @param file  The file.
+ * @retval 0 on success.
+ * @retval >0 if the trace could not be written.
+ */
+int MIDITraceWriteChromeTrace( struct MIDITrace * trace, FILE * file ) {
+  struct MIDITraceRecord * records = NULL;
+  long long * stamps;
+  long long prev, last;
+  size_t i, n = 0;
+  int h, next, result = 0;
+
+  MIDIPrecond( trace != NULL, EFAULT );
+  MIDIPrecond( file != NULL, EINVAL );
+  if( trace->capacity > 0 ) {
+    records = malloc( sizeof( struct MIDITraceRecord ) * trace->capacity );
+    MIDIPrecond( records != NULL, ENOMEM );
+    pthread_mutex_lock( &(trace->lock) );
+    n = _trace_copy_records( trace, trace->capacity, records );
+    pthread_mutex_unlock( &(trace->lock) );
+  }
+
+  result |= fprintf( file, "{\"traceEvents\":[" ) < 0;
+  for( i=0; i<n; i++ ) {
+    stamps = &(records[i].stamps[0]);
+    last   = stamps[MIDI_TRACE_INGRESS];
+    for( h=MIDI_TRACE_INGRESS+1; h<MIDI_TRACE_NUM_HOPS; h++ ) {
+      if( stamps[h] > last ) last = stamps[h];
+    }
+    result |= fprintf( file, "%s\n{\"name\":\"message\",\"cat\":\"midi\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                       "\"pid\":1,\"tid\":%lu,\"args\":{\"status\":\"0x%02x\"}}", ( i == 0 ) ? "" : ",",
+                       stamps[MIDI_TRACE_INGRESS] / 1000.0, ( last - stamps[MIDI_TRACE_INGRESS] ) / 1000.0,
+                       records[i].id, records[i].status ) < 0;
+    /* the hops in the order they were passed */
+    prev = stamps[MIDI_TRACE_INGRESS];
+    for( ;; ) {
+      for( h=MIDI_TRACE_INGRESS+1, next=-1; h<MIDI_TRACE_NUM_HOPS; h++ ) {
+        if( stamps[h] > prev && ( next < 0 || stamps[h] < stamps[next] ) ) next = h;
+      }
+      if( next < 0 ) break;
+      result |= fprintf( file, ",\n{\"name\":\"%s\",\"cat\":\"midi\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                         "\"pid\":1,\"tid\":%lu}", _trace_hops[next], prev / 1000.0,
+                         ( stamps[next] - prev ) / 1000.0, records[i].id ) < 0;
+      prev = stamps[next];
+    }
+  }
+  result |= fprintf( file, "\n],\"displayTimeUnit\":\"ns\"}\n" ) < 0;
+  free( records );
+  return result;
+}
+
+/** @} */
@@ -0,0 +1,68 @@
+#ifndef MIDIKIT_MIDI_TRACE_H
+#define MIDIKIT_MIDI_TRACE_H
+#include <stdio.h>
+#include "midi.h"
+#include "driver.h"
+
+struct MIDIMessage;
+
+struct MIDITrace;
+
+#define MIDI_TRACE_INGRESS    0
+#define MIDI_TRACE_PORT       1
+#define MIDI_TRACE_QUEUE_PUSH 2
+#define MIDI_TRACE_QUEUE_POP  3
+#define MIDI_TRACE_SEND       4
+#define MIDI_TRACE_NUM_HOPS   5
+
+/**
+ * @brief Number of messages that can be traced at the same time.
+ */
+#ifndef MIDI_TRACE_TABLE_SIZE
+#define MIDI_TRACE_TABLE_SIZE 64
+#endif
+
+struct MIDITraceRecord {
+  unsigned long id;
+  MIDIStatus status;
+  long long stamps[MIDI_TRACE_NUM_HOPS];
+};
+
+struct MIDITraceStats {
+  unsigned long sampled;
+  unsigned long completed;
+  unsigned long skipped;
+  struct MIDIDriverLatencyHistogram hops[MIDI_TRACE_NUM_HOPS];
+  struct MIDIDriverLatencyHistogram total;
+};
+
+extern struct MIDITrace * volatile MIDITraceCurrent;
+
+struct MIDITrace * MIDITraceCreate( size_t capacity, unsigned long interval );
+void MIDITraceDestroy( struct MIDITrace * trace );
+void MIDITraceRetain( struct MIDITrace * trace );
+void MIDITraceRelease( struct MIDITrace * trace );
+
+int MIDITraceSetInterval( struct MIDITrace * trace, unsigned long interval );
+int MIDITraceSetCurrent( struct MIDITrace * trace );
+int MIDITraceReset( struct MIDITrace * trace );
+
+void MIDITraceStampMessage( struct MIDITrace * trace, struct MIDIMessage * message, int hop );
+void MIDITraceFinishMessage( struct MIDITrace * trace, struct MIDIMessage * message );
+
+int MIDITraceGetStats( struct MIDITrace * trace, struct MIDITraceStats * stats );
+int MIDITraceGetRecords( struct MIDITrace * trace, size_t size, struct MIDITraceRecord * records, size_t * count );
+int MIDITraceWriteHistograms( struct MIDITrace * trace, FILE * file );
+int MIDITraceWriteChromeTrace( struct MIDITrace * trace, FILE * file );
+
+#ifndef NO_TRACING
+#define MIDITraceHop( message, hop ) \
+do { if( MIDITraceCurrent != NULL ) { MIDITraceStampMessage( MIDITraceCurrent, (message), (hop) ); } } while( 0 )
+#define MIDITraceFinish( message ) \
+do { if( MIDITraceCurrent != NULL ) { MIDITraceFinishMessage( MIDITraceCurrent, (message) ); } } while( 0 )
+#else
+#define MIDITraceHop( message, hop )
+#define MIDITraceFinish( message )
+#endif
+
+#endif
@@ -0,0 +1,461 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include "ump.h"
+#include "message.h"
+
+/**
+ * @ingroup MIDI
+ * @struct MIDIUniversalPacket ump.h
+ * @brief MIDI 2.0 Universal MIDI Packet.
+ * A universal packet holds one message of 32, 64, 96 or 128 bits as up
+ * to four 32 bit words in host byte order. The size of a packet is always
+ * four words (and on GCC it is aligned to 16 bytes) so arrays of packets
+ * can be indexed, copied and processed lane-wise without looking at the
+ * message type first. Unused words are zero.
+ *
+ * The upper four bits of the first word are the message type, which
+ * determines the number of words that are used, the next four bits are
+ * the group. MIDI 1.0 channel voice and system messages map losslessly
+ * to message types 2 and 1, MIDI 2.0 channel voice messages (type 4) are
+ * converted with the min-center-max scaling of the UMP specification.
+ * System exclusive data (types 3 and 5) is carried as is but not
+ * converted to or from @ref MIDIMessage objects.
+ */
+
+/* MARK: Internals *//**
+ * @name Internals
+ * @cond INTERNALS
+ * @{
+ */
+
+/* number of words by message type */
+static const unsigned char _ump_words[16] = {
+  1, 1, 1, 2, 2, 4, 1, 1, 2, 2, 2, 3, 3, 4, 4, 4
+};
+
+/* data bytes of the system messages 0xf0 ... 0xff */
+static const unsigned char _system_data[16] = {
+  0, 1, 2, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+/**
+ * @brief Scale a value up to more bits.
+ * The value is shifted up, values above the center repeat their lower bits
+ * in the new low bits so that the maximum maps to the maximum and the
+ * center stays in the center.
+ */
+static uint32_t _scale_up( uint32_t value, int from, int to ) {
+  int shift = to - from;
+  uint32_t center = 1U << ( from - 1 );
+  uint32_t result, repeat;
+  int fill;
+
+  result = value << shift;
+  if( value <= center ) return result;
+  repeat = value & ( center - 1 );
+  fill   = shift;
+  while( fill > 0 ) {
+    if( fill >= from - 1 ) {
+      fill   -= from - 1;
+      result |= repeat << fill;
+    } else {
+      result |= repeat >> ( ( from - 1 ) - fill );
+      fill    = 0;
+    }
+  }
+  return result;
+}
+
+static void _header( struct MIDIUniversalPacket * packet, unsigned char type, unsigned char group,
+                     unsigned char byte1, unsigned char byte2, unsigned char byte3 ) {
+  packet->words[0] = ( (uint32_t) ( type & 0xf ) << 28 ) | ( (uint32_t) ( group & 0xf ) << 24 )
+                   | ( (uint32_t) byte1 << 16 ) | ( (uint32_t) byte2 << 8 ) | byte3;
+  packet->words[1] = 0;
+  packet->words[2] = 0;
+  packet->words[3] = 0;
+}
+
+static void _compact( struct MIDICompactMessage * compact, unsigned char status,
+                      unsigned char data1, unsigned char data2 ) {
+  compact->bytes[0]     = status;
+  compact->bytes[1]     = data1 & 0x7f;
+  compact->bytes[2]     = data2 & 0x7f;
+  compact->flags        = 0;
+  compact->timestamp    = 0;
+  compact->sysex_offset = 0;
+  compact->sysex_size   = 0;
+}
+
+/** @} @endcond */
+
+/* MARK: Channel voice *//**
+ * @name Channel voice
+ * Access the fields of MIDI 2.0 channel voice packets.
+ * @{
+ */
+
+/**
+ * @brief Set a MIDI 2.0 channel voice packet.
+ * Build a 64 bit channel voice packet (message type 4). The meaning of
+ * @c index and @c extra depends on the status, for notes they are the key
+ * and the attribute type, for controls the index and for registered and
+ * assignable controls the bank and index. The @c value fills the second
+ * word, for notes it holds the 16 bit velocity in the upper half and the
+ * attribute in the lower half.
+ * @public @memberof MIDIUniversalPacket
+ * @param packet  The packet.
+ * @param group   The group.
+ * @param status  The status, one of the channel voice statuses of MIDI 1.0
+ *                or one of the @c MIDI_UMP_STATUS_* values.
+ * @param channel The channel.
+ * @param index   The first data byte.
+ * @param extra   The second data byte.
+ * @param value   The data word.
+ * @retval 0  on success.
+ * @retval >0 if the packet could not be set.
+ */
+int MIDIUniversalPacketSetChannelVoice( struct MIDIUniversalPacket * packet, unsigned char group,
+                                        MIDIStatus status, MIDIChannel channel,
+                                        unsigned char index, unsigned char extra, uint32_t value ) {
+  MIDIPrecond( packet != NULL, EFAULT );
+  MIDIPrecond( status <= 0xf, EINVAL );
+  MIDIPrecond( channel >= 0 && channel <= 0xf, EINVAL );
+  _header( packet, MIDI_UMP_TYPE_MIDI2_CHANNEL, group, ( status << 4 ) | channel, index, extra );
+  packet->words[1] = value;
+  return 0;
+}
+
+/**
+ * @brief Get the fields of a MIDI 2.0 channel voice packet.
+ * @public @memberof MIDIUniversalPacket
+ * @param packet  The packet.
+ * @param status  The status.
+ * @param channel The channel.
+ * @param index   The first data byte.
+ * @param extra   The second data byte.
+ * @param value   The data word.
+ * @retval 0  on success.
+ * @retval >0 if the packet is no MIDI 2.0 channel voice packet.
+ */
+int MIDIUniversalPacketGetChannelVoice( struct MIDIUniversalPacket * packet, MIDIStatus * status, MIDIChannel * channel,
+                                        unsigned char * index, unsigned char * extra, uint32_t * value ) {
+  MIDIPrecond( packet != NULL, EFAULT );
+  if( MIDI_UMP_TYPE( packet ) != MIDI_UMP_TYPE_MIDI2_CHANNEL ) return 1;
+  if( status != NULL )  *status  = ( packet->words[0] >> 20 ) & 0xf;
+  if( channel != NULL ) *channel = ( packet->words[0] >> 16 ) & 0xf;
+  if( index != NULL )   *index   = ( packet->words[0] >> 8 ) & 0xff;
+  if( extra != NULL )   *extra   = packet->words[0] & 0xff;
+  if( value != NULL )   *value   = packet->words[1];
+  return 0;
+}
+
+/**
+ * @brief Set a jitter reduction timestamp packet.
+ * The timestamp tells the receiver when the following packets of the
+ * group are to be played, in units of the sender's clock.
+ * @public @memberof MIDIUniversalPacket
+ * @param packet    The packet.
+ * @param group     The group.
+ * @param timestamp The timestamp.
+ * @retval 0  on success.
+ * @retval >0 if the packet could not be set.
+ */
+int MIDIUniversalPacketSetTimestamp( struct MIDIUniversalPacket * packet, unsigned char group, unsigned short timestamp ) {
+  MIDIPrecond( packet != NULL, EFAULT );
+  _header( packet, MIDI_UMP_TYPE_UTILITY, group, MIDI_UMP_UTILITY_JR_TIMESTAMP << 4,
+           timestamp >> 8, timestamp & 0xff );
+  return 0;
+}
+
+/** @} */
+
+/* MARK: Conversion *//**
+ * @name Conversion
+ * Convert packets to and from compact messages and message objects.
+ * @{
+ */
+
+/**
+ * @brief Get the size of a packet.
+ * @public @memberof MIDIUniversalPacket
+ * @param packet The packet.
+ * @param words  The number of 32 bit words the packet uses.
+ * @retval 0  on success.
+ * @retval >0 if the size could not be determined.
+ */
+int MIDIUniversalPacketGetSize( struct MIDIUniversalPacket * packet, size_t * words ) {
+  MIDIPrecond( packet != NULL, EFAULT );
+  MIDIPrecond( words != NULL, EINVAL );
+  *words = _ump_words[MIDI_UMP_TYPE( packet )];
+  return 0;
+}
+
+/**
+ * @brief Make a packet from a compact message.
+ * System common and real time messages become system packets (message
+ * type 1). Channel voice messages become MIDI 1.0 channel voice packets
+ * (message type 2), or when @c upgrade is set MIDI 2.0 channel voice
+ * packets (message type 4) with their values scaled to the wider fields.
+ * An upgraded note on with velocity zero becomes a note off. The
+ * timestamp of the compact message is not converted.
+ * @public @memberof MIDIUniversalPacket
+ * @param packet  The packet.
+ * @param group   The group.
+ * @param compact The compact message.
+ * @param upgrade Whether to make MIDI 2.0 channel voice packets.
+ * @retval 0  on success.
+ * @retval >0 if the compact message has no packet form.
+ */
+int MIDIUniversalPacketFromCompact( struct MIDIUniversalPacket * packet, unsigned char group,
+                                    struct MIDICompactMessage * compact, MIDIBoolean upgrade ) {
+  unsigned char status, data1, data2, channel;
+  MIDIPrecond( packet != NULL, EFAULT );
+  MIDIPrecond( compact != NULL, EINVAL );
+  status = compact->bytes[0];
+  data1  = compact->bytes[1] & 0x7f;
+  data2  = compact->bytes[2] & 0x7f;
+
+  if( status < 0x80 ) return 1;
+  if( status >= 0xf0 ) {
+    if( status == MIDI_STATUS_SYSTEM_EXCLUSIVE || status == MIDI_STATUS_END_OF_EXCLUSIVE ) return 1;
+    _header( packet, MIDI_UMP_TYPE_SYSTEM, group, status,
+             ( _system_data[status & 0xf] > 0 ) ? data1 : 0,
+             ( _system_data[status & 0xf] > 1 ) ? data2 : 0 );
+    return 0;
+  }
+  if( !upgrade ) {
+    if( ( status >> 4 ) == MIDI_STATUS_PROGRAM_CHANGE || ( status >> 4 ) == MIDI_STATUS_CHANNEL_PRESSURE ) data2 = 0;
+    _header( packet, MIDI_UMP_TYPE_MIDI1_CHANNEL, group, status, data1, data2 );
+    return 0;
+  }
+
+  channel = status & 0xf;
+  switch( status >> 4 ) {
+    case MIDI_STATUS_NOTE_ON:
+      if( data2 > 0 ) {
+        _header( packet, MIDI_UMP_TYPE_MIDI2_CHANNEL, group, status, data1, 0 );
+        packet->words[1] = _scale_up( data2, 7, 16 ) << 16;
+        break;
+      }
+      data2 = 64;
+      status = ( MIDI_STATUS_NOTE_OFF << 4 ) | channel;
+      /* fall through */
+    case MIDI_STATUS_NOTE_OFF:
+      _header( packet, MIDI_UMP_TYPE_MIDI2_CHANNEL, group, status, data1, 0 );
+      packet->words[1] = _scale_up( data2, 7, 16 ) << 16;
+      break;
+    case MIDI_STATUS_POLYPHONIC_KEY_PRESSURE:
+    case MIDI_STATUS_CONTROL_CHANGE:
+      _header( packet, MIDI_UMP_TYPE_MIDI2_CHANNEL, group, status, data1, 0 );
+      packet->words[1] = _scale_up( data2, 7, 32 );
+      break;
+    case MIDI_STATUS_PROGRAM_CHANGE:
+      _header( packet, MIDI_UMP_TYPE_MIDI2_CHANNEL, group, status, 0, 0 );
+      packet->words[1] = (uint32_t) data1 << 24;
+      break;
+    case MIDI_STATUS_CHANNEL_PRESSURE:
+      _header( packet, MIDI_UMP_TYPE_MIDI2_CHANNEL, group, status, 0, 0 );
+      packet->words[1] = _scale_up( data1, 7, 32 );
+      break;
+    case MIDI_STATUS_PITCH_WHEEL_CHANGE:
+      _header( packet, MIDI_UMP_TYPE_MIDI2_CHANNEL, group, status, 0, 0 );
+      packet->words[1] = _scale_up( data1 | ( (uint32_t) data2 << 7 ), 14, 32 );
+      break;
+    default:
+      return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Make a compact message from a packet.
+ * System and MIDI 1.0 channel voice packets are copied, MIDI 2.0 channel
+ * voice packets are scaled down to seven (or for the pitch wheel fourteen)
+ * bits. A note on that would end up with velocity zero gets velocity one
+ * so it does not become a note off. Per note and registered controls,
+ * bank selects of program changes, utility and data packets have no
+ * MIDI 1.0 form and are not converted.
+ * @public @memberof MIDIUniversalPacket
+ * @param packet  The packet.
+ * @param compact The compact message.
+ * @retval 0  on success.
+ * @retval >0 if the packet has no compact form.
+ */
+int MIDIUniversalPacketToCompact( struct MIDIUniversalPacket * packet, struct MIDICompactMessage * compact ) {
+  unsigned char status, data1;
+  uint32_t value;
+  MIDIPrecond( packet != NULL, EFAULT );
+  MIDIPrecond( compact != NULL, EINVAL );
+
+  status = ( packet->words[0] >> 16 ) & 0xff;
+  data1  = ( packet->words[0] >> 8 ) & 0xff;
+  value  = packet->words[1];
+  switch( MIDI_UMP_TYPE( packet ) ) {
+    case MIDI_UMP_TYPE_SYSTEM:
+      if( status < 0xf1 || status == MIDI_STATUS_END_OF_EXCLUSIVE ) return 1;
+      _compact( compact, status, data1, packet->words[0] & 0xff );
+      return 0;
+    case MIDI_UMP_TYPE_MIDI1_CHANNEL:
+      if( status < 0x80 || status >= 0xf0 ) return 1;
+      _compact( compact, status, data1, packet->words[0] & 0xff );
+      return 0;
+    case MIDI_UMP_TYPE_MIDI2_CHANNEL:
+      break;
+    default:
+      return 1;
+  }
+
+  switch( status >> 4 ) {
+    case MIDI_STATUS_NOTE_OFF:
+      _compact( compact, status, data1, value >> 25 );
+      break;
+    case MIDI_STATUS_NOTE_ON:
+      _compact( compact, status, data1, ( ( value >> 25 ) > 0 ) ? ( value >> 25 ) : 1 );
+      break;
+    case MIDI_STATUS_POLYPHONIC_KEY_PRESSURE:
+    case MIDI_STATUS_CONTROL_CHANGE:
+      _compact( compact, status, data1, value >> 25 );
+      break;
+    case MIDI_STATUS_PROGRAM_CHANGE:
+      _compact( compact, status, value >> 24, 0 );
+      break;
+    case MIDI_STATUS_CHANNEL_PRESSURE:
+      _compact( compact, status, value >> 25, 0 );
+      break;
+    case MIDI_STATUS_PITCH_WHEEL_CHANGE:
+      value >>= 18;
+      _compact( compact, status, value & 0x7f, value >> 7 );
+      break;
+    default:
+      return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Make a packet from a message.
+ * @public @memberof MIDIUniversalPacket
+ * @param packet  The packet.
+ * @param group   The group.
+ * @param message The message.
+ * @param upgrade Whether to make MIDI 2.0 channel voice packets.
+ * @retval 0  on success.
+ * @retval >0 if the message has no packet form.
+ * @see MIDIUniversalPacketFromCompact
+ */
+int MIDIUniversalPacketFromMessage( struct MIDIUniversalPacket * packet, unsigned char group,
+                                    struct MIDIMessage * message, MIDIBoolean upgrade ) {
+  struct MIDICompactMessage compact;
+  MIDIPrecond( packet != NULL, EFAULT );
+  MIDIPrecond( message != NULL, EINVAL );
+  if( MIDIMessageGetCompact( message, &compact ) ) return 1;
+  return MIDIUniversalPacketFromCompact( packet, group, &compact, upgrade );
+}
+
+/**
+ * @brief Set a message from a packet.
+ * The timestamp of the message is not changed.
+ * @public @memberof MIDIUniversalPacket
+ * @param packet  The packet.
+ * @param message The message.
+ * @retval 0  on success.
+ * @retval >0 if the packet has no message form.
+ * @see MIDIUniversalPacketToCompact
+ */
+int MIDIUniversalPacketToMessage( struct MIDIUniversalPacket * packet, struct MIDIMessage * message ) {
+  struct MIDICompactMessage compact;
+  MIDIPrecond( packet != NULL, EFAULT );
+  MIDIPrecond( message != NULL, EINVAL );
+  if( MIDIUniversalPacketToCompact( packet, &compact ) ) return 1;
+  return MIDIMessageSetCompact( message, &compact, NULL );
+}
+
+/** @} */
+
+/* MARK: Coding *//**
+ * @name Coding
+ * Encode and decode packets as streams of big endian words.
+ * @{
+ */
+
+/**
+ * @brief Encode packets into a buffer.
+ * Write the used words of the packets in network byte order. Encoding
+ * stops at the first packet that does not fit into the buffer.
+ * @public @memberof MIDIUniversalPacket
+ * @param size    The size of @c buffer in bytes.
+ * @param buffer  The buffer to encode to.
+ * @param n       The number of packets.
+ * @param packets The packets to encode.
+ * @param count   The number of encoded packets, may be @c NULL.
+ * @param written The number of bytes written, may be @c NULL.
+ * @retval 0  on success.
+ * @retval >0 if not all packets could be encoded.
+ */
+int MIDIUniversalPacketEncode( size_t size, void * buffer, size_t n, struct MIDIUniversalPacket * packets,
+                               size_t * count, size_t * written ) {
+  unsigned char * bytes = buffer;
+  size_t i, w, words, p = 0;
+  uint32_t word;
+  MIDIPrecond( buffer != NULL || size == 0, EINVAL );
+  MIDIPrecond( packets != NULL || n == 0, EINVAL );
+
+  for( i=0; i<n; i++ ) {
+    words = _ump_words[MIDI_UMP_TYPE( &(packets[i]) )];
+    if( p + words * 4 > size ) break;
+    for( w=0; w<words; w++ ) {
+      word = packets[i].words[w];
+      bytes[p++] = word >> 24;
+      bytes[p++] = word >> 16;
+      bytes[p++] = word >> 8;
+      bytes[p++] = word;
+    }
+  }
+  if( count != NULL )   *count   = i;
+  if( written != NULL ) *written = p;
+  return ( i < n ) ? 1 : 0;
+}
+
+/**
+ * @brief Decode packets from a buffer.
+ * Read big endian words and group them into packets by their message
+ * type. Decoding stops when @c max packets were decoded or the remaining
+ * bytes do not hold a complete packet, in which case they are left for
+ * the next call.
+ * @public @memberof MIDIUniversalPacket
+ * @param size    The size of @c buffer in bytes.
+ * @param buffer  The buffer to decode.
+ * @param max     The number of entries in @c packets.
+ * @param packets The array to decode the packets to.
+ * @param count   The number of decoded packets.
+ * @param read    The number of bytes that were consumed, may be @c NULL.
+ * @retval 0  on success.
+ * @retval >0 if the buffer could not be decoded.
+ */
+int MIDIUniversalPacketDecode( size_t size, void * buffer, size_t max, struct MIDIUniversalPacket * packets,
+                               size_t * count, size_t * read ) {
+  unsigned char * bytes = buffer;
+  size_t n = 0, w, words, p = 0;
+  MIDIPrecond( buffer != NULL || size == 0, EINVAL );
+  MIDIPrecond( packets != NULL || max == 0, EINVAL );
+  MIDIPrecond( count != NULL, EINVAL );
+
+  while( n < max && p + 4 <= size ) {
+    words = _ump_words[bytes[p] >> 4];
+    if( p + words * 4 > size ) break;
+    memset( &(packets[n]), 0, sizeof(struct MIDIUniversalPacket) );
+    for( w=0; w<words; w++ ) {
+      packets[n].words[w] = ( (uint32_t) bytes[p] << 24 ) | ( (uint32_t) bytes[p+1] << 16 )
+                          | ( (uint32_t) bytes[p+2] << 8 ) | bytes[p+3];
+      p += 4;
+    }
+    n++;
+  }
+  *count = n;
+  if( read != NULL ) *read = p;
+  return 0;
+}
+
+/** @} */
@@ -0,0 +1,64 @@
+#ifndef MIDIKIT_MIDI_UMP_H
+#define MIDIKIT_MIDI_UMP_H
+#include <stdlib.h>
+#include <stdint.h>
+#include "midi.h"
+
+#define MIDI_UMP_TYPE_UTILITY       0x0
+#define MIDI_UMP_TYPE_SYSTEM        0x1
+#define MIDI_UMP_TYPE_MIDI1_CHANNEL 0x2
+#define MIDI_UMP_TYPE_DATA_64       0x3
+#define MIDI_UMP_TYPE_MIDI2_CHANNEL 0x4
+#define MIDI_UMP_TYPE_DATA_128      0x5
+
+#define MIDI_UMP_UTILITY_NOOP         0x0
+#define MIDI_UMP_UTILITY_JR_CLOCK     0x1
+#define MIDI_UMP_UTILITY_JR_TIMESTAMP 0x2
+
+#define MIDI_UMP_STATUS_REGISTERED_PER_NOTE_CONTROL 0x0
+#define MIDI_UMP_STATUS_ASSIGNABLE_PER_NOTE_CONTROL 0x1
+#define MIDI_UMP_STATUS_REGISTERED_CONTROL          0x2
+#define MIDI_UMP_STATUS_ASSIGNABLE_CONTROL          0x3
+#define MIDI_UMP_STATUS_RELATIVE_REGISTERED_CONTROL 0x4
+#define MIDI_UMP_STATUS_RELATIVE_ASSIGNABLE_CONTROL 0x5
+#define MIDI_UMP_STATUS_PER_NOTE_PITCH_BEND         0x6
+#define MIDI_UMP_STATUS_PER_NOTE_MANAGEMENT         0xf
+
+#define MIDI_UMP_MAX_WORDS 4
+
+#define MIDI_UMP_TYPE( packet )  ( (packet)->words[0] >> 28 )
+#define MIDI_UMP_GROUP( packet ) ( ( (packet)->words[0] >> 24 ) & 0x0f )
+
+struct MIDIMessage;
+struct MIDICompactMessage;
+
+struct MIDIUniversalPacket {
+  uint32_t words[MIDI_UMP_MAX_WORDS];
+}
+#if defined( __GNUC__ )
+__attribute__(( aligned( 16 ) ))
+#endif
+;
+
+int MIDIUniversalPacketGetSize( struct MIDIUniversalPacket * packet, size_t * words );
+
+int MIDIUniversalPacketSetChannelVoice( struct MIDIUniversalPacket * packet, unsigned char group,
+                                        MIDIStatus status, MIDIChannel channel,
+                                        unsigned char index, unsigned char extra, uint32_t value );
+int MIDIUniversalPacketGetChannelVoice( struct MIDIUniversalPacket * packet, MIDIStatus * status, MIDIChannel * channel,
+                                        unsigned char * index, unsigned char * extra, uint32_t * value );
+int MIDIUniversalPacketSetTimestamp( struct MIDIUniversalPacket * packet, unsigned char group, unsigned short timestamp );
+
+int MIDIUniversalPacketFromCompact( struct MIDIUniversalPacket * packet, unsigned char group,
+                                    struct MIDICompactMessage * compact, MIDIBoolean upgrade );
+int MIDIUniversalPacketToCompact( struct MIDIUniversalPacket * packet, struct MIDICompactMessage * compact );
+int MIDIUniversalPacketFromMessage( struct MIDIUniversalPacket * packet, unsigned char group,
+                                    struct MIDIMessage * message, MIDIBoolean upgrade );
+int MIDIUniversalPacketToMessage( struct MIDIUniversalPacket * packet, struct MIDIMessage * message );
+
+int MIDIUniversalPacketEncode( size_t size, void * buffer, size_t n, struct MIDIUniversalPacket * packets,
+                               size_t * count, size_t * written );
+int MIDIUniversalPacketDecode( size_t size, void * buffer, size_t max, struct MIDIUniversalPacket * packets,
+                               size_t * count, size_t * read );
+
+#endif
@@ -0,0 +1,117 @@
+#include "test.h"
+#include "midi/array.h"
+#include "midi/type.h"
+
+struct TestItem {
+  int refs;
+  int key;
+};
+
+static void _retain_item( struct TestItem * item ) {
+  item->refs++;
+}
+
+static void _release_item( struct TestItem * item ) {
+  item->refs--;
+}
+
+static int _compare_key( void * a, void * b ) {
+  return ((struct TestItem *) a)->key - ((struct TestItem *) b)->key;
+}
+
+static int _apply_remove( void * item, void * info ) {
+  return MIDIArrayRemove( info, item );
+}
+
+MIDI_TYPE_SPEC( TestItem, 0x0000, &_retain_item, &_release_item, NULL, NULL );
+
+/**
+ * Test that unsorted arrays grow, retain their items and keep
+ * their order until items are removed.
+ */
+int test001_array( void ) {
+  struct TestItem items[10];
+  struct MIDIArray * array = MIDIArrayCreate( TestItemType, 0 );
+  void * item;
+  size_t i, length;
+
+  ASSERT_NOT_EQUAL( array, NULL, "Could not create array." );
+  for( i=0; i<10; i++ ) {
+    items[i].refs = 1;
+    items[i].key  = i;
+    ASSERT_NO_ERROR( MIDIArrayAdd( array, &(items[i]) ), "Could not add item." );
+    ASSERT_EQUAL( items[i].refs, 2, "Item was not retained." );
+  }
+  ASSERT_NO_ERROR( MIDIArrayGetLength( array, &length ), "Could not get length." );
+  ASSERT_EQUAL( length, 10, "Array has wrong length." );
+  for( i=0; i<10; i++ ) {
+    ASSERT_NO_ERROR( MIDIArrayGet( array, i, &item ), "Could not get item." );
+    ASSERT_EQUAL( item, &(items[i]), "Items are not kept in order." );
+  }
+
+  /* the last item takes the place of a removed one */
+  ASSERT_NO_ERROR( MIDIArrayRemove( array, &(items[2]) ), "Could not remove item." );
+  ASSERT_EQUAL( items[2].refs, 1, "Item was not released." );
+  ASSERT_EQUAL( MIDIArrayContains( array, &(items[2]) ), -1, "Removed item is still contained." );
+  ASSERT_EQUAL( MIDIArrayContains( array, &(items[3]) ), 0, "Item is not contained." );
+  ASSERT_NO_ERROR( MIDIArrayGet( array, 2, &item ), "Could not get item." );
+  ASSERT_EQUAL( item, &(items[9]), "Last item did not fill the gap." );
+  ASSERT_NO_ERROR( MIDIArrayRemoveAt( array, 0 ), "Could not remove item at index." );
+  ASSERT_EQUAL( items[0].refs, 1, "Item was not released." );
+
+  /* appliers may remove the item they are called with */
+  ASSERT_NO_ERROR( MIDIArrayApply( array, array, &_apply_remove ), "Could not apply remove function." );
+  ASSERT_NO_ERROR( MIDIArrayGetLength( array, &length ), "Could not get length." );
+  ASSERT_EQUAL( length, 0, "Applier did not remove all items." );
+  for( i=0; i<10; i++ ) {
+    ASSERT_EQUAL( items[i].refs, 1, "Item was not released." );
+  }
+
+  ASSERT_NO_ERROR( MIDIArrayAdd( array, &(items[0]) ), "Could not add item." );
+  MIDIArrayRelease( array );
+  ASSERT_EQUAL( items[0].refs, 1, "Item was not released on destruction." );
+  return 0;
+}
+
+/**
+ * Test that sorted arrays keep their items ordered and find
+ * them by key.
+ */
+int test002_array( void ) {
+  int keys[8] = { 5, 1, 7, 3, 0, 6, 2, 4 };
+  struct TestItem items[8], key;
+  struct MIDIArray * array = MIDIArrayCreateSorted( TestItemType, 2, &_compare_key );
+  void * item;
+  size_t i, index;
+
+  ASSERT_NOT_EQUAL( array, NULL, "Could not create sorted array." );
+  for( i=0; i<8; i++ ) {
+    items[i].refs = 1;
+    items[i].key  = keys[i];
+    ASSERT_NO_ERROR( MIDIArrayAdd( array, &(items[i]) ), "Could not add item." );
+  }
+  for( i=0; i<8; i++ ) {
+    ASSERT_NO_ERROR( MIDIArrayGet( array, i, &item ), "Could not get item." );
+    ASSERT_EQUAL( ((struct TestItem *) item)->key, (int) i, "Items are not sorted." );
+  }
+
+  key.key = 3;
+  ASSERT_NO_ERROR( MIDIArrayIndexOf( array, &key, &index ), "Could not find item by key." );
+  ASSERT_EQUAL( index, 3, "Found item at wrong index." );
+  key.key = 9;
+  ASSERT_EQUAL( MIDIArrayIndexOf( array, &key, &index ), -1, "Found item that was never added." );
+  ASSERT_EQUAL( index, 8, "Wrong insertion point for missing item." );
+
+  key.key = 3;
+  ASSERT_NO_ERROR( MIDIArrayRemove( array, &key ), "Could not remove item by key." );
+  ASSERT_EQUAL( items[3].refs, 1, "Item was not released." );
+  ASSERT_EQUAL( MIDIArrayContains( array, &key ), -1, "Removed item is still contained." );
+  ASSERT_NO_ERROR( MIDIArrayGet( array, 3, &item ), "Could not get item." );
+  ASSERT_EQUAL( ((struct TestItem *) item)->key, 4, "Removal did not keep the order." );
+
+  MIDIArrayRelease( array );
+  for( i=0; i<8; i++ ) {
+    ASSERT_EQUAL( items[i].refs, 1, "Item was not released on destruction." );
+  }
+  return 0;
+}
@@ -0,0 +1,115 @@
+#include "test.h"
+#include "midi/port.h"
+#include "midi/clock.h"
+#include "midi/message.h"
+#include "midi/audio_bridge.h"
+
+/* send a note on message with a timestamp relative to a given time */
+static int _send_note( struct MIDIPort * port, MIDIKey key, MIDITimestamp timestamp ) {
+  struct MIDIMessage * message = MIDIMessageCreate( MIDI_STATUS_NOTE_ON );
+  MIDIChannel channel = MIDI_CHANNEL_1;
+  MIDIVelocity velocity = 100;
+  int result;
+  ASSERT_NOT_EQUAL( message, NULL, "Could not create message." );
+  MIDIMessageSet( message, MIDI_CHANNEL, sizeof(MIDIChannel), &channel );
+  MIDIMessageSet( message, MIDI_KEY, sizeof(MIDIKey), &key );
+  MIDIMessageSet( message, MIDI_VELOCITY, sizeof(MIDIVelocity), &velocity );
+  MIDIMessageSetTimestamp( message, timestamp );
+  result = MIDIPortSend( port, MIDIMessageType, message );
+  MIDIMessageRelease( message );
+  return result;
+}
+
+/**
+ * Test that received messages are handed out per audio block with
+ * their timestamps converted to frame offsets.
+ */
+int test001_audio_bridge( void ) {
+  struct MIDIAudioThreadBridge * bridge = MIDIAudioThreadBridgeCreate( NULL, 16 );
+  struct MIDIAudioThreadBridgeStats stats;
+  struct MIDIAudioEvent events[8];
+  struct MIDIPort * port, * source;
+  struct MIDIClock * clock;
+  MIDISamplingRate rate;
+  MIDITimestamp start;
+  size_t count;
+
+  ASSERT_NOT_EQUAL( bridge, NULL, "Could not create bridge." );
+  ASSERT_NO_ERROR( MIDIAudioThreadBridgeGetPort( bridge, &port ), "Could not get bridge port." );
+  ASSERT_NO_ERROR( MIDIAudioThreadBridgeGetClock( bridge, &clock ), "Could not get bridge clock." );
+  ASSERT_NO_ERROR( MIDIClockGetSamplingRate( clock, &rate ), "Could not get sampling rate." );
+  source = MIDIPortCreate( "source", MIDI_PORT_OUT, NULL, NULL );
+  ASSERT_NO_ERROR( MIDIPortConnect( source, port ), "Could not connect bridge." );
+
+  /* 10ms late, at the block start, 2ms and 20ms into the future */
+  start = 1000 * (MIDITimestamp) rate;
+  ASSERT_NO_ERROR( _send_note( source, 60, start - rate / 100 ), "Could not send message." );
+  ASSERT_NO_ERROR( _send_note( source, 61, start ), "Could not send message." );
+  ASSERT_NO_ERROR( _send_note( source, 62, start + rate / 500 ), "Could not send message." );
+  ASSERT_NO_ERROR( _send_note( source, 63, start + rate / 50 ), "Could not send message." );
+
+  /* 256 frames at 48KHz are a little more than 5ms */
+  ASSERT_NO_ERROR( MIDIAudioThreadBridgeDrain( bridge, start, 256, 48000, 8, &(events[0]), &count ),
+                   "Could not drain bridge." );
+  ASSERT_EQUAL( count, 3, "Drained wrong number of events." );
+  ASSERT_EQUAL( events[0].frame, 0, "Late event was not placed at the block start." );
+  ASSERT_EQUAL( events[0].bytes[1], 60, "Drained wrong event." );
+  ASSERT_EQUAL( events[1].frame, 0, "Wrong frame offset." );
+  ASSERT_EQUAL( events[2].frame, 96, "Wrong frame offset." );
+  ASSERT_EQUAL( events[2].bytes[0], 0x90, "Drained wrong status." );
+  ASSERT_EQUAL( events[2].bytes[2], 100, "Drained wrong velocity." );
+
+  /* the future event is kept for its block */
+  ASSERT_NO_ERROR( MIDIAudioThreadBridgeDrain( bridge, start + rate / 200, 256, 48000, 8, &(events[0]), &count ),
+                   "Could not drain bridge." );
+  ASSERT_EQUAL( count, 0, "Drained event before it was due." );
+  ASSERT_NO_ERROR( MIDIAudioThreadBridgeDrain( bridge, start + rate / 50 - rate / 1000, 256, 48000, 8, &(events[0]), &count ),
+                   "Could not drain bridge." );
+  ASSERT_EQUAL( count, 1, "Event was not drained in its block." );
+  ASSERT_EQUAL( events[0].frame, 48, "Wrong frame offset." );
+  ASSERT_EQUAL( events[0].bytes[1], 63, "Drained wrong event." );
+
+  ASSERT_NO_ERROR( MIDIAudioThreadBridgeGetStats( bridge, &stats ), "Could not get stats." );
+  ASSERT_EQUAL( stats.received, 4, "Wrong number of received messages." );
+  ASSERT_EQUAL( stats.late, 1, "Wrong number of late events." );
+  ASSERT_EQUAL( stats.dropped, 0, "Dropped messages." );
+
+  MIDIPortRelease( source );
+  MIDIAudioThreadBridgeRelease( bridge );
+  return 0;
+}
+
+/**
+ * Test that messages are dropped when the bridge is full and that
+ * the caller's event buffer is not overrun.
+ */
+int test002_audio_bridge( void ) {
+  struct MIDIAudioThreadBridge * bridge = MIDIAudioThreadBridgeCreate( NULL, 16 );
+  struct MIDIAudioThreadBridgeStats stats;
+  struct MIDIAudioEvent events[10];
+  struct MIDIPort * port, * source;
+  size_t count;
+  int i;
+
+  ASSERT_NOT_EQUAL( bridge, NULL, "Could not create bridge." );
+  ASSERT_NO_ERROR( MIDIAudioThreadBridgeGetPort( bridge, &port ), "Could not get bridge port." );
+  source = MIDIPortCreate( "source", MIDI_PORT_OUT, NULL, NULL );
+  ASSERT_NO_ERROR( MIDIPortConnect( source, port ), "Could not connect bridge." );
+
+  for( i=0; i<20; i++ ) {
+    ASSERT_NO_ERROR( _send_note( source, 60+i, 0 ), "Could not send message." );
+  }
+  ASSERT_NO_ERROR( MIDIAudioThreadBridgeGetStats( bridge, &stats ), "Could not get stats." );
+  ASSERT_EQUAL( stats.received, 20, "Wrong number of received messages." );
+  ASSERT_EQUAL( stats.dropped, 4, "Wrong number of dropped messages." );
+
+  ASSERT_NO_ERROR( MIDIAudioThreadBridgeDrain( bridge, 0, 64, 44100, 10, &(events[0]), &count ), "Could not drain bridge." );
+  ASSERT_EQUAL( count, 10, "Event buffer was not filled." );
+  ASSERT_NO_ERROR( MIDIAudioThreadBridgeDrain( bridge, 0, 64, 44100, 10, &(events[0]), &count ), "Could not drain bridge." );
+  ASSERT_EQUAL( count, 6, "Remaining events were not drained." );
+  ASSERT_EQUAL( events[5].bytes[1], 75, "Drained wrong event." );
+
+  MIDIPortRelease( source );
+  MIDIAudioThreadBridgeRelease( bridge );
+  return 0;
+}
@@ -125,3 +125,71 @@ int test006_clock( void ) {
   ASSERT_GREATER( b, a-10, "Roundtrip conversion did break timestamp." );
   return 0;
 }
+
+/**
+ * Test that skewed clocks drift and that timestamp conversion
+ * takes the skew into account.
+ */
+int test007_clock( void ) {
+  struct MIDIClock * local  = MIDIClockCreate( 10000 );
+  struct MIDIClock * remote = MIDIClockCreate( 10000 );
+  MIDITimestamp now, a;
+  double skew;
+
+  ASSERT_NOT_EQUAL( local, NULL, "Could not create MIDI clock." );
+  ASSERT_NOT_EQUAL( remote, NULL, "Could not create MIDI clock." );
+  ASSERT_NO_ERROR( MIDIClockGetNow( local, &now ), "Could not get current clock time." );
+  ASSERT_NO_ERROR( MIDIClockAdjust( remote, now + 5000, 0.001 ), "Could not adjust clock." );
+  ASSERT_NO_ERROR( MIDIClockGetSkew( remote, &skew ), "Could not get skew." );
+  ASSERT_EQUAL( skew, 0.001, "Got wrong skew." );
+
+  a = now;
+  ASSERT_NO_ERROR( MIDIClockConvertTimestamp( remote, local, &a ), "Could not convert timestamp." );
+  ASSERT_GREATER( a, now + 5000 - 5, "Conversion did not apply the offset." );
+  ASSERT_LESS( a, now + 5000 + 5, "Conversion did not apply the offset." );
+
+  /* one thousand seconds later the remote clock gained one second */
+  a = now + 10000000;
+  ASSERT_NO_ERROR( MIDIClockConvertTimestamp( remote, local, &a ), "Could not convert timestamp." );
+  ASSERT_GREATER( a, now + 10015000 - 5, "Conversion did not apply the skew." );
+  ASSERT_LESS( a, now + 10015000 + 5, "Conversion did not apply the skew." );
+
+  ASSERT_NO_ERROR( MIDIClockConvertTimestamp( local, remote, &a ), "Could not convert timestamp." );
+  ASSERT_GREATER( a, now + 10000000 - 5, "Roundtrip conversion did break timestamp." );
+  ASSERT_LESS( a, now + 10000000 + 5, "Roundtrip conversion did break timestamp." );
+
+  MIDIClockRelease( remote );
+  MIDIClockRelease( local );
+  return 0;
+}
+
+/**
+ * Test that clocks with different rates read the same time, so that
+ * the conversion of the timestamp source agrees with the conversion
+ * between clocks.
+ */
+int test008_clock( void ) {
+  static MIDISamplingRate rates[] = { 1000, 10000, 44100, 48000, 96000, 192000, 0 };
+  struct MIDIClock * usec = MIDIClockCreate( 1000000 ), * clock;
+  MIDITimestamp a, b, c;
+  int i;
+
+  ASSERT_NOT_EQUAL( usec, NULL, "Could not create MIDI clock." );
+  for( i=0; rates[i] != 0; i++ ) {
+    clock = MIDIClockCreate( rates[i] );
+    ASSERT_NOT_EQUAL( clock, NULL, "Could not create MIDI clock." );
+    ASSERT_NO_ERROR( MIDIClockSetNow( clock, 0 ), "Could not set current clock time." );
+    ASSERT_NO_ERROR( MIDIClockSetNow( usec, 0 ), "Could not set current clock time." );
+    usleep( 2000 );
+    ASSERT_NO_ERROR( MIDIClockGetNow( clock, &a ), "Could not get current clock time." );
+    ASSERT_NO_ERROR( MIDIClockGetNow( usec, &b ), "Could not get current clock time." );
+    c = a;
+    ASSERT_NO_ERROR( MIDIClockConvertTimestamp( usec, clock, &c ), "Could not convert timestamp." );
+    /* one tick of the slower clock plus the time between the two reads */
+    ASSERT_LESS( b - c, 1000000 / rates[i] + 100, "Clocks with different rates disagree." );
+    ASSERT_GREATER( b - c, -100, "Clocks with different rates disagree." );
+    MIDIClockRelease( clock );
+  }
+  MIDIClockRelease( usec );
+  return 0;
+}
@@ -0,0 +1,135 @@
+#include <string.h>
+#include "test.h"
+#include "midi/message.h"
+#include "midi/compact.h"
+
+#define COMPACT_TEST_COUNT 1003
+
+static struct MIDICompactMessage _messages[COMPACT_TEST_COUNT];
+static struct MIDICompactMessage _expected[COMPACT_TEST_COUNT];
+
+/* fill the messages with a reproducible mix of channel and system messages */
+static void _fill( void ) {
+  static const unsigned char statuses[] = { 0x80, 0x90, 0x90, 0xa0, 0xb0, 0xc0, 0xe0, 0xf8 };
+  unsigned long seed = 12345;
+  size_t i;
+  for( i=0; i<COMPACT_TEST_COUNT; i++ ) {
+    seed = seed * 1103515245 + 12345;
+    _messages[i].bytes[0]     = statuses[(seed >> 8) & 7] | ( ( statuses[(seed >> 8) & 7] < 0xf0 ) ? ( (seed >> 12) & 0x0f ) : 0 );
+    _messages[i].bytes[1]     = (seed >> 16) & 0x7f;
+    _messages[i].bytes[2]     = ( (seed >> 24) & 7 ) ? ( (seed >> 4) & 0x7f ) : 0;
+    _messages[i].flags        = 0;
+    _messages[i].timestamp    = i;
+    _messages[i].sysex_offset = 0;
+    _messages[i].sysex_size   = 0;
+  }
+  memcpy( &(_expected[0]), &(_messages[0]), sizeof(_messages) );
+}
+
+static int _is_key( unsigned char status ) {
+  return ( status & 0xf0 ) == 0x80 || ( status & 0xf0 ) == 0x90 || ( status & 0xf0 ) == 0xa0;
+}
+
+/**
+ * Test that the filter keeps the passing messages in order.
+ */
+int test001_compact( void ) {
+  struct MIDICompactFilter filter;
+  size_t i, n = 0, written;
+  unsigned char s;
+
+  _fill();
+  MIDICompactFilterInit( &filter );
+  MIDICompactFilterSetStatus( &filter, MIDI_STATUS_PROGRAM_CHANGE, MIDI_OFF );
+  MIDICompactFilterSetStatus( &filter, MIDI_STATUS_TIMING_CLOCK, MIDI_OFF );
+  MIDICompactFilterSetChannel( &filter, MIDI_CHANNEL_3, MIDI_OFF );
+  MIDICompactFilterSetKeyRange( &filter, 36, 84 );
+  for( i=0; i<COMPACT_TEST_COUNT; i++ ) {
+    s = _expected[i].bytes[0];
+    if( s >= 0xf0 || ( s & 0xf0 ) == 0xc0 || ( s & 0x0f ) == MIDI_CHANNEL_3 ) continue;
+    if( _is_key( s ) && ( _expected[i].bytes[1] < 36 || _expected[i].bytes[1] > 84 ) ) continue;
+    _expected[n++] = _expected[i];
+  }
+
+  ASSERT_NO_ERROR( MIDICompactFilterApply( &filter, COMPACT_TEST_COUNT, &(_messages[0]), &(_messages[0]), &written ),
+                   "Could not filter messages." );
+  ASSERT_EQUAL( written, n, "Filtered wrong number of messages." );
+  ASSERT_NO_ERROR( memcmp( &(_messages[0]), &(_expected[0]), sizeof( struct MIDICompactMessage ) * n ),
+                   "Filtered wrong messages." );
+  return 0;
+}
+
+/**
+ * Test that channels are remapped and notes are transposed with
+ * clamping, leaving other messages alone.
+ */
+int test002_compact( void ) {
+  unsigned char map[16];
+  size_t i;
+  int c, key;
+  unsigned char s;
+
+  _fill();
+  for( c=0; c<16; c++ ) map[c] = c;
+  map[MIDI_CHANNEL_1] = MIDI_CHANNEL_10;
+  map[MIDI_CHANNEL_5] = MIDI_CHANNEL_1;
+  for( i=0; i<COMPACT_TEST_COUNT; i++ ) {
+    s = _expected[i].bytes[0];
+    if( s < 0xf0 ) _expected[i].bytes[0] = ( s & 0xf0 ) | map[s & 0x0f];
+    if( _is_key( s ) ) {
+      key = _expected[i].bytes[1] - 40;
+      _expected[i].bytes[1] = ( key < 0 ) ? 0 : key;
+    }
+  }
+
+  ASSERT_NO_ERROR( MIDICompactRemapChannels( COMPACT_TEST_COUNT, &(_messages[0]), &(map[0]) ), "Could not remap channels." );
+  ASSERT_NO_ERROR( MIDICompactTranspose( COMPACT_TEST_COUNT, &(_messages[0]), -40 ), "Could not transpose." );
+  ASSERT_NO_ERROR( memcmp( &(_messages[0]), &(_expected[0]), sizeof(_messages) ), "Transformed wrong messages." );
+
+  ASSERT_NO_ERROR( MIDICompactTranspose( COMPACT_TEST_COUNT, &(_messages[0]), 127 ), "Could not transpose." );
+  for( i=0; i<COMPACT_TEST_COUNT; i++ ) {
+    if( _is_key( _messages[i].bytes[0] ) ) {
+      ASSERT_EQUAL( _messages[i].bytes[1], 127, "Did not clamp key." );
+    }
+  }
+  return 0;
+}
+
+/**
+ * Test that note on velocities are scaled and mapped through curves
+ * without turning them into note off messages.
+ */
+int test003_compact( void ) {
+  unsigned char curve[128];
+  unsigned int velocity;
+  size_t i;
+  unsigned char s;
+
+  _fill();
+  for( i=0; i<COMPACT_TEST_COUNT; i++ ) {
+    s = _expected[i].bytes[0];
+    if( ( s & 0xf0 ) != 0x90 || _expected[i].bytes[2] == 0 ) continue;
+    velocity = ( _expected[i].bytes[2] * 300 ) >> 8;
+    _expected[i].bytes[2] = ( velocity > 127 ) ? 127 : ( velocity == 0 ) ? 1 : velocity;
+  }
+  ASSERT_NO_ERROR( MIDICompactScaleVelocity( COMPACT_TEST_COUNT, &(_messages[0]), 300 ), "Could not scale velocities." );
+  ASSERT_NO_ERROR( memcmp( &(_messages[0]), &(_expected[0]), sizeof(_messages) ), "Scaled wrong velocities." );
+
+  ASSERT_NO_ERROR( MIDICompactScaleVelocity( COMPACT_TEST_COUNT, &(_messages[0]), 1 ), "Could not scale velocities." );
+  for( i=0; i<COMPACT_TEST_COUNT; i++ ) {
+    if( ( _messages[i].bytes[0] & 0xf0 ) == 0x90 && _expected[i].bytes[2] != 0 ) {
+      ASSERT_EQUAL( _messages[i].bytes[2], 1, "Turned note on into note off." );
+    }
+  }
+
+  _fill();
+  for( i=0; i<128; i++ ) curve[i] = 127 - i;
+  for( i=0; i<COMPACT_TEST_COUNT; i++ ) {
+    s = _expected[i].bytes[0];
+    if( ( s & 0xf0 ) != 0x90 || _expected[i].bytes[2] == 0 ) continue;
+    _expected[i].bytes[2] = ( _expected[i].bytes[2] == 127 ) ? 1 : curve[_expected[i].bytes[2]];
+  }
+  ASSERT_NO_ERROR( MIDICompactApplyVelocityCurve( COMPACT_TEST_COUNT, &(_messages[0]), &(curve[0]) ), "Could not apply curve." );
+  ASSERT_NO_ERROR( memcmp( &(_messages[0]), &(_expected[0]), sizeof(_messages) ), "Applied wrong curve." );
+  return 0;
+}
@@ -0,0 +1,165 @@
+#include "test.h"
+#include "midi/device.h"
+#include "midi/controller.h"
+
+static int _receive_cc( struct MIDIController * controller, MIDIControl control, MIDIValue value ) {
+  return MIDIControllerReceiveControlChange( controller, NULL, MIDI_CHANNEL_1, control, value );
+}
+
+/**
+ * Test that non-registered parameters received through data entry
+ * are stored and recalled when they are selected again.
+ */
+int test001_controller( void ) {
+  struct MIDIController * controller = MIDIControllerCreate( NULL );
+  MIDILongValue value;
+  MIDIValue entry;
+
+  ASSERT_NOT_EQUAL( controller, NULL, "Could not create controller." );
+  ASSERT_EQUAL( MIDIControllerGetNonRegisteredParameter( controller, MIDI_LONG_VALUE( 0x12, 0x34 ), sizeof(value), &value ), 1,
+                "Got a non-registered parameter that was never stored." );
+
+  ASSERT_NO_ERROR( _receive_cc( controller, MIDI_CONTROL_NON_REGISTERED_PARAMETER_NUMBER_MSB, 0x12 ), "Could not select parameter." );
+  ASSERT_NO_ERROR( _receive_cc( controller, MIDI_CONTROL_NON_REGISTERED_PARAMETER_NUMBER_LSB, 0x34 ), "Could not select parameter." );
+  ASSERT_NO_ERROR( _receive_cc( controller, MIDI_CONTROL_DATA_ENTRY, 0x40 ), "Could not receive data entry." );
+  ASSERT_NO_ERROR( _receive_cc( controller, MIDI_CONTROL_DATA_ENTRY+32, 0x01 ), "Could not receive data entry." );
+  ASSERT_NO_ERROR( MIDIControllerGetNonRegisteredParameter( controller, MIDI_LONG_VALUE( 0x12, 0x34 ), sizeof(value), &value ),
+                   "Could not get non-registered parameter." );
+  ASSERT_EQUAL( value, MIDI_LONG_VALUE( 0x40, 0x01 ), "Stored wrong value." );
+
+  /* parameters on a different page do not interfere */
+  ASSERT_NO_ERROR( _receive_cc( controller, MIDI_CONTROL_NON_REGISTERED_PARAMETER_NUMBER_MSB, 0x7e ), "Could not select parameter." );
+  ASSERT_NO_ERROR( _receive_cc( controller, MIDI_CONTROL_NON_REGISTERED_PARAMETER_NUMBER_LSB, 0x00 ), "Could not select parameter." );
+  ASSERT_NO_ERROR( _receive_cc( controller, MIDI_CONTROL_DATA_ENTRY, 0x05 ), "Could not receive data entry." );
+  ASSERT_NO_ERROR( _receive_cc( controller, MIDI_CONTROL_DATA_INCREMENT, 0 ), "Could not receive data increment." );
+  ASSERT_NO_ERROR( MIDIControllerGetNonRegisteredParameter( controller, MIDI_LONG_VALUE( 0x7e, 0x00 ), sizeof(value), &value ),
+                   "Could not get non-registered parameter." );
+  ASSERT_EQUAL( value, MIDI_LONG_VALUE( 0x05, 0x01 ), "Data increment was not stored." );
+
+  ASSERT_NO_ERROR( _receive_cc( controller, MIDI_CONTROL_NON_REGISTERED_PARAMETER_NUMBER_MSB, 0x12 ), "Could not select parameter." );
+  ASSERT_NO_ERROR( _receive_cc( controller, MIDI_CONTROL_NON_REGISTERED_PARAMETER_NUMBER_LSB, 0x34 ), "Could not select parameter." );
+  ASSERT_NO_ERROR( MIDIControllerGetControl( controller, MIDI_CONTROL_DATA_ENTRY, sizeof(entry), &entry ),
+                   "Could not get data entry." );
+  ASSERT_EQUAL( entry, 0x40, "Selecting the parameter did not recall its value." );
+
+  MIDIControllerRelease( controller );
+  return 0;
+}
+
+/**
+ * Test that non-registered parameters can be set directly and that
+ * registered parameters are kept apart from them.
+ */
+int test002_controller( void ) {
+  struct MIDIController * controller = MIDIControllerCreate( NULL );
+  MIDILongValue value = MIDI_LONG_VALUE( 0x22, 0x11 );
+
+  ASSERT_NOT_EQUAL( controller, NULL, "Could not create controller." );
+  ASSERT_NO_ERROR( MIDIControllerSetNonRegisteredParameter( controller, 0x0000, sizeof(value), &value ),
+                   "Could not set non-registered parameter." );
+
+  /* pitch bend range is registered parameter 0 */
+  ASSERT_NO_ERROR( _receive_cc( controller, MIDI_CONTROL_REGISTERED_PARAMETER_NUMBER_MSB, 0x00 ), "Could not select parameter." );
+  ASSERT_NO_ERROR( _receive_cc( controller, MIDI_CONTROL_REGISTERED_PARAMETER_NUMBER_LSB, 0x00 ), "Could not select parameter." );
+  ASSERT_NO_ERROR( _receive_cc( controller, MIDI_CONTROL_DATA_ENTRY, 12 ), "Could not receive data entry." );
+
+  value = 0;
+  ASSERT_NO_ERROR( MIDIControllerGetNonRegisteredParameter( controller, 0x0000, sizeof(value), &value ),
+                   "Could not get non-registered parameter." );
+  ASSERT_EQUAL( value, MIDI_LONG_VALUE( 0x22, 0x11 ), "Registered parameter overwrote non-registered parameter." );
+
+  MIDIControllerRelease( controller );
+  return 0;
+}
+
+/**
+ * Test that the state of a controller can be stored and recalled
+ * including its non-registered parameters.
+ */
+int test003_controller( void ) {
+  struct MIDIController * controller = MIDIControllerCreate( NULL );
+  struct MIDIControllerState state;
+  MIDILongValue value = MIDI_LONG_VALUE( 0x33, 0x44 );
+  MIDIValue volume = 17;
+  size_t size;
+
+  ASSERT_NOT_EQUAL( controller, NULL, "Could not create controller." );
+  ASSERT_NO_ERROR( MIDIControllerSetControl( controller, MIDI_CONTROL_CHANNEL_VOLUME, sizeof(volume), &volume ),
+                   "Could not set control." );
+  ASSERT_NO_ERROR( MIDIControllerSetNonRegisteredParameter( controller, MIDI_LONG_VALUE( 0x10, 0x20 ), sizeof(value), &value ),
+                   "Could not set non-registered parameter." );
+  ASSERT_NO_ERROR( MIDIControllerStore( controller, sizeof(state), &state, &size ), "Could not store controller." );
+  ASSERT_EQUAL( size, sizeof(state), "Stored wrong number of bytes." );
+  ASSERT_EQUAL( state.version, MIDI_CONTROLLER_STATE_VERSION, "Stored wrong version." );
+
+  volume = 99;
+  value  = 0;
+  ASSERT_NO_ERROR( MIDIControllerSetControl( controller, MIDI_CONTROL_CHANNEL_VOLUME, sizeof(volume), &volume ),
+                   "Could not set control." );
+  ASSERT_NO_ERROR( MIDIControllerSetNonRegisteredParameter( controller, MIDI_LONG_VALUE( 0x10, 0x20 ), sizeof(value), &value ),
+                   "Could not set non-registered parameter." );
+  ASSERT_NO_ERROR( MIDIControllerRecall( controller, sizeof(state), &state, &size ), "Could not recall controller." );
+  ASSERT_NO_ERROR( MIDIControllerGetControl( controller, MIDI_CONTROL_CHANNEL_VOLUME, sizeof(volume), &volume ),
+                   "Could not get control." );
+  ASSERT_EQUAL( volume, 17, "Recalled wrong control value." );
+  ASSERT_NO_ERROR( MIDIControllerGetNonRegisteredParameter( controller, MIDI_LONG_VALUE( 0x10, 0x20 ), sizeof(value), &value ),
+                   "Could not get non-registered parameter." );
+  ASSERT_EQUAL( value, MIDI_LONG_VALUE( 0x33, 0x44 ), "Recalled wrong non-registered parameter." );
+
+  state.version++;
+  ASSERT_ERROR( MIDIControllerRecall( controller, sizeof(state), &state, &size ), "Recalled state of another version." );
+  MIDIErrorNumber = 0;
+  MIDIControllerRelease( controller );
+  return 0;
+}
+
+/**
+ * Test that staged snapshots become current only when they are
+ * committed and that a device stores and recalls all channels.
+ */
+int test004_controller( void ) {
+  struct MIDIDevice * device = MIDIDeviceCreate( NULL );
+  struct MIDIController * a = MIDIControllerCreate( NULL );
+  struct MIDIController * b = MIDIControllerCreate( NULL );
+  struct MIDIControllerState scene[16];
+  MIDIValue volume;
+
+  ASSERT_NO_ERROR( MIDIDeviceSetChannelController( device, MIDI_CHANNEL_1, a ), "Could not set controller." );
+  ASSERT_NO_ERROR( MIDIDeviceSetChannelController( device, MIDI_CHANNEL_2, b ), "Could not set controller." );
+  ASSERT_NO_ERROR( MIDIDeviceSetChannelController( device, MIDI_CHANNEL_3, b ), "Could not set controller." );
+  MIDIControllerRelease( a );
+  MIDIControllerRelease( b );
+
+  ASSERT_NO_ERROR( _receive_cc( a, MIDI_CONTROL_CHANNEL_VOLUME, 10 ), "Could not receive control change." );
+  ASSERT_NO_ERROR( _receive_cc( b, MIDI_CONTROL_CHANNEL_VOLUME, 20 ), "Could not receive control change." );
+  ASSERT_NO_ERROR( MIDIDeviceStoreAll( device, &(scene[0]) ), "Could not store scene." );
+  ASSERT_EQUAL( scene[MIDI_CHANNEL_4].version, 0, "Stored channel without controller." );
+  ASSERT_EQUAL( scene[MIDI_CHANNEL_3].controls[MIDI_CONTROL_CHANNEL_VOLUME], 20, "Stored wrong state." );
+
+  ASSERT_NO_ERROR( _receive_cc( a, MIDI_CONTROL_CHANNEL_VOLUME, 11 ), "Could not receive control change." );
+  ASSERT_NO_ERROR( _receive_cc( b, MIDI_CONTROL_CHANNEL_VOLUME, 21 ), "Could not receive control change." );
+  ASSERT_NO_ERROR( MIDIDeviceStageAll( device, &(scene[0]) ), "Could not stage scene." );
+  ASSERT_ERROR( MIDIControllerStage( a, sizeof(scene[0]), &(scene[0]) ), "Staged twice." );
+  MIDIErrorNumber = 0;
+  ASSERT_NO_ERROR( MIDIControllerGetControl( a, MIDI_CONTROL_CHANNEL_VOLUME, sizeof(volume), &volume ),
+                   "Could not get control." );
+  ASSERT_EQUAL( volume, 11, "Staged scene became current before commit." );
+
+  ASSERT_NO_ERROR( MIDIDeviceCommitAll( device ), "Could not commit scene." );
+  ASSERT_NO_ERROR( MIDIControllerGetControl( a, MIDI_CONTROL_CHANNEL_VOLUME, sizeof(volume), &volume ),
+                   "Could not get control." );
+  ASSERT_EQUAL( volume, 10, "Did not commit staged scene." );
+  ASSERT_NO_ERROR( MIDIControllerGetControl( b, MIDI_CONTROL_CHANNEL_VOLUME, sizeof(volume), &volume ),
+                   "Could not get control." );
+  ASSERT_EQUAL( volume, 20, "Did not commit staged scene." );
+  ASSERT_EQUAL( MIDIControllerCommit( a ), 1, "Committed without staged scene." );
+
+  ASSERT_NO_ERROR( _receive_cc( a, MIDI_CONTROL_CHANNEL_VOLUME, 12 ), "Could not receive control change." );
+  ASSERT_NO_ERROR( MIDIDeviceRecallAll( device, &(scene[0]) ), "Could not recall scene." );
+  ASSERT_NO_ERROR( MIDIControllerGetControl( a, MIDI_CONTROL_CHANNEL_VOLUME, sizeof(volume), &volume ),
+                   "Could not get control." );
+  ASSERT_EQUAL( volume, 10, "Did not recall scene." );
+
+  MIDIDeviceRelease( device );
+  return 0;
+}
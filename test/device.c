@@ -2,11 +2,31 @@
 #include "midi/port.h"
 #include "midi/message.h"
 #include "midi/device.h"
+#include "midi/controller.h"
 
 MIDIStatus _status;
+MIDILongValue _value;
+MIDITimestamp _timestamp;
 
 static int _receive_rt( struct MIDIDevice * device, MIDIStatus status, MIDITimestamp timestamp ) {
-  _status = status;
+  _status    = status;
+  _timestamp = timestamp;
+  return 0;
+}
+
+static int _receive_pwc( struct MIDIDevice * device, MIDIChannel channel, MIDILongValue value ) {
+  _status = MIDI_STATUS_PITCH_WHEEL_CHANGE;
+  _value  = value;
+  return 0;
+}
+
+static int _batches;
+static size_t _batched;
+
+static int _receive_batch( struct MIDIDevice * device, MIDIStatus status, MIDIChannel channel,
+                           size_t count, struct MIDICompactMessage * messages ) {
+  _batches++;
+  _batched += count;
   return 0;
 }
 
@@ -17,7 +37,7 @@ static struct MIDIDeviceDelegate _test_device = {
   NULL, /* recv_cc   */
   NULL, /* recv_pc   */
   NULL, /* recv_cp   */
-  NULL, /* recv_pwc  */
+  &_receive_pwc,
   NULL, /* recv_sx   */
   NULL, /* recv_tcqf */
   NULL, /* recv_spp  */
@@ -89,3 +109,67 @@ int test002_device( void ) {
   MIDIDeviceRelease( device_slave );
   return 0;
 }
+
+/**
+ * Test that compact messages are dispatched without a port.
+ */
+int test003_device( void ) {
+  struct MIDICompactMessage compact = { { 0xe3, 0x01, 0x40 }, 0, 0, 0, 0 };
+  struct MIDIDevice * device;
+
+  ASSERT_EQUAL( sizeof(struct MIDICompactMessage), 16, "Compact message has unexpected size." );
+  device = MIDIDeviceCreate( &_test_device );
+  ASSERT_NOT_EQUAL( device, NULL, "Could not create device!" );
+  ASSERT_NO_ERROR( MIDIDeviceReceiveCompact( device, 0, &compact, NULL ), "Could not receive pitch wheel change." );
+  ASSERT_EQUAL( _status, MIDI_STATUS_PITCH_WHEEL_CHANGE, "Test device did not receive pitch wheel change." );
+  ASSERT_EQUAL( _value, 0x2001, "Test device received wrong pitch wheel value." );
+
+  compact.bytes[0]  = MIDI_STATUS_CONTINUE;
+  compact.timestamp = 5;
+  ASSERT_NO_ERROR( MIDIDeviceReceiveCompact( device, 1000, &compact, NULL ), "Could not receive real time message." );
+  ASSERT_EQUAL( _status, MIDI_STATUS_CONTINUE, "Test device did not receive real time message." );
+  ASSERT_EQUAL( _timestamp, 1005, "Real time message was not stamped relative to the base time." );
+  MIDIDeviceRelease( device );
+  return 0;
+}
+
+/**
+ * Test that blocks of compact messages are dispatched in runs
+ * and that control changes still reach the channel controller.
+ */
+int test004_device( void ) {
+  struct MIDICompactMessage block[7] = {
+    { { 0x90, 60, 100 }, 0, 0, 0, 0 },
+    { { 0x90, 64, 100 }, 0, 0, 0, 0 },
+    { { 0x90, 67, 100 }, 0, 0, 0, 0 },
+    { { 0xb0,  7,  50 }, 0, 0, 0, 0 },
+    { { 0xb0, 10,  20 }, 0, 0, 0, 0 },
+    { { MIDI_STATUS_TIMING_CLOCK, 0, 0 }, 0, 0, 0, 0 },
+    { { 0x90, 72, 100 }, 0, 0, 0, 0 }
+  };
+  struct MIDIDeviceDelegate delegate = _test_device;
+  struct MIDIController * controller;
+  struct MIDIDevice * device;
+  MIDIValue value;
+
+  delegate.recv_batch = &_receive_batch;
+  device = MIDIDeviceCreate( &delegate );
+  ASSERT_NOT_EQUAL( device, NULL, "Could not create device!" );
+  controller = MIDIControllerCreate( NULL );
+  ASSERT_NOT_EQUAL( controller, NULL, "Could not create controller!" );
+  ASSERT_NO_ERROR( MIDIDeviceSetChannelController( device, MIDI_CHANNEL_1, controller ), "Could not set controller." );
+
+  _batches = 0;
+  _batched = 0;
+  ASSERT_NO_ERROR( MIDIDeviceReceiveBatch( device, 0, 7, &(block[0]), NULL ), "Could not receive batch." );
+  ASSERT_EQUAL( _batches, 3, "Batch was not split into runs." );
+  ASSERT_EQUAL( _batched, 6, "Runs have the wrong number of messages." );
+  ASSERT_EQUAL( _status, MIDI_STATUS_TIMING_CLOCK, "Real time message was not dispatched." );
+  ASSERT_NO_ERROR( MIDIControllerGetControl( controller, MIDI_CONTROL_CHANNEL_VOLUME, sizeof(value), &value ),
+                   "Could not get control." );
+  ASSERT_EQUAL( value, 50, "Controller did not receive control change." );
+
+  MIDIControllerRelease( controller );
+  MIDIDeviceRelease( device );
+  return 0;
+}
@@ -1,12 +1,16 @@
 #include <stdlib.h>
+#include <string.h>
 #include "test.h"
 #define MIDI_DRIVER_INTERNALS
 #include "midi/message.h"
 #include "midi/port.h"
 #include "midi/device.h"
 #include "midi/driver.h"
+#include "midi/runloop.h"
 
 static unsigned char * _buffer = NULL;
+static unsigned char _sent[64][3];
+static size_t _nsent = 0;
 
 static int _send( void * driver, struct MIDIMessage * message ) {
 /*struct MIDIDriver * driver = implementation;*/
@@ -37,6 +41,31 @@ static void _destroy( void * driver ) {
   }
 }
 
+static int _send_compact( void * driver, struct MIDIMessage * message ) {
+  struct MIDICompactMessage compact;
+  ASSERT_NO_ERROR( MIDIMessageGetCompact( message, &compact ), "Could not get compact message." );
+  ASSERT_LESS( _nsent, 64, "Sent too many messages." );
+  memcpy( &(_sent[_nsent++][0]), &(compact.bytes[0]), 3 );
+  return 0;
+}
+
+static int _send_control( struct MIDIPort * port, MIDIStatus status, MIDIControl control, MIDIValue value ) {
+  struct MIDIMessage * message = MIDIMessageCreate( status );
+  MIDIChannel channel = MIDI_CHANNEL_1;
+  ASSERT_NOT_EQUAL( message, NULL, "Could not create message." );
+  MIDIMessageSet( message, MIDI_CHANNEL, sizeof(MIDIChannel), &channel );
+  if( status == MIDI_STATUS_CONTROL_CHANGE ) {
+    MIDIMessageSet( message, MIDI_CONTROL, sizeof(MIDIControl), &control );
+    MIDIMessageSet( message, MIDI_VALUE, sizeof(MIDIValue), &value );
+  } else if( status == MIDI_STATUS_NOTE_ON ) {
+    MIDIMessageSet( message, MIDI_KEY, sizeof(MIDIKey), &control );
+    MIDIMessageSet( message, MIDI_VELOCITY, sizeof(MIDIVelocity), &value );
+  }
+  ASSERT_NO_ERROR( MIDIPortReceive( port, MIDIMessageType, message ), "Driver port could not receive message." );
+  MIDIMessageRelease( message );
+  return 0;
+}
+
 /**
  * Test that a MIDI driver can receive messages.
  */
@@ -131,3 +160,128 @@ int test002_driver( void ) {
 }
 
 
+
+/**
+ * Test that drivers collect profiling information.
+ */
+int test003_driver( void ) {
+  struct MIDIDriver * driver;
+  struct MIDIMessage * message;
+  struct MIDIDriverProfilingStats stats;
+  unsigned long count;
+  int i;
+
+  driver = MIDIDriverCreate( "test driver", MIDI_SAMPLING_RATE_DEFAULT );
+  ASSERT_NOT_EQUAL( driver, NULL, "Could not create driver!" );
+  message = MIDIMessageCreate( MIDI_STATUS_TIMING_CLOCK );
+  ASSERT_NOT_EQUAL( message, NULL, "Could not create clock message!" );
+  ASSERT_ERROR( MIDIDriverGetProfilingStats( driver, &stats ), "Got profiling stats without profiling." );
+  MIDIErrorNumber = 0;
+
+#ifdef NO_PROFILING
+  ASSERT_EQUAL( MIDIDriverStartProfiling( driver ), ENOSYS, "Started profiling that was compiled out." );
+  MIDIErrorNumber = 0;
+  MIDIMessageRelease( message );
+  MIDIDriverRelease( driver );
+  return 0;
+#endif
+  ASSERT_NO_ERROR( MIDIDriverStartProfiling( driver ), "Could not start profiling." );
+  for( i=0; i<3; i++ ) {
+    ASSERT_NO_ERROR( MIDIDriverReceive( driver, message ), "Could not simulate received message." );
+  }
+  ASSERT_NO_ERROR( MIDIDriverGetProfilingStats( driver, &stats ), "Could not get profiling stats." );
+  ASSERT_GREATER( stats.rate, 0, "Profiling clock has no rate." );
+  ASSERT_EQUAL( stats.messages_in, 3, "Did not count received messages." );
+  ASSERT_EQUAL( stats.messages_out, 0, "Counted messages that were not sent." );
+  ASSERT_EQUAL( stats.stages[MIDI_DRIVER_STAGE_DISPATCH].count, 3, "Did not record dispatch latency." );
+  for( count=0, i=0; i<MIDI_DRIVER_HISTOGRAM_BUCKETS; i++ ) {
+    count += stats.stages[MIDI_DRIVER_STAGE_DISPATCH].buckets[i];
+  }
+  ASSERT_EQUAL( count, 3, "Dispatch latencies are missing from the histogram." );
+  ASSERT_EQUAL( stats.stages[MIDI_DRIVER_STAGE_ENCODE].count, 0, "Recorded latency of a stage that did not run." );
+
+  /* restarting resets the stats */
+  ASSERT_NO_ERROR( MIDIDriverStartProfiling( driver ), "Could not restart profiling." );
+  ASSERT_NO_ERROR( MIDIDriverGetProfilingStats( driver, &stats ), "Could not get profiling stats." );
+  ASSERT_EQUAL( stats.messages_in, 0, "Restarting did not reset the stats." );
+
+  ASSERT_NO_ERROR( MIDIDriverStopProfiling( driver ), "Could not stop profiling." );
+  ASSERT_ERROR( MIDIDriverGetProfilingStats( driver, &stats ), "Got profiling stats after profiling was stopped." );
+  MIDIErrorNumber = 0;
+
+  MIDIMessageRelease( message );
+  MIDIDriverRelease( driver );
+  return 0;
+}
+
+/**
+ * Test that the thinning stage holds back continuous controllers but
+ * always sends their latest value and never holds notes.
+ */
+int test004_driver( void ) {
+  struct MIDIDriver * driver;
+  struct MIDIPort * port;
+  struct MIDIRunloop * runloop;
+#ifndef NO_PROFILING
+  struct MIDIDriverProfilingStats stats;
+#endif
+  unsigned long rate, budget;
+  int i;
+
+  driver = MIDIDriverCreate( "test driver", MIDI_SAMPLING_RATE_DEFAULT );
+  ASSERT_NOT_EQUAL( driver, NULL, "Could not create driver!" );
+  driver->send = &_send_compact;
+  MIDIDriverGetPort( driver, &port );
+#ifndef NO_PROFILING
+  ASSERT_NO_ERROR( MIDIDriverStartProfiling( driver ), "Could not start profiling." );
+#endif
+  ASSERT_NO_ERROR( MIDIDriverSetThinning( driver, 100, 0 ), "Could not set thinning." );
+  ASSERT_NO_ERROR( MIDIDriverGetThinning( driver, &rate, &budget ), "Could not get thinning." );
+  ASSERT_EQUAL( rate, 100, "Got wrong thinning rate." );
+  ASSERT_EQUAL( budget, 0, "Got wrong thinning budget." );
+  runloop = MIDIRunloopCreate();
+  ASSERT_NO_ERROR( MIDIRunloopAddDriver( runloop, driver ), "Could not add driver to runloop." );
+
+  _nsent = 0;
+  for( i=0; i<50; i++ ) {
+    ASSERT_NO_ERROR( _send_control( port, MIDI_STATUS_CONTROL_CHANGE, 1, i ), "Could not send control change." );
+    ASSERT_NO_ERROR( _send_control( port, MIDI_STATUS_CONTROL_CHANGE, 64, i & 1 ), "Could not send control change." );
+  }
+  ASSERT_NO_ERROR( _send_control( port, MIDI_STATUS_NOTE_ON, 60, 100 ), "Could not send note." );
+  ASSERT_EQUAL( _nsent, 52, "Held back messages that are never thinned." );
+  ASSERT_EQUAL( _sent[0][2], 0, "Did not send the first value immediately." );
+  ASSERT_EQUAL( _sent[51][0] >> 4, MIDI_STATUS_NOTE_ON, "Held back the note." );
+#ifndef NO_PROFILING
+  ASSERT_NO_ERROR( MIDIDriverGetProfilingStats( driver, &stats ), "Could not get profiling stats." );
+  ASSERT_EQUAL( stats.thinned, 48, "Did not count replaced values." );
+#endif
+
+  ASSERT_NO_ERROR( MIDIRunloopStep( runloop ), "Could not step through runloop." );
+  ASSERT_EQUAL( _nsent, 53, "Did not send the held value." );
+  ASSERT_EQUAL( _sent[52][1], 1, "Sent value of the wrong controller." );
+  ASSERT_EQUAL( _sent[52][2], 49, "Did not send the latest value." );
+
+  /* the byte budget is shared by all controllers */
+  ASSERT_NO_ERROR( MIDIDriverSetThinning( driver, 0, 300 ), "Could not set thinning." );
+  _nsent = 0;
+  for( i=1; i<=20; i++ ) {
+    ASSERT_NO_ERROR( _send_control( port, MIDI_STATUS_CONTROL_CHANGE, ( i < 6 ) ? i : i + 1, i ),
+                     "Could not send control change." );
+  }
+  ASSERT_EQUAL( _nsent, 10, "Did not hold values over the budget." );
+  while( _nsent < 20 ) {
+    ASSERT_NO_ERROR( MIDIRunloopStep( runloop ), "Could not step through runloop." );
+  }
+  ASSERT_EQUAL( _sent[19][1], 21, "Did not send the held values in order." );
+
+  /* removing the stage sends what is held */
+  ASSERT_NO_ERROR( _send_control( port, MIDI_STATUS_PITCH_WHEEL_CHANGE, 0, 64 ), "Could not send pitch wheel change." );
+  ASSERT_NO_ERROR( MIDIDriverSetThinning( driver, 0, 0 ), "Could not remove thinning." );
+  ASSERT_EQUAL( _nsent, 21, "Did not send held value." );
+  ASSERT_EQUAL( _sent[20][0] >> 4, MIDI_STATUS_PITCH_WHEEL_CHANGE, "Sent the wrong message." );
+
+  MIDIRunloopRemoveDriver( runloop, driver );
+  MIDIRunloopRelease( runloop );
+  MIDIDriverRelease( driver );
+  return 0;
+}
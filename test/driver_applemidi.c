@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <sys/select.h>
@@ -9,6 +10,7 @@
 #include "midi/event.h"
 #include "midi/driver.h"
 #include "midi/message.h"
+#include "midi/clock.h"
 #include "midi/runloop.h"
 #include "driver/applemidi/applemidi.h"
 
@@ -21,6 +23,13 @@
 #define SERVER_CONTROL_PORT 5204
 #define SERVER_RTP_PORT SERVER_CONTROL_PORT + 1
 
+#define SERVER2_CONTROL_PORT 5304
+#define SERVER2_RTP_PORT SERVER2_CONTROL_PORT + 1
+
+#define SERVER3_CONTROL_PORT 5404
+#define SERVER3_RTP_PORT SERVER3_CONTROL_PORT + 1
+#define CLIENT3_CONTROL_PORT 5504
+
 static struct MIDIDriverAppleMIDI * driver = NULL;
 
 static int client_control_socket = 0;
@@ -87,9 +96,23 @@ static int _check_socket_in( int fd ) {
   return FD_ISSET( fd, &fds );
 }
 
+/* receive a pending RTP-MIDI packet without blocking,
+ * skipping AppleMIDI session commands like clock synchronization */
+static ssize_t _recv_rtp_midi( int fd, unsigned char * buffer, size_t size ) {
+  struct timeval tv = { 0, 0 };
+  fd_set fds;
+  ssize_t bytes;
+  for(;;) {
+    FD_ZERO( &fds );
+    FD_SET( fd, &fds );
+    if( select( fd+1, &fds, NULL, NULL, &tv ) <= 0 ) return 0;
+    bytes = recv( fd, buffer, size, 0 );
+    if( bytes < 2 || buffer[0] != 0xff || buffer[1] != 0xff ) return bytes;
+  }
+}
+
 static int _n_msg = 0;
 static int _receive( void * target, void * source, struct MIDITypeSpec * type, void * data ) {
-  struct MIDIMessage * message;
   char * buffer;
   int i;
   if( target != &_n_msg ) {
@@ -97,9 +120,7 @@ static int _receive( void * target, void * source, struct MIDITypeSpec * type, v
   }
 
   if( type == MIDIMessageType ) {
-    message = data;
     printf( "Received message!\n" );
-    MIDIMessageRelease( message );
     _n_msg++;
   } else if( type == MIDIEventType ) {
     printf( "Received event!\n" );
@@ -326,11 +347,489 @@ int test004_applemidi( void ) {
   return 0;
 }
 
+/**
+ * Test that messages sent within the batch window are
+ * coalesced into a single RTP MIDI packet.
+ */
+int test005_applemidi( void ) {
+  struct MIDIMessage * message;
+  struct MIDIRunloopSource * source;
+  struct MIDIRunloop * runloop;
+  unsigned char buffer[128];
+  ssize_t bytes;
+  int i;
+  MIDIKey key;
+  MIDIChannel channel = MIDI_CHANNEL_1;
+
+  runloop = MIDIRunloopCreate();
+  ASSERT_NOT_EQUAL( runloop, NULL, "Could not create runloop." );
+  ASSERT_NO_ERROR( MIDIDriverAppleMIDIGetRunloopSource( driver, &source ), "Could not get runloop source." );
+  ASSERT_NO_ERROR( MIDIRunloopAddSource( runloop, source ), "Could not add source to runloop." );
+  ASSERT_NO_ERROR( MIDIDriverAppleMIDISetBatchWindow( driver, 2000 ), "Could not set batch window." );
+
+  /* discard packets left over from previous tests */
+  while( _recv_rtp_midi( client_rtp_socket, &(buffer[0]), sizeof(buffer) ) > 0 );
+
+  for( i=0; i<3; i++ ) {
+    key = 60 + i;
+    message = MIDIMessageCreate( MIDI_STATUS_NOTE_ON );
+    MIDIMessageSet( message, MIDI_CHANNEL, sizeof(MIDIChannel), &channel );
+    MIDIMessageSet( message, MIDI_KEY, sizeof(MIDIKey), &key );
+    ASSERT_NO_ERROR( MIDIDriverAppleMIDISendMessage( driver, message ), "Could not queue midi message." );
+    MIDIMessageRelease( message );
+  }
+
+  bytes = _recv_rtp_midi( client_rtp_socket, &(buffer[0]), sizeof(buffer) );
+  ASSERT_EQUAL( bytes, 0, "Messages were sent before the batch window closed." );
+
+  for( i=0; i<100 && bytes == 0; i++ ) {
+    ASSERT_NO_ERROR( MIDIRunloopStep( runloop ), "Could not step through runloop." );
+    bytes = _recv_rtp_midi( client_rtp_socket, &(buffer[0]), sizeof(buffer) );
+  }
+  /* 12 bytes RTP header, 1 byte MIDI header, 3 bytes first message and
+   * 3 bytes for each subsequent message (delta time and running status) */
+  ASSERT_GREATER_OR_EQUAL( bytes, 22, "Batched messages were not sent in a single packet." );
+  /* the recovery journal for the previous test's notes may follow the
+   * command section, so check the length in the MIDI header */
+  ASSERT_EQUAL( buffer[12] & 0x0f, 9, "Batched messages were not sent in a single packet." );
+
+  ASSERT_NO_ERROR( MIDIDriverAppleMIDISetBatchWindow( driver, 0 ), "Could not reset batch window." );
+  ASSERT_NO_ERROR( MIDIRunloopRemoveSource( runloop, source ), "Could not remove source from runloop." );
+  MIDIRunloopRelease( runloop );
+  return 0;
+}
+
+/* fill in one of the timestamps of a sync command */
+static void _fillin_sync_timestamp( unsigned char * buf, int index, unsigned long long ts ) {
+  int i, offset = 12 + (8*index);
+  for( i=0; i<8; i++ ) {
+    buf[offset+i] = (ts >> (56-8*i)) & 0xff;
+  }
+}
+
+/**
+ * Test that clock synchronization tracks the peer's clock and that the
+ * jitter buffer delays messages of synchronized peers and delivers them
+ * through the runloop.
+ */
+int test006_applemidi( void ) {
+  unsigned long long peer_time = 0x100000000ULL + 1234;
+  unsigned char packet[16] = {
+    /* RTP header / seqnum */
+    0x80, 0x61, 0x00, 0x01,
+    /* timestamp, filled in below */
+    0x00, 0x00, 0x00, 0x00,
+    /* SSRC */
+    0xff & (CLIENT_SSRC >> 24), 0xff & (CLIENT_SSRC >> 16),
+    0xff & (CLIENT_SSRC >> 8),  0xff &  CLIENT_SSRC,
+    /* MIDI header and note on */
+    0x03, 0x90, 0x40, 0x64
+  };
+  unsigned char buf[36] = { 0 };
+  struct MIDIRunloopSource * source;
+  struct MIDIRunloop * runloop;
+  struct AppleMIDIPeerSync sync;
+  struct MIDIClock * peer_clock;
+  MIDITimestamp peer_now;
+  unsigned long latency;
+  int i, n_msg;
+
+  ASSERT_NO_ERROR( MIDIDriverAppleMIDISetJitterBuffer( driver, 50000, 500000 ), "Could not enable jitter buffer." );
+  while( _recv_rtp_midi( client_rtp_socket, &(buf[0]), sizeof(buf) ) > 0 );
+
+  /* let the driver answer a sync that was started by the client, the peer
+   * clock will be peer_time when the sync finishes */
+  _fillin_sync( &(buf[0]), 0 );
+  _fillin_sync_timestamp( &(buf[0]), 0, peer_time );
+  ASSERT_EQUAL( 36, sendto( client_rtp_socket, &(buf[0]), sizeof(buf), 0,
+                (struct sockaddr *) &server_addr, sizeof(server_addr) ), "Could not send sync." );
+  usleep( 1000 );
+  ASSERT_NO_ERROR( MIDIDriverAppleMIDIReceive( driver ), "Could not receive sync." );
+  ASSERT( _check_socket_in( client_rtp_socket ), "Expected sync answer on client RTP socket." );
+  ASSERT_EQUAL( 36, recv( client_rtp_socket, &(buf[0]), sizeof(buf), 0 ), "Did not receive synchronization answer." );
+
+  _fillin_sync( &(buf[0]), 2 );
+  _fillin_sync_timestamp( &(buf[0]), 0, peer_time );
+  _fillin_sync_timestamp( &(buf[0]), 2, peer_time );
+  ASSERT_EQUAL( 36, sendto( client_rtp_socket, &(buf[0]), sizeof(buf), 0,
+                (struct sockaddr *) &server_addr, sizeof(server_addr) ), "Could not send sync." );
+  usleep( 1000 );
+  ASSERT_NO_ERROR( MIDIDriverAppleMIDIReceive( driver ), "Could not receive sync." );
+
+  ASSERT_NO_ERROR( MIDIDriverAppleMIDIGetPeerSync( driver, CLIENT_SSRC, &sync ), "Could not get peer sync." );
+  ASSERT_GREATER_OR_EQUAL( sync.count, 1, "Sync was not counted." );
+  ASSERT_EQUAL( sync.skew, 0, "Skew was estimated from a single sync." );
+  ASSERT_NO_ERROR( MIDIDriverAppleMIDIGetPeerClock( driver, CLIENT_SSRC, &peer_clock ), "Could not get peer clock." );
+  ASSERT_NO_ERROR( MIDIClockGetNow( peer_clock, &peer_now ), "Could not get peer time." );
+  ASSERT_GREATER_OR_EQUAL( peer_now, peer_time, "Peer clock is behind the synchronized time." );
+  ASSERT_LESS( peer_now, peer_time + 1000, "Peer clock is ahead of the synchronized time." );
+
+  /* send a message that was sent at the end of the sync */
+  packet[4] = (peer_time >> 24) & 0xff;
+  packet[5] = (peer_time >> 16) & 0xff;
+  packet[6] = (peer_time >>  8) & 0xff;
+  packet[7] =  peer_time        & 0xff;
+  n_msg = _n_msg;
+  ASSERT_EQUAL( 16, sendto( client_rtp_socket, &(packet[0]), sizeof(packet), 0,
+                (struct sockaddr *) &server_addr, sizeof(server_addr) ), "Could not send RTP-MIDI." );
+  usleep( 1000 );
+  ASSERT_NO_ERROR( MIDIDriverAppleMIDIReceive( driver ), "Could not receive RTP-MIDI." );
+  ASSERT_EQUAL( _n_msg, n_msg, "Message was delivered before the target latency passed." );
+  ASSERT_NO_ERROR( MIDIDriverAppleMIDIGetPeerLatency( driver, CLIENT_SSRC, &latency ), "Could not get peer latency." );
+  ASSERT_EQUAL( latency, 50000, "Target latency is not the minimum latency." );
+
+  runloop = MIDIRunloopCreate();
+  ASSERT_NOT_EQUAL( runloop, NULL, "Could not create runloop." );
+  ASSERT_NO_ERROR( MIDIDriverAppleMIDIGetRunloopSource( driver, &source ), "Could not get runloop source." );
+  ASSERT_NO_ERROR( MIDIRunloopAddSource( runloop, source ), "Could not add source to runloop." );
+  for( i=0; i<100 && _n_msg == n_msg; i++ ) {
+    ASSERT_NO_ERROR( MIDIRunloopStep( runloop ), "Could not step through runloop." );
+  }
+  ASSERT_EQUAL( _n_msg, n_msg+1, "Jitter buffer did not deliver the message." );
+
+  ASSERT_NO_ERROR( MIDIDriverAppleMIDISetJitterBuffer( driver, 0, 0 ), "Could not disable jitter buffer." );
+  ASSERT_NO_ERROR( MIDIRunloopRemoveSource( runloop, source ), "Could not remove source from runloop." );
+  MIDIRunloopRelease( runloop );
+  return 0;
+}
+
+/**
+ * Test that host names are resolved without blocking and the peer is
+ * invited from the runloop once the name is known.
+ */
+int test007_applemidi( void ) {
+  struct timeval tv = { 0, 0 };
+  struct MIDIRunloopSource * source;
+  struct MIDIRunloop * runloop;
+  struct sockaddr_in addr;
+  unsigned char buf[32];
+  fd_set fds;
+  int i, fd, ready = 0;
+
+  fd = socket( PF_INET, SOCK_DGRAM, 0 );
+  ASSERT_NOT_EQUAL( fd, -1, "Could not create socket." );
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = INADDR_ANY;
+  addr.sin_port = htons( CLIENT_CONTROL_PORT + 200 );
+  ASSERT_NO_ERROR( bind( fd, (struct sockaddr *) &addr, sizeof(addr) ), "Could not bind socket." );
+
+  runloop = MIDIRunloopCreate();
+  ASSERT_NOT_EQUAL( runloop, NULL, "Could not create runloop." );
+  ASSERT_NO_ERROR( MIDIDriverAppleMIDIGetRunloopSource( driver, &source ), "Could not get runloop source." );
+  ASSERT_NO_ERROR( MIDIRunloopAddSource( runloop, source ), "Could not add source to runloop." );
+
+  ASSERT_NO_ERROR( MIDIDriverAppleMIDIAddPeer( driver, "localhost", CLIENT_CONTROL_PORT + 200 ),
+                   "Could not start resolving the peer." );
+  for( i=0; i<100 && !ready; i++ ) {
+    ASSERT_NO_ERROR( MIDIRunloopStep( runloop ), "Could not step through runloop." );
+    FD_ZERO( &fds );
+    FD_SET( fd, &fds );
+    ready = select( fd+1, &fds, NULL, NULL, &tv ) > 0;
+  }
+  ASSERT( ready, "Expected invitation after the name was resolved." );
+  ASSERT_EQUAL( recv( fd, &(buf[0]), sizeof(buf), 0 ) >= 4, 1, "Could not receive invitation." );
+  ASSERT_EQUAL( buf[2], 'I', "Received wrong AppleMIDI command." );
+  ASSERT_EQUAL( buf[3], 'N', "Received wrong AppleMIDI command." );
+
+  ASSERT_NO_ERROR( MIDIRunloopRemoveSource( runloop, source ), "Could not remove source from runloop." );
+  MIDIRunloopRelease( runloop );
+  close( fd );
+  return 0;
+}
+
+/**
+ * Test that real-time messages are put at the head of the next packet
+ * or sent in a packet of their own, and that the time spent in each
+ * lane is profiled.
+ */
+int test008_applemidi( void ) {
+#ifndef NO_PROFILING
+  struct MIDIDriverProfilingStats stats;
+#endif
+  struct MIDIMessage * message;
+  struct MIDIRunloopSource * source;
+  struct MIDIRunloop * runloop;
+  unsigned char buffer[128];
+  ssize_t bytes;
+  int i;
+  MIDIKey key;
+  MIDIChannel channel = MIDI_CHANNEL_1;
+
+  runloop = MIDIRunloopCreate();
+  ASSERT_NOT_EQUAL( runloop, NULL, "Could not create runloop." );
+  ASSERT_NO_ERROR( MIDIDriverAppleMIDIGetRunloopSource( driver, &source ), "Could not get runloop source." );
+  ASSERT_NO_ERROR( MIDIRunloopAddSource( runloop, source ), "Could not add source to runloop." );
+  ASSERT_NO_ERROR( MIDIDriverAppleMIDISetBatchWindow( driver, 2000 ), "Could not set batch window." );
+#ifndef NO_PROFILING
+  ASSERT_NO_ERROR( MIDIDriverStartProfiling( (struct MIDIDriver *) driver ), "Could not start profiling." );
+#endif
+  while( _recv_rtp_midi( client_rtp_socket, &(buffer[0]), sizeof(buffer) ) > 0 );
+
+  for( i=0; i<3; i++ ) {
+    key = 60 + i;
+    message = MIDIMessageCreate( MIDI_STATUS_NOTE_ON );
+    MIDIMessageSet( message, MIDI_CHANNEL, sizeof(MIDIChannel), &channel );
+    MIDIMessageSet( message, MIDI_KEY, sizeof(MIDIKey), &key );
+    ASSERT_NO_ERROR( MIDIDriverAppleMIDISendMessage( driver, message ), "Could not queue midi message." );
+    MIDIMessageRelease( message );
+  }
+  message = MIDIMessageCreate( MIDI_STATUS_TIMING_CLOCK );
+  ASSERT_NO_ERROR( MIDIDriverAppleMIDISendMessage( driver, message ), "Could not queue timing clock." );
+  MIDIMessageRelease( message );
+
+  bytes = 0;
+  for( i=0; i<100 && bytes == 0; i++ ) {
+    ASSERT_NO_ERROR( MIDIRunloopStep( runloop ), "Could not step through runloop." );
+    bytes = _recv_rtp_midi( client_rtp_socket, &(buffer[0]), sizeof(buffer) );
+  }
+  ASSERT_GREATER_OR_EQUAL( bytes, 14, "Could not receive RTP MIDI packet." );
+  ASSERT_EQUAL( buffer[13], MIDI_STATUS_TIMING_CLOCK, "Timing clock was not sent at the head of the packet." );
+  while( _recv_rtp_midi( client_rtp_socket, &(buffer[0]), sizeof(buffer) ) > 0 );
+
+  ASSERT_NO_ERROR( MIDIDriverSetRealTimePolicy( (struct MIDIDriver *) driver, MIDI_DRIVER_REALTIME_IMMEDIATE ),
+                   "Could not set real-time policy." );
+  key = 64;
+  message = MIDIMessageCreate( MIDI_STATUS_NOTE_ON );
+  MIDIMessageSet( message, MIDI_CHANNEL, sizeof(MIDIChannel), &channel );
+  MIDIMessageSet( message, MIDI_KEY, sizeof(MIDIKey), &key );
+  ASSERT_NO_ERROR( MIDIDriverAppleMIDISendMessage( driver, message ), "Could not queue midi message." );
+  MIDIMessageRelease( message );
+  message = MIDIMessageCreate( MIDI_STATUS_TIMING_CLOCK );
+  ASSERT_NO_ERROR( MIDIDriverAppleMIDISendMessage( driver, message ), "Could not send timing clock." );
+  MIDIMessageRelease( message );
+  bytes = _recv_rtp_midi( client_rtp_socket, &(buffer[0]), sizeof(buffer) );
+  ASSERT_GREATER_OR_EQUAL( bytes, 14, "Timing clock was not sent at once." );
+  ASSERT_EQUAL( buffer[12] & 0x0f, 1, "Timing clock was not sent in its own packet." );
+  ASSERT_EQUAL( buffer[13], MIDI_STATUS_TIMING_CLOCK, "Timing clock was not sent in its own packet." );
+
+  bytes = 0;
+  for( i=0; i<100 && bytes == 0; i++ ) {
+    ASSERT_NO_ERROR( MIDIRunloopStep( runloop ), "Could not step through runloop." );
+    bytes = _recv_rtp_midi( client_rtp_socket, &(buffer[0]), sizeof(buffer) );
+  }
+#ifndef NO_PROFILING
+  ASSERT_NO_ERROR( MIDIDriverGetProfilingStats( (struct MIDIDriver *) driver, &stats ), "Could not get stats." );
+  ASSERT_EQUAL( stats.lanes[MIDI_DRIVER_LANE_REALTIME].count, 2, "Did not profile the real-time lane." );
+  ASSERT_EQUAL( stats.lanes[MIDI_DRIVER_LANE_BULK].count, 4, "Did not profile the bulk lane." );
+  ASSERT_NO_ERROR( MIDIDriverStopProfiling( (struct MIDIDriver *) driver ), "Could not stop profiling." );
+#endif
+
+  ASSERT_NO_ERROR( MIDIDriverSetRealTimePolicy( (struct MIDIDriver *) driver, MIDI_DRIVER_REALTIME_HEAD ),
+                   "Could not reset real-time policy." );
+  ASSERT_NO_ERROR( MIDIDriverAppleMIDISetBatchWindow( driver, 0 ), "Could not reset batch window." );
+  ASSERT_NO_ERROR( MIDIRunloopRemoveSource( runloop, source ), "Could not remove source from runloop." );
+  MIDIRunloopRelease( runloop );
+  return 0;
+}
+
+static int _fillin_invitation( unsigned char * buf, unsigned long ssrc ) {
+  memset( buf, 0, 20 );
+  buf[0]  = 0xff;
+  buf[1]  = 0xff;
+  buf[2]  = 'I';
+  buf[3]  = 'N';
+  buf[7]  = 2;
+  buf[11] = 0x42;
+  buf[12] = 0xff & (ssrc >> 24);
+  buf[13] = 0xff & (ssrc >> 16);
+  buf[14] = 0xff & (ssrc >> 8);
+  buf[15] = 0xff &  ssrc;
+  memcpy( &(buf[16]), "Test", 5 );
+  return 0;
+}
+
+/* wait for an accepted invitation, skipping other session commands */
+static int _expect_invitation_accepted( int fd, unsigned char * buf, size_t size ) {
+  ssize_t bytes;
+  while( _check_socket_in( fd ) ) {
+    bytes = recv( fd, buf, size, 0 );
+    if( bytes >= 16 && buf[0] == 0xff && buf[2] == 'O' && buf[3] == 'K' ) return 1;
+  }
+  return 0;
+}
+
+/**
+ * Test that a server shards its peers by SSRC over several workers
+ * that share one port pair.
+ */
+int test009_applemidi( void ) {
+  static unsigned long ssrcs[2] = { 0x10000002, 0x10000003 };
+  struct MIDIDriverAppleMIDIServer * server;
+  struct MIDIDriverAppleMIDI * worker;
+  struct sockaddr_in addr;
+  unsigned char buf[64], session[4];
+  size_t count = 0, shard, peers, i;
+  int fd0 = 0, fd1 = 0;
+
+  server = MIDIDriverAppleMIDIServerCreate( "Venue", SERVER2_CONTROL_PORT, 2 );
+  ASSERT_NOT_EQUAL( server, NULL, "Could not create AppleMIDI server." );
+  ASSERT_NO_ERROR( MIDIDriverAppleMIDIServerGetWorkerCount( server, &count ), "Could not get worker count." );
+  ASSERT_GREATER_OR_EQUAL( count, 1, "Server has no workers." );
+  for( i=0; i<count; i++ ) {
+    ASSERT_NO_ERROR( MIDIDriverAppleMIDIServerGetWorker( server, i, &worker ), "Could not get worker." );
+    MIDIDriverAppleMIDIAcceptFromAny( worker );
+  }
+  if( count > 1 ) {
+    MIDIDriverAppleMIDIServerGetWorker( server, 0, &worker );
+    MIDIDriverAppleMIDIGetControlSocket( worker, &fd0 );
+    MIDIDriverAppleMIDIServerGetWorker( server, 1, &worker );
+    MIDIDriverAppleMIDIGetControlSocket( worker, &fd1 );
+    ASSERT_NOT_EQUAL( fd0, fd1, "Workers share a socket." );
+  }
+  ASSERT_NO_ERROR( MIDIDriverAppleMIDIServerStart( server ), "Could not start AppleMIDI server." );
+
+  addr.sin_family = AF_INET;
+  inet_aton( SERVER_ADDRESS, &(addr.sin_addr) );
+  for( i=0; i<2; i++ ) {
+    _fillin_invitation( &(buf[0]), ssrcs[i] );
+    addr.sin_port = htons( SERVER2_CONTROL_PORT );
+    sendto( client_control_socket, &(buf[0]), 21, 0, (struct sockaddr *) &addr, sizeof(addr) );
+    ASSERT( _expect_invitation_accepted( client_control_socket, &(buf[0]), sizeof(buf) ),
+            "Expected accepted invitation on client control socket." );
+    if( i == 0 ) {
+      memcpy( &(session[0]), &(buf[12]), 4 );
+    } else {
+      ASSERT_EQUAL( memcmp( &(session[0]), &(buf[12]), 4 ), 0, "Workers have different SSRCs." );
+    }
+
+    _fillin_invitation( &(buf[0]), ssrcs[i] );
+    addr.sin_port = htons( SERVER2_RTP_PORT );
+    sendto( client_rtp_socket, &(buf[0]), 21, 0, (struct sockaddr *) &addr, sizeof(addr) );
+    ASSERT( _expect_invitation_accepted( client_rtp_socket, &(buf[0]), sizeof(buf) ),
+            "Expected accepted invitation on client RTP socket." );
+  }
+  ASSERT_NO_ERROR( MIDIDriverAppleMIDIServerStop( server ), "Could not stop AppleMIDI server." );
+
+  for( i=0; i<2; i++ ) {
+    ASSERT_NO_ERROR( MIDIDriverAppleMIDIServerGetShard( server, ssrcs[i], &shard ), "Could not get shard." );
+    ASSERT_EQUAL( shard, ssrcs[i] % count, "Peer has the wrong shard." );
+  }
+  for( i=0; i<count; i++ ) {
+    MIDIDriverAppleMIDIServerGetWorker( server, i, &worker );
+    ASSERT_NO_ERROR( MIDIDriverAppleMIDIGetPeerCount( worker, &peers ), "Could not get peer count." );
+    ASSERT_EQUAL( peers, 2 / count, "Peer was not added to its shard." );
+  }
+  MIDIDriverAppleMIDIServerRelease( server );
+  return 0;
+}
+
+/* turn a received invitation into an accepted invitation of the given peer */
+static void _fillin_answer( unsigned char * buf, unsigned long ssrc ) {
+  buf[2]  = 'O';
+  buf[3]  = 'K';
+  buf[12] = 0xff & (ssrc >> 24);
+  buf[13] = 0xff & (ssrc >> 16);
+  buf[14] = 0xff & (ssrc >> 8);
+  buf[15] = 0xff &  ssrc;
+  memcpy( &(buf[16]), "Test", 5 );
+}
+
+/* step through a runloop until a session command of the given type arrives */
+static int _step_until_command( struct MIDIRunloop * runloop, int fd, unsigned char * buf, size_t size,
+                                char c0, char c1 ) {
+  struct timeval tv;
+  fd_set fds;
+  int i;
+  for( i=0; i<100; i++ ) {
+    tv.tv_sec  = 0;
+    tv.tv_usec = 0;
+    FD_ZERO( &fds );
+    FD_SET( fd, &fds );
+    if( select( fd+1, &fds, NULL, NULL, &tv ) > 0 ) {
+      if( recv( fd, buf, size, 0 ) >= 4 && buf[0] == 0xff && buf[2] == c0 && buf[3] == c1 ) return 1;
+    } else if( MIDIRunloopStep( runloop ) ) {
+      return 0;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Test that invitations to several peers are pending at the same time,
+ * that unanswered invitations are resent and that every new peer gets
+ * its own clock synchronization.
+ */
+int test010_applemidi( void ) {
+  static unsigned long ssrcs[2] = { 0x20000001, 0x20000002 };
+  struct MIDIDriverAppleMIDI * inviter;
+  struct MIDIRunloopSource * source;
+  struct MIDIRunloop * runloop;
+  struct sockaddr_in addr;
+  unsigned char buf[64];
+  int control[2], rtp[2], i;
+  size_t peers = 0;
+
+  inviter = MIDIDriverAppleMIDICreate( "Reconnect", SERVER3_CONTROL_PORT );
+  ASSERT_NOT_EQUAL( inviter, NULL, "Could not create AppleMIDI driver." );
+  runloop = MIDIRunloopCreate();
+  ASSERT_NOT_EQUAL( runloop, NULL, "Could not create runloop." );
+  ASSERT_NO_ERROR( MIDIDriverAppleMIDIGetRunloopSource( inviter, &source ), "Could not get runloop source." );
+  ASSERT_NO_ERROR( MIDIRunloopAddSource( runloop, source ), "Could not add source to runloop." );
+
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = INADDR_ANY;
+  for( i=0; i<2; i++ ) {
+    control[i] = socket( PF_INET, SOCK_DGRAM, 0 );
+    rtp[i]     = socket( PF_INET, SOCK_DGRAM, 0 );
+    addr.sin_port = htons( CLIENT3_CONTROL_PORT + 10*i );
+    ASSERT_NO_ERROR( bind( control[i], (struct sockaddr *) &addr, sizeof(addr) ), "Could not bind control socket." );
+    addr.sin_port = htons( CLIENT3_CONTROL_PORT + 10*i + 1 );
+    ASSERT_NO_ERROR( bind( rtp[i], (struct sockaddr *) &addr, sizeof(addr) ), "Could not bind rtp socket." );
+    ASSERT_NO_ERROR( MIDIDriverAppleMIDIAddPeer( inviter, CLIENT_ADDRESS, CLIENT3_CONTROL_PORT + 10*i ),
+                     "Could not add client." );
+  }
+  for( i=0; i<2; i++ ) {
+    ASSERT( _check_socket_in( control[i] ), "Invitations were not sent at the same time." );
+    recv( control[i], &(buf[0]), sizeof(buf), 0 );
+    ASSERT_EQUAL( buf[2], 'I', "Received wrong AppleMIDI command." );
+    ASSERT_EQUAL( buf[3], 'N', "Received wrong AppleMIDI command." );
+  }
+
+  /* the first client answers, the second does not */
+  inet_aton( SERVER_ADDRESS, &(addr.sin_addr) );
+  addr.sin_port = htons( SERVER3_CONTROL_PORT );
+  _fillin_answer( &(buf[0]), ssrcs[0] );
+  sendto( control[0], &(buf[0]), 21, 0, (struct sockaddr *) &addr, sizeof(addr) );
+  ASSERT( _step_until_command( runloop, rtp[0], &(buf[0]), sizeof(buf), 'I', 'N' ),
+          "Expected invitation on client RTP socket." );
+  _fillin_answer( &(buf[0]), ssrcs[0] );
+  addr.sin_port = htons( SERVER3_RTP_PORT );
+  sendto( rtp[0], &(buf[0]), 21, 0, (struct sockaddr *) &addr, sizeof(addr) );
+
+  ASSERT( _step_until_command( runloop, control[1], &(buf[0]), sizeof(buf), 'I', 'N' ),
+          "Unanswered invitation was not resent." );
+  _fillin_answer( &(buf[0]), ssrcs[1] );
+  addr.sin_port = htons( SERVER3_CONTROL_PORT );
+  sendto( control[1], &(buf[0]), 21, 0, (struct sockaddr *) &addr, sizeof(addr) );
+  ASSERT( _step_until_command( runloop, rtp[1], &(buf[0]), sizeof(buf), 'I', 'N' ),
+          "Expected invitation on client RTP socket." );
+  _fillin_answer( &(buf[0]), ssrcs[1] );
+  addr.sin_port = htons( SERVER3_RTP_PORT );
+  sendto( rtp[1], &(buf[0]), 21, 0, (struct sockaddr *) &addr, sizeof(addr) );
+
+  for( i=0; i<2; i++ ) {
+    ASSERT( _step_until_command( runloop, rtp[i], &(buf[0]), sizeof(buf), 'C', 'K' ),
+            "New peer was not synchronized." );
+    ASSERT_EQUAL( buf[8], 0, "Synchronization did not start with the first packet." );
+  }
+  ASSERT_NO_ERROR( MIDIDriverAppleMIDIGetPeerCount( inviter, &peers ), "Could not get peer count." );
+  ASSERT_EQUAL( peers, 2, "Resent invitations added peers more than once." );
+
+  ASSERT_NO_ERROR( MIDIRunloopRemoveSource( runloop, source ), "Could not remove source from runloop." );
+  MIDIRunloopRelease( runloop );
+  MIDIDriverRelease( inviter );
+  for( i=0; i<2; i++ ) {
+    close( control[i] );
+    close( rtp[i] );
+  }
+  return 0;
+}
+
 /**
  * Test that AppleMIDI sessions can be torn down and
  * clients receive the proper ENDSESSION commands.
  */
-int test005_applemidi( void ) {
+int test011_applemidi( void ) {
 
   MIDIDriverRelease( driver );
 
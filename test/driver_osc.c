@@ -0,0 +1,248 @@
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/select.h>
+#include "test.h"
+#include "midi/port.h"
+#include "midi/driver.h"
+#include "midi/message.h"
+#include "driver/osc/osc.h"
+
+#define OSC_ADDRESS     "127.0.0.1"
+#define OSC_SERVER_PORT 5404
+#define OSC_CLIENT_PORT 5405
+
+static struct MIDIDriverOSC * driver = NULL;
+static int client_socket = 0;
+
+static int _n_msg = 0;
+static unsigned char _received[4][3];
+
+static int _receive( void * target, void * source, struct MIDITypeSpec * type, void * data ) {
+  struct MIDICompactMessage compact;
+  if( type == MIDIMessageType && _n_msg < 4 && MIDIMessageGetCompact( data, &compact ) == 0 ) {
+    memcpy( &(_received[_n_msg][0]), &(compact.bytes[0]), 3 );
+    _n_msg++;
+  }
+  return 0;
+}
+
+static struct MIDIMessage * _message( MIDIStatus status, MIDIChannel channel, MIDIProperty property, MIDIValue value ) {
+  struct MIDIMessage * message = MIDIMessageCreate( status );
+  MIDIMessageSet( message, MIDI_CHANNEL, sizeof(MIDIChannel), &channel );
+  MIDIMessageSet( message, property, sizeof(MIDIValue), &value );
+  return message;
+}
+
+/**
+ * Test that channel voice messages are encoded into the default namespace.
+ */
+int test001_osc( void ) {
+  static unsigned char expected[44] = {
+    '/', 'o', 's', 'c', '/', 'm', 'i', 'd', 'i', '/', 'o', 'u', 't', '/', 'n', 'o', 't', 'e', 'O', 'n', 0, 0, 0, 0,
+    ',', 'i', 'i', 'i', 0, 0, 0, 0,
+    0, 0, 0, 2,  0, 0, 0, 60,  0, 0, 0, 100
+  };
+  struct MIDIMessage * message;
+  unsigned char buffer[64];
+  size_t written;
+  MIDIVelocity velocity = 100;
+  MIDILongValue bend = 0x2001;
+  MIDIChannel channel = MIDI_CHANNEL_16;
+
+  driver = MIDIDriverOSCCreate( "OSC", OSC_SERVER_PORT );
+  ASSERT_NOT_EQUAL( driver, NULL, "Could not create OSC driver." );
+
+  message = _message( MIDI_STATUS_NOTE_ON, MIDI_CHANNEL_2, MIDI_KEY, 60 );
+  MIDIMessageSet( message, MIDI_VELOCITY, sizeof(MIDIVelocity), &velocity );
+  ASSERT_NO_ERROR( MIDIDriverOSCEncodeMessageDefault( driver, message, sizeof(buffer), &(buffer[0]), &written ),
+                   "Could not encode note on message." );
+  ASSERT_EQUAL( written, sizeof(expected), "Encoded message has the wrong size." );
+  ASSERT_EQUAL( memcmp( &(buffer[0]), &(expected[0]), sizeof(expected) ), 0, "Encoded the wrong message." );
+  ASSERT_ERROR( MIDIDriverOSCEncodeMessageDefault( driver, message, 40, &(buffer[0]), &written ),
+                "Encoded message into a buffer that is too small." );
+  MIDIMessageRelease( message );
+
+  message = MIDIMessageCreate( MIDI_STATUS_PITCH_WHEEL_CHANGE );
+  MIDIMessageSet( message, MIDI_CHANNEL, sizeof(MIDIChannel), &channel );
+  MIDIMessageSet( message, MIDI_VALUE, sizeof(MIDILongValue), &bend );
+  ASSERT_NO_ERROR( MIDIDriverOSCEncodeMessageDefault( driver, message, sizeof(buffer), &(buffer[0]), &written ),
+                   "Could not encode pitch wheel message." );
+  ASSERT_EQUAL( written, 20 + 4 + 8, "Encoded message has the wrong size." );
+  ASSERT_EQUAL( memcmp( &(buffer[0]), "/osc/midi/out/bend\0\0,ii\0", 24 ), 0, "Encoded the wrong address." );
+  ASSERT_EQUAL( buffer[27], 16, "Encoded the wrong channel." );
+  ASSERT_EQUAL( buffer[30], 0x20, "Encoded the wrong pitch." );
+  ASSERT_EQUAL( buffer[31], 0x01, "Encoded the wrong pitch." );
+  MIDIMessageRelease( message );
+  return 0;
+}
+
+/**
+ * Test that OSC messages and raw blobs decode into MIDI messages.
+ */
+int test002_osc( void ) {
+  unsigned char control[] = {
+    '/', 'o', 's', 'c', '/', 'm', 'i', 'd', 'i', '/', 'i', 'n', '/', 'c', 'o', 'n', 't', 'r', 'o', 'l', 0, 0, 0, 0,
+    ',', 'i', 'f', 'i', 0, 0, 0, 0,
+    0, 0, 0, 3,  0x42, 0x38, 0, 0,  0, 0, 0, 127
+  };
+  struct MIDIMessage * message = MIDIMessageCreate( MIDI_STATUS_NOTE_OFF );
+  struct MIDICompactMessage compact;
+  unsigned char buffer[64];
+  size_t written, read;
+
+  ASSERT_NO_ERROR( MIDIDriverOSCDecodeMessageDefault( driver, message, sizeof(control), &(control[0]), &read ),
+                   "Could not decode control message." );
+  ASSERT_EQUAL( read, sizeof(control), "Decoded the wrong number of bytes." );
+  ASSERT_NO_ERROR( MIDIMessageGetCompact( message, &compact ), "Could not get compact message." );
+  ASSERT_EQUAL( compact.bytes[0], 0xb2, "Decoded the wrong status." );
+  ASSERT_EQUAL( compact.bytes[1], 46, "Decoded the wrong controller." );
+  ASSERT_EQUAL( compact.bytes[2], 127, "Decoded the wrong value." );
+  ASSERT_ERROR( MIDIDriverOSCDecodeMessageDefault( driver, message, 40, &(control[0]), &read ),
+                "Decoded a truncated message." );
+  control[10] = 'o';
+  ASSERT_ERROR( MIDIDriverOSCDecodeMessageDefault( driver, message, sizeof(control), &(control[0]), &read ),
+                "Decoded a message with an unknown address." );
+
+  MIDIMessageRelease( message );
+  message = _message( MIDI_STATUS_PROGRAM_CHANGE, MIDI_CHANNEL_1, MIDI_PROGRAM, 12 );
+  ASSERT_NO_ERROR( MIDIDriverOSCEncodeMessageRaw( driver, message, sizeof(buffer), &(buffer[0]), &written ),
+                   "Could not encode raw message." );
+  ASSERT_EQUAL( written, 20 + 4 + 8, "Encoded raw message has the wrong size." );
+  ASSERT_EQUAL( memcmp( &(buffer[0]), "/osc/midi/out/raw\0\0\0,b\0\0", 24 ), 0, "Encoded the wrong address." );
+  ASSERT_EQUAL( buffer[27], 2, "Encoded the wrong blob size." );
+  ASSERT_EQUAL( buffer[28], 0xc0, "Encoded the wrong blob." );
+  ASSERT_EQUAL( buffer[29], 12, "Encoded the wrong blob." );
+
+  ASSERT_NO_ERROR( MIDIDriverOSCSetAddressSpace( driver, "/midi", "/midi" ), "Could not set address space." );
+  ASSERT_NO_ERROR( MIDIDriverOSCEncodeMessageRaw( driver, message, sizeof(buffer), &(buffer[0]), &written ),
+                   "Could not encode raw message." );
+  MIDIMessageRelease( message );
+  message = MIDIMessageCreate( MIDI_STATUS_NOTE_OFF );
+  ASSERT_ERROR( MIDIDriverOSCDecodeMessageDefault( driver, message, written, &(buffer[0]), &read ),
+                "Decoded raw message as default message." );
+  ASSERT_NO_ERROR( MIDIDriverOSCDecodeMessageRaw( driver, message, written, &(buffer[0]), &read ),
+                   "Could not decode raw message." );
+  ASSERT_NO_ERROR( MIDIMessageGetCompact( message, &compact ), "Could not get compact message." );
+  ASSERT_EQUAL( compact.bytes[0], 0xc0, "Decoded the wrong status." );
+  ASSERT_EQUAL( compact.bytes[1], 12, "Decoded the wrong program." );
+  MIDIMessageRelease( message );
+  return 0;
+}
+
+/**
+ * Test that queued messages are sent as one bundle and that received
+ * bundles are passed to the driver's port.
+ */
+int test003_osc( void ) {
+  struct timeval tv = { 1, 0 };
+  struct sockaddr_in addr;
+  struct MIDIMessage * message;
+  struct MIDIPort * port, * receiver;
+  unsigned char buffer[256];
+  MIDIValue value = 64;
+  ssize_t bytes;
+  fd_set fds;
+
+  client_socket = socket( PF_INET, SOCK_DGRAM, 0 );
+  ASSERT_NOT_EQUAL( client_socket, -1, "Could not create client socket." );
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = INADDR_ANY;
+  addr.sin_port = htons( OSC_CLIENT_PORT );
+  ASSERT_NO_ERROR( bind( client_socket, (struct sockaddr *) &addr, sizeof(addr) ), "Could not bind client socket." );
+  ASSERT_NO_ERROR( MIDIDriverOSCSetDestination( driver, OSC_ADDRESS, OSC_CLIENT_PORT ), "Could not set destination." );
+
+  message = _message( MIDI_STATUS_CONTROL_CHANGE, MIDI_CHANNEL_1, MIDI_CONTROL, 7 );
+  MIDIMessageSet( message, MIDI_VALUE, sizeof(MIDIValue), &value );
+  ASSERT_NO_ERROR( MIDIDriverOSCSendMessage( driver, message ), "Could not queue message." );
+  MIDIMessageRelease( message );
+  message = _message( MIDI_STATUS_CHANNEL_PRESSURE, MIDI_CHANNEL_3, MIDI_PRESSURE, 99 );
+  ASSERT_NO_ERROR( MIDIDriverOSCSendMessage( driver, message ), "Could not queue message." );
+  MIDIMessageRelease( message );
+  ASSERT_NO_ERROR( MIDIDriverOSCSend( driver ), "Could not send bundle." );
+
+  FD_ZERO( &fds );
+  FD_SET( client_socket, &fds );
+  ASSERT_EQUAL( select( client_socket+1, &fds, NULL, NULL, &tv ), 1, "Expected bundle on client socket." );
+  bytes = recv( client_socket, &(buffer[0]), sizeof(buffer), 0 );
+  ASSERT_EQUAL( bytes, 16 + 4 + 36 + 4 + 24, "Received bundle has the wrong size." );
+  ASSERT_EQUAL( memcmp( &(buffer[0]), "#bundle", 8 ), 0, "Received no bundle." );
+  ASSERT_EQUAL( buffer[19], 36, "Bundle element has the wrong size." );
+  ASSERT_EQUAL( memcmp( &(buffer[20]), "/midi/control", 14 ), 0, "Bundle element has the wrong address." );
+  ASSERT_EQUAL( buffer[59], 24, "Bundle element has the wrong size." );
+  ASSERT_EQUAL( memcmp( &(buffer[60]), "/midi/touch", 12 ), 0, "Bundle element has the wrong address." );
+
+  ASSERT_NO_ERROR( MIDIDriverGetPort( driver, &port ), "Could not get driver port." );
+  receiver = MIDIPortCreate( "OSC test port", MIDI_PORT_IN, &_n_msg, &_receive );
+  ASSERT_NO_ERROR( MIDIPortConnect( port, receiver ), "Could not connect ports." );
+  _n_msg = 0;
+  ASSERT_NO_ERROR( MIDIDriverOSCReceivePacket( driver, bytes, &(buffer[0]) ), "Could not receive bundle." );
+  ASSERT_EQUAL( _n_msg, 2, "Bundle was not unpacked." );
+  ASSERT_EQUAL( _received[0][0], 0xb0, "Received wrong status." );
+  ASSERT_EQUAL( _received[0][1], 7, "Received wrong controller." );
+  ASSERT_EQUAL( _received[0][2], 64, "Received wrong value." );
+  ASSERT_EQUAL( _received[1][0], 0xd2, "Received wrong status." );
+  ASSERT_EQUAL( _received[1][1], 99, "Received wrong pressure." );
+
+  /* a bundle element that claims to be longer than the packet */
+  buffer[19] = 200;
+  ASSERT_ERROR( MIDIDriverOSCReceivePacket( driver, bytes, &(buffer[0]) ), "Received malformed bundle." );
+  ASSERT_EQUAL( _n_msg, 2, "Malformed bundle was unpacked." );
+
+  MIDIPortRelease( receiver );
+  return 0;
+}
+
+/**
+ * Test that messages are coded as universal MIDI packet blobs.
+ */
+int test004_osc( void ) {
+  struct MIDIMessage * message;
+  struct MIDICompactMessage compact;
+  unsigned char buffer[64];
+  size_t written, read;
+  MIDIVelocity velocity = 90;
+
+  ASSERT_NO_ERROR( MIDIDriverOSCSetAddressSpace( driver, MIDI_DRIVER_OSC_DEFAULT_ADDRESS_SPACE_OUT,
+                                                 MIDI_DRIVER_OSC_DEFAULT_ADDRESS_SPACE_IN ), "Could not set address space." );
+  message = _message( MIDI_STATUS_CONTROL_CHANGE, MIDI_CHANNEL_3, MIDI_CONTROL, 7 );
+  ASSERT_NO_ERROR( MIDIDriverOSCEncodeMessageUniversal( driver, message, sizeof(buffer), &(buffer[0]), &written ),
+                   "Could not encode universal packet message." );
+  ASSERT_EQUAL( written, 20 + 4 + 4 + 8, "Encoded universal packet message has the wrong size." );
+  ASSERT_EQUAL( memcmp( &(buffer[0]), "/osc/midi/out/ump\0\0\0,b\0\0", 24 ), 0, "Encoded the wrong address." );
+  ASSERT_EQUAL( buffer[27], 8, "Encoded the wrong blob size." );
+  ASSERT_EQUAL( buffer[28], 0x40, "Encoded the wrong packet type." );
+  ASSERT_EQUAL( buffer[29], 0xb2, "Encoded the wrong status." );
+  ASSERT_EQUAL( buffer[30], 7, "Encoded the wrong controller." );
+  ASSERT_ERROR( MIDIDriverOSCEncodeMessageUniversal( driver, message, 32, &(buffer[0]), &written ),
+                "Encoded message into a buffer that is too small." );
+  MIDIMessageRelease( message );
+
+  ASSERT_NO_ERROR( MIDIDriverOSCSetAddressSpace( driver, "/midi", "/midi" ), "Could not set address space." );
+  message = _message( MIDI_STATUS_NOTE_ON, MIDI_CHANNEL_1, MIDI_KEY, 61 );
+  MIDIMessageSet( message, MIDI_VELOCITY, sizeof(MIDIVelocity), &velocity );
+  ASSERT_NO_ERROR( MIDIDriverOSCEncodeMessageUniversal( driver, message, sizeof(buffer), &(buffer[0]), &written ),
+                   "Could not encode universal packet message." );
+  MIDIMessageRelease( message );
+  message = MIDIMessageCreate( MIDI_STATUS_NOTE_OFF );
+  ASSERT_ERROR( MIDIDriverOSCDecodeMessageRaw( driver, message, written, &(buffer[0]), &read ),
+                "Decoded universal packet message as raw message." );
+  ASSERT_NO_ERROR( MIDIDriverOSCDecodeMessageUniversal( driver, message, written, &(buffer[0]), &read ),
+                   "Could not decode universal packet message." );
+  ASSERT_EQUAL( read, written, "Decoded the wrong number of bytes." );
+  ASSERT_NO_ERROR( MIDIMessageGetCompact( message, &compact ), "Could not get compact message." );
+  ASSERT_EQUAL( compact.bytes[0], 0x90, "Decoded the wrong status." );
+  ASSERT_EQUAL( compact.bytes[1], 61, "Decoded the wrong key." );
+  ASSERT_EQUAL( compact.bytes[2], 90, "Decoded the wrong velocity." );
+  MIDIMessageRelease( message );
+  return 0;
+}
+
+/**
+ * Test that the OSC driver can be released.
+ */
+int test005_osc( void ) {
+  MIDIDriverRelease( driver );
+  close( client_socket );
+  return 0;
+}
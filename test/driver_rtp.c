@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include "test.h"
@@ -8,6 +9,8 @@
 #define RTP_CLIENT_PORT 5204
 #define RTP_CLIENT_SSRC 123456789
 #define RTP_SERVER_PORT 5104
+#define RTP_OTHER_PORT 5304
+#define RTP_OTHER_SSRC 987654321
 
 static struct RTPSession * _session = NULL;
 
@@ -22,6 +25,16 @@ static int _rtp_address( struct sockaddr_in * address, short port ) {
   return 0;
 }
 
+static int _n_foreign = 0;
+
+static int _rtp_foreign( void * info, size_t size, void * data, socklen_t addrlen, struct sockaddr * addr ) {
+  unsigned char * buffer = data;
+  if( size == 16 && buffer[0] == 0xff && addrlen == sizeof(struct sockaddr_in) ) {
+    _n_foreign++;
+  }
+  return 0;
+}
+
 static int _rtp_socket( int * s, struct sockaddr_in * address ) {
   int socket_id = socket( AF_INET, SOCK_DGRAM, 0 );
 
@@ -175,17 +188,383 @@ int test004_rtp( void ) {
 }
 
 /**
- * Test that malicious packets don't mess up the RTP session.
+ * Test that all pending packets can be received at once, that
+ * corrupted packets are dropped on the way and that datagrams of other
+ * protocols are passed to the foreign handler.
  */
 int test005_rtp( void ) {
+  struct RTPPacketInfo infos[9];
+  unsigned char send_buffer[16] = { 0x80, 96,   /* V=2, P=0, X=0, CC=0, PT=96 */
+                                    0x00, 0x00, /* Seqnum */
+                                    5, 6, 7, 8, /* timestamp */
+                                  ( RTP_CLIENT_SSRC >> 24 ) & 0xff,
+                                  ( RTP_CLIENT_SSRC >> 16 ) & 0xff,
+                                  ( RTP_CLIENT_SSRC >> 8 ) & 0xff,
+                                  ( RTP_CLIENT_SSRC ) & 0xff,
+                                  0, 2, 3, 4 };
+  unsigned char foreign_buffer[16] = { 0xff, 0xff, 'R', 'S', 0x12, 0x34, 0x56, 0x78,
+                                       0x12, 0x34, 0x56, 0x78 };
+  struct RTPPeer * peer;
+  unsigned char * payload;
+  size_t count;
+  int s, i;
+  ASSERT_NO_ERROR( _rtp_socket( &s, &client_address ),
+                   "Could not create client socket." );
+
+  for( i=0; i<3; i++ ) {
+    send_buffer[3]  = 0x40 + i;
+    send_buffer[12] = i;
+    sendto( s, &send_buffer[0], sizeof(send_buffer), 0,
+            (struct sockaddr *) &server_address, sizeof(server_address) );
+    /* too short for an RTP header */
+    sendto( s, &send_buffer[0], 4, 0,
+            (struct sockaddr *) &server_address, sizeof(server_address) );
+    /* not an RTP packet, like the session commands of AppleMIDI */
+    sendto( s, &foreign_buffer[0], sizeof(foreign_buffer), 0,
+            (struct sockaddr *) &server_address, sizeof(server_address) );
+  }
+
+  ASSERT_NO_ERROR( RTPSessionSetForeignHandler( _session, &_rtp_foreign, NULL ),
+                   "Could not set foreign handler." );
+  ASSERT_NO_ERROR( RTPSessionReceivePackets( _session, 9, &infos[0], &count ),
+                   "Could not receive packets from peer." );
+  RTPSessionSetForeignHandler( _session, NULL, NULL );
+  ASSERT_EQUAL( count, 3, "Received unexpected number of packets." );
+  ASSERT_EQUAL( _n_foreign, 3, "Foreign datagrams were not passed to the handler." );
+  ASSERT_ERROR( RTPSessionFindPeerBySSRC( _session, &peer, 0x12345678 ),
+                "Foreign datagram was taken for an RTP packet." );
+  for( i=0; i<3; i++ ) {
+    payload = infos[i].iov[0].iov_base;
+    ASSERT_EQUAL( infos[i].payload_size, 4, "Received message of unexpected size." );
+    ASSERT_EQUAL( infos[i].sequence_number, 0x40 + i, "Message has unexpected sequence number." );
+    ASSERT_EQUAL( payload[0], i, "First byte of RTP payload has incorrect value." );
+    ASSERT_EQUAL( payload[3], 4, "Fourth byte of RTP payload has incorrect value." );
+  }
+  close( s );
+  return 0;
+}
+
+/**
+ * Test that one payload can be sent to several peers at once,
+ * each packet with the receiving peer's own sequence number.
+ */
+int test006_rtp( void ) {
+  struct sockaddr_in other_address;
+  struct RTPPeer * peers[2];
+  struct RTPPacketInfo infos[2];
+  struct iovec iov;
+  unsigned char send_buffer[4] = { 1, 2, 3, 4 };
+  unsigned char recv_buffer[32];
+  int s[2], i, bytes;
+  size_t sent;
+  ASSERT_NO_ERROR( _rtp_address( &other_address, RTP_OTHER_PORT ),
+                   "Could not fill out other address." );
+  ASSERT_NO_ERROR( _rtp_socket( &(s[0]), &client_address ),
+                   "Could not create client socket." );
+  ASSERT_NO_ERROR( _rtp_socket( &(s[1]), &other_address ),
+                   "Could not create other socket." );
+
+  ASSERT_NO_ERROR( RTPSessionFindPeerBySSRC( _session, &(peers[0]), RTP_CLIENT_SSRC ),
+                   "Could not find peer." );
+  peers[1] = RTPPeerCreate( RTP_OTHER_SSRC, sizeof(struct sockaddr_in), (void*) &other_address );
+  ASSERT_NO_ERROR( RTPSessionAddPeer( _session, peers[1] ), "Could not add peer." );
+
+  iov.iov_len  = sizeof(send_buffer);
+  iov.iov_base = &(send_buffer[0]);
+  for( i=0; i<2; i++ ) {
+    infos[i].peer = peers[i];
+    infos[i].padding = 0;
+    infos[i].extension = 0;
+    infos[i].csrc_count = 0;
+    infos[i].marker = 0;
+    infos[i].payload_type = 96;
+    infos[i].timestamp = 0;
+    infos[i].iovlen = 1;
+    infos[i].iov    = &iov;
+  }
+
+  ASSERT_NO_ERROR( RTPSessionSendPackets( _session, 2, &(infos[0]), &sent ),
+                   "Could not send payload to peers." );
+  ASSERT_EQUAL( sent, 2, "Payload was not sent to every peer." );
+  ASSERT_EQUAL( infos[1].sequence_number, 1, "Packet has unexpected sequence number." );
+
+  for( i=0; i<2; i++ ) {
+    bytes = recv( s[i], &recv_buffer[0], sizeof(recv_buffer), 0 );
+    ASSERT_EQUAL( bytes, 16, "Received message of unexpected size." );
+    ASSERT_EQUAL( recv_buffer[3], infos[i].sequence_number & 0xff, "Packet has incorrect sequence number." );
+    ASSERT_EQUAL( recv_buffer[12], 1, "First byte of RTP payload has incorrect value." );
+    ASSERT_EQUAL( recv_buffer[15], 4, "Fourth byte of RTP payload has incorrect value." );
+    close( s[i] );
+  }
+
+  ASSERT_NO_ERROR( RTPSessionRemovePeer( _session, peers[1] ), "Could not remove peer." );
+  RTPPeerRelease( peers[1] );
+  return 0;
+}
+
+/**
+ * Test that malicious packets don't mess up the RTP session.
+ */
+int test007_rtp( void ) {
+  return 0;
+}
+
+
+#define RTP_MANY_PEERS 64
+
+/**
+ * Test that a session grows beyond its initial number of peers and
+ * that lookups stay correct while peers are added and removed.
+ */
+int test009_rtp( void ) {
+  struct RTPSession * session;
+  struct RTPPeer * peer[RTP_MANY_PEERS];
+  struct RTPPeer * p;
+  struct sockaddr_in address[RTP_MANY_PEERS];
+  size_t i, n;
+  int s;
+
+  s = socket( AF_INET, SOCK_DGRAM, 0 );
+  ASSERT_GREATER_OR_EQUAL( s, 0, "Could not create socket." );
+  session = RTPSessionCreate( s );
+  ASSERT_NOT_EQUAL( session, NULL, "Could not create RTP session." );
+
+  for( i=0; i<RTP_MANY_PEERS; i++ ) {
+    ASSERT_NO_ERROR( _rtp_address( &(address[i]), htons( RTP_OTHER_PORT + i ) ),
+                     "Could not fill out peer address." );
+    peer[i] = RTPPeerCreate( RTP_OTHER_SSRC + i, sizeof(struct sockaddr_in), (void*) &(address[i]) );
+    ASSERT_NOT_EQUAL( peer[i], NULL, "Could not create RTP peer." );
+    ASSERT_NO_ERROR( RTPSessionAddPeer( session, peer[i] ), "Could not add peer." );
+  }
+
+  for( i=0; i<RTP_MANY_PEERS; i++ ) {
+    ASSERT_NO_ERROR( RTPSessionFindPeerBySSRC( session, &p, RTP_OTHER_SSRC + i ), "Could not find peer by SSRC." );
+    ASSERT_EQUAL( p, peer[i], "Lookup by SSRC returned wrong peer." );
+    ASSERT_NO_ERROR( RTPSessionFindPeerByAddress( session, &p, sizeof(struct sockaddr_in), (void*) &(address[i]) ),
+                     "Could not find peer by address." );
+    ASSERT_EQUAL( p, peer[i], "Lookup by address returned wrong peer." );
+  }
+
+  for( i=0; i<RTP_MANY_PEERS; i+=2 ) {
+    ASSERT_NO_ERROR( RTPSessionRemovePeer( session, peer[i] ), "Could not remove peer." );
+  }
+  for( i=0; i<RTP_MANY_PEERS; i++ ) {
+    if( i % 2 ) {
+      ASSERT_NO_ERROR( RTPSessionFindPeerBySSRC( session, &p, RTP_OTHER_SSRC + i ), "Could not find peer by SSRC." );
+      ASSERT_EQUAL( p, peer[i], "Lookup by SSRC returned wrong peer." );
+      ASSERT_NO_ERROR( RTPSessionFindPeerByAddress( session, &p, sizeof(struct sockaddr_in), (void*) &(address[i]) ),
+                       "Could not find peer by address." );
+      ASSERT_EQUAL( p, peer[i], "Lookup by address returned wrong peer." );
+    } else {
+      ASSERT_ERROR( RTPSessionFindPeerBySSRC( session, &p, RTP_OTHER_SSRC + i ), "Removed peer was found by SSRC." );
+      ASSERT_ERROR( RTPSessionFindPeerByAddress( session, &p, sizeof(struct sockaddr_in), (void*) &(address[i]) ),
+                    "Removed peer was found by address." );
+    }
+  }
+
+  p = NULL;
+  n = 0;
+  do {
+    ASSERT_NO_ERROR( RTPSessionNextPeer( session, &p ), "Could not get next peer." );
+    if( p != NULL ) n++;
+  } while( p != NULL && n <= RTP_MANY_PEERS );
+  ASSERT_EQUAL( n, RTP_MANY_PEERS / 2, "Iterated over wrong number of peers." );
+
+  for( i=0; i<RTP_MANY_PEERS; i++ ) {
+    RTPPeerRelease( peer[i] );
+  }
+  RTPSessionRelease( session );
+  close( s );
   return 0;
 }
 
+/**
+ * Test that received packets carry the time they arrived at the socket
+ * once timestamping is enabled.
+ */
+int test010_rtp( void ) {
+  struct RTPSession * session;
+  struct RTPPacketInfo infos[2];
+  struct sockaddr_in address;
+  struct timespec now;
+  unsigned char send_buffer[16] = { 0x80, 96, 0x00, 0x01, 0, 0, 0, 0,
+                                    0x11, 0x22, 0x33, 0x44, 1, 2, 3, 4 };
+  size_t count;
+  int s, c;
+
+  ASSERT_NO_ERROR( _rtp_address( &address, RTP_OTHER_PORT ), "Could not fill out address." );
+  ASSERT_NO_ERROR( _rtp_socket( &s, &address ), "Could not create socket." );
+  c = socket( AF_INET, SOCK_DGRAM, 0 );
+  ASSERT_GREATER_OR_EQUAL( c, 0, "Could not create socket." );
+  session = RTPSessionCreate( s );
+  ASSERT_NOT_EQUAL( session, NULL, "Could not create RTP session." );
+
+  sendto( c, &send_buffer[0], sizeof(send_buffer), 0, (struct sockaddr *) &address, sizeof(address) );
+  ASSERT_NO_ERROR( RTPSessionReceivePackets( session, 2, &infos[0], &count ), "Could not receive packet." );
+  ASSERT_EQUAL( count, 1, "Received unexpected number of packets." );
+  ASSERT_EQUAL( infos[0].arrival.tv_sec, 0, "Packet was timestamped without timestamping." );
+
+  ASSERT_NO_ERROR( RTPSessionSetTimestamping( session, 1 ), "Could not enable timestamping." );
+  send_buffer[3] = 0x02;
+  sendto( c, &send_buffer[0], sizeof(send_buffer), 0, (struct sockaddr *) &address, sizeof(address) );
+  ASSERT_NO_ERROR( RTPSessionReceivePackets( session, 2, &infos[0], &count ), "Could not receive packet." );
+  ASSERT_EQUAL( count, 1, "Received unexpected number of packets." );
+  clock_gettime( CLOCK_REALTIME, &now );
+  ASSERT_GREATER( infos[0].arrival.tv_sec, 0, "Packet was not timestamped." );
+  ASSERT_LESS_OR_EQUAL( infos[0].arrival.tv_sec, now.tv_sec, "Packet arrived in the future." );
+  ASSERT_GREATER_OR_EQUAL( infos[0].arrival.tv_sec + 1, now.tv_sec, "Packet timestamp is too old." );
+
+  RTPSessionRelease( session );
+  close( c );
+  close( s );
+  return 0;
+}
+
+/**
+ * Test that gaps in the sequence numbers are counted as lost packets and
+ * that late packets are taken back, also across a wrap of the numbers.
+ */
+int test011_rtp( void ) {
+  struct RTPSession * session;
+  struct RTPPacketInfo infos[4];
+  struct sockaddr_in address;
+  struct RTPPeer * peer = NULL;
+  unsigned char send_buffer[16] = { 0x80, 96, 0x00, 0x00, 0, 0, 0, 0,
+                                    0x55, 0x66, 0x77, 0x88, 1, 2, 3, 4 };
+  unsigned short seqnums[3] = { 0xfffe, 0x0001, 0xffff };
+  unsigned long received, lost;
+  size_t count;
+  int s, c, i;
+
+  ASSERT_NO_ERROR( _rtp_address( &address, RTP_OTHER_PORT ), "Could not fill out address." );
+  ASSERT_NO_ERROR( _rtp_socket( &s, &address ), "Could not create socket." );
+  c = socket( AF_INET, SOCK_DGRAM, 0 );
+  ASSERT_GREATER_OR_EQUAL( c, 0, "Could not create socket." );
+  session = RTPSessionCreate( s );
+  ASSERT_NOT_EQUAL( session, NULL, "Could not create RTP session." );
+
+  for( i=0; i<3; i++ ) {
+    send_buffer[2] = seqnums[i] >> 8;
+    send_buffer[3] = seqnums[i] & 0xff;
+    sendto( c, &send_buffer[0], sizeof(send_buffer), 0, (struct sockaddr *) &address, sizeof(address) );
+  }
+  ASSERT_NO_ERROR( RTPSessionReceivePackets( session, 4, &infos[0], &count ), "Could not receive packets." );
+  ASSERT_EQUAL( count, 3, "Received unexpected number of packets." );
+  ASSERT_NO_ERROR( RTPSessionFindPeerBySSRC( session, &peer, 0x55667788 ), "Sender was not added as peer." );
+  ASSERT_NO_ERROR( RTPPeerGetReceptionStats( peer, &received, &lost ), "Could not get reception stats." );
+  ASSERT_EQUAL( received, 3, "Counted wrong number of received packets." );
+  ASSERT_EQUAL( lost, 1, "Counted wrong number of lost packets." );
+
+  RTPSessionRelease( session );
+  close( c );
+  close( s );
+  return 0;
+}
+
+static int _rtp_send_stream( struct RTPSession * session, struct RTPPeer * peer, size_t size, void * payload ) {
+  struct RTPPacketInfo info;
+  struct iovec iov;
+  memset( &info, 0, sizeof(info) );
+  iov.iov_base      = payload;
+  iov.iov_len       = size;
+  info.peer         = peer;
+  info.payload_type = 96;
+  info.iovlen       = 1;
+  info.iov          = &iov;
+  return RTPSessionSendPacket( session, &info );
+}
+
+/**
+ * Test that packets to a peer with a stream are framed with their length,
+ * coalesced until the streams are flushed and decoded on the other end,
+ * and that a closed stream is reported.
+ */
+int test012_rtp( void ) {
+  struct RTPSession * sessions[2];
+  struct RTPPeer * peers[2];
+  struct RTPPacketInfo infos[4];
+  struct sockaddr_in address;
+  unsigned char payload[5000];
+  unsigned char foreign[18] = { 0, 16, 0xff, 0xff, 'C', 'K' };
+  size_t i, count, pending;
+  int fds[2], s[2], fd, n;
+
+  ASSERT_NO_ERROR( _rtp_address( &address, RTP_OTHER_PORT ), "Could not fill out address." );
+  ASSERT_NO_ERROR( socketpair( AF_UNIX, SOCK_STREAM, 0, &fds[0] ), "Could not create stream sockets." );
+  for( i=0; i<2; i++ ) {
+    s[i] = socket( AF_INET, SOCK_DGRAM, 0 );
+    ASSERT_GREATER_OR_EQUAL( s[i], 0, "Could not create socket." );
+    sessions[i] = RTPSessionCreate( s[i] );
+    ASSERT_NOT_EQUAL( sessions[i], NULL, "Could not create RTP session." );
+    RTPSessionSetSSRC( sessions[i], ( i == 0 ) ? RTP_CLIENT_SSRC : RTP_OTHER_SSRC );
+    peers[i] = RTPPeerCreate( ( i == 0 ) ? RTP_OTHER_SSRC : RTP_CLIENT_SSRC,
+                              sizeof(address), (struct sockaddr *) &address );
+    ASSERT_NO_ERROR( RTPSessionAddPeer( sessions[i], peers[i] ), "Could not add peer." );
+    ASSERT_NO_ERROR( RTPPeerSetStream( peers[i], fds[i] ), "Could not set stream." );
+    ASSERT_NO_ERROR( RTPPeerGetStream( peers[i], &fd ), "Could not get stream." );
+    ASSERT_EQUAL( fd, fds[i], "Peer has wrong stream." );
+  }
+  RTPSessionSetForeignHandler( sessions[1], &_rtp_foreign, NULL );
+  for( i=0; i<sizeof(payload); i++ ) payload[i] = i & 0xff;
+
+  for( i=0; i<3; i++ ) {
+    ASSERT_NO_ERROR( _rtp_send_stream( sessions[0], peers[0], 4, &payload[i] ), "Could not send packet." );
+  }
+  ASSERT_NO_ERROR( RTPPeerGetStreamPending( peers[0], &pending ), "Could not get pending bytes." );
+  ASSERT_EQUAL( pending, 3 * ( 2 + 12 + 4 ), "Packets were not coalesced." );
+  ASSERT_NO_ERROR( RTPSessionReceiveStream( sessions[1], peers[1], 4, &infos[0], &count ),
+                   "Could not read empty stream." );
+  ASSERT_EQUAL( count, 0, "Coalesced packets were written before the flush." );
+
+  ASSERT_NO_ERROR( RTPSessionFlushStreams( sessions[0], &pending ), "Could not flush streams." );
+  ASSERT_EQUAL( pending, 0, "Stream was not flushed." );
+  ASSERT_NO_ERROR( RTPSessionReceiveStream( sessions[1], peers[1], 4, &infos[0], &count ),
+                   "Could not receive packets." );
+  ASSERT_EQUAL( count, 3, "Received unexpected number of packets." );
+  for( i=0; i<count; i++ ) {
+    ASSERT_EQUAL( infos[i].peer, peers[1], "Packet came from unexpected peer." );
+    ASSERT_EQUAL( infos[i].sequence_number, i+1, "Packet has unexpected sequence number." );
+    ASSERT_EQUAL( infos[i].payload_size, 4, "Packet has unexpected size." );
+    ASSERT_EQUAL( ((unsigned char *) infos[i].iov[0].iov_base)[0], i, "Packet has unexpected payload." );
+  }
+
+  /* a frame that does not fit is written right away, after the coalesced bytes */
+  ASSERT_NO_ERROR( _rtp_send_stream( sessions[0], peers[0], 4, &payload[0] ), "Could not send packet." );
+  ASSERT_NO_ERROR( _rtp_send_stream( sessions[0], peers[0], sizeof(payload), &payload[0] ),
+                   "Could not send large packet." );
+  ASSERT_NO_ERROR( RTPPeerGetStreamPending( peers[0], &pending ), "Could not get pending bytes." );
+  ASSERT_EQUAL( pending, 0, "Large packet was coalesced." );
+  ASSERT_EQUAL( write( fds[0], &foreign[0], sizeof(foreign) ), sizeof(foreign), "Could not write frame." );
+  n = _n_foreign;
+  for( i=0, count=0; i<2 && count<2; i++ ) {
+    ASSERT_NO_ERROR( RTPSessionReceiveStream( sessions[1], peers[1], 4, &infos[count], &pending ),
+                     "Could not receive packets." );
+    count += pending;
+  }
+  ASSERT_EQUAL( count, 2, "Received unexpected number of packets." );
+  ASSERT_EQUAL( infos[1].payload_size, sizeof(payload), "Large packet has unexpected size." );
+  ASSERT_EQUAL( memcmp( infos[1].iov[0].iov_base, &payload[0], sizeof(payload) ), 0,
+                "Large packet has unexpected payload." );
+  ASSERT_EQUAL( _n_foreign, n+1, "Foreign frame was not passed to the handler." );
+
+  ASSERT_NO_ERROR( RTPPeerSetStream( peers[0], -1 ), "Could not remove stream." );
+  ASSERT_NO_ERROR( RTPPeerGetStream( peers[0], &fd ), "Could not get stream." );
+  ASSERT_EQUAL( fd, -1, "Peer still has a stream." );
+  ASSERT_EQUAL( RTPSessionReceiveStream( sessions[1], peers[1], 4, &infos[0], &count ), -1,
+                "Closed stream was not reported." );
+
+  for( i=0; i<2; i++ ) {
+    RTPPeerRelease( peers[i] );
+    RTPSessionRelease( sessions[i] );
+    close( s[i] );
+  }
+  return 0;
+}
 
 /**
  * Test that an RTP session can be properly teared down.
  */
-int test006_rtp( void ) {
+int test008_rtp( void ) {
   if( _session != NULL ) {
     RTPSessionRelease( _session );
   }
@@ -0,0 +1,884 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include "test.h"
+#define MIDI_DRIVER_INTERNALS
+#include "midi/message.h"
+#include "midi/driver.h"
+#include "driver/common/rtp.h"
+#include "driver/common/rtpmidi.h"
+
+#define RTPMIDI_ADDRESS "127.0.0.1"
+#define RTPMIDI_SENDER_PORT   5404
+#define RTPMIDI_RECEIVER_PORT 5504
+#define RTPMIDI_RECEIVER_SSRC 0x0badf00d
+#define RTPMIDI_OTHER_PORT    5604
+#define RTPMIDI_OTHER_SSRC    0x0defaced
+#define RTPMIDI_SYSEX_SENDER_PORT   5704
+#define RTPMIDI_SYSEX_RECEIVER_PORT 5804
+#define RTPMIDI_SYSEX_SIZE 3000
+#define RTPMIDI_FORWARD_SENDER_PORT   5904
+#define RTPMIDI_FORWARD_PORT          6004
+#define RTPMIDI_FORWARD_RECEIVER_PORT 6104
+#define RTPMIDI_COMMANDS_SENDER_PORT   6204
+#define RTPMIDI_COMMANDS_RECEIVER_PORT 6304
+#define RTPMIDI_COMMANDS_TIMESTAMP 0x1000
+#define RTPMIDI_COMMANDS_FORWARD_PORT  6404
+#define RTPMIDI_DROP_SENDER_PORT   6504
+#define RTPMIDI_DROP_RECEIVER_PORT 6604
+#define RTPMIDI_ASSEMBLY_SENDER_PORT   6704
+#define RTPMIDI_ASSEMBLY_RECEIVER_PORT 6804
+
+static int _sender_socket   = -1;
+static int _receiver_socket = -1;
+static struct RTPSession * _sender_rtp   = NULL;
+static struct RTPSession * _receiver_rtp = NULL;
+static struct RTPMIDISession * _sender   = NULL;
+static struct RTPMIDISession * _receiver = NULL;
+static struct RTPPeer * _receiver_peer   = NULL;
+
+static int _rtpmidi_socket( int * s, struct sockaddr_in * address, short port ) {
+  address->sin_family = AF_INET;
+  address->sin_port   = port;
+  ASSERT_NOT_EQUAL( inet_aton( RTPMIDI_ADDRESS, &(address->sin_addr) ), 0,
+                    "Could not create internet address." );
+  *s = socket( AF_INET, SOCK_DGRAM, 0 );
+  ASSERT_GREATER_OR_EQUAL( *s, 0, "Could not create socket." );
+  ASSERT_NO_ERROR( bind( *s, (void*)address, sizeof(struct sockaddr_in) ),
+                   "Could not bind socket." );
+  return 0;
+}
+
+/* send raw channel voice messages as one RTP-MIDI packet */
+static int _rtpmidi_send( size_t n, unsigned char (*bytes)[3] ) {
+  struct MIDIMessageList messages[4];
+  size_t i, read;
+  int result;
+  for( i=0; i<n; i++ ) {
+    messages[i].message = MIDIMessageCreate( 0 );
+    MIDIMessageDecode( messages[i].message, 3, &(bytes[i][0]), &read );
+    messages[i].next = ( i+1 < n ) ? &(messages[i+1]) : NULL;
+  }
+  result = RTPMIDISessionSend( _sender, &(messages[0]) );
+  for( i=0; i<n; i++ ) {
+    MIDIMessageRelease( messages[i].message );
+  }
+  return result;
+}
+
+/* receive one RTP-MIDI packet and compare its messages to raw messages */
+static int _rtpmidi_expect( size_t n, unsigned char (*bytes)[3] ) {
+  struct MIDIMessageList messages[8];
+  unsigned char buffer[3];
+  size_t i, written;
+  for( i=0; i<8; i++ ) {
+    messages[i].message = NULL;
+    messages[i].next = ( i+1 < 8 ) ? &(messages[i+1]) : NULL;
+  }
+  ASSERT_NO_ERROR( RTPMIDISessionReceive( _receiver, &(messages[0]) ), "Could not receive RTP-MIDI packet." );
+  for( i=0; i<n; i++ ) {
+    ASSERT_NOT_EQUAL( messages[i].message, NULL, "Received too few messages." );
+    MIDIMessageEncode( messages[i].message, sizeof(buffer), &(buffer[0]), &written );
+    ASSERT_EQUAL( buffer[0], bytes[i][0], "Received message with unexpected status." );
+    ASSERT_EQUAL( buffer[1], bytes[i][1], "Received message with unexpected first data byte." );
+    if( written > 2 ) {
+      ASSERT_EQUAL( buffer[2], bytes[i][2], "Received message with unexpected second data byte." );
+    }
+    MIDIMessageRelease( messages[i].message );
+  }
+  ASSERT_EQUAL( messages[n].message, NULL, "Received too many messages." );
+  return 0;
+}
+
+/**
+ * Test that RTP-MIDI sessions can be set up.
+ */
+int test001_rtpmidi( void ) {
+  struct sockaddr_in sender_address, receiver_address;
+  ASSERT_NO_ERROR( _rtpmidi_socket( &_sender_socket, &sender_address, RTPMIDI_SENDER_PORT ),
+                   "Could not create sender socket." );
+  ASSERT_NO_ERROR( _rtpmidi_socket( &_receiver_socket, &receiver_address, RTPMIDI_RECEIVER_PORT ),
+                   "Could not create receiver socket." );
+
+  _sender_rtp   = RTPSessionCreate( _sender_socket );
+  _receiver_rtp = RTPSessionCreate( _receiver_socket );
+  _sender   = RTPMIDISessionCreate( _sender_rtp );
+  _receiver = RTPMIDISessionCreate( _receiver_rtp );
+  ASSERT_NOT_EQUAL( _sender, NULL, "Could not create sending session." );
+  ASSERT_NOT_EQUAL( _receiver, NULL, "Could not create receiving session." );
+
+  _receiver_peer = RTPPeerCreate( RTPMIDI_RECEIVER_SSRC, sizeof(receiver_address), (void*) &receiver_address );
+  ASSERT_NO_ERROR( RTPSessionAddPeer( _sender_rtp, _receiver_peer ), "Could not add receiving peer." );
+  return 0;
+}
+
+/**
+ * Test that the state of lost packets is recovered from the journal
+ * of the next packet so that notes don't get stuck.
+ */
+int test002_rtpmidi( void ) {
+  unsigned char packet[128];
+  unsigned char first[1][3]   = { { 0x90, 60, 100 } };
+  unsigned char lost[3][3]    = { { 0xb0, 7, 90 }, { 0xc0, 5, 0 }, { 0x80, 60, 64 } };
+  unsigned char third[1][3]   = { { 0x90, 62, 80 } };
+  unsigned char recover[4][3] = { { 0xc0, 5, 0 }, { 0xb0, 7, 90 }, { 0x80, 60, 64 }, { 0x90, 62, 80 } };
+  ssize_t bytes;
+
+  ASSERT_NO_ERROR( _rtpmidi_send( 1, first ), "Could not send first packet." );
+  ASSERT_NO_ERROR( _rtpmidi_expect( 1, first ), "Did not receive first packet." );
+
+  /* drop the second packet, it has to carry the journal of the first */
+  ASSERT_NO_ERROR( _rtpmidi_send( 3, lost ), "Could not send second packet." );
+  bytes = recv( _receiver_socket, &(packet[0]), sizeof(packet), 0 );
+  ASSERT_GREATER( bytes, 13, "Received packet of unexpected size." );
+  ASSERT( packet[12] & 0x40, "Second packet has no journal." );
+
+  ASSERT_NO_ERROR( _rtpmidi_send( 1, third ), "Could not send third packet." );
+  ASSERT_NO_ERROR( _rtpmidi_expect( 4, recover ), "Could not recover the lost packet." );
+  return 0;
+}
+
+/**
+ * Test that receiver feedback trunkates the journal.
+ */
+int test003_rtpmidi( void ) {
+  unsigned char packet[128];
+  unsigned char note[1][3] = { { 0x80, 62, 64 } };
+  unsigned short seqnum;
+  ssize_t bytes;
+
+  ASSERT_NO_ERROR( _rtpmidi_send( 1, note ), "Could not send packet." );
+  bytes = recv( _receiver_socket, &(packet[0]), sizeof(packet), 0 );
+  ASSERT_GREATER( bytes, 13, "Received packet of unexpected size." );
+  ASSERT( packet[12] & 0x40, "Packet has no journal." );
+  seqnum = ( packet[2] << 8 ) | packet[3];
+
+  ASSERT_NO_ERROR( RTPMIDISessionJournalTrunkate( _sender, _receiver_peer, seqnum ),
+                   "Could not trunkate journal." );
+  ASSERT_NO_ERROR( _rtpmidi_send( 1, note ), "Could not send packet." );
+  bytes = recv( _receiver_socket, &(packet[0]), sizeof(packet), 0 );
+  ASSERT_EQUAL( bytes, 16, "Received packet of unexpected size." );
+  ASSERT_EQUAL( packet[12] & 0x40, 0, "Packet still carries the trunkated journal." );
+  return 0;
+}
+
+/**
+ * Test that messages that do not fit into one packet are sent in
+ * the following packets.
+ */
+int test004_rtpmidi( void ) {
+  unsigned char packet[2048];
+  unsigned char bytes[3] = { 0x90, 60, 100 };
+  struct MIDIMessageList messages[400];
+  size_t i, read, received = 0;
+  ssize_t size;
+  int packets = 0, result;
+
+  for( i=0; i<400; i++ ) {
+    messages[i].message = MIDIMessageCreate( 0 );
+    MIDIMessageDecode( messages[i].message, 3, &(bytes[0]), &read );
+    messages[i].next = ( i+1 < 400 ) ? &(messages[i+1]) : NULL;
+  }
+  result = RTPMIDISessionSend( _sender, &(messages[0]) );
+  for( i=0; i<400; i++ ) {
+    MIDIMessageRelease( messages[i].message );
+  }
+  ASSERT_NO_ERROR( result, "Could not send messages." );
+
+  /* every command takes three bytes, the first with status and the rest with delta times */
+  while( received < 400 ) {
+    size = recv( _receiver_socket, &(packet[0]), sizeof(packet), 0 );
+    ASSERT_GREATER( size, 14, "Received packet of unexpected size." );
+    ASSERT_LESS_OR_EQUAL( size, 1472, "Received packet larger than the MTU." );
+    ASSERT( packet[12] & 0x80, "Packet has no long header." );
+    received += ( ( ( packet[12] & 0x0f ) << 8 ) | packet[13] ) / 3;
+    packets++;
+  }
+  ASSERT_EQUAL( packets, 2, "Sent wrong number of packets." );
+  return 0;
+}
+
+/**
+ * Test that peers share the send history but get journals that start
+ * at the last packet they acknowledged.
+ */
+int test005_rtpmidi( void ) {
+  unsigned char packet[128], other_packet[128];
+  unsigned char note[1][3] = { { 0x90, 64, 100 } };
+  struct sockaddr_in other_address;
+  struct RTPPeer * other_peer;
+  unsigned short seqnum;
+  int other_socket;
+  ssize_t bytes, other_bytes;
+
+  ASSERT_NO_ERROR( _rtpmidi_socket( &other_socket, &other_address, RTPMIDI_OTHER_PORT ),
+                   "Could not create other receiver socket." );
+  other_peer = RTPPeerCreate( RTPMIDI_OTHER_SSRC, sizeof(other_address), (void*) &other_address );
+  ASSERT_NO_ERROR( RTPSessionAddPeer( _sender_rtp, other_peer ), "Could not add other peer." );
+
+  /* the new peer gets none of the history sent before it joined */
+  ASSERT_NO_ERROR( _rtpmidi_send( 1, note ), "Could not send packet." );
+  bytes = recv( _receiver_socket, &(packet[0]), sizeof(packet), 0 );
+  other_bytes = recv( other_socket, &(other_packet[0]), sizeof(other_packet), 0 );
+  ASSERT( packet[12] & 0x40, "Packet has no journal." );
+  ASSERT_EQUAL( other_bytes, 16, "Received packet of unexpected size." );
+  ASSERT_EQUAL( other_packet[12] & 0x40, 0, "Packet to the new peer carries old history." );
+  seqnum = ( packet[2] << 8 ) | packet[3];
+
+  /* both peers are at the same checkpoint, they get the same journal */
+  ASSERT_NO_ERROR( RTPMIDISessionJournalTrunkate( _sender, _receiver_peer, seqnum ),
+                   "Could not trunkate journal." );
+  seqnum = ( other_packet[2] << 8 ) | other_packet[3];
+  ASSERT_NO_ERROR( RTPMIDISessionJournalTrunkate( _sender, other_peer, seqnum ),
+                   "Could not trunkate journal." );
+  ASSERT_NO_ERROR( _rtpmidi_send( 1, note ), "Could not send packet." );
+  bytes = recv( _receiver_socket, &(packet[0]), sizeof(packet), 0 );
+  other_bytes = recv( other_socket, &(other_packet[0]), sizeof(other_packet), 0 );
+  ASSERT_EQUAL( bytes, 16, "Received packet of unexpected size." );
+  ASSERT_EQUAL( other_bytes, 16, "Received packet of unexpected size." );
+  ASSERT_NO_ERROR( _rtpmidi_send( 1, note ), "Could not send packet." );
+  bytes = recv( _receiver_socket, &(packet[0]), sizeof(packet), 0 );
+  other_bytes = recv( other_socket, &(other_packet[0]), sizeof(other_packet), 0 );
+  ASSERT( packet[12] & 0x40, "Packet has no journal." );
+  ASSERT_EQUAL( bytes, other_bytes, "Peers at the same checkpoint got different journals." );
+  ASSERT_EQUAL( memcmp( &(packet[19]), &(other_packet[19]), bytes-19 ), 0,
+                "Peers at the same checkpoint got different journals." );
+
+  /* feedback of one peer does not trunkate the journal of the other */
+  seqnum = ( other_packet[2] << 8 ) | other_packet[3];
+  ASSERT_NO_ERROR( RTPMIDISessionJournalTrunkate( _sender, other_peer, seqnum ),
+                   "Could not trunkate journal." );
+  ASSERT_NO_ERROR( _rtpmidi_send( 1, note ), "Could not send packet." );
+  bytes = recv( _receiver_socket, &(packet[0]), sizeof(packet), 0 );
+  other_bytes = recv( other_socket, &(other_packet[0]), sizeof(other_packet), 0 );
+  ASSERT( packet[12] & 0x40, "Packet lost the journal of the lagging peer." );
+  ASSERT_EQUAL( other_bytes, 16, "Received packet of unexpected size." );
+  ASSERT_EQUAL( other_packet[12] & 0x40, 0, "Packet still carries the trunkated journal." );
+
+  ASSERT_NO_ERROR( RTPSessionRemovePeer( _sender_rtp, other_peer ), "Could not remove other peer." );
+  RTPPeerRelease( other_peer );
+  close( other_socket );
+  return 0;
+}
+
+/**
+ * Test that the command section can be coded as universal MIDI packets.
+ */
+int test006_rtpmidi( void ) {
+  unsigned char packet[128];
+  unsigned char notes[2][3] = { { 0x91, 62, 100 }, { 0xe1, 0x12, 0x34 } };
+  struct MIDIMessageList messages[8];
+  struct MIDICompactMessage compact;
+  size_t i, n;
+  ssize_t bytes;
+
+  ASSERT_NO_ERROR( RTPMIDISessionSetUniversalPackets( _sender, 1 ), "Could not set payload format." );
+  ASSERT_NO_ERROR( RTPMIDISessionSetUniversalPackets( _receiver, 1 ), "Could not set payload format." );
+  /* the packets of the last test were not received by the session,
+   * so the state recovered from the journal comes first */
+  ASSERT_NO_ERROR( _rtpmidi_send( 2, notes ), "Could not send packet." );
+  for( i=0; i<8; i++ ) {
+    messages[i].message = NULL;
+    messages[i].next = ( i+1 < 8 ) ? &(messages[i+1]) : NULL;
+  }
+  ASSERT_NO_ERROR( RTPMIDISessionReceive( _receiver, &(messages[0]) ), "Could not receive RTP-MIDI packet." );
+  for( n=0; n<8 && messages[n].message != NULL; n++ );
+  ASSERT_GREATER_OR_EQUAL( n, 2, "Received too few messages." );
+  for( i=0; i<n; i++ ) {
+    if( i+2 >= n ) {
+      ASSERT_NO_ERROR( MIDIMessageGetCompact( messages[i].message, &compact ), "Could not get compact message." );
+      ASSERT_EQUAL( memcmp( &(compact.bytes[0]), &(notes[i+2-n][0]), 3 ), 0, "Received the wrong message." );
+    }
+    MIDIMessageRelease( messages[i].message );
+  }
+
+  ASSERT_NO_ERROR( _rtpmidi_send( 2, notes ), "Could not send packet." );
+  bytes = recv( _receiver_socket, &(packet[0]), sizeof(packet), 0 );
+  ASSERT_GREATER_OR_EQUAL( bytes, 14 + 16, "Received packet of unexpected size." );
+  ASSERT( packet[12] & 0x80, "Command section has a short header." );
+  ASSERT_EQUAL( packet[13], 16, "Command section has wrong length." );
+  ASSERT_EQUAL( packet[14], 0x40, "Command section holds no MIDI 2.0 packet." );
+  ASSERT_EQUAL( packet[15], 0x91, "Packet has wrong status." );
+  ASSERT_EQUAL( packet[22], 0x40, "Command section holds no MIDI 2.0 packet." );
+
+  ASSERT_NO_ERROR( RTPMIDISessionSetUniversalPackets( _sender, 0 ), "Could not set payload format." );
+  ASSERT_NO_ERROR( RTPMIDISessionSetUniversalPackets( _receiver, 0 ), "Could not set payload format." );
+  return 0;
+}
+
+/**
+ * Test that a multicast group gets one packet for all peers and that
+ * peers that lag behind are repaired with unicast packets.
+ */
+int test007_rtpmidi( void ) {
+  unsigned char packet[128], other_packet[128];
+  unsigned char note[1][3] = { { 0x92, 65, 100 } };
+  unsigned char control[1][3] = { { 0xb2, 7, 80 } };
+  struct sockaddr_in other_address;
+  struct sockaddr * address;
+  struct RTPPeer * group, * other_peer;
+  unsigned short seqnum, first;
+  socklen_t size;
+  int other_socket;
+  ssize_t bytes, other_bytes;
+
+  ASSERT_NO_ERROR( _rtpmidi_socket( &other_socket, &other_address, RTPMIDI_OTHER_PORT ),
+                   "Could not create other receiver socket." );
+  other_peer = RTPPeerCreate( RTPMIDI_OTHER_SSRC, sizeof(other_address), (void*) &other_address );
+  ASSERT_NO_ERROR( RTPSessionAddPeer( _sender_rtp, other_peer ), "Could not add other peer." );
+
+  /* the group has the receiver's address, so only the receiver gets the packets */
+  ASSERT_NO_ERROR( RTPPeerGetAddress( _receiver_peer, &size, &address ), "Could not get peer address." );
+  group = RTPPeerCreate( 0, size, address );
+  ASSERT_NO_ERROR( RTPSessionSetMulticastGroup( _sender_rtp, group ), "Could not set multicast group." );
+  ASSERT_NO_ERROR( _rtpmidi_send( 1, note ), "Could not send packet." );
+  bytes = recv( _receiver_socket, &(packet[0]), sizeof(packet), 0 );
+  ASSERT_GREATER( bytes, 13, "Received packet of unexpected size." );
+  other_bytes = recv( other_socket, &(other_packet[0]), sizeof(other_packet), MSG_DONTWAIT );
+  ASSERT_LESS( other_bytes, 0, "Peer received a unicast packet." );
+  first = ( packet[2] << 8 ) | packet[3];
+
+  /* the other peer acknowledges the first packet and misses the second */
+  ASSERT_NO_ERROR( RTPMIDISessionJournalTrunkate( _sender, other_peer, first ), "Could not trunkate journal." );
+  ASSERT_NO_ERROR( _rtpmidi_send( 1, control ), "Could not send packet." );
+  bytes = recv( _receiver_socket, &(packet[0]), sizeof(packet), 0 );
+  seqnum = ( packet[2] << 8 ) | packet[3];
+  ASSERT_EQUAL( seqnum, (unsigned short) ( first + 1 ), "Group packets are not numbered in sequence." );
+
+  ASSERT_NO_ERROR( RTPMIDISessionSendRepair( _sender, other_peer ), "Could not send repair packet." );
+  other_bytes = recv( other_socket, &(other_packet[0]), sizeof(other_packet), 0 );
+  ASSERT_GREATER( other_bytes, 16, "Received repair packet of unexpected size." );
+  ASSERT_EQUAL( ( other_packet[2] << 8 ) | other_packet[3], seqnum, "Repair packet has wrong sequence number." );
+  ASSERT_EQUAL( other_packet[12], 0x40, "Repair packet has commands or no journal." );
+
+  ASSERT_NO_ERROR( RTPSessionSetMulticastGroup( _sender_rtp, NULL ), "Could not unset multicast group." );
+  RTPPeerRelease( group );
+  ASSERT_NO_ERROR( RTPSessionRemovePeer( _sender_rtp, other_peer ), "Could not remove other peer." );
+  RTPPeerRelease( other_peer );
+  close( other_socket );
+  return 0;
+}
+
+/**
+ * Test that RTP-MIDI sessions can be torn down.
+ */
+int test008_rtpmidi( void ) {
+  RTPPeerRelease( _receiver_peer );
+  RTPMIDISessionRelease( _sender );
+  RTPMIDISessionRelease( _receiver );
+  RTPSessionRelease( _sender_rtp );
+  RTPSessionRelease( _receiver_rtp );
+  close( _sender_socket );
+  close( _receiver_socket );
+  return 0;
+}
+
+/* receive one RTP-MIDI packet with a system exclusive segment and append its payload */
+static int _rtpmidi_expect_segment( struct RTPMIDISession * receiver, unsigned char * buffer, size_t * length,
+                                    char * fragment ) {
+  struct MIDIMessageList messages[2] = { { NULL, &(messages[1]) }, { NULL, NULL } };
+  MIDIStatus status;
+  unsigned char * data;
+  size_t size;
+  ASSERT_NO_ERROR( RTPMIDISessionReceive( receiver, &(messages[0]) ), "Could not receive RTP-MIDI packet." );
+  ASSERT_NOT_EQUAL( messages[0].message, NULL, "Received no segment." );
+  ASSERT_EQUAL( messages[1].message, NULL, "Received more than the segment." );
+  MIDIMessageGetStatus( messages[0].message, &status );
+  ASSERT_EQUAL( status, MIDI_STATUS_SYSTEM_EXCLUSIVE, "Received message is no segment." );
+  MIDIMessageGet( messages[0].message, MIDI_SYSEX_FRAGMENT, sizeof(char), fragment );
+  MIDIMessageGet( messages[0].message, MIDI_SYSEX_SIZE, sizeof(size_t), &size );
+  MIDIMessageGet( messages[0].message, MIDI_SYSEX_DATA, sizeof(void*), &data );
+  ASSERT_LESS_OR_EQUAL( *length + size, RTPMIDI_SYSEX_SIZE, "Received too many system exclusive bytes." );
+  memcpy( buffer + *length, data, size );
+  *length += size;
+  MIDIMessageRelease( messages[0].message );
+  return 0;
+}
+
+/**
+ * Test that a system exclusive message that is too long for a packet is
+ * sent in segments after the messages that follow it, and that the
+ * segments are paced.
+ */
+int test009_rtpmidi( void ) {
+  static unsigned char sysex[RTPMIDI_SYSEX_SIZE], received[RTPMIDI_SYSEX_SIZE];
+  unsigned char note[1][3] = { { 0x90, 60, 100 } };
+  struct sockaddr_in sender_address, receiver_address;
+  struct RTPSession * sender_rtp, * receiver_rtp;
+  struct RTPMIDISession * sender, * receiver;
+  struct RTPPeer * peer;
+  struct MIDIMessageList messages[2], slice;
+  struct MIDISysExBuffer * buffer;
+  struct timespec delay;
+  MIDIManufacturerId id = 0x7d;
+  unsigned char * data = &(sysex[0]);
+  size_t i, size = sizeof(sysex), length = 0, bytes, count;
+  char fragment;
+  int sender_socket, receiver_socket;
+
+  ASSERT_NO_ERROR( _rtpmidi_socket( &sender_socket, &sender_address, RTPMIDI_SYSEX_SENDER_PORT ),
+                   "Could not create sender socket." );
+  ASSERT_NO_ERROR( _rtpmidi_socket( &receiver_socket, &receiver_address, RTPMIDI_SYSEX_RECEIVER_PORT ),
+                   "Could not create receiver socket." );
+  sender_rtp   = RTPSessionCreate( sender_socket );
+  receiver_rtp = RTPSessionCreate( receiver_socket );
+  sender   = RTPMIDISessionCreate( sender_rtp );
+  receiver = RTPMIDISessionCreate( receiver_rtp );
+  peer = RTPPeerCreate( RTPMIDI_RECEIVER_SSRC, sizeof(receiver_address), (void*) &receiver_address );
+  ASSERT_NO_ERROR( RTPSessionAddPeer( sender_rtp, peer ), "Could not add receiving peer." );
+
+  for( i=0; i<sizeof(sysex); i++ ) sysex[i] = i & 0x7f;
+  sysex[sizeof(sysex)-1] = MIDI_STATUS_END_OF_EXCLUSIVE;
+  messages[0].message = MIDIMessageCreate( MIDI_STATUS_SYSTEM_EXCLUSIVE );
+  MIDIMessageSet( messages[0].message, MIDI_MANUFACTURER_ID, sizeof(MIDIManufacturerId), &id );
+  MIDIMessageSet( messages[0].message, MIDI_SYSEX_DATA, sizeof(void**), &data );
+  MIDIMessageSet( messages[0].message, MIDI_SYSEX_SIZE, sizeof(size_t), &size );
+  messages[0].next = &(messages[1]);
+  messages[1].message = MIDIMessageCreate( 0 );
+  MIDIMessageDecode( messages[1].message, 3, &(note[0][0]), &bytes );
+  messages[1].next = NULL;
+
+  /* the note does not wait for the segments */
+  ASSERT_NO_ERROR( RTPMIDISessionSend( sender, &(messages[0]) ), "Could not send messages." );
+  ASSERT_NO_ERROR( RTPMIDISessionGetPendingSysEx( sender, &bytes, &count ), "Could not get pending bytes." );
+  ASSERT_EQUAL( bytes + count, 0, "Segments were not sent." );
+  _receiver = receiver;
+  ASSERT_NO_ERROR( _rtpmidi_expect( 1, note ), "Note was not sent first." );
+  fragment = -1;
+  for( i=0; i<4; i++ ) {
+    ASSERT_NO_ERROR( _rtpmidi_expect_segment( receiver, &(received[0]), &length, &fragment ),
+                     "Could not receive segment." );
+    ASSERT_EQUAL( fragment, ( i == 0 ) ? 0 : 1, "Segment has unexpected fragment number." );
+  }
+  /* the first segment starts after the status and manufacturer id */
+  ASSERT_EQUAL( length, RTPMIDI_SYSEX_SIZE, "Received unexpected number of bytes." );
+  ASSERT_EQUAL( memcmp( &(received[0]), &(sysex[0]), length ), 0, "Segments have unexpected payload." );
+
+  /* a slice of a shared buffer is segmented without a copy */
+  buffer = MIDISysExBufferCreate( sizeof(sysex), &(sysex[0]) );
+  ASSERT_NOT_EQUAL( buffer, NULL, "Could not create system exclusive buffer." );
+  slice.message = MIDIMessageCreate( MIDI_STATUS_SYSTEM_EXCLUSIVE );
+  slice.next    = NULL;
+  MIDIMessageSet( slice.message, MIDI_MANUFACTURER_ID, sizeof(MIDIManufacturerId), &id );
+  ASSERT_NO_ERROR( MIDIMessageSetSysExBuffer( slice.message, buffer, 0, sizeof(sysex) ), "Could not set slice." );
+  MIDISysExBufferRelease( buffer );
+  ASSERT_NO_ERROR( RTPMIDISessionSend( sender, &slice ), "Could not send slice." );
+  MIDIMessageRelease( slice.message );
+  length = 0;
+  for( i=0; i<4; i++ ) {
+    ASSERT_NO_ERROR( _rtpmidi_expect_segment( receiver, &(received[0]), &length, &fragment ),
+                     "Could not receive segment of slice." );
+  }
+  ASSERT_EQUAL( length, RTPMIDI_SYSEX_SIZE, "Received unexpected number of bytes of slice." );
+  ASSERT_EQUAL( memcmp( &(received[0]), &(sysex[0]), length ), 0, "Segments of slice have unexpected payload." );
+
+  /* only the first segment goes out right away at a low rate */
+  ASSERT_NO_ERROR( RTPMIDISessionSetSysExRate( sender, 1000 ), "Could not set rate." );
+  messages[0].next = NULL;
+  ASSERT_NO_ERROR( RTPMIDISessionSend( sender, &(messages[0]) ), "Could not send message." );
+  ASSERT_NO_ERROR( RTPMIDISessionSendSysEx( sender ), "Could not send segments." );
+  ASSERT_NO_ERROR( RTPMIDISessionGetPendingSysEx( sender, &bytes, &count ), "Could not get pending bytes." );
+  ASSERT_GREATER( bytes, 0, "Segments were not paced." );
+  ASSERT_NO_ERROR( RTPMIDISessionGetSysExDelay( sender, &delay ), "Could not get delay." );
+  ASSERT_GREATER( delay.tv_sec * 1000000000L + delay.tv_nsec, 500000000L, "Delay is too short for the rate." );
+  length = 0;
+  ASSERT_NO_ERROR( _rtpmidi_expect_segment( receiver, &(received[0]), &length, &fragment ),
+                   "Could not receive segment." );
+  ASSERT_LESS( recv( receiver_socket, &(received[0]), sizeof(received), MSG_DONTWAIT ), 0,
+               "Second segment was not paced." );
+  ASSERT_NO_ERROR( RTPMIDISessionCancelSysEx( sender ), "Could not cancel segments." );
+  ASSERT_ERROR( RTPMIDISessionGetSysExDelay( sender, &delay ), "Cancelled segments are pending." );
+
+  MIDIMessageRelease( messages[0].message );
+  MIDIMessageRelease( messages[1].message );
+  RTPPeerRelease( peer );
+  RTPMIDISessionRelease( sender );
+  RTPMIDISessionRelease( receiver );
+  RTPSessionRelease( sender_rtp );
+  RTPSessionRelease( receiver_rtp );
+  close( sender_socket );
+  close( receiver_socket );
+  _receiver = NULL;
+  return 0;
+}
+
+/**
+ * Test that received commands can be forwarded as compact messages
+ * without decoding them.
+ */
+int test010_rtpmidi( void ) {
+  unsigned char sysex[5] = { 0xf0, 0x7d, 0x01, 0x02, 0xf7 };
+  unsigned char notes[2][3] = { { 0x90, 60, 100 }, { 0x90, 64, 90 } };
+  unsigned char buffer[8];
+  struct sockaddr_in sender_address, forward_address, receiver_address;
+  struct RTPSession * sender_rtp, * forward_rtp, * receiver_rtp;
+  struct RTPMIDISession * sender, * forward, * receiver;
+  struct RTPPeer * forward_peer, * receiver_peer;
+  struct MIDIMessageList messages[4];
+  struct MIDICompactMessage compact[4];
+  unsigned char * payload;
+  MIDITimestamp timestamp;
+  size_t i, count, read, written;
+  int sender_socket, forward_socket, receiver_socket;
+
+  ASSERT_NO_ERROR( _rtpmidi_socket( &sender_socket, &sender_address, RTPMIDI_FORWARD_SENDER_PORT ),
+                   "Could not create sender socket." );
+  ASSERT_NO_ERROR( _rtpmidi_socket( &forward_socket, &forward_address, RTPMIDI_FORWARD_PORT ),
+                   "Could not create forwarding socket." );
+  ASSERT_NO_ERROR( _rtpmidi_socket( &receiver_socket, &receiver_address, RTPMIDI_FORWARD_RECEIVER_PORT ),
+                   "Could not create receiver socket." );
+  sender_rtp   = RTPSessionCreate( sender_socket );
+  forward_rtp  = RTPSessionCreate( forward_socket );
+  receiver_rtp = RTPSessionCreate( receiver_socket );
+  sender   = RTPMIDISessionCreate( sender_rtp );
+  forward  = RTPMIDISessionCreate( forward_rtp );
+  receiver = RTPMIDISessionCreate( receiver_rtp );
+  forward_peer  = RTPPeerCreate( RTPMIDI_OTHER_SSRC, sizeof(forward_address), (void*) &forward_address );
+  receiver_peer = RTPPeerCreate( RTPMIDI_RECEIVER_SSRC, sizeof(receiver_address), (void*) &receiver_address );
+  ASSERT_NO_ERROR( RTPSessionAddPeer( sender_rtp, forward_peer ), "Could not add forwarding peer." );
+  ASSERT_NO_ERROR( RTPSessionAddPeer( forward_rtp, receiver_peer ), "Could not add receiving peer." );
+
+  for( i=0; i<3; i++ ) {
+    messages[i].message = MIDIMessageCreate( 0 );
+    if( i < 2 ) {
+      MIDIMessageDecode( messages[i].message, 3, &(notes[i][0]), &read );
+    } else {
+      MIDIMessageDecode( messages[i].message, sizeof(sysex), &(sysex[0]), &read );
+    }
+    messages[i].next = ( i < 2 ) ? &(messages[i+1]) : NULL;
+  }
+  ASSERT_NO_ERROR( RTPMIDISessionSend( sender, &(messages[0]) ), "Could not send messages." );
+  for( i=0; i<3; i++ ) {
+    MIDIMessageRelease( messages[i].message );
+  }
+
+  /* the system exclusive payload is a view into the received packet */
+  ASSERT_NO_ERROR( RTPMIDISessionReceiveCompact( forward, NULL, 4, &(compact[0]), &count, &payload, &timestamp ),
+                   "Could not receive compact messages." );
+  ASSERT_EQUAL( count, 3, "Received unexpected number of compact messages." );
+  ASSERT_EQUAL( compact[1].bytes[1], 64, "Received compact message with unexpected key." );
+  ASSERT_EQUAL( compact[2].bytes[0], MIDI_STATUS_SYSTEM_EXCLUSIVE, "Received unexpected compact message." );
+  ASSERT_EQUAL( compact[2].flags, MIDI_COMPACT_SYSEX_START | MIDI_COMPACT_SYSEX_END,
+                "Received incomplete system exclusive message." );
+  ASSERT_EQUAL( compact[2].sysex_size, 3, "Received system exclusive message of unexpected size." );
+  ASSERT_EQUAL( memcmp( payload + compact[2].sysex_offset, &(sysex[1]), 3 ), 0,
+                "System exclusive view has unexpected payload." );
+  ASSERT_NO_ERROR( RTPMIDISessionSendCompact( forward, timestamp, count, &(compact[0]), payload ),
+                   "Could not forward compact messages." );
+
+  for( i=0; i<4; i++ ) {
+    messages[i].message = NULL;
+    messages[i].next = ( i+1 < 4 ) ? &(messages[i+1]) : NULL;
+  }
+  ASSERT_NO_ERROR( RTPMIDISessionReceive( receiver, &(messages[0]) ), "Could not receive forwarded packet." );
+  for( i=0; i<3; i++ ) {
+    ASSERT_NOT_EQUAL( messages[i].message, NULL, "Received too few forwarded messages." );
+    MIDIMessageEncode( messages[i].message, sizeof(buffer), &(buffer[0]), &written );
+    if( i < 2 ) {
+      ASSERT_EQUAL( memcmp( &(buffer[0]), &(notes[i][0]), 3 ), 0, "Forwarded note has unexpected bytes." );
+    } else {
+      ASSERT_EQUAL( written, sizeof(sysex), "Forwarded system exclusive message has unexpected size." );
+      ASSERT_EQUAL( memcmp( &(buffer[0]), &(sysex[0]), sizeof(sysex) ), 0,
+                    "Forwarded system exclusive message has unexpected bytes." );
+    }
+    MIDIMessageRelease( messages[i].message );
+  }
+  ASSERT_EQUAL( messages[3].message, NULL, "Received too many forwarded messages." );
+
+  RTPPeerRelease( forward_peer );
+  RTPPeerRelease( receiver_peer );
+  RTPMIDISessionRelease( sender );
+  RTPMIDISessionRelease( forward );
+  RTPMIDISessionRelease( receiver );
+  RTPSessionRelease( sender_rtp );
+  RTPSessionRelease( forward_rtp );
+  RTPSessionRelease( receiver_rtp );
+  close( sender_socket );
+  close( forward_socket );
+  close( receiver_socket );
+  return 0;
+}
+
+/* send a raw command section without delta time for the first command */
+static int _rtpmidi_send_commands( int s, struct sockaddr_in * address, unsigned short seqnum,
+                                   size_t size, unsigned char * commands ) {
+  unsigned char buffer[32] = { 0x80, 97,                /* V=2, P=0, X=0, CC=0, PT=97 */
+                               seqnum >> 8, seqnum & 0xff,
+                               ( RTPMIDI_COMMANDS_TIMESTAMP >> 24 ) & 0xff,
+                               ( RTPMIDI_COMMANDS_TIMESTAMP >> 16 ) & 0xff,
+                               ( RTPMIDI_COMMANDS_TIMESTAMP >> 8 ) & 0xff,
+                               ( RTPMIDI_COMMANDS_TIMESTAMP ) & 0xff,
+                               ( RTPMIDI_OTHER_SSRC >> 24 ) & 0xff,
+                               ( RTPMIDI_OTHER_SSRC >> 16 ) & 0xff,
+                               ( RTPMIDI_OTHER_SSRC >> 8 ) & 0xff,
+                               ( RTPMIDI_OTHER_SSRC ) & 0xff,
+                               size };                  /* B=0, J=0, Z=0, P=0, LEN */
+  ASSERT_LESS_OR_EQUAL( size, 15, "Command section is too long for the short header." );
+  memcpy( &(buffer[13]), commands, size );
+  ASSERT_EQUAL( sendto( s, &(buffer[0]), 13 + size, 0, (struct sockaddr *) address, sizeof(*address) ), 13 + size,
+                "Could not send command section." );
+  return 0;
+}
+
+/**
+ * Test that a segmented or cancelled system exclusive message in the
+ * first command of a packet does not corrupt the delta times of the
+ * commands that follow it.
+ */
+int test011_rtpmidi( void ) {
+  unsigned char segment[]   = { 0xf0, 0x7d, 0x01, 0x02, 0xf0, 0x00, 0x90, 0x3c, 0x40 };
+  unsigned char cancelled[] = { 0xf0, 0x7d, 0x05, 0xf4, 0x00, 0x80, 0x3c, 0x00 };
+  struct sockaddr_in sender_address, receiver_address;
+  struct RTPSession * receiver_rtp;
+  struct RTPMIDISession * receiver;
+  struct MIDIMessageList messages[4];
+  MIDITimestamp timestamp;
+  MIDIStatus status;
+  char fragment;
+  size_t i, size;
+  int sender_socket, receiver_socket, k;
+
+  ASSERT_NO_ERROR( _rtpmidi_socket( &sender_socket, &sender_address, RTPMIDI_COMMANDS_SENDER_PORT ),
+                   "Could not create sender socket." );
+  ASSERT_NO_ERROR( _rtpmidi_socket( &receiver_socket, &receiver_address, RTPMIDI_COMMANDS_RECEIVER_PORT ),
+                   "Could not create receiver socket." );
+  receiver_rtp = RTPSessionCreate( receiver_socket );
+  receiver     = RTPMIDISessionCreate( receiver_rtp );
+
+  ASSERT_NO_ERROR( _rtpmidi_send_commands( sender_socket, &receiver_address, 1, sizeof(segment), &(segment[0]) ),
+                   "Could not send segment." );
+  ASSERT_NO_ERROR( _rtpmidi_send_commands( sender_socket, &receiver_address, 2, sizeof(cancelled), &(cancelled[0]) ),
+                   "Could not send cancelled message." );
+  for( k=0; k<2; k++ ) {
+    for( i=0; i<4; i++ ) {
+      messages[i].message = NULL;
+      messages[i].next = ( i+1 < 4 ) ? &(messages[i+1]) : NULL;
+    }
+    ASSERT_NO_ERROR( RTPMIDISessionReceive( receiver, &(messages[0]) ), "Could not receive RTP-MIDI packet." );
+    ASSERT_NOT_EQUAL( messages[1].message, NULL, "Received too few messages." );
+    ASSERT_EQUAL( messages[2].message, NULL, "Received too many messages." );
+    MIDIMessageGetStatus( messages[0].message, &status );
+    ASSERT_EQUAL( status, MIDI_STATUS_SYSTEM_EXCLUSIVE, "First message is no system exclusive message." );
+    MIDIMessageGet( messages[0].message, MIDI_SYSEX_FRAGMENT, sizeof(char), &fragment );
+    MIDIMessageGet( messages[0].message, MIDI_SYSEX_SIZE, sizeof(size_t), &size );
+    ASSERT_EQUAL( fragment, 0, "System exclusive message is no first segment." );
+    ASSERT_EQUAL( size, ( k == 0 ) ? 2 : 1, "System exclusive message has unexpected size." );
+    MIDIMessageGetStatus( messages[1].message, &status );
+    ASSERT_EQUAL( status, ( k == 0 ) ? MIDI_STATUS_NOTE_ON : MIDI_STATUS_NOTE_OFF,
+                  "Second message has unexpected status." );
+    MIDIMessageGetTimestamp( messages[1].message, &timestamp );
+    ASSERT_EQUAL( timestamp, RTPMIDI_COMMANDS_TIMESTAMP, "Second message has a corrupted delta time." );
+    MIDIMessageRelease( messages[0].message );
+    MIDIMessageRelease( messages[1].message );
+  }
+
+  RTPMIDISessionRelease( receiver );
+  RTPSessionRelease( receiver_rtp );
+  close( sender_socket );
+  close( receiver_socket );
+  return 0;
+}
+
+/**
+ * Test that a segmented or cancelled system exclusive message in the
+ * first command of a packet keeps its framing when it is forwarded as a
+ * compact message.
+ */
+int test012_rtpmidi( void ) {
+  unsigned char segment[]   = { 0xf0, 0x7d, 0x01, 0x02, 0xf0, 0x00, 0x90, 0x3c, 0x40 };
+  unsigned char cancelled[] = { 0xf0, 0x7d, 0x05, 0xf4, 0x00, 0x80, 0x3c, 0x00 };
+  unsigned char flags[2] = { MIDI_COMPACT_SYSEX_START, MIDI_COMPACT_SYSEX_START | MIDI_COMPACT_SYSEX_CANCEL };
+  struct sockaddr_in sender_address, forward_address, receiver_address;
+  struct RTPSession * forward_rtp, * receiver_rtp;
+  struct RTPMIDISession * forward, * receiver;
+  struct RTPPeer * receiver_peer;
+  struct MIDICompactMessage compact[4];
+  unsigned char * payload;
+  MIDITimestamp timestamp;
+  size_t count;
+  int sender_socket, forward_socket, receiver_socket, k;
+
+  ASSERT_NO_ERROR( _rtpmidi_socket( &sender_socket, &sender_address, RTPMIDI_COMMANDS_SENDER_PORT ),
+                   "Could not create sender socket." );
+  ASSERT_NO_ERROR( _rtpmidi_socket( &forward_socket, &forward_address, RTPMIDI_COMMANDS_FORWARD_PORT ),
+                   "Could not create forwarding socket." );
+  ASSERT_NO_ERROR( _rtpmidi_socket( &receiver_socket, &receiver_address, RTPMIDI_COMMANDS_RECEIVER_PORT ),
+                   "Could not create receiver socket." );
+  forward_rtp  = RTPSessionCreate( forward_socket );
+  receiver_rtp = RTPSessionCreate( receiver_socket );
+  forward  = RTPMIDISessionCreate( forward_rtp );
+  receiver = RTPMIDISessionCreate( receiver_rtp );
+  receiver_peer = RTPPeerCreate( RTPMIDI_RECEIVER_SSRC, sizeof(receiver_address), (void*) &receiver_address );
+  ASSERT_NO_ERROR( RTPSessionAddPeer( forward_rtp, receiver_peer ), "Could not add receiving peer." );
+
+  ASSERT_NO_ERROR( _rtpmidi_send_commands( sender_socket, &forward_address, 1, sizeof(segment), &(segment[0]) ),
+                   "Could not send segment." );
+  ASSERT_NO_ERROR( _rtpmidi_send_commands( sender_socket, &forward_address, 2, sizeof(cancelled), &(cancelled[0]) ),
+                   "Could not send cancelled message." );
+  for( k=0; k<2; k++ ) {
+    ASSERT_NO_ERROR( RTPMIDISessionReceiveCompact( forward, NULL, 4, &(compact[0]), &count, &payload, &timestamp ),
+                     "Could not receive compact messages." );
+    ASSERT_EQUAL( count, 2, "Received unexpected number of compact messages." );
+    ASSERT_EQUAL( compact[0].flags, flags[k], "Received system exclusive message with unexpected framing." );
+    ASSERT_EQUAL( compact[1].timestamp, 0, "Second message has a corrupted delta time." );
+    ASSERT_NO_ERROR( RTPMIDISessionSendCompact( forward, timestamp, count, &(compact[0]), payload ),
+                     "Could not forward compact messages." );
+
+    ASSERT_NO_ERROR( RTPMIDISessionReceiveCompact( receiver, NULL, 4, &(compact[0]), &count, &payload, &timestamp ),
+                     "Could not receive forwarded messages." );
+    ASSERT_EQUAL( count, 2, "Received unexpected number of forwarded messages." );
+    ASSERT_EQUAL( compact[0].flags, flags[k], "Forwarded system exclusive message lost its framing." );
+    ASSERT_EQUAL( compact[0].sysex_size, ( k == 0 ) ? 3 : 2, "Forwarded system exclusive message has unexpected size." );
+    ASSERT_EQUAL( compact[1].bytes[0], ( k == 0 ) ? 0x90 : 0x80, "Forwarded message has unexpected status." );
+    ASSERT_EQUAL( compact[1].timestamp, 0, "Forwarded message has a corrupted delta time." );
+  }
+
+  RTPPeerRelease( receiver_peer );
+  RTPMIDISessionRelease( forward );
+  RTPMIDISessionRelease( receiver );
+  RTPSessionRelease( forward_rtp );
+  RTPSessionRelease( receiver_rtp );
+  close( sender_socket );
+  close( forward_socket );
+  close( receiver_socket );
+  return 0;
+}
+
+/**
+ * Test that commands that do not fit into the message list are counted
+ * as drops instead of being lost silently.
+ */
+int test013_rtpmidi( void ) {
+  unsigned char commands[] = { 0x90, 0x3c, 0x40, 0x00, 0x3d, 0x40, 0x00, 0x3e, 0x40 };
+  unsigned char packets[]  = { 0x20, 0x90, 0x3c, 0x40, 0x20, 0x90, 0x3d, 0x40, 0x20, 0x90, 0x3e, 0x40 };
+  struct sockaddr_in sender_address, receiver_address;
+  struct RTPSession * receiver_rtp;
+  struct RTPMIDISession * receiver;
+  struct MIDIMessageList messages[2];
+  struct MIDIDriver * driver;
+#ifndef NO_PROFILING
+  struct MIDIDriverProfilingStats stats;
+#endif
+  MIDIKey key;
+  int sender_socket, receiver_socket, k;
+
+  ASSERT_NO_ERROR( _rtpmidi_socket( &sender_socket, &sender_address, RTPMIDI_DROP_SENDER_PORT ),
+                   "Could not create sender socket." );
+  ASSERT_NO_ERROR( _rtpmidi_socket( &receiver_socket, &receiver_address, RTPMIDI_DROP_RECEIVER_PORT ),
+                   "Could not create receiver socket." );
+  receiver_rtp = RTPSessionCreate( receiver_socket );
+  receiver     = RTPMIDISessionCreate( receiver_rtp );
+  driver       = MIDIDriverCreate( "test driver", MIDI_SAMPLING_RATE_DEFAULT );
+  ASSERT_NOT_EQUAL( driver, NULL, "Could not create driver." );
+#ifndef NO_PROFILING
+  ASSERT_NO_ERROR( MIDIDriverStartProfiling( driver ), "Could not start profiling." );
+  ASSERT_NO_ERROR( RTPMIDISessionSetProfile( receiver, driver->profile ), "Could not set profile." );
+#endif
+
+  /* the same for commands and universal packets */
+  for( k=0; k<2; k++ ) {
+    ASSERT_NO_ERROR( RTPMIDISessionSetUniversalPackets( receiver, k ), "Could not set packet coding." );
+    if( k == 0 ) {
+      ASSERT_NO_ERROR( _rtpmidi_send_commands( sender_socket, &receiver_address, 1, sizeof(commands), &(commands[0]) ),
+                       "Could not send commands." );
+    } else {
+      ASSERT_NO_ERROR( _rtpmidi_send_commands( sender_socket, &receiver_address, 2, sizeof(packets), &(packets[0]) ),
+                       "Could not send universal packets." );
+    }
+    messages[0].message = NULL;
+    messages[0].next    = &(messages[1]);
+    messages[1].message = NULL;
+    messages[1].next    = NULL;
+    ASSERT_NO_ERROR( RTPMIDISessionReceive( receiver, &(messages[0]) ), "Could not receive RTP-MIDI packet." );
+    ASSERT_NOT_EQUAL( messages[1].message, NULL, "Received too few messages." );
+    MIDIMessageGet( messages[1].message, MIDI_KEY, sizeof(MIDIKey), &key );
+    ASSERT_EQUAL( key, 0x3d, "Second message has unexpected key." );
+#ifndef NO_PROFILING
+    ASSERT_NO_ERROR( MIDIDriverGetProfilingStats( driver, &stats ), "Could not get profiling stats." );
+    ASSERT_EQUAL( stats.drops, k+1, "Did not count the command that did not fit." );
+#endif
+    MIDIMessageRelease( messages[0].message );
+    MIDIMessageRelease( messages[1].message );
+  }
+#ifndef NO_PROFILING
+  RTPMIDISessionSetProfile( receiver, NULL );
+#endif
+
+  MIDIDriverRelease( driver );
+  RTPMIDISessionRelease( receiver );
+  RTPSessionRelease( receiver_rtp );
+  close( sender_socket );
+  close( receiver_socket );
+  return 0;
+}
+
+/**
+ * Test that the segments of a system exclusive message are reassembled
+ * into one message and that messages past the maximum size are dropped.
+ */
+int test014_rtpmidi( void ) {
+  unsigned char first[]  = { 0xf0, 0x7d, 0x01, 0x02, 0xf0, 0x00, 0x90, 0x3c, 0x40 };
+  unsigned char second[] = { 0xf7, 0x03, 0x04, 0xf7, 0x00, 0x80, 0x3c, 0x00 };
+  struct sockaddr_in sender_address, receiver_address;
+  struct RTPSession * receiver_rtp;
+  struct RTPMIDISession * receiver;
+  struct MIDIMessageList messages[3];
+  MIDIManufacturerId manufacturer_id;
+  MIDIStatus status;
+  unsigned char * data;
+  size_t i, size;
+  int sender_socket, receiver_socket, k;
+
+  ASSERT_NO_ERROR( _rtpmidi_socket( &sender_socket, &sender_address, RTPMIDI_ASSEMBLY_SENDER_PORT ),
+                   "Could not create sender socket." );
+  ASSERT_NO_ERROR( _rtpmidi_socket( &receiver_socket, &receiver_address, RTPMIDI_ASSEMBLY_RECEIVER_PORT ),
+                   "Could not create receiver socket." );
+
+  for( k=0; k<2; k++ ) {
+    receiver_rtp = RTPSessionCreate( receiver_socket );
+    receiver     = RTPMIDISessionCreate( receiver_rtp );
+    ASSERT_NO_ERROR( RTPMIDISessionSetSysExAssembly( receiver, 1, ( k == 0 ) ? 0 : 4 ), "Could not set assembly." );
+    ASSERT_NO_ERROR( _rtpmidi_send_commands( sender_socket, &receiver_address, 1, sizeof(first), &(first[0]) ),
+                     "Could not send first segment." );
+    ASSERT_NO_ERROR( _rtpmidi_send_commands( sender_socket, &receiver_address, 2, sizeof(second), &(second[0]) ),
+                     "Could not send last segment." );
+    for( i=0; i<3; i++ ) {
+      messages[i].message = NULL;
+      messages[i].next = ( i+1 < 3 ) ? &(messages[i+1]) : NULL;
+    }
+    ASSERT_NO_ERROR( RTPMIDISessionReceive( receiver, &(messages[0]) ), "Could not receive first packet." );
+    ASSERT_NOT_EQUAL( messages[0].message, NULL, "Received too few messages." );
+    ASSERT_EQUAL( messages[1].message, NULL, "Received the first segment." );
+    MIDIMessageGetStatus( messages[0].message, &status );
+    ASSERT_EQUAL( status, MIDI_STATUS_NOTE_ON, "First message has unexpected status." );
+    MIDIMessageRelease( messages[0].message );
+
+    messages[0].message = NULL;
+    ASSERT_NO_ERROR( RTPMIDISessionReceive( receiver, &(messages[0]) ), "Could not receive last packet." );
+    ASSERT_NOT_EQUAL( messages[0].message, NULL, "Received too few messages." );
+    if( k == 0 ) {
+      ASSERT_NOT_EQUAL( messages[1].message, NULL, "Received too few messages." );
+      MIDIMessageGetStatus( messages[0].message, &status );
+      ASSERT_EQUAL( status, MIDI_STATUS_SYSTEM_EXCLUSIVE, "Did not reassemble the message." );
+      MIDIMessageGet( messages[0].message, MIDI_MANUFACTURER_ID, sizeof(manufacturer_id), &manufacturer_id );
+      ASSERT_EQUAL( manufacturer_id, 0x7d, "Reassembled wrong manufacturer id." );
+      MIDIMessageGet( messages[0].message, MIDI_SYSEX_SIZE, sizeof(size_t), &size );
+      ASSERT_EQUAL( size, 5, "Reassembled wrong size." );
+      MIDIMessageGet( messages[0].message, MIDI_SYSEX_DATA, sizeof(void*), &data );
+      ASSERT_EQUAL( data[2], 0x03, "Reassembled wrong data." );
+      MIDIMessageRelease( messages[0].message );
+      messages[0].message = messages[1].message;
+    }
+    ASSERT_EQUAL( messages[( k == 0 ) ? 2 : 1].message, NULL, "Received too many messages." );
+    MIDIMessageGetStatus( messages[0].message, &status );
+    ASSERT_EQUAL( status, MIDI_STATUS_NOTE_OFF, "Last message has unexpected status." );
+    MIDIMessageRelease( messages[0].message );
+    RTPMIDISessionRelease( receiver );
+    RTPSessionRelease( receiver_rtp );
+  }
+
+  close( sender_socket );
+  close( receiver_socket );
+  return 0;
+}
@@ -0,0 +1,151 @@
+#include <string.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include "test.h"
+#include "midi/port.h"
+#include "midi/driver.h"
+#include "midi/message.h"
+#include "driver/shm/shm.h"
+
+#define SHM_PATH "/tmp/midikit-test-shm"
+
+static struct MIDIDriverSHM * owner = NULL;
+static struct MIDIDriverSHM * peer  = NULL;
+static struct MIDIPort * receiver   = NULL;
+
+static int _n_msg = 0;
+static unsigned char _received[4][3];
+static MIDITimestamp _timestamp = 0;
+
+static int _receive( void * target, void * source, struct MIDITypeSpec * type, void * data ) {
+  struct MIDICompactMessage compact;
+  if( type == MIDIMessageType && MIDIMessageGetCompact( data, &compact ) == 0 ) {
+    if( _n_msg < 4 ) {
+      memcpy( &(_received[_n_msg][0]), &(compact.bytes[0]), 3 );
+    }
+    MIDIMessageGetTimestamp( data, &_timestamp );
+    _n_msg++;
+  }
+  return 0;
+}
+
+static struct MIDIMessage * _message( MIDIStatus status, MIDIChannel channel, MIDIProperty property, MIDIValue value ) {
+  struct MIDIMessage * message = MIDIMessageCreate( status );
+  MIDIMessageSet( message, MIDI_CHANNEL, sizeof(MIDIChannel), &channel );
+  MIDIMessageSet( message, property, sizeof(MIDIValue), &value );
+  return message;
+}
+
+static int _readable( int fd ) {
+  struct timeval tv = { 0, 0 };
+  fd_set fds;
+  FD_ZERO( &fds );
+  FD_SET( fd, &fds );
+  return select( fd+1, &fds, NULL, NULL, &tv );
+}
+
+/**
+ * Test that messages pass through the rings and that the doorbell is
+ * only rung once while the consumer is idle.
+ */
+int test001_shm( void ) {
+  struct MIDIMessage * message;
+  struct MIDIPort * port;
+  MIDITimestamp timestamp;
+  unsigned char buffer[8];
+  size_t pending;
+  int fd;
+
+  ASSERT_EQUAL( MIDIDriverSHMCreate( "SHM", SHM_PATH, 0 ), NULL, "Attached to a missing segment." );
+  MIDIErrorNumber = 0;
+  owner = MIDIDriverSHMCreate( "SHM owner", SHM_PATH, 1 );
+  ASSERT_NOT_EQUAL( owner, NULL, "Could not create shared memory segment." );
+  peer = MIDIDriverSHMCreate( "SHM peer", SHM_PATH, 0 );
+  ASSERT_NOT_EQUAL( peer, NULL, "Could not attach to shared memory segment." );
+
+  receiver = MIDIPortCreate( "SHM test port", MIDI_PORT_IN, &_n_msg, &_receive );
+  ASSERT_NO_ERROR( MIDIDriverGetPort( peer, &port ), "Could not get driver port." );
+  ASSERT_NO_ERROR( MIDIPortConnect( port, receiver ), "Could not connect ports." );
+  ASSERT_NO_ERROR( MIDIDriverGetPort( owner, &port ), "Could not get driver port." );
+  ASSERT_NO_ERROR( MIDIPortConnect( port, receiver ), "Could not connect ports." );
+  ASSERT_NO_ERROR( MIDIDriverSHMGetDoorbell( peer, &fd ), "Could not get doorbell." );
+  ASSERT_EQUAL( _readable( fd ), 0, "Doorbell rang before a message was sent." );
+
+  message = _message( MIDI_STATUS_NOTE_ON, MIDI_CHANNEL_2, MIDI_KEY, 60 );
+  timestamp = 123456;
+  MIDIMessageSetTimestamp( message, timestamp );
+  ASSERT_NO_ERROR( MIDIDriverSHMSendMessage( owner, message ), "Could not send message." );
+  MIDIMessageRelease( message );
+  message = _message( MIDI_STATUS_CONTROL_CHANGE, MIDI_CHANNEL_1, MIDI_CONTROL, 7 );
+  ASSERT_NO_ERROR( MIDIDriverSHMSendMessage( owner, message ), "Could not send message." );
+  MIDIMessageRelease( message );
+
+  ASSERT_NO_ERROR( MIDIDriverSHMGetPending( peer, &pending ), "Could not get pending events." );
+  ASSERT_EQUAL( pending, 2, "Ring has the wrong number of events." );
+  ASSERT_NO_ERROR( MIDIDriverSHMGetPending( owner, &pending ), "Could not get pending events." );
+  ASSERT_EQUAL( pending, 0, "Message was added to the wrong ring." );
+  ASSERT_EQUAL( _readable( fd ), 1, "Doorbell did not ring." );
+  ASSERT_EQUAL( read( fd, &(buffer[0]), sizeof(buffer) ), 1, "Doorbell rang more than once." );
+  ASSERT_EQUAL( read( fd, &(buffer[0]), sizeof(buffer) ), -1, "Doorbell rang more than once." );
+
+  _n_msg = 0;
+  ASSERT_NO_ERROR( MIDIDriverSHMReceive( peer ), "Could not receive messages." );
+  ASSERT_EQUAL( _n_msg, 2, "Received wrong number of messages." );
+  ASSERT_EQUAL( _received[0][0], 0x91, "Received wrong status." );
+  ASSERT_EQUAL( _received[0][1], 60, "Received wrong key." );
+  ASSERT_EQUAL( _received[1][0], 0xb0, "Received wrong status." );
+  ASSERT_EQUAL( _received[1][1], 7, "Received wrong controller." );
+  ASSERT_NO_ERROR( MIDIDriverSHMGetPending( peer, &pending ), "Could not get pending events." );
+  ASSERT_EQUAL( pending, 0, "Ring was not drained." );
+
+  message = _message( MIDI_STATUS_PROGRAM_CHANGE, MIDI_CHANNEL_3, MIDI_PROGRAM, 12 );
+  MIDIMessageSetTimestamp( message, timestamp );
+  ASSERT_NO_ERROR( MIDIDriverSHMSendMessage( peer, message ), "Could not send message." );
+  MIDIMessageRelease( message );
+  ASSERT_NO_ERROR( MIDIDriverSHMGetDoorbell( owner, &fd ), "Could not get doorbell." );
+  ASSERT_EQUAL( _readable( fd ), 1, "Doorbell did not ring." );
+  _n_msg = 0;
+  ASSERT_NO_ERROR( MIDIDriverSHMReceive( owner ), "Could not receive messages." );
+  ASSERT_EQUAL( _n_msg, 1, "Received wrong number of messages." );
+  ASSERT_EQUAL( _received[0][0], 0xc2, "Received wrong status." );
+  ASSERT_EQUAL( _timestamp, timestamp, "Timestamp changed between processes of the same clock." );
+  ASSERT_EQUAL( _readable( fd ), 0, "Doorbell was not consumed." );
+
+  message = MIDIMessageCreate( MIDI_STATUS_SYSTEM_EXCLUSIVE );
+  ASSERT_ERROR( MIDIDriverSHMSendMessage( owner, message ), "Sent a system exclusive message." );
+  MIDIErrorNumber = 0;
+  MIDIMessageRelease( message );
+  return 0;
+}
+
+/**
+ * Test that a full ring drops messages and that releasing the segment
+ * owner removes the segment.
+ */
+int test002_shm( void ) {
+  struct MIDIMessage * message;
+  size_t pending;
+  int i;
+
+  message = _message( MIDI_STATUS_NOTE_OFF, MIDI_CHANNEL_1, MIDI_KEY, 1 );
+  for( i=0; i<MIDI_DRIVER_SHM_RING_SIZE; i++ ) {
+    ASSERT_NO_ERROR( MIDIDriverSHMSendMessage( owner, message ), "Could not send message." );
+  }
+  ASSERT_ERROR( MIDIDriverSHMSendMessage( owner, message ), "Sent a message to a full ring." );
+  MIDIErrorNumber = 0;
+  MIDIMessageRelease( message );
+
+  _n_msg = 0;
+  ASSERT_NO_ERROR( MIDIDriverSHMReceive( peer ), "Could not receive messages." );
+  ASSERT_EQUAL( _n_msg, MIDI_DRIVER_SHM_RING_SIZE, "Received wrong number of messages." );
+  ASSERT_NO_ERROR( MIDIDriverSHMGetPending( peer, &pending ), "Could not get pending events." );
+  ASSERT_EQUAL( pending, 0, "Ring was not drained." );
+
+  MIDIDriverSHMRelease( peer );
+  ASSERT_EQUAL( access( SHM_PATH, F_OK ), 0, "Peer removed the segment." );
+  MIDIDriverSHMRelease( owner );
+  ASSERT_NOT_EQUAL( access( SHM_PATH, F_OK ), 0, "Owner did not remove the segment." );
+  ASSERT_NOT_EQUAL( access( SHM_PATH ".0", F_OK ), 0, "Owner did not remove the doorbell." );
+  MIDIPortRelease( receiver );
+  return 0;
+}
@@ -0,0 +1,163 @@
+#include <string.h>
+#include "test.h"
+#define MIDI_DRIVER_INTERNALS
+#include "midi/event.h"
+#include "midi/message.h"
+#include "midi/driver.h"
+
+static int _observed = 0;
+static size_t _last_id = 0;
+
+static int _observe( void * target, struct MIDIEvent * event ) {
+  _observed++;
+  MIDIEventGetId( event, &_last_id );
+  return (target != NULL) ? 1 : 0;
+}
+
+/**
+ * Test that event messages are formatted when they are requested.
+ */
+int test001_event( void ) {
+  struct MIDIEvent * event;
+  char * message = NULL;
+  char name[] = "Session";
+  size_t id = 0;
+  void * info = NULL;
+
+  event = MIDIEventCreate( 12, &id, "%s: %d/%5.2f %lu %zu %%%c", name, -3, 1.5, 70000UL, (size_t) 9, 'x' );
+  ASSERT_NOT_EQUAL( event, NULL, "Could not create event." );
+  /* the string argument has to be copied */
+  name[0] = 'X';
+  ASSERT_NO_ERROR( MIDIEventGetId( event, &id ), "Could not get event id." );
+  ASSERT_EQUAL( id, 12, "Event has wrong id." );
+  ASSERT_NO_ERROR( MIDIEventGetInfo( event, &info ), "Could not get event info." );
+  ASSERT_EQUAL( info, &id, "Event has wrong info." );
+  ASSERT_NO_ERROR( MIDIEventGetMessage( event, &message ), "Could not get event message." );
+  ASSERT_NOT_EQUAL( message, NULL, "Event has no message." );
+  ASSERT_EQUAL( strcmp( message, "Session: -3/ 1.50 70000 9 %x" ), 0, "Event message is formatted incorrectly." );
+  MIDIEventRelease( event );
+
+  /* unsupported conversions are formatted immediately */
+  event = MIDIEventCreate( 1, NULL, "%*d", 3, 7 );
+  ASSERT_NOT_EQUAL( event, NULL, "Could not create event." );
+  ASSERT_NO_ERROR( MIDIEventGetMessage( event, &message ), "Could not get event message." );
+  ASSERT_EQUAL( strcmp( message, "  7" ), 0, "Event message is formatted incorrectly." );
+  MIDIEventRelease( event );
+
+  event = MIDIEventCreate( 2, NULL, NULL );
+  ASSERT_NOT_EQUAL( event, NULL, "Could not create event." );
+  ASSERT_NO_ERROR( MIDIEventGetMessage( event, &message ), "Could not get event message." );
+  ASSERT_EQUAL( message, NULL, "Event without format has a message." );
+  MIDIEventRelease( event );
+  return 0;
+}
+
+/**
+ * Test that events can be encoded and decoded.
+ */
+int test002_event( void ) {
+  struct MIDIEvent * event, * decoded;
+  unsigned char buffer[32];
+  char * message;
+  size_t written = 0, read = 0, id = 0;
+
+  event = MIDIEventCreate( 0x4b71494e, NULL, "peer %s", "abc" );
+  ASSERT_NOT_EQUAL( event, NULL, "Could not create event." );
+  ASSERT_ERROR( MIDIEventEncode( event, 10, &(buffer[0]), &written ), "Encoded event into a buffer that is too small." );
+  MIDIErrorNumber = 0;
+  ASSERT_NO_ERROR( MIDIEventEncode( event, sizeof(buffer), &(buffer[0]), &written ), "Could not encode event." );
+  ASSERT_EQUAL( written, 16, "Encoded event has wrong size." );
+  ASSERT_EQUAL( buffer[0], 0x4b, "Event id is encoded incorrectly." );
+  ASSERT_EQUAL( buffer[3], 0x4e, "Event id is encoded incorrectly." );
+  ASSERT_EQUAL( buffer[7], 8, "Message length is encoded incorrectly." );
+  ASSERT_EQUAL( memcmp( &(buffer[8]), "peer abc", 8 ), 0, "Message is encoded incorrectly." );
+
+  decoded = MIDIEventCreate( 0, NULL, "%d", 5 );
+  ASSERT_NOT_EQUAL( decoded, NULL, "Could not create event." );
+  ASSERT_ERROR( MIDIEventDecode( decoded, 12, &(buffer[0]), &read ), "Decoded a truncated event." );
+  MIDIErrorNumber = 0;
+  ASSERT_NO_ERROR( MIDIEventDecode( decoded, written, &(buffer[0]), &read ), "Could not decode event." );
+  ASSERT_EQUAL( read, written, "Decoded wrong number of bytes." );
+  ASSERT_NO_ERROR( MIDIEventGetId( decoded, &id ), "Could not get event id." );
+  ASSERT_EQUAL( id, 0x4b71494e, "Decoded event has wrong id." );
+  ASSERT_NO_ERROR( MIDIEventGetMessage( decoded, &message ), "Could not get event message." );
+  ASSERT_EQUAL( strcmp( message, "peer abc" ), 0, "Decoded event has wrong message." );
+
+  MIDIEventRelease( decoded );
+  MIDIEventRelease( event );
+  return 0;
+}
+
+/**
+ * Test that the event bus delivers events to the observers of their id.
+ */
+int test003_event( void ) {
+  struct MIDIEventBus bus;
+  struct MIDIEvent * event;
+  int cancel = 1;
+
+  ASSERT_NO_ERROR( MIDIEventBusInit( &bus ), "Could not initialize event bus." );
+  ASSERT_EQUAL( MIDIEventBusObserves( &bus, 3 ), 0, "Empty bus observes events." );
+  ASSERT_NO_ERROR( MIDIEventBusSubscribe( &bus, 3, &_observe, NULL ), "Could not subscribe." );
+  ASSERT_NOT_EQUAL( MIDIEventBusObserves( &bus, 3 ), 0, "Bus does not observe subscribed id." );
+  ASSERT_EQUAL( MIDIEventBusObserves( &bus, 4 ), 0, "Bus observes an id without observers." );
+
+  _observed = 0;
+  event = MIDIEventCreate( 4, NULL, NULL );
+  ASSERT_EQUAL( MIDIEventBusPost( &bus, event ), 0, "Unobserved event was cancelled." );
+  ASSERT_EQUAL( _observed, 0, "Unobserved event was delivered." );
+  MIDIEventRelease( event );
+
+  event = MIDIEventCreate( 3, NULL, NULL );
+  ASSERT_EQUAL( MIDIEventBusPost( &bus, event ), 0, "Observer cancelled the event." );
+  ASSERT_EQUAL( _observed, 1, "Observed event was not delivered." );
+
+  ASSERT_NO_ERROR( MIDIEventBusSubscribe( &bus, MIDI_EVENT_ANY, &_observe, &cancel ), "Could not subscribe." );
+  ASSERT_EQUAL( MIDIEventBusPost( &bus, event ), 1, "Observer result was not returned." );
+  ASSERT_EQUAL( _observed, 3, "Event was not delivered to all observers." );
+  MIDIEventRelease( event );
+
+  ASSERT_NO_ERROR( MIDIEventBusUnsubscribe( &bus, MIDI_EVENT_ANY, &_observe, &cancel ), "Could not unsubscribe." );
+  ASSERT_EQUAL( MIDIEventBusUnsubscribe( &bus, MIDI_EVENT_ANY, &_observe, &cancel ), 1, "Unsubscribed twice." );
+  ASSERT_EQUAL( MIDIEventBusObserves( &bus, 4 ), 0, "Mask was not updated after unsubscribing." );
+  ASSERT_NO_ERROR( MIDIEventBusClear( &bus ), "Could not clear event bus." );
+  ASSERT_EQUAL( bus.observers, NULL, "Observers were not removed." );
+  return 0;
+}
+
+/**
+ * Test that driver observers can cancel sending and receiving messages.
+ */
+int test004_event( void ) {
+  struct MIDIDriver * driver;
+  struct MIDIMessage * message;
+  int cancel = 1;
+
+  driver = MIDIDriverCreate( "test driver", MIDI_SAMPLING_RATE_DEFAULT );
+  ASSERT_NOT_EQUAL( driver, NULL, "Could not create driver!" );
+  message = MIDIMessageCreate( MIDI_STATUS_TIMING_CLOCK );
+  ASSERT_NOT_EQUAL( message, NULL, "Could not create clock message!" );
+  ASSERT_NO_ERROR( MIDIDriverMakeLoopback( driver ), "Could not make loopback driver." );
+
+  _observed = 0;
+  ASSERT_NO_ERROR( MIDIDriverTriggerEventFormat( driver, 7, NULL, "%d", 1 ), "Could not trigger event." );
+  ASSERT_EQUAL( _observed, 0, "Unobserved driver event was delivered." );
+
+  ASSERT_NO_ERROR( MIDIDriverAddEventObserver( driver, MIDI_DRIVER_WILL_RECEIVE_MESSAGE, &_observe, &cancel ),
+                   "Could not add event observer." );
+  ASSERT_NO_ERROR( MIDIDriverSend( driver, message ), "Could not send message." );
+  ASSERT_EQUAL( _observed, 1, "Will receive event was not delivered." );
+  ASSERT_EQUAL( _last_id, MIDI_DRIVER_WILL_RECEIVE_MESSAGE, "Delivered wrong event." );
+
+  ASSERT_NO_ERROR( MIDIDriverRemoveEventObserver( driver, MIDI_DRIVER_WILL_RECEIVE_MESSAGE, &_observe, &cancel ),
+                   "Could not remove event observer." );
+  ASSERT_NO_ERROR( MIDIDriverAddEventObserver( driver, MIDI_DRIVER_WILL_SEND_MESSAGE, &_observe, NULL ),
+                   "Could not add event observer." );
+  ASSERT_NO_ERROR( MIDIDriverSend( driver, message ), "Could not send message." );
+  ASSERT_EQUAL( _observed, 2, "Will send event was not delivered." );
+  ASSERT_EQUAL( _last_id, MIDI_DRIVER_WILL_SEND_MESSAGE, "Delivered wrong event." );
+
+  MIDIMessageRelease( message );
+  MIDIDriverRelease( driver );
+  return 0;
+}
@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <pthread.h>
+#include "test.h"
+#include "midi/log.h"
+
+static char _text[256];
+static int _channel = 0;
+static int _logged = 0;
+static MIDILogFunction _logger = NULL;
+
+/* capture drained records, pass assertion failures to the test logger */
+static int _capture( int channel, const char * fmt, ... ) {
+  va_list ap;
+  va_start( ap, fmt );
+  vsnprintf( &(_text[0]), sizeof(_text), fmt, ap );
+  va_end( ap );
+  if( channel == MIDI_LOG_TEST ) {
+    return ( _logger != NULL ) ? (*_logger)( channel, "%s", &(_text[0]) ) : 0;
+  }
+  _channel = channel;
+  _logged++;
+  return 0;
+}
+
+static void * _writer( void * info ) {
+  struct MIDILogSite * site = info;
+  int i;
+  for( i=0; i<10; i++ ) {
+    MIDILogRingWrite( site, "record %i\n", i );
+  }
+  return NULL;
+}
+
+/**
+ * Test that log records are formatted when the rings are drained.
+ */
+int test001_log( void ) {
+  static struct MIDILogSite site = MIDI_LOG_SITE_INIT( MIDI_LOG_INFO, 0 );
+  static struct MIDILogSite location = MIDI_LOG_SITE_INIT( MIDI_LOG_DEBUG, 1 );
+  char name[] = "peer";
+  size_t count = 0;
+
+  MIDILogRingDrain( NULL );
+  _logger   = MIDILogger;
+  MIDILogger = &_capture;
+  _logged = 0;
+  ASSERT_NO_ERROR( MIDILogRingWrite( &site, "%s %d: %lu %.1f\n", name, -2, 7UL, 0.5 ), "Could not write log record." );
+  name[0] = 'x';
+  ASSERT_EQUAL( _logged, 0, "Record was logged before the ring was drained." );
+  ASSERT_NO_ERROR( MIDILogRingDrain( &count ), "Could not drain log rings." );
+  ASSERT_EQUAL( count, 1, "Drained wrong number of records." );
+  ASSERT_EQUAL( _logged, 1, "Drained record was not logged." );
+  ASSERT_EQUAL( _channel, MIDI_LOG_INFO, "Record was logged on the wrong channel." );
+  ASSERT_EQUAL( strcmp( _text, "peer -2: 7 0.5\n" ), 0, "Record was formatted incorrectly." );
+
+  ASSERT_NO_ERROR( MIDILogRingWrite( &location, "%*d\n", 3, 1 ), "Could not write log record." );
+  ASSERT_NO_ERROR( MIDILogRingDrain( &count ), "Could not drain log rings." );
+  ASSERT_EQUAL( count, 1, "Drained wrong number of records." );
+  ASSERT_NOT_EQUAL( strstr( _text, "log.c:" ), NULL, "Record has no location." );
+  ASSERT_NOT_EQUAL( strstr( _text, ":   1\n" ), NULL, "Record was formatted incorrectly." );
+
+  MIDILogger = _logger;
+  return 0;
+}
+
+/**
+ * Test that noisy call sites are throttled and full rings drop records.
+ */
+int test002_log( void ) {
+  static struct MIDILogSite sites[6] = {
+    MIDI_LOG_SITE_INIT( MIDI_LOG_DEBUG, 0 ),
+    MIDI_LOG_SITE_INIT( MIDI_LOG_DEBUG, 0 ), MIDI_LOG_SITE_INIT( MIDI_LOG_DEBUG, 0 ),
+    MIDI_LOG_SITE_INIT( MIDI_LOG_DEBUG, 0 ), MIDI_LOG_SITE_INIT( MIDI_LOG_DEBUG, 0 ),
+    MIDI_LOG_SITE_INIT( MIDI_LOG_DEBUG, 0 )
+  };
+  struct MIDILogRingStats before, after;
+  size_t count = 0;
+  int i, s;
+
+  MIDILogRingDrain( NULL );
+  _logger   = MIDILogger;
+  MIDILogger = &_capture;
+  ASSERT_NO_ERROR( MIDILogRingGetStats( &before ), "Could not get log stats." );
+  for( i=0; i<3*MIDI_LOG_RATE_LIMIT; i++ ) {
+    MIDILogRingWrite( &(sites[0]), "%i\n", i );
+  }
+  ASSERT_NO_ERROR( MIDILogRingGetStats( &after ), "Could not get log stats." );
+  ASSERT_GREATER_OR_EQUAL( after.suppressed - before.suppressed, MIDI_LOG_RATE_LIMIT, "Call site was not throttled." );
+  ASSERT_NO_ERROR( MIDILogRingDrain( &count ), "Could not drain log rings." );
+  ASSERT_LESS_OR_EQUAL( count, 2*MIDI_LOG_RATE_LIMIT, "Throttled records were logged." );
+
+  before = after;
+  for( s=1; s<6; s++ ) {
+    for( i=0; i<MIDI_LOG_RATE_LIMIT; i++ ) {
+      MIDILogRingWrite( &(sites[s]), "%i\n", i );
+    }
+  }
+  ASSERT_NO_ERROR( MIDILogRingGetStats( &after ), "Could not get log stats." );
+  if( 5*MIDI_LOG_RATE_LIMIT > MIDI_LOG_RING_SIZE ) {
+    ASSERT_GREATER( after.dropped, before.dropped, "Full ring did not drop records." );
+  }
+  ASSERT_NO_ERROR( MIDILogRingDrain( &count ), "Could not drain log rings." );
+  ASSERT_LESS_OR_EQUAL( count, MIDI_LOG_RING_SIZE, "Drained more records than the ring holds." );
+
+  MIDILogger = _logger;
+  return 0;
+}
+
+/**
+ * Test that every thread logs to a ring of its own.
+ */
+int test003_log( void ) {
+  static struct MIDILogSite site1 = MIDI_LOG_SITE_INIT( MIDI_LOG_DEBUG, 0 );
+  static struct MIDILogSite site2 = MIDI_LOG_SITE_INIT( MIDI_LOG_DEBUG, 0 );
+  pthread_t thread1, thread2;
+  size_t count = 0;
+
+  MIDILogRingDrain( NULL );
+  _logger   = MIDILogger;
+  MIDILogger = &_capture;
+  _logged = 0;
+  ASSERT_EQUAL( pthread_create( &thread1, NULL, &_writer, &site1 ), 0, "Could not start thread." );
+  ASSERT_EQUAL( pthread_create( &thread2, NULL, &_writer, &site2 ), 0, "Could not start thread." );
+  pthread_join( thread1, NULL );
+  pthread_join( thread2, NULL );
+  ASSERT_NO_ERROR( MIDILogRingDrain( &count ), "Could not drain log rings." );
+  ASSERT_EQUAL( count, 20, "Records of threads were lost." );
+  ASSERT_EQUAL( _logged, 20, "Records of threads were not logged." );
+
+  ASSERT_NO_ERROR( MIDILogRingStartThread( 1000 ), "Could not start drain thread." );
+  ASSERT_NO_ERROR( MIDILogRingWrite( &site1, "background\n" ), "Could not write log record." );
+  ASSERT_NO_ERROR( MIDILogRingStopThread(), "Could not stop drain thread." );
+  ASSERT_EQUAL( _logged, 21, "Drain thread did not log the record." );
+  ASSERT_EQUAL( strcmp( _text, "background\n" ), 0, "Drain thread logged wrong record." );
+  ASSERT_EQUAL( MIDILogRingStopThread(), 1, "Stopped drain thread twice." );
+
+  MIDILogger = _logger;
+  return 0;
+}
@@ -257,3 +257,316 @@ int test006_message( void ) {
   MIDIMessageRelease( messages[11].message );
   return 0;
 }
+
+/**
+ * Test that messages are recycled by a MIDIMessagePool and that
+ * the pool falls back to the heap when it is exhausted.
+ */
+int test007_message( void ) {
+  struct MIDIMessagePool * pool = MIDIMessagePoolCreate( 2 );
+  struct MIDIMessagePoolStats stats;
+  struct MIDIMessage * message[3];
+  struct MIDIMessage * recycled;
+  MIDIChannel channel;
+  MIDIKey key;
+  ASSERT_NOT_EQUAL( pool, NULL, "Could not create message pool." );
+
+  message[0] = MIDIMessageCreateFromPool( pool, MIDI_STATUS_NOTE_ON );
+  message[1] = MIDIMessageCreateFromPool( pool, MIDI_STATUS_NOTE_OFF );
+  message[2] = MIDIMessageCreateFromPool( pool, MIDI_STATUS_CONTROL_CHANGE );
+  ASSERT_NOT_EQUAL( message[0], NULL, "Could not create message 0." );
+  ASSERT_NOT_EQUAL( message[1], NULL, "Could not create message 1." );
+  ASSERT_NOT_EQUAL( message[2], NULL, "Could not create message 2." );
+
+  ASSERT_NO_ERROR( MIDIMessagePoolGetStats( pool, &stats ), "Could not get pool stats." );
+  ASSERT_EQUAL( stats.hits, 2, "Pool reported wrong number of hits." );
+  ASSERT_EQUAL( stats.misses, 1, "Pool reported wrong number of misses." );
+  ASSERT_EQUAL( stats.in_use, 2, "Pool reported wrong number of used messages." );
+
+  key = 60;
+  channel = MIDI_CHANNEL_10;
+  ASSERT_NO_ERROR( MIDIMessageSet( message[0], MIDI_KEY, sizeof(MIDIKey), &key ), "Could not set key." );
+  ASSERT_NO_ERROR( MIDIMessageSet( message[0], MIDI_CHANNEL, sizeof(MIDIChannel), &channel ), "Could not set channel." );
+  MIDIMessageRelease( message[0] );
+  MIDIMessageRelease( message[2] );
+
+  /* the pool may not go away while messages are still in use */
+  MIDIMessagePoolRetain( pool );
+  MIDIMessagePoolRelease( pool );
+
+  recycled = MIDIMessageCreateFromPool( pool, MIDI_STATUS_NOTE_ON );
+  ASSERT_EQUAL( recycled, message[0], "Pool did not recycle released message." );
+  ASSERT_NO_ERROR( MIDIMessageGet( recycled, MIDI_KEY, sizeof(MIDIKey), &key ), "Could not get key." );
+  ASSERT_EQUAL( key, 0, "Recycled message was not reset." );
+  ASSERT_NO_ERROR( MIDIMessageGet( recycled, MIDI_CHANNEL, sizeof(MIDIChannel), &channel ), "Could not get channel." );
+  ASSERT_EQUAL( channel, MIDI_CHANNEL_1, "Recycled message kept its channel." );
+
+  ASSERT_NO_ERROR( MIDIMessagePoolGetStats( pool, &stats ), "Could not get pool stats." );
+  ASSERT_EQUAL( stats.hits, 3, "Pool reported wrong number of hits." );
+  ASSERT_EQUAL( stats.high_water, 2, "Pool reported wrong high water mark." );
+
+  MIDIMessagePoolRelease( pool );
+  MIDIMessageRelease( message[1] );
+  MIDIMessageRelease( recycled );
+  return 0;
+}
+
+/**
+ * Test that byte streams are decoded into compact messages with
+ * running status, interleaved real time messages and system
+ * exclusive messages that span multiple buffers.
+ */
+int test008_message( void ) {
+  unsigned char stream[] = {
+    0x90, 60, 100, 62, 0xf8, 90,   /* running status with an embedded clock */
+    0xc1, 5,
+    0xf0, 0x7d, 1, 2, 0xfe, 3, 0xf7, /* active sensing inside system exclusive */
+    64, 0x80, 60                     /* stray data byte and an incomplete message */
+  };
+  unsigned char tail[] = { 0xf0, 0x7d, 1, 2 };
+  unsigned char rest[] = { 3, 4, 0xf7 };
+  struct MIDICompactMessage messages[16];
+  struct MIDIMessage * message;
+  MIDIRunningStatus status = 0;
+  MIDIManufacturerId manufacturer_id;
+  unsigned char * data;
+  size_t count, read, size;
+
+  ASSERT_NO_ERROR( MIDIMessageDecodeStream( sizeof(stream), &(stream[0]), &status, 16, &(messages[0]), &count, &read ),
+                   "Could not decode stream." );
+  ASSERT_EQUAL( count, 7, "Decoded wrong number of messages." );
+  ASSERT_EQUAL( read, sizeof(stream) - 2, "Did not leave the incomplete message in the buffer." );
+  ASSERT_EQUAL( messages[0].bytes[0], 0x90, "Decoded wrong status." );
+  ASSERT_EQUAL( messages[0].bytes[2], 100, "Decoded wrong velocity." );
+  ASSERT_EQUAL( messages[1].bytes[0], 0xf8, "Did not decode the embedded clock first." );
+  ASSERT_EQUAL( messages[2].bytes[0], 0x90, "Did not use the running status." );
+  ASSERT_EQUAL( messages[2].bytes[1], 62, "Decoded wrong key." );
+  ASSERT_EQUAL( messages[2].bytes[2], 90, "Decoded wrong velocity." );
+  ASSERT_EQUAL( messages[3].bytes[0], 0xc1, "Decoded wrong status." );
+  ASSERT_EQUAL( messages[3].bytes[1], 5, "Decoded wrong program." );
+  ASSERT_EQUAL( messages[4].bytes[0], MIDI_STATUS_SYSTEM_EXCLUSIVE, "Did not decode system exclusive message." );
+  ASSERT_EQUAL( messages[4].flags, MIDI_COMPACT_SYSEX_START, "First segment has wrong flags." );
+  ASSERT_EQUAL( messages[4].sysex_offset, 9, "First segment has wrong offset." );
+  ASSERT_EQUAL( messages[4].sysex_size, 3, "First segment has wrong size." );
+  ASSERT_EQUAL( messages[5].bytes[0], 0xfe, "Did not decode active sensing inside system exclusive." );
+  ASSERT_EQUAL( messages[6].flags, MIDI_COMPACT_SYSEX_END, "Last segment has wrong flags." );
+  ASSERT_EQUAL( messages[6].sysex_offset, 13, "Last segment has wrong offset." );
+  ASSERT_EQUAL( messages[6].sysex_size, 1, "Last segment has wrong size." );
+  ASSERT_EQUAL( status, 0, "System exclusive message did not reset running status." );
+
+  /* a message that does not fit is not consumed */
+  status = 0;
+  ASSERT_NO_ERROR( MIDIMessageDecodeStream( sizeof(stream), &(stream[0]), &status, 1, &(messages[0]), &count, &read ),
+                   "Could not decode stream." );
+  ASSERT_EQUAL( count, 1, "Decoded more messages than requested." );
+  ASSERT_EQUAL( read, 3, "Consumed more than one message." );
+
+  /* system exclusive messages continue in the next buffer */
+  status = 0;
+  ASSERT_NO_ERROR( MIDIMessageDecodeStream( sizeof(tail), &(tail[0]), &status, 16, &(messages[0]), &count, &read ),
+                   "Could not decode first buffer." );
+  ASSERT_EQUAL( count, 1, "Decoded wrong number of segments." );
+  ASSERT_EQUAL( read, sizeof(tail), "Did not consume the whole segment." );
+  ASSERT_EQUAL( status, MIDI_STATUS_SYSTEM_EXCLUSIVE, "Did not remember the open system exclusive message." );
+
+  message = MIDIMessageCreate( 0 );
+  ASSERT_NO_ERROR( MIDIMessageSetCompact( message, &(messages[0]), &(tail[0]) ), "Could not set message." );
+  ASSERT_NO_ERROR( MIDIMessageGet( message, MIDI_MANUFACTURER_ID, sizeof(manufacturer_id), &manufacturer_id ),
+                   "Could not get manufacturer id." );
+  ASSERT_EQUAL( manufacturer_id, 0x7d, "Set wrong manufacturer id." );
+  ASSERT_NO_ERROR( MIDIMessageGet( message, MIDI_SYSEX_SIZE, sizeof(size), &size ), "Could not get size." );
+  ASSERT_EQUAL( size, 2, "Set wrong system exclusive size." );
+
+  ASSERT_NO_ERROR( MIDIMessageDecodeStream( sizeof(rest), &(rest[0]), &status, 16, &(messages[0]), &count, &read ),
+                   "Could not decode second buffer." );
+  ASSERT_EQUAL( count, 1, "Decoded wrong number of segments." );
+  ASSERT_EQUAL( messages[0].flags, MIDI_COMPACT_SYSEX_END, "Continued segment has wrong flags." );
+  ASSERT_EQUAL( messages[0].sysex_size, 2, "Continued segment has wrong size." );
+  ASSERT_EQUAL( status, 0, "Did not close the system exclusive message." );
+
+  ASSERT_NO_ERROR( MIDIMessageSetCompact( message, &(messages[0]), &(rest[0]) ), "Could not set message." );
+  ASSERT_NO_ERROR( MIDIMessageGet( message, MIDI_SYSEX_DATA, sizeof(data), &data ), "Could not get data." );
+  ASSERT_EQUAL( data[0], 3, "Copied wrong system exclusive data." );
+  ASSERT_EQUAL( data[2], 0xf7, "Did not keep the terminator." );
+  MIDIMessageRelease( message );
+  return 0;
+}
+
+/**
+ * Test that streams with delta times are decoded.
+ */
+int test009_message( void ) {
+  unsigned char stream[] = {
+    0x00, 0x90, 60, 100,
+    0x81, 0x00, 62, 100,             /* running status after a two byte delta time */
+    0x05, 0xf0, 0x7d, 1, 0xf0,       /* segment of a system exclusive message */
+    0x01, 0xf7, 2, 0xf4              /* cancelled segment */
+  };
+  struct MIDICompactMessage messages[8];
+  MIDIRunningStatus status = 0;
+  size_t count, read;
+
+  ASSERT_NO_ERROR( MIDIMessageDecodeTimedStream( sizeof(stream), &(stream[0]), &status, 8, &(messages[0]), &count, &read ),
+                   "Could not decode stream." );
+  ASSERT_EQUAL( count, 4, "Decoded wrong number of messages." );
+  ASSERT_EQUAL( read, sizeof(stream), "Did not consume the whole stream." );
+  ASSERT_EQUAL( messages[0].timestamp, 0, "Decoded wrong delta time." );
+  ASSERT_EQUAL( messages[1].timestamp, 128, "Decoded wrong delta time." );
+  ASSERT_EQUAL( messages[1].bytes[1], 62, "Decoded wrong key." );
+  ASSERT_EQUAL( messages[2].timestamp, 133, "Decoded wrong delta time." );
+  ASSERT_EQUAL( messages[2].flags, MIDI_COMPACT_SYSEX_START, "Segment has wrong flags." );
+  ASSERT_EQUAL( messages[2].sysex_size, 2, "Segment has wrong size." );
+  ASSERT_EQUAL( messages[3].flags, MIDI_COMPACT_SYSEX_CANCEL, "Cancelled segment has wrong flags." );
+  ASSERT_EQUAL( messages[3].sysex_size, 1, "Cancelled segment has wrong size." );
+  return 0;
+}
+
+/**
+ * Test that message arrays are encoded with running status and stop at
+ * the first message that does not fit.
+ */
+int test010_message( void ) {
+  unsigned char input[][3] = {
+    { 0x90, 60, 100 }, { 0x90, 62, 100 }, { 0xf8, 0, 0 }, { 0x90, 64, 100 }, { 0xc0, 5, 0 }
+  };
+  unsigned char expect[] = {
+    0x00, 0x90, 60, 100,
+    0x81, 0x00, 62, 100,             /* running status after a two byte delta time */
+    0x00, 0xf8,                      /* real-time keeps the running status */
+    0x00, 64, 100,
+    0x00, 0xc0, 5
+  };
+  unsigned char buffer[32];
+  struct MIDIMessage * messages[5];
+  MIDIVarLen deltas[5] = { 0, 128, 0, 0, 0 };
+  MIDIRunningStatus status = 0;
+  size_t i, count, written, read;
+
+  for( i=0; i<5; i++ ) {
+    messages[i] = MIDIMessageCreate( 0 );
+    ASSERT_NO_ERROR( MIDIMessageDecode( messages[i], 3, &(input[i][0]), &read ), "Could not decode message." );
+  }
+
+  ASSERT_NO_ERROR( MIDIMessageEncodeTimedStream( sizeof(buffer), &(buffer[0]), &status, 5, &(messages[0]), &(deltas[0]),
+                                                 &count, &written ), "Could not encode stream." );
+  ASSERT_EQUAL( count, 5, "Encoded wrong number of messages." );
+  ASSERT_EQUAL( written, sizeof(expect), "Encoded wrong number of bytes." );
+  for( i=0; i<sizeof(expect); i++ ) {
+    ASSERT_EQUAL( buffer[i], expect[i], "Encoded wrong byte." );
+  }
+  ASSERT_EQUAL( status, 0xc0, "Did not update the running status." );
+
+  /* the fourth message does not fit, the running status stays at the last one written */
+  status = 0;
+  ASSERT_NO_ERROR( MIDIMessageEncodeTimedStream( 12, &(buffer[0]), &status, 5, &(messages[0]), &(deltas[0]),
+                                                 &count, &written ), "Could not encode stream." );
+  ASSERT_EQUAL( count, 3, "Encoded wrong number of messages." );
+  ASSERT_EQUAL( written, 10, "Encoded wrong number of bytes." );
+  ASSERT_EQUAL( status, 0x90, "Changed the running status." );
+
+  /* without delta times */
+  status = 0;
+  ASSERT_NO_ERROR( MIDIMessageEncodeTimedStream( sizeof(buffer), &(buffer[0]), &status, 2, &(messages[0]), NULL,
+                                                 &count, &written ), "Could not encode stream." );
+  ASSERT_EQUAL( count, 2, "Encoded wrong number of messages." );
+  ASSERT_EQUAL( written, 5, "Encoded wrong number of bytes." );
+  ASSERT_EQUAL( buffer[3], 62, "Did not use running status." );
+
+  for( i=0; i<5; i++ ) {
+    MIDIMessageRelease( messages[i] );
+  }
+  return 0;
+}
+
+/**
+ * Test that system exclusive messages share slices of one buffer.
+ */
+int test011_message( void ) {
+  struct MIDISysExBuffer * buffer, * b;
+  struct MIDIMessage * messages[4];
+  MIDIManufacturerId manufacturer_id = 0x7d;
+  unsigned char encoded[300];
+  unsigned char * data;
+  void * payload;
+  size_t i, size, offset, written;
+  char fragment;
+
+  buffer = MIDISysExBufferCreate( 1000, NULL );
+  ASSERT_NOT_EQUAL( buffer, NULL, "Could not create buffer." );
+  ASSERT_NO_ERROR( MIDISysExBufferGetData( buffer, &size, &payload ), "Could not get buffer data." );
+  ASSERT_EQUAL( size, 1000, "Buffer has wrong size." );
+  data = payload;
+  for( i=0; i<size; i++ ) data[i] = i & 0x7f;
+
+  /* slice the dump into four segments */
+  for( i=0; i<4; i++ ) {
+    fragment = i;
+    messages[i] = MIDIMessageCreate( MIDI_STATUS_SYSTEM_EXCLUSIVE );
+    MIDIMessageSet( messages[i], MIDI_MANUFACTURER_ID, sizeof(MIDIManufacturerId), &manufacturer_id );
+    MIDIMessageSet( messages[i], MIDI_SYSEX_FRAGMENT, sizeof(char), &fragment );
+    ASSERT_NO_ERROR( MIDIMessageSetSysExBuffer( messages[i], buffer, i*250, 250 ), "Could not set slice." );
+  }
+  ASSERT_ERROR( MIDIMessageSetSysExBuffer( messages[0], buffer, 900, 250 ), "Could set slice past the end." );
+  MIDIErrorNumber = 0;
+  MIDISysExBufferRelease( buffer );
+
+  /* the messages keep the buffer alive and point right into it */
+  ASSERT_NO_ERROR( MIDIMessageGet( messages[2], MIDI_SYSEX_DATA, sizeof(void*), &payload ), "Could not get data." );
+  ASSERT_EQUAL( payload, data + 500, "Slice does not point into the buffer." );
+  ASSERT_NO_ERROR( MIDIMessageGetSysExBuffer( messages[2], &b, &offset ), "Could not get buffer." );
+  ASSERT_EQUAL( b, buffer, "Message references wrong buffer." );
+  ASSERT_EQUAL( offset, 500, "Message references wrong offset." );
+
+  ASSERT_NO_ERROR( MIDIMessageEncode( messages[0], sizeof(encoded), &(encoded[0]), &written ), "Could not encode slice." );
+  ASSERT_EQUAL( written, 252, "Encoded slice has wrong size." );
+  ASSERT_EQUAL( encoded[1], 0x7d, "Encoded wrong manufacturer id." );
+  ASSERT_EQUAL( encoded[2], 0, "Encoded wrong data." );
+  ASSERT_NO_ERROR( MIDIMessageEncode( messages[1], sizeof(encoded), &(encoded[0]), &written ), "Could not encode slice." );
+  ASSERT_EQUAL( written, 250, "Encoded continued slice has wrong size." );
+  ASSERT_EQUAL( encoded[0], 250 & 0x7f, "Encoded wrong data." );
+
+  /* replacing the data drops the reference */
+  payload = NULL;
+  MIDIMessageSet( messages[3], MIDI_SYSEX_DATA, sizeof(void*), &payload );
+  ASSERT_NO_ERROR( MIDIMessageGetSysExBuffer( messages[3], &b, NULL ), "Could not get buffer." );
+  ASSERT_EQUAL( b, NULL, "Message still references the buffer." );
+
+  for( i=0; i<4; i++ ) {
+    MIDIMessageRelease( messages[i] );
+  }
+  return 0;
+}
+
+/**
+ * Test that single-owner messages are reference counted and go
+ * straight back to their pool.
+ */
+int test012_message( void ) {
+  struct MIDIMessagePool * pool = MIDIMessagePoolCreate( 2 );
+  struct MIDIMessagePoolStats stats;
+  struct MIDIMessage * message, * shared, * recycled, * other;
+
+  message = MIDIMessageCreateLocal( pool, MIDI_STATUS_NOTE_ON );
+  ASSERT_NOT_EQUAL( message, NULL, "Could not create local message." );
+  shared = MIDIMessageCreateFromPool( pool, MIDI_STATUS_NOTE_ON );
+  MIDIMessageRetain( message );
+  MIDIMessageRelease( message );
+  ASSERT_NO_ERROR( MIDIMessagePoolGetStats( pool, &stats ), "Could not get pool stats." );
+  ASSERT_EQUAL( stats.in_use, 2, "Released retained local message." );
+
+  /* shared messages are recycled after the local list ran dry */
+  MIDIMessageRelease( shared );
+  MIDIMessageRelease( message );
+  recycled = MIDIMessageCreateFromPool( pool, MIDI_STATUS_NOTE_OFF );
+  ASSERT_EQUAL( recycled, message, "Local message was not recycled first." );
+  other = MIDIMessageCreateLocal( pool, MIDI_STATUS_NOTE_OFF );
+  ASSERT_EQUAL( other, shared, "Shared message was not recycled." );
+  MIDIMessageRelease( recycled );
+  MIDIMessageRelease( other );
+
+  ASSERT_NO_ERROR( MIDIMessagePoolGetStats( pool, &stats ), "Could not get pool stats." );
+  ASSERT_EQUAL( stats.in_use, 0, "Pool reported wrong number of used messages." );
+  ASSERT_EQUAL( stats.misses, 0, "Pool reported wrong number of misses." );
+  MIDIMessagePoolRelease( pool );
+  return 0;
+}
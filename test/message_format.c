@@ -96,3 +96,41 @@ int test003_message_format( void ) {
   free( message );
   return 0;
 }
+
+/**
+ * Test that the format detected for every status byte is the
+ * format that accepts the byte.
+ */
+int test004_message_format( void ) {
+  struct MIDIMessageFormat * format;
+  unsigned char byte;
+  MIDIRunningStatus status;
+  int i;
+
+  for( i=0; i<0x80; i++ ) {
+    byte = i;
+    ASSERT_EQUAL( MIDIMessageFormatDetect( &byte ), NULL, "Detected a format for a data byte." );
+  }
+  for( i=0x80; i<0x100; i++ ) {
+    byte = i;
+    format = MIDIMessageFormatDetect( &byte );
+    if( byte == MIDI_STATUS_UNDEFINED0 || byte == MIDI_STATUS_UNDEFINED1 || byte == MIDI_STATUS_UNDEFINED2
+     || byte == MIDI_STATUS_UNDEFINED3 || byte == MIDI_STATUS_END_OF_EXCLUSIVE ) {
+      ASSERT_EQUAL( format, NULL, "Detected a format for an undefined status byte." );
+    } else {
+      ASSERT_NOT_EQUAL( format, NULL, "Could not detect format of status byte." );
+      ASSERT( MIDIMessageFormatTest( format, &byte ), "Detected format does not accept the status byte." );
+    }
+  }
+
+  status = 0x93;
+  byte   = 60;
+  ASSERT_EQUAL( MIDIMessageFormatDetectRunningStatus( &byte, &status ), MIDIMessageFormatForStatus( MIDI_STATUS_NOTE_ON ),
+                "Did not detect the format of the running status." );
+  status = 0;
+  ASSERT_EQUAL( MIDIMessageFormatDetectRunningStatus( &byte, &status ), NULL,
+                "Detected a format without running status." );
+  ASSERT_EQUAL( MIDIMessageFormatForStatus( MIDI_STATUS_RESET ), MIDIMessageFormatForStatus( MIDI_STATUS_TIMING_CLOCK ),
+                "Real time messages do not share a format." );
+  return 0;
+}
@@ -62,3 +62,168 @@ int test001_message_queue( void ) {
   MIDIMessageQueueRelease( queue );
   return 0;
 }
+
+/**
+ * Test that the ring buffer backed MIDIMessageQueue keeps the
+ * order of messages and refuses to push when it is full.
+ */
+int test002_message_queue( void ) {
+  struct MIDIMessageQueue * queue = MIDIMessageQueueCreateRing( 3 );
+  struct MIDIMessage * message = MIDIMessageCreate( MIDI_STATUS_NOTE_ON );
+  struct MIDIMessage * other   = MIDIMessageCreate( MIDI_STATUS_NOTE_OFF );
+  struct MIDIMessage * m;
+  size_t length;
+  int i;
+
+  ASSERT_NOT_EQUAL( queue, NULL, "Could not create ring message queue." );
+  ASSERT_NO_ERROR( MIDIMessageQueuePop( queue, &m ), "Could not pop from empty queue." );
+  ASSERT_EQUAL( m, NULL, "Empty queue returned a message." );
+
+  ASSERT_NO_ERROR( MIDIMessageQueuePush( queue, other ), "Could not enqueue message." );
+  for( i=1; i<4; i++ ) {
+    ASSERT_NO_ERROR( MIDIMessageQueuePush( queue, message ), "Could not enqueue message." );
+  }
+  ASSERT_ERROR( MIDIMessageQueuePush( queue, message ), "Could enqueue message into full queue." );
+
+  ASSERT_NO_ERROR( MIDIMessageQueueGetLength( queue, &length ),
+    "Could not determine queue length." );
+  ASSERT_EQUAL( length, 4, "Message queue returned wrong length." );
+
+  ASSERT_NO_ERROR( MIDIMessageQueuePeek( queue, &m ), "Could not peek into queue." );
+  ASSERT_EQUAL( m, other, "Queue returned wrong message." );
+  ASSERT_NO_ERROR( MIDIMessageQueuePop( queue, &m ), "Could not pop message." );
+  ASSERT_EQUAL( m, other, "Queue returned wrong message." );
+  MIDIMessageRelease( m );
+
+  /* wrap around the end of the ring */
+  ASSERT_NO_ERROR( MIDIMessageQueuePush( queue, other ), "Could not enqueue message." );
+  for( i=0; i<3; i++ ) {
+    ASSERT_NO_ERROR( MIDIMessageQueuePop( queue, &m ), "Could not pop message." );
+    ASSERT_EQUAL( m, message, "Queue returned wrong message." );
+    MIDIMessageRelease( m );
+  }
+  ASSERT_NO_ERROR( MIDIMessageQueuePop( queue, &m ), "Could not pop message." );
+  ASSERT_EQUAL( m, other, "Queue returned wrong message." );
+  MIDIMessageRelease( m );
+
+  ASSERT_NO_ERROR( MIDIMessageQueueGetLength( queue, &length ),
+    "Could not determine queue length." );
+  ASSERT_EQUAL( length, 0, "Message queue returned wrong length." );
+
+  MIDIMessageQueuePush( queue, message );
+  MIDIMessageQueueRelease( queue );
+  MIDIMessageRelease( message );
+  MIDIMessageRelease( other );
+  return 0;
+}
+
+/**
+ * Test that the compact ring buffer stores copies of compact messages.
+ */
+int test003_message_queue( void ) {
+  struct MIDIMessageQueue * queue = MIDIMessageQueueCreateCompactRing( 2 );
+  struct MIDIMessage * message = MIDIMessageCreate( MIDI_STATUS_NOTE_ON );
+  struct MIDICompactMessage compact, out;
+  MIDIChannel channel = MIDI_CHANNEL_1;
+  MIDIKey key = 60;
+  size_t length;
+
+  ASSERT_NOT_EQUAL( queue, NULL, "Could not create compact message queue." );
+  ASSERT_ERROR( MIDIMessageQueuePopCompact( queue, &out ), "Could pop from empty queue." );
+
+  MIDIMessageSet( message, MIDI_CHANNEL, sizeof(MIDIChannel), &channel );
+  MIDIMessageSet( message, MIDI_KEY, sizeof(MIDIKey), &key );
+  MIDIMessageSetTimestamp( message, 1234 );
+  ASSERT_NO_ERROR( MIDIMessageGetCompact( message, &compact ), "Could not get compact message." );
+  ASSERT_NO_ERROR( MIDIMessageQueuePushCompact( queue, &compact ), "Could not enqueue compact message." );
+  compact.bytes[1] = 62;
+  ASSERT_NO_ERROR( MIDIMessageQueuePushCompact( queue, &compact ), "Could not enqueue compact message." );
+  ASSERT_ERROR( MIDIMessageQueuePushCompact( queue, &compact ), "Could enqueue into full queue." );
+  ASSERT_NO_ERROR( MIDIMessageQueueGetLength( queue, &length ), "Could not determine queue length." );
+  ASSERT_EQUAL( length, 2, "Message queue returned wrong length." );
+
+  ASSERT_NO_ERROR( MIDIMessageQueuePopCompact( queue, &out ), "Could not pop compact message." );
+  ASSERT_EQUAL( out.bytes[0], 0x90, "Queue returned wrong status." );
+  ASSERT_EQUAL( out.bytes[1], 60, "Queue returned wrong key." );
+  ASSERT_EQUAL( out.timestamp, 1234, "Queue returned wrong timestamp." );
+  ASSERT_NO_ERROR( MIDIMessageQueuePopCompact( queue, &out ), "Could not pop compact message." );
+  ASSERT_EQUAL( out.bytes[1], 62, "Queue returned wrong key." );
+
+  MIDIMessageQueueRelease( queue );
+  MIDIMessageRelease( message );
+  return 0;
+}
+
+/* create a control change message for a channel and controller */
+static struct MIDIMessage * _control_change( MIDIChannel channel, MIDIControl control, MIDIValue value ) {
+  struct MIDIMessage * message = MIDIMessageCreate( MIDI_STATUS_CONTROL_CHANGE );
+  MIDIMessageSet( message, MIDI_CHANNEL, sizeof(MIDIChannel), &channel );
+  MIDIMessageSet( message, MIDI_CONTROL, sizeof(MIDIControl), &control );
+  MIDIMessageSet( message, MIDI_VALUE, sizeof(MIDIValue), &value );
+  return message;
+}
+
+/**
+ * Test that full queues apply their policy and count what they gave up.
+ */
+int test004_message_queue( void ) {
+  struct MIDIMessageQueue * list = MIDIMessageQueueCreate();
+  struct MIDIMessageQueue * ring = MIDIMessageQueueCreateRing( 8 );
+  struct MIDIMessage * messages[3], * message;
+  struct MIDIMessageQueueStats stats;
+  MIDIValue value;
+  int i;
+
+  ASSERT_NOT_EQUAL( list, NULL, "Could not create message queue." );
+  ASSERT_NOT_EQUAL( ring, NULL, "Could not create ring buffer message queue." );
+  for( i=0; i<3; i++ ) {
+    messages[i] = _control_change( MIDI_CHANNEL_1, i, 10 * i );
+  }
+
+  ASSERT_NO_ERROR( MIDIMessageQueueSetLimit( list, 2, MIDI_QUEUE_POLICY_BLOCK ), "Could not limit queue." );
+  ASSERT_NO_ERROR( MIDIMessageQueuePush( list, messages[0] ), "Could not push message." );
+  ASSERT_NO_ERROR( MIDIMessageQueuePush( list, messages[1] ), "Could not push message." );
+  ASSERT_ERROR( MIDIMessageQueuePush( list, messages[2] ), "Full blocking queue accepted a message." );
+
+  ASSERT_NO_ERROR( MIDIMessageQueueSetLimit( list, 2, MIDI_QUEUE_POLICY_DROP_NEWEST ), "Could not limit queue." );
+  ASSERT_ERROR( MIDIMessageQueuePush( list, messages[2] ), "Full queue did not drop the new message." );
+
+  ASSERT_NO_ERROR( MIDIMessageQueueSetLimit( list, 2, MIDI_QUEUE_POLICY_DROP_OLDEST ), "Could not limit queue." );
+  ASSERT_NO_ERROR( MIDIMessageQueuePush( list, messages[2] ), "Full queue did not drop the oldest message." );
+  ASSERT_NO_ERROR( MIDIMessageQueuePeek( list, &message ), "Could not peek message." );
+  ASSERT_EQUAL( message, messages[1], "Queue did not drop the oldest message." );
+
+  ASSERT_NO_ERROR( MIDIMessageQueueGetStats( list, &stats ), "Could not get queue stats." );
+  ASSERT_EQUAL( stats.capacity, 2, "Queue reported wrong capacity." );
+  ASSERT_EQUAL( stats.length, 2, "Queue reported wrong length." );
+  ASSERT_EQUAL( stats.length_max, 2, "Queue reported wrong maximum length." );
+  ASSERT_EQUAL( stats.rejected, 1, "Queue did not count rejected message." );
+  ASSERT_EQUAL( stats.dropped, 2, "Queue did not count dropped messages." );
+
+  /* coalescing replaces the value for the same channel and controller */
+  ASSERT_NO_ERROR( MIDIMessageQueueSetLimit( ring, 0, MIDI_QUEUE_POLICY_COALESCE ), "Could not limit queue." );
+  ASSERT_NO_ERROR( MIDIMessageQueuePush( ring, messages[0] ), "Could not push message." );
+  ASSERT_NO_ERROR( MIDIMessageQueuePush( ring, messages[1] ), "Could not push message." );
+  message = _control_change( MIDI_CHANNEL_1, 0, 99 );
+  ASSERT_NO_ERROR( MIDIMessageQueuePush( ring, message ), "Could not coalesce message." );
+  MIDIMessageRelease( message );
+  message = _control_change( MIDI_CHANNEL_2, 0, 33 );
+  ASSERT_NO_ERROR( MIDIMessageQueuePush( ring, message ), "Could not push message." );
+  MIDIMessageRelease( message );
+
+  ASSERT_NO_ERROR( MIDIMessageQueueGetStats( ring, &stats ), "Could not get queue stats." );
+  ASSERT_EQUAL( stats.capacity, 8, "Queue reported wrong capacity." );
+  ASSERT_EQUAL( stats.length, 3, "Queue did not coalesce message." );
+  ASSERT_EQUAL( stats.coalesced, 1, "Queue did not count coalesced message." );
+  ASSERT_NO_ERROR( MIDIMessageQueuePop( ring, &message ), "Could not pop message." );
+  MIDIMessageGet( message, MIDI_VALUE, sizeof(MIDIValue), &value );
+  ASSERT_EQUAL( value, 99, "Coalesced message does not hold the latest value." );
+  MIDIMessageRelease( message );
+
+  MIDIMessageQueueRelease( list );
+  MIDIMessageQueueRelease( ring );
+  for( i=0; i<3; i++ ) {
+    MIDIMessageRelease( messages[i] );
+  }
+  return 0;
+}
@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "test.h"
+#include "midi/driver.h"
+#include "midi/message.h"
+#include "midi/message_queue.h"
+#include "midi/runloop.h"
+#include "midi/metrics.h"
+
+#define METRICS_PATH "/tmp/midikit-test.prom"
+#define METRICS_THREADS 4
+#define METRICS_COUNTS  10000
+
+static struct MIDIMetrics * _metrics = NULL;
+static size_t _counter;
+static char _text[32768];
+
+static void * _count_thread( void * info ) {
+  int i;
+  for( i=0; i<METRICS_COUNTS; i++ ) {
+    MIDIMetricsCount( _metrics, _counter, 1 );
+  }
+  return NULL;
+}
+
+static int _collect( void * info, struct MIDIMetricsWriter * writer ) {
+  char * labels[] = { "name", info, NULL };
+  MIDIMetricsWriterFamily( writer, "test_custom", MIDI_METRICS_GAUGE, "A custom gauge." );
+  return MIDIMetricsWriterSample( writer, "test_custom", &(labels[0]), 0.5 );
+}
+
+static int _read_file( char * path ) {
+  size_t length;
+  FILE * file = fopen( path, "r" );
+  ASSERT_NOT_EQUAL( file, NULL, "Could not open metrics file." );
+  length = fread( &(_text[0]), 1, sizeof(_text) - 1, file );
+  _text[length] = '\0';
+  fclose( file );
+  return 0;
+}
+
+static int _count_lines( char * prefix ) {
+  char * line = &(_text[0]);
+  int n = 0;
+  while( line != NULL && *line != '\0' ) {
+    if( strncmp( line, prefix, strlen( prefix ) ) == 0 ) n++;
+    line = strchr( line, '\n' );
+    if( line != NULL ) line++;
+  }
+  return n;
+}
+
+/**
+ * Test that counters are summed over the slots of all threads and that
+ * the collected objects are written in the OpenMetrics text format with
+ * every family once.
+ */
+int test001_metrics( void ) {
+  struct MIDIDriver * driver;
+  struct MIDIMessage * message;
+  struct MIDIMessageQueue * queue[2];
+  struct MIDIMessagePool * pool;
+  struct MIDIRunloop * runloop;
+  pthread_t threads[METRICS_THREADS];
+  size_t length;
+  int i;
+
+  _metrics = MIDIMetricsCreate();
+  ASSERT_NOT_EQUAL( _metrics, NULL, "Could not create metrics." );
+  ASSERT_NO_ERROR( MIDIMetricsAddCounter( _metrics, "test_events", "Counted events.", &_counter ),
+                   "Could not add counter." );
+  for( i=0; i<METRICS_THREADS; i++ ) {
+    ASSERT_EQUAL( pthread_create( &(threads[i]), NULL, &_count_thread, NULL ), 0, "Could not start thread." );
+  }
+  for( i=0; i<METRICS_THREADS; i++ ) {
+    pthread_join( threads[i], NULL );
+  }
+
+  driver = MIDIDriverCreate( "test driver", MIDI_SAMPLING_RATE_DEFAULT );
+  message = MIDIMessageCreate( MIDI_STATUS_TIMING_CLOCK );
+#ifndef NO_PROFILING
+  ASSERT_NO_ERROR( MIDIDriverStartProfiling( driver ), "Could not start profiling." );
+#endif
+  ASSERT_NO_ERROR( MIDIDriverReceive( driver, message ), "Could not simulate received message." );
+  ASSERT_NO_ERROR( MIDIDriverReceive( driver, message ), "Could not simulate received message." );
+  MIDIMessageRelease( message );
+  ASSERT_NO_ERROR( MIDIMetricsAddDriver( _metrics, "test \"driver\"", driver ), "Could not add driver." );
+  MIDIDriverRelease( driver );
+
+  queue[0] = MIDIMessageQueueCreateRing( 8 );
+  queue[1] = MIDIMessageQueueCreateRing( 8 );
+  message = MIDIMessageCreate( MIDI_STATUS_TIMING_CLOCK );
+  MIDIMessageQueuePush( queue[1], message );
+  MIDIMessageRelease( message );
+  ASSERT_NO_ERROR( MIDIMetricsAddQueue( _metrics, "a", queue[0] ), "Could not add queue." );
+  ASSERT_NO_ERROR( MIDIMetricsAddQueue( _metrics, "b", queue[1] ), "Could not add queue." );
+  pool = MIDIMessagePoolCreate( 4 );
+  ASSERT_NO_ERROR( MIDIMetricsAddPool( _metrics, "pool", pool ), "Could not add pool." );
+  runloop = MIDIRunloopCreate();
+  ASSERT_NO_ERROR( MIDIMetricsAddRunloop( _metrics, "main", runloop ), "Could not add runloop." );
+  ASSERT_NO_ERROR( MIDIMetricsAddCollector( _metrics, &_collect, "custom" ), "Could not add collector." );
+
+  ASSERT_NO_ERROR( MIDIMetricsWriteFile( _metrics, METRICS_PATH ), "Could not write metrics file." );
+  ASSERT_EQUAL( access( METRICS_PATH ".tmp", F_OK ), -1, "Temporary file was left behind." );
+  ASSERT_NO_ERROR( _read_file( METRICS_PATH ), "Could not read metrics file." );
+  ASSERT_NOT_EQUAL( strstr( &(_text[0]), "test_events_total 40000\n" ), NULL, "Counter was not summed." );
+#ifndef NO_PROFILING
+  ASSERT_NOT_EQUAL( strstr( &(_text[0]), "midikit_driver_messages_total{driver=\"test \\\"driver\\\"\",direction=\"in\"} 2\n" ),
+                    NULL, "Driver messages were not exported with escaped label." );
+  ASSERT_NOT_EQUAL( strstr( &(_text[0]), "stage=\"dispatch\",le=\"+Inf\"} 2\n" ), NULL, "Stage histogram was not exported." );
+#endif
+  ASSERT_NOT_EQUAL( strstr( &(_text[0]), "midikit_queue_length{queue=\"b\"} 1\n" ), NULL, "Queue length was not exported." );
+  ASSERT_NOT_EQUAL( strstr( &(_text[0]), "midikit_pool_capacity{pool=\"pool\"} 4\n" ), NULL, "Pool was not exported." );
+  ASSERT_NOT_EQUAL( strstr( &(_text[0]), "midikit_runloop_iterations_total{runloop=\"main\"} 0\n" ), NULL, "Runloop was not exported." );
+  ASSERT_NOT_EQUAL( strstr( &(_text[0]), "test_custom{name=\"custom\"} 0.5\n" ), NULL, "Custom collector was not called." );
+  ASSERT_EQUAL( _count_lines( "# TYPE midikit_queue_length " ), 1, "Family of two queues was not merged." );
+  ASSERT_EQUAL( _count_lines( "midikit_queue_length{" ), 2, "Samples of a merged family are missing." );
+  length = strlen( &(_text[0]) );
+  ASSERT_EQUAL( strcmp( &(_text[length-6]), "# EOF\n" ), 0, "Metrics do not end with EOF." );
+
+  ASSERT_NO_ERROR( MIDIMetricsRemove( _metrics, queue[1] ), "Could not remove queue." );
+  ASSERT_ERROR( MIDIMetricsRemove( _metrics, queue[1] ), "Removed queue twice." );
+  MIDIErrorNumber = 0;
+  ASSERT_NO_ERROR( MIDIMetricsWriteFile( _metrics, METRICS_PATH ), "Could not write metrics file." );
+  ASSERT_NO_ERROR( _read_file( METRICS_PATH ), "Could not read metrics file." );
+  ASSERT_EQUAL( _count_lines( "midikit_queue_length{" ), 1, "Removed queue was exported." );
+
+  MIDIMessageQueueRelease( queue[0] );
+  MIDIMessageQueueRelease( queue[1] );
+  MIDIMessagePoolRelease( pool );
+  MIDIRunloopRelease( runloop );
+  unlink( METRICS_PATH );
+  return 0;
+}
+
+/**
+ * Test that the endpoint answers a scraper's request and that the stats
+ * file is written periodically by the runloop source.
+ */
+int test002_metrics( void ) {
+  struct MIDIRunloopSource * source;
+  struct MIDIRunloop * runloop;
+  struct MIDIRunloopStats stats;
+  struct sockaddr_in addr;
+  char request[] = "GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n";
+  unsigned short port;
+  size_t length = 0;
+  ssize_t n;
+  int fd, i;
+
+  runloop = MIDIRunloopCreate();
+  ASSERT_NO_ERROR( MIDIMetricsGetRunloopSource( _metrics, &source ), "Could not get runloop source." );
+  ASSERT_NO_ERROR( MIDIRunloopAddSource( runloop, source ), "Could not add runloop source." );
+  ASSERT_NO_ERROR( MIDIMetricsAddRunloop( _metrics, "metrics", runloop ), "Could not add runloop." );
+  ASSERT_NO_ERROR( MIDIMetricsListen( _metrics, 0 ), "Could not close closed endpoint." );
+  ASSERT_NO_ERROR( MIDIMetricsGetPort( _metrics, &port ), "Could not get port." );
+  ASSERT_EQUAL( port, 0, "Closed endpoint has a port." );
+
+  memset( &addr, 0, sizeof(addr) );
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+  for( port=47000; port<47100; port++ ) {
+    if( MIDIMetricsListen( _metrics, port ) == 0 ) break;
+    MIDIErrorNumber = 0;
+  }
+  ASSERT_NO_ERROR( MIDIMetricsGetPort( _metrics, &port ), "Could not get port." );
+  ASSERT_GREATER( port, 0, "Endpoint was not opened." );
+  addr.sin_port = htons( port );
+
+  fd = socket( AF_INET, SOCK_STREAM, 0 );
+  ASSERT_GREATER_OR_EQUAL( fd, 0, "Could not create socket." );
+  ASSERT_NO_ERROR( connect( fd, (struct sockaddr *) &addr, sizeof(addr) ), "Could not connect to endpoint." );
+  ASSERT_EQUAL( send( fd, &(request[0]), sizeof(request) - 1, 0 ), sizeof(request) - 1, "Could not send request." );
+  fcntl( fd, F_SETFL, fcntl( fd, F_GETFL, 0 ) | O_NONBLOCK );
+  for( i=0; i<16; i++ ) {
+    ASSERT_NO_ERROR( MIDIRunloopStep( runloop ), "Could not step through runloop." );
+    while( ( n = recv( fd, &(_text[length]), sizeof(_text) - 1 - length, 0 ) ) > 0 ) length += n;
+    if( n == 0 ) break;
+    ASSERT( errno == EAGAIN || errno == EWOULDBLOCK, "Could not receive response." );
+  }
+  close( fd );
+  _text[length] = '\0';
+  ASSERT_EQUAL( strncmp( &(_text[0]), "HTTP/1.0 200 OK\r\n", 17 ), 0, "Request was not answered." );
+  ASSERT_NOT_EQUAL( strstr( &(_text[0]), "Content-Type: application/openmetrics-text" ), NULL, "Wrong content type." );
+  ASSERT_NOT_EQUAL( strstr( &(_text[0]), "test_events_total 40000\n" ), NULL, "Response has no metrics." );
+  ASSERT_NO_ERROR( MIDIRunloopGetStats( runloop, &stats ), "Could not get runloop stats." );
+  ASSERT_GREATER( stats.iterations, 0, "Runloop did not count iterations." );
+
+  unlink( METRICS_PATH );
+  ASSERT_NO_ERROR( MIDIMetricsSetFile( _metrics, METRICS_PATH, 1000 ), "Could not set stats file." );
+  for( i=0; i<100 && access( METRICS_PATH, F_OK ) != 0; i++ ) {
+    ASSERT_NO_ERROR( MIDIRunloopStep( runloop ), "Could not step through runloop." );
+  }
+  ASSERT_NO_ERROR( _read_file( METRICS_PATH ), "Stats file was not written." );
+  ASSERT_NOT_EQUAL( strstr( &(_text[0]), "midikit_runloop_iterations_total{runloop=\"metrics\"}" ), NULL,
+                    "Stats file has no runloop metrics." );
+  ASSERT_NO_ERROR( MIDIMetricsSetFile( _metrics, NULL, 0 ), "Could not stop stats file." );
+
+  MIDIRunloopRemoveSource( runloop, source );
+  MIDIMetricsRelease( _metrics );
+  MIDIRunloopRelease( runloop );
+  unlink( METRICS_PATH );
+  return 0;
+}
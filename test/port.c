@@ -48,6 +48,60 @@ int test001_port( void ) {
   return 0;
 }
 
+static struct MIDIPort * _disconnect_source = NULL;
+static struct MIDIPort * _disconnect_target = NULL;
+
+static int _receive_disconnect( void * target, void * source, struct MIDITypeSpec * type, void * data ) {
+  (*(int*)target)++;
+  MIDIPortDisconnect( _disconnect_source, _disconnect_target );
+  return 0;
+}
+
+/**
+ * Test that messages are sent to all connected ports and that
+ * connections can change while a message is being sent.
+ */
+int test002_port( void ) {
+  int counts[4] = { 0, 0, 0, 0 }; /* the first port counts, the others store the value */
+  struct MIDIPort * ports[4];
+  struct MIDIPort * source = MIDIPortCreate( "source", MIDI_PORT_OUT, NULL, NULL );
+  int i, v = 1;
+
+  ASSERT_NOT_EQUAL( source, NULL, "Could not create source port!" );
+  for( i=0; i<4; i++ ) {
+    ports[i] = MIDIPortCreate( "target", MIDI_PORT_IN, &(counts[i]), ( i == 0 ) ? &_receive_disconnect : &_receive );
+    ASSERT_NOT_EQUAL( ports[i], NULL, "Could not create target port!" );
+    ASSERT_NO_ERROR( MIDIPortConnect( source, ports[i] ), "Could not connect MIDI ports!" );
+  }
+  _disconnect_source = source;
+  _disconnect_target = ports[3];
+
+  /* the first target disconnects the last one, which still gets the message */
+  ASSERT_NO_ERROR( MIDIPortSend( source, TestPortType, &v ), "Could not send message." );
+  ASSERT_EQUAL( counts[0], 1, "First port did not receive message." );
+  ASSERT_EQUAL( counts[3], 1, "Disconnected port did not receive message." );
+
+  v = 2;
+  ASSERT_NO_ERROR( MIDIPortSend( source, TestPortType, &v ), "Could not send message." );
+  ASSERT_EQUAL( counts[0], 2, "First port did not receive message." );
+  ASSERT_EQUAL( counts[1], 2, "Second port did not receive message." );
+  ASSERT_EQUAL( counts[3], 1, "Disconnected port received message." );
+
+  /* invalidated ports are dropped */
+  v = 3;
+  MIDIPortInvalidate( ports[2] );
+  ASSERT_NO_ERROR( MIDIPortSend( source, TestPortType, &v ), "Could not send message." );
+  ASSERT_EQUAL( counts[2], 2, "Invalidated port received message." );
+  ASSERT_EQUAL( counts[1], 3, "Second port did not receive message." );
+
+  MIDIPortInvalidate( source );
+  MIDIPortRelease( source );
+  for( i=0; i<4; i++ ) {
+    MIDIPortRelease( ports[i] );
+  }
+  return 0;
+}
+
 /**
  * Test something else ..
  */
@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "test.h"
+#define MIDI_DRIVER_INTERNALS
+#include "midi/port.h"
+#include "midi/clock.h"
+#include "midi/driver.h"
+#include "midi/message.h"
+#include "midi/recorder.h"
+
+static unsigned char _log[] = {
+  'M', 'K', 'R', 'L', 0x00, 0x00, 0x03, 0xe8,
+  0x00, 0x90, 0x3c, 0x40,
+  0x0a, 0x3e, 0x40,
+  0x00, 0xb0, 0x07, 0x64,
+  0x5a, 0xf0, 0x05, 0xf0, 0x7d, 0x01, 0x02, 0xf7,
+  0x64, 0xf8
+};
+
+static MIDIStatus    _received_status[8];
+static MIDITimestamp _received_timestamp[8];
+static int _received_count = 0;
+
+static int _receive( void * target, void * source, struct MIDITypeSpec * type, void * data ) {
+  if( type == MIDIMessageType && _received_count < 8 ) {
+    MIDIMessageGetStatus( data, &(_received_status[_received_count]) );
+    MIDIMessageGetTimestamp( data, &(_received_timestamp[_received_count]) );
+  }
+  _received_count++;
+  return 0;
+}
+
+static int _receive_message( struct MIDIDriver * driver, MIDIStatus status, MIDITimestamp timestamp,
+                             MIDIKey key, MIDIValue value ) {
+  unsigned char sysex[] = { 0x01, 0x02, 0xf7 };
+  unsigned char * data = &(sysex[0]);
+  struct MIDIMessage * message = MIDIMessageCreate( status );
+  MIDIManufacturerId manufacturer_id = 0x7d;
+  MIDIChannel channel = MIDI_CHANNEL_1;
+  size_t size = sizeof(sysex);
+  int result;
+  if( status == MIDI_STATUS_SYSTEM_EXCLUSIVE ) {
+    MIDIMessageSet( message, MIDI_MANUFACTURER_ID, sizeof(MIDIManufacturerId), &manufacturer_id );
+    MIDIMessageSet( message, MIDI_SYSEX_DATA, sizeof(void**), &data );
+    MIDIMessageSet( message, MIDI_SYSEX_SIZE, sizeof(size_t), &size );
+  } else if( status == MIDI_STATUS_NOTE_ON ) {
+    MIDIMessageSet( message, MIDI_CHANNEL, sizeof(MIDIChannel), &channel );
+    MIDIMessageSet( message, MIDI_KEY, sizeof(MIDIKey), &key );
+    MIDIMessageSet( message, MIDI_VELOCITY, sizeof(MIDIVelocity), &value );
+  } else if( status == MIDI_STATUS_CONTROL_CHANGE ) {
+    MIDIMessageSet( message, MIDI_CHANNEL, sizeof(MIDIChannel), &channel );
+    MIDIMessageSet( message, MIDI_CONTROL, sizeof(MIDIControl), &key );
+    MIDIMessageSet( message, MIDI_VALUE, sizeof(MIDIValue), &value );
+  }
+  MIDIMessageSetTimestamp( message, timestamp );
+  result = MIDIDriverReceive( driver, message );
+  MIDIMessageRelease( message );
+  return result;
+}
+
+static int _temp_file( char * path ) {
+  int fd = mkstemp( path );
+  unlink( path );
+  return fd;
+}
+
+/**
+ * Test that received messages are logged with delta times, running
+ * status and length prefixed system exclusive messages.
+ */
+int test001_recorder( void ) {
+  char path[] = "/tmp/midikit-recorder-XXXXXX";
+  unsigned char buffer[64];
+  struct MIDIDriver * driver;
+  struct MIDIRecorder * recorder;
+  struct MIDIRecorderStats stats;
+  int fd;
+
+  fd = _temp_file( path );
+  ASSERT_GREATER_OR_EQUAL( fd, 0, "Could not create temporary file." );
+  driver = MIDIDriverCreate( "Recorded", 1000 );
+  recorder = MIDIRecorderCreate( fd, driver );
+  ASSERT_NOT_EQUAL( recorder, NULL, "Could not create recorder." );
+
+  ASSERT_NO_ERROR( _receive_message( driver, MIDI_STATUS_NOTE_ON, 100, 0x3c, 0x40 ), "Could not receive note." );
+  ASSERT_NO_ERROR( _receive_message( driver, MIDI_STATUS_NOTE_ON, 110, 0x3e, 0x40 ), "Could not receive note." );
+  ASSERT_NO_ERROR( _receive_message( driver, MIDI_STATUS_CONTROL_CHANGE, 110, 0x07, 0x64 ), "Could not receive control change." );
+  ASSERT_NO_ERROR( _receive_message( driver, MIDI_STATUS_SYSTEM_EXCLUSIVE, 200, 0, 0 ), "Could not receive system exclusive message." );
+  ASSERT_NO_ERROR( _receive_message( driver, MIDI_STATUS_TIMING_CLOCK, 300, 0, 0 ), "Could not receive timing clock." );
+  ASSERT_NO_ERROR( MIDIRecorderFlush( recorder ), "Could not flush recorder." );
+  MIDIRecorderGetStats( recorder, &stats );
+  ASSERT_EQUAL( stats.messages, 5, "Recorded wrong number of messages." );
+  ASSERT_EQUAL( stats.bytes, sizeof(_log), "Recorded wrong number of bytes." );
+
+  ASSERT_EQUAL( pread( fd, &(buffer[0]), sizeof(buffer), 0 ), sizeof(_log), "Wrote wrong log size." );
+  ASSERT_NO_ERROR( memcmp( &(buffer[0]), &(_log[0]), sizeof(_log) ), "Wrote wrong log." );
+
+  MIDIRecorderRelease( recorder );
+  MIDIDriverRelease( driver );
+  close( fd );
+  return 0;
+}
+
+/**
+ * Test that a log is replayed through a driver.
+ */
+int test002_recorder( void ) {
+  char path[] = "/tmp/midikit-recorder-XXXXXX";
+  struct MIDIDriver * driver;
+  struct MIDIPort * port, * driver_port;
+  MIDITimestamp start;
+  size_t count;
+  int fd, i;
+
+  fd = _temp_file( path );
+  ASSERT_GREATER_OR_EQUAL( fd, 0, "Could not create temporary file." );
+  ASSERT_EQUAL( write( fd, &(_log[0]), sizeof(_log) ), sizeof(_log), "Could not write log." );
+  driver = MIDIDriverCreate( "Replayed", 1000 );
+  port   = MIDIPortCreate( "Test", MIDI_PORT_IN, &_received_count, &_receive );
+  MIDIDriverGetPort( driver, &driver_port );
+  MIDIPortConnect( driver_port, port );
+
+  _received_count = 0;
+  lseek( fd, 0, SEEK_SET );
+  MIDIClockGetNow( driver->clock, &start );
+  ASSERT_NO_ERROR( MIDIRecorderReplay( fd, driver, 10, &count ), "Could not replay log." );
+  ASSERT_EQUAL( count, 5, "Replayed wrong number of messages." );
+  ASSERT_EQUAL( _received_count, 5, "Driver relayed wrong number of messages." );
+  ASSERT_EQUAL( _received_status[1], MIDI_STATUS_NOTE_ON, "Did not apply running status." );
+  ASSERT_EQUAL( _received_status[2], MIDI_STATUS_CONTROL_CHANGE, "Replayed wrong message." );
+  ASSERT_EQUAL( _received_status[3], MIDI_STATUS_SYSTEM_EXCLUSIVE, "Replayed wrong message." );
+  ASSERT_EQUAL( _received_status[4], MIDI_STATUS_TIMING_CLOCK, "Replayed wrong message." );
+  for( i=1; i<5; i++ ) {
+    ASSERT_GREATER_OR_EQUAL( _received_timestamp[i], _received_timestamp[i-1], "Replayed out of order." );
+  }
+  ASSERT_GREATER_OR_EQUAL( _received_timestamp[4], start + 20, "Did not keep relative timing." );
+
+  _received_count = 0;
+  lseek( fd, 0, SEEK_SET );
+  ASSERT_NO_ERROR( MIDIRecorderReplay( fd, driver, 0, &count ), "Could not replay log at full speed." );
+  ASSERT_EQUAL( count, 5, "Replayed wrong number of messages." );
+
+  _received_count = 0;
+  ftruncate( fd, sizeof(_log) - 3 );
+  lseek( fd, 0, SEEK_SET );
+  ASSERT_ERROR( MIDIRecorderReplay( fd, driver, 0, &count ), "Replayed a truncated log." );
+  MIDIErrorNumber = 0;
+  ASSERT_EQUAL( count, 3, "Replayed messages after the truncation." );
+
+  MIDIPortRelease( port );
+  MIDIDriverRelease( driver );
+  close( fd );
+  return 0;
+}
+
+/**
+ * Test that the recorder does not lose messages when it has to swap
+ * buffers.
+ */
+int test003_recorder( void ) {
+  char path[] = "/tmp/midikit-recorder-XXXXXX";
+  struct MIDIDriver * driver;
+  struct MIDIRecorder * recorder;
+  struct MIDIRecorderStats stats;
+  struct stat st;
+  int fd, i;
+
+  fd = _temp_file( path );
+  ASSERT_GREATER_OR_EQUAL( fd, 0, "Could not create temporary file." );
+  driver = MIDIDriverCreate( "Recorded", 1000 );
+  recorder = MIDIRecorderCreate( fd, driver );
+  ASSERT_NOT_EQUAL( recorder, NULL, "Could not create recorder." );
+  for( i=0; i<50000; i++ ) {
+    ASSERT_NO_ERROR( _receive_message( driver, MIDI_STATUS_NOTE_ON, i, i & 0x7f, 0x40 ), "Could not receive note." );
+  }
+  ASSERT_NO_ERROR( MIDIRecorderFlush( recorder ), "Could not flush recorder." );
+  MIDIRecorderGetStats( recorder, &stats );
+  ASSERT_EQUAL( stats.messages, 50000, "Recorded wrong number of messages." );
+  ASSERT_GREATER_OR_EQUAL( stats.swaps, 3, "Did not swap buffers." );
+  /* the first note needs a status byte, all others use running status */
+  ASSERT_EQUAL( stats.bytes, MIDI_RECORDER_HEADER_SIZE + 1 + 50000 * 3, "Recorded wrong number of bytes." );
+  ASSERT_NO_ERROR( fstat( fd, &st ), "Could not stat log." );
+  ASSERT_EQUAL( st.st_size, stats.bytes, "Lost records." );
+
+  MIDIRecorderRelease( recorder );
+  MIDIDriverRelease( driver );
+  close( fd );
+  return 0;
+}
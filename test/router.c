@@ -0,0 +1,203 @@
+#include "test.h"
+#include "midi/port.h"
+#include "midi/message.h"
+#include "midi/router.h"
+
+static MIDIStatus    _received_status[8];
+static MIDIChannel   _received_channel[8];
+static MIDIKey       _received_key[8];
+static MIDITimestamp _received_timestamp[8];
+static int _received_count = 0;
+
+static int _receive( void * target, void * source, struct MIDITypeSpec * type, void * data ) {
+  if( type == MIDIMessageType && _received_count < 8 ) {
+    MIDIMessageGetStatus( data, &(_received_status[_received_count]) );
+    MIDIMessageGet( data, MIDI_CHANNEL, sizeof(MIDIChannel), &(_received_channel[_received_count]) );
+    if( _received_status[_received_count] == MIDI_STATUS_CONTROL_CHANGE ) {
+      MIDIMessageGet( data, MIDI_CONTROL, sizeof(MIDIControl), &(_received_key[_received_count]) );
+    } else {
+      MIDIMessageGet( data, MIDI_KEY, sizeof(MIDIKey), &(_received_key[_received_count]) );
+    }
+    MIDIMessageGetTimestamp( data, &(_received_timestamp[_received_count]) );
+  }
+  _received_count++;
+  return 0;
+}
+
+/* feed a message with a channel, a key or controller and a timestamp into a port */
+static int _send( struct MIDIPort * port, MIDIStatus status, MIDIChannel channel, MIDIKey key ) {
+  struct MIDIMessage * message = MIDIMessageCreate( status );
+  MIDIValue value = 0x40;
+  int result;
+  MIDIMessageSet( message, MIDI_CHANNEL, sizeof(MIDIChannel), &channel );
+  if( status == MIDI_STATUS_CONTROL_CHANGE ) {
+    MIDIMessageSet( message, MIDI_CONTROL, sizeof(MIDIControl), &key );
+    MIDIMessageSet( message, MIDI_VALUE, sizeof(MIDIValue), &value );
+  } else {
+    MIDIMessageSet( message, MIDI_KEY, sizeof(MIDIKey), &key );
+    MIDIMessageSet( message, MIDI_VELOCITY, sizeof(MIDIVelocity), &value );
+  }
+  MIDIMessageSetTimestamp( message, 1234 );
+  result = MIDIPortReceive( port, MIDIMessageType, message );
+  MIDIMessageRelease( message );
+  return result;
+}
+
+/**
+ * Test that routes pass messages unchanged or remap channels and
+ * transpose notes.
+ */
+int test001_router( void ) {
+  struct MIDIRouter * router = MIDIRouterCreate();
+  struct MIDIRouterFilter filter;
+  struct MIDIPort * sink, * input;
+  size_t source, a, b;
+
+  ASSERT_NOT_EQUAL( router, NULL, "Could not create router." );
+  sink = MIDIPortCreate( "Sink", MIDI_PORT_IN, &_received_count, &_receive );
+  ASSERT_NO_ERROR( MIDIRouterAddSource( router, "Keyboard", &source ), "Could not add source." );
+  ASSERT_NO_ERROR( MIDIRouterAddSink( router, sink, &a ), "Could not add sink." );
+  ASSERT_NO_ERROR( MIDIRouterAddSink( router, sink, &b ), "Could not add sink." );
+  ASSERT_NO_ERROR( MIDIRouterGetSourcePort( router, source, &input ), "Could not get source port." );
+
+  ASSERT_NO_ERROR( MIDIRouterConnect( router, source, a, NULL, NULL ), "Could not connect." );
+  MIDIRouterFilterInit( &filter );
+  MIDIRouterFilterSetChannelMap( &filter, MIDI_CHANNEL_1, MIDI_CHANNEL_10 );
+  MIDIRouterFilterSetTranspose( &filter, 12 );
+  ASSERT_NO_ERROR( MIDIRouterConnect( router, source, b, &filter, NULL ), "Could not connect." );
+
+  _received_count = 0;
+  ASSERT_NO_ERROR( _send( input, MIDI_STATUS_NOTE_ON, MIDI_CHANNEL_1, 60 ), "Could not route message." );
+  ASSERT_EQUAL( _received_count, 2, "Routed to wrong number of sinks." );
+  ASSERT_EQUAL( _received_channel[0], MIDI_CHANNEL_1, "Modified unfiltered message." );
+  ASSERT_EQUAL( _received_key[0], 60, "Modified unfiltered message." );
+  ASSERT_EQUAL( _received_channel[1], MIDI_CHANNEL_10, "Did not remap channel." );
+  ASSERT_EQUAL( _received_key[1], 72, "Did not transpose note." );
+  ASSERT_EQUAL( _received_timestamp[1], 1234, "Did not keep timestamp." );
+
+  MIDIRouterRelease( router );
+  MIDIPortRelease( sink );
+  return 0;
+}
+
+/**
+ * Test that channel, key range and controller filters drop messages.
+ */
+int test002_router( void ) {
+  struct MIDIRouter * router = MIDIRouterCreate();
+  struct MIDIRouterFilter filter;
+  struct MIDIPort * sink, * input;
+  size_t source, node;
+
+  sink = MIDIPortCreate( "Sink", MIDI_PORT_IN, &_received_count, &_receive );
+  MIDIRouterAddSource( router, "Keyboard", &source );
+  MIDIRouterAddSink( router, sink, &node );
+  MIDIRouterGetSourcePort( router, source, &input );
+  MIDIRouterFilterInit( &filter );
+  MIDIRouterFilterSetKeyRange( &filter, 36, 59 );
+  MIDIRouterFilterSetTranspose( &filter, 70 );
+  MIDIRouterFilterSetChannelMap( &filter, MIDI_CHANNEL_2, -1 );
+  MIDIRouterFilterSetControl( &filter, 7, MIDI_OFF );
+  ASSERT_NO_ERROR( MIDIRouterConnect( router, source, node, &filter, NULL ), "Could not connect." );
+
+  _received_count = 0;
+  _send( input, MIDI_STATUS_NOTE_ON, MIDI_CHANNEL_1, 30 );
+  _send( input, MIDI_STATUS_NOTE_ON, MIDI_CHANNEL_1, 60 );
+  ASSERT_EQUAL( _received_count, 0, "Did not apply key range." );
+  _send( input, MIDI_STATUS_NOTE_ON, MIDI_CHANNEL_1, 58 );
+  ASSERT_EQUAL( _received_count, 0, "Transposed note out of range." );
+  _send( input, MIDI_STATUS_NOTE_ON, MIDI_CHANNEL_2, 36 );
+  ASSERT_EQUAL( _received_count, 0, "Did not drop channel." );
+  _send( input, MIDI_STATUS_CONTROL_CHANGE, MIDI_CHANNEL_1, 7 );
+  ASSERT_EQUAL( _received_count, 0, "Did not drop controller." );
+  ASSERT_NO_ERROR( _send( input, MIDI_STATUS_CONTROL_CHANGE, MIDI_CHANNEL_1, 10 ), "Could not route message." );
+  ASSERT_NO_ERROR( _send( input, MIDI_STATUS_NOTE_OFF, MIDI_CHANNEL_1, 57 ), "Could not route message." );
+  ASSERT_EQUAL( _received_count, 2, "Dropped wrong messages." );
+  ASSERT_EQUAL( _received_status[1], MIDI_STATUS_NOTE_OFF, "Routed wrong message." );
+  ASSERT_EQUAL( _received_key[1], 127, "Did not transpose note." );
+
+  MIDIRouterRelease( router );
+  MIDIPortRelease( sink );
+  return 0;
+}
+
+/**
+ * Test that filters of routes through a bus are composed and that
+ * disconnecting a route removes it from the plan.
+ */
+int test003_router( void ) {
+  struct MIDIRouter * router = MIDIRouterCreate();
+  struct MIDIRouterFilter filter;
+  struct MIDIPort * sink, * input;
+  size_t source, bus, node, route;
+
+  sink = MIDIPortCreate( "Sink", MIDI_PORT_IN, &_received_count, &_receive );
+  MIDIRouterAddSource( router, "Keyboard", &source );
+  MIDIRouterAddSource( router, "Bus", &bus );
+  MIDIRouterAddSink( router, sink, &node );
+  MIDIRouterGetSourcePort( router, source, &input );
+
+  MIDIRouterFilterInit( &filter );
+  MIDIRouterFilterSetChannelMap( &filter, MIDI_CHANNEL_1, MIDI_CHANNEL_3 );
+  MIDIRouterFilterSetTranspose( &filter, -5 );
+  ASSERT_NO_ERROR( MIDIRouterConnect( router, source, bus, &filter, &route ), "Could not connect to bus." );
+  MIDIRouterFilterInit( &filter );
+  MIDIRouterFilterSetChannelMap( &filter, MIDI_CHANNEL_3, MIDI_CHANNEL_4 );
+  MIDIRouterFilterSetKeyRange( &filter, 50, 127 );
+  MIDIRouterFilterSetStatus( &filter, MIDI_STATUS_CONTROL_CHANGE, MIDI_OFF );
+  ASSERT_NO_ERROR( MIDIRouterConnect( router, bus, node, &filter, NULL ), "Could not connect bus." );
+  /* cycles are ignored */
+  ASSERT_NO_ERROR( MIDIRouterConnect( router, bus, source, NULL, NULL ), "Could not connect cycle." );
+
+  _received_count = 0;
+  _send( input, MIDI_STATUS_NOTE_ON, MIDI_CHANNEL_1, 54 );
+  ASSERT_EQUAL( _received_count, 0, "Did not compose key range." );
+  _send( input, MIDI_STATUS_CONTROL_CHANGE, MIDI_CHANNEL_1, 1 );
+  ASSERT_EQUAL( _received_count, 0, "Did not compose status filter." );
+  _send( input, MIDI_STATUS_NOTE_ON, MIDI_CHANNEL_1, 55 );
+  ASSERT_EQUAL( _received_count, 1, "Did not route through bus." );
+  ASSERT_EQUAL( _received_channel[0], MIDI_CHANNEL_4, "Did not compose channel maps." );
+  ASSERT_EQUAL( _received_key[0], 50, "Did not compose transposition." );
+
+  ASSERT_NO_ERROR( MIDIRouterDisconnect( router, route ), "Could not disconnect." );
+  _send( input, MIDI_STATUS_NOTE_ON, MIDI_CHANNEL_1, 60 );
+  ASSERT_EQUAL( _received_count, 1, "Routed through removed route." );
+  ASSERT_ERROR( MIDIRouterDisconnect( router, route ), "Disconnected a route twice." );
+  MIDIErrorNumber = 0;
+
+  MIDIRouterRelease( router );
+  MIDIPortRelease( sink );
+  return 0;
+}
+
+/**
+ * Test that a filter applied to a block of compact messages has the
+ * same effect as a route.
+ */
+int test004_router( void ) {
+  struct MIDICompactMessage messages[6] = {
+    { { 0x90, 60, 100 }, 0, 1, 0, 0 },
+    { { 0x91, 60, 100 }, 0, 2, 0, 0 },
+    { { 0x90, 120, 100 }, 0, 3, 0, 0 },
+    { { 0xb0, 7, 100 }, 0, 4, 0, 0 },
+    { { 0xb0, 10, 100 }, 0, 5, 0, 0 },
+    { { 0xf8, 0, 0 }, 0, 6, 0, 0 }
+  };
+  struct MIDIRouterFilter filter;
+  size_t written;
+
+  MIDIRouterFilterInit( &filter );
+  MIDIRouterFilterSetChannelMap( &filter, MIDI_CHANNEL_1, MIDI_CHANNEL_3 );
+  MIDIRouterFilterSetChannelMap( &filter, MIDI_CHANNEL_2, -1 );
+  MIDIRouterFilterSetTranspose( &filter, 12 );
+  MIDIRouterFilterSetControl( &filter, 7, MIDI_OFF );
+  ASSERT_NO_ERROR( MIDIRouterFilterApplyBatch( &filter, 6, &(messages[0]), &(messages[0]), &written ),
+                   "Could not filter block." );
+  ASSERT_EQUAL( written, 3, "Filtered wrong number of messages." );
+  ASSERT_EQUAL( messages[0].bytes[0], 0x92, "Did not remap channel." );
+  ASSERT_EQUAL( messages[0].bytes[1], 72, "Did not transpose note." );
+  ASSERT_EQUAL( messages[1].bytes[0], 0xb2, "Did not remap channel." );
+  ASSERT_EQUAL( messages[1].bytes[1], 10, "Dropped wrong controller." );
+  ASSERT_EQUAL( messages[2].timestamp, 6, "Did not keep system message." );
+  return 0;
+}
@@ -1,10 +1,15 @@
 #include "test.h"
 #include "midi/runloop.h"
+#include "midi/message.h"
+#include "midi/message_queue.h"
+#include <pthread.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 struct MIDIRunloopTestSource {
   int send_sock;
@@ -90,15 +95,14 @@ struct MIDIRunloopSourceDelegate _rls_delegate = {
   &_rls_timeout
 };
 
-/**
- * Test that the runloop works.
- */
-int test001_runloop( void ) {
-  struct MIDIRunloop * runloop = MIDIRunloopCreate();
+static int _rls_run( struct MIDIRunloop * runloop ) {
   struct MIDIRunloopSource * source = MIDIRunloopSourceCreate( &_rls_delegate );
   
   ASSERT_NOT_EQUAL( runloop, NULL, "Could not create runloop." );
   ASSERT_NOT_EQUAL( source,  NULL, "Could not create runloop source." );
+
+  _rls_info.send_data = 0;
+  _rls_info.recv_data = 0;
   
   ASSERT_NO_ERROR( MIDIRunloopAddSource( runloop, source ),
                    "Could not schedule source in runloop." );
@@ -143,3 +147,270 @@ int test001_runloop( void ) {
   close( _rls_info.recv_sock );
   return 0;
 }
+
+/**
+ * Test that the runloop works with the native poller.
+ */
+int test001_runloop( void ) {
+  return _rls_run( MIDIRunloopCreate() );
+}
+
+/**
+ * Test that the runloop works when falling back to select.
+ */
+int test002_runloop( void ) {
+  struct MIDIRunloop * runloop = MIDIRunloopCreate();
+  ASSERT_NO_ERROR( MIDIRunloopSetDelegate( runloop, NULL ), "Could not reset runloop delegate." );
+  return _rls_run( runloop );
+}
+
+static int _rls_timer_order[4];
+static int _rls_timer_count = 0;
+
+static int _rls_timer( void * info, struct timespec * now ) {
+  _rls_timer_order[_rls_timer_count++] = *((int *) info);
+  return 0;
+}
+
+/**
+ * Test that runloop timers expire in the order of their deadlines
+ * and that cancelled timers are not called.
+ */
+int test003_runloop( void ) {
+  struct MIDIRunloop * runloop = MIDIRunloopCreate();
+  struct MIDIRunloopSource * source = MIDIRunloopSourceCreate( NULL );
+  struct timespec delay[4] = { { 0, 3000000 }, { 0, 1000000 }, { 0, 2000000 }, { 0, 1500000 } };
+  int ids[4] = { 0, 1, 2, 3 };
+  unsigned long handle[4];
+  int i;
+
+  ASSERT_NOT_EQUAL( runloop, NULL, "Could not create runloop." );
+  ASSERT_NOT_EQUAL( source,  NULL, "Could not create runloop source." );
+  ASSERT_NO_ERROR( MIDIRunloopAddSource( runloop, source ), "Could not add source to runloop." );
+
+  for( i=0; i<4; i++ ) {
+    ASSERT_NO_ERROR( MIDIRunloopSourceAddTimer( source, &(delay[i]), &_rls_timer, &(ids[i]), &(handle[i]) ),
+                     "Could not add timer." );
+  }
+  ASSERT_NO_ERROR( MIDIRunloopSourceCancelTimer( source, handle[3] ), "Could not cancel timer." );
+  ASSERT_ERROR( MIDIRunloopSourceCancelTimer( source, handle[3] ), "Cancelled timer twice." );
+
+  for( i=0; i<100 && _rls_timer_count < 3; i++ ) {
+    ASSERT_NO_ERROR( MIDIRunloopStep( runloop ), "Could not step through runloop." );
+  }
+  ASSERT_EQUAL( _rls_timer_count, 3, "Wrong number of timers expired." );
+  ASSERT_EQUAL( _rls_timer_order[0], 1, "Timers expired in wrong order." );
+  ASSERT_EQUAL( _rls_timer_order[1], 2, "Timers expired in wrong order." );
+  ASSERT_EQUAL( _rls_timer_order[2], 0, "Timers expired in wrong order." );
+  ASSERT_ERROR( MIDIRunloopSourceCancelTimer( source, handle[0] ), "Cancelled expired timer." );
+
+  MIDIRunloopSourceRelease( source );
+  MIDIRunloopRelease( runloop );
+  return 0;
+}
+
+#define RLS_HANDOFF_MESSAGES 200
+
+struct _rls_handoff {
+  struct MIDIRunloop * runloop;
+  struct MIDIMessageQueue * queue;
+  pthread_t thread;
+  int volatile pending;
+  int volatile received;
+  int volatile wrong_thread;
+};
+
+static void * _rls_handoff_thread( void * info ) {
+  struct _rls_handoff * handoff = info;
+  MIDIRunloopStart( handoff->runloop );
+  return NULL;
+}
+
+static int _rls_handoff_drain( void * info ) {
+  struct _rls_handoff * handoff = info;
+  struct MIDIRunloop * current = NULL;
+  struct MIDIMessage * message;
+
+  MIDIRunloopGetCurrentRunloop( &current );
+  if( current != handoff->runloop || ! pthread_equal( pthread_self(), handoff->thread ) ) {
+    handoff->wrong_thread++;
+  }
+  __sync_lock_release( &(handoff->pending) );
+  do {
+    MIDIMessageQueuePop( handoff->queue, &message );
+    if( message != NULL ) {
+      handoff->received++;
+      MIDIMessageRelease( message );
+    }
+  } while( message != NULL );
+  return 0;
+}
+
+/**
+ * Test that callbacks can be posted to a runloop that runs on another
+ * thread and that messages can be handed over through a ring queue.
+ */
+int test004_runloop( void ) {
+  struct _rls_handoff handoff;
+  struct timespec wait = { 0, 100000 };
+  struct MIDIMessage * message;
+  struct MIDIRunloop * current = NULL;
+  int i;
+
+  handoff.runloop  = MIDIRunloopCreate();
+  handoff.queue    = MIDIMessageQueueCreateRing( 16 );
+  handoff.pending  = 0;
+  handoff.received = 0;
+  handoff.wrong_thread = 0;
+  ASSERT_NOT_EQUAL( handoff.runloop, NULL, "Could not create runloop." );
+  ASSERT_NOT_EQUAL( handoff.queue, NULL, "Could not create queue." );
+  ASSERT_EQUAL( pthread_create( &(handoff.thread), NULL, &_rls_handoff_thread, &handoff ), 0,
+                "Could not start runloop thread." );
+
+  for( i=0; i<RLS_HANDOFF_MESSAGES; i++ ) {
+    message = MIDIMessageCreate( MIDI_STATUS_TIMING_CLOCK );
+    ASSERT_NOT_EQUAL( message, NULL, "Could not create message." );
+    while( MIDIMessageQueuePush( handoff.queue, message ) ) {
+      nanosleep( &wait, NULL );
+    }
+    MIDIMessageRelease( message );
+    if( __sync_lock_test_and_set( &(handoff.pending), 1 ) == 0 ) {
+      ASSERT_NO_ERROR( MIDIRunloopPost( handoff.runloop, &_rls_handoff_drain, &handoff ), "Could not post callback." );
+    }
+  }
+  for( i=0; i<10000 && handoff.received < RLS_HANDOFF_MESSAGES; i++ ) {
+    nanosleep( &wait, NULL );
+  }
+  ASSERT_NO_ERROR( MIDIRunloopStop( handoff.runloop ), "Could not stop runloop." );
+  ASSERT_EQUAL( pthread_join( handoff.thread, NULL ), 0, "Could not join runloop thread." );
+
+  ASSERT_EQUAL( handoff.received, RLS_HANDOFF_MESSAGES, "Messages were lost in the handoff." );
+  ASSERT_EQUAL( handoff.wrong_thread, 0, "Posted callbacks were called on the wrong thread." );
+  ASSERT_NO_ERROR( MIDIRunloopGetCurrentRunloop( &current ), "Could not get current runloop." );
+  ASSERT_NOT_EQUAL( current, handoff.runloop, "Runloop is current on a thread that does not run it." );
+
+  MIDIMessageQueueRelease( handoff.queue );
+  MIDIRunloopRelease( handoff.runloop );
+  return 0;
+}
+
+#define RLS_MANY_SOURCES 48
+
+static int _rls_many_fired = 0;
+
+static int _rls_many_timer( void * info, struct timespec * now ) {
+  _rls_many_fired++;
+  return 0;
+}
+
+/**
+ * Test that a runloop grows beyond its initial number of sources and
+ * keeps serving all of them.
+ */
+int test005_runloop( void ) {
+  struct MIDIRunloop * runloop = MIDIRunloopCreate();
+  struct MIDIRunloopSource * source[RLS_MANY_SOURCES];
+  struct timespec delay = { 0, 1000000 };
+  int i;
+
+  ASSERT_NOT_EQUAL( runloop, NULL, "Could not create runloop." );
+  for( i=0; i<RLS_MANY_SOURCES; i++ ) {
+    source[i] = MIDIRunloopSourceCreate( NULL );
+    ASSERT_NOT_EQUAL( source[i], NULL, "Could not create runloop source." );
+    ASSERT_NO_ERROR( MIDIRunloopAddSource( runloop, source[i] ), "Could not add source to runloop." );
+    ASSERT_NO_ERROR( MIDIRunloopSourceAddTimer( source[i], &delay, &_rls_many_timer, NULL, NULL ),
+                     "Could not add timer." );
+  }
+
+  for( i=0; i<1000 && _rls_many_fired < RLS_MANY_SOURCES; i++ ) {
+    ASSERT_NO_ERROR( MIDIRunloopStep( runloop ), "Could not step through runloop." );
+  }
+  ASSERT_EQUAL( _rls_many_fired, RLS_MANY_SOURCES, "Not all sources were served." );
+
+  for( i=0; i<RLS_MANY_SOURCES; i++ ) {
+    ASSERT_NO_ERROR( MIDIRunloopRemoveSource( runloop, source[i] ), "Could not remove source." );
+    MIDIRunloopSourceRelease( source[i] );
+  }
+  MIDIRunloopRelease( runloop );
+  return 0;
+}
+
+struct _rls_spin {
+  int fds[2];
+  int volatile received;
+};
+
+static int _rls_spin_read( void * info, int nfds, fd_set * fds ) {
+  struct _rls_spin * spin = info;
+  char byte;
+  if( FD_ISSET( spin->fds[0], fds ) && read( spin->fds[0], &byte, 1 ) == 1 ) {
+    spin->received++;
+  }
+  return 0;
+}
+
+static void * _rls_spin_thread( void * info ) {
+  struct _rls_spin * spin = info;
+  struct timespec wait = { 0, 2000000 };
+  nanosleep( &wait, NULL );
+  write( spin->fds[1], "x", 1 );
+  return NULL;
+}
+
+/**
+ * Test that a busy polling runloop dispatches data that arrives while it
+ * spins and that spinning does not delay timers.
+ */
+int test006_runloop( void ) {
+  struct _rls_spin spin = { { -1, -1 }, 0 };
+  struct MIDIRunloopSourceDelegate delegate = { &spin, &_rls_spin_read, NULL, NULL };
+  struct MIDIRunloop * runloop = MIDIRunloopCreate();
+  struct MIDIRunloopSource * source;
+  struct timespec timeout = { 1, 0 };
+  struct timespec delay = { 0, 1000000 };
+  struct timespec start, end;
+  unsigned long usec;
+  pthread_t thread;
+  int i;
+
+  ASSERT_NOT_EQUAL( runloop, NULL, "Could not create runloop." );
+  ASSERT_NO_ERROR( MIDIRunloopSetBusyPoll( runloop, 500000 ), "Could not set busy poll budget." );
+  ASSERT_NO_ERROR( MIDIRunloopGetBusyPoll( runloop, &usec ), "Could not get busy poll budget." );
+  ASSERT_EQUAL( usec, 500000, "Busy poll budget was not stored." );
+  ASSERT_ERROR( MIDIRunloopSetThreadAffinity( runloop, -2 ), "Pinned runloop to an invalid CPU." );
+  ASSERT_ERROR( MIDIRunloopSetThreadPriority( runloop, 1000 ), "Set invalid runloop priority." );
+  MIDIErrorNumber = 0;
+
+  ASSERT_EQUAL( pipe( spin.fds ), 0, "Could not create pipe." );
+  source = MIDIRunloopSourceCreate( &delegate );
+  ASSERT_NOT_EQUAL( source, NULL, "Could not create runloop source." );
+  ASSERT_NO_ERROR( MIDIRunloopSourceScheduleRead( source, spin.fds[0] ), "Could not schedule read." );
+  /* without a timeout the runloop would poll without blocking anyway */
+  ASSERT_NO_ERROR( MIDIRunloopSourceScheduleTimeout( source, &timeout ), "Could not schedule timeout." );
+  ASSERT_NO_ERROR( MIDIRunloopAddSource( runloop, source ), "Could not add source to runloop." );
+
+  ASSERT_EQUAL( pthread_create( &thread, NULL, &_rls_spin_thread, &spin ), 0, "Could not start writer thread." );
+  for( i=0; i<10 && spin.received == 0; i++ ) {
+    ASSERT_NO_ERROR( MIDIRunloopStep( runloop ), "Could not step through runloop." );
+  }
+  pthread_join( thread, NULL );
+  ASSERT_EQUAL( spin.received, 1, "Data that arrived while spinning was not dispatched." );
+
+  _rls_many_fired = 0;
+  ASSERT_NO_ERROR( MIDIRunloopSourceAddTimer( source, &delay, &_rls_many_timer, NULL, NULL ), "Could not add timer." );
+  clock_gettime( CLOCK_MONOTONIC, &start );
+  for( i=0; i<100 && _rls_many_fired == 0; i++ ) {
+    ASSERT_NO_ERROR( MIDIRunloopStep( runloop ), "Could not step through runloop." );
+  }
+  clock_gettime( CLOCK_MONOTONIC, &end );
+  ASSERT_EQUAL( _rls_many_fired, 1, "Timer did not fire while busy polling." );
+  ASSERT_LESS( ( end.tv_sec - start.tv_sec ) * 1000 + ( end.tv_nsec - start.tv_nsec ) / 1000000, 250,
+               "Spinning delayed the timer." );
+
+  ASSERT_NO_ERROR( MIDIRunloopRemoveSource( runloop, source ), "Could not remove source." );
+  MIDIRunloopSourceRelease( source );
+  MIDIRunloopRelease( runloop );
+  close( spin.fds[0] );
+  close( spin.fds[1] );
+  return 0;
+}
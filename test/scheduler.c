@@ -0,0 +1,118 @@
+#include "test.h"
+#include <time.h>
+#include "midi/port.h"
+#include "midi/clock.h"
+#include "midi/message.h"
+#include "midi/runloop.h"
+#include "midi/scheduler.h"
+
+static MIDIKey _scheduled_keys[4];
+static int _scheduled_count = 0;
+
+static int _scheduled_receive( void * target, void * source, struct MIDITypeSpec * type, void * data ) {
+  MIDIKey key;
+  if( type == MIDIMessageType && _scheduled_count < 4 ) {
+    MIDIMessageGet( data, MIDI_KEY, sizeof(MIDIKey), &key );
+    _scheduled_keys[_scheduled_count++] = key;
+  }
+  return 0;
+}
+
+/* schedule a note on message for a key some milliseconds from now */
+static int _schedule_note( struct MIDIScheduler * scheduler, struct MIDIClock * clock, MIDIKey key, int ms ) {
+  struct MIDIMessage * message = MIDIMessageCreate( MIDI_STATUS_NOTE_ON );
+  MIDISamplingRate rate;
+  MIDITimestamp now;
+  int result;
+  ASSERT_NOT_EQUAL( message, NULL, "Could not create message." );
+  MIDIMessageSet( message, MIDI_KEY, sizeof(MIDIKey), &key );
+  MIDIClockGetNow( clock, &now );
+  MIDIClockGetSamplingRate( clock, &rate );
+  MIDIMessageSetTimestamp( message, now + ( (MIDITimestamp) rate * ms ) / 1000 );
+  result = MIDISchedulerSchedule( scheduler, message );
+  MIDIMessageRelease( message );
+  return result;
+}
+
+/**
+ * Test that scheduled messages are held until they are due and
+ * sent in timestamp order.
+ */
+int test001_scheduler( void ) {
+  struct timespec wait = { 0, 30000000 };
+  struct MIDIScheduler * scheduler = MIDISchedulerCreate( NULL );
+  struct MIDIPort * port, * receiver;
+  struct MIDISchedulerStats stats;
+  struct MIDIClock * clock;
+  size_t length;
+
+  ASSERT_NOT_EQUAL( scheduler, NULL, "Could not create scheduler." );
+  ASSERT_NO_ERROR( MIDISchedulerGetClock( scheduler, &clock ), "Could not get scheduler clock." );
+  ASSERT_NO_ERROR( MIDISchedulerGetPort( scheduler, &port ), "Could not get scheduler port." );
+  receiver = MIDIPortCreate( "receiver", MIDI_PORT_IN, &_scheduled_count, &_scheduled_receive );
+  ASSERT_NO_ERROR( MIDIPortConnect( port, receiver ), "Could not connect receiver." );
+
+  _scheduled_count = 0;
+  ASSERT_NO_ERROR( _schedule_note( scheduler, clock, 62, 20 ), "Could not schedule message." );
+  ASSERT_NO_ERROR( _schedule_note( scheduler, clock, 61, 10 ), "Could not schedule message." );
+  ASSERT_NO_ERROR( _schedule_note( scheduler, clock, 63, 20 ), "Could not schedule message." );
+  ASSERT_NO_ERROR( _schedule_note( scheduler, clock, 60, -5 ), "Could not schedule message." );
+  ASSERT_EQUAL( _scheduled_count, 1, "Due message was not sent at once." );
+  ASSERT_EQUAL( _scheduled_keys[0], 60, "Sent wrong message." );
+  ASSERT_NO_ERROR( MIDISchedulerGetLength( scheduler, &length ), "Could not get length." );
+  ASSERT_EQUAL( length, 3, "Future messages were not held." );
+
+  nanosleep( &wait, NULL );
+  ASSERT_NO_ERROR( MIDISchedulerPoll( scheduler ), "Could not poll scheduler." );
+  ASSERT_EQUAL( _scheduled_count, 4, "Due messages were not sent." );
+  ASSERT_EQUAL( _scheduled_keys[1], 61, "Messages were not sent in timestamp order." );
+  ASSERT_EQUAL( _scheduled_keys[2], 62, "Messages with equal timestamps were reordered." );
+  ASSERT_EQUAL( _scheduled_keys[3], 63, "Messages with equal timestamps were reordered." );
+
+  ASSERT_NO_ERROR( MIDISchedulerGetStats( scheduler, &stats ), "Could not get stats." );
+  ASSERT_EQUAL( stats.scheduled, 4, "Wrong number of scheduled messages." );
+  ASSERT_EQUAL( stats.sent, 4, "Wrong number of sent messages." );
+  ASSERT_EQUAL( stats.late, 1, "Wrong number of late messages." );
+  ASSERT_EQUAL( stats.queue_depth_max, 4, "Wrong queue depth." );
+  ASSERT_EQUAL( stats.queue_depth, 0, "Wrong queue depth." );
+  ASSERT_EQUAL( stats.jitter.count, 4, "Jitter was not recorded." );
+
+  MIDIPortRelease( receiver );
+  MIDISchedulerRelease( scheduler );
+  return 0;
+}
+
+/**
+ * Test that the scheduler wakes up the runloop when a message is due.
+ */
+int test002_scheduler( void ) {
+  struct MIDIRunloop * runloop = MIDIRunloopCreate();
+  struct MIDIScheduler * scheduler = MIDISchedulerCreate( NULL );
+  struct MIDIPort * port, * receiver;
+  struct MIDIClock * clock;
+  int i;
+
+  ASSERT_NOT_EQUAL( runloop, NULL, "Could not create runloop." );
+  ASSERT_NOT_EQUAL( scheduler, NULL, "Could not create scheduler." );
+  ASSERT_NO_ERROR( MIDIRunloopAddScheduler( runloop, scheduler ), "Could not add scheduler to runloop." );
+  ASSERT_NO_ERROR( MIDISchedulerGetClock( scheduler, &clock ), "Could not get scheduler clock." );
+  ASSERT_NO_ERROR( MIDISchedulerGetPort( scheduler, &port ), "Could not get scheduler port." );
+  receiver = MIDIPortCreate( "receiver", MIDI_PORT_IN, &_scheduled_count, &_scheduled_receive );
+  ASSERT_NO_ERROR( MIDIPortConnect( port, receiver ), "Could not connect receiver." );
+
+  _scheduled_count = 0;
+  ASSERT_NO_ERROR( _schedule_note( scheduler, clock, 64, 5 ), "Could not schedule message." );
+  ASSERT_NO_ERROR( _schedule_note( scheduler, clock, 65, 2 ), "Could not schedule message." );
+  for( i=0; i<100 && _scheduled_count < 2; i++ ) {
+    ASSERT_NO_ERROR( MIDIRunloopStep( runloop ), "Could not step through runloop." );
+  }
+  ASSERT_EQUAL( _scheduled_count, 2, "Runloop did not send scheduled messages." );
+  ASSERT_EQUAL( _scheduled_keys[0], 65, "Messages were not sent in timestamp order." );
+  ASSERT_EQUAL( _scheduled_keys[1], 64, "Messages were not sent in timestamp order." );
+
+  MIDIPortRelease( receiver );
+  MIDIRunloopRemoveScheduler( runloop, scheduler );
+  MIDISchedulerRelease( scheduler );
+  MIDIRunloopRelease( runloop );
+  return 0;
+}
@@ -0,0 +1,172 @@
+#include "test.h"
+#include "midi/port.h"
+#include "midi/clock.h"
+#include "midi/device.h"
+#include "midi/message.h"
+#include "midi/scheduler.h"
+#include "midi/smf.h"
+#include "midi/sequence_player.h"
+
+static unsigned char _file[] = {
+  'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 1, 0, 2, 0, 96,
+  /* tempo track, 120 bpm and 240 bpm from tick 96 */
+  'M', 'T', 'r', 'k', 0, 0, 0, 18,
+  0x00, 0xff, 0x51, 0x03, 0x07, 0xa1, 0x20,
+  0x60, 0xff, 0x51, 0x03, 0x03, 0xd0, 0x90,
+  0x00, 0xff, 0x2f, 0x00,
+  /* volume and program, two notes, volume change in between */
+  'M', 'T', 'r', 'k', 0, 0, 0, 26,
+  0x00, 0xb0, 0x07, 0x64,
+  0x00, 0xc0, 0x05,
+  0x30, 0x90, 0x3c, 0x40,
+  0x30, 0xb0, 0x07, 0x32,
+  0x30, 0x90, 0x3c, 0x00,
+  0x30, 0x40, 0x40,
+  0x60, 0xff, 0x2f, 0x00
+};
+
+static MIDIStatus _received_status[8];
+static MIDIValue  _received_value[8];
+static int _received_count = 0;
+
+static int _receive( void * target, void * source, struct MIDITypeSpec * type, void * data ) {
+  MIDIStatus status;
+  MIDIValue value = 0;
+  if( type == MIDIMessageType && _received_count < 8 ) {
+    MIDIMessageGetStatus( data, &status );
+    switch( status ) {
+      case MIDI_STATUS_CONTROL_CHANGE:
+        MIDIMessageGet( data, MIDI_VALUE, sizeof(MIDIValue), &value );
+        break;
+      case MIDI_STATUS_PROGRAM_CHANGE:
+        MIDIMessageGet( data, MIDI_PROGRAM, sizeof(MIDIProgram), &value );
+        break;
+      case MIDI_STATUS_NOTE_ON:
+        MIDIMessageGet( data, MIDI_KEY, sizeof(MIDIKey), &value );
+        break;
+    }
+    _received_status[_received_count] = status;
+    _received_value[_received_count]  = value;
+    _received_count++;
+  }
+  return 0;
+}
+
+static struct MIDISequencePlayer * _player_create( struct MIDIClock * clock, struct MIDIPort ** port ) {
+  struct MIDISMFReader * reader;
+  struct MIDISequencePlayer * player;
+  struct MIDIDevice * device;
+  reader = MIDISMFReaderCreateWithBuffer( sizeof(_file), &(_file[0]) );
+  device = MIDIDeviceCreate( NULL );
+  *port  = MIDIPortCreate( "Test", MIDI_PORT_IN, &_received_count, &_receive );
+  MIDIDeviceAttachOut( device, *port );
+  player = MIDISequencePlayerCreate( reader, device, clock );
+  MIDIDeviceRelease( device );
+  MIDISMFReaderRelease( reader );
+  _received_count = 0;
+  return player;
+}
+
+/**
+ * Test that the tempo map converts between ticks and clock time.
+ */
+int test001_sequence_player( void ) {
+  struct MIDIClock * clock = MIDIClockCreate( 1000 );
+  struct MIDISequencePlayer * player;
+  struct MIDIPort * port;
+  MIDITimestamp timestamp;
+  unsigned long tick;
+
+  player = _player_create( clock, &port );
+  ASSERT_NOT_EQUAL( player, NULL, "Could not create player." );
+
+  ASSERT_NO_ERROR( MIDISequencePlayerGetTimestampForTick( player, 48, &timestamp ), "Could not convert tick." );
+  ASSERT_EQUAL( timestamp, 250, "Converted tick with wrong tempo." );
+  ASSERT_NO_ERROR( MIDISequencePlayerGetTimestampForTick( player, 192, &timestamp ), "Could not convert tick." );
+  ASSERT_EQUAL( timestamp, 750, "Did not apply tempo change." );
+  ASSERT_NO_ERROR( MIDISequencePlayerGetTickForTimestamp( player, 625, &tick ), "Could not convert time." );
+  ASSERT_EQUAL( tick, 144, "Converted time with wrong tempo." );
+  ASSERT_NO_ERROR( MIDISequencePlayerGetDuration( player, &timestamp ), "Could not get duration." );
+  ASSERT_EQUAL( timestamp, 1000, "Computed wrong duration." );
+
+  MIDISequencePlayerRelease( player );
+  MIDIPortRelease( port );
+  MIDIClockRelease( clock );
+  return 0;
+}
+
+/**
+ * Test that seeking chases the channel state and that playback
+ * resumes at the new position.
+ */
+int test002_sequence_player( void ) {
+  struct MIDIClock * clock = MIDIClockCreate( 1000 );
+  struct MIDISequencePlayer * player;
+  struct MIDIScheduler * scheduler;
+  struct MIDIPort * port;
+  MIDITimestamp now;
+
+  player = _player_create( clock, &port );
+  ASSERT_NOT_EQUAL( player, NULL, "Could not create player." );
+  MIDISequencePlayerGetScheduler( player, &scheduler );
+  MIDISequencePlayerSetLookahead( player, 2000 );
+
+  ASSERT_NO_ERROR( MIDISequencePlayerSeek( player, 600 ), "Could not seek." );
+  ASSERT_EQUAL( _received_count, 2, "Chased wrong number of messages." );
+  ASSERT_EQUAL( _received_status[0], MIDI_STATUS_CONTROL_CHANGE, "Did not chase volume." );
+  ASSERT_EQUAL( _received_value[0], 50, "Chased stale volume." );
+  ASSERT_EQUAL( _received_status[1], MIDI_STATUS_PROGRAM_CHANGE, "Did not chase program." );
+  ASSERT_EQUAL( _received_value[1], 5, "Chased wrong program." );
+
+  MIDIClockGetNow( clock, &now );
+  ASSERT_NO_ERROR( MIDISequencePlayerStart( player ), "Could not start player." );
+  ASSERT_EQUAL( _received_count, 2, "Sent messages before they were due." );
+  MIDIClockAdjust( clock, now + 500, 0 );
+  ASSERT_NO_ERROR( MIDISchedulerPoll( scheduler ), "Could not poll scheduler." );
+  ASSERT_EQUAL( _received_count, 4, "Did not play remaining notes." );
+  ASSERT_EQUAL( _received_value[2], 0x3c, "Played wrong note." );
+  ASSERT_EQUAL( _received_value[3], 0x40, "Played wrong note." );
+
+  ASSERT_NO_ERROR( MIDISequencePlayerStop( player ), "Could not stop player." );
+  ASSERT_EQUAL( _received_status[4], MIDI_STATUS_CONTROL_CHANGE, "Did not turn notes off." );
+
+  MIDISequencePlayerRelease( player );
+  MIDIPortRelease( port );
+  MIDIClockRelease( clock );
+  return 0;
+}
+
+/**
+ * Test that a loop region is repeated.
+ */
+int test003_sequence_player( void ) {
+  struct MIDIClock * clock = MIDIClockCreate( 1000 );
+  struct MIDISequencePlayer * player;
+  struct MIDIScheduler * scheduler;
+  struct MIDISchedulerStats stats;
+  struct MIDIPort * port;
+  MIDITimestamp now, position;
+
+  player = _player_create( clock, &port );
+  ASSERT_NOT_EQUAL( player, NULL, "Could not create player." );
+  MIDISequencePlayerGetScheduler( player, &scheduler );
+  MIDISequencePlayerSetLookahead( player, 300 );
+
+  ASSERT_NO_ERROR( MIDISequencePlayerSetLoop( player, 96, 192 ), "Could not set loop." );
+  ASSERT_NO_ERROR( MIDISequencePlayerSeek( player, 500 ), "Could not seek." );
+  MIDIClockGetNow( clock, &now );
+  ASSERT_NO_ERROR( MIDISequencePlayerStart( player ), "Could not start player." );
+  MIDISchedulerGetStats( scheduler, &stats );
+  ASSERT_EQUAL( stats.scheduled, 3, "Did not wrap around the loop." );
+
+  MIDIClockAdjust( clock, now + 300, 0 );
+  MIDISequencePlayerGetPosition( player, &position );
+  ASSERT_GREATER_OR_EQUAL( position, 550, "Did not wrap position." );
+  ASSERT_LESS( position, 600, "Did not wrap position." );
+
+  MIDISequencePlayerStop( player );
+  MIDISequencePlayerRelease( player );
+  MIDIPortRelease( port );
+  MIDIClockRelease( clock );
+  return 0;
+}
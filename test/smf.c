@@ -0,0 +1,299 @@
+#include <stdio.h>
+#include <unistd.h>
+#include "test.h"
+#include "midi/port.h"
+#include "midi/message.h"
+#include "midi/smf.h"
+
+static unsigned char _file[] = {
+  'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 1, 0, 2, 0, 96,
+  /* tempo track, ends at tick 100 */
+  'M', 'T', 'r', 'k', 0, 0, 0, 11,
+  0x00, 0xff, 0x51, 0x03, 0x07, 0xa1, 0x20,
+  0x64, 0xff, 0x2f, 0x00,
+  /* note, running status, system exclusive, program change */
+  'M', 'T', 'r', 'k', 0, 0, 0, 20,
+  0x00, 0x90, 0x3c, 0x40,
+  0x60, 0x3c, 0x00,
+  0x00, 0xf0, 0x03, 0x7d, 0x01, 0xf7,
+  0x10, 0xc0, 0x05,
+  0x00, 0xff, 0x2f, 0x00
+};
+
+/**
+ * Test that a cursor decodes the events of a track lazily.
+ */
+int test001_smf( void ) {
+  struct MIDISMFReader * reader;
+  struct MIDISMFCursor cursor;
+  struct MIDISMFEvent event;
+  unsigned short division;
+  size_t count;
+  int format;
+
+  reader = MIDISMFReaderCreateWithBuffer( sizeof(_file), &(_file[0]) );
+  ASSERT_NOT_EQUAL( reader, NULL, "Could not create reader." );
+  ASSERT_NO_ERROR( MIDISMFReaderGetFormat( reader, &format ), "Could not get format." );
+  ASSERT_EQUAL( format, MIDI_SMF_FORMAT_MULTIPLE_TRACKS, "Read wrong format." );
+  ASSERT_NO_ERROR( MIDISMFReaderGetDivision( reader, &division ), "Could not get division." );
+  ASSERT_EQUAL( division, 96, "Read wrong division." );
+  ASSERT_NO_ERROR( MIDISMFReaderGetTrackCount( reader, &count ), "Could not get track count." );
+  ASSERT_EQUAL( count, 2, "Indexed wrong number of tracks." );
+
+  ASSERT_NO_ERROR( MIDISMFReaderGetCursor( reader, 1, &cursor ), "Could not get cursor." );
+  ASSERT_NO_ERROR( MIDISMFCursorNext( &cursor, &event ), "Could not decode note on." );
+  ASSERT_EQUAL( event.bytes[0], 0x90, "Decoded wrong status." );
+  ASSERT_EQUAL( event.bytes[2], 0x40, "Decoded wrong velocity." );
+  ASSERT_EQUAL( event.tick, 0, "Decoded wrong tick." );
+
+  ASSERT_NO_ERROR( MIDISMFCursorNext( &cursor, &event ), "Could not decode running status." );
+  ASSERT_EQUAL( event.bytes[0], 0x90, "Did not apply running status." );
+  ASSERT_EQUAL( event.bytes[1], 0x3c, "Decoded wrong key." );
+  ASSERT_EQUAL( event.bytes[2], 0x00, "Decoded wrong velocity." );
+  ASSERT_EQUAL( event.tick, 96, "Decoded wrong tick." );
+
+  ASSERT_NO_ERROR( MIDISMFCursorNext( &cursor, &event ), "Could not decode system exclusive event." );
+  ASSERT_EQUAL( event.status, MIDI_STATUS_SYSTEM_EXCLUSIVE, "Decoded wrong status." );
+  ASSERT_EQUAL( event.size, 3, "Decoded wrong size." );
+  ASSERT_EQUAL( event.data, &(_file[51]), "Copied the payload." );
+
+  ASSERT_NO_ERROR( MIDISMFCursorNext( &cursor, &event ), "Could not decode program change." );
+  ASSERT_EQUAL( event.bytes[0], 0xc0, "Decoded wrong status." );
+  ASSERT_EQUAL( event.bytes[1], 0x05, "Decoded wrong program." );
+  ASSERT_EQUAL( event.tick, 112, "Decoded wrong tick." );
+
+  ASSERT_NO_ERROR( MIDISMFCursorNext( &cursor, &event ), "Could not decode end of track." );
+  ASSERT_EQUAL( event.status, MIDI_SMF_STATUS_META, "Decoded wrong status." );
+  ASSERT_EQUAL( event.type, MIDI_SMF_META_END_OF_TRACK, "Decoded wrong meta event." );
+  ASSERT_EQUAL( MIDISMFCursorNext( &cursor, &event ), 1, "Decoded past the end of track." );
+
+  MIDISMFReaderRelease( reader );
+  return 0;
+}
+
+/**
+ * Test that the iterator merges tracks in time order.
+ */
+int test002_smf( void ) {
+  unsigned long ticks[] = { 0, 0, 96, 96, 100, 112, 112 };
+  size_t tracks[] = { 0, 1, 1, 1, 0, 1, 1 };
+  struct MIDISMFReader * reader;
+  struct MIDISMFIterator * iterator;
+  struct MIDISMFEvent event;
+  size_t i, pass;
+
+  reader = MIDISMFReaderCreateWithBuffer( sizeof(_file), &(_file[0]) );
+  ASSERT_NOT_EQUAL( reader, NULL, "Could not create reader." );
+  iterator = MIDISMFIteratorCreate( reader );
+  ASSERT_NOT_EQUAL( iterator, NULL, "Could not create iterator." );
+  MIDISMFReaderRelease( reader );
+
+  for( pass=0; pass<2; pass++ ) {
+    for( i=0; i<sizeof(ticks)/sizeof(ticks[0]); i++ ) {
+      ASSERT_NO_ERROR( MIDISMFIteratorNext( iterator, &event ), "Could not get next event." );
+      ASSERT_EQUAL( event.tick, ticks[i], "Merged events in wrong order." );
+      ASSERT_EQUAL( event.track, tracks[i], "Merged events of the wrong track." );
+    }
+    ASSERT_NOT_EQUAL( MIDISMFIteratorNext( iterator, &event ), 0, "Merged too many events." );
+    ASSERT_NO_ERROR( MIDISMFIteratorRewind( iterator ), "Could not rewind iterator." );
+  }
+
+  MIDISMFIteratorRelease( iterator );
+  return 0;
+}
+
+/**
+ * Test that files are mapped and that events convert to messages.
+ */
+int test003_smf( void ) {
+  char path[] = "/tmp/midikit-smf-XXXXXX";
+  struct MIDISMFReader * reader;
+  struct MIDISMFCursor cursor;
+  struct MIDISMFEvent event;
+  struct MIDIMessage * message;
+  MIDIManufacturerId manufacturer_id;
+  MIDIKey key;
+  MIDITimestamp timestamp;
+  size_t size;
+  int fd;
+
+  fd = mkstemp( path );
+  ASSERT_GREATER_OR_EQUAL( fd, 0, "Could not create temporary file." );
+  ASSERT_EQUAL( write( fd, &(_file[0]), sizeof(_file) ), sizeof(_file), "Could not write temporary file." );
+  close( fd );
+  reader = MIDISMFReaderCreate( path );
+  unlink( path );
+  ASSERT_NOT_EQUAL( reader, NULL, "Could not map file." );
+
+  message = MIDIMessageCreate( MIDI_STATUS_RESET );
+  ASSERT_NO_ERROR( MIDISMFReaderGetCursor( reader, 1, &cursor ), "Could not get cursor." );
+  ASSERT_NO_ERROR( MIDISMFCursorNext( &cursor, &event ), "Could not decode note on." );
+  ASSERT_NO_ERROR( MIDISMFCursorNext( &cursor, &event ), "Could not decode note off." );
+  ASSERT_NO_ERROR( MIDISMFEventGetMessage( &event, message ), "Could not convert note." );
+  MIDIMessageGet( message, MIDI_KEY, sizeof(key), &key );
+  ASSERT_EQUAL( key, 0x3c, "Converted wrong key." );
+  MIDIMessageGetTimestamp( message, &timestamp );
+  ASSERT_EQUAL( timestamp, 96, "Converted wrong timestamp." );
+
+  ASSERT_NO_ERROR( MIDISMFCursorNext( &cursor, &event ), "Could not decode system exclusive event." );
+  ASSERT_NO_ERROR( MIDISMFEventGetMessage( &event, message ), "Could not convert system exclusive event." );
+  MIDIMessageGet( message, MIDI_MANUFACTURER_ID, sizeof(manufacturer_id), &manufacturer_id );
+  ASSERT_EQUAL( manufacturer_id, 0x7d, "Converted wrong manufacturer id." );
+  MIDIMessageGet( message, MIDI_SYSEX_SIZE, sizeof(size), &size );
+  ASSERT_EQUAL( size, 2, "Converted wrong size." );
+
+  ASSERT_NO_ERROR( MIDISMFCursorNext( &cursor, &event ), "Could not decode program change." );
+  ASSERT_NO_ERROR( MIDISMFCursorNext( &cursor, &event ), "Could not decode end of track." );
+  ASSERT_NOT_EQUAL( MIDISMFEventGetMessage( &event, message ), 0, "Converted a meta event." );
+
+  MIDIMessageRelease( message );
+  MIDISMFReaderRelease( reader );
+
+  ASSERT_EQUAL( MIDISMFReaderCreateWithBuffer( 14, &(_file[14]) ), NULL, "Accepted a file without header." );
+  return 0;
+}
+
+/* create a note on message on the first channel */
+static struct MIDIMessage * _note_on( MIDIKey key, MIDIVelocity velocity ) {
+  struct MIDIMessage * message = MIDIMessageCreate( MIDI_STATUS_NOTE_ON );
+  MIDIChannel channel = MIDI_CHANNEL_1;
+  MIDIMessageSet( message, MIDI_CHANNEL, sizeof(MIDIChannel), &channel );
+  MIDIMessageSet( message, MIDI_KEY, sizeof(MIDIKey), &key );
+  MIDIMessageSet( message, MIDI_VELOCITY, sizeof(MIDIVelocity), &velocity );
+  return message;
+}
+
+/* write a file to a temporary file and read it back */
+static struct MIDISMFReader * _write_and_read( struct MIDISMFWriter * writer ) {
+  char path[] = "/tmp/midikit-smf-XXXXXX";
+  struct MIDISMFReader * reader;
+  int fd = mkstemp( path );
+  if( fd < 0 ) return NULL;
+  if( MIDISMFWriterWrite( writer, fd ) ) {
+    close( fd );
+    unlink( path );
+    return NULL;
+  }
+  close( fd );
+  reader = MIDISMFReaderCreate( path );
+  unlink( path );
+  return reader;
+}
+
+/**
+ * Test that the writer uses running status and back-patches lengths.
+ */
+int test004_smf( void ) {
+  unsigned char sysex[] = { 0xf0, 0x7d, 0x01, 0x02, 0xf7 };
+  unsigned char tempo[] = { 0x07, 0xa1, 0x20 };
+  struct MIDISMFWriter * writer;
+  struct MIDISMFReader * reader;
+  struct MIDISMFCursor cursor;
+  struct MIDISMFEvent event;
+  struct MIDIMessage * message;
+  size_t track, count, read;
+
+  writer = MIDISMFWriterCreate( MIDI_SMF_FORMAT_MULTIPLE_TRACKS, 96 );
+  ASSERT_NOT_EQUAL( writer, NULL, "Could not create writer." );
+  ASSERT_NO_ERROR( MIDISMFWriterAddTrack( writer, &track ), "Could not add tempo track." );
+  ASSERT_NO_ERROR( MIDISMFWriterAppendMeta( writer, track, 0, MIDI_SMF_META_SET_TEMPO, sizeof(tempo), &(tempo[0]) ),
+                   "Could not append tempo." );
+  ASSERT_NO_ERROR( MIDISMFWriterAddTrack( writer, &track ), "Could not add track." );
+  ASSERT_EQUAL( track, 1, "Added track with wrong index." );
+
+  message = _note_on( 0x3c, 0x40 );
+  ASSERT_NO_ERROR( MIDISMFWriterAppendMessage( writer, track, 0, message ), "Could not append note on." );
+  MIDIMessageRelease( message );
+  message = _note_on( 0x3c, 0 );
+  ASSERT_NO_ERROR( MIDISMFWriterAppendMessage( writer, track, 96, message ), "Could not append note off." );
+  MIDIMessageRelease( message );
+  message = MIDIMessageCreate( MIDI_STATUS_RESET );
+  ASSERT_NO_ERROR( MIDIMessageDecode( message, sizeof(sysex), &(sysex[0]), &read ), "Could not decode sysex." );
+  ASSERT_NO_ERROR( MIDISMFWriterAppendMessage( writer, track, 96, message ), "Could not append sysex." );
+  MIDIMessageRelease( message );
+
+  reader = _write_and_read( writer );
+  ASSERT_NOT_EQUAL( reader, NULL, "Could not read written file." );
+  ASSERT_NO_ERROR( MIDISMFWriterGetTrackCount( writer, &count ), "Could not get track count." );
+  ASSERT_EQUAL( count, 2, "Wrote wrong number of tracks." );
+  ASSERT_ERROR( MIDISMFWriterAddTrack( writer, NULL ), "Added a track to a finalized file." );
+  MIDISMFWriterRelease( writer );
+
+  ASSERT_NO_ERROR( MIDISMFReaderGetTrackCount( reader, &count ), "Could not get track count." );
+  ASSERT_EQUAL( count, 2, "Read wrong number of tracks." );
+  ASSERT_NO_ERROR( MIDISMFReaderGetCursor( reader, 1, &cursor ), "Could not get cursor." );
+  /* note on (4), running status (3), sysex (7) and end of track (4) */
+  ASSERT_EQUAL( cursor.size, 18, "Did not compress running status." );
+  ASSERT_NO_ERROR( MIDISMFCursorNext( &cursor, &event ), "Could not decode note on." );
+  ASSERT_NO_ERROR( MIDISMFCursorNext( &cursor, &event ), "Could not decode note off." );
+  ASSERT_EQUAL( event.tick, 96, "Wrote wrong delta time." );
+  ASSERT_EQUAL( event.bytes[2], 0, "Wrote wrong velocity." );
+  ASSERT_NO_ERROR( MIDISMFCursorNext( &cursor, &event ), "Could not decode sysex." );
+  ASSERT_EQUAL( event.status, MIDI_STATUS_SYSTEM_EXCLUSIVE, "Wrote wrong status." );
+  ASSERT_EQUAL( event.size, 4, "Wrote wrong sysex size." );
+  ASSERT_EQUAL( event.data[3], 0xf7, "Did not keep the terminator." );
+  ASSERT_NO_ERROR( MIDISMFCursorNext( &cursor, &event ), "Could not decode end of track." );
+  ASSERT_EQUAL( event.type, MIDI_SMF_META_END_OF_TRACK, "Did not end the track." );
+  MIDISMFReaderRelease( reader );
+  return 0;
+}
+
+/**
+ * Test that a streaming writer flushes large recordings and patches the
+ * track length, and that messages sent to it's port are recorded.
+ */
+int test005_smf( void ) {
+  char path[] = "/tmp/midikit-smf-XXXXXX";
+  struct MIDISMFWriter * writer;
+  struct MIDISMFReader * reader;
+  struct MIDISMFCursor cursor;
+  struct MIDISMFEvent event;
+  struct MIDIMessage * message;
+  struct MIDIClock * clock;
+  struct MIDIPort * port;
+  size_t i, count = 0;
+  int fd, format;
+
+  fd = mkstemp( path );
+  ASSERT_GREATER_OR_EQUAL( fd, 0, "Could not create temporary file." );
+  writer = MIDISMFWriterCreateStreaming( fd, 96 );
+  ASSERT_NOT_EQUAL( writer, NULL, "Could not create streaming writer." );
+  ASSERT_ERROR( MIDISMFWriterAddTrack( writer, NULL ), "Added a track to a streaming writer." );
+
+  clock = MIDIClockCreate( 1000 );
+  ASSERT_NO_ERROR( MIDISMFWriterSetClock( writer, clock ), "Could not set clock." );
+  MIDIClockRelease( clock );
+  ASSERT_NO_ERROR( MIDISMFWriterGetPort( writer, &port ), "Could not get port." );
+  message = _note_on( 0x3c, 0x40 );
+  MIDIMessageSetTimestamp( message, 1000 );
+  ASSERT_NO_ERROR( MIDIPortReceive( port, MIDIMessageType, message ), "Could not record message." );
+  MIDIMessageSetTimestamp( message, 1500 );
+  ASSERT_NO_ERROR( MIDIPortReceive( port, MIDIMessageType, message ), "Could not record message." );
+  MIDIMessageRelease( message );
+
+  /* more than fits into the buffer */
+  for( i=0; i<30000; i++ ) {
+    message = _note_on( i & 0x7f, ( i & 1 ) ? 0 : 0x40 );
+    ASSERT_NO_ERROR( MIDISMFWriterAppendMessage( writer, 0, 96 + i, message ), "Could not append message." );
+    MIDIMessageRelease( message );
+  }
+  ASSERT_NO_ERROR( MIDISMFWriterFinalize( writer ), "Could not finalize writer." );
+  MIDISMFWriterRelease( writer );
+  close( fd );
+
+  reader = MIDISMFReaderCreate( path );
+  unlink( path );
+  ASSERT_NOT_EQUAL( reader, NULL, "Could not read streamed file." );
+  ASSERT_NO_ERROR( MIDISMFReaderGetFormat( reader, &format ), "Could not get format." );
+  ASSERT_EQUAL( format, MIDI_SMF_FORMAT_SINGLE_TRACK, "Streamed wrong format." );
+  ASSERT_NO_ERROR( MIDISMFReaderGetCursor( reader, 0, &cursor ), "Could not get cursor." );
+  ASSERT_NO_ERROR( MIDISMFCursorNext( &cursor, &event ), "Could not decode recorded message." );
+  ASSERT_EQUAL( event.tick, 0, "Recorded first message at wrong tick." );
+  ASSERT_NO_ERROR( MIDISMFCursorNext( &cursor, &event ), "Could not decode recorded message." );
+  ASSERT_EQUAL( event.tick, 96, "Recorded message at wrong tick." );
+  while( MIDISMFCursorNext( &cursor, &event ) == 0 ) count++;
+  ASSERT_EQUAL( count, 30001, "Streamed wrong number of events." );
+  ASSERT_EQUAL( event.type, MIDI_SMF_META_END_OF_TRACK, "Did not end the track." );
+  MIDISMFReaderRelease( reader );
+  return 0;
+}
@@ -0,0 +1,168 @@
+#include <string.h>
+#include "test.h"
+#include "midi/port.h"
+#include "midi/message.h"
+#include "midi/device.h"
+#include "midi/controller.h"
+#include "midi/state_tracker.h"
+
+static struct MIDICompactMessage _messages[MIDI_STATE_TRACKER_MAX_SNAPSHOT];
+
+/**
+ * Test that held notes are tracked and that note offs are emitted
+ * for exactly the held notes, grouped by channel.
+ */
+int test001_state_tracker( void ) {
+  struct MIDIStateTracker * tracker = MIDIStateTrackerCreate();
+  MIDIVelocity velocity;
+  size_t count;
+  ASSERT_NOT_EQUAL( tracker, NULL, "Could not create state tracker." );
+
+  ASSERT_NO_ERROR( MIDIStateTrackerNoteOn( tracker, MIDI_CHANNEL_3, 100, 90 ), "Could not record note on." );
+  ASSERT_NO_ERROR( MIDIStateTrackerNoteOn( tracker, MIDI_CHANNEL_1, 60, 64 ), "Could not record note on." );
+  ASSERT_NO_ERROR( MIDIStateTrackerNoteOn( tracker, MIDI_CHANNEL_1, 3, 10 ), "Could not record note on." );
+  ASSERT_NO_ERROR( MIDIStateTrackerNoteOn( tracker, MIDI_CHANNEL_1, 60, 70 ), "Could not record note on." );
+  ASSERT_NO_ERROR( MIDIStateTrackerNoteOn( tracker, MIDI_CHANNEL_16, 127, 1 ), "Could not record note on." );
+  ASSERT_NO_ERROR( MIDIStateTrackerNoteOn( tracker, MIDI_CHANNEL_16, 127, 0 ), "Could not record note on." );
+  ASSERT_NO_ERROR( MIDIStateTrackerNoteOff( tracker, MIDI_CHANNEL_2, 5 ), "Could not record note off." );
+
+  ASSERT_NO_ERROR( MIDIStateTrackerGetActiveNotes( tracker, &count ), "Could not get active notes." );
+  ASSERT_EQUAL( count, 3, "Tracked wrong number of notes." );
+  ASSERT_NO_ERROR( MIDIStateTrackerGetNote( tracker, MIDI_CHANNEL_1, 60, &velocity ), "Could not get note." );
+  ASSERT_EQUAL( velocity, 70, "Tracked wrong velocity." );
+  ASSERT_NO_ERROR( MIDIStateTrackerGetNote( tracker, MIDI_CHANNEL_16, 127, &velocity ), "Could not get note." );
+  ASSERT_EQUAL( velocity, 0, "Did not end note with zero velocity note on." );
+
+  ASSERT_NO_ERROR( MIDIStateTrackerEmitNotesOff( tracker, MIDI_STATE_TRACKER_MAX_NOTES, &(_messages[0]), &count ),
+                   "Could not emit note offs." );
+  ASSERT_EQUAL( count, 3, "Emitted wrong number of note offs." );
+  ASSERT_EQUAL( _messages[0].bytes[0], 0x80, "Emitted wrong status." );
+  ASSERT_EQUAL( _messages[0].bytes[1], 3, "Emitted wrong key." );
+  ASSERT_EQUAL( _messages[1].bytes[1], 60, "Emitted wrong key." );
+  ASSERT_EQUAL( _messages[2].bytes[0], 0x82, "Emitted wrong status." );
+  ASSERT_EQUAL( _messages[2].bytes[1], 100, "Emitted wrong key." );
+  ASSERT_EQUAL( _messages[2].bytes[2], 0, "Emitted wrong velocity." );
+
+  ASSERT_EQUAL( MIDIStateTrackerEmitNotesOff( tracker, 2, &(_messages[0]), &count ), 1, "Did not report full buffer." );
+  ASSERT_EQUAL( count, 2, "Emitted wrong number of note offs." );
+
+  ASSERT_NO_ERROR( MIDIStateTrackerUpdate( tracker, 3, &(_messages[0]) ), "Could not record note offs." );
+  ASSERT_NO_ERROR( MIDIStateTrackerGetActiveNotes( tracker, &count ), "Could not get active notes." );
+  ASSERT_EQUAL( count, 0, "Did not end notes." );
+  ASSERT_NO_ERROR( MIDIStateTrackerEmitNotesOff( tracker, MIDI_STATE_TRACKER_MAX_NOTES, &(_messages[0]), &count ),
+                   "Could not emit note offs." );
+  ASSERT_EQUAL( count, 0, "Emitted note offs without held notes." );
+
+  MIDIStateTrackerRelease( tracker );
+  return 0;
+}
+
+/**
+ * Test that a snapshot restores controls before programs and notes and
+ * that channel mode messages are applied instead of recorded.
+ */
+int test002_state_tracker( void ) {
+  struct MIDIStateTracker * tracker = MIDIStateTrackerCreate();
+  MIDILongValue pitch;
+  MIDIProgram program;
+  MIDIValue value;
+  size_t count;
+  ASSERT_NOT_EQUAL( tracker, NULL, "Could not create state tracker." );
+
+  ASSERT_EQUAL( MIDIStateTrackerGetProgram( tracker, MIDI_CHANNEL_1, &program ), 1, "Reported unknown program." );
+  ASSERT_EQUAL( MIDIStateTrackerGetControl( tracker, MIDI_CHANNEL_1, 7, &value ), 1, "Reported unknown control." );
+  ASSERT_NO_ERROR( MIDIStateTrackerProgramChange( tracker, MIDI_CHANNEL_2, 42 ), "Could not record program change." );
+  ASSERT_NO_ERROR( MIDIStateTrackerControlChange( tracker, MIDI_CHANNEL_2, MIDI_CONTROL_CHANNEL_VOLUME, 100 ),
+                   "Could not record control change." );
+  ASSERT_NO_ERROR( MIDIStateTrackerControlChange( tracker, MIDI_CHANNEL_2, MIDI_CONTROL_BANK_SELECT, 1 ),
+                   "Could not record control change." );
+  ASSERT_NO_ERROR( MIDIStateTrackerPitchWheelChange( tracker, MIDI_CHANNEL_2, 0x2345 ), "Could not record pitch wheel." );
+  ASSERT_NO_ERROR( MIDIStateTrackerNoteOn( tracker, MIDI_CHANNEL_2, 64, 99 ), "Could not record note on." );
+  ASSERT_NO_ERROR( MIDIStateTrackerNoteOn( tracker, MIDI_CHANNEL_5, 64, 99 ), "Could not record note on." );
+  ASSERT_NO_ERROR( MIDIStateTrackerControlChange( tracker, MIDI_CHANNEL_5, MIDI_CONTROL_ALL_NOTES_OFF, 0 ),
+                   "Could not record all notes off." );
+
+  ASSERT_NO_ERROR( MIDIStateTrackerGetControl( tracker, MIDI_CHANNEL_2, MIDI_CONTROL_CHANNEL_VOLUME, &value ),
+                   "Could not get control." );
+  ASSERT_EQUAL( value, 100, "Tracked wrong control value." );
+  ASSERT_NO_ERROR( MIDIStateTrackerEmitSnapshot( tracker, MIDI_STATE_TRACKER_MAX_SNAPSHOT, &(_messages[0]), &count ),
+                   "Could not emit snapshot." );
+  ASSERT_EQUAL( count, 5, "Emitted wrong number of messages." );
+  ASSERT_EQUAL( _messages[0].bytes[0], 0xb1, "Did not emit controls first." );
+  ASSERT_EQUAL( _messages[0].bytes[1], MIDI_CONTROL_BANK_SELECT, "Did not emit bank select first." );
+  ASSERT_EQUAL( _messages[1].bytes[1], MIDI_CONTROL_CHANNEL_VOLUME, "Emitted wrong control." );
+  ASSERT_EQUAL( _messages[1].bytes[2], 100, "Emitted wrong control value." );
+  ASSERT_EQUAL( _messages[2].bytes[0], 0xc1, "Did not emit program change." );
+  ASSERT_EQUAL( _messages[2].bytes[1], 42, "Emitted wrong program." );
+  ASSERT_EQUAL( _messages[3].bytes[0], 0xe1, "Did not emit pitch wheel change." );
+  ASSERT_EQUAL( MIDI_LONG_VALUE( _messages[3].bytes[2], _messages[3].bytes[1] ), 0x2345, "Emitted wrong pitch." );
+  ASSERT_EQUAL( _messages[4].bytes[0], 0x91, "Did not emit note on." );
+  ASSERT_EQUAL( _messages[4].bytes[2], 99, "Emitted wrong velocity." );
+
+  ASSERT_NO_ERROR( MIDIStateTrackerControlChange( tracker, MIDI_CHANNEL_2, MIDI_CONTROL_RESET_ALL_CONTROLLERS, 0 ),
+                   "Could not record reset all controllers." );
+  ASSERT_NO_ERROR( MIDIStateTrackerGetPitchWheel( tracker, MIDI_CHANNEL_2, &pitch ), "Could not get pitch wheel." );
+  ASSERT_EQUAL( pitch, 0x2000, "Did not center pitch wheel." );
+  ASSERT_NO_ERROR( MIDIStateTrackerEmitSnapshot( tracker, MIDI_STATE_TRACKER_MAX_SNAPSHOT, &(_messages[0]), &count ),
+                   "Could not emit snapshot." );
+  ASSERT_EQUAL( count, 2, "Emitted reset controls." );
+
+  ASSERT_NO_ERROR( MIDIStateTrackerReset( tracker ), "Could not reset state tracker." );
+  ASSERT_NO_ERROR( MIDIStateTrackerEmitSnapshot( tracker, MIDI_STATE_TRACKER_MAX_SNAPSHOT, &(_messages[0]), &count ),
+                   "Could not emit snapshot." );
+  ASSERT_EQUAL( count, 0, "Emitted state after reset." );
+  MIDIStateTrackerRelease( tracker );
+  return 0;
+}
+
+/**
+ * Test that a device updates its state trackers when it receives
+ * and sends messages.
+ */
+int test003_state_tracker( void ) {
+  struct MIDIDevice * device = MIDIDeviceCreate( NULL );
+  struct MIDIStateTracker * in = MIDIStateTrackerCreate();
+  struct MIDIStateTracker * out = MIDIStateTrackerCreate();
+  struct MIDIStateTracker * tracker;
+  struct MIDICompactMessage batch[3];
+  MIDIVelocity velocity;
+  MIDIValue value;
+  size_t count;
+
+  ASSERT_NO_ERROR( MIDIDeviceSetStateTracker( device, MIDI_PORT_IN, in ), "Could not set input state tracker." );
+  ASSERT_NO_ERROR( MIDIDeviceSetStateTracker( device, MIDI_PORT_OUT, out ), "Could not set output state tracker." );
+  ASSERT_NO_ERROR( MIDIDeviceGetStateTracker( device, MIDI_PORT_OUT, &tracker ), "Could not get state tracker." );
+  ASSERT_EQUAL( tracker, out, "Returned wrong state tracker." );
+  MIDIStateTrackerRelease( in );
+  MIDIStateTrackerRelease( out );
+
+  ASSERT_NO_ERROR( MIDIDeviceReceiveNoteOn( device, MIDI_CHANNEL_1, 60, 80 ), "Could not receive note on." );
+  ASSERT_NO_ERROR( MIDIDeviceSendNoteOn( device, MIDI_CHANNEL_4, 61, 81 ), "Could not send note on." );
+  ASSERT_NO_ERROR( MIDIDeviceSendControlChange( device, MIDI_CHANNEL_4, MIDI_CONTROL_PAN, 12 ), "Could not send control change." );
+
+  memset( &(batch[0]), 0, sizeof(batch) );
+  batch[0].bytes[0] = 0xb0; batch[0].bytes[1] = MIDI_CONTROL_MODULATION_WHEEL; batch[0].bytes[2] = 33;
+  batch[1].bytes[0] = 0x90; batch[1].bytes[1] = 62; batch[1].bytes[2] = 82;
+  batch[2].bytes[0] = 0x80; batch[2].bytes[1] = 60; batch[2].bytes[2] = 0;
+  ASSERT_NO_ERROR( MIDIDeviceReceiveBatch( device, 0, 3, &(batch[0]), NULL ), "Could not receive batch." );
+
+  ASSERT_NO_ERROR( MIDIStateTrackerGetNote( in, MIDI_CHANNEL_1, 62, &velocity ), "Could not get note." );
+  ASSERT_EQUAL( velocity, 82, "Did not track received note." );
+  ASSERT_NO_ERROR( MIDIStateTrackerGetActiveNotes( in, &count ), "Could not get active notes." );
+  ASSERT_EQUAL( count, 1, "Did not track received note off." );
+  ASSERT_NO_ERROR( MIDIStateTrackerGetControl( in, MIDI_CHANNEL_1, MIDI_CONTROL_MODULATION_WHEEL, &value ),
+                   "Could not get control." );
+  ASSERT_EQUAL( value, 33, "Did not track received control change." );
+  ASSERT_NO_ERROR( MIDIStateTrackerGetNote( out, MIDI_CHANNEL_4, 61, &velocity ), "Could not get note." );
+  ASSERT_EQUAL( velocity, 81, "Did not track sent note." );
+  ASSERT_NO_ERROR( MIDIStateTrackerGetControl( out, MIDI_CHANNEL_4, MIDI_CONTROL_PAN, &value ), "Could not get control." );
+  ASSERT_EQUAL( value, 12, "Did not track sent control change." );
+  ASSERT_NO_ERROR( MIDIStateTrackerGetActiveNotes( out, &count ), "Could not get active notes." );
+  ASSERT_EQUAL( count, 1, "Tracked received notes as sent." );
+
+  ASSERT_NO_ERROR( MIDIDeviceSetStateTracker( device, MIDI_PORT_IN | MIDI_PORT_OUT, NULL ), "Could not remove state trackers." );
+  ASSERT_NO_ERROR( MIDIDeviceGetStateTracker( device, MIDI_PORT_IN, &tracker ), "Could not get state tracker." );
+  ASSERT_EQUAL( tracker, NULL, "Did not remove state tracker." );
+  MIDIDeviceRelease( device );
+  return 0;
+}
@@ -0,0 +1,143 @@
+#include "test.h"
+#include "midi/message.h"
+#include "midi/sysex.h"
+
+static size_t _chunk_size  = 0;
+static int    _chunk_flags = 0;
+static int    _chunks      = 0;
+
+static int _chunk( void * info, int flags, size_t size, unsigned char * data ) {
+  _chunk_size  += size;
+  _chunk_flags |= flags;
+  _chunks++;
+  return 0;
+}
+
+/**
+ * Test that system exclusive messages decoded in pieces are reassembled.
+ */
+int test001_sysex( void ) {
+  unsigned char first[]  = { 0xf0, 0x7d, 1, 2 };
+  unsigned char second[] = { 0xf8, 3, 4, 0xf7 };
+  struct MIDICompactMessage compact[4];
+  struct MIDISysExAssembler * assembler;
+  struct MIDIMessage * message;
+  MIDIRunningStatus status = 0;
+  MIDIManufacturerId manufacturer_id;
+  size_t i, count, read, size;
+  unsigned char * data;
+
+  assembler = MIDISysExAssemblerCreate( 0 );
+  ASSERT_NOT_EQUAL( assembler, NULL, "Could not create assembler." );
+
+  ASSERT_NO_ERROR( MIDIMessageDecodeStream( sizeof(first), &(first[0]), &status, 4, &(compact[0]), &count, &read ),
+                   "Could not decode first piece." );
+  ASSERT_EQUAL( count, 1, "Decoded wrong number of segments." );
+  ASSERT_NO_ERROR( MIDISysExAssemblerAppendCompact( assembler, &(compact[0]), &(first[0]), &message ),
+                   "Could not append first segment." );
+  ASSERT_EQUAL( message, NULL, "Completed an unfinished message." );
+
+  /* the clock message interrupts the segment and is ignored */
+  ASSERT_NO_ERROR( MIDIMessageDecodeStream( sizeof(second), &(second[0]), &status, 4, &(compact[0]), &count, &read ),
+                   "Could not decode second piece." );
+  message = NULL;
+  for( i=0; i<count && message == NULL; i++ ) {
+    ASSERT_NO_ERROR( MIDISysExAssemblerAppendCompact( assembler, &(compact[i]), &(second[0]), &message ),
+                     "Could not append segment." );
+  }
+  ASSERT_NOT_EQUAL( message, NULL, "Did not complete the message." );
+
+  MIDIMessageGet( message, MIDI_MANUFACTURER_ID, sizeof(manufacturer_id), &manufacturer_id );
+  ASSERT_EQUAL( manufacturer_id, 0x7d, "Assembled wrong manufacturer id." );
+  MIDIMessageGet( message, MIDI_SYSEX_SIZE, sizeof(size), &size );
+  ASSERT_EQUAL( size, 5, "Assembled wrong size." );
+  MIDIMessageGet( message, MIDI_SYSEX_DATA, sizeof(data), &data );
+  ASSERT_EQUAL( data[0], 1, "Assembled wrong data." );
+  ASSERT_EQUAL( data[3], 4, "Assembled wrong data." );
+  ASSERT_EQUAL( data[4], 0xf7, "Did not keep the terminator." );
+
+  MIDIMessageRelease( message );
+  MIDISysExAssemblerRelease( assembler );
+  return 0;
+}
+
+/**
+ * Test that segments are streamed to the chunk callback and that
+ * messages larger than the maximum size are cancelled.
+ */
+int test002_sysex( void ) {
+  unsigned char data[100];
+  struct MIDISysExAssembler * assembler;
+  struct MIDIMessage * message;
+  size_t i, size;
+
+  for( i=0; i<sizeof(data); i++ ) data[i] = i & 0x7f;
+  assembler = MIDISysExAssemblerCreate( 250 );
+  ASSERT_NOT_EQUAL( assembler, NULL, "Could not create assembler." );
+  ASSERT_NO_ERROR( MIDISysExAssemblerSetChunkCallback( assembler, NULL, &_chunk ), "Could not set callback." );
+
+  ASSERT_NO_ERROR( MIDISysExAssemblerAppend( assembler, MIDI_COMPACT_SYSEX_START, 100, &(data[0]), &message ),
+                   "Could not append first segment." );
+  ASSERT_NO_ERROR( MIDISysExAssemblerAppend( assembler, MIDI_COMPACT_SYSEX_END, 100, &(data[0]), &message ),
+                   "Could not append last segment." );
+  ASSERT_EQUAL( message, NULL, "Buffered a streamed message." );
+  ASSERT_EQUAL( _chunks, 2, "Streamed wrong number of chunks." );
+  ASSERT_EQUAL( _chunk_size, 200, "Streamed wrong number of bytes." );
+  ASSERT_EQUAL( _chunk_flags, MIDI_COMPACT_SYSEX_START | MIDI_COMPACT_SYSEX_END, "Streamed wrong flags." );
+
+  _chunk_flags = 0;
+  ASSERT_NO_ERROR( MIDISysExAssemblerAppend( assembler, MIDI_COMPACT_SYSEX_START, 100, &(data[0]), NULL ),
+                   "Could not append first segment." );
+  ASSERT_NO_ERROR( MIDISysExAssemblerAppend( assembler, 0, 100, &(data[0]), NULL ), "Could not append segment." );
+  ASSERT_NO_ERROR( MIDISysExAssemblerGetSize( assembler, &size ), "Could not get size." );
+  ASSERT_EQUAL( size, 200, "Assembler has wrong size." );
+  ASSERT_ERROR( MIDISysExAssemblerAppend( assembler, 0, 100, &(data[0]), NULL ), "Appended past the maximum size." );
+  ASSERT( _chunk_flags & MIDI_COMPACT_SYSEX_CANCEL, "Did not cancel the streamed message." );
+
+  /* segments of the cancelled message are ignored */
+  ASSERT_NO_ERROR( MIDISysExAssemblerAppend( assembler, MIDI_COMPACT_SYSEX_END, 10, &(data[0]), NULL ),
+                   "Could not ignore segment." );
+  ASSERT_EQUAL( _chunks, 5, "Streamed segments of a cancelled message." );
+
+  MIDISysExAssemblerRelease( assembler );
+  return 0;
+}
+
+/**
+ * Test that an assembler with a pool reuses the buffers of the messages
+ * it delivered.
+ */
+int test003_sysex( void ) {
+  unsigned char data[] = { 0x7d, 1, 2, 3 };
+  struct MIDIMessagePool * pool;
+  struct MIDIMessagePoolStats stats;
+  struct MIDISysExAssembler * assembler;
+  struct MIDISysExBuffer * first, * second;
+  struct MIDIMessage * message;
+
+  pool = MIDIMessagePoolCreate( 4 );
+  ASSERT_NOT_EQUAL( pool, NULL, "Could not create pool." );
+  assembler = MIDISysExAssemblerCreate( 0 );
+  ASSERT_NOT_EQUAL( assembler, NULL, "Could not create assembler." );
+  ASSERT_NO_ERROR( MIDISysExAssemblerSetPool( assembler, pool ), "Could not set pool." );
+
+  ASSERT_NO_ERROR( MIDISysExAssemblerAppend( assembler, MIDI_COMPACT_SYSEX_START | MIDI_COMPACT_SYSEX_END,
+                                             sizeof(data), &(data[0]), &message ), "Could not append message." );
+  ASSERT_NOT_EQUAL( message, NULL, "Did not complete the message." );
+  ASSERT_NO_ERROR( MIDIMessageGetSysExBuffer( message, &first, NULL ), "Could not get buffer." );
+  ASSERT_NOT_EQUAL( first, NULL, "Message references no buffer." );
+  MIDIMessageRelease( message );
+
+  ASSERT_NO_ERROR( MIDISysExAssemblerAppend( assembler, MIDI_COMPACT_SYSEX_START | MIDI_COMPACT_SYSEX_END,
+                                             sizeof(data), &(data[0]), &message ), "Could not append message." );
+  ASSERT_NOT_EQUAL( message, NULL, "Did not complete the message." );
+  ASSERT_NO_ERROR( MIDIMessageGetSysExBuffer( message, &second, NULL ), "Could not get buffer." );
+  ASSERT_EQUAL( second, first, "Did not reuse the released buffer." );
+  ASSERT_NO_ERROR( MIDIMessagePoolGetStats( pool, &stats ), "Could not get pool stats." );
+  ASSERT_EQUAL( stats.hits, 2, "Did not take the messages from the pool." );
+  MIDIMessageRelease( message );
+
+  MIDISysExAssemblerRelease( assembler );
+  MIDIMessagePoolRelease( pool );
+  return 0;
+}
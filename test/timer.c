@@ -0,0 +1,132 @@
+#include "test.h"
+#include "midi/port.h"
+#include "midi/clock.h"
+#include "midi/device.h"
+#include "midi/message.h"
+#include "midi/runloop.h"
+#include "midi/timer.h"
+
+#define TIMER_TEST_CLOCKS 48
+
+static MIDITimestamp _clock_timestamp[TIMER_TEST_CLOCKS];
+static int _clock_count = 0;
+
+static int _receive( void * target, void * source, struct MIDITypeSpec * type, void * data ) {
+  MIDIStatus status;
+  if( type != MIDIMessageType ) return 0;
+  MIDIMessageGetStatus( data, &status );
+  if( status == MIDI_STATUS_TIMING_CLOCK && _clock_count < TIMER_TEST_CLOCKS ) {
+    MIDIMessageGetTimestamp( data, &(_clock_timestamp[_clock_count++]) );
+  }
+  return 0;
+}
+
+/* feed clocks at a tempo with a reproducible jitter of up to +/- 5% of the period */
+static int _feed( struct MIDITimer * timer, MIDITimestamp * t, double period, int n ) {
+  unsigned long seed = 4711;
+  int i, jitter;
+  for( i=0; i<n; i++ ) {
+    seed   = seed * 1103515245 + 12345;
+    jitter = (int) ( ( (long) ( ( seed >> 16 ) % 201 ) - 100 ) * period / 2000 );
+    *t += period;
+    if( MIDITimerReceiveRealTime( timer, NULL, MIDI_STATUS_TIMING_CLOCK, *t + jitter ) ) return 1;
+  }
+  return 0;
+}
+
+/**
+ * Test that the follower estimates tempo and phase from jittery clocks
+ * and keeps track of the song position.
+ */
+int test001_timer( void ) {
+  struct MIDIClock * clock = MIDIClockCreate( MIDI_SAMPLING_RATE_48KHZ );
+  struct MIDITimer * timer = MIDITimerCreate( NULL );
+  MIDITimestamp t = 0;
+  MIDILongValue position;
+  MIDIBoolean running;
+  double bpm, phase;
+
+  ASSERT_NOT_EQUAL( timer, NULL, "Could not create timer." );
+  ASSERT_NO_ERROR( MIDITimerSetClock( timer, clock ), "Could not set timer clock." );
+  MIDIClockRelease( clock );
+
+  ASSERT_NO_ERROR( MIDITimerReceiveRealTime( timer, NULL, MIDI_STATUS_START, t ), "Could not receive start." );
+  ASSERT_NO_ERROR( _feed( timer, &t, 1200.0, 480 ), "Could not receive clocks." );
+  ASSERT_NO_ERROR( MIDITimerGetTempo( timer, &bpm ), "Could not get tempo." );
+  ASSERT_NEAR( bpm, 100.0, "Estimated wrong tempo." );
+  ASSERT_NO_ERROR( MIDITimerGetSongPosition( timer, &position ), "Could not get song position." );
+  ASSERT_EQUAL( position, 80, "Counted wrong song position." );
+  ASSERT_NO_ERROR( MIDITimerGetPhase( timer, t + 600, &phase ), "Could not get phase." );
+  ASSERT_GREATER( phase, 0.95, "Estimated wrong phase." );
+  ASSERT_LESS( phase, 1.0, "Estimated wrong phase." );
+
+  ASSERT_NO_ERROR( MIDITimerReceiveRealTime( timer, NULL, MIDI_STATUS_STOP, t ), "Could not receive stop." );
+  ASSERT_NO_ERROR( MIDITimerIsRunning( timer, &running ), "Could not get running state." );
+  ASSERT_EQUAL( running, MIDI_OFF, "Did not stop." );
+  ASSERT_NO_ERROR( _feed( timer, &t, 48000.0 * 60 / ( 140 * 24 ), 480 ), "Could not receive clocks." );
+  ASSERT_NO_ERROR( MIDITimerGetTempo( timer, &bpm ), "Could not get tempo." );
+  ASSERT_NEAR( bpm, 140.0, "Did not follow tempo change." );
+  ASSERT_NO_ERROR( MIDITimerGetSongPosition( timer, &position ), "Could not get song position." );
+  ASSERT_EQUAL( position, 80, "Advanced song position while stopped." );
+
+  ASSERT_ERROR( MIDITimerReceiveRealTime( timer, NULL, MIDI_STATUS_ACTIVE_SENSING, t ), "Accepted active sensing." );
+  MIDIErrorNumber = 0;
+  MIDITimerRelease( timer );
+  return 0;
+}
+
+/**
+ * Test that the generator sends clocks on a fixed grid of deadlines.
+ */
+int test002_timer( void ) {
+  struct MIDIRunloop * runloop = MIDIRunloopCreate();
+  struct MIDIRunloopSource * source = MIDIRunloopSourceCreate( NULL );
+  struct MIDIDevice * device = MIDIDeviceCreate( NULL );
+  struct MIDITimer * timer = MIDITimerCreate( NULL );
+  struct MIDIPort * out, * port;
+  struct MIDIClock * clock;
+  MIDISamplingRate rate;
+  MIDILongValue position;
+  double interval, bpm;
+  int i, exact = 0;
+
+  ASSERT_NOT_EQUAL( timer, NULL, "Could not create timer." );
+  ASSERT_NO_ERROR( MIDIRunloopAddSource( runloop, source ), "Could not add source to runloop." );
+  ASSERT_NO_ERROR( MIDIDeviceGetOutputPort( device, &out ), "Could not get output port." );
+  port = MIDIPortCreate( "test port", MIDI_PORT_IN, &_clock_count, &_receive );
+  ASSERT_NO_ERROR( MIDIPortConnect( out, port ), "Could not connect ports." );
+
+  ASSERT_NO_ERROR( MIDITimerSetTempo( timer, 600 ), "Could not set tempo." );
+  ASSERT_NO_ERROR( MIDITimerGetTempo( timer, &bpm ), "Could not get tempo." );
+  ASSERT_EQUAL( bpm, 600, "Set wrong tempo." );
+  ASSERT_NO_ERROR( MIDITimerSendRealTime( timer, device, MIDI_STATUS_START, 0 ), "Could not send start." );
+  ASSERT_NO_ERROR( MIDITimerStartGenerator( timer, device, source ), "Could not start generator." );
+  ASSERT_ERROR( MIDITimerStartGenerator( timer, device, source ), "Started generator twice." );
+  MIDIErrorNumber = 0;
+
+  for( i=0; i<10000 && _clock_count < TIMER_TEST_CLOCKS; i++ ) {
+    ASSERT_NO_ERROR( MIDIRunloopStep( runloop ), "Could not step through runloop." );
+  }
+  ASSERT_NO_ERROR( MIDITimerStopGenerator( timer ), "Could not stop generator." );
+  ASSERT_EQUAL( _clock_count, TIMER_TEST_CLOCKS, "Sent wrong number of clocks." );
+  ASSERT_NO_ERROR( MIDITimerGetSongPosition( timer, &position ), "Could not get song position." );
+  ASSERT_EQUAL( position, TIMER_TEST_CLOCKS / MIDI_CLOCKS_PER_BEAT, "Counted wrong song position." );
+
+  MIDITimerGetClock( timer, &clock );
+  MIDIClockGetSamplingRate( clock, &rate );
+  interval = (double) rate * 60 / ( 600 * MIDI_CLOCKS_PER_QUARTER_NOTE );
+  for( i=1; i<TIMER_TEST_CLOCKS; i++ ) {
+    /* the generator only leaves the grid if the runloop was blocked */
+    ASSERT_GREATER_OR_EQUAL( _clock_timestamp[i] - _clock_timestamp[i-1], (MIDITimestamp) interval,
+                             "Sent clocks too early." );
+    if( _clock_timestamp[i] - _clock_timestamp[i-1] <= (MIDITimestamp) interval + 1 ) exact++;
+  }
+  ASSERT_GREATER( exact, TIMER_TEST_CLOCKS / 2, "Sent clocks off the grid." );
+
+  MIDITimerRelease( timer );
+  MIDIPortRelease( port );
+  MIDIDeviceRelease( device );
+  MIDIRunloopSourceRelease( source );
+  MIDIRunloopRelease( runloop );
+  return 0;
+}
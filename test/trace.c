@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <string.h>
+#include "test.h"
+#include "midi/driver.h"
+#include "midi/message.h"
+#include "midi/message_queue.h"
+#include "midi/trace.h"
+
+static char _text[8192];
+
+static int _read_back( FILE * file ) {
+  size_t length;
+  rewind( file );
+  length = fread( &(_text[0]), 1, sizeof(_text) - 1, file );
+  _text[length] = '\0';
+  return 0;
+}
+
+/**
+ * Test that sampled messages are stamped at every hop of the message
+ * path and that the hops are written as histograms and Chrome trace.
+ */
+int test001_trace( void ) {
+  struct MIDITrace * trace;
+  struct MIDITraceStats stats;
+  struct MIDITraceRecord records[4];
+  struct MIDIDriver * driver;
+  struct MIDIMessageQueue * queue;
+  struct MIDIMessage * message[2], * popped;
+  size_t count;
+  FILE * file;
+  int i, h;
+
+  trace = MIDITraceCreate( 4, 2 );
+  ASSERT_NOT_EQUAL( trace, NULL, "Could not create trace." );
+  ASSERT_NO_ERROR( MIDITraceSetCurrent( trace ), "Could not set current trace." );
+  driver = MIDIDriverCreate( "test driver", MIDI_SAMPLING_RATE_DEFAULT );
+  ASSERT_NO_ERROR( MIDIDriverMakeLoopback( driver ), "Could not make loopback driver." );
+  queue = MIDIMessageQueueCreateRing( 4 );
+
+  /* only every second message is sampled */
+  for( i=0; i<2; i++ ) {
+    message[i] = MIDIMessageCreate( MIDI_STATUS_NOTE_ON );
+    MIDITraceHop( message[i], MIDI_TRACE_INGRESS );
+    ASSERT_NO_ERROR( MIDIMessageQueuePush( queue, message[i] ), "Could not push message." );
+    ASSERT_NO_ERROR( MIDIMessageQueuePop( queue, &popped ), "Could not pop message." );
+    ASSERT_EQUAL( popped, message[i], "Popped another message." );
+    ASSERT_NO_ERROR( MIDIDriverSend( driver, message[i] ), "Could not send message." );
+    MIDIMessageRelease( popped );
+  }
+  ASSERT_NO_ERROR( MIDITraceGetStats( trace, &stats ), "Could not get stats." );
+  ASSERT_EQUAL( stats.sampled, 1, "Sampled the wrong number of messages." );
+  ASSERT_EQUAL( stats.completed, 0, "Completed a message that is still alive." );
+  MIDIMessageRelease( message[0] );
+  MIDIMessageRelease( message[1] );
+
+  ASSERT_NO_ERROR( MIDITraceGetStats( trace, &stats ), "Could not get stats." );
+  ASSERT_EQUAL( stats.completed, 1, "Did not complete the destroyed message." );
+  ASSERT_EQUAL( stats.hops[MIDI_TRACE_INGRESS].count, 0, "Counted latency of ingress." );
+  for( h=MIDI_TRACE_INGRESS+1; h<MIDI_TRACE_NUM_HOPS; h++ ) {
+    ASSERT_EQUAL( stats.hops[h].count, 1, "Hop was not stamped once." );
+  }
+  ASSERT_EQUAL( stats.total.count, 1, "Total latency was not counted." );
+  ASSERT_NO_ERROR( MIDITraceGetRecords( trace, 4, &(records[0]), &count ), "Could not get records." );
+  ASSERT_EQUAL( count, 1, "Kept the wrong number of records." );
+  ASSERT_EQUAL( records[0].status, MIDI_STATUS_NOTE_ON, "Record has the wrong status." );
+  for( h=MIDI_TRACE_INGRESS+1; h<MIDI_TRACE_NUM_HOPS; h++ ) {
+    ASSERT_GREATER_OR_EQUAL( records[0].stamps[h], records[0].stamps[MIDI_TRACE_INGRESS], "Hop was stamped before ingress." );
+  }
+  ASSERT_GREATER_OR_EQUAL( records[0].stamps[MIDI_TRACE_QUEUE_POP], records[0].stamps[MIDI_TRACE_QUEUE_PUSH],
+                          "Pop was stamped before push." );
+  ASSERT_GREATER_OR_EQUAL( records[0].stamps[MIDI_TRACE_SEND], records[0].stamps[MIDI_TRACE_PORT],
+                          "Send was stamped before the port." );
+
+  file = tmpfile();
+  ASSERT_NOT_EQUAL( file, NULL, "Could not create temporary file." );
+  ASSERT_NO_ERROR( MIDITraceWriteHistograms( trace, file ), "Could not write histograms." );
+  _read_back( file );
+  ASSERT_NOT_EQUAL( strstr( &(_text[0]), "# sampled 1 completed 1 skipped 0\n" ), NULL, "Histograms have no counters." );
+  ASSERT_NOT_EQUAL( strstr( &(_text[0]), "\nqueue_pop count 1 " ), NULL, "Histograms have no queue hop." );
+  ASSERT_NOT_EQUAL( strstr( &(_text[0]), "\ntotal count 1 " ), NULL, "Histograms have no total." );
+  fclose( file );
+
+  file = tmpfile();
+  ASSERT_NOT_EQUAL( file, NULL, "Could not create temporary file." );
+  ASSERT_NO_ERROR( MIDITraceWriteChromeTrace( trace, file ), "Could not write Chrome trace." );
+  _read_back( file );
+  ASSERT_EQUAL( strncmp( &(_text[0]), "{\"traceEvents\":[", 16 ), 0, "Chrome trace has no events." );
+  ASSERT_NOT_EQUAL( strstr( &(_text[0]), "\"args\":{\"status\":\"0x09\"}" ), NULL, "Chrome trace has no message." );
+  ASSERT_NOT_EQUAL( strstr( &(_text[0]), "{\"name\":\"send\"" ), NULL, "Chrome trace has no send hop." );
+  fclose( file );
+
+  ASSERT_NO_ERROR( MIDITraceReset( trace ), "Could not reset trace." );
+  ASSERT_NO_ERROR( MIDITraceGetRecords( trace, 4, &(records[0]), &count ), "Could not get records." );
+  ASSERT_EQUAL( count, 0, "Reset kept records." );
+
+  ASSERT_NO_ERROR( MIDITraceSetCurrent( NULL ), "Could not stop tracing." );
+  MIDIMessageQueueRelease( queue );
+  MIDIDriverRelease( driver );
+  MIDITraceRelease( trace );
+  return 0;
+}
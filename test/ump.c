@@ -0,0 +1,170 @@
+#include <string.h>
+#include "test.h"
+#include "midi/ump.h"
+#include "midi/message.h"
+
+static void _compact( struct MIDICompactMessage * compact, unsigned char status,
+                      unsigned char data1, unsigned char data2 ) {
+  memset( compact, 0, sizeof(struct MIDICompactMessage) );
+  compact->bytes[0] = status;
+  compact->bytes[1] = data1;
+  compact->bytes[2] = data2;
+}
+
+/**
+ * Test that MIDI 1.0 messages map to universal packets and back.
+ */
+int test001_ump( void ) {
+  struct MIDIUniversalPacket packet;
+  struct MIDICompactMessage compact, result;
+  size_t words;
+
+  ASSERT_EQUAL( sizeof(struct MIDIUniversalPacket), 16, "Packet has wrong size." );
+  _compact( &compact, 0x92, 60, 100 );
+  ASSERT_NO_ERROR( MIDIUniversalPacketFromCompact( &packet, 3, &compact, 0 ), "Could not make packet." );
+  ASSERT_EQUAL( packet.words[0], 0x23923c64, "Packet has wrong header." );
+  ASSERT_EQUAL( packet.words[1], 0, "Unused word was not cleared." );
+  ASSERT_EQUAL( MIDI_UMP_TYPE( &packet ), MIDI_UMP_TYPE_MIDI1_CHANNEL, "Packet has wrong type." );
+  ASSERT_EQUAL( MIDI_UMP_GROUP( &packet ), 3, "Packet has wrong group." );
+  ASSERT_NO_ERROR( MIDIUniversalPacketGetSize( &packet, &words ), "Could not get packet size." );
+  ASSERT_EQUAL( words, 1, "Packet has wrong size." );
+  ASSERT_NO_ERROR( MIDIUniversalPacketToCompact( &packet, &result ), "Could not make compact message." );
+  ASSERT_EQUAL( memcmp( &(result.bytes[0]), &(compact.bytes[0]), 3 ), 0, "Message changed in conversion." );
+
+  _compact( &compact, MIDI_STATUS_SONG_POSITION_POINTER, 1, 2 );
+  ASSERT_NO_ERROR( MIDIUniversalPacketFromCompact( &packet, 0, &compact, 1 ), "Could not make packet." );
+  ASSERT_EQUAL( packet.words[0], 0x10f20102, "System packet has wrong header." );
+  ASSERT_NO_ERROR( MIDIUniversalPacketToCompact( &packet, &result ), "Could not make compact message." );
+  ASSERT_EQUAL( memcmp( &(result.bytes[0]), &(compact.bytes[0]), 3 ), 0, "Message changed in conversion." );
+
+  _compact( &compact, MIDI_STATUS_TIMING_CLOCK, 0, 0 );
+  ASSERT_NO_ERROR( MIDIUniversalPacketFromCompact( &packet, 0, &compact, 1 ), "Could not make packet." );
+  ASSERT_EQUAL( packet.words[0], 0x10f80000, "System packet has wrong header." );
+
+  _compact( &compact, MIDI_STATUS_SYSTEM_EXCLUSIVE, 0, 0 );
+  ASSERT_NOT_EQUAL( MIDIUniversalPacketFromCompact( &packet, 0, &compact, 0 ), 0,
+                    "Made a packet from a system exclusive message." );
+  ASSERT_NO_ERROR( MIDIUniversalPacketSetTimestamp( &packet, 0, 0x1234 ), "Could not set timestamp." );
+  ASSERT_EQUAL( packet.words[0], 0x00201234, "Timestamp packet has wrong header." );
+  ASSERT_NOT_EQUAL( MIDIUniversalPacketToCompact( &packet, &result ), 0,
+                    "Made a compact message from a utility packet." );
+  return 0;
+}
+
+/**
+ * Test that MIDI 2.0 channel voice packets are scaled from and to
+ * MIDI 1.0 values.
+ */
+int test002_ump( void ) {
+  struct MIDIUniversalPacket packet;
+  struct MIDICompactMessage compact, result;
+  MIDIStatus status;
+  MIDIChannel channel;
+  unsigned char index;
+  uint32_t value;
+  int i;
+
+  _compact( &compact, 0x95, 60, 127 );
+  ASSERT_NO_ERROR( MIDIUniversalPacketFromCompact( &packet, 1, &compact, 1 ), "Could not make packet." );
+  ASSERT_EQUAL( packet.words[0], 0x41953c00, "Packet has wrong header." );
+  ASSERT_EQUAL( packet.words[1], 0xffff0000, "Maximum velocity was not scaled to the maximum." );
+  ASSERT_NO_ERROR( MIDIUniversalPacketGetChannelVoice( &packet, &status, &channel, &index, NULL, &value ),
+                   "Could not get channel voice fields." );
+  ASSERT_EQUAL( status, MIDI_STATUS_NOTE_ON, "Packet has wrong status." );
+  ASSERT_EQUAL( channel, 5, "Packet has wrong channel." );
+  ASSERT_EQUAL( index, 60, "Packet has wrong key." );
+
+  _compact( &compact, 0x90, 60, 64 );
+  MIDIUniversalPacketFromCompact( &packet, 0, &compact, 1 );
+  ASSERT_EQUAL( packet.words[1], 0x80000000, "Center velocity was not scaled to the center." );
+  _compact( &compact, 0x90, 60, 0 );
+  MIDIUniversalPacketFromCompact( &packet, 0, &compact, 1 );
+  ASSERT_EQUAL( ( packet.words[0] >> 20 ) & 0xf, MIDI_STATUS_NOTE_OFF, "Note on without velocity is no note off." );
+  _compact( &compact, 0xb0, 7, 127 );
+  MIDIUniversalPacketFromCompact( &packet, 0, &compact, 1 );
+  ASSERT_EQUAL( packet.words[1], 0xffffffff, "Maximum control value was not scaled to the maximum." );
+  _compact( &compact, 0xe0, 0, 0x40 );
+  MIDIUniversalPacketFromCompact( &packet, 0, &compact, 1 );
+  ASSERT_EQUAL( packet.words[1], 0x80000000, "Centered pitch wheel was not scaled to the center." );
+  _compact( &compact, 0xc3, 5, 0 );
+  MIDIUniversalPacketFromCompact( &packet, 0, &compact, 1 );
+  ASSERT_EQUAL( packet.words[1], 0x05000000, "Program was not stored in the data word." );
+
+  for( i=1; i<128; i++ ) {
+    _compact( &compact, 0x90, 60, i );
+    MIDIUniversalPacketFromCompact( &packet, 0, &compact, 1 );
+    ASSERT_NO_ERROR( MIDIUniversalPacketToCompact( &packet, &result ), "Could not make compact message." );
+    ASSERT_EQUAL( result.bytes[2], i, "Velocity changed in conversion." );
+  }
+  for( i=0; i<0x4000; i++ ) {
+    _compact( &compact, 0xe1, i & 0x7f, i >> 7 );
+    MIDIUniversalPacketFromCompact( &packet, 0, &compact, 1 );
+    ASSERT_NO_ERROR( MIDIUniversalPacketToCompact( &packet, &result ), "Could not make compact message." );
+    ASSERT_EQUAL( memcmp( &(result.bytes[0]), &(compact.bytes[0]), 3 ), 0, "Pitch changed in conversion." );
+  }
+
+  ASSERT_NO_ERROR( MIDIUniversalPacketSetChannelVoice( &packet, 0, MIDI_STATUS_NOTE_ON, 0, 60, 0, 0x00010000 ),
+                   "Could not set channel voice packet." );
+  ASSERT_NO_ERROR( MIDIUniversalPacketToCompact( &packet, &result ), "Could not make compact message." );
+  ASSERT_EQUAL( result.bytes[2], 1, "Quiet note on became a note off." );
+  ASSERT_NO_ERROR( MIDIUniversalPacketSetChannelVoice( &packet, 0, MIDI_UMP_STATUS_PER_NOTE_PITCH_BEND, 0, 60, 0, 0 ),
+                   "Could not set channel voice packet." );
+  ASSERT_NOT_EQUAL( MIDIUniversalPacketToCompact( &packet, &result ), 0,
+                    "Made a compact message from a per note pitch bend." );
+  return 0;
+}
+
+/**
+ * Test that packets are coded as big endian words and converted to
+ * and from message objects.
+ */
+int test003_ump( void ) {
+  struct MIDIUniversalPacket packets[3], decoded[3];
+  struct MIDIMessage * message;
+  unsigned char buffer[32];
+  MIDIKey key = 0;
+  MIDIVelocity velocity = 0;
+  size_t count, written, read;
+
+  memset( &(packets[0]), 0, sizeof(packets) );
+  MIDIUniversalPacketSetChannelVoice( &(packets[0]), 2, MIDI_STATUS_CONTROL_CHANGE, 1, 7, 0, 0x12345678 );
+  packets[1].words[0] = 0x10f80000;
+  packets[2].words[0] = 0x50010203;
+  packets[2].words[3] = 0xdeadbeef;
+
+  ASSERT_ERROR( MIDIUniversalPacketEncode( 10, &(buffer[0]), 3, &(packets[0]), &count, &written ),
+                "Encoded packets into a buffer that is too small." );
+  MIDIErrorNumber = 0;
+  ASSERT_EQUAL( count, 1, "Encoded wrong number of packets." );
+  ASSERT_EQUAL( written, 8, "Encoded wrong number of bytes." );
+  ASSERT_NO_ERROR( MIDIUniversalPacketEncode( sizeof(buffer), &(buffer[0]), 3, &(packets[0]), &count, &written ),
+                   "Could not encode packets." );
+  ASSERT_EQUAL( written, 28, "Encoded wrong number of bytes." );
+  ASSERT_EQUAL( buffer[0], 0x42, "Header is not big endian." );
+  ASSERT_EQUAL( buffer[7], 0x78, "Data word is not big endian." );
+  ASSERT_EQUAL( buffer[27], 0xef, "Last word is not big endian." );
+
+  ASSERT_NO_ERROR( MIDIUniversalPacketDecode( 27, &(buffer[0]), 3, &(decoded[0]), &count, &read ),
+                   "Could not decode packets." );
+  ASSERT_EQUAL( count, 2, "Decoded a truncated packet." );
+  ASSERT_EQUAL( read, 12, "Consumed bytes of a truncated packet." );
+  ASSERT_NO_ERROR( MIDIUniversalPacketDecode( written, &(buffer[0]), 3, &(decoded[0]), &count, &read ),
+                   "Could not decode packets." );
+  ASSERT_EQUAL( count, 3, "Decoded wrong number of packets." );
+  ASSERT_EQUAL( memcmp( &(decoded[0]), &(packets[0]), sizeof(packets) ), 0, "Packets changed in coding." );
+
+  message = MIDIMessageCreate( MIDI_STATUS_NOTE_ON );
+  ASSERT_NOT_EQUAL( message, NULL, "Could not create message." );
+  ASSERT_NO_ERROR( MIDIUniversalPacketSetChannelVoice( &(packets[0]), 0, MIDI_STATUS_NOTE_ON, 3, 64, 0, 0xffff0000 ),
+                   "Could not set channel voice packet." );
+  ASSERT_NO_ERROR( MIDIUniversalPacketToMessage( &(packets[0]), message ), "Could not set message from packet." );
+  MIDIMessageGet( message, MIDI_KEY, sizeof(MIDIKey), &key );
+  MIDIMessageGet( message, MIDI_VELOCITY, sizeof(MIDIVelocity), &velocity );
+  ASSERT_EQUAL( key, 64, "Message has wrong key." );
+  ASSERT_EQUAL( velocity, 127, "Message has wrong velocity." );
+  ASSERT_NO_ERROR( MIDIUniversalPacketFromMessage( &(decoded[0]), 0, message, 1 ), "Could not make packet from message." );
+  ASSERT_EQUAL( memcmp( &(decoded[0]), &(packets[0]), sizeof(struct MIDIUniversalPacket) ), 0,
+                "Packet changed in conversion." );
+  MIDIMessageRelease( message );
+  return 0;
+}